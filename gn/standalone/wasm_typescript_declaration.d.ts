@@ -64,5 +64,8 @@ declare namespace Wasm {
     printErr(s: string): void;
     onRuntimeInitialized(): void;
     onAbort?(): void;
+    // Only for modules built with threads.
+    wasmMemory?: WebAssembly.Memory;
+    mainScriptUrlOrBlob?: string;
   }
 }
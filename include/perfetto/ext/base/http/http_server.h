@@ -124,6 +124,10 @@ class HttpServerConnection {
 
   bool is_websocket() const { return is_websocket_; }
 
+  // Returns false if the socket's send buffer is full, i.e. the client is not
+  // keeping up and further sends would block. See UnixSocket::IsWritable().
+  bool IsWritable() const { return sock->IsWritable(); }
+
  private:
   friend class HttpServer;
 
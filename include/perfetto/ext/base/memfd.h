@@ -14,8 +14,8 @@
  * limitations under the License.
  */
 
-#ifndef SRC_TRACING_IPC_MEMFD_H_
-#define SRC_TRACING_IPC_MEMFD_H_
+#ifndef INCLUDE_PERFETTO_EXT_BASE_MEMFD_H_
+#define INCLUDE_PERFETTO_EXT_BASE_MEMFD_H_
 
 #include "perfetto/base/build_config.h"
 
@@ -41,6 +41,7 @@
 #endif
 
 namespace perfetto {
+namespace base {
 
 // Whether the operating system supports memfd.
 bool HasMemfdSupport();
@@ -48,8 +49,9 @@ bool HasMemfdSupport();
 // Call memfd(2) if available on platform and return the fd as result. This call
 // also makes a kernel version check for safety on older kernels (b/116769556).
 // Returns an invalid ScopedFile on failure.
-base::ScopedFile CreateMemfd(const char* name, unsigned int flags);
+ScopedFile CreateMemfd(const char* name, unsigned int flags);
 
+}  // namespace base
 }  // namespace perfetto
 
-#endif  // SRC_TRACING_IPC_MEMFD_H_
+#endif  // INCLUDE_PERFETTO_EXT_BASE_MEMFD_H_
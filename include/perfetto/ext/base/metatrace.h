@@ -21,6 +21,7 @@
 #include <atomic>
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/thread_utils.h"
@@ -31,15 +32,15 @@
 // A facility to trace execution of the perfetto codebase itself.
 // The meta-tracing framework is organized into three layers:
 //
-// 1. A static ring-buffer in base/ (this file) that supports concurrent writes
-//    and a single reader.
+// 1. A set of per-thread ring-buffers in base/ (this file), each with a single
+//    writer (its thread), and a single reader that merges them.
 //    The responsibility of this layer is to store events and counters as
-//    efficiently as possible without re-entering any tracing code.
-//    This is really a static-storage-based ring-buffer based on a POD array.
+//    efficiently as possible without re-entering any tracing code. Writers
+//    don't share any cache line, so they don't contend on atomic operations.
 //    This layer does NOT deal with serializing the meta-trace buffer.
-//    It posts a task when it's half full and expects something outside of
-//    base/ to drain the ring-buffer and serialize it, eventually writing it
-//    into the trace itself, before it gets 100% full.
+//    It posts a task when one ring is half full and expects something outside
+//    of base/ to drain the rings and serialize them, eventually writing them
+//    into the trace itself, before they get 100% full.
 //
 // 2. A class in tracing/core which takes care of serializing the meta-trace
 //    buffer into the trace using a TraceWriter. See metatrace_writer.h .
@@ -47,7 +48,8 @@
 // 3. A data source in traced_probes that, when be enabled via the trace config,
 //    injects metatrace events into the trace. See metatrace_data_source.h .
 //
-// The available events and tags are defined in metatrace_events.h .
+// The available events and tags are defined in metatrace_events.h . More tags
+// can be registered at runtime with RegisterTag().
 
 namespace perfetto {
 
@@ -80,6 +82,25 @@ bool Enable(std::function<void()> read_task, base::TaskRunner*, uint32_t tags);
 // Must be called on the same |task_runner| as Enable().
 void Disable();
 
+// Tags registered at runtime take the bits from kFirstDynamicTagBit onwards.
+// The static Tags in metatrace_events.h must stay below it.
+constexpr uint32_t kFirstDynamicTagBit = 16;
+constexpr uint32_t kMaxDynamicTags = 32 - kFirstDynamicTagBit;
+
+// Registers a tag category named |name| for a sub-system that is not covered
+// by the static Tags in metatrace_events.h and returns its bit, to be passed
+// to Enable(), IsEnabled(), TraceCounter() and ScopedEvent. Registering the
+// same name again returns the same bit. Returns TAG_NONE, which is never
+// enabled, once all the kMaxDynamicTags bits are taken.
+// |name| must have static lifetime (e.g. a string literal). Thread-safe.
+uint32_t RegisterTag(const char* name);
+
+// Returns the name of a single static or registered tag, or nullptr.
+const char* GetTagName(uint32_t tag);
+
+// Returns the tag bit with the given name, static or registered, or TAG_NONE.
+uint32_t LookupTag(const std::string& name);
+
 inline uint64_t TraceTimeNowNs() {
   return static_cast<uint64_t>(base::GetBootTimeNs().count());
 }
@@ -143,88 +164,69 @@ struct Record {
   };
 };
 
-// Hold the meta-tracing data into a statically allocated array.
-// This class uses static storage (as opposite to being a singleton) to:
+// Holds the meta-tracing data in one ring buffer per thread, merged by
+// timestamp when read. This class has only static members (as opposite to
+// being a singleton) to:
 // - Have the guarantee of always valid storage, so that meta-tracing can be
 //   safely used in any part of the codebase, including base/ itself.
 // - Avoid barriers that thread-safe static locals would require.
+// The ring of a thread is allocated on its first write and is never freed.
+// When the thread exits, the ring is handed to the next thread that needs
+// one, so the memory is bounded by the number of concurrently tracing threads.
 class RingBuffer {
  public:
-  static constexpr size_t kCapacity = 4096;  // 4096 * 16 bytes = 64K.
+  static constexpr size_t kCapacity = 4096;  // Per thread, 4096 * 16 = 64K.
 
-  // This iterator is not idempotent and will bump the read index in the buffer
+  class ThreadRing;
+
+  // This iterator is not idempotent and will bump the read index of the rings
   // at the end of the reads. There can be only one reader at any time.
+  // It yields the records of all the rings in timestamp order, stopping each
+  // ring at its first record not fully written yet. A record completed after
+  // the iterator moved past its timestamp is returned by the next iterator.
   // Usage: for (auto it = RingBuffer::GetReadIterator(); it; ++it) { it->... }
   class ReadIterator {
    public:
-    ReadIterator(ReadIterator&& other) {
-      PERFETTO_DCHECK(other.valid_);
-      cur_ = other.cur_;
-      end_ = other.end_;
-      valid_ = other.valid_;
-      other.valid_ = false;
-    }
-
-    ~ReadIterator() {
-      if (!valid_)
-        return;
-      PERFETTO_DCHECK(cur_ >= RingBuffer::rd_index_);
-      PERFETTO_DCHECK(cur_ <= RingBuffer::wr_index_);
-      RingBuffer::rd_index_.store(cur_, std::memory_order_release);
-    }
-
-    explicit operator bool() const { return cur_ < end_; }
-    const Record* operator->() const { return RingBuffer::At(cur_); }
+    ReadIterator(ReadIterator&& other) noexcept;
+    ~ReadIterator();
+
+    explicit operator bool() const { return cur_ < cursors_.size(); }
+    const Record* operator->() const { return cursors_[cur_].record; }
     const Record& operator*() const { return *operator->(); }
 
     // This is for ++it. it++ is deliberately not supported.
-    ReadIterator& operator++() {
-      PERFETTO_DCHECK(cur_ < end_);
-      // Once a record has been read, mark it as free clearing its type_and_id,
-      // so if we encounter it in another read iteration while being written
-      // we know it's not fully written yet.
-      // The memory_order_relaxed below is enough because:
-      // - The reader is single-threaded and doesn't re-read the same records.
-      // - Before starting a read batch, the reader has an acquire barrier on
-      //   |rd_index_|.
-      // - After terminating a read batch, the ~ReadIterator dtor updates the
-      //   |rd_index_| with a release-store.
-      // - Reader and writer are typically kCapacity/2 apart. So unless an
-      //   overrun happens a writer won't reuse a newly released record any time
-      //   soon. If an overrun happens, everything is busted regardless.
-      At(cur_)->type_and_id.store(0, std::memory_order_relaxed);
-      ++cur_;
-      return *this;
-    }
+    ReadIterator& operator++();
 
    private:
     friend class RingBuffer;
-    ReadIterator(uint64_t begin, uint64_t end)
-        : cur_(begin), end_(end), valid_(true) {}
+
+    struct Cursor {
+      ThreadRing* ring;
+      uint64_t index;
+      uint64_t end;
+      const Record* record;  // The record at |index| or nullptr if none.
+    };
+
+    ReadIterator();
     ReadIterator& operator=(const ReadIterator&) = delete;
     ReadIterator(const ReadIterator&) = delete;
 
-    uint64_t cur_;
-    uint64_t end_;
-    bool valid_;
-  };
+    // Points |cursor.record| to the record at |cursor.index|, if it's fully
+    // written, and |cur_| to the cursor with the earliest record.
+    void LoadRecord(Cursor*);
+    void SelectEarliest();
 
-  static Record* At(uint64_t index) {
-    // Doesn't really have to be pow2, but if not the compiler will emit
-    // arithmetic operations to compute the modulo instead of a bitwise AND.
-    static_assert(!(kCapacity & (kCapacity - 1)), "kCapacity must be pow2");
-    PERFETTO_DCHECK(index >= rd_index_);
-    PERFETTO_DCHECK(index <= wr_index_);
-    return &records_[index % kCapacity];
-  }
+    std::vector<Cursor> cursors_;
+    size_t cur_ = 0;  // Index in |cursors_|, == size() when done.
+    bool valid_ = false;
+  };
 
   // Must be called on the same task runner passed to Enable()
-  static ReadIterator GetReadIterator() {
-    PERFETTO_DCHECK(RingBuffer::IsOnValidTaskRunner());
-    return ReadIterator(rd_index_.load(std::memory_order_acquire),
-                        wr_index_.load(std::memory_order_acquire));
-  }
+  static ReadIterator GetReadIterator();
 
+  // Returns the next record of the calling thread's ring, with |thread_id|
+  // already set. The caller fills the other fields and then publishes it with
+  // a release-store on |type_and_id|.
   static Record* AppendNewRecord();
   static void Reset();
 
@@ -232,15 +234,8 @@ class RingBuffer {
     return has_overruns_.load(std::memory_order_acquire);
   }
 
-  // Can temporarily return a value >= kCapacity but is eventually consistent.
-  // This would happen in case of overruns until threads hit the --wr_index_
-  // in AppendNewRecord().
-  static uint64_t GetSizeForTesting() {
-    auto wr_index = wr_index_.load(std::memory_order_relaxed);
-    auto rd_index = rd_index_.load(std::memory_order_relaxed);
-    PERFETTO_DCHECK(wr_index >= rd_index);
-    return wr_index - rd_index;
-  }
+  // Returns the number of records not read yet, summed over all the rings.
+  static uint64_t GetSizeForTesting();
 
  private:
   friend class ReadIterator;
@@ -249,10 +244,14 @@ class RingBuffer {
   // Used only for DCHECKs.
   static bool IsOnValidTaskRunner();
 
-  static std::array<Record, kCapacity> records_;
+  // Returns the ring of the calling thread, acquiring one the first time.
+  static ThreadRing* GetThreadRing();
+
+  // Slow-path of AppendNewRecord() when |ring| is at least half full.
+  static Record* AppendNewRecordSlow(ThreadRing* ring);
+
+  static std::atomic<ThreadRing*> rings_;  // Linked list of all the rings.
   static std::atomic<bool> read_task_queued_;
-  static std::atomic<uint64_t> wr_index_;
-  static std::atomic<uint64_t> rd_index_;
   static std::atomic<bool> has_overruns_;
   static Record bankruptcy_record_;  // Used in case of overruns.
 };
@@ -264,7 +263,6 @@ inline void TraceCounter(uint32_t tag, uint16_t id, int32_t value) {
   if (PERFETTO_LIKELY((enabled_tags & tag) == 0))
     return;
   Record* record = RingBuffer::AppendNewRecord();
-  record->thread_id = static_cast<uint32_t>(base::GetThreadId());
   record->set_timestamp(TraceTimeNowNs());
   record->counter_value = value;
   record->type_and_id.store(Record::kTypeCounter | id,
@@ -279,7 +277,6 @@ class ScopedEvent {
       return;
     event_id_ = event_id;
     record_ = RingBuffer::AppendNewRecord();
-    record_->thread_id = static_cast<uint32_t>(base::GetThreadId());
     record_->set_timestamp(TraceTimeNowNs());
   }
 
@@ -54,6 +54,32 @@ class PagedMemory {
     // reserved and the user should call EnsureCommitted() before writing to
     // memory addresses.
     kDontCommit = 1 << 1,
+
+    // Requests transparent huge pages (THP) on Linux and Android: the memory
+    // is aligned to the huge page size and madvise()d with MADV_HUGEPAGE, so
+    // that the kernel can back it with huge pages and save TLB misses. This is
+    // best effort (THP may be disabled, or memory too fragmented); see
+    // huge_pages() and GetHugePageBytes() for what was obtained. Ignored on
+    // other platforms.
+    kHugePages = 1 << 2,
+
+    // Like kHugePages, but first tries to map the memory from the hugetlbfs
+    // pool (MAP_HUGETLB), which must have been reserved beforehand (e.g. via
+    // vm.nr_hugepages). Falls back to kHugePages if the pool is too small.
+    // Pool pages can only be discarded whole, so AdviseDontNeed() is a no-op
+    // for them.
+    kHugeTlb = 1 << 3,
+  };
+
+  // What the memory got for the kHugePages and kHugeTlb flags.
+  enum class HugePages {
+    // Regular pages: no flag, unsupported platform or madvise() failure.
+    kNone,
+    // MADV_HUGEPAGE was applied. The kernel backs the memory with huge pages
+    // when it can.
+    kTransparent,
+    // The memory is mapped from the hugetlbfs pool.
+    kHugeTlb,
   };
 
   // Allocates |size| bytes using mmap(MAP_ANONYMOUS). The returned memory is
@@ -61,6 +87,17 @@ class PagedMemory {
   // For |flags|, see the AllocationFlags enum above.
   static PagedMemory Allocate(size_t size, int flags = 0);
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // Like Allocate(), but the memory is a shared mapping of the file |fd|
+  // rather than anonymous memory: the page cache, rather than the process,
+  // holds the pages and can write them back to the file and evict them under
+  // memory pressure. The file is truncated and then extended (sparsely) to
+  // |size| bytes, so that the memory is zeroed. Returns an invalid
+  // PagedMemory, regardless of |flags|, if the file can't be resized or
+  // mapped. |fd| can be closed afterwards.
+  static PagedMemory AllocateFileBacked(int fd, size_t size, int flags = 0);
+#endif
+
   // Hint to the OS that the memory range is not needed and can be discarded.
   // The memory remains accessible and its contents may be retained, or they
   // may be zeroed. This function may be a NOP on some platforms. Returns true
@@ -76,13 +113,22 @@ class PagedMemory {
   void EnsureCommitted(size_t /*committed_size*/) {}
 #endif  // TRACK_COMMITTED_SIZE()
 
+  // Returns the number of bytes of the memory currently backed by huge pages,
+  // as reported by /proc/self/smaps. Returns 0 on platforms other than Linux
+  // and Android.
+  size_t GetHugePageBytes() const;
+
   inline void* Get() const noexcept { return p_; }
   inline bool IsValid() const noexcept { return !!p_; }
   inline size_t size() const noexcept { return size_; }
+  inline HugePages huge_pages() const noexcept { return huge_pages_; }
 
  private:
   PagedMemory(char* p, size_t size);
 
+  // The size of the mapping between the guard pages.
+  size_t MappedSize() const;
+
   PagedMemory(const PagedMemory&) = delete;
   // Defaulted for implementation of move constructor + assignment.
   PagedMemory& operator=(const PagedMemory&) = default;
@@ -94,6 +140,8 @@ class PagedMemory {
   // the system page size.
   size_t size_ = 0;
 
+  HugePages huge_pages_ = HugePages::kNone;
+
 #if TRACK_COMMITTED_SIZE()
   size_t committed_size_ = 0u;
 #endif  // TRACK_COMMITTED_SIZE()
@@ -168,6 +168,26 @@ inline bool operator!=(const StringView& x, const StringView& y) {
   return !(x == y);
 }
 
+// Allow comparing with the std::string keys of a map when looking up a
+// StringView (see StringViewHash).
+inline bool operator==(const std::string& x, const StringView& y) {
+  return StringView(x) == y;
+}
+
+inline bool operator==(const StringView& x, const std::string& y) {
+  return x == StringView(y);
+}
+
+// Without these, comparing with a string literal would be ambiguous between
+// the two overloads above.
+inline bool operator==(const StringView& x, const char* y) {
+  return x == StringView(y);
+}
+
+inline bool operator==(const char* x, const StringView& y) {
+  return StringView(x) == y;
+}
+
 inline bool operator<(const StringView& x, const StringView& y) {
   auto size = std::min(x.size(), y.size());
   if (size == 0)
@@ -188,6 +208,20 @@ inline bool operator<=(const StringView& x, const StringView& y) {
   return !(y < x);
 }
 
+// Transparent hasher for the FlatHashMap(s) keyed by std::string. Hashes a
+// std::string and the equal StringView to the same value, so that they can be
+// looked up by StringView without constructing a std::string.
+struct StringViewHash {
+  using is_transparent = void;
+
+  size_t operator()(const StringView& sv) const {
+    return static_cast<size_t>(sv.Hash());
+  }
+  size_t operator()(const std::string& str) const {
+    return static_cast<size_t>(StringView(str).Hash());
+  }
+};
+
 }  // namespace base
 }  // namespace perfetto
 
@@ -17,12 +17,21 @@
 #ifndef INCLUDE_PERFETTO_EXT_BASE_THREADING_THREAD_POOL_H_
 #define INCLUDE_PERFETTO_EXT_BASE_THREADING_THREAD_POOL_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <functional>
-#include <list>
+#include <memory>
 #include <mutex>
+#include <new>
 #include <optional>
 #include <thread>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/task_runner.h"
@@ -30,46 +39,164 @@
 namespace perfetto {
 namespace base {
 
-// Bounded thread pool designed for CPU-bound tasks.
+// Bounded work-stealing thread pool designed for CPU-bound tasks.
 //
-// This is a classic bounded thread pool designed for running jobs which fully
-// occupy the CPU without blocking. IO bound tasks which block for long periods
-// of times will cause starvation for any other tasks which are waiting.
-// IO-heavy tasks should use base::TaskRunner and async-IO instead of using this
-// class.
+// This is a bounded thread pool designed for running jobs which fully occupy
+// the CPU without blocking. IO bound tasks which block for long periods of
+// times will cause starvation for any other tasks which are waiting. IO-heavy
+// tasks should use base::TaskRunner and async-IO instead of using this class.
 //
 // Threads are created when the thread pool is created and persist for the
 // lifetime of the ThreadPool. No new threads are created after construction.
 // When the ThreadPool is destroyed, any active tasks are completed and every
 // thread joined before returning from the destructor.
 //
-// Tasks are executed in a FIFO order without any notion of priority. If a
-// thread in the pool is free, it will be used to execute the task immediately.
-// Otherwise, it will be queued for execution when any thread becomes available.
+// Each thread has its own task deque. Tasks posted from outside the pool go
+// to a shared queue and are executed in FIFO order. Tasks posted by a task of
+// the pool (e.g. by ParallelFor()) go to the deque of its thread, which runs
+// them in LIFO order for cache locality, while idle threads steal them from
+// the other end. Tasks are stored inline when small enough, so posting a task
+// doesn't allocate in the common case.
 class ThreadPool {
  public:
-  // Initializes this thread_pool |thread_count| threads.
+  // A move-only void() callable which stores callables of up to
+  // |kInlineSize| bytes inline rather than on the heap.
+  class Task {
+   public:
+    static constexpr size_t kInlineSize = 6 * sizeof(void*);
+
+    Task() = default;
+
+    template <typename Fn,
+              typename = std::enable_if_t<
+                  !std::is_same<std::decay_t<Fn>, Task>::value>>
+    Task(Fn&& fn) {  // NOLINT(google-explicit-constructor)
+      using F = std::decay_t<Fn>;
+      if constexpr (sizeof(F) <= kInlineSize &&
+                    alignof(F) <= alignof(std::max_align_t) &&
+                    std::is_nothrow_move_constructible<F>::value) {
+        new (storage_) F(std::forward<Fn>(fn));
+        ops_ = &kInlineOps<F>;
+      } else {
+        new (storage_) F*(new F(std::forward<Fn>(fn)));
+        ops_ = &kHeapOps<F>;
+      }
+    }
+
+    Task(Task&& other) noexcept { MoveFrom(&other); }
+    Task& operator=(Task&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        MoveFrom(&other);
+      }
+      return *this;
+    }
+    ~Task() { Reset(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+    void operator()() { ops_->run(storage_); }
+
+   private:
+    struct Ops {
+      void (*run)(void*);
+      // Move-constructs the callable at |dst| from the one at |src| and
+      // destroys the latter.
+      void (*relocate)(void* dst, void* src);
+      void (*destroy)(void*);
+    };
+
+    template <typename F>
+    static constexpr Ops kInlineOps = {
+        [](void* s) { (*static_cast<F*>(s))(); },
+        [](void* dst, void* src) {
+          new (dst) F(std::move(*static_cast<F*>(src)));
+          static_cast<F*>(src)->~F();
+        },
+        [](void* s) { static_cast<F*>(s)->~F(); },
+    };
+
+    template <typename F>
+    static constexpr Ops kHeapOps = {
+        [](void* s) { (**static_cast<F**>(s))(); },
+        [](void* dst, void* src) { new (dst) F*(*static_cast<F**>(src)); },
+        [](void* s) { delete *static_cast<F**>(s); },
+    };
+
+    void MoveFrom(Task* other) {
+      ops_ = other->ops_;
+      if (ops_)
+        ops_->relocate(storage_, other->storage_);
+      other->ops_ = nullptr;
+    }
+
+    void Reset() {
+      if (ops_)
+        ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
+  };
+
+  // Initializes this thread_pool |thread_count| threads. On WebAssembly builds
+  // with threads, all the pools share a fixed number of threads, so a pool
+  // can get fewer threads (but at least one) if others are alive.
   explicit ThreadPool(uint32_t thread_count);
   ~ThreadPool();
 
   // Submits a task for execution by any thread in this thread pool.
   //
   // This task should not block for IO as this can cause starvation.
-  void PostTask(std::function<void()>);
+  void PostTask(Task);
+
+  // Runs |fn(0)|, ..., |fn(count - 1)| on the threads of this pool and on the
+  // calling thread, and returns when all of them have run. Can be called by a
+  // task of this pool: while waiting, the calling thread runs the pending
+  // tasks of the pool rather than blocking, so nested calls can't deadlock.
+  void ParallelFor(size_t count, const std::function<void(size_t)>& fn);
+
+  // Returns the number of threads, including the calling one, which can
+  // usefully run CPU-bound tasks at the same time. This is always 1 on
+  // WebAssembly builds without threads and is capped on WebAssembly builds
+  // with threads, whose threads come from a fixed pool of Web Workers.
+  static uint32_t MaxConcurrency();
 
  private:
-  void RunThreadLoop();
+  struct Worker {
+    size_t index = 0;
+    std::mutex mutex;
+    std::deque<Task> tasks;  // Guarded by |mutex|.
+  };
+
+  void RunThreadLoop(size_t worker_index);
+
+  // Pops a task of the pool, in order: from the deque of |self| (if not
+  // null), from the shared queue, from the deque of another thread.
+  Task PopTask(Worker* self);
+
+  // Pops and runs a task of the pool. Returns false if there was none.
+  bool RunPendingTask();
+
+  // Returns the worker of the calling thread if it's a thread of this pool.
+  Worker* CurrentWorker();
 
   ThreadPool(ThreadPool&&) = delete;
   ThreadPool& operator=(ThreadPool&&) = delete;
 
-  // Start of mutex protected members.
+  std::vector<std::unique_ptr<Worker>> workers_;
+
+  std::mutex shared_mutex_;
+  std::deque<Task> shared_tasks_;  // Guarded by |shared_mutex_|.
+
+  // Number of tasks queued in |shared_tasks_| and in the deques of |workers_|.
+  // Idle threads sleep only when it's zero.
+  std::atomic<int64_t> pending_count_{0};
+  std::atomic<uint32_t> sleeping_count_{0};
+
   std::mutex mutex_;
-  std::list<std::function<void()>> pending_tasks_;
-  std::condition_variable thread_waiter_;
-  uint32_t thread_waiting_count_ = 0;
-  bool quit_ = false;
-  // End of mutex protected members.
+  std::condition_variable thread_waiter_;  // Waited on with |mutex_| held.
+  std::atomic<bool> quit_{false};          // Set with |mutex_| held.
 
   std::vector<std::thread> threads_;
 };
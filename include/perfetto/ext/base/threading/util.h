@@ -204,6 +204,19 @@ Future<T> RunOnceOnThreadPool(ThreadPool* pool, std::function<T()> fn) {
       .Collect(base::ToFutureCheckedCollector<T>());
 }
 
+// Creates a Future<FVoid> which runs |fn(0)|, ..., |fn(count - 1)| on the
+// threads of |pool| (see ThreadPool::ParallelFor()) and completes when all of
+// them have run.
+inline Future<FVoid> ParallelForOnThreadPool(
+    ThreadPool* pool,
+    size_t count,
+    std::function<void(size_t)> fn) {
+  return RunOnceOnThreadPool<FVoid>(pool, [pool, count, fn = std::move(fn)]() {
+    pool->ParallelFor(count, fn);
+    return FVoid();
+  });
+}
+
 }  // namespace base
 }  // namespace perfetto
 
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_EXT_BASE_TIMER_WHEEL_H_
+#define INCLUDE_PERFETTO_EXT_BASE_TIMER_WHEEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <functional>
+#include <optional>
+#include <vector>
+
+#include "perfetto/base/time.h"
+
+namespace perfetto {
+namespace base {
+
+// Hierarchical timer wheel holding the delayed tasks of UnixTaskRunner.
+//
+// Level L has 64 slots of 64^L ms each. A task is placed at the level of the
+// highest 6-bit digit where its deadline differs from the current time, in the
+// slot indexed by that digit. When the current time reaches the start of a
+// slot, its tasks are re-placed at lower levels (cascaded), until they reach
+// level 0, whose slots hold the tasks of a single millisecond. Adding a task
+// and popping the next due one cost O(1) (amortized over the cascades),
+// regardless of the number of pending tasks.
+//
+// Tasks run in deadline order. Tasks with the same deadline run in the order
+// they were added. Not thread safe.
+class TimerWheel {
+ public:
+  using Task = std::function<void()>;
+
+  // |now| is the current time. Add()'s deadlines and PopDue()'s times must be
+  // in the same time base, e.g. GetWallTimeMs().
+  explicit TimerWheel(TimeMillis now);
+  ~TimerWheel();
+
+  TimerWheel(TimerWheel&&) noexcept;
+  TimerWheel& operator=(TimerWheel&&) noexcept;
+
+  // Adds |task| to run at |deadline|, which can be in the past.
+  void Add(TimeMillis deadline, Task task);
+
+  // Advances the current time to |now| (if later) and returns the task with
+  // the earliest deadline, if it is <= |now|. Otherwise returns an empty Task.
+  Task PopDue(TimeMillis now);
+
+  // Returns the earliest deadline of the pending tasks, if any.
+  std::optional<TimeMillis> NextDeadline() const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  static constexpr uint32_t kSlotBits = 6;
+  static constexpr uint32_t kNumSlots = 1u << kSlotBits;
+  static constexpr uint32_t kNumLevels = (64 + kSlotBits - 1) / kSlotBits;
+
+  struct Entry {
+    uint64_t deadline;
+    uint64_t seq;  // Keeps the tasks with the same deadline in FIFO order.
+    Task task;
+  };
+
+  struct Slot {
+    std::vector<Entry> entries;  // Sorted by |seq|.
+    uint64_t min_deadline = UINT64_MAX;
+  };
+
+  TimerWheel(const TimerWheel&) = delete;
+  TimerWheel& operator=(const TimerWheel&) = delete;
+
+  Slot& GetSlot(uint32_t level, uint32_t index) {
+    return slots_[level * kNumSlots + index];
+  }
+  const Slot& GetSlot(uint32_t level, uint32_t index) const {
+    return slots_[level * kNumSlots + index];
+  }
+
+  // Puts |entry| in its slot, or in |due_| if its deadline is <= |now_|.
+  void Place(Entry entry);
+
+  // Returns the time at which the earliest occupied slot starts, if any.
+  std::optional<uint64_t> NextSlotStart() const;
+
+  // Moves the current time to |now|, cascading the slots it goes through.
+  void AdvanceTo(uint64_t now);
+
+  uint64_t now_ = 0;
+  uint64_t next_seq_ = 0;
+  size_t size_ = 0;
+
+  // Bit i of |occupied_[L]| is set iff the slot i of level L has entries.
+  uint64_t occupied_[kNumLevels]{};
+
+  // kNumLevels * kNumSlots slots, level by level.
+  std::vector<Slot> slots_;
+
+  // The tasks whose deadline is <= |now_|, sorted by (deadline, seq).
+  std::deque<Entry> due_;
+};
+
+}  // namespace base
+}  // namespace perfetto
+
+#endif  // INCLUDE_PERFETTO_EXT_BASE_TIMER_WHEEL_H_
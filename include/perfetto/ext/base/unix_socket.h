@@ -101,6 +101,13 @@ inline bool SockShmemSupported(const char* addr) {
   return SockShmemSupported(GetSockFamily(addr));
 }
 
+// A buffer passed to the vectored SendV() methods below. Equivalent to a
+// struct iovec, which doesn't exist on Windows.
+struct SockSendBuffer {
+  const void* data;
+  size_t size;
+};
+
 // UnixSocketRaw is a basic wrapper around sockets. It exposes wrapper
 // methods that take care of most common pitfalls (e.g., marking fd as
 // O_CLOEXEC, avoiding SIGPIPE, properly handling partial writes). It is used as
@@ -133,6 +140,11 @@ class UnixSocketRaw {
   bool Connect(const std::string& socket_name);
   bool SetTxTimeout(uint32_t timeout_ms);
   bool SetRxTimeout(uint32_t timeout_ms);
+
+  // Returns true if the send buffer has room, i.e. a Send() of a moderate
+  // size would not block. Doesn't block.
+  bool IsWritable() const;
+
   void Shutdown();
   void SetBlocking(bool);
   void DcheckIsBlocking(bool expected) const;  // No-op on release and Win.
@@ -166,6 +178,16 @@ class UnixSocketRaw {
     return Send(str.data(), str.size());
   }
 
+  // Sends the concatenation of |bufs| with as few syscalls as possible (a
+  // single sendmsg() for up to kMaxSendBuffers buffers on POSIX). The files,
+  // if any, are sent with the first byte. Returns the number of bytes sent,
+  // which is less than the total size of |bufs| only on errors.
+  static constexpr size_t kMaxSendBuffers = 64;
+  ssize_t SendV(const SockSendBuffer* bufs,
+                size_t num_bufs,
+                const int* send_fds = nullptr,
+                size_t num_fds = 0);
+
   // |fd_vec| and |max_files| are ignored on Windows.
   ssize_t Receive(void* msg,
                   size_t len,
@@ -344,6 +366,10 @@ class PERFETTO_EXPORT_COMPONENT UnixSocket {
     PERFETTO_CHECK(sock_raw_.SetRxTimeout(timeout_ms));
   }
 
+  // See UnixSocketRaw::IsWritable(). Useful to apply backpressure before
+  // sending more data to a slow peer.
+  bool IsWritable() const { return sock_raw_ && sock_raw_.IsWritable(); }
+
   std::string GetSockAddr() const { return sock_raw_.GetSockAddr(); }
 
   // Returns true is the message was queued, false if there was no space in the
@@ -364,6 +390,14 @@ class PERFETTO_EXPORT_COMPONENT UnixSocket {
     return Send(msg.data(), msg.size(), -1);
   }
 
+  // Like Send(), for the concatenation of |bufs|, which is written with a
+  // single syscall in most cases (see UnixSocketRaw::SendV()). Useful to send
+  // several messages queued by the caller at once.
+  bool SendV(const SockSendBuffer* bufs,
+             size_t num_bufs,
+             const int* send_fds = nullptr,
+             size_t num_fds = 0);
+
   // Returns the number of bytes (<= |len|) written in |msg| or 0 if there
   // is no data in the buffer to read or an error occurs (in which case a
   // EventListener::OnDisconnect() will follow).
@@ -24,6 +24,7 @@
 #include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/thread_checker.h"
+#include "perfetto/ext/base/timer_wheel.h"
 
 #include <chrono>
 #include <deque>
@@ -31,7 +32,19 @@
 #include <mutex>
 #include <vector>
 
-#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+// On Linux and Android the watched fds are registered in an epoll instance as
+// they are added and removed, rather than being passed to poll(2) at every
+// iteration.
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#define PERFETTO_TASK_RUNNER_USES_EPOLL() 1
+#else
+#define PERFETTO_TASK_RUNNER_USES_EPOLL() 0
+#endif
+
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+#include <sys/epoll.h>
+#elif !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <poll.h>
 #endif
 
@@ -86,18 +99,29 @@ class UnixTaskRunner : public TaskRunner {
   void UpdateWatchTasksLocked();
   int GetDelayMsToNextTaskLocked() const;
   void RunImmediateAndDelayedTask();
-  void PostFileDescriptorWatches(uint64_t windows_wait_result);
+  void PostFileDescriptorWatches(uint64_t wait_result);
   void RunFileDescriptorWatch(PlatformHandle);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  void RecreateEpollIfForkedLocked();
+#endif
 
   ThreadChecker thread_checker_;
   PlatformThreadId created_thread_id_ = GetThreadId();
 
   EventFd event_;
 
-// The array of fds/handles passed to poll(2) / WaitForMultipleObjects().
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  // The watched fds are registered with EPOLLONESHOT (except |event_|), so
+  // that an fd isn't reported again until the task for its watch runs and
+  // re-arms it.
+  ScopedFile epoll_fd_;
+  uint32_t epoll_fork_generation_ = 0;  // See RecreateEpollIfForkedLocked().
+  std::vector<struct epoll_event> epoll_events_;
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  // The array of handles passed to WaitForMultipleObjects().
   std::vector<PlatformHandle> poll_fds_;
 #else
+  // The array of fds passed to poll(2).
   std::vector<struct pollfd> poll_fds_;
 #endif
 
@@ -106,12 +130,16 @@ class UnixTaskRunner : public TaskRunner {
   std::mutex lock_;
 
   std::deque<std::function<void()>> immediate_tasks_;
-  std::multimap<TimeMillis, std::function<void()>> delayed_tasks_;
+  TimerWheel delayed_tasks_{GetWallTimeMs()};
   bool quit_ = false;
 
   struct WatchTask {
     std::function<void()> callback;
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    // True if epoll doesn't support the fd (e.g. a regular file). Like
+    // poll(2) would, the fd is then treated as always readable.
+    bool always_ready = false;
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     // On UNIX systems we make the FD number negative in |poll_fds_| to avoid
     // polling it again until the queued task runs. On Windows we can't do that.
     // Instead we keep track of its state here.
@@ -18,6 +18,7 @@
 #define INCLUDE_PERFETTO_EXT_BASE_WATCHDOG_POSIX_H_
 
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/scoped_file.h"
 
 #include <atomic>
@@ -155,7 +156,7 @@ class Watchdog {
   // Check each type of resource every |polling_interval_ms_| miillis.
   // Returns true if the threshold is exceeded and the process should be killed.
   bool CheckMemory_Locked(uint64_t rss_bytes);
-  bool CheckCpu_Locked(uint64_t cpu_time);
+  bool CheckCpu_Locked(uint64_t cpu_time_us);
 
   void AddFatalTimer(TimerData);
   void RemoveFatalTimer(TimerData);
@@ -171,6 +172,10 @@ class Watchdog {
   std::thread thread_;
   ScopedPlatformHandle timer_fd_;
 
+  // Wakes up the thread when the limits change (the periodic checks stop
+  // while there are none) or when the watchdog is destroyed.
+  EventFd wakeup_event_;
+
   // --- Begin lock-protected members ---
 
   std::mutex mutex_;
@@ -179,7 +184,7 @@ class Watchdog {
   WindowedInterval memory_window_bytes_;
 
   uint32_t cpu_limit_percentage_ = 0;
-  WindowedInterval cpu_window_time_ticks_;
+  WindowedInterval cpu_window_time_us_;
 
   // Outstanding timers created via CreateFatalTimer() and not yet destroyed.
   // The vector is not sorted. In most cases there are only 1-2 timers, we can
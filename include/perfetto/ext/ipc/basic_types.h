@@ -21,6 +21,8 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+#include <string>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/cpp_message_obj.h"
 
@@ -49,6 +51,14 @@ constexpr size_t kIPCBufferSize = 128 * 1024;
 
 constexpr uid_t kInvalidUid = static_cast<uid_t>(-1);
 
+// Decompresses the payload of a compressed frame (see
+// IPCFrame.compressed_frames), appending the serialized frames it carries to
+// |frames|. Returns false if the payload is invalid or decompresses to more
+// than |max_size| bytes.
+using FrameDecompressorFn = bool (*)(const std::string& compressed,
+                                     size_t max_size,
+                                     std::string* frames);
+
 }  // namespace ipc
 }  // namespace perfetto
 
@@ -63,6 +63,10 @@ class Client {
     const char* socket_name = nullptr;
     bool retry = false;  // Only for connecting with |socket_name|.
     std::function<int(void)> receive_shmem_fd_cb_fuchsia;
+    // Frames larger than this are sent through a memfd passed over the
+    // socket, rather than through the socket itself, if the host supports
+    // it. 0 disables this.
+    size_t shmem_frame_threshold = 0;
   };
 
   static std::unique_ptr<Client> CreateInstance(ConnArgs, base::TaskRunner*);
@@ -41,13 +41,21 @@ class Host {
  public:
   // Creates an instance and starts listening on the given |socket_name|.
   // Returns nullptr if listening on the socket fails.
-  static std::unique_ptr<Host> CreateInstance(const char* socket_name,
-                                              base::TaskRunner*);
+  // The services are invoked on the given task runner, which is the one the
+  // Host must be used on. If |io_task_runner| is not null, the sockets are
+  // read and written, and the requests decoded, on its thread instead, which
+  // leaves only the invocation of the services to the former.
+  static std::unique_ptr<Host> CreateInstance(
+      const char* socket_name,
+      base::TaskRunner*,
+      base::TaskRunner* io_task_runner = nullptr);
 
   // Like the above but takes a file descriptor to a pre-bound unix socket.
   // Returns nullptr if listening on the socket fails.
-  static std::unique_ptr<Host> CreateInstance(base::ScopedSocketHandle,
-                                              base::TaskRunner*);
+  static std::unique_ptr<Host> CreateInstance(
+      base::ScopedSocketHandle,
+      base::TaskRunner*,
+      base::TaskRunner* io_task_runner = nullptr);
 
   // Creates a Host which is not backed by a POSIX listening socket.
   // Instead, it accepts sockets passed in via AdoptConnectedSocket_Fuchsia().
@@ -75,6 +83,16 @@ class Host {
 
   // Overrides the default send timeout for the per-connection sockets.
   virtual void SetSocketSendTimeoutMs(uint32_t timeout_ms) = 0;
+
+  // Sends the frames larger than |threshold_bytes| through a memfd passed
+  // over the socket, rather than through the socket itself, to the clients
+  // which support it. 0 (the default) disables this.
+  virtual void SetShmemFrameThreshold(size_t threshold_bytes) = 0;
+
+  // Decodes the compressed frames sent by the clients (e.g. traced_relay) with
+  // |decompressor|. Without one (the default), a client sending compressed
+  // frames is disconnected.
+  virtual void SetFrameDecompressor(FrameDecompressorFn decompressor) = 0;
 };
 
 }  // namespace ipc
@@ -88,6 +88,11 @@ namespace protozero {
 //
 // In the next ReadMessage() the R cursor will chase the W cursor. When this
 // happens (very frequent) we can just reset both cursors to 0 and restart.
+// Furthermore, when the buffer is empty, the complete messages passed to
+// Append() are not copied at all: ReadMessage() returns pointers into the
+// appended data and only the trailing incomplete message is buffered. Hence
+// the caller must keep the data passed to Append() alive until ReadMessage()
+// returns an invalid message.
 // If we are unlucky and get to the end of the buffer, two things happen:
 // 1. We try first to recompact the buffer, moving everything left by R.
 // 2. If still there isn't enough space, we expand the buffer.
@@ -112,7 +117,8 @@ class RingBufferMessageReader {
   RingBufferMessageReader& operator=(const RingBufferMessageReader&) = delete;
 
   // Appends data into the ring buffer, recompacting or resizing it if needed.
-  // Will invaildate the pointers previously handed out.
+  // Will invaildate the pointers previously handed out. |data| must stay valid
+  // until ReadMessage() returns an invalid message.
   void Append(const void* data, size_t len);
 
   // If a message can be read, it returns the boundaries of the message
@@ -132,7 +138,12 @@ class RingBufferMessageReader {
 
  private:
   perfetto::base::PagedMemory buf_;
-  Message fastpath_{};
+
+  // The complete messages of the last Append() that have not been read yet,
+  // when they were not copied into |buf_| (see the fastpath in Append()).
+  const uint8_t* ext_rd_ = nullptr;
+  const uint8_t* ext_end_ = nullptr;
+
   bool failed_ = false;  // Set in case of an unrecoverable framing faiulre.
   size_t rd_ = 0;        // Offset of the read cursor in |buf_|.
   size_t wr_ = 0;        // Offset of the write cursor in |buf_|.
@@ -51,10 +51,27 @@ class IteratorImpl;
 //   of a row).
 // The intended use case is streaaming these batches onto through a
 // chunked-encoded HTTP response, or through a repetition of Wasm calls.
+// Batches are produced only when Serialize() is called: a caller which pulls
+// the next batch only after the previous one has been drained by its
+// transport keeps the memory usage bounded to O(batch), regardless of the
+// size of the result.
 class QueryResultSerializer {
  public:
   static constexpr uint32_t kDefaultBatchSplitThreshold = 128 * 1024;
-  explicit QueryResultSerializer(Iterator);
+
+  // How the cells of each batch are laid out. See CellsBatch in
+  // trace_processor.proto for the details of each encoding.
+  enum class BatchEncoding {
+    // One type header per cell, cells are emitted row by row.
+    kRowMajor,
+    // One CellsBatch.Column per column, with a NULL bitmap and a typed
+    // payload array for each column.
+    kColumnar,
+  };
+
+  explicit QueryResultSerializer(
+      Iterator,
+      BatchEncoding encoding = BatchEncoding::kRowMajor);
   ~QueryResultSerializer();
 
   // No copy or move.
@@ -78,10 +95,17 @@ class QueryResultSerializer {
  private:
   void SerializeMetadata(protos::pbzero::QueryResult*);
   void SerializeBatch(protos::pbzero::QueryResult*);
+  void SerializeColumnarBatch(protos::pbzero::QueryResult*);
   void MaybeSerializeError(protos::pbzero::QueryResult*);
 
+  // Per-column scratch buffers used by SerializeColumnarBatch(). They are
+  // cleared, but not freed, between batches.
+  struct ColumnBuffer;
+
   std::unique_ptr<IteratorImpl> iter_;
   const uint32_t num_cols_;
+  const BatchEncoding encoding_;
+  std::vector<ColumnBuffer> column_buffers_;
   bool did_write_metadata_ = false;
   bool eof_reached_ = false;
   uint32_t col_ = UINT32_MAX;
@@ -142,6 +142,19 @@ class PERFETTO_EXPORT_COMPONENT SharedMemoryArbiter {
   // DataSourceDescriptor.will_notify_on_stop=true).
   virtual void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) = 0;
 
+  // Called to let the arbiter adapt the length of the batching period to the
+  // load. When enabled, the period starts at 0 and, at the end of each one, is
+  // sized so that the commits of a period fill a fraction of the SMB at the
+  // commit rate observed during the previous one. It is halved whenever the
+  // SMB fills up during a period (i.e. commits had to be sent early or
+  // writers stalled). The duration set by SetBatchCommitsDuration() is the
+  // upper bound of the period.
+  virtual void SetAdaptiveBatchCommits(bool enabled) = 0;
+
+  // Returns the length of the current batching period. It's the one set by
+  // SetBatchCommitsDuration(), unless adaptive batching is enabled.
+  virtual uint32_t GetBatchCommitsDuration() = 0;
+
   // Called to enable direct producer-side patching of chunks that have not yet
   // been committed to the service. The return value indicates whether direct
   // patching was successfully enabled. It will be true if
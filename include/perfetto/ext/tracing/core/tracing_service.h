@@ -21,6 +21,7 @@
 
 #include <functional>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "perfetto/base/export.h"
@@ -285,8 +286,38 @@ struct PERFETTO_EXPORT_COMPONENT TracingServiceInitOpts {
   using CompressorFn = void (*)(std::vector<TracePacket>*);
   CompressorFn compressor_fn = nullptr;
 
+  // Same as |compressor_fn|, for COMPRESSION_TYPE_ZSTD. When the trace is read
+  // over IPC, it is called on a dedicated thread: it must be thread-safe.
+  CompressorFn zstd_compressor_fn = nullptr;
+
+  // Whether the files of write_into_file sessions are written on a dedicated
+  // thread, so that slow storage doesn't stall the service thread.
+  bool write_into_file_on_dedicated_thread = false;
+
+  // Whether the IPC hosts created by ServiceIPCHost service their sockets on
+  // a dedicated thread: reading and writing the sockets and (de)serializing
+  // the IPC frames then happen off the service thread, which only runs the
+  // requests. See ipc::Host::CreateInstance().
+  bool ipc_on_dedicated_thread = false;
+
   // Whether the relay endpoint is enabled on producer transport(s).
   bool enable_relay_endpoint = false;
+
+  // Function used by the producer transport(s) to decompress the compressed
+  // frames sent by traced_relay (see IPCFrame.compressed_frames). When set,
+  // the relay endpoint tells traced_relay that compressed frames are accepted.
+  // Matches ipc::FrameDecompressorFn.
+  using FrameDecompressorFn = bool (*)(const std::string& compressed,
+                                       size_t max_size,
+                                       std::string* frames);
+  FrameDecompressorFn relay_frame_decompressor_fn = nullptr;
+
+  // Directory shared with the machines of the producers that connect through
+  // traced_relay, e.g. a mount of cross-VM shared memory. When set, these
+  // producers can create their SMB as a file in this directory, which the
+  // service maps instead of emulating the SMB over the socket. Only trusted
+  // producers must be able to write into it.
+  std::string relay_producer_shmem_dir;
 };
 
 // The API for the Relay port of the Service. Subclassed by the
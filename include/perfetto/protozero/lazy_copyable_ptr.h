@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INCLUDE_PERFETTO_PROTOZERO_LAZY_COPYABLE_PTR_H_
+#define INCLUDE_PERFETTO_PROTOZERO_LAZY_COPYABLE_PTR_H_
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/proto_decoder.h"
+
+namespace protozero {
+
+// Storage for nested message fields of the .gen.h classes generated with the
+// lazy_nested_messages plugin option. ParseFromArray() only copies the
+// serialized bytes of the nested message, which is decoded into T on first
+// access. If the field is never accessed, Serialize() writes back the bytes
+// as-is, without any decoding at all.
+//
+// Like CopyablePtr, the header only needs a forward declaration of T: the
+// methods that need the full definition are instantiated only by the .gen.cc.
+//
+// The const accessors modify the internal state, hence objects that use this
+// are not safe to access concurrently from different threads, even if all the
+// threads only read them.
+template <typename T>
+class LazyCopyablePtr {
+ public:
+  LazyCopyablePtr() = default;
+  ~LazyCopyablePtr() = default;
+
+  LazyCopyablePtr(const LazyCopyablePtr& other)
+      : ptr_(other.ptr_ ? new T(*other.ptr_) : nullptr), raw_(other.raw_) {}
+  LazyCopyablePtr& operator=(const LazyCopyablePtr& other) {
+    ptr_.reset(other.ptr_ ? new T(*other.ptr_) : nullptr);
+    raw_ = other.raw_;
+    return *this;
+  }
+
+  LazyCopyablePtr(LazyCopyablePtr&& other) noexcept
+      : ptr_(std::move(other.ptr_)), raw_(std::move(other.raw_)) {
+    other.raw_.clear();
+  }
+  LazyCopyablePtr& operator=(LazyCopyablePtr&& other) {
+    ptr_ = std::move(other.ptr_);
+    raw_ = std::move(other.raw_);
+    other.raw_.clear();
+    return *this;
+  }
+
+  // Called by ParseFromArray(). Defers the decoding of the nested message,
+  // unless it has been decoded already (e.g. the field is repeated on the
+  // wire). In that case the bytes are merged right away, as the non-lazy
+  // classes do.
+  void ParseLazily(const void* data, size_t size) {
+    if (!ptr_ && raw_.empty()) {
+      raw_.assign(static_cast<const char*>(data), size);
+      return;
+    }
+    get()->ParseFromArray(data, size);
+  }
+
+  // True if the message has been decoded (or modified) and raw() is stale.
+  bool is_decoded() const { return !!ptr_; }
+
+  // The serialized message. Valid only if !is_decoded().
+  const std::string& raw() const { return raw_; }
+
+  T* get() { return Decode(); }
+  const T* get() const { return Decode(); }
+
+  T* operator->() { return Decode(); }
+  const T* operator->() const { return Decode(); }
+
+  T& operator*() { return *Decode(); }
+  const T& operator*() const { return *Decode(); }
+
+  friend bool operator==(const LazyCopyablePtr& lhs,
+                         const LazyCopyablePtr& rhs) {
+    if (!lhs.ptr_ && !rhs.ptr_ && lhs.raw_ == rhs.raw_)
+      return true;
+    return *lhs == *rhs;
+  }
+
+  friend bool operator!=(const LazyCopyablePtr& lhs,
+                         const LazyCopyablePtr& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  T* Decode() const {
+    if (!ptr_) {
+      ptr_.reset(new T());
+      if (!raw_.empty()) {
+        ptr_->ParseFromArray(raw_.data(), raw_.size());
+        std::string().swap(raw_);
+      }
+    }
+    return ptr_.get();
+  }
+
+  mutable std::unique_ptr<T> ptr_;
+  mutable std::string raw_;
+};
+
+// The repeated field counterpart of LazyCopyablePtr. Keeps the serialized
+// fields (including their preamble) back to back in a single string until
+// the std::vector<T> is accessed. The same caveats apply.
+template <typename T>
+class LazyRepeatedPtr {
+ public:
+  LazyRepeatedPtr() = default;
+  ~LazyRepeatedPtr() = default;
+
+  LazyRepeatedPtr(const LazyRepeatedPtr&) = default;
+  LazyRepeatedPtr& operator=(const LazyRepeatedPtr&) = default;
+
+  LazyRepeatedPtr(LazyRepeatedPtr&& other) noexcept
+      : vec_(std::move(other.vec_)),
+        raw_(std::move(other.raw_)),
+        decoded_(other.decoded_) {
+    other.clear();
+  }
+  LazyRepeatedPtr& operator=(LazyRepeatedPtr&& other) {
+    vec_ = std::move(other.vec_);
+    raw_ = std::move(other.raw_);
+    decoded_ = other.decoded_;
+    other.clear();
+    return *this;
+  }
+
+  // Called by ParseFromArray() for each element of the repeated field.
+  void ParseLazily(const Field& field) {
+    if (!decoded_) {
+      field.SerializeAndAppendTo(&raw_);
+      return;
+    }
+    vec_.emplace_back();
+    vec_.back().ParseFromArray(field.data(), field.size());
+  }
+
+  void clear() {
+    vec_.clear();
+    raw_.clear();
+    decoded_ = false;
+  }
+
+  // True if the elements have been decoded (or modified) and raw() is stale.
+  bool is_decoded() const { return decoded_; }
+
+  // The serialized fields. Valid only if !is_decoded().
+  const std::string& raw() const { return raw_; }
+
+  std::vector<T>* get() { return Decode(); }
+  const std::vector<T>* get() const { return Decode(); }
+
+  std::vector<T>* operator->() { return Decode(); }
+  const std::vector<T>* operator->() const { return Decode(); }
+
+  std::vector<T>& operator*() { return *Decode(); }
+  const std::vector<T>& operator*() const { return *Decode(); }
+
+  friend bool operator==(const LazyRepeatedPtr& lhs,
+                         const LazyRepeatedPtr& rhs) {
+    if (!lhs.decoded_ && !rhs.decoded_ && lhs.raw_ == rhs.raw_)
+      return true;
+    return *lhs == *rhs;
+  }
+
+  friend bool operator!=(const LazyRepeatedPtr& lhs,
+                         const LazyRepeatedPtr& rhs) {
+    return !(lhs == rhs);
+  }
+
+ private:
+  std::vector<T>* Decode() const {
+    if (!decoded_) {
+      decoded_ = true;
+      ProtoDecoder dec(raw_.data(), raw_.size());
+      for (auto f = dec.ReadField(); f.valid(); f = dec.ReadField()) {
+        vec_.emplace_back();
+        vec_.back().ParseFromArray(f.data(), f.size());
+      }
+      std::string().swap(raw_);
+    }
+    return &vec_;
+  }
+
+  mutable std::vector<T> vec_;
+  mutable std::string raw_;
+  mutable bool decoded_ = false;
+};
+
+}  // namespace protozero
+
+#endif  // INCLUDE_PERFETTO_PROTOZERO_LAZY_COPYABLE_PTR_H_
@@ -188,6 +188,35 @@ class PERFETTO_EXPORT_COMPONENT Message {
     WriteToStream(src, src + size);
   }
 
+  // Append a single element of a packed repeated field, without any preamble.
+  // These are meant to be used only on the nested message that holds the
+  // payload of the packed field, see PackedVarIntWriter in
+  // packed_repeated_fields.h.
+  template <typename T>
+  void AppendRawVarInt(T value) {
+    PERFETTO_DCHECK(!is_finalized());
+    // Fast path: encode in place if the current chunk has room for the
+    // largest possible varint.
+    if (PERFETTO_LIKELY(stream_writer_->bytes_available() >=
+                        proto_utils::kMaxSimpleFieldEncodedSize)) {
+      uint8_t* begin = stream_writer_->write_ptr();
+      uint8_t* end = proto_utils::WriteVarInt(value, begin);
+      stream_writer_->set_write_ptr(end);
+      size_ += static_cast<uint32_t>(end - begin);
+      return;
+    }
+    uint8_t buffer[proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* pos = proto_utils::WriteVarInt(value, buffer);
+    WriteToStream(buffer, pos);
+  }
+
+  template <typename T>
+  void AppendRawFixed(T value) {
+    uint8_t buffer[sizeof(T)];
+    memcpy(buffer, &value, sizeof(T));
+    WriteToStream(buffer, buffer + sizeof(T));
+  }
+
  private:
   Message(const Message&) = delete;
   Message& operator=(const Message&) = delete;
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <forward_list>
+#include <iterator>
 #include <type_traits>
 
 #include "perfetto/base/export.h"
@@ -35,10 +36,22 @@ class Message;
 // usage pattern of protozero nested messages. It avoids hitting the system
 // allocator in most cases, by reusing the same block, and falls back on
 // allocating new blocks only when using deeply nested messages (which are
-// extremely rare).
+// extremely rare). Those extra blocks are recycled through a small per-thread
+// freelist, so that code which keeps nesting past the first block (e.g. deep
+// debug annotations) doesn't hit the allocator on every packet.
 // This is used by RootMessage<T> to handle the storage for root-level messages.
 class PERFETTO_EXPORT_COMPONENT MessageArena {
  public:
+  // Process-wide counters, mostly for benchmarks and diagnostics.
+  struct Stats {
+    // Number of times NewMessage() outgrew the current block.
+    uint64_t expansions = 0;
+    // Number of blocks obtained from the system allocator, rather than from
+    // the per-thread freelist.
+    uint64_t block_allocations = 0;
+  };
+  static Stats GetStats();
+
   MessageArena();
   ~MessageArena();
 
@@ -66,15 +79,32 @@ class PERFETTO_EXPORT_COMPONENT MessageArena {
   // but could happen if some client does some overly clever std::move() trick).
   void Reset() {
     PERFETTO_DCHECK(!blocks_.empty());
-    blocks_.resize(1);
+    if (PERFETTO_UNLIKELY(std::next(blocks_.cbegin()) != blocks_.cend()))
+      ReleaseExtraBlocks();
     auto& block = blocks_.front();
     block.entries = 0;
     PERFETTO_ASAN_POISON(block.storage, sizeof(block.storage));
   }
 
  private:
+  struct Block;
+
   void DeleteLastMessageInternal();
 
+  // Pushes a new block at the front of |blocks_|, taking it from the
+  // per-thread freelist if possible.
+  void PushBlock();
+
+  // Removes the front block from |blocks_|, returning it to the per-thread
+  // freelist if not full. The block must be empty.
+  void PopBlock();
+
+  // Pops all the blocks but the last one.
+  void ReleaseExtraBlocks();
+
+  // Returns the per-thread freelist, or nullptr if the thread is exiting.
+  static std::forward_list<Block>* GetThreadFreeBlocks(size_t** size);
+
   struct Block {
     static constexpr size_t kCapacity = 16;
 
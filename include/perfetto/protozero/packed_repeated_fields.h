@@ -24,6 +24,7 @@
 #include <type_traits>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/protozero/message.h"
 #include "perfetto/protozero/proto_utils.h"
 
 namespace protozero {
@@ -44,6 +45,19 @@ namespace protozero {
 //   buf.Append(-1);
 //   msg->set_fieldname(buf);
 //   msg.SerializeAsString();
+//
+// When the values are produced in one go, they can instead be encoded straight
+// into the message, without the intermediate copy, through one of:
+// * protozero::PackedVarIntWriter
+// * protozero::PackedFixedSizeIntWriter</*element_type=*/ uint32_t>
+// These are returned by the begin_fieldname() generated methods, e.g.:
+//   auto writer = msg->begin_fieldname();
+//   writer.Append(42);
+//   writer.Append(-1);
+//   msg->set_other_field(...);  // Ends the packed field.
+// The length of the field is backfilled when the packed field ends, like for
+// nested messages. Hence, as with nested messages, no other field of the
+// parent message can be set while a writer is in use.
 
 class PackedBufferBase {
  public:
@@ -110,6 +124,40 @@ class PackedFixedSizeInt : public PackedBufferBase {
   }
 };
 
+// Encodes the elements of a packed repeated field directly into the stream of
+// |msg|. The field ends when any other field of |msg| is set or when |msg| is
+// finalized. Appending further elements after that is not allowed.
+class PackedVarIntWriter {
+ public:
+  PackedVarIntWriter(Message* msg, uint32_t field_id)
+      : payload_(msg->BeginNestedMessage<Message>(field_id)) {}
+
+  template <typename T>
+  void Append(T value) {
+    payload_->AppendRawVarInt(value);
+  }
+
+ private:
+  Message* payload_;
+};
+
+template <typename T /* e.g. uint32_t for Fixed32 */>
+class PackedFixedSizeIntWriter {
+ public:
+  PackedFixedSizeIntWriter(Message* msg, uint32_t field_id)
+      : payload_(msg->BeginNestedMessage<Message>(field_id)) {}
+
+  void Append(T value) {
+    static_assert(sizeof(T) == 4 || sizeof(T) == 8,
+                  "PackedFixedSizeIntWriter should be used only with 32/64-bit "
+                  "ints");
+    payload_->AppendRawFixed(value);
+  }
+
+ private:
+  Message* payload_;
+};
+
 }  // namespace protozero
 
 #endif  // INCLUDE_PERFETTO_PROTOZERO_PACKED_REPEATED_FIELDS_H_
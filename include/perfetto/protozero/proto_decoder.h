@@ -371,8 +371,11 @@ class PERFETTO_EXPORT_COMPONENT TypedProtoDecoderBase : public ProtoDecoder {
                       std::is_trivially_destructible<Field>::value &&
                       std::is_trivial<Field>::value,
                   "Field must be a trivial aggregate type");
-    memset(fields_, 0, sizeof(Field) * capacity_);
+    // Only the slots for known field ids can be accessed randomly. The
+    // repeated slots are written linearly and initialized before |size_| is
+    // incremented, so they don't need to be zeroed.
     PERFETTO_DCHECK(capacity > 0);
+    memset(fields_, 0, sizeof(Field) * size_);
   }
 
   void ParseAllFields();
@@ -429,7 +432,7 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   TypedProtoDecoder(const uint8_t* buffer, size_t length)
       : TypedProtoDecoderBase(on_stack_storage_,
                               /*num_fields=*/MAX_FIELD_ID + 1,
-                              PROTOZERO_DECODER_INITIAL_STACK_CAPACITY,
+                              kStackCapacity,
                               buffer,
                               length) {
     TypedProtoDecoderBase::ParseAllFields();
@@ -438,11 +441,11 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   template <uint32_t FIELD_ID>
   const Field& at() const {
     static_assert(FIELD_ID <= MAX_FIELD_ID, "FIELD_ID > MAX_FIELD_ID");
-    // If the field id is < the on-stack capacity, it's safe to always
+    // If the field id is < the initial |size_|, it's safe to always
     // dereference |fields_|, whether it's still using the stack or it fell
     // back on the heap. Because both terms of the if () are known at compile
-    // time, the compiler elides the branch for ids < INITIAL_STACK_CAPACITY.
-    if (FIELD_ID < PROTOZERO_DECODER_INITIAL_STACK_CAPACITY) {
+    // time, the compiler elides the branch for ids < kStackCapacity - 1.
+    if (FIELD_ID < kStackCapacity - 1) {
       return fields_[FIELD_ID];
     } else {
       // Otherwise use the slowpath Get() which will do a runtime check.
@@ -462,7 +465,17 @@ class TypedProtoDecoder : public TypedProtoDecoderBase {
   }
 
  private:
-  Field on_stack_storage_[PROTOZERO_DECODER_INITIAL_STACK_CAPACITY];
+  // Messages without non-packed repeated fields never need more than one slot
+  // per field id (plus one for the rare case of a duplicated field), so they
+  // can use a smaller stack frame. See the comment in the
+  // TypedProtoDecoderBase constructor about the "- 1".
+  static constexpr uint32_t kStackCapacity =
+      !HAS_NONPACKED_REPEATED_FIELDS &&
+              MAX_FIELD_ID + 2 < PROTOZERO_DECODER_INITIAL_STACK_CAPACITY
+          ? MAX_FIELD_ID + 2
+          : PROTOZERO_DECODER_INITIAL_STACK_CAPACITY;
+
+  Field on_stack_storage_[kStackCapacity];
 };
 
 }  // namespace protozero
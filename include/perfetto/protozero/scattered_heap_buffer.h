@@ -60,6 +60,9 @@ class PERFETTO_EXPORT_COMPONENT ScatteredHeapBuffer
     void Clear();
 
    private:
+    // Returns |buffer_| to the per-thread pool of slice buffers.
+    void ReleaseBuffer();
+
     std::unique_ptr<uint8_t[]> buffer_;
     size_t size_;
     size_t unused_bytes_;
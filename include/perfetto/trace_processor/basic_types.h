@@ -142,6 +142,18 @@ struct PERFETTO_EXPORT_COMPONENT Config {
   // unaffected by this flag.
   bool ingest_ftrace_in_raw_table = true;
 
+  // When set to true (and |ingest_ftrace_in_raw_table| is also true), typed
+  // ftrace events are still added to the raw table while parsing but their
+  // fields are only decoded into the args table by the first query which reads
+  // the raw, ftrace_event or args tables. Until then, only the slices of the
+  // trace holding these events are kept in memory. This saves most of the
+  // memory used by these args for traces which are never queried for them, at
+  // the cost of a one-off delay for the first query which is.
+  //
+  // Note: events whose fields refer to kernel symbols are always decoded while
+  // parsing.
+  bool lazy_ftrace_raw_args = false;
+
   // Indicates the event which should be used as a marker to drop ftrace data in
   // the trace before that event. See the enum documentation for more details.
   DropFtraceDataBefore drop_ftrace_data_before =
@@ -180,6 +192,134 @@ struct PERFETTO_EXPORT_COMPONENT Config {
   // Sets developer-only flags to the provided values. Does not have any affect
   // unless |enable_dev_features| = true.
   std::unordered_map<std::string, std::string> dev_flags;
+
+  // The number of threads which can be used to tokenize proto traces. When
+  // greater than one, the |compressed_packets| of each chunk of the trace are
+  // inflated on a pool of this many threads. Packets are still tokenized (i.e.
+  // incremental state, interned data and clock snapshots are handled) on the
+  // calling thread and in trace order so the parsed trace is identical to the
+  // single threaded (default) mode.
+  //
+  // When greater than one, whole-file gzip traces are also inflated on a
+  // background thread, overlapping with parsing of the previously inflated
+  // data, the samples of each chunk of perf.data files are parsed on a pool
+  // of this many threads, and so are the logcat files of Android bugreports
+  // (while their dumpstate file is inflated in the background). The per-CPU
+  // and per-machine queues of the sorter are also sorted on this pool before
+  // being merged.
+  //
+  // Ignored on builds which do not support threads (i.e. WebAssembly without
+  // threads).
+  uint32_t tokenizer_thread_count = 1;
+
+  // When set to true and the trace is fully sorted (see |sorting_mode|), the
+  // tokenized events which are held until the end of the trace are stored in
+  // shared mappings of an unlinked temporary file (in $TMPDIR) rather than in
+  // anonymous memory. This allows the kernel to write them back and evict them
+  // under memory pressure (even without swap) at the cost of disk I/O.
+  //
+  // Ignored on platforms without mmap support (e.g. Windows, WebAssembly).
+  bool spill_full_sort_to_disk = false;
+
+  // When set to true, the time spent and the bytes consumed by tokenizing and
+  // parsing each kind of TracePacket, sorting and flushing are measured during
+  // ingestion and reported in the |__intrinsic_ingestion_profile| table at the
+  // end of the trace. This adds a few clock reads per packet so should only be
+  // enabled when investigating import performance.
+  bool enable_ingestion_profile = false;
+
+  // When set to true, the full result of each query passed to |ExecuteQuery|
+  // which is made of a single read-only statement is stored and served again
+  // when exactly the same query (ignoring whitespace) is executed. This makes
+  // repeated executions of the same queries (e.g. reloading a dashboard)
+  // nearly free at the cost of the memory used by their results.
+  //
+  // The stored results are discarded whenever any table, view, function,
+  // macro or index is created or dropped, a module is included or any
+  // statement modifying the database is executed. Queries using
+  // non-deterministic functions (e.g. random()) will however return the
+  // stored result so this should only be enabled for deterministic queries.
+  // Queries reading the |stats| or |sqlstats| tables and results of more than
+  // 2^20 rows are never cached.
+  //
+  // Whether the result of each query was served from the cache is reported in
+  // the |cache_hit| column of the |sqlstats| table.
+  bool enable_query_result_cache = false;
+
+  // The number of threads which can be used to compute span joins
+  // (SPAN_JOIN, SPAN_LEFT_JOIN and SPAN_OUTER_JOIN). When greater than one,
+  // span joins where both tables are partitioned by the same column are
+  // computed by reading both tables in full and joining each partition on a
+  // pool of this many threads. Rows are still returned in partition order so
+  // the results are identical to the single threaded (default) mode, at the
+  // cost of holding both tables in memory for the duration of the query.
+  //
+  // Ignored on builds which do not support threads (i.e. WebAssembly without
+  // threads).
+  uint32_t span_join_thread_count = 1;
+
+  // The number of threads which can be used to compute which objects of
+  // each Java heap graph are reachable from its roots (and their distance to
+  // the closest root). When greater than one, each level of the breadth-first
+  // search over the references is split between a pool of this many threads.
+  // The results are identical to the single threaded (default) mode.
+  //
+  // Ignored on builds which do not support threads (i.e. WebAssembly without
+  // threads).
+  uint32_t heap_graph_thread_count = 1;
+
+  // When set to true, the wall time spent executing and the rows produced by
+  // each SQL statement (including the ones of included modules) and by each
+  // cursor on the tables implemented in C++ are recorded in the
+  // |__intrinsic_sql_profile| table alongside the constraints and orders
+  // requested on these tables. This adds a few clock reads per row returned
+  // by these tables so should only be enabled when investigating query
+  // performance.
+  bool enable_sql_profile = false;
+
+  // When set to true, the PERFETTO TABLEs created by included modules are
+  // only computed the first time a statement references them rather than
+  // when the module is included. As most modules define many tables, most of
+  // which are only used by a subset of queries, this can significantly reduce
+  // the time taken to include modules.
+  //
+  // Note that with this option, errors in the definition of these tables are
+  // only surfaced when the table is first used and the table sees the state of
+  // its dependencies at that time rather than at inclusion time. Tables which
+  // were not yet used are also not listed in |perfetto_tables|.
+  bool enable_lazy_module_tables = false;
+
+  // When greater than zero, an estimate of the memory used by the tables, the
+  // string pool and the sorter is kept and, as it approaches this number of
+  // bytes, trace processor degrades gracefully rather than being killed for
+  // running out of memory. In order, as the usage crosses 70%, 85% and 95% of
+  // the budget:
+  //  * the args of slices, counters, flows and raw events are dropped.
+  //  * ftrace events are not added to the |ftrace_event| (aka |raw|) table.
+  //  * new PERFETTO TABLEs are refused with an error.
+  // Once reached, a step stays in effect until the trace processor is
+  // destroyed. What was dropped is reported in the |stats| table (see the
+  // memory_budget_* stats).
+  //
+  // Note that this is a budget for the estimate, not a hard limit: memory
+  // used by e.g. SQLite, the query results and the tables created from SQL is
+  // not included.
+  uint64_t memory_budget_bytes = 0;
+
+  // When greater than zero, the queries run with TraceProcessor::ExecuteQuery
+  // fail with a "timed out" error once they have been running, including the
+  // iteration of their result, for longer than this number of milliseconds.
+  // Can be overridden for each query.
+  uint32_t query_timeout_ms = 0;
+
+  // When greater than zero, the trace files read with ReadTrace() are not
+  // mapped in memory but read in 1 MB chunks by this many threads, each
+  // reading a different chunk, up to this many chunks ahead of the one being
+  // parsed. Keeping several reads in flight hides the latency of network file
+  // systems and cold disks behind the parsing of the trace.
+  //
+  // Ignored on Windows and on builds which do not support threads.
+  uint32_t read_ahead_chunks = 0;
 };
 
 // Represents a dynamically typed value returned by SQL.
@@ -91,9 +91,10 @@ class PERFETTO_EXPORT_COMPONENT Iterator {
   util::Status Status();
 
  private:
+  friend class ArrowIpcSerializer;
   friend class QueryResultSerializer;
 
-  // This is to allow QueryResultSerializer, which is very perf sensitive, to
+  // This is to allow the serializers, which are very perf sensitive, to
   // access direct the impl_ and avoid one extra function call for each cell.
   template <typename T = IteratorImpl>
   std::unique_ptr<T> take_impl() {
@@ -34,8 +34,15 @@ util::Status PERFETTO_EXPORT_COMPONENT ReadTrace(
     const char* filename,
     const std::function<void(uint64_t parsed_size)>& progress_callback = {});
 
+// Writes into |output| the packets of the trace at |data|, with the
+// |compressed_packets| (and |zstd_compressed_packets|) inflated. Compressed
+// packets are inflated on |thread_count| threads (0 means one per core);
+// |output| is identical whatever the number of threads.
 util::Status PERFETTO_EXPORT_COMPONENT
-DecompressTrace(const uint8_t* data, size_t size, std::vector<uint8_t>* output);
+DecompressTrace(const uint8_t* data,
+                size_t size,
+                std::vector<uint8_t>* output,
+                uint32_t thread_count = 1);
 
 }  // namespace trace_processor
 }  // namespace perfetto
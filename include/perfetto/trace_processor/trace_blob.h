@@ -71,6 +71,13 @@ class PERFETTO_EXPORT_COMPONENT TraceBlob : public RefCounted {
   uint8_t* data() const { return data_; }
   size_t size() const { return size_; }
 
+  // Returns the number of bytes of all the TraceBlobs currently alive in the
+  // process, respectively owned on the heap and memory-mapped. These are
+  // process-wide: if several TraceProcessor instances are alive, they include
+  // the blobs retained by all of them.
+  static uint64_t heap_bytes_in_use();
+  static uint64_t mmap_bytes_in_use();
+
  private:
   enum class Ownership { kNullOrMmaped = 0, kHeapBuf };
 
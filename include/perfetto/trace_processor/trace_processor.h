@@ -44,6 +44,9 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
 
   ~TraceProcessor() override;
 
+  // Returns the config this instance was created with.
+  virtual const Config& config() const = 0;
+
   // Executes the SQL on the loaded portion of the trace.
   //
   // More than one SQL statement can be passed to this function; all but the
@@ -55,6 +58,13 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
   // the returned iterator.
   virtual Iterator ExecuteQuery(const std::string& sql) = 0;
 
+  // Same as above but the query fails with a "timed out" error if it is still
+  // running |timeout_ms| milliseconds from now, instead of after
+  // |Config::query_timeout_ms|. Zero means no timeout. The time spent by the
+  // caller between calls to Iterator::Next() counts towards the timeout.
+  virtual Iterator ExecuteQuery(const std::string& sql,
+                                uint32_t timeout_ms) = 0;
+
   // Registers SQL files with the associated path under the module named
   // |sql_module.name|. These modules can be run by using the |IMPORT| SQL
   // function.
@@ -102,7 +112,10 @@ class PERFETTO_EXPORT_COMPONENT TraceProcessor : public TraceProcessorStorage {
       MetricResultFormat format,
       std::string* metrics_string) = 0;
 
-  // Interrupts the current query. Typically used by Ctrl-C handler.
+  // Interrupts the queries currently running, which fail with a "cancelled"
+  // error. Can be called from a signal handler (e.g. on Ctrl-C) or from
+  // another thread, as long as it is not concurrent with
+  // RestoreInitialTables() or the destruction of this instance.
   virtual void InterruptQuery() = 0;
 
   // Restores Trace Processor to its pristine state. It preserves the built-in
@@ -26,6 +26,7 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <vector>
 
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -71,8 +72,15 @@ class PERFETTO_EXPORT_COMPONENT ConsoleInterceptor
   void OnStart(const StartArgs&) override;
   void OnStop(const StopArgs&) override;
 
+  // Single-producer single-consumer buffer passing the packets of a thread to
+  // the formatting thread in asynchronous mode.
+  class PacketRing;
+
   struct ThreadLocalState : public InterceptorBase::ThreadLocalState {
     ThreadLocalState(ThreadLocalStateArgs&);
+    // Used by the formatting thread in asynchronous mode, which keeps the
+    // state of each sequence outside of the emitting thread's TLS.
+    ThreadLocalState(int output_fd, bool enable_colors, uint64_t start_time);
     ~ThreadLocalState() override;
 
     // Destination file. Assumed to stay valid until the program ends (i.e., is
@@ -89,33 +97,42 @@ class PERFETTO_EXPORT_COMPONENT ConsoleInterceptor
     // sequence state is stored in TLS.
     TrackEventStateTracker::SequenceState sequence_state;
     uint64_t start_time_ns{};
+
+    // In asynchronous mode, the ring buffer which the packets of this thread
+    // are copied into. Null in synchronous mode.
+    std::shared_ptr<PacketRing> packet_ring;
   };
 
  private:
+  class AsyncFormatter;
   class Delegate;
 
   // Appends a formatted message to |message_buffer_| or directly to the output
   // file if the buffer is full.
-  static void Printf(InterceptorContext& context,
+  static void Printf(ThreadLocalState& tls,
                      const char* format,
                      ...) PERFETTO_PRINTF_ATTR;
-  static void Flush(InterceptorContext& context);
-  static void SetColor(InterceptorContext& context, const ConsoleColor&);
-  static void SetColor(InterceptorContext& context, const char*);
+  static void Flush(ThreadLocalState& tls);
+  static void SetColor(ThreadLocalState& tls, const ConsoleColor&);
+  static void SetColor(ThreadLocalState& tls, const char*);
 
-  static void PrintDebugAnnotations(InterceptorContext&,
+  static void PrintDebugAnnotations(ThreadLocalState&,
                                     const protos::pbzero::TrackEvent_Decoder&,
                                     const ConsoleColor& slice_color,
                                     const ConsoleColor& highlight_color);
   static void PrintDebugAnnotationName(
-      InterceptorContext&,
+      ThreadLocalState&,
       const perfetto::protos::pbzero::DebugAnnotation_Decoder& annotation);
   static void PrintDebugAnnotationValue(
-      InterceptorContext&,
+      ThreadLocalState&,
       const perfetto::protos::pbzero::DebugAnnotation_Decoder& annotation);
 
   int fd_ = STDOUT_FILENO;
   bool use_colors_ = true;
+  bool async_formatting_ = false;
+
+  // Only set between OnStart() and OnStop() in asynchronous mode.
+  std::unique_ptr<AsyncFormatter> async_formatter_;
 
   TrackEventStateTracker::SessionState session_state_;
   uint64_t start_time_ns_{};
@@ -983,8 +983,17 @@ class TrackEventDataSource
             return;
           }
 
+          uint64_t dropped_events = 0;
+          if (!CatTraits::kIsDynamic &&
+              !ShouldEmitEvent(ctx, CatTraits::GetStaticIndex(category), type,
+                               track, &dropped_events)) {
+            return;
+          }
+
           auto event_ctx = WriteTrackEvent(ctx, category, event_name, type,
                                            track, timestamp);
+          if (PERFETTO_UNLIKELY(dropped_events))
+            event_ctx.event()->set_dropped_events_before(dropped_events);
           WriteTrackEventArgs(std::move(event_ctx),
                               std::forward<Arguments>(args)...);
         });
@@ -1013,8 +1022,17 @@ class TrackEventDataSource
             return;
           }
 
+          uint64_t dropped_events = 0;
+          if (!CatTraits::kIsDynamic &&
+              !ShouldEmitEvent(ctx, CatTraits::GetStaticIndex(category), type,
+                               track, &dropped_events)) {
+            return;
+          }
+
           auto event_ctx =
               WriteTrackEvent(ctx, category, event_name, type, track);
+          if (PERFETTO_UNLIKELY(dropped_events))
+            event_ctx.event()->set_dropped_events_before(dropped_events);
           WriteTrackEventArgs(std::move(event_ctx),
                               std::forward<Arguments>(args)...);
         });
@@ -1033,6 +1051,26 @@ class TrackEventDataSource
     }
   }
 
+  // Applies TrackEventConfig.category_rate_limits to an event of a static
+  // category. Returns false if the event should be dropped. Otherwise, sets
+  // |dropped_events| to the number of events of the category dropped on this
+  // thread since the previous one emitted.
+  template <typename TrackType>
+  static bool ShouldEmitEvent(typename Base::TraceContext& ctx,
+                              size_t category_index,
+                              perfetto::protos::pbzero::TrackEvent::Type type,
+                              const TrackType& track,
+                              uint64_t* dropped_events) PERFETTO_ALWAYS_INLINE {
+    TrackEventTlsState& tls_state = *ctx.GetCustomTlsState();
+    if (PERFETTO_LIKELY(tls_state.rate_limits.empty()))
+      return true;
+    bool on_current_thread_track =
+        (&track == &TrackEventInternal::kDefaultTrack);
+    return TrackEventInternal::ShouldEmitRateLimitedEvent(
+        *Registry, tls_state, category_index, type, on_current_thread_track,
+        dropped_events);
+  }
+
   // Determines if the given dynamic category is enabled, first by checking the
   // per-trace writer cache or by falling back to computing it based on the
   // trace config for the given session.
@@ -29,7 +29,9 @@
 #include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
 #include "protos/perfetto/trace/track_event/track_event.pbzero.h"
 
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace perfetto {
 
@@ -108,6 +110,41 @@ class PERFETTO_EXPORT_COMPONENT BaseTrackEventInternedDataIndex {
 #endif  // PERFETTO_DCHECK_IS_ON()
 };
 
+// A sampling or rate limit applied to the categories matching |category|, see
+// TrackEventConfig.CategoryRateLimit.
+struct TrackEventRateLimit {
+  std::string category;
+  uint32_t sampling_interval = 0;
+  uint32_t max_events_per_sec = 0;
+  uint32_t burst_size = 0;
+};
+
+// The state of the sampling and rate limiting of one category on one thread.
+struct TrackEventRateLimiter {
+  static constexpr uint32_t kMaxSliceDepth = 64;
+  static constexpr size_t kNotLimited = static_cast<size_t>(-1);
+
+  // Index of the limit of the category in TrackEventTlsState::rate_limits, or
+  // kNotLimited. Only valid once |resolved|.
+  size_t limit_index = kNotLimited;
+  bool resolved = false;
+
+  // Events seen since the last one kept by the sampling.
+  uint32_t sampling_counter = 0;
+
+  // Token bucket.
+  double tokens = 0;
+  uint64_t last_refill_ns = 0;
+
+  // Events dropped since the last one emitted.
+  uint64_t dropped_events = 0;
+
+  // Slices open on the default track of the thread: bit N is set if the begin
+  // event of the slice at depth N was dropped (so its end must be too).
+  uint64_t dropped_slices = 0;
+  uint32_t slice_depth = 0;
+};
+
 struct TrackEventTlsState {
   template <typename TraceContext>
   explicit TrackEventTlsState(const TraceContext& trace_context);
@@ -117,6 +154,11 @@ struct TrackEventTlsState {
   uint64_t timestamp_unit_multiplier = 1;
   uint32_t default_clock;
   std::map<const void*, std::unique_ptr<TrackEventTlsStateUserData>> user_data;
+  // TrackEventConfig.category_rate_limits. Empty (the common case) if no
+  // category is limited.
+  std::vector<TrackEventRateLimit> rate_limits;
+  // Indexed by static category index, grown on demand.
+  std::vector<TrackEventRateLimiter> rate_limiters;
 };
 
 struct TrackEventIncrementalState {
@@ -208,6 +250,21 @@ class PERFETTO_EXPORT_COMPONENT TrackEventInternal {
                                 const protos::gen::TrackEventConfig& config,
                                 const Category& category);
 
+  static std::vector<TrackEventRateLimit> GetCategoryRateLimits(
+      const protos::gen::TrackEventConfig& config);
+
+  // Decides whether an event of the static category |category_index| should
+  // be emitted, according to the rate limits in |tls_state|. If so, returns
+  // in |dropped_events| the number of events of the category dropped on this
+  // thread since the previous one emitted.
+  static bool ShouldEmitRateLimitedEvent(
+      const TrackEventCategoryRegistry& registry,
+      TrackEventTlsState& tls_state,
+      size_t category_index,
+      perfetto::protos::pbzero::TrackEvent::Type type,
+      bool on_current_thread_track,
+      uint64_t* dropped_events);
+
   static void WriteEventName(perfetto::DynamicString event_name,
                              perfetto::EventContext& event_ctx,
                              const TrackEventTlsState&);
@@ -342,6 +399,8 @@ TrackEventTlsState::TrackEventTlsState(const TraceContext& trace_context) {
     if (config.has_timestamp_unit_multiplier()) {
       timestamp_unit_multiplier = config.timestamp_unit_multiplier();
     }
+    if (!config.category_rate_limits().empty())
+      rate_limits = TrackEventInternal::GetCategoryRateLimits(config);
   }
   if (disable_incremental_timestamps) {
     if (timestamp_unit_multiplier == 1) {
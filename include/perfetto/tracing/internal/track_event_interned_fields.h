@@ -46,7 +46,7 @@ struct PERFETTO_EXPORT_COMPONENT InternedEventName
           InternedEventName,
           perfetto::protos::pbzero::InternedData::kEventNamesFieldNumber,
           const char*,
-          SmallInternedDataTraits> {
+          FlatInternedDataTraits> {
   ~InternedEventName() override;
 
   static void Add(protos::pbzero::InternedData* interned_data,
@@ -60,7 +60,7 @@ struct PERFETTO_EXPORT_COMPONENT InternedDebugAnnotationName
           perfetto::protos::pbzero::InternedData::
               kDebugAnnotationNamesFieldNumber,
           const char*,
-          SmallInternedDataTraits> {
+          FlatInternedDataTraits> {
   ~InternedDebugAnnotationName() override;
 
   static void Add(protos::pbzero::InternedData* interned_data,
@@ -121,8 +121,13 @@
     constexpr auto PERFETTO_UID(                                               \
         kCatIndex_ADD_TO_PERFETTO_DEFINE_CATEGORIES_IF_FAILS_) =               \
         PERFETTO_GET_CATEGORY_INDEX(category);                                 \
-    if (::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsDynamicCategory(         \
-            category)) {                                                       \
+    constexpr bool PERFETTO_UID(kCompiledOut_) =                               \
+        ::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsCompiledOutCategory(     \
+            category);                                                         \
+    if (PERFETTO_UID(kCompiledOut_)) {                                         \
+      /* See PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES. */                \
+    } else if (::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsDynamicCategory(  \
+                   category)) {                                                \
       tns::TrackEvent::CallIfEnabled(                                          \
           [&](uint32_t instances) PERFETTO_NO_THREAD_SAFETY_ANALYSIS {         \
             tns::TrackEvent::method(                                           \
@@ -214,11 +219,14 @@
 // https://gcc.gnu.org/bugzilla/show_bug.cgi?id=82643
 // TODO(khokhlov): Remove this fallback after Perfetto moves to a more recent
 // GCC version.
-#define PERFETTO_INTERNAL_CATEGORY_ENABLED(category)                           \
-  (::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsDynamicCategory(category)     \
-       ? PERFETTO_TRACK_EVENT_NAMESPACE::TrackEvent::IsDynamicCategoryEnabled( \
-             ::perfetto::DynamicCategory(category))                            \
-       : PERFETTO_TRACK_EVENT_NAMESPACE::TrackEvent::IsCategoryEnabled(        \
+#define PERFETTO_INTERNAL_CATEGORY_ENABLED(category)                         \
+  (::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsCompiledOutCategory(        \
+       category)                                                             \
+       ? false                                                               \
+   : ::PERFETTO_TRACK_EVENT_NAMESPACE::internal::IsDynamicCategory(category) \
+       ? PERFETTO_TRACK_EVENT_NAMESPACE::TrackEvent::                        \
+             IsDynamicCategoryEnabled(::perfetto::DynamicCategory(category)) \
+       : PERFETTO_TRACK_EVENT_NAMESPACE::TrackEvent::IsCategoryEnabled(      \
              PERFETTO_GET_CATEGORY_INDEX(category)))
 #else  // !PERFETTO_BUILDFLAG(PERFETTO_COMPILER_GCC)
 #define PERFETTO_INTERNAL_CATEGORY_ENABLED(category)                     \
@@ -228,6 +236,12 @@
     constexpr auto PERFETTO_UID(index) =                                 \
         PERFETTO_GET_CATEGORY_INDEX(category);                           \
     constexpr auto PERFETTO_UID(dynamic) = IsDynamicCategory(category);  \
+    using ::PERFETTO_TRACK_EVENT_NAMESPACE::internal::                   \
+        IsCompiledOutCategory;                                           \
+    constexpr auto PERFETTO_UID(compiled_out) =                          \
+        IsCompiledOutCategory(category);                                 \
+    if (PERFETTO_UID(compiled_out))                                      \
+      return false;                                                      \
     return PERFETTO_UID(dynamic)                                         \
                ? TrackEvent::IsDynamicCategoryEnabled(                   \
                      ::perfetto::DynamicCategory(category))              \
@@ -108,6 +108,12 @@ struct TracingInitArgs {
   // delay, i.e. commits will be sent to the service at the next opportunity.
   uint32_t shmem_batch_commits_duration_ms = 0;
 
+  // [Optional] Adapts the batching period to the load, between 0 and
+  // `shmem_batch_commits_duration_ms`: commits are sent sooner when the shared
+  // memory buffer fills up and batched for longer while the producer is mostly
+  // idle. See SetAdaptiveBatchCommits in shared_memory_arbiter.h.
+  bool shmem_adaptive_batch_commits = false;
+
   // [Optional] Enables direct producer-side patching of chunks that have not
   // yet been committed to the service. This flag will only have an effect
   // if the service supports direct patching, otherwise it will be ignored.
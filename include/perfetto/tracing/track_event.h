@@ -152,6 +152,19 @@ constexpr bool IsDynamicCategory(const ::perfetto::DynamicCategory&) {
   return true;
 }
 
+// By default no categories are compiled out, but this can be overridden with
+// PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES or
+// PERFETTO_DEFINE_COMPILED_IN_CATEGORY_PREFIXES.
+template <typename... T>
+constexpr bool IsCompiledOutCategory(const char*) {
+  return false;
+}
+
+// Dynamic categories are only known at runtime and can't be compiled out.
+constexpr bool IsCompiledOutCategory(const ::perfetto::DynamicCategory&) {
+  return false;
+}
+
 }  // namespace internal
 }  // namespace PERFETTO_TRACK_EVENT_NAMESPACE
 
@@ -172,6 +185,46 @@ constexpr bool IsDynamicCategory(const ::perfetto::DynamicCategory&) {
   } /* namespace PERFETTO_TRACK_EVENT_NAMESPACE */                        \
   PERFETTO_INTERNAL_SWALLOW_SEMICOLON()
 
+// Trace points in some statically defined categories can be removed from the
+// binary altogether, e.g., to strip debug categories out of release builds.
+// Such trace points never record anything, don't check the category state at
+// runtime and TRACE_EVENT_CATEGORY_ENABLED() is always false for them. The
+// categories still need to be registered with PERFETTO_DEFINE_CATEGORIES.
+//
+// Use this macro to list the prefixes of the categories to compile out, e.g.:
+//
+//   #if defined(NDEBUG)
+//   PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES("debug", "verbose");
+//   #endif
+//
+// Like PERFETTO_DEFINE_TEST_CATEGORY_PREFIXES, this must be used before the
+// first trace point of the compilation unit.
+#define PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES(...)               \
+  namespace PERFETTO_TRACK_EVENT_NAMESPACE {                              \
+  namespace internal {                                                    \
+  template <>                                                             \
+  constexpr bool IsCompiledOutCategory(const char* name) {                \
+    return ::perfetto::internal::IsStringInPrefixList(name, __VA_ARGS__); \
+  }                                                                       \
+  } /* namespace internal */                                              \
+  } /* namespace PERFETTO_TRACK_EVENT_NAMESPACE */                        \
+  PERFETTO_INTERNAL_SWALLOW_SEMICOLON()
+
+// The allowlist counterpart of PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES:
+// only the trace points of the categories matching one of the given prefixes
+// are kept, all the other statically defined categories are compiled out.
+// Only one of the two macros can be used.
+#define PERFETTO_DEFINE_COMPILED_IN_CATEGORY_PREFIXES(...)                 \
+  namespace PERFETTO_TRACK_EVENT_NAMESPACE {                               \
+  namespace internal {                                                     \
+  template <>                                                              \
+  constexpr bool IsCompiledOutCategory(const char* name) {                 \
+    return !::perfetto::internal::IsStringInPrefixList(name, __VA_ARGS__); \
+  }                                                                        \
+  } /* namespace internal */                                               \
+  } /* namespace PERFETTO_TRACK_EVENT_NAMESPACE */                         \
+  PERFETTO_INTERNAL_SWALLOW_SEMICOLON()
+
 // Register the set of available categories by passing a list of categories to
 // this macro: perfetto::Category("cat1"), perfetto::Category("cat2"), ...
 // `ns` is the name of the namespace in which the categories should be declared.
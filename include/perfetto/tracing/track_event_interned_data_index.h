@@ -22,6 +22,10 @@
 #include "perfetto/base/compiler.h"
 #include "perfetto/tracing/event_context.h"
 
+#include <stdint.h>
+
+#include <algorithm>
+#include <array>
 #include <map>
 #include <type_traits>
 #include <unordered_map>
@@ -143,6 +147,124 @@ struct HashedInternedDataTraits {
   };
 };
 
+// This type of interning index is a fixed size open-addressing hash table
+// stored inline in the index: lookups never allocate and only touch a few
+// adjacent slots, which makes it a good fit for the interned data looked up by
+// every trace point (e.g., event names). Pointers are used directly as keys,
+// other types are keyed by their std::hash with the same caveat about
+// collisions as HashedInternedDataTraits.
+//
+// The size of the index is bounded: when it fills up, the entries which weren't
+// hit since they were inserted or since the previous eviction are dropped, or
+// all of them if most were hit. Dropped values get a new interning id, and
+// their definition is emitted again, the next time they are interned.
+template <size_t kSlotCount>
+struct FlatInternedDataTraitsWithSize {
+  static_assert(kSlotCount >= 4 && (kSlotCount & (kSlotCount - 1)) == 0,
+                "The slot count must be a power of two");
+
+  template <typename ValueType>
+  class Index {
+   public:
+    bool LookUpOrInsert(size_t* iid, const ValueType& value) {
+      size_t key = KeyFor(value, std::is_pointer<ValueType>());
+      size_t slot = FindSlot(key);
+      if (PERFETTO_LIKELY(slots_[slot].iid)) {
+        slots_[slot].recently_used = true;
+        *iid = slots_[slot].iid;
+        return true;
+      }
+      if (PERFETTO_UNLIKELY(size_ >= kMaxSize)) {
+        Evict();
+        slot = FindSlot(key);
+      }
+      slots_[slot] = Slot{key, ++last_iid_, false};
+      size_++;
+      *iid = last_iid_;
+      return false;
+    }
+
+   private:
+    static constexpr size_t kMask = kSlotCount - 1;
+    // Keep a quarter of the slots free to bound the length of the probes.
+    static constexpr size_t kMaxSize = kSlotCount - kSlotCount / 4;
+
+    struct Slot {
+      size_t key;
+      size_t iid;  // 0 if the slot is free.
+      bool recently_used;
+    };
+
+    static size_t KeyFor(const ValueType& value, std::true_type) {
+      return static_cast<size_t>(reinterpret_cast<uintptr_t>(value));
+    }
+
+    static size_t KeyFor(const ValueType& value, std::false_type) {
+      return std::hash<ValueType>()(value);
+    }
+
+    // Fibonacci hashing: the low bits of pointers are mostly zero because of
+    // alignment, the high bits of the product depend on all of them.
+    static size_t HomeSlot(size_t key) {
+      return static_cast<size_t>(
+                 (static_cast<uint64_t>(key) * 0x9e3779b97f4a7c15ull) >> 32) &
+             kMask;
+    }
+
+    // Returns the slot holding |key|, or the free slot where it should be
+    // inserted.
+    size_t FindSlot(size_t key) const {
+      size_t slot = HomeSlot(key);
+      while (slots_[slot].iid && slots_[slot].key != key)
+        slot = (slot + 1) & kMask;
+      return slot;
+    }
+
+    void Evict() {
+      size_t kept = 0;
+      size_t start = kSlotCount;
+      for (size_t i = 0; i < kSlotCount; i++) {
+        if (!slots_[i].iid) {
+          start = std::min(start, i);
+        } else if (slots_[i].recently_used) {
+          kept++;
+        }
+      }
+      if (kept > kMaxSize / 2) {
+        slots_ = {};
+        size_ = 0;
+        return;
+      }
+      for (Slot& slot : slots_) {
+        if (!slot.recently_used)
+          slot = Slot{};
+      }
+      // Move the remaining entries to where a lookup would now find them. The
+      // sweep starts from a slot which was free before the eviction, so that
+      // no probe sequence wraps around it: this guarantees that moving an
+      // entry never breaks the probe sequence of an entry moved before.
+      for (size_t n = 1; n <= kSlotCount; n++) {
+        size_t i = (start + n) & kMask;
+        if (!slots_[i].iid)
+          continue;
+        Slot slot = slots_[i];
+        slot.recently_used = false;
+        slots_[i] = Slot{};
+        slots_[FindSlot(slot.key)] = slot;
+      }
+      size_ = kept;
+    }
+
+    std::array<Slot, kSlotCount> slots_{};
+    size_t size_ = 0;
+    // Interning ids keep increasing across evictions: a dropped value must
+    // not share its new id with another value.
+    size_t last_iid_ = 0;
+  };
+};
+
+using FlatInternedDataTraits = FlatInternedDataTraitsWithSize<512>;
+
 // A templated base class for an interned data type which corresponds to a field
 // in interned_data.proto.
 //
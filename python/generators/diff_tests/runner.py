@@ -185,118 +185,26 @@ class TestCaseRunner:
     except:
       return '<Invalid input for proto deserializaiton>'
 
-  def __run_metrics_test(self, trace_path: str,
-                         metrics_message_factory) -> TestResult:
 
-    if self.test.blueprint.is_out_file():
-      with open(self.test.expected_path, 'r') as expected_file:
-        expected = expected_file.read()
-    else:
-      expected = self.test.blueprint.out.contents
-
-    tmp_perf_file = tempfile.NamedTemporaryFile(delete=False)
-    is_json_output_file = self.test.blueprint.is_out_file(
-    ) and os.path.basename(self.test.expected_path).endswith('.json.out')
-    is_json_output = is_json_output_file or self.test.blueprint.is_out_json()
-    cmd = [
-        self.trace_processor_path,
-        '--analyze-trace-proto-content',
-        '--crop-track-events',
-        '--run-metrics',
-        self.test.blueprint.query.name,
-        '--metrics-output=%s' % ('json' if is_json_output else 'binary'),
-        '--perf-file',
-        tmp_perf_file.name,
-        trace_path,
-    ]
-    for sql_module_path in self.override_sql_module_paths:
-      cmd += ['--override-sql-module', sql_module_path]
-    tp = subprocess.Popen(
-        cmd,
-        stdout=subprocess.PIPE,
-        stderr=subprocess.PIPE,
-        env=get_env(ROOT_DIR))
-    (stdout, stderr) = tp.communicate()
-
-    if is_json_output:
-      expected_text = expected
-      actual_text = stdout.decode('utf8')
-    else:
-      # Expected will be in text proto format and we'll need to parse it to
-      # a real proto.
-      expected_message = metrics_message_factory()
-      text_format.Merge(expected, expected_message)
-
-      # Actual will be the raw bytes of the proto and we'll need to parse it
-      # into a message.
-      actual_message = metrics_message_factory()
-      actual_message.ParseFromString(stdout)
-
-      # Convert both back to text format.
-      expected_text = text_format.MessageToString(expected_message)
-      actual_text = text_format.MessageToString(actual_message)
-
-    perf_lines = [line.decode('utf8') for line in tmp_perf_file.readlines()]
-    tmp_perf_file.close()
-    os.remove(tmp_perf_file.name)
-    return TestResult(self.test, trace_path, cmd, expected_text, actual_text,
-                      stderr.decode('utf8'), tp.returncode, perf_lines)
-
-  # Run a query based Diff Test.
-  def __run_query_test(self, trace_path: str, keep_query: bool) -> TestResult:
-    # Fetch expected text.
-    if self.test.expected_path:
-      with open(self.test.expected_path, 'r') as expected_file:
-        expected = expected_file.read()
-    else:
-      expected = self.test.blueprint.out.contents
-
-    # Fetch query.
-    if self.test.blueprint.is_query_file():
-      query = self.test.query_path
-    else:
-      tmp_query_file = tempfile.NamedTemporaryFile(delete=False)
-      with open(tmp_query_file.name, 'w') as query_file:
-        query_file.write(self.test.blueprint.query)
-      query = tmp_query_file.name
-
-    tmp_perf_file = tempfile.NamedTemporaryFile(delete=False)
-    cmd = [
-        self.trace_processor_path,
-        '--analyze-trace-proto-content',
-        '--crop-track-events',
-        '-q',
-        query,
-        '--perf-file',
-        tmp_perf_file.name,
-        trace_path,
-    ]
+  # Arguments of trace processor common to all the tests.
+  def common_args(self) -> List[str]:
+    args = ['--analyze-trace-proto-content', '--crop-track-events']
     for sql_module_path in self.override_sql_module_paths:
-      cmd += ['--override-sql-module', sql_module_path]
-    tp = subprocess.Popen(
-        cmd,
-        stdout=subprocess.PIPE,
-        stderr=subprocess.PIPE,
-        env=get_env(ROOT_DIR))
-    (stdout, stderr) = tp.communicate()
-
-    if not self.test.blueprint.is_query_file() and not keep_query:
-      tmp_query_file.close()
-      os.remove(tmp_query_file.name)
-    perf_lines = [line.decode('utf8') for line in tmp_perf_file.readlines()]
-    tmp_perf_file.close()
-    os.remove(tmp_perf_file.name)
-
-    actual = stdout.decode('utf8')
-    if self.test.blueprint.is_out_binaryproto():
-      actual = self.__output_to_text_proto(actual, self.test.blueprint.out)
-
-    return TestResult(self.test, trace_path, cmd, expected, actual,
-                      stderr.decode('utf8'), tp.returncode, perf_lines)
-
-  def __run(self, metrics_descriptor_paths: List[str],
-            extension_descriptor_paths: List[str], keep_input,
-            rebase) -> Tuple[TestResult, str]:
+      args += ['--override-sql-module', sql_module_path]
+    return args
+
+  # Key of the tests which can share the trace loaded by trace processor, or
+  # None if the trace is specific to this test.
+  def trace_key(self) -> Optional[str]:
+    if (self.test.blueprint.is_trace_file() and
+        self.test.blueprint.trace_modifier is None):
+      return self.test.trace_path
+    return None
+
+  # Returns the path of the trace to load, generating it if needed, and whether
+  # it was generated.
+  def prepare_trace(self,
+                    extension_descriptor_paths: List[str]) -> Tuple[str, bool]:
     # We can't use delete=True here. When using that on Windows, the
     # resulting file is opened in exclusive mode (in turn that's a subtle
     # side-effect of the underlying CreateFile(FILE_ATTRIBUTE_TEMPORARY))
@@ -341,29 +249,101 @@ class TestCaseRunner:
                      self.test.trace_path, gen_trace_file.name,
                      self.test.blueprint.trace_modifier)
 
-    if gen_trace_file:
-      trace_path = os.path.realpath(gen_trace_file.name)
-    else:
-      trace_path = self.test.trace_path
+    if not gen_trace_file:
+      return self.test.trace_path, False
+    gen_trace_file.close()
+    return os.path.realpath(gen_trace_file.name), True
 
-    str = f"{self.colors.yellow('[ RUN      ]')} {self.test.name}\n"
+  # Returns the arguments of trace processor specific to this test. The
+  # temporary files it writes to are added to |tmp_files|.
+  def test_args(self, keep_input: bool, tmp_files: List[str]) -> List[str]:
+    tmp_perf_file = tempfile.NamedTemporaryFile(delete=False)
+    tmp_perf_file.close()
+    tmp_files.append(tmp_perf_file.name)
+
+    if self.test.type == TestType.METRIC:
+      return [
+          '--run-metrics',
+          self.test.blueprint.query.name,
+          '--metrics-output',
+          'json' if self.__is_json_metrics_output() else 'binary',
+          '--perf-file',
+          tmp_perf_file.name,
+      ]
 
-    if self.test.type == TestType.QUERY:
-      result = self.__run_query_test(trace_path, keep_input)
-    elif self.test.type == TestType.METRIC:
-      result = self.__run_metrics_test(
-          trace_path,
-          create_message_factory(metrics_descriptor_paths,
-                                 'perfetto.protos.TraceMetrics'))
+    assert self.test.type == TestType.QUERY
+    if self.test.blueprint.is_query_file():
+      query = self.test.query_path
     else:
-      assert False
+      tmp_query_file = tempfile.NamedTemporaryFile(delete=False)
+      with open(tmp_query_file.name, 'w') as query_file:
+        query_file.write(self.test.blueprint.query)
+      query = tmp_query_file.name
+      if not keep_input:
+        tmp_files.append(query)
+    return ['-q', query, '--perf-file', tmp_perf_file.name]
+
+  # The command running the test in its own trace processor process.
+  def cmd(self, args: List[str], trace_path: str) -> List[str]:
+    return [self.trace_processor_path] + self.common_args() + args + [
+        trace_path
+    ]
 
-    if gen_trace_file:
-      if keep_input:
-        str += f"Saving generated input trace: {trace_path}\n"
-      else:
-        gen_trace_file.close()
-        os.remove(trace_path)
+  def __is_json_metrics_output(self) -> bool:
+    is_json_output_file = self.test.blueprint.is_out_file(
+    ) and os.path.basename(self.test.expected_path).endswith('.json.out')
+    return is_json_output_file or self.test.blueprint.is_out_json()
+
+  def __expected(self) -> str:
+    if self.test.expected_path:
+      with open(self.test.expected_path, 'r') as expected_file:
+        return expected_file.read()
+    return self.test.blueprint.out.contents
+
+  # Builds the result of the test from the outputs of trace processor.
+  def result(self, trace_path: str, args: List[str], stdout: bytes,
+             stderr: bytes, exit_code: int,
+             metrics_descriptor_paths: List[str]) -> TestResult:
+    perf_file = args[args.index('--perf-file') + 1]
+    with open(perf_file, 'r') as f:
+      perf_lines = f.readlines()
+
+    expected = self.__expected()
+    if self.test.type == TestType.METRIC and not self.__is_json_metrics_output(
+    ):
+      metrics_message_factory = create_message_factory(
+          metrics_descriptor_paths, 'perfetto.protos.TraceMetrics')
+
+      # Expected will be in text proto format and we'll need to parse it to
+      # a real proto.
+      expected_message = metrics_message_factory()
+      text_format.Merge(expected, expected_message)
+
+      # Actual will be the raw bytes of the proto and we'll need to parse it
+      # into a message.
+      actual_message = metrics_message_factory()
+      actual_message.ParseFromString(stdout)
+
+      # Convert both back to text format.
+      expected = text_format.MessageToString(expected_message)
+      actual = text_format.MessageToString(actual_message)
+    else:
+      actual = stdout.decode('utf8')
+      if (self.test.type == TestType.QUERY and
+          self.test.blueprint.is_out_binaryproto()):
+        actual = self.__output_to_text_proto(actual, self.test.blueprint.out)
+
+    return TestResult(self.test, trace_path, self.cmd(args, trace_path),
+                      expected, actual, stderr.decode('utf8'), exit_code,
+                      perf_lines)
+
+  # Returns the report of the test, rebasing it if needed.
+  def report(self, result: TestResult, generated_trace: bool,
+             keep_input: bool, rebase: bool) -> str:
+    trace_path = result.trace
+    str = f"{self.colors.yellow('[ RUN      ]')} {self.test.name}\n"
+    if generated_trace and keep_input:
+      str += f"Saving generated input trace: {trace_path}\n"
 
     def write_cmdlines():
       res = ""
@@ -390,38 +370,102 @@ class TestCaseRunner:
 
       str += (f"{self.colors.red('[  FAILED  ]')} {self.test.name}\n")
       str += result.rebase(rebase)
-
-      return result, str
     else:
       str += (f"{self.colors.green('[       OK ]')} {self.test.name} "
               f"(ingest: {result.perf_result.ingest_time_ns / 1000000:.2f} ms "
               f"query: {result.perf_result.real_time_ns / 1000000:.2f} ms)\n")
-    return result, str
-
-  # Run a TestCase.
-  def execute(self, extension_descriptor_paths: List[str],
-              metrics_descriptor_paths: List[str], keep_input: bool,
-              rebase: bool) -> Tuple[str, str, TestResult]:
-    if not metrics_descriptor_paths:
-      out_path = os.path.dirname(self.trace_processor_path)
-      metrics_protos_path = os.path.join(out_path, 'gen', 'protos', 'perfetto',
-                                         'metrics')
-      metrics_descriptor_paths = [
-          os.path.join(metrics_protos_path, 'metrics.descriptor'),
-          os.path.join(metrics_protos_path, 'chrome',
-                       'all_chrome_metrics.descriptor'),
-          os.path.join(metrics_protos_path, 'webview',
-                       'all_webview_metrics.descriptor')
+    return str
+
+
+def default_metrics_descriptor_paths(trace_processor_path: str) -> List[str]:
+  out_path = os.path.dirname(trace_processor_path)
+  metrics_protos_path = os.path.join(out_path, 'gen', 'protos', 'perfetto',
+                                     'metrics')
+  return [
+      os.path.join(metrics_protos_path, 'metrics.descriptor'),
+      os.path.join(metrics_protos_path, 'chrome',
+                   'all_chrome_metrics.descriptor'),
+      os.path.join(metrics_protos_path, 'webview',
+                   'all_webview_metrics.descriptor')
+  ]
+
+
+# Runs tests sharing the same trace. Where fork() is available, the trace is
+# loaded once by trace processor in --test-host mode, which runs each test in a
+# copy-on-write fork of itself. Otherwise each test runs in its own process.
+# Returns the name, report and result of each test.
+def execute_tests(runners: List[TestCaseRunner],
+                  extension_descriptor_paths: List[str],
+                  metrics_descriptor_paths: List[str], keep_input: bool,
+                  rebase: bool,
+                  jobs: int) -> List[Tuple[str, str, TestResult]]:
+  first = runners[0]
+  if not metrics_descriptor_paths:
+    metrics_descriptor_paths = default_metrics_descriptor_paths(
+        first.trace_processor_path)
+  trace_path, generated_trace = first.prepare_trace(extension_descriptor_paths)
+
+  tmp_files = []
+  args = [runner.test_args(keep_input, tmp_files) for runner in runners]
+  outputs = []
+  with tempfile.TemporaryDirectory() as out_dir:
+    if os.name == 'nt':
+      for runner, test_args in zip(runners, args):
+        tp = subprocess.Popen(
+            runner.cmd(test_args, trace_path),
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            env=get_env(ROOT_DIR))
+        (stdout, stderr) = tp.communicate()
+        outputs.append((stdout, stderr, tp.returncode))
+    else:
+      requests = ''
+      for i, test_args in enumerate(args):
+        requests += '\t'.join([
+            str(i),
+            os.path.join(out_dir, f'{i}.out'),
+            os.path.join(out_dir, f'{i}.err')
+        ] + test_args) + '\n'
+      cmd = [first.trace_processor_path] + first.common_args() + [
+          '--test-host', '--test-host-jobs',
+          str(jobs), trace_path
       ]
-    result_str = ""
-
-    result, run_str = self.__run(metrics_descriptor_paths,
-                                 extension_descriptor_paths, keep_input, rebase)
-    result_str += run_str
-    if not result:
-      return self.test.name, result_str, None
-
-    return self.test.name, result_str, result
+      host = subprocess.Popen(
+          cmd,
+          stdin=subprocess.PIPE,
+          stdout=subprocess.PIPE,
+          stderr=subprocess.PIPE,
+          env=get_env(ROOT_DIR))
+      (host_stdout, host_stderr) = host.communicate(requests.encode('utf8'))
+      exit_codes = {}
+      for line in host_stdout.decode('utf8').splitlines():
+        test_id, exit_code = line.split(' ')
+        exit_codes[int(test_id)] = int(exit_code)
+      for i in range(len(runners)):
+        if i not in exit_codes:
+          # The host failed before running the test, e.g. to load the trace.
+          outputs.append((b'', host_stderr, host.returncode or 1))
+          continue
+        with open(os.path.join(out_dir, f'{i}.out'), 'rb') as f:
+          stdout = f.read()
+        with open(os.path.join(out_dir, f'{i}.err'), 'rb') as f:
+          stderr = f.read()
+        outputs.append((stdout, stderr, exit_codes[i]))
+
+  reports = []
+  for runner, test_args, (stdout, stderr, exit_code) in zip(
+      runners, args, outputs):
+    result = runner.result(trace_path, test_args, stdout, stderr, exit_code,
+                           metrics_descriptor_paths)
+    reports.append((runner.test.name,
+                    runner.report(result, generated_trace, keep_input,
+                                  rebase), result))
+
+  for tmp_file in tmp_files:
+    os.remove(tmp_file)
+  if generated_trace and not keep_input:
+    os.remove(trace_path)
+  return reports
 
 
 # Fetches and executes all diff viable tests.
@@ -457,21 +501,31 @@ class DiffTestsRunner:
     rebased = []
     test_run_start = datetime.datetime.now()
 
+    # The tests using the same trace file run together, so that it is only
+    # loaded once. The largest groups are started first as they take longer.
+    groups = {}
+    for runner in self.test_runners:
+      key = runner.trace_key() or runner.test.name
+      groups.setdefault(key, []).append(runner)
+    groups = sorted(groups.values(), key=len, reverse=True)
+    jobs = os.cpu_count() or 1
+
     with concurrent.futures.ProcessPoolExecutor() as e:
       fut = [
-          e.submit(test.execute, [chrome_extensions, test_extensions, winscope_extensions],
-                   metrics_descriptor_paths, keep_input, rebase)
-          for test in self.test_runners
+          e.submit(execute_tests, group,
+                   [chrome_extensions, test_extensions, winscope_extensions],
+                   metrics_descriptor_paths, keep_input, rebase, jobs)
+          for group in groups
       ]
       for res in concurrent.futures.as_completed(fut):
-        test_name, res_str, result = res.result()
-        sys.stderr.write(res_str)
-        if not result or not result.passed:
-          if rebase:
-            rebased.append(test_name)
-          failures.append(test_name)
-        else:
-          perf_results.append(result.perf_result)
+        for test_name, res_str, result in res.result():
+          sys.stderr.write(res_str)
+          if not result or not result.passed:
+            if rebase:
+              rebased.append(test_name)
+            failures.append(test_name)
+          else:
+            perf_results.append(result.perf_result)
     test_time_ms = int(
         (datetime.datetime.now() - test_run_start).total_seconds() * 1000)
     return TestResults(failures, perf_results, rebased, test_time_ms)
@@ -139,6 +139,16 @@ class ColumnSerializer:
       return None
     return f'    mutable_{self.name}()->Append(row.{self.name});'
 
+  def append_multiple(self) -> Optional[str]:
+    if self.is_implicit_id or self.is_implicit_type:
+      return None
+    if self.is_ancestor:
+      return None
+    return f'''
+    mutable_{self.name}()->AppendMultiple(
+        count, [&rows](uint32_t i) {{ return rows[i].{self.name}; }});
+    '''
+
   def accessor(self) -> Optional[str]:
     inner = f'columns()[ColumnIndex::{self.name}]'
     return f'''
@@ -277,17 +287,25 @@ class ColumnSerializer:
     if ColumnFlag.SET_ID in self.flags:
       return f'''{self.name}_storage_layer_(
           new column::SetIdStorage(&{self.name}_.vector()))'''
+    # Sorted columns are searched with binary searches so they don't need a
+    # zone map.
+    is_sorted = ColumnFlag.SORTED in self.flags
     if self.is_optional:
+      zone_map = ('nullptr'
+                  if is_sorted else f'&{self.name}_.non_null_zone_map()')
       return f'''{self.name}_storage_layer_(
           new column::NumericStorage<ColumnType::{self.name}::non_optional_stored_type>(
             &{self.name}_.non_null_vector(),
             ColumnTypeHelper<ColumnType::{self.name}::stored_type>::ToColumnType(),
-            {str(ColumnFlag.SORTED in self.flags).lower()}))'''
+            {str(is_sorted).lower()},
+            {zone_map}))'''
+    zone_map = 'nullptr' if is_sorted else f'&{self.name}_.zone_map()'
     return f'''{self.name}_storage_layer_(
         new column::NumericStorage<ColumnType::{self.name}::non_optional_stored_type>(
           &{self.name}_.vector(),
           ColumnTypeHelper<ColumnType::{self.name}::stored_type>::ToColumnType(),
-          {str(ColumnFlag.SORTED in self.flags).lower()}))'''
+          {str(is_sorted).lower()},
+          {zone_map}))'''
 
   def null_layer_init(self) -> str:
     if self.is_ancestor:
@@ -475,6 +493,28 @@ class TableSerializer(object):
     type_.Append(string_pool()->InternString(row.type()));
       '''
 
+  def insert_batch(self) -> str:
+    # The rows of child tables are also inserted in their parent table, one
+    # at a time.
+    if self.table.parent:
+      return ''
+    return f'''
+  // Inserts |rows| at the end of the table and returns the row number of the
+  // first one. Faster than calling Insert() for each row as the columns are
+  // appended to one at a time.
+  RowNumber InsertBatch(const std::vector<Row>& rows) {{
+    uint32_t row_number = row_count();
+    if (rows.empty())
+      return RowNumber(row_number);
+    auto count = static_cast<uint32_t>(rows.size());
+    StringPool::Id type = string_pool()->InternString(rows.front().type());
+    type_.AppendMultiple(count, [type](uint32_t) {{ return type; }});
+    {self.foreach_col(ColumnSerializer.append_multiple)}
+    UpdateSelfOverlayAfterInsertBatch(count);
+    return RowNumber(row_number);
+  }}
+    '''
+
   def const_iterator(self) -> str:
     iterator_getters = self.foreach_col(
         ColumnSerializer.iterator_getter, delimiter='\n')
@@ -707,6 +747,8 @@ class {self.table_name} : public macros_internal::MacroTable {{
                      RowNumber(row_number)}};
   }}
 
+  {self.insert_batch().strip()}
+
   {self.extend().strip()}
 
   {self.foreach_col(ColumnSerializer.accessor)}
@@ -14,7 +14,9 @@
 
 #include <functional>
 #include <random>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <benchmark/benchmark.h>
 #include <stdio.h>
@@ -61,6 +63,7 @@ namespace {
 using namespace perfetto;
 using benchmark::Counter;
 using perfetto::base::AlreadyHashed;
+using perfetto::base::GroupProbe;
 using perfetto::base::LinearProbe;
 using perfetto::base::QuadraticHalfProbe;
 using perfetto::base::QuadraticProbe;
@@ -299,6 +302,64 @@ void BM_HashMap_LookupRandInts(benchmark::State& state) {
                                       Counter::kIsIterationInvariantRate);
 }
 
+// Looks up std::string keys by StringView, e.g. the strings of a trace being
+// parsed. Our map (and Absl's) look up the view directly, while
+// std::unordered_map (pre C++20) has to copy it into a std::string first.
+template <typename Probe>
+uint64_t* FindByView(
+    Ours<std::string, uint64_t, base::StringViewHash, Probe>* m,
+    base::StringView view) {
+  return m->Find(view);
+}
+
+#if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
+uint64_t* FindByView(absl::flat_hash_map<std::string, uint64_t>* m,
+                     base::StringView view) {
+  auto it = m->find(absl::string_view(view.data(), view.size()));
+  return it == m->end() ? nullptr : &it->second;
+}
+#endif
+
+template <typename MapType>
+uint64_t* FindByView(MapType* m, base::StringView view) {
+  auto it = m->find(view.ToStdString());
+  return it == m->end() ? nullptr : &it->second;
+}
+
+template <typename MapType>
+void BM_HashMap_LookupStringViews(benchmark::State& state) {
+  const size_t num_keys = num_samples() / 10;
+  std::string text;
+  std::vector<std::pair<size_t, size_t>> offsets;
+  for (size_t i = 0; i < num_keys; i++) {
+    std::string key = "com.example.slice_name_" + std::to_string(i);
+    offsets.emplace_back(text.size(), key.size());
+    text += key;
+  }
+  std::vector<base::StringView> views;
+  for (const auto& off : offsets)
+    views.emplace_back(text.data() + off.first, off.second);
+  std::minstd_rand0 rng(0);
+  std::shuffle(views.begin(), views.end(), rng);
+
+  MapType mapz;
+  for (size_t i = 0; i < views.size(); i++)
+    mapz.insert({views[i].ToStdString(), i});
+
+  for (auto _ : state) {
+    uint64_t total = 0;
+    for (base::StringView view : views) {
+      uint64_t* value = FindByView(&mapz, view);
+      PERFETTO_CHECK(value);
+      total += *value;
+    }
+    benchmark::DoNotOptimize(total);
+    benchmark::ClobberMemory();
+  }
+  state.counters["lookups"] = Counter(static_cast<double>(views.size()),
+                                      Counter::kIsIterationInvariantRate);
+}
+
 }  // namespace
 
 using Ours_LinearProbing =
@@ -307,20 +368,26 @@ using Ours_QuadProbing =
     Ours<uint64_t, uint64_t, AlreadyHashed<uint64_t>, QuadraticProbe>;
 using Ours_QuadCompProbing =
     Ours<uint64_t, uint64_t, AlreadyHashed<uint64_t>, QuadraticHalfProbe>;
+using Ours_GroupProbing =
+    Ours<uint64_t, uint64_t, AlreadyHashed<uint64_t>, GroupProbe>;
 using StdUnorderedMap =
     std::unordered_map<uint64_t, uint64_t, AlreadyHashed<uint64_t>>;
 
+#define STR_ARGS std::string, uint64_t, perfetto::base::StringViewHash
+
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
 using RobinMap = tsl::robin_map<uint64_t, uint64_t, AlreadyHashed<uint64_t>>;
 using AbslFlatHashMap =
     absl::flat_hash_map<uint64_t, uint64_t, AlreadyHashed<uint64_t>>;
 using FollyF14FastMap =
     folly::F14FastMap<uint64_t, uint64_t, AlreadyHashed<uint64_t>>;
+using AbslStringMap = absl::flat_hash_map<std::string, uint64_t>;
 #endif
 
 BENCHMARK(BM_HashMap_InsertTraceStrings_AppendOnly);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, Ours_LinearProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, Ours_QuadProbing);
+BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, Ours_GroupProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, StdUnorderedMap);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
 BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, RobinMap);
@@ -332,6 +399,7 @@ BENCHMARK_TEMPLATE(BM_HashMap_InsertTraceStrings, FollyF14FastMap);
 BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, Ours<TID_ARGS, LinearProbe>);
 BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, Ours<TID_ARGS, QuadraticProbe>);
 BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, Ours<TID_ARGS, QuadraticHalfProbe>);
+BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, Ours<TID_ARGS, GroupProbe>);
 BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, std::unordered_map<TID_ARGS>);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
 BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, tsl::robin_map<TID_ARGS>);
@@ -341,6 +409,7 @@ BENCHMARK_TEMPLATE(BM_HashMap_TraceTids, folly::F14FastMap<TID_ARGS>);
 
 BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, Ours_LinearProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, Ours_QuadProbing);
+BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, Ours_GroupProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, StdUnorderedMap);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
 BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, RobinMap);
@@ -350,6 +419,7 @@ BENCHMARK_TEMPLATE(BM_HashMap_InsertRandInts, FollyF14FastMap);
 
 BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, Ours_LinearProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, Ours_QuadProbing);
+BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, Ours_GroupProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, Ours_QuadCompProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, StdUnorderedMap);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
@@ -360,6 +430,7 @@ BENCHMARK_TEMPLATE(BM_HashMap_InsertCollidingInts, FollyF14FastMap);
 
 BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, Ours_LinearProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, Ours_QuadProbing);
+BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, Ours_GroupProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, Ours_QuadCompProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, StdUnorderedMap);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
@@ -370,9 +441,18 @@ BENCHMARK_TEMPLATE(BM_HashMap_InsertDupeInts, FollyF14FastMap);
 
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, Ours_LinearProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, Ours_QuadProbing);
+BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, Ours_GroupProbing);
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, StdUnorderedMap);
 #if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, RobinMap);
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, AbslFlatHashMap);
 BENCHMARK_TEMPLATE(BM_HashMap_LookupRandInts, FollyF14FastMap);
 #endif
+
+BENCHMARK_TEMPLATE(BM_HashMap_LookupStringViews, Ours<STR_ARGS, LinearProbe>);
+BENCHMARK_TEMPLATE(BM_HashMap_LookupStringViews, Ours<STR_ARGS, GroupProbe>);
+BENCHMARK_TEMPLATE(BM_HashMap_LookupStringViews,
+                   std::unordered_map<std::string, uint64_t>);
+#if defined(PERFETTO_HASH_MAP_COMPARE_THIRD_PARTY_LIBS)
+BENCHMARK_TEMPLATE(BM_HashMap_LookupStringViews, AbslStringMap);
+#endif
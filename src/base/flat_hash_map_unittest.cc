@@ -20,9 +20,11 @@
 #include <functional>
 #include <random>
 #include <set>
+#include <string>
 #include <unordered_map>
 
 #include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/string_view.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -41,7 +43,8 @@ class FlatHashMapTest : public testing::Test {
   using Probe = T;
 };
 
-using ProbeTypes = Types<LinearProbe, QuadraticHalfProbe, QuadraticProbe>;
+using ProbeTypes =
+    Types<LinearProbe, QuadraticHalfProbe, QuadraticProbe, GroupProbe>;
 TYPED_TEST_SUITE(FlatHashMapTest, ProbeTypes, /* trailing ',' for GCC*/);
 
 struct Key {
@@ -383,6 +386,61 @@ TYPED_TEST(FlatHashMapTest, VsUnorderedMap) {
   }
 }
 
+TYPED_TEST(FlatHashMapTest, HeterogeneousLookup) {
+  FlatHashMap<std::string, int, StringViewHash, typename TestFixture::Probe>
+      fmap;
+  for (int i = 0; i < 100; i++)
+    fmap.Insert("key" + std::to_string(i), i);
+
+  const std::string buf = "key42key7";
+  int* res = fmap.Find(StringView(buf.data(), 5));
+  ASSERT_NE(res, nullptr);
+  ASSERT_EQ(*res, 42);
+  res = fmap.Find(StringView(buf.data() + 5, 4));
+  ASSERT_NE(res, nullptr);
+  ASSERT_EQ(*res, 7);
+  ASSERT_EQ(fmap.Find(StringView(buf.data(), 3)), nullptr);
+  ASSERT_EQ(fmap.Find(StringView(buf)), nullptr);
+  ASSERT_EQ(*fmap.Find(std::string("key99")), 99);
+}
+
+TEST(FlatHashMapGroupProbeTest, Match) {
+  std::array<uint8_t, GroupProbe::kGroupSize> tags{};
+  ASSERT_EQ(GroupProbe::Match(tags.data(), 0), 0xffffu);
+  ASSERT_EQ(GroupProbe::Match(tags.data(), 2), 0u);
+  tags[0] = 2;
+  tags[7] = 2;
+  tags[8] = 0x80;
+  tags[15] = 2;
+  ASSERT_EQ(GroupProbe::Match(tags.data(), 2), 0x8081u);
+  ASSERT_EQ(GroupProbe::Match(tags.data(), 0x80), 0x100u);
+  ASSERT_EQ(GroupProbe::Match(tags.data(), 0), 0x7e7eu);
+  ASSERT_EQ(GroupProbe::LowestSlot(0x8080u), 7u);
+
+  // Every tag value, in every position.
+  for (size_t pos = 0; pos < GroupProbe::kGroupSize; pos++) {
+    for (uint32_t tag = 0; tag < 256; tag++) {
+      tags.fill(static_cast<uint8_t>(tag + 1));
+      tags[pos] = static_cast<uint8_t>(tag);
+      ASSERT_EQ(GroupProbe::Match(tags.data(), static_cast<uint8_t>(tag)),
+                1u << pos);
+    }
+  }
+}
+
+TEST(FlatHashMapGroupProbeTest, SmallCapacity) {
+  // The capacity is rounded up to a whole group.
+  FlatHashMap<int, int, base::Hash<int>, GroupProbe> fmap(
+      /*initial_capacity=*/4, /*load_limit_pct=*/100);
+  ASSERT_EQ(fmap.capacity(), GroupProbe::kGroupSize);
+  for (int i = 0; i < 16; i++)
+    ASSERT_TRUE(fmap.Insert(i, i).second);
+  ASSERT_EQ(fmap.capacity(), GroupProbe::kGroupSize);
+  for (int i = 0; i < 16; i++)
+    ASSERT_EQ(*fmap.Find(i), i);
+  ASSERT_EQ(fmap.Find(16), nullptr);
+}
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
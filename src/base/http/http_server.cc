@@ -555,9 +555,11 @@ void HttpServerConnection::SendWebsocketFrame(uint8_t opcode,
     memcpy(&hdr[2], &len_be, sizeof(len_be));
   }
 
-  sock->Send(hdr, hdr_len);
-  if (payload && payload_len > 0)
-    sock->Send(payload, payload_len);
+  // Send the header and the payload with one syscall, without copying the
+  // payload into a frame buffer.
+  SockSendBuffer bufs[] = {{hdr, hdr_len}, {payload, payload_len}};
+  const size_t num_bufs = payload && payload_len > 0 ? 2 : 1;
+  sock->SendV(bufs, num_bufs);
 }
 
 HttpServerConnection::HttpServerConnection(std::unique_ptr<UnixSocket> s)
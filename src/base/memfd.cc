@@ -14,7 +14,7 @@
  * limitations under the License.
  */
 
-#include "src/tracing/ipc/memfd.h"
+#include "perfetto/ext/base/memfd.h"
 
 #include <errno.h>
 
@@ -47,6 +47,7 @@
 #endif  // !defined(__NR_memfd_create)
 
 namespace perfetto {
+namespace base {
 bool HasMemfdSupport() {
   static bool kSupportsMemfd = [] {
     // Check kernel version supports memfd_create(). Some older kernels segfault
@@ -62,7 +63,7 @@ bool HasMemfdSupport() {
       return false;
     }
 
-    base::ScopedFile fd;
+    ScopedFile fd;
     fd.reset(static_cast<int>(syscall(__NR_memfd_create, "perfetto_shmem",
                                       MFD_CLOEXEC | MFD_ALLOW_SEALING)));
     return !!fd;
@@ -70,26 +71,29 @@ bool HasMemfdSupport() {
   return kSupportsMemfd;
 }
 
-base::ScopedFile CreateMemfd(const char* name, unsigned int flags) {
+ScopedFile CreateMemfd(const char* name, unsigned int flags) {
   if (!HasMemfdSupport()) {
     errno = ENOSYS;
-    return base::ScopedFile();
+    return ScopedFile();
   }
-  return base::ScopedFile(
+  return ScopedFile(
       static_cast<int>(syscall(__NR_memfd_create, name, flags)));
 }
+}  // namespace base
 }  // namespace perfetto
 
 #else  // PERFETTO_MEMFD_ENABLED()
 
 namespace perfetto {
+namespace base {
 bool HasMemfdSupport() {
   return false;
 }
-base::ScopedFile CreateMemfd(const char*, unsigned int) {
+ScopedFile CreateMemfd(const char*, unsigned int) {
   errno = ENOSYS;
-  return base::ScopedFile();
+  return ScopedFile();
 }
+}  // namespace base
 }  // namespace perfetto
 
 #endif  // PERFETTO_MEMFD_ENABLED()
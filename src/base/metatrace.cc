@@ -16,8 +16,11 @@
 
 #include "perfetto/ext/base/metatrace.h"
 
+#include <string.h>
+
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/base/thread_utils.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/thread_annotations.h"
@@ -28,16 +31,74 @@ namespace metatrace {
 std::atomic<uint32_t> g_enabled_tags{0};
 std::atomic<uint64_t> g_enabled_timestamp{0};
 
+// The ring buffer of one thread. Only its owner thread writes records and
+// |wr_index|, only the reader writes |rd_index|.
+class RingBuffer::ThreadRing {
+ public:
+  Record* At(uint64_t index) {
+    // Doesn't really have to be pow2, but if not the compiler will emit
+    // arithmetic operations to compute the modulo instead of a bitwise AND.
+    static_assert(!(kCapacity & (kCapacity - 1)), "kCapacity must be pow2");
+    return &records[index % kCapacity];
+  }
+
+  std::array<Record, kCapacity> records;
+  std::atomic<uint64_t> wr_index{0};
+
+  // On a different cache line than |wr_index|, to not slow down the writer
+  // while the reader drains the ring.
+  alignas(64) std::atomic<uint64_t> rd_index{0};
+
+  // True while a thread owns the ring. Set back to false when it exits.
+  std::atomic<bool> in_use{false};
+  uint32_t thread_id = 0;  // Of the owner thread.
+
+  ThreadRing* next = nullptr;  // Immutable once the ring is in |rings_|.
+};
+
 // static members
-std::array<Record, RingBuffer::kCapacity> RingBuffer::records_;
+std::atomic<RingBuffer::ThreadRing*> RingBuffer::rings_;
 std::atomic<bool> RingBuffer::read_task_queued_;
-std::atomic<uint64_t> RingBuffer::wr_index_;
-std::atomic<uint64_t> RingBuffer::rd_index_;
 std::atomic<bool> RingBuffer::has_overruns_;
 Record RingBuffer::bankruptcy_record_;
 
 namespace {
 
+static_assert(TAG_PRODUCER < (1u << kFirstDynamicTagBit),
+              "Static tags overlap with the dynamic ones");
+
+struct StaticTag {
+  uint32_t tag;
+  const char* name;
+};
+
+// Keep in sync with the Tags in metatrace_events.h.
+constexpr StaticTag kStaticTags[] = {
+    {TAG_FTRACE, "FTRACE"},
+    {TAG_PROC_POLLERS, "PROC_POLLERS"},
+    {TAG_TRACE_WRITER, "TRACE_WRITER"},
+    {TAG_TRACE_SERVICE, "TRACE_SERVICE"},
+    {TAG_PRODUCER, "PRODUCER"},
+};
+
+// The names of the tags registered with RegisterTag(), filled in order.
+std::atomic<const char*> g_dynamic_tag_names[kMaxDynamicTags]{};
+
+// The ring of the current thread. This is a POD to keep the access cheap,
+// the ring is released by ThreadRingReleaser when the thread exits.
+thread_local RingBuffer::ThreadRing* g_thread_ring = nullptr;
+
+struct ThreadRingReleaser {
+  ~ThreadRingReleaser() {
+    if (!g_thread_ring)
+      return;
+    g_thread_ring->in_use.store(false, std::memory_order_release);
+    g_thread_ring = nullptr;
+  }
+  bool armed = false;
+};
+thread_local ThreadRingReleaser g_thread_ring_releaser;
+
 // std::function<> is not trivially de/constructible. This struct wraps it in a
 // heap-allocated struct to avoid static initializers.
 struct Delegate {
@@ -69,6 +130,52 @@ bool Enable(std::function<void()> read_task,
   return true;
 }
 
+uint32_t RegisterTag(const char* name) {
+  PERFETTO_DCHECK(name && *name);
+  if (uint32_t tag = LookupTag(name))
+    return tag;
+  // Slots are taken in order, so a concurrent registration of the same name
+  // is found before any free slot.
+  for (uint32_t i = 0; i < kMaxDynamicTags; i++) {
+    const char* expected = nullptr;
+    if (g_dynamic_tag_names[i].compare_exchange_strong(
+            expected, name, std::memory_order_acq_rel) ||
+        strcmp(expected, name) == 0) {
+      return 1u << (kFirstDynamicTagBit + i);
+    }
+  }
+  PERFETTO_ELOG("Too many metatrace tags, cannot register %s", name);
+  return TAG_NONE;
+}
+
+const char* GetTagName(uint32_t tag) {
+  for (const StaticTag& static_tag : kStaticTags) {
+    if (static_tag.tag == tag)
+      return static_tag.name;
+  }
+  for (uint32_t i = 0; i < kMaxDynamicTags; i++) {
+    if (tag == 1u << (kFirstDynamicTagBit + i))
+      return g_dynamic_tag_names[i].load(std::memory_order_acquire);
+  }
+  return nullptr;
+}
+
+uint32_t LookupTag(const std::string& name) {
+  for (const StaticTag& static_tag : kStaticTags) {
+    if (name == static_tag.name)
+      return static_tag.tag;
+  }
+  for (uint32_t i = 0; i < kMaxDynamicTags; i++) {
+    const char* tag_name =
+        g_dynamic_tag_names[i].load(std::memory_order_acquire);
+    if (!tag_name)
+      break;
+    if (name == tag_name)
+      return 1u << (kFirstDynamicTagBit + i);
+  }
+  return TAG_NONE;
+}
+
 void Disable() {
   g_enabled_tags.store(0, std::memory_order_release);
   Delegate* dg = Delegate::GetInstance();
@@ -81,28 +188,76 @@ void Disable() {
 // static
 void RingBuffer::Reset() {
   bankruptcy_record_.clear();
-  for (Record& record : records_)
-    record.clear();
-  wr_index_ = 0;
-  rd_index_ = 0;
+  // |wr_index| belongs to the writer threads, drop the records by moving the
+  // read index instead.
+  for (ThreadRing* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    for (Record& record : ring->records)
+      record.clear();
+    ring->rd_index.store(ring->wr_index.load(std::memory_order_acquire),
+                         std::memory_order_release);
+  }
   has_overruns_ = false;
   read_task_queued_ = false;
 }
 
+// static
+RingBuffer::ThreadRing* RingBuffer::GetThreadRing() {
+  if (PERFETTO_LIKELY(g_thread_ring))
+    return g_thread_ring;
+
+  // Take over the ring of a thread that exited, if any. Its records that were
+  // not read yet are preserved, they carry the old |thread_id|.
+  ThreadRing* ring = rings_.load(std::memory_order_acquire);
+  for (; ring; ring = ring->next) {
+    bool expected = false;
+    if (!ring->in_use.load(std::memory_order_relaxed) &&
+        ring->in_use.compare_exchange_strong(expected, true,
+                                             std::memory_order_acq_rel)) {
+      break;
+    }
+  }
+
+  if (!ring) {
+    ring = new ThreadRing();
+    ring->in_use.store(true, std::memory_order_relaxed);
+    ThreadRing* head = rings_.load(std::memory_order_relaxed);
+    do {
+      ring->next = head;
+    } while (!rings_.compare_exchange_weak(head, ring,
+                                           std::memory_order_acq_rel));
+  }
+
+  ring->thread_id = static_cast<uint32_t>(base::GetThreadId());
+  g_thread_ring = ring;
+  g_thread_ring_releaser.armed = true;  // Registers the exit destructor.
+  return ring;
+}
+
 // static
 Record* RingBuffer::AppendNewRecord() {
-  auto wr_index = wr_index_.fetch_add(1, std::memory_order_acq_rel);
+  ThreadRing* ring = GetThreadRing();
+  auto wr_index = ring->wr_index.load(std::memory_order_relaxed);
 
   // rd_index can only monotonically increase, we don't care if we read an
   // older value, we'll just hit the slow-path a bit earlier if it happens.
-  auto rd_index = rd_index_.load(std::memory_order_relaxed);
+  // The acquire pairs with the reader's release and guarantees that the reader
+  // is done with (and has cleared) the records before rd_index.
+  auto rd_index = ring->rd_index.load(std::memory_order_acquire);
 
   PERFETTO_DCHECK(wr_index >= rd_index);
-  auto size = wr_index - rd_index;
-  if (PERFETTO_LIKELY(size < kCapacity / 2))
-    return At(wr_index);
+  if (PERFETTO_UNLIKELY(wr_index - rd_index >= kCapacity / 2))
+    return AppendNewRecordSlow(ring);
+
+  Record* record = ring->At(wr_index);
+  record->thread_id = ring->thread_id;
+  ring->wr_index.store(wr_index + 1, std::memory_order_release);
+  return record;
+}
 
-  // Slow-path: Enqueue the read task and handle overruns.
+// static
+Record* RingBuffer::AppendNewRecordSlow(ThreadRing* ring) {
+  // Enqueue the read task and handle overruns.
   bool expected = false;
   if (RingBuffer::read_task_queued_.compare_exchange_strong(expected, true)) {
     Delegate* dg = Delegate::GetInstance();
@@ -117,11 +272,16 @@ Record* RingBuffer::AppendNewRecord() {
     }
   }
 
-  if (PERFETTO_LIKELY(size < kCapacity))
-    return At(wr_index);
+  auto wr_index = ring->wr_index.load(std::memory_order_relaxed);
+  auto rd_index = ring->rd_index.load(std::memory_order_acquire);
+  if (PERFETTO_LIKELY(wr_index - rd_index < kCapacity)) {
+    Record* record = ring->At(wr_index);
+    record->thread_id = ring->thread_id;
+    ring->wr_index.store(wr_index + 1, std::memory_order_release);
+    return record;
+  }
 
   has_overruns_.store(true, std::memory_order_release);
-  wr_index_.fetch_sub(1, std::memory_order_acq_rel);
 
   // In the case of overflows, threads will race writing on the same memory
   // location and TSan will rightly complain. This is fine though because nobody
@@ -131,6 +291,102 @@ Record* RingBuffer::AppendNewRecord() {
   return &bankruptcy_record_;
 }
 
+// static
+RingBuffer::ReadIterator RingBuffer::GetReadIterator() {
+  PERFETTO_DCHECK(RingBuffer::IsOnValidTaskRunner());
+  ReadIterator it;
+  for (ThreadRing* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    auto rd_index = ring->rd_index.load(std::memory_order_relaxed);
+    auto wr_index = ring->wr_index.load(std::memory_order_acquire);
+    if (rd_index == wr_index)
+      continue;
+    it.cursors_.push_back(ReadIterator::Cursor{ring, rd_index, wr_index, {}});
+    it.LoadRecord(&it.cursors_.back());
+  }
+  it.SelectEarliest();
+  return it;
+}
+
+// static
+uint64_t RingBuffer::GetSizeForTesting() {
+  uint64_t size = 0;
+  for (ThreadRing* ring = rings_.load(std::memory_order_acquire); ring;
+       ring = ring->next) {
+    auto wr_index = ring->wr_index.load(std::memory_order_relaxed);
+    auto rd_index = ring->rd_index.load(std::memory_order_relaxed);
+    PERFETTO_DCHECK(wr_index >= rd_index);
+    size += wr_index - rd_index;
+  }
+  return size;
+}
+
+RingBuffer::ReadIterator::ReadIterator() : valid_(true) {}
+
+RingBuffer::ReadIterator::ReadIterator(ReadIterator&& other) noexcept {
+  PERFETTO_DCHECK(other.valid_);
+  cursors_ = std::move(other.cursors_);
+  cur_ = other.cur_;
+  valid_ = other.valid_;
+  other.valid_ = false;
+}
+
+RingBuffer::ReadIterator::~ReadIterator() {
+  if (!valid_)
+    return;
+  for (const Cursor& cursor : cursors_)
+    cursor.ring->rd_index.store(cursor.index, std::memory_order_release);
+}
+
+RingBuffer::ReadIterator& RingBuffer::ReadIterator::operator++() {
+  PERFETTO_DCHECK(cur_ < cursors_.size());
+  Cursor& cursor = cursors_[cur_];
+  // Once a record has been read, mark it as free clearing its type_and_id,
+  // so if we encounter it in another read iteration while being written
+  // we know it's not fully written yet.
+  // The memory_order_relaxed below is enough because:
+  // - The reader is single-threaded and doesn't re-read the same records.
+  // - Before starting a read batch, the reader has an acquire barrier on
+  //   |wr_index|.
+  // - After terminating a read batch, the ~ReadIterator dtor updates the
+  //   |rd_index| of each ring with a release-store, which the writer reads
+  //   with an acquire-load before reusing the record.
+  Record* record = cursor.ring->At(cursor.index);
+  record->type_and_id.store(0, std::memory_order_relaxed);
+  ++cursor.index;
+  LoadRecord(&cursor);
+  SelectEarliest();
+  return *this;
+}
+
+void RingBuffer::ReadIterator::LoadRecord(Cursor* cursor) {
+  cursor->record = nullptr;
+  if (cursor->index == cursor->end)
+    return;
+  const Record* record = cursor->ring->At(cursor->index);
+  if (record->type_and_id.load(std::memory_order_acquire) == 0)
+    return;  // Not fully written yet, stop reading this ring.
+  cursor->record = record;
+}
+
+void RingBuffer::ReadIterator::SelectEarliest() {
+  // The records of a ring are in timestamp order, so the next one overall is
+  // the earliest of the rings' next ones. The number of rings is the number
+  // of threads, a linear scan is cheaper than a heap.
+  cur_ = cursors_.size();
+  uint64_t earliest = 0;
+  for (size_t i = 0; i < cursors_.size(); i++) {
+    const Record* record = cursors_[i].record;
+    if (!record)
+      continue;
+    uint64_t ts = record->timestamp_ns();
+    if (cur_ == cursors_.size() || ts < earliest) {
+      cur_ = i;
+      earliest = ts;
+    }
+  }
+}
+
 // static
 bool RingBuffer::IsOnValidTaskRunner() {
   auto* task_runner = Delegate::GetInstance()->task_runner;
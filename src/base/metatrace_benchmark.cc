@@ -0,0 +1,79 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <optional>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/metatrace.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/unix_task_runner.h"
+
+namespace {
+
+namespace m = ::perfetto::metatrace;
+
+// Meta-tracing must be enabled on a task runner, which also runs the reader
+// that drains the ring buffer(s) when they are half full.
+class MetatraceFixture : public benchmark::Fixture {
+ public:
+  void SetUp(const benchmark::State& state) override {
+    if (state.thread_index() != 0)
+      return;
+    task_runner_.emplace(
+        perfetto::base::ThreadTaskRunner::CreateAndStart("metatrace_rd"));
+    perfetto::base::TaskRunner* task_runner = task_runner_->get();
+    task_runner_->PostTaskAndWaitForTesting([task_runner] {
+      m::Enable(
+          [] {
+            for (auto it = m::RingBuffer::GetReadIterator(); it; ++it)
+              benchmark::DoNotOptimize(it->counter_value);
+          },
+          task_runner, m::TAG_ANY);
+    });
+  }
+
+  void TearDown(const benchmark::State& state) override {
+    if (state.thread_index() != 0)
+      return;
+    task_runner_->PostTaskAndWaitForTesting([] { m::Disable(); });
+    task_runner_.reset();
+  }
+
+ private:
+  std::optional<perfetto::base::ThreadTaskRunner> task_runner_;
+};
+
+}  // namespace
+
+BENCHMARK_DEFINE_F(MetatraceFixture, BM_MetatraceCounter)
+(benchmark::State& state) {
+  int32_t value = 0;
+  for (auto _ : state)
+    m::TraceCounter(m::TAG_ANY, /*id=*/1, value++);
+}
+
+BENCHMARK_DEFINE_F(MetatraceFixture, BM_MetatraceScopedEvent)
+(benchmark::State& state) {
+  for (auto _ : state) {
+    m::ScopedEvent evt(m::TAG_ANY, /*id=*/1);
+  }
+}
+
+BENCHMARK_REGISTER_F(MetatraceFixture, BM_MetatraceCounter)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
+BENCHMARK_REGISTER_F(MetatraceFixture, BM_MetatraceScopedEvent)
+    ->ThreadRange(1, 8)
+    ->UseRealTime();
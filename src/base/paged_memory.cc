@@ -24,8 +24,26 @@
 #include <Windows.h>
 #else  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include <sys/mman.h>
+#include <unistd.h>
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_splitter.h"
+#define PERFETTO_HAS_HUGE_PAGES() 1
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+#else
+#define PERFETTO_HAS_HUGE_PAGES() 0
+#endif
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/container_annotations.h"
 #include "perfetto/ext/base/utils.h"
@@ -48,32 +66,149 @@ size_t GuardSize() {
   return GetSysPageSize();
 }
 
+#if PERFETTO_HAS_HUGE_PAGES()
+constexpr size_t kDefaultHugePageSize = 2 * 1024 * 1024;  // 2MB
+
+// Returns the default huge page size of the kernel (the "Hugepagesize" of
+// /proc/meminfo), which is also the size of transparent huge pages.
+size_t GetHugePageSize() {
+  static const size_t huge_page_size = [] {
+    std::string meminfo;
+    if (!ReadFile("/proc/meminfo", &meminfo))
+      return kDefaultHugePageSize;
+    for (StringSplitter lines(std::move(meminfo), '\n'); lines.Next();) {
+      size_t size_kb = 0;
+      if (sscanf(lines.cur_token(), "Hugepagesize: %zu kB", &size_kb) == 1 &&
+          size_kb > 0 && (size_kb & (size_kb - 1)) == 0) {
+        return size_kb * 1024;
+      }
+    }
+    return kDefaultHugePageSize;
+  }();
+  return huge_page_size;
+}
+#endif  // PERFETTO_HAS_HUGE_PAGES()
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+// Maps |usable_size| bytes of anonymous memory preceded and followed by
+// GuardSize() bytes, which the caller protects. The usable region is aligned
+// to |alignment|: the mapping is over-sized and then trimmed to fit. Returns
+// the start of the usable region, or nullptr if the mmap() fails.
+char* MapAligned(size_t usable_size, size_t alignment) {
+  const size_t slack = alignment > GetSysPageSize() ? alignment : 0;
+  const size_t outer_size = usable_size + GuardSize() * 2 + slack;
+  void* ptr = mmap(nullptr, outer_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED)
+    return nullptr;
+  PERFETTO_CHECK(ptr);
+  char* const outer_begin = reinterpret_cast<char*>(ptr);
+  char* const usable_region = reinterpret_cast<char*>(AlignUp(
+      reinterpret_cast<uintptr_t>(outer_begin + GuardSize()), alignment));
+  char* const head_end = usable_region - GuardSize();
+  char* const tail_begin = usable_region + usable_size + GuardSize();
+  int res = 0;
+  if (head_end > outer_begin)
+    res |= munmap(outer_begin, static_cast<size_t>(head_end - outer_begin));
+  if (outer_begin + outer_size > tail_begin) {
+    res |= munmap(tail_begin,
+                  static_cast<size_t>(outer_begin + outer_size - tail_begin));
+  }
+  PERFETTO_CHECK(res == 0);
+  return usable_region;
+}
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
+#if PERFETTO_HAS_HUGE_PAGES()
+// Maps a guard page at |addr|, unless something else is mapped there.
+bool MapGuardAt(char* addr) {
+  void* ptr = mmap(addr, GuardSize(), PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+  if (ptr == MAP_FAILED)
+    return false;
+  if (ptr != addr) {
+    // Kernels older than 4.17 take MAP_FIXED_NOREPLACE as a mere hint.
+    munmap(ptr, GuardSize());
+    return false;
+  }
+  return true;
+}
+
+// Maps |size| bytes (a multiple of the huge page size) from the hugetlbfs
+// pool, between two guard pages. The mapping can't be placed over a
+// placeholder with MAP_FIXED, as Allocate() does for alignment: on failure,
+// some kernels leave the placeholder unmapped. Returns nullptr if the pool is
+// too small or the guard pages can't be mapped next to the memory.
+char* MapHugeTlb(size_t size) {
+  void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+  if (ptr == MAP_FAILED)
+    return nullptr;
+  char* const region = reinterpret_cast<char*>(ptr);
+  const bool guard_before = MapGuardAt(region - GuardSize());
+  const bool guard_after = MapGuardAt(region + size);
+  if (guard_before && guard_after)
+    return region;
+  if (guard_before)
+    munmap(region - GuardSize(), GuardSize());
+  if (guard_after)
+    munmap(region + size, GuardSize());
+  munmap(region, size);
+  return nullptr;
+}
+#endif  // PERFETTO_HAS_HUGE_PAGES()
+
 }  // namespace
 
 // static
 PagedMemory PagedMemory::Allocate(size_t req_size, int flags) {
   size_t rounded_up_size = RoundUpToSysPageSize(req_size);
   PERFETTO_CHECK(rounded_up_size >= req_size);
-  size_t outer_size = rounded_up_size + GuardSize() * 2;
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  size_t outer_size = rounded_up_size + GuardSize() * 2;
   void* ptr = VirtualAlloc(nullptr, outer_size, MEM_RESERVE, PAGE_NOACCESS);
   if (!ptr && (flags & kMayFail))
     return PagedMemory();
   PERFETTO_CHECK(ptr);
   char* usable_region = reinterpret_cast<char*>(ptr) + GuardSize();
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  void* ptr = mmap(nullptr, outer_size, PROT_READ | PROT_WRITE,
-                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-  if (ptr == MAP_FAILED && (flags & kMayFail))
-    return PagedMemory();
-  PERFETTO_CHECK(ptr && ptr != MAP_FAILED);
-  char* usable_region = reinterpret_cast<char*>(ptr) + GuardSize();
-  int res = mprotect(ptr, GuardSize(), PROT_NONE);
-  res |= mprotect(usable_region + rounded_up_size, GuardSize(), PROT_NONE);
-  PERFETTO_CHECK(res == 0);
+  HugePages huge_pages = HugePages::kNone;
+  size_t mapped_size = rounded_up_size;
+  size_t alignment = GetSysPageSize();
+  char* usable_region = nullptr;
+#if PERFETTO_HAS_HUGE_PAGES()
+  if (flags & kHugeTlb) {
+    const size_t huge_size = AlignUp(rounded_up_size, GetHugePageSize());
+    usable_region = MapHugeTlb(huge_size);
+    if (usable_region) {
+      mapped_size = huge_size;
+      huge_pages = HugePages::kHugeTlb;
+    }
+  }
+  if (flags & (kHugePages | kHugeTlb))
+    alignment = GetHugePageSize();
+#endif
+  if (!usable_region) {
+    usable_region = MapAligned(mapped_size, alignment);
+    if (!usable_region && (flags & kMayFail))
+      return PagedMemory();
+    PERFETTO_CHECK(usable_region);
+#if PERFETTO_HAS_HUGE_PAGES()
+    if ((flags & (kHugePages | kHugeTlb)) &&
+        madvise(usable_region, mapped_size, MADV_HUGEPAGE) == 0) {
+      huge_pages = HugePages::kTransparent;
+    }
+#endif
+    int res = mprotect(usable_region - GuardSize(), GuardSize(), PROT_NONE);
+    res |= mprotect(usable_region + mapped_size, GuardSize(), PROT_NONE);
+    PERFETTO_CHECK(res == 0);
+  }
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 
   auto memory = PagedMemory(usable_region, req_size);
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  memory.huge_pages_ = huge_pages;
+#endif
 #if TRACK_COMMITTED_SIZE()
   size_t initial_commit = req_size;
   if (flags & kDontCommit)
@@ -83,6 +218,35 @@ PagedMemory PagedMemory::Allocate(size_t req_size, int flags) {
   return memory;
 }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+// static
+PagedMemory PagedMemory::AllocateFileBacked(int fd, size_t req_size, int flags) {
+  const size_t rounded_up_size = RoundUpToSysPageSize(req_size);
+  PERFETTO_CHECK(rounded_up_size >= req_size);
+  if (ftruncate(fd, 0) != 0 ||
+      ftruncate(fd, static_cast<off_t>(rounded_up_size)) != 0) {
+    PERFETTO_PLOG("ftruncate() of the backing file failed");
+    return PagedMemory();
+  }
+
+  // Reserve the guard pages as Allocate() does, then map the file over the
+  // usable region: the destructor unmaps both at once. The page cache decides
+  // the page size of the file, so the huge page flags don't apply.
+  PagedMemory memory =
+      Allocate(req_size, (flags | kDontCommit) & ~(kHugePages | kHugeTlb));
+  if (!memory.IsValid())
+    return memory;
+  void* ptr = mmap(memory.p_, rounded_up_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_FIXED, fd, 0);
+  if (ptr == MAP_FAILED) {
+    PERFETTO_PLOG("mmap() of the backing file failed");
+    return PagedMemory();
+  }
+  PERFETTO_CHECK(ptr == memory.p_);
+  return memory;
+}
+#endif
+
 PagedMemory::PagedMemory() {}
 
 // clang-format off
@@ -111,7 +275,7 @@ PagedMemory::~PagedMemory() {
   BOOL res = VirtualFree(start, 0, MEM_RELEASE);
   PERFETTO_CHECK(res != 0);
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
-  const size_t outer_size = RoundUpToSysPageSize(size_) + GuardSize() * 2;
+  const size_t outer_size = MappedSize() + GuardSize() * 2;
   int res = munmap(start, outer_size);
   PERFETTO_CHECK(res == 0);
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -128,6 +292,9 @@ bool PagedMemory::AdviseDontNeed(void* p, size_t size) {
   return false;
 #else   // PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) ||
         // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // hugetlb pages can only be discarded whole.
+  if (huge_pages_ == HugePages::kHugeTlb)
+    return false;
   // http://man7.org/linux/man-pages/man2/madvise.2.html
   int res = madvise(p, size, MADV_DONTNEED);
   PERFETTO_DCHECK(res == 0);
@@ -136,6 +303,50 @@ bool PagedMemory::AdviseDontNeed(void* p, size_t size) {
         // PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
 }
 
+size_t PagedMemory::MappedSize() const {
+#if PERFETTO_HAS_HUGE_PAGES()
+  if (huge_pages_ == HugePages::kHugeTlb)
+    return AlignUp(size_, GetHugePageSize());
+#endif
+  return RoundUpToSysPageSize(size_);
+}
+
+size_t PagedMemory::GetHugePageBytes() const {
+#if PERFETTO_HAS_HUGE_PAGES()
+  if (!p_)
+    return 0;
+  std::string smaps;
+  if (!ReadFile("/proc/self/smaps", &smaps))
+    return 0;
+  const uintptr_t begin = reinterpret_cast<uintptr_t>(p_);
+  const uintptr_t end = begin + MappedSize();
+  // smaps lists each mapping as a "start-end perms ..." header followed by
+  // "Field: value" lines. Sums the huge page fields of the mappings which
+  // overlap the memory.
+  bool overlaps = false;
+  size_t huge_kb = 0;
+  for (StringSplitter lines(std::move(smaps), '\n'); lines.Next();) {
+    const char* line = lines.cur_token();
+    uintptr_t vma_begin = 0;
+    uintptr_t vma_end = 0;
+    if (sscanf(line, "%" SCNxPTR "-%" SCNxPTR " ", &vma_begin, &vma_end) ==
+        2) {
+      overlaps = vma_begin < end && vma_end > begin;
+      continue;
+    }
+    size_t kb = 0;
+    if (overlaps && (sscanf(line, "AnonHugePages: %zu kB", &kb) == 1 ||
+                     sscanf(line, "Private_Hugetlb: %zu kB", &kb) == 1 ||
+                     sscanf(line, "Shared_Hugetlb: %zu kB", &kb) == 1)) {
+      huge_kb += kb;
+    }
+  }
+  return huge_kb * 1024;
+#else
+  return 0;
+#endif  // PERFETTO_HAS_HUGE_PAGES()
+}
+
 #if TRACK_COMMITTED_SIZE()
 void PagedMemory::EnsureCommitted(size_t committed_size) {
   PERFETTO_DCHECK(committed_size <= size_);
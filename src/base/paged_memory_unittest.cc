@@ -17,8 +17,11 @@
 #include "perfetto/ext/base/paged_memory.h"
 
 #include <stdint.h>
+#include <string.h>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/vm_test_utils.h"
 #include "test/gtest_and_gmock.h"
@@ -29,6 +32,11 @@
 #include <sys/resource.h>
 #endif
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace perfetto {
 namespace base {
 namespace {
@@ -216,6 +224,88 @@ TEST(PagedMemoryTest, Unchecked) {
 #pragma GCC diagnostic pop
 #endif
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+TEST(PagedMemoryTest, FileBacked) {
+  const size_t kSize = GetSysPageSize() * 4;
+  TempFile file = TempFile::CreateUnlinked();
+  // Stale contents are discarded.
+  ASSERT_EQ(WriteAll(file.fd(), "stale", 5), 5);
+  {
+    PagedMemory mem = PagedMemory::AllocateFileBacked(file.fd(), kSize);
+    ASSERT_TRUE(mem.IsValid());
+    ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(mem.Get()) % GetSysPageSize());
+    auto* ptr = static_cast<char*>(mem.Get());
+    for (size_t i = 0; i < kSize; i++)
+      ASSERT_EQ(ptr[i], 0);
+    ptr[0] = 'a';
+    ptr[kSize - 1] = 'z';
+  }
+
+  // The writes went to the file, which is sparse where nothing was written.
+  struct stat st {};
+  ASSERT_EQ(fstat(file.fd(), &st), 0);
+  ASSERT_EQ(static_cast<size_t>(st.st_size), kSize);
+  char c = 0;
+  ASSERT_EQ(pread(file.fd(), &c, 1, 0), 1);
+  ASSERT_EQ(c, 'a');
+  ASSERT_EQ(pread(file.fd(), &c, 1, static_cast<off_t>(kSize - 1)), 1);
+  ASSERT_EQ(c, 'z');
+}
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+TEST(PagedMemoryTest, HugePages) {
+  const size_t kHugePageSize = 2 * 1024 * 1024;
+  const size_t kSize = kHugePageSize * 2 + GetSysPageSize();
+  void* ptr_raw = nullptr;
+  {
+    PagedMemory mem = PagedMemory::Allocate(kSize, PagedMemory::kHugePages);
+    ASSERT_TRUE(mem.IsValid());
+    ptr_raw = mem.Get();
+    // The memory is aligned so that it can be backed by huge pages, if the
+    // kernel supports THP.
+    if (mem.huge_pages() == PagedMemory::HugePages::kTransparent) {
+      ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(ptr_raw) % kHugePageSize);
+    }
+    auto* ptr = static_cast<char*>(ptr_raw);
+    for (size_t i = 0; i < kSize; i += GetSysPageSize()) {
+      ASSERT_EQ(ptr[i], 0);
+      ptr[i] = 'x';
+    }
+    ASSERT_LE(mem.GetHugePageBytes(), mem.size());
+    volatile char* raw = ptr;
+    EXPECT_DEATH_IF_SUPPORTED({ raw[-1] = 'x'; }, ".*");
+    EXPECT_DEATH_IF_SUPPORTED({ raw[kSize] = 'x'; }, ".*");
+  }
+  ASSERT_FALSE(vm_test_utils::IsMapped(ptr_raw, kSize));
+}
+
+// The hugetlbfs pool is usually empty, in which case the allocation falls
+// back to transparent huge pages.
+TEST(PagedMemoryTest, HugeTlb) {
+  const size_t kSize = GetSysPageSize() * 3;
+  void* ptr_raw = nullptr;
+  {
+    PagedMemory mem = PagedMemory::Allocate(
+        kSize, PagedMemory::kHugeTlb | PagedMemory::kDontCommit);
+    ASSERT_TRUE(mem.IsValid());
+    ptr_raw = mem.Get();
+    auto* ptr = static_cast<char*>(ptr_raw);
+    for (size_t i = 0; i < kSize; i++)
+      ASSERT_EQ(ptr[i], 0);
+    memset(ptr, 'x', kSize);
+    if (mem.huge_pages() == PagedMemory::HugePages::kHugeTlb) {
+      EXPECT_FALSE(mem.AdviseDontNeed(ptr, kSize));
+      EXPECT_GT(mem.GetHugePageBytes(), 0u);
+    }
+    volatile char* raw = ptr;
+    EXPECT_DEATH_IF_SUPPORTED({ raw[-1] = 'x'; }, ".*");
+  }
+  ASSERT_FALSE(vm_test_utils::IsMapped(ptr_raw, kSize));
+}
+#endif  // OS_LINUX || OS_ANDROID
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
@@ -19,11 +19,13 @@
 #include "perfetto/ext/base/unix_task_runner.h"
 
 #include <thread>
+#include <vector>
 
 #include "perfetto/ext/base/event_fd.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/pipe.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/gtest_test_suite.h"
 #include "test/gtest_and_gmock.h"
@@ -384,8 +386,36 @@ TEST_F(TaskRunnerTest, FileDescriptorClosedEvent) {
   task_runner.Run();
 }
 
+// Regular files can't be added to an epoll set. Like poll(2) does, the task
+// runner treats them as always readable.
+TEST_F(TaskRunnerTest, RegularFileWatch) {
+  auto& task_runner = this->task_runner;
+  TempFile file = TempFile::Create();
+  int num_calls = 0;
+  task_runner.AddFileDescriptorWatch(file.fd(), [&] {
+    if (++num_calls == 3) {
+      task_runner.RemoveFileDescriptorWatch(file.fd());
+      task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 10);
+    }
+  });
+  task_runner.Run();
+  EXPECT_EQ(num_calls, 3);
+}
+
 #endif
 
+TEST_F(TaskRunnerTest, DelayedTasksRunInDeadlineOrder) {
+  auto& task_runner = this->task_runner;
+  std::vector<int> order;
+  for (int i = 0; i < 8; i++) {
+    task_runner.PostDelayedTask([&order, i] { order.push_back(i); },
+                                static_cast<uint32_t>(80 - i * 10));
+  }
+  task_runner.PostDelayedTask([&task_runner] { task_runner.Quit(); }, 100);
+  task_runner.Run();
+  EXPECT_EQ(order, std::vector<int>({7, 6, 5, 4, 3, 2, 1, 0}));
+}
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
@@ -15,18 +15,84 @@
  */
 
 #include "perfetto/ext/base/threading/thread_pool.h"
+#include <algorithm>
+#include <atomic>
 #include <mutex>
 #include <thread>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+
 namespace perfetto {
 namespace base {
 
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+constexpr uint32_t kWasmMaxConcurrency = 4;
+
+// The threads of all the pools come from the Web Workers preallocated for
+// PTHREAD_POOL_SIZE (see gn/standalone/wasm.gni): starting one more deadlocks,
+// as the thread starting it waits for its tasks without ever yielding to the
+// JS event loop. The pools alive at the same time (sorting, tokenization,
+// span joins, heap graphs, perf and bugreport import, queries, ...) share
+// this many threads, which leaves some of the workers for other threads.
+// Keep below PTHREAD_POOL_SIZE.
+constexpr uint32_t kWasmMaxPoolThreads = 16;
+std::atomic<uint32_t> g_wasm_pool_threads{0};
+
+// Returns how many of the |requested| threads a new pool can start. Each pool
+// gets at least one thread, as most of them wait for the tasks they post.
+uint32_t ReserveWasmPoolThreads(uint32_t requested) {
+  uint32_t used = g_wasm_pool_threads.load();
+  uint32_t granted;
+  do {
+    uint32_t available = used < kWasmMaxPoolThreads
+                             ? kWasmMaxPoolThreads - used
+                             : 0;
+    granted = std::min(requested, std::max(available, 1u));
+  } while (!g_wasm_pool_threads.compare_exchange_weak(used, used + granted));
+  if (granted < requested) {
+    PERFETTO_DLOG("Thread pool capped to %u of %u threads", granted,
+                  requested);
+  }
+  return granted;
+}
+#endif
+
+// The pool and the worker of the calling thread, if it's a thread of a pool.
+thread_local const ThreadPool* g_current_pool = nullptr;
+thread_local void* g_current_worker = nullptr;
+
+}  // namespace
+
 ThreadPool::ThreadPool(uint32_t thread_count) {
+#if PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  thread_count = ReserveWasmPoolThreads(thread_count);
+#endif
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    workers_.emplace_back(new Worker());
+    workers_.back()->index = i;
+  }
   for (uint32_t i = 0; i < thread_count; ++i) {
-    threads_.emplace_back(std::bind(&ThreadPool::RunThreadLoop, this));
+    threads_.emplace_back(std::bind(&ThreadPool::RunThreadLoop, this, i));
   }
 }
 
+// static
+uint32_t ThreadPool::MaxConcurrency() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  return 1;
+#else
+  uint32_t count = std::max(std::thread::hardware_concurrency(), 1u);
+#if PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  count = std::min(count, kWasmMaxConcurrency);
+#endif
+  return count;
+#endif
+}
+
 ThreadPool::~ThreadPool() {
   {
     std::lock_guard<std::mutex> guard(mutex_);
@@ -36,36 +102,146 @@ ThreadPool::~ThreadPool() {
   for (auto& thread : threads_) {
     thread.join();
   }
+#if PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  g_wasm_pool_threads.fetch_sub(static_cast<uint32_t>(threads_.size()));
+#endif
 }
 
-void ThreadPool::PostTask(std::function<void()> fn) {
-  std::lock_guard<std::mutex> guard(mutex_);
-  pending_tasks_.emplace_back(std::move(fn));
-  if (thread_waiting_count_ == 0) {
-    return;
+void ThreadPool::PostTask(Task task) {
+  Worker* self = CurrentWorker();
+  if (self) {
+    std::lock_guard<std::mutex> guard(self->mutex);
+    self->tasks.emplace_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> guard(shared_mutex_);
+    shared_tasks_.emplace_back(std::move(task));
   }
+
+  // Pairs with the check of |pending_count_| by the threads going to sleep in
+  // RunThreadLoop(): either they see the new task or they get notified.
+  pending_count_.fetch_add(1);
+  if (sleeping_count_.load() == 0)
+    return;
+  std::lock_guard<std::mutex> guard(mutex_);
   thread_waiter_.notify_one();
 }
 
-void ThreadPool::RunThreadLoop() {
+void ThreadPool::ParallelFor(size_t count,
+                             const std::function<void(size_t)>& fn) {
+  if (count == 0)
+    return;
+
+  struct State {
+    std::atomic<size_t> next_index{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t running_tasks = 0;  // Guarded by |mutex|.
+  };
+  State state;
+  auto run_indices = [&state, &fn, count] {
+    for (;;) {
+      size_t i = state.next_index.fetch_add(1);
+      if (i >= count)
+        break;
+      fn(i);
+    }
+  };
+
+  // The calling thread takes a share of the indices too, so don't post more
+  // tasks than there are other threads or indices.
+  size_t task_count = std::min(threads_.size(), count - 1);
+  state.running_tasks = task_count;
+  for (size_t i = 0; i < task_count; ++i) {
+    PostTask([&state, &run_indices] {
+      run_indices();
+      std::lock_guard<std::mutex> guard(state.mutex);
+      if (--state.running_tasks == 0)
+        state.done.notify_one();
+    });
+  }
+  run_indices();
+
+  // The tasks reference |state|: wait for all of them, including the ones
+  // which found no index left. Help with the pending tasks meanwhile. If there
+  // are none, the remaining tasks are already running on other threads.
   for (;;) {
-    std::function<void()> fn;
     {
-      std::unique_lock<std::mutex> guard(mutex_);
-      if (quit_) {
+      std::lock_guard<std::mutex> guard(state.mutex);
+      if (state.running_tasks == 0)
         return;
-      }
-      if (pending_tasks_.empty()) {
-        thread_waiting_count_++;
-        thread_waiter_.wait(
-            guard, [this]() { return quit_ || !pending_tasks_.empty(); });
-        thread_waiting_count_--;
-        continue;
-      }
-      fn = std::move(pending_tasks_.front());
-      pending_tasks_.pop_front();
     }
-    fn();
+    if (RunPendingTask())
+      continue;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.done.wait(lock, [&state] { return state.running_tasks == 0; });
+  }
+}
+
+ThreadPool::Worker* ThreadPool::CurrentWorker() {
+  if (g_current_pool != this)
+    return nullptr;
+  return static_cast<Worker*>(g_current_worker);
+}
+
+ThreadPool::Task ThreadPool::PopTask(Worker* self) {
+  Task task;
+  if (self) {
+    std::lock_guard<std::mutex> guard(self->mutex);
+    if (!self->tasks.empty()) {
+      task = std::move(self->tasks.back());
+      self->tasks.pop_back();
+    }
+  }
+  if (!task) {
+    std::lock_guard<std::mutex> guard(shared_mutex_);
+    if (!shared_tasks_.empty()) {
+      task = std::move(shared_tasks_.front());
+      shared_tasks_.pop_front();
+    }
+  }
+  // Steal the oldest task of another thread, starting from the next one to
+  // spread the thieves.
+  size_t self_index = self ? self->index : 0;
+  for (size_t i = 1; !task && i <= workers_.size(); ++i) {
+    Worker* victim = workers_[(self_index + i) % workers_.size()].get();
+    if (victim == self)
+      continue;
+    std::unique_lock<std::mutex> lock(victim->mutex, std::try_to_lock);
+    if (!lock.owns_lock() || victim->tasks.empty())
+      continue;
+    task = std::move(victim->tasks.front());
+    victim->tasks.pop_front();
+  }
+  if (task)
+    pending_count_.fetch_sub(1);
+  return task;
+}
+
+bool ThreadPool::RunPendingTask() {
+  Task task = PopTask(CurrentWorker());
+  if (!task)
+    return false;
+  task();
+  return true;
+}
+
+void ThreadPool::RunThreadLoop(size_t worker_index) {
+  Worker* self = workers_[worker_index].get();
+  g_current_pool = this;
+  g_current_worker = self;
+  while (!quit_.load()) {
+    Task task = PopTask(self);
+    if (task) {
+      task();
+      continue;
+    }
+    std::unique_lock<std::mutex> guard(mutex_);
+    if (quit_)
+      return;
+    sleeping_count_.fetch_add(1);
+    thread_waiter_.wait(
+        guard, [this]() { return quit_ || pending_count_.load() > 0; });
+    sleeping_count_.fetch_sub(1);
   }
 }
 
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2023 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
+
+namespace {
+
+using perfetto::base::ThreadPool;
+using perfetto::base::WaitableEvent;
+
+// The number of tasks or loop iterations per benchmark iteration.
+constexpr uint32_t kItems = 4096;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// The argument is the number of threads of the pool.
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(2);
+    return;
+  }
+  uint32_t max_threads = std::max(ThreadPool::MaxConcurrency(), 2u);
+  for (uint32_t threads = 1; threads <= max_threads; threads *= 2)
+    b->Arg(threads);
+}
+
+// A few hundred ns of CPU-bound work, to have the cost of the pool matter.
+uint64_t Work(uint64_t seed) {
+  for (uint32_t i = 0; i < 64; ++i)
+    seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+  return seed;
+}
+
+// Posts kItems independent tasks from the calling thread and waits for them.
+void BM_ThreadPoolPostTask(benchmark::State& state) {
+  ThreadPool pool(static_cast<uint32_t>(state.range(0)));
+  std::atomic<uint64_t> sink{0};
+  for (auto _ : state) {
+    std::atomic<uint32_t> remaining{kItems};
+    WaitableEvent done;
+    for (uint32_t i = 0; i < kItems; ++i) {
+      pool.PostTask([&sink, &remaining, &done, i] {
+        sink.fetch_add(Work(i), std::memory_order_relaxed);
+        if (remaining.fetch_sub(1) == 1)
+          done.Notify();
+      });
+    }
+    done.Wait();
+  }
+  benchmark::DoNotOptimize(sink.load());
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kItems);
+}
+
+// Runs kItems iterations of a ParallelFor() from the calling thread.
+void BM_ThreadPoolParallelFor(benchmark::State& state) {
+  ThreadPool pool(static_cast<uint32_t>(state.range(0)));
+  std::vector<uint64_t> results(kItems);
+  for (auto _ : state) {
+    pool.ParallelFor(kItems, [&results](size_t i) { results[i] = Work(i); });
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kItems);
+}
+
+// Runs kItems iterations split in nested ParallelFor() calls, i.e. tasks
+// posted by tasks, which are stolen by the idle threads.
+void BM_ThreadPoolNestedParallelFor(benchmark::State& state) {
+  constexpr uint32_t kOuter = 64;
+  ThreadPool pool(static_cast<uint32_t>(state.range(0)));
+  std::vector<uint64_t> results(kItems);
+  for (auto _ : state) {
+    pool.ParallelFor(kOuter, [&pool, &results](size_t outer) {
+      pool.ParallelFor(kItems / kOuter, [&results, outer](size_t inner) {
+        size_t i = outer * (kItems / kOuter) + inner;
+        results[i] = Work(i);
+      });
+    });
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * kItems);
+}
+
+}  // namespace
+
+BENCHMARK(BM_ThreadPoolPostTask)->Apply(BenchmarkArgs)->UseRealTime();
+BENCHMARK(BM_ThreadPoolParallelFor)->Apply(BenchmarkArgs)->UseRealTime();
+BENCHMARK(BM_ThreadPoolNestedParallelFor)->Apply(BenchmarkArgs)->UseRealTime();
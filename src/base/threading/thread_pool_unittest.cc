@@ -15,9 +15,12 @@
  */
 
 #include "perfetto/ext/base//threading/thread_pool.h"
+#include <array>
 #include <atomic>
 #include <condition_variable>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include "perfetto/ext/base/waitable_event.h"
 #include "test/gtest_and_gmock.h"
@@ -103,6 +106,74 @@ TEST(ThreadPoolTest, StressTest) {
   cv.wait(lock, [&count]() { return count == 1024u; });
 }
 
+TEST(ThreadPoolTest, TasksPostedByTasks) {
+  base::ThreadPool pool(4);
+  std::atomic<uint32_t> count{0};
+  base::WaitableEvent done;
+  for (uint32_t i = 0; i < 16; ++i) {
+    pool.PostTask([&pool, &count, &done] {
+      for (uint32_t j = 0; j < 16; ++j) {
+        pool.PostTask([&count, &done] {
+          if (++count == 256)
+            done.Notify();
+        });
+      }
+    });
+  }
+  done.Wait();
+  ASSERT_EQ(count.load(), 256u);
+}
+
+TEST(ThreadPoolTest, ParallelFor) {
+  base::ThreadPool pool(4);
+  std::vector<std::atomic<uint32_t>> runs(1000);
+  pool.ParallelFor(runs.size(), [&runs](size_t i) { runs[i]++; });
+  for (const auto& run : runs)
+    ASSERT_EQ(run.load(), 1u);
+
+  // No threads: everything runs on the calling thread.
+  base::ThreadPool empty_pool(0);
+  uint32_t count = 0;
+  empty_pool.ParallelFor(10, [&count](size_t) { count++; });
+  ASSERT_EQ(count, 10u);
+}
+
+TEST(ThreadPoolTest, NestedParallelFor) {
+  // More outer iterations than threads: all the threads end up waiting for
+  // nested loops, which must not deadlock.
+  base::ThreadPool pool(2);
+  std::atomic<uint32_t> count{0};
+  base::WaitableEvent done;
+  pool.PostTask([&pool, &count, &done] {
+    pool.ParallelFor(8, [&pool, &count](size_t) {
+      pool.ParallelFor(8, [&count](size_t) { count++; });
+    });
+    done.Notify();
+  });
+  done.Wait();
+  ASSERT_EQ(count.load(), 64u);
+}
+
+TEST(ThreadPoolTest, TaskStorage) {
+  uint32_t small_runs = 0;
+  base::ThreadPool::Task small([&small_runs] { small_runs++; });
+  base::ThreadPool::Task moved = std::move(small);
+  ASSERT_FALSE(small);
+  moved();
+  ASSERT_EQ(small_runs, 1u);
+
+  // Larger than the inline storage, and move-only.
+  std::array<char, base::ThreadPool::Task::kInlineSize + 1> payload{};
+  payload[0] = 'x';
+  auto owned = std::make_unique<uint32_t>(0);
+  uint32_t* owned_ptr = owned.get();
+  base::ThreadPool::Task large(
+      [payload, owned = std::move(owned)] { *owned += payload[0] == 'x'; });
+  moved = std::move(large);
+  moved();
+  ASSERT_EQ(*owned_ptr, 1u);
+}
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
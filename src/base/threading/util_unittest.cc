@@ -16,7 +16,9 @@
 
 #include "perfetto/ext/base/threading/util.h"
 
+#include <atomic>
 #include <optional>
+#include <vector>
 
 #include "perfetto/base/flat_set.h"
 #include "perfetto/base/platform_handle.h"
@@ -34,9 +36,10 @@ namespace perfetto {
 namespace base {
 namespace {
 
-int WaitForFutureReady(base::Future<int>& stream,
-                       base::FlatSet<base::PlatformHandle>& interested,
-                       PollContext& ctx) {
+template <typename T>
+T WaitForFutureReady(base::Future<T>& stream,
+                     base::FlatSet<base::PlatformHandle>& interested,
+                     PollContext& ctx) {
   auto res = stream.Poll(&ctx);
   for (; res.IsPending(); res = stream.Poll(&ctx)) {
     PERFETTO_CHECK(interested.size() == 1);
@@ -146,6 +149,20 @@ TEST(UtilUnittest, RunOnceOnThreadPool) {
   ASSERT_EQ(WaitForFutureReady(fut, interested, ctx), 1);
 }
 
+TEST(UtilUnittest, ParallelForOnThreadPool) {
+  base::FlatSet<base::PlatformHandle> interested;
+  base::FlatSet<base::PlatformHandle> ready;
+  PollContext ctx(&interested, &ready);
+
+  base::ThreadPool pool(2);
+  std::vector<std::atomic<uint32_t>> runs(100);
+  base::Future<FVoid> fut = base::ParallelForOnThreadPool(
+      &pool, runs.size(), [&runs](size_t i) { runs[i]++; });
+  WaitForFutureReady(fut, interested, ctx);
+  for (const auto& run : runs)
+    ASSERT_EQ(run.load(), 1u);
+}
+
 }  // namespace
 }  // namespace base
 }  // namespace perfetto
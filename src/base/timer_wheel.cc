@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/timer_wheel.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace base {
+
+namespace {
+
+uint64_t ToUnsigned(TimeMillis t) {
+  return static_cast<uint64_t>(std::max<int64_t>(t.count(), 0));
+}
+
+uint32_t CountLeadingZeros(uint64_t x) {
+  PERFETTO_DCHECK(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_clzll(x));
+#else
+  uint32_t n = 0;
+  for (uint64_t bit = 1ull << 63; !(x & bit); bit >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+uint32_t CountTrailingZeros(uint64_t x) {
+  PERFETTO_DCHECK(x != 0);
+#if defined(__GNUC__) || defined(__clang__)
+  return static_cast<uint32_t>(__builtin_ctzll(x));
+#else
+  uint32_t n = 0;
+  for (; !(x & 1); x >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+}  // namespace
+
+TimerWheel::TimerWheel(TimeMillis now)
+    : now_(ToUnsigned(now)), slots_(kNumLevels * kNumSlots) {}
+
+TimerWheel::~TimerWheel() = default;
+TimerWheel::TimerWheel(TimerWheel&&) noexcept = default;
+TimerWheel& TimerWheel::operator=(TimerWheel&&) noexcept = default;
+
+void TimerWheel::Add(TimeMillis deadline, Task task) {
+  Place(Entry{ToUnsigned(deadline), next_seq_++, std::move(task)});
+  size_++;
+}
+
+TimerWheel::Task TimerWheel::PopDue(TimeMillis now) {
+  AdvanceTo(ToUnsigned(now));
+  if (due_.empty())
+    return Task();
+  Task task = std::move(due_.front().task);
+  due_.pop_front();
+  size_--;
+  return task;
+}
+
+std::optional<TimeMillis> TimerWheel::NextDeadline() const {
+  if (!due_.empty())
+    return TimeMillis(static_cast<int64_t>(due_.front().deadline));
+  // The slots of a level cover increasing time ranges, so the earliest
+  // deadline is in the first occupied slot of one of the levels.
+  uint64_t deadline = UINT64_MAX;
+  for (uint32_t level = 0; level < kNumLevels; level++) {
+    if (!occupied_[level])
+      continue;
+    const uint32_t index = CountTrailingZeros(occupied_[level]);
+    deadline = std::min(deadline, GetSlot(level, index).min_deadline);
+  }
+  if (deadline == UINT64_MAX)
+    return std::nullopt;
+  return TimeMillis(static_cast<int64_t>(deadline));
+}
+
+void TimerWheel::Place(Entry entry) {
+  auto by_deadline_and_seq = [](const Entry& a, const Entry& b) {
+    return a.deadline < b.deadline ||
+           (a.deadline == b.deadline && a.seq < b.seq);
+  };
+  if (entry.deadline <= now_) {
+    due_.insert(std::upper_bound(due_.begin(), due_.end(), entry,
+                                 by_deadline_and_seq),
+                std::move(entry));
+    return;
+  }
+  const uint32_t highest_bit = 63 - CountLeadingZeros(entry.deadline ^ now_);
+  const uint32_t level = highest_bit / kSlotBits;
+  const uint32_t index =
+      static_cast<uint32_t>(entry.deadline >> (level * kSlotBits)) &
+      (kNumSlots - 1);
+  Slot& slot = GetSlot(level, index);
+  slot.min_deadline = std::min(slot.min_deadline, entry.deadline);
+  // Cascaded entries can be older than the ones added directly to the slot.
+  auto by_seq = [](const Entry& a, const Entry& b) { return a.seq < b.seq; };
+  slot.entries.insert(std::upper_bound(slot.entries.begin(),
+                                       slot.entries.end(), entry, by_seq),
+                      std::move(entry));
+  occupied_[level] |= 1ull << index;
+}
+
+std::optional<uint64_t> TimerWheel::NextSlotStart() const {
+  std::optional<uint64_t> start;
+  for (uint32_t level = 0; level < kNumLevels; level++) {
+    if (!occupied_[level])
+      continue;
+    // All the occupied slots of a level are after the current one: the slot
+    // of an entry is the digit where its deadline is greater than |now_|.
+    const uint32_t shift = level * kSlotBits;
+    const uint32_t index = CountTrailingZeros(occupied_[level]);
+    const uint64_t upper_mask =
+        shift + kSlotBits >= 64 ? 0 : ~0ull << (shift + kSlotBits);
+    const uint64_t slot_start =
+        (now_ & upper_mask) | (static_cast<uint64_t>(index) << shift);
+    PERFETTO_DCHECK(slot_start > now_);
+    if (!start || slot_start < *start)
+      start = slot_start;
+  }
+  return start;
+}
+
+void TimerWheel::AdvanceTo(uint64_t now) {
+  for (;;) {
+    std::optional<uint64_t> slot_start = NextSlotStart();
+    if (!slot_start || *slot_start > now)
+      break;
+    now_ = *slot_start;
+    // Cascade the slots which start at |now_|, from the coarsest. Their
+    // entries land in lower levels or, if due, in |due_|.
+    for (uint32_t level = kNumLevels; level-- > 0;) {
+      const uint32_t index =
+          static_cast<uint32_t>(now_ >> (level * kSlotBits)) & (kNumSlots - 1);
+      if (!(occupied_[level] & (1ull << index)))
+        continue;
+      Slot& slot = GetSlot(level, index);
+      std::vector<Entry> entries = std::move(slot.entries);
+      slot.entries.clear();
+      slot.min_deadline = UINT64_MAX;
+      occupied_[level] &= ~(1ull << index);
+      for (Entry& entry : entries)
+        Place(std::move(entry));
+    }
+  }
+  now_ = std::max(now_, now);
+}
+
+}  // namespace base
+}  // namespace perfetto
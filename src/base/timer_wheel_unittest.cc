@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/ext/base/timer_wheel.h"
+
+#include <map>
+#include <random>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace base {
+namespace {
+
+using ::testing::ElementsAre;
+
+TimeMillis Ms(int64_t ms) {
+  return TimeMillis(ms);
+}
+
+// Pops and runs all the tasks due at |now|.
+void PopAllDue(TimerWheel* wheel, TimeMillis now) {
+  for (;;) {
+    TimerWheel::Task task = wheel->PopDue(now);
+    if (!task)
+      return;
+    task();
+  }
+}
+
+TEST(TimerWheelTest, Empty) {
+  TimerWheel wheel(Ms(1000));
+  EXPECT_TRUE(wheel.empty());
+  EXPECT_FALSE(wheel.NextDeadline().has_value());
+  EXPECT_FALSE(wheel.PopDue(Ms(1000000)));
+}
+
+TEST(TimerWheelTest, RunsInDeadlineThenFifoOrder) {
+  TimerWheel wheel(Ms(1000));
+  std::vector<int> ran;
+  auto push = [&ran](int id) { return [&ran, id] { ran.push_back(id); }; };
+  wheel.Add(Ms(1300), push(3));
+  wheel.Add(Ms(1001), push(1));
+  wheel.Add(Ms(1300), push(4));
+  wheel.Add(Ms(1100), push(2));
+  wheel.Add(Ms(900), push(0));  // Already due.
+  EXPECT_EQ(wheel.size(), 5u);
+  EXPECT_EQ(wheel.NextDeadline(), Ms(900));
+
+  PopAllDue(&wheel, Ms(1000));
+  EXPECT_THAT(ran, ElementsAre(0));
+  EXPECT_EQ(wheel.NextDeadline(), Ms(1001));
+
+  PopAllDue(&wheel, Ms(1299));
+  EXPECT_THAT(ran, ElementsAre(0, 1, 2));
+  EXPECT_EQ(wheel.NextDeadline(), Ms(1300));
+
+  PopAllDue(&wheel, Ms(5000));
+  EXPECT_THAT(ran, ElementsAre(0, 1, 2, 3, 4));
+  EXPECT_TRUE(wheel.empty());
+}
+
+// A task added with a long delay is cascaded down the levels, and must still
+// run before a task with the same deadline added later with a shorter delay.
+TEST(TimerWheelTest, CascadeKeepsFifoOrder) {
+  TimerWheel wheel(Ms(0));
+  std::vector<int> ran;
+  wheel.Add(Ms(100000), [&ran] { ran.push_back(1); });
+  PopAllDue(&wheel, Ms(99990));
+  wheel.Add(Ms(100000), [&ran] { ran.push_back(2); });
+  EXPECT_EQ(wheel.NextDeadline(), Ms(100000));
+  PopAllDue(&wheel, Ms(99999));
+  EXPECT_TRUE(ran.empty());
+  PopAllDue(&wheel, Ms(100000));
+  EXPECT_THAT(ran, ElementsAre(1, 2));
+}
+
+TEST(TimerWheelTest, LargeTimes) {
+  const int64_t kStart = (int64_t{1} << 42) - 7;
+  TimerWheel wheel(Ms(kStart));
+  std::vector<int> ran;
+  wheel.Add(Ms(kStart + 10), [&ran] { ran.push_back(1); });
+  wheel.Add(Ms(kStart + int64_t{UINT32_MAX}), [&ran] { ran.push_back(2); });
+  EXPECT_EQ(wheel.NextDeadline(), Ms(kStart + 10));
+  PopAllDue(&wheel, Ms(kStart + 9));
+  EXPECT_TRUE(ran.empty());
+  PopAllDue(&wheel, Ms(kStart + 10));
+  EXPECT_THAT(ran, ElementsAre(1));
+  EXPECT_EQ(wheel.NextDeadline(), Ms(kStart + int64_t{UINT32_MAX}));
+  PopAllDue(&wheel, Ms(kStart + int64_t{UINT32_MAX}));
+  EXPECT_THAT(ran, ElementsAre(1, 2));
+}
+
+// Compares against a std::multimap, advancing the time in random steps.
+TEST(TimerWheelTest, MatchesMultimap) {
+  std::minstd_rand rnd(42);
+  int64_t now = 12345;
+  TimerWheel wheel(Ms(now));
+  std::multimap<int64_t, int> expected;
+  std::vector<int> ran;
+  int next_id = 0;
+  for (int i = 0; i < 20000; i++) {
+    if (rnd() % 2) {
+      // Mix of short and long delays, to exercise all the levels.
+      const int64_t delay = static_cast<int64_t>(rnd() % (1u << (rnd() % 28)));
+      const int id = next_id++;
+      wheel.Add(Ms(now + delay), [&ran, id] { ran.push_back(id); });
+      expected.emplace(now + delay, id);
+    } else {
+      now += static_cast<int64_t>(rnd() % (1u << (rnd() % 16)));
+    }
+    if (expected.empty()) {
+      ASSERT_FALSE(wheel.NextDeadline().has_value());
+    } else {
+      ASSERT_EQ(wheel.NextDeadline(), Ms(expected.begin()->first));
+    }
+    // Pop one due task at most, like UnixTaskRunner does.
+    TimerWheel::Task task = wheel.PopDue(Ms(now));
+    if (!expected.empty() && expected.begin()->first <= now) {
+      ASSERT_TRUE(task);
+      ran.clear();
+      task();
+      ASSERT_THAT(ran, ElementsAre(expected.begin()->second));
+      expected.erase(expected.begin());
+    } else {
+      ASSERT_FALSE(task);
+    }
+    ASSERT_EQ(wheel.size(), expected.size());
+  }
+}
+
+}  // namespace
+}  // namespace base
+}  // namespace perfetto
@@ -484,6 +484,23 @@ ssize_t UnixSocketRaw::Send(const void* msg,
                 nullptr, 0);
 }
 
+ssize_t UnixSocketRaw::SendV(const SockSendBuffer* bufs,
+                             size_t num_bufs,
+                             const int* send_fds,
+                             size_t num_fds) {
+  // There is no sendmsg() on Windows: send the buffers one by one.
+  ssize_t total_sent = 0;
+  for (size_t i = 0; i < num_bufs; ++i) {
+    ssize_t res = Send(bufs[i].data, bufs[i].size, send_fds, num_fds);
+    if (res < 0)
+      return total_sent ? total_sent : res;
+    total_sent += res;
+    if (static_cast<size_t>(res) < bufs[i].size)
+      break;
+  }
+  return total_sent;
+}
+
 ssize_t UnixSocketRaw::Receive(void* msg,
                                size_t len,
                                ScopedFile* /*fd_vec*/,
@@ -566,31 +583,63 @@ ssize_t UnixSocketRaw::Send(const void* msg,
                             size_t len,
                             const int* send_fds,
                             size_t num_fds) {
-  PERFETTO_DCHECK(fd_);
-  msghdr msg_hdr = {};
-  iovec iov = {const_cast<void*>(msg), len};
-  msg_hdr.msg_iov = &iov;
-  msg_hdr.msg_iovlen = 1;
-  alignas(cmsghdr) char control_buf[256];
+  SockSendBuffer buf{msg, len};
+  return SendV(&buf, 1, send_fds, num_fds);
+}
 
-  if (num_fds > 0) {
-    const auto raw_ctl_data_sz = num_fds * sizeof(int);
-    const CBufLenType control_buf_len =
-        static_cast<CBufLenType>(CMSG_SPACE(raw_ctl_data_sz));
-    PERFETTO_CHECK(control_buf_len <= sizeof(control_buf));
-    memset(control_buf, 0, sizeof(control_buf));
-    msg_hdr.msg_control = control_buf;
-    msg_hdr.msg_controllen = control_buf_len;  // used by CMSG_FIRSTHDR
-    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg_hdr);
-    cmsg->cmsg_level = SOL_SOCKET;
-    cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = static_cast<CBufLenType>(CMSG_LEN(raw_ctl_data_sz));
-    memcpy(CMSG_DATA(cmsg), send_fds, num_fds * sizeof(int));
-    // note: if we were to send multiple cmsghdr structures, then
-    // msg_hdr.msg_controllen would need to be adjusted, see "man 3 cmsg".
-  }
+ssize_t UnixSocketRaw::SendV(const SockSendBuffer* bufs,
+                             size_t num_bufs,
+                             const int* send_fds,
+                             size_t num_fds) {
+  PERFETTO_DCHECK(fd_);
+  ssize_t total_sent = 0;
+  size_t first_buf = 0;
+  // Sends the buffers in batches of kMaxSendBuffers, which keeps the iovec
+  // array on the stack and well below IOV_MAX. Each batch takes one sendmsg()
+  // unless the socket buffer fills up (see SendMsgAllPosix()).
+  do {
+    const bool is_first_batch = first_buf == 0;
+    const size_t batch_size = std::min(num_bufs - first_buf, kMaxSendBuffers);
+    iovec iov[kMaxSendBuffers];
+    size_t batch_len = 0;
+    for (size_t i = 0; i < batch_size; ++i) {
+      const SockSendBuffer& buf = bufs[first_buf + i];
+      iov[i] = {const_cast<void*>(buf.data), buf.size};
+      batch_len += buf.size;
+    }
+    first_buf += batch_size;
+
+    msghdr msg_hdr = {};
+    msg_hdr.msg_iov = iov;
+    msg_hdr.msg_iovlen = static_cast<decltype(msg_hdr.msg_iovlen)>(batch_size);
+    alignas(cmsghdr) char control_buf[256];
+
+    // The files are sent only with the first batch.
+    if (num_fds > 0 && is_first_batch) {
+      const auto raw_ctl_data_sz = num_fds * sizeof(int);
+      const CBufLenType control_buf_len =
+          static_cast<CBufLenType>(CMSG_SPACE(raw_ctl_data_sz));
+      PERFETTO_CHECK(control_buf_len <= sizeof(control_buf));
+      memset(control_buf, 0, sizeof(control_buf));
+      msg_hdr.msg_control = control_buf;
+      msg_hdr.msg_controllen = control_buf_len;  // used by CMSG_FIRSTHDR
+      struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg_hdr);
+      cmsg->cmsg_level = SOL_SOCKET;
+      cmsg->cmsg_type = SCM_RIGHTS;
+      cmsg->cmsg_len = static_cast<CBufLenType>(CMSG_LEN(raw_ctl_data_sz));
+      memcpy(CMSG_DATA(cmsg), send_fds, num_fds * sizeof(int));
+      // note: if we were to send multiple cmsghdr structures, then
+      // msg_hdr.msg_controllen would need to be adjusted, see "man 3 cmsg".
+    }
 
-  return SendMsgAllPosix(&msg_hdr);
+    const ssize_t res = SendMsgAllPosix(&msg_hdr);
+    if (res < 0)
+      return total_sent ? total_sent : res;
+    total_sent += res;
+    if (static_cast<size_t>(res) < batch_len)
+      break;
+  } while (first_buf < num_bufs);
+  return total_sent;
 }
 
 ssize_t UnixSocketRaw::Receive(void* msg,
@@ -691,6 +740,22 @@ bool UnixSocketRaw::SetRxTimeout(uint32_t timeout_ms) {
                     sizeof(timeout)) == 0;
 }
 
+bool UnixSocketRaw::IsWritable() const {
+  PERFETTO_DCHECK(fd_);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  WSAPOLLFD pfd{};
+  pfd.fd = *fd_;
+  pfd.events = POLLWRNORM;
+  return WSAPoll(&pfd, 1, /*timeout=*/0) > 0 && (pfd.revents & POLLWRNORM);
+#else
+  struct pollfd pfd {};
+  pfd.fd = *fd_;
+  pfd.events = POLLOUT;
+  return PERFETTO_EINTR(poll(&pfd, 1, /*timeout=*/0)) > 0 &&
+         (pfd.revents & POLLOUT);
+#endif
+}
+
 std::string UnixSocketRaw::GetSockAddr() const {
   struct sockaddr_storage stg {};
   socklen_t slen = sizeof(stg);
@@ -1067,13 +1132,25 @@ bool UnixSocket::Send(const void* msg,
                       size_t len,
                       const int* send_fds,
                       size_t num_fds) {
+  SockSendBuffer buf{msg, len};
+  return SendV(&buf, 1, send_fds, num_fds);
+}
+
+bool UnixSocket::SendV(const SockSendBuffer* bufs,
+                       size_t num_bufs,
+                       const int* send_fds,
+                       size_t num_fds) {
   if (state_ != State::kConnected) {
     errno = ENOTCONN;
     return false;
   }
 
+  size_t len = 0;
+  for (size_t i = 0; i < num_bufs; ++i)
+    len += bufs[i].size;
+
   sock_raw_.SetBlocking(true);
-  const ssize_t sz = sock_raw_.Send(msg, len, send_fds, num_fds);
+  const ssize_t sz = sock_raw_.SendV(bufs, num_bufs, send_fds, num_fds);
   sock_raw_.SetBlocking(false);
 
   if (sz == static_cast<ssize_t>(len)) {
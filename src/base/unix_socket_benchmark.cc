@@ -0,0 +1,98 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/unix_socket.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
+namespace {
+
+using perfetto::base::SockFamily;
+using perfetto::base::SockSendBuffer;
+using perfetto::base::SockType;
+using perfetto::base::UnixSocketRaw;
+
+// The number of messages sent per iteration, e.g. the IPC frames queued
+// during one task.
+constexpr size_t kMessagesPerBatch = 32;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// The argument is the size of each message.
+void BenchmarkArgs(benchmark::internal::Benchmark* b) {
+  if (IsBenchmarkFunctionalOnly()) {
+    b->Arg(64);
+  } else {
+    b->RangeMultiplier(4)->Range(64, 16 * 1024);
+  }
+}
+
+// Sends kMessagesPerBatch messages of state.range(0) bytes per iteration over
+// an AF_UNIX stream socket pair, drained by another thread.
+template <bool kVectored>
+void BM_UnixSocketSend(benchmark::State& state) {
+  UnixSocketRaw send_sock;
+  UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) =
+      UnixSocketRaw::CreatePairPosix(SockFamily::kUnix, SockType::kStream);
+  PERFETTO_CHECK(send_sock && recv_sock);
+
+  std::thread reader([&recv_sock] {
+    std::vector<char> buf(128 * 1024);
+    while (recv_sock.Receive(buf.data(), buf.size()) > 0) {
+    }
+  });
+
+  const size_t msg_size = static_cast<size_t>(state.range(0));
+  std::vector<std::string> msgs(kMessagesPerBatch, std::string(msg_size, 'x'));
+  std::vector<SockSendBuffer> bufs;
+  for (const std::string& msg : msgs)
+    bufs.push_back(SockSendBuffer{msg.data(), msg.size()});
+
+  for (auto _ : state) {
+    if (kVectored) {
+      send_sock.SendV(bufs.data(), bufs.size());
+    } else {
+      for (const std::string& msg : msgs)
+        send_sock.Send(msg.data(), msg.size());
+    }
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(kMessagesPerBatch * msg_size));
+
+  send_sock.Shutdown();
+  reader.join();
+}
+
+}  // namespace
+
+BENCHMARK_TEMPLATE(BM_UnixSocketSend, /*kVectored=*/false)
+    ->Apply(BenchmarkArgs);
+BENCHMARK_TEMPLATE(BM_UnixSocketSend, /*kVectored=*/true)
+    ->Apply(BenchmarkArgs);
+
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
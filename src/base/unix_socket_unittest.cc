@@ -989,6 +989,52 @@ TEST_F(UnixSocketTest, PartialSendMsgAll) {
   ASSERT_EQ(memcmp(&send_buf[0], &recv_buf[0], send_buf.size()), 0);
 }
 
+// Sends more buffers than fit in a single sendmsg() batch, together with a
+// file, which must be received with the first byte.
+TEST_F(UnixSocketTest, SendV) {
+  UnixSocketRaw send_sock;
+  UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) =
+      UnixSocketRaw::CreatePairPosix(kTestSocket.family(), SockType::kStream);
+  ASSERT_TRUE(send_sock);
+  ASSERT_TRUE(recv_sock);
+
+  const size_t kNumBufs = UnixSocketRaw::kMaxSendBuffers * 2 + 3;
+  std::vector<std::string> strs;
+  std::vector<SockSendBuffer> bufs;
+  std::string expected;
+  for (size_t i = 0; i < kNumBufs; ++i)
+    strs.push_back("buf" + std::to_string(i) + ",");
+  for (const std::string& str : strs) {
+    bufs.push_back(SockSendBuffer{str.data(), str.size()});
+    expected += str;
+  }
+
+  Pipe pipe = Pipe::Create();
+  int send_fd = *pipe.wr;
+  ASSERT_EQ(send_sock.SendV(bufs.data(), bufs.size(), &send_fd, 1),
+            static_cast<ssize_t>(expected.size()));
+
+  std::string received(expected.size(), '\0');
+  ScopedFile fd;
+  ssize_t rsize = recv_sock.Receive(&received[0], received.size(), &fd, 1);
+  ASSERT_GT(rsize, 0);
+  ASSERT_TRUE(fd);
+  size_t offset = static_cast<size_t>(rsize);
+  while (offset < received.size()) {
+    rsize = recv_sock.Receive(&received[offset], received.size() - offset);
+    ASSERT_GT(rsize, 0);
+    offset += static_cast<size_t>(rsize);
+  }
+  EXPECT_EQ(received, expected);
+
+  // The file received is the write end of |pipe|.
+  ASSERT_EQ(WriteAll(*fd, "x", 1), 1);
+  char c = 0;
+  ASSERT_EQ(Read(*pipe.rd, &c, 1), 1);
+  EXPECT_EQ(c, 'x');
+}
+
 // Regression test for b/193234818. SO_SNDTIMEO is unreliable on most systems.
 // It doesn't guarantee that the whole send() call blocks for at most X, as the
 // kernel rearms the timeout if the send buffers frees up and allows a partial
@@ -1036,6 +1082,27 @@ TEST_F(UnixSocketTest, BlockingSendTimeout) {
   tx_thread.join();
 }
 
+TEST_F(UnixSocketTest, IsWritable) {
+  UnixSocketRaw send_sock;
+  UnixSocketRaw recv_sock;
+  std::tie(send_sock, recv_sock) =
+      UnixSocketRaw::CreatePairPosix(kTestSocket.family(), SockType::kStream);
+  ASSERT_TRUE(send_sock.IsWritable());
+
+  // Fill the tx buffer in non-blocking mode.
+  send_sock.SetBlocking(false);
+  char buf[1024 * 16]{};
+  while (send_sock.Send(buf, sizeof(buf)) > 0) {
+  }
+  ASSERT_FALSE(send_sock.IsWritable());
+
+  // Drain the buffer from the other end.
+  recv_sock.SetBlocking(false);
+  while (recv_sock.Receive(buf, sizeof(buf)) > 0) {
+  }
+  ASSERT_TRUE(send_sock.IsWritable());
+}
+
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_FUCHSIA)
 TEST_F(UnixSocketTest, SetsCloexec) {
   // CLOEXEC set when constructing sockets through helper:
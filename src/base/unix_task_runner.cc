@@ -29,15 +29,51 @@
 #include <unistd.h>
 #endif
 
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+#include <pthread.h>
+#endif
+
 #include <algorithm>
+#include <atomic>
 #include <limits>
+#include <optional>
 
 #include "perfetto/ext/base/watchdog.h"
 
 namespace perfetto {
 namespace base {
 
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+namespace {
+// The max number of fd events returned by each epoll_wait(). Further ready fds
+// are returned by the next one.
+constexpr size_t kMaxEpollEvents = 64;
+
+// Incremented in the child of each fork(). Unlike a poll() set, an epoll
+// instance is shared with the child, so a task runner used on both sides of
+// a fork() would see the fds watched by the other process.
+std::atomic<uint32_t> g_fork_generation{0};
+
+uint32_t GetForkGeneration() {
+  static bool registered = [] {
+    pthread_atfork(nullptr, nullptr, [] {
+      g_fork_generation.fetch_add(1, std::memory_order_relaxed);
+    });
+    return true;
+  }();
+  base::ignore_result(registered);
+  return g_fork_generation.load(std::memory_order_relaxed);
+}
+}  // namespace
+#endif
+
 UnixTaskRunner::UnixTaskRunner() {
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+  PERFETTO_CHECK(epoll_fd_);
+  epoll_fork_generation_ = GetForkGeneration();
+  epoll_events_.resize(kMaxEpollEvents);
+#endif
   AddFileDescriptorWatch(event_.fd(), [] {
     // Not reached -- see PostFileDescriptorWatches().
     PERFETTO_DFATAL("Should be unreachable.");
@@ -77,6 +113,14 @@ void UnixTaskRunner::Run() {
     // WaitForSingleObject() for the one handle that WaitForMultipleObject()
     // returned.
     PostFileDescriptorWatches(ret);
+#elif PERFETTO_TASK_RUNNER_USES_EPOLL()
+    platform::BeforeMaybeBlockingSyscall();
+    int ret = PERFETTO_EINTR(epoll_wait(*epoll_fd_, epoll_events_.data(),
+                                        static_cast<int>(epoll_events_.size()),
+                                        poll_timeout_ms));
+    platform::AfterMaybeBlockingSyscall();
+    PERFETTO_CHECK(ret >= 0);
+    PostFileDescriptorWatches(static_cast<uint64_t>(ret));
 #else
     platform::BeforeMaybeBlockingSyscall();
     int ret = PERFETTO_EINTR(poll(
@@ -110,6 +154,11 @@ bool UnixTaskRunner::IsIdleForTesting() {
 
 void UnixTaskRunner::UpdateWatchTasksLocked() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  // The epoll set is updated by {Add,Remove}FileDescriptorWatch().
+  RecreateEpollIfForkedLocked();
+  return;
+#else
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
   if (!watch_tasks_changed_)
     return;
@@ -127,6 +176,7 @@ void UnixTaskRunner::UpdateWatchTasksLocked() {
     poll_fds_.push_back({handle, POLLIN | POLLHUP, 0});
 #endif
   }
+#endif  // PERFETTO_TASK_RUNNER_USES_EPOLL()
 }
 
 void UnixTaskRunner::RunImmediateAndDelayedTask() {
@@ -140,13 +190,7 @@ void UnixTaskRunner::RunImmediateAndDelayedTask() {
       immediate_task = std::move(immediate_tasks_.front());
       immediate_tasks_.pop_front();
     }
-    if (!delayed_tasks_.empty()) {
-      auto it = delayed_tasks_.begin();
-      if (now >= it->first) {
-        delayed_task = std::move(it->second);
-        delayed_tasks_.erase(it);
-      }
-    }
+    delayed_task = delayed_tasks_.PopDue(now);
   }
 
   errno = 0;
@@ -157,20 +201,35 @@ void UnixTaskRunner::RunImmediateAndDelayedTask() {
     RunTaskWithWatchdogGuard(delayed_task);
 }
 
-void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
+// |wait_result| is the result of WaitForMultipleObjects() on Windows and the
+// number of events returned by epoll_wait() with epoll. Ignored otherwise.
+void UnixTaskRunner::PostFileDescriptorWatches(uint64_t wait_result) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  for (size_t i = 0; i < wait_result; i++) {
+    const PlatformHandle handle = epoll_events_[i].data.fd;
+    // The wake-up event is handled inline to avoid an infinite recursion of
+    // posted tasks.
+    if (handle == event_.fd()) {
+      event_.Clear();
+      continue;
+    }
+    // The fd is disarmed (EPOLLONESHOT) until RunFileDescriptorWatch().
+    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this, handle));
+  }
+#else
   for (size_t i = 0; i < poll_fds_.size(); i++) {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     const PlatformHandle handle = poll_fds_[i];
-    // |windows_wait_result| is the result of WaitForMultipleObjects() call. If
-    // one of the objects was signalled, it will have a value between
+    // |wait_result| is the result of WaitForMultipleObjects() call. If one of
+    // the objects was signalled, it will have a value between
     // [0, poll_fds_.size()].
-    if (i != windows_wait_result &&
+    if (i != wait_result &&
         WaitForSingleObject(handle, 0) != WAIT_OBJECT_0) {
       continue;
     }
 #else
-    base::ignore_result(windows_wait_result);
+    base::ignore_result(wait_result);
     const PlatformHandle handle = poll_fds_[i].fd;
     if (!(poll_fds_[i].revents & (POLLIN | POLLHUP)))
       continue;
@@ -204,10 +263,14 @@ void UnixTaskRunner::PostFileDescriptorWatches(uint64_t windows_wait_result) {
     poll_fds_[i].fd = -poll_fds_[i].fd;
 #endif
   }
+#endif  // PERFETTO_TASK_RUNNER_USES_EPOLL()
 }
 
 void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
   std::function<void()> task;
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  bool always_ready = false;
+#endif
   {
     std::lock_guard<std::mutex> lock(lock_);
     auto it = watch_tasks_.find(fd);
@@ -215,11 +278,25 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
       return;
     WatchTask& watch_task = it->second;
 
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    // Re-arm the fd, which was disarmed when reported by epoll_wait().
+    always_ready = watch_task.always_ready;
+    if (!always_ready) {
+      RecreateEpollIfForkedLocked();
+      struct epoll_event ev {};
+      ev.events = EPOLLIN | EPOLLHUP | EPOLLONESHOT;
+      ev.data.fd = fd;
+      PERFETTO_CHECK(epoll_ctl(*epoll_fd_, EPOLL_CTL_MOD, fd, &ev) == 0);
+    }
+#else
     // Make poll(2) pay attention to the fd again. Since another thread may have
     // updated this watch we need to refresh the set first.
     UpdateWatchTasksLocked();
+#endif
 
-#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    // Nothing else to do.
+#elif PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     // On Windows we manually track the presence of outstanding tasks for the
     // watch. The UpdateWatchTasksLocked() in the Run() loop will re-add the
     // task to the |poll_fds_| vector.
@@ -233,6 +310,10 @@ void UnixTaskRunner::RunFileDescriptorWatch(PlatformHandle fd) {
 #endif
     task = watch_task.callback;
   }
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  if (always_ready)
+    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this, fd));
+#endif
   errno = 0;
   RunTaskWithWatchdogGuard(task);
 }
@@ -241,8 +322,9 @@ int UnixTaskRunner::GetDelayMsToNextTaskLocked() const {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   if (!immediate_tasks_.empty())
     return 0;
-  if (!delayed_tasks_.empty()) {
-    TimeMillis diff = delayed_tasks_.begin()->first - GetWallTimeMs();
+  std::optional<TimeMillis> deadline = delayed_tasks_.NextDeadline();
+  if (deadline) {
+    TimeMillis diff = *deadline - GetWallTimeMs();
     return std::max(0, static_cast<int>(diff.count()));
   }
   return -1;
@@ -262,21 +344,49 @@ void UnixTaskRunner::PostTask(std::function<void()> task) {
 void UnixTaskRunner::PostDelayedTask(std::function<void()> task,
                                      uint32_t delay_ms) {
   TimeMillis runtime = GetWallTimeMs() + TimeMillis(delay_ms);
+  bool is_next;
   {
     std::lock_guard<std::mutex> lock(lock_);
-    delayed_tasks_.insert(std::make_pair(runtime, std::move(task)));
+    std::optional<TimeMillis> next_deadline = delayed_tasks_.NextDeadline();
+    is_next = !next_deadline || runtime < *next_deadline;
+    delayed_tasks_.Add(runtime, std::move(task));
   }
-  WakeUp();
+  // Run() only needs to recompute its timeout if the task is due before the
+  // ones it is already waiting for.
+  if (is_next)
+    WakeUp();
 }
 
 void UnixTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
                                             std::function<void()> task) {
   PERFETTO_DCHECK(PlatformHandleChecker::IsValid(fd));
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+  bool always_ready = false;
+#endif
   {
     std::lock_guard<std::mutex> lock(lock_);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    RecreateEpollIfForkedLocked();  // Before |fd| is in |watch_tasks_|.
+#endif
     PERFETTO_DCHECK(!watch_tasks_.count(fd));
     WatchTask& watch_task = watch_tasks_[fd];
     watch_task.callback = std::move(task);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLHUP;
+    if (fd != event_.fd())
+      ev.events |= EPOLLONESHOT;
+    ev.data.fd = fd;
+    if (epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      PERFETTO_CHECK(errno == EPERM);
+      watch_task.always_ready = true;
+    }
+    always_ready = watch_task.always_ready;
+  }
+  // epoll_wait() picks up the new fd without a wake-up.
+  if (always_ready)
+    PostTask(std::bind(&UnixTaskRunner::RunFileDescriptorWatch, this, fd));
+#else
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     watch_task.pending = false;
 #else
@@ -285,6 +395,7 @@ void UnixTaskRunner::AddFileDescriptorWatch(PlatformHandle fd,
     watch_tasks_changed_ = true;
   }
   WakeUp();
+#endif  // PERFETTO_TASK_RUNNER_USES_EPOLL()
 }
 
 void UnixTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
@@ -293,11 +404,43 @@ void UnixTaskRunner::RemoveFileDescriptorWatch(PlatformHandle fd) {
     std::lock_guard<std::mutex> lock(lock_);
     PERFETTO_DCHECK(watch_tasks_.count(fd));
     watch_tasks_.erase(fd);
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+    // Fails if the fd was closed already, which removed it from the set, or
+    // if it was never added (see WatchTask::always_ready).
+    RecreateEpollIfForkedLocked();
+    epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#else
     watch_tasks_changed_ = true;
+#endif
   }
   // No need to schedule a wake-up for this.
 }
 
+#if PERFETTO_TASK_RUNNER_USES_EPOLL()
+void UnixTaskRunner::RecreateEpollIfForkedLocked() {
+  const uint32_t fork_generation = GetForkGeneration();
+  if (PERFETTO_LIKELY(fork_generation == epoll_fork_generation_))
+    return;
+  // We are in the child of a fork(): register the watched fds in an epoll
+  // instance of our own, leaving the parent's one alone. The fds are armed
+  // again, at worst a watch task runs once more than needed.
+  epoll_fork_generation_ = fork_generation;
+  epoll_fd_.reset(epoll_create1(EPOLL_CLOEXEC));
+  PERFETTO_CHECK(epoll_fd_);
+  for (const auto& it : watch_tasks_) {
+    const PlatformHandle fd = it.first;
+    if (it.second.always_ready)
+      continue;
+    struct epoll_event ev {};
+    ev.events = EPOLLIN | EPOLLHUP;
+    if (fd != event_.fd())
+      ev.events |= EPOLLONESHOT;
+    ev.data.fd = fd;
+    PERFETTO_CHECK(epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, fd, &ev) == 0);
+  }
+}
+#endif
+
 bool UnixTaskRunner::RunsTasksOnCurrentThread() const {
   return GetThreadId() == created_thread_id_;
 }
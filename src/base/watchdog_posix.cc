@@ -24,6 +24,8 @@
 #include <signal.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
 #include <sys/syscall.h>
 #include <sys/timerfd.h>
 #include <unistd.h>
@@ -55,6 +57,18 @@ bool IsMultipleOf(uint32_t number, uint32_t divisor) {
   return number >= divisor && number % divisor == 0;
 }
 
+// Returns the CPU time (user + system) used by the process so far.
+uint64_t GetCpuTimeUs() {
+  struct rusage usage {};
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+  auto to_us = [](const struct timeval& tv) {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000000 +
+           static_cast<uint64_t>(tv.tv_usec);
+  };
+  return to_us(usage.ru_utime) + to_us(usage.ru_stime);
+}
+
 double MeanForArray(const uint64_t array[], size_t size) {
   uint64_t total = 0;
   for (size_t i = 0; i < size; i++) {
@@ -102,14 +116,10 @@ Watchdog::~Watchdog() {
   PERFETTO_DCHECK(enabled_);
   enabled_ = false;
 
-  // Rearm the timer to 1ns from now. This will cause the watchdog thread to
-  // wakeup from the poll() and see |enabled_| == false.
-  // This code path is used only in tests. In production code the watchdog is
-  // a singleton and is never destroyed.
-  struct itimerspec ts {};
-  ts.it_value.tv_sec = 0;
-  ts.it_value.tv_nsec = 1;
-  timerfd_settime(*timer_fd_, /*flags=*/0, &ts, nullptr);
+  // Wake up the watchdog thread from the poll(), so that it sees |enabled_| ==
+  // false. This code path is used only in tests. In production code the
+  // watchdog is a singleton and is never destroyed.
+  wakeup_event_.Notify();
 
   thread_.join();
 }
@@ -197,6 +207,9 @@ void Watchdog::SetMemoryLimit(uint64_t bytes, uint32_t window_ms) {
   size_t size = bytes == 0 ? 0 : window_ms / polling_interval_ms_ + 1;
   memory_window_bytes_.Reset(size);
   memory_limit_bytes_ = bytes;
+
+  // The thread doesn't poll while there are no limits to enforce.
+  wakeup_event_.Notify();
 }
 
 void Watchdog::SetCpuLimit(uint32_t percentage, uint32_t window_ms) {
@@ -207,8 +220,9 @@ void Watchdog::SetCpuLimit(uint32_t percentage, uint32_t window_ms) {
                  percentage == 0);
 
   size_t size = percentage == 0 ? 0 : window_ms / polling_interval_ms_ + 1;
-  cpu_window_time_ticks_.Reset(size);
+  cpu_window_time_us_.Reset(size);
   cpu_limit_percentage_ = percentage;
+  wakeup_event_.Notify();
 }
 
 void Watchdog::ThreadMain() {
@@ -223,17 +237,43 @@ void Watchdog::ThreadMain() {
 
   PERFETTO_DCHECK(timer_fd_);
 
-  constexpr uint8_t kFdCount = 1;
+  // Let the kernel delay the periodic ticks by up to 1% of the polling
+  // interval, to coalesce them with other wakeups. This doesn't affect the
+  // fatal timers, which are on |timer_fd_|.
+  prctl(PR_SET_TIMERSLACK,
+        static_cast<unsigned long>(polling_interval_ms_) * 1000 * 1000 / 100);
+
+  constexpr uint8_t kFdCount = 2;
   struct pollfd fds[kFdCount]{};
   fds[0].fd = *timer_fd_;
   fds[0].events = POLLIN;
+  fds[1].fd = wakeup_event_.fd();
+  fds[1].events = POLLIN;
+
+  // Deadline of the next cpu/memory check, zero while there are no limits.
+  TimeMillis next_tick{};
 
   for (;;) {
     // We use the poll() timeout to drive the periodic ticks for the cpu/memory
-    // checks. The only other case when the poll() unblocks is when we crash
-    // (or have to quit via enabled_ == false, but that happens only in tests).
+    // checks. When no limit is set, there is nothing to check periodically and
+    // the thread sleeps until a fatal timer expires or a limit is set. The
+    // poll() also unblocks when we have to quit via enabled_ == false, but
+    // that happens only in tests.
+    std::unique_lock<std::mutex> guard(mutex_);
+    const bool has_limits = memory_limit_bytes_ || cpu_limit_percentage_;
+    guard.unlock();
+    int timeout_ms = -1;
+    if (has_limits) {
+      const TimeMillis now = GetWallTimeMs();
+      if (next_tick.count() == 0)
+        next_tick = now + TimeMillis(polling_interval_ms_);
+      timeout_ms = static_cast<int>(
+          std::max<int64_t>(0, (next_tick - now).count()));
+    } else {
+      next_tick = TimeMillis();
+    }
     platform::BeforeMaybeBlockingSyscall();
-    auto ret = poll(fds, kFdCount, static_cast<int>(polling_interval_ms_));
+    auto ret = poll(fds, kFdCount, timeout_ms);
     platform::AfterMaybeBlockingSyscall();
     if (!enabled_)
       return;
@@ -249,6 +289,10 @@ void Watchdog::ThreadMain() {
     // If we get here either:
     // 1. poll() timed out, in which case we should process cpu/mem guardrails.
     // 2. A timer expired, in which case we shall crash.
+    // 3. A limit was changed, in which case the periodic checks start or stop
+    //    (see |next_tick| above).
+    if (fds[1].revents & POLLIN)
+      wakeup_event_.Clear();
 
     uint64_t expired = 0;  // Must be exactly 8 bytes.
     auto res = PERFETTO_EINTR(read(*timer_fd_, &expired, sizeof(expired)));
@@ -259,7 +303,7 @@ void Watchdog::ThreadMain() {
     // Check if any of the timers expired.
     int tid_to_kill = 0;
     WatchdogCrashReason crash_reason{};
-    std::unique_lock<std::mutex> guard(mutex_);
+    guard.lock();
     for (const auto& timer : timers_) {
       if (now >= timer.deadline) {
         tid_to_kill = timer.thread_id;
@@ -272,21 +316,32 @@ void Watchdog::ThreadMain() {
     if (tid_to_kill)
       SerializeLogsAndKillThread(tid_to_kill, crash_reason);
 
-    // Check CPU and memory guardrails (if enabled).
-    lseek(stat_fd.get(), 0, SEEK_SET);
-    ProcStat stat;
-    if (!ReadProcStat(stat_fd.get(), &stat))
-      continue;
-    uint64_t cpu_time = stat.utime + stat.stime;
-    uint64_t rss_bytes =
-        static_cast<uint64_t>(stat.rss_pages) * base::GetSysPageSize();
+    if (next_tick.count() == 0 || now < next_tick)
+      continue;  // Not a periodic tick.
+    next_tick = now + TimeMillis(polling_interval_ms_);
+
+    // Check CPU and memory guardrails (if enabled). The CPU time comes from
+    // getrusage(), the RSS requires reading /proc/self/stat.
+    uint64_t cpu_time_us = GetCpuTimeUs();
+    uint64_t rss_bytes = 0;
+    guard.lock();
+    const bool check_memory = memory_limit_bytes_ != 0;
+    guard.unlock();
+    if (check_memory) {
+      lseek(stat_fd.get(), 0, SEEK_SET);
+      ProcStat stat;
+      if (!ReadProcStat(stat_fd.get(), &stat))
+        continue;
+      rss_bytes =
+          static_cast<uint64_t>(stat.rss_pages) * base::GetSysPageSize();
+    }
 
     bool threshold_exceeded = false;
     guard.lock();
     if (CheckMemory_Locked(rss_bytes)) {
       threshold_exceeded = true;
       crash_reason = WatchdogCrashReason::kMemGuardrail;
-    } else if (CheckCpu_Locked(cpu_time)) {
+    } else if (CheckCpu_Locked(cpu_time_us)) {
       threshold_exceeded = true;
       crash_reason = WatchdogCrashReason::kCpuGuardrail;
     }
@@ -348,22 +403,21 @@ bool Watchdog::CheckMemory_Locked(uint64_t rss_bytes) {
   return false;
 }
 
-bool Watchdog::CheckCpu_Locked(uint64_t cpu_time) {
+bool Watchdog::CheckCpu_Locked(uint64_t cpu_time_us) {
   if (cpu_limit_percentage_ == 0)
     return false;
 
   // Add the cpu time to the ring buffer.
-  if (cpu_window_time_ticks_.Push(cpu_time)) {
+  if (cpu_window_time_us_.Push(cpu_time_us)) {
     // Compute the percentage over the whole window and check that it remains
     // under the threshold.
-    uint64_t difference_ticks = cpu_window_time_ticks_.NewestWhenFull() -
-                                cpu_window_time_ticks_.OldestWhenFull();
-    double window_interval_ticks =
-        (static_cast<double>(WindowTimeForRingBuffer(cpu_window_time_ticks_)) /
-         1000.0) *
-        static_cast<double>(sysconf(_SC_CLK_TCK));
-    double percentage = static_cast<double>(difference_ticks) /
-                        static_cast<double>(window_interval_ticks) * 100;
+    uint64_t difference_us = cpu_window_time_us_.NewestWhenFull() -
+                             cpu_window_time_us_.OldestWhenFull();
+    double window_interval_us =
+        static_cast<double>(WindowTimeForRingBuffer(cpu_window_time_us_)) *
+        1000.0;
+    double percentage =
+        static_cast<double>(difference_us) / window_interval_us * 100;
     if (percentage > cpu_limit_percentage_) {
       PERFETTO_ELOG("CPU watchdog trigger. %f%% CPU use is above the %" PRIu32
                     "%% CPU limit.",
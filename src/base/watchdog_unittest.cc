@@ -113,6 +113,22 @@ TEST(WatchdogTest, CrashCpu) {
       "");
 }
 
+TEST(WatchdogTest, CrashCpuLimitSetAfterStart) {
+  // Without limits the watchdog thread doesn't poll: setting one must wake it.
+  EXPECT_DEATH(
+      {
+        TestWatchdog watchdog(1);
+        watchdog.Start();
+        usleep(10 * 1000);
+        watchdog.SetCpuLimit(10, 25);
+        volatile int x = 0;
+        for (;;) {
+          x++;
+        }
+      },
+      "");
+}
+
 // The test below tests that the fatal timer signal is sent to the thread that
 // created the timer and not a random one.
 
@@ -16,13 +16,25 @@
 
 #include "src/ipc/buffered_frame_deserializer.h"
 
+#include "perfetto/base/build_config.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
 #include <algorithm>
 #include <cinttypes>
 #include <type_traits>
 #include <utility>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/memfd.h"
+#include "perfetto/ext/base/scoped_mmap.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/proto_utils.h"
 
 #include "protos/perfetto/ipc/wire_protocol.gen.h"
 
@@ -33,6 +45,43 @@ namespace {
 
 // The header is just the number of bytes of the Frame protobuf message.
 constexpr size_t kHeaderSize = sizeof(uint32_t);
+
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+// The sender must not be able to change or truncate a shmem frame while it is
+// decoded.
+constexpr int kShmemFrameSeals = F_SEAL_WRITE | F_SEAL_SHRINK;
+
+std::unique_ptr<Frame> DecodeShmemFrame(base::ScopedFile fd, uint64_t size) {
+  if (size == 0 || size > BufferedFrameDeserializer::kMaxShmemFrameSize) {
+    PERFETTO_LOG("IPC shmem frame too large (size %" PRIu64 ")", size);
+    return nullptr;
+  }
+  int seals = fcntl(*fd, F_GET_SEALS);
+  if (seals == -1 || (seals & kShmemFrameSeals) != kShmemFrameSeals) {
+    PERFETTO_LOG("IPC shmem frame not sealed");
+    return nullptr;
+  }
+  struct stat stat_buf {};
+  if (fstat(*fd, &stat_buf) != 0 ||
+      static_cast<uint64_t>(stat_buf.st_size) < size) {
+    return nullptr;
+  }
+  base::ScopedMmap mapping =
+      base::ScopedMmap::FromHandle(std::move(fd), static_cast<size_t>(size));
+  if (!mapping.IsValid())
+    return nullptr;
+  std::unique_ptr<Frame> frame(new Frame);
+  if (!frame->ParseFromArray(mapping.data(), static_cast<size_t>(size)))
+    return nullptr;
+  return frame;
+}
+#else
+std::unique_ptr<Frame> DecodeShmemFrame(base::ScopedFile, uint64_t) {
+  return nullptr;
+}
+#endif
+
 }  // namespace
 
 BufferedFrameDeserializer::BufferedFrameDeserializer(size_t max_capacity)
@@ -64,6 +113,11 @@ BufferedFrameDeserializer::BeginReceive() {
 }
 
 bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
+  return EndReceive(recv_size, nullptr);
+}
+
+bool BufferedFrameDeserializer::EndReceive(size_t recv_size,
+                                           base::ScopedFile* fd) {
   const auto page_size = base::GetSysPageSize();
   PERFETTO_CHECK(recv_size + size_ <= capacity_);
   size_ += recv_size;
@@ -118,9 +172,11 @@ bool BufferedFrameDeserializer::EndReceive(size_t recv_size) {
     }
 
     // Case C. We got at least one header and whole frame.
-    DecodeFrame(rd_ptr, payload_size);
+    if (!DecodeFrame(rd_ptr, payload_size))
+      return false;
     consumed_size += next_frame_size;
   }
+  DecodeShmemFrames(fd);
 
   PERFETTO_DCHECK(consumed_size <= size_);
   if (consumed_size > 0) {
@@ -163,12 +219,101 @@ std::unique_ptr<Frame> BufferedFrameDeserializer::PopNextFrame() {
   return frame;
 }
 
-void BufferedFrameDeserializer::DecodeFrame(const char* data, size_t size) {
+bool BufferedFrameDeserializer::DecodeFrame(const char* data, size_t size) {
   if (size == 0)
-    return;
+    return true;
   std::unique_ptr<Frame> frame(new Frame);
-  if (frame->ParseFromArray(data, size))
+  if (!frame->ParseFromArray(data, size))
+    return true;
+  if (frame->has_compressed_frames())
+    return DecodeCompressedFrames(frame->compressed_frames());
+  decoded_frames_.push_back(std::move(frame));
+  return true;
+}
+
+bool BufferedFrameDeserializer::DecodeCompressedFrames(
+    const std::string& compressed_frames) {
+  std::string frames;
+  if (!frame_decompressor_ ||
+      !frame_decompressor_(compressed_frames, capacity_, &frames)) {
+    PERFETTO_LOG("Invalid IPC compressed frame");
+    return false;
+  }
+
+  // A compressed frame carries only whole frames.
+  size_t offset = 0;
+  while (offset < frames.size()) {
+    uint32_t payload_size = 0;
+    if (frames.size() - offset < kHeaderSize)
+      return false;
+    memcpy(base::AssumeLittleEndian(&payload_size), &frames[offset],
+           kHeaderSize);
+    offset += kHeaderSize;
+    if (payload_size > frames.size() - offset)
+      return false;
+    std::unique_ptr<Frame> frame(new Frame);
+    const char* payload = &frames[offset];
+    offset += payload_size;
+    if (payload_size == 0 || !frame->ParseFromArray(payload, payload_size))
+      continue;
+    if (frame->has_compressed_frames())
+      continue;  // Compressed frames can't be nested.
     decoded_frames_.push_back(std::move(frame));
+  }
+  return true;
+}
+
+void BufferedFrameDeserializer::DecodeShmemFrames(base::ScopedFile* fd) {
+  // The kernel doesn't return the data sent after a file in the same recv()
+  // as the file, so the memfd can only belong to the last frame. All the other
+  // shmem frames were decoded by the previous calls.
+  if (fd && *fd && !decoded_frames_.empty() &&
+      decoded_frames_.back()->has_shmem_frame_size()) {
+    uint64_t size = decoded_frames_.back()->shmem_frame_size();
+    decoded_frames_.pop_back();
+    std::unique_ptr<Frame> frame = DecodeShmemFrame(std::move(*fd), size);
+    if (frame)
+      decoded_frames_.push_back(std::move(frame));
+  }
+  decoded_frames_.remove_if([](const std::unique_ptr<Frame>& frame) {
+    return frame->has_shmem_frame_size();
+  });
+}
+
+// static
+bool BufferedFrameDeserializer::ShmemFramesSupported() {
+  return base::HasMemfdSupport();
+}
+
+// static
+base::ScopedFile BufferedFrameDeserializer::SerializeShmemFrame(
+    const std::string& serialized_frame,
+    std::string* shmem_frame) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  PERFETTO_DCHECK(serialized_frame.size() >= kHeaderSize);
+  const size_t size = serialized_frame.size() - kHeaderSize;
+  if (size == 0 || size > kMaxShmemFrameSize)
+    return base::ScopedFile();
+  base::ScopedFile fd = base::CreateMemfd("perfetto_ipc_frame",
+                                          MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (!fd)
+    return base::ScopedFile();
+  if (base::WriteAll(*fd, serialized_frame.data() + kHeaderSize, size) !=
+          static_cast<ssize_t>(size) ||
+      fcntl(*fd, F_ADD_SEALS, kShmemFrameSeals | F_SEAL_GROW | F_SEAL_SEAL) !=
+          0) {
+    PERFETTO_DPLOG("Failed to write the IPC shmem frame");
+    return base::ScopedFile();
+  }
+  Frame frame;
+  frame.set_shmem_frame_size(size);
+  *shmem_frame = Serialize(frame);
+  return fd;
+#else
+  base::ignore_result(serialized_frame, shmem_frame);
+  return base::ScopedFile();
+#endif
 }
 
 // static
@@ -182,5 +327,61 @@ std::string BufferedFrameDeserializer::Serialize(const Frame& frame) {
   return buf;
 }
 
+// static
+std::string BufferedFrameDeserializer::SerializeInvokeMethodReply(
+    RequestID request_id,
+    bool success,
+    bool has_more,
+    const std::string& reply_proto) {
+  using protozero::proto_utils::MakeTagLengthDelimited;
+  using protozero::proto_utils::MakeTagVarInt;
+  using protozero::proto_utils::WriteVarInt;
+  using Reply = protos::gen::IPCFrame_InvokeMethodReply;
+
+  // Encodes the fields in the same order as Frame::SerializeAsString():
+  // Frame {request_id, msg_invoke_method_reply {success, has_more,
+  // reply_proto}}.
+  uint8_t reply_preamble[32];
+  uint8_t* ptr = reply_preamble;
+  if (success) {
+    ptr = WriteVarInt(MakeTagVarInt(Reply::kSuccessFieldNumber), ptr);
+    *ptr++ = 1;
+  }
+  ptr = WriteVarInt(MakeTagVarInt(Reply::kHasMoreFieldNumber), ptr);
+  *ptr++ = has_more ? 1 : 0;
+  if (success) {
+    ptr = WriteVarInt(MakeTagLengthDelimited(Reply::kReplyProtoFieldNumber),
+                      ptr);
+    ptr = WriteVarInt(reply_proto.size(), ptr);
+  }
+  const size_t reply_preamble_size = static_cast<size_t>(ptr - reply_preamble);
+  const size_t reply_size =
+      reply_preamble_size + (success ? reply_proto.size() : 0);
+
+  uint8_t frame_preamble[32];
+  ptr = frame_preamble;
+  ptr = WriteVarInt(MakeTagVarInt(Frame::kRequestIdFieldNumber), ptr);
+  ptr = WriteVarInt(request_id, ptr);
+  ptr = WriteVarInt(
+      MakeTagLengthDelimited(Frame::kMsgInvokeMethodReplyFieldNumber), ptr);
+  ptr = WriteVarInt(reply_size, ptr);
+  const size_t frame_preamble_size = static_cast<size_t>(ptr - frame_preamble);
+
+  const uint32_t payload_size =
+      static_cast<uint32_t>(frame_preamble_size + reply_size);
+  std::string buf;
+  buf.reserve(kHeaderSize + payload_size);
+  buf.append(reinterpret_cast<const char*>(
+                 base::AssumeLittleEndian(&payload_size)),
+             kHeaderSize);
+  buf.append(reinterpret_cast<const char*>(frame_preamble),
+             frame_preamble_size);
+  buf.append(reinterpret_cast<const char*>(reply_preamble),
+             reply_preamble_size);
+  if (success)
+    buf.append(reply_proto);
+  return buf;
+}
+
 }  // namespace ipc
 }  // namespace perfetto
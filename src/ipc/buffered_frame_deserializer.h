@@ -21,8 +21,10 @@
 
 #include <list>
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/basic_types.h"
 
@@ -80,6 +82,22 @@ using Frame = ::perfetto::protos::gen::IPCFrame;
 //   that a malicious sends an abnormally large frame and OOMs us.
 // - Simplicity: just use a linear mmap region. No reallocations or scattering.
 //   Takes care of madvise()-ing unused memory.
+//
+// Shmem frames
+// ------------
+// Frames of several MB (e.g. ReadBuffers() replies) would take many recv()
+// calls, and be copied once more into the receive buffer. Instead, peers which
+// support it (see BindService.accepts_shmem_frames) can move such frames into
+// a sealed memfd, sent over the socket along with a small "shmem frame" (see
+// IPCFrame.shmem_frame_size) standing in for the actual frame. The receiver
+// maps the memfd and decodes the frame from it, in place of the shmem frame.
+//
+// Compressed frames
+// -----------------
+// traced_relay can batch and compress the frames it relays to the host (see
+// IPCFrame.compressed_frames). If a decompressor is set, the frames carried by
+// a compressed frame are decoded in its place. Otherwise compressed frames are
+// rejected like oversized ones.
 
 class BufferedFrameDeserializer {
  public:
@@ -88,6 +106,9 @@ class BufferedFrameDeserializer {
     size_t size;
   };
 
+  // The largest frame which can be sent as a shmem frame.
+  static constexpr size_t kMaxShmemFrameSize = 64 * 1024 * 1024;
+
   // |max_capacity| is overridable only for tests.
   explicit BufferedFrameDeserializer(size_t max_capacity = kIPCBufferSize);
   ~BufferedFrameDeserializer();
@@ -97,6 +118,26 @@ class BufferedFrameDeserializer {
   // in common that doesn't justify having its own class.
   static std::string Serialize(const Frame&);
 
+  // Same as Serialize() for an InvokeMethodReply frame. Encodes |reply_proto|
+  // straight into the returned buffer, rather than copying it into a Frame
+  // first and then serializing the Frame. Replies carrying trace data can be
+  // several MB per ReadBuffers() call, so each copy saved counts.
+  static std::string SerializeInvokeMethodReply(RequestID request_id,
+                                                bool success,
+                                                bool has_more,
+                                                const std::string& reply_proto);
+
+  // Whether shmem frames can be sent and received on this platform.
+  static bool ShmemFramesSupported();
+
+  // Moves a frame serialized with Serialize*() into a sealed memfd. Returns
+  // the memfd, which must be sent along with the shmem frame returned in
+  // |shmem_frame|, in place of |serialized_frame|. Returns an invalid file if
+  // the frame can't be moved, in which case it should be sent as usual.
+  static base::ScopedFile SerializeShmemFrame(
+      const std::string& serialized_frame,
+      std::string* shmem_frame);
+
   // Returns a buffer that can be passed to recv(). The buffer is deliberately
   // not initialized.
   ReceiveBuffer BeginReceive();
@@ -104,10 +145,24 @@ class BufferedFrameDeserializer {
   // Must be called soon after BeginReceive().
   // |recv_size| is the number of valid bytes that have been written into the
   // buffer previously returned by BeginReceive() (the return value of recv()).
-  // Returns false if a header > |max_capacity| is received, in which case the
-  // caller is expected to shutdown the socket and terminate the ipc.
+  // Returns false if a header > |max_capacity| or a compressed frame which
+  // can't be decompressed is received, in which case the caller is expected to shutdown the socket
+  // and terminate the ipc.
   bool EndReceive(size_t recv_size) PERFETTO_WARN_UNUSED_RESULT;
 
+  // Same as above, for a recv() which also received the file |fd|. If the
+  // last frame completed by this recv() is a shmem frame, |fd| is its memfd:
+  // the actual frame is decoded from it and |fd| is reset. Otherwise |fd| is
+  // left to the caller. Shmem frames received without a valid memfd are
+  // dropped.
+  bool EndReceive(size_t recv_size,
+                  base::ScopedFile* fd) PERFETTO_WARN_UNUSED_RESULT;
+
+  // Enables the decoding of compressed frames.
+  void set_frame_decompressor(FrameDecompressorFn decompressor) {
+    frame_decompressor_ = decompressor;
+  }
+
   // Decodes and returns the next decoded frame in the buffer if any, nullptr
   // if no further frames have been decoded.
   std::unique_ptr<Frame> PopNextFrame();
@@ -120,8 +175,16 @@ class BufferedFrameDeserializer {
   BufferedFrameDeserializer& operator=(const BufferedFrameDeserializer&) =
       delete;
 
-  // If a valid frame is decoded it is added to |decoded_frames_|.
-  void DecodeFrame(const char*, size_t);
+  // If a valid frame is decoded it is added to |decoded_frames_|. Returns
+  // false if the frame is a compressed frame which can't be decompressed.
+  bool DecodeFrame(const char*, size_t);
+
+  // Adds the frames carried by a compressed frame to |decoded_frames_|.
+  bool DecodeCompressedFrames(const std::string& compressed_frames);
+
+  // Replaces the shmem frames at the end of |decoded_frames_| with the frames
+  // they stand for. See EndReceive().
+  void DecodeShmemFrames(base::ScopedFile* fd);
 
   char* buf() { return reinterpret_cast<char*>(buf_.Get()); }
 
@@ -133,6 +196,7 @@ class BufferedFrameDeserializer {
   size_t size_ = 0;
 
   std::list<std::unique_ptr<Frame>> decoded_frames_;
+  FrameDecompressorFn frame_decompressor_ = nullptr;
 };
 
 }  // namespace ipc
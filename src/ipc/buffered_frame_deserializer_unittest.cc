@@ -20,6 +20,8 @@
 #include <string>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/memfd.h"
 #include "perfetto/ext/base/utils.h"
 #include "test/gtest_and_gmock.h"
 
@@ -377,6 +379,164 @@ TEST(BufferedFrameDeserializerTest, FillCapacity) {
   }
 }
 
+// SerializeInvokeMethodReply() must produce the same bytes as Serialize().
+TEST(BufferedFrameDeserializerTest, SerializeInvokeMethodReply) {
+  for (bool success : {true, false}) {
+    for (bool has_more : {true, false}) {
+      std::string reply_proto(success ? 1000 : 0, 'x');
+      Frame frame;
+      frame.set_request_id(0x123456789);
+      auto* reply = frame.mutable_msg_invoke_method_reply();
+      reply->set_has_more(has_more);
+      if (success) {
+        reply->set_success(true);
+        reply->set_reply_proto(reply_proto);
+      }
+      EXPECT_EQ(BufferedFrameDeserializer::SerializeInvokeMethodReply(
+                    0x123456789, success, has_more, reply_proto),
+                BufferedFrameDeserializer::Serialize(frame));
+    }
+  }
+}
+
+// Delivers |buf| in a single recv(), along with |fd|.
+bool Receive(BufferedFrameDeserializer* bfd,
+             const std::string& buf,
+             base::ScopedFile* fd) {
+  BufferedFrameDeserializer::ReceiveBuffer rbuf = bfd->BeginReceive();
+  PERFETTO_CHECK(rbuf.size >= buf.size());
+  memcpy(rbuf.data, buf.data(), buf.size());
+  return bfd->EndReceive(buf.size(), fd);
+}
+
+TEST(BufferedFrameDeserializerTest, ShmemFrame) {
+  if (!BufferedFrameDeserializer::ShmemFramesSupported())
+    GTEST_SKIP() << "memfd not supported";
+  // Larger than the receive buffer.
+  std::vector<char> frame = GetSimpleFrame(kIPCBufferSize * 4);
+  std::string shmem_frame;
+  base::ScopedFile fd = BufferedFrameDeserializer::SerializeShmemFrame(
+      std::string(frame.data(), frame.size()), &shmem_frame);
+  ASSERT_TRUE(fd);
+  ASSERT_LT(shmem_frame.size(), 32u);
+
+  BufferedFrameDeserializer bfd;
+  ASSERT_TRUE(Receive(&bfd, shmem_frame, &fd));
+  EXPECT_FALSE(fd);
+  auto decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(frame, *decoded_frame));
+  ASSERT_FALSE(bfd.PopNextFrame());
+}
+
+// The file received along with a regular frame is left to the caller.
+TEST(BufferedFrameDeserializerTest, FileOfRegularFrameIsNotTaken) {
+  if (!BufferedFrameDeserializer::ShmemFramesSupported())
+    GTEST_SKIP() << "memfd not supported";
+  std::vector<char> frame = GetSimpleFrame(64);
+  base::ScopedFile fd = base::CreateMemfd("test", MFD_CLOEXEC);
+  ASSERT_TRUE(fd);
+
+  BufferedFrameDeserializer bfd;
+  ASSERT_TRUE(Receive(&bfd, std::string(frame.data(), frame.size()), &fd));
+  EXPECT_TRUE(fd);
+  auto decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(frame, *decoded_frame));
+}
+
+// Shmem frames without a memfd, or with one which the sender could still
+// modify, are dropped.
+TEST(BufferedFrameDeserializerTest, InvalidShmemFramesAreDropped) {
+  if (!BufferedFrameDeserializer::ShmemFramesSupported())
+    GTEST_SKIP() << "memfd not supported";
+  std::vector<char> frame = GetSimpleFrame(1024);
+  Frame shmem_frame;
+  shmem_frame.set_shmem_frame_size(frame.size() - kHeaderSize);
+  std::string shmem_buf = BufferedFrameDeserializer::Serialize(shmem_frame);
+
+  BufferedFrameDeserializer bfd;
+  ASSERT_TRUE(Receive(&bfd, shmem_buf, nullptr));
+  ASSERT_FALSE(bfd.PopNextFrame());
+
+  base::ScopedFile unsealed_fd = base::CreateMemfd("test", MFD_CLOEXEC);
+  ASSERT_TRUE(unsealed_fd);
+  ASSERT_EQ(base::WriteAll(*unsealed_fd, frame.data() + kHeaderSize,
+                           frame.size() - kHeaderSize),
+            static_cast<ssize_t>(frame.size() - kHeaderSize));
+  ASSERT_TRUE(Receive(&bfd, shmem_buf, &unsealed_fd));
+  ASSERT_FALSE(bfd.PopNextFrame());
+
+  // The deserializer is still usable.
+  std::vector<char> next_frame = GetSimpleFrame(64);
+  ASSERT_TRUE(Receive(&bfd, std::string(next_frame.data(), next_frame.size()),
+                      nullptr));
+  auto decoded_frame = bfd.PopNextFrame();
+  ASSERT_TRUE(decoded_frame);
+  ASSERT_TRUE(FrameEq(next_frame, *decoded_frame));
+}
+
+// Stands for the decompression of compressed frames carrying their frames
+// uncompressed.
+bool CopyFrames(const std::string& compressed,
+                size_t max_size,
+                std::string* frames) {
+  if (compressed.size() > max_size)
+    return false;
+  frames->append(compressed);
+  return true;
+}
+
+std::string CompressedFrame(const std::vector<std::vector<char>>& frames) {
+  std::string batch;
+  for (const auto& frame : frames)
+    batch.append(frame.data(), frame.size());
+  Frame compressed_frame;
+  compressed_frame.set_compressed_frames(batch);
+  return BufferedFrameDeserializer::Serialize(compressed_frame);
+}
+
+// The frames carried by a compressed frame are decoded in its place.
+TEST(BufferedFrameDeserializerTest, CompressedFrames) {
+  std::vector<char> frame1 = GetSimpleFrame(64);
+  std::vector<char> frame2 = GetSimpleFrame(1000);
+  std::vector<char> frame3 = GetSimpleFrame(128);
+  std::string buf = CompressedFrame({frame1, frame2});
+  buf.append(frame3.data(), frame3.size());
+
+  BufferedFrameDeserializer bfd;
+  bfd.set_frame_decompressor(&CopyFrames);
+  ASSERT_TRUE(Receive(&bfd, buf, nullptr));
+  for (const auto& frame : {frame1, frame2, frame3}) {
+    auto decoded_frame = bfd.PopNextFrame();
+    ASSERT_TRUE(decoded_frame);
+    ASSERT_TRUE(FrameEq(frame, *decoded_frame));
+  }
+  ASSERT_FALSE(bfd.PopNextFrame());
+}
+
+TEST(BufferedFrameDeserializerTest, RejectCompressedFramesWithoutDecompressor) {
+  BufferedFrameDeserializer bfd;
+  ASSERT_FALSE(Receive(&bfd, CompressedFrame({GetSimpleFrame(64)}), nullptr));
+}
+
+TEST(BufferedFrameDeserializerTest, RejectInvalidCompressedFrames) {
+  std::vector<char> truncated_frame = GetSimpleFrame(64);
+  truncated_frame.resize(truncated_frame.size() - 1);
+  BufferedFrameDeserializer bfd;
+  bfd.set_frame_decompressor(&CopyFrames);
+  ASSERT_FALSE(Receive(&bfd, CompressedFrame({truncated_frame}), nullptr));
+
+  // Compressed frames can't be nested.
+  std::string nested = CompressedFrame({GetSimpleFrame(64)});
+  std::string buf =
+      CompressedFrame({std::vector<char>(nested.begin(), nested.end())});
+  BufferedFrameDeserializer bfd2;
+  bfd2.set_frame_decompressor(&CopyFrames);
+  ASSERT_TRUE(Receive(&bfd2, buf, nullptr));
+  ASSERT_FALSE(bfd2.PopNextFrame());
+}
+
 }  // namespace
 }  // namespace ipc
 }  // namespace perfetto
@@ -19,7 +19,9 @@
 #include <fcntl.h>
 
 #include <cinttypes>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/unix_socket.h"
@@ -52,6 +54,7 @@ std::unique_ptr<Client> Client::CreateInstance(ConnArgs conn_args,
 ClientImpl::ClientImpl(ConnArgs conn_args, base::TaskRunner* task_runner)
     : socket_name_(conn_args.socket_name),
       socket_retry_(conn_args.retry),
+      shmem_frame_threshold_(conn_args.shmem_frame_threshold),
       task_runner_(task_runner),
       weak_ptr_factory_(this) {
   if (conn_args.socket_fd) {
@@ -69,6 +72,7 @@ ClientImpl::ClientImpl(ConnArgs conn_args, base::TaskRunner* task_runner)
 ClientImpl::~ClientImpl() {
   // Ensure we are not destroyed in the middle of invoking a reply.
   PERFETTO_DCHECK(!invoking_method_reply_);
+  FlushPendingFrames();
   OnDisconnect(
       nullptr);  // The base::UnixSocket* ptr is not used in OnDisconnect().
 }
@@ -93,6 +97,8 @@ void ClientImpl::BindService(base::WeakPtr<ServiceProxy> service_proxy) {
   Frame::BindService* req = frame.mutable_msg_bind_service();
   const char* const service_name = service_proxy->GetDescriptor().service_name;
   req->set_service_name(service_name);
+  req->set_accepts_shmem_frames(
+      BufferedFrameDeserializer::ShmemFramesSupported());
   if (!SendFrame(frame)) {
     PERFETTO_DLOG("BindService(%s) failed", service_name);
     return service_proxy->OnConnect(false /* success */);
@@ -142,6 +148,46 @@ bool ClientImpl::SendFrame(const Frame& frame, int fd) {
   // Serialize the frame into protobuf, add the size header, and send it.
   std::string buf = BufferedFrameDeserializer::Serialize(frame);
 
+  // Large frames go through a memfd, if the host supports it. Frames which
+  // already carry a file can't.
+  base::ScopedFile shmem_fd;
+  if (shmem_frame_threshold_ && buf.size() > shmem_frame_threshold_ &&
+      host_accepts_shmem_frames_ && fd == base::ScopedFile::kInvalid) {
+    std::string shmem_frame;
+    shmem_fd =
+        BufferedFrameDeserializer::SerializeShmemFrame(buf, &shmem_frame);
+    if (shmem_fd) {
+      buf = std::move(shmem_frame);
+      fd = *shmem_fd;
+    }
+  }
+
+  // Frames without a file are queued and written together at the end of the
+  // task (or as soon as the queue gets large), as producers typically send
+  // many small requests in a row (e.g. CommitData()). A failure to send them
+  // later disconnects the socket, which fails the requests in flight.
+  if (fd == base::ScopedFile::kInvalid) {
+    if (!sock_->is_connected())
+      return false;
+    if (pending_frames_.empty()) {
+      auto weak_this = weak_ptr_factory_.GetWeakPtr();
+      task_runner_->PostTask([weak_this] {
+        if (weak_this)
+          static_cast<ClientImpl&>(*weak_this).FlushPendingFrames();
+      });
+    }
+    pending_bytes_ += buf.size();
+    pending_frames_.emplace_back(std::move(buf));
+    if (pending_bytes_ >= kIPCBufferSize)
+      return FlushPendingFrames();
+    return true;
+  }
+
+  // The file must be received with its own frame, so the frames queued before
+  // have to go first.
+  if (!FlushPendingFrames())
+    return false;
+
   // TODO(primiano): this should do non-blocking I/O. But then what if the
   // socket buffer is full? We might want to either drop the request or throttle
   // the send and PostTask the reply later? Right now we are making Send()
@@ -151,6 +197,22 @@ bool ClientImpl::SendFrame(const Frame& frame, int fd) {
   return res;
 }
 
+bool ClientImpl::FlushPendingFrames() {
+  if (pending_frames_.empty())
+    return true;
+  std::vector<std::string> frames = std::move(pending_frames_);
+  pending_frames_.clear();
+  pending_bytes_ = 0;
+
+  std::vector<base::SockSendBuffer> bufs;
+  bufs.reserve(frames.size());
+  for (const std::string& frame : frames)
+    bufs.push_back(base::SockSendBuffer{frame.data(), frame.size()});
+  bool res = sock_->SendV(bufs.data(), bufs.size());
+  PERFETTO_CHECK(res || !sock_->is_connected());
+  return res;
+}
+
 void ClientImpl::OnConnect(base::UnixSocket*, bool connected) {
   if (!connected && socket_retry_) {
     socket_backoff_ms_ =
@@ -212,6 +274,12 @@ void ClientImpl::OnDataAvailable(base::UnixSocket*) {
     auto buf = frame_deserializer_.BeginReceive();
     base::ScopedFile fd;
     rsize = sock_->Receive(buf.data, buf.size, &fd);
+    // Takes |fd| if it is the memfd of a shmem frame.
+    if (!frame_deserializer_.EndReceive(rsize, &fd)) {
+      // The endpoint tried to send a frame that is way too large.
+      return sock_->Shutdown(true);  // In turn will trigger an OnDisconnect().
+      // TODO(fmayer): check this.
+    }
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     PERFETTO_DCHECK(!fd);
 #else
@@ -222,11 +290,6 @@ void ClientImpl::OnDataAvailable(base::UnixSocket*) {
       received_fd_ = std::move(fd);
     }
 #endif
-    if (!frame_deserializer_.EndReceive(rsize)) {
-      // The endpoint tried to send a frame that is way too large.
-      return sock_->Shutdown(true);  // In turn will trigger an OnDisconnect().
-      // TODO(fmayer): check this.
-    }
   } while (rsize > 0);
 
   while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame())
@@ -292,6 +355,8 @@ void ClientImpl::OnBindServiceReply(QueuedRequest req,
     }
     methods[method.name()] = method.id();
   }
+  if (reply.accepts_shmem_frames())
+    host_accepts_shmem_frames_ = true;
   service_proxy->InitializeBinding(weak_ptr_factory_.GetWeakPtr(),
                                    reply.service_id(), std::move(methods));
   service_bindings_[reply.service_id()] = service_proxy;
@@ -20,6 +20,8 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -85,6 +87,8 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
 
   void TryConnect();
   bool SendFrame(const Frame&, int fd = -1);
+  // Writes the frames queued by SendFrame() with a single syscall.
+  bool FlushPendingFrames();
   void OnFrameReceived(const Frame&);
   void OnBindServiceReply(QueuedRequest,
                           const protos::gen::IPCFrame_BindServiceReply&);
@@ -95,7 +99,12 @@ class ClientImpl : public Client, public base::UnixSocket::EventListener {
   const char* socket_name_ = nullptr;
   bool socket_retry_ = false;
   uint32_t socket_backoff_ms_ = 0;
+  const size_t shmem_frame_threshold_;
+  // Set by BindServiceReply.accepts_shmem_frames.
+  bool host_accepts_shmem_frames_ = false;
   std::unique_ptr<base::UnixSocket> sock_;
+  std::vector<std::string> pending_frames_;
+  size_t pending_bytes_ = 0;
   base::TaskRunner* const task_runner_;
   RequestID last_request_id_ = 0;
   BufferedFrameDeserializer frame_deserializer_;
@@ -18,7 +18,10 @@
 
 #include <algorithm>
 #include <cinttypes>
+#include <memory>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
@@ -29,11 +32,16 @@
 #include "perfetto/ext/base/sys_types.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/ipc/service.h"
 #include "perfetto/ext/ipc/service_descriptor.h"
 
 #include "protos/perfetto/ipc/wire_protocol.gen.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <unistd.h>
+#endif
+
 // TODO(primiano): put limits on #connections/uid and req. queue (b/69093705).
 
 namespace perfetto {
@@ -88,7 +96,112 @@ base::MachineID GenerateMachineID(base::UnixSocket* sock,
 }
 }  // namespace
 
-uid_t HostImpl::ClientConnection::GetPosixPeerUid() const {
+// The socket side of the host: accepts the connections, reads the frames and
+// decodes the requests, which are handed over to the HostImpl, and sends the
+// replies. Lives on the I/O thread (see the comment in host_impl.h).
+class HostImpl::Frontend : public base::UnixSocket::EventListener {
+ public:
+  Frontend(HostImpl* host, base::TaskRunner* task_runner);
+  ~Frontend() override;
+
+  bool Listen(const char* socket_name);
+  bool Listen(base::ScopedSocketHandle);
+  void AdoptConnectedSocket_Fuchsia(base::ScopedSocketHandle,
+                                    std::function<bool(int)> send_fd_cb);
+  void AddService(ServiceID, const ServiceDescriptor*);
+  void set_socket_tx_timeout_ms(uint32_t ms) { socket_tx_timeout_ms_ = ms; }
+  void set_shmem_frame_threshold(size_t bytes) {
+    shmem_frame_threshold_ = bytes;
+  }
+  void set_frame_decompressor(FrameDecompressorFn decompressor) {
+    frame_decompressor_ = decompressor;
+  }
+  const base::UnixSocket* sock() const { return sock_.get(); }
+
+  // Sends a frame already serialized with BufferedFrameDeserializer, if the
+  // client is still connected.
+  void SendSerializedFrame(ClientID, std::string buf, int fd);
+
+  // base::UnixSocket::EventListener implementation.
+  void OnNewIncomingConnection(base::UnixSocket*,
+                               std::unique_ptr<base::UnixSocket>) override;
+  void OnDisconnect(base::UnixSocket*) override;
+  void OnDataAvailable(base::UnixSocket*) override;
+
+ private:
+  // Owns the per-client receive buffer (BufferedFrameDeserializer).
+  struct ClientConnection {
+    ~ClientConnection();
+    ClientID id;
+    std::unique_ptr<base::UnixSocket> sock;
+    BufferedFrameDeserializer frame_deserializer;
+    base::ScopedFile received_fd;
+    std::function<bool(int)> send_fd_cb_fuchsia;
+    // Set by BindService.accepts_shmem_frames.
+    bool accepts_shmem_frames = false;
+    // The frames sent during the current task, written to the socket together
+    // by FlushPendingFrames().
+    std::vector<std::string> pending_frames;
+    size_t pending_bytes = 0;
+    // Peer identity set using IPCFrame sent by the client. These 3 fields
+    // should be used only for non-AF_UNIX connections AF_UNIX connections
+    // should only rely on the peer identity obtained from the socket.
+    uid_t uid_override = base::kInvalidUid;
+    pid_t pid_override = base::kInvalidPid;
+
+    // |machine_id| is mapped from machine_id_hint (or socket hostname if
+    // |the client doesn't support machine_id_hint).
+    base::MachineID machine_id = base::kDefaultMachineID;
+
+    pid_t GetLinuxPeerPid() const;
+    uid_t GetPosixPeerUid() const;
+    base::MachineID GetMachineID() const { return machine_id; }
+    ClientInfo GetClientInfo() const {
+      return ClientInfo(id, GetPosixPeerUid(), GetLinuxPeerPid(),
+                        GetMachineID());
+    }
+  };
+
+  void OnReceivedFrame(ClientConnection*, const Frame&);
+  void OnBindService(ClientConnection*, const Frame&);
+  void OnInvokeMethod(ClientConnection*, const Frame&);
+  void OnSetPeerIdentity(ClientConnection*, const Frame&);
+
+  // Runs |task| on the service thread, unless the HostImpl is gone by then.
+  void PostToHost(std::function<void(HostImpl*)> task);
+
+  void SendFrame(ClientConnection*, const Frame&, int fd = -1);
+  void SendSerializedFrame(ClientConnection*, std::string buf, int fd = -1);
+
+  // The frames sent to a client are queued and written with a single
+  // UnixSocket::SendV() at the end of the task, rather than with one syscall
+  // each: the replies to the requests read in one go by OnDataAvailable() are
+  // sent in one go too. Frames carrying a file flush the queue and are sent
+  // right away, as are the queues that grow larger than kIPCBufferSize.
+  void FlushPendingFrames(ClientConnection*);
+  void FlushAllPendingFrames();
+
+  // |host_| is used directly only without an I/O thread. Otherwise the tasks
+  // posted to |host_task_runner_| use |host_weak_ptr_|.
+  HostImpl* const host_;
+  base::WeakPtr<HostImpl> host_weak_ptr_;
+  base::TaskRunner* const host_task_runner_;
+  const bool has_io_thread_;
+  base::TaskRunner* const task_runner_;
+  std::map<ServiceID, const ServiceDescriptor*> services_;
+  std::unique_ptr<base::UnixSocket> sock_;  // The listening socket.
+  std::map<ClientID, std::unique_ptr<ClientConnection>> clients_;
+  std::map<base::UnixSocket*, ClientConnection*> clients_by_socket_;
+  ClientID last_client_id_ = 0;
+  uint32_t socket_tx_timeout_ms_ = kDefaultIpcTxTimeoutMs;
+  size_t shmem_frame_threshold_ = 0;  // 0: shmem frames disabled.
+  FrameDecompressorFn frame_decompressor_ = nullptr;
+  std::vector<ClientID> clients_with_pending_frames_;
+  PERFETTO_THREAD_CHECKER(thread_checker_)
+  base::WeakPtrFactory<Frontend> weak_ptr_factory_;  // Keep last.
+};
+
+uid_t HostImpl::Frontend::ClientConnection::GetPosixPeerUid() const {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
@@ -103,7 +216,7 @@ uid_t HostImpl::ClientConnection::GetPosixPeerUid() const {
   return 0;
 }
 
-pid_t HostImpl::ClientConnection::GetLinuxPeerPid() const {
+pid_t HostImpl::Frontend::ClientConnection::GetLinuxPeerPid() const {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
   if (sock->family() == base::SockFamily::kUnix)
@@ -116,19 +229,22 @@ pid_t HostImpl::ClientConnection::GetLinuxPeerPid() const {
 
 // static
 std::unique_ptr<Host> Host::CreateInstance(const char* socket_name,
-                                           base::TaskRunner* task_runner) {
-  std::unique_ptr<HostImpl> host(new HostImpl(socket_name, task_runner));
-  if (!host->sock() || !host->sock()->is_listening())
+                                           base::TaskRunner* task_runner,
+                                           base::TaskRunner* io_task_runner) {
+  std::unique_ptr<HostImpl> host(
+      new HostImpl(socket_name, task_runner, io_task_runner));
+  if (!host->is_listening())
     return nullptr;
   return std::unique_ptr<Host>(std::move(host));
 }
 
 // static
 std::unique_ptr<Host> Host::CreateInstance(base::ScopedSocketHandle socket_fd,
-                                           base::TaskRunner* task_runner) {
+                                           base::TaskRunner* task_runner,
+                                           base::TaskRunner* io_task_runner) {
   std::unique_ptr<HostImpl> host(
-      new HostImpl(std::move(socket_fd), task_runner));
-  if (!host->sock() || !host->sock()->is_listening())
+      new HostImpl(std::move(socket_fd), task_runner, io_task_runner));
+  if (!host->is_listening())
     return nullptr;
   return std::unique_ptr<Host>(std::move(host));
 }
@@ -140,30 +256,70 @@ std::unique_ptr<Host> Host::CreateInstance_Fuchsia(
 }
 
 HostImpl::HostImpl(base::ScopedSocketHandle socket_fd,
-                   base::TaskRunner* task_runner)
-    : task_runner_(task_runner), weak_ptr_factory_(this) {
+                   base::TaskRunner* task_runner,
+                   base::TaskRunner* io_task_runner)
+    : task_runner_(task_runner),
+      io_task_runner_(io_task_runner ? io_task_runner : task_runner),
+      weak_ptr_factory_(this) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  sock_ = base::UnixSocket::Listen(std::move(socket_fd), this, task_runner_,
-                                   kHostSockFamily, base::SockType::kStream);
+  CreateFrontend([this, &socket_fd](Frontend* frontend) {
+    is_listening_ = frontend->Listen(std::move(socket_fd));
+  });
 }
 
-HostImpl::HostImpl(const char* socket_name, base::TaskRunner* task_runner)
-    : task_runner_(task_runner), weak_ptr_factory_(this) {
+HostImpl::HostImpl(const char* socket_name,
+                   base::TaskRunner* task_runner,
+                   base::TaskRunner* io_task_runner)
+    : task_runner_(task_runner),
+      io_task_runner_(io_task_runner ? io_task_runner : task_runner),
+      weak_ptr_factory_(this) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  sock_ = base::UnixSocket::Listen(socket_name, this, task_runner_,
-                                   base::GetSockFamily(socket_name),
-                                   base::SockType::kStream);
-  if (!sock_) {
-    PERFETTO_PLOG("Failed to create %s", socket_name);
-  }
+  CreateFrontend([this, socket_name](Frontend* frontend) {
+    is_listening_ = frontend->Listen(socket_name);
+  });
 }
 
 HostImpl::HostImpl(base::TaskRunner* task_runner)
-    : task_runner_(task_runner), weak_ptr_factory_(this) {
+    : task_runner_(task_runner),
+      io_task_runner_(task_runner),
+      weak_ptr_factory_(this) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  CreateFrontend([](Frontend*) {});
+}
+
+HostImpl::~HostImpl() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  // The frontend must go away on its thread. The replies it still has to send
+  // are sent first, as they were posted before.
+  RunOnIoThreadAndWait([this] { frontend_.reset(); });
 }
 
-HostImpl::~HostImpl() = default;
+void HostImpl::CreateFrontend(std::function<void(Frontend*)> init) {
+  RunOnIoThreadAndWait([this, &init] {
+    frontend_.reset(new Frontend(this, io_task_runner_));
+    init(frontend_.get());
+    const base::UnixSocket* sock = frontend_->sock();
+    use_shmem_emulation_ =
+        sock && !base::SockShmemSupported(sock->family());
+  });
+}
+
+void HostImpl::RunOnIoThreadAndWait(std::function<void()> task) {
+  if (!has_io_thread()) {
+    task();
+    return;
+  }
+  base::WaitableEvent done;
+  io_task_runner_->PostTask([&task, &done] {
+    task();
+    done.Notify();
+  });
+  done.Wait();
+}
+
+const base::UnixSocket* HostImpl::sock() const {
+  return frontend_->sock();
+}
 
 bool HostImpl::ExposeService(std::unique_ptr<Service> service) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -172,11 +328,15 @@ bool HostImpl::ExposeService(std::unique_ptr<Service> service) {
     PERFETTO_DLOG("Duplicate ExposeService(): %s", service_name.c_str());
     return false;
   }
-  service->use_shmem_emulation_ =
-      sock() && !base::SockShmemSupported(sock()->family());
+  service->use_shmem_emulation_ = use_shmem_emulation_;
   ServiceID sid = ++last_service_id_;
+  const ServiceDescriptor* descriptor = &service->GetDescriptor();
   ExposedService exposed_service(sid, service_name, std::move(service));
   services_.emplace(sid, std::move(exposed_service));
+  // Waiting here guarantees that clients can bind to the service as soon as
+  // this returns, as is the case without an I/O thread.
+  RunOnIoThreadAndWait(
+      [this, sid, descriptor] { frontend_->AddService(sid, descriptor); });
   return true;
 }
 
@@ -184,6 +344,168 @@ void HostImpl::AdoptConnectedSocket_Fuchsia(
     base::ScopedSocketHandle connected_socket,
     std::function<bool(int)> send_fd_cb) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_DCHECK(!has_io_thread());
+  frontend_->AdoptConnectedSocket_Fuchsia(std::move(connected_socket),
+                                          std::move(send_fd_cb));
+}
+
+void HostImpl::SetSocketSendTimeoutMs(uint32_t timeout_ms) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // Should be less than the watchdog period (30s).
+  RunOnIoThreadAndWait([this, timeout_ms] {
+    frontend_->set_socket_tx_timeout_ms(timeout_ms);
+  });
+}
+
+void HostImpl::SetShmemFrameThreshold(size_t threshold_bytes) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  RunOnIoThreadAndWait([this, threshold_bytes] {
+    frontend_->set_shmem_frame_threshold(threshold_bytes);
+  });
+}
+
+void HostImpl::SetFrameDecompressor(FrameDecompressorFn decompressor) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  RunOnIoThreadAndWait([this, decompressor] {
+    frontend_->set_frame_decompressor(decompressor);
+  });
+}
+
+void HostImpl::OnInvokeMethod(MethodInvocation* invocation) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto svc_it = services_.find(invocation->service_id);
+  PERFETTO_CHECK(svc_it != services_.end());
+  Service* service = svc_it->second.instance.get();
+
+  const ClientInfo& client_info = invocation->client_info;
+  ClientID client_id = client_info.client_id();
+  RequestID request_id = invocation->request_id;
+  Deferred<ProtoMessage> deferred_reply;
+  base::WeakPtr<HostImpl> host_weak_ptr = weak_ptr_factory_.GetWeakPtr();
+
+  if (!invocation->drop_reply) {
+    deferred_reply.Bind([host_weak_ptr, client_id,
+                         request_id](AsyncResult<ProtoMessage> reply) {
+      if (!host_weak_ptr)
+        return;  // The reply came too late, the HostImpl has gone.
+      host_weak_ptr->ReplyToMethodInvocation(client_id, request_id,
+                                             std::move(reply));
+    });
+  }
+
+  // A file descriptor is kept until a service takes it, even if the method it
+  // was sent with doesn't.
+  base::ScopedFile& received_fd = received_fds_[client_id];
+  if (invocation->received_fd)
+    received_fd = std::move(invocation->received_fd);
+
+  auto scoped_key =
+      g_crash_key_uid.SetScoped(static_cast<int64_t>(client_info.uid()));
+  service->client_info_ = client_info;
+  service->received_fd_ = &received_fd;
+  invocation->method->invoker(service, *invocation->args,
+                              std::move(deferred_reply));
+  service->received_fd_ = nullptr;
+  service->client_info_ = ClientInfo();
+  if (!received_fd)
+    received_fds_.erase(client_id);
+}
+
+void HostImpl::OnClientDisconnected(const ClientInfo& client_info) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  received_fds_.erase(client_info.client_id());
+  for (const auto& service_it : services_) {
+    Service& service = *service_it.second.instance;
+    service.client_info_ = client_info;
+    service.OnClientDisconnected();
+    service.client_info_ = ClientInfo();
+  }
+}
+
+void HostImpl::ReplyToMethodInvocation(ClientID client_id,
+                                       RequestID request_id,
+                                       AsyncResult<ProtoMessage> reply) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // TODO(fmayer): add a test to guarantee that the reply is consumed within the
+  // same call stack and not kept around. ConsumerIPCService::OnTraceData()
+  // relies on this behavior. This is also why the reply is serialized here
+  // even when it is sent from the I/O thread.
+  // The reply is serialized directly into the frame, rather than through a
+  // Frame object, to save two copies of it.
+  std::string reply_proto;
+  if (reply.success())
+    reply_proto = reply->SerializeAsString();
+  std::string buf = BufferedFrameDeserializer::SerializeInvokeMethodReply(
+      request_id, reply.success(), reply.has_more(), reply_proto);
+  if (!has_io_thread()) {
+    frontend_->SendSerializedFrame(client_id, std::move(buf), reply.fd());
+    return;
+  }
+
+  // The file descriptor is owned by the service, which might close it before
+  // the I/O thread sends it.
+  auto fd = std::make_shared<base::ScopedFile>();
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (reply.fd() != base::ScopedFile::kInvalid)
+    fd->reset(dup(reply.fd()));
+#else
+  PERFETTO_DCHECK(reply.fd() == base::ScopedFile::kInvalid);
+#endif
+  auto shared_buf = std::make_shared<std::string>(std::move(buf));
+  Frontend* frontend = frontend_.get();
+  io_task_runner_->PostTask([frontend, client_id, shared_buf, fd] {
+    frontend->SendSerializedFrame(client_id, std::move(*shared_buf),
+                                  fd->get());
+  });
+}
+
+const HostImpl::ExposedService* HostImpl::GetServiceByName(
+    const std::string& name) {
+  // This could be optimized by using another map<name,ServiceID>. However this
+  // is used only by ExposeService that is quite rare (once per service
+  // instance), not worth it.
+  for (const auto& it : services_) {
+    if (it.second.name == name)
+      return &it.second;
+  }
+  return nullptr;
+}
+
+HostImpl::Frontend::Frontend(HostImpl* host, base::TaskRunner* task_runner)
+    : host_(host),
+      host_weak_ptr_(host->weak_ptr_factory_.GetWeakPtr()),
+      host_task_runner_(host->task_runner_),
+      has_io_thread_(host->has_io_thread()),
+      task_runner_(task_runner),
+      weak_ptr_factory_(this) {}
+
+HostImpl::Frontend::~Frontend() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  FlushAllPendingFrames();
+}
+
+bool HostImpl::Frontend::Listen(base::ScopedSocketHandle socket_fd) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  sock_ = base::UnixSocket::Listen(std::move(socket_fd), this, task_runner_,
+                                   kHostSockFamily, base::SockType::kStream);
+  return sock_ && sock_->is_listening();
+}
+
+bool HostImpl::Frontend::Listen(const char* socket_name) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  sock_ = base::UnixSocket::Listen(socket_name, this, task_runner_,
+                                   base::GetSockFamily(socket_name),
+                                   base::SockType::kStream);
+  if (!sock_) {
+    PERFETTO_PLOG("Failed to create %s", socket_name);
+  }
+  return sock_ && sock_->is_listening();
+}
+
+void HostImpl::Frontend::AdoptConnectedSocket_Fuchsia(
+    base::ScopedSocketHandle connected_socket,
+    std::function<bool(int)> send_fd_cb) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DCHECK(connected_socket);
   // Should not be used in conjunction with listen sockets.
   PERFETTO_DCHECK(!sock_);
@@ -199,13 +521,25 @@ void HostImpl::AdoptConnectedSocket_Fuchsia(
   PERFETTO_DCHECK(client_connection->send_fd_cb_fuchsia);
 }
 
-void HostImpl::SetSocketSendTimeoutMs(uint32_t timeout_ms) {
+void HostImpl::Frontend::AddService(ServiceID service_id,
+                                    const ServiceDescriptor* descriptor) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
-  // Should be less than the watchdog period (30s).
-  socket_tx_timeout_ms_ = timeout_ms;
+  services_[service_id] = descriptor;
 }
 
-void HostImpl::OnNewIncomingConnection(
+void HostImpl::Frontend::PostToHost(std::function<void(HostImpl*)> task) {
+  if (!has_io_thread_) {
+    task(host_);
+    return;
+  }
+  base::WeakPtr<HostImpl> host = host_weak_ptr_;
+  host_task_runner_->PostTask([host, task] {
+    if (host)
+      task(host.get());
+  });
+}
+
+void HostImpl::Frontend::OnNewIncomingConnection(
     base::UnixSocket*,
     std::unique_ptr<base::UnixSocket> new_conn) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -215,10 +549,11 @@ void HostImpl::OnNewIncomingConnection(
   client->id = client_id;
   client->sock = std::move(new_conn);
   client->sock->SetTxTimeout(socket_tx_timeout_ms_);
+  client->frame_deserializer.set_frame_decompressor(frame_decompressor_);
   clients_[client_id] = std::move(client);
 }
 
-void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
+void HostImpl::Frontend::OnDataAvailable(base::UnixSocket* sock) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   auto it = clients_by_socket_.find(sock);
   if (it == clients_by_socket_.end())
@@ -234,12 +569,12 @@ void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
     auto buf = frame_deserializer.BeginReceive();
     base::ScopedFile fd;
     rsize = client->sock->Receive(buf.data, buf.size, &fd);
+    if (!frame_deserializer.EndReceive(rsize, &fd))
+      return OnDisconnect(client->sock.get());
     if (fd) {
       PERFETTO_DCHECK(!client->received_fd);
       client->received_fd = std::move(fd);
     }
-    if (!frame_deserializer.EndReceive(rsize))
-      return OnDisconnect(client->sock.get());
   } while (rsize > 0);
 
   for (;;) {
@@ -250,8 +585,8 @@ void HostImpl::OnDataAvailable(base::UnixSocket* sock) {
   }
 }
 
-void HostImpl::OnReceivedFrame(ClientConnection* client,
-                               const Frame& req_frame) {
+void HostImpl::Frontend::OnReceivedFrame(ClientConnection* client,
+                                         const Frame& req_frame) {
   if (req_frame.has_msg_bind_service())
     return OnBindService(client, req_frame);
   if (req_frame.has_msg_invoke_method())
@@ -266,19 +601,28 @@ void HostImpl::OnReceivedFrame(ClientConnection* client,
   SendFrame(client, reply_frame);
 }
 
-void HostImpl::OnBindService(ClientConnection* client, const Frame& req_frame) {
+void HostImpl::Frontend::OnBindService(ClientConnection* client,
+                                       const Frame& req_frame) {
   // Binding a service doesn't do anything major. It just returns back the
   // service id and its method map.
   const Frame::BindService& req = req_frame.msg_bind_service();
+  if (req.accepts_shmem_frames())
+    client->accepts_shmem_frames = true;
   Frame reply_frame;
   reply_frame.set_request_id(req_frame.request_id());
   auto* reply = reply_frame.mutable_msg_bind_service_reply();
-  const ExposedService* service = GetServiceByName(req.service_name());
-  if (service) {
+  reply->set_accepts_shmem_frames(
+      BufferedFrameDeserializer::ShmemFramesSupported());
+  auto svc_it = std::find_if(services_.begin(), services_.end(),
+                             [&req](const auto& service) {
+                               return service.second->service_name ==
+                                      req.service_name();
+                             });
+  if (svc_it != services_.end()) {
     reply->set_success(true);
-    reply->set_service_id(service->id);
+    reply->set_service_id(svc_it->first);
     uint32_t method_id = 1;  // method ids start at index 1.
-    for (const auto& desc_method : service->instance->GetDescriptor().methods) {
+    for (const auto& desc_method : svc_it->second->methods) {
       Frame::BindServiceReply::MethodInfo* method_info = reply->add_methods();
       method_info->set_name(desc_method.name);
       method_info->set_id(method_id++);
@@ -287,8 +631,8 @@ void HostImpl::OnBindService(ClientConnection* client, const Frame& req_frame) {
   SendFrame(client, reply_frame);
 }
 
-void HostImpl::OnInvokeMethod(ClientConnection* client,
-                              const Frame& req_frame) {
+void HostImpl::Frontend::OnInvokeMethod(ClientConnection* client,
+                                        const Frame& req_frame) {
   const Frame::InvokeMethod& req = req_frame.msg_invoke_method();
   Frame reply_frame;
   RequestID request_id = req_frame.request_id();
@@ -298,8 +642,7 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
   if (svc_it == services_.end())
     return SendFrame(client, reply_frame);  // |success| == false by default.
 
-  Service* service = svc_it->second.instance.get();
-  const ServiceDescriptor& svc = service->GetDescriptor();
+  const ServiceDescriptor& svc = *svc_it->second;
   const auto& methods = svc.methods;
   const uint32_t method_id = req.method_id();
   if (method_id == 0 || method_id > methods.size())
@@ -311,32 +654,21 @@ void HostImpl::OnInvokeMethod(ClientConnection* client,
   if (!decoded_req_args)
     return SendFrame(client, reply_frame);
 
-  Deferred<ProtoMessage> deferred_reply;
-  base::WeakPtr<HostImpl> host_weak_ptr = weak_ptr_factory_.GetWeakPtr();
-  ClientID client_id = client->id;
-
-  if (!req.drop_reply()) {
-    deferred_reply.Bind([host_weak_ptr, client_id,
-                         request_id](AsyncResult<ProtoMessage> reply) {
-      if (!host_weak_ptr)
-        return;  // The reply came too late, the HostImpl has gone.
-      host_weak_ptr->ReplyToMethodInvocation(client_id, request_id,
-                                             std::move(reply));
-    });
-  }
-
-  auto peer_uid = client->GetPosixPeerUid();
-  auto scoped_key = g_crash_key_uid.SetScoped(static_cast<int64_t>(peer_uid));
-  service->client_info_ = ClientInfo(
-      client->id, peer_uid, client->GetLinuxPeerPid(), client->GetMachineID());
-  service->received_fd_ = &client->received_fd;
-  method.invoker(service, *decoded_req_args, std::move(deferred_reply));
-  service->received_fd_ = nullptr;
-  service->client_info_ = ClientInfo();
+  auto invocation = std::make_shared<MethodInvocation>();
+  invocation->client_info = client->GetClientInfo();
+  invocation->request_id = request_id;
+  invocation->service_id = svc_it->first;
+  invocation->method = &method;
+  invocation->args = std::move(decoded_req_args);
+  invocation->drop_reply = req.drop_reply();
+  invocation->received_fd = std::move(client->received_fd);
+  PostToHost([invocation](HostImpl* host) {
+    host->OnInvokeMethod(invocation.get());
+  });
 }
 
-void HostImpl::OnSetPeerIdentity(ClientConnection* client,
-                                 const Frame& req_frame) {
+void HostImpl::Frontend::OnSetPeerIdentity(ClientConnection* client,
+                                           const Frame& req_frame) {
   if (client->sock->family() == base::SockFamily::kUnix) {
     PERFETTO_DLOG("SetPeerIdentity is ignored for unix socket connections.");
     return;
@@ -357,37 +689,28 @@ void HostImpl::OnSetPeerIdentity(ClientConnection* client,
                                          set_peer_identity.machine_id_hint());
 }
 
-void HostImpl::ReplyToMethodInvocation(ClientID client_id,
-                                       RequestID request_id,
-                                       AsyncResult<ProtoMessage> reply) {
+void HostImpl::Frontend::SendSerializedFrame(ClientID client_id,
+                                             std::string buf,
+                                             int fd) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
   auto client_iter = clients_.find(client_id);
   if (client_iter == clients_.end())
     return;  // client has disconnected by the time we got the async reply.
+  SendSerializedFrame(client_iter->second.get(), std::move(buf), fd);
+}
 
-  ClientConnection* client = client_iter->second.get();
-  Frame reply_frame;
-  reply_frame.set_request_id(request_id);
-
-  // TODO(fmayer): add a test to guarantee that the reply is consumed within the
-  // same call stack and not kept around. ConsumerIPCService::OnTraceData()
-  // relies on this behavior.
-  auto* reply_frame_data = reply_frame.mutable_msg_invoke_method_reply();
-  reply_frame_data->set_has_more(reply.has_more());
-  if (reply.success()) {
-    std::string reply_proto = reply->SerializeAsString();
-    reply_frame_data->set_reply_proto(reply_proto);
-    reply_frame_data->set_success(true);
-  }
-  SendFrame(client, reply_frame, reply.fd());
+void HostImpl::Frontend::SendFrame(ClientConnection* client,
+                                   const Frame& frame,
+                                   int fd) {
+  SendSerializedFrame(client, BufferedFrameDeserializer::Serialize(frame), fd);
 }
 
-// static
-void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
+void HostImpl::Frontend::SendSerializedFrame(ClientConnection* client,
+                                             std::string buf,
+                                             int fd) {
   auto peer_uid = client->GetPosixPeerUid();
   auto scoped_key = g_crash_key_uid.SetScoped(static_cast<int64_t>(peer_uid));
 
-  std::string buf = BufferedFrameDeserializer::Serialize(frame);
-
   // On Fuchsia, |send_fd_cb_fuchsia_| is used to send the FD to the client
   // and therefore must be set.
   PERFETTO_DCHECK(!PERFETTO_BUILDFLAG(PERFETTO_OS_FUCHSIA) ||
@@ -400,6 +723,46 @@ void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
     fd = base::ScopedFile::kInvalid;
   }
 
+  // Large frames (e.g. ReadBuffers() replies) go through a memfd, if the
+  // client supports it. Frames which already carry a file can't.
+  base::ScopedFile shmem_fd;
+  if (shmem_frame_threshold_ && buf.size() > shmem_frame_threshold_ &&
+      client->accepts_shmem_frames && fd == base::ScopedFile::kInvalid) {
+    std::string shmem_frame;
+    shmem_fd =
+        BufferedFrameDeserializer::SerializeShmemFrame(buf, &shmem_frame);
+    if (shmem_fd) {
+      buf = std::move(shmem_frame);
+      fd = *shmem_fd;
+    }
+  }
+
+  if (fd == base::ScopedFile::kInvalid) {
+    if (!client->sock->is_connected())
+      return;
+    if (client->pending_frames.empty()) {
+      // A flush task is pending iff |clients_with_pending_frames_| is not
+      // empty.
+      if (clients_with_pending_frames_.empty()) {
+        base::WeakPtr<Frontend> weak_this = weak_ptr_factory_.GetWeakPtr();
+        task_runner_->PostTask([weak_this] {
+          if (weak_this)
+            weak_this->FlushAllPendingFrames();
+        });
+      }
+      clients_with_pending_frames_.push_back(client->id);
+    }
+    client->pending_bytes += buf.size();
+    client->pending_frames.emplace_back(std::move(buf));
+    if (client->pending_bytes >= kIPCBufferSize)
+      FlushPendingFrames(client);
+    return;
+  }
+
+  // The file must be received with its own frame, so the frames queued before
+  // have to go first.
+  FlushPendingFrames(client);
+
   // When a new Client connects in OnNewClientConnection we set a timeout on
   // Send (see call to SetTxTimeout).
   //
@@ -411,40 +774,58 @@ void HostImpl::SendFrame(ClientConnection* client, const Frame& frame, int fd) {
   PERFETTO_CHECK(res || !client->sock->is_connected());
 }
 
-void HostImpl::OnDisconnect(base::UnixSocket* sock) {
+void HostImpl::Frontend::FlushPendingFrames(ClientConnection* client) {
+  if (client->pending_frames.empty())
+    return;
+  std::vector<std::string> frames = std::move(client->pending_frames);
+  client->pending_frames.clear();
+  client->pending_bytes = 0;
+
+  std::vector<base::SockSendBuffer> bufs;
+  bufs.reserve(frames.size());
+  for (const std::string& frame : frames)
+    bufs.push_back(base::SockSendBuffer{frame.data(), frame.size()});
+  // See the comments about timeouts in SendSerializedFrame().
+  bool res = client->sock->SendV(bufs.data(), bufs.size());
+  PERFETTO_CHECK(res || !client->sock->is_connected());
+}
+
+void HostImpl::Frontend::FlushAllPendingFrames() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  std::vector<ClientID> client_ids = std::move(clients_with_pending_frames_);
+  clients_with_pending_frames_.clear();
+  for (ClientID client_id : client_ids) {
+    auto it = clients_.find(client_id);
+    if (it == clients_.end())
+      continue;  // Disconnected in the meantime.
+    ClientConnection* client = it->second.get();
+    auto peer_uid = client->GetPosixPeerUid();
+    auto scoped_key =
+        g_crash_key_uid.SetScoped(static_cast<int64_t>(peer_uid));
+    FlushPendingFrames(client);
+  }
+}
+
+void HostImpl::Frontend::OnDisconnect(base::UnixSocket* sock) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   auto it = clients_by_socket_.find(sock);
   if (it == clients_by_socket_.end())
     return;
   auto* client = it->second;
   ClientID client_id = client->id;
-
-  ClientInfo client_info(client_id, client->GetPosixPeerUid(),
-                         client->GetLinuxPeerPid(), client->GetMachineID());
+  ClientInfo client_info = client->GetClientInfo();
 
   clients_by_socket_.erase(it);
   PERFETTO_DCHECK(clients_.count(client_id));
   clients_.erase(client_id);
 
-  for (const auto& service_it : services_) {
-    Service& service = *service_it.second.instance;
-    service.client_info_ = client_info;
-    service.OnClientDisconnected();
-    service.client_info_ = ClientInfo();
-  }
+  PostToHost([client_info](HostImpl* host) {
+    host->OnClientDisconnected(client_info);
+  });
 }
 
-const HostImpl::ExposedService* HostImpl::GetServiceByName(
-    const std::string& name) {
-  // This could be optimized by using another map<name,ServiceID>. However this
-  // is used only by Bind/ExposeService that are quite rare (once per client
-  // connection and once per service instance), not worth it.
-  for (const auto& it : services_) {
-    if (it.second.name == name)
-      return &it.second;
-  }
-  return nullptr;
-}
+HostImpl::MethodInvocation::MethodInvocation() = default;
+HostImpl::MethodInvocation::~MethodInvocation() = default;
 
 HostImpl::ExposedService::ExposedService(ServiceID id_,
                                          const std::string& name_,
@@ -456,7 +837,7 @@ HostImpl::ExposedService& HostImpl::ExposedService::operator=(
     HostImpl::ExposedService&&) = default;
 HostImpl::ExposedService::~ExposedService() = default;
 
-HostImpl::ClientConnection::~ClientConnection() = default;
+HostImpl::Frontend::ClientConnection::~ClientConnection() = default;
 
 }  // namespace ipc
 }  // namespace perfetto
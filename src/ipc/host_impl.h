@@ -17,7 +17,9 @@
 #ifndef SRC_IPC_HOST_IMPL_H_
 #define SRC_IPC_HOST_IMPL_H_
 
+#include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
@@ -27,8 +29,11 @@
 #include "perfetto/ext/base/sys_types.h"
 #include "perfetto/ext/base/thread_checker.h"
 #include "perfetto/ext/base/unix_socket.h"
+#include "perfetto/ext/base/weak_ptr.h"
+#include "perfetto/ext/ipc/client_info.h"
 #include "perfetto/ext/ipc/deferred.h"
 #include "perfetto/ext/ipc/host.h"
+#include "perfetto/ext/ipc/service_descriptor.h"
 #include "src/ipc/buffered_frame_deserializer.h"
 
 namespace perfetto {
@@ -36,10 +41,25 @@ namespace ipc {
 
 constexpr uint32_t kDefaultIpcTxTimeoutMs = 10000;
 
-class HostImpl : public Host, public base::UnixSocket::EventListener {
+// Threading: the exposed services always run on |task_runner|, the task runner
+// passed to the constructor, which is also the one the HostImpl must be used
+// and destroyed on. The sockets are serviced by the "frontend", which runs
+// on |io_task_runner| if one is given, or on |task_runner| otherwise.
+//
+// With a separate |io_task_runner|, reading and writing the sockets, parsing
+// the frames and decoding the arguments of the requests happen on the I/O
+// thread. The I/O thread hands the decoded requests over to the service
+// thread, which hands the serialized replies back. The two threads share
+// nothing else: a reply must be serialized on the service thread anyway, as
+// it may point to memory owned by the service (see ReplyToMethodInvocation()).
+class HostImpl : public Host {
  public:
-  HostImpl(const char* socket_name, base::TaskRunner*);
-  HostImpl(base::ScopedSocketHandle, base::TaskRunner*);
+  HostImpl(const char* socket_name,
+           base::TaskRunner*,
+           base::TaskRunner* io_task_runner = nullptr);
+  HostImpl(base::ScopedSocketHandle,
+           base::TaskRunner*,
+           base::TaskRunner* io_task_runner = nullptr);
   HostImpl(base::TaskRunner* task_runner);
   ~HostImpl() override;
 
@@ -49,38 +69,31 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
       base::ScopedSocketHandle,
       std::function<bool(int)> send_fd_cb) override;
   void SetSocketSendTimeoutMs(uint32_t timeout_ms) override;
+  void SetShmemFrameThreshold(size_t threshold_bytes) override;
+  void SetFrameDecompressor(FrameDecompressorFn decompressor) override;
 
-  // base::UnixSocket::EventListener implementation.
-  void OnNewIncomingConnection(base::UnixSocket*,
-                               std::unique_ptr<base::UnixSocket>) override;
-  void OnDisconnect(base::UnixSocket*) override;
-  void OnDataAvailable(base::UnixSocket*) override;
+  bool is_listening() const { return is_listening_; }
 
-  const base::UnixSocket* sock() const { return sock_.get(); }
+  // The listening socket. Can be used only on the I/O thread.
+  const base::UnixSocket* sock() const;
 
  private:
-  // Owns the per-client receive buffer (BufferedFrameDeserializer).
-  struct ClientConnection {
-    ~ClientConnection();
-    ClientID id;
-    std::unique_ptr<base::UnixSocket> sock;
-    BufferedFrameDeserializer frame_deserializer;
+  class Frontend;
+
+  // A request decoded by the frontend, to be dispatched on the service thread.
+  struct MethodInvocation {
+    MethodInvocation();
+    ~MethodInvocation();
+
+    ClientInfo client_info;
+    RequestID request_id = 0;
+    ServiceID service_id = 0;
+    const ServiceDescriptor::Method* method = nullptr;
+    std::unique_ptr<ProtoMessage> args;
+    bool drop_reply = false;
     base::ScopedFile received_fd;
-    std::function<bool(int)> send_fd_cb_fuchsia;
-    // Peer identity set using IPCFrame sent by the client. These 3 fields
-    // should be used only for non-AF_UNIX connections AF_UNIX connections
-    // should only rely on the peer identity obtained from the socket.
-    uid_t uid_override = base::kInvalidUid;
-    pid_t pid_override = base::kInvalidPid;
-
-    // |machine_id| is mapped from machine_id_hint (or socket hostname if
-    // |the client doesn't support machine_id_hint).
-    base::MachineID machine_id = base::kDefaultMachineID;
-
-    pid_t GetLinuxPeerPid() const;
-    uid_t GetPosixPeerUid() const;
-    base::MachineID GetMachineID() const { return machine_id; }
   };
+
   struct ExposedService {
     ExposedService(ServiceID, const std::string&, std::unique_ptr<Service>);
     ~ExposedService();
@@ -95,25 +108,29 @@ class HostImpl : public Host, public base::UnixSocket::EventListener {
   HostImpl(const HostImpl&) = delete;
   HostImpl& operator=(const HostImpl&) = delete;
 
-  bool Initialize(const char* socket_name);
-  void OnReceivedFrame(ClientConnection*, const Frame&);
-  void OnBindService(ClientConnection*, const Frame&);
-  void OnInvokeMethod(ClientConnection*, const Frame&);
-  void OnSetPeerIdentity(ClientConnection*, const Frame&);
+  void CreateFrontend(std::function<void(Frontend*)> init);
+  void RunOnIoThreadAndWait(std::function<void()>);
+  bool has_io_thread() const { return io_task_runner_ != task_runner_; }
+
+  // Called by the frontend, on the service thread.
+  void OnInvokeMethod(MethodInvocation*);
+  void OnClientDisconnected(const ClientInfo&);
 
   void ReplyToMethodInvocation(ClientID, RequestID, AsyncResult<ProtoMessage>);
   const ExposedService* GetServiceByName(const std::string&);
 
-  static void SendFrame(ClientConnection*, const Frame&, int fd = -1);
-
   base::TaskRunner* const task_runner_;
+  base::TaskRunner* const io_task_runner_;
+  std::unique_ptr<Frontend> frontend_;  // Used on the I/O thread only.
+  bool is_listening_ = false;
+  bool use_shmem_emulation_ = false;
   std::map<ServiceID, ExposedService> services_;
-  std::unique_ptr<base::UnixSocket> sock_;  // The listening socket.
-  std::map<ClientID, std::unique_ptr<ClientConnection>> clients_;
-  std::map<base::UnixSocket*, ClientConnection*> clients_by_socket_;
   ServiceID last_service_id_ = 0;
-  ClientID last_client_id_ = 0;
-  uint32_t socket_tx_timeout_ms_ = kDefaultIpcTxTimeoutMs;
+
+  // The file descriptors received from each client and not taken yet by the
+  // services, see Service::TakeReceivedFD().
+  std::map<ClientID, base::ScopedFile> received_fds_;
+
   PERFETTO_THREAD_CHECKER(thread_checker_)
   base::WeakPtrFactory<HostImpl> weak_ptr_factory_;  // Keep last.
 };
@@ -18,10 +18,12 @@
 
 #include <memory>
 
+#include "perfetto/base/thread_utils.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/sys_types.h"
 #include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/ipc/service.h"
@@ -118,12 +120,15 @@ class FakeClient : public base::UnixSocket::EventListener {
 
   ~FakeClient() override = default;
 
-  void BindService(const std::string& service_name) {
+  void BindService(const std::string& service_name,
+                   bool accepts_shmem_frames = false) {
     Frame frame;
     uint64_t request_id = requests_.empty() ? 1 : requests_.rbegin()->first + 1;
     requests_.emplace(request_id, 0);
     frame.set_request_id(request_id);
     frame.mutable_msg_bind_service()->set_service_name(service_name);
+    frame.mutable_msg_bind_service()->set_accepts_shmem_frames(
+        accepts_shmem_frames);
     SendFrame(frame);
   }
 
@@ -171,7 +176,7 @@ class FakeClient : public base::UnixSocket::EventListener {
     auto buf = frame_deserializer_.BeginReceive();
     base::ScopedFile fd;
     size_t rsize = sock->Receive(buf.data, buf.size, &fd);
-    ASSERT_TRUE(frame_deserializer_.EndReceive(rsize));
+    ASSERT_TRUE(frame_deserializer_.EndReceive(rsize, &fd));
     if (fd)
       OnFileDescriptorReceived(*fd);
     while (std::unique_ptr<Frame> frame = frame_deserializer_.PopNextFrame()) {
@@ -180,13 +185,14 @@ class FakeClient : public base::UnixSocket::EventListener {
       if (frame->has_msg_bind_service_reply()) {
         if (frame->msg_bind_service_reply().success())
           last_bound_service_id_ = frame->msg_bind_service_reply().service_id();
-        return OnServiceBound(frame->msg_bind_service_reply());
+        OnServiceBound(frame->msg_bind_service_reply());
+      } else if (frame->has_msg_invoke_method_reply()) {
+        OnInvokeMethodReply(frame->msg_invoke_method_reply());
+      } else if (frame->has_msg_request_error()) {
+        OnRequestError();
+      } else {
+        FAIL() << "Unexpected frame received from host";
       }
-      if (frame->has_msg_invoke_method_reply())
-        return OnInvokeMethodReply(frame->msg_invoke_method_reply());
-      if (frame->has_msg_request_error())
-        return OnRequestError();
-      FAIL() << "Unexpected frame received from host";
     }
   }
 
@@ -415,6 +421,95 @@ TEST_F(HostImplTest, SendFileDescriptor) {
   task_runner_->RunUntilCheckpoint("on_fd_received");
 }
 
+// The replies sent during the same task are queued and written together,
+// except the ones carrying a file: check that they all keep their order.
+TEST_F(HostImplTest, RepliesKeepTheirOrder) {
+  FakeService* fake_service = new FakeService("FakeService");
+  ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
+  auto on_bind = task_runner_->CreateCheckpoint("on_bind");
+  cli_->BindService("FakeService");
+  EXPECT_CALL(*cli_, OnServiceBound(_)).WillOnce(InvokeWithoutArgs(on_bind));
+  task_runner_->RunUntilCheckpoint("on_bind");
+
+  static constexpr int kNumRequests = 5;
+  base::TempFile tx_file = base::TempFile::CreateUnlinked();
+  for (int i = 0; i < kNumRequests; i++) {
+    RequestProto req_args;
+    req_args.set_data(std::to_string(i));
+    cli_->InvokeMethod(cli_->last_bound_service_id_, 1, req_args);
+  }
+  EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+      .Times(kNumRequests)
+      .WillRepeatedly(
+          Invoke([&tx_file](const RequestProto& req, DeferredBase* reply) {
+            std::unique_ptr<ReplyProto> reply_args(new ReplyProto());
+            reply_args->set_data(req.data());
+            auto async_res = AsyncResult<ProtoMessage>(
+                std::unique_ptr<ProtoMessage>(reply_args.release()));
+            if (req.data() == "2")
+              async_res.set_fd(tx_file.fd());
+            reply->Resolve(std::move(async_res));
+          }));
+
+  auto on_replies_received =
+      task_runner_->CreateCheckpoint("on_replies_received");
+  int num_replies = 0;
+  EXPECT_CALL(*cli_, OnFileDescriptorReceived(_));
+  EXPECT_CALL(*cli_, OnInvokeMethodReply(_))
+      .Times(kNumRequests)
+      .WillRepeatedly(Invoke([on_replies_received, &num_replies](
+                                 const Frame::InvokeMethodReply& reply) {
+        ReplyProto reply_args;
+        reply_args.ParseFromString(reply.reply_proto());
+        ASSERT_EQ(std::to_string(num_replies), reply_args.data());
+        if (++num_replies == kNumRequests)
+          on_replies_received();
+      }));
+  task_runner_->RunUntilCheckpoint("on_replies_received");
+}
+
+TEST_F(HostImplTest, ShmemFrames) {
+  if (!BufferedFrameDeserializer::ShmemFramesSupported())
+    GTEST_SKIP() << "memfd not supported";
+  host_->SetShmemFrameThreshold(4096);
+  FakeService* fake_service = new FakeService("FakeService");
+  ASSERT_TRUE(host_->ExposeService(std::unique_ptr<Service>(fake_service)));
+  auto on_bind = task_runner_->CreateCheckpoint("on_bind");
+  cli_->BindService("FakeService", /*accepts_shmem_frames=*/true);
+  EXPECT_CALL(*cli_, OnServiceBound(_))
+      .WillOnce(Invoke([on_bind](const Frame::BindServiceReply& reply) {
+        EXPECT_TRUE(reply.accepts_shmem_frames());
+        on_bind();
+      }));
+  task_runner_->RunUntilCheckpoint("on_bind");
+
+  // Larger than the receive buffer of the client, which can only get it
+  // through shared memory.
+  const std::string kLargeData(kIPCBufferSize * 4, 'x');
+  RequestProto req_args;
+  cli_->InvokeMethod(cli_->last_bound_service_id_, 1, req_args);
+  EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+      .WillOnce(Invoke([&kLargeData](const RequestProto&, DeferredBase* reply) {
+        std::unique_ptr<ReplyProto> reply_args(new ReplyProto());
+        reply_args->set_data(kLargeData);
+        reply->Resolve(AsyncResult<ProtoMessage>(
+            std::unique_ptr<ProtoMessage>(reply_args.release())));
+      }));
+
+  auto on_reply_received = task_runner_->CreateCheckpoint("on_reply_received");
+  EXPECT_CALL(*cli_, OnFileDescriptorReceived(_)).Times(0);
+  EXPECT_CALL(*cli_, OnInvokeMethodReply(_))
+      .WillOnce(Invoke([on_reply_received,
+                        &kLargeData](const Frame::InvokeMethodReply& reply) {
+        ASSERT_TRUE(reply.success());
+        ReplyProto reply_args;
+        reply_args.ParseFromString(reply.reply_proto());
+        ASSERT_EQ(kLargeData, reply_args.data());
+        on_reply_received();
+      }));
+  task_runner_->RunUntilCheckpoint("on_reply_received");
+}
+
 TEST_F(HostImplTest, ReceiveFileDescriptor) {
   auto received = task_runner_->CreateCheckpoint("received");
   FakeService* fake_service = new FakeService("FakeService");
@@ -450,6 +545,69 @@ TEST_F(HostImplTest, ReceiveFileDescriptor) {
             PERFETTO_EINTR(read(*rx_fd, buf, sizeof(buf))));
   ASSERT_STREQ(kFileContent, buf);
 }
+
+// With an I/O thread the services still run on the host task runner, and the
+// file descriptors of the replies are sent even if the service closes them as
+// soon as it has replied.
+TEST(HostImpl, IoThread) {
+  kTestSocket.Destroy();
+  base::TestTaskRunner task_runner;
+  base::ThreadTaskRunner io_thread =
+      base::ThreadTaskRunner::CreateAndStart("io");
+  std::unique_ptr<Host> host =
+      Host::CreateInstance(kTestSocket.name(), &task_runner, &io_thread);
+  ASSERT_TRUE(host);
+  FakeService* fake_service = new FakeService("FakeService");
+  ASSERT_TRUE(host->ExposeService(std::unique_ptr<Service>(fake_service)));
+
+  std::unique_ptr<FakeClient> cli(new FakeClient(&task_runner));
+  auto on_connect = task_runner.CreateCheckpoint("on_connect");
+  EXPECT_CALL(*cli, OnConnect()).WillOnce(Invoke(on_connect));
+  task_runner.RunUntilCheckpoint("on_connect");
+
+  auto on_bind = task_runner.CreateCheckpoint("on_bind");
+  cli->BindService("FakeService");
+  EXPECT_CALL(*cli, OnServiceBound(_)).WillOnce(InvokeWithoutArgs(on_bind));
+  task_runner.RunUntilCheckpoint("on_bind");
+
+  static constexpr char kFileContent[] = "shared file";
+  RequestProto req_args;
+  req_args.set_data("foo");
+  cli->InvokeMethod(cli->last_bound_service_id_, 1, req_args);
+  const base::PlatformThreadId host_thread = base::GetThreadId();
+  EXPECT_CALL(*fake_service, OnFakeMethod1(_, _))
+      .WillOnce(Invoke([host_thread](const RequestProto& req,
+                                     DeferredBase* reply) {
+        ASSERT_EQ(base::GetThreadId(), host_thread);
+        ASSERT_EQ("foo", req.data());
+        base::TempFile tx_file = base::TempFile::CreateUnlinked();
+        ASSERT_EQ(static_cast<size_t>(base::WriteAll(
+                      tx_file.fd(), kFileContent, sizeof(kFileContent))),
+                  sizeof(kFileContent));
+        auto async_res = AsyncResult<ProtoMessage>(
+            std::unique_ptr<ProtoMessage>(new ReplyProto()));
+        async_res.set_fd(tx_file.fd());
+        reply->Resolve(std::move(async_res));
+      }));
+
+  auto on_fd_received = task_runner.CreateCheckpoint("on_fd_received");
+  EXPECT_CALL(*cli, OnFileDescriptorReceived(_))
+      .WillOnce(Invoke([on_fd_received](int fd) {
+        char buf[sizeof(kFileContent)] = {};
+        ASSERT_EQ(0, lseek(fd, 0, SEEK_SET));
+        ASSERT_EQ(static_cast<int32_t>(sizeof(buf)),
+                  PERFETTO_EINTR(read(fd, buf, sizeof(buf))));
+        ASSERT_STREQ(kFileContent, buf);
+        on_fd_received();
+      }));
+  EXPECT_CALL(*cli, OnInvokeMethodReply(_));
+  task_runner.RunUntilCheckpoint("on_fd_received");
+
+  cli.reset();
+  host.reset();
+  task_runner.RunUntilIdle();
+  kTestSocket.Destroy();
+}
 #endif  // !OS_WIN
 
 // Invoke a method and immediately after disconnect the client.
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/ipc/zlib_frame_compressor.h"
+
+#include "perfetto/base/build_config.h"
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#error "Zlib must be enabled to compile this file."
+#endif
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "src/ipc/buffered_frame_deserializer.h"
+
+#include "protos/perfetto/ipc/wire_protocol.gen.h"
+
+namespace perfetto {
+namespace ipc {
+
+namespace {
+
+// The relayed frames are compressed on the fly, on the relay's I/O thread:
+// favor speed over ratio.
+constexpr int kCompressionLevel = Z_BEST_SPEED;
+
+// The decompressed frames grow by this much at a time.
+constexpr size_t kOutputChunkSize = 16 * 1024;
+
+}  // namespace
+
+bool ZlibCompressFrames(const char* frames, size_t size, std::string* out) {
+  z_stream z{};
+  if (deflateInit(&z, kCompressionLevel) != Z_OK)
+    return false;
+  std::string compressed;
+  compressed.resize(deflateBound(&z, static_cast<uLong>(size)));
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(frames));
+  z.avail_in = static_cast<uInt>(size);
+  z.next_out = reinterpret_cast<Bytef*>(&compressed[0]);
+  z.avail_out = static_cast<uInt>(compressed.size());
+  int ret = deflate(&z, Z_FINISH);
+  deflateEnd(&z);
+  if (ret != Z_STREAM_END) {
+    PERFETTO_DLOG("deflate() failed: %d", ret);
+    return false;
+  }
+  compressed.resize(compressed.size() - z.avail_out);
+
+  Frame frame;
+  frame.set_compressed_frames(std::move(compressed));
+  out->append(BufferedFrameDeserializer::Serialize(frame));
+  return true;
+}
+
+bool ZlibDecompressFrames(const std::string& compressed,
+                          size_t max_size,
+                          std::string* frames) {
+  z_stream z{};
+  if (inflateInit(&z) != Z_OK)
+    return false;
+  z.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+  z.avail_in = static_cast<uInt>(compressed.size());
+  const size_t initial_size = frames->size();
+  size_t frames_size = initial_size;
+  int ret = Z_OK;
+  while (ret == Z_OK) {
+    size_t decompressed_size = frames_size - initial_size;
+    if (decompressed_size >= max_size)
+      break;  // Too large, or a decompression bomb.
+    size_t chunk_size =
+        std::min(kOutputChunkSize, max_size - decompressed_size);
+    frames->resize(frames_size + chunk_size);
+    z.next_out = reinterpret_cast<Bytef*>(&(*frames)[frames_size]);
+    z.avail_out = static_cast<uInt>(chunk_size);
+    ret = inflate(&z, Z_NO_FLUSH);
+    frames_size += chunk_size - z.avail_out;
+  }
+  inflateEnd(&z);
+  frames->resize(frames_size);
+  // The whole payload must be a single, complete, zlib stream.
+  if (ret != Z_STREAM_END || z.avail_in > 0) {
+    PERFETTO_DLOG("inflate() failed: %d", ret);
+    frames->resize(initial_size);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace ipc
+}  // namespace perfetto
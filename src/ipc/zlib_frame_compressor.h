@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_IPC_ZLIB_FRAME_COMPRESSOR_H_
+#define SRC_IPC_ZLIB_FRAME_COMPRESSOR_H_
+
+#include <stddef.h>
+
+#include <string>
+
+namespace perfetto {
+namespace ipc {
+
+// Compressed frames (see IPCFrame.compressed_frames) carry a batch of whole
+// frames, serialized with their size header and compressed with zlib. They are
+// sent by traced_relay, over the (possibly slow) link between a guest machine
+// and the host, to the hosts which accept them. Each compressed frame is a
+// complete zlib stream, so it can be decompressed on its own.
+
+// Compresses |size| bytes of serialized frames into a compressed frame, which
+// is appended, serialized, to |out|. Returns false on errors.
+bool ZlibCompressFrames(const char* frames, size_t size, std::string* out);
+
+// Decompresses the payload of a compressed frame, appending the serialized
+// frames to |frames|. Returns false if the data is invalid or decompresses to
+// more than |max_size| bytes. Matches ipc::FrameDecompressorFn.
+bool ZlibDecompressFrames(const std::string& compressed,
+                          size_t max_size,
+                          std::string* frames);
+
+}  // namespace ipc
+}  // namespace perfetto
+
+#endif  // SRC_IPC_ZLIB_FRAME_COMPRESSOR_H_
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/ipc/zlib_frame_compressor.h"
+
+#include <string>
+
+#include "perfetto/ext/ipc/basic_types.h"
+#include "src/ipc/buffered_frame_deserializer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/ipc/wire_protocol.gen.h"
+
+namespace perfetto {
+namespace ipc {
+namespace {
+
+std::string SerializeFrame(uint64_t request_id, const std::string& data) {
+  Frame frame;
+  frame.set_request_id(request_id);
+  frame.add_data_for_testing(data);
+  return BufferedFrameDeserializer::Serialize(frame);
+}
+
+TEST(ZlibFrameCompressorTest, RoundTrip) {
+  std::string frames;
+  for (uint64_t i = 1; i <= 10; i++)
+    frames += SerializeFrame(i, std::string(1000, static_cast<char>('a' + i)));
+
+  std::string buf;
+  ASSERT_TRUE(ZlibCompressFrames(frames.data(), frames.size(), &buf));
+  ASSERT_LT(buf.size(), frames.size() / 10);
+
+  BufferedFrameDeserializer bfd;
+  bfd.set_frame_decompressor(&ZlibDecompressFrames);
+  auto rbuf = bfd.BeginReceive();
+  ASSERT_GE(rbuf.size, buf.size());
+  memcpy(rbuf.data, buf.data(), buf.size());
+  ASSERT_TRUE(bfd.EndReceive(buf.size()));
+  for (uint64_t i = 1; i <= 10; i++) {
+    auto frame = bfd.PopNextFrame();
+    ASSERT_TRUE(frame);
+    EXPECT_EQ(frame->request_id(), i);
+    ASSERT_EQ(frame->data_for_testing().size(), 1u);
+    EXPECT_EQ(frame->data_for_testing()[0],
+              std::string(1000, static_cast<char>('a' + i)));
+  }
+  EXPECT_FALSE(bfd.PopNextFrame());
+}
+
+TEST(ZlibFrameCompressorTest, RejectsLargeOrInvalidData) {
+  std::string frames = SerializeFrame(1, std::string(kIPCBufferSize, 'x'));
+  std::string buf;
+  ASSERT_TRUE(ZlibCompressFrames(frames.data(), frames.size(), &buf));
+  Frame compressed_frame;
+  ASSERT_TRUE(compressed_frame.ParseFromArray(buf.data() + sizeof(uint32_t),
+                                              buf.size() - sizeof(uint32_t)));
+  const std::string& compressed = compressed_frame.compressed_frames();
+
+  std::string decompressed;
+  EXPECT_TRUE(ZlibDecompressFrames(compressed, frames.size(), &decompressed));
+  EXPECT_EQ(decompressed, frames);
+
+  // Decompresses to more than |max_size|.
+  decompressed.clear();
+  EXPECT_FALSE(
+      ZlibDecompressFrames(compressed, frames.size() - 1, &decompressed));
+
+  // Truncated or corrupted.
+  decompressed.clear();
+  EXPECT_FALSE(ZlibDecompressFrames(compressed.substr(0, compressed.size() / 2),
+                                    frames.size(), &decompressed));
+  EXPECT_FALSE(ZlibDecompressFrames("not zlib", frames.size(), &decompressed));
+  EXPECT_TRUE(decompressed.empty());
+}
+
+}  // namespace
+}  // namespace ipc
+}  // namespace perfetto
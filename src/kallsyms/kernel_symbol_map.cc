@@ -27,10 +27,12 @@
 #include "perfetto/protozero/proto_utils.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include <algorithm>
 #include <cinttypes>
 #include <functional>
+#include <limits>
 #include <map>
 #include <unordered_map>
 #include <utility>
@@ -211,7 +213,7 @@ TokenId KernelSymbolMap::TokenTable::Add(const std::string& token) {
 base::StringView KernelSymbolMap::TokenTable::Lookup(TokenId id) {
   if (id == 0)
     return base::StringView();
-  if (id > num_tokens_)
+  if (id >= num_tokens_)
     return base::StringView("<error>");
   // We don't know precisely where the id-th token starts in the buffer. We
   // store only one position every kTokenIndexSampling. From there, the token
@@ -403,23 +405,77 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
   if (index_.empty() || sym_addr < base_addr_)
     return "";
 
-  // First find the highest symbol address <= sym_addr.
-  // Start with a binary search using the sparse index.
-
   const uint32_t sym_rel_addr = static_cast<uint32_t>(sym_addr - base_addr_);
-  auto it = std::upper_bound(index_.cbegin(), index_.cend(),
+  size_t index_pos = 0;
+  SymbolRange sym = FindSymbol(sym_rel_addr, &index_pos);
+  if (!sym.tokens)
+    return "";
+
+  // If this address is too far from the start of the symbol, this is likely
+  // a pointer to something else (e.g. some vmalloc struct) and we just picked
+  // the very last symbol for a loader region.
+  if (sym_rel_addr - sym.start > kSymMaxSizeBytes)
+    return "";
+
+  return SymbolName(sym.tokens);
+}
+
+std::vector<std::string> KernelSymbolMap::LookupSorted(
+    const std::vector<uint64_t>& addrs) {
+  std::vector<std::string> names(addrs.size());
+  if (index_.empty())
+    return names;
+
+  size_t index_pos = 0;
+  uint32_t prev_rel_addr = 0;
+  SymbolRange sym;
+  std::string sym_name;
+  for (size_t i = 0; i < addrs.size(); i++) {
+    PERFETTO_DCHECK(i == 0 || addrs[i - 1] <= addrs[i]);
+    if (addrs[i] < base_addr_)
+      continue;
+    const uint32_t sym_rel_addr = static_cast<uint32_t>(addrs[i] - base_addr_);
+    // Like in Lookup(), addresses more than 4 GB past the first symbol wrap
+    // around: restart the search of the index from the beginning.
+    if (sym_rel_addr < prev_rel_addr) {
+      index_pos = 0;
+      sym = SymbolRange();
+    }
+    prev_rel_addr = sym_rel_addr;
+
+    if (!sym.tokens || sym_rel_addr < sym.start || sym_rel_addr >= sym.end) {
+      sym = FindSymbol(sym_rel_addr, &index_pos);
+      if (!sym.tokens)
+        continue;
+      sym_name = SymbolName(sym.tokens);
+    }
+    if (sym_rel_addr - sym.start <= kSymMaxSizeBytes)
+      names[i] = sym_name;
+  }
+  return names;
+}
+
+KernelSymbolMap::SymbolRange KernelSymbolMap::FindSymbol(
+    uint32_t sym_rel_addr,
+    size_t* index_pos) const {
+  // First find the highest symbol address <= sym_rel_addr.
+  // Start with a binary search using the sparse index.
+  PERFETTO_DCHECK(*index_pos < index_.size());
+  auto begin = index_.cbegin() + static_cast<ptrdiff_t>(*index_pos);
+  auto it = std::upper_bound(begin, index_.cend(),
                              std::make_pair(sym_rel_addr, 0u));
   if (it != index_.cbegin())
     --it;
+  *index_pos = static_cast<size_t>(it - index_.cbegin());
 
   // Then continue with a linear scan (of at most kSymIndexSampling steps).
+  SymbolRange sym;
+  sym.end = std::numeric_limits<uint32_t>::max();
   uint32_t addr = it->first;
   uint32_t off = it->second;
   const uint8_t* rdptr = &buf_[off];
   const uint8_t* const buf_end = buf_.data() + buf_.size();
   bool parsing_addr = true;
-  const uint8_t* next_rdptr = nullptr;
-  uint64_t sym_start_addr = 0;
   for (bool is_first_addr = true;; is_first_addr = false) {
     uint64_t v = 0;
     const auto* prev_rdptr = rdptr;
@@ -429,30 +485,23 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
     if (parsing_addr) {
       addr += is_first_addr ? 0 : static_cast<uint32_t>(v);
       parsing_addr = false;
-      if (addr > sym_rel_addr)
+      if (addr > sym_rel_addr) {
+        sym.end = addr;
         break;
-      next_rdptr = rdptr;
-      sym_start_addr = addr;
+      }
+      sym.tokens = rdptr;
+      sym.start = addr;
     } else {
       // This is a token. Wait for the EOF maker.
       parsing_addr = (v & 1) == 1;
     }
   }
+  PERFETTO_DCHECK(!sym.tokens || sym_rel_addr >= sym.start);
+  return sym;
+}
 
-  if (!next_rdptr)
-    return "";
-
-  PERFETTO_DCHECK(sym_rel_addr >= sym_start_addr);
-
-  // If this address is too far from the start of the symbol, this is likely
-  // a pointer to something else (e.g. some vmalloc struct) and we just picked
-  // the very last symbol for a loader region.
-  if (sym_rel_addr - sym_start_addr > kSymMaxSizeBytes)
-    return "";
-
-  // The address has been found. Now rejoin the tokens to form the symbol name.
-
-  rdptr = next_rdptr;
+std::string KernelSymbolMap::SymbolName(const uint8_t* rdptr) {
+  const uint8_t* const buf_end = buf_.data() + buf_.size();
   std::string sym_name;
   sym_name.reserve(kSymNameMaxLen);
   for (bool eof = false, is_first_token = true; !eof; is_first_token = false) {
@@ -471,4 +520,138 @@ std::string KernelSymbolMap::Lookup(uint64_t sym_addr) {
   return sym_name;
 }
 
+namespace {
+
+// Header of the blob written by Serialize(). It is followed by the key, the
+// token buffer, the token index, the symbol buffer and the symbol index.
+// The blob uses the native byte order: it is a cache for the same machine.
+struct SerializedHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t key_size;
+  uint64_t base_addr;
+  uint64_t num_syms;
+  uint32_t num_tokens;
+  uint32_t sym_index_sampling;
+  uint32_t token_index_sampling;
+  uint32_t reserved;
+  uint64_t token_buf_size;
+  uint64_t token_index_size;
+  uint64_t sym_buf_size;
+  uint64_t sym_index_size;
+};
+
+constexpr char kSerializedMagic[8] = "PFKSYMS";
+constexpr uint32_t kSerializedVersion = 1;
+
+template <typename T>
+void AppendVector(const std::vector<T>& v, std::string* out) {
+  out->append(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+// Reads |count| elements into |v|, advancing |*ptr|. Returns false if there
+// are fewer than |count| elements before |end|.
+template <typename T>
+bool ReadVector(const uint8_t** ptr,
+                const uint8_t* end,
+                uint64_t count,
+                std::vector<T>* v) {
+  const size_t avail = static_cast<size_t>(end - *ptr) / sizeof(T);
+  if (count > avail)
+    return false;
+  v->resize(static_cast<size_t>(count));
+  memcpy(static_cast<void*>(v->data()), *ptr, v->size() * sizeof(T));
+  *ptr += v->size() * sizeof(T);
+  return true;
+}
+
+}  // namespace
+
+std::string KernelSymbolMap::Serialize(const std::string& key) const {
+  SerializedHeader hdr{};
+  memcpy(hdr.magic, kSerializedMagic, sizeof(hdr.magic));
+  hdr.version = kSerializedVersion;
+  hdr.key_size = static_cast<uint32_t>(key.size());
+  hdr.base_addr = base_addr_;
+  hdr.num_syms = num_syms_;
+  hdr.num_tokens = tokens_.num_tokens_;
+  hdr.sym_index_sampling = static_cast<uint32_t>(kSymIndexSampling);
+  hdr.token_index_sampling = static_cast<uint32_t>(kTokenIndexSampling);
+  hdr.token_buf_size = tokens_.buf_.size();
+  hdr.token_index_size = tokens_.index_.size();
+  hdr.sym_buf_size = buf_.size();
+  hdr.sym_index_size = index_.size();
+
+  std::string out;
+  out.reserve(sizeof(hdr) + key.size() + size_bytes());
+  out.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+  out.append(key);
+  AppendVector(tokens_.buf_, &out);
+  AppendVector(tokens_.index_, &out);
+  AppendVector(buf_, &out);
+  AppendVector(index_, &out);
+  return out;
+}
+
+bool KernelSymbolMap::Deserialize(const void* data,
+                                  size_t size,
+                                  const std::string& key) {
+  *this = KernelSymbolMap();
+
+  const uint8_t* ptr = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = ptr + size;
+  SerializedHeader hdr;
+  if (size < sizeof(hdr))
+    return false;
+  memcpy(&hdr, ptr, sizeof(hdr));
+  ptr += sizeof(hdr);
+  // The sampling rates are part of the layout of the indexes.
+  if (memcmp(hdr.magic, kSerializedMagic, sizeof(hdr.magic)) != 0 ||
+      hdr.version != kSerializedVersion ||
+      hdr.sym_index_sampling != kSymIndexSampling ||
+      hdr.token_index_sampling != kTokenIndexSampling ||
+      hdr.key_size != key.size() ||
+      static_cast<size_t>(end - ptr) < key.size() ||
+      memcmp(ptr, key.data(), key.size()) != 0) {
+    return false;
+  }
+  ptr += key.size();
+
+  TokenTable tokens;
+  tokens.num_tokens_ = hdr.num_tokens;
+  std::vector<uint8_t> buf;
+  std::vector<std::pair<uint32_t, uint32_t>> index;
+  if (!ReadVector(&ptr, end, hdr.token_buf_size, &tokens.buf_) ||
+      !ReadVector(&ptr, end, hdr.token_index_size, &tokens.index_) ||
+      !ReadVector(&ptr, end, hdr.sym_buf_size, &buf) ||
+      !ReadVector(&ptr, end, hdr.sym_index_size, &index) || ptr != end) {
+    return false;
+  }
+
+  // Check the invariants Lookup() relies on, so that a corrupted cache can't
+  // make it read out of bounds.
+  const size_t sampling = kTokenIndexSampling;
+  if (hdr.num_tokens == 0 ||
+      tokens.index_.size() != (hdr.num_tokens + sampling - 1) / sampling) {
+    return false;
+  }
+  for (uint32_t off : tokens.index_) {
+    if (off >= tokens.buf_.size())
+      return false;
+  }
+  for (const auto& rel_addr_and_off : index) {
+    if (rel_addr_and_off.second >= buf.size())
+      return false;
+  }
+  if (index.empty() != (hdr.num_syms == 0))
+    return false;
+
+  tokens_ = std::move(tokens);
+  base_addr_ = hdr.base_addr;
+  num_syms_ = static_cast<size_t>(hdr.num_syms);
+  buf_ = std::move(buf);
+  index_ = std::move(index);
+  return true;
+}
+
 }  // namespace perfetto
@@ -131,6 +131,23 @@ class KernelSymbolMap {
   // if the passed |addr| is < min(addr)).
   std::string Lookup(uint64_t addr);
 
+  // Same as Lookup() for each address of |addrs|, which must be sorted.
+  // Nearby addresses are resolved without searching the index again, and the
+  // name of a symbol is rebuilt once for all the addresses that fall into it.
+  // Returns one name (possibly empty) per address, in the same order.
+  std::vector<std::string> LookupSorted(const std::vector<uint64_t>& addrs);
+
+  // Serializes the map into a flat blob that can be stored in a file and
+  // loaded back with Deserialize(), which is much cheaper than parsing
+  // kallsyms again. |key| identifies the kernel the symbols belong to and is
+  // checked by Deserialize().
+  std::string Serialize(const std::string& key) const;
+
+  // Replaces the contents of the map with a blob produced by Serialize() with
+  // the same |key|. Returns false, leaving the map empty, if the blob is
+  // malformed, comes from another version or has a different key.
+  bool Deserialize(const void* data, size_t size, const std::string& key);
+
   // Returns the numberr of valid symbols decoded.
   size_t num_syms() const { return num_syms_; }
 
@@ -157,6 +174,8 @@ class KernelSymbolMap {
     }
 
    private:
+    friend class KernelSymbolMap;  // For Serialize() and Deserialize().
+
     TokenId num_tokens_ = 0;
 
     std::vector<char> buf_;  // Token buffer.
@@ -167,6 +186,22 @@ class KernelSymbolMap {
   };
 
  private:
+  // The symbol that contains an address.
+  struct SymbolRange {
+    uint32_t start = 0;  // Relative address of the symbol.
+    uint32_t end = 0;    // Relative address of the next symbol, if any.
+    const uint8_t* tokens = nullptr;  // Token ids in |buf_|.
+  };
+
+  // Finds the symbol with the highest relative address <= |sym_rel_addr|,
+  // searching |index_| from |*index_pos|, which is updated to the position
+  // of the index entry where the symbol was found. Returns a range with null
+  // |tokens| if there is no such symbol.
+  SymbolRange FindSymbol(uint32_t sym_rel_addr, size_t* index_pos) const;
+
+  // Joins the tokens of a symbol, as returned by FindSymbol().
+  std::string SymbolName(const uint8_t* tokens);
+
   TokenTable tokens_;  // Token table.
 
   uint64_t base_addr_ = 0;    // Address of the first symbol (after sorting).
@@ -19,6 +19,7 @@
 #include <cinttypes>
 #include <random>
 #include <unordered_map>
+#include <vector>
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/string_utils.h"
@@ -164,5 +165,62 @@ TEST(KernelSymbolMapTest, GoldenTest) {
   }
 }
 
+TEST(KernelSymbolMapTest, LookupSortedAndSerialize) {
+  std::string fake_kallsyms;
+  std::minstd_rand rng(0);
+  std::vector<uint64_t> addrs;
+  for (uint64_t addr = 0xffffff8f70000000ULL; addrs.size() < 1000;
+       addr += 16 + (rng() % 512)) {
+    addrs.push_back(addr);
+    fake_kallsyms += base::StackString<64>("%" PRIx64 " t sym_%zu\n", addr,
+                                           addrs.size())
+                         .ToStdString();
+  }
+  base::TempFile tmp = base::TempFile::Create();
+  base::WriteAll(tmp.fd(), fake_kallsyms.data(), fake_kallsyms.size());
+  base::FlushFile(tmp.fd());
+
+  KernelSymbolMap kallsyms;
+  kallsyms.Parse(tmp.path().c_str());
+  ASSERT_EQ(kallsyms.num_syms(), addrs.size());
+
+  // Look up the start, the middle and past the end of each symbol, and
+  // addresses before the first one and too far from the last one.
+  std::vector<uint64_t> lookups = {0x42, addrs[0] - 1};
+  for (uint64_t addr : addrs) {
+    lookups.push_back(addr);
+    lookups.push_back(addr + 7);
+    lookups.push_back(addr + 7);
+  }
+  lookups.push_back(addrs.back() + 2 * 1024 * 1024);
+  auto check_lookups = [&lookups](KernelSymbolMap* map) {
+    std::vector<std::string> names = map->LookupSorted(lookups);
+    ASSERT_EQ(names.size(), lookups.size());
+    for (size_t i = 0; i < lookups.size(); i++)
+      ASSERT_EQ(names[i], map->Lookup(lookups[i])) << i;
+  };
+  check_lookups(&kallsyms);
+  EXPECT_EQ(kallsyms.LookupSorted(lookups)[2], "sym_1");
+  EXPECT_EQ(kallsyms.LookupSorted(lookups)[3], "sym_1");
+
+  std::string blob = kallsyms.Serialize("boot_id");
+  KernelSymbolMap deserialized;
+  ASSERT_TRUE(deserialized.Deserialize(blob.data(), blob.size(), "boot_id"));
+  EXPECT_EQ(deserialized.num_syms(), kallsyms.num_syms());
+  EXPECT_EQ(deserialized.size_bytes(), kallsyms.size_bytes());
+  check_lookups(&deserialized);
+
+  // A different key, a truncated blob or a corrupted index are rejected.
+  KernelSymbolMap rejected;
+  EXPECT_FALSE(rejected.Deserialize(blob.data(), blob.size(), "other"));
+  EXPECT_FALSE(rejected.Deserialize(blob.data(), blob.size() - 1, "boot_id"));
+  std::string corrupted = blob;
+  memset(&corrupted[corrupted.size() - 4], 0xff, 4);
+  EXPECT_FALSE(
+      rejected.Deserialize(corrupted.data(), corrupted.size(), "boot_id"));
+  EXPECT_EQ(rejected.num_syms(), 0u);
+  EXPECT_EQ(rejected.Lookup(addrs[0]), "");
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -16,14 +16,18 @@
 
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
 
-#include <string>
-
+#include <stdio.h>
 #include <unistd.h>
 
+#include <string>
+
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/scoped_mmap.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 
@@ -38,6 +42,8 @@ namespace {
 const char kKallsymsPath[] = "/proc/kallsyms";
 const char kPtrRestrictPath[] = "/proc/sys/kernel/kptr_restrict";
 const char kLowerPtrRestrictAndroidProp[] = "security.lower_kptr_restrict";
+const char kBootIdPath[] = "/proc/sys/kernel/random/boot_id";
+const char kModulesPath[] = "/proc/modules";
 
 // This class takes care of temporarily lowering kptr_restrict and putting it
 // back to the original value if necessary. It solves the following problem:
@@ -146,23 +152,89 @@ void ScopedKptrUnrestrict::WriteKptrRestrict(const std::string& value) {
 
 }  // namespace
 
+const char* LazyKernelSymbolizer::g_cache_file = nullptr;
+
 LazyKernelSymbolizer::LazyKernelSymbolizer() = default;
 LazyKernelSymbolizer::~LazyKernelSymbolizer() = default;
 
 KernelSymbolMap* LazyKernelSymbolizer::GetOrCreateKernelSymbolMap() {
-  PERFETTO_DCHECK_THREAD(thread_checker_);
+  // Once created, the map can also be looked up by the ftrace reader threads,
+  // while the owner thread waits for them.
   if (symbol_map_)
     return symbol_map_.get();
+  PERFETTO_DCHECK_THREAD(thread_checker_);
 
   symbol_map_.reset(new KernelSymbolMap());
 
-  // If kptr_restrict is set, try temporarily lifting it (it works only if
-  // traced_probes is run as a privileged user).
-  ScopedKptrUnrestrict kptr_unrestrict;
-  symbol_map_->Parse(kKallsymsPath);
+  std::string key;
+  if (g_cache_file) {
+    key = GetKernelKey();
+    if (!key.empty() && LoadFromCacheFile(key))
+      return symbol_map_.get();
+  }
+
+  {
+    // If kptr_restrict is set, try temporarily lifting it (it works only if
+    // traced_probes is run as a privileged user).
+    ScopedKptrUnrestrict kptr_unrestrict;
+    symbol_map_->Parse(kKallsymsPath);
+  }
+
+  // Don't cache a map parsed while the addresses were masked.
+  if (!key.empty() && symbol_map_->num_syms() > 0)
+    SaveToCacheFile(key);
   return symbol_map_.get();
 }
 
+// static
+std::string LazyKernelSymbolizer::GetKernelKey() {
+  std::string boot_id;
+  if (!base::ReadFile(kBootIdPath, &boot_id))
+    return "";
+  // Module symbols are part of kallsyms: (un)loading a module changes the
+  // table without changing the boot id. Kernels without module support
+  // don't have /proc/modules.
+  std::string modules;
+  base::ReadFile(kModulesPath, &modules);
+  base::Hasher hasher;
+  hasher.Update(modules);
+  return base::TrimWhitespace(boot_id) + "/" +
+         std::to_string(hasher.digest());
+}
+
+bool LazyKernelSymbolizer::LoadFromCacheFile(const std::string& key) {
+  base::ScopedMmap mapped = base::ReadMmapWholeFile(g_cache_file);
+  if (!mapped.IsValid())
+    return false;
+  if (!symbol_map_->Deserialize(mapped.data(), mapped.length(), key)) {
+    PERFETTO_DLOG("Ignoring stale kallsyms cache %s", g_cache_file);
+    return false;
+  }
+  PERFETTO_DLOG("Loaded %zu kallsyms entries from %s", symbol_map_->num_syms(),
+                g_cache_file);
+  return true;
+}
+
+void LazyKernelSymbolizer::SaveToCacheFile(const std::string& key) {
+  // Write a temporary file and rename it, so that a concurrent or interrupted
+  // write never leaves a truncated cache behind.
+  const std::string tmp_path = std::string(g_cache_file) + ".tmp";
+  std::string blob = symbol_map_->Serialize(key);
+  base::ScopedFile fd =
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (!fd || base::WriteAll(*fd, blob.data(), blob.size()) !=
+                 static_cast<ssize_t>(blob.size())) {
+    PERFETTO_PLOG("Failed to write %s", tmp_path.c_str());
+    remove(tmp_path.c_str());
+    return;
+  }
+  fd.reset();
+  if (rename(tmp_path.c_str(), g_cache_file) != 0) {
+    PERFETTO_PLOG("Failed to rename %s", tmp_path.c_str());
+    remove(tmp_path.c_str());
+  }
+}
+
 void LazyKernelSymbolizer::Destroy() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   symbol_map_.reset();
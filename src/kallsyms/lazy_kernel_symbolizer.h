@@ -18,6 +18,7 @@
 #define SRC_KALLSYMS_LAZY_KERNEL_SYMBOLIZER_H_
 
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/base/thread_checker.h"
 
@@ -38,6 +39,14 @@ class KernelSymbolMap;
 // valid. LazyKernelSymbolizer may or may not contain a valid symbol map.
 class LazyKernelSymbolizer {
  public:
+  // If not null, the parsed symbol map is saved to this file, and later
+  // GetOrCreateKernelSymbolMap() calls (including after a restart of the
+  // process) load it from there rather than parsing /proc/kallsyms, for as
+  // long as the boot id and the loaded modules of the kernel don't change.
+  // The file contains kernel addresses and is created with 0600 permissions.
+  // Set by ProbesMain() in probes.cc.
+  static const char* g_cache_file;
+
   // Constructs an empty instance. Does NOT load any symbols upon construction.
   // Loading and parsing happens on the first GetOrCreateKernelSymbolMap() call.
   LazyKernelSymbolizer();
@@ -57,6 +66,13 @@ class LazyKernelSymbolizer {
       const char* ksyms_path_for_testing = nullptr);
 
  private:
+  // Returns a string that identifies the current kernel symbol table, or an
+  // empty string if it can't be determined.
+  static std::string GetKernelKey();
+
+  bool LoadFromCacheFile(const std::string& key);
+  void SaveToCacheFile(const std::string& key);
+
   std::unique_ptr<KernelSymbolMap> symbol_map_;
   PERFETTO_THREAD_CHECKER(thread_checker_)
 };
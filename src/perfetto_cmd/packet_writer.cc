@@ -17,6 +17,7 @@
 #include "src/perfetto_cmd/packet_writer.h"
 
 #include <array>
+#include <utility>
 
 #include <fcntl.h>
 #include <signal.h>
@@ -26,11 +27,20 @@
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/getopt.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "protos/perfetto/trace/trace.pbzero.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include "src/tracing/service/zlib_compressor.h"
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include "src/tracing/service/zstd_compressor.h"
+#endif
+
 namespace perfetto {
 namespace {
 
@@ -38,6 +48,15 @@ using protozero::proto_utils::MakeTagLengthDelimited;
 using protozero::proto_utils::WriteVarInt;
 using Preamble = std::array<char, 16>;
 
+// Packets are compressed in batches of roughly this size: large enough for a
+// good compression ratio, small enough to bound the memory held by the
+// packets waiting to be compressed.
+constexpr size_t kCompressBatchSize = 1024 * 1024;
+
+// If compression can't keep up with the service, WritePackets() blocks rather
+// than buffering the trace in memory.
+constexpr size_t kMaxQueuedBatches = 4;
+
 template <uint32_t id>
 size_t GetPreamble(size_t sz, Preamble* preamble) {
   uint8_t* ptr = reinterpret_cast<uint8_t*>(preamble->data());
@@ -52,10 +71,115 @@ size_t GetPreamble(size_t sz, Preamble* preamble) {
 
 }  // namespace
 
+PacketWriter::PacketWriter(FILE* fd, CompressionType compression)
+    : fd_(fd) {
+  PERFETTO_CHECK(IsCompressionSupported(compression));
+  switch (compression) {
+    case TraceConfig::COMPRESSION_TYPE_UNSPECIFIED:
+      return;
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE:
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+      compress_fn_ = &ZlibCompressFn;
+#endif
+      break;
+    case TraceConfig::COMPRESSION_TYPE_ZSTD:
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+      compress_fn_ = &ZstdCompressFn;
+#endif
+      break;
+  }
+  compress_thread_ = std::thread(&PacketWriter::CompressThreadMain, this);
+}
+
 PacketWriter::~PacketWriter() {
+  if (compress_thread_.joinable()) {
+    FlushPending();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    compress_thread_.join();
+  }
   fflush(fd_);
 }
 
+// static
+bool PacketWriter::IsCompressionSupported(CompressionType compression) {
+  switch (compression) {
+    case TraceConfig::COMPRESSION_TYPE_UNSPECIFIED:
+      return true;
+    case TraceConfig::COMPRESSION_TYPE_DEFLATE:
+      return PERFETTO_BUILDFLAG(PERFETTO_ZLIB);
+    case TraceConfig::COMPRESSION_TYPE_ZSTD:
+      return PERFETTO_BUILDFLAG(PERFETTO_ZSTD);
+  }
+  return false;
+}
+
+bool PacketWriter::WritePackets(std::vector<TracePacket> packets) {
+  if (!compress_fn_) {
+    for (const TracePacket& packet : packets) {
+      if (!WritePacket(packet)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  for (TracePacket& packet : packets) {
+    pending_size_ += packet.size();
+    pending_.emplace_back(std::move(packet));
+  }
+  if (pending_size_ >= kCompressBatchSize) {
+    FlushPending();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  return !write_failed_;
+}
+
+void PacketWriter::FlushPending() {
+  if (pending_.empty()) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return queue_.size() < kMaxQueuedBatches; });
+    queue_.emplace_back(std::move(pending_));
+  }
+  cv_.notify_all();
+  pending_.clear();
+  pending_size_ = 0;
+}
+
+void PacketWriter::CompressThreadMain() {
+  base::MaybeSetThreadName("pf-compress");
+  for (;;) {
+    std::vector<TracePacket> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return quit_ || !queue_.empty(); });
+      if (queue_.empty()) {
+        return;
+      }
+      batch = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    // Wakes up FlushPending(), if it's waiting for room in the queue.
+    cv_.notify_all();
+
+    compress_fn_(&batch);
+    for (const TracePacket& packet : batch) {
+      if (!WritePacket(packet)) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        write_failed_ = true;
+        break;
+      }
+    }
+  }
+}
+
 bool PacketWriter::WritePacket(const TracePacket& packet) {
   Preamble preamble;
   size_t size = GetPreamble<protos::pbzero::Trace::kPacketFieldNumber>(
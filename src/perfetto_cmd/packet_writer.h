@@ -17,30 +17,64 @@
 #ifndef SRC_PERFETTO_CMD_PACKET_WRITER_H_
 #define SRC_PERFETTO_CMD_PACKET_WRITER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <stdio.h>
 
 #include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/tracing/core/trace_config.h"
 
 namespace perfetto {
 
+// Writes the packets read back from the service into a trace file.
+//
+// If a compression type is passed, the packets are compressed into
+// {zstd_,}compressed_packets TracePackets, like the service does when
+// TraceConfig.compression_type is set. This happens on a background thread,
+// while the following packets are being received. The file is complete only
+// after the PacketWriter has been destroyed.
 class PacketWriter {
  public:
-  explicit PacketWriter(FILE* fd) : fd_(fd) {}
+  using CompressionType = TraceConfig::CompressionType;
+
+  explicit PacketWriter(FILE* fd,
+                        CompressionType compression =
+                            TraceConfig::COMPRESSION_TYPE_UNSPECIFIED);
   ~PacketWriter();
-  bool WritePackets(const std::vector<TracePacket>& packets) {
-    for (const TracePacket& packet : packets) {
-      if (!WritePacket(packet)) {
-        return false;
-      }
-    }
-    return true;
-  }
-  bool WritePacket(const TracePacket& packets);
+
+  // Returns false if writing these or any previous packets failed.
+  bool WritePackets(std::vector<TracePacket> packets);
+
+  // Returns true if this build can compress with |compression|.
+  static bool IsCompressionSupported(CompressionType compression);
 
  private:
+  using CompressFn = void (*)(std::vector<TracePacket>*);
+
+  bool WritePacket(const TracePacket& packet);
+
+  // Hands the pending packets over to the compression thread.
+  void FlushPending();
+  void CompressThreadMain();
+
   FILE* fd_;
+  CompressFn compress_fn_ = nullptr;
+
+  // The packets for the next compression batch. Accessed only by the thread
+  // which calls WritePackets().
+  std::vector<TracePacket> pending_;
+  size_t pending_size_ = 0;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::vector<TracePacket>> queue_;  // Guarded by |mutex_|.
+  bool quit_ = false;                            // Guarded by |mutex_|.
+  bool write_failed_ = false;                    // Guarded by |mutex_|.
+  std::thread compress_thread_;
 };
 
 }  // namespace perfetto
@@ -32,6 +32,10 @@
 #include "protos/perfetto/trace/trace.gen.h"
 #include "protos/perfetto/trace/trace_packet.gen.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include <zlib.h>
+#endif
+
 namespace perfetto {
 namespace {
 
@@ -75,5 +79,56 @@ TEST(PacketWriterTest, FilePacketWriter) {
   EXPECT_EQ(trace.packet()[0].for_testing().str(), "abc");
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+TEST(PacketWriterTest, DeflatePacketWriter) {
+  base::TempFile tmp = base::TempFile::CreateUnlinked();
+  base::ScopedResource<FILE*, fclose, nullptr> f(
+      fdopen(tmp.ReleaseFD().release(), "wb+"));
+
+  // Enough packets for several compression batches.
+  constexpr size_t kPacketCount = 5000;
+  {
+    PacketWriter writer(*f, TraceConfig::COMPRESSION_TYPE_DEFLATE);
+    for (size_t i = 0; i < kPacketCount; i++) {
+      std::vector<perfetto::TracePacket> packets;
+      packets.push_back(CreateTracePacket([i](TracePacketProto* msg) {
+        auto* for_testing = msg->mutable_for_testing();
+        for_testing->set_str(std::to_string(i) + std::string(1000, 'x'));
+      }));
+      EXPECT_TRUE(writer.WritePackets(std::move(packets)));
+    }
+  }
+
+  fseek(*f, 0, SEEK_SET);
+  std::string s;
+  EXPECT_TRUE(base::ReadFileStream(*f, &s));
+
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(s));
+  EXPECT_GT(trace.packet().size(), 1u);
+
+  size_t count = 0;
+  for (const auto& compressed : trace.packet()) {
+    ASSERT_TRUE(compressed.has_compressed_packets());
+    const std::string& data = compressed.compressed_packets();
+    std::string decompressed(4 * 1024 * 1024, '\0');
+    uLongf size = static_cast<uLongf>(decompressed.size());
+    ASSERT_EQ(uncompress(reinterpret_cast<Bytef*>(&decompressed[0]), &size,
+                         reinterpret_cast<const Bytef*>(data.data()),
+                         static_cast<uLong>(data.size())),
+              Z_OK);
+    decompressed.resize(size);
+
+    protos::gen::Trace batch;
+    ASSERT_TRUE(batch.ParseFromString(decompressed));
+    for (const auto& packet : batch.packet()) {
+      EXPECT_EQ(packet.for_testing().str(),
+                std::to_string(count++) + std::string(1000, 'x'));
+    }
+  }
+  EXPECT_EQ(count, kPacketCount);
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+
 }  // namespace
 }  // namespace perfetto
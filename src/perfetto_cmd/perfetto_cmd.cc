@@ -199,6 +199,40 @@ void ArgsAppend(std::string* str, const std::string& arg) {
   str->append(arg);
   str->append("\0", 1);
 }
+
+// Prints a row of the SERVICE LATENCIES table of --query: the number of
+// samples, their mean and the bucket bounds of their 50th and 99th
+// percentiles, in microseconds.
+void PrintLatencyHistogram(const std::string& session,
+                           const TracingServiceState::LatencyHistogram& hist,
+                           const std::vector<int64_t>& def_ns) {
+  uint64_t count = 0;
+  for (uint64_t bucket_count : hist.counts())
+    count += bucket_count;
+  int64_t sum_ns = 0;
+  for (int64_t bucket_sum_ns : hist.sums_ns())
+    sum_ns += bucket_sum_ns;
+  if (count == 0 || def_ns.empty())
+    return;
+
+  auto percentile = [&](uint64_t pct) {
+    const uint64_t target = (count * pct + 99) / 100;
+    uint64_t cumulative = 0;
+    size_t bucket = 0;
+    for (; bucket < hist.counts().size(); ++bucket) {
+      cumulative += hist.counts()[bucket];
+      if (cumulative >= target)
+        break;
+    }
+    if (bucket >= def_ns.size())
+      return ">" + std::to_string(def_ns.back() / 1000);
+    return "<=" + std::to_string(def_ns[bucket] / 1000);
+  };
+  printf("%-8s %-13s %-28s %-10" PRIu64 " %-10" PRId64 " %-10s %s\n",
+         session.c_str(), hist.name().c_str(), hist.producer_name().c_str(),
+         count, sum_ns / static_cast<int64_t>(count) / 1000,
+         percentile(50).c_str(), percentile(99).c_str());
+}
 }  // namespace
 
 const char* kStateDir = "/data/misc/perfetto-traces";
@@ -238,6 +272,10 @@ Usage: %s
                              If using CLONE_SNAPSHOT triggers, each snapshot
                              will be saved in a new file with a counter suffix
                              (e.g., file.0, file.1, file.2).
+  --compress-output=TYPE   : Compresses the trace written to --out on this
+                             side, while it is read back from the service.
+                             TYPE is either deflate or zstd. Not supported
+                             with write_into_file.
   --txt                    : Parse config as pbtxt. Not for production use.
                              Not a stable API.
   --query [--long]         : Queries the service state and prints it as
@@ -308,6 +346,7 @@ std::optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
     OPT_LONG,
     OPT_QUERY_RAW,
     OPT_VERSION,
+    OPT_COMPRESS_OUTPUT,
   };
   static const option long_options[] = {
       {"help", no_argument, nullptr, 'h'},
@@ -340,6 +379,7 @@ std::optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       {"version", no_argument, nullptr, OPT_VERSION},
       {"save-for-bugreport", no_argument, nullptr, OPT_BUGREPORT},
       {"save-all-for-bugreport", no_argument, nullptr, OPT_BUGREPORT_ALL},
+      {"compress-output", required_argument, nullptr, OPT_COMPRESS_OUTPUT},
       {nullptr, 0, nullptr, 0}};
 
   std::string config_file_name;
@@ -568,6 +608,23 @@ std::optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
       continue;
     }
 
+    if (option == OPT_COMPRESS_OUTPUT) {
+      if (strcmp(optarg, "deflate") == 0) {
+        compress_output_ = TraceConfig::COMPRESSION_TYPE_DEFLATE;
+      } else if (strcmp(optarg, "zstd") == 0) {
+        compress_output_ = TraceConfig::COMPRESSION_TYPE_ZSTD;
+      } else {
+        PERFETTO_ELOG("Invalid --compress-output type: %s", optarg);
+        return 1;
+      }
+      if (!PacketWriter::IsCompressionSupported(compress_output_)) {
+        PERFETTO_ELOG("--compress-output=%s is not supported by this build",
+                      optarg);
+        return 1;
+      }
+      continue;
+    }
+
     PrintUsage(argv[0]);
     return 1;
   }
@@ -854,11 +911,23 @@ std::optional<int> PerfettoCmd::ParseCmdlineAndMaybeDaemonize(int argc,
         "TraceConfig's write_into_file must be true when using --detach");
     return 1;
   }
+  if (compress_output_ != TraceConfig::COMPRESSION_TYPE_UNSPECIFIED) {
+    if (!open_out_file || trace_config_->write_into_file()) {
+      PERFETTO_ELOG(
+          "--compress-output requires the trace to be read back into --out "
+          "(it does not work with write_into_file)");
+      return 1;
+    }
+    // Don't compress the trace twice.
+    trace_config_->set_compression_type(
+        TraceConfig::COMPRESSION_TYPE_UNSPECIFIED);
+  }
+
   if (open_out_file) {
     if (!OpenOutputFile())
       return 1;
     if (!trace_config_->write_into_file())
-      packet_writer_.emplace(trace_out_stream_.get());
+      packet_writer_.emplace(trace_out_stream_.get(), compress_output_);
   }
 
   bool will_trace_indefinitely =
@@ -1181,7 +1250,7 @@ void PerfettoCmd::OnTraceData(std::vector<TracePacket> packets, bool has_more) {
   trace_data_timeout_armed_ = false;
 
   PERFETTO_CHECK(packet_writer_.has_value());
-  if (!packet_writer_->WritePackets(packets)) {
+  if (!packet_writer_->WritePackets(std::move(packets))) {
     PERFETTO_ELOG("Failed to write packets");
     FinalizeTraceAndExit();
   }
@@ -1524,6 +1593,23 @@ ID      UID     STATE      BUF (#) KB   DUR (s)   #DS  STARTED  NAME
           "If you want to list all session, run again this command as root.\n");
     }
   }  // if (supports_tracing_sessions)
+
+  if (!svc_state.latency_histogram_def_ns().empty()) {
+    printf(R"(
+
+SERVICE LATENCIES (us):
+
+SESSION  OPERATION     PRODUCER                     COUNT      MEAN       P50        P99
+=======  =========     ========                     =====      ====       ===        ===
+)");
+    const auto& def_ns = svc_state.latency_histogram_def_ns();
+    for (const auto& hist : svc_state.latency_histograms())
+      PrintLatencyHistogram("-", hist, def_ns);
+    for (const auto& sess : svc_state.tracing_sessions()) {
+      for (const auto& hist : sess.latency_histograms())
+        PrintLatencyHistogram(std::to_string(sess.id()), hist, def_ns);
+    }
+  }  // if (latency_histogram_def_ns)
 }
 
 void PerfettoCmd::OnObservableEvents(
@@ -145,6 +145,8 @@ class PerfettoCmd : public Consumer {
       consumer_endpoint_;
   std::unique_ptr<TraceConfig> trace_config_;
   std::optional<PacketWriter> packet_writer_;
+  PacketWriter::CompressionType compress_output_ =
+      TraceConfig::COMPRESSION_TYPE_UNSPECIFIED;
   base::ScopedFstream trace_out_stream_;
   std::vector<std::string> triggers_to_activate_;
   std::string trace_out_path_;
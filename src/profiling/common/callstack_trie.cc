@@ -16,6 +16,11 @@
 
 #include "src/profiling/common/callstack_trie.h"
 
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <new>
 #include <vector>
 
 #include "perfetto/ext/base/string_splitter.h"
@@ -28,12 +33,27 @@ namespace profiling {
 GlobalCallstackTrie::Node* GlobalCallstackTrie::GetOrCreateChild(
     Node* self,
     const Interned<Frame>& loc) {
-  Node* child = self->GetChild(loc);
-  if (!child)
-    child = self->AddChild(loc, ++next_callstack_id_, self);
+  Node* child = self->children_.Find(loc);
+  if (!child) {
+    child = arena_.New(loc, ++next_callstack_id_, self);
+    self->children_.Insert(child);
+  }
   return child;
 }
 
+void GlobalCallstackTrie::DeleteDescendants(Node* node) {
+  std::vector<Node*> to_delete(node->children_.begin(),
+                               node->children_.end());
+  while (!to_delete.empty()) {
+    Node* cur = to_delete.back();
+    to_delete.pop_back();
+    to_delete.insert(to_delete.end(), cur->children_.begin(),
+                     cur->children_.end());
+    arena_.Delete(cur);
+  }
+  node->children_.Clear();
+}
+
 std::vector<Interned<Frame>> GlobalCallstackTrie::BuildInverseCallstack(
     const Node* node) const {
   std::vector<Interned<Frame>> res;
@@ -87,8 +107,12 @@ void GlobalCallstackTrie::DecrementNode(Node* node) {
   bool delete_prev = false;
   Node* prev = nullptr;
   while (node != nullptr) {
-    if (delete_prev)
-      node->RemoveChild(prev);
+    if (delete_prev) {
+      node->children_.Remove(prev);
+      // Only nodes never referenced can be left below |prev|.
+      DeleteDescendants(prev);
+      arena_.Delete(prev);
+    }
     node->ref_count_ -= 1;
     delete_prev = node->ref_count_ == 0;
     prev = node;
@@ -126,29 +150,101 @@ Interned<Frame> GlobalCallstackTrie::MakeRootFrame() {
   return frame_interner_.Intern(frame);
 }
 
-GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::AddChild(
-    const Interned<Frame>& loc,
-    uint64_t callstack_id,
-    Node* parent) {
-  auto it = children_.emplace(loc, callstack_id, parent);
-  return const_cast<Node*>(&(*it.first));
+GlobalCallstackTrie::Node::Children::~Children() {
+  Clear();
 }
-void GlobalCallstackTrie::Node::RemoveChild(Node* node) {
-  children_.erase(*node);
+
+void GlobalCallstackTrie::Node::Children::Clear() {
+  if (capacity_)
+    free(heap_);
+  inline_ = nullptr;
+  size_ = 0;
+  capacity_ = 0;
 }
 
-GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::GetChild(
-    const Interned<Frame>& loc) {
-  // This will be nicer with C++14 transparent comparators.
-  // Then we will be able to look up by just the key using a sutiable
-  // comparator.
-  //
-  // For now we need to allow to construct Node from the key.
-  Node node(loc);
-  auto it = children_.find(node);
-  if (it == children_.end())
+uint32_t GlobalCallstackTrie::Node::Children::LowerBound(
+    const Interned<Frame>& loc) const {
+  Node* const* it = std::lower_bound(
+      begin(), end(), loc,
+      [](const Node* child, const Interned<Frame>& l) {
+        return child->location_ < l;
+      });
+  return static_cast<uint32_t>(it - begin());
+}
+
+GlobalCallstackTrie::Node* GlobalCallstackTrie::Node::Children::Find(
+    const Interned<Frame>& loc) const {
+  uint32_t i = LowerBound(loc);
+  if (i == size_ || !(data()[i]->location_ == loc))
     return nullptr;
-  return const_cast<Node*>(&(*it));
+  return data()[i];
+}
+
+void GlobalCallstackTrie::Node::Children::Insert(Node* child) {
+  if (size_ == 0 && capacity_ == 0) {
+    inline_ = child;
+    size_ = 1;
+    return;
+  }
+  uint32_t i = LowerBound(child->location_);
+  PERFETTO_DCHECK(i == size_ || !(data()[i]->location_ == child->location_));
+  if (size_ == capacity_ || capacity_ == 0) {
+    uint32_t new_capacity = std::max(capacity_ * 2, 4u);
+    Node** new_heap =
+        static_cast<Node**>(malloc(new_capacity * sizeof(Node*)));
+    PERFETTO_CHECK(new_heap);
+    memcpy(new_heap, data(), size_ * sizeof(Node*));
+    if (capacity_)
+      free(heap_);
+    heap_ = new_heap;
+    capacity_ = new_capacity;
+  }
+  Node** nodes = data();
+  memmove(&nodes[i + 1], &nodes[i], (size_ - i) * sizeof(Node*));
+  nodes[i] = child;
+  size_++;
+}
+
+void GlobalCallstackTrie::Node::Children::Remove(Node* child) {
+  uint32_t i = LowerBound(child->location_);
+  PERFETTO_DCHECK(i < size_ && data()[i] == child);
+  Node** nodes = data();
+  memmove(&nodes[i], &nodes[i + 1], (size_ - i - 1) * sizeof(Node*));
+  size_--;
+  // Go back to inline storage rather than keeping an array for one child.
+  if (capacity_ && size_ <= 1) {
+    Node** heap = heap_;
+    inline_ = size_ ? heap[0] : nullptr;
+    capacity_ = 0;
+    free(heap);
+  }
+}
+
+GlobalCallstackTrie::Node* GlobalCallstackTrie::NodeArena::New(
+    const Interned<Frame>& loc,
+    uint64_t id,
+    Node* parent) {
+  Slot* slot = free_list_;
+  if (slot) {
+    free_list_ = slot->next_free;
+  } else {
+    if (slots_used_in_last_slab_ == kNodesPerSlab) {
+      slabs_.emplace_back(new Slot[kNodesPerSlab]);
+      slots_used_in_last_slab_ = 0;
+    }
+    slot = &slabs_.back()[slots_used_in_last_slab_++];
+  }
+  size_++;
+  return new (&slot->node) Node(loc, id, parent);
+}
+
+void GlobalCallstackTrie::NodeArena::Delete(Node* node) {
+  // The node is the first (and only) member of its slot.
+  Slot* slot = reinterpret_cast<Slot*>(node);
+  node->~Node();
+  slot->next_free = free_list_;
+  free_list_ = slot;
+  size_--;
 }
 
 }  // namespace profiling
@@ -17,7 +17,7 @@
 #ifndef SRC_PROFILING_COMMON_CALLSTACK_TRIE_H_
 #define SRC_PROFILING_COMMON_CALLSTACK_TRIE_H_
 
-#include <set>
+#include <memory>
 #include <string>
 #include <typeindex>
 #include <vector>
@@ -95,6 +95,11 @@ struct Frame {
 //                   libc_init
 //                       |
 //                    [root_]
+//
+// Long profiling sessions accumulate millions of nodes, so they are kept
+// small: they are allocated from slabs of the trie rather than one by one,
+// and their children are a sorted array (or a single inline pointer, as most
+// nodes have at most one child).
 class GlobalCallstackTrie {
  public:
   // Optionally, Nodes can be externally refcounted via |IncrementNode| and
@@ -105,47 +110,58 @@ class GlobalCallstackTrie {
     // This is opaque except to GlobalCallstackTrie.
     friend class GlobalCallstackTrie;
 
-    // Allow building a node out of a frame for GetChild.
-    explicit Node(Interned<Frame> frame) : Node(frame, 0, nullptr) {}
-    Node(const Node&) = default;
-    Node(Node&&) = default;
-
-    Node(Interned<Frame> frame, uint64_t id)
-        : Node(std::move(frame), id, nullptr) {}
     Node(Interned<Frame> frame, uint64_t id, Node* parent)
-        : id_(id), parent_(parent), location_(frame) {}
+        : id_(id), parent_(parent), location_(std::move(frame)) {}
+
+    Node(const Node&) = delete;
+    Node& operator=(const Node&) = delete;
 
     ~Node() { PERFETTO_DCHECK(!ref_count_); }
 
     uint64_t id() const { return id_; }
 
    private:
-    Node* GetOrCreateChild(const Interned<Frame>& loc);
-    // Deletes all descendant nodes, regardless of |ref_count_|.
-    void DeleteChildren() { children_.clear(); }
+    // The children of a node, sorted by |location_|.
+    class Children {
+     public:
+      Children() : inline_(nullptr) {}
+      ~Children();
+      Children(const Children&) = delete;
+      Children& operator=(const Children&) = delete;
+
+      Node* Find(const Interned<Frame>& loc) const;
+      // |child| must not be in the list yet.
+      void Insert(Node* child);
+      void Remove(Node* child);
+      void Clear();
+
+      Node* const* begin() const { return data(); }
+      Node* const* end() const { return data() + size_; }
+      bool empty() const { return size_ == 0; }
+
+     private:
+      Node* const* data() const { return capacity_ ? heap_ : &inline_; }
+      Node** data() { return capacity_ ? heap_ : &inline_; }
+      // Index of the first child not before |loc|.
+      uint32_t LowerBound(const Interned<Frame>& loc) const;
+
+      union {
+        Node* inline_;  // If capacity_ == 0, holds the only child if any.
+        Node** heap_;
+      };
+      uint32_t size_ = 0;
+      uint32_t capacity_ = 0;
+    };
 
     uint64_t ref_count_ = 0;
     uint64_t id_;
     Node* const parent_;
     const Interned<Frame> location_;
-
-    class NodeComparator {
-     public:
-      bool operator()(const Node& one, const Node& other) const {
-        return one.location_ < other.location_;
-      }
-    };
-    Node* AddChild(const Interned<Frame>& loc,
-                   uint64_t next_callstack_id_,
-                   Node* parent);
-    void RemoveChild(Node* node);
-    Node* GetChild(const Interned<Frame>& loc);
-
-    std::set<Node, NodeComparator> children_;
+    Children children_;
   };
 
   GlobalCallstackTrie() = default;
-  ~GlobalCallstackTrie() = default;
+  ~GlobalCallstackTrie() { DeleteDescendants(&root_); }
   GlobalCallstackTrie(const GlobalCallstackTrie&) = delete;
   GlobalCallstackTrie& operator=(const GlobalCallstackTrie&) = delete;
 
@@ -160,8 +176,8 @@ class GlobalCallstackTrie {
                        const std::vector<std::string>& build_ids);
   Node* CreateCallsite(const std::vector<Interned<Frame>>& callstack);
 
-  static void IncrementNode(Node* node);
-  static void DecrementNode(Node* node);
+  void IncrementNode(Node* node);
+  void DecrementNode(Node* node);
 
   std::vector<Interned<Frame>> BuildInverseCallstack(const Node* node) const;
 
@@ -170,11 +186,44 @@ class GlobalCallstackTrie {
   // of nodes (Node.ref_count_).
   void ClearTrie() {
     PERFETTO_DLOG("Clearing trie");
-    root_.DeleteChildren();
+    DeleteDescendants(&root_);
   }
 
+  size_t node_count_for_testing() const { return arena_.size(); }
+
  private:
+  // Allocates the nodes in fixed-size slabs, so that they never move, and
+  // reuses the ones deleted.
+  class NodeArena {
+   public:
+    NodeArena() = default;
+    NodeArena(const NodeArena&) = delete;
+    NodeArena& operator=(const NodeArena&) = delete;
+
+    Node* New(const Interned<Frame>& loc, uint64_t id, Node* parent);
+    void Delete(Node* node);
+
+    size_t size() const { return size_; }
+
+   private:
+    static constexpr size_t kNodesPerSlab = 1024;
+
+    union Slot {
+      Slot() {}
+      ~Slot() {}
+      Slot* next_free;
+      Node node;
+    };
+
+    std::vector<std::unique_ptr<Slot[]>> slabs_;
+    size_t slots_used_in_last_slab_ = kNodesPerSlab;
+    Slot* free_list_ = nullptr;
+    size_t size_ = 0;
+  };
+
   Node* GetOrCreateChild(Node* self, const Interned<Frame>& loc);
+  // Deletes all descendant nodes, regardless of |ref_count_|.
+  void DeleteDescendants(Node* node);
 
   Interned<Frame> MakeRootFrame();
 
@@ -182,11 +231,13 @@ class GlobalCallstackTrie {
   Interner<Mapping> mapping_interner_;
   Interner<Frame> frame_interner_;
 
+  NodeArena arena_;
+
   uint64_t next_callstack_id_ = 0;
 
   // Note: profile_module in trace processor relies on the value of this root
   // callsite being exactly "1". See the perf_sample parsing code.
-  Node root_{MakeRootFrame(), ++next_callstack_id_};
+  Node root_{MakeRootFrame(), ++next_callstack_id_, nullptr};
 };
 
 }  // namespace profiling
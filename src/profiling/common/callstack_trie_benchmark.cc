@@ -0,0 +1,121 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/profiling/common/callstack_trie.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+struct Callstack {
+  std::vector<unwindstack::FrameData> frames;
+  std::vector<std::string> build_ids;
+};
+
+// Generates callstacks shaped like the ones of real processes: they all share
+// the bottom frames, and at each level a few callees are much more common
+// than the others.
+std::vector<Callstack> GenerateCallstacks(size_t count) {
+  std::minstd_rand rnd(42);
+  std::uniform_int_distribution<size_t> depth_dist(8, 48);
+  std::geometric_distribution<uint64_t> callee_dist(0.3);
+  std::vector<Callstack> res(count);
+  for (Callstack& callstack : res) {
+    size_t depth = depth_dist(rnd);
+    uint64_t frame_id = 0;
+    for (size_t i = 0; i < depth; ++i) {
+      // The two bottom frames (e.g. __libc_init and main) are always the same.
+      uint64_t callee = i < 2 ? 0 : std::min<uint64_t>(callee_dist(rnd), 31);
+      frame_id = frame_id * 32 + callee + 1;
+      unwindstack::FrameData frame{};
+      frame.rel_pc = frame_id;
+      frame.function_name = "fun" + std::to_string(frame_id);
+      callstack.frames.emplace_back(std::move(frame));
+    }
+    // The unwinder returns the leaf frame first.
+    std::reverse(callstack.frames.begin(), callstack.frames.end());
+    callstack.build_ids.resize(depth);
+  }
+  return res;
+}
+
+void BM_CallstackTrieCreate(benchmark::State& state) {
+  std::vector<Callstack> callstacks =
+      GenerateCallstacks(static_cast<size_t>(state.range(0)));
+  size_t nodes = 0;
+  for (auto _ : state) {
+    GlobalCallstackTrie trie;
+    for (const Callstack& callstack : callstacks) {
+      benchmark::DoNotOptimize(
+          trie.CreateCallsite(callstack.frames, callstack.build_ids));
+    }
+    nodes = trie.node_count_for_testing();
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          state.range(0));
+  state.counters["nodes"] = static_cast<double>(nodes);
+}
+
+BENCHMARK(BM_CallstackTrieCreate)->Arg(1000)->Arg(20000);
+
+// The common case for heapprofd: most allocations come from callstacks that
+// are already in the trie.
+void BM_CallstackTrieLookup(benchmark::State& state) {
+  std::vector<Callstack> callstacks =
+      GenerateCallstacks(static_cast<size_t>(state.range(0)));
+  GlobalCallstackTrie trie;
+  for (const Callstack& callstack : callstacks)
+    trie.CreateCallsite(callstack.frames, callstack.build_ids);
+  size_t i = 0;
+  for (auto _ : state) {
+    const Callstack& callstack = callstacks[i++ % callstacks.size()];
+    benchmark::DoNotOptimize(
+        trie.CreateCallsite(callstack.frames, callstack.build_ids));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+BENCHMARK(BM_CallstackTrieLookup)->Arg(1000)->Arg(100000);
+
+// Callsites that are referenced and then released, as when short-lived
+// allocations are freed.
+void BM_CallstackTrieChurn(benchmark::State& state) {
+  std::vector<Callstack> callstacks =
+      GenerateCallstacks(static_cast<size_t>(state.range(0)));
+  GlobalCallstackTrie trie;
+  size_t i = 0;
+  for (auto _ : state) {
+    const Callstack& callstack = callstacks[i++ % callstacks.size()];
+    GlobalCallstackTrie::Node* node =
+        trie.CreateCallsite(callstack.frames, callstack.build_ids);
+    trie.IncrementNode(node);
+    trie.DecrementNode(node);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+}
+
+BENCHMARK(BM_CallstackTrieChurn)->Arg(1000)->Arg(100000);
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/common/callstack_trie.h"
+
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+
+std::vector<unwindstack::FrameData> Stack(
+    const std::vector<uint64_t>& pcs) {
+  std::vector<unwindstack::FrameData> res;
+  for (uint64_t pc : pcs) {
+    unwindstack::FrameData data{};
+    data.function_name = "fun" + std::to_string(pc);
+    data.rel_pc = pc;
+    res.emplace_back(std::move(data));
+  }
+  return res;
+}
+
+std::vector<uint64_t> RelPcs(const GlobalCallstackTrie& trie,
+                             const GlobalCallstackTrie::Node* node) {
+  std::vector<uint64_t> res;
+  for (const Interned<Frame>& frame : trie.BuildInverseCallstack(node))
+    res.push_back(frame->rel_pc);
+  return res;
+}
+
+// |pcs| starts from the leaf frame, like the output of the unwinder.
+GlobalCallstackTrie::Node* CreateCallsite(GlobalCallstackTrie* trie,
+                                          const std::vector<uint64_t>& pcs) {
+  return trie->CreateCallsite(Stack(pcs),
+                              std::vector<std::string>(pcs.size()));
+}
+
+TEST(CallstackTrieTest, SharesCommonPrefix) {
+  GlobalCallstackTrie trie;
+  GlobalCallstackTrie::Node* a = CreateCallsite(&trie, {3, 2, 1});
+  GlobalCallstackTrie::Node* b = CreateCallsite(&trie, {4, 2, 1});
+  EXPECT_NE(a, b);
+  EXPECT_EQ(trie.node_count_for_testing(), 4u);
+  EXPECT_EQ(CreateCallsite(&trie, {3, 2, 1}), a);
+  EXPECT_EQ(trie.node_count_for_testing(), 4u);
+  EXPECT_THAT(RelPcs(trie, a), ElementsAre(3u, 2u, 1u));
+  EXPECT_THAT(RelPcs(trie, b), ElementsAre(4u, 2u, 1u));
+}
+
+TEST(CallstackTrieTest, ManyChildren) {
+  GlobalCallstackTrie trie;
+  std::vector<GlobalCallstackTrie::Node*> nodes;
+  // Insert in an order unrelated to the one of the interned frames.
+  for (uint64_t i = 0; i < 100; ++i)
+    nodes.push_back(CreateCallsite(&trie, {(i * 37) % 100 + 2, 1}));
+  EXPECT_EQ(trie.node_count_for_testing(), 101u);
+  for (uint64_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(CreateCallsite(&trie, {(i * 37) % 100 + 2, 1}), nodes[i]);
+    EXPECT_THAT(RelPcs(trie, nodes[i]), ElementsAre((i * 37) % 100 + 2, 1u));
+  }
+}
+
+TEST(CallstackTrieTest, DecrementDeletesOrphans) {
+  GlobalCallstackTrie trie;
+  GlobalCallstackTrie::Node* a = CreateCallsite(&trie, {3, 2, 1});
+  GlobalCallstackTrie::Node* b = CreateCallsite(&trie, {4, 2, 1});
+  trie.IncrementNode(a);
+  trie.IncrementNode(b);
+  // Never referenced, so only kept alive by its ancestors.
+  CreateCallsite(&trie, {6, 5, 3, 2, 1});
+  EXPECT_EQ(trie.node_count_for_testing(), 6u);
+
+  trie.DecrementNode(a);
+  EXPECT_EQ(trie.node_count_for_testing(), 3u);
+  EXPECT_THAT(RelPcs(trie, b), ElementsAre(4u, 2u, 1u));
+
+  trie.DecrementNode(b);
+  EXPECT_EQ(trie.node_count_for_testing(), 0u);
+}
+
+TEST(CallstackTrieTest, ReusesDeletedNodes) {
+  GlobalCallstackTrie trie;
+  for (uint64_t i = 0; i < 3000; ++i) {
+    GlobalCallstackTrie::Node* node = CreateCallsite(&trie, {i + 2, 1});
+    trie.IncrementNode(node);
+    trie.DecrementNode(node);
+    EXPECT_EQ(trie.node_count_for_testing(), 0u);
+  }
+  GlobalCallstackTrie::Node* node = CreateCallsite(&trie, {2, 1});
+  EXPECT_THAT(RelPcs(trie, node), ElementsAre(2u, 1u));
+}
+
+TEST(CallstackTrieTest, ClearTrie) {
+  GlobalCallstackTrie trie;
+  uint64_t id = CreateCallsite(&trie, {3, 2, 1})->id();
+  CreateCallsite(&trie, {5, 1});
+  EXPECT_EQ(trie.node_count_for_testing(), 4u);
+  trie.ClearTrie();
+  EXPECT_EQ(trie.node_count_for_testing(), 0u);
+  // Ids are not reused after clearing.
+  EXPECT_GT(CreateCallsite(&trie, {3, 2, 1})->id(), id);
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
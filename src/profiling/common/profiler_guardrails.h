@@ -62,6 +62,8 @@ class ProfilerMemoryGuardrails {
 
   bool IsOverMemoryThreshold(const GuardrailConfig& ds);
 
+  std::optional<uint32_t> anon_and_swap_kb() const { return anon_and_swap_; }
+
  private:
   std::optional<uint32_t> anon_and_swap_;
 };
@@ -16,13 +16,22 @@
 
 #include "src/profiling/common/unwind_support.h"
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cinttypes>
+#include <mutex>
+#include <shared_mutex>
 
 #include <procinfo/process_map.h>
+#include <unwindstack/Elf.h>
+#include <unwindstack/MachineArm64.h>
+#include <unwindstack/MachineX86_64.h>
 #include <unwindstack/Maps.h>
 #include <unwindstack/Memory.h>
+#include <unwindstack/Regs.h>
 
-#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
 namespace profiling {
@@ -58,14 +67,24 @@ size_t FDMemory::Read(uint64_t addr, void* dst, size_t size) {
 FDMaps::FDMaps(base::ScopedFile fd) : fd_(std::move(fd)) {}
 
 bool FDMaps::Parse() {
-  // If the process has already exited, lseek or ReadFileDescriptor will
-  // return false.
-  if (lseek(*fd_, 0, SEEK_SET) == -1)
-    return false;
-
+  // Read with pread() rather than lseek() and read(), as the fd can be a
+  // dup() used by other threads, sharing the file offset (e.g. by the
+  // heapprofd unwinding workers). If the process has already exited, pread
+  // will fail.
   std::string content;
-  if (!base::ReadFileDescriptor(*fd_, &content))
-    return false;
+  constexpr size_t kReadSize = 16 * 1024;
+  for (off64_t offset = 0;;) {
+    size_t size = content.size();
+    content.resize(size + kReadSize);
+    ssize_t rd =
+        PERFETTO_EINTR(pread64(*fd_, &content[size], kReadSize, offset));
+    if (rd < 0)
+      return false;
+    content.resize(size + static_cast<size_t>(rd));
+    if (rd == 0)
+      break;
+    offset += rd;
+  }
 
   unwindstack::SharedString name("");
   std::shared_ptr<unwindstack::MapInfo> prev_map;
@@ -173,5 +192,109 @@ std::string StringifyLibUnwindstackError(unwindstack::ErrorCode e) {
   }
 }
 
+bool WalkFramePointers(uint64_t fp,
+                       uint64_t sp,
+                       const uint8_t* stack,
+                       size_t stack_size,
+                       size_t max_frames,
+                       std::vector<uint64_t>* return_addresses) {
+  // A frame record is the saved frame pointer followed by the return address.
+  constexpr uint64_t kFrameRecordSize = 2 * sizeof(uint64_t);
+  const uint64_t stack_end = sp + stack_size;
+  uint64_t min_fp = sp;
+  while (fp != 0 && return_addresses->size() < max_frames) {
+    if (fp % sizeof(uint64_t) != 0 || fp < min_fp || fp >= stack_end ||
+        stack_end - fp < kFrameRecordSize) {
+      return false;
+    }
+    uint64_t record[2];
+    memcpy(record, stack + (fp - sp), sizeof(record));
+    if (record[1] == 0)
+      break;
+    return_addresses->push_back(record[1]);
+    min_fp = fp + kFrameRecordSize;
+    fp = record[0];
+  }
+  return true;
+}
+
+bool UnwindFramePointers(
+    unwindstack::Unwinder* unwinder,
+    unwindstack::Regs* regs,
+    const uint8_t* stack,
+    size_t stack_size,
+    size_t max_frames,
+    const std::vector<std::string>* initial_map_names_to_skip,
+    std::vector<unwindstack::FrameData>* frames) {
+  frames->clear();
+  uint64_t fp;
+  // The return addresses are moved back into the call instruction, as the
+  // DWARF unwinding of libunwindstack does for the frames but the first.
+  uint64_t pc_adjustment;
+  switch (regs->Arch()) {
+    case unwindstack::ARCH_ARM64:
+      fp = static_cast<uint64_t*>(regs->RawData())[unwindstack::ARM64_REG_R29];
+      pc_adjustment = 4;
+      break;
+    case unwindstack::ARCH_X86_64:
+      fp =
+          static_cast<uint64_t*>(regs->RawData())[unwindstack::X86_64_REG_RBP];
+      pc_adjustment = 1;
+      break;
+    case unwindstack::ARCH_ARM:
+    case unwindstack::ARCH_X86:
+    case unwindstack::ARCH_RISCV64:
+    case unwindstack::ARCH_UNKNOWN:
+      return false;
+  }
+
+  std::vector<uint64_t> pcs{regs->pc()};
+  if (!WalkFramePointers(fp, regs->sp(), stack, stack_size, max_frames - 1,
+                         &pcs)) {
+    return false;
+  }
+
+  bool skipping = initial_map_names_to_skip != nullptr;
+  for (size_t i = 0; i < pcs.size(); ++i) {
+    uint64_t pc = i == 0 ? pcs[i] : pcs[i] - pc_adjustment;
+    unwindstack::FrameData frame = unwinder->BuildFrameFromPcOnly(pc);
+    // Garbage that happened to look like a frame record.
+    if (frame.map_info == nullptr) {
+      frames->clear();
+      return false;
+    }
+    if (skipping) {
+      const std::string& path = frame.map_info->name();
+      std::string name = path.substr(path.rfind('/') + 1);
+      if (std::find(initial_map_names_to_skip->begin(),
+                    initial_map_names_to_skip->end(),
+                    name) != initial_map_names_to_skip->end()) {
+        continue;
+      }
+      skipping = false;
+    }
+    frame.num = frames->size();
+    frames->emplace_back(std::move(frame));
+  }
+  return true;
+}
+
+void ResetAndEnableUnwindstackCache() {
+  PERFETTO_DLOG("Resetting unwindstack cache");
+  // Libunwindstack uses an unsynchronized variable for setting/checking whether
+  // the cache is enabled, and frees the cache without waiting for its users.
+  // Therefore, use our own lock to exclude both other toggles and unwinding on
+  // other threads.
+  // TODO(rsavitski): consider fixing this in libunwindstack itself.
+  std::unique_lock<std::shared_mutex> guard{UnwindstackCacheMutex()};
+  unwindstack::Elf::SetCachingEnabled(false);  // free any existing state
+  unwindstack::Elf::SetCachingEnabled(true);   // reallocate a fresh cache
+}
+
+std::shared_mutex& UnwindstackCacheMutex() {
+  static std::shared_mutex* mutex = new std::shared_mutex{};
+  return *mutex;
+}
+
 }  // namespace profiling
 }  // namespace perfetto
@@ -21,7 +21,9 @@
 #include "perfetto/base/build_config.h"
 
 #include <memory>
+#include <shared_mutex>
 #include <string>
+#include <vector>
 
 #include <unwindstack/Maps.h>
 #include <unwindstack/Unwinder.h>
@@ -115,6 +117,8 @@ struct UnwindingMetadata {
   std::shared_ptr<unwindstack::Memory> fd_mem;
   uint64_t reparses = 0;
   base::TimeMillis last_maps_reparse_time{0};
+  // Whether to try UnwindFramePointers before unwinding with DWARF.
+  bool frame_pointer_unwinding = false;
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   std::unique_ptr<unwindstack::JitDebug> jit_debug;
   std::unique_ptr<unwindstack::DexFiles> dex_files;
@@ -123,6 +127,51 @@ struct UnwindingMetadata {
 
 std::string StringifyLibUnwindstackError(unwindstack::ErrorCode);
 
+// Walks the chain of frame records (pairs of saved frame pointer and return
+// address) starting at the frame pointer |fp|, through |stack|, a copy of the
+// stack of a process starting at its stack pointer |sp|. Appends the return
+// addresses to |return_addresses|, up to |max_frames| of them. The chain ends
+// at a null frame pointer or return address.
+//
+// Returns false if the chain is invalid: if a frame record is misaligned, not
+// above the previous one, or not within the copied stack.
+bool WalkFramePointers(uint64_t fp,
+                       uint64_t sp,
+                       const uint8_t* stack,
+                       size_t stack_size,
+                       size_t max_frames,
+                       std::vector<uint64_t>* return_addresses);
+
+// Unwinds |regs| with WalkFramePointers, which is much cheaper than DWARF
+// unwinding for binaries built with frame pointers, and symbolizes the frames
+// with |unwinder|. The leading frames in |initial_map_names_to_skip| are
+// dropped, as with unwindstack::Unwinder::Unwind().
+//
+// Returns false, leaving |frames| empty, if the callstack should be unwound
+// with DWARF instead: if the frame pointer chain is invalid or leads out of
+// the mapped code, or for architectures other than arm64 and x86-64 (whose
+// frame records have the same layout).
+bool UnwindFramePointers(
+    unwindstack::Unwinder* unwinder,
+    unwindstack::Regs* regs,
+    const uint8_t* stack,
+    size_t stack_size,
+    size_t max_frames,
+    const std::vector<std::string>* initial_map_names_to_skip,
+    std::vector<unwindstack::FrameData>* frames);
+
+// Enables the process-wide cache of parsed ELF files of libunwindstack,
+// dropping the one from before if any. The cached ELF files are shared by the
+// maps of all the processes and the unwinders of all the threads. Waits for
+// the threads which hold UnwindstackCacheMutex() to release it, so it must not
+// be called while holding it.
+void ResetAndEnableUnwindstackCache();
+
+// Held in shared mode by the threads which unwind concurrently with
+// ResetAndEnableUnwindstackCache() calls on other threads, for the duration
+// of each unwind.
+std::shared_mutex& UnwindstackCacheMutex();
+
 }  // namespace profiling
 }  // namespace perfetto
 
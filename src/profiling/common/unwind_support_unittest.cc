@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/common/unwind_support.h"
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+using ::testing::ElementsAre;
+
+constexpr uint64_t kSp = 0x7000;
+
+// A copied stack of |words| starting at kSp.
+class FakeStack {
+ public:
+  explicit FakeStack(size_t words) : words_(words) {}
+
+  uint64_t Address(size_t word) const { return kSp + word * sizeof(uint64_t); }
+
+  // Writes a frame record at |word|.
+  void SetFrameRecord(size_t word, uint64_t fp, uint64_t return_address) {
+    words_[word] = fp;
+    words_[word + 1] = return_address;
+  }
+
+  bool Walk(uint64_t fp, size_t max_frames, std::vector<uint64_t>* out) const {
+    return WalkFramePointers(fp, kSp,
+                             reinterpret_cast<const uint8_t*>(words_.data()),
+                             words_.size() * sizeof(uint64_t), max_frames, out);
+  }
+
+ private:
+  std::vector<uint64_t> words_;
+};
+
+TEST(WalkFramePointersTest, WalksToNullFramePointer) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(6), 0x1000);
+  stack.SetFrameRecord(6, stack.Address(10), 0x2000);
+  stack.SetFrameRecord(10, 0, 0x3000);
+  std::vector<uint64_t> pcs;
+  EXPECT_TRUE(stack.Walk(stack.Address(2), 100, &pcs));
+  EXPECT_THAT(pcs, ElementsAre(0x1000u, 0x2000u, 0x3000u));
+}
+
+TEST(WalkFramePointersTest, StopsAtNullReturnAddress) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(6), 0x1000);
+  stack.SetFrameRecord(6, stack.Address(10), 0);
+  std::vector<uint64_t> pcs;
+  EXPECT_TRUE(stack.Walk(stack.Address(2), 100, &pcs));
+  EXPECT_THAT(pcs, ElementsAre(0x1000u));
+}
+
+TEST(WalkFramePointersTest, StopsAtMaxFrames) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(6), 0x1000);
+  stack.SetFrameRecord(6, stack.Address(10), 0x2000);
+  stack.SetFrameRecord(10, 0, 0x3000);
+  std::vector<uint64_t> pcs;
+  EXPECT_TRUE(stack.Walk(stack.Address(2), 2, &pcs));
+  EXPECT_THAT(pcs, ElementsAre(0x1000u, 0x2000u));
+}
+
+TEST(WalkFramePointersTest, RejectsLoop) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(6), 0x1000);
+  stack.SetFrameRecord(6, stack.Address(2), 0x2000);
+  std::vector<uint64_t> pcs;
+  EXPECT_FALSE(stack.Walk(stack.Address(2), 100, &pcs));
+}
+
+TEST(WalkFramePointersTest, RejectsOverlappingRecord) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(3), 0x1000);
+  std::vector<uint64_t> pcs;
+  EXPECT_FALSE(stack.Walk(stack.Address(2), 100, &pcs));
+}
+
+TEST(WalkFramePointersTest, RejectsMisaligned) {
+  FakeStack stack(16);
+  stack.SetFrameRecord(2, stack.Address(6) + 4, 0x1000);
+  std::vector<uint64_t> pcs;
+  EXPECT_FALSE(stack.Walk(stack.Address(2), 100, &pcs));
+}
+
+TEST(WalkFramePointersTest, RejectsOutsideOfStack) {
+  FakeStack stack(16);
+  std::vector<uint64_t> pcs;
+  EXPECT_FALSE(stack.Walk(kSp - 16, 100, &pcs));
+  EXPECT_FALSE(stack.Walk(stack.Address(16), 100, &pcs));
+  // The record must fit entirely.
+  EXPECT_FALSE(stack.Walk(stack.Address(15), 100, &pcs));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
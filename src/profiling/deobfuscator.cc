@@ -16,6 +16,9 @@
 
 #include "src/profiling/deobfuscator.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <optional>
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/file_utils.h"
@@ -31,47 +34,63 @@ namespace perfetto {
 namespace profiling {
 namespace {
 
+// Splits |line| at spaces into |out|, skipping empty tokens. Returns the
+// number of tokens, which is |max_tokens| + 1 if there were more.
+size_t Tokenize(base::StringView line,
+                base::StringView* out,
+                size_t max_tokens) {
+  size_t count = 0;
+  size_t pos = 0;
+  while (pos < line.size()) {
+    size_t end = line.find(' ', pos);
+    if (end == base::StringView::npos)
+      end = line.size();
+    if (end > pos) {
+      if (count == max_tokens)
+        return count + 1;
+      out[count++] = line.substr(pos, end - pos);
+    }
+    pos = end + 1;
+  }
+  return count;
+}
+
 struct ProguardClass {
-  std::string obfuscated_name;
-  std::string deobfuscated_name;
+  base::StringView obfuscated_name;
+  base::StringView deobfuscated_name;
 };
 
-std::optional<ProguardClass> ParseClass(std::string line) {
-  base::StringSplitter ss(std::move(line), ' ');
+std::optional<ProguardClass> ParseClass(base::StringView line) {
+  base::StringView tokens[3];
+  size_t count = Tokenize(line, tokens, 3);
 
-  if (!ss.Next()) {
+  if (count < 1) {
     PERFETTO_ELOG("Missing deobfuscated name.");
     return std::nullopt;
   }
-  std::string deobfuscated_name(ss.cur_token(), ss.cur_token_size());
+  base::StringView deobfuscated_name = tokens[0];
 
-  if (!ss.Next() || ss.cur_token_size() != 2 ||
-      strncmp("->", ss.cur_token(), 2) != 0) {
+  if (count < 2 || tokens[1] != "->") {
     PERFETTO_ELOG("Missing ->");
     return std::nullopt;
   }
 
-  if (!ss.Next()) {
+  if (count < 3) {
     PERFETTO_ELOG("Missing obfuscated name.");
     return std::nullopt;
   }
-  std::string obfuscated_name(ss.cur_token(), ss.cur_token_size());
-  if (obfuscated_name.empty()) {
-    PERFETTO_ELOG("Empty obfuscated name.");
-    return std::nullopt;
-  }
-  if (obfuscated_name.back() != ':') {
+  base::StringView obfuscated_name = tokens[2];
+  if (obfuscated_name.at(obfuscated_name.size() - 1) != ':') {
     PERFETTO_ELOG("Expected colon.");
     return std::nullopt;
   }
 
-  obfuscated_name.resize(obfuscated_name.size() - 1);
-  if (ss.Next()) {
+  obfuscated_name = obfuscated_name.substr(0, obfuscated_name.size() - 1);
+  if (count > 3) {
     PERFETTO_ELOG("Unexpected data.");
     return std::nullopt;
   }
-  return ProguardClass{std::move(obfuscated_name),
-                       std::move(deobfuscated_name)};
+  return ProguardClass{obfuscated_name, deobfuscated_name};
 }
 
 enum class ProguardMemberType {
@@ -81,56 +100,50 @@ enum class ProguardMemberType {
 
 struct ProguardMember {
   ProguardMemberType type;
-  std::string obfuscated_name;
-  std::string deobfuscated_name;
+  base::StringView obfuscated_name;
+  base::StringView deobfuscated_name;
 };
 
-std::optional<ProguardMember> ParseMember(std::string line) {
-  base::StringSplitter ss(std::move(line), ' ');
+std::optional<ProguardMember> ParseMember(base::StringView line) {
+  base::StringView tokens[4];
+  size_t count = Tokenize(line, tokens, 4);
 
-  if (!ss.Next()) {
+  if (count < 1) {
     PERFETTO_ELOG("Missing type name.");
     return std::nullopt;
   }
-  std::string type_name(ss.cur_token(), ss.cur_token_size());
 
-  if (!ss.Next()) {
+  if (count < 2) {
     PERFETTO_ELOG("Missing deobfuscated name.");
     return std::nullopt;
   }
-  std::string deobfuscated_name(ss.cur_token(), ss.cur_token_size());
+  base::StringView deobfuscated_name = tokens[1];
 
-  if (!ss.Next() || ss.cur_token_size() != 2 ||
-      strncmp("->", ss.cur_token(), 2) != 0) {
+  if (count < 3 || tokens[2] != "->") {
     PERFETTO_ELOG("Missing ->");
     return std::nullopt;
   }
 
-  if (!ss.Next()) {
+  if (count < 4) {
     PERFETTO_ELOG("Missing obfuscated name.");
     return std::nullopt;
   }
-  std::string obfuscated_name(ss.cur_token(), ss.cur_token_size());
+  base::StringView obfuscated_name = tokens[3];
 
-  if (ss.Next()) {
+  if (count > 4) {
     PERFETTO_ELOG("Unexpected data.");
     return std::nullopt;
   }
 
   ProguardMemberType member_type;
   auto paren_idx = deobfuscated_name.find('(');
-  if (paren_idx != std::string::npos) {
+  if (paren_idx != base::StringView::npos) {
     member_type = ProguardMemberType::kMethod;
     deobfuscated_name = deobfuscated_name.substr(0, paren_idx);
-    auto colon_idx = type_name.find(':');
-    if (colon_idx != std::string::npos) {
-      type_name = type_name.substr(colon_idx + 1);
-    }
   } else {
     member_type = ProguardMemberType::kField;
   }
-  return ProguardMember{member_type, std::move(obfuscated_name),
-                        std::move(deobfuscated_name)};
+  return ProguardMember{member_type, obfuscated_name, deobfuscated_name};
 }
 
 std::string FlattenMethods(const std::vector<std::string>& v) {
@@ -140,6 +153,47 @@ std::string FlattenMethods(const std::vector<std::string>& v) {
   return "[ambiguous]";
 }
 
+// Calls |fn| with each obfuscated method name of |cls| and its flattened
+// deobfuscated name, with the same output as
+// ObfuscatedClass::deobfuscated_methods().
+template <typename Fn>
+void ForEachFlattenedMethod(const ProguardParser::Class& cls, Fn fn) {
+  using Method = ProguardParser::Method;
+  std::vector<const Method*> methods;
+  methods.reserve(cls.methods.size());
+  for (const Method& method : cls.methods)
+    methods.push_back(&method);
+  std::stable_sort(methods.begin(), methods.end(),
+                   [](const Method* a, const Method* b) {
+                     if (a->obfuscated_name != b->obfuscated_name)
+                       return a->obfuscated_name < b->obfuscated_name;
+                     return a->deobfuscated_class < b->deobfuscated_class;
+                   });
+  for (size_t i = 0; i < methods.size();) {
+    base::StringView obfuscated_name = methods[i]->obfuscated_name;
+    std::string flattened;
+    while (i < methods.size() &&
+           methods[i]->obfuscated_name == obfuscated_name) {
+      base::StringView deobfuscated_class = methods[i]->deobfuscated_class;
+      size_t same_class = i;
+      while (same_class < methods.size() &&
+             methods[same_class]->obfuscated_name == obfuscated_name &&
+             methods[same_class]->deobfuscated_class == deobfuscated_class) {
+        same_class++;
+      }
+      if (!flattened.empty())
+        flattened += " | ";
+      flattened += deobfuscated_class.ToStdString() + ".";
+      if (same_class - i == 1)
+        flattened += methods[i]->deobfuscated_name.ToStdString();
+      else
+        flattened += "[ambiguous]";
+      i = same_class;
+    }
+    fn(obfuscated_name, flattened);
+  }
+}
+
 }  // namespace
 
 std::string FlattenClasses(
@@ -156,46 +210,110 @@ std::string FlattenClasses(
   return result;
 }
 
+ProguardParser::StringArena::StringArena() = default;
+ProguardParser::StringArena::~StringArena() = default;
+
+base::StringView ProguardParser::StringArena::Intern(base::StringView str) {
+  if (str.empty())
+    return base::StringView();
+  const base::StringView* existing = interned_.Find(str);
+  if (existing)
+    return *existing;
+  char* copy;
+  if (str.size() > kChunkSize / 4) {
+    // Large strings get their own allocation, so that they don't waste the
+    // rest of the current chunk.
+    chunks_.emplace_back(new char[str.size()]);
+    copy = chunks_.back().get();
+  } else {
+    if (kChunkSize - chunk_used_ < str.size()) {
+      chunks_.emplace_back(new char[kChunkSize]);
+      chunk_ = chunks_.back().get();
+      chunk_used_ = 0;
+    }
+    copy = chunk_ + chunk_used_;
+    chunk_used_ += str.size();
+  }
+  memcpy(copy, str.data(), str.size());
+  base::StringView interned(copy, str.size());
+  interned_.Insert(interned, interned);
+  return interned;
+}
+
+ProguardParser::ProguardParser() = default;
+ProguardParser::~ProguardParser() = default;
+
 // See https://www.guardsquare.com/en/products/proguard/manual/retrace for the
 // file format we are parsing.
 base::Status ProguardParser::AddLine(std::string line) {
-  auto first_ch_pos = line.find_first_not_of(" \t");
-  if (first_ch_pos == std::string::npos || line[first_ch_pos] == '#')
+  return ParseLine(base::StringView(line));
+}
+
+base::Status ProguardParser::ParseLine(base::StringView line) {
+  size_t first_ch_pos = 0;
+  while (first_ch_pos < line.size() &&
+         (line.at(first_ch_pos) == ' ' || line.at(first_ch_pos) == '\t')) {
+    first_ch_pos++;
+  }
+  if (first_ch_pos == line.size() || line.at(first_ch_pos) == '#')
     return base::Status();
 
-  bool is_member = line[0] == ' ';
+  bool is_member = line.at(0) == ' ';
   if (is_member && !current_class_) {
     return base::Status(
         "Failed to parse proguard map. Saw member before class.");
   }
   if (!is_member) {
-    auto opt_cls = ParseClass(std::move(line));
+    auto opt_cls = ParseClass(line);
     if (!opt_cls)
       return base::Status("Class not found.");
-    auto p = mapping_.emplace(std::move(opt_cls->obfuscated_name),
-                              std::move(opt_cls->deobfuscated_name));
-    if (!p.second) {
+    base::StringView obfuscated_name =
+        strings_.Intern(opt_cls->obfuscated_name);
+    auto idx = static_cast<uint32_t>(classes_.size());
+    if (!class_idx_.Insert(obfuscated_name, idx).second) {
       return base::Status("Duplicate class.");
     }
-    current_class_ = &p.first->second;
+    Class cls;
+    cls.obfuscated_name = obfuscated_name;
+    cls.deobfuscated_name = strings_.Intern(opt_cls->deobfuscated_name);
+    classes_.emplace_back(std::move(cls));
+    current_class_ = idx;
   } else {
-    auto opt_member = ParseMember(std::move(line));
+    auto opt_member = ParseMember(line);
     if (!opt_member)
       return base::Status("Failed to parse member.");
+    Class& cls = classes_[*current_class_];
+    base::StringView obfuscated_name =
+        strings_.Intern(opt_member->obfuscated_name);
     switch (opt_member->type) {
       case (ProguardMemberType::kField): {
-        if (!current_class_->AddField(opt_member->obfuscated_name,
-                                      opt_member->deobfuscated_name)) {
+        base::StringView deobfuscated_name =
+            strings_.Intern(opt_member->deobfuscated_name);
+        auto it_and_inserted = fields_.Insert(
+            FieldKey{*current_class_, obfuscated_name.data()},
+            deobfuscated_name);
+        if (it_and_inserted.second) {
+          cls.fields.push_back(Field{obfuscated_name, deobfuscated_name});
+        } else if (*it_and_inserted.first != deobfuscated_name) {
           return base::Status(std::string("Member redefinition: ") +
-                              current_class_->deobfuscated_name().c_str() +
-                              "." + opt_member->deobfuscated_name.c_str() +
+                              cls.deobfuscated_name.ToStdString() + "." +
+                              deobfuscated_name.ToStdString() +
                               " Proguard map invalid");
         }
         break;
       }
       case (ProguardMemberType::kMethod): {
-        current_class_->AddMethod(opt_member->obfuscated_name,
-                                  opt_member->deobfuscated_name);
+        // Methods inlined from other classes are qualified by their class.
+        base::StringView deobfuscated_class = cls.deobfuscated_name;
+        base::StringView deobfuscated_name = opt_member->deobfuscated_name;
+        size_t dot = deobfuscated_name.rfind('.');
+        if (dot != base::StringView::npos) {
+          deobfuscated_class =
+              strings_.Intern(deobfuscated_name.substr(0, dot));
+          deobfuscated_name = deobfuscated_name.substr(dot + 1);
+        }
+        cls.methods.push_back(Method{obfuscated_name, deobfuscated_class,
+                                     strings_.Intern(deobfuscated_name)});
         break;
       }
     }
@@ -206,7 +324,8 @@ base::Status ProguardParser::AddLine(std::string line) {
 bool ProguardParser::AddLines(std::string contents) {
   size_t lineno = 1;
   for (base::StringSplitter lines(std::move(contents), '\n'); lines.Next();) {
-    auto status = AddLine(lines.cur_token());
+    auto status = ParseLine(
+        base::StringView(lines.cur_token(), lines.cur_token_size()));
     if (!status.ok()) {
       PERFETTO_ELOG("Failed to parse proguard map (line %zu): %s", lineno,
                     status.c_message());
@@ -217,9 +336,32 @@ bool ProguardParser::AddLines(std::string contents) {
   return true;
 }
 
+std::map<std::string, ObfuscatedClass> ProguardParser::ConsumeMapping() {
+  std::map<std::string, ObfuscatedClass> mapping;
+  for (const Class& cls : classes_) {
+    std::map<std::string, std::string> fields;
+    for (const Field& field : cls.fields) {
+      fields.emplace(field.obfuscated_name.ToStdString(),
+                     field.deobfuscated_name.ToStdString());
+    }
+    std::map<std::string, std::map<std::string, std::vector<std::string>>>
+        methods;
+    for (const Method& method : cls.methods) {
+      methods[method.obfuscated_name.ToStdString()]
+             [method.deobfuscated_class.ToStdString()]
+                 .push_back(method.deobfuscated_name.ToStdString());
+    }
+    mapping.emplace(
+        cls.obfuscated_name.ToStdString(),
+        ObfuscatedClass(cls.deobfuscated_name.ToStdString(), std::move(fields),
+                        std::move(methods)));
+  }
+  return mapping;
+}
+
 void MakeDeobfuscationPackets(
     const std::string& package_name,
-    const std::map<std::string, profiling::ObfuscatedClass>& mapping,
+    const ProguardParser& parser,
     std::function<void(const std::string&)> callback) {
   protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
   auto* packet = trace->add_packet();
@@ -227,27 +369,26 @@ void MakeDeobfuscationPackets(
   // can support multiple dumps in the same trace.
   auto* proto_mapping = packet->set_deobfuscation_mapping();
   proto_mapping->set_package_name(package_name);
-  for (const auto& p : mapping) {
-    const std::string& obfuscated_class_name = p.first;
-    const profiling::ObfuscatedClass& cls = p.second;
-
+  for (const ProguardParser::Class& cls : parser.classes()) {
     auto* proto_class = proto_mapping->add_obfuscated_classes();
-    proto_class->set_obfuscated_name(obfuscated_class_name);
-    proto_class->set_deobfuscated_name(cls.deobfuscated_name());
-    for (const auto& field_p : cls.deobfuscated_fields()) {
-      const std::string& obfuscated_field_name = field_p.first;
-      const std::string& deobfuscated_field_name = field_p.second;
+    proto_class->set_obfuscated_name(cls.obfuscated_name.data(),
+                                     cls.obfuscated_name.size());
+    proto_class->set_deobfuscated_name(cls.deobfuscated_name.data(),
+                                       cls.deobfuscated_name.size());
+    for (const ProguardParser::Field& field : cls.fields) {
       auto* proto_member = proto_class->add_obfuscated_members();
-      proto_member->set_obfuscated_name(obfuscated_field_name);
-      proto_member->set_deobfuscated_name(deobfuscated_field_name);
+      proto_member->set_obfuscated_name(field.obfuscated_name.data(),
+                                        field.obfuscated_name.size());
+      proto_member->set_deobfuscated_name(field.deobfuscated_name.data(),
+                                          field.deobfuscated_name.size());
     }
-    for (const auto& field_p : cls.deobfuscated_methods()) {
-      const std::string& obfuscated_method_name = field_p.first;
-      const std::string& deobfuscated_method_name = field_p.second;
+    ForEachFlattenedMethod(cls, [proto_class](base::StringView obfuscated_name,
+                                              const std::string& flattened) {
       auto* proto_member = proto_class->add_obfuscated_methods();
-      proto_member->set_obfuscated_name(obfuscated_method_name);
-      proto_member->set_deobfuscated_name(deobfuscated_method_name);
-    }
+      proto_member->set_obfuscated_name(obfuscated_name.data(),
+                                        obfuscated_name.size());
+      proto_member->set_deobfuscated_name(flattened);
+    });
   }
   callback(trace.SerializeAsString());
 }
@@ -269,13 +410,11 @@ bool ReadProguardMapsToDeobfuscationPackets(
       PERFETTO_ELOG("Failed to parse %s", filename);
       return false;
     }
-    std::map<std::string, profiling::ObfuscatedClass> obfuscation_map =
-        parser.ConsumeMapping();
 
     // TODO(fmayer): right now, we don't use the profile we are given. We can
     // filter the output to only contain the classes actually seen in the
     // profile.
-    MakeDeobfuscationPackets(map.package, obfuscation_map, fn);
+    MakeDeobfuscationPackets(map.package, parser, fn);
   }
   return true;
 }
@@ -17,12 +17,18 @@
 #ifndef SRC_PROFILING_DEOBFUSCATOR_H_
 #define SRC_PROFILING_DEOBFUSCATOR_H_
 
+#include <cstdint>
 #include <functional>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
+#include "perfetto/ext/base/string_view.h"
 
 namespace perfetto {
 namespace profiling {
@@ -55,52 +61,105 @@ class ObfuscatedClass {
     return result;
   }
 
-  bool redefined_methods() const { return redefined_methods_; }
-
-  bool AddField(std::string obfuscated_name, std::string deobfuscated_name) {
-    auto p = deobfuscated_fields_.emplace(std::move(obfuscated_name),
-                                          deobfuscated_name);
-    return p.second || p.first->second == deobfuscated_name;
-  }
-
-  void AddMethod(std::string obfuscated_name, std::string deobfuscated_name) {
-    std::string cls = deobfuscated_name_;
-    auto dot = deobfuscated_name.rfind('.');
-    if (dot != std::string::npos) {
-      cls = deobfuscated_name.substr(0, dot);
-      deobfuscated_name = deobfuscated_name.substr(dot + 1);
-    }
-    auto& deobfuscated_names_for_cls =
-        deobfuscated_methods_[std::move(obfuscated_name)][std::move(cls)];
-    deobfuscated_names_for_cls.push_back(std::move(deobfuscated_name));
-    if (deobfuscated_names_for_cls.size() > 1 ||
-        deobfuscated_methods_.size() > 1) {
-      redefined_methods_ = true;
-    }
-  }
-
  private:
   std::string deobfuscated_name_;
   std::map<std::string, std::string> deobfuscated_fields_;
   std::map<std::string, std::map<std::string, std::vector<std::string>>>
       deobfuscated_methods_;
-  bool redefined_methods_ = false;
 };
 
+// Parses ProGuard / R8 mapping files, see
+// https://www.guardsquare.com/en/products/proguard/manual/retrace for the
+// format.
+//
+// Mapping files of large apps are 100+ MB, so lines are tokenized in place
+// and each distinct string is copied once into an arena: the short obfuscated
+// member names and the class names of inlined methods repeat a lot. Classes
+// and fields are indexed by flat hash maps on the interned strings.
 class ProguardParser {
  public:
+  struct Field {
+    base::StringView obfuscated_name;
+    base::StringView deobfuscated_name;
+  };
+
+  struct Method {
+    base::StringView obfuscated_name;
+    // The class the method was defined in. It differs from the one of the
+    // enclosing Class for methods inlined from other classes.
+    base::StringView deobfuscated_class;
+    base::StringView deobfuscated_name;
+  };
+
+  struct Class {
+    base::StringView obfuscated_name;
+    base::StringView deobfuscated_name;
+    std::vector<Field> fields;
+    std::vector<Method> methods;
+  };
+
+  ProguardParser();
+  ~ProguardParser();
+
+  ProguardParser(const ProguardParser&) = delete;
+  ProguardParser& operator=(const ProguardParser&) = delete;
+
   // A return value of false means this line failed to parse. This leaves the
   // parser in an undefined state and it should no longer be used.
   base::Status AddLine(std::string line);
   bool AddLines(std::string contents);
 
-  std::map<std::string, ObfuscatedClass> ConsumeMapping() {
-    return std::move(mapping_);
-  }
+  // The classes in the order of the file. The strings are owned by the parser.
+  const std::vector<Class>& classes() const { return classes_; }
+
+  // Copies the mapping into standalone objects, keyed by obfuscated class
+  // name. Prefer classes() for large mappings.
+  std::map<std::string, ObfuscatedClass> ConsumeMapping();
 
  private:
-  std::map<std::string, ObfuscatedClass> mapping_;
-  ObfuscatedClass* current_class_ = nullptr;
+  // Append-only storage for the strings, which never moves them, so that the
+  // views handed out stay valid.
+  class StringArena {
+   public:
+    StringArena();
+    ~StringArena();
+    // Returns the copy of |str| in the arena, making it if needed.
+    base::StringView Intern(base::StringView str);
+
+   private:
+    static constexpr size_t kChunkSize = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    char* chunk_ = nullptr;
+    size_t chunk_used_ = kChunkSize;
+    // Both the key and the value are the copy in the arena.
+    base::FlatHashMap<base::StringView, base::StringView> interned_;
+  };
+
+  struct FieldKey {
+    uint32_t class_idx;
+    const char* obfuscated_name;  // interned, so compared by address
+    bool operator==(const FieldKey& other) const {
+      return class_idx == other.class_idx &&
+             obfuscated_name == other.obfuscated_name;
+    }
+  };
+  struct FieldKeyHash {
+    size_t operator()(const FieldKey& key) const {
+      return static_cast<size_t>(base::Hasher::Combine(
+          key.class_idx, reinterpret_cast<uintptr_t>(key.obfuscated_name)));
+    }
+  };
+
+  base::Status ParseLine(base::StringView line);
+
+  StringArena strings_;
+  std::vector<Class> classes_;
+  // Obfuscated class name to index in |classes_|.
+  base::FlatHashMap<base::StringView, uint32_t> class_idx_;
+  // Obfuscated field to its deobfuscated name.
+  base::FlatHashMap<FieldKey, base::StringView, FieldKeyHash> fields_;
+  // Index in |classes_| of the class that member lines belong to.
+  std::optional<uint32_t> current_class_;
 };
 
 struct ProguardMap {
@@ -110,7 +169,7 @@ struct ProguardMap {
 
 void MakeDeobfuscationPackets(
     const std::string& package_name,
-    const std::map<std::string, profiling::ObfuscatedClass>& mapping,
+    const ProguardParser& parser,
     std::function<void(const std::string&)> callback);
 
 std::vector<ProguardMap> GetPerfettoProguardMapPath();
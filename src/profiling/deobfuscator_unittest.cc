@@ -242,6 +242,32 @@ Example$$Class -> C:
           "C", {"Example$$Class", {{"q", "first"}, {"o", "second"}}, {}})));
 }
 
+TEST(ProguardParserTest, ClassesInFileOrderWithInternedStrings) {
+  ProguardParser p;
+  const char input[] = R"(
+Foo -> b:
+    int count -> a
+    1:1:void Bar.inlined():10:10 -> c
+Bar -> a:
+    int count -> a
+)";
+
+  ASSERT_TRUE(p.AddLines(std::string(input)));
+  const auto& classes = p.classes();
+  ASSERT_EQ(classes.size(), 2u);
+  EXPECT_EQ(classes[0].obfuscated_name, "b");
+  EXPECT_EQ(classes[1].obfuscated_name, "a");
+  ASSERT_EQ(classes[0].methods.size(), 1u);
+  EXPECT_EQ(classes[0].methods[0].deobfuscated_class, "Bar");
+  EXPECT_EQ(classes[0].methods[0].deobfuscated_name, "inlined");
+  // Equal strings are stored once.
+  ASSERT_EQ(classes[1].fields.size(), 1u);
+  EXPECT_EQ(classes[0].fields[0].obfuscated_name.data(),
+            classes[1].obfuscated_name.data());
+  EXPECT_EQ(classes[0].methods[0].deobfuscated_class.data(),
+            classes[1].deobfuscated_name.data());
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
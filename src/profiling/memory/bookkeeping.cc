@@ -144,8 +144,8 @@ uint64_t HeapTracker::GetSizeForTesting(
       callsites_->CreateCallsite(stack, build_ids);
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
-  GlobalCallstackTrie::IncrementNode(node);
-  GlobalCallstackTrie::DecrementNode(node);
+  callsites_->IncrementNode(node);
+  callsites_->DecrementNode(node);
   auto it = callstack_allocations_.find(node);
   if (it == callstack_allocations_.end()) {
     return 0;
@@ -162,8 +162,8 @@ uint64_t HeapTracker::GetMaxForTesting(
       callsites_->CreateCallsite(stack, build_ids);
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
-  GlobalCallstackTrie::IncrementNode(node);
-  GlobalCallstackTrie::DecrementNode(node);
+  callsites_->IncrementNode(node);
+  callsites_->DecrementNode(node);
   auto it = callstack_allocations_.find(node);
   if (it == callstack_allocations_.end()) {
     return 0;
@@ -180,8 +180,8 @@ uint64_t HeapTracker::GetMaxCountForTesting(
       callsites_->CreateCallsite(stack, build_ids);
   // Hack to make it go away again if it wasn't used before.
   // This is only good because this is used for testing only.
-  GlobalCallstackTrie::IncrementNode(node);
-  GlobalCallstackTrie::DecrementNode(node);
+  callsites_->IncrementNode(node);
+  callsites_->DecrementNode(node);
   auto it = callstack_allocations_.find(node);
   if (it == callstack_allocations_.end()) {
     return 0;
@@ -18,6 +18,7 @@
 #define SRC_PROFILING_MEMORY_BOOKKEEPING_H_
 
 #include <map>
+#include <tuple>
 #include <vector>
 
 #include "perfetto/base/time.h"
@@ -108,18 +109,22 @@ class HeapTracker {
 
   // Sum of all the allocations for a given callstack.
   struct CallstackAllocations {
-    explicit CallstackAllocations(GlobalCallstackTrie::Node* n) : node(n) {}
+    CallstackAllocations(GlobalCallstackTrie* c, GlobalCallstackTrie::Node* n)
+        : callsites(c), node(n) {}
 
     uint64_t allocs = 0;
+    // Whether |value| changed since the last GetCallstackAllocations.
+    bool changed = false;
 
     union {
       CallstackMaxAllocations retain_max;
       CallstackTotalAllocations totals;
     } value = {};
 
+    GlobalCallstackTrie* const callsites;
     GlobalCallstackTrie::Node* const node;
 
-    ~CallstackAllocations() { GlobalCallstackTrie::DecrementNode(node); }
+    ~CallstackAllocations() { callsites->DecrementNode(node); }
 
     bool operator<(const CallstackAllocations& other) const {
       return node < other.node;
@@ -138,8 +143,11 @@ class HeapTracker {
                     uint64_t sequence_number,
                     uint64_t timestamp);
 
+  // If |changed_only| is true, |fn| is only called for the callstacks whose
+  // values changed since the previous call. This is used for incremental
+  // dumps.
   template <typename F>
-  void GetCallstackAllocations(F fn) {
+  void GetCallstackAllocations(F fn, bool changed_only = false) {
     // There are two reasons we remove the unused callstack allocations on the
     // next iteration of Dump:
     // * We need to remove them after the callstacks were dumped, which
@@ -167,8 +175,10 @@ class HeapTracker {
 
     for (auto it = callstack_allocations_.begin();
          it != callstack_allocations_.end(); ++it) {
-      const CallstackAllocations& alloc = it->second;
-      fn(alloc);
+      CallstackAllocations& alloc = it->second;
+      if (!changed_only || alloc.changed)
+        fn(alloc);
+      alloc.changed = false;
 
       if (alloc.allocs == 0)
         dead_callstack_allocations_.emplace_back(
@@ -258,10 +268,12 @@ class HeapTracker {
       GlobalCallstackTrie::Node* node) {
     auto callstack_allocations_it = callstack_allocations_.find(node);
     if (callstack_allocations_it == callstack_allocations_.end()) {
-      GlobalCallstackTrie::IncrementNode(node);
+      callsites_->IncrementNode(node);
       bool inserted;
       std::tie(callstack_allocations_it, inserted) =
-          callstack_allocations_.emplace(node, node);
+          callstack_allocations_.emplace(
+              std::piecewise_construct, std::forward_as_tuple(node),
+              std::forward_as_tuple(callsites_, node));
       PERFETTO_DCHECK(inserted);
     }
     return &callstack_allocations_it->second;
@@ -282,6 +294,7 @@ class HeapTracker {
                        const PendingOperation& operation);
 
   void AddToCallstackAllocations(uint64_t ts, const Allocation& alloc) {
+    alloc.callstack_allocations()->changed = true;
     if (dump_at_max_mode_) {
       current_unfreed_ += alloc.sample_size;
       alloc.callstack_allocations()->value.retain_max.cur += alloc.sample_size;
@@ -303,6 +316,11 @@ class HeapTracker {
           // do not know which ones have changed since the last max.
           // TODO(fmayer): Add an index to speed this up
           CallstackAllocations& csa = p.second;
+          if (csa.value.retain_max.max != csa.value.retain_max.cur ||
+              csa.value.retain_max.max_count !=
+                  csa.value.retain_max.cur_count) {
+            csa.changed = true;
+          }
           csa.value.retain_max.max = csa.value.retain_max.cur;
           csa.value.retain_max.max_count = csa.value.retain_max.cur_count;
         }
@@ -318,6 +336,7 @@ class HeapTracker {
   }
 
   void SubtractFromCallstackAllocations(const Allocation& alloc) {
+    alloc.callstack_allocations()->changed = true;
     if (dump_at_max_mode_) {
       current_unfreed_ -= alloc.sample_size;
       alloc.callstack_allocations()->value.retain_max.cur -= alloc.sample_size;
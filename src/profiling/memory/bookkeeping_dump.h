@@ -56,6 +56,9 @@ class DumpState {
 
   void WriteAllocation(const HeapTracker::CallstackAllocations& alloc,
                        bool dump_at_max_mode);
+  // Writes the header of the process, even if there are no allocations to
+  // write. Used for incremental dumps, which can be empty.
+  void WriteProcessHeader() { GetCurrentProcessHeapSamples(); }
   void DumpCallstacks(GlobalCallstackTrie* callsites);
 
  private:
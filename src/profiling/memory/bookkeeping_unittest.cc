@@ -23,6 +23,7 @@ namespace profiling {
 namespace {
 
 using ::testing::AnyOf;
+using ::testing::ElementsAre;
 using ::testing::Eq;
 
 std::vector<unwindstack::FrameData> stack() {
@@ -122,6 +123,43 @@ TEST(BookkeepingTest, Basic) {
   ASSERT_EQ(hd.GetTimestampForTesting(), 100 * (sequence_number - 1));
 }
 
+TEST(BookkeepingTest, ChangedOnly) {
+  uint64_t sequence_number = 1;
+  GlobalCallstackTrie c;
+  HeapTracker hd(&c, false);
+
+  auto changed_freed = [&hd] {
+    std::vector<uint64_t> res;
+    hd.GetCallstackAllocations(
+        [&res](const HeapTracker::CallstackAllocations& alloc) {
+          res.push_back(alloc.value.totals.freed);
+        },
+        /*changed_only=*/true);
+    return res;
+  };
+
+  hd.RecordMalloc(stack(), DummyBuildIds(stack().size()), 0x1, 5, 5,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  hd.RecordMalloc(stack2(), DummyBuildIds(stack2().size()), 0x2, 2, 2,
+                  sequence_number, 100 * sequence_number);
+  sequence_number++;
+  EXPECT_EQ(changed_freed().size(), 2u);
+  EXPECT_TRUE(changed_freed().empty());
+
+  hd.RecordFree(0x1, sequence_number, 100 * sequence_number);
+  sequence_number++;
+  EXPECT_THAT(changed_freed(), ElementsAre(5u));
+  EXPECT_TRUE(changed_freed().empty());
+
+  // The first callstack has no allocations left, so it was removed by the
+  // previous call.
+  size_t all = 0;
+  hd.GetCallstackAllocations(
+      [&all](const HeapTracker::CallstackAllocations&) { all++; });
+  EXPECT_EQ(all, 1u);
+}
+
 TEST(BookkeepingTest, Max) {
   uint64_t sequence_number = 1;
   GlobalCallstackTrie c;
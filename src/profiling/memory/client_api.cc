@@ -120,7 +120,8 @@ AHeapInfo& GetHeap(uint32_t id) {
 }
 
 // Protects g_client, and serves as an external lock for sampling decisions (see
-// perfetto::profiling::Sampler).
+// perfetto::profiling::Sampler), except for the allocations that the sampler
+// can skip without it.
 //
 // We rely on this atomic's destuction being a nop, as it is possible for the
 // hooks to attempt to acquire the spinlock after its destructor should have run
@@ -380,6 +381,9 @@ AHeapProfile_reportAllocation(uint32_t heap_id, uint64_t id, uint64_t size) {
   if (!heap.enabled.load(std::memory_order_acquire)) {
     return false;
   }
+  // Most allocations are not sampled: skip them without taking the spinlock.
+  if (heap.sampler.SkipWithoutLock(static_cast<size_t>(size)))
+    return false;
   size_t sampled_alloc_sz = 0;
   std::shared_ptr<perfetto::profiling::Client> client;
   {
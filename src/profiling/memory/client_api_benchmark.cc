@@ -12,13 +12,25 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/time.h"
 #include "perfetto/heap_profile.h"
 #include "src/profiling/memory/heap_profile_internal.h"
 
 #include "src/profiling/memory/client.h"
 #include "src/profiling/memory/client_api_factory.h"
+#include "src/profiling/memory/shared_ring_buffer.h"
+#include "src/profiling/memory/wire_protocol.h"
 
 namespace perfetto {
 namespace profiling {
@@ -32,6 +44,10 @@ uint32_t GetHeapId() {
 
 ClientConfiguration g_client_config;
 int g_shmem_fd;
+// Size of the shared memory buffer of the next client. If it's not infinite,
+// the buffer must be drained by a reader (see BufferReader).
+size_t g_shmem_size = 8 * 1048576;
+bool g_infinite_shmem = true;
 
 base::UnixSocketRaw& GlobalServerSocket() {
   static base::UnixSocketRaw* srv_sock = new base::UnixSocketRaw;
@@ -57,9 +73,10 @@ std::shared_ptr<Client> ConstructClient(
   base::UnixSocketRaw& srv_sock = GlobalServerSocket();
   std::tie(cli_sock, srv_sock) = base::UnixSocketRaw::CreatePairPosix(
       base::SockFamily::kUnix, base::SockType::kStream);
-  auto ringbuf = SharedRingBuffer::Create(8 * 1048576);
-  ringbuf->InfiniteBufferForTesting();
+  auto ringbuf = SharedRingBuffer::Create(g_shmem_size);
   PERFETTO_CHECK(ringbuf);
+  if (g_infinite_shmem)
+    ringbuf->InfiniteBufferForTesting();
   PERFETTO_CHECK(cli_sock);
   PERFETTO_CHECK(srv_sock);
   g_shmem_fd = ringbuf->fd();
@@ -215,6 +232,210 @@ static void BM_ClientApiEnabledHeapFree(benchmark::State& state) {
 
 BENCHMARK(BM_ClientApiEnabledHeapFree);
 
+// Contention of the clients' threads on the ring buffer, with the writes
+// reserved under the spinlock (0) or lock-free (1).
+static void BM_ClientApiRingBufferFree(benchmark::State& state) {
+  // Shared by the threads of the benchmark.
+  static SharedRingBuffer* ringbuf = [] {
+    auto* buf = new SharedRingBuffer(*SharedRingBuffer::Create(8 * 1048576));
+    buf->InfiniteBufferForTesting();
+    return buf;
+  }();
+  ringbuf->SetLockFreeWritesForTesting(state.range(0) != 0);
+
+  FreeEntry entry{};
+  WireMessage msg{};
+  msg.record_type = RecordType::Free;
+  msg.free_header = &entry;
+  for (auto _ : state) {
+    entry.sequence_number++;
+    benchmark::DoNotOptimize(SendWireMessage(ringbuf, msg));
+  }
+}
+
+BENCHMARK(BM_ClientApiRingBufferFree)
+    ->Arg(0)
+    ->Arg(1)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
+
+namespace {
+
+// Records the duration of one in kSamplingInterval allocations, so that
+// reading the clock doesn't dominate the cost of the unsampled ones.
+class LatencySampler {
+ public:
+  static constexpr uint64_t kSamplingInterval = 16;
+  static constexpr size_t kMaxSamples = 64 * 1024;
+
+  LatencySampler() { samples_.reserve(kMaxSamples); }
+
+  template <typename Fn>
+  void Run(Fn fn) {
+    if (count_++ % kSamplingInterval) {
+      fn();
+      return;
+    }
+    int64_t start_ns = base::GetWallTimeNs().count();
+    fn();
+    int64_t duration_ns = base::GetWallTimeNs().count() - start_ns;
+    // Past kMaxSamples, the oldest samples are overwritten.
+    if (samples_.size() < kMaxSamples) {
+      samples_.push_back(duration_ns);
+    } else {
+      samples_[next_sample_++ % kMaxSamples] = duration_ns;
+    }
+  }
+
+  // Returns the 99th percentile of the sampled durations, in nanoseconds.
+  double P99() {
+    if (samples_.empty())
+      return 0;
+    size_t index = samples_.size() * 99 / 100;
+    std::nth_element(samples_.begin(),
+                     samples_.begin() + static_cast<ptrdiff_t>(index),
+                     samples_.end());
+    return static_cast<double>(samples_[index]);
+  }
+
+ private:
+  uint64_t count_ = 0;
+  size_t next_sample_ = 0;
+  std::vector<int64_t> samples_;
+};
+
+// Stands in for the unwinding worker of heapprofd: reads out the records of
+// the shared memory buffer of the client as fast as possible.
+class BufferReader {
+ public:
+  explicit BufferReader(SharedRingBuffer* ringbuf)
+      : ringbuf_(ringbuf), thread_([this] { Run(); }) {}
+  ~BufferReader() {
+    stop_.store(true, std::memory_order_relaxed);
+    thread_.join();
+  }
+
+ private:
+  void Run() {
+    while (!stop_.load(std::memory_order_relaxed)) {
+      SharedRingBuffer::Buffer buf = ringbuf_->BeginRead();
+      if (!buf) {
+        std::this_thread::yield();
+        continue;
+      }
+      ringbuf_->EndRead(std::move(buf));
+    }
+  }
+
+  SharedRingBuffer* ringbuf_;
+  std::atomic<bool> stop_{false};
+  std::thread thread_;
+};
+
+// Calls |fn| |depth| frames deeper than the caller, so that the client copies
+// a larger stack for each sampled allocation.
+PERFETTO_NO_INLINE void RunAtStackDepth(int64_t depth,
+                                        const std::function<void()>& fn) {
+  volatile char frame[64];
+  frame[0] = 0;
+  if (depth <= 0) {
+    fn();
+  } else {
+    RunAtStackDepth(depth - 1, fn);
+  }
+  // Prevents the recursive call from being turned into a tail call.
+  benchmark::DoNotOptimize(frame[0]);
+}
+
+// The dimensions of BM_ClientApiAllocationMatrix.
+void AllocationMatrixArgs(benchmark::internal::Benchmark* b) {
+  b->ArgNames({"interval", "shmem_kb", "block", "depth"});
+  for (int64_t interval : {1, 4096, 32768}) {
+    for (int64_t shmem_kb : {64, 1024, 8192}) {
+      for (int64_t block_client : {0, 1}) {
+        for (int64_t depth : {0, 32, 256})
+          b->Args({interval, shmem_kb, block_client, depth});
+      }
+    }
+  }
+  b->ThreadRange(1, 16)->UseRealTime();
+}
+
+}  // namespace
+
+// Reports 64 byte allocations from state.threads() threads, with a sampling
+// interval of state.range(0) bytes, a shared memory buffer of state.range(1)
+// KB drained by a reader thread, with block_client set to state.range(2) and
+// state.range(3) extra frames on the stack.
+// Besides the time per allocation, reports the 99th percentile of the
+// duration of an allocation (averaged over the threads), the fraction of the
+// allocations which were sampled, the fraction of the writes to the buffer
+// which failed because it was full and whether the client was disconnected
+// because of it (which is what happens on the first failure without
+// block_client).
+static void BM_ClientApiAllocationMatrix(benchmark::State& state) {
+  const uint32_t heap_id = GetHeapId();
+
+  std::optional<SharedRingBuffer> ringbuf;
+  std::unique_ptr<BufferReader> reader;
+  if (state.thread_index == 0) {
+    ClientConfiguration client_config{};
+    client_config.default_interval = static_cast<uint64_t>(state.range(0));
+    client_config.all_heaps = true;
+    client_config.block_client = state.range(2) != 0;
+    g_client_config = client_config;
+    g_shmem_size = static_cast<size_t>(state.range(1)) * 1024;
+    g_infinite_shmem = false;
+    PERFETTO_CHECK(AHeapProfile_initSession(malloc, free));
+    g_shmem_size = 8 * 1048576;
+    g_infinite_shmem = true;
+
+    PERFETTO_CHECK(g_shmem_fd);
+    ringbuf = SharedRingBuffer::Attach(base::ScopedFile(dup(g_shmem_fd)));
+    PERFETTO_CHECK(ringbuf);
+    reader.reset(new BufferReader(&*ringbuf));
+  }
+
+  LatencySampler sampler;
+  RunAtStackDepth(state.range(3), [&] {
+    uint64_t addr = 0x1000 * (static_cast<uint64_t>(state.thread_index) + 1);
+    for (auto _ : state) {
+      sampler.Run([&] {
+        benchmark::DoNotOptimize(
+            AHeapProfile_reportAllocation(heap_id, addr, 64));
+      });
+      addr += 64;
+    }
+  });
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["P99Ns"] =
+      benchmark::Counter(sampler.P99(), benchmark::Counter::kAvgThreads);
+  if (state.thread_index != 0)
+    return;
+
+  reader.reset();
+  SharedRingBuffer::Stats stats;
+  {
+    auto lock = ringbuf->AcquireLock(ScopedSpinlock::Mode::Blocking);
+    stats = ringbuf->GetStats(lock);
+  }
+  double allocations =
+      static_cast<double>(state.iterations()) * state.threads;
+  double writes = static_cast<double>(stats.num_writes_succeeded +
+                                      stats.num_writes_overflow);
+  state.counters["SampledRate"] =
+      static_cast<double>(stats.num_writes_succeeded) / allocations;
+  state.counters["DropRate"] =
+      writes ? static_cast<double>(stats.num_writes_overflow) / writes : 0;
+  state.counters["Disconnected"] =
+      stats.error_state != SharedRingBuffer::kNoError ? 1 : 0;
+  DisconnectGlobalServerSocket();
+  ringbuf->SetShuttingDown();
+}
+
+BENCHMARK(BM_ClientApiAllocationMatrix)->Apply(AllocationMatrixArgs);
+
 static void BM_ClientApiMallocFree(benchmark::State& state) {
   for (auto _ : state) {
     volatile char* x = static_cast<char*>(malloc(100));
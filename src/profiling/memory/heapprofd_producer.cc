@@ -33,6 +33,7 @@
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/watchdog_posix.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
@@ -43,6 +44,7 @@
 #include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
 #include "src/profiling/common/producer_support.h"
 #include "src/profiling/common/profiler_guardrails.h"
+#include "src/profiling/common/unwind_support.h"
 #include "src/profiling/memory/shared_ring_buffer.h"
 #include "src/profiling/memory/unwound_messages.h"
 #include "src/profiling/memory/wire_protocol.h"
@@ -62,6 +64,9 @@ constexpr size_t kUnwinderThreads = 5;
 constexpr uint32_t kInitialConnectionBackoffMs = 100;
 constexpr uint32_t kMaxConnectionBackoffMs = 30 * 1000;
 constexpr uint32_t kGuardrailIntervalMs = 30 * 1000;
+// Once heapprofd uses more memory than this, the cache of parsed ELF files is
+// dropped as soon as no process is being unwound.
+constexpr uint32_t kUnwindCacheMemoryLimitKb = 128 * 1024;
 
 constexpr uint64_t kDefaultShmemSize = 8 * 1048576;  // ~8 MB
 constexpr uint64_t kMaxShmemSize = 500 * 1048576;    // ~500 MB
@@ -77,6 +82,13 @@ std::vector<UnwindingWorker> MakeUnwindingWorkers(HeapprofdProducer* delegate,
     ret.emplace_back(delegate,
                      base::ThreadTaskRunner::CreateAndStart("heapprofdunwind"));
   }
+  // The workers unwind the allocations of each other's clients that fall
+  // behind. Only once |ret| is complete, as growing it moves the workers.
+  std::vector<UnwindingWorker*> peers;
+  for (UnwindingWorker& worker : ret)
+    peers.push_back(&worker);
+  for (UnwindingWorker& worker : ret)
+    worker.SetPeers(peers);
   return ret;
 }
 
@@ -212,11 +224,18 @@ HeapprofdProducer::HeapprofdProducer(HeapprofdMode mode,
       socket_delegate_(this),
       weak_factory_(this),
       unwinding_workers_(MakeUnwindingWorkers(this, kUnwinderThreads)) {
+  // Parse the ELF files of the libraries shared by the profiled processes
+  // (e.g. libc) once, rather than for every process and reparse of its maps.
+  ResetAndEnableUnwindstackCache();
   CheckDataSourceCpuTask();
   CheckDataSourceMemoryTask();
 }
 
-HeapprofdProducer::~HeapprofdProducer() = default;
+HeapprofdProducer::~HeapprofdProducer() {
+  // The workers post tasks to each other. Stop that before destroying any.
+  for (UnwindingWorker& worker : unwinding_workers_)
+    worker.DetachPeers();
+}
 
 void HeapprofdProducer::SetTargetProcess(pid_t target_pid,
                                          std::string target_cmdline) {
@@ -560,9 +579,30 @@ void HeapprofdProducer::StartDataSource(DataSourceInstanceID id,
 }
 
 UnwindingWorker& HeapprofdProducer::UnwinderForPID(pid_t pid) {
+  auto it = unwinder_for_pid_.find(pid);
+  if (it != unwinder_for_pid_.end())
+    return unwinding_workers_[it->second];
   return unwinding_workers_[static_cast<uint64_t>(pid) % kUnwinderThreads];
 }
 
+UnwindingWorker& HeapprofdProducer::AssignUnwinder(pid_t pid) {
+  // Rather than by pid, clients go to the worker with the fewest clients
+  // and queued unwinds, so that a worker doesn't end up with all the busy
+  // clients while the others are idle.
+  size_t best = static_cast<uint64_t>(pid) % kUnwinderThreads;
+  size_t best_load = unwinding_workers_[best].load();
+  for (size_t i = 0; i < unwinding_workers_.size(); ++i) {
+    size_t load = unwinding_workers_[i].load();
+    if (load < best_load) {
+      best = i;
+      best_load = load;
+    }
+  }
+  unwinder_for_pid_[pid] = best;
+  unwind_cache_reset_ = false;
+  return unwinding_workers_[best];
+}
+
 void HeapprofdProducer::StopDataSource(DataSourceInstanceID id) {
   auto it = data_sources_.find(id);
   if (it == data_sources_.end()) {
@@ -622,6 +662,7 @@ void HeapprofdProducer::ShutdownDataSource(DataSource* data_source) {
           for (const auto& pid_and_process_state : ds.process_states) {
             pid_t pid = pid_and_process_state.first;
             weak_producer->UnwinderForPID(pid).PostPurgeProcess(pid);
+            weak_producer->unwinder_for_pid_.erase(pid);
           }
           // Do not dump any stragglers, just trigger the Flush and tear down
           // the data source.
@@ -714,9 +755,11 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
 
     bool from_startup = data_source->signaled_pids.find(pid) ==
                         data_source->signaled_pids.cend();
+    bool incremental =
+        data_source->config.continuous_dump_config().incremental();
 
-    auto new_heapsamples = [pid, from_startup, process_state, data_source,
-                            &heap_info](
+    auto new_heapsamples = [pid, from_startup, incremental, process_state,
+                            data_source, &heap_info](
                                ProfilePacket::ProcessHeapSamples* proto) {
       proto->set_pid(static_cast<uint64_t>(pid));
       proto->set_timestamp(heap_info.heap_tracker.dump_timestamp());
@@ -731,6 +774,8 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
         proto->set_heap_name(heap_info.heap_name.c_str());
       proto->set_sampling_interval_bytes(heap_info.sampling_interval);
       proto->set_orig_sampling_interval_bytes(heap_info.orig_sampling_interval);
+      if (incremental)
+        proto->set_incremental(true);
       auto* stats = proto->set_stats();
       SetStats(stats, *process_state);
     };
@@ -743,7 +788,12 @@ void HeapprofdProducer::DumpProcessState(DataSource* data_source,
         [&dump_state,
          &data_source](const HeapTracker::CallstackAllocations& alloc) {
           dump_state.WriteAllocation(alloc, data_source->config.dump_at_max());
-        });
+        },
+        incremental);
+    // Incremental dumps still report the stats and errors of the process if
+    // none of its callstacks changed.
+    if (incremental)
+      dump_state.WriteProcessHeader();
     dump_state.DumpCallstacks(&callsites_);
   }
 }
@@ -905,8 +955,10 @@ void HeapprofdProducer::SocketDelegate::OnDataAvailable(
     handoff_data.shmem = std::move(pending_process.shmem);
     handoff_data.client_config = data_source.client_configuration;
     handoff_data.stream_allocations = data_source.config.stream_allocations();
+    handoff_data.frame_pointer_unwinding =
+        data_source.config.frame_pointer_unwinding();
 
-    producer_->UnwinderForPID(self->peer_pid_linux())
+    producer_->AssignUnwinder(self->peer_pid_linux())
         .PostHandoffSocket(std::move(handoff_data));
     producer_->pending_processes_.erase(it);
   } else if (fds[kHandshakeMaps] || fds[kHandshakeMem]) {
@@ -1237,6 +1289,7 @@ void HeapprofdProducer::HandleSocketDisconnected(
 
   DumpProcessState(&ds, pid, &process_state);
   ds.process_states.erase(pid);
+  unwinder_for_pid_.erase(pid);
   MaybeFinishDataSource(&ds);
 }
 
@@ -1282,6 +1335,27 @@ void HeapprofdProducer::CheckDataSourceMemoryTask() {
       ShutdownDataSource(&ds);
     }
   }
+  MaybeResetUnwindCache(gr);
+}
+
+void HeapprofdProducer::MaybeResetUnwindCache(
+    const ProfilerMemoryGuardrails& gr) {
+  // libunwindstack does not bound its cache, which keeps the ELF files of
+  // processes long gone. It can only be reset while no worker unwinds.
+  std::optional<uint32_t> anon_and_swap_kb = gr.anon_and_swap_kb();
+  if (unwind_cache_reset_ || !anon_and_swap_kb ||
+      *anon_and_swap_kb <= kUnwindCacheMemoryLimitKb) {
+    return;
+  }
+  for (const UnwindingWorker& worker : unwinding_workers_) {
+    if (worker.load() > 0)
+      return;
+  }
+  PERFETTO_LOG("Dropping unwinding cache (%" PRIu32 " kB used).",
+               *anon_and_swap_kb);
+  ResetAndEnableUnwindstackCache();
+  base::MaybeReleaseAllocatorMemToOS();
+  unwind_cache_reset_ = true;
 }
 
 }  // namespace profiling
@@ -258,6 +258,7 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   void IncreaseConnectionBackoff();
 
   void CheckDataSourceMemoryTask();
+  void MaybeResetUnwindCache(const ProfilerMemoryGuardrails&);
   void CheckDataSourceCpuTask();
 
   void FinishDataSourceFlush(FlushRequestID flush_id);
@@ -271,6 +272,7 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   void DrainDone(DataSourceInstanceID);
 
   UnwindingWorker& UnwinderForPID(pid_t);
+  UnwindingWorker& AssignUnwinder(pid_t);
   bool IsPidProfiled(pid_t);
   DataSource* GetDataSourceForProcess(const Process& proc);
   void RecordOtherSourcesAsRejected(DataSource* active_ds, const Process& proc);
@@ -318,6 +320,10 @@ class HeapprofdProducer : public Producer, public UnwindingWorker::Delegate {
   SystemProperties properties_;
 
   std::map<FlushRequestID, size_t> flushes_in_progress_;
+  // The index in |unwinding_workers_| of the worker of each connected client.
+  std::map<pid_t, size_t> unwinder_for_pid_;
+  // Whether the unwinding cache was dropped since the last handoff.
+  bool unwind_cache_reset_ = false;
   std::map<DataSourceInstanceID, DataSource> data_sources_;
 
   // Specific to mode_ == kChild
@@ -39,13 +39,38 @@ std::default_random_engine& GetGlobalRandomEngineLocked();
 // https://cs.chromium.org/search/?q=f:cc+symbol:AllocatorShimLogAlloc+package:%5Echromium$&type=cs
 // Googlers: see go/chrome-shp for more details.
 //
-// NB: not thread-safe, requires external synchronization.
+// NB: not thread-safe, requires external synchronization. The exception is
+// SkipWithoutLock, which can be called concurrently with the other methods.
 class Sampler {
  public:
   void SetSamplingInterval(uint64_t sampling_interval) {
-    sampling_interval_ = sampling_interval;
-    sampling_rate_ = 1.0 / static_cast<double>(sampling_interval_);
-    interval_to_next_sample_ = NextSampleInterval();
+    sampling_interval_.store(sampling_interval, std::memory_order_relaxed);
+    sampling_rate_ = 1.0 / static_cast<double>(sampling_interval);
+    interval_to_next_sample_.store(NextSampleInterval(),
+                                   std::memory_order_relaxed);
+  }
+
+  // Fast path for the allocations that do not contain a sampled byte, which
+  // are the vast majority. Returns true, and accounts the allocation, if it
+  // should not be sampled. Otherwise SampleSize needs to be called.
+  //
+  // This does not need the external lock, and does not draw random numbers:
+  // it only counts down the bytes to the next sample. Allocations that reach
+  // the next sample are left to SampleSize, so that each sample is attributed
+  // to exactly one allocation.
+  bool SkipWithoutLock(size_t alloc_sz) {
+    if (PERFETTO_UNLIKELY(alloc_sz >=
+                          sampling_interval_.load(std::memory_order_relaxed)))
+      return false;
+    int64_t sz = static_cast<int64_t>(alloc_sz);
+    int64_t next = interval_to_next_sample_.load(std::memory_order_relaxed);
+    while (next > sz) {
+      if (interval_to_next_sample_.compare_exchange_weak(
+              next, next - sz, std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
   }
 
   // Returns number of bytes that should be be attributed to the sample.
@@ -54,12 +79,15 @@ class Sampler {
   // Due to how the poission sampling works, some samples should be accounted
   // multiple times.
   size_t SampleSize(size_t alloc_sz) {
-    if (PERFETTO_UNLIKELY(alloc_sz >= sampling_interval_))
+    uint64_t sampling_interval = this->sampling_interval();
+    if (PERFETTO_UNLIKELY(alloc_sz >= sampling_interval))
       return alloc_sz;
-    return static_cast<size_t>(sampling_interval_ * NumberOfSamples(alloc_sz));
+    return static_cast<size_t>(sampling_interval * NumberOfSamples(alloc_sz));
   }
 
-  uint64_t sampling_interval() const { return sampling_interval_; }
+  uint64_t sampling_interval() const {
+    return sampling_interval_.load(std::memory_order_relaxed);
+  }
 
  private:
   int64_t NextSampleInterval() {
@@ -75,18 +103,24 @@ class Sampler {
   // Returns number of times a sample should be accounted. Due to how the
   // poission sampling works, some samples should be accounted multiple times.
   size_t NumberOfSamples(size_t alloc_sz) {
-    interval_to_next_sample_ -= alloc_sz;
+    int64_t sz = static_cast<int64_t>(alloc_sz);
+    int64_t next =
+        interval_to_next_sample_.fetch_sub(sz, std::memory_order_relaxed) - sz;
     size_t num_samples = 0;
-    while (PERFETTO_UNLIKELY(interval_to_next_sample_ <= 0)) {
-      interval_to_next_sample_ += NextSampleInterval();
+    while (PERFETTO_UNLIKELY(next <= 0)) {
+      int64_t interval = NextSampleInterval();
+      next = interval_to_next_sample_.fetch_add(interval,
+                                                std::memory_order_relaxed) +
+             interval;
       ++num_samples;
     }
     return num_samples;
   }
 
-  uint64_t sampling_interval_;
-  double sampling_rate_;
-  int64_t interval_to_next_sample_;
+  // Until SetSamplingInterval is called, SkipWithoutLock never skips.
+  std::atomic<uint64_t> sampling_interval_{0};
+  double sampling_rate_ = 0;
+  std::atomic<int64_t> interval_to_next_sample_{0};
 };
 
 }  // namespace profiling
@@ -16,7 +16,9 @@
 
 #include "src/profiling/memory/sampler.h"
 
+#include <mutex>
 #include <thread>
+#include <vector>
 
 #include "test/gtest_and_gmock.h"
 
@@ -47,6 +49,55 @@ TEST(SamplerTest, TestSequence) {
   EXPECT_EQ(sampler.SampleSize(5), 5u);
 }
 
+TEST(SamplerTest, SkipWithoutLockLarge) {
+  GetGlobalRandomEngineLocked().seed(1);
+  Sampler sampler;
+  EXPECT_FALSE(sampler.SkipWithoutLock(1));
+  sampler.SetSamplingInterval(512);
+  EXPECT_FALSE(sampler.SkipWithoutLock(512));
+  EXPECT_EQ(sampler.SampleSize(512), 512u);
+}
+
+TEST(SamplerTest, SkipWithoutLockUntilSample) {
+  GetGlobalRandomEngineLocked().seed(1);
+  Sampler sampler;
+  sampler.SetSamplingInterval(4096);
+  size_t skipped = 0;
+  while (sampler.SkipWithoutLock(1))
+    skipped++;
+  EXPECT_GT(skipped, 0u);
+  EXPECT_EQ(sampler.SampleSize(1), 4096u);
+}
+
+// Samples the same number of bytes, on average, whichever thread makes the
+// allocations.
+TEST(SamplerTest, SkipWithoutLockMultiThreaded) {
+  constexpr uint64_t kInterval = 1024;
+  constexpr size_t kThreads = 4;
+  constexpr size_t kAllocsPerThread = 100000;
+  constexpr size_t kAllocSize = 32;
+  GetGlobalRandomEngineLocked().seed(1);
+  Sampler sampler;
+  sampler.SetSamplingInterval(kInterval);
+  std::mutex mutex;
+  uint64_t sampled = 0;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreads; ++i) {
+    threads.emplace_back([&] {
+      for (size_t j = 0; j < kAllocsPerThread; ++j) {
+        if (sampler.SkipWithoutLock(kAllocSize))
+          continue;
+        std::lock_guard<std::mutex> lock(mutex);
+        sampled += sampler.SampleSize(kAllocSize);
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+  double allocated = kThreads * kAllocsPerThread * kAllocSize;
+  EXPECT_NEAR(static_cast<double>(sampled) / allocated, 1.0, 0.05);
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -18,6 +18,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -52,6 +53,12 @@ size_t meta_page_size() {
   return base::GetSysPageSize();
 }
 
+// Stats updated by concurrent lock-free writers.
+void IncrementStat(uint64_t* stat, uint64_t n) {
+  reinterpret_cast<std::atomic<uint64_t>*>(stat)->fetch_add(
+      n, std::memory_order_relaxed);
+}
+
 }  // namespace
 
 SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
@@ -95,6 +102,8 @@ SharedRingBuffer::SharedRingBuffer(CreateFlag, size_t size) {
     return;
 
   new (meta_) MetadataPage();
+  // EndRead() clears the records, so the writers can do without the lock.
+  meta_->lock_free_writes.store(true, std::memory_order_relaxed);
 }
 
 SharedRingBuffer::~SharedRingBuffer() {
@@ -233,6 +242,55 @@ SharedRingBuffer::Buffer SharedRingBuffer::BeginWrite(
   return result;
 }
 
+SharedRingBuffer::Buffer SharedRingBuffer::BeginWriteLockFree(size_t size) {
+  PERFETTO_DCHECK(lock_free_writes());
+  Buffer result;
+
+  const uint64_t size_with_header =
+      base::AlignUp<kAlignment>(size + kHeaderSize);
+
+  // size_with_header < size is for catching overflow of size_with_header.
+  if (PERFETTO_UNLIKELY(size_with_header < size)) {
+    errno = EINVAL;
+    return result;
+  }
+
+  PointerPositions pos;
+  for (;;) {
+    // read_pos needs to be loaded first, otherwise it can overtake the local
+    // copy of write_pos. The acquire load makes sure the reader's clearing
+    // of the records up to read_pos is visible before the space is reused.
+    //
+    // This is matched by the release in EndRead.
+    pos.read_pos = meta_->read_pos.load(std::memory_order_acquire);
+    pos.write_pos = meta_->write_pos.load(std::memory_order_relaxed);
+    if (IsCorrupt(pos)) {
+      IncrementStat(&meta_->stats.num_writes_corrupt, 1);
+      errno = EBADF;
+      return result;
+    }
+    if (size_with_header > write_avail(pos)) {
+      IncrementStat(&meta_->stats.num_writes_overflow, 1);
+      errno = EAGAIN;
+      return result;
+    }
+    // The header of the record is already zero, so the reader stops at it
+    // until EndWrite.
+    if (meta_->write_pos.compare_exchange_weak(
+            pos.write_pos, pos.write_pos + size_with_header,
+            std::memory_order_release, std::memory_order_relaxed)) {
+      break;
+    }
+  }
+
+  result.size = size;
+  result.data = at(pos.write_pos) + kHeaderSize;
+  result.bytes_free = write_avail(pos);
+  IncrementStat(&meta_->stats.bytes_written, size);
+  IncrementStat(&meta_->stats.num_writes_succeeded, 1);
+  return result;
+}
+
 void SharedRingBuffer::EndWrite(Buffer buf) {
   if (!buf)
     return;
@@ -295,7 +353,11 @@ size_t SharedRingBuffer::EndRead(Buffer buf) {
   if (!buf)
     return 0;
   size_t size_with_header = base::AlignUp<kAlignment>(buf.size + kHeaderSize);
-  meta_->read_pos.fetch_add(size_with_header, std::memory_order_relaxed);
+  // Clear the record, for the lock-free writers that reuse the space to find
+  // zero headers (see BeginWriteLockFree).
+  memset(buf.data - kHeaderSize, 0, size_with_header);
+  // This is matched by the acquire load in BeginWriteLockFree.
+  meta_->read_pos.fetch_add(size_with_header, std::memory_order_release);
   meta_->stats.num_reads_succeeded++;
   return size_with_header;
 }
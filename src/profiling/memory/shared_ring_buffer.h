@@ -52,6 +52,12 @@ namespace profiling {
 // meantime.
 // !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 //
+// Writers either reserve space under the spin-lock (BeginWrite), or, if the
+// buffer was created with lock_free_writes(), with a compare-and-swap of the
+// write position (BeginWriteLockFree). The latter relies on the reader
+// clearing the records it consumed, so that the header of a record that is
+// reserved but not yet written is always zero.
+//
 // TODO:
 // - Write a benchmark.
 class SharedRingBuffer {
@@ -123,8 +129,21 @@ class SharedRingBuffer {
   }
 
   Buffer BeginWrite(const ScopedSpinlock& spinlock, size_t size);
+  // Same as BeginWrite, but without the spin-lock. Only valid if
+  // lock_free_writes().
+  Buffer BeginWriteLockFree(size_t size);
   void EndWrite(Buffer buf);
 
+  // Set for buffers created by this version of the reader, which clears the
+  // records it consumed. Writers must use the spin-lock otherwise.
+  bool lock_free_writes() {
+    return meta_->lock_free_writes.load(std::memory_order_relaxed);
+  }
+
+  void SetLockFreeWritesForTesting(bool enabled) {
+    meta_->lock_free_writes.store(enabled, std::memory_order_relaxed);
+  }
+
   Buffer BeginRead();
   // Returns the number bytes read from the shared memory buffer. This is
   // different than the number of bytes returned in the Buffer, because it
@@ -203,9 +222,12 @@ class SharedRingBuffer {
     // When the user requests stats, the atomics above get copied into this
     // struct, which is then returned.
     alignas(sizeof(uint64_t)) Stats stats;
+    // Appended to keep the layout above compatible across versions of the
+    // client and heapprofd. Older readers leave it unset.
+    alignas(sizeof(uint64_t)) std::atomic<bool> lock_free_writes;
   };
 
-  static_assert(sizeof(MetadataPage) == 144,
+  static_assert(sizeof(MetadataPage) == 152,
                 "metadata page size needs to be ABI independent");
 
  private:
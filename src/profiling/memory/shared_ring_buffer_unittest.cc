@@ -36,7 +36,9 @@ std::string ToString(const SharedRingBuffer::Buffer& buf_and_size) {
 
 bool TryWrite(SharedRingBuffer* wr, const char* src, size_t size) {
   SharedRingBuffer::Buffer buf;
-  {
+  if (wr->lock_free_writes()) {
+    buf = wr->BeginWriteLockFree(size);
+  } else {
     auto lock = wr->AcquireLock(ScopedSpinlock::Mode::Try);
     if (!lock.locked())
       return false;
@@ -186,11 +188,37 @@ TEST(SharedRingBufferTest, SingleThreadAttach) {
   StructuredTest(&*buf1, &*buf2);
 }
 
-TEST(SharedRingBufferTest, MultiThreadingTest) {
+TEST(SharedRingBufferTest, SingleThreadLocked) {
+  const size_t kBufSize = base::GetSysPageSize() * 4;
+  std::optional<SharedRingBuffer> buf1 = SharedRingBuffer::Create(kBufSize);
+  std::optional<SharedRingBuffer> buf2 =
+      SharedRingBuffer::Attach(base::ScopedFile(dup(buf1->fd())));
+  buf1->SetLockFreeWritesForTesting(false);
+  ASSERT_FALSE(buf2->lock_free_writes());
+  StructuredTest(&*buf1, &*buf2);
+}
+
+TEST(SharedRingBufferTest, ReadClearsRecord) {
+  const size_t kBufSize = base::GetSysPageSize() * 4;
+  std::optional<SharedRingBuffer> buf = SharedRingBuffer::Create(kBufSize);
+  ASSERT_TRUE(buf);
+  ASSERT_TRUE(buf->lock_free_writes());
+  ASSERT_TRUE(TryWrite(&*buf, "foobar", 7));
+
+  auto read_buf = buf->BeginRead();
+  ASSERT_EQ(ToString(read_buf), std::string("foobar", 7));
+  const uint8_t* record = read_buf.data - sizeof(uint64_t);
+  buf->EndRead(std::move(read_buf));
+  for (size_t i = 0; i < 2 * sizeof(uint64_t); ++i)
+    EXPECT_EQ(record[i], 0u) << i;
+}
+
+void RunMultiThreadingTest(bool lock_free) {
   const size_t kBufSize = base::GetSysPageSize() * 1024;  // 4 MB
   SharedRingBuffer rd = *SharedRingBuffer::Create(kBufSize);
   SharedRingBuffer wr =
       *SharedRingBuffer::Attach(base::ScopedFile(dup(rd.fd())));
+  rd.SetLockFreeWritesForTesting(lock_free);
 
   std::mutex mutex;
   std::unordered_map<std::string, int64_t> expected_contents;
@@ -252,6 +280,16 @@ TEST(SharedRingBufferTest, MultiThreadingTest) {
   writers_enabled.store(false);
 
   reader_thread.join();
+  for (const auto& content_and_count : expected_contents)
+    EXPECT_EQ(content_and_count.second, 0);
+}
+
+TEST(SharedRingBufferTest, MultiThreadingTest) {
+  RunMultiThreadingTest(/*lock_free=*/true);
+}
+
+TEST(SharedRingBufferTest, MultiThreadingTestLocked) {
+  RunMultiThreadingTest(/*lock_free=*/false);
 }
 
 TEST(SharedRingBufferTest, InvalidSize) {
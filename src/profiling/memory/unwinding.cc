@@ -63,13 +63,27 @@ constexpr uint32_t kRetryDelayMs = 100;
 
 constexpr size_t kMaxFrames = 500;
 
-// We assume average ~300us per unwind. If we handle up to 1000 unwinds, this
-// makes sure other tasks get to be run at least every 300ms if the unwinding
-// saturates this thread.
-constexpr size_t kUnwindBatchSize = 1000;
+// We assume average ~300us per unwind. The number of unwinds handled by a
+// task grows with the fill level of the buffer of the client, from
+// kMinUnwindBatchSize for a buffer with little data up to kMaxUnwindBatchSize
+// for a full one. This makes sure other tasks get to be run at least every
+// 600ms if the unwinding saturates this thread, while the clients which write
+// the most are drained in fewer, larger batches.
+constexpr size_t kMinUnwindBatchSize = 250;
+constexpr size_t kMaxUnwindBatchSize = 2000;
+constexpr size_t kSocketRecvBufSize = 1000;
 constexpr size_t kRecordBatchSize = 1024;
 constexpr size_t kMaxAllocRecordArenaSize = 2 * kRecordBatchSize;
 
+// The allocations of a client are unwound by the peers of its worker too once
+// the backlog of its buffer exceeds 1/kOffloadBacklogDivisor of the buffer,
+// as long as a peer has fewer than kMaxQueuedUnwinds allocations queued.
+// The limit bounds the memory used by the copies of the queued allocations.
+constexpr size_t kOffloadBacklogDivisor = 8;
+constexpr size_t kMaxQueuedUnwinds = 64;
+
+std::atomic<uint64_t> g_next_client_id{1};
+
 #pragma GCC diagnostic push
 // We do not care about deterministic destructor order.
 #pragma GCC diagnostic ignored "-Wglobal-constructors"
@@ -88,6 +102,28 @@ void ReadFromRawData(unwindstack::Regs* regs, void* raw_data) {
   memcpy(regs->RawData(), raw_data, GetRegsSize(regs));
 }
 
+std::unique_ptr<AllocRecord> UnwindAlloc(AllocRecordArena* alloc_record_arena,
+                                         WireMessage* msg,
+                                         UnwindingMetadata* metadata,
+                                         pid_t peer_pid,
+                                         DataSourceInstanceID ds_id,
+                                         bool stream_allocations) {
+  std::unique_ptr<AllocRecord> rec = alloc_record_arena->BorrowAllocRecord();
+  rec->alloc_metadata = *msg->alloc_header;
+  rec->pid = peer_pid;
+  rec->data_source_instance_id = ds_id;
+  auto start_time_us = base::GetWallTimeNs() / 1000;
+  if (!stream_allocations)
+    DoUnwind(msg, metadata, rec.get());
+  rec->unwinding_time_us = static_cast<uint64_t>(
+      ((base::GetWallTimeNs() / 1000) - start_time_us).count());
+  return rec;
+}
+
+base::ScopedFile Dup(const base::ScopedFile& fd) {
+  return base::ScopedFile(fd ? dup(*fd) : -1);
+}
+
 }  // namespace
 
 std::unique_ptr<unwindstack::Regs> CreateRegsFromRawData(
@@ -149,7 +185,12 @@ bool DoUnwind(WireMessage* msg, UnwindingMetadata* metadata, AllocRecord* out) {
   // Suppress incorrect "variable may be uninitialized" error for if condition
   // after this loop. error_code = LastErrorCode gets run at least once.
   unwindstack::ErrorCode error_code = unwindstack::ERROR_NONE;
-  for (int attempt = 0; attempt < 2; ++attempt) {
+  // Only fall back to DWARF if the frame pointers are unusable.
+  bool unwound = metadata->frame_pointer_unwinding &&
+                 UnwindFramePointers(&unwinder, regs.get(), stack,
+                                     msg->payload_size, kMaxFrames, &kSkipMaps,
+                                     &out->frames);
+  for (int attempt = 0; !unwound && attempt < 2; ++attempt) {
     if (attempt > 0) {
       if (metadata->last_maps_reparse_time + kMapsReparseInterval >
           base::GetWallTimeMs()) {
@@ -199,17 +240,24 @@ UnwindingWorker::~UnwindingWorker() {
   if (thread_task_runner_.get() == nullptr) {
     return;
   }
-  std::mutex mutex;
-  std::condition_variable cv;
-
-  std::unique_lock<std::mutex> lock(mutex);
-  bool done = false;
-  thread_task_runner_.PostTask([&mutex, &cv, &done, this] {
+  PostTaskAndWait([this] {
     for (auto& it : client_data_) {
       auto& client_data = it.second;
       client_data.sock->Shutdown(false);
     }
     client_data_.clear();
+    offloaded_metadata_.clear();
+  });
+}
+
+void UnwindingWorker::PostTaskAndWait(std::function<void()> fn) {
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  bool done = false;
+  thread_task_runner_.PostTask([&mutex, &cv, &done, &fn] {
+    fn();
 
     std::lock_guard<std::mutex> inner_lock(mutex);
     done = true;
@@ -218,6 +266,26 @@ UnwindingWorker::~UnwindingWorker() {
   cv.wait(lock, [&done] { return done; });
 }
 
+void UnwindingWorker::SetPeers(std::vector<UnwindingWorker*> peers) {
+  PostTaskAndWait([this, &peers] {
+    PERFETTO_DCHECK(client_data_.empty());
+    peers_.clear();
+    for (UnwindingWorker* peer : peers) {
+      if (peer != this)
+        peers_.push_back(peer);
+    }
+  });
+}
+
+void UnwindingWorker::DetachPeers() {
+  if (thread_task_runner_.get() == nullptr)
+    return;
+  PostTaskAndWait([this] {
+    peers_.clear();
+    offloaded_metadata_.clear();
+  });
+}
+
 void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
   pid_t peer_pid = self->peer_pid_linux();
   auto it = client_data_.find(peer_pid);
@@ -239,8 +307,23 @@ void UnwindingWorker::OnDisconnect(base::UnixSocket* self) {
 
 void UnwindingWorker::RemoveClientData(
     std::map<pid_t, ClientData>::iterator client_data_iterator) {
+  uint64_t client_id = client_data_iterator->second.client_id;
+  // The peers only received allocations if they are still attached.
+  if (!peers_.empty()) {
+    for (UnwindingWorker* peer : client_data_iterator->second.peers) {
+      peer->thread_task_runner_.get()->PostTask(
+          [peer, client_id] { peer->HandleDropOffloadedClient(client_id); });
+    }
+  }
+  // Run what still waits for the peers, e.g. to acknowledge a drain. The
+  // functions tolerate the client being gone.
+  std::deque<Barrier> barriers =
+      std::move(client_data_iterator->second.barriers);
   client_data_.erase(client_data_iterator);
-  if (client_data_.empty()) {
+  load_->clients.fetch_sub(1, std::memory_order_release);
+  for (Barrier& barrier : barriers)
+    barrier.fn();
+  if (client_data_.empty() && offloaded_metadata_.empty()) {
     // We got rid of the last client. Flush and destruct AllocRecords in
     // arena. Disable the arena (will not accept returning borrowed records)
     // in case there are pending AllocRecords on the main thread.
@@ -254,6 +337,18 @@ void UnwindingWorker::FinishDisconnect(
   ClientData& client_data = client_data_iterator->second;
   SharedRingBuffer& shmem = client_data.shmem;
 
+  // The final dump must include the allocations being unwound by the peers.
+  if (HasOffloadedUnwinds(client_data)) {
+    uint64_t client_id = client_data.client_id;
+    RunAfterOffloadedUnwinds(
+        peer_pid, &client_data, [this, peer_pid, client_id] {
+          auto it = client_data_.find(peer_pid);
+          if (it != client_data_.end() && it->second.client_id == client_id)
+            FinishDisconnect(it);
+        });
+    return;
+  }
+
   if (!client_data.free_records.empty()) {
     delegate_->PostFreeRecord(this, std::move(client_data.free_records));
   }
@@ -274,7 +369,7 @@ void UnwindingWorker::FinishDisconnect(
 
 void UnwindingWorker::OnDataAvailable(base::UnixSocket* self) {
   // Drain buffer to clear the notification.
-  char recv_buf[kUnwindBatchSize];
+  char recv_buf[kSocketRecvBufSize];
   self->Receive(recv_buf, sizeof(recv_buf));
   BatchUnwindJob(self->peer_pid_linux());
 }
@@ -285,14 +380,22 @@ UnwindingWorker::ReadAndUnwindBatchResult UnwindingWorker::ReadAndUnwindBatch(
   SharedRingBuffer::Buffer buf;
   ReadAndUnwindBatchResult res;
 
+  pid_t peer_pid = client_data->sock->peer_pid_linux();
+  // If the client writes faster than this worker unwinds, share its
+  // allocations with the peers.
+  bool offload = !peers_.empty() && !client_data->stream_allocations &&
+                 shmem.read_avail() >= shmem.size() / kOffloadBacklogDivisor;
+  size_t batch_size = UnwindBatchSize(shmem.read_avail(), shmem.size());
   size_t i;
-  for (i = 0; i < kUnwindBatchSize; ++i) {
+  for (i = 0; i < batch_size; ++i) {
     uint64_t reparses_before = client_data->metadata.reparses;
     buf = shmem.BeginRead();
     if (!buf)
       break;
-    HandleBuffer(this, &alloc_record_arena_, buf, client_data,
-                 client_data->sock->peer_pid_linux(), delegate_);
+    if (!offload || !MaybeOffloadUnwind(buf, client_data, peer_pid)) {
+      HandleBuffer(this, &alloc_record_arena_, buf, client_data, peer_pid,
+                   delegate_);
+    }
     res.bytes_read += shmem.EndRead(std::move(buf));
     // Reparsing takes time, so process the rest in a new batch to avoid timing
     // out.
@@ -302,7 +405,7 @@ UnwindingWorker::ReadAndUnwindBatchResult UnwindingWorker::ReadAndUnwindBatch(
     }
   }
 
-  if (i == kUnwindBatchSize) {
+  if (i == batch_size) {
     res.status = ReadAndUnwindBatchResult::Status::kHasMore;
   } else if (i > 0) {
     res.status = ReadAndUnwindBatchResult::Status::kReadSome;
@@ -385,6 +488,17 @@ void UnwindingWorker::DrainJob(pid_t peer_pid) {
   FinishDisconnect(it);
 }
 
+// static
+size_t UnwindingWorker::UnwindBatchSize(size_t read_avail,
+                                        size_t buffer_size) {
+  if (buffer_size == 0 || read_avail >= buffer_size)
+    return kMaxUnwindBatchSize;
+  // Scale in 64 steps to avoid overflowing on large buffers.
+  size_t fill_64ths = read_avail / (buffer_size / 64 + 1);
+  return kMinUnwindBatchSize +
+         (kMaxUnwindBatchSize - kMinUnwindBatchSize) * fill_64ths / 64;
+}
+
 // static
 void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
                                    AllocRecordArena* alloc_record_arena,
@@ -405,16 +519,10 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
   }
 
   if (msg.record_type == RecordType::Malloc) {
-    std::unique_ptr<AllocRecord> rec = alloc_record_arena->BorrowAllocRecord();
-    rec->alloc_metadata = *msg.alloc_header;
-    rec->pid = peer_pid;
-    rec->data_source_instance_id = data_source_instance_id;
-    auto start_time_us = base::GetWallTimeNs() / 1000;
-    if (!client_data->stream_allocations)
-      DoUnwind(&msg, unwinding_metadata, rec.get());
-    rec->unwinding_time_us = static_cast<uint64_t>(
-        ((base::GetWallTimeNs() / 1000) - start_time_us).count());
-    delegate->PostAllocRecord(self, std::move(rec));
+    delegate->PostAllocRecord(
+        self, UnwindAlloc(alloc_record_arena, &msg, unwinding_metadata,
+                          peer_pid, data_source_instance_id,
+                          client_data->stream_allocations));
   } else if (msg.record_type == RecordType::Free) {
     FreeRecord rec;
     rec.pid = peer_pid;
@@ -422,11 +530,8 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
     // We need to copy this, so we can return the memory to the shmem buffer.
     memcpy(&rec.entry, msg.free_header, sizeof(*msg.free_header));
     client_data->free_records.emplace_back(std::move(rec));
-    if (client_data->free_records.size() == kRecordBatchSize) {
-      delegate->PostFreeRecord(self, std::move(client_data->free_records));
-      client_data->free_records.clear();
-      client_data->free_records.reserve(kRecordBatchSize);
-    }
+    if (client_data->free_records.size() == kRecordBatchSize)
+      FlushFreeRecords(self, delegate, peer_pid, client_data);
   } else if (msg.record_type == RecordType::HeapName) {
     HeapNameRecord rec;
     rec.pid = peer_pid;
@@ -442,6 +547,7 @@ void UnwindingWorker::HandleBuffer(UnwindingWorker* self,
 void UnwindingWorker::PostHandoffSocket(HandoffData handoff_data) {
   // Even with C++14, this cannot be moved, as std::function has to be
   // copyable, which HandoffData is not.
+  load_->clients.fetch_add(1, std::memory_order_relaxed);
   HandoffData* raw_data = new HandoffData(std::move(handoff_data));
   // We do not need to use a WeakPtr here because the task runner will not
   // outlive its UnwindingWorker.
@@ -458,8 +564,15 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       base::SockFamily::kUnix, base::SockType::kStream);
   pid_t peer_pid = sock->peer_pid_linux();
 
+  std::shared_ptr<ClientFds> fds;
+  if (!peers_.empty()) {
+    fds = std::make_shared<ClientFds>();
+    fds->maps_fd = Dup(handoff_data.maps_fd);
+    fds->mem_fd = Dup(handoff_data.mem_fd);
+  }
   UnwindingMetadata metadata(std::move(handoff_data.maps_fd),
                              std::move(handoff_data.mem_fd));
+  metadata.frame_pointer_unwinding = handoff_data.frame_pointer_unwinding;
   ClientData client_data{
       handoff_data.data_source_instance_id,
       std::move(sock),
@@ -469,6 +582,12 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
       handoff_data.stream_allocations,
       /*drain_bytes=*/0,
       /*free_records=*/{},
+      /*client_id=*/g_next_client_id.fetch_add(1),
+      std::move(fds),
+      /*peers_since_barrier=*/{},
+      /*peers=*/{},
+      /*barriers=*/{},
+      /*next_barrier_id=*/0,
   };
   client_data.free_records.reserve(kRecordBatchSize);
   client_data.shmem.SetReaderPaused();
@@ -478,16 +597,192 @@ void UnwindingWorker::HandleHandoffSocket(HandoffData handoff_data) {
 
 void UnwindingWorker::HandleDrainFree(DataSourceInstanceID ds_id, pid_t pid) {
   auto it = client_data_.find(pid);
-  if (it != client_data_.end()) {
-    ClientData& client_data = it->second;
+  if (it == client_data_.end()) {
+    delegate_->PostDrainDone(this, ds_id);
+    return;
+  }
+  // The dump that follows must include the allocations being unwound by the
+  // peers.
+  uint64_t client_id = it->second.client_id;
+  RunAfterOffloadedUnwinds(pid, &it->second, [this, ds_id, pid, client_id] {
+    auto client_it = client_data_.find(pid);
+    if (client_it != client_data_.end() &&
+        client_it->second.client_id == client_id) {
+      ClientData& client_data = client_it->second;
+      if (!client_data.free_records.empty()) {
+        delegate_->PostFreeRecord(this, std::move(client_data.free_records));
+        client_data.free_records.clear();
+        client_data.free_records.reserve(kRecordBatchSize);
+      }
+    }
+    delegate_->PostDrainDone(this, ds_id);
+  });
+}
+
+// static
+void UnwindingWorker::FlushFreeRecords(UnwindingWorker* self,
+                                       Delegate* delegate,
+                                       pid_t peer_pid,
+                                       ClientData* client_data) {
+  std::vector<FreeRecord> free_records = std::move(client_data->free_records);
+  client_data->free_records.clear();
+  client_data->free_records.reserve(kRecordBatchSize);
+  if (!self) {
+    delegate->PostFreeRecord(self, std::move(free_records));
+    return;
+  }
+  self->RunAfterOffloadedUnwinds(
+      peer_pid, client_data,
+      [self, delegate, free_records = std::move(free_records)]() mutable {
+        delegate->PostFreeRecord(self, std::move(free_records));
+      });
+}
 
-    if (!client_data.free_records.empty()) {
-      delegate_->PostFreeRecord(this, std::move(client_data.free_records));
-      client_data.free_records.clear();
-      client_data.free_records.reserve(kRecordBatchSize);
+UnwindingWorker* UnwindingWorker::PickPeer() {
+  UnwindingWorker* best = nullptr;
+  size_t best_queued = kMaxQueuedUnwinds;
+  for (UnwindingWorker* peer : peers_) {
+    size_t queued = peer->load_->queued_unwinds.load(std::memory_order_relaxed);
+    if (queued < best_queued) {
+      best = peer;
+      best_queued = queued;
     }
   }
-  delegate_->PostDrainDone(this, ds_id);
+  return best;
+}
+
+bool UnwindingWorker::MaybeOffloadUnwind(const SharedRingBuffer::Buffer& buf,
+                                         ClientData* client_data,
+                                         pid_t peer_pid) {
+  // Only allocations are worth unwinding elsewhere. Frees and heap names
+  // are handled inline, in order.
+  WireMessage msg;
+  if (!client_data->fds ||
+      !ReceiveWireMessage(reinterpret_cast<char*>(buf.data), buf.size,
+                          &msg) ||
+      msg.record_type != RecordType::Malloc) {
+    return false;
+  }
+  UnwindingWorker* peer = PickPeer();
+  if (!peer)
+    return false;
+
+  // The allocation is copied, so that the client can reuse its space in the
+  // buffer right away.
+  auto* job = new OffloadedUnwind();
+  job->client_id = client_data->client_id;
+  job->data_source_instance_id = client_data->data_source_instance_id;
+  job->pid = peer_pid;
+  job->fds = client_data->fds;
+  job->frame_pointer_unwinding = client_data->metadata.frame_pointer_unwinding;
+  job->msg.reset(new uint8_t[buf.size]);
+  memcpy(job->msg.get(), buf.data, buf.size);
+  job->msg_size = buf.size;
+  client_data->peers_since_barrier.insert(peer);
+  client_data->peers.insert(peer);
+  peer->load_->queued_unwinds.fetch_add(1, std::memory_order_relaxed);
+  // As for PostHandoffSocket(), the job cannot be moved into the task.
+  peer->thread_task_runner_.get()->PostTask([peer, job] {
+    peer->HandleOffloadedUnwind(std::unique_ptr<OffloadedUnwind>(job));
+  });
+  return true;
+}
+
+void UnwindingWorker::HandleOffloadedUnwind(
+    std::unique_ptr<OffloadedUnwind> job) {
+  if (!peers_.empty())  // Not detached.
+    UnwindOffloaded(*job);
+  // Only once done, as a worker without load must not be using
+  // libunwindstack (see load()).
+  load_->queued_unwinds.fetch_sub(1, std::memory_order_release);
+}
+
+void UnwindingWorker::UnwindOffloaded(const OffloadedUnwind& job) {
+  WireMessage msg;
+  if (!ReceiveWireMessage(reinterpret_cast<char*>(job.msg.get()),
+                          job.msg_size, &msg)) {
+    PERFETTO_DFATAL_OR_ELOG("Failed to receive offloaded wire message.");
+    return;
+  }
+  auto it = offloaded_metadata_.find(job.client_id);
+  if (it == offloaded_metadata_.end()) {
+    // The maps are parsed with pread(), so sharing the file offset with the
+    // fd of the client's own worker is fine.
+    UnwindingMetadata metadata(Dup(job.fds->maps_fd), Dup(job.fds->mem_fd));
+    metadata.frame_pointer_unwinding = job.frame_pointer_unwinding;
+    it = offloaded_metadata_.emplace(job.client_id, std::move(metadata)).first;
+    alloc_record_arena_.Enable();
+  }
+  delegate_->PostAllocRecord(
+      this, UnwindAlloc(&alloc_record_arena_, &msg, &it->second, job.pid,
+                        job.data_source_instance_id,
+                        /*stream_allocations=*/false));
+}
+
+void UnwindingWorker::HandleDropOffloadedClient(uint64_t client_id) {
+  offloaded_metadata_.erase(client_id);
+  if (client_data_.empty() && offloaded_metadata_.empty())
+    alloc_record_arena_.Disable();
+}
+
+void UnwindingWorker::RunAfterOffloadedUnwinds(pid_t peer_pid,
+                                               ClientData* client_data,
+                                               std::function<void()> fn) {
+  if (!HasOffloadedUnwinds(*client_data)) {
+    fn();
+    return;
+  }
+  uint64_t client_id = client_data->client_id;
+  uint64_t id = client_data->next_barrier_id++;
+  // The tasks of each peer run in order: once the peer runs the task below,
+  // it has posted all the allocations it was sent before.
+  for (UnwindingWorker* peer : client_data->peers_since_barrier) {
+    peer->thread_task_runner_.get()->PostTask(
+        [this, peer, peer_pid, client_id, id] {
+          if (peer->peers_.empty())
+            return;  // Detached.
+          thread_task_runner_.get()->PostTask([this, peer_pid, client_id, id] {
+            HandleBarrierAck(peer_pid, client_id, id);
+          });
+        });
+  }
+  // A barrier without peers still waits for the previous ones, to keep the
+  // order of |fn|s.
+  client_data->barriers.push_back(
+      Barrier{id, client_data->peers_since_barrier.size(), std::move(fn)});
+  client_data->peers_since_barrier.clear();
+}
+
+void UnwindingWorker::HandleBarrierAck(pid_t peer_pid,
+                                       uint64_t client_id,
+                                       uint64_t id) {
+  auto it = client_data_.find(peer_pid);
+  if (it == client_data_.end() || it->second.client_id != client_id)
+    return;
+  for (Barrier& barrier : it->second.barriers) {
+    if (barrier.id == id) {
+      PERFETTO_DCHECK(barrier.pending_acks > 0);
+      barrier.pending_acks--;
+      break;
+    }
+  }
+  RunCompletedBarriers(peer_pid, client_id);
+}
+
+void UnwindingWorker::RunCompletedBarriers(pid_t peer_pid,
+                                           uint64_t client_id) {
+  for (;;) {
+    // Looked up again every time, as |fn| can remove the client.
+    auto it = client_data_.find(peer_pid);
+    if (it == client_data_.end() || it->second.client_id != client_id)
+      return;
+    std::deque<Barrier>& barriers = it->second.barriers;
+    if (barriers.empty() || barriers.front().pending_acks > 0)
+      return;
+    std::function<void()> fn = std::move(barriers.front().fn);
+    barriers.pop_front();
+    fn();
+  }
 }
 
 void UnwindingWorker::PostDisconnectSocket(pid_t pid) {
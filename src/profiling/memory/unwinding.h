@@ -19,6 +19,11 @@
 
 #include <unwindstack/Regs.h>
 
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <set>
+
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/thread_task_runner.h"
@@ -80,16 +85,34 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     SharedRingBuffer shmem;
     ClientConfiguration client_config;
     bool stream_allocations;
+    bool frame_pointer_unwinding;
   };
 
   UnwindingWorker(Delegate* delegate, base::ThreadTaskRunner thread_task_runner)
       : delegate_(delegate),
+        load_(new LoadCounters()),
         thread_task_runner_(std::move(thread_task_runner)) {}
 
   ~UnwindingWorker() override;
   UnwindingWorker(UnwindingWorker&&) = default;
 
+  // Lets this worker send the allocations of its clients that fall behind to
+  // |peers| to be unwound in parallel. |peers| can include this worker and
+  // must outlive it, or be detached with DetachPeers() first. Must be called
+  // before any client is handed off.
+  void SetPeers(std::vector<UnwindingWorker*> peers);
+
   // Public API safe to call from other threads.
+  // Stops sending work to the peers, and ignores the work they sent. Once
+  // this returned for all the workers, they can be destroyed in any order.
+  void DetachPeers();
+  // The clients handed off to this worker plus the allocations of other
+  // workers' clients waiting to be unwound by it. Once zero, the worker is
+  // done using libunwindstack until the next handoff.
+  size_t load() const {
+    return load_->clients.load(std::memory_order_acquire) +
+           load_->queued_unwinds.load(std::memory_order_acquire);
+  }
   void PostDisconnectSocket(pid_t pid);
   void PostPurgeProcess(pid_t pid);
   void PostHandoffSocket(HandoffData);
@@ -108,6 +131,19 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   void OnDataAvailable(base::UnixSocket* self) override;
 
  public:
+  struct ClientFds {
+    base::ScopedFile maps_fd;
+    base::ScopedFile mem_fd;
+  };
+
+  // Runs |fn| on the worker reading the buffer of a client once the peers
+  // have posted all the allocations of that client they were sent before.
+  struct Barrier {
+    uint64_t id;
+    size_t pending_acks;
+    std::function<void()> fn;
+  };
+
   // public for testing/fuzzer
   struct ClientData {
     DataSourceInstanceID data_source_instance_id;
@@ -118,6 +154,17 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
     bool stream_allocations = false;
     size_t drain_bytes = 0;
     std::vector<FreeRecord> free_records;
+
+    // State of the unwinding of allocations by peer workers (see SetPeers()).
+    // Identifies the client across workers, as pids can be reused.
+    uint64_t client_id = 0;
+    // dup()s of the fds of |metadata|, for the peers to unwind on their own.
+    std::shared_ptr<const ClientFds> fds;
+    // The peers sent allocations since the last barrier, and ever.
+    std::set<UnwindingWorker*> peers_since_barrier;
+    std::set<UnwindingWorker*> peers;
+    std::deque<Barrier> barriers;
+    uint64_t next_barrier_id = 0;
   };
 
   // public for testing/fuzzing
@@ -128,6 +175,10 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
                            pid_t peer_pid,
                            Delegate* delegate);
 
+  // Returns how many records should be read by one task from a buffer of
+  // |buffer_size| bytes of which |read_avail| are pending. public for testing.
+  static size_t UnwindBatchSize(size_t read_avail, size_t buffer_size);
+
  private:
   void HandleHandoffSocket(HandoffData data);
   void HandleDisconnectSocket(pid_t pid);
@@ -151,9 +202,58 @@ class UnwindingWorker : public base::UnixSocket::EventListener {
   void BatchUnwindJob(pid_t);
   void DrainJob(pid_t);
 
+  // An allocation of a client of another worker, to be unwound by this one.
+  struct OffloadedUnwind {
+    uint64_t client_id;
+    DataSourceInstanceID data_source_instance_id;
+    pid_t pid;
+    std::shared_ptr<const ClientFds> fds;
+    bool frame_pointer_unwinding;
+    std::unique_ptr<uint8_t[]> msg;
+    size_t msg_size;
+  };
+
+  UnwindingWorker* PickPeer();
+  bool MaybeOffloadUnwind(const SharedRingBuffer::Buffer& buf,
+                          ClientData* client_data,
+                          pid_t peer_pid);
+  void HandleOffloadedUnwind(std::unique_ptr<OffloadedUnwind> job);
+  void UnwindOffloaded(const OffloadedUnwind& job);
+  void HandleDropOffloadedClient(uint64_t client_id);
+  static void FlushFreeRecords(UnwindingWorker* self,
+                               Delegate* delegate,
+                               pid_t peer_pid,
+                               ClientData* client_data);
+  // Runs |fn| now if no allocation of the client is being unwound by a peer,
+  // or once they all have been posted to the delegate otherwise. Used to
+  // order the frees and dumps after the allocations that preceded them.
+  void RunAfterOffloadedUnwinds(pid_t peer_pid,
+                                ClientData* client_data,
+                                std::function<void()> fn);
+  bool HasOffloadedUnwinds(const ClientData& client_data) const {
+    // Once detached, the peers no longer acknowledge barriers.
+    return !peers_.empty() && (!client_data.peers_since_barrier.empty() ||
+                               !client_data.barriers.empty());
+  }
+  void HandleBarrierAck(pid_t peer_pid, uint64_t client_id, uint64_t id);
+  void RunCompletedBarriers(pid_t peer_pid, uint64_t client_id);
+  void PostTaskAndWait(std::function<void()> fn);
+
+  // Shared with the other workers, which read them to balance their work.
+  // Behind a pointer to keep UnwindingWorker movable.
+  struct LoadCounters {
+    std::atomic<size_t> clients{0};
+    std::atomic<size_t> queued_unwinds{0};
+  };
+
   AllocRecordArena alloc_record_arena_;
   std::map<pid_t, ClientData> client_data_;
   Delegate* delegate_;
+  std::unique_ptr<LoadCounters> load_;
+  // Empty if the allocations of the clients are only unwound by this worker.
+  std::vector<UnwindingWorker*> peers_;
+  // The metadata of the clients of other workers, by ClientData::client_id.
+  std::map<uint64_t, UnwindingMetadata> offloaded_metadata_;
 
   // Task runner with a dedicated thread. Keep last. By destroying this task
   // runner first, we ensure that the UnwindingWorker is not active while the
@@ -57,7 +57,13 @@ int FuzzUnwinding(const uint8_t* data, size_t size) {
                                           /*client_config=*/{},
                                           /*stream_allocations=*/false,
                                           /*drain_bytes=*/0,
-                                          /*free_records=*/{}};
+                                          /*free_records=*/{},
+                                          /*client_id=*/0,
+                                          /*fds=*/{},
+                                          /*peers_since_barrier=*/{},
+                                          /*peers=*/{},
+                                          /*barriers=*/{},
+                                          /*next_barrier_id=*/0};
 
   AllocRecordArena arena;
   UnwindingWorker::HandleBuffer(nullptr, &arena, buf, &client_data, self_pid,
@@ -22,10 +22,20 @@
 #include <sys/types.h>
 #include <unwindstack/RegsGetLocal.h>
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/unix_socket.h"
 #include "src/profiling/common/unwind_support.h"
 #include "src/profiling/memory/client.h"
+#include "src/profiling/memory/shared_ring_buffer.h"
 #include "src/profiling/memory/wire_protocol.h"
 #include "test/gtest_and_gmock.h"
 
@@ -33,6 +43,8 @@ namespace perfetto {
 namespace profiling {
 namespace {
 
+using ::testing::ElementsAre;
+
 TEST(UnwindingTest, StackOverlayMemoryOverlay) {
   base::ScopedFile proc_mem(base::OpenFile("/proc/self/mem", O_RDONLY));
   ASSERT_TRUE(proc_mem);
@@ -182,6 +194,210 @@ TEST(UnwindingTest, DoUnwindReparse) {
                "namespace)::GetRecord(perfetto::profiling::WireMessage*)");
 }
 
+TEST(UnwindingTest, UnwindBatchSizeGrowsWithFillLevel) {
+  constexpr size_t kBufferSize = 8 * 1024 * 1024;
+  size_t empty = UnwindingWorker::UnwindBatchSize(0, kBufferSize);
+  size_t half = UnwindingWorker::UnwindBatchSize(kBufferSize / 2, kBufferSize);
+  size_t full = UnwindingWorker::UnwindBatchSize(kBufferSize, kBufferSize);
+  EXPECT_GT(empty, 0u);
+  EXPECT_LT(empty, half);
+  EXPECT_LT(half, full);
+  EXPECT_EQ(UnwindingWorker::UnwindBatchSize(kBufferSize - 1, kBufferSize),
+            UnwindingWorker::UnwindBatchSize(kBufferSize - 2, kBufferSize));
+}
+
+// Records what the workers post, in order, from any thread.
+class RecordingDelegate : public UnwindingWorker::Delegate {
+ public:
+  enum class Type { kAlloc, kFree, kDisconnected, kDrainDone };
+  struct Event {
+    Type type;
+    UnwindingWorker* worker;
+    DataSourceInstanceID ds_id;
+  };
+
+  void PostAllocRecord(UnwindingWorker* worker,
+                       std::unique_ptr<AllocRecord> rec) override {
+    Add({Type::kAlloc, worker, rec->data_source_instance_id});
+  }
+  void PostFreeRecord(UnwindingWorker* worker,
+                      std::vector<FreeRecord> recs) override {
+    for (const FreeRecord& rec : recs)
+      Add({Type::kFree, worker, rec.data_source_instance_id});
+  }
+  void PostHeapNameRecord(UnwindingWorker*, HeapNameRecord) override {}
+  void PostSocketDisconnected(UnwindingWorker* worker,
+                              DataSourceInstanceID ds_id,
+                              pid_t,
+                              SharedRingBuffer::Stats) override {
+    Add({Type::kDisconnected, worker, ds_id});
+  }
+  void PostDrainDone(UnwindingWorker* worker,
+                     DataSourceInstanceID ds_id) override {
+    Add({Type::kDrainDone, worker, ds_id});
+  }
+
+  // Waits for |count| events of |type| to be posted and returns all the
+  // events posted so far.
+  std::vector<Event> WaitFor(Type type, size_t count = 1) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cv_.wait_for(lock, std::chrono::seconds(30), [this, type, count] {
+      auto n = std::count_if(events_.begin(), events_.end(),
+                             [type](const Event& e) { return e.type == type; });
+      return static_cast<size_t>(n) >= count;
+    });
+    return events_;
+  }
+
+ private:
+  void Add(Event event) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    events_.push_back(event);
+    cv_.notify_all();
+  }
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Event> events_;
+};
+
+class UnwindingWorkerOffloadTest : public ::testing::Test {
+ protected:
+  using Event = RecordingDelegate::Event;
+
+  static constexpr DataSourceInstanceID kDataSource = 1;
+  static constexpr size_t kAllocs = 100;
+  static constexpr size_t kShmemSize = 128 * 1024;
+
+  UnwindingWorkerOffloadTest()
+      : owner_(&delegate_, base::ThreadTaskRunner::CreateAndStart("owner")),
+        peer_(&delegate_, base::ThreadTaskRunner::CreateAndStart("peer")) {
+    owner_.SetPeers({&owner_, &peer_});
+    peer_.SetPeers({&owner_, &peer_});
+  }
+
+  ~UnwindingWorkerOffloadTest() override {
+    owner_.DetachPeers();
+    peer_.DetachPeers();
+  }
+
+  // Hands off to |owner_| a client whose buffer holds kAllocs allocations
+  // followed by a free, enough for the owner to offload allocations to
+  // |peer_| as soon as it reads the buffer. Returns the client end of the
+  // socket of the client.
+  base::UnixSocketRaw HandOffClient() {
+    std::optional<SharedRingBuffer> shmem =
+        SharedRingBuffer::Create(kShmemSize);
+    PERFETTO_CHECK(shmem);
+    client_shmem_ =
+        SharedRingBuffer::Attach(base::ScopedFile(dup(shmem->fd())));
+    PERFETTO_CHECK(client_shmem_);
+
+    uint8_t stack[64] = {};
+    AllocMetadata alloc_header = {};
+    alloc_header.arch = unwindstack::Regs::CurrentArch();
+    alloc_header.stack_pointer = reinterpret_cast<uint64_t>(stack);
+    WireMessage msg = {};
+    msg.record_type = RecordType::Malloc;
+    msg.alloc_header = &alloc_header;
+    msg.payload = reinterpret_cast<char*>(stack);
+    msg.payload_size = sizeof(stack);
+    for (size_t i = 0; i < kAllocs; i++) {
+      alloc_header.sequence_number = i + 1;
+      alloc_header.alloc_address = 0x1000 + i * 0x10;
+      PERFETTO_CHECK(SendWireMessage(&*client_shmem_, msg) > 0);
+    }
+    FreeEntry free_header = {};
+    free_header.sequence_number = kAllocs + 1;
+    free_header.addr = 0x1000;
+    msg = {};
+    msg.record_type = RecordType::Free;
+    msg.free_header = &free_header;
+    PERFETTO_CHECK(SendWireMessage(&*client_shmem_, msg) > 0);
+    // The backlog is past the offloading threshold.
+    PERFETTO_CHECK(client_shmem_->read_avail() >= kShmemSize / 8);
+
+    auto sock_pair = base::UnixSocketRaw::CreatePairPosix(
+        base::SockFamily::kUnix, base::SockType::kStream);
+    UnwindingWorker::HandoffData data{};
+    data.data_source_instance_id = kDataSource;
+    data.sock = std::move(sock_pair.first);
+    data.maps_fd = base::OpenFile("/proc/self/maps", O_RDONLY);
+    data.mem_fd = base::OpenFile("/proc/self/mem", O_RDONLY);
+    data.shmem = std::move(*shmem);
+    owner_.PostHandoffSocket(std::move(data));
+    return std::move(sock_pair.second);
+  }
+
+  // Checks that all the allocations, some unwound by |peer_|, were posted
+  // before the free, which was posted before the event at |end|.
+  void CheckAllocsBeforeFree(const std::vector<Event>& events, size_t end) {
+    size_t allocs = 0;
+    size_t peer_allocs = 0;
+    std::optional<size_t> free_pos;
+    for (size_t i = 0; i < end; i++) {
+      const Event& event = events[i];
+      if (event.type == RecordingDelegate::Type::kAlloc) {
+        EXPECT_FALSE(free_pos) << "Allocation posted after the free";
+        allocs++;
+        if (event.worker == &peer_)
+          peer_allocs++;
+      } else if (event.type == RecordingDelegate::Type::kFree) {
+        free_pos = i;
+      }
+    }
+    EXPECT_EQ(allocs, kAllocs);
+    EXPECT_GT(peer_allocs, 0u);
+    EXPECT_TRUE(free_pos);
+  }
+
+  RecordingDelegate delegate_;
+  std::optional<SharedRingBuffer> client_shmem_;
+  UnwindingWorker owner_;
+  UnwindingWorker peer_;
+};
+
+TEST_F(UnwindingWorkerOffloadTest, DrainWaitsForOffloadedUnwinds) {
+  base::UnixSocketRaw sock = HandOffClient();
+  ASSERT_EQ(sock.Send("x", 1), 1);
+
+  // Once the owner read the whole buffer, the allocations it offloaded can
+  // still be queued on |peer_|.
+  for (int i = 0; i < 3000 && client_shmem_->read_avail() > 0; i++)
+    base::SleepMicroseconds(10 * 1000);
+  ASSERT_EQ(client_shmem_->read_avail(), 0u);
+
+  // The drains wait for the offloaded allocations and complete in order.
+  owner_.PostDrainFree(kDataSource, getpid());
+  owner_.PostDrainFree(kDataSource + 1, getpid());
+  auto events = delegate_.WaitFor(RecordingDelegate::Type::kDrainDone, 2);
+  ASSERT_GE(events.size(), 2u);
+  std::vector<DataSourceInstanceID> drains;
+  size_t first_drain = events.size();
+  for (size_t i = 0; i < events.size(); i++) {
+    if (events[i].type != RecordingDelegate::Type::kDrainDone)
+      continue;
+    first_drain = std::min(first_drain, i);
+    drains.push_back(events[i].ds_id);
+  }
+  EXPECT_THAT(drains, ElementsAre(kDataSource, kDataSource + 1));
+  CheckAllocsBeforeFree(events, first_drain);
+
+  sock.Shutdown();
+  delegate_.WaitFor(RecordingDelegate::Type::kDisconnected);
+}
+
+TEST_F(UnwindingWorkerOffloadTest, DisconnectWaitsForOffloadedUnwinds) {
+  base::UnixSocketRaw sock = HandOffClient();
+  // The owner reads out the buffer after the disconnect, offloading
+  // allocations, and reports the disconnect only once they were posted.
+  sock.Shutdown();
+  auto events = delegate_.WaitFor(RecordingDelegate::Type::kDisconnected);
+  ASSERT_FALSE(events.empty());
+  ASSERT_EQ(events.back().type, RecordingDelegate::Type::kDisconnected);
+  CheckAllocsBeforeFree(events, events.size() - 1);
+}
+
 TEST(AllocRecordArenaTest, Smoke) {
   AllocRecordArena a;
   auto borrowed = a.BorrowAllocRecord();
@@ -18,6 +18,7 @@
 #define SRC_PROFILING_PERF_COMMON_TYPES_H_
 
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include <linux/perf_event.h>
@@ -58,6 +59,48 @@ struct ParsedSample {
   std::vector<uint64_t> kernel_ips;
 };
 
+// Recycles the buffers holding the sampled stacks, which are copied out of the
+// kernel ring buffers on the main thread and freed on the unwinder threads.
+// Reusing their capacity avoids a large allocation per sample. Thread-safe.
+class StackBufferPool {
+ public:
+  // Returns an empty buffer, with the capacity of a previously returned one if
+  // there is any.
+  std::vector<char> Get() {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (buffers_.empty())
+      return std::vector<char>();
+    std::vector<char> ret = std::move(buffers_.back());
+    buffers_.pop_back();
+    return ret;
+  }
+
+  void Return(std::vector<char> buffer) {
+    if (buffer.capacity() == 0)
+      return;
+    buffer.clear();
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (buffers_.size() < kMaxBuffers)
+      buffers_.emplace_back(std::move(buffer));
+  }
+
+  // Frees the pooled buffers, e.g. once no data source is active.
+  void Clear() {
+    std::vector<std::vector<char>> buffers;
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      buffers.swap(buffers_);
+    }
+  }
+
+ private:
+  // Stacks are at most 64k, so the pool holds at most 4 MB.
+  static constexpr size_t kMaxBuffers = 64;
+
+  std::mutex mutex_;
+  std::vector<std::vector<char>> buffers_;
+};
+
 // Entry in an unwinding queue. Either a sample that requires unwinding, or a
 // tombstoned entry (valid == false).
 struct UnwindEntry {
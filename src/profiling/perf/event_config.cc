@@ -346,6 +346,7 @@ std::optional<EventConfig> EventConfig::Create(
 
   // Callstack sampling.
   bool user_frames = false;
+  bool frame_pointer_unwinding = false;
   bool kernel_frames = false;
   TargetFilter target_filter;
   bool legacy_config = pb_config.all_cpus();  // all_cpus was mandatory before
@@ -366,6 +367,10 @@ std::optional<EventConfig> EventConfig::Create(
       case PerfEventConfig::UNWIND_DWARF:
         user_frames = true;
         break;
+      case PerfEventConfig::UNWIND_FRAME_POINTER:
+        user_frames = true;
+        frame_pointer_unwinding = true;
+        break;
       default:
         // enum value from the future that we don't yet know, refuse the config
         // TODO(rsavitski): double-check that both pbzero and ::gen propagate
@@ -474,10 +479,11 @@ std::optional<EventConfig> EventConfig::Create(
   }
 
   return EventConfig(
-      raw_ds_config, pe, timebase_event, user_frames, kernel_frames,
-      std::move(target_filter), ring_buffer_pages.value(), read_tick_period_ms,
-      samples_per_tick_limit, remote_descriptor_timeout_ms,
-      pb_config.unwind_state_clear_period_ms(), max_enqueued_footprint_bytes,
+      raw_ds_config, pe, timebase_event, user_frames, frame_pointer_unwinding,
+      kernel_frames, std::move(target_filter), ring_buffer_pages.value(),
+      read_tick_period_ms, samples_per_tick_limit,
+      remote_descriptor_timeout_ms, pb_config.unwind_state_clear_period_ms(),
+      pb_config.unwind_cache_budget_kb(), max_enqueued_footprint_bytes,
       pb_config.target_installed_by());
 }
 
@@ -485,6 +491,7 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
                          const perf_event_attr& pe,
                          const PerfCounter& timebase_event,
                          bool user_frames,
+                         bool frame_pointer_unwinding,
                          bool kernel_frames,
                          TargetFilter target_filter,
                          uint32_t ring_buffer_pages,
@@ -492,11 +499,13 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
                          uint64_t samples_per_tick_limit,
                          uint32_t remote_descriptor_timeout_ms,
                          uint32_t unwind_state_clear_period_ms,
+                         uint32_t unwind_cache_budget_kb,
                          uint64_t max_enqueued_footprint_bytes,
                          std::vector<std::string> target_installed_by)
     : perf_event_attr_(pe),
       timebase_event_(timebase_event),
       user_frames_(user_frames),
+      frame_pointer_unwinding_(frame_pointer_unwinding),
       kernel_frames_(kernel_frames),
       target_filter_(std::move(target_filter)),
       ring_buffer_pages_(ring_buffer_pages),
@@ -504,6 +513,7 @@ EventConfig::EventConfig(const DataSourceConfig& raw_ds_config,
       samples_per_tick_limit_(samples_per_tick_limit),
       remote_descriptor_timeout_ms_(remote_descriptor_timeout_ms),
       unwind_state_clear_period_ms_(unwind_state_clear_period_ms),
+      unwind_cache_budget_kb_(unwind_cache_budget_kb),
       max_enqueued_footprint_bytes_(max_enqueued_footprint_bytes),
       target_installed_by_(std::move(target_installed_by)),
       raw_ds_config_(raw_ds_config) /* full copy */ {}
@@ -133,11 +133,13 @@ class EventConfig {
   uint32_t unwind_state_clear_period_ms() const {
     return unwind_state_clear_period_ms_;
   }
+  uint32_t unwind_cache_budget_kb() const { return unwind_cache_budget_kb_; }
   uint64_t max_enqueued_footprint_bytes() const {
     return max_enqueued_footprint_bytes_;
   }
   bool sample_callstacks() const { return user_frames_ || kernel_frames_; }
   bool user_frames() const { return user_frames_; }
+  bool frame_pointer_unwinding() const { return frame_pointer_unwinding_; }
   bool kernel_frames() const { return kernel_frames_; }
   const TargetFilter& filter() const { return target_filter_; }
   perf_event_attr* perf_attr() const {
@@ -154,6 +156,7 @@ class EventConfig {
               const perf_event_attr& pe,
               const PerfCounter& timebase_event,
               bool user_frames,
+              bool frame_pointer_unwinding,
               bool kernel_frames,
               TargetFilter target_filter,
               uint32_t ring_buffer_pages,
@@ -161,6 +164,7 @@ class EventConfig {
               uint64_t samples_per_tick_limit,
               uint32_t remote_descriptor_timeout_ms,
               uint32_t unwind_state_clear_period_ms,
+              uint32_t unwind_cache_budget_kb,
               uint64_t max_enqueued_footprint_bytes,
               std::vector<std::string> target_installed_by);
 
@@ -175,6 +179,10 @@ class EventConfig {
   // If true, include userspace frames in sampled callstacks.
   const bool user_frames_;
 
+  // If true, unwind the userspace frames by walking the frame pointers when
+  // possible.
+  const bool frame_pointer_unwinding_;
+
   // If true, include kernel frames in sampled callstacks.
   const bool kernel_frames_;
 
@@ -198,6 +206,10 @@ class EventConfig {
   // Optional period for clearing cached unwinder state. Skipped if zero.
   const uint32_t unwind_state_clear_period_ms_;
 
+  // If non-zero, the periodic clear of the unwinder state only drops the state
+  // of idle processes while the daemon's memory is within this budget.
+  const uint32_t unwind_cache_budget_kb_;
+
   const uint64_t max_enqueued_footprint_bytes_;
 
   // Only profile target if it was installed by one of the packages given.
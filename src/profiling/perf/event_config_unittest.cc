@@ -308,6 +308,21 @@ TEST(EventConfigTest, CallstackSamplingModeDetection) {
 
     EXPECT_NE(event_config->perf_attr()->exclude_callchain_user, 0u);
   }
+  {  // frame pointer unwinding still samples the stack, for the fallback
+    protos::gen::PerfEventConfig cfg;
+    cfg.mutable_callstack_sampling()->set_user_frames(
+        protos::gen::PerfEventConfig::UNWIND_FRAME_POINTER);
+
+    std::optional<EventConfig> event_config = CreateEventConfig(cfg);
+
+    ASSERT_TRUE(event_config.has_value());
+    EXPECT_TRUE(event_config->user_frames());
+    EXPECT_TRUE(event_config->frame_pointer_unwinding());
+    EXPECT_EQ(
+        event_config->perf_attr()->sample_type &
+            (PERF_SAMPLE_STACK_USER | PERF_SAMPLE_REGS_USER),
+        static_cast<uint64_t>(PERF_SAMPLE_STACK_USER | PERF_SAMPLE_REGS_USER));
+  }
 }
 
 TEST(EventConfigTest, EnableKernelFrames) {
@@ -16,6 +16,8 @@
 
 #include "src/profiling/perf/event_reader.h"
 
+#include <algorithm>
+
 #include <linux/perf_event.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -31,19 +33,6 @@ namespace profiling {
 
 namespace {
 
-template <typename T>
-const char* ReadValue(T* value_out, const char* ptr) {
-  memcpy(value_out, reinterpret_cast<const void*>(ptr), sizeof(T));
-  return ptr + sizeof(T);
-}
-
-template <typename T>
-const char* ReadValues(T* out, const char* ptr, size_t num_values) {
-  size_t sz = sizeof(T) * num_values;
-  memcpy(out, reinterpret_cast<const void*>(ptr), sz);
-  return ptr + sz;
-}
-
 bool IsPowerOfTwo(size_t v) {
   return (v != 0 && ((v & (v - 1)) == 0));
 }
@@ -87,11 +76,13 @@ PerfRingBuffer::PerfRingBuffer(PerfRingBuffer&& other) noexcept
     : metadata_page_(other.metadata_page_),
       mmap_sz_(other.mmap_sz_),
       data_buf_(other.data_buf_),
-      data_buf_sz_(other.data_buf_sz_) {
+      data_buf_sz_(other.data_buf_sz_),
+      cached_data_head_(other.cached_data_head_) {
   other.metadata_page_ = nullptr;
   other.mmap_sz_ = 0;
   other.data_buf_ = nullptr;
   other.data_buf_sz_ = 0;
+  other.cached_data_head_ = 0;
 }
 
 PerfRingBuffer& PerfRingBuffer::operator=(PerfRingBuffer&& other) noexcept {
@@ -141,13 +132,31 @@ std::optional<PerfRingBuffer> PerfRingBuffer::Allocate(int perf_fd,
   return std::make_optional(std::move(ret));
 }
 
+void PerfRingBuffer::RecordView::Read(void* dst, size_t size) {
+  size_t prefix_sz = std::min(size, buf_size_ - pos_);
+  memcpy(dst, buf_ + pos_, prefix_sz);
+  if (prefix_sz < size)  // wrapped around the end of the buffer
+    memcpy(reinterpret_cast<char*>(dst) + prefix_sz, buf_, size - prefix_sz);
+  Skip(size);
+}
+
+void PerfRingBuffer::RecordView::ReadInto(std::vector<char>* dst,
+                                          size_t size) {
+  size_t prefix_sz = std::min(size, buf_size_ - pos_);
+  dst->assign(buf_ + pos_, buf_ + pos_ + prefix_sz);
+  if (prefix_sz < size)  // wrapped around the end of the buffer
+    dst->insert(dst->end(), buf_, buf_ + (size - prefix_sz));
+  Skip(size);
+}
+
 // See |perf_output_put_handle| for the necessary synchronization between the
 // kernel and this userspace thread (which are using the same shared memory, but
 // might be on different cores).
 // TODO(rsavitski): is there false sharing between |data_tail| and |data_head|?
 // Is there an argument for maintaining our own copy of |data_tail| instead of
 // reloading it?
-char* PerfRingBuffer::ReadRecordNonconsuming() {
+std::optional<PerfRingBuffer::RecordView>
+PerfRingBuffer::ReadRecordNonconsuming() {
   static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "");
 
   PERFETTO_DCHECK(valid());
@@ -157,14 +166,19 @@ char* PerfRingBuffer::ReadRecordNonconsuming() {
   uint64_t read_offset = metadata_page_->data_tail;
 
   // |data_head| is written by the kernel, perform an acquiring load such that
-  // the payload reads below are ordered after this load.
-  uint64_t write_offset =
-      reinterpret_cast<std::atomic<uint64_t>*>(&metadata_page_->data_head)
-          ->load(std::memory_order_acquire);
+  // the payload reads below are ordered after this load. The records before
+  // the previously loaded value are already visible, so it's only reloaded
+  // once they've all been consumed.
+  if (read_offset == cached_data_head_) {
+    cached_data_head_ =
+        reinterpret_cast<std::atomic<uint64_t>*>(&metadata_page_->data_head)
+            ->load(std::memory_order_acquire);
+  }
+  uint64_t write_offset = cached_data_head_;
 
   PERFETTO_DCHECK(read_offset <= write_offset);
   if (write_offset == read_offset)
-    return nullptr;  // no new data
+    return std::nullopt;  // no new data
 
   size_t read_pos = static_cast<size_t>(read_offset & (data_buf_sz_ - 1));
 
@@ -173,23 +187,9 @@ char* PerfRingBuffer::ReadRecordNonconsuming() {
   PERFETTO_DCHECK(0 == reinterpret_cast<size_t>(data_buf_ + read_pos) %
                            alignof(perf_event_header));
 
-  perf_event_header* evt_header =
-      reinterpret_cast<perf_event_header*>(data_buf_ + read_pos);
-  uint16_t evt_size = evt_header->size;
-
-  // event wrapped - reconstruct it, and return a pointer to the buffer
-  if (read_pos + evt_size > data_buf_sz_) {
-    PERFETTO_DLOG("PerfRingBuffer: returning reconstructed event");
-
-    size_t prefix_sz = data_buf_sz_ - read_pos;
-    memcpy(&reconstructed_record_[0], data_buf_ + read_pos, prefix_sz);
-    memcpy(&reconstructed_record_[0] + prefix_sz, data_buf_,
-           evt_size - prefix_sz);
-    return &reconstructed_record_[0];
-  } else {
-    // usual case - contiguous sample
-    return data_buf_ + read_pos;
-  }
+  // The record might wrap around the end of the buffer, which the view
+  // handles when reading its fields.
+  return RecordView(data_buf_, data_buf_sz_, read_pos);
 }
 
 void PerfRingBuffer::Consume(size_t bytes) {
@@ -244,21 +244,25 @@ std::optional<EventReader> EventReader::ConfigureEvents(
 }
 
 std::optional<ParsedSample> EventReader::ReadUntilSample(
-    std::function<void(uint64_t)> records_lost_callback) {
+    std::function<void(uint64_t)> records_lost_callback,
+    StackBufferPool* stack_pool) {
   for (;;) {
-    char* event = ring_buffer_.ReadRecordNonconsuming();
+    std::optional<PerfRingBuffer::RecordView> event =
+        ring_buffer_.ReadRecordNonconsuming();
     if (!event)
       return std::nullopt;  // caught up with the writer
 
-    auto* event_hdr = reinterpret_cast<const perf_event_header*>(event);
+    const perf_event_header* event_hdr = event->header();
+    uint16_t event_size = event_hdr->size;
+    uint32_t event_type = event_hdr->type;
 
-    if (event_hdr->type == PERF_RECORD_SAMPLE) {
-      ParsedSample sample = ParseSampleRecord(cpu_, event);
-      ring_buffer_.Consume(event_hdr->size);
+    if (event_type == PERF_RECORD_SAMPLE) {
+      ParsedSample sample = ParseSampleRecord(cpu_, &*event, stack_pool);
+      ring_buffer_.Consume(event_size);
       return std::make_optional(std::move(sample));
     }
 
-    if (event_hdr->type == PERF_RECORD_LOST) {
+    if (event_type == PERF_RECORD_LOST) {
       /*
        * struct {
        *   struct perf_event_header header;
@@ -267,32 +271,36 @@ std::optional<ParsedSample> EventReader::ReadUntilSample(
        *   struct sample_id sample_id;
        * };
        */
-      uint64_t records_lost = *reinterpret_cast<const uint64_t*>(
-          event + sizeof(perf_event_header) + sizeof(uint64_t));
+      uint64_t records_lost = 0;
+      event->Skip(sizeof(perf_event_header) + sizeof(uint64_t));
+      event->ReadValue(&records_lost);
 
       records_lost_callback(records_lost);
-      ring_buffer_.Consume(event_hdr->size);
+      ring_buffer_.Consume(event_size);
       continue;  // keep looking for a sample
     }
 
     // Kernel had to throttle irqs.
-    if (event_hdr->type == PERF_RECORD_THROTTLE ||
-        event_hdr->type == PERF_RECORD_UNTHROTTLE) {
-      ring_buffer_.Consume(event_hdr->size);
+    if (event_type == PERF_RECORD_THROTTLE ||
+        event_type == PERF_RECORD_UNTHROTTLE) {
+      ring_buffer_.Consume(event_size);
       continue;  // keep looking for a sample
     }
 
     PERFETTO_DFATAL_OR_ELOG("Unsupported event type [%zu]",
-                            static_cast<size_t>(event_hdr->type));
-    ring_buffer_.Consume(event_hdr->size);
+                            static_cast<size_t>(event_type));
+    ring_buffer_.Consume(event_size);
   }
 }
 
 // Generally, samples can belong to any cpu (which can be recorded with
 // PERF_SAMPLE_CPU). However, this producer uses only cpu-scoped events,
 // therefore it is already known.
+// The fields are copied straight out of the ring buffer, including the stack,
+// which goes into a buffer recycled through |stack_pool|.
 ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
-                                            const char* record_start) {
+                                            PerfRingBuffer::RecordView* record,
+                                            StackBufferPool* stack_pool) {
   if (event_attr_.sample_type &
       (~uint64_t(PERF_SAMPLE_TID | PERF_SAMPLE_TIME | PERF_SAMPLE_STACK_USER |
                  PERF_SAMPLE_REGS_USER | PERF_SAMPLE_CALLCHAIN |
@@ -300,7 +308,7 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
     PERFETTO_FATAL("Unsupported sampling option");
   }
 
-  auto* event_hdr = reinterpret_cast<const perf_event_header*>(record_start);
+  const perf_event_header* event_hdr = record->header();
   size_t sample_size = event_hdr->size;
 
   ParsedSample sample = {};
@@ -309,36 +317,47 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
 
   // Parse the payload, which consists of concatenated data for each
   // |attr.sample_type| flag.
-  const char* parse_pos = record_start + sizeof(perf_event_header);
+  record->Skip(sizeof(perf_event_header));
 
   if (event_attr_.sample_type & PERF_SAMPLE_TID) {
     uint32_t pid = 0;
     uint32_t tid = 0;
-    parse_pos = ReadValue(&pid, parse_pos);
-    parse_pos = ReadValue(&tid, parse_pos);
+    record->ReadValue(&pid);
+    record->ReadValue(&tid);
     sample.common.pid = static_cast<pid_t>(pid);
     sample.common.tid = static_cast<pid_t>(tid);
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_TIME) {
-    parse_pos = ReadValue(&sample.common.timestamp, parse_pos);
+    record->ReadValue(&sample.common.timestamp);
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_READ) {
-    parse_pos = ReadValue(&sample.common.timebase_count, parse_pos);
+    record->ReadValue(&sample.common.timebase_count);
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_CALLCHAIN) {
     uint64_t chain_len = 0;
-    parse_pos = ReadValue(&chain_len, parse_pos);
+    record->ReadValue(&chain_len);
     sample.kernel_ips.resize(static_cast<size_t>(chain_len));
-    parse_pos = ReadValues<uint64_t>(sample.kernel_ips.data(), parse_pos,
-                                     static_cast<size_t>(chain_len));
+    record->Read(sample.kernel_ips.data(),
+                 static_cast<size_t>(chain_len) * sizeof(uint64_t));
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_REGS_USER) {
+    // The register values are copied into a contiguous buffer for parsing:
+    // [u64 abi] followed by one u64 per register in |sample_regs_user|, unless
+    // the abi is PERF_SAMPLE_REGS_ABI_NONE.
+    uint64_t regs_data[1 + 64];
+    record->ReadValue(&regs_data[0]);
+    if (regs_data[0] != PERF_SAMPLE_REGS_ABI_NONE) {
+      size_t num_regs = static_cast<size_t>(
+          __builtin_popcountll(event_attr_.sample_regs_user));
+      record->Read(&regs_data[1], num_regs * sizeof(uint64_t));
+    }
     // Can be empty, e.g. if we sampled a kernel thread.
-    sample.regs = ReadPerfUserRegsData(&parse_pos);
+    const char* regs_pos = reinterpret_cast<const char*>(&regs_data[0]);
+    sample.regs = ReadPerfUserRegsData(&regs_pos);
   }
 
   if (event_attr_.sample_type & PERF_SAMPLE_STACK_USER) {
@@ -346,28 +365,29 @@ ParsedSample EventReader::ParseSampleRecord(uint32_t cpu,
     // the requested size if there wasn't enough room in the sample (which is
     // limited to 64k).
     uint64_t max_stack_size;
-    parse_pos = ReadValue(&max_stack_size, parse_pos);
-
-    const char* stack_start = parse_pos;
-    parse_pos += max_stack_size;  // skip to dyn_size
+    record->ReadValue(&max_stack_size);
 
     // Payload written conditionally, e.g. kernel threads don't have a
     // user stack.
     if (max_stack_size > 0) {
+      // dyn_size follows the stack bytes.
+      PerfRingBuffer::RecordView stack_view = *record;
+      record->Skip(static_cast<size_t>(max_stack_size));
       uint64_t filled_stack_size;
-      parse_pos = ReadValue(&filled_stack_size, parse_pos);
+      record->ReadValue(&filled_stack_size);
+      PERFETTO_CHECK(filled_stack_size <= max_stack_size);
 
-      // copy stack bytes into a vector
+      // copy stack bytes into a recycled buffer
       size_t payload_sz = static_cast<size_t>(filled_stack_size);
-      sample.stack.resize(payload_sz);
-      memcpy(sample.stack.data(), stack_start, payload_sz);
+      sample.stack = stack_pool->Get();
+      stack_view.ReadInto(&sample.stack, payload_sz);
 
       // remember whether the stack sample is (most likely) truncated
       sample.stack_maxed = (filled_stack_size == max_stack_size);
     }
   }
 
-  PERFETTO_CHECK(parse_pos == record_start + sample_size);
+  PERFETTO_CHECK(record->offset() == sample_size);
   return sample;
 }
 
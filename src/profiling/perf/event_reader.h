@@ -22,6 +22,7 @@
 #include <sys/mman.h>
 #include <sys/types.h>
 #include <optional>
+#include <vector>
 
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
@@ -33,6 +34,39 @@ namespace profiling {
 
 class PerfRingBuffer {
  public:
+  // A record in place in the ring buffer. The record can wrap around the end
+  // of the buffer, so its fields are copied out rather than accessed in place.
+  class RecordView {
+   public:
+    RecordView(const char* buf, size_t buf_size, size_t pos)
+        : buf_(buf), buf_size_(buf_size), start_(pos), pos_(pos) {}
+
+    // The header is never split by the end of the buffer.
+    const perf_event_header* header() const {
+      return reinterpret_cast<const perf_event_header*>(buf_ + start_);
+    }
+
+    // Copies the next |size| bytes of the record to |dst|.
+    void Read(void* dst, size_t size);
+    template <typename T>
+    void ReadValue(T* value) {
+      Read(value, sizeof(T));
+    }
+    // Replaces the contents of |dst| with the next |size| bytes of the record.
+    // Reuses the capacity of |dst|, without zero-filling it first.
+    void ReadInto(std::vector<char>* dst, size_t size);
+    void Skip(size_t size) { pos_ = (pos_ + size) & (buf_size_ - 1); }
+
+    // Number of bytes of the record read or skipped so far.
+    size_t offset() const { return (pos_ - start_) & (buf_size_ - 1); }
+
+   private:
+    const char* buf_;
+    size_t buf_size_;  // power of two
+    size_t start_;
+    size_t pos_;
+  };
+
   static std::optional<PerfRingBuffer> Allocate(int perf_fd,
                                                 size_t data_page_count);
 
@@ -44,7 +78,9 @@ class PerfRingBuffer {
   PerfRingBuffer(PerfRingBuffer&& other) noexcept;
   PerfRingBuffer& operator=(PerfRingBuffer&& other) noexcept;
 
-  char* ReadRecordNonconsuming();
+  // Returns the next record without consuming it, or nullopt if caught up
+  // with the writer. The records are never copied out of the buffer.
+  std::optional<RecordView> ReadRecordNonconsuming();
   void Consume(size_t bytes);
 
  private:
@@ -62,11 +98,10 @@ class PerfRingBuffer {
   char* data_buf_ = nullptr;
   size_t data_buf_sz_ = 0;
 
-  // When a record wraps around the ring buffer boundary, it is reconstructed in
-  // a contiguous form in this buffer. This allows us to always return a pointer
-  // to a contiguous record.
-  constexpr static size_t kMaxPerfRecordSize = 1 << 16;  // max size 64k
-  alignas(uint64_t) char reconstructed_record_[kMaxPerfRecordSize];
+  // Last observed value of |data_head|. The records up to it are read without
+  // reloading it, so that it's loaded once per batch of records rather than
+  // once per record.
+  uint64_t cached_data_head_ = 0;
 };
 
 class EventReader {
@@ -77,9 +112,11 @@ class EventReader {
 
   // Consumes records from the ring buffer until either encountering a sample,
   // or catching up to the writer. The other record of interest
-  // (PERF_RECORD_LOST) is handled via the given callback.
+  // (PERF_RECORD_LOST) is handled via the given callback. The sampled stack
+  // is copied into a buffer from |stack_pool|.
   std::optional<ParsedSample> ReadUntilSample(
-      std::function<void(uint64_t)> lost_events_callback);
+      std::function<void(uint64_t)> lost_events_callback,
+      StackBufferPool* stack_pool);
 
   void EnableEvents();
   // Pauses the event counting, without invalidating existing samples.
@@ -101,7 +138,9 @@ class EventReader {
               base::ScopedFile perf_fd,
               PerfRingBuffer ring_buffer);
 
-  ParsedSample ParseSampleRecord(uint32_t cpu, const char* record_start);
+  ParsedSample ParseSampleRecord(uint32_t cpu,
+                                 PerfRingBuffer::RecordView* record,
+                                 StackBufferPool* stack_pool);
 
   // All events are cpu-bound (thread-scoped events not supported).
   const uint32_t cpu_;
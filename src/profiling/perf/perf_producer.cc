@@ -78,6 +78,10 @@ constexpr uint32_t kInitialConnectionBackoffMs = 100;
 constexpr uint32_t kMaxConnectionBackoffMs = 30 * 1000;
 
 constexpr char kProducerName[] = "perfetto.traced_perf";
+
+// Number of threads unwinding the sampled callstacks. The samples of all the
+// data sources for a given process are unwound by the same thread.
+constexpr size_t kUnwinderThreads = 4;
 constexpr char kDataSourceName[] = "linux.perf";
 
 size_t NumberOfCpus() {
@@ -369,11 +373,23 @@ PerfProducer::PerfProducer(ProcDescriptorGetter* proc_fd_getter,
                            base::TaskRunner* task_runner)
     : task_runner_(task_runner),
       proc_fd_getter_(proc_fd_getter),
-      unwinding_worker_(this),
       weak_factory_(this) {
+  for (size_t i = 0; i < kUnwinderThreads; ++i)
+    unwinding_workers_.emplace_back(new UnwinderHandle(this, &stack_pool_));
   proc_fd_getter->SetDelegate(this);
 }
 
+UnwinderHandle& PerfProducer::UnwinderForPid(pid_t pid) {
+  return *unwinding_workers_[static_cast<uint64_t>(pid) % kUnwinderThreads];
+}
+
+uint64_t PerfProducer::GetEnqueuedFootprint() {
+  uint64_t footprint = 0;
+  for (auto& unwinder : unwinding_workers_)
+    footprint += (*unwinder)->GetEnqueuedFootprint();
+  return footprint;
+}
+
 void PerfProducer::SetupDataSource(DataSourceInstanceID,
                                    const DataSourceConfig&) {}
 
@@ -472,11 +488,14 @@ void PerfProducer::StartDataSource(DataSourceInstanceID ds_id,
 
   // Inform unwinder of the new data source instance, and optionally start a
   // periodic task to clear its cached state.
-  unwinding_worker_->PostStartDataSource(ds_id,
-                                         ds.event_config.kernel_frames());
-  if (ds.event_config.unwind_state_clear_period_ms()) {
-    unwinding_worker_->PostClearCachedStatePeriodic(
-        ds_id, ds.event_config.unwind_state_clear_period_ms());
+  for (auto& unwinder : unwinding_workers_) {
+    (*unwinder)->PostStartDataSource(ds_id, ds.event_config.kernel_frames(),
+                                     ds.event_config.frame_pointer_unwinding());
+    if (ds.event_config.unwind_state_clear_period_ms()) {
+      (*unwinder)->PostClearCachedStatePeriodic(
+          ds_id, ds.event_config.unwind_state_clear_period_ms(),
+          ds.event_config.unwind_cache_budget_kb());
+    }
   }
 
   // Kick off periodic read task.
@@ -635,12 +654,16 @@ void PerfProducer::TickDataSourceRead(DataSourceInstanceID ds_id) {
     }
   }
 
-  // Wake up the unwinder as we've (likely) pushed samples into its queue.
-  unwinding_worker_->PostProcessQueue();
+  // Wake up the unwinders as we've (likely) pushed samples into their queues.
+  for (auto& unwinder : unwinding_workers_)
+    (*unwinder)->PostProcessQueue();
 
   if (PERFETTO_UNLIKELY(ds.status == DataSourceState::Status::kShuttingDown) &&
       !more_records_available) {
-    unwinding_worker_->PostInitiateDataSourceStop(ds_id);
+    // Each unwinder calls back to FinishDataSourceStop once done.
+    ds.unwinders_stopping = unwinding_workers_.size();
+    for (auto& unwinder : unwinding_workers_)
+      (*unwinder)->PostInitiateDataSourceStop(ds_id);
   } else {
     // otherwise, keep reading
     auto tick_period_ms = it->second.event_config.read_tick_period_ms();
@@ -672,7 +695,7 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
 
   for (uint64_t i = 0; i < max_samples; i++) {
     std::optional<ParsedSample> sample =
-        reader->ReadUntilSample(records_lost_callback);
+        reader->ReadUntilSample(records_lost_callback, &stack_pool_);
     if (!sample) {
       return false;  // caught up to the writer
     }
@@ -753,7 +776,7 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
         // Either a kernel thread (no need to obtain proc-fds), or a userspace
         // process but we're not recording userspace callstacks.
         process_state = ProcessTrackingStatus::kAccepted;
-        unwinding_worker_->PostRecordNoUserspaceProcess(ds_id, pid);
+        UnwinderForPid(pid)->PostRecordNoUserspaceProcess(ds_id, pid);
         // note: fallthrough
       }
     }
@@ -771,11 +794,13 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
     }
 
     // Optionally: drop sample if above a given threshold of sampled stacks
-    // that are waiting in the unwinding queue.
+    // that are waiting in the unwinding queues (of all the unwinders, as the
+    // threshold bounds the memory use of the whole producer).
+    UnwinderHandle& unwinder = UnwinderForPid(pid);
     uint64_t max_footprint_bytes = event_config.max_enqueued_footprint_bytes();
     uint64_t sample_stack_size = sample->stack.size();
     if (max_footprint_bytes) {
-      uint64_t footprint_bytes = unwinding_worker_->GetEnqueuedFootprint();
+      uint64_t footprint_bytes = GetEnqueuedFootprint();
       if (footprint_bytes + sample_stack_size >= max_footprint_bytes) {
         PERFETTO_DLOG("Skipping sample enqueueing due to footprint limit.");
         EmitSkippedSample(ds_id, std::move(sample.value()),
@@ -785,13 +810,13 @@ bool PerfProducer::ReadAndParsePerCpuBuffer(EventReader* reader,
     }
 
     // Push the sample into the unwinding queue if there is room.
-    auto& queue = unwinding_worker_->unwind_queue();
+    auto& queue = unwinder->unwind_queue();
     WriteView write_view = queue.BeginWrite();
     if (write_view.valid) {
       queue.at(write_view.write_pos) =
           UnwindEntry{ds_id, std::move(sample.value())};
       queue.CommitWrite();
-      unwinding_worker_->IncrementEnqueuedFootprint(sample_stack_size);
+      unwinder->IncrementEnqueuedFootprint(sample_stack_size);
     } else {
       PERFETTO_DLOG("Unwinder queue full, skipping sample");
       EmitSkippedSample(ds_id, std::move(sample.value()),
@@ -837,7 +862,7 @@ void PerfProducer::OnProcDescriptors(pid_t pid,
                     static_cast<int>(pid), static_cast<size_t>(it.first));
 
       proc_status_it->second = ProcessTrackingStatus::kAccepted;
-      unwinding_worker_->PostAdoptProcDescriptors(
+      UnwinderForPid(pid)->PostAdoptProcDescriptors(
           it.first, pid, std::move(maps_fd), std::move(mem_fd));
       return;  // done
     }
@@ -900,7 +925,7 @@ void PerfProducer::EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id,
     proc_status_it->second = ProcessTrackingStatus::kFdsTimedOut;
     // Also inform the unwinder of the state change (so that it can discard any
     // of the already-enqueued samples).
-    unwinding_worker_->PostRecordTimedOutProcDescriptors(ds_id, pid);
+    UnwinderForPid(pid)->PostRecordTimedOutProcDescriptors(ds_id, pid);
   }
 }
 
@@ -1001,6 +1026,9 @@ void PerfProducer::PostEmitSkippedSample(DataSourceInstanceID ds_id,
 void PerfProducer::EmitSkippedSample(DataSourceInstanceID ds_id,
                                      ParsedSample sample,
                                      SampleSkipReason reason) {
+  // The stack isn't recorded for skipped samples.
+  stack_pool_.Return(std::move(sample.stack));
+
   auto ds_it = data_sources_.find(ds_id);
   if (ds_it == data_sources_.end())
     return;
@@ -1061,6 +1089,9 @@ void PerfProducer::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   }
   DataSourceState& ds = ds_it->second;
   PERFETTO_CHECK(ds.status == DataSourceState::Status::kShuttingDown);
+  PERFETTO_CHECK(ds.unwinders_stopping > 0);
+  if (--ds.unwinders_stopping > 0)
+    return;  // wait for the other unwinders
 
   ds.trace_writer->Flush();
   data_sources_.erase(ds_it);
@@ -1070,6 +1101,7 @@ void PerfProducer::FinishDataSourceStop(DataSourceInstanceID ds_id) {
   // Clean up resources if there are no more active sources.
   if (data_sources_.empty()) {
     callstack_trie_.ClearTrie();  // purge internings
+    stack_pool_.Clear();
     base::MaybeReleaseAllocatorMemToOS();
   }
 }
@@ -1092,7 +1124,8 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   PERFETTO_LOG("Stopping DataSource(%zu) prematurely",
                static_cast<size_t>(ds_id));
 
-  unwinding_worker_->PostPurgeDataSource(ds_id);
+  for (auto& unwinder : unwinding_workers_)
+    (*unwinder)->PostPurgeDataSource(ds_id);
 
   // Write a packet indicating the abrupt stop.
   {
@@ -1112,6 +1145,7 @@ void PerfProducer::PurgeDataSource(DataSourceInstanceID ds_id) {
   // Clean up resources if there are no more active sources.
   if (data_sources_.empty()) {
     callstack_trie_.ClearTrie();  // purge internings
+    stack_pool_.Clear();
     base::MaybeReleaseAllocatorMemToOS();
   }
 }
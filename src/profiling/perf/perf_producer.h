@@ -21,6 +21,7 @@
 #include <map>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include <unwindstack/Error.h>
 #include <unwindstack/Regs.h>
@@ -52,7 +53,8 @@ namespace profiling {
 // summary in the mean time: three stages: (1) kernel buffer reader that parses
 // the samples -> (2) callstack unwinder -> (3) interning and serialization of
 // samples. This class handles stages (1) and (3) on the main thread. Unwinding
-// is done by |Unwinder| on a dedicated thread.
+// is done by |Unwinder|s on dedicated threads, with the samples of each process
+// always going to the same |Unwinder|.
 class PerfProducer : public Producer,
                      public ProcDescriptorDelegate,
                      public Unwinder::Delegate {
@@ -168,6 +170,9 @@ class PerfProducer : public Producer,
     // Additional state for EventConfig.TargetFilter: command lines we have
     // decided to unwind, up to a total of additional_cmdline_count values.
     base::FlatSet<std::string> additional_cmdlines;
+    // Number of unwinders which have yet to finish stopping the source, once
+    // it is shutting down.
+    size_t unwinders_stopping = 0;
   };
 
   // For |EmitSkippedSample|.
@@ -204,6 +209,10 @@ class PerfProducer : public Producer,
                              uint32_t timeout_ms);
   void EvaluateDescriptorLookupTimeout(DataSourceInstanceID ds_id, pid_t pid);
 
+  UnwinderHandle& UnwinderForPid(pid_t pid);
+  // Sum of the enqueued footprints of all the unwinders.
+  uint64_t GetEnqueuedFootprint();
+
   void EmitSample(DataSourceInstanceID ds_id, CompletedSample sample);
   void EmitRingBufferLoss(DataSourceInstanceID ds_id,
                           size_t cpu,
@@ -275,8 +284,15 @@ class PerfProducer : public Producer,
   // State associated with perf-sampling data sources.
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
 
-  // Unwinding stage, running on a dedicated thread.
-  UnwinderHandle unwinding_worker_;
+  // Buffers for the sampled stacks, recycled between the reading of the
+  // kernel buffers and the unwinders. Declared before the unwinders as they
+  // return buffers to it until they're destroyed.
+  StackBufferPool stack_pool_;
+
+  // Unwinding stage, running on kUnwinderThreads dedicated threads. The
+  // processes are sharded across the unwinders by pid (see UnwinderForPid), so
+  // each has its own queue and unwinding state.
+  std::vector<std::unique_ptr<UnwinderHandle>> unwinding_workers_;
 
   // Used for tracepoint name -> id lookups. Initialized lazily, and in general
   // best effort - can be null if tracefs isn't accessible.
@@ -18,6 +18,7 @@
 
 #include <cinttypes>
 #include <mutex>
+#include <shared_mutex>
 
 #include <unwindstack/Unwinder.h>
 
@@ -25,6 +26,7 @@
 #include "perfetto/ext/base/no_destructor.h"
 #include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
+#include "src/profiling/common/profiler_guardrails.h"
 
 namespace {
 constexpr size_t kUnwindingMaxFrames = 1000;
@@ -36,26 +38,34 @@ namespace profiling {
 
 Unwinder::Delegate::~Delegate() = default;
 
-Unwinder::Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner)
-    : task_runner_(task_runner), delegate_(delegate) {
+Unwinder::Unwinder(Delegate* delegate,
+                   base::UnixTaskRunner* task_runner,
+                   StackBufferPool* stack_pool)
+    : task_runner_(task_runner), delegate_(delegate), stack_pool_(stack_pool) {
   ResetAndEnableUnwindstackCache();
   base::MaybeSetThreadName("stack-unwinding");
 }
 
 void Unwinder::PostStartDataSource(DataSourceInstanceID ds_id,
-                                   bool kernel_frames) {
+                                   bool kernel_frames,
+                                   bool frame_pointer_unwinding) {
   // No need for a weak pointer as the associated task runner quits (stops
   // running tasks) strictly before the Unwinder's destruction.
-  task_runner_->PostTask(
-      [this, ds_id, kernel_frames] { StartDataSource(ds_id, kernel_frames); });
+  task_runner_->PostTask([this, ds_id, kernel_frames, frame_pointer_unwinding] {
+    StartDataSource(ds_id, kernel_frames, frame_pointer_unwinding);
+  });
 }
 
-void Unwinder::StartDataSource(DataSourceInstanceID ds_id, bool kernel_frames) {
+void Unwinder::StartDataSource(DataSourceInstanceID ds_id,
+                               bool kernel_frames,
+                               bool frame_pointer_unwinding) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Unwinder::StartDataSource(%zu)", static_cast<size_t>(ds_id));
 
   auto it_and_inserted = data_sources_.emplace(ds_id, DataSourceState{});
   PERFETTO_DCHECK(it_and_inserted.second);
+  it_and_inserted.first->second.frame_pointer_unwinding =
+      frame_pointer_unwinding;
 
   if (kernel_frames) {
     kernel_symbolizer_.GetOrCreateKernelSymbolMap();
@@ -114,6 +124,8 @@ void Unwinder::AdoptProcDescriptors(DataSourceInstanceID ds_id,
   proc_state.status = ProcessState::Status::kFdsResolved;
   proc_state.unwind_state =
       UnwindingMetadata{std::move(maps_fd), std::move(mem_fd)};
+  proc_state.unwind_state->frame_pointer_unwinding =
+      ds.frame_pointer_unwinding;
 }
 
 void Unwinder::PostRecordTimedOutProcDescriptors(DataSourceInstanceID ds_id,
@@ -225,6 +237,7 @@ base::FlatSet<DataSourceInstanceID> Unwinder::ConsumeAndUnwindReadySamples() {
     // Data source might be gone due to an abrupt stop.
     auto it = data_sources_.find(entry.data_source_id);
     if (it == data_sources_.end()) {
+      stack_pool_->Return(std::move(entry.sample.stack));
       entry = UnwindEntry::Invalid();
       DecrementEnqueuedFootprint(sampled_stack_bytes);
       continue;
@@ -239,9 +252,8 @@ base::FlatSet<DataSourceInstanceID> Unwinder::ConsumeAndUnwindReadySamples() {
       PERFETTO_DLOG("Unwinder skipping sample for pid [%d]: kFdsTimedOut",
                     static_cast<int>(pid));
 
-      // free up the sampled stack as the main thread has no use for it
-      entry.sample.stack.clear();
-      entry.sample.stack.shrink_to_fit();
+      // recycle the sampled stack as the main thread has no use for it
+      stack_pool_->Return(std::move(entry.sample.stack));
 
       delegate_->PostEmitUnwinderSkippedSample(entry.data_source_id,
                                                std::move(entry.sample));
@@ -275,9 +287,17 @@ base::FlatSet<DataSourceInstanceID> Unwinder::ConsumeAndUnwindReadySamples() {
           (proc_state.unwind_state.has_value()
                ? &proc_state.unwind_state.value()
                : nullptr);
-      CompletedSample unwound_sample = UnwindSample(
-          entry.sample, opt_user_state, proc_state.attempted_unwinding);
+      CompletedSample unwound_sample;
+      {
+        // The other unwinders might reset the libunwindstack cache.
+        std::shared_lock<std::shared_mutex> cache_lock(
+            UnwindstackCacheMutex());
+        unwound_sample = UnwindSample(entry.sample, opt_user_state,
+                                      proc_state.attempted_unwinding);
+      }
       proc_state.attempted_unwinding = true;
+      proc_state.unwound_since_clear = true;
+      stack_pool_->Return(std::move(entry.sample.stack));
 
       PERFETTO_METATRACE_COUNTER(TAG_PRODUCER, PROFILER_UNWIND_CURRENT_PID, 0);
 
@@ -374,11 +394,36 @@ CompletedSample Unwinder::UnwindSample(const ParsedSample& sample,
             unwinder.ConsumeFrames()};
   };
 
+  auto attempt_frame_pointer_unwind =
+      [&sample, unwind_state,
+       &overlay_memory](std::vector<unwindstack::FrameData>* frames) {
+        unwindstack::Unwinder unwinder(kUnwindingMaxFrames,
+                                       &unwind_state->fd_maps,
+                                       sample.regs.get(), overlay_memory);
+#if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
+        unwinder.SetJitDebug(unwind_state->GetJitDebug(sample.regs->Arch()));
+        unwinder.SetDexFiles(unwind_state->GetDexFiles(sample.regs->Arch()));
+#endif
+        return UnwindFramePointers(
+            &unwinder, sample.regs.get(),
+            reinterpret_cast<const uint8_t*>(sample.stack.data()),
+            sample.stack.size(), kUnwindingMaxFrames,
+            /*initial_map_names_to_skip=*/nullptr, frames);
+      };
+
+  // Only fall back to DWARF if the frame pointers are unusable.
+  UnwindResult unwind(unwindstack::ERROR_NONE, 0, {});
+  bool unwound = unwind_state->frame_pointer_unwinding &&
+                 attempt_frame_pointer_unwind(&unwind.frames);
+
   // first unwind attempt
-  UnwindResult unwind = attempt_unwind();
+  if (!unwound)
+    unwind = attempt_unwind();
 
-  bool should_retry = unwind.error_code == unwindstack::ERROR_INVALID_MAP ||
-                      unwind.warnings & unwindstack::WARNING_DEX_PC_NOT_IN_MAP;
+  bool should_retry =
+      !unwound &&
+      (unwind.error_code == unwindstack::ERROR_INVALID_MAP ||
+       unwind.warnings & unwindstack::WARNING_DEX_PC_NOT_IN_MAP);
 
   // ERROR_INVALID_MAP means that unwinding reached a point in memory without a
   // corresponding mapping. This is possible if the parsed /proc/pid/maps is
@@ -534,15 +579,19 @@ void Unwinder::PurgeDataSource(DataSourceInstanceID ds_id) {
 }
 
 void Unwinder::PostClearCachedStatePeriodic(DataSourceInstanceID ds_id,
-                                            uint32_t period_ms) {
+                                            uint32_t period_ms,
+                                            uint32_t budget_kb) {
   task_runner_->PostDelayedTask(
-      [this, ds_id, period_ms] { ClearCachedStatePeriodic(ds_id, period_ms); },
+      [this, ds_id, period_ms, budget_kb] {
+        ClearCachedStatePeriodic(ds_id, period_ms, budget_kb);
+      },
       period_ms);
 }
 
 // See header for rationale.
 void Unwinder::ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
-                                        uint32_t period_ms) {
+                                        uint32_t period_ms,
+                                        uint32_t budget_kb) {
   auto it = data_sources_.find(ds_id);
   if (it == data_sources_.end())
     return;  // stop the periodic task
@@ -552,30 +601,31 @@ void Unwinder::ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
     return;
 
   PERFETTO_METATRACE_SCOPED(TAG_PRODUCER, PROFILER_UNWIND_CACHE_CLEAR);
-  PERFETTO_DLOG("Clearing unwinder's cached state.");
 
-  for (auto& pid_and_process : ds.process_states) {
-    if (pid_and_process.second.status == ProcessState::Status::kFdsResolved)
-      pid_and_process.second.unwind_state->fd_maps.Reset();
+  bool clear_all = true;
+  if (budget_kb) {
+    ProfilerMemoryGuardrails footprint_snapshot;
+    std::optional<uint32_t> footprint_kb =
+        footprint_snapshot.anon_and_swap_kb();
+    clear_all = !footprint_kb || *footprint_kb > budget_kb;
   }
-  ResetAndEnableUnwindstackCache();
-  base::MaybeReleaseAllocatorMemToOS();
+  PERFETTO_DLOG("Clearing unwinder's cached state (%s).",
+                clear_all ? "all" : "idle processes");
 
-  PostClearCachedStatePeriodic(ds_id, period_ms);  // repost
-}
+  for (auto& pid_and_process : ds.process_states) {
+    ProcessState& process = pid_and_process.second;
+    if (process.status == ProcessState::Status::kFdsResolved &&
+        (clear_all || !process.unwound_since_clear)) {
+      process.unwind_state->fd_maps.Reset();
+    }
+    process.unwound_since_clear = false;
+  }
+  if (clear_all) {
+    ResetAndEnableUnwindstackCache();
+    base::MaybeReleaseAllocatorMemToOS();
+  }
 
-void Unwinder::ResetAndEnableUnwindstackCache() {
-  PERFETTO_DLOG("Resetting unwindstack cache");
-  // Libunwindstack uses an unsynchronized variable for setting/checking whether
-  // the cache is enabled. Therefore unwinding and cache toggling should stay on
-  // the same thread, but we might be moving unwinding across threads if we're
-  // recreating |Unwinder| instances (during a reconnect to traced). Therefore,
-  // use our own static lock to synchronize the cache toggling.
-  // TODO(rsavitski): consider fixing this in libunwindstack itself.
-  static std::mutex* lock = new std::mutex{};
-  std::lock_guard<std::mutex> guard{*lock};
-  unwindstack::Elf::SetCachingEnabled(false);  // free any existing state
-  unwindstack::Elf::SetCachingEnabled(true);   // reallocate a fresh cache
+  PostClearCachedStatePeriodic(ds_id, period_ms, budget_kb);  // repost
 }
 
 }  // namespace profiling
@@ -89,7 +89,9 @@ class Unwinder {
 
   ~Unwinder() { PERFETTO_DCHECK_THREAD(thread_checker_); }
 
-  void PostStartDataSource(DataSourceInstanceID ds_id, bool kernel_frames);
+  void PostStartDataSource(DataSourceInstanceID ds_id,
+                           bool kernel_frames,
+                           bool frame_pointer_unwinding);
   void PostAdoptProcDescriptors(DataSourceInstanceID ds_id,
                                 pid_t pid,
                                 base::ScopedFile maps_fd,
@@ -101,7 +103,8 @@ class Unwinder {
   void PostPurgeDataSource(DataSourceInstanceID ds_id);
 
   void PostClearCachedStatePeriodic(DataSourceInstanceID ds_id,
-                                    uint32_t period_ms);
+                                    uint32_t period_ms,
+                                    uint32_t budget_kb);
 
   UnwindQueue<UnwindEntry, kUnwindQueueCapacity>& unwind_queue() {
     return unwind_queue_;
@@ -140,12 +143,16 @@ class Unwinder {
     // Used to distinguish first-time unwinding attempts for a process, for
     // logging purposes.
     bool attempted_unwinding = false;
+    // Whether a sample of the process was unwound since the last periodic
+    // clear of the cached state.
+    bool unwound_since_clear = false;
   };
 
   struct DataSourceState {
     enum class Status { kActive, kShuttingDown };
 
     Status status = Status::kActive;
+    bool frame_pointer_unwinding = false;
     std::map<pid_t, ProcessState> process_states;
   };
 
@@ -159,11 +166,15 @@ class Unwinder {
   };
 
   // Must be instantiated via the |UnwinderHandle|.
-  Unwinder(Delegate* delegate, base::UnixTaskRunner* task_runner);
+  Unwinder(Delegate* delegate,
+           base::UnixTaskRunner* task_runner,
+           StackBufferPool* stack_pool);
 
   // Marks the data source as valid and active at the unwinding stage.
   // Initializes kernel address symbolization if needed.
-  void StartDataSource(DataSourceInstanceID ds_id, bool kernel_frames);
+  void StartDataSource(DataSourceInstanceID ds_id,
+                       bool kernel_frames,
+                       bool frame_pointer_unwinding);
 
   void AdoptProcDescriptors(DataSourceInstanceID ds_id,
                             pid_t pid,
@@ -232,17 +243,25 @@ class Unwinder {
   // Note that this operation is heavy in terms of cpu%, and should therefore
   // be called only for profiling configs that require it.
   //
+  // If |budget_kb| is non-zero, the clear is narrowed down while the daemon's
+  // anon+swap memory is within the budget: only the parsed maps of the
+  // processes which were not sampled since the previous period are dropped,
+  // and the libunwindstack cache (with e.g. libc, shared by all the processes)
+  // is kept. The recently sampled processes keep their parsed maps.
+  //
   // TODO(rsavitski): dropping the full parsed maps is somewhat excessive, could
   // instead clear just the |MapInfo.elf| shared_ptr, but that's considered too
   // brittle as it's an implementation detail of libunwindstack.
   // TODO(rsavitski): improve libunwindstack cache's architecture (it is still
   // worth having at the moment to speed up unwinds across map reparses).
-  void ClearCachedStatePeriodic(DataSourceInstanceID ds_id, uint32_t period_ms);
-
-  void ResetAndEnableUnwindstackCache();
+  void ClearCachedStatePeriodic(DataSourceInstanceID ds_id,
+                                uint32_t period_ms,
+                                uint32_t budget_kb);
 
   base::UnixTaskRunner* const task_runner_;
   Delegate* const delegate_;
+  // Receives the sampled stacks once they're no longer needed.
+  StackBufferPool* const stack_pool_;
   UnwindQueue<UnwindEntry, kUnwindQueueCapacity> unwind_queue_;
   QueueFootprintTracker footprint_tracker_;
   std::map<DataSourceInstanceID, DataSourceState> data_sources_;
@@ -257,7 +276,7 @@ class Unwinder {
 // owned state, and consolidate.
 class UnwinderHandle {
  public:
-  explicit UnwinderHandle(Unwinder::Delegate* delegate) {
+  UnwinderHandle(Unwinder::Delegate* delegate, StackBufferPool* stack_pool) {
     std::mutex init_lock;
     std::condition_variable init_cv;
 
@@ -275,7 +294,7 @@ class UnwinderHandle {
         };
 
     thread_ = std::thread(&UnwinderHandle::RunTaskThread, this,
-                          std::move(initializer), delegate);
+                          std::move(initializer), delegate, stack_pool);
 
     std::unique_lock<std::mutex> lock(init_lock);
     init_cv.wait(lock, [this] { return !!task_runner_ && !!unwinder_; });
@@ -297,9 +316,10 @@ class UnwinderHandle {
  private:
   void RunTaskThread(
       std::function<void(base::UnixTaskRunner*, Unwinder*)> initializer,
-      Unwinder::Delegate* delegate) {
+      Unwinder::Delegate* delegate,
+      StackBufferPool* stack_pool) {
     base::UnixTaskRunner task_runner;
-    Unwinder unwinder(delegate, &task_runner);
+    Unwinder unwinder(delegate, &task_runner, stack_pool);
     task_runner.PostTask(
         std::bind(std::move(initializer), &task_runner, &unwinder));
     task_runner.Run();
@@ -13,15 +13,14 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
-#include <memory>
-
 #include "src/profiling/symbolizer/breakpad_parser.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
-#include "perfetto/ext/base/string_splitter.h"
-#include "perfetto/ext/base/string_utils.h"
-#include "perfetto/ext/base/string_writer.h"
 
 namespace perfetto {
 namespace profiling {
@@ -32,28 +31,53 @@ bool SymbolComparator(const uint64_t i, const BreakpadParser::Symbol& sym) {
   return i < sym.start_address;
 }
 
-std::optional<std::string> GetFileContents(const std::string& file_path) {
-  std::string file_contents;
-  base::ScopedFile fd = base::OpenFile(file_path, O_RDONLY);
-  // Read the contents of the file into |file_contents|.
-  if (!fd) {
-    return std::nullopt;
-  }
-  if (!base::ReadFileDescriptor(fd.get(), &file_contents)) {
+bool StartAddressLess(const BreakpadParser::Symbol& a,
+                      const BreakpadParser::Symbol& b) {
+  return a.start_address < b.start_address;
+}
+
+// Returns the first space separated token of |*line| and removes it, with the
+// spaces that follow, from |*line|.
+base::StringView NextToken(base::StringView* line) {
+  size_t space = line->find(' ');
+  base::StringView token = line->substr(0, space);
+  size_t next = space;
+  while (next < line->size() && line->at(next) == ' ')
+    next++;
+  *line = line->substr(next);
+  return token;
+}
+
+// Like base::CStringToUInt64(token, 16) but doesn't need a null terminated
+// string, so that the mapped file can be parsed in place.
+std::optional<uint64_t> ParseHex(base::StringView token) {
+  if (token.empty() || token.size() > 16)
     return std::nullopt;
+  uint64_t value = 0;
+  for (size_t i = 0; i < token.size(); ++i) {
+    char c = token.at(i);
+    uint64_t digit;
+    if (c >= '0' && c <= '9') {
+      digit = static_cast<uint64_t>(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      digit = static_cast<uint64_t>(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      digit = static_cast<uint64_t>(c - 'A' + 10);
+    } else {
+      return std::nullopt;
+    }
+    value = (value << 4) | digit;
   }
-
-  return std::make_optional(std::move(file_contents));
+  return value;
 }
 
 // Parses the given string and determines if it begins with the label
 // 'MODULE'. Returns an ok status if it does begin with this label and a fail
 // status otherwise.
 base::Status ParseIfModuleRecord(base::StringView first_line) {
-  // Split the given line by spaces.
   const char kModuleLabel[] = "MODULE";
   // Check to see if the line starts with 'MODULE'.
-  if (!base::StartsWith(first_line.ToStdString(), kModuleLabel)) {
+  if (!first_line.StartsWith(kModuleLabel)) {
     return base::Status("Breakpad file not formatted correctly.");
   }
   return base::OkStatus();
@@ -64,16 +88,22 @@ base::Status ParseIfModuleRecord(base::StringView first_line) {
 BreakpadParser::BreakpadParser(const std::string& file_path)
     : file_path_(file_path) {}
 
+BreakpadParser::~BreakpadParser() = default;
+
 bool BreakpadParser::ParseFile() {
-  std::optional<std::string> file_contents = GetFileContents(file_path_);
-  if (!file_contents) {
+  map_ = base::ReadMmapWholeFile(file_path_.c_str());
+  if (map_.IsValid()) {
+    data_ = static_cast<const char*>(map_.data());
+    size_ = map_.length();
+  } else if (base::GetFileSize(file_path_) != 0u) {
+    // Empty files can't be mapped, but are valid.
     PERFETTO_ELOG("Could not get file contents of %s.", file_path_.c_str());
     return false;
   }
 
   // TODO(uwemwilson): Extract a build id and store it in the Symbol object.
 
-  if (!ParseFromString(*file_contents)) {
+  if (!ParseContents()) {
     PERFETTO_ELOG("Could not parse file contents.");
     return false;
   }
@@ -82,60 +112,94 @@ bool BreakpadParser::ParseFile() {
 }
 
 bool BreakpadParser::ParseFromString(const std::string& file_contents) {
-  // Create StringSplitter objects for each line so that specific lines can be
-  // used to create StringSplitter objects for words on that line.
-  base::StringSplitter lines(file_contents, '\n');
-  if (!lines.Next()) {
-    // File must be empty, so just return true and continue.
-    return true;
-  }
+  contents_ = file_contents;
+  data_ = contents_.data();
+  size_ = contents_.size();
+  return ParseContents();
+}
 
-  // TODO(crbug/1239750): Extract a build id and store it in the Symbol object.
-  base::StringView first_line(lines.cur_token(), lines.cur_token_size());
-  base::Status parse_record_status = ParseIfModuleRecord(first_line);
-  if (!parse_record_status.ok()) {
-    PERFETTO_ELOG("%s Breakpad files should begin with a MODULE record",
-                  parse_record_status.message().c_str());
-    return false;
-  }
+bool BreakpadParser::ParseContents() {
+  symbols_.clear();
+  public_symbols_.clear();
+  bool first_line = true;
+  const char* end = data_ + size_;
+  for (const char* line = data_; line < end;) {
+    const char* line_end = static_cast<const char*>(
+        memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (!line_end)
+      line_end = end;
+    size_t line_size = static_cast<size_t>(line_end - line);
+    const char* cur_line = line;
+    line = line_end + 1;
+    if (line_size == 0)
+      continue;
 
-  // Parse each line.
-  while (lines.Next()) {
-    parse_record_status = ParseIfFuncRecord(lines.cur_token());
-    if (!parse_record_status.ok()) {
-      PERFETTO_ELOG("%s", parse_record_status.message().c_str());
+    // TODO(crbug/1239750): Extract a build id and store it in the Symbol
+    // object.
+    if (first_line) {
+      first_line = false;
+      base::Status status =
+          ParseIfModuleRecord(base::StringView(cur_line, line_size));
+      if (!status.ok()) {
+        PERFETTO_ELOG("%s Breakpad files should begin with a MODULE record",
+                      status.message().c_str());
+        return false;
+      }
+      continue;
+    }
+
+    base::Status status = ParseIfSymbolRecord(cur_line, line_size);
+    if (!status.ok()) {
+      PERFETTO_ELOG("%s", status.message().c_str());
+      symbols_.clear();
+      public_symbols_.clear();
       return false;
     }
   }
 
+  // Symbol files are normally sorted already.
+  if (!std::is_sorted(symbols_.begin(), symbols_.end(), StartAddressLess))
+    std::stable_sort(symbols_.begin(), symbols_.end(), StartAddressLess);
+  if (!std::is_sorted(public_symbols_.begin(), public_symbols_.end(),
+                      StartAddressLess)) {
+    std::stable_sort(public_symbols_.begin(), public_symbols_.end(),
+                     StartAddressLess);
+  }
   return true;
 }
 
-std::optional<std::string> BreakpadParser::GetSymbol(uint64_t address) const {
+std::optional<base::StringView> BreakpadParser::GetSymbol(
+    uint64_t address) const {
   // Returns an iterator pointing to the first element where the symbol's start
   // address is greater than |address|.
   auto it = std::upper_bound(symbols_.begin(), symbols_.end(), address,
                              &SymbolComparator);
-  // If the first symbol's address is greater than |address| then |address| is
-  // too low to appear in |symbols_|.
-  if (it == symbols_.begin()) {
-    return std::nullopt;
-  }
   // upper_bound() returns the first symbol who's start address is greater than
   // |address|. Therefore to find the symbol with a range of addresses that
   // |address| falls into, we check the previous symbol.
-  it--;
+  const Symbol* func = it == symbols_.begin() ? nullptr : &*(it - 1);
   // Check to see if the address is in the function's range.
-  if (address >= it->start_address &&
-      address < it->start_address + it->function_size) {
-    return it->symbol_name;
-  }
-  return std::nullopt;
+  if (func && address < func->start_address + func->function_size)
+    return GetSymbolName(*func);
+
+  // Otherwise fall back to the closest PUBLIC symbol, unless a FUNC starts
+  // between the two.
+  auto pub_it = std::upper_bound(public_symbols_.begin(),
+                                 public_symbols_.end(), address,
+                                 &SymbolComparator);
+  if (pub_it == public_symbols_.begin())
+    return std::nullopt;
+  const Symbol& pub = *(pub_it - 1);
+  if (func && func->start_address >= pub.start_address)
+    return std::nullopt;
+  return GetSymbolName(pub);
 }
 
-base::Status BreakpadParser::ParseIfFuncRecord(base::StringView current_line) {
-  // Parses a FUNC record from a file. Structure of a FUNC record:
+base::Status BreakpadParser::ParseIfSymbolRecord(const char* line,
+                                                 size_t line_size) {
+  // Parses a FUNC or PUBLIC record from a file. Structure of the records:
   // FUNC [m] address size parameter_size name
+  // PUBLIC [m] address parameter_size name
   // m: The m field is optional. If present it indicates that multiple symbols
   //   reference this function's instructions. (In which case, only one symbol
   //   name is mentioned within the breakpad file.)
@@ -147,66 +211,53 @@ base::Status BreakpadParser::ParseIfFuncRecord(base::StringView current_line) {
   // name: The function name. This field may contain spaces.
   // More info at
   // https://chromium.googlesource.com/breakpad/breakpad/+/HEAD/docs/symbol_files.md
+  base::StringView rest(line, line_size);
+  if (rest.at(rest.size() - 1) == '\r')
+    rest = rest.substr(0, rest.size() - 1);
 
-  const char kFuncLabel[] = "FUNC";
-  base::StringSplitter words(current_line.ToStdString(), ' ');
-  // Check to see if the first word indicates a FUNC record. If it is, create a
-  // Symbol struct and add tokens from words. If it isn't the function can just
-  // return true and resume parsing file.
-  if (!words.Next() || strcmp(words.cur_token(), kFuncLabel) != 0) {
+  // Most lines are LINE records, which start with a hex address, so check the
+  // first character before looking at the whole label.
+  if (rest.empty() || (rest.at(0) != 'F' && rest.at(0) != 'P'))
+    return base::OkStatus();
+  base::StringView label = NextToken(&rest);
+  bool is_func = label == "FUNC";
+  if (!is_func && label != "PUBLIC")
     return base::OkStatus();
-  }
 
   Symbol new_symbol;
-  // There can be either 4 or 5 FUNC record tokens. The second token, 'm' is
-  // optional.
-  const char kOptionalArg[] = "m";
-  // Get the first argument on the line.
-  words.Next();
-
+  base::StringView token = NextToken(&rest);
   // If the optional argument is present, skip to the next token.
-  if (strcmp(words.cur_token(), kOptionalArg) == 0) {
-    words.Next();
-  }
+  if (token == "m")
+    token = NextToken(&rest);
 
   // Get the start address.
-  std::optional<uint64_t> optional_address =
-      base::CStringToUInt64(words.cur_token(), 16);
+  std::optional<uint64_t> optional_address = ParseHex(token);
   if (!optional_address) {
     return base::Status("Address should be hexadecimal.");
   }
   new_symbol.start_address = *optional_address;
 
   // Get the function size.
-  words.Next();
-  std::optional<size_t> optional_func_size =
-      base::CStringToUInt32(words.cur_token(), 16);
-  if (!optional_func_size) {
-    return base::Status("Function size should be hexadecimal.");
+  if (is_func) {
+    std::optional<uint64_t> optional_func_size = ParseHex(NextToken(&rest));
+    if (!optional_func_size || *optional_func_size > UINT32_MAX) {
+      return base::Status("Function size should be hexadecimal.");
+    }
+    new_symbol.function_size = static_cast<uint32_t>(*optional_func_size);
   }
-  new_symbol.function_size = *optional_func_size;
 
   // Skip the parameter size.
-  words.Next();
-
-  // Get the function name. Function names can have spaces, so any token is now
-  // considered a part of the function name and will be appended to the buffer
-  // in |func_name_writer|.
-  std::unique_ptr<char[]> joined_string(new char[current_line.size()]);
-  base::StringWriter func_name_writer(joined_string.get(), current_line.size());
-  bool first_token = true;
-  while (words.Next()) {
-    if (!first_token) {
-      func_name_writer.AppendChar(' ');
-    } else {
-      first_token = false;
-    }
-    func_name_writer.AppendString(words.cur_token(), strlen(words.cur_token()));
-  }
+  NextToken(&rest);
 
-  new_symbol.symbol_name = func_name_writer.GetStringView().ToStdString();
+  // The function name is the rest of the line, as it can have spaces.
+  if (!rest.empty())
+    new_symbol.name_offset = static_cast<size_t>(rest.data() - data_);
+  new_symbol.name_size = static_cast<uint32_t>(rest.size());
 
-  symbols_.push_back(std::move(new_symbol));
+  if (is_func)
+    symbols_.push_back(new_symbol);
+  else
+    public_symbols_.push_back(new_symbol);
 
   return base::OkStatus();
 }
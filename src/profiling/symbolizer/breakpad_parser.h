@@ -17,11 +17,13 @@
 #ifndef SRC_PROFILING_SYMBOLIZER_BREAKPAD_PARSER_H_
 #define SRC_PROFILING_SYMBOLIZER_BREAKPAD_PARSER_H_
 
+#include <cstdint>
 #include <optional>
 #include <string>
 #include <vector>
 
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/scoped_mmap.h"
 #include "perfetto/ext/base/string_view.h"
 
 namespace perfetto {
@@ -36,19 +38,27 @@ namespace profiling {
 //
 // BreakpadParser parser("file.breakpad");
 // parser.ParseFile();
-// std::string symbol = parser.GetSymbol(addr);
+// std::optional<base::StringView> symbol = parser.GetSymbol(addr);
+//
+// Symbol files can be hundreds of MB, so the file is mmapped rather than read,
+// and only a compact index of the FUNC and PUBLIC records is built, in a single
+// pass. Function names are views into the mapping, which are only looked at
+// when an address resolves to them.
 class BreakpadParser {
  public:
   struct Symbol {
     // The address where a function starts.
     uint64_t start_address = 0;
-    // The length in bytes of the function's instructions.
-    size_t function_size = 0;
-    // The human-readable name for the function signature.
-    std::string symbol_name;
+    // Offset of the name in the file contents.
+    size_t name_offset = 0;
+    // The length in bytes of the function's instructions. Always 0 for PUBLIC
+    // records, which extend up to the next symbol.
+    uint32_t function_size = 0;
+    uint32_t name_size = 0;
   };
 
   explicit BreakpadParser(const std::string& file_path);
+  ~BreakpadParser();
 
   BreakpadParser(const BreakpadParser& other) = delete;
   BreakpadParser& operator=(const BreakpadParser& other) = delete;
@@ -61,22 +71,42 @@ class BreakpadParser {
   // Parses from  a string instead of a file.
   bool ParseFromString(const std::string& file_contents);
 
-  // Returns the function name corresponding to |address| as a string. The
-  // search is log(N) on the number of functions in the binary. |address| is the
-  // relative offset from the start of the binary.
-  std::optional<std::string> GetSymbol(uint64_t address) const;
+  // Returns the function name corresponding to |address|, which points into
+  // the parsed file and is valid as long as the parser. FUNC records take
+  // precedence, and PUBLIC ones are only used for addresses after the end of
+  // the last FUNC before them. The search is log(N) on the number of symbols
+  // in the binary. |address| is the relative offset from the start of the
+  // binary.
+  std::optional<base::StringView> GetSymbol(uint64_t address) const;
+
+  base::StringView GetSymbolName(const Symbol& symbol) const {
+    return base::StringView(data_ + symbol.name_offset, symbol.name_size);
+  }
 
+  // Both sorted by start address.
   const std::vector<Symbol>& symbols_for_testing() const { return symbols_; }
+  const std::vector<Symbol>& public_symbols_for_testing() const {
+    return public_symbols_;
+  }
 
  private:
-  // Parses the given string and creates a new Symbol object if it is a FUNC
-  // record. Returns an ok status if it was successfully able to add to the
-  // |symbols_| or if the string is not a FUNC record. Return a fail status on
-  // parsing errors on FUNC record.
-  base::Status ParseIfFuncRecord(base::StringView current_line);
+  bool ParseContents();
+
+  // Parses the given line and adds a Symbol to |symbols_| or
+  // |public_symbols_| if it is a FUNC or PUBLIC record. Returns an ok status if
+  // it was successfully able to add the symbol or if the line is another
+  // record. Return a fail status on parsing errors on FUNC and PUBLIC records.
+  base::Status ParseIfSymbolRecord(const char* line, size_t line_size);
 
   std::vector<Symbol> symbols_;
+  std::vector<Symbol> public_symbols_;
   const std::string file_path_;
+
+  // The parsed contents, either |map_| or |contents_|.
+  base::ScopedMmap map_;
+  std::string contents_;
+  const char* data_ = nullptr;
+  size_t size_ = 0;
 };
 
 }  // namespace profiling
@@ -62,8 +62,8 @@ TEST(BreakpadParserTest, ContainsOneFuncRecord) {
       "PUBLIC 2e7c0 0 items\n";
   ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
   ASSERT_EQ(parser.symbols_for_testing().size(), 1u);
-  EXPECT_STREQ(parser.symbols_for_testing()[0].symbol_name.c_str(),
-               "foo::bar()");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[0]),
+            "foo::bar()");
   EXPECT_EQ(parser.symbols_for_testing()[0].start_address,
             static_cast<uint64_t>(0x1010));
 }
@@ -79,16 +79,18 @@ TEST(BreakpadParserTest, ContainsManyFuncRecords) {
       "FUNC 10d0 6b 0 baz_baz()\n";
   ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
   ASSERT_EQ(parser.symbols_for_testing().size(), 3u);
-  EXPECT_STREQ(parser.symbols_for_testing()[0].symbol_name.c_str(), "foo_foo");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[0]),
+            "foo_foo");
   EXPECT_EQ(parser.symbols_for_testing()[0].start_address,
             static_cast<uint64_t>(0x1010));
   EXPECT_EQ(parser.symbols_for_testing()[0].function_size, 35u);
-  EXPECT_STREQ(parser.symbols_for_testing()[1].symbol_name.c_str(), "bar_1");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[1]),
+            "bar_1");
   EXPECT_EQ(parser.symbols_for_testing()[1].start_address,
             static_cast<uint64_t>(0x1040));
   EXPECT_EQ(parser.symbols_for_testing()[1].function_size, 132u);
-  EXPECT_STREQ(parser.symbols_for_testing()[2].symbol_name.c_str(),
-               "baz_baz()");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[2]),
+            "baz_baz()");
   EXPECT_EQ(parser.symbols_for_testing()[2].start_address,
             static_cast<uint64_t>(0x10d0));
   EXPECT_EQ(parser.symbols_for_testing()[2].function_size, 107u);
@@ -103,11 +105,12 @@ TEST(BreakpadParserTest, OptionalArgument) {
       "FUNC m 1040 84 0 bar_1\n";
   ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
   ASSERT_EQ(parser.symbols_for_testing().size(), 2u);
-  EXPECT_STREQ(parser.symbols_for_testing()[0].symbol_name.c_str(),
-               "foo_foo()");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[0]),
+            "foo_foo()");
   EXPECT_EQ(parser.symbols_for_testing()[0].start_address,
             static_cast<uint64_t>(0x1010));
-  EXPECT_STREQ(parser.symbols_for_testing()[1].symbol_name.c_str(), "bar_1");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[1]),
+            "bar_1");
   EXPECT_EQ(parser.symbols_for_testing()[1].start_address,
             static_cast<uint64_t>(0x1040));
 }
@@ -123,11 +126,12 @@ TEST(BreakpadParserTest, FuncNameWithSpaces) {
       "FUNC 10d0 6b 0 baz\n";
   ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
   ASSERT_EQ(parser.symbols_for_testing().size(), 3u);
-  EXPECT_STREQ(parser.symbols_for_testing()[0].symbol_name.c_str(),
-               "foo foo foo");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[0]),
+            "foo foo foo");
   EXPECT_EQ(parser.symbols_for_testing()[0].start_address,
             static_cast<uint64_t>(0x1010));
-  EXPECT_STREQ(parser.symbols_for_testing()[2].symbol_name.c_str(), "baz");
+  EXPECT_EQ(parser.GetSymbolName(parser.symbols_for_testing()[2]),
+            "baz");
   EXPECT_EQ(parser.symbols_for_testing()[2].start_address,
             static_cast<uint64_t>(0x10d0));
 }
@@ -209,6 +213,48 @@ TEST(BreakpadParserTest, AddrBetweenFunctions) {
   EXPECT_FALSE(parser.GetSymbol(0x1036U));
 }
 
+TEST(BreakpadParserTest, PublicRecords) {
+  BreakpadParser parser(kFakeFilePath);
+  constexpr char kTestFileContents[] =
+      "MODULE mac x86_64 E3A0F28FBCB43C15986D8608AF1DD2380 exif.so\n"
+      "FUNC 1010 23 0 foo\n"
+      "PUBLIC 1000 0 pub_before\n"
+      "PUBLIC m 1040 0 pub_after\n";
+  ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
+  ASSERT_EQ(parser.public_symbols_for_testing().size(), 2u);
+  EXPECT_EQ(*parser.GetSymbol(0x1008U), "pub_before");
+  // FUNC records take precedence.
+  EXPECT_EQ(*parser.GetSymbol(0x1020U), "foo");
+  // A FUNC starts between the PUBLIC and the address.
+  EXPECT_FALSE(parser.GetSymbol(0x1038U));
+  EXPECT_EQ(*parser.GetSymbol(0x5000U), "pub_after");
+}
+
+TEST(BreakpadParserTest, UnsortedRecordsAndCrLf) {
+  BreakpadParser parser(kFakeFilePath);
+  constexpr char kTestFileContents[] =
+      "MODULE mac x86_64 E3A0F28FBCB43C15986D8608AF1DD2380 exif.so\r\n"
+      "FUNC 10d0 6b 0 baz\r\n"
+      "FUNC 1010 23 0 foo\r\n";
+  ASSERT_TRUE(parser.ParseFromString(kTestFileContents));
+  ASSERT_EQ(parser.symbols_for_testing().size(), 2u);
+  EXPECT_EQ(parser.symbols_for_testing()[0].start_address, 0x1010u);
+  EXPECT_EQ(*parser.GetSymbol(0x1010U), "foo");
+  EXPECT_EQ(*parser.GetSymbol(0x10d0U), "baz");
+}
+
+TEST(BreakpadParserTest, ParsesMappedFile) {
+  base::TempFile file = base::TempFile::Create();
+  constexpr char kTestFileContents[] =
+      "MODULE mac x86_64 E3A0F28FBCB43C15986D8608AF1DD2380 exif.so\n"
+      "FUNC 1010 23 0 foo::bar(int, char)\n";
+  ASSERT_TRUE(base::WriteAll(file.fd(), kTestFileContents,
+                             sizeof(kTestFileContents) - 1));
+  BreakpadParser parser(file.path());
+  ASSERT_TRUE(parser.ParseFile());
+  EXPECT_EQ(*parser.GetSymbol(0x1020U), "foo::bar(int, char)");
+}
+
 }  // namespace
 }  // namespace profiling
 }  // namespace perfetto
@@ -85,9 +85,9 @@ std::vector<std::vector<SymbolizedFrame>> BreakpadSymbolizer::Symbolize(
   // Add each address's function name to the |result| vector in the same order.
   for (uint64_t addr : address) {
     SymbolizedFrame frame;
-    std::optional<std::string> opt_func_name = parser.GetSymbol(addr);
+    std::optional<base::StringView> opt_func_name = parser.GetSymbol(addr);
     if (opt_func_name) {
-      frame.function_name = *opt_func_name;
+      frame.function_name = opt_func_name->ToStdString();
       num_symbolized_frames++;
     }
     result.push_back({std::move(frame)});
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/caching_symbolizer.h"
+
+#include <fcntl.h>
+
+#include <cinttypes>
+#include <optional>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
+
+namespace perfetto {
+namespace profiling {
+
+namespace {
+
+// Parses "<line>\t<file name>\t<function name>". The function name can
+// contain tabs, the file name can't.
+std::optional<SymbolizedFrame> ParseFrame(const std::string& line) {
+  size_t first_tab = line.find('\t');
+  if (first_tab == std::string::npos)
+    return std::nullopt;
+  size_t second_tab = line.find('\t', first_tab + 1);
+  if (second_tab == std::string::npos)
+    return std::nullopt;
+  std::optional<uint32_t> line_no =
+      base::StringToUInt32(line.substr(0, first_tab));
+  if (!line_no)
+    return std::nullopt;
+  SymbolizedFrame frame;
+  frame.line = *line_no;
+  frame.file_name = line.substr(first_tab + 1, second_tab - first_tab - 1);
+  frame.function_name = line.substr(second_tab + 1);
+  return frame;
+}
+
+// Parses the records of a cache file into |cache|, stopping at the first
+// malformed one (e.g. truncated by a writer that died). Returns false if there
+// was any.
+bool ParseCacheFile(const std::string& contents,
+                    std::map<std::pair<uint64_t, uint64_t>,
+                             std::vector<SymbolizedFrame>>* cache) {
+  if (contents.empty())
+    return true;
+  // Only complete lines are considered.
+  size_t end = contents.rfind('\n');
+  if (end == std::string::npos)
+    return false;
+  std::vector<std::string> lines =
+      base::SplitString(contents.substr(0, end), "\n");
+  for (size_t i = 0; i < lines.size();) {
+    std::vector<std::string> header = base::SplitString(lines[i++], " ");
+    if (header.size() != 3)
+      return false;
+    std::optional<uint64_t> load_bias = base::StringToUInt64(header[0], 16);
+    std::optional<uint64_t> address = base::StringToUInt64(header[1], 16);
+    std::optional<uint32_t> frame_count = base::StringToUInt32(header[2]);
+    if (!load_bias || !address || !frame_count ||
+        *frame_count > lines.size() - i) {
+      return false;
+    }
+    std::vector<SymbolizedFrame> frames;
+    for (uint32_t j = 0; j < *frame_count; ++j) {
+      std::optional<SymbolizedFrame> frame = ParseFrame(lines[i++]);
+      if (!frame)
+        return false;
+      frames.emplace_back(std::move(*frame));
+    }
+    (*cache)[{*load_bias, *address}] = std::move(frames);
+  }
+  return end == contents.size() - 1;
+}
+
+// Newlines would break the line-based format, and tabs in the file name the
+// frame parsing, neither are expected in practice.
+std::string Sanitize(const std::string& str, bool replace_tabs) {
+  std::string ret = base::ReplaceAll(str, "\n", " ");
+  if (replace_tabs)
+    ret = base::ReplaceAll(ret, "\t", " ");
+  return ret;
+}
+
+void AppendRecord(uint64_t load_bias,
+                  uint64_t address,
+                  const std::vector<SymbolizedFrame>& frames,
+                  std::string* out) {
+  base::StackString<64> header("%" PRIx64 " %" PRIx64 " %zu\n", load_bias,
+                               address, frames.size());
+  *out += header.ToStdString();
+  for (const SymbolizedFrame& frame : frames) {
+    *out += std::to_string(frame.line) + "\t" +
+            Sanitize(frame.file_name, /*replace_tabs=*/true) + "\t" +
+            Sanitize(frame.function_name, /*replace_tabs=*/false) + "\n";
+  }
+}
+
+}  // namespace
+
+CachingSymbolizer::CachingSymbolizer(std::string cache_dir,
+                                     std::unique_ptr<Symbolizer> inner)
+    : cache_dir_(std::move(cache_dir)), inner_(std::move(inner)) {
+  // Fine if it already exists.
+  base::Mkdir(cache_dir_);
+}
+
+CachingSymbolizer::~CachingSymbolizer() = default;
+
+std::string CachingSymbolizer::CacheFilePath(
+    const std::string& build_id) const {
+  return cache_dir_ + "/" + base::ToHex(build_id.c_str(), build_id.size());
+}
+
+CachingSymbolizer::BuildIdCache* CachingSymbolizer::GetOrLoadBuildIdCache(
+    const std::string& build_id) {
+  auto it = caches_.find(build_id);
+  if (it != caches_.end())
+    return &it->second;
+  BuildIdCache* cache = &caches_[build_id];
+  std::string contents;
+  if (base::ReadFile(CacheFilePath(build_id), &contents))
+    cache->needs_rewrite = !ParseCacheFile(contents, &cache->frames);
+  return cache;
+}
+
+std::vector<std::vector<SymbolizedFrame>> CachingSymbolizer::Symbolize(
+    const std::string& mapping_name,
+    const std::string& build_id,
+    uint64_t load_bias,
+    const std::vector<uint64_t>& addresses) {
+  return std::move(SymbolizeBatch({SymbolizeRequest{
+      mapping_name, build_id, load_bias, addresses}})[0]);
+}
+
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+CachingSymbolizer::SymbolizeBatch(
+    const std::vector<SymbolizeRequest>& requests) {
+  // The addresses missing from the cache are symbolized in a single batch, so
+  // that the inner symbolizer can still work on the mappings in parallel.
+  std::vector<SymbolizeRequest> inner_requests;
+  std::vector<size_t> inner_request_index;  // in |requests|
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const SymbolizeRequest& request = requests[i];
+    if (request.build_id.empty()) {
+      inner_requests.push_back(request);
+      inner_request_index.push_back(i);
+      continue;
+    }
+    BuildIdCache* cache = GetOrLoadBuildIdCache(request.build_id);
+    std::vector<uint64_t> missing;
+    for (uint64_t address : request.addresses) {
+      if (cache->frames.find({request.load_bias, address}) ==
+          cache->frames.end()) {
+        missing.push_back(address);
+      }
+    }
+    if (missing.empty())
+      continue;
+    inner_requests.push_back(SymbolizeRequest{request.mapping_name,
+                                              request.build_id,
+                                              request.load_bias,
+                                              std::move(missing)});
+    inner_request_index.push_back(i);
+  }
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> inner_results =
+      inner_->SymbolizeBatch(inner_requests);
+  PERFETTO_CHECK(inner_results.size() == inner_requests.size());
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> result(
+      requests.size());
+  std::vector<bool> failed(requests.size());
+  for (size_t j = 0; j < inner_requests.size(); ++j) {
+    size_t i = inner_request_index[j];
+    const SymbolizeRequest& request = requests[i];
+    if (request.build_id.empty()) {
+      result[i] = std::move(inner_results[j]);
+      continue;
+    }
+    // An empty result means that the binary couldn't be symbolized at all
+    // (e.g. it wasn't found). It might be available next time, so the result
+    // isn't cached.
+    if (inner_results[j].empty()) {
+      failed[i] =
+          inner_requests[j].addresses.size() == request.addresses.size();
+      continue;
+    }
+    StoreFrames(request.build_id, request.load_bias,
+                inner_requests[j].addresses, &inner_results[j]);
+  }
+
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const SymbolizeRequest& request = requests[i];
+    if (request.build_id.empty() || failed[i])
+      continue;
+    const BuildIdCache& cache = caches_[request.build_id];
+    result[i].reserve(request.addresses.size());
+    for (uint64_t address : request.addresses) {
+      auto it = cache.frames.find({request.load_bias, address});
+      if (it != cache.frames.end())
+        result[i].emplace_back(it->second);
+      else
+        result[i].emplace_back();
+    }
+  }
+  return result;
+}
+
+void CachingSymbolizer::StoreFrames(
+    const std::string& build_id,
+    uint64_t load_bias,
+    const std::vector<uint64_t>& addresses,
+    std::vector<std::vector<SymbolizedFrame>>* frames) {
+  PERFETTO_DCHECK(frames->size() == addresses.size());
+  BuildIdCache* cache = &caches_[build_id];
+  for (size_t i = 0; i < addresses.size(); ++i)
+    cache->frames[{load_bias, addresses[i]}] = std::move((*frames)[i]);
+
+  // A malformed file is replaced with all the known records. Otherwise the
+  // new records are appended in a single write, so that the records of
+  // concurrent writers don't interleave.
+  std::string records;
+  int flags = O_WRONLY | O_CREAT;
+  if (cache->needs_rewrite) {
+    flags |= O_TRUNC;
+    for (const auto& key_and_frames : cache->frames) {
+      AppendRecord(key_and_frames.first.first, key_and_frames.first.second,
+                   key_and_frames.second, &records);
+    }
+  } else {
+    flags |= O_APPEND;
+    for (uint64_t address : addresses) {
+      AppendRecord(load_bias, address, cache->frames[{load_bias, address}],
+                   &records);
+    }
+  }
+  base::ScopedFile fd = base::OpenFile(CacheFilePath(build_id), flags, 0666);
+  if (fd && base::WriteAll(*fd, records.data(), records.size()) ==
+                static_cast<ssize_t>(records.size())) {
+    cache->needs_rewrite = false;
+  } else {
+    PERFETTO_PLOG("Failed to write symbolizer cache %s",
+                  CacheFilePath(build_id).c_str());
+  }
+}
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
+#define SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// A Symbolizer that remembers the frames returned by another Symbolizer in a
+// directory on disk, so that the addresses of a binary are only symbolized
+// once across runs (and users, if the directory is shared).
+//
+// The cache has one file per build id, named after its hex representation.
+// The file is a sequence of records, one for each address:
+//   <load bias hex> <address hex> <number of frames>
+//   <line>\t<file name>\t<function name>   (once per frame)
+// Records are appended, with one write per call to Symbolize, so concurrent
+// writers at worst symbolize the same address twice. If a file turns out to be
+// malformed (e.g. a writer died mid-write), the records before the malformed
+// one are used, and the file is rewritten on the next write.
+//
+// Mappings without a build id are not cached, as they can't be told apart.
+class CachingSymbolizer : public Symbolizer {
+ public:
+  CachingSymbolizer(std::string cache_dir, std::unique_ptr<Symbolizer> inner);
+  ~CachingSymbolizer() override;
+
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string& mapping_name,
+      const std::string& build_id,
+      uint64_t load_bias,
+      const std::vector<uint64_t>& address) override;
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> SymbolizeBatch(
+      const std::vector<SymbolizeRequest>& requests) override;
+
+ private:
+  // (load bias, address)
+  using CacheKey = std::pair<uint64_t, uint64_t>;
+  struct BuildIdCache {
+    std::map<CacheKey, std::vector<SymbolizedFrame>> frames;
+    bool needs_rewrite = false;
+  };
+
+  BuildIdCache* GetOrLoadBuildIdCache(const std::string& build_id);
+  std::string CacheFilePath(const std::string& build_id) const;
+  // Adds the symbolized |frames| of |addresses| to the cache, in memory and
+  // on disk.
+  void StoreFrames(const std::string& build_id,
+                   uint64_t load_bias,
+                   const std::vector<uint64_t>& addresses,
+                   std::vector<std::vector<SymbolizedFrame>>* frames);
+
+  std::string cache_dir_;
+  std::unique_ptr<Symbolizer> inner_;
+  // Keyed by the raw build id.
+  std::map<std::string, BuildIdCache> caches_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_CACHING_SYMBOLIZER_H_
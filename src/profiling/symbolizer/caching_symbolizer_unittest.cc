@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/caching_symbolizer.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/base/test/tmp_dir_tree.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr char kBuildId[] = "\x01\x02\x03\x04";
+constexpr char kCacheFile[] = "01020304";
+
+// Symbolizes every address into a single frame named after it, and records
+// the addresses it was asked for.
+class FakeSymbolizer : public Symbolizer {
+ public:
+  explicit FakeSymbolizer(std::vector<uint64_t>* requested)
+      : requested_(requested) {}
+
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string&,
+      const std::string&,
+      uint64_t,
+      const std::vector<uint64_t>& addresses) override {
+    std::vector<std::vector<SymbolizedFrame>> result;
+    for (uint64_t address : addresses) {
+      requested_->push_back(address);
+      SymbolizedFrame frame;
+      frame.function_name = "fn_" + std::to_string(address);
+      frame.file_name = "file.cc";
+      frame.line = static_cast<uint32_t>(address);
+      result.push_back({frame});
+    }
+    return result;
+  }
+
+ private:
+  std::vector<uint64_t>* requested_;
+};
+
+class NotFoundSymbolizer : public Symbolizer {
+ public:
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::string&,
+      const std::string&,
+      uint64_t,
+      const std::vector<uint64_t>&) override {
+    return {};
+  }
+};
+
+TEST(CachingSymbolizerTest, OnlySymbolizesMissingAddresses) {
+  base::TmpDirTree tmp;
+  tmp.TrackFile(kCacheFile);
+  std::vector<uint64_t> requested;
+  CachingSymbolizer symbolizer(
+      tmp.path(), std::unique_ptr<Symbolizer>(new FakeSymbolizer(&requested)));
+
+  auto first = symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x10, 0x20});
+  ASSERT_EQ(first.size(), 2u);
+  EXPECT_EQ(first[1][0].function_name, "fn_32");
+
+  auto second = symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x20, 0x30});
+  ASSERT_EQ(second.size(), 2u);
+  EXPECT_EQ(second[0][0].function_name, "fn_32");
+  EXPECT_EQ(second[1][0].function_name, "fn_48");
+  EXPECT_THAT(requested, testing::ElementsAre(0x10u, 0x20u, 0x30u));
+}
+
+TEST(CachingSymbolizerTest, PersistsAcrossInstances) {
+  base::TmpDirTree tmp;
+  tmp.TrackFile(kCacheFile);
+  std::vector<uint64_t> requested;
+  {
+    CachingSymbolizer symbolizer(
+        tmp.path(),
+        std::unique_ptr<Symbolizer>(new FakeSymbolizer(&requested)));
+    symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x10, 0x20});
+  }
+  requested.clear();
+
+  CachingSymbolizer symbolizer(
+      tmp.path(), std::unique_ptr<Symbolizer>(new FakeSymbolizer(&requested)));
+  auto res = symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x20, 0x10});
+  EXPECT_TRUE(requested.empty());
+  ASSERT_EQ(res.size(), 2u);
+  ASSERT_EQ(res[0].size(), 1u);
+  EXPECT_EQ(res[0][0].function_name, "fn_32");
+  EXPECT_EQ(res[0][0].file_name, "file.cc");
+  EXPECT_EQ(res[0][0].line, 0x20u);
+  EXPECT_EQ(res[1][0].function_name, "fn_16");
+
+  // A different load bias is a different key.
+  symbolizer.Symbolize("libfoo.so", kBuildId, 0x1000, {0x10});
+  EXPECT_THAT(requested, testing::ElementsAre(0x10u));
+}
+
+TEST(CachingSymbolizerTest, RewritesTruncatedFile) {
+  base::TmpDirTree tmp;
+  tmp.AddFile(kCacheFile,
+              "0 10 1\n16\tfile.cc\tcached\n"
+              "0 20 2\n32\tfile.cc\tpartial\n");
+  std::vector<uint64_t> requested;
+  CachingSymbolizer symbolizer(
+      tmp.path(), std::unique_ptr<Symbolizer>(new FakeSymbolizer(&requested)));
+  auto res = symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x10, 0x20});
+  ASSERT_EQ(res.size(), 2u);
+  EXPECT_EQ(res[0][0].function_name, "cached");
+  EXPECT_EQ(res[1][0].function_name, "fn_32");
+  EXPECT_THAT(requested, testing::ElementsAre(0x20u));
+
+  // The malformed file was rewritten with the complete records.
+  requested.clear();
+  CachingSymbolizer reloaded(
+      tmp.path(), std::unique_ptr<Symbolizer>(new FakeSymbolizer(&requested)));
+  res = reloaded.Symbolize("libfoo.so", kBuildId, 0, {0x10, 0x20});
+  EXPECT_EQ(res[0][0].function_name, "cached");
+  EXPECT_EQ(res[1][0].function_name, "fn_32");
+  EXPECT_TRUE(requested.empty());
+}
+
+TEST(CachingSymbolizerTest, DoesNotCacheMissingBinary) {
+  base::TmpDirTree tmp;
+  CachingSymbolizer symbolizer(
+      tmp.path(), std::unique_ptr<Symbolizer>(new NotFoundSymbolizer()));
+  EXPECT_TRUE(symbolizer.Symbolize("libfoo.so", kBuildId, 0, {0x10}).empty());
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,631 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/elf_symbol_file.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <optional>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/trace_processor/demangle.h"
+#include "src/profiling/symbolizer/elf.h"
+
+namespace perfetto {
+namespace profiling {
+
+namespace {
+
+// DWARF constants, see the DWARF 5 standard, section 6.2 and 7.22.
+constexpr uint8_t DW_LNS_copy = 1;
+constexpr uint8_t DW_LNS_advance_pc = 2;
+constexpr uint8_t DW_LNS_advance_line = 3;
+constexpr uint8_t DW_LNS_set_file = 4;
+constexpr uint8_t DW_LNS_const_add_pc = 8;
+constexpr uint8_t DW_LNS_fixed_advance_pc = 9;
+constexpr uint8_t DW_LNE_end_sequence = 1;
+constexpr uint8_t DW_LNE_set_address = 2;
+constexpr uint64_t DW_LNCT_path = 1;
+constexpr uint64_t DW_LNCT_directory_index = 2;
+constexpr uint64_t DW_FORM_block = 0x09;
+constexpr uint64_t DW_FORM_data1 = 0x0b;
+constexpr uint64_t DW_FORM_data2 = 0x05;
+constexpr uint64_t DW_FORM_data4 = 0x06;
+constexpr uint64_t DW_FORM_data8 = 0x07;
+constexpr uint64_t DW_FORM_data16 = 0x1e;
+constexpr uint64_t DW_FORM_string = 0x08;
+constexpr uint64_t DW_FORM_strp = 0x0e;
+constexpr uint64_t DW_FORM_udata = 0x0f;
+constexpr uint64_t DW_FORM_line_strp = 0x1f;
+
+// Bounds checked little-endian reader. Reading past the end returns zeroes
+// and makes ok() false.
+class ByteReader {
+ public:
+  ByteReader(const uint8_t* begin, const uint8_t* end)
+      : pos_(begin), end_(end) {}
+
+  bool ok() const { return ok_; }
+  void Fail() { ok_ = false; }
+  const uint8_t* pos() const { return pos_; }
+  size_t remaining() const { return static_cast<size_t>(end_ - pos_); }
+
+  bool Skip(uint64_t size) {
+    if (!ok_ || size > remaining()) {
+      ok_ = false;
+      return false;
+    }
+    pos_ += size;
+    return true;
+  }
+
+  uint64_t ReadUnsigned(size_t size) {
+    uint64_t value = 0;
+    const uint8_t* start = pos_;
+    if (size > sizeof(value) || !Skip(size))
+      return 0;
+    for (size_t i = 0; i < size; ++i)
+      value |= static_cast<uint64_t>(start[i]) << (8 * i);
+    return value;
+  }
+  uint8_t U8() { return static_cast<uint8_t>(ReadUnsigned(1)); }
+  uint16_t U16() { return static_cast<uint16_t>(ReadUnsigned(2)); }
+  uint32_t U32() { return static_cast<uint32_t>(ReadUnsigned(4)); }
+  uint64_t U64() { return ReadUnsigned(8); }
+  // Section offsets are 64 bit in the 64 bit DWARF format.
+  uint64_t Offset(bool dwarf64) { return dwarf64 ? U64() : U32(); }
+
+  uint64_t Uleb() {
+    uint64_t value = 0;
+    for (uint32_t shift = 0;; shift += 7) {
+      uint8_t byte = U8();
+      if (!ok_)
+        return 0;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return value;
+    }
+  }
+
+  int64_t Sleb() {
+    uint64_t value = 0;
+    uint32_t shift = 0;
+    uint8_t byte = 0;
+    do {
+      byte = U8();
+      if (!ok_)
+        return 0;
+      if (shift < 64)
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    if (shift < 64 && (byte & 0x40))
+      value |= ~uint64_t(0) << shift;
+    return static_cast<int64_t>(value);
+  }
+
+  // Returns an empty string, and fails, if there is no terminator.
+  std::string CStr() {
+    const void* nul = memchr(pos_, 0, remaining());
+    if (!ok_ || !nul) {
+      ok_ = false;
+      return {};
+    }
+    const uint8_t* str_end = static_cast<const uint8_t*>(nul);
+    std::string str(reinterpret_cast<const char*>(pos_),
+                    static_cast<size_t>(str_end - pos_));
+    pos_ = str_end + 1;
+    return str;
+  }
+
+ private:
+  const uint8_t* pos_;
+  const uint8_t* end_;
+  bool ok_ = true;
+};
+
+std::string StringAt(const char* section, size_t size, uint64_t offset) {
+  if (!section || offset >= size)
+    return {};
+  const char* str = section + offset;
+  size_t len = strnlen(str, size - static_cast<size_t>(offset));
+  return std::string(str, len);
+}
+
+std::string JoinPath(const std::string& dir, const std::string& name) {
+  bool absolute = (!name.empty() && (name[0] == '/' || name[0] == '\\')) ||
+                  (name.size() > 1 && name[1] == ':');
+  if (dir.empty() || absolute)
+    return name;
+  return dir + "/" + name;
+}
+
+struct FileEntry {
+  std::string path;
+  uint64_t dir_index = 0;
+};
+
+// Reads the directory or file name table of a DWARF 5 line table header.
+bool ReadEntryTableV5(ByteReader* r,
+                      bool dwarf64,
+                      const char* debug_line_str,
+                      size_t debug_line_str_size,
+                      const char* debug_str,
+                      size_t debug_str_size,
+                      std::vector<FileEntry>* out) {
+  uint8_t format_count = r->U8();
+  std::vector<std::pair<uint64_t, uint64_t>> formats;  // (content, form)
+  for (uint8_t i = 0; i < format_count && r->ok(); ++i) {
+    uint64_t content = r->Uleb();
+    uint64_t form = r->Uleb();
+    formats.emplace_back(content, form);
+  }
+  uint64_t count = r->Uleb();
+  for (uint64_t i = 0; i < count && r->ok(); ++i) {
+    FileEntry entry;
+    for (const auto& content_and_form : formats) {
+      std::string str;
+      uint64_t num = 0;
+      switch (content_and_form.second) {
+        case DW_FORM_string:
+          str = r->CStr();
+          break;
+        case DW_FORM_line_strp:
+          str = StringAt(debug_line_str, debug_line_str_size,
+                         r->Offset(dwarf64));
+          break;
+        case DW_FORM_strp:
+          str = StringAt(debug_str, debug_str_size, r->Offset(dwarf64));
+          break;
+        case DW_FORM_udata:
+          num = r->Uleb();
+          break;
+        case DW_FORM_data1:
+          num = r->U8();
+          break;
+        case DW_FORM_data2:
+          num = r->U16();
+          break;
+        case DW_FORM_data4:
+          num = r->U32();
+          break;
+        case DW_FORM_data8:
+          num = r->U64();
+          break;
+        case DW_FORM_data16:
+          r->Skip(16);
+          break;
+        case DW_FORM_block:
+          r->Skip(r->Uleb());
+          break;
+        default:
+          return false;  // can't know the size of the entry
+      }
+      if (content_and_form.first == DW_LNCT_path)
+        entry.path = std::move(str);
+      else if (content_and_form.first == DW_LNCT_directory_index)
+        entry.dir_index = num;
+    }
+    out->emplace_back(std::move(entry));
+  }
+  return r->ok();
+}
+
+bool InRange(size_t total_size, uint64_t offset, uint64_t size) {
+  return offset <= total_size && size <= total_size - offset;
+}
+
+}  // namespace
+
+ElfSymbolFile::~ElfSymbolFile() = default;
+
+// static
+std::unique_ptr<ElfSymbolFile> ElfSymbolFile::Open(const std::string& path) {
+  std::unique_ptr<ElfSymbolFile> file(new ElfSymbolFile());
+  file->map_ = base::ReadMmapWholeFile(path.c_str());
+  if (!file->map_.IsValid())
+    return nullptr;
+  const char* mem = static_cast<const char*>(file->map_.data());
+  size_t size = file->map_.length();
+  if (size <= EI_CLASS || mem[EI_MAG0] != ELFMAG0 || mem[EI_MAG1] != ELFMAG1 ||
+      mem[EI_MAG2] != ELFMAG2 || mem[EI_MAG3] != ELFMAG3 ||
+      mem[EI_DATA] != ELFDATA2LSB) {
+    return nullptr;
+  }
+  bool parsed = false;
+  switch (mem[EI_CLASS]) {
+    case ELFCLASS32:
+      parsed = file->Parse<Elf32>();
+      break;
+    case ELFCLASS64:
+      parsed = file->Parse<Elf64>();
+      break;
+    default:
+      break;
+  }
+  if (!parsed || file->symbols_.empty())
+    return nullptr;
+  return file;
+}
+
+template <typename E>
+bool ElfSymbolFile::Parse() {
+  char* mem = static_cast<char*>(map_.data());
+  size_t size = map_.length();
+  if (size < sizeof(typename E::Ehdr))
+    return false;
+  const typename E::Ehdr* ehdr = reinterpret_cast<typename E::Ehdr*>(mem);
+  if (ehdr->e_shentsize != sizeof(typename E::Shdr) ||
+      !InRange(size, ehdr->e_shoff,
+               uint64_t(ehdr->e_shnum) * sizeof(typename E::Shdr)) ||
+      ehdr->e_shstrndx >= ehdr->e_shnum) {
+    PERFETTO_ELOG("Corrupted ELF.");
+    return false;
+  }
+
+  auto section_data = [mem, size](const typename E::Shdr* shdr,
+                                   size_t* data_size) -> const char* {
+    if (shdr->sh_type == SHT_NOBITS || (shdr->sh_flags & SHF_COMPRESSED) ||
+        !InRange(size, shdr->sh_offset, shdr->sh_size)) {
+      return nullptr;
+    }
+    *data_size = static_cast<size_t>(shdr->sh_size);
+    return mem + shdr->sh_offset;
+  };
+
+  size_t shstrtab_size = 0;
+  const char* shstrtab =
+      section_data(GetShdr<E>(mem, ehdr, ehdr->e_shstrndx), &shstrtab_size);
+
+  const typename E::Shdr* symtab = nullptr;
+  const typename E::Shdr* dynsym = nullptr;
+  LineTableSections line_sections;
+  line_sections.address_size = sizeof(typename E::Addr);
+  for (size_t i = 0; i < ehdr->e_shnum; ++i) {
+    const typename E::Shdr* shdr = GetShdr<E>(mem, ehdr, i);
+    if (shdr->sh_type == SHT_SYMTAB)
+      symtab = shdr;
+    else if (shdr->sh_type == SHT_DYNSYM)
+      dynsym = shdr;
+
+    std::string name = StringAt(shstrtab, shstrtab_size, shdr->sh_name);
+    size_t data_size = 0;
+    if (name == ".debug_line") {
+      line_sections.debug_line = reinterpret_cast<const uint8_t*>(
+          section_data(shdr, &line_sections.debug_line_size));
+    } else if (name == ".debug_line_str") {
+      line_sections.debug_line_str = section_data(shdr, &data_size);
+      line_sections.debug_line_str_size = data_size;
+    } else if (name == ".debug_str") {
+      line_sections.debug_str = section_data(shdr, &data_size);
+      line_sections.debug_str_size = data_size;
+    }
+  }
+
+  // Prefer the full symbol table, the dynamic one only has exported symbols.
+  const typename E::Shdr* symbols = symtab ? symtab : dynsym;
+  if (symbols && symbols->sh_link < ehdr->e_shnum) {
+    ParseSymbols<E>(symbols, GetShdr<E>(mem, ehdr, symbols->sh_link),
+                    ehdr->e_machine == EM_ARM);
+  }
+  // Without line tables (or with .zdebug_line, or a compressed .debug_line),
+  // llvm-symbolizer would report file names and lines which this can't.
+  if (!line_sections.debug_line)
+    return false;
+  ParseLineTables(line_sections);
+  return true;
+}
+
+template <typename E>
+void ElfSymbolFile::ParseSymbols(const typename E::Shdr* symtab,
+                                 const typename E::Shdr* strtab,
+                                 bool thumb) {
+  const char* mem = static_cast<const char*>(map_.data());
+  size_t size = map_.length();
+  if (symtab->sh_type == SHT_NOBITS || strtab->sh_type == SHT_NOBITS ||
+      !InRange(size, symtab->sh_offset, symtab->sh_size) ||
+      !InRange(size, strtab->sh_offset, strtab->sh_size)) {
+    return;
+  }
+  const char* names = mem + strtab->sh_offset;
+  size_t names_size = static_cast<size_t>(strtab->sh_size);
+  size_t count = static_cast<size_t>(symtab->sh_size) /
+                 sizeof(typename E::Sym);
+  for (size_t i = 0; i < count; ++i) {
+    typename E::Sym sym;
+    memcpy(&sym, mem + symtab->sh_offset + i * sizeof(sym), sizeof(sym));
+    if ((sym.st_info & 0xf) != STT_FUNC || sym.st_shndx == SHN_UNDEF ||
+        sym.st_name >= names_size ||
+        !memchr(names + sym.st_name, 0, names_size - sym.st_name)) {
+      continue;
+    }
+    uint64_t start = sym.st_value;
+    // The lowest bit of arm functions is set if they're thumb code.
+    if (thumb)
+      start &= ~uint64_t(1);
+    symbols_.push_back(Symbol{start, start + sym.st_size, names + sym.st_name});
+  }
+
+  // Aliases have the same address, keep the one with the largest size.
+  std::sort(symbols_.begin(), symbols_.end(),
+            [](const Symbol& a, const Symbol& b) {
+              return a.start < b.start || (a.start == b.start && a.end > b.end);
+            });
+  symbols_.erase(std::unique(symbols_.begin(), symbols_.end(),
+                             [](const Symbol& a, const Symbol& b) {
+                               return a.start == b.start;
+                             }),
+                 symbols_.end());
+}
+
+void ElfSymbolFile::ParseLineTables(const LineTableSections& sections) {
+  // Sequences are contiguous address ranges, sorted once they're all parsed.
+  std::vector<std::vector<LineRow>> sequences;
+  std::map<std::string, uint32_t> file_ids;
+  auto intern_file = [this, &file_ids](const std::string& path) {
+    auto it_and_inserted =
+        file_ids.emplace(path, static_cast<uint32_t>(files_.size()));
+    if (it_and_inserted.second)
+      files_.push_back(path);
+    return it_and_inserted.first->second;
+  };
+
+  ByteReader r(sections.debug_line,
+               sections.debug_line + sections.debug_line_size);
+  while (r.ok() && r.remaining() > 0) {
+    bool dwarf64 = false;
+    uint64_t unit_length = r.U32();
+    if (unit_length == 0xffffffff) {
+      dwarf64 = true;
+      unit_length = r.U64();
+    }
+    const uint8_t* unit_start = r.pos();
+    if (!r.Skip(unit_length))
+      break;
+    const uint8_t* unit_end = r.pos();
+    ByteReader unit(unit_start, unit_end);
+
+    uint16_t version = unit.U16();
+    if (version < 2 || version > 5)
+      continue;
+    uint8_t address_size = sections.address_size;
+    if (version >= 5) {
+      address_size = unit.U8();
+      unit.U8();  // segment_selector_size
+    }
+    uint64_t header_length = unit.Offset(dwarf64);
+    if (!unit.ok() || header_length > unit.remaining())
+      continue;
+    ByteReader program(unit.pos() + header_length, unit_end);
+
+    uint8_t min_inst_length = unit.U8();
+    if (version >= 4)
+      unit.U8();  // maximum_operations_per_instruction
+    unit.U8();    // default_is_stmt
+    int8_t line_base = static_cast<int8_t>(unit.U8());
+    uint8_t line_range = unit.U8();
+    uint8_t opcode_base = unit.U8();
+    std::vector<uint8_t> opcode_lengths;
+    for (uint8_t i = 1; i < opcode_base; ++i)
+      opcode_lengths.push_back(unit.U8());
+    if (!unit.ok() || line_range == 0 || opcode_base == 0)
+      continue;
+
+    // Maps the file numbers of the line program to |files_|.
+    std::vector<uint32_t> unit_files;
+    if (version >= 5) {
+      std::vector<FileEntry> dirs;
+      std::vector<FileEntry> files;
+      if (!ReadEntryTableV5(&unit, dwarf64, sections.debug_line_str,
+                            sections.debug_line_str_size, sections.debug_str,
+                            sections.debug_str_size, &dirs) ||
+          !ReadEntryTableV5(&unit, dwarf64, sections.debug_line_str,
+                            sections.debug_line_str_size, sections.debug_str,
+                            sections.debug_str_size, &files)) {
+        continue;
+      }
+      for (const FileEntry& file : files) {
+        std::string dir =
+            file.dir_index < dirs.size() ? dirs[file.dir_index].path : "";
+        unit_files.push_back(intern_file(JoinPath(dir, file.path)));
+      }
+    } else {
+      // Directory 0 is the compilation directory, which is only known from
+      // .debug_info. File numbers start at 1.
+      std::vector<std::string> dirs{""};
+      for (std::string dir = unit.CStr(); unit.ok() && !dir.empty();
+           dir = unit.CStr()) {
+        dirs.push_back(std::move(dir));
+      }
+      unit_files.push_back(kNoFile);
+      for (std::string name = unit.CStr(); unit.ok() && !name.empty();
+           name = unit.CStr()) {
+        uint64_t dir_index = unit.Uleb();
+        unit.Uleb();  // modification time
+        unit.Uleb();  // length
+        std::string dir = dir_index < dirs.size() ? dirs[dir_index] : "";
+        unit_files.push_back(intern_file(JoinPath(dir, name)));
+      }
+      if (!unit.ok())
+        continue;
+    }
+
+    // Runs the line number program, see section 6.2.5 of DWARF 5.
+    uint64_t address = 0;
+    uint64_t file = 1;
+    int64_t line = 1;
+    std::vector<LineRow> sequence;
+    auto emit_row = [&](bool end_sequence) {
+      uint32_t file_id = file < unit_files.size() ? unit_files[file] : kNoFile;
+      uint32_t row_line = static_cast<uint32_t>(
+          std::clamp<int64_t>(line, 0, std::numeric_limits<uint32_t>::max()));
+      sequence.push_back(LineRow{address, file_id, row_line, end_sequence});
+      if (!end_sequence)
+        return;
+      // The code of functions removed by the linker is left at address 0, or
+      // at the -1/-2 tombstones of newer linkers.
+      uint64_t tombstone = address_size == 4 ? 0xfffffffe : ~uint64_t(1);
+      if (sequence.front().address != 0 &&
+          sequence.front().address < tombstone) {
+        sequences.emplace_back(std::move(sequence));
+      }
+      sequence.clear();
+      address = 0;
+      file = 1;
+      line = 1;
+    };
+
+    while (program.ok() && program.remaining() > 0) {
+      uint8_t opcode = program.U8();
+      if (opcode >= opcode_base) {
+        uint8_t adjusted = static_cast<uint8_t>(opcode - opcode_base);
+        address += uint64_t(adjusted / line_range) * min_inst_length;
+        line += line_base + adjusted % line_range;
+        emit_row(false);
+        continue;
+      }
+      switch (opcode) {
+        case 0: {  // extended opcode
+          uint64_t length = program.Uleb();
+          if (length == 0 || length > program.remaining()) {
+            program.Fail();
+            break;
+          }
+          ByteReader extended(program.pos(), program.pos() + length);
+          program.Skip(length);
+          uint8_t sub_opcode = extended.U8();
+          if (sub_opcode == DW_LNE_end_sequence) {
+            emit_row(true);
+          } else if (sub_opcode == DW_LNE_set_address) {
+            address = extended.ReadUnsigned(length - 1);
+          }
+          break;
+        }
+        case DW_LNS_copy:
+          emit_row(false);
+          break;
+        case DW_LNS_advance_pc:
+          address += program.Uleb() * min_inst_length;
+          break;
+        case DW_LNS_advance_line:
+          line += program.Sleb();
+          break;
+        case DW_LNS_set_file:
+          file = program.Uleb();
+          break;
+        case DW_LNS_const_add_pc:
+          address +=
+              uint64_t((255 - opcode_base) / line_range) * min_inst_length;
+          break;
+        case DW_LNS_fixed_advance_pc:
+          address += program.U16();
+          break;
+        default:
+          // Skip the operands of the opcodes which don't affect the rows.
+          for (uint8_t i = 0; i < opcode_lengths[size_t(opcode - 1)]; ++i)
+            program.Uleb();
+          break;
+      }
+    }
+  }
+
+  std::sort(sequences.begin(), sequences.end(),
+            [](const std::vector<LineRow>& a, const std::vector<LineRow>& b) {
+              return a.front().address < b.front().address;
+            });
+  size_t row_count = std::accumulate(
+      sequences.begin(), sequences.end(), size_t(0),
+      [](size_t n, const std::vector<LineRow>& s) { return n + s.size(); });
+  line_rows_.reserve(row_count);
+  for (const std::vector<LineRow>& sequence : sequences)
+    line_rows_.insert(line_rows_.end(), sequence.begin(), sequence.end());
+}
+
+const ElfSymbolFile::Symbol* ElfSymbolFile::LookupSymbol(
+    uint64_t address,
+    size_t* cursor) const {
+  auto it = std::upper_bound(
+      symbols_.begin() + static_cast<ptrdiff_t>(*cursor), symbols_.end(),
+      address,
+      [](uint64_t addr, const Symbol& sym) { return addr < sym.start; });
+  if (it == symbols_.begin())
+    return nullptr;
+  --it;
+  *cursor = static_cast<size_t>(it - symbols_.begin());
+  // Symbols without a size extend up to the next one.
+  if (it->end != it->start && address >= it->end)
+    return nullptr;
+  return &*it;
+}
+
+const ElfSymbolFile::LineRow* ElfSymbolFile::LookupLine(uint64_t address,
+                                                        size_t* cursor) const {
+  auto it = std::upper_bound(
+      line_rows_.begin() + static_cast<ptrdiff_t>(*cursor), line_rows_.end(),
+      address,
+      [](uint64_t addr, const LineRow& row) { return addr < row.address; });
+  if (it == line_rows_.begin())
+    return nullptr;
+  --it;
+  *cursor = static_cast<size_t>(it - line_rows_.begin());
+  // The end of a sequence is the first address after it.
+  if (it->end_sequence)
+    return nullptr;
+  return &*it;
+}
+
+std::vector<std::vector<SymbolizedFrame>> ElfSymbolFile::Symbolize(
+    const std::vector<uint64_t>& addresses) const {
+  std::vector<std::vector<SymbolizedFrame>> result(addresses.size());
+
+  // Resolve the addresses in increasing order, so that each lookup only
+  // searches past the previous one.
+  std::vector<size_t> order(addresses.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::stable_sort(order.begin(), order.end(),
+                   [&addresses](size_t a, size_t b) {
+                     return addresses[a] < addresses[b];
+                   });
+
+  size_t symbol_cursor = 0;
+  size_t line_cursor = 0;
+  for (size_t i : order) {
+    uint64_t address = addresses[i];
+    const Symbol* symbol = LookupSymbol(address, &symbol_cursor);
+    if (!symbol)
+      continue;
+    SymbolizedFrame frame;
+    std::unique_ptr<char, base::FreeDeleter> demangled =
+        trace_processor::demangle::Demangle(symbol->name);
+    frame.function_name = demangled ? demangled.get() : symbol->name;
+    const LineRow* row = LookupLine(address, &line_cursor);
+    if (row) {
+      if (row->file != kNoFile)
+        frame.file_name = files_[row->file];
+      frame.line = row->line;
+    }
+    result[i].emplace_back(std::move(frame));
+  }
+  return result;
+}
+
+}  // namespace profiling
+}  // namespace perfetto
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_PROFILING_SYMBOLIZER_ELF_SYMBOL_FILE_H_
+#define SRC_PROFILING_SYMBOLIZER_ELF_SYMBOL_FILE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/scoped_mmap.h"
+#include "src/profiling/symbolizer/symbolizer.h"
+
+namespace perfetto {
+namespace profiling {
+
+// The symbols of an ELF file, read in process rather than by llvm-symbolizer.
+// The function symbols (.symtab, or .dynsym if stripped) and the rows of the
+// DWARF line tables (.debug_line) are parsed once into arrays sorted by
+// address, which are then binary searched.
+//
+// This is less complete than llvm-symbolizer, so LocalSymbolizer only uses it
+// when asked to. Inlined frames are not reported, as that requires parsing
+// .debug_info: each address resolves to the function of its symbol and the
+// line of the innermost inlined call. For the same reason, the file names of
+// DWARF < 5 line tables are not made absolute with the compilation directory.
+//
+// Immutable once opened, so it can be used from several threads at once.
+class ElfSymbolFile {
+ public:
+  // Returns nullptr if |path| is not an ELF file, has no function symbols, or
+  // has no uncompressed .debug_line section, so that llvm-symbolizer (which
+  // decompresses sections) symbolizes it instead.
+  static std::unique_ptr<ElfSymbolFile> Open(const std::string& path);
+
+  ~ElfSymbolFile();
+
+  // |addresses| are virtual addresses of the ELF file, in any order. Returns
+  // the frames of each address, which are empty if it isn't in a function.
+  // Sorted addresses are resolved in a single pass over the arrays.
+  std::vector<std::vector<SymbolizedFrame>> Symbolize(
+      const std::vector<uint64_t>& addresses) const;
+
+  size_t symbol_count() const { return symbols_.size(); }
+  size_t line_row_count() const { return line_rows_.size(); }
+
+ private:
+  struct Symbol {
+    uint64_t start;
+    uint64_t end;      // == start if the symbol has no size.
+    const char* name;  // in the mapped file
+  };
+
+  struct LineRow {
+    uint64_t address;
+    uint32_t file;  // index in |files_|, or kNoFile
+    uint32_t line;
+    bool end_sequence;
+  };
+
+  static constexpr uint32_t kNoFile = UINT32_MAX;
+
+  struct LineTableSections {
+    const uint8_t* debug_line = nullptr;
+    size_t debug_line_size = 0;
+    // Strings referenced by DWARF 5 line table headers.
+    const char* debug_line_str = nullptr;
+    size_t debug_line_str_size = 0;
+    const char* debug_str = nullptr;
+    size_t debug_str_size = 0;
+    uint8_t address_size = 8;
+  };
+
+  ElfSymbolFile() = default;
+
+  template <typename E>
+  bool Parse();
+  template <typename E>
+  void ParseSymbols(const typename E::Shdr* symtab,
+                    const typename E::Shdr* strtab,
+                    bool thumb);
+  void ParseLineTables(const LineTableSections& sections);
+
+  // The lookups only search from |*cursor| onwards, and move it forward. They
+  // must be called with non-decreasing addresses for the same cursor.
+  const Symbol* LookupSymbol(uint64_t address, size_t* cursor) const;
+  // Returns nullptr if |address| isn't covered by a line table.
+  const LineRow* LookupLine(uint64_t address, size_t* cursor) const;
+
+  base::ScopedMmap map_;
+  std::vector<Symbol> symbols_;     // sorted by start
+  std::vector<LineRow> line_rows_;  // sorted by address, sequence by sequence
+  std::vector<std::string> files_;
+};
+
+}  // namespace profiling
+}  // namespace perfetto
+
+#endif  // SRC_PROFILING_SYMBOLIZER_ELF_SYMBOL_FILE_H_
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/profiling/symbolizer/elf_symbol_file.h"
+
+#include <string.h>
+
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/profiling/symbolizer/elf.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace profiling {
+namespace {
+
+constexpr uint8_t kSetAddress[] = {0x00, 9, 0x02};  // + 8 byte address
+constexpr uint8_t kEndSequence[] = {0x00, 1, 0x01};
+constexpr uint8_t kAdvancePc = 0x02;    // + uleb
+constexpr uint8_t kAdvanceLine = 0x03;  // + sleb
+constexpr uint8_t kCopy = 0x01;
+
+template <typename T>
+void Append(std::string* out, const T& value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendBytes(std::string* out, std::initializer_list<uint8_t> bytes) {
+  for (uint8_t byte : bytes)
+    out->push_back(static_cast<char>(byte));
+}
+
+void AppendSetAddress(std::string* out, uint64_t address) {
+  out->append(reinterpret_cast<const char*>(kSetAddress), sizeof(kSetAddress));
+  Append(out, address);
+}
+
+void AppendEndSequence(std::string* out) {
+  out->append(reinterpret_cast<const char*>(kEndSequence),
+              sizeof(kEndSequence));
+}
+
+// A DWARF 4 line table for src/foo.cc with two sequences: one for the
+// functions at 0x1000 (lines 10 and 12), and one left at address 0 by the
+// linker, which must be ignored.
+std::string CreateDebugLine() {
+  std::string header;
+  AppendBytes(&header, {1, 1, 1, 0xfb, 14, 13});  // min_inst_length .. base
+  AppendBytes(&header, {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1});
+  header.append("src\0\0", 5);  // include_directories
+  header.append("foo.cc\0", 7);
+  AppendBytes(&header, {1, 0, 0, 0});  // dir, mtime, length, end of files
+
+  std::string program;
+  AppendSetAddress(&program, 0);
+  AppendBytes(&program, {kAdvanceLine, 5, kCopy, kAdvancePc, 0x40});
+  AppendEndSequence(&program);
+  AppendSetAddress(&program, 0x1000);
+  AppendBytes(&program, {kAdvanceLine, 9, kCopy});
+  AppendBytes(&program, {kAdvancePc, 0x20, kAdvanceLine, 2, kCopy});
+  AppendBytes(&program, {kAdvancePc, 0x20});
+  AppendEndSequence(&program);
+
+  std::string unit;
+  Append(&unit, uint16_t{4});  // version
+  Append(&unit, static_cast<uint32_t>(header.size()));
+  unit += header + program;
+
+  std::string debug_line;
+  Append(&debug_line, static_cast<uint32_t>(unit.size()));
+  return debug_line + unit;
+}
+
+Elf64::Sym CreateSymbol(uint32_t name,
+                        uint8_t type,
+                        uint16_t shndx,
+                        uint64_t value,
+                        uint64_t size) {
+  Elf64::Sym sym;
+  memset(&sym, 0, sizeof(sym));
+  sym.st_name = name;
+  sym.st_info = type;
+  sym.st_shndx = shndx;
+  sym.st_value = value;
+  sym.st_size = size;
+  return sym;
+}
+
+// Functions foo at [0x1000, 0x1020) and bar at [0x1020, 0x1040), as well as
+// symbols that are not defined functions. The .debug_line section has the
+// given type and flags.
+std::string CreateElf(uint32_t debug_line_type = /*SHT_PROGBITS=*/1,
+                      uint64_t debug_line_flags = 0) {
+  const char kShstrtab[] = "\0.shstrtab\0.strtab\0.symtab\0.debug_line\0";
+  const char kStrtab[] = "\0foo\0bar\0data\0undef\0";
+  std::string symtab;
+  Append(&symtab, CreateSymbol(0, 0, 0, 0, 0));
+  Append(&symtab, CreateSymbol(1, STT_FUNC, 1, 0x1000, 0x20));
+  Append(&symtab, CreateSymbol(5, STT_FUNC, 1, 0x1020, 0x20));
+  Append(&symtab, CreateSymbol(9, /*STT_OBJECT=*/1, 1, 0x1010, 0x8));
+  Append(&symtab, CreateSymbol(14, STT_FUNC, SHN_UNDEF, 0x1008, 0));
+  std::string debug_line = CreateDebugLine();
+
+  std::string elf(sizeof(Elf64::Ehdr), '\0');
+  std::vector<Elf64::Shdr> shdrs(5);
+  memset(shdrs.data(), 0, shdrs.size() * sizeof(Elf64::Shdr));
+  auto add_section = [&elf, &shdrs](size_t index, uint32_t name,
+                                    uint32_t type, const std::string& data) {
+    shdrs[index].sh_name = name;
+    shdrs[index].sh_type = type;
+    shdrs[index].sh_offset = elf.size();
+    shdrs[index].sh_size = data.size();
+    elf += data;
+  };
+  constexpr uint32_t kStrtabType = 3;  // SHT_STRTAB
+  add_section(1, 1, kStrtabType, std::string(kShstrtab, sizeof(kShstrtab)));
+  add_section(2, 11, kStrtabType, std::string(kStrtab, sizeof(kStrtab)));
+  add_section(3, 19, SHT_SYMTAB, symtab);
+  shdrs[3].sh_link = 2;
+  add_section(4, 27, debug_line_type, debug_line);
+  shdrs[4].sh_flags = debug_line_flags;
+
+  Elf64::Ehdr ehdr;
+  memset(&ehdr, 0, sizeof(ehdr));
+  ehdr.e_ident[EI_MAG0] = ELFMAG0;
+  ehdr.e_ident[EI_MAG1] = ELFMAG1;
+  ehdr.e_ident[EI_MAG2] = ELFMAG2;
+  ehdr.e_ident[EI_MAG3] = ELFMAG3;
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_ehsize = sizeof(ehdr);
+  ehdr.e_shentsize = sizeof(Elf64::Shdr);
+  ehdr.e_shnum = static_cast<uint16_t>(shdrs.size());
+  ehdr.e_shstrndx = 1;
+  ehdr.e_shoff = elf.size();
+  memcpy(&elf[0], &ehdr, sizeof(ehdr));
+  elf.append(reinterpret_cast<const char*>(shdrs.data()),
+             shdrs.size() * sizeof(Elf64::Shdr));
+  return elf;
+}
+
+TEST(ElfSymbolFileTest, Symbolize) {
+  base::TmpDirTree tmp;
+  tmp.AddFile("elf", CreateElf());
+  std::unique_ptr<ElfSymbolFile> file =
+      ElfSymbolFile::Open(tmp.AbsolutePath("elf"));
+  ASSERT_TRUE(file);
+  EXPECT_EQ(file->symbol_count(), 2u);
+  // The sequence at address 0 is dropped.
+  EXPECT_EQ(file->line_row_count(), 3u);
+
+  // Unsorted, with addresses outside of any function.
+  auto res = file->Symbolize({0x1024, 0x800, 0x1004, 0x1040, 0x1000});
+  ASSERT_EQ(res.size(), 5u);
+  ASSERT_EQ(res[0].size(), 1u);
+  EXPECT_EQ(res[0][0].function_name, "bar");
+  EXPECT_EQ(res[0][0].file_name, "src/foo.cc");
+  EXPECT_EQ(res[0][0].line, 12u);
+  EXPECT_TRUE(res[1].empty());
+  ASSERT_EQ(res[2].size(), 1u);
+  EXPECT_EQ(res[2][0].function_name, "foo");
+  EXPECT_EQ(res[2][0].file_name, "src/foo.cc");
+  EXPECT_EQ(res[2][0].line, 10u);
+  EXPECT_TRUE(res[3].empty());
+  ASSERT_EQ(res[4].size(), 1u);
+  EXPECT_EQ(res[4][0].function_name, "foo");
+  EXPECT_EQ(res[4][0].line, 10u);
+}
+
+// These are left to llvm-symbolizer, which can report their file names and
+// lines.
+TEST(ElfSymbolFileTest, NoDebugLine) {
+  base::TmpDirTree tmp;
+  tmp.AddFile("stripped", CreateElf(SHT_NOBITS));
+  tmp.AddFile("compressed", CreateElf(/*SHT_PROGBITS=*/1, SHF_COMPRESSED));
+  EXPECT_FALSE(ElfSymbolFile::Open(tmp.AbsolutePath("stripped")));
+  EXPECT_FALSE(ElfSymbolFile::Open(tmp.AbsolutePath("compressed")));
+}
+
+TEST(ElfSymbolFileTest, NotElf) {
+  base::TmpDirTree tmp;
+  tmp.AddFile("text", "not an elf file");
+  EXPECT_FALSE(ElfSymbolFile::Open(tmp.AbsolutePath("text")));
+  EXPECT_FALSE(ElfSymbolFile::Open(tmp.AbsolutePath("missing")));
+}
+
+}  // namespace
+}  // namespace profiling
+}  // namespace perfetto
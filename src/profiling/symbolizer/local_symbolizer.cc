@@ -19,6 +19,8 @@
 #include <fcntl.h>
 
 #include <cinttypes>
+#include <cstdlib>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <optional>
@@ -33,6 +35,7 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/scoped_mmap.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "src/profiling/symbolizer/caching_symbolizer.h"
 #include "src/profiling/symbolizer/elf.h"
 #include "src/profiling/symbolizer/filesystem.h"
 
@@ -55,7 +58,21 @@ std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
       finder.reset(new LocalBinaryIndexer(std::move(binary_path)));
     else
       PERFETTO_FATAL("Invalid symbolizer mode [find | index]: %s", mode);
-    symbolizer.reset(new LocalSymbolizer(std::move(finder)));
+    const char* in_process_env = getenv("PERFETTO_SYMBOLIZER_IN_PROCESS");
+    bool in_process = in_process_env && strcmp(in_process_env, "1") == 0;
+    symbolizer.reset(new LocalSymbolizer(std::move(finder), in_process));
+    const char* cache_dir = getenv("PERFETTO_SYMBOLIZER_CACHE_DIR");
+    if (cache_dir && *cache_dir) {
+      // The frames symbolized in process lack the inlined ones, so they are
+      // kept apart from those of llvm-symbolizer, rather than being served to
+      // later runs which don't opt in.
+      std::string dir = cache_dir;
+      if (in_process) {
+        base::Mkdir(dir);
+        dir += "/in_process";
+      }
+      symbolizer.reset(new CachingSymbolizer(dir, std::move(symbolizer)));
+    }
 #else
     base::ignore_result(mode);
     PERFETTO_FATAL("This build does not support local symbolization.");
@@ -516,34 +533,106 @@ std::vector<std::vector<SymbolizedFrame>> LocalSymbolizer::Symbolize(
     const std::string& build_id,
     uint64_t load_bias,
     const std::vector<uint64_t>& addresses) {
-  std::optional<FoundBinary> binary =
-      finder_->FindBinary(mapping_name, build_id);
-  if (!binary)
-    return {};
-  uint64_t load_bias_correction = 0;
-  if (binary->load_bias > load_bias) {
-    // On Android 10, there was a bug in libunwindstack that would incorrectly
-    // calculate the load_bias, and thus the relative PC. This would end up in
-    // frames that made no sense. We can fix this up after the fact if we
-    // detect this situation.
-    load_bias_correction = binary->load_bias - load_bias;
-    PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s",
-                 load_bias_correction, mapping_name.c_str());
+  return std::move(SymbolizeBatch({SymbolizeRequest{
+      mapping_name, build_id, load_bias, addresses}})[0]);
+}
+
+std::vector<std::vector<std::vector<SymbolizedFrame>>>
+LocalSymbolizer::SymbolizeBatch(const std::vector<SymbolizeRequest>& requests) {
+  // The binaries are found on this thread, as the finders aren't thread-safe.
+  struct ResolvedRequest {
+    std::string file_name;
+    std::vector<uint64_t> addresses;
+  };
+  std::vector<std::optional<ResolvedRequest>> resolved(requests.size());
+  std::vector<std::string> new_files;
+  for (size_t i = 0; i < requests.size(); ++i) {
+    const SymbolizeRequest& request = requests[i];
+    std::optional<FoundBinary> binary =
+        finder_->FindBinary(request.mapping_name, request.build_id);
+    if (!binary)
+      continue;
+    uint64_t load_bias_correction = 0;
+    if (binary->load_bias > request.load_bias) {
+      // On Android 10, there was a bug in libunwindstack that would incorrectly
+      // calculate the load_bias, and thus the relative PC. This would end up in
+      // frames that made no sense. We can fix this up after the fact if we
+      // detect this situation.
+      load_bias_correction = binary->load_bias - request.load_bias;
+      PERFETTO_LOG("Correcting load bias by %" PRIu64 " for %s",
+                   load_bias_correction, request.mapping_name.c_str());
+    }
+    ResolvedRequest& resolved_request = resolved[i].emplace();
+    resolved_request.file_name = binary->file_name;
+    resolved_request.addresses.reserve(request.addresses.size());
+    for (uint64_t address : request.addresses)
+      resolved_request.addresses.push_back(address + load_bias_correction);
+    if (in_process_ && elf_files_.emplace(binary->file_name, nullptr).second)
+      new_files.push_back(binary->file_name);
+  }
+
+  // Parse the binaries seen for the first time, then symbolize the addresses
+  // of each mapping, in parallel.
+  std::vector<std::unique_ptr<ElfSymbolFile>> opened(new_files.size());
+  RunParallel(new_files.size(), [&new_files, &opened](size_t i) {
+    opened[i] = ElfSymbolFile::Open(new_files[i]);
+  });
+  for (size_t i = 0; i < new_files.size(); ++i)
+    elf_files_[new_files[i]] = std::move(opened[i]);
+
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> result(
+      requests.size());
+  std::vector<const ElfSymbolFile*> elf_files(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    auto it = resolved[i] ? elf_files_.find(resolved[i]->file_name)
+                          : elf_files_.end();
+    if (it != elf_files_.end())
+      elf_files[i] = it->second.get();
+  }
+  RunParallel(requests.size(), [&resolved, &elf_files, &result](size_t i) {
+    if (elf_files[i])
+      result[i] = elf_files[i]->Symbolize(resolved[i]->addresses);
+  });
+
+  // The rest goes through llvm-symbolizer, one address at a time.
+  for (size_t i = 0; i < requests.size(); ++i) {
+    if (!resolved[i] || elf_files[i])
+      continue;
+    if (!llvm_symbolizer_)
+      llvm_symbolizer_.reset(new LLVMSymbolizerProcess(symbolizer_path_));
+    result[i].reserve(resolved[i]->addresses.size());
+    for (uint64_t address : resolved[i]->addresses) {
+      result[i].emplace_back(
+          llvm_symbolizer_->Symbolize(resolved[i]->file_name, address));
+    }
   }
-  std::vector<std::vector<SymbolizedFrame>> result;
-  result.reserve(addresses.size());
-  for (uint64_t address : addresses)
-    result.emplace_back(llvm_symbolizer_.Symbolize(
-        binary->file_name, address + load_bias_correction));
   return result;
 }
 
-LocalSymbolizer::LocalSymbolizer(const std::string& symbolizer_path,
-                                 std::unique_ptr<BinaryFinder> finder)
-    : llvm_symbolizer_(symbolizer_path), finder_(std::move(finder)) {}
+void LocalSymbolizer::RunParallel(size_t count,
+                                  const std::function<void(size_t)>& fn) {
+  uint32_t concurrency = base::ThreadPool::MaxConcurrency();
+  if (count <= 1 || concurrency <= 1) {
+    for (size_t i = 0; i < count; ++i)
+      fn(i);
+    return;
+  }
+  // The calling thread takes part in the work too.
+  if (!thread_pool_)
+    thread_pool_.reset(new base::ThreadPool(concurrency - 1));
+  thread_pool_->ParallelFor(count, fn);
+}
 
-LocalSymbolizer::LocalSymbolizer(std::unique_ptr<BinaryFinder> finder)
-    : LocalSymbolizer(kDefaultSymbolizer, std::move(finder)) {}
+LocalSymbolizer::LocalSymbolizer(const std::string& symbolizer_path,
+                                 std::unique_ptr<BinaryFinder> finder,
+                                 bool in_process)
+    : symbolizer_path_(symbolizer_path),
+      in_process_(in_process),
+      finder_(std::move(finder)) {}
+
+LocalSymbolizer::LocalSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                                 bool in_process)
+    : LocalSymbolizer(kDefaultSymbolizer, std::move(finder), in_process) {}
 
 LocalSymbolizer::~LocalSymbolizer() = default;
 
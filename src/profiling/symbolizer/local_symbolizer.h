@@ -25,6 +25,8 @@
 #include <vector>
 
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "src/profiling/symbolizer/elf_symbol_file.h"
 #include "src/profiling/symbolizer/subprocess.h"
 #include "src/profiling/symbolizer/symbolizer.h"
 
@@ -95,12 +97,18 @@ class LLVMSymbolizerProcess {
   Subprocess subprocess_;
 };
 
+// Symbolizes ELF files with an llvm-symbolizer subprocess. If |in_process|,
+// the files which have function symbols and line tables are instead
+// symbolized in process (see ElfSymbolFile), on a thread pool when given
+// several mappings, at the cost of their inlined frames.
 class LocalSymbolizer : public Symbolizer {
  public:
   LocalSymbolizer(const std::string& symbolizer_path,
-                  std::unique_ptr<BinaryFinder> finder);
+                  std::unique_ptr<BinaryFinder> finder,
+                  bool in_process = false);
 
-  explicit LocalSymbolizer(std::unique_ptr<BinaryFinder> finder);
+  explicit LocalSymbolizer(std::unique_ptr<BinaryFinder> finder,
+                           bool in_process = false);
 
   std::vector<std::vector<SymbolizedFrame>> Symbolize(
       const std::string& mapping_name,
@@ -108,11 +116,23 @@ class LocalSymbolizer : public Symbolizer {
       uint64_t load_bias,
       const std::vector<uint64_t>& address) override;
 
+  std::vector<std::vector<std::vector<SymbolizedFrame>>> SymbolizeBatch(
+      const std::vector<SymbolizeRequest>& requests) override;
+
   ~LocalSymbolizer() override;
 
  private:
-  LLVMSymbolizerProcess llvm_symbolizer_;
+  void RunParallel(size_t count, const std::function<void(size_t)>& fn);
+
+  std::string symbolizer_path_;
+  bool in_process_;
+  // Started on the first file which isn't symbolized in process.
+  std::unique_ptr<LLVMSymbolizerProcess> llvm_symbolizer_;
   std::unique_ptr<BinaryFinder> finder_;
+  // By file name. Null for the files which are symbolized by llvm-symbolizer,
+  // which are all of them unless |in_process_|.
+  std::map<std::string, std::unique_ptr<ElfSymbolFile>> elf_files_;
+  std::unique_ptr<base::ThreadPool> thread_pool_;
 };
 
 std::unique_ptr<Symbolizer> LocalSymbolizerOrDie(
@@ -16,7 +16,9 @@
 
 #include "src/profiling/symbolizer/symbolize_database.h"
 
+#include <algorithm>
 #include <map>
+#include <set>
 #include <utility>
 #include <vector>
 
@@ -43,31 +45,35 @@ constexpr const char* kQueryUnsymbolized =
     "on spf.mapping = spm.id "
     "where spm.build_id != '' and spf.symbol_set_id IS NULL";
 
-using NameAndBuildIdPair = std::pair<std::string, std::string>;
+// The mappings with the same build id are symbolized together, as a batch of
+// this many build ids, so that the symbolizer can work on them in parallel
+// while only the frames of a batch are held in memory.
+constexpr size_t kBuildIdsPerBatch = 64;
 
-struct UnsymbolizedMapping {
-  std::string name;
-  std::string build_id;
-  uint64_t load_bias;
-  bool operator<(const UnsymbolizedMapping& o) const {
-    return std::tie(name, build_id, load_bias) <
-           std::tie(o.name, o.build_id, o.load_bias);
-  }
+// (name, load bias)
+using MappingKey = std::pair<std::string, uint64_t>;
+// (build id, load bias)
+using RequestKey = std::pair<std::string, uint64_t>;
+
+// The rel_pcs of the unsymbolized frames of each mapping with a build id.
+struct UnsymbolizedBuildId {
+  std::map<MappingKey, std::set<uint64_t>> mappings;
 };
 
-std::map<UnsymbolizedMapping, std::vector<uint64_t>> GetUnsymbolizedFrames(
+// Keyed by the raw build id.
+std::map<std::string, UnsymbolizedBuildId> GetUnsymbolizedFrames(
     trace_processor::TraceProcessor* tp) {
-  std::map<UnsymbolizedMapping, std::vector<uint64_t>> res;
+  std::map<std::string, UnsymbolizedBuildId> res;
   Iterator it = tp->ExecuteQuery(kQueryUnsymbolized);
   while (it.Next()) {
     int64_t load_bias = it.Get(3).AsLong();
     PERFETTO_CHECK(load_bias >= 0);
     trace_processor::BuildId build_id =
         trace_processor::BuildId::FromHex(it.Get(1).AsString());
-    UnsymbolizedMapping unsymbolized_mapping{
-        it.Get(0).AsString(), build_id.raw(), static_cast<uint64_t>(load_bias)};
     int64_t rel_pc = it.Get(2).AsLong();
-    res[unsymbolized_mapping].emplace_back(rel_pc);
+    res[build_id.raw()]
+        .mappings[{it.Get(0).AsString(), static_cast<uint64_t>(load_bias)}]
+        .insert(static_cast<uint64_t>(rel_pc));
   }
   if (!it.Status().ok()) {
     PERFETTO_DFATAL_OR_ELOG("Invalid iterator: %s",
@@ -76,6 +82,77 @@ std::map<UnsymbolizedMapping, std::vector<uint64_t>> GetUnsymbolizedFrames(
   }
   return res;
 }
+
+// Symbolizes the mappings of |begin|..|end| and passes a ModuleSymbols packet
+// for each of them to |callback|. The mappings which share a build id and a
+// load bias (e.g. the same library mapped under different names) are
+// symbolized once, with the union of their addresses.
+void SymbolizeBuildIds(
+    std::map<std::string, UnsymbolizedBuildId>::const_iterator begin,
+    std::map<std::string, UnsymbolizedBuildId>::const_iterator end,
+    Symbolizer* symbolizer,
+    const std::function<void(const std::string&)>& callback) {
+  std::vector<SymbolizeRequest> requests;
+  std::map<RequestKey, size_t> request_index;
+  for (auto it = begin; it != end; ++it) {
+    const std::string& build_id = it->first;
+    for (const auto& mapping_and_pcs : it->second.mappings) {
+      const MappingKey& mapping = mapping_and_pcs.first;
+      auto index = request_index.emplace(RequestKey{build_id, mapping.second},
+                                         requests.size());
+      if (index.second) {
+        requests.push_back(
+            SymbolizeRequest{mapping.first, build_id, mapping.second, {}});
+      }
+      std::vector<uint64_t>& addresses =
+          requests[index.first->second].addresses;
+      addresses.insert(addresses.end(), mapping_and_pcs.second.begin(),
+                       mapping_and_pcs.second.end());
+    }
+  }
+  for (SymbolizeRequest& request : requests) {
+    std::sort(request.addresses.begin(), request.addresses.end());
+    request.addresses.erase(
+        std::unique(request.addresses.begin(), request.addresses.end()),
+        request.addresses.end());
+  }
+
+  auto results = symbolizer->SymbolizeBatch(requests);
+  PERFETTO_CHECK(results.size() == requests.size());
+
+  for (auto it = begin; it != end; ++it) {
+    const std::string& build_id = it->first;
+    for (const auto& mapping_and_pcs : it->second.mappings) {
+      const MappingKey& mapping = mapping_and_pcs.first;
+      size_t r = request_index[{build_id, mapping.second}];
+      const std::vector<uint64_t>& addresses = requests[r].addresses;
+      const auto& res = results[r];
+      if (res.empty())
+        continue;
+      PERFETTO_DCHECK(res.size() == addresses.size());
+
+      protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
+      auto* packet = trace->add_packet();
+      auto* module_symbols = packet->set_module_symbols();
+      module_symbols->set_path(mapping.first);
+      module_symbols->set_build_id(build_id);
+      for (uint64_t rel_pc : mapping_and_pcs.second) {
+        size_t i = static_cast<size_t>(
+            std::lower_bound(addresses.begin(), addresses.end(), rel_pc) -
+            addresses.begin());
+        auto* address_symbols = module_symbols->add_address_symbols();
+        address_symbols->set_address(rel_pc);
+        for (const SymbolizedFrame& frame : res[i]) {
+          auto* line = address_symbols->add_lines();
+          line->set_function_name(frame.function_name);
+          line->set_source_file_name(frame.file_name);
+          line->set_line_number(frame.line);
+        }
+      }
+      callback(trace.SerializeAsString());
+    }
+  }
+}
 }  // namespace
 
 void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
@@ -83,32 +160,18 @@ void SymbolizeDatabase(trace_processor::TraceProcessor* tp,
                        std::function<void(const std::string&)> callback) {
   PERFETTO_CHECK(symbolizer);
   auto unsymbolized = GetUnsymbolizedFrames(tp);
-  for (auto it = unsymbolized.cbegin(); it != unsymbolized.cend(); ++it) {
-    const auto& unsymbolized_mapping = it->first;
-    const std::vector<uint64_t>& rel_pcs = it->second;
-    auto res = symbolizer->Symbolize(unsymbolized_mapping.name,
-                                     unsymbolized_mapping.build_id,
-                                     unsymbolized_mapping.load_bias, rel_pcs);
-    if (res.empty())
-      continue;
-
-    protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
-    auto* packet = trace->add_packet();
-    auto* module_symbols = packet->set_module_symbols();
-    module_symbols->set_path(unsymbolized_mapping.name);
-    module_symbols->set_build_id(unsymbolized_mapping.build_id);
-    PERFETTO_DCHECK(res.size() == rel_pcs.size());
-    for (size_t i = 0; i < res.size(); ++i) {
-      auto* address_symbols = module_symbols->add_address_symbols();
-      address_symbols->set_address(rel_pcs[i]);
-      for (const SymbolizedFrame& frame : res[i]) {
-        auto* line = address_symbols->add_lines();
-        line->set_function_name(frame.function_name);
-        line->set_source_file_name(frame.file_name);
-        line->set_line_number(frame.line);
-      }
+
+  // The packets of each batch are passed to |callback| before the next batch
+  // is symbolized, rather than once all the mappings are symbolized.
+  auto batch_begin = unsymbolized.cbegin();
+  while (batch_begin != unsymbolized.cend()) {
+    auto batch_end = batch_begin;
+    for (size_t i = 0;
+         i < kBuildIdsPerBatch && batch_end != unsymbolized.cend(); ++i) {
+      ++batch_end;
     }
-    callback(trace.SerializeAsString());
+    SymbolizeBuildIds(batch_begin, batch_end, symbolizer, callback);
+    batch_begin = batch_end;
   }
 }
 
@@ -30,6 +30,14 @@ struct SymbolizedFrame {
   uint32_t line = 0;
 };
 
+// The addresses to symbolize in a mapping, see Symbolizer::Symbolize.
+struct SymbolizeRequest {
+  std::string mapping_name;
+  std::string build_id;
+  uint64_t load_bias = 0;
+  std::vector<uint64_t> addresses;
+};
+
 class Symbolizer {
  public:
   // For each address in the input vector, output a vector of SymbolizedFrame
@@ -42,6 +50,12 @@ class Symbolizer {
       const std::string& build_id,
       uint64_t load_bias,
       const std::vector<uint64_t>& address) = 0;
+
+  // Same as Symbolize for each of |requests|, with the results in the same
+  // order. Implementations can symbolize the mappings in parallel.
+  virtual std::vector<std::vector<std::vector<SymbolizedFrame>>>
+  SymbolizeBatch(const std::vector<SymbolizeRequest>& requests);
+
   virtual ~Symbolizer();
 };
 
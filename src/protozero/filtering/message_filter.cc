@@ -16,6 +16,10 @@
 
 #include "src/protozero/filtering/message_filter.h"
 
+#include <string.h>
+
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "src/protozero/filtering/string_filter.h"
@@ -126,8 +130,14 @@ MessageFilter::FilteredMessage MessageFilter::FilterMessageFragments(
   for (size_t slice_idx = 0; slice_idx < num_slices; ++slice_idx) {
     const InputSlice& slice = slices[slice_idx];
     const uint8_t* data = static_cast<const uint8_t*>(slice.data);
-    for (size_t i = 0; i < slice.len; ++i)
-      FilterOneByte(data[i]);
+    for (size_t i = 0; i < slice.len;) {
+      size_t consumed = FilterPayloadBytes(&data[i], slice.len - i);
+      if (consumed) {
+        i += consumed;
+        continue;
+      }
+      FilterOneByte(data[i++]);
+    }
   }
 
   // Construct the output object.
@@ -284,6 +294,24 @@ void MessageFilter::FilterOneByte(uint8_t octet) {
   }
 }
 
+size_t MessageFilter::FilterPayloadBytes(const uint8_t* data, size_t len) {
+  auto* state = &stack_.back();
+  if (state->eat_next_bytes <= 1)
+    return 0;
+  // The payload cannot cross the end of the current message: this has been
+  // checked when the length-delimited token was seen. Hence this can never
+  // cause a pop of the stack.
+  const size_t n =
+      std::min(static_cast<size_t>(state->eat_next_bytes - 1), len);
+  if (state->action != StackState::kDrop) {
+    memcpy(out_, data, n);
+    out_ += n;
+  }
+  state->eat_next_bytes -= static_cast<uint32_t>(n);
+  state->in_bytes += static_cast<uint32_t>(n);
+  return n;
+}
+
 void MessageFilter::SetUnrecoverableErrorState() {
   error_ = true;
   stack_.clear();
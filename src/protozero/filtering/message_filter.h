@@ -147,6 +147,14 @@ class MessageFilter {
   // It gives a 20-25% speedup (265ms vs 215ms for a 25MB trace).
   void FilterOneByte(uint8_t octet) PERFETTO_ALWAYS_INLINE;
 
+  // Fastpath for the payload of string/bytes fields, which is most of the
+  // bytes of a typical trace. Copies (or skips, if the field is not allowed)
+  // up to |len| bytes in one go, leaving the last byte of the payload to
+  // FilterOneByte(), which takes care of string filtering and of popping the
+  // stack. Returns the number of bytes consumed, 0 if not in a payload.
+  size_t FilterPayloadBytes(const uint8_t* data,
+                            size_t len) PERFETTO_ALWAYS_INLINE;
+
   // No-inline because this is a slowpath (only when usage tracking is enabled).
   void IncrementCurrentFieldUsage(uint32_t field_id,
                                   bool allowed) PERFETTO_NO_INLINE;
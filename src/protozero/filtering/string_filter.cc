@@ -16,6 +16,7 @@
 
 #include "src/protozero/filtering/string_filter.h"
 
+#include <cctype>
 #include <cstring>
 #include <regex>
 #include <string_view>
@@ -72,6 +73,125 @@ bool StartsWith(const char* ptr,
          memcmp(ptr, starts_with.data(), starts_with.size()) == 0;
 }
 
+// Returns the index of the first character after the character class which
+// starts at |pos| (i.e. p[pos] == '['), or std::string_view::npos if the class
+// is not terminated.
+size_t SkipCharacterClass(std::string_view p, size_t pos) {
+  size_t i = pos + 1;
+  if (i < p.size() && p[i] == '^')
+    ++i;
+  // A ']' right after the opening bracket is part of the class.
+  if (i < p.size() && p[i] == ']')
+    ++i;
+  for (; i < p.size() && p[i] != ']'; ++i) {
+    if (p[i] == '\\')
+      ++i;
+  }
+  return i < p.size() ? i + 1 : std::string_view::npos;
+}
+
+// Like SkipCharacterClass() but for groups (i.e. p[pos] == '(').
+size_t SkipGroup(std::string_view p, size_t pos) {
+  uint32_t depth = 0;
+  for (size_t i = pos; i < p.size();) {
+    if (p[i] == '\\') {
+      i += 2;
+    } else if (p[i] == '[') {
+      i = SkipCharacterClass(p, i);
+    } else {
+      if (p[i] == '(') {
+        ++depth;
+      } else if (p[i] == ')' && --depth == 0) {
+        return i + 1;
+      }
+      ++i;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Works out, from an ECMAScript regex, the literal that any fully matching
+// string must start with (|prefix|) and the longest literal that any matching
+// substring must contain (|literal|). This is deliberately conservative: it
+// only looks at the top-level sequence of the pattern, ignores the content of
+// groups and classes and gives up on top-level alternations. Both are empty if
+// nothing can be inferred.
+void ExtractRequiredLiterals(std::string_view p,
+                             std::string* prefix,
+                             std::string* literal) {
+  prefix->clear();
+  literal->clear();
+  std::string run;
+  bool run_is_prefix = true;
+  auto end_run = [&] {
+    if (run_is_prefix)
+      *prefix = run;
+    if (run.size() > literal->size())
+      *literal = run;
+    run.clear();
+    run_is_prefix = false;
+  };
+  for (size_t i = 0; i < p.size();) {
+    char c = p[i];
+    size_t next = i + 1;
+    bool is_literal = false;
+    if (c == '|') {
+      // A top-level alternation: nothing is required by all the branches.
+      prefix->clear();
+      literal->clear();
+      return;
+    } else if (c == '\\') {
+      if (next >= p.size())
+        break;
+      // Escaped letters and digits are classes (\d, \w...), special
+      // characters or codes (\x41, \u0041, backreferences...). To stay on the
+      // safe side, skip also the alphanumerics that follow them. Everything
+      // else is an identity escape.
+      c = p[next++];
+      is_literal = !isalnum(static_cast<unsigned char>(c));
+      while (!is_literal && next < p.size() &&
+             isalnum(static_cast<unsigned char>(p[next]))) {
+        ++next;
+      }
+    } else if (c == '[') {
+      next = SkipCharacterClass(p, i);
+    } else if (c == '(') {
+      next = SkipGroup(p, i);
+    } else if (c == '{') {
+      size_t close = p.find('}', i);
+      next = close == std::string_view::npos ? close : close + 1;
+    } else {
+      is_literal = strchr(".)]}*+?^$", c) == nullptr;
+    }
+    if (next == std::string_view::npos)
+      break;
+    // A quantified character is not required to appear exactly once.
+    bool quantified = next < p.size() && strchr("*+?{", p[next]) != nullptr;
+    if (is_literal && !quantified) {
+      run.push_back(c);
+    } else {
+      end_run();
+    }
+    i = next;
+  }
+  end_run();
+}
+
+// Returns true if the string given by [ptr, end) can possibly be fully matched
+// by a pattern, given the literals extracted from it by
+// ExtractRequiredLiterals().
+bool MayFullyMatch(const char* ptr,
+                   const char* end,
+                   const std::string& required_prefix,
+                   const std::string& required_literal) {
+  if (!StartsWith(ptr, end, required_prefix))
+    return false;
+  if (required_literal.size() <= required_prefix.size())
+    return true;
+  std::string_view str(ptr, static_cast<size_t>(end - ptr));
+  return str.find(required_literal) != std::string_view::npos;
+}
+
 void RedactMatches(const Matches& matches) {
   // Go through every group in the matches.
   for (size_t i = 1; i < matches.size(); ++i) {
@@ -95,11 +215,15 @@ void RedactMatches(const Matches& matches) {
 void StringFilter::AddRule(Policy policy,
                            std::string_view pattern_str,
                            std::string atrace_payload_starts_with) {
-  rules_.emplace_back(StringFilter::Rule{
-      policy,
-      std::regex(pattern_str.begin(), pattern_str.end(),
-                 std::regex::ECMAScript | std::regex_constants::optimize),
-      std::move(atrace_payload_starts_with)});
+  Rule rule{policy,
+            std::regex(pattern_str.begin(), pattern_str.end(),
+                       std::regex::ECMAScript | std::regex_constants::optimize),
+            std::move(atrace_payload_starts_with),
+            {},
+            {}};
+  ExtractRequiredLiterals(pattern_str, &rule.required_prefix,
+                          &rule.required_literal);
+  rules_.emplace_back(std::move(rule));
 }
 
 bool StringFilter::MaybeFilterInternal(char* ptr, size_t len) const {
@@ -110,7 +234,9 @@ bool StringFilter::MaybeFilterInternal(char* ptr, size_t len) const {
     switch (rule.policy) {
       case Policy::kMatchRedactGroups:
       case Policy::kMatchBreak:
-        if (std::regex_match(ptr, ptr + len, matches, rule.pattern)) {
+        if (MayFullyMatch(ptr, ptr + len, rule.required_prefix,
+                          rule.required_literal) &&
+            std::regex_match(ptr, ptr + len, matches, rule.pattern)) {
           if (rule.policy == Policy::kMatchBreak) {
             return false;
           }
@@ -127,6 +253,8 @@ bool StringFilter::MaybeFilterInternal(char* ptr, size_t len) const {
         if (atrace_payload_ptr &&
             StartsWith(atrace_payload_ptr, ptr + len,
                        rule.atrace_payload_starts_with) &&
+            MayFullyMatch(ptr, ptr + len, rule.required_prefix,
+                          rule.required_literal) &&
             std::regex_match(ptr, ptr + len, matches, rule.pattern)) {
           if (rule.policy == Policy::kAtraceMatchBreak) {
             return false;
@@ -140,8 +268,11 @@ bool StringFilter::MaybeFilterInternal(char* ptr, size_t len) const {
                                  ? atrace_payload_ptr
                                  : FindAtracePayloadPtr(ptr, ptr + len);
         atrace_find_tried = true;
-        if (atrace_payload_ptr && StartsWith(atrace_payload_ptr, ptr + len,
-                                             rule.atrace_payload_starts_with)) {
+        if (atrace_payload_ptr &&
+            StartsWith(atrace_payload_ptr, ptr + len,
+                       rule.atrace_payload_starts_with) &&
+            std::string_view(ptr, len).find(rule.required_literal) !=
+                std::string_view::npos) {
           auto beg = std::regex_iterator<char*>(ptr, ptr + len, rule.pattern);
           auto end = std::regex_iterator<char*>();
           bool has_any_matches = beg != end;
@@ -54,6 +54,12 @@ class StringFilter {
     Policy policy;
     std::regex pattern;
     std::string atrace_payload_starts_with;
+
+    // Literals that any string matched by |pattern| must start with / contain,
+    // worked out from the pattern in AddRule(). They allow to discard most
+    // strings with a memcmp/find instead of running the regex engine.
+    std::string required_prefix;
+    std::string required_literal;
   };
 
   bool MaybeFilterInternal(char* ptr, size_t len) const;
@@ -16,6 +16,7 @@
 
 #include <benchmark/benchmark.h>
 #include <cstdint>
+#include <string>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -163,3 +164,38 @@ static void BM_ProtozeroStringRewriterAtraceSearchSingleRedactSpammy(
 BENCHMARK(BM_ProtozeroStringRewriterAtraceSearchSingleRedactSpammy)
     ->Unit(benchmark::kMillisecond)
     ->Arg(10);
+
+// Many distinct rules, none of which matches, as in configs redacting lots of
+// different atrace slices. Most strings are discarded by the literals inferred
+// from the patterns, without running the regex engine.
+static void BM_ProtozeroStringRewriterManyRulesMissing(
+    benchmark::State& state) {
+  protozero::StringFilter rewriter;
+  for (int64_t i = 0; i < state.range(0); ++i) {
+    std::string name = "MissingSlice" + std::to_string(i);
+    rewriter.AddRule(Policy::kMatchRedactGroups,
+                     R"(B\|[^|]+\|)" + name + R"( (.*)\n)", "");
+    rewriter.AddRule(Policy::kAtraceMatchRedactGroups,
+                     R"(B\|[^|]+\|)" + name + R"(Atrace (.*)\n)",
+                     name + "Atrace");
+  }
+
+  std::vector<char> storage;
+  auto strs = LoadTraceStrings(state, storage);
+  for (auto _ : state) {
+    uint32_t match = 0;
+    std::vector<char> local = storage;
+    for (auto& str : strs) {
+      match += rewriter.MaybeFilter(local.data() + str.first, str.second);
+    }
+    benchmark::DoNotOptimize(match);
+  }
+  state.counters["time/string"] =
+      benchmark::Counter(static_cast<double>(strs.size()),
+                         benchmark::Counter::kIsIterationInvariantRate |
+                             benchmark::Counter::kInvert);
+}
+BENCHMARK(BM_ProtozeroStringRewriterManyRulesMissing)
+    ->Unit(benchmark::kMillisecond)
+    ->Arg(10)
+    ->Arg(50);
@@ -232,6 +232,55 @@ TEST(StringFilterTest, AtraceSearchRecursive) {
   ASSERT_EQ(res, "B|1234|foo x:P60R x:P60 y:4904 x:P60R x:P60RED");
 }
 
+// The rules are prefiltered with the literals inferred from their pattern.
+// Check that the patterns for which little or nothing can be inferred still
+// behave like a plain regex match.
+TEST(StringFilterTest, RegexRedactionPrefilter) {
+  struct Case {
+    const char* pattern;
+    const char* str;
+    bool redacted;
+  };
+  const Case kCases[] = {
+      {R"(foo|bar (.*))", "bar baz", true},
+      {R"(foo|bar (.*))", "foo", true},
+      {R"((foo|bar) (.*))", "bar baz", true},
+      {R"(ab*c (.*))", "ac x", true},
+      {R"(ab*c (.*))", "abbbc x", true},
+      {R"(ab?c (.*))", "ac x", true},
+      {R"(ab{0,2}c (.*))", "ac x", true},
+      {R"(abc (.*))", "abc x", true},
+      {R"(abc (.*))", "a62c x", false},
+      {R"(abc (.*))", "abc x", true},
+      {R"([b|]+\|(.*))", "b||b|x", true},
+      {R"(.*\|foo\|(.*))", "B|1|foo|x", true},
+      {R"(.*\|foo\|(.*))", "B|1|fo|x", false},
+      {R"(B\|(\d+)\|(a|b)*\(x\))", "B|12|abba(x)", true},
+      {R"(B\|(\d+)\|(a|b)*\(x\))", "B|12|abc(x)", false},
+  };
+  for (const Case& c : kCases) {
+    StringFilter filter;
+    filter.AddRule(StringFilter::Policy::kMatchRedactGroups, c.pattern, "");
+    std::string res = c.str;
+    EXPECT_EQ(filter.MaybeFilter(res.data(), res.size()), c.redacted)
+        << c.pattern << " " << c.str;
+  }
+}
+
+TEST(StringFilterTest, AtraceSearchPrefilter) {
+  StringFilter filter;
+  filter.AddRule(StringFilter::Policy::kAtraceRepeatedSearchRedactGroups,
+                 R"(x:(\d+))", "foo");
+
+  std::string res = "B|1234|foo y:12";
+  ASSERT_FALSE(filter.MaybeFilter(res.data(), res.size()));
+  ASSERT_EQ(res, "B|1234|foo y:12");
+
+  res = "B|1234|foo y:12 x:34";
+  ASSERT_TRUE(filter.MaybeFilter(res.data(), res.size()));
+  ASSERT_EQ(res, "B|1234|foo y:12 x:P6");
+}
+
 TEST(StringFilterTest, RegexRedactionNonUtf) {
   StringFilter filter;
   filter.AddRule(StringFilter::Policy::kMatchRedactGroups,
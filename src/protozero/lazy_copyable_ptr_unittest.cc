@@ -0,0 +1,176 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/protozero/lazy_copyable_ptr.h"
+
+#include <string>
+
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "test/gtest_and_gmock.h"
+
+namespace protozero {
+namespace {
+
+// A message whose "decoding" appends the bytes to |val|, like a message with a
+// single string field would when merging.
+struct X {
+  bool ParseFromArray(const void* data, size_t size) {
+    ++parse_count;
+    val.append(static_cast<const char*>(data), size);
+    return true;
+  }
+
+  friend bool operator==(const X& lhs, const X& rhs) {
+    return lhs.val == rhs.val;
+  }
+
+  std::string val;
+  int parse_count = 0;
+};
+
+// A serialized field 1 of type bytes.
+std::string BytesField(const std::string& payload) {
+  std::string field;
+  field.push_back(static_cast<char>(proto_utils::MakeTagLengthDelimited(1)));
+  field.push_back(static_cast<char>(payload.size()));
+  return field + payload;
+}
+
+TEST(LazyCopyablePtrTest, DecodesOnFirstAccess) {
+  LazyCopyablePtr<X> p;
+  p.ParseLazily("abc", 3);
+  EXPECT_FALSE(p.is_decoded());
+  EXPECT_EQ(p.raw(), "abc");
+
+  const LazyCopyablePtr<X>& const_p = p;
+  EXPECT_EQ(const_p->val, "abc");
+  EXPECT_TRUE(p.is_decoded());
+  EXPECT_EQ(p->parse_count, 1);
+  EXPECT_EQ(p->val, "abc");
+  EXPECT_EQ(p->parse_count, 1);
+}
+
+TEST(LazyCopyablePtrTest, UnsetIsEmpty) {
+  LazyCopyablePtr<X> p;
+  EXPECT_FALSE(p.is_decoded());
+  EXPECT_EQ(p->val, "");
+  EXPECT_EQ(p->parse_count, 0);
+}
+
+// A message field repeated on the wire is merged, as in the non-lazy classes.
+TEST(LazyCopyablePtrTest, MergesRepeatedField) {
+  LazyCopyablePtr<X> p;
+  p.ParseLazily("ab", 2);
+  p.ParseLazily("cd", 2);
+  EXPECT_TRUE(p.is_decoded());
+  EXPECT_EQ(p->val, "abcd");
+}
+
+TEST(LazyCopyablePtrTest, CopyAndMove) {
+  LazyCopyablePtr<X> p1;
+  p1.ParseLazily("abc", 3);
+
+  LazyCopyablePtr<X> p2(p1);
+  EXPECT_FALSE(p2.is_decoded());
+  EXPECT_EQ(p2->val, "abc");
+  EXPECT_FALSE(p1.is_decoded());
+
+  LazyCopyablePtr<X> p3;
+  p3 = p2;
+  EXPECT_TRUE(p3.is_decoded());
+  p3->val = "x";
+  EXPECT_EQ(p2->val, "abc");
+
+  LazyCopyablePtr<X> p4(std::move(p1));
+  EXPECT_EQ(p4->val, "abc");
+  // The moved-from object needs to stay valid and empty.
+  EXPECT_EQ(p1.raw(), "");
+  EXPECT_EQ(p1->val, "");
+
+  p4 = std::move(p3);
+  EXPECT_EQ(p4->val, "x");
+}
+
+TEST(LazyCopyablePtrTest, Compare) {
+  LazyCopyablePtr<X> p1;
+  p1.ParseLazily("abc", 3);
+  LazyCopyablePtr<X> p2;
+  p2.ParseLazily("abc", 3);
+
+  // Equal bytes are equal without decoding.
+  EXPECT_TRUE(p1 == p2);
+  EXPECT_FALSE(p1.is_decoded());
+  EXPECT_FALSE(p2.is_decoded());
+
+  p1->val = "abc";
+  EXPECT_TRUE(p1 == p2);
+  p1->val = "x";
+  EXPECT_TRUE(p1 != p2);
+}
+
+TEST(LazyRepeatedPtrTest, DecodesOnFirstAccess) {
+  std::string serialized = BytesField("ab") + BytesField("") + BytesField("c");
+  LazyRepeatedPtr<X> p;
+  ProtoDecoder dec(serialized.data(), serialized.size());
+  for (auto f = dec.ReadField(); f.valid(); f = dec.ReadField())
+    p.ParseLazily(f);
+  EXPECT_FALSE(p.is_decoded());
+  EXPECT_EQ(p.raw(), serialized);
+
+  const LazyRepeatedPtr<X>& const_p = p;
+  ASSERT_EQ(const_p->size(), 3u);
+  EXPECT_TRUE(p.is_decoded());
+  EXPECT_EQ((*p)[0].val, "ab");
+  EXPECT_EQ((*p)[1].val, "");
+  EXPECT_EQ((*p)[2].val, "c");
+
+  // Once decoded, new elements are decoded right away.
+  std::string more = BytesField("d");
+  ProtoDecoder more_dec(more.data(), more.size());
+  p.ParseLazily(more_dec.ReadField());
+  ASSERT_EQ(p->size(), 4u);
+  EXPECT_EQ((*p)[3].val, "d");
+
+  p.clear();
+  EXPECT_FALSE(p.is_decoded());
+  EXPECT_TRUE(p->empty());
+}
+
+TEST(LazyRepeatedPtrTest, CopyMoveAndCompare) {
+  std::string serialized = BytesField("ab") + BytesField("c");
+  LazyRepeatedPtr<X> p1;
+  ProtoDecoder dec(serialized.data(), serialized.size());
+  for (auto f = dec.ReadField(); f.valid(); f = dec.ReadField())
+    p1.ParseLazily(f);
+
+  LazyRepeatedPtr<X> p2(p1);
+  EXPECT_TRUE(p1 == p2);
+  EXPECT_FALSE(p1.is_decoded());
+
+  p2->emplace_back();
+  EXPECT_TRUE(p1 != p2);
+  EXPECT_EQ(p1->size(), 2u);
+
+  LazyRepeatedPtr<X> p3(std::move(p2));
+  EXPECT_EQ(p3->size(), 3u);
+  // The moved-from object needs to stay valid and empty.
+  EXPECT_FALSE(p2.is_decoded());
+  EXPECT_TRUE(p2->empty());
+}
+
+}  // namespace
+}  // namespace protozero
@@ -24,23 +24,83 @@
 
 namespace protozero {
 
+namespace {
+
+// Caps the memory retained by each thread, see GetThreadFreeBlocks().
+constexpr size_t kMaxFreeBlocksPerThread = 8;
+
+std::atomic<uint64_t> g_expansions{};
+std::atomic<uint64_t> g_block_allocations{};
+
+}  // namespace
+
+// static
+MessageArena::Stats MessageArena::GetStats() {
+  Stats stats;
+  stats.expansions = g_expansions.load(std::memory_order_relaxed);
+  stats.block_allocations = g_block_allocations.load(std::memory_order_relaxed);
+  return stats;
+}
+
+// static
+std::forward_list<MessageArena::Block>* MessageArena::GetThreadFreeBlocks(
+    size_t** size) {
+  struct FreeBlocks {
+    std::forward_list<Block> blocks;
+    size_t size = 0;
+  };
+
+  // This is a POD to keep the access cheap, the list is deleted by
+  // FreeBlocksReleaser when the thread exits. Arenas destroyed after that
+  // (e.g. by other thread_local objects) bypass the freelist.
+  static thread_local FreeBlocks* free_blocks = nullptr;
+  static thread_local bool released = false;
+
+  struct FreeBlocksReleaser {
+    ~FreeBlocksReleaser() {
+      delete free_blocks;
+      free_blocks = nullptr;
+      released = true;
+    }
+    bool armed = false;
+  };
+  static thread_local FreeBlocksReleaser releaser;
+
+  if (PERFETTO_UNLIKELY(!free_blocks)) {
+    if (released)
+      return nullptr;
+    free_blocks = new FreeBlocks();
+    releaser.armed = true;  // Registers the exit destructor.
+  }
+  *size = &free_blocks->size;
+  return &free_blocks->blocks;
+}
+
 MessageArena::MessageArena() {
   // The code below assumes that there is always at least one block.
-  blocks_.emplace_front();
+  PushBlock();
   static_assert(
       std::alignment_of<decltype(blocks_.front().storage[0])>::value >=
           alignof(Message),
       "MessageArea's storage is not properly aligned");
 }
 
-MessageArena::~MessageArena() = default;
+MessageArena::~MessageArena() {
+  while (!blocks_.empty()) {
+    Block& block = blocks_.front();
+    block.entries = 0;
+    PERFETTO_ASAN_POISON(block.storage, sizeof(block.storage));
+    PopBlock();
+  }
+}
 
 Message* MessageArena::NewMessage() {
   PERFETTO_DCHECK(!blocks_.empty());  // Should never become empty.
 
   Block* block = &blocks_.front();
   if (PERFETTO_UNLIKELY(block->entries >= Block::kCapacity)) {
-    blocks_.emplace_front();
+    g_expansions.fetch_add(1, std::memory_order_relaxed);
+    PushBlock();
     block = &blocks_.front();
   }
   const auto idx = block->entries++;
@@ -65,7 +125,44 @@ void MessageArena::DeleteLastMessageInternal() {
   // Don't remove the first block to avoid malloc/free calls when the root
   // message is reset. Hitting the allocator all the times is a waste of time.
   if (block->entries == 0 && std::next(blocks_.cbegin()) != blocks_.cend()) {
-    blocks_.pop_front();
+    PopBlock();
+  }
+}
+
+void MessageArena::PushBlock() {
+  size_t* free_size = nullptr;
+  std::forward_list<Block>* free_blocks = GetThreadFreeBlocks(&free_size);
+  if (free_blocks && !free_blocks->empty()) {
+    // Moves the node without any allocation.
+    blocks_.splice_after(blocks_.before_begin(), *free_blocks,
+                         free_blocks->before_begin());
+    --*free_size;
+    PERFETTO_DCHECK(blocks_.front().entries == 0);
+    return;
+  }
+  g_block_allocations.fetch_add(1, std::memory_order_relaxed);
+  blocks_.emplace_front();
+}
+
+void MessageArena::PopBlock() {
+  PERFETTO_DCHECK(!blocks_.empty() && blocks_.front().entries == 0);
+  size_t* free_size = nullptr;
+  std::forward_list<Block>* free_blocks = GetThreadFreeBlocks(&free_size);
+  if (free_blocks && *free_size < kMaxFreeBlocksPerThread) {
+    free_blocks->splice_after(free_blocks->before_begin(), blocks_,
+                              blocks_.before_begin());
+    ++*free_size;
+    return;
+  }
+  blocks_.pop_front();
+}
+
+void MessageArena::ReleaseExtraBlocks() {
+  while (std::next(blocks_.cbegin()) != blocks_.cend()) {
+    Block& block = blocks_.front();
+    block.entries = 0;
+    PERFETTO_ASAN_POISON(block.storage, sizeof(block.storage));
+    PopBlock();
   }
 }
 
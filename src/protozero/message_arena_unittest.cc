@@ -62,5 +62,38 @@ TEST(MessageArenaTest, ManyMessages) {
   EXPECT_THAT(msg, NotNull());
 }
 
+TEST(MessageArenaTest, RecyclesBlocks) {
+  // Ideally this should be more than MessageArena::Block::kCapacity, but that's
+  // private.
+  constexpr size_t kNumMessages = 32;
+  auto nest_and_unnest = [](MessageArena* arena) {
+    std::array<Message*, kNumMessages> messages;
+    for (size_t i = 0; i < kNumMessages; i++)
+      messages[i] = arena->NewMessage();
+    for (auto it = messages.crbegin(); it != messages.crend(); it++)
+      arena->DeleteLastMessage(*it);
+  };
+
+  // Warm up the per-thread freelist.
+  {
+    MessageArena arena;
+    nest_and_unnest(&arena);
+  }
+
+  // Further nesting and new arenas on the same thread reuse the freed blocks.
+  MessageArena::Stats before = MessageArena::GetStats();
+  for (int i = 0; i < 3; i++) {
+    MessageArena arena;
+    nest_and_unnest(&arena);
+    nest_and_unnest(&arena);
+    arena.NewMessage();
+    arena.NewMessage();
+    arena.Reset();
+  }
+  MessageArena::Stats after = MessageArena::GetStats();
+  EXPECT_GE(after.expansions - before.expansions, 6u);
+  EXPECT_EQ(after.block_allocations, before.block_allocations);
+}
+
 }  // namespace
 }  // namespace protozero
@@ -65,6 +65,10 @@ ParseFieldResult ParseOneField(const uint8_t* const buffer,
   uint64_t preamble = 0;
   if (PERFETTO_LIKELY(*pos < 0x80)) {  // Fastpath for fields with ID < 16.
     preamble = *(pos++);
+  } else if (PERFETTO_LIKELY(end - pos >= 2 && pos[1] < 0x80)) {
+    // Fastpath for fields with ID < 2048.
+    preamble = (pos[0] & 0x7fu) | (static_cast<uint64_t>(pos[1]) << 7);
+    pos += 2;
   } else {
     const uint8_t* next = ParseVarInt(pos, end, &preamble);
     if (PERFETTO_UNLIKELY(pos == next))
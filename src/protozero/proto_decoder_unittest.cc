@@ -16,8 +16,12 @@
 
 #include "perfetto/protozero/proto_decoder.h"
 
+#include <limits>
+#include <vector>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/message.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/static_buffer.h"
@@ -353,6 +357,34 @@ TEST(ProtoDecoderTest, PackedRepeatedVarint) {
   ASSERT_FALSE(parse_error);
 }
 
+TEST(ProtoDecoderTest, PackedRepeatedVarintMixedSizes) {
+  std::vector<uint64_t> values;
+  for (uint32_t shift = 0; shift < 64; shift += 3) {
+    values.push_back(1ull << shift);
+    values.push_back(0);
+    values.push_back((1ull << shift) - 1);
+  }
+  values.push_back(std::numeric_limits<uint64_t>::max());
+
+  PackedVarInt packed;
+  for (uint64_t v : values)
+    packed.Append(v);
+  HeapBuffered<Message> message;
+  message->AppendBytes(1, packed.data(), packed.size());
+  auto data = message.SerializeAsArray();
+
+  TypedProtoDecoder<1, false> decoder(data.data(), data.size());
+  bool parse_error = false;
+  std::vector<uint64_t> decoded_values;
+  for (auto it = decoder.GetPackedRepeated<ProtoWireType::kVarInt, uint64_t>(
+           1, &parse_error);
+       it; ++it) {
+    decoded_values.push_back(*it);
+  }
+  ASSERT_FALSE(parse_error);
+  ASSERT_EQ(values, decoded_values);
+}
+
 TEST(ProtoDecoderTest, PackedRepeatedFixed32) {
   std::vector<uint32_t> values = {42, 255, 0, 1};
 
@@ -590,6 +622,35 @@ TEST(ProtoDecoderTest, BigFieldIds) {
   }
 }
 
+TEST(ProtoDecoderTest, TwoBytePreambles) {
+  HeapBuffered<Message> message;
+  message->AppendVarInt(/*field_id=*/16, 1);
+  message->AppendString(/*field_id=*/100, "foo");
+  message->AppendVarInt(/*field_id=*/2047, 2);
+  message->AppendVarInt(/*field_id=*/2048, 3);
+  auto data = message.SerializeAsArray();
+
+  ProtoDecoder decoder(data.data(), data.size());
+  Field field = decoder.ReadField();
+  ASSERT_EQ(field.id(), 16u);
+  ASSERT_EQ(field.as_uint32(), 1u);
+  field = decoder.ReadField();
+  ASSERT_EQ(field.id(), 100u);
+  ASSERT_EQ(field.as_std_string(), "foo");
+  field = decoder.ReadField();
+  ASSERT_EQ(field.id(), 2047u);
+  ASSERT_EQ(field.as_uint32(), 2u);
+  field = decoder.ReadField();
+  ASSERT_EQ(field.id(), 2048u);
+  ASSERT_EQ(field.as_uint32(), 3u);
+  ASSERT_FALSE(decoder.ReadField().valid());
+
+  // A preamble truncated after its first byte is not a valid field.
+  const uint8_t truncated[] = {0x80};
+  ProtoDecoder truncated_decoder(truncated, sizeof(truncated));
+  ASSERT_FALSE(truncated_decoder.ReadField().valid());
+}
+
 // Edge case for SkipBigFieldIds, the message contains only one field with a
 // very big id. Test that we skip it and return an invalid field, instead of
 // geetting stuck in some loop.
@@ -647,5 +708,28 @@ TEST(ProtoDecoderTest, RepeatedMaxFieldIdStack) {
   }
 }
 
+// Messages without non-packed repeated fields use a stack storage sized on
+// their max field id. Duplicated fields must still work, falling back on the
+// heap once the spare slot is used.
+TEST(ProtoDecoderTest, SmallStackStorageDuplicatedFields) {
+  HeapBuffered<Message> message;
+  message->AppendVarInt(1, 10);
+  for (uint64_t i = 0; i < 5; i++)
+    message->AppendVarInt(3, i);
+  std::vector<uint8_t> proto = message.SerializeAsArray();
+
+  protozero::TypedProtoDecoder</*MAX_FIELD_ID=*/3,
+                               /*HAS_NONPACKED_REPEATED_FIELDS=*/false>
+      decoder(proto.data(), proto.size());
+  EXPECT_EQ(decoder.at<1>().as_uint64(), 10u);
+  EXPECT_FALSE(decoder.at<2>().valid());
+  EXPECT_EQ(decoder.at<3>().as_uint64(), 4u);
+  std::vector<uint64_t> res;
+  for (auto it = decoder.GetRepeated<uint64_t>(3); it; it++) {
+    res.push_back(*it);
+  }
+  EXPECT_THAT(res, ElementsAre(0, 1, 2, 3, 4));
+}
+
 }  // namespace
 }  // namespace protozero
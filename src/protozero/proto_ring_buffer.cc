@@ -16,8 +16,11 @@
 
 #include "perfetto/ext/protozero/proto_ring_buffer.h"
 
+#include <algorithm>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 
 namespace protozero {
@@ -89,19 +92,30 @@ void RingBufferMessageReader::Append(const void* data_void, size_t data_len) {
   if (rd_ == wr_)
     rd_ = wr_ = 0;
 
-  // The caller is expected to always issue a ReadMessage() after each Append().
-  PERFETTO_CHECK(!fastpath_.valid());
+  // The caller is expected to always issue ReadMessage() calls after each
+  // Append(), until no more messages can be read.
+  PERFETTO_CHECK(ext_rd_ == ext_end_);
   if (rd_ == wr_) {
-    auto msg = TryReadMessage(data, data + data_len);
-    if (msg.valid() && msg.end() == (data + data_len)) {
-      // Fastpath: in many cases, the underlying stream will effectively
-      // preserve the atomicity of messages for most small messages.
-      // In this case we can avoid the extra buf_ roundtrip and just pass a
-      // pointer to |data| + (proto preamble len).
-      // The next call to ReadMessage)= will return |fastpath_|.
-      fastpath_ = std::move(msg);
-      return;
+    // Fastpath: in many cases, the underlying stream will effectively
+    // preserve the atomicity of messages, or will deliver large chunks made
+    // of many complete messages. In this case we can avoid the extra buf_
+    // roundtrip and hand out pointers into |data| from the next ReadMessage()
+    // calls. Only the trailing incomplete message, if any, is copied.
+    const uint8_t* data_end = data + data_len;
+    const uint8_t* complete_end = data;
+    for (;;) {
+      auto msg = TryReadMessage(complete_end, data_end);
+      if (!msg.valid())
+        break;
+      PERFETTO_CHECK(msg.end() > complete_end && msg.end() <= data_end);
+      complete_end = msg.end();
     }
+    ext_rd_ = data;
+    ext_end_ = complete_end;
+    data = complete_end;
+    data_len = static_cast<size_t>(data_end - complete_end);
+    if (data_len == 0)
+      return;
   }
 
   size_t avail = buf_.size() - wr_;
@@ -117,11 +131,13 @@ void RingBufferMessageReader::Append(const void* data_void, size_t data_len) {
     // After recompaction:
     // buf_: [msg1 incomplete]
     //       ^rd_             ^wr_
-    uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
-    memmove(&buf[0], &buf[rd_], wr_ - rd_);
-    avail += rd_;
-    wr_ -= rd_;
-    rd_ = 0;
+    if (rd_ > 0) {
+      uint8_t* buf = static_cast<uint8_t*>(buf_.Get());
+      memmove(&buf[0], &buf[rd_], wr_ - rd_);
+      avail += rd_;
+      wr_ -= rd_;
+      rd_ = 0;
+    }
     if (data_len > avail) {
       // The compaction didn't free up enough space and we need to expand the
       // ring buffer. Yes, we could have detected this earlier and split the
@@ -129,15 +145,20 @@ void RingBufferMessageReader::Append(const void* data_void, size_t data_len) {
       // sufficient. However, that would make the code harder to reason about,
       // creating code paths that are nearly never hit, hence making it more
       // likely to accumulate bugs in future. All this is very rare.
-      size_t new_size = buf_.size();
-      while (data_len > new_size - wr_)
-        new_size += kGrowBytes;
-      if (new_size > kMaxMsgSize * 2) {
+      // The buffer grows geometrically: a large message received in small
+      // chunks would otherwise cause a realloc (and a copy of the whole
+      // buffer) every kGrowBytes.
+      constexpr size_t kMaxSize = kMaxMsgSize * 2;
+      const size_t min_size = wr_ + data_len;
+      if (min_size > kMaxSize) {
         failed_ = true;
         return;
       }
+      size_t new_size = std::max(min_size, std::min(buf_.size() * 2, kMaxSize));
+      new_size = perfetto::base::AlignUp<kGrowBytes>(new_size);
       auto new_buf = perfetto::base::PagedMemory::Allocate(new_size);
-      memcpy(new_buf.Get(), buf_.Get(), buf_.size());
+      // Only [0, wr_) is in use, as the buffer has just been compacted.
+      memcpy(new_buf.Get(), buf_.Get(), wr_);
       buf_ = std::move(new_buf);
       avail = new_size - wr_;
       // No need to touch rd_ / wr_ cursors.
@@ -154,11 +175,11 @@ RingBufferMessageReader::Message RingBufferMessageReader::ReadMessage() {
   if (failed_)
     return FramingError();
 
-  if (fastpath_.valid()) {
-    // The fastpath can only be hit when the buffer is empty.
-    PERFETTO_CHECK(rd_ == wr_);
-    auto msg = std::move(fastpath_);
-    fastpath_ = Message{};
+  if (ext_rd_ != ext_end_) {
+    // Messages from the last Append(), which were all validated there.
+    auto msg = TryReadMessage(ext_rd_, ext_end_);
+    PERFETTO_CHECK(msg.valid());
+    ext_rd_ = msg.end();
     return msg;
   }
 
@@ -127,6 +127,31 @@ TEST_F(ProtoRingBufferTest, Fastpath) {
   }
 }
 
+// Test that when appending a chunk made of several whole messages and a partial
+// one, only the partial one is copied in the ring buffer.
+TEST_F(ProtoRingBufferTest, FastpathMultipleMessages) {
+  ProtoRingBuffer buf;
+  last_msg_.reserve(1024);
+  std::vector<ProtoRingBuffer::Message> expected;
+  for (uint32_t i = 1; i <= 4; i++)
+    expected.emplace_back(MakeProtoMessage(i, 100, /*append=*/true));
+
+  // Leave out the last 10 bytes of the 4th message.
+  buf.Append(last_msg_.data(), last_msg_.size() - 10);
+  EXPECT_EQ(buf.capacity() - buf.avail(), 100 + 2 /* preamble */ - 10u);
+  for (uint32_t i = 0; i < 3; i++) {
+    auto msg = buf.ReadMessage();
+    ASSERT_TRUE(msg.valid());
+    EXPECT_EQ(msg.start, expected[i].start);  // Should point to the same buf.
+    EXPECT_EQ(msg, expected[i]);
+  }
+  EXPECT_FALSE(buf.ReadMessage().valid());
+
+  buf.Append(last_msg_.data() + last_msg_.size() - 10, 10);
+  EXPECT_EQ(buf.ReadMessage(), expected[3]);
+  EXPECT_FALSE(buf.ReadMessage().valid());
+}
+
 TEST_F(ProtoRingBufferTest, CoalescingStream) {
   ProtoRingBuffer buf;
   last_msg_.reserve(1024);
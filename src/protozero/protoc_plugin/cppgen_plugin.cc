@@ -72,6 +72,14 @@ class CppObjGenerator : public ::google::protobuf::compiler::CodeGenerator {
   void GenClassDecl(const Descriptor*, Printer*) const;
   void GenClassDef(const Descriptor*, Printer*) const;
 
+  // True for the nested message fields that are decoded on first access,
+  // see the lazy_nested_messages option. Not to be confused with the
+  // [lazy=true] fields, which are exposed only as raw bytes.
+  bool IsLazyNested(const FieldDescriptor* field) const {
+    return lazy_nested_messages_ && field->type() == TYPE_MESSAGE &&
+           !field->options().lazy();
+  }
+
   std::vector<std::string> GetNamespaces(const FileDescriptor* file) const {
     std::string pkg = file->package() + wrapper_namespace_;
     return SplitString(pkg, ".");
@@ -101,6 +109,7 @@ class CppObjGenerator : public ::google::protobuf::compiler::CodeGenerator {
   }
 
   mutable std::string wrapper_namespace_;
+  mutable bool lazy_nested_messages_ = false;
   mutable std::string package_;
 };
 
@@ -116,6 +125,8 @@ bool CppObjGenerator::Generate(const google::protobuf::FileDescriptor* file,
     if (option_pair[0] == "wrapper_namespace") {
       wrapper_namespace_ =
           option_pair.size() == 2 ? "." + option_pair[1] : std::string();
+    } else if (option_pair[0] == "lazy_nested_messages") {
+      lazy_nested_messages_ = true;
     } else {
       *error = "Unknown plugin option: " + option_pair[0];
       return false;
@@ -150,6 +161,8 @@ bool CppObjGenerator::Generate(const google::protobuf::FileDescriptor* file,
   h_printer.Print("#include <type_traits>\n\n");
   h_printer.Print("#include \"perfetto/protozero/cpp_message_obj.h\"\n");
   h_printer.Print("#include \"perfetto/protozero/copyable_ptr.h\"\n");
+  if (lazy_nested_messages_)
+    h_printer.Print("#include \"perfetto/protozero/lazy_copyable_ptr.h\"\n");
   h_printer.Print("#include \"perfetto/base/export.h\"\n\n");
 
   cc_printer.Print("#include \"perfetto/protozero/gen_field_helpers.h\"\n");
@@ -607,7 +620,14 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
     } else if (!field->is_repeated()) {
       p->Print("bool has_$n$() const { return _has_field_[$bit$]; }\n", "n",
                field->lowercase_name(), "bit", std::to_string(field->number()));
-      if (field->type() == TYPE_MESSAGE) {
+      if (IsLazyNested(field)) {
+        // Decoding requires the full definition of the nested type, hence
+        // these are defined in the .cc file.
+        p->Print("$t$ $n$() const;\n", "t", GetCppType(field, true), "n",
+                 field->lowercase_name());
+        p->Print("$t$* mutable_$n$();\n", "t", GetCppType(field, false), "n",
+                 field->lowercase_name());
+      } else if (field->type() == TYPE_MESSAGE) {
         p->Print("$t$ $n$() const { return *$n$_; }\n", "t",
                  GetCppType(field, true), "n", field->lowercase_name());
         p->Print("$t$* mutable_$n$() { $s$; return $n$_.get(); }\n", "t",
@@ -626,6 +646,15 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
               "n", field->lowercase_name(), "s", set_bit);
         }
       }
+    } else if (IsLazyNested(field)) {  // && is_repeated()
+      p->Print("const std::vector<$t$>& $n$() const;\n", "t",
+               GetCppType(field, false), "n", field->lowercase_name());
+      p->Print("std::vector<$t$>* mutable_$n$();\n", "t",
+               GetCppType(field, false), "n", field->lowercase_name());
+      p->Print("int $n$_size() const;\n", "n", field->lowercase_name());
+      p->Print("void clear_$n$();\n", "n", field->lowercase_name());
+      p->Print("$t$* add_$n$();\n", "t", GetCppType(field, false), "n",
+               field->lowercase_name());
     } else {  // is_repeated()
       p->Print("const std::vector<$t$>& $n$() const { return $n$_; }\n", "t",
                GetCppType(field, false), "n", field->lowercase_name());
@@ -670,6 +699,11 @@ void CppObjGenerator::GenClassDecl(const Descriptor* msg, Printer* p) const {
     if (field->options().lazy()) {
       p->Print("std::string $n$_;  // [lazy=true]\n", "n",
                field->lowercase_name());
+    } else if (IsLazyNested(field)) {
+      std::string type = field->is_repeated() ? "::protozero::LazyRepeatedPtr"
+                                              : "::protozero::LazyCopyablePtr";
+      p->Print("$t$<$m$> $n$_;\n", "t", type, "m", GetCppType(field, false),
+               "n", field->lowercase_name());
     } else if (!field->is_repeated()) {
       std::string type = GetCppType(field, false);
       if (field->type() == TYPE_MESSAGE) {
@@ -724,11 +758,41 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
   p->Outdent();
   p->Print("\n}\n\n");
 
+  // Accessors for lazily decoded message fields.
+  for (int i = 0; i < msg->field_count(); i++) {
+    const FieldDescriptor* field = msg->field(i);
+    if (!IsLazyNested(field))
+      continue;
+    std::map<std::string, std::string> args;
+    args["c"] = full_name;
+    args["t"] = GetCppType(field, false);
+    args["n"] = field->lowercase_name();
+    args["id"] = std::to_string(field->number());
+    if (!field->is_repeated()) {
+      p->Print(args, "const $t$& $c$::$n$() const { return *$n$_; }\n");
+      p->Print(args,
+               "$t$* $c$::mutable_$n$() { _has_field_.set($id$); "
+               "return $n$_.get(); }\n");
+      continue;
+    }
+    p->Print(args,
+             "const std::vector<$t$>& $c$::$n$() const { return *$n$_; }\n");
+    p->Print(args,
+             "std::vector<$t$>* $c$::mutable_$n$() { return $n$_.get(); }\n");
+    p->Print(args,
+             "int $c$::$n$_size() const { "
+             "return static_cast<int>($n$_->size()); }\n");
+    p->Print(args, "void $c$::clear_$n$() { $n$_.clear(); }\n");
+    p->Print(args,
+             "$t$* $c$::add_$n$() { $n$_->emplace_back(); "
+             "return &$n$_->back(); }\n");
+  }
+
   // Accessors for repeated message fields.
   for (int i = 0; i < msg->field_count(); i++) {
     const FieldDescriptor* field = msg->field(i);
     if (field->options().lazy() || !field->is_repeated() ||
-        field->type() != TYPE_MESSAGE) {
+        field->type() != TYPE_MESSAGE || IsLazyNested(field)) {
       continue;
     }
     p->Print(
@@ -776,6 +840,11 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
           "::protozero::internal::gen_helpers::DeserializeString(field, "
           "&$n$_);\n",
           "n", field->lowercase_name());
+    } else if (IsLazyNested(field)) {
+      p->Print(field->is_repeated()
+                   ? "$n$_.ParseLazily(field);\n"
+                   : "$n$_.ParseLazily(field.data(), field.size());\n",
+               "n", field->lowercase_name());
     } else {
       std::string statement;
       if (field->type() == TYPE_MESSAGE) {
@@ -860,7 +929,31 @@ void CppObjGenerator::GenClassDef(const Descriptor* msg, Printer* p) const {
     args["id"] = std::to_string(field->number());
     args["n"] = field->lowercase_name();
     p->Print(args, "// Field $id$: $n$\n");
-    if (field->is_packed()) {
+    if (IsLazyNested(field)) {
+      // Fields that have never been accessed are written back verbatim.
+      if (field->is_repeated()) {
+        p->Print(args, "if ($n$_.is_decoded()) {\n");
+        p->Print(args, "  for (auto& it : *$n$_)\n");
+        p->Print(args,
+                 "    it.Serialize("
+                 "msg->BeginNestedMessage<::protozero::Message>($id$));\n");
+        p->Print(args, "} else {\n");
+        p->Print(args,
+                 "  msg->AppendRawProtoBytes($n$_.raw().data(), "
+                 "$n$_.raw().size());\n");
+        p->Print("}\n");
+      } else {
+        p->Print(args, "if (_has_field_[$id$] && $n$_.is_decoded()) {\n");
+        p->Print(args,
+                 "  $n$_->Serialize("
+                 "msg->BeginNestedMessage<::protozero::Message>($id$));\n");
+        p->Print(args, "} else if (_has_field_[$id$]) {\n");
+        p->Print(args,
+                 "  msg->AppendBytes($id$, $n$_.raw().data(), "
+                 "$n$_.raw().size());\n");
+        p->Print("}\n");
+      }
+    } else if (field->is_packed()) {
       PERFETTO_CHECK(field->is_repeated());
       p->Print("{\n");
       p->Indent();
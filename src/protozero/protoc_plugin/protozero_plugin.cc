@@ -246,6 +246,16 @@ class GeneratorJob {
     return "";
   }
 
+  // e.g. ::protozero::PackedFixedSizeInt<uint32_t> ->
+  //      ::protozero::PackedFixedSizeIntWriter<uint32_t>
+  std::string FieldTypeToPackedWriterType(FieldDescriptor::Type proto_type) {
+    std::string type = FieldTypeToPackedBufferType(proto_type);
+    size_t pos = type.find('<');
+    if (pos == std::string::npos)
+      return type + "Writer";
+    return type.substr(0, pos) + "Writer" + type.substr(pos);
+  }
+
   const char* FieldToProtoSchemaType(const FieldDescriptor* field) {
     switch (field->type()) {
       case FieldDescriptor::TYPE_BOOL:
@@ -680,6 +690,14 @@ case $full_class$::$value_name$:
         "  AppendBytes($field_metadata$::kFieldId, packed_buffer.data(),\n"
         "              packed_buffer.size());\n"
         "}\n");
+
+    // Encodes the elements straight into the message, without the
+    // intermediate copy of the buffer above.
+    setter["writer_type"] = FieldTypeToPackedWriterType(field->type());
+    stub_h_->Print(setter,
+                   "$writer_type$ begin_$name$() {\n"
+                   "  return $writer_type$(this, $field_metadata$::kFieldId);\n"
+                   "}\n");
   }
 
   void GenerateSimpleFieldDescriptor(const FieldDescriptor* field) {
@@ -17,26 +17,127 @@
 #include "perfetto/protozero/scattered_heap_buffer.h"
 
 #include <algorithm>
+#include <array>
 
 namespace protozero {
 
+namespace {
+
+// A per-thread cache of slice buffers, so that code that serializes lots of
+// short-lived HeapBuffered messages doesn't hit malloc for each of them.
+// Only power-of-two sizes are cached (the slice sizes are doubled on each
+// GetNewBuffer() so, in practice, all of them), one free list per size. The
+// amount of memory retained by each thread is capped.
+class SlicePool {
+ public:
+  static constexpr size_t kMinSizeLog2 = 7;   // 128 B.
+  static constexpr size_t kMaxSizeLog2 = 17;  // 128 KB.
+  static constexpr size_t kMaxSlicesPerSize = 16;
+  static constexpr size_t kMaxRetainedBytes = 256 * 1024;
+
+  std::unique_ptr<uint8_t[]> Allocate(size_t size) {
+    size_t idx = SizeIndex(size);
+    if (idx < free_lists_.size() && !free_lists_[idx].empty()) {
+      std::unique_ptr<uint8_t[]> buf = std::move(free_lists_[idx].back());
+      free_lists_[idx].pop_back();
+      retained_bytes_ -= size;
+      return buf;
+    }
+    return std::unique_ptr<uint8_t[]>(new uint8_t[size]);
+  }
+
+  void Release(std::unique_ptr<uint8_t[]> buf, size_t size) {
+    size_t idx = SizeIndex(size);
+    if (idx >= free_lists_.size() ||
+        free_lists_[idx].size() >= kMaxSlicesPerSize ||
+        retained_bytes_ + size > kMaxRetainedBytes) {
+      return;  // |buf| is freed when going out of scope.
+    }
+    free_lists_[idx].emplace_back(std::move(buf));
+    retained_bytes_ += size;
+  }
+
+ private:
+  // Returns the free list index for |size|, or an out of range index if
+  // |size| is not cached.
+  static size_t SizeIndex(size_t size) {
+    if ((size & (size - 1)) != 0 || size < (1u << kMinSizeLog2))
+      return kNumSizes;
+    size_t idx = 0;
+    for (size >>= kMinSizeLog2; size > 1; size >>= 1)
+      ++idx;
+    return idx;
+  }
+
+  static constexpr size_t kNumSizes = kMaxSizeLog2 - kMinSizeLog2 + 1;
+  std::array<std::vector<std::unique_ptr<uint8_t[]>>, kNumSizes> free_lists_;
+  size_t retained_bytes_ = 0;
+};
+
+// This is a POD to keep the access cheap, the pool is deleted by
+// SlicePoolReleaser when the thread exits. Slices destroyed after that (e.g.
+// by other thread_local objects) bypass the pool.
+thread_local SlicePool* g_slice_pool = nullptr;
+thread_local bool g_slice_pool_released = false;
+
+struct SlicePoolReleaser {
+  ~SlicePoolReleaser() {
+    delete g_slice_pool;
+    g_slice_pool = nullptr;
+    g_slice_pool_released = true;
+  }
+  bool armed = false;
+};
+thread_local SlicePoolReleaser g_slice_pool_releaser;
+
+SlicePool* GetSlicePool() {
+  if (PERFETTO_UNLIKELY(!g_slice_pool)) {
+    if (g_slice_pool_released)
+      return nullptr;
+    g_slice_pool = new SlicePool();
+    g_slice_pool_releaser.armed = true;  // Registers the exit destructor.
+  }
+  return g_slice_pool;
+}
+
+}  // namespace
+
 ScatteredHeapBuffer::Slice::Slice()
     : buffer_(nullptr), size_(0u), unused_bytes_(0u) {}
 
-ScatteredHeapBuffer::Slice::Slice(size_t size)
-    : buffer_(std::unique_ptr<uint8_t[]>(new uint8_t[size])),
-      size_(size),
-      unused_bytes_(size) {
+ScatteredHeapBuffer::Slice::Slice(size_t size) : size_(size) {
   PERFETTO_DCHECK(size);
+  SlicePool* pool = GetSlicePool();
+  buffer_ = pool ? pool->Allocate(size)
+                 : std::unique_ptr<uint8_t[]>(new uint8_t[size]);
   Clear();
 }
 
 ScatteredHeapBuffer::Slice::Slice(Slice&& slice) noexcept = default;
 
-ScatteredHeapBuffer::Slice::~Slice() = default;
+ScatteredHeapBuffer::Slice::~Slice() {
+  ReleaseBuffer();
+}
+
+ScatteredHeapBuffer::Slice& ScatteredHeapBuffer::Slice::operator=(
+    Slice&& other) {
+  if (this != &other) {
+    ReleaseBuffer();
+    buffer_ = std::move(other.buffer_);
+    size_ = other.size_;
+    unused_bytes_ = other.unused_bytes_;
+  }
+  return *this;
+}
 
-ScatteredHeapBuffer::Slice& ScatteredHeapBuffer::Slice::operator=(Slice&&) =
-    default;
+void ScatteredHeapBuffer::Slice::ReleaseBuffer() {
+  if (!buffer_)
+    return;
+  SlicePool* pool = GetSlicePool();
+  if (pool)
+    pool->Release(std::move(buffer_), size_);
+  buffer_.reset();
+}
 
 void ScatteredHeapBuffer::Slice::Clear() {
   unused_bytes_ = size_;
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "perfetto/protozero/message.h"
+#include "test/gtest_and_gmock.h"
+
+namespace protozero {
+namespace {
+
+TEST(ScatteredHeapBufferTest, RecyclesSliceBuffers) {
+  const uint8_t* first_buf;
+  {
+    HeapBuffered<Message> msg(4096, 4096);
+    msg->AppendString(1, "foo");
+    first_buf = msg.GetSlices()[0].start();
+  }
+
+  // The buffer of the destroyed message is reused by the next one of the same
+  // size on the same thread, and no stale data leaks into the output.
+  HeapBuffered<Message> msg(4096, 4096);
+  msg->AppendVarInt(2, 42);
+  EXPECT_EQ(msg.GetSlices()[0].start(), first_buf);
+  HeapBuffered<Message> expected(128, 128);
+  expected->AppendVarInt(2, 42);
+  EXPECT_EQ(msg.SerializeAsArray(), expected.SerializeAsArray());
+}
+
+TEST(ScatteredHeapBufferTest, ManySlicesAndThreads) {
+  auto serialize_many = [] {
+    for (uint32_t i = 0; i < 100; ++i) {
+      // Small slices that grow up to a non power-of-two size, which is not
+      // pooled.
+      HeapBuffered<Message> msg(128, 3000);
+      std::string str(i * 100, static_cast<char>('a' + i % 26));
+      msg->AppendString(1, str);
+      msg->AppendVarInt(2, i);
+      std::vector<uint8_t> data = msg.SerializeAsArray();
+
+      HeapBuffered<Message> expected(1024 * 1024, 1024 * 1024);
+      expected->AppendString(1, str);
+      expected->AppendVarInt(2, i);
+      ASSERT_EQ(data, expected.SerializeAsArray());
+    }
+  };
+  std::thread t1(serialize_many);
+  std::thread t2(serialize_many);
+  serialize_many();
+  t1.join();
+  t2.join();
+}
+
+}  // namespace
+}  // namespace protozero
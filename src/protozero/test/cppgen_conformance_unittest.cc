@@ -23,6 +23,7 @@
 #include "test/gtest_and_gmock.h"
 
 // Autogenerated headers in out/*/gen/
+#include "src/protozero/test/example_proto/lazy_messages.gen.h"
 #include "src/protozero/test/example_proto/library.gen.h"
 #include "src/protozero/test/example_proto/other_package/test_messages.gen.h"
 #include "src/protozero/test/example_proto/subpackage/test_messages.gen.h"
@@ -31,6 +32,7 @@
 
 // Generated by the cppgen compiler.
 namespace pbtest = protozero::test::protos::gen;
+namespace pbtest_lazy = protozero::test::protos::lazy::gen;
 namespace pbtest_subpackage = protozero::test::protos::subpackage::gen;
 namespace pbtest_otherpackage = other_package::gen;
 
@@ -397,5 +399,49 @@ TEST(ProtoCppConformanceTest, DifferentPackages) {
   EXPECT_EQ(pbgold_other_package::Message_NestedEnum_D,
             gold_msg.otherpackage_nested_enum());
 }
+
+// LazyNestedA is generated with the lazy_nested_messages option and has the
+// same wire format as NestedA.
+TEST(ProtoCppConformanceTest, LazyNestedMessages) {
+  pbtest::NestedA msg_a;
+  msg_a.add_repeated_a()->mutable_value_b()->set_value_c(321);
+  msg_a.add_repeated_a();
+  msg_a.mutable_super_nested()->set_value_c(1000);
+  std::string serialized = msg_a.SerializeAsString();
+
+  pbtest_lazy::LazyNestedA lazy;
+  ASSERT_TRUE(lazy.ParseFromString(serialized));
+  pbtest_lazy::LazyNestedA lazy_copy = lazy;
+
+  // Fields that are never accessed are re-serialized as-is.
+  EXPECT_EQ(serialized, lazy.SerializeAsString());
+
+  EXPECT_TRUE(lazy.has_super_nested());
+  EXPECT_EQ(1000, lazy.super_nested().value_c());
+  ASSERT_EQ(2, lazy.repeated_a_size());
+  EXPECT_EQ(321, lazy.repeated_a()[0].value_b().value_c());
+  EXPECT_FALSE(lazy.repeated_a()[1].has_value_b());
+  EXPECT_EQ(lazy_copy, lazy);
+
+  lazy.mutable_super_nested()->set_value_c(2000);
+  lazy.add_repeated_a()->mutable_value_b()->set_value_c(42);
+  EXPECT_NE(lazy_copy, lazy);
+
+  pbgold::NestedA gold_msg_a;
+  ASSERT_TRUE(gold_msg_a.ParseFromString(lazy.SerializeAsString()));
+  ASSERT_EQ(3, gold_msg_a.repeated_a_size());
+  EXPECT_EQ(321, gold_msg_a.repeated_a(0).value_b().value_c());
+  EXPECT_FALSE(gold_msg_a.repeated_a(1).has_value_b());
+  EXPECT_EQ(42, gold_msg_a.repeated_a(2).value_b().value_c());
+  EXPECT_EQ(2000, gold_msg_a.super_nested().value_c());
+
+  // Parsing again replaces the repeated fields, as in the non-lazy classes.
+  ASSERT_TRUE(lazy.ParseFromString(serialized));
+  EXPECT_EQ(2, lazy.repeated_a_size());
+
+  pbtest_lazy::LazyNestedA moved = std::move(lazy_copy);
+  EXPECT_EQ(1000, moved.super_nested().value_c());
+  EXPECT_EQ(2, moved.repeated_a_size());
+}
 }  // namespace
 }  // namespace protozero
@@ -19,6 +19,7 @@
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/protozero/proto_ring_buffer.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/base/test/utils.h"
 
 static void BM_ProtoRingBufferReadLargeChunks(benchmark::State& state) {
@@ -73,3 +74,67 @@ static void BM_ProtoRingBufferRead(benchmark::State& state) {
 }
 
 BENCHMARK(BM_ProtoRingBufferRead);
+
+// A single large message received in small chunks, as it happens when loading
+// a trace through the TP RPC interface.
+static void BM_ProtoRingBufferReadLargeMessage(benchmark::State& state) {
+  const size_t kMsgSize = static_cast<size_t>(state.range(0)) * 1024 * 1024;
+  constexpr size_t kChunkSize = 64 * 1024;
+  std::string data(kMsgSize + 16, 'x');
+  uint8_t* wptr = reinterpret_cast<uint8_t*>(&data[0]);
+  wptr = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(1), wptr);
+  wptr = protozero::proto_utils::WriteVarInt(kMsgSize, wptr);
+  data.resize(static_cast<size_t>(wptr - reinterpret_cast<uint8_t*>(&data[0])) +
+              kMsgSize);
+
+  for (auto _ : state) {
+    protozero::ProtoRingBuffer buffer;
+    size_t total_packet_size = 0;
+    for (size_t off = 0; off < data.size(); off += kChunkSize) {
+      buffer.Append(data.data() + off, std::min(kChunkSize, data.size() - off));
+      for (auto msg = buffer.ReadMessage(); msg.valid();
+           msg = buffer.ReadMessage()) {
+        total_packet_size += msg.len;
+      }
+    }
+    benchmark::DoNotOptimize(total_packet_size);
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * data.size()));
+}
+
+BENCHMARK(BM_ProtoRingBufferReadLargeMessage)->Arg(1)->Arg(16)->Arg(64);
+
+// Many small messages received in large chunks, which mostly hit the fastpath.
+static void BM_ProtoRingBufferReadSmallMessages(benchmark::State& state) {
+  constexpr size_t kChunkSize = 1024 * 1024;
+  std::string data;
+  for (uint32_t i = 0; data.size() < kChunkSize * 8; i++) {
+    uint8_t preamble[16];
+    uint8_t* wptr = protozero::proto_utils::WriteVarInt(
+        protozero::proto_utils::MakeTagLengthDelimited(1), preamble);
+    const uint32_t len = 16 + (i * 7919) % 1024;
+    wptr = protozero::proto_utils::WriteVarInt(len, wptr);
+    data.append(reinterpret_cast<char*>(preamble),
+                static_cast<size_t>(wptr - preamble));
+    data.append(len, 'x');
+  }
+
+  for (auto _ : state) {
+    protozero::ProtoRingBuffer buffer;
+    size_t total_packet_size = 0;
+    for (size_t off = 0; off < data.size(); off += kChunkSize) {
+      buffer.Append(data.data() + off, std::min(kChunkSize, data.size() - off));
+      for (auto msg = buffer.ReadMessage(); msg.valid();
+           msg = buffer.ReadMessage()) {
+        total_packet_size += msg.len;
+      }
+    }
+    benchmark::DoNotOptimize(total_packet_size);
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * data.size()));
+}
+
+BENCHMARK(BM_ProtoRingBufferReadSmallMessages);
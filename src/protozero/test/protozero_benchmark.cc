@@ -16,7 +16,9 @@
 
 // See /docs/design-docs/protozero.md for rationale and results.
 
+#include <algorithm>
 #include <memory>
+#include <random>
 #include <vector>
 
 #include <unistd.h>
@@ -24,6 +26,10 @@
 #include <benchmark/benchmark.h>
 
 #include "perfetto/base/compiler.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/protozero/static_buffer.h"
 
 // Autogenerated headers in out/*/gen/
@@ -128,8 +134,131 @@ PERFETTO_ALWAYS_INLINE void Clobber(benchmark::State& state) {
   benchmark::ClobberMemory();
 }
 
+// Returns |count| VarInts which are all |size| bytes long, or of random sizes
+// if |size| is 0.
+std::vector<uint8_t> MakeVarInts(size_t count, uint32_t size) {
+  std::minstd_rand rnd(0);
+  protozero::PackedVarInt varints;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t value_size = size ? size : 1 + rnd() % 10;
+    // The MSB of the value is set so that it takes exactly |value_size| bytes.
+    uint64_t msb = 1ull << std::min(7 * (value_size - 1), 63u);
+    uint64_t value = msb | (static_cast<uint64_t>(rnd()) & (msb - 1));
+    varints.Append(value);
+  }
+  return std::vector<uint8_t>(varints.data(), varints.data() + varints.size());
+}
+
 }  // namespace
 
+static void BM_Protozero_ParseVarInt(benchmark::State& state) {
+  constexpr size_t kCount = 1024;
+  std::vector<uint8_t> varints =
+      MakeVarInts(kCount, static_cast<uint32_t>(state.range(0)));
+  const uint8_t* end = varints.data() + varints.size();
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (const uint8_t* pos = varints.data(); pos < end;) {
+      uint64_t value;
+      pos = protozero::proto_utils::ParseVarInt(pos, end, &value);
+      sum += value;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kCount));
+}
+
+static void BM_Protozero_PackedVarIntIterator(benchmark::State& state) {
+  constexpr size_t kCount = 1024;
+  std::vector<uint8_t> varints =
+      MakeVarInts(kCount, static_cast<uint32_t>(state.range(0)));
+  for (auto _ : state) {
+    bool parse_error = false;
+    uint64_t sum = 0;
+    for (protozero::PackedRepeatedFieldIterator<
+             protozero::proto_utils::ProtoWireType::kVarInt, uint64_t>
+             it(varints.data(), varints.size(), &parse_error);
+         it; ++it) {
+      sum += *it;
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kCount));
+}
+
+// Arg is the number of elements of the packed field.
+static void BM_Protozero_PackedVarInt_Buffered(benchmark::State& state) {
+  std::vector<uint64_t> values(static_cast<size_t>(state.range(0)));
+  std::minstd_rand rnd(0);
+  std::generate(values.begin(), values.end(), [&] { return rnd(); });
+  protozero::HeapBuffered<pbzero::PackedRepeatedFields> msg;
+  for (auto _ : state) {
+    msg.Reset();
+    protozero::PackedVarInt buf;
+    for (uint64_t value : values)
+      buf.Append(value);
+    msg->set_field_uint64(buf);
+    benchmark::DoNotOptimize(msg->Finalize());
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * values.size()));
+}
+
+static void BM_Protozero_PackedVarInt_Writer(benchmark::State& state) {
+  std::vector<uint64_t> values(static_cast<size_t>(state.range(0)));
+  std::minstd_rand rnd(0);
+  std::generate(values.begin(), values.end(), [&] { return rnd(); });
+  protozero::HeapBuffered<pbzero::PackedRepeatedFields> msg;
+  for (auto _ : state) {
+    msg.Reset();
+    auto writer = msg->begin_field_uint64();
+    for (uint64_t value : values)
+      writer.Append(value);
+    benchmark::DoNotOptimize(msg->Finalize());
+  }
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * values.size()));
+}
+
+static void BM_Protozero_Decode_Nested(benchmark::State& state) {
+  protozero::HeapBuffered<pbzero::EveryField> msg;
+  FillMessage_Nested(msg.get());
+  std::vector<uint8_t> serialized = msg.SerializeAsArray();
+  for (auto _ : state) {
+    // Walks down the nested messages, decoding all the fields of each.
+    const uint8_t* begin = serialized.data();
+    size_t size = serialized.size();
+    uint64_t sum = 0;
+    while (size) {
+      protozero::ProtoDecoder decoder(begin, size);
+      size = 0;
+      for (auto field = decoder.ReadField(); field;
+           field = decoder.ReadField()) {
+        sum += field.id() + field.size();
+        if (field.id() == pbzero::EveryField::kFieldNestedFieldNumber) {
+          begin = field.data();
+          size = field.size();
+        }
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+}
+
+static void BM_Protozero_Decode_Typed(benchmark::State& state) {
+  protozero::HeapBuffered<pbzero::CamelCaseFields> msg;
+  msg->set_foo_bar_baz(true);
+  msg->set_moomoo(true);
+  msg->set_bangbig__(true);
+  std::vector<uint8_t> serialized = msg.SerializeAsArray();
+  for (auto _ : state) {
+    pbzero::CamelCaseFields::Decoder decoder(serialized.data(),
+                                             serialized.size());
+    benchmark::DoNotOptimize(decoder.foo_bar_baz() && decoder.moomoo() &&
+                             decoder.bangbig__());
+  }
+}
+
 static void BM_Protozero_Simple_Libprotobuf(benchmark::State& state) {
   while (state.KeepRunning()) {
     {
@@ -198,3 +327,11 @@ BENCHMARK(BM_Protozero_Simple_SpeedOfLight);
 BENCHMARK(BM_Protozero_Nested_Libprotobuf);
 BENCHMARK(BM_Protozero_Nested_Protozero);
 BENCHMARK(BM_Protozero_Nested_SpeedOfLight);
+
+// Arg is the size of the VarInts, 0 for a mix of all sizes.
+BENCHMARK(BM_Protozero_ParseVarInt)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(10);
+BENCHMARK(BM_Protozero_PackedVarIntIterator)->Arg(0)->Arg(1)->Arg(2);
+BENCHMARK(BM_Protozero_PackedVarInt_Buffered)->Arg(8)->Arg(1024)->Arg(16384);
+BENCHMARK(BM_Protozero_PackedVarInt_Writer)->Arg(8)->Arg(1024)->Arg(16384);
+BENCHMARK(BM_Protozero_Decode_Nested);
+BENCHMARK(BM_Protozero_Decode_Typed);
@@ -307,6 +307,65 @@ TEST(ProtoZeroConformanceTest, PackedRepeatedResize) {
   }
 }
 
+TEST(ProtoZeroConformanceTest, PackedRepeatedWriter) {
+  int values[] = {42, 255, -1};
+  uint32_t fixed_values[] = {1, 2, 4, 8};
+
+  HeapBuffered<pbtest::PackedRepeatedFields> msg{kChunkSize, kChunkSize};
+  auto writer = msg->begin_field_int32();
+  for (auto v : values)
+    writer.Append(v);
+  // Ends the field above.
+  auto fixed_writer = msg->begin_field_fixed32();
+  for (auto v : fixed_values)
+    fixed_writer.Append(v);
+  std::string serialized = msg.SerializeAsString();
+
+  // Encoded identically to the buffered setters.
+  HeapBuffered<pbtest::PackedRepeatedFields> buffered_msg;
+  PackedVarInt buf;
+  for (auto v : values)
+    buf.Append(v);
+  buffered_msg->set_field_int32(buf);
+  PackedFixedSizeInt<uint32_t> fixed_buf;
+  for (auto v : fixed_values)
+    fixed_buf.Append(v);
+  buffered_msg->set_field_fixed32(fixed_buf);
+  EXPECT_EQ(buffered_msg.SerializeAsString(), serialized);
+
+  // Correctly parsed by the protobuf library.
+  pbgold::PackedRepeatedFields parsed_gold_msg;
+  parsed_gold_msg.ParseFromString(serialized);
+  ASSERT_THAT(parsed_gold_msg.field_int32(), testing::ElementsAreArray(values));
+  ASSERT_THAT(parsed_gold_msg.field_fixed32(),
+              testing::ElementsAreArray(fixed_values));
+}
+
+// Tests that elements straddling chunk boundaries are not lost and that
+// payloads that don't fit in one byte of length are encoded correctly.
+TEST(ProtoZeroConformanceTest, PackedRepeatedWriterMultipleChunks) {
+  const int kNumValues = 32768;
+  const int64_t kMultiplier = 10000000;
+  HeapBuffered<pbtest::PackedRepeatedFields> msg{kChunkSize, kChunkSize};
+  auto writer = msg->begin_field_int64();
+  for (int i = 0; i < kNumValues; i++)
+    writer.Append(i * kMultiplier);
+  auto fixed_writer = msg->begin_field_sfixed64();
+  for (int i = 0; i < kNumValues; i++)
+    fixed_writer.Append(-i * kMultiplier);
+  std::string serialized = msg.SerializeAsString();
+
+  // Correctly parsed by the protobuf library.
+  pbgold::PackedRepeatedFields parsed_gold_msg;
+  parsed_gold_msg.ParseFromString(serialized);
+  ASSERT_EQ(parsed_gold_msg.field_int64().size(), kNumValues);
+  ASSERT_EQ(parsed_gold_msg.field_sfixed64().size(), kNumValues);
+  for (int i = 0; i < kNumValues; i++) {
+    ASSERT_EQ(parsed_gold_msg.field_int64(i), i * kMultiplier);
+    ASSERT_EQ(parsed_gold_msg.field_sfixed64(i), -i * kMultiplier);
+  }
+}
+
 TEST(ProtoZeroConformanceTest, EnumToString) {
   EXPECT_STREQ(protozero::test::protos::pbzero::SmallEnum_Name(
                    protozero::test::protos::pbzero::SmallEnum::TO_BE),
@@ -0,0 +1,435 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Encode and decode benchmarks on the real message shapes found in the traces
+// under test/data (as opposed to protozero_benchmark.cc, which uses synthetic
+// messages). Each benchmark works on the subset of TracePacket(s) of one
+// trace which carry a given payload:
+// - TrackEvent + InternedData (Chrome trace).
+// - FtraceEventBundle with CompactSched.
+// - ProcessTree.
+// - ProfilePacket (heapprofd).
+// The Decode benchmarks walk the packets with the generated pbzero decoders,
+// reading the fields that the trace processor tokenizer/parsers read.
+// The Encode benchmarks re-serialize the same packets field-by-field through
+// protozero::Message, replaying a flattened list of writes which is computed
+// once outside of the timed loop.
+
+#include <benchmark/benchmark.h>
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/base/test/utils.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_packet.pbzero.h"
+#include "protos/perfetto/trace/ps/process_tree.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace {
+
+using protozero::ConstBytes;
+using protozero::proto_utils::ProtoWireType;
+
+namespace pbzero = perfetto::protos::pbzero;
+
+constexpr char kTrackEventTrace[] =
+    "test/data/chrome_scroll_without_vsync.pftrace";
+constexpr char kCompactSchedTrace[] = "test/data/compact_sched.pb";
+constexpr char kProcessTreeTrace[] = "test/data/example_android_trace_30s.pb";
+constexpr char kProfileTrace[] =
+    "test/data/heapprofd_standalone_client_example-trace";
+
+// Nested messages deeper than this are treated as opaque bytes by the
+// encoder replay. Real traces never get anywhere close.
+constexpr uint32_t kMaxNestingDepth = 32;
+
+struct Corpus {
+  std::string trace;
+  std::vector<ConstBytes> packets;
+  size_t total_size = 0;
+};
+
+// Loads |trace_path| and keeps the packets which have any of the
+// |packet_field_ids| set. Returns false, and marks the benchmark as skipped,
+// if the trace is not available (e.g. test/data has not been downloaded).
+bool LoadCorpus(benchmark::State& state,
+                const char* trace_path,
+                std::initializer_list<uint32_t> packet_field_ids,
+                Corpus* corpus) {
+  if (!perfetto::base::ReadFile(perfetto::base::GetTestDataPath(trace_path),
+                                &corpus->trace)) {
+    state.SkipWithError("Test trace not found, run install-build-deps");
+    return false;
+  }
+  pbzero::Trace::Decoder trace(corpus->trace);
+  for (auto it = trace.packet(); it; ++it) {
+    protozero::ProtoDecoder packet(*it);
+    for (uint32_t field_id : packet_field_ids) {
+      if (packet.FindField(field_id).valid()) {
+        corpus->packets.push_back(*it);
+        corpus->total_size += it->size();
+        break;
+      }
+    }
+  }
+  if (corpus->packets.empty()) {
+    state.SkipWithError("No matching packets in the test trace");
+    return false;
+  }
+  return true;
+}
+
+// -----------------------------------------------------------------------------
+// Decoding.
+// -----------------------------------------------------------------------------
+
+// All the Decode*() functions return a checksum of the fields read, to
+// prevent the compiler from eliding the decoding.
+
+uint64_t DecodeTrackEventPacket(ConstBytes bytes) {
+  pbzero::TracePacket::Decoder packet(bytes);
+  uint64_t sum = packet.timestamp() + packet.sequence_flags();
+  if (packet.has_interned_data()) {
+    pbzero::InternedData::Decoder interned(packet.interned_data());
+    for (auto it = interned.event_names(); it; ++it) {
+      pbzero::EventName::Decoder name(*it);
+      sum += name.iid() + name.name().size;
+    }
+    for (auto it = interned.event_categories(); it; ++it) {
+      pbzero::EventCategory::Decoder cat(*it);
+      sum += cat.iid() + cat.name().size;
+    }
+    for (auto it = interned.debug_annotation_names(); it; ++it) {
+      pbzero::DebugAnnotationName::Decoder name(*it);
+      sum += name.iid() + name.name().size;
+    }
+  }
+  if (packet.has_track_event()) {
+    pbzero::TrackEvent::Decoder event(packet.track_event());
+    sum += static_cast<uint64_t>(event.type()) + event.track_uuid() +
+           event.name_iid() + event.name().size;
+    for (auto it = event.category_iids(); it; ++it)
+      sum += *it;
+    for (auto it = event.flow_ids(); it; ++it)
+      sum += *it;
+    for (auto it = event.debug_annotations(); it; ++it) {
+      pbzero::DebugAnnotation::Decoder annotation(*it);
+      sum += annotation.name_iid() + annotation.uint_value() +
+             static_cast<uint64_t>(annotation.int_value()) +
+             annotation.string_value().size;
+    }
+  }
+  return sum;
+}
+
+uint64_t DecodeCompactSchedPacket(ConstBytes bytes) {
+  pbzero::TracePacket::Decoder packet(bytes);
+  pbzero::FtraceEventBundle::Decoder bundle(packet.ftrace_events());
+  uint64_t sum = bundle.cpu();
+  for (auto it = bundle.event(); it; ++it) {
+    pbzero::FtraceEvent::Decoder event(*it);
+    sum += event.timestamp() + event.pid();
+    if (event.has_sched_switch()) {
+      pbzero::SchedSwitchFtraceEvent::Decoder sw(event.sched_switch());
+      sum += static_cast<uint64_t>(sw.next_pid()) + sw.next_comm().size;
+    }
+  }
+  if (!bundle.has_compact_sched())
+    return sum;
+
+  pbzero::FtraceEventBundle::CompactSched::Decoder sched(
+      bundle.compact_sched());
+  bool parse_error = false;
+  for (auto it = sched.intern_table(); it; ++it)
+    sum += it->size();
+  for (auto it = sched.switch_timestamp(&parse_error); it; ++it)
+    sum += *it;
+  for (auto it = sched.switch_prev_state(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.switch_next_pid(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.switch_next_prio(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.switch_next_comm_index(&parse_error); it; ++it)
+    sum += *it;
+  for (auto it = sched.waking_timestamp(&parse_error); it; ++it)
+    sum += *it;
+  for (auto it = sched.waking_pid(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.waking_target_cpu(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.waking_prio(&parse_error); it; ++it)
+    sum += static_cast<uint64_t>(*it);
+  for (auto it = sched.waking_comm_index(&parse_error); it; ++it)
+    sum += *it;
+  for (auto it = sched.waking_common_flags(&parse_error); it; ++it)
+    sum += *it;
+  return sum + parse_error;
+}
+
+uint64_t DecodeProcessTreePacket(ConstBytes bytes) {
+  pbzero::TracePacket::Decoder packet(bytes);
+  pbzero::ProcessTree::Decoder tree(packet.process_tree());
+  uint64_t sum = packet.timestamp();
+  for (auto it = tree.processes(); it; ++it) {
+    pbzero::ProcessTree::Process::Decoder proc(*it);
+    sum += static_cast<uint64_t>(proc.pid() + proc.ppid() + proc.uid());
+    for (auto cmd = proc.cmdline(); cmd; ++cmd)
+      sum += cmd->size();
+  }
+  for (auto it = tree.threads(); it; ++it) {
+    pbzero::ProcessTree::Thread::Decoder thread(*it);
+    sum += static_cast<uint64_t>(thread.tid() + thread.tgid()) +
+           thread.name().size;
+  }
+  return sum;
+}
+
+uint64_t DecodeProfilePacket(ConstBytes bytes) {
+  pbzero::TracePacket::Decoder packet(bytes);
+  pbzero::ProfilePacket::Decoder profile(packet.profile_packet());
+  uint64_t sum = profile.index();
+  for (auto it = profile.strings(); it; ++it) {
+    pbzero::InternedString::Decoder str(*it);
+    sum += str.iid() + str.str().size;
+  }
+  for (auto it = profile.mappings(); it; ++it) {
+    pbzero::Mapping::Decoder mapping(*it);
+    sum += mapping.iid() + mapping.build_id() + mapping.start() +
+           mapping.end() + mapping.load_bias();
+    for (auto id = mapping.path_string_ids(); id; ++id)
+      sum += *id;
+  }
+  for (auto it = profile.frames(); it; ++it) {
+    pbzero::Frame::Decoder frame(*it);
+    sum += frame.iid() + frame.function_name_id() + frame.mapping_id() +
+           frame.rel_pc();
+  }
+  for (auto it = profile.callstacks(); it; ++it) {
+    pbzero::Callstack::Decoder callstack(*it);
+    sum += callstack.iid();
+    for (auto id = callstack.frame_ids(); id; ++id)
+      sum += *id;
+  }
+  for (auto it = profile.process_dumps(); it; ++it) {
+    pbzero::ProfilePacket::ProcessHeapSamples::Decoder dump(*it);
+    sum += dump.pid() + dump.timestamp();
+    for (auto s = dump.samples(); s; ++s) {
+      pbzero::ProfilePacket::HeapSample::Decoder sample(*s);
+      sum += sample.callstack_id() + sample.self_allocated() +
+             sample.self_freed() + sample.alloc_count() + sample.free_count();
+    }
+  }
+  return sum;
+}
+
+void BM_ProtozeroCorpus_Decode(benchmark::State& state,
+                               uint64_t (*decode_fn)(ConstBytes),
+                               const char* trace_path,
+                               std::initializer_list<uint32_t> field_ids) {
+  Corpus corpus;
+  if (!LoadCorpus(state, trace_path, field_ids, &corpus))
+    return;
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (const ConstBytes& packet : corpus.packets)
+      sum += decode_fn(packet);
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * corpus.total_size));
+  state.counters["packets"] = static_cast<double>(corpus.packets.size());
+}
+
+// -----------------------------------------------------------------------------
+// Encoding.
+// -----------------------------------------------------------------------------
+
+// A single protozero::Message call. The writes of a packet are recorded once
+// from the corpus and replayed in the benchmark loop, so that the timed part
+// is only the serialization and has the exact field layout of real packets.
+struct EncodeOp {
+  enum Type : uint8_t {
+    kVarInt,
+    kFixed32,
+    kFixed64,
+    kBytes,
+    kBeginNested,
+    kEndNested,
+  };
+  Type type;
+  uint32_t field_id;
+  uint64_t int_value;
+  ConstBytes bytes;
+};
+
+// Returns true if |bytes| parses as a well formed proto message. The schema
+// is not known here, so this is how length-delimited fields are split into
+// nested messages and strings/bytes/packed fields. A few short strings are
+// misclassified as messages, which doesn't matter for benchmarking purposes.
+bool LooksLikeMessage(ConstBytes bytes) {
+  if (bytes.size == 0)
+    return false;
+  protozero::ProtoDecoder decoder(bytes);
+  for (auto f = decoder.ReadField(); f.valid(); f = decoder.ReadField()) {
+  }
+  return decoder.bytes_left() == 0;
+}
+
+void RecordOps(ConstBytes bytes, uint32_t depth, std::vector<EncodeOp>* ops) {
+  protozero::ProtoDecoder decoder(bytes);
+  for (auto f = decoder.ReadField(); f.valid(); f = decoder.ReadField()) {
+    switch (f.type()) {
+      case ProtoWireType::kVarInt:
+        ops->push_back({EncodeOp::kVarInt, f.id(), f.as_uint64(), {}});
+        break;
+      case ProtoWireType::kFixed32:
+        ops->push_back({EncodeOp::kFixed32, f.id(), f.as_uint32(), {}});
+        break;
+      case ProtoWireType::kFixed64:
+        ops->push_back({EncodeOp::kFixed64, f.id(), f.as_uint64(), {}});
+        break;
+      case ProtoWireType::kLengthDelimited:
+        if (depth < kMaxNestingDepth && LooksLikeMessage(f.as_bytes())) {
+          ops->push_back({EncodeOp::kBeginNested, f.id(), 0, {}});
+          RecordOps(f.as_bytes(), depth + 1, ops);
+          ops->push_back({EncodeOp::kEndNested, 0, 0, {}});
+        } else {
+          ops->push_back({EncodeOp::kBytes, f.id(), 0, f.as_bytes()});
+        }
+        break;
+    }
+  }
+}
+
+// Replays the ops of one packet, starting at |*pos|, into |msg|. Returns when
+// reaching the kEndNested matching the current message or the end of |ops|.
+void ReplayOps(const std::vector<EncodeOp>& ops,
+               size_t* pos,
+               protozero::Message* msg) {
+  while (*pos < ops.size()) {
+    const EncodeOp& op = ops[(*pos)++];
+    switch (op.type) {
+      case EncodeOp::kVarInt:
+        msg->AppendVarInt(op.field_id, op.int_value);
+        break;
+      case EncodeOp::kFixed32:
+        msg->AppendFixed(op.field_id, static_cast<uint32_t>(op.int_value));
+        break;
+      case EncodeOp::kFixed64:
+        msg->AppendFixed(op.field_id, op.int_value);
+        break;
+      case EncodeOp::kBytes:
+        msg->AppendBytes(op.field_id, op.bytes.data, op.bytes.size);
+        break;
+      case EncodeOp::kBeginNested:
+        ReplayOps(ops, pos,
+                  msg->BeginNestedMessage<protozero::Message>(op.field_id));
+        break;
+      case EncodeOp::kEndNested:
+        return;
+    }
+  }
+}
+
+void BM_ProtozeroCorpus_Encode(benchmark::State& state,
+                               const char* trace_path,
+                               std::initializer_list<uint32_t> field_ids) {
+  Corpus corpus;
+  if (!LoadCorpus(state, trace_path, field_ids, &corpus))
+    return;
+
+  // One op list per packet, to be able to Reset() the buffer in between as
+  // the tracing service would do with the chunks.
+  std::vector<std::vector<EncodeOp>> packets_ops(corpus.packets.size());
+  for (size_t i = 0; i < corpus.packets.size(); ++i)
+    RecordOps(corpus.packets[i], 0, &packets_ops[i]);
+
+  protozero::HeapBuffered<protozero::Message> msg(4096, 4096);
+  size_t encoded_size = 0;
+  for (auto _ : state) {
+    encoded_size = 0;
+    for (const auto& ops : packets_ops) {
+      msg.Reset();
+      size_t pos = 0;
+      ReplayOps(ops, &pos, msg.get());
+      encoded_size += msg->Finalize();
+    }
+    benchmark::DoNotOptimize(encoded_size);
+    benchmark::ClobberMemory();
+  }
+  state.SetBytesProcessed(
+      static_cast<int64_t>(state.iterations() * corpus.total_size));
+  state.counters["packets"] = static_cast<double>(corpus.packets.size());
+}
+
+}  // namespace
+
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Decode,
+                  TrackEvent,
+                  DecodeTrackEventPacket,
+                  kTrackEventTrace,
+                  {pbzero::TracePacket::kTrackEventFieldNumber,
+                   pbzero::TracePacket::kInternedDataFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Decode,
+                  CompactSched,
+                  DecodeCompactSchedPacket,
+                  kCompactSchedTrace,
+                  {pbzero::TracePacket::kFtraceEventsFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Decode,
+                  ProcessTree,
+                  DecodeProcessTreePacket,
+                  kProcessTreeTrace,
+                  {pbzero::TracePacket::kProcessTreeFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Decode,
+                  ProfilePacket,
+                  DecodeProfilePacket,
+                  kProfileTrace,
+                  {pbzero::TracePacket::kProfilePacketFieldNumber});
+
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Encode,
+                  TrackEvent,
+                  kTrackEventTrace,
+                  {pbzero::TracePacket::kTrackEventFieldNumber,
+                   pbzero::TracePacket::kInternedDataFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Encode,
+                  CompactSched,
+                  kCompactSchedTrace,
+                  {pbzero::TracePacket::kFtraceEventsFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Encode,
+                  ProcessTree,
+                  kProcessTreeTrace,
+                  {pbzero::TracePacket::kProcessTreeFieldNumber});
+BENCHMARK_CAPTURE(BM_ProtozeroCorpus_Encode,
+                  ProfilePacket,
+                  kProfileTrace,
+                  {pbzero::TracePacket::kProfilePacketFieldNumber});
@@ -185,6 +185,21 @@ void BM_Shlib_TeDebugAnnotations(benchmark::State& state) {
   }
 }
 
+void BM_Shlib_TeMultipleDebugAnnotations(benchmark::State& state) {
+  EnsureInitialized();
+  TracingSession tracing_session =
+      TracingSession::Builder().set_data_source_name("track_event").Build();
+
+  while (state.KeepRunning()) {
+    PERFETTO_TE(benchmark_cat, PERFETTO_TE_SLICE_BEGIN("Event"),
+                PERFETTO_TE_ARG_UINT64("value", 42),
+                PERFETTO_TE_ARG_INT64("delta", -1),
+                PERFETTO_TE_ARG_BOOL("valid", true),
+                PERFETTO_TE_ARG_STRING("state", "running"));
+    benchmark::ClobberMemory();
+  }
+}
+
 void BM_Shlib_TeLlBasic(benchmark::State& state) {
   EnsureInitialized();
   TracingSession tracing_session =
@@ -357,6 +372,7 @@ BENCHMARK(BM_Shlib_TeDisabled);
 BENCHMARK(BM_Shlib_TeBasic);
 BENCHMARK(BM_Shlib_TeBasicNoIntern);
 BENCHMARK(BM_Shlib_TeDebugAnnotations);
+BENCHMARK(BM_Shlib_TeMultipleDebugAnnotations);
 BENCHMARK(BM_Shlib_TeLlBasic);
 BENCHMARK(BM_Shlib_TeLlBasicNoIntern);
 BENCHMARK(BM_Shlib_TeLlDebugAnnotations);
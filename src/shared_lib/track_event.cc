@@ -19,6 +19,7 @@
 #include "perfetto/public/abi/track_event_ll_abi.h"
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <limits>
 #include <mutex>
@@ -200,16 +201,7 @@ namespace perfetto {
 namespace shlib {
 
 struct TrackEventIncrementalState {
-  // A heap-allocated message for storing newly seen interned data while we are
-  // in the middle of writing a track event. When a track event wants to write
-  // new interned data into the trace, it is first serialized into this message
-  // and then flushed to the real trace in EventContext when the packet ends.
-  // The message is cached here as a part of incremental state so that we can
-  // reuse the underlying buffer allocation for subsequently written interned
-  // data.
   uint64_t last_timestamp_ns = 0;
-  protozero::HeapBuffered<protos::pbzero::InternedData>
-      serialized_interned_data;
   bool was_cleared = true;
   base::FlatSet<uint64_t> seen_track_uuids;
   // Map from serialized representation of a dynamic category to its enabled
@@ -634,51 +626,176 @@ void ResetIncrementalStateIfRequired(
   }
 }
 
+bool IsDebugArg(const PerfettoTeHlExtra* extra) {
+  return extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_BOOL ||
+         extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_UINT64 ||
+         extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_INT64 ||
+         extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_DOUBLE ||
+         extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_STRING ||
+         extra->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_POINTER;
+}
+
+// Returns the name of a debug argument (IsDebugArg(extra) must be true).
+const char* DebugArgName(const PerfettoTeHlExtra* extra) {
+  switch (extra->type) {
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_BOOL:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgBool*>(
+                 extra)
+          ->name;
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_UINT64:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgUint64*>(
+                 extra)
+          ->name;
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_INT64:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgInt64*>(
+                 extra)
+          ->name;
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_DOUBLE:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgDouble*>(
+                 extra)
+          ->name;
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_STRING:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgString*>(
+                 extra)
+          ->name;
+    case PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_POINTER:
+      return reinterpret_cast<const struct PerfettoTeHlExtraDebugArgPointer*>(
+                 extra)
+          ->name;
+  }
+  return nullptr;
+}
+
+// Interns the strings of a track event. Strings seen for the first time on the
+// sequence are written straight into the interned data of the trace packet,
+// which must not have any other nested message open: the interning must be done
+// before the track event is started.
+class EventInterner {
+ public:
+  EventInterner(perfetto::shlib::TrackEventIncrementalState* incr,
+                perfetto::protos::pbzero::TracePacket* packet)
+      : incr_(incr), packet_(packet) {}
+
+  uint64_t InternCategory(const PerfettoTeCategoryImpl* cat) {
+    uint64_t iid = cat->cat_iid;
+    auto res = incr_->iids.FindOrAssign(
+        perfetto::protos::pbzero::InternedData::kEventCategoriesFieldNumber,
+        &iid, sizeof(iid));
+    if (res.newly_assigned) {
+      auto* ser = interned_data()->add_event_categories();
+      ser->set_iid(iid);
+      ser->set_name(cat->desc->name);
+    }
+    return iid;
+  }
+
+  uint64_t InternEventName(const char* name) {
+    size_t len = strlen(name);
+    auto res = incr_->iids.FindOrAssign(
+        perfetto::protos::pbzero::InternedData::kEventNamesFieldNumber, name,
+        len);
+    if (res.newly_assigned) {
+      auto* ser = interned_data()->add_event_names();
+      ser->set_iid(res.iid);
+      ser->set_name(name, len);
+    }
+    return res.iid;
+  }
+
+  uint64_t InternDebugArgName(const char* name) {
+    size_t len = strlen(name);
+    auto res = incr_->iids.FindOrAssign(
+        perfetto::protos::pbzero::InternedData::
+            kDebugAnnotationNamesFieldNumber,
+        name, len);
+    if (res.newly_assigned) {
+      auto* ser = interned_data()->add_debug_annotation_names();
+      ser->set_iid(res.iid);
+      ser->set_name(name, len);
+    }
+    return res.iid;
+  }
+
+ private:
+  perfetto::protos::pbzero::InternedData* interned_data() {
+    if (!interned_data_)
+      interned_data_ = packet_->set_interned_data();
+    return interned_data_;
+  }
+
+  perfetto::shlib::TrackEventIncrementalState* const incr_;
+  perfetto::protos::pbzero::TracePacket* const packet_;
+  perfetto::protos::pbzero::InternedData* interned_data_ = nullptr;
+};
+
+// The interned ids of the strings of a track event.
+struct EventIids {
+  // The ids of the names of the first kMaxArgs debug arguments are kept here.
+  // The ids of the names of the other arguments are looked up again when the
+  // arguments are written.
+  static constexpr size_t kMaxArgs = 8;
+
+  uint64_t category = 0;
+  uint64_t name = 0;
+  std::array<uint64_t, kMaxArgs> arg_names{};
+};
+
+// Interns all the strings of a track event. This must be done before starting
+// the track event message, so that the new interned data can be written
+// directly in the packet, without staging it in a heap buffer.
+void InternTrackEventStrings(EventInterner* interner,
+                             EventIids* iids,
+                             PerfettoTeCategoryImpl* cat,
+                             perfetto::protos::pbzero::TrackEvent::Type type,
+                             const char* name,
+                             const PerfettoTeHlExtra* extra_data,
+                             const PerfettoTeCategoryDescriptor* dynamic_cat,
+                             bool use_interning) {
+  if (!dynamic_cat &&
+      type != perfetto::protos::pbzero::TrackEvent::TYPE_SLICE_END &&
+      type != perfetto::protos::pbzero::TrackEvent::TYPE_COUNTER) {
+    iids->category = interner->InternCategory(cat);
+  }
+
+  if (type != perfetto::protos::pbzero::TrackEvent::TYPE_SLICE_END && name &&
+      use_interning) {
+    iids->name = interner->InternEventName(name);
+  }
+
+  size_t arg_index = 0;
+  for (const auto* it = extra_data; it; it = it->next) {
+    if (!IsDebugArg(it))
+      continue;
+    const char* arg_name = DebugArgName(it);
+    if (!arg_name)
+      continue;
+    uint64_t iid = interner->InternDebugArgName(arg_name);
+    if (arg_index < EventIids::kMaxArgs)
+      iids->arg_names[arg_index++] = iid;
+  }
+}
+
 void WriteTrackEvent(perfetto::shlib::TrackEventIncrementalState* incr,
                      perfetto::protos::pbzero::TrackEvent* event,
-                     PerfettoTeCategoryImpl* cat,
+                     const EventIids& iids,
                      perfetto::protos::pbzero::TrackEvent::Type type,
                      const char* name,
                      const PerfettoTeHlExtra* extra_data,
                      std::optional<uint64_t> track_uuid,
-                     const PerfettoTeCategoryDescriptor* dynamic_cat,
-                     bool use_interning) {
+                     const PerfettoTeCategoryDescriptor* dynamic_cat) {
   if (type != perfetto::protos::pbzero::TrackEvent::TYPE_UNSPECIFIED) {
     event->set_type(type);
   }
 
-  if (!dynamic_cat &&
-      type != perfetto::protos::pbzero::TrackEvent::TYPE_SLICE_END &&
-      type != perfetto::protos::pbzero::TrackEvent::TYPE_COUNTER) {
-    uint64_t iid = cat->cat_iid;
-    auto res = incr->iids.FindOrAssign(
-        perfetto::protos::pbzero::InternedData::kEventCategoriesFieldNumber,
-        &iid, sizeof(iid));
-    if (res.newly_assigned) {
-      auto* ser = incr->serialized_interned_data->add_event_categories();
-      ser->set_iid(iid);
-      ser->set_name(cat->desc->name);
-    }
-    event->add_category_iids(iid);
+  if (iids.category) {
+    event->add_category_iids(iids.category);
   }
 
   if (type != perfetto::protos::pbzero::TrackEvent::TYPE_SLICE_END) {
-    if (name) {
-      if (use_interning) {
-        const void* str = name;
-        size_t len = strlen(name);
-        auto res = incr->iids.FindOrAssign(
-            perfetto::protos::pbzero::InternedData::kEventNamesFieldNumber, str,
-            len);
-        if (res.newly_assigned) {
-          auto* ser = incr->serialized_interned_data->add_event_names();
-          ser->set_iid(res.iid);
-          ser->set_name(name);
-        }
-        event->set_name_iid(res.iid);
-      } else {
-        event->set_name(name);
-      }
+    if (iids.name) {
+      event->set_name_iid(iids.name);
+    } else if (name) {
+      event->set_name(name);
     }
   }
 
@@ -705,63 +822,51 @@ void WriteTrackEvent(perfetto::shlib::TrackEventIncrementalState* incr,
     }
   }
 
+  size_t arg_index = 0;
   for (const auto* it = extra_data; it; it = it->next) {
-    if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_BOOL ||
-        it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_UINT64 ||
-        it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_INT64 ||
-        it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_DOUBLE ||
-        it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_STRING ||
-        it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_POINTER) {
-      auto* dbg = event->add_debug_annotations();
-      const char* arg_name = nullptr;
-      if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_BOOL) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgBool*>(it);
-        dbg->set_bool_value(arg->value);
-        arg_name = arg->name;
-      } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_UINT64) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgUint64*>(it);
-        dbg->set_uint_value(arg->value);
-        arg_name = arg->name;
-      } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_INT64) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgInt64*>(it);
-        dbg->set_int_value(arg->value);
-        arg_name = arg->name;
-      } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_DOUBLE) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgDouble*>(it);
-        dbg->set_double_value(arg->value);
-        arg_name = arg->name;
-      } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_STRING) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgString*>(it);
-        dbg->set_string_value(arg->value);
-        arg_name = arg->name;
-      } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_POINTER) {
-        auto* arg =
-            reinterpret_cast<const struct PerfettoTeHlExtraDebugArgPointer*>(
-                it);
-        dbg->set_pointer_value(arg->value);
-        arg_name = arg->name;
-      }
+    if (!IsDebugArg(it))
+      continue;
+    auto* dbg = event->add_debug_annotations();
+    if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_BOOL) {
+      dbg->set_bool_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgBool*>(it)
+              ->value);
+    } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_UINT64) {
+      dbg->set_uint_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgUint64*>(it)
+              ->value);
+    } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_INT64) {
+      dbg->set_int_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgInt64*>(it)
+              ->value);
+    } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_DOUBLE) {
+      dbg->set_double_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgDouble*>(it)
+              ->value);
+    } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_STRING) {
+      dbg->set_string_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgString*>(it)
+              ->value);
+    } else if (it->type == PERFETTO_TE_HL_EXTRA_TYPE_DEBUG_ARG_POINTER) {
+      dbg->set_pointer_value(
+          reinterpret_cast<const struct PerfettoTeHlExtraDebugArgPointer*>(it)
+              ->value);
+    }
 
-      if (arg_name != nullptr) {
-        const void* str = arg_name;
-        size_t len = strlen(arg_name);
-        auto res =
-            incr->iids.FindOrAssign(perfetto::protos::pbzero::InternedData::
-                                        kDebugAnnotationNamesFieldNumber,
-                                    str, len);
-        if (res.newly_assigned) {
-          auto* ser =
-              incr->serialized_interned_data->add_debug_annotation_names();
-          ser->set_iid(res.iid);
-          ser->set_name(arg_name);
-        }
-        dbg->set_name_iid(res.iid);
+    const char* arg_name = DebugArgName(it);
+    if (arg_name != nullptr) {
+      uint64_t iid;
+      if (arg_index < EventIids::kMaxArgs) {
+        iid = iids.arg_names[arg_index++];
+      } else {
+        // Already interned by InternTrackEventStrings().
+        iid = incr->iids
+                  .FindOrAssign(perfetto::protos::pbzero::InternedData::
+                                    kDebugAnnotationNamesFieldNumber,
+                                arg_name, strlen(arg_name))
+                  .iid;
       }
+      dbg->set_name_iid(iid);
     }
   }
 
@@ -985,18 +1090,15 @@ static void InstanceOp(
     auto packet = NewTracePacketInternal(
         trace_writer, incr_state, track_event_tls, ts,
         perfetto::protos::pbzero::TracePacket::SEQ_NEEDS_INCREMENTAL_STATE);
-    auto* track_event = packet->set_track_event();
-    WriteTrackEvent(incr_state, track_event, cat, type, name, extra_data,
-                    track_uuid, dynamic_cat, use_interning);
-    track_event->Finalize();
-
-    if (!incr_state->serialized_interned_data.empty()) {
-      auto ranges = incr_state->serialized_interned_data.GetRanges();
-      packet->AppendScatteredBytes(
-          perfetto::protos::pbzero::TracePacket::kInternedDataFieldNumber,
-          ranges.data(), ranges.size());
-      incr_state->serialized_interned_data.Reset();
+    EventIids iids;
+    {
+      EventInterner interner(incr_state, packet.get());
+      InternTrackEventStrings(&interner, &iids, cat, type, name, extra_data,
+                              dynamic_cat, use_interning);
     }
+    auto* track_event = packet->set_track_event();
+    WriteTrackEvent(incr_state, track_event, iids, type, name, extra_data,
+                    track_uuid, dynamic_cat);
   }
 
   bool flush = false;
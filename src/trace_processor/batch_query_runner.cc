@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/batch_query_runner.h"
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/iterator.h"
+#include "perfetto/trace_processor/read_trace.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
+#include "src/trace_processor/sqlite/sql_source.h"
+#include "src/trace_processor/sqlite/sqlite_engine.h"
+#include "src/trace_processor/trace_processor_impl.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// A copy of a SqlValue which outlives the iterator it was read from.
+struct MergeValue {
+  SqlValue::Type type = SqlValue::Type::kNull;
+  int64_t long_value = 0;
+  double double_value = 0;
+  std::string data;  // Strings and bytes.
+};
+
+struct TraceTask {
+  size_t index = 0;
+  std::string path;
+  uint64_t size = 0;
+
+  // Set on the worker thread, read on the main thread once |done| is set.
+  // When merging, the values of the query are kept in |merge_values|, row by
+  // row and without the trace column, instead of the CSV lines of |rows|.
+  base::Status status;
+  std::vector<std::string> columns;
+  std::string rows;
+  std::vector<MergeValue> merge_values;
+  bool done = false;
+};
+
+// Formats values in the same way as trace_processor_shell does for query
+// results printed as CSV.
+void AppendCsvValue(const SqlValue& value, std::string* out) {
+  char buf[64];
+  switch (value.type) {
+    case SqlValue::Type::kNull:
+      out->append("\"[NULL]\"");
+      break;
+    case SqlValue::Type::kDouble:
+      snprintf(buf, sizeof(buf), "%f", value.double_value);
+      out->append(buf);
+      break;
+    case SqlValue::Type::kLong:
+      snprintf(buf, sizeof(buf), "%" PRIi64, value.long_value);
+      out->append(buf);
+      break;
+    case SqlValue::Type::kString:
+      out->append("\"").append(value.string_value).append("\"");
+      break;
+    case SqlValue::Type::kBytes:
+      out->append("\"<raw bytes>\"");
+      break;
+  }
+}
+
+MergeValue ToMergeValue(const SqlValue& value) {
+  MergeValue merge_value;
+  merge_value.type = value.type;
+  switch (value.type) {
+    case SqlValue::Type::kNull:
+      break;
+    case SqlValue::Type::kLong:
+      merge_value.long_value = value.long_value;
+      break;
+    case SqlValue::Type::kDouble:
+      merge_value.double_value = value.double_value;
+      break;
+    case SqlValue::Type::kString:
+      merge_value.data = value.string_value;
+      break;
+    case SqlValue::Type::kBytes:
+      merge_value.data.assign(static_cast<const char*>(value.bytes_value),
+                              value.bytes_count);
+      break;
+  }
+  return merge_value;
+}
+
+// Quotes |name| so it can be used as an SQLite identifier.
+std::string QuoteIdentifier(const std::string& name) {
+  std::string quoted = "\"";
+  for (char c : name) {
+    if (c == '"')
+      quoted.push_back('"');
+    quoted.push_back(c);
+  }
+  return quoted.append("\"");
+}
+
+std::string CsvHeader(const std::vector<std::string>& columns) {
+  std::string header;
+  for (const std::string& column : columns) {
+    header.append(header.empty() ? "\"" : ",\"").append(column).append("\"");
+  }
+  return header.append("\n");
+}
+
+void RunTraceTask(const Config& config,
+                  const std::string& sql,
+                  bool merge,
+                  TraceTask* task) {
+  std::unique_ptr<TraceProcessor> tp = TraceProcessor::CreateInstance(config);
+  base::Status status = ReadTrace(tp.get(), task->path.c_str());
+  if (!status.ok()) {
+    task->status = base::ErrStatus("Could not read trace: %s",
+                                   status.c_message());
+    return;
+  }
+
+  auto it = tp->ExecuteQuery(sql);
+  bool has_more = it.Next();
+  task->columns = {"trace"};
+  for (uint32_t c = 0; c < it.ColumnCount(); c++)
+    task->columns.push_back(it.GetColumnName(c));
+
+  for (; has_more; has_more = it.Next()) {
+    if (merge) {
+      for (uint32_t c = 0; c < it.ColumnCount(); c++)
+        task->merge_values.push_back(ToMergeValue(it.Get(c)));
+      continue;
+    }
+    task->rows.append("\"").append(task->path).append("\"");
+    for (uint32_t c = 0; c < it.ColumnCount(); c++) {
+      task->rows.append(",");
+      AppendCsvValue(it.Get(c), &task->rows);
+    }
+    task->rows.append("\n");
+  }
+  task->status = it.Status();
+}
+
+// Gathers the results of each trace into the batch_results table of a trace
+// processor instance without any trace, to run the merge query on it.
+class ResultMerger {
+ public:
+  ResultMerger() : tp_(new TraceProcessorImpl(Config())) {}
+
+  base::Status Add(const TraceTask& task) {
+    if (columns_.empty()) {
+      std::string create = "CREATE TABLE batch_results(trace_id";
+      std::string insert = "INSERT INTO batch_results VALUES (?";
+      for (const std::string& column : task.columns) {
+        create.append(", ").append(QuoteIdentifier(column));
+        insert.append(", ?");
+      }
+      create.append(")");
+      insert.append(")");
+      RETURN_IF_ERROR(Execute(create));
+
+      // Rows are bound to a single statement rather than spelled out as SQL,
+      // which keeps bytes values and avoids parsing one huge INSERT.
+      insert_.emplace(tp_->engine()->sqlite_engine()->PrepareStatement(
+          SqlSource::FromTraceProcessorImplementation(insert)));
+      RETURN_IF_ERROR(insert_->status());
+      columns_ = task.columns;
+    } else if (task.columns != columns_) {
+      std::string header = CsvHeader(task.columns);
+      header.pop_back();
+      return base::ErrStatus(
+          "Columns differ from the ones of the first trace: %s",
+          header.c_str());
+    }
+
+    // The trace column isn't part of the values.
+    const size_t row_size = columns_.size() - 1;
+    sqlite3_stmt* stmt = insert_->sqlite_stmt();
+    for (size_t row = 0; row_size > 0 && row < task.merge_values.size();
+         row += row_size) {
+      sqlite3_bind_int64(stmt, 1, static_cast<int64_t>(task.index));
+      sqlite3_bind_text(stmt, 2, task.path.c_str(), -1, SQLITE_TRANSIENT);
+      for (size_t c = 0; c < row_size; c++) {
+        BindValue(stmt, static_cast<int>(c) + 3, task.merge_values[row + c]);
+      }
+      while (insert_->Step()) {
+      }
+      RETURN_IF_ERROR(insert_->status());
+      sqlite3_reset(stmt);
+    }
+    return base::OkStatus();
+  }
+
+  base::Status WriteMergedResults(const std::string& sql, FILE* output) {
+    if (columns_.empty())
+      return base::OkStatus();
+    auto it = tp_->ExecuteQuery(sql);
+    bool has_more = it.Next();
+    std::vector<std::string> columns;
+    for (uint32_t c = 0; c < it.ColumnCount(); c++)
+      columns.push_back(it.GetColumnName(c));
+    std::string rows = CsvHeader(columns);
+    for (; has_more; has_more = it.Next()) {
+      for (uint32_t c = 0; c < it.ColumnCount(); c++) {
+        if (c > 0)
+          rows.append(",");
+        AppendCsvValue(it.Get(c), &rows);
+      }
+      rows.append("\n");
+    }
+    RETURN_IF_ERROR(it.Status());
+    fputs(rows.c_str(), output);
+    return base::OkStatus();
+  }
+
+ private:
+  static void BindValue(sqlite3_stmt* stmt, int index, const MergeValue& v) {
+    switch (v.type) {
+      case SqlValue::Type::kNull:
+        sqlite3_bind_null(stmt, index);
+        break;
+      case SqlValue::Type::kLong:
+        sqlite3_bind_int64(stmt, index, v.long_value);
+        break;
+      case SqlValue::Type::kDouble:
+        sqlite3_bind_double(stmt, index, v.double_value);
+        break;
+      case SqlValue::Type::kString:
+        sqlite3_bind_text(stmt, index, v.data.data(),
+                          static_cast<int>(v.data.size()), SQLITE_TRANSIENT);
+        break;
+      case SqlValue::Type::kBytes:
+        sqlite3_bind_blob(stmt, index, v.data.data(),
+                          static_cast<int>(v.data.size()), SQLITE_TRANSIENT);
+        break;
+    }
+  }
+
+  base::Status Execute(const std::string& sql) {
+    auto it = tp_->ExecuteQuery(sql);
+    while (it.Next()) {
+    }
+    return it.Status();
+  }
+
+  std::unique_ptr<TraceProcessorImpl> tp_;
+  std::optional<SqliteEngine::PreparedStatement> insert_;
+  std::vector<std::string> columns_;
+};
+
+}  // namespace
+
+base::Status RunBatchQueries(const BatchQueryConfig& config,
+                             const std::vector<std::string>& trace_paths,
+                             const std::string& sql,
+                             FILE* output) {
+  std::vector<TraceTask> tasks(trace_paths.size());
+  for (size_t i = 0; i < trace_paths.size(); ++i) {
+    tasks[i].index = i;
+    tasks[i].path = trace_paths[i];
+    tasks[i].size = base::GetFileSize(trace_paths[i]).value_or(0);
+  }
+
+  const uint32_t concurrency = std::max(config.concurrency, 1u);
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint32_t running = 0;
+  uint64_t running_bytes = 0;
+
+  // Traces are started in order, so only the next one needs to be checked.
+  size_t next_to_start = 0;
+  auto can_start = [&] {
+    if (next_to_start == tasks.size() || running == concurrency)
+      return false;
+    return running == 0 || config.max_loaded_bytes == 0 ||
+           running_bytes + tasks[next_to_start].size <=
+               config.max_loaded_bytes;
+  };
+
+  const bool merge = !config.merge_sql.empty();
+  std::optional<ResultMerger> merger;
+  if (merge)
+    merger.emplace();
+
+  // Declared after the state above, which its tasks use.
+  base::ThreadPool pool(concurrency);
+
+  size_t next_to_write = 0;
+  uint32_t failures = 0;
+  std::string last_header;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (next_to_write < tasks.size()) {
+    for (; can_start(); ++next_to_start) {
+      TraceTask* task = &tasks[next_to_start];
+      running++;
+      running_bytes += task->size;
+      pool.PostTask([&, task] {
+        RunTraceTask(config.config, sql, merge, task);
+        std::lock_guard<std::mutex> task_lock(mutex);
+        running--;
+        running_bytes -= task->size;
+        task->done = true;
+        cv.notify_one();
+      });
+    }
+
+    cv.wait(lock, [&] { return tasks[next_to_write].done || can_start(); });
+
+    // Results of traces which finish out of order are kept until all the
+    // traces before them have been written.
+    while (next_to_write < tasks.size() && tasks[next_to_write].done) {
+      TraceTask& task = tasks[next_to_write++];
+      lock.unlock();
+      if (task.status.ok() && merge) {
+        task.status = merger->Add(task);
+      } else if (task.status.ok()) {
+        std::string header = CsvHeader(task.columns);
+        if (header != last_header) {
+          fputs(header.c_str(), output);
+          last_header = std::move(header);
+        }
+        fputs(task.rows.c_str(), output);
+      }
+      if (!task.status.ok()) {
+        failures++;
+        PERFETTO_ELOG("%s: %s", task.path.c_str(), task.status.c_message());
+      }
+      task.rows = std::string();
+      std::vector<MergeValue>().swap(task.merge_values);
+      lock.lock();
+    }
+  }
+  if (merge) {
+    base::Status status = merger->WriteMergedResults(config.merge_sql, output);
+    if (!status.ok()) {
+      fflush(output);
+      return base::ErrStatus("Merge query failed: %s", status.c_message());
+    }
+  }
+  fflush(output);
+
+  if (failures > 0) {
+    return base::ErrStatus("%u of %zu traces failed", failures, tasks.size());
+  }
+  return base::OkStatus();
+}
+
+}  // namespace perfetto::trace_processor
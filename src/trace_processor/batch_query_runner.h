@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_BATCH_QUERY_RUNNER_H_
+#define SRC_TRACE_PROCESSOR_BATCH_QUERY_RUNNER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/trace_processor/basic_types.h"
+
+namespace perfetto::trace_processor {
+
+struct BatchQueryConfig {
+  // The config of the TraceProcessor instance created for each trace.
+  Config config;
+
+  // The maximum number of traces loaded (and queried) at the same time.
+  uint32_t concurrency = 1;
+
+  // If non-zero, traces are only started while the total size of the trace
+  // files being processed stays below this value. A trace larger than this is
+  // still processed, on its own.
+  uint64_t max_loaded_bytes = 0;
+
+  // If set, the rows returned for all the traces are not written out but
+  // gathered into a `batch_results` table, with the columns of the per-trace
+  // query preceded by `trace_id` (the index of the trace in the list) and
+  // `trace` (its path). This query is then run on it, to aggregate the
+  // results across traces, and its rows are written instead.
+  std::string merge_sql;
+};
+
+// Runs the same queries over many traces in a single process.
+//
+// Each trace is loaded into its own TraceProcessor instance, on a pool of
+// |BatchQueryConfig::concurrency| threads, and |sql| is executed on it. The
+// instance is destroyed as soon as the result has been collected. As all the
+// instances live in the same process, the stdlib modules included by |sql| are
+// only parsed once (see PerfettoSqlEngine) and the startup costs of the
+// process are paid once for all the traces.
+//
+// The rows returned by the last statement of |sql| are written to |output| as
+// CSV, in the order of |trace_paths|, with an extra first column holding the
+// path of the trace. A header is written before the rows of the first trace
+// and again whenever the columns change.
+//
+// A trace which fails to load or to be queried doesn't stop the others: the
+// error is logged and an error is returned once all the traces have been
+// processed. With |BatchQueryConfig::merge_sql|, the results are merged
+// instead (see above): traces whose columns differ from the ones of the first
+// trace also count as failures.
+base::Status RunBatchQueries(const BatchQueryConfig& config,
+                             const std::vector<std::string>& trace_paths,
+                             const std::string& sql,
+                             FILE* output);
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_BATCH_QUERY_RUNNER_H_
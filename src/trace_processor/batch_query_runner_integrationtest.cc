@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/batch_query_runner.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+
+class BatchQueryRunnerTest : public ::testing::Test {
+ protected:
+  // Writes a JSON trace with |slice_count| slices and returns its path.
+  std::string WriteTrace(uint32_t slice_count) {
+    std::string json = "{\"traceEvents\":[";
+    for (uint32_t i = 0; i < slice_count; ++i) {
+      if (i > 0)
+        json += ",";
+      json += "{\"name\":\"s\",\"ph\":\"X\",\"ts\":" + std::to_string(i * 10) +
+              ",\"dur\":5,\"pid\":1,\"tid\":1}";
+    }
+    json += "]}";
+    traces_.emplace_back(base::TempFile::Create());
+    base::WriteAll(traces_.back().fd(), json.data(), json.size());
+    return traces_.back().path();
+  }
+
+  // Runs the queries and returns what was written to the output.
+  std::string Run(const BatchQueryConfig& config,
+                  const std::vector<std::string>& trace_paths,
+                  base::Status* status,
+                  const std::string& sql =
+                      "SELECT COUNT(*) AS n, MAX(dur) AS d FROM slice") {
+    FILE* output = tmpfile();
+    *status = RunBatchQueries(config, trace_paths, sql, output);
+    std::string result;
+    fseek(output, 0, SEEK_SET);
+    char buf[1024];
+    for (size_t n; (n = fread(buf, 1, sizeof(buf), output)) > 0;)
+      result.append(buf, n);
+    fclose(output);
+    return result;
+  }
+
+  std::vector<base::TempFile> traces_;
+};
+
+TEST_F(BatchQueryRunnerTest, ResultsAreTaggedAndInOrder) {
+  std::vector<std::string> paths = {WriteTrace(1), WriteTrace(2),
+                                    WriteTrace(3)};
+  std::string expected = "\"trace\",\"n\",\"d\"\n\"" + paths[0] +
+                         "\",1,5000\n\"" + paths[1] + "\",2,5000\n\"" +
+                         paths[2] + "\",3,5000\n";
+
+  BatchQueryConfig config;
+  config.concurrency = 3;
+  base::Status status;
+  ASSERT_EQ(Run(config, paths, &status), expected);
+  ASSERT_TRUE(status.ok()) << status.message();
+
+  // A memory budget smaller than any trace makes them run one at a time, with
+  // the same output.
+  config.max_loaded_bytes = 1;
+  ASSERT_EQ(Run(config, paths, &status), expected);
+  ASSERT_TRUE(status.ok()) << status.message();
+}
+
+TEST_F(BatchQueryRunnerTest, FailedTracesDoNotStopTheOthers) {
+  std::vector<std::string> paths = {WriteTrace(1), "/does/not/exist",
+                                    WriteTrace(2)};
+  BatchQueryConfig config;
+  config.concurrency = 2;
+  base::Status status;
+  ASSERT_EQ(Run(config, paths, &status),
+            "\"trace\",\"n\",\"d\"\n\"" + paths[0] + "\",1,5000\n\"" +
+                paths[2] + "\",2,5000\n");
+  ASSERT_FALSE(status.ok());
+  ASSERT_EQ(status.message(), "1 of 3 traces failed");
+}
+
+TEST_F(BatchQueryRunnerTest, MergeResults) {
+  std::vector<std::string> paths = {WriteTrace(1), "/does/not/exist",
+                                    WriteTrace(2), WriteTrace(3)};
+  BatchQueryConfig config;
+  config.concurrency = 2;
+  config.merge_sql =
+      "SELECT COUNT(DISTINCT trace) AS traces, SUM(n) AS n, "
+      "GROUP_CONCAT(trace_id) AS ids FROM batch_results";
+  base::Status status;
+  ASSERT_EQ(Run(config, paths, &status),
+            "\"traces\",\"n\",\"ids\"\n3,6,\"0,2,3\"\n");
+  ASSERT_EQ(status.message(), "1 of 4 traces failed");
+
+  // Every row of each trace is gathered, with string values escaped.
+  config.merge_sql =
+      "SELECT trace_id, COUNT(*) AS n, MAX(name) AS name FROM batch_results "
+      "GROUP BY trace_id ORDER BY trace_id";
+  ASSERT_EQ(Run(config, {paths[0], paths[3]}, &status,
+                "SELECT name || '''' AS name FROM slice"),
+            "\"trace_id\",\"n\",\"name\"\n0,1,\"s'\"\n1,3,\"s'\"\n");
+  ASSERT_TRUE(status.ok()) << status.message();
+
+  // Column names are quoted and bytes values are kept as blobs.
+  config.merge_sql =
+      "SELECT SUM(LENGTH(\"a\"\"b\")) AS n, TYPEOF(\"a\"\"b\") AS t "
+      "FROM batch_results";
+  ASSERT_EQ(Run(config, {paths[0], paths[3]}, &status,
+                "SELECT CAST(name AS BLOB) AS \"a\"\"b\" FROM slice"),
+            "\"n\",\"t\"\n4,\"blob\"\n");
+  ASSERT_TRUE(status.ok()) << status.message();
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -105,6 +105,51 @@ PERFETTO_ALWAYS_INLINE uint64_t Pext(uint64_t word, uint64_t mask) {
 #endif
 }
 
+enum class WordOp { kAnd, kOr, kNot };
+
+// Applies |op| to the |kWords| words at |dst| (using the words at |src| as
+// the second operand for kAnd and kOr), storing the result in |dst| and
+// returning the number of set bits in it.
+//
+// Fusing the computation of the counts with the bitwise operation means the
+// words only have to be read from memory once.
+template <WordOp op, uint32_t kWords>
+PERFETTO_ALWAYS_INLINE uint32_t ApplyWordOp(uint64_t* dst,
+                                            const uint64_t* src) {
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+  static_assert(kWords % 4 == 0, "Blocks must be a multiple of 256 bits");
+  for (uint32_t i = 0; i < kWords; i += 4) {
+    auto* d = reinterpret_cast<__m256i*>(dst + i);
+    __m256i value = _mm256_loadu_si256(d);
+    if constexpr (op == WordOp::kAnd) {
+      value = _mm256_and_si256(
+          value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+    } else if constexpr (op == WordOp::kOr) {
+      value = _mm256_or_si256(
+          value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i)));
+    } else {
+      value = _mm256_xor_si256(value, _mm256_set1_epi64x(-1));
+    }
+    _mm256_storeu_si256(d, value);
+  }
+#else
+  for (uint32_t i = 0; i < kWords; ++i) {
+    if constexpr (op == WordOp::kAnd) {
+      dst[i] &= src[i];
+    } else if constexpr (op == WordOp::kOr) {
+      dst[i] |= src[i];
+    } else {
+      dst[i] = ~dst[i];
+    }
+  }
+#endif
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < kWords; ++i) {
+    count += static_cast<uint32_t>(PERFETTO_POPCOUNT(dst[i]));
+  }
+  return count;
+}
+
 // This function implements the tzcnt instruction.
 // See https://www.felixcloutier.com/x86/tzcnt for details on what tzcnt does.
 PERFETTO_ALWAYS_INLINE uint32_t Tzcnt(uint64_t value) {
@@ -153,6 +198,7 @@ void BitVector::Resize(uint32_t new_size, bool filler) {
   if (new_size == 0) {
     words_.clear();
     counts_.clear();
+    stale_counts_block_ = kNoStaleCounts;
     size_ = 0;
     return;
   }
@@ -213,7 +259,37 @@ void BitVector::Resize(uint32_t new_size, bool filler) {
   size_ = new_size;
 }
 
+void BitVector::AppendBits(uint64_t word, uint32_t count) {
+  PERFETTO_DCHECK(count <= BitWord::kBits);
+  if (count == 0)
+    return;
+  if (count < BitWord::kBits)
+    word &= (uint64_t(1) << count) - 1;
+
+  // If the bits do not fit in the last block, fill it first: the count of the
+  // new block has to include them.
+  uint32_t bits_left_in_block = BlockCount() * Block::kBits - size_;
+  if (count > bits_left_in_block) {
+    AppendBits(word, bits_left_in_block);
+    word >>= bits_left_in_block;
+    count -= bits_left_in_block;
+
+    uint32_t t = CountSetBits();
+    words_.resize(words_.size() + Block::kWords);
+    counts_.emplace_back(t);
+  }
+
+  // The bits after |size_| are always false so they can be or-ed in place.
+  uint32_t word_idx = size_ / BitWord::kBits;
+  uint32_t bit_idx = size_ % BitWord::kBits;
+  words_[word_idx] |= word << bit_idx;
+  if (bit_idx + count > BitWord::kBits)
+    words_[word_idx + 1] |= word >> (BitWord::kBits - bit_idx);
+  size_ += count;
+}
+
 BitVector BitVector::Copy() const {
+  EnsureCountsUpToDate();
   return {words_, counts_, size_};
 }
 
@@ -221,9 +297,12 @@ void BitVector::Not() {
   if (size_ == 0) {
     return;
   }
+  EnsureCountsUpToDate();
 
-  for (uint64_t& word : words_) {
-    BitWord(&word).Not();
+  // The counts can be computed from the old ones so there is no need to count
+  // the set bits of the result.
+  for (uint32_t i = 0; i < words_.size(); i += Block::kWords) {
+    ApplyWordOp<WordOp::kNot, Block::kWords>(&words_[i], nullptr);
   }
 
   // Make sure to reset the last block's trailing bits to zero to preserve the
@@ -238,18 +317,44 @@ void BitVector::Not() {
 
 void BitVector::Or(const BitVector& sec) {
   PERFETTO_CHECK(size_ == sec.size());
-  for (uint32_t i = 0; i < words_.size(); ++i) {
-    BitWord(&words_[i]).Or(sec.words_[i]);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] = count;
+    count += ApplyWordOp<WordOp::kOr, Block::kWords>(
+        &words_[i * Block::kWords], &sec.words_[i * Block::kWords]);
   }
-  UpdateCounts(words_, counts_);
+  stale_counts_block_ = kNoStaleCounts;
 }
 
 void BitVector::And(const BitVector& sec) {
   Resize(std::min(size_, sec.size_));
-  for (uint32_t i = 0; i < words_.size(); ++i) {
-    BitWord(&words_[i]).And(sec.words_[i]);
+  PERFETTO_DCHECK(words_.size() <= sec.words_.size());
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < counts_.size(); ++i) {
+    counts_[i] = count;
+    count += ApplyWordOp<WordOp::kAnd, Block::kWords>(
+        &words_[i * Block::kWords], &sec.words_[i * Block::kWords]);
   }
-  UpdateCounts(words_, counts_);
+  stale_counts_block_ = kNoStaleCounts;
+}
+
+void BitVector::SetBits(const std::vector<uint32_t>& indices) {
+  if (indices.empty())
+    return;
+
+  uint32_t min_idx = std::numeric_limits<uint32_t>::max();
+  for (uint32_t idx : indices) {
+    PERFETTO_DCHECK(idx < size());
+    words_[idx / BitWord::kBits] |= 1ull << (idx % BitWord::kBits);
+    min_idx = std::min(min_idx, idx);
+  }
+  MarkCountsStaleAfter(BlockFloor(min_idx));
+}
+
+void BitVector::RebuildStaleCounts() const {
+  PERFETTO_DCHECK(stale_counts_block_ >= 1);
+  UpdateCounts(words_, counts_, stale_counts_block_);
+  stale_counts_block_ = kNoStaleCounts;
 }
 
 void BitVector::UpdateSetBits(const BitVector& update) {
@@ -338,6 +443,7 @@ void BitVector::UpdateSetBits(const BitVector& update) {
   PERFETTO_DCHECK(update_ptr == update_ptr_end);
 
   UpdateCounts(words_, counts_);
+  stale_counts_block_ = kNoStaleCounts;
 
   // After the loop, we should have precisely the same number of bits
   // set as |update|.
@@ -409,6 +515,7 @@ void BitVector::SelectBits(const BitVector& mask_bv) {
   // |set_bits_in_mask| are cleared (allowing this count algortihm to be
   // accurate).
   UpdateCounts(words_, counts_);
+  stale_counts_block_ = kNoStaleCounts;
 }
 
 BitVector BitVector::FromSortedIndexVector(
@@ -490,6 +597,7 @@ std::vector<uint32_t> BitVector::GetSetBitIndices() const {
 
 void BitVector::Serialize(
     protos::pbzero::SerializedColumn::BitVector* msg) const {
+  EnsureCountsUpToDate();
   msg->set_size(size_);
   if (!counts_.empty()) {
     msg->set_counts(reinterpret_cast<const uint8_t*>(counts_.data()),
@@ -505,6 +613,7 @@ void BitVector::Serialize(
 void BitVector::Deserialize(
     const protos::pbzero::SerializedColumn::BitVector::Decoder& bv_msg) {
   size_ = bv_msg.size();
+  stale_counts_block_ = kNoStaleCounts;
   if (bv_msg.has_counts()) {
     counts_.resize(
         static_cast<size_t>(bv_msg.counts().size / sizeof(uint32_t)));
@@ -18,9 +18,11 @@
 #define SRC_TRACE_PROCESSOR_CONTAINERS_BIT_VECTOR_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <initializer_list>
 #include <iterator>
+#include <limits>
 #include <utility>
 #include <vector>
 
@@ -44,6 +46,13 @@ class SetBitsIterator;
 
 // A BitVector which compactly stores a vector of bools using a single bit
 // for each bool.
+//
+// Alongside the bits, the BitVector keeps the number of set bits before each
+// block to make rank queries (e.g. |CountSetBits|, |IndexOfNthSet|) fast.
+// |Set|, |Clear| and |SetBits| do not update these counts but only mark them
+// as stale: they are rebuilt by the next method which needs them. This means
+// that reading a BitVector from multiple threads is only safe if it was not
+// changed with one of these methods since the last such read.
 class BitVector {
  public:
   static constexpr uint32_t kBitsInWord = 64;
@@ -83,6 +92,48 @@ class BitVector {
       global_bit_offset_ += BitWord::kBits;
     }
 
+    // Appends |count| bits equal to |value| to the builder.
+    void AppendRepeated(bool value, uint32_t count) {
+      PERFETTO_DCHECK(count <= BitsUntilFull());
+      uint32_t end = global_bit_offset_ + count;
+      if (!value) {
+        // |words_| is zero initialized so there is nothing to write.
+        global_bit_offset_ = end;
+        return;
+      }
+      while (global_bit_offset_ < end &&
+             global_bit_offset_ % BitWord::kBits != 0) {
+        Append(true);
+      }
+      while (global_bit_offset_ + BitWord::kBits <= end) {
+        AppendWord(~uint64_t(0));
+      }
+      while (global_bit_offset_ < end) {
+        Append(true);
+      }
+    }
+
+    // Appends the bits of |bv| at the indices between the current end of the
+    // builder and |end|: i.e. copies the bits of |bv| at the same positions in
+    // the BitVector being built. Bits past the end of |bv| are appended as
+    // false.
+    void AppendBitsAt(const BitVector& bv, uint32_t end) {
+      PERFETTO_DCHECK(end <= size_);
+      uint32_t copy_end = std::min(end, bv.size());
+      while (global_bit_offset_ < copy_end &&
+             global_bit_offset_ % BitWord::kBits != 0) {
+        Append(bv.IsSet(global_bit_offset_));
+      }
+      while (global_bit_offset_ + BitWord::kBits <= copy_end) {
+        AppendWord(bv.words_[global_bit_offset_ / BitWord::kBits]);
+      }
+      while (global_bit_offset_ < copy_end) {
+        Append(bv.IsSet(global_bit_offset_));
+      }
+      // |words_| is zero initialized so the remaining bits are already false.
+      global_bit_offset_ = std::max(global_bit_offset_, end);
+    }
+
     // Creates a BitVector from this Builder.
     BitVector Build() && {
       if (size_ == 0)
@@ -179,6 +230,8 @@ class BitVector {
     if (end == 0)
       return 0;
 
+    EnsureCountsUpToDate();
+
     // Although the external interface we present uses an exclusive |end|,
     // internally it's a lot nicer to work with an inclusive |end| (mainly
     // because we get block rollovers on exclusive ends which means we need
@@ -195,6 +248,7 @@ class BitVector {
   // CountSetBits().
   uint32_t IndexOfNthSet(uint32_t n) const {
     PERFETTO_DCHECK(n < CountSetBits());
+    EnsureCountsUpToDate();
 
     // First search for the block which, up until the start of it, has more than
     // n bits set. Note that this should never return |counts.begin()| as
@@ -228,14 +282,11 @@ class BitVector {
     bool old_value =
         ConstBlockFromIndex(addr.block_idx).IsSet(addr.block_offset);
 
-    // If the old value was unset, set the bit and add one to the count.
+    // If the old value was unset, set the bit and mark the counts of all the
+    // following blocks as stale.
     if (PERFETTO_LIKELY(!old_value)) {
       BlockFromIndex(addr.block_idx).Set(addr.block_offset);
-
-      auto size = static_cast<uint32_t>(counts_.size());
-      for (uint32_t i = addr.block_idx + 1; i < size; ++i) {
-        counts_[i]++;
-      }
+      MarkCountsStaleAfter(addr.block_idx);
     }
     return old_value;
   }
@@ -248,18 +299,21 @@ class BitVector {
     bool old_value =
         ConstBlockFromIndex(addr.block_idx).IsSet(addr.block_offset);
 
-    // If the old value was set, clear the bit and subtract one from all the
-    // counts.
+    // If the old value was set, clear the bit and mark the counts of all the
+    // following blocks as stale.
     if (PERFETTO_LIKELY(old_value)) {
       BlockFromIndex(addr.block_idx).Clear(addr.block_offset);
-
-      auto size = static_cast<uint32_t>(counts_.size());
-      for (uint32_t i = addr.block_idx + 1; i < size; ++i) {
-        counts_[i]--;
-      }
+      MarkCountsStaleAfter(addr.block_idx);
     }
   }
 
+  // Sets the bits at all the indices in |indices| to true. |indices| does not
+  // need to be sorted and can contain duplicates.
+  //
+  // This is much faster than calling |Set| for each index as the old value of
+  // the bits does not need to be read.
+  void SetBits(const std::vector<uint32_t>& indices);
+
   // Appends true to the BitVector.
   void AppendTrue() {
     AppendFalse();
@@ -284,6 +338,12 @@ class BitVector {
     // size_ is always set to false.
   }
 
+  // Appends the |count| lowest bits of |word| to the BitVector, starting with
+  // the least significant one. |count| must be at most 64.
+  //
+  // This is much faster than appending the bits one at a time.
+  void AppendBits(uint64_t word, uint32_t count);
+
   // Resizes the BitVector to the given |size|.
   // Truncates the BitVector if |size| < |size()| or fills the new space with
   // |filler| if |size| > |size()|. Calling this method is a noop if |size| ==
@@ -361,6 +421,7 @@ class BitVector {
   // Requests the removal of unused capacity.
   // Matches the semantics of std::vector::shrink_to_fit.
   void ShrinkToFit() {
+    EnsureCountsUpToDate();
     words_.shrink_to_fit();
     counts_.shrink_to_fit();
   }
@@ -402,6 +463,12 @@ class BitVector {
     return BlockCount(n) * Block::kBits + BlockCount(n) * sizeof(uint32_t);
   }
 
+  // Returns the number of bytes of memory used by the BitVector.
+  size_t memory_usage() const {
+    return words_.capacity() * sizeof(uint64_t) +
+           counts_.capacity() * sizeof(uint32_t);
+  }
+
   // Returns a vector<uint32_t> containing the indices of all the set bits
   // in the BitVector.
   std::vector<uint32_t> GetSetBitIndices() const;
@@ -922,22 +989,44 @@ class BitVector {
     return block_idx * Block::kBits;
   }
 
-  // Updates the counts in |counts| by counting the set bits in |words|.
+  // Updates the counts in |counts| starting from block |first_block| by
+  // counting the set bits in |words|.
   static void UpdateCounts(const std::vector<uint64_t>& words,
-                           std::vector<uint32_t>& counts) {
+                           std::vector<uint32_t>& counts,
+                           uint32_t first_block = 1) {
     PERFETTO_CHECK(words.size() == counts.size() * Block::kWords);
-    for (uint32_t i = 1; i < counts.size(); ++i) {
+    PERFETTO_DCHECK(first_block >= 1);
+    for (uint32_t i = first_block; i < counts.size(); ++i) {
       counts[i] = counts[i - 1] +
                   ConstBlock(&words[Block::kWords * (i - 1)]).CountSetBits();
     }
   }
 
+  // Records that the counts of all the blocks after |block_idx| have to be
+  // rebuilt before being read.
+  void MarkCountsStaleAfter(uint32_t block_idx) {
+    stale_counts_block_ = std::min(stale_counts_block_, block_idx + 1);
+  }
+
+  // Rebuilds the counts if any of them are stale.
+  void EnsureCountsUpToDate() const {
+    if (PERFETTO_UNLIKELY(stale_counts_block_ < counts_.size()))
+      RebuildStaleCounts();
+  }
+
+  void RebuildStaleCounts() const;
+
   uint32_t size_ = 0;
   // See class documentation for how these constants are chosen.
   static constexpr uint16_t kWordsInBlock = Block::kWords;
   static constexpr uint32_t kBitsInBlock = kWordsInBlock * BitWord::kBits;
-  std::vector<uint32_t> counts_;
+  // Rebuilt lazily on const access: see the class documentation.
+  mutable std::vector<uint32_t> counts_;
   std::vector<uint64_t> words_;
+  // The index of the first block whose count is stale.
+  mutable uint32_t stale_counts_block_ = kNoStaleCounts;
+  static constexpr uint32_t kNoStaleCounts =
+      std::numeric_limits<uint32_t>::max();
 };
 
 }  // namespace trace_processor
@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstdint>
 #include <limits>
 #include <random>
@@ -144,6 +145,60 @@ static void BM_BitVectorClear(benchmark::State& state) {
 }
 BENCHMARK(BM_BitVectorClear)->Apply(BitVectorArgs);
 
+static void BM_BitVectorSetBits(benchmark::State& state) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+
+  // Sets 1% of the bits (but at least one) in each iteration.
+  std::vector<uint32_t> rows(std::max(size / 100, 1u));
+  for (uint32_t& row : rows) {
+    row = rnd_engine() % size;
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    BitVector copy = bv.Copy();
+    state.ResumeTiming();
+
+    copy.SetBits(rows);
+    benchmark::DoNotOptimize(copy.CountSetBits());
+  }
+}
+BENCHMARK(BM_BitVectorSetBits)->Apply(BitVectorArgs);
+
+// Same as BM_BitVectorSetBits but setting the bits one at a time.
+static void BM_BitVectorSetLoop(benchmark::State& state) {
+  static constexpr uint32_t kRandomSeed = 42;
+  std::minstd_rand0 rnd_engine(kRandomSeed);
+
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+
+  std::vector<uint32_t> rows(std::max(size / 100, 1u));
+  for (uint32_t& row : rows) {
+    row = rnd_engine() % size;
+  }
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    BitVector copy = bv.Copy();
+    state.ResumeTiming();
+
+    for (uint32_t row : rows) {
+      copy.Set(row);
+    }
+    benchmark::DoNotOptimize(copy.CountSetBits());
+  }
+}
+BENCHMARK(BM_BitVectorSetLoop)->Apply(BitVectorArgs);
+
 static void BM_BitVectorIndexOfNthSet(benchmark::State& state) {
   static constexpr uint32_t kRandomSeed = 42;
   std::minstd_rand0 rnd_engine(kRandomSeed);
@@ -348,3 +403,52 @@ static void BM_BitVectorFromIndexVector(benchmark::State& state) {
   }
 }
 BENCHMARK(BM_BitVectorFromIndexVector);
+
+static void BM_BitVectorAnd(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+  BitVector other = BvWithSizeAndSetPercentage(size, 50);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    BitVector copy = bv.Copy();
+    state.ResumeTiming();
+
+    copy.And(other);
+    benchmark::DoNotOptimize(copy.CountSetBits());
+  }
+}
+BENCHMARK(BM_BitVectorAnd)->Apply(BitVectorArgs);
+
+static void BM_BitVectorOr(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+  BitVector other = BvWithSizeAndSetPercentage(size, 50);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    BitVector copy = bv.Copy();
+    state.ResumeTiming();
+
+    copy.Or(other);
+    benchmark::DoNotOptimize(copy.CountSetBits());
+  }
+}
+BENCHMARK(BM_BitVectorOr)->Apply(BitVectorArgs);
+
+static void BM_BitVectorNot(benchmark::State& state) {
+  uint32_t size = static_cast<uint32_t>(state.range(0));
+  uint32_t set_percentage = static_cast<uint32_t>(state.range(1));
+
+  BitVector bv = BvWithSizeAndSetPercentage(size, set_percentage);
+
+  for (auto _ : state) {
+    bv.Not();
+    benchmark::DoNotOptimize(bv.CountSetBits());
+  }
+}
+BENCHMARK(BM_BitVectorNot)->Apply(BitVectorArgs);
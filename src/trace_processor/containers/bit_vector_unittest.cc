@@ -124,6 +124,32 @@ TEST(BitVectorUnittest, AppendToEmpty) {
   ASSERT_FALSE(bv.IsSet(1));
 }
 
+TEST(BitVectorUnittest, AppendBits) {
+  // Append words crossing both word and block boundaries and compare with
+  // appending one bit at a time.
+  BitVector bv;
+  BitVector expected;
+  uint64_t word = 0xf0f0'0000'ffff'1234;
+  for (uint32_t count : {3u, 64u, 61u, 0u, 17u, 64u, 64u, 64u, 64u, 64u, 33u}) {
+    bv.AppendBits(word, count);
+    for (uint32_t i = 0; i < count; ++i) {
+      if ((word >> i) & 1) {
+        expected.AppendTrue();
+      } else {
+        expected.AppendFalse();
+      }
+    }
+    word = word * 31 + 7;
+  }
+
+  ASSERT_EQ(bv.size(), expected.size());
+  ASSERT_EQ(bv.CountSetBits(), expected.CountSetBits());
+  for (uint32_t i = 0; i < bv.size(); ++i) {
+    ASSERT_EQ(bv.IsSet(i), expected.IsSet(i)) << i;
+    ASSERT_EQ(bv.CountSetBits(i), expected.CountSetBits(i)) << i;
+  }
+}
+
 TEST(BitVectorUnittest, AppendToExisting) {
   BitVector bv(2046, false);
   bv.AppendTrue();
@@ -542,6 +568,27 @@ TEST(BitVectorUnittest, BuilderSkipAll) {
   ASSERT_EQ(bv.CountSetBits(), 0u);
 }
 
+TEST(BitVectorUnittest, BuilderAppendBitsAt) {
+  BitVector src(300);
+  for (uint32_t i = 0; i < 300; i += 7) {
+    src.Set(i);
+  }
+
+  // Copies an unaligned range, whole words and then bits past the end of
+  // |src| which should be false.
+  BitVector::Builder builder(400, 3);
+  builder.AppendBitsAt(src, 70);
+  builder.AppendBitsAt(src, 256);
+  builder.AppendBitsAt(src, 400);
+  BitVector bv = std::move(builder).Build();
+
+  ASSERT_EQ(bv.size(), 400u);
+  for (uint32_t i = 0; i < 400; ++i) {
+    ASSERT_EQ(bv.IsSet(i), i >= 3 && i < 300 && i % 7 == 0) << i;
+  }
+  ASSERT_EQ(bv.CountSetBits(), src.CountSetBits() - 1);
+}
+
 TEST(BitVectorUnittest, BuilderBitsInCompleteWordsUntilFull) {
   BitVector::Builder builder(128 + 1);
 
@@ -716,6 +763,71 @@ TEST(BitVectorUnittest, OrBig) {
   ASSERT_EQ(bv.CountSetBits(), bv_or.CountSetBits());
 }
 
+TEST(BitVectorUnittest, AndBig) {
+  BitVector bv = BitVector::RangeForTesting(
+      0, 1025, [](uint32_t i) { return i % 5 == 0; });
+  BitVector bv_sec = BitVector::RangeForTesting(
+      0, 2000, [](uint32_t i) { return i % 3 == 0; });
+  bv.And(bv_sec);
+
+  ASSERT_EQ(bv.size(), 1025u);
+  for (uint32_t i = 0; i < bv.size(); ++i) {
+    ASSERT_EQ(bv.IsSet(i), i % 15 == 0);
+    ASSERT_EQ(bv.CountSetBits(i), (i + 14) / 15);
+  }
+}
+
+TEST(BitVectorUnittest, SetBits) {
+  BitVector bv(2000, false);
+  bv.SetBits({1999, 3, 700, 3, 512});
+
+  EXPECT_THAT(bv.GetSetBitIndices(), ElementsAre(3, 512, 700, 1999));
+  ASSERT_EQ(bv.CountSetBits(), 4u);
+  ASSERT_EQ(bv.CountSetBits(600), 2u);
+  ASSERT_EQ(bv.IndexOfNthSet(2), 700u);
+}
+
+TEST(BitVectorUnittest, CountsAfterSetAndClear) {
+  static constexpr uint32_t kSize = 5000;
+  std::minstd_rand0 rand;
+  BitVector bv(kSize, false);
+  std::vector<bool> expected(kSize);
+
+  // Interleave modifications with queries so the stale counts are rebuilt
+  // both partially and fully.
+  for (uint32_t i = 0; i < 20000; ++i) {
+    uint32_t idx = rand() % kSize;
+    if (rand() % 3 == 0) {
+      bv.Clear(idx);
+      expected[idx] = false;
+    } else {
+      bv.Set(idx);
+      expected[idx] = true;
+    }
+    if (i % 1000 == 0) {
+      uint32_t end = rand() % kSize;
+      uint32_t count = 0;
+      for (uint32_t j = 0; j < end; ++j)
+        count += expected[j];
+      ASSERT_EQ(bv.CountSetBits(end), count);
+    }
+  }
+
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < kSize; ++i) {
+    ASSERT_EQ(bv.CountSetBits(i), count);
+    if (expected[i]) {
+      ASSERT_EQ(bv.IndexOfNthSet(count), i);
+      count++;
+    }
+  }
+
+  // Copies must not inherit stale counts.
+  bv.Set(0);
+  BitVector copy = bv.Copy();
+  ASSERT_EQ(copy.CountSetBits(), bv.CountSetBits());
+}
+
 TEST(BitVectorUnittest, QueryStressTest) {
   BitVector bv;
   std::vector<bool> bool_vec;
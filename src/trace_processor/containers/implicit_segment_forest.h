@@ -114,7 +114,7 @@ class ImplicitSegmentForest {
 
   // Returns the value at |n| in the tree: this corresponds to the |n|th
   // element |Push|-ed into the tree.
-  const T& operator[](uint32_t n) { return values_[n * 2]; }
+  const T& operator[](uint32_t n) const { return values_[n * 2]; }
 
   // Returns the number of elements pushed into the forest.
   uint32_t size() const { return static_cast<uint32_t>(values_.size() / 2); }
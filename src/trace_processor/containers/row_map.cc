@@ -17,6 +17,7 @@
 #include "src/trace_processor/containers/row_map.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <unordered_set>
 #include <utility>
@@ -259,6 +260,19 @@ OutputIndex RowMap::Max() const {
   NoVariantMatched();
 }
 
+size_t RowMap::memory_usage() const {
+  if (std::get_if<Range>(&data_)) {
+    return 0;
+  }
+  if (const auto* bv = std::get_if<BitVector>(&data_)) {
+    return bv->memory_usage();
+  }
+  if (const auto* vec = std::get_if<IndexVector>(&data_)) {
+    return vec->capacity() * sizeof(OutputIndex);
+  }
+  NoVariantMatched();
+}
+
 RowMap RowMap::SelectRowsSlow(const RowMap& selector) const {
   return std::visit(
       [](const auto& def, const auto& selector_def) {
@@ -18,6 +18,7 @@
 #define SRC_TRACE_PROCESSOR_CONTAINERS_ROW_MAP_H_
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
 #include <iterator>
 #include <numeric>
@@ -421,6 +422,9 @@ class RowMap {
   // Returns the iterator over the rows in this RowMap.
   Iterator IterateRows() const { return Iterator(this); }
 
+  // Returns the number of bytes of memory used by the RowMap.
+  size_t memory_usage() const;
+
   // Returns if the RowMap is internally represented using a range.
   bool IsRange() const { return std::holds_alternative<Range>(data_); }
 
@@ -42,6 +42,18 @@ StringPool::~StringPool() = default;
 StringPool::StringPool(StringPool&&) noexcept = default;
 StringPool& StringPool::operator=(StringPool&&) noexcept = default;
 
+std::vector<StringPool::Id> StringPool::Merge(const Staging& staging) {
+  std::vector<Id> ids;
+  ids.reserve(staging.size());
+  ids.push_back(Id::Null());
+  for (size_t i = 1; i < staging.entries_.size(); ++i) {
+    const Staging::Entry& entry = staging.entries_[i];
+    base::StringView str(staging.data_.data() + entry.offset, entry.size);
+    ids.push_back(InternStringWithHash(str, entry.hash));
+  }
+  return ids;
+}
+
 StringPool::Id StringPool::InsertString(base::StringView str, uint64_t hash) {
   // Try and find enough space in the current block for the string and the
   // metadata (varint-encoded size + the string data + the null terminator).
@@ -88,6 +100,21 @@ StringPool::Id StringPool::InsertLargeString(base::StringView str,
   return string_id;
 }
 
+StringPool::MemoryUsage StringPool::GetMemoryUsage() const {
+  MemoryUsage usage;
+  usage.index = string_index_.capacity() * (sizeof(StringHash) + sizeof(Id));
+  for (const Block& block : blocks_)
+    usage.small_strings += block.pos();
+  for (const auto& str : large_strings_)
+    usage.large_strings += str->capacity();
+  return usage;
+}
+
+size_t StringPool::memory_usage() const {
+  MemoryUsage usage = GetMemoryUsage();
+  return usage.small_strings + usage.large_strings + usage.index;
+}
+
 std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
     base::StringView str) {
   auto str_size = str.size();
@@ -120,6 +147,27 @@ std::pair<bool /*success*/, uint32_t /*offset*/> StringPool::Block::TryInsert(
   return std::make_pair(true, offset);
 }
 
+StringPool::Staging::Staging() {
+  // Reserve the LocalId of the null string.
+  entries_.push_back(Entry{0, 0, 0});
+}
+
+StringPool::Staging::~Staging() = default;
+
+StringPool::Staging::Staging(Staging&&) noexcept = default;
+StringPool::Staging& StringPool::Staging::operator=(Staging&&) noexcept =
+    default;
+
+StringPool::Staging::LocalId StringPool::Staging::AddString(
+    base::StringView str,
+    uint64_t hash) {
+  PERFETTO_CHECK(entries_.size() < std::numeric_limits<LocalId>::max());
+  auto id = static_cast<LocalId>(entries_.size());
+  entries_.push_back(Entry{hash, data_.size(), str.size()});
+  data_.insert(data_.end(), str.data(), str.data() + str.size());
+  return id;
+}
+
 StringPool::Iterator::Iterator(const StringPool* pool) : pool_(pool) {}
 
 StringPool::Iterator& StringPool::Iterator::operator++() {
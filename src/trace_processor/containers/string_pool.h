@@ -103,6 +103,88 @@ class StringPool {
     uint32_t large_strings_index_ = 0;
   };
 
+  // Collects strings to be interned in a StringPool without accessing the pool
+  // itself. The pool is not thread-safe: threads other than the one owning the
+  // pool can intern strings into their own Staging (hashing and de-duplicating
+  // them) and the owning thread then merges each Staging into the pool using
+  // |StringPool::Merge|, which returns the final Ids.
+  //
+  // As the pool is still only written by one thread, Ids and
+  // |MaxSmallStringId| are exactly the same as if the strings of each Staging
+  // were interned directly, in Merge order.
+  class Staging {
+   public:
+    // Index of a string in the Staging. Converted to an Id using the vector
+    // returned by Merge.
+    using LocalId = uint32_t;
+
+    // The LocalId of the null string.
+    static constexpr LocalId kNullLocalId = 0;
+
+    Staging();
+    ~Staging();
+
+    // Allow std::move().
+    Staging(Staging&&) noexcept;
+    Staging& operator=(Staging&&) noexcept;
+
+    // Disable implicit copy.
+    Staging(const Staging&) = delete;
+    Staging& operator=(const Staging&) = delete;
+
+    LocalId InternString(base::StringView str) {
+      if (str.data() == nullptr)
+        return kNullLocalId;
+
+      auto hash = str.Hash();
+      auto it_and_inserted = index_.Insert(hash, kNullLocalId);
+      LocalId* id = it_and_inserted.first;
+      if (!it_and_inserted.second) {
+        PERFETTO_DCHECK(Get(*id) == str);
+        return *id;
+      }
+      *id = AddString(str, hash);
+      return *id;
+    }
+
+    base::StringView Get(LocalId id) const {
+      if (id == kNullLocalId)
+        return base::StringView();
+      const Entry& entry = entries_[id];
+      if (entry.size == 0)
+        return base::StringView("", 0);
+      return base::StringView(data_.data() + entry.offset, entry.size);
+    }
+
+    // The number of LocalIds handed out so far, including the null one.
+    size_t size() const { return entries_.size(); }
+
+   private:
+    friend class StringPool;
+
+    struct Entry {
+      uint64_t hash;
+      size_t offset;
+      size_t size;
+    };
+
+    LocalId AddString(base::StringView, uint64_t hash);
+
+    // The contents of all the strings, one after the other.
+    std::vector<char> data_;
+
+    // Indexed by LocalId. |entries_[kNullLocalId]| is a placeholder for the
+    // null string.
+    std::vector<Entry> entries_;
+
+    base::FlatHashMap<uint64_t,
+                      LocalId,
+                      base::AlreadyHashed<uint64_t>,
+                      base::LinearProbe,
+                      /*AppendOnly=*/true>
+        index_{/*initial_capacity=*/4096u};
+  };
+
   StringPool();
   ~StringPool();
 
@@ -117,21 +199,14 @@ class StringPool {
   Id InternString(base::StringView str) {
     if (str.data() == nullptr)
       return Id::Null();
-
-    auto hash = str.Hash();
-
-    // Perform a hashtable insertion with a null ID just to check if the string
-    // is already inserted. If it's not, overwrite 0 with the actual Id.
-    auto it_and_inserted = string_index_.Insert(hash, Id());
-    Id* id = it_and_inserted.first;
-    if (!it_and_inserted.second) {
-      PERFETTO_DCHECK(Get(*id) == str);
-      return *id;
-    }
-    *id = InsertString(str, hash);
-    return *id;
+    return InternStringWithHash(str, str.Hash());
   }
 
+  // Interns all the strings of |staging| (see Staging) in the pool, in the
+  // order they were added to |staging|. Returns the Id of each string, indexed
+  // by Staging::LocalId.
+  std::vector<Id> Merge(const Staging& staging);
+
   std::optional<Id> GetId(base::StringView str) const {
     if (str.data() == nullptr)
       return Id::Null();
@@ -165,13 +240,29 @@ class StringPool {
   // Returns whether there is at least one large string in a string pool
   bool HasLargeString() const { return !large_strings_.empty(); }
 
+  // Breakdown of the bytes used by the pool.
+  struct MemoryUsage {
+    // Bytes used by strings stored in the blocks.
+    size_t small_strings = 0;
+    // Bytes used by strings too large to fit in a block.
+    size_t large_strings = 0;
+    // Bytes used by the index used to deduplicate strings.
+    size_t index = 0;
+  };
+  MemoryUsage GetMemoryUsage() const;
+
+  // Returns an estimate of the number of bytes used by the strings in the
+  // pool and by the index used to deduplicate them.
+  size_t memory_usage() const;
+
  private:
   using StringHash = uint64_t;
 
   struct Block {
     explicit Block(size_t size)
-        : mem_(base::PagedMemory::Allocate(size,
-                                           base::PagedMemory::kDontCommit)),
+        : mem_(base::PagedMemory::Allocate(
+              size, base::PagedMemory::kDontCommit |
+                        base::PagedMemory::kHugePages)),
           size_(size) {}
     ~Block() = default;
 
@@ -238,6 +329,19 @@ class StringPool {
   // plus 1 byte for null terminator. The actual size may be lower.
   static constexpr uint8_t kMaxMetadataSize = 6;
 
+  Id InternStringWithHash(base::StringView str, uint64_t hash) {
+    // Perform a hashtable insertion with a null ID just to check if the string
+    // is already inserted. If it's not, overwrite 0 with the actual Id.
+    auto it_and_inserted = string_index_.Insert(hash, Id());
+    Id* id = it_and_inserted.first;
+    if (!it_and_inserted.second) {
+      PERFETTO_DCHECK(Get(*id) == str);
+      return *id;
+    }
+    *id = InsertString(str, hash);
+    return *id;
+  }
+
   // Inserts the string with the given hash into the pool and return its Id.
   Id InsertString(base::StringView, uint64_t hash);
 
@@ -0,0 +1,105 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/containers/string_pool.h"
+
+namespace {
+
+using perfetto::base::StringView;
+using perfetto::trace_processor::StringPool;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// Returns a list of strings with many duplicates, like the names of slices or
+// the args of a trace.
+const std::vector<std::string>& GetStrings() {
+  static const std::vector<std::string>* strings = [] {
+    size_t count = IsBenchmarkFunctionalOnly() ? 1024 : 1024 * 1024;
+    std::minstd_rand0 rnd(42);
+    auto* res = new std::vector<std::string>();
+    for (size_t i = 0; i < count; ++i) {
+      res->emplace_back("string_with_a_common_prefix_" +
+                        std::to_string(rnd() % (count / 16)));
+    }
+    return res;
+  }();
+  return *strings;
+}
+
+void StagedArgs(benchmark::internal::Benchmark* b) {
+  b->Arg(1);
+  if (!IsBenchmarkFunctionalOnly()) {
+    b->Arg(2);
+    b->Arg(4);
+    b->Arg(8);
+  }
+}
+
+}  // namespace
+
+static void BM_StringPoolInternDirect(benchmark::State& state) {
+  const std::vector<std::string>& strings = GetStrings();
+  for (auto _ : state) {
+    StringPool pool;
+    for (const std::string& str : strings)
+      benchmark::DoNotOptimize(pool.InternString(StringView(str)));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(strings.size()));
+}
+BENCHMARK(BM_StringPoolInternDirect)->UseRealTime();
+
+// Each of the N threads interns a slice of the strings in its own Staging,
+// then the stagings are merged in the pool on the calling thread.
+static void BM_StringPoolInternStaged(benchmark::State& state) {
+  const std::vector<std::string>& strings = GetStrings();
+  auto thread_count = static_cast<size_t>(state.range(0));
+  size_t slice = (strings.size() + thread_count - 1) / thread_count;
+  for (auto _ : state) {
+    std::vector<StringPool::Staging> stagings(thread_count);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < thread_count; ++t) {
+      threads.emplace_back([&strings, &stagings, slice, t] {
+        size_t end = std::min(strings.size(), (t + 1) * slice);
+        for (size_t i = t * slice; i < end; ++i) {
+          benchmark::DoNotOptimize(
+              stagings[t].InternString(StringView(strings[i])));
+        }
+      });
+    }
+    for (std::thread& thread : threads)
+      thread.join();
+
+    StringPool pool;
+    for (const StringPool::Staging& staging : stagings)
+      benchmark::DoNotOptimize(pool.Merge(staging));
+  }
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(strings.size()));
+}
+BENCHMARK(BM_StringPoolInternStaged)->Apply(StagedArgs)->UseRealTime();
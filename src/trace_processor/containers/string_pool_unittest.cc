@@ -17,7 +17,11 @@
 #include "src/trace_processor/containers/string_pool.h"
 
 #include <array>
+#include <cstring>
 #include <random>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "test/gtest_and_gmock.h"
 
@@ -197,6 +201,85 @@ TEST_F(StringPoolTest, BigString) {
   }
 }
 
+TEST_F(StringPoolTest, StagingMergeMatchesDirectInterning) {
+  StringPool staged_pool;
+  StringPool::Staging staging;
+  std::vector<std::string> strings = {"foo", "", "bar", "foo", "baz", "bar"};
+  std::vector<StringPool::Staging::LocalId> local_ids;
+  for (const std::string& str : strings)
+    local_ids.push_back(staging.InternString(base::StringView(str)));
+  ASSERT_EQ(staging.InternString(NullTermStringView()),
+            StringPool::Staging::kNullLocalId);
+
+  // Duplicates are removed in the staging already.
+  ASSERT_EQ(local_ids[0], local_ids[3]);
+  ASSERT_EQ(local_ids[2], local_ids[5]);
+  ASSERT_EQ(staging.size(), 5u);
+  ASSERT_EQ(staging.Get(local_ids[1]), "");
+  ASSERT_NE(staging.Get(local_ids[1]).data(), nullptr);
+
+  staged_pool.InternString("bar");
+  pool_.InternString("bar");
+  std::vector<StringPool::Id> ids = staged_pool.Merge(staging);
+  ASSERT_EQ(ids.size(), staging.size());
+  ASSERT_TRUE(ids[StringPool::Staging::kNullLocalId].is_null());
+
+  for (size_t i = 0; i < strings.size(); ++i) {
+    StringPool::Id id = ids[local_ids[i]];
+    ASSERT_EQ(staged_pool.Get(id), base::StringView(strings[i]));
+    ASSERT_EQ(id, pool_.InternString(base::StringView(strings[i])));
+  }
+  ASSERT_EQ(staged_pool.size(), pool_.size());
+  ASSERT_EQ(staged_pool.MaxSmallStringId(), pool_.MaxSmallStringId());
+}
+
+TEST_F(StringPoolTest, StagingFromMultipleThreads) {
+  constexpr uint32_t kThreads = 4;
+  constexpr uint32_t kStringsPerThread = 10000;
+
+  // Each thread interns some strings shared with all the other threads and
+  // some of its own.
+  std::vector<StringPool::Staging> stagings(kThreads);
+  std::vector<std::vector<StringPool::Staging::LocalId>> local_ids(kThreads);
+  std::vector<std::thread> threads;
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([t, &stagings, &local_ids] {
+      for (uint32_t i = 0; i < kStringsPerThread; ++i) {
+        std::string str = i % 2 ? "shared_" + std::to_string(i % 100)
+                                : std::to_string(t) + "_" + std::to_string(i);
+        local_ids[t].push_back(stagings[t].InternString(base::StringView(str)));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  for (uint32_t t = 0; t < kThreads; ++t) {
+    std::vector<StringPool::Id> ids = pool_.Merge(stagings[t]);
+    for (uint32_t i = 0; i < kStringsPerThread; ++i) {
+      StringPool::Staging::LocalId local_id = local_ids[t][i];
+      ASSERT_EQ(pool_.Get(ids[local_id]), stagings[t].Get(local_id));
+    }
+  }
+  ASSERT_EQ(pool_.size(), kThreads * kStringsPerThread / 2 + 50);
+}
+
+TEST_F(StringPoolTest, MemoryUsageBreakdown) {
+  StringPool::MemoryUsage before = pool_.GetMemoryUsage();
+  ASSERT_EQ(before.large_strings, 0u);
+
+  pool_.InternString("small");
+  // Too large to fit in a block.
+  std::string large(kBlockSizeBytes, 'a');
+  pool_.InternString(base::StringView(large));
+
+  StringPool::MemoryUsage after = pool_.GetMemoryUsage();
+  ASSERT_GT(after.small_strings, before.small_strings + strlen("small"));
+  ASSERT_GE(after.large_strings, large.size());
+  ASSERT_EQ(pool_.memory_usage(),
+            after.small_strings + after.large_strings + after.index);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
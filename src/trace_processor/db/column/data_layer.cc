@@ -169,14 +169,18 @@ NumericStorageBase::~NumericStorageBase() = default;
 
 template <typename T>
 std::unique_ptr<DataLayerChain> NumericStorage<T>::MakeChain() {
-  return std::make_unique<ChainImpl>(vector_, storage_type_, is_sorted_);
+  return std::make_unique<ChainImpl>(vector_, storage_type_, is_sorted_,
+                                     zone_map_);
 }
 
 template <typename T>
 NumericStorage<T>::NumericStorage(const std::vector<T>* vec,
                                   ColumnType type,
-                                  bool is_sorted)
-    : NumericStorageBase(type, is_sorted, GetImpl()), vector_(vec) {}
+                                  bool is_sorted,
+                                  const ZoneMap<T>* zone_map)
+    : NumericStorageBase(type, is_sorted, GetImpl()),
+      vector_(vec),
+      zone_map_(zone_map) {}
 
 // Define explicit instantiation of the necessary templates here to reduce
 // binary size bloat.
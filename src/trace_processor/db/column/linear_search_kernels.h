@@ -0,0 +1,353 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_LINEAR_SEARCH_KERNELS_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_LINEAR_SEARCH_KERNELS_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/types.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#define PERFETTO_TP_LINEAR_SEARCH_AVX2() 1
+#else
+#define PERFETTO_TP_LINEAR_SEARCH_AVX2() 0
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ARCH_CPU_ARM64) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PERFETTO_TP_LINEAR_SEARCH_NEON() 1
+#else
+#define PERFETTO_TP_LINEAR_SEARCH_NEON() 0
+#endif
+
+// Kernels comparing a word (i.e. BitVector::kBitsInWord elements) of a
+// numeric column with a value and returning the result as a BitVector word.
+//
+// Explicit AVX2 (if PERFETTO_X64_CPU_OPT is enabled) and NEON (on arm64)
+// versions are provided for int32, uint32, int64 and double columns: the
+// compiler does not reliably vectorize the scalar loop as it has to pack the
+// comparison results into a single word.
+namespace perfetto::trace_processor::column::kernels {
+
+// Returns the result of comparing |a| with |b| using |op|. Matches the
+// semantics of the std:: comparators (in particular, for NaN doubles, only
+// kNe is true).
+template <FilterOp op, typename T>
+PERFETTO_ALWAYS_INLINE bool Compare(T a, T b) {
+  if constexpr (op == FilterOp::kEq) {
+    return a == b;
+  } else if constexpr (op == FilterOp::kNe) {
+    return a != b;
+  } else if constexpr (op == FilterOp::kLt) {
+    return a < b;
+  } else if constexpr (op == FilterOp::kLe) {
+    return a <= b;
+  } else if constexpr (op == FilterOp::kGt) {
+    return a > b;
+  } else if constexpr (op == FilterOp::kGe) {
+    return a >= b;
+  } else {
+    static_assert(op == FilterOp::kEq, "Unsupported FilterOp");
+  }
+}
+
+// Returns a word with bit k set iff Compare<op>(data[k], val) for k in
+// [0, BitVector::kBitsInWord).
+template <FilterOp op, typename T>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordScalar(const T* data, T val) {
+  uint64_t word = 0;
+  for (uint32_t k = 0; k < BitVector::kBitsInWord; ++k) {
+    word |= static_cast<uint64_t>(Compare<op>(data[k], val)) << k;
+  }
+  return word;
+}
+
+namespace internal {
+
+#if PERFETTO_TP_LINEAR_SEARCH_AVX2()
+
+// For integers, only ==, > and < are available as instructions: the other
+// operations are computed as the negation of one of those.
+template <FilterOp op>
+constexpr bool IsNegatedIntOp() {
+  return op == FilterOp::kNe || op == FilterOp::kLe || op == FilterOp::kGe;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE __m256i CompareInt32Avx2(__m256i d, __m256i v) {
+  if constexpr (op == FilterOp::kEq || op == FilterOp::kNe) {
+    return _mm256_cmpeq_epi32(d, v);
+  } else if constexpr (op == FilterOp::kGt || op == FilterOp::kLe) {
+    return _mm256_cmpgt_epi32(d, v);
+  } else {
+    return _mm256_cmpgt_epi32(v, d);
+  }
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordAvx2(const int32_t* data,
+                                                int32_t val) {
+  const __m256i v = _mm256_set1_epi32(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 8) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i m = CompareInt32Avx2<op>(d, v);
+    auto bits =
+        static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+    word |= static_cast<uint64_t>(bits) << i;
+  }
+  return IsNegatedIntOp<op>() ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordAvx2(const uint32_t* data,
+                                                uint32_t val) {
+  // AVX2 has no unsigned comparison: flipping the sign bit of both sides maps
+  // the unsigned order onto the signed one.
+  const __m256i bias = _mm256_set1_epi32(std::numeric_limits<int32_t>::min());
+  const __m256i v =
+      _mm256_xor_si256(_mm256_set1_epi32(static_cast<int32_t>(val)), bias);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 8) {
+    __m256i d = _mm256_xor_si256(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), bias);
+    __m256i m = CompareInt32Avx2<op>(d, v);
+    auto bits =
+        static_cast<uint32_t>(_mm256_movemask_ps(_mm256_castsi256_ps(m)));
+    word |= static_cast<uint64_t>(bits) << i;
+  }
+  return IsNegatedIntOp<op>() ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordAvx2(const int64_t* data,
+                                                int64_t val) {
+  const __m256i v = _mm256_set1_epi64x(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i m;
+    if constexpr (op == FilterOp::kEq || op == FilterOp::kNe) {
+      m = _mm256_cmpeq_epi64(d, v);
+    } else if constexpr (op == FilterOp::kGt || op == FilterOp::kLe) {
+      m = _mm256_cmpgt_epi64(d, v);
+    } else {
+      m = _mm256_cmpgt_epi64(v, d);
+    }
+    auto bits =
+        static_cast<uint32_t>(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+    word |= static_cast<uint64_t>(bits) << i;
+  }
+  return IsNegatedIntOp<op>() ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordAvx2(const double* data,
+                                                double val) {
+  // Negating is not correct for NaNs so each operation uses its own
+  // predicate: all are ordered (i.e. false for NaN) apart from != which is
+  // unordered (i.e. true for NaN).
+  const __m256d v = _mm256_set1_pd(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 4) {
+    __m256d d = _mm256_loadu_pd(data + i);
+    __m256d m;
+    if constexpr (op == FilterOp::kEq) {
+      m = _mm256_cmp_pd(d, v, _CMP_EQ_OQ);
+    } else if constexpr (op == FilterOp::kNe) {
+      m = _mm256_cmp_pd(d, v, _CMP_NEQ_UQ);
+    } else if constexpr (op == FilterOp::kLt) {
+      m = _mm256_cmp_pd(d, v, _CMP_LT_OQ);
+    } else if constexpr (op == FilterOp::kLe) {
+      m = _mm256_cmp_pd(d, v, _CMP_LE_OQ);
+    } else if constexpr (op == FilterOp::kGt) {
+      m = _mm256_cmp_pd(d, v, _CMP_GT_OQ);
+    } else {
+      m = _mm256_cmp_pd(d, v, _CMP_GE_OQ);
+    }
+    auto bits = static_cast<uint32_t>(_mm256_movemask_pd(m));
+    word |= static_cast<uint64_t>(bits) << i;
+  }
+  return word;
+}
+
+#endif  // PERFETTO_TP_LINEAR_SEARCH_AVX2()
+
+#if PERFETTO_TP_LINEAR_SEARCH_NEON()
+
+// NEON has instructions for all the comparisons but kNe, which is computed as
+// the negation of kEq (this is also correct for NaNs).
+#define PERFETTO_TP_DEFINE_COMPARE_NEON(vector_type, suffix)                 \
+  template <FilterOp op>                                                    \
+  PERFETTO_ALWAYS_INLINE auto CompareNeon(vector_type d, vector_type v) {   \
+    if constexpr (op == FilterOp::kEq || op == FilterOp::kNe) {             \
+      return vceqq_##suffix(d, v);                                          \
+    } else if constexpr (op == FilterOp::kLt) {                             \
+      return vcltq_##suffix(d, v);                                          \
+    } else if constexpr (op == FilterOp::kLe) {                             \
+      return vcleq_##suffix(d, v);                                          \
+    } else if constexpr (op == FilterOp::kGt) {                             \
+      return vcgtq_##suffix(d, v);                                          \
+    } else {                                                                \
+      return vcgeq_##suffix(d, v);                                          \
+    }                                                                       \
+  }
+PERFETTO_TP_DEFINE_COMPARE_NEON(int32x4_t, s32)
+PERFETTO_TP_DEFINE_COMPARE_NEON(uint32x4_t, u32)
+PERFETTO_TP_DEFINE_COMPARE_NEON(int64x2_t, s64)
+PERFETTO_TP_DEFINE_COMPARE_NEON(float64x2_t, f64)
+#undef PERFETTO_TP_DEFINE_COMPARE_NEON
+
+// Packs the lanes of a 4 x 32-bit comparison mask into the low 4 bits.
+PERFETTO_ALWAYS_INLINE uint64_t PackNeon(uint32x4_t m) {
+  static constexpr uint32_t kLaneBits[] = {1, 2, 4, 8};
+  return vaddvq_u32(vandq_u32(m, vld1q_u32(kLaneBits)));
+}
+
+// Packs the lanes of a 2 x 64-bit comparison mask into the low 2 bits.
+PERFETTO_ALWAYS_INLINE uint64_t PackNeon(uint64x2_t m) {
+  static constexpr uint64_t kLaneBits[] = {1, 2};
+  return vaddvq_u64(vandq_u64(m, vld1q_u64(kLaneBits)));
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordNeon(const int32_t* data,
+                                                int32_t val) {
+  const int32x4_t v = vdupq_n_s32(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 4) {
+    word |= PackNeon(CompareNeon<op>(vld1q_s32(data + i), v)) << i;
+  }
+  return op == FilterOp::kNe ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordNeon(const uint32_t* data,
+                                                uint32_t val) {
+  const uint32x4_t v = vdupq_n_u32(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 4) {
+    word |= PackNeon(CompareNeon<op>(vld1q_u32(data + i), v)) << i;
+  }
+  return op == FilterOp::kNe ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordNeon(const int64_t* data,
+                                                int64_t val) {
+  const int64x2_t v = vdupq_n_s64(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 2) {
+    word |= PackNeon(CompareNeon<op>(vld1q_s64(data + i), v)) << i;
+  }
+  return op == FilterOp::kNe ? ~word : word;
+}
+
+template <FilterOp op>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWordNeon(const double* data,
+                                                double val) {
+  const float64x2_t v = vdupq_n_f64(val);
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord; i += 2) {
+    word |= PackNeon(CompareNeon<op>(vld1q_f64(data + i), v)) << i;
+  }
+  return op == FilterOp::kNe ? ~word : word;
+}
+
+#endif  // PERFETTO_TP_LINEAR_SEARCH_NEON()
+
+}  // namespace internal
+
+// Whether CompareWord() has an explicitly vectorized implementation for |T|
+// in this build.
+template <typename T>
+constexpr bool HasSimdCompareWord() {
+#if PERFETTO_TP_LINEAR_SEARCH_AVX2() || PERFETTO_TP_LINEAR_SEARCH_NEON()
+  return std::is_same_v<T, int32_t> || std::is_same_v<T, uint32_t> ||
+         std::is_same_v<T, int64_t> || std::is_same_v<T, double>;
+#else
+  return false;
+#endif
+}
+
+// Same as CompareWordScalar() but vectorized when possible. |data| does not
+// need to be aligned.
+template <FilterOp op, typename T>
+PERFETTO_ALWAYS_INLINE uint64_t CompareWord(const T* data, T val) {
+  if constexpr (HasSimdCompareWord<T>()) {
+#if PERFETTO_TP_LINEAR_SEARCH_AVX2()
+    return internal::CompareWordAvx2<op>(data, val);
+#elif PERFETTO_TP_LINEAR_SEARCH_NEON()
+    return internal::CompareWordNeon<op>(data, val);
+#endif
+  } else {
+    return CompareWordScalar<op>(data, val);
+  }
+}
+
+// Appends the result of comparing each of the |count| first elements of
+// |data| with |val| using |op| to |builder|.
+template <FilterOp op, typename T>
+void LinearSearch(T val,
+                  const T* data,
+                  uint32_t count,
+                  BitVector::Builder& builder) {
+  PERFETTO_DCHECK(count <= builder.BitsUntilFull());
+  const T* cur_val = data;
+  const T* end = data + count;
+
+  // Slow path: we compare <64 elements and append to get us to a word
+  // boundary.
+  uint32_t front_elements =
+      std::min(count, builder.BitsUntilWordBoundaryOrFull());
+  for (uint32_t i = 0; i < front_elements; ++i, ++cur_val) {
+    builder.Append(Compare<op>(*cur_val, val));
+  }
+
+  // Fast path: we compare as many groups of 64 elements as we can.
+  auto remaining = static_cast<uint32_t>(end - cur_val);
+  uint32_t fast_path_elements =
+      remaining / BitVector::kBitsInWord * BitVector::kBitsInWord;
+  for (uint32_t i = 0; i < fast_path_elements; i += BitVector::kBitsInWord) {
+    builder.AppendWord(CompareWord<op>(cur_val, val));
+    cur_val += BitVector::kBitsInWord;
+  }
+
+  // Slow path: we compare <64 elements and append the remaining ones.
+  for (; cur_val != end; ++cur_val) {
+    builder.Append(Compare<op>(*cur_val, val));
+  }
+}
+
+// Appends the result of comparing each element of |data| with |val| using
+// |op| to |builder| until it is full.
+template <FilterOp op, typename T>
+void LinearSearch(T val, const T* data, BitVector::Builder& builder) {
+  LinearSearch<op>(val, data, builder.BitsUntilFull(), builder);
+}
+
+}  // namespace perfetto::trace_processor::column::kernels
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_LINEAR_SEARCH_KERNELS_H_
@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/trace_processor/db/column/linear_search_kernels.h"
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/types.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::column::kernels {
+namespace {
+
+// Returns 64 * 4 + 13 values mixing random values, |val| itself and the
+// extremes of |T| so that all the comparison outcomes are exercised.
+template <typename T>
+std::vector<T> MakeData(T val) {
+  std::minstd_rand0 rnd(42);
+  std::vector<T> data;
+  for (uint32_t i = 0; i < BitVector::kBitsInWord * 4 + 13; ++i) {
+    switch (rnd() % 6) {
+      case 0:
+        data.push_back(val);
+        break;
+      case 1:
+        data.push_back(std::numeric_limits<T>::max());
+        break;
+      case 2:
+        data.push_back(std::numeric_limits<T>::lowest());
+        break;
+      default:
+        data.push_back(static_cast<T>(rnd()) - static_cast<T>(rnd()));
+        break;
+    }
+  }
+  return data;
+}
+
+template <FilterOp op, typename T>
+void CheckOp(const std::vector<T>& data, T val) {
+  for (uint32_t i = 0; i + BitVector::kBitsInWord <= data.size();
+       i += BitVector::kBitsInWord) {
+    ASSERT_EQ(CompareWord<op>(data.data() + i, val),
+              CompareWordScalar<op>(data.data() + i, val));
+  }
+
+  // Start at an unaligned offset so both slow paths are used.
+  const uint32_t offset = 5;
+  auto size = static_cast<uint32_t>(data.size());
+  BitVector::Builder builder(size, offset);
+  LinearSearch<op>(val, data.data() + offset, builder);
+  BitVector bv = std::move(builder).Build();
+  ASSERT_EQ(bv.size(), size);
+  for (uint32_t i = 0; i < offset; ++i) {
+    ASSERT_FALSE(bv.IsSet(i));
+  }
+  for (uint32_t i = offset; i < size; ++i) {
+    ASSERT_EQ(bv.IsSet(i), Compare<op>(data[i], val)) << i;
+  }
+}
+
+template <typename T>
+void CheckAllOps(T val) {
+  std::vector<T> data = MakeData(val);
+  CheckOp<FilterOp::kEq>(data, val);
+  CheckOp<FilterOp::kNe>(data, val);
+  CheckOp<FilterOp::kLt>(data, val);
+  CheckOp<FilterOp::kLe>(data, val);
+  CheckOp<FilterOp::kGt>(data, val);
+  CheckOp<FilterOp::kGe>(data, val);
+}
+
+TEST(LinearSearchKernels, Int32) {
+  CheckAllOps<int32_t>(0);
+  CheckAllOps<int32_t>(-12345);
+  CheckAllOps(std::numeric_limits<int32_t>::max());
+  CheckAllOps(std::numeric_limits<int32_t>::min());
+}
+
+TEST(LinearSearchKernels, Uint32) {
+  CheckAllOps<uint32_t>(0);
+  CheckAllOps<uint32_t>(12345);
+  // Values with the top bit set are negative when reinterpreted as signed.
+  CheckAllOps<uint32_t>(0x80000001u);
+  CheckAllOps(std::numeric_limits<uint32_t>::max());
+}
+
+TEST(LinearSearchKernels, Int64) {
+  CheckAllOps<int64_t>(0);
+  CheckAllOps<int64_t>(-(int64_t(1) << 40));
+  CheckAllOps(std::numeric_limits<int64_t>::max());
+  CheckAllOps(std::numeric_limits<int64_t>::min());
+}
+
+TEST(LinearSearchKernels, Double) {
+  CheckAllOps(0.0);
+  CheckAllOps(-1.5);
+  CheckAllOps(std::numeric_limits<double>::max());
+  CheckAllOps(std::numeric_limits<double>::infinity());
+}
+
+TEST(LinearSearchKernels, DoubleNaN) {
+  std::vector<double> data = MakeData(2.5);
+  for (uint32_t i = 0; i < data.size(); i += 3) {
+    data[i] = std::nan("");
+  }
+  CheckOp<FilterOp::kEq>(data, 2.5);
+  CheckOp<FilterOp::kNe>(data, 2.5);
+  CheckOp<FilterOp::kLt>(data, 2.5);
+  CheckOp<FilterOp::kLe>(data, 2.5);
+  CheckOp<FilterOp::kGt>(data, 2.5);
+  CheckOp<FilterOp::kGe>(data, 2.5);
+
+  // Only != is true when comparing with NaN.
+  ASSERT_EQ(CompareWord<FilterOp::kNe>(data.data(), std::nan("")),
+            ~uint64_t(0));
+  ASSERT_EQ(CompareWord<FilterOp::kGe>(data.data(), std::nan("")), 0u);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::column::kernels
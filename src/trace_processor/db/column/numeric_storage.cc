@@ -33,6 +33,7 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/db/column/data_layer.h"
+#include "src/trace_processor/db/column/linear_search_kernels.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
 #include "src/trace_processor/tp_metatrace.h"
@@ -194,27 +195,28 @@ uint32_t UpperBoundExtrinsic(const void* vector_ptr,
 template <typename T>
 void TypedLinearSearch(T typed_val,
                        const T* start,
+                       uint32_t count,
                        FilterOp op,
                        BitVector::Builder& builder) {
   switch (op) {
     case FilterOp::kEq:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::equal_to<T>(), builder);
+      return kernels::LinearSearch<FilterOp::kEq>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kNe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::not_equal_to<T>(), builder);
+      return kernels::LinearSearch<FilterOp::kNe>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kLe:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::less_equal<T>(), builder);
+      return kernels::LinearSearch<FilterOp::kLe>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kLt:
-      return utils::LinearSearchWithComparator(typed_val, start, std::less<T>(),
-                                               builder);
+      return kernels::LinearSearch<FilterOp::kLt>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kGt:
-      return utils::LinearSearchWithComparator(typed_val, start,
-                                               std::greater<T>(), builder);
+      return kernels::LinearSearch<FilterOp::kGt>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kGe:
-      return utils::LinearSearchWithComparator(
-          typed_val, start, std::greater_equal<T>(), builder);
+      return kernels::LinearSearch<FilterOp::kGe>(typed_val, start, count,
+                                                  builder);
     case FilterOp::kGlob:
     case FilterOp::kRegex:
     case FilterOp::kIsNotNull:
@@ -223,6 +225,89 @@ void TypedLinearSearch(T typed_val,
   }
 }
 
+// Whether none, some or all of the values of a zone match a constraint.
+enum class ZoneMatch { kNone, kSome, kAll };
+
+template <typename T>
+ZoneMatch MatchZone(FilterOp op,
+                    T val,
+                    const typename ZoneMap<T>::Zone& zone) {
+  if constexpr (std::is_floating_point_v<T>) {
+    if (std::isnan(val) || std::isnan(zone.min))
+      return ZoneMatch::kSome;
+  }
+  switch (op) {
+    case FilterOp::kEq:
+      if (val < zone.min || val > zone.max)
+        return ZoneMatch::kNone;
+      return zone.min == val && zone.max == val ? ZoneMatch::kAll
+                                                : ZoneMatch::kSome;
+    case FilterOp::kNe:
+      if (val < zone.min || val > zone.max)
+        return ZoneMatch::kAll;
+      return zone.min == val && zone.max == val ? ZoneMatch::kNone
+                                                : ZoneMatch::kSome;
+    case FilterOp::kLt:
+      if (zone.max < val)
+        return ZoneMatch::kAll;
+      return zone.min < val ? ZoneMatch::kSome : ZoneMatch::kNone;
+    case FilterOp::kLe:
+      if (zone.max <= val)
+        return ZoneMatch::kAll;
+      return zone.min <= val ? ZoneMatch::kSome : ZoneMatch::kNone;
+    case FilterOp::kGt:
+      if (zone.min > val)
+        return ZoneMatch::kAll;
+      return zone.max > val ? ZoneMatch::kSome : ZoneMatch::kNone;
+    case FilterOp::kGe:
+      if (zone.min >= val)
+        return ZoneMatch::kAll;
+      return zone.max >= val ? ZoneMatch::kSome : ZoneMatch::kNone;
+    case FilterOp::kGlob:
+    case FilterOp::kRegex:
+    case FilterOp::kIsNotNull:
+    case FilterOp::kIsNull:
+      break;
+  }
+  return ZoneMatch::kSome;
+}
+
+// Searches |range| of |data|, only reading the blocks of |zone_map| (if any)
+// which contain both matching and non-matching values.
+template <typename T>
+void TypedLinearSearchWithZoneMap(T typed_val,
+                                  const std::vector<T>& data,
+                                  const ZoneMap<T>* zone_map,
+                                  FilterOp op,
+                                  Range range,
+                                  BitVector::Builder& builder) {
+  if (!zone_map || zone_map->size() != data.size()) {
+    PERFETTO_DCHECK(!zone_map);
+    TypedLinearSearch(typed_val, data.data() + range.start, range.size(), op,
+                      builder);
+    return;
+  }
+  constexpr uint32_t kBlockSize = ZoneMap<T>::kBlockSize;
+  const auto& zones = zone_map->zones();
+  for (uint32_t start = range.start; start < range.end;) {
+    uint32_t block = start / kBlockSize;
+    uint32_t end = std::min((block + 1) * kBlockSize, range.end);
+    switch (MatchZone(op, typed_val, zones[block])) {
+      case ZoneMatch::kNone:
+        builder.AppendRepeated(false, end - start);
+        break;
+      case ZoneMatch::kAll:
+        builder.AppendRepeated(true, end - start);
+        break;
+      case ZoneMatch::kSome:
+        TypedLinearSearch(typed_val, data.data() + start, end - start, op,
+                          builder);
+        break;
+    }
+    start = end;
+  }
+}
+
 SearchValidationResult IntColumnWithDouble(FilterOp op, SqlValue* sql_val) {
   double double_val = sql_val->AsDouble();
 
@@ -300,8 +385,41 @@ SearchValidationResult DoubleColumnWithInt(FilterOp op, SqlValue* sql_val) {
 
 NumericStorageBase::ChainImpl::ChainImpl(const void* vector_ptr,
                                          ColumnType type,
-                                         bool is_sorted)
-    : vector_ptr_(vector_ptr), storage_type_(type), is_sorted_(is_sorted) {}
+                                         bool is_sorted,
+                                         const void* zone_map_ptr)
+    : vector_ptr_(vector_ptr),
+      storage_type_(type),
+      is_sorted_(is_sorted),
+      zone_map_ptr_(zone_map_ptr) {}
+
+std::string NumericStorageBase::ChainImpl::DebugString() const {
+  if (!zone_map_ptr_)
+    return "NumericStorage";
+  uint32_t zones = 0;
+  switch (storage_type_) {
+    case ColumnType::kInt64:
+      zones = static_cast<uint32_t>(
+          static_cast<const ZoneMap<int64_t>*>(zone_map_ptr_)->zones().size());
+      break;
+    case ColumnType::kInt32:
+      zones = static_cast<uint32_t>(
+          static_cast<const ZoneMap<int32_t>*>(zone_map_ptr_)->zones().size());
+      break;
+    case ColumnType::kUint32:
+      zones = static_cast<uint32_t>(
+          static_cast<const ZoneMap<uint32_t>*>(zone_map_ptr_)->zones().size());
+      break;
+    case ColumnType::kDouble:
+      zones = static_cast<uint32_t>(
+          static_cast<const ZoneMap<double>*>(zone_map_ptr_)->zones().size());
+      break;
+    case ColumnType::kString:
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      PERFETTO_FATAL("Invalid type");
+  }
+  return "NumericStorage(zone map: " + std::to_string(zones) + " blocks)";
+}
 
 SearchValidationResult NumericStorageBase::ChainImpl::ValidateSearchConstraints(
     FilterOp op,
@@ -583,25 +701,25 @@ BitVector NumericStorageBase::ChainImpl::LinearSearchInternal(
     Range range) const {
   BitVector::Builder builder(range.end, range.start);
   if (const auto* u32 = std::get_if<uint32_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<uint32_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*u32, start, op, builder);
+    TypedLinearSearchWithZoneMap(
+        *u32, *static_cast<const std::vector<uint32_t>*>(vector_ptr_),
+        static_cast<const ZoneMap<uint32_t>*>(zone_map_ptr_), op, range,
+        builder);
   } else if (const auto* i64 = std::get_if<int64_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<int64_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*i64, start, op, builder);
+    TypedLinearSearchWithZoneMap(
+        *i64, *static_cast<const std::vector<int64_t>*>(vector_ptr_),
+        static_cast<const ZoneMap<int64_t>*>(zone_map_ptr_), op, range,
+        builder);
   } else if (const auto* i32 = std::get_if<int32_t>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<int32_t>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*i32, start, op, builder);
+    TypedLinearSearchWithZoneMap(
+        *i32, *static_cast<const std::vector<int32_t>*>(vector_ptr_),
+        static_cast<const ZoneMap<int32_t>*>(zone_map_ptr_), op, range,
+        builder);
   } else if (const auto* db = std::get_if<double>(&val)) {
-    const auto* start =
-        static_cast<const std::vector<double>*>(vector_ptr_)->data() +
-        range.start;
-    TypedLinearSearch(*db, start, op, builder);
+    TypedLinearSearchWithZoneMap(
+        *db, *static_cast<const std::vector<double>*>(vector_ptr_),
+        static_cast<const ZoneMap<double>*>(zone_map_ptr_), op, range,
+        builder);
   } else {
     PERFETTO_DFATAL("Invalid");
   }
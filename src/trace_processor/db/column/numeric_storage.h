@@ -34,6 +34,7 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
+#include "src/trace_processor/db/column/zone_map.h"
 
 namespace perfetto::trace_processor::column {
 
@@ -55,10 +56,13 @@ class NumericStorageBase : public DataLayer {
 
     void Serialize(StorageProto*) const override;
 
-    std::string DebugString() const override { return "NumericStorage"; }
+    std::string DebugString() const override;
 
    protected:
-    ChainImpl(const void* vector_ptr, ColumnType type, bool is_sorted);
+    ChainImpl(const void* vector_ptr,
+              ColumnType type,
+              bool is_sorted,
+              const void* zone_map_ptr);
 
    private:
     // All viable numeric values for ColumnTypes.
@@ -73,6 +77,7 @@ class NumericStorageBase : public DataLayer {
     const void* vector_ptr_ = nullptr;
     const ColumnType storage_type_ = ColumnType::kDummy;
     const bool is_sorted_ = false;
+    const void* zone_map_ptr_ = nullptr;
   };
 
   NumericStorageBase(ColumnType type, bool is_sorted, Impl impl);
@@ -86,9 +91,12 @@ class NumericStorageBase : public DataLayer {
 template <typename T>
 class NumericStorage final : public NumericStorageBase {
  public:
+  // If |zone_map| is not null, it should be kept up to date with |vec| and is
+  // used to skip blocks of |vec| in linear searches.
   PERFETTO_NO_INLINE NumericStorage(const std::vector<T>* vec,
                                     ColumnType type,
-                                    bool is_sorted);
+                                    bool is_sorted,
+                                    const ZoneMap<T>* zone_map = nullptr);
 
   // The implementation of this function is given by
   // make_chain.cc/make_chain_minimal.cc depending on whether this is a minimal
@@ -98,8 +106,11 @@ class NumericStorage final : public NumericStorageBase {
  private:
   class ChainImpl : public NumericStorageBase::ChainImpl {
    public:
-    ChainImpl(const std::vector<T>* vector, ColumnType type, bool is_sorted)
-        : NumericStorageBase::ChainImpl(vector, type, is_sorted),
+    ChainImpl(const std::vector<T>* vector,
+              ColumnType type,
+              bool is_sorted,
+              const ZoneMap<T>* zone_map)
+        : NumericStorageBase::ChainImpl(vector, type, is_sorted, zone_map),
           vector_(vector) {}
 
     SingleSearchResult SingleSearch(FilterOp op,
@@ -189,6 +200,7 @@ class NumericStorage final : public NumericStorageBase {
   }
 
   const std::vector<T>* vector_;
+  const ZoneMap<T>* zone_map_;
 };
 
 // Define external templates to reduce binary size bloat.
@@ -27,6 +27,8 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/column/utils.h"
+#include "src/trace_processor/db/column/zone_map.h"
+#include "src/trace_processor/db/column_storage.h"
 #include "src/trace_processor/db/compare.h"
 #include "test/gtest_and_gmock.h"
 
@@ -75,6 +77,34 @@ TEST(NumericStorage, InvalidSearchConstraintsGeneralChecks) {
             SearchValidationResult::kNoData);
 }
 
+TEST(NumericStorage, SearchWithZoneMap) {
+  // Values which mostly increase with a few outliers, as is typical for
+  // columns correlated with time.
+  ColumnStorage<int64_t> data;
+  for (int64_t i = 0; i < 10000; ++i) {
+    data.Append(i % 1000 == 17 ? -i : i);
+  }
+  NumericStorage<int64_t> zoned(&data.vector(), ColumnType::kInt64, false,
+                                &data.zone_map());
+  NumericStorage<int64_t> plain(&data.vector(), ColumnType::kInt64, false);
+  auto zoned_chain = zoned.MakeChain();
+  auto plain_chain = plain.MakeChain();
+
+  for (FilterOp op : {FilterOp::kEq, FilterOp::kNe, FilterOp::kLt,
+                      FilterOp::kLe, FilterOp::kGt, FilterOp::kGe}) {
+    for (int64_t val : {int64_t{-5017}, int64_t{0}, int64_t{3000},
+                        int64_t{4095}, int64_t{20000}}) {
+      for (Range range : {Range(0, 10000), Range(13, 9001)}) {
+        auto res = zoned_chain->Search(op, SqlValue::Long(val), range);
+        auto expected = plain_chain->Search(op, SqlValue::Long(val), range);
+        ASSERT_EQ(utils::ToIndexVectorForTests(res),
+                  utils::ToIndexVectorForTests(expected))
+            << static_cast<uint32_t>(op) << " " << val;
+      }
+    }
+  }
+}
+
 TEST(NumericStorage, InvalidValueBoundsUint32) {
   std::vector<uint32_t> data_vec(128);
   std::iota(data_vec.begin(), data_vec.end(), 0);
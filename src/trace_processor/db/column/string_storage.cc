@@ -88,22 +88,6 @@ struct Glob {
   const StringPool* pool_;
 };
 
-struct GlobFullStringPool {
-  GlobFullStringPool(StringPool* pool, const util::GlobMatcher& matcher)
-      : pool_(pool), matches_(pool->MaxSmallStringId().raw_id()) {
-    PERFETTO_DCHECK(!pool->HasLargeString());
-    for (auto it = pool->CreateIterator(); it; ++it) {
-      auto id = it.StringId();
-      matches_[id.raw_id()] = matcher.Matches(pool->Get(id));
-    }
-  }
-  bool operator()(StringPool::Id lhs, StringPool::Id) const {
-    return lhs != StringPool::Id::Null() && matches_[lhs.raw_id()];
-  }
-  StringPool* pool_;
-  std::vector<uint8_t> matches_;
-};
-
 struct Regex {
   bool operator()(StringPool::Id lhs, const regex::Regex& pattern) const {
     return lhs != StringPool::Id::Null() &&
@@ -112,21 +96,66 @@ struct Regex {
   const StringPool* pool_;
 };
 
-struct RegexFullStringPool {
-  RegexFullStringPool(StringPool* pool, const regex::Regex& regex)
-      : pool_(pool), matches_(pool->MaxSmallStringId().raw_id()) {
+// Dictionary of the distinct strings in a range of a string column and whether
+// they match a predicate (e.g. a glob or a regex). The predicate is evaluated
+// only once for each distinct string, the rows are then filtered by only
+// checking whether their id is one of the matching ones.
+//
+// The results are stored in a table indexed by |StringPool::Id::raw_id| so
+// this can only be used if the pool has no large strings.
+class MatchingIds {
+ public:
+  template <typename Predicate>
+  MatchingIds(const StringPool* pool,
+              const StringPool::Id* start,
+              const StringPool::Id* end,
+              Predicate predicate)
+      : states_(pool->MaxSmallStringId().raw_id() + 1, kUnknown) {
     PERFETTO_DCHECK(!pool->HasLargeString());
-    for (auto it = pool->CreateIterator(); it; ++it) {
-      auto id = it.StringId();
-      matches_[id.raw_id()] =
-          id != StringPool::Id::Null() && regex.Search(pool_->Get(id).c_str());
+    states_[StringPool::Id::Null().raw_id()] = kNoMatch;
+    for (const StringPool::Id* it = start; it != end; ++it) {
+      uint8_t& state = states_[it->raw_id()];
+      if (PERFETTO_LIKELY(state != kUnknown))
+        continue;
+      if (predicate(pool->Get(*it))) {
+        state = kMatch;
+        last_match_ = *it;
+        ++match_count_;
+      } else {
+        state = kNoMatch;
+      }
     }
   }
-  bool operator()(StringPool::Id lhs, StringPool::Id) const {
-    return matches_[lhs.raw_id()];
+
+  // Appends to |builder| whether each id in the range passed to the
+  // constructor matched.
+  void Filter(const StringPool::Id* start, BitVector::Builder& builder) const {
+    // Comparing with at most one id is cheaper than looking up |states_|.
+    if (match_count_ == 0) {
+      utils::LinearSearchWithComparator(
+          StringPool::Id::Null(), start,
+          [](StringPool::Id, StringPool::Id) { return false; }, builder);
+    } else if (match_count_ == 1) {
+      utils::LinearSearchWithComparator(last_match_, start, std::equal_to<>(),
+                                        builder);
+    } else {
+      utils::LinearSearchWithComparator(
+          StringPool::Id::Null(), start,
+          [this](StringPool::Id lhs, StringPool::Id) {
+            return states_[lhs.raw_id()] == kMatch;
+          },
+          builder);
+    }
   }
-  StringPool* pool_;
-  std::vector<uint8_t> matches_;
+
+ private:
+  static constexpr uint8_t kUnknown = 0;
+  static constexpr uint8_t kNoMatch = 1;
+  static constexpr uint8_t kMatch = 2;
+
+  std::vector<uint8_t> states_;
+  uint32_t match_count_ = 0;
+  StringPool::Id last_match_ = StringPool::Id::Null();
 };
 
 struct IsNull {
@@ -484,9 +513,10 @@ BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
         break;
       }
 
-      utils::LinearSearchWithComparator(
-          StringPool::Id::Null(), start,
-          GlobFullStringPool{string_pool_, matcher}, builder);
+      MatchingIds ids(
+          string_pool_, start, start + range.size(),
+          [&matcher](NullTermStringView str) { return matcher.Matches(str); });
+      ids.Filter(start, builder);
       break;
     }
     case FilterOp::kRegex: {
@@ -503,9 +533,12 @@ BitVector StringStorage::ChainImpl::LinearSearch(FilterOp op,
                                           Regex{string_pool_}, builder);
         break;
       }
-      utils::LinearSearchWithComparator(
-          StringPool::Id::Null(), start,
-          RegexFullStringPool{string_pool_, regex.value()}, builder);
+      const regex::Regex& pattern = regex.value();
+      MatchingIds ids(string_pool_, start, start + range.size(),
+                      [&pattern](NullTermStringView str) {
+                        return pattern.Search(str.c_str());
+                      });
+      ids.Filter(start, builder);
       break;
     }
     case FilterOp::kIsNull:
@@ -151,6 +151,44 @@ TEST(StringStorage, Search) {
   ASSERT_THAT(utils::ToIndexVectorForTests(res), ElementsAre(1, 2, 4));
 }
 
+TEST(StringStorage, SearchGlobRepeatedStrings) {
+  std::vector<std::string> strings{"binder transaction", "binder reply",
+                                   "Choreographer#doFrame", "binder", "draw"};
+  std::vector<StringPool::Id> ids;
+  StringPool pool;
+  for (uint32_t i = 0; i < 200; ++i) {
+    ids.push_back(i % 7 == 6 ? StringPool::Id::Null()
+                             : pool.InternString(base::StringView(
+                                   strings[i % 7 % strings.size()])));
+  }
+  StringStorage storage(&pool, &ids);
+  auto chain = storage.MakeChain();
+  Range range(3, 197);
+
+  // Returns the rows in |range| whose string matches |fn|.
+  auto expected = [&](auto fn) {
+    std::vector<uint32_t> rows;
+    for (uint32_t i = range.start; i < range.end; ++i) {
+      if (!ids[i].is_null() && fn(pool.Get(ids[i]).ToStdString()))
+        rows.push_back(i);
+    }
+    return rows;
+  };
+
+  auto res = chain->Search(FilterOp::kGlob, SqlValue::String("binder*"), range);
+  ASSERT_EQ(utils::ToIndexVectorForTests(res), expected([](std::string s) {
+              return s.rfind("binder", 0) == 0;
+            }));
+
+  res = chain->Search(FilterOp::kGlob, SqlValue::String("*Frame"), range);
+  ASSERT_EQ(utils::ToIndexVectorForTests(res), expected([](std::string s) {
+              return s == "Choreographer#doFrame";
+            }));
+
+  res = chain->Search(FilterOp::kGlob, SqlValue::String("*foo*"), range);
+  ASSERT_THAT(utils::ToIndexVectorForTests(res), IsEmpty());
+}
+
 TEST(StringStorage, IndexSearch) {
   std::vector<std::string> strings{"cheese",  "pasta", "pizza",
                                    "pierogi", "onion", "fries"};
@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
+#define SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/containers/bit_vector.h"
+
+namespace perfetto::trace_processor::column {
+
+// Stores the minimum and maximum value of every block of |kBlockSize|
+// consecutive elements of a numeric vector. This allows linear searches to
+// skip the blocks which cannot contain any match (or which only contain
+// matches) without reading their data: as traces are mostly ordered by time,
+// this is very effective on columns correlated with time even if they are not
+// sorted.
+//
+// The bounds of a block are only guaranteed to contain every value in the
+// block: updating or inserting values only widens them.
+template <typename T>
+class ZoneMap {
+ public:
+  // Number of elements in each block. This is a multiple of the size of a
+  // BitVector word so searches can fill the rows of skipped blocks one word
+  // at a time.
+  static constexpr uint32_t kBlockSize = 16 * BitVector::kBitsInWord;
+
+  struct Zone {
+    T min;
+    T max;
+  };
+
+  // Must be called after |val| is appended to the vector.
+  void Append(T val) {
+    if (size_++ % kBlockSize == 0) {
+      zones_.push_back(Zone{val, val});
+      return;
+    }
+    Widen(zones_.back(), val);
+  }
+
+  // Must be called after the |count| elements starting at |data| are appended
+  // to the vector.
+  void AppendMultiple(const T* data, uint32_t count) {
+    uint32_t i = 0;
+    for (; i < count && size_ % kBlockSize != 0; ++i) {
+      Append(data[i]);
+    }
+    // The remaining elements start new blocks: the bounds of each block are
+    // computed in one go.
+    while (i < count) {
+      uint32_t end = std::min(i + kBlockSize, count);
+      Zone zone{data[i], data[i]};
+      for (uint32_t j = i + 1; j < end; ++j) {
+        Widen(zone, data[j]);
+      }
+      zones_.push_back(zone);
+      size_ += end - i;
+      i = end;
+    }
+  }
+
+  // Must be called after the element at |idx| of the vector is set to |val|.
+  void Update(uint32_t idx, T val) {
+    PERFETTO_DCHECK(idx < size_);
+    Widen(zones_[idx / kBlockSize], val);
+  }
+
+  // Must be called after |data[idx]| was inserted, shifting all the following
+  // elements of |data| by one.
+  void Insert(const std::vector<T>& data, uint32_t idx) {
+    PERFETTO_DCHECK(data.size() == size_ + 1);
+    PERFETTO_DCHECK(idx < data.size());
+    if (idx == size_) {
+      Append(data[idx]);
+      return;
+    }
+    Widen(zones_[idx / kBlockSize], data[idx]);
+
+    // Each following block has lost its last element to the next block and
+    // gained the last element of the previous block as its first element.
+    for (uint32_t b = idx / kBlockSize + 1; b < zones_.size(); ++b) {
+      Widen(zones_[b], data[b * kBlockSize]);
+    }
+    if (size_++ % kBlockSize == 0) {
+      zones_.push_back(Zone{data.back(), data.back()});
+    }
+  }
+
+  void ShrinkToFit() { zones_.shrink_to_fit(); }
+
+  const std::vector<Zone>& zones() const { return zones_; }
+
+  // Number of elements of the vector.
+  uint32_t size() const { return size_; }
+
+  // Returns the number of bytes of memory used by the zones.
+  size_t memory_usage() const { return zones_.capacity() * sizeof(Zone); }
+
+ private:
+  static void Widen(Zone& zone, T val) {
+    if constexpr (std::is_floating_point_v<T>) {
+      // Blocks with a NaN have NaN bounds so they are never skipped: NaN is
+      // not ordered with respect to the other values.
+      if (std::isnan(val)) {
+        zone.min = val;
+        zone.max = val;
+        return;
+      }
+    }
+    if (val < zone.min)
+      zone.min = val;
+    if (val > zone.max)
+      zone.max = val;
+  }
+
+  std::vector<Zone> zones_;
+  uint32_t size_ = 0;
+};
+
+}  // namespace perfetto::trace_processor::column
+
+#endif  // SRC_TRACE_PROCESSOR_DB_COLUMN_ZONE_MAP_H_
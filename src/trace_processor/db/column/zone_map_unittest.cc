@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#include "src/trace_processor/db/column/zone_map.h"
+
+#include <cmath>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "src/trace_processor/db/column_storage.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::column {
+namespace {
+
+constexpr uint32_t kBlockSize = ZoneMap<int64_t>::kBlockSize;
+
+// Checks that the bounds of each zone contain all the values of its block.
+template <typename T>
+void CheckContains(const ZoneMap<T>& zone_map, const std::vector<T>& data) {
+  ASSERT_EQ(zone_map.size(), data.size());
+  ASSERT_EQ(zone_map.zones().size(),
+            (data.size() + kBlockSize - 1) / kBlockSize);
+  for (uint32_t i = 0; i < data.size(); ++i) {
+    const auto& zone = zone_map.zones()[i / kBlockSize];
+    ASSERT_LE(zone.min, data[i]) << i;
+    ASSERT_GE(zone.max, data[i]) << i;
+  }
+}
+
+TEST(ZoneMap, Append) {
+  ColumnStorage<int64_t> storage;
+  for (int64_t i = 0; i < 3 * kBlockSize + 10; ++i) {
+    storage.Append(i % 2 ? i : -i);
+  }
+  CheckContains(storage.zone_map(), storage.vector());
+
+  const auto& zones = storage.zone_map().zones();
+  ASSERT_EQ(zones[1].min, -int64_t{kBlockSize * 2 - 2});
+  ASSERT_EQ(zones[1].max, int64_t{kBlockSize * 2 - 1});
+}
+
+TEST(ZoneMap, AppendMultiple) {
+  ColumnStorage<int64_t> storage;
+  storage.Append(5);
+  storage.AppendMultiple(2 * kBlockSize + 10,
+                         [](uint32_t i) { return int64_t{i} * -3; });
+  storage.AppendMultiple(0, [](uint32_t) { return int64_t{0}; });
+  storage.AppendMultiple(kBlockSize, [](uint32_t i) { return int64_t{i}; });
+  CheckContains(storage.zone_map(), storage.vector());
+  ASSERT_EQ(storage.vector()[kBlockSize], -3 * int64_t{kBlockSize - 1});
+
+  const auto& zones = storage.zone_map().zones();
+  ASSERT_EQ(zones[0].max, 5);
+  ASSERT_EQ(zones[0].min, -3 * int64_t{kBlockSize - 2});
+}
+
+TEST(ZoneMap, NullableAppendMultiple) {
+  auto storage = ColumnStorage<std::optional<int64_t>>::Create<false>();
+  storage.Append(std::nullopt);
+  storage.AppendMultiple(3 * kBlockSize, [](uint32_t i) {
+    return i % 3 ? std::make_optional(int64_t{i}) : std::nullopt;
+  });
+  ASSERT_EQ(storage.size(), 3 * kBlockSize + 1);
+  ASSERT_EQ(storage.non_null_size(), 2 * kBlockSize);
+  ASSERT_EQ(storage.Get(0), std::nullopt);
+  ASSERT_EQ(storage.Get(1), std::nullopt);
+  ASSERT_EQ(storage.Get(3), 2);
+  ASSERT_EQ(storage.Get(3 * kBlockSize), 3 * int64_t{kBlockSize} - 1);
+  CheckContains(storage.non_null_zone_map(), storage.non_null_vector());
+
+  auto dense = ColumnStorage<std::optional<int64_t>>::Create<true>();
+  dense.AppendMultiple(100, [](uint32_t i) {
+    return i % 2 ? std::make_optional(int64_t{i}) : std::nullopt;
+  });
+  ASSERT_EQ(dense.non_null_size(), 100u);
+  ASSERT_EQ(dense.Get(98), std::nullopt);
+  ASSERT_EQ(dense.Get(99), 99);
+}
+
+TEST(ZoneMap, Set) {
+  ColumnStorage<uint32_t> storage;
+  for (uint32_t i = 0; i < 2 * kBlockSize; ++i) {
+    storage.Append(i);
+  }
+  storage.Set(kBlockSize + 5, 1000000);
+  CheckContains(storage.zone_map(), storage.vector());
+  ASSERT_EQ(storage.zone_map().zones()[0].max, kBlockSize - 1);
+  ASSERT_EQ(storage.zone_map().zones()[1].max, 1000000u);
+}
+
+TEST(ZoneMap, SparseNullableInsert) {
+  auto storage = ColumnStorage<std::optional<int64_t>>::Create<false>();
+  for (uint32_t i = 0; i < 3 * kBlockSize; ++i) {
+    if (i % 3 == 0) {
+      storage.Append(std::nullopt);
+    } else {
+      storage.Append(int64_t{i});
+    }
+  }
+  // Setting null rows to non-null inserts values in the middle of the
+  // non-null vector, shifting all the following values.
+  storage.Set(0, -5);
+  storage.Set(3 * kBlockSize / 2, 1 << 20);
+  storage.Set(3 * kBlockSize - 3, 7);
+  CheckContains(storage.non_null_zone_map(), storage.non_null_vector());
+}
+
+TEST(ZoneMap, DoubleNaN) {
+  ColumnStorage<double> storage;
+  for (uint32_t i = 0; i < 2 * kBlockSize; ++i) {
+    storage.Append(i == kBlockSize + 1 ? std::nan("") : 1.5);
+  }
+  const auto& zones = storage.zone_map().zones();
+  ASSERT_EQ(zones[0].min, 1.5);
+  ASSERT_EQ(zones[0].max, 1.5);
+  ASSERT_TRUE(std::isnan(zones[1].min));
+  ASSERT_TRUE(std::isnan(zones[1].max));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::column
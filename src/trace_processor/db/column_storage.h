@@ -17,15 +17,18 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 #define SRC_TRACE_PROCESSOR_DB_COLUMN_STORAGE_H_
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <optional>
+#include <type_traits>
 #include <vector>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/public/compiler.h"
 #include "src/trace_processor/containers/bit_vector.h"
+#include "src/trace_processor/db/column/zone_map.h"
 
 namespace perfetto::trace_processor {
 
@@ -46,6 +49,10 @@ class ColumnStorageBase {
   virtual const BitVector* bv() const = 0;
   virtual uint32_t size() const = 0;
   virtual uint32_t non_null_size() const = 0;
+
+  // Returns the number of bytes of memory used by the storage, including the
+  // null bit vector and the zone map.
+  virtual size_t memory_usage() const = 0;
 };
 
 // Class used for implementing storage for non-null columns.
@@ -61,15 +68,48 @@ class ColumnStorage final : public ColumnStorageBase {
   ColumnStorage& operator=(ColumnStorage&&) noexcept = default;
 
   T Get(uint32_t idx) const { return vector_[idx]; }
-  void Append(T val) { vector_.emplace_back(val); }
-  void Set(uint32_t idx, T val) { vector_[idx] = val; }
-  PERFETTO_NO_INLINE void ShrinkToFit() { vector_.shrink_to_fit(); }
+  void Append(T val) {
+    vector_.emplace_back(val);
+    if constexpr (std::is_arithmetic_v<T>) {
+      zone_map_.Append(val);
+    }
+  }
+  // Appends |count| values, the ith of which is returned by |fn(i)|. Faster
+  // than calling Append() |count| times.
+  template <typename Fn>
+  void AppendMultiple(uint32_t count, Fn fn) {
+    size_t start = vector_.size();
+    vector_.resize(start + count);
+    T* out = vector_.data() + start;
+    for (uint32_t i = 0; i < count; ++i) {
+      out[i] = fn(i);
+    }
+    if constexpr (std::is_arithmetic_v<T>) {
+      zone_map_.AppendMultiple(out, count);
+    }
+  }
+  void Set(uint32_t idx, T val) {
+    vector_[idx] = val;
+    if constexpr (std::is_arithmetic_v<T>) {
+      zone_map_.Update(idx, val);
+    }
+  }
+  PERFETTO_NO_INLINE void ShrinkToFit() {
+    vector_.shrink_to_fit();
+    zone_map_.ShrinkToFit();
+  }
   const std::vector<T>& vector() const { return vector_; }
 
+  // Per-block bounds of |vector()|. Only maintained for arithmetic types.
+  const column::ZoneMap<T>& zone_map() const { return zone_map_; }
+
   const void* data() const final { return vector_.data(); }
   const BitVector* bv() const final { return nullptr; }
   uint32_t size() const final { return static_cast<uint32_t>(vector_.size()); }
   uint32_t non_null_size() const final { return size(); }
+  size_t memory_usage() const final {
+    return vector_.capacity() * sizeof(T) + zone_map_.memory_usage();
+  }
 
   template <bool IsDense>
   static ColumnStorage<T> Create() {
@@ -82,12 +122,14 @@ class ColumnStorage final : public ColumnStorageBase {
       ColumnStorage<std::optional<T>> null_storage) {
     PERFETTO_CHECK(null_storage.size() == null_storage.non_null_size());
     ColumnStorage<T> x;
+    x.zone_map_ = null_storage.non_null_zone_map();
     x.vector_ = std::move(null_storage).non_null_vector();
     return x;
   }
 
  private:
   std::vector<T> vector_;
+  column::ZoneMap<T> zone_map_;
 };
 
 // Class used for implementing storage for nullable columns.
@@ -113,6 +155,9 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   void Append(T val) {
     data_.emplace_back(val);
     valid_.AppendTrue();
+    if constexpr (std::is_arithmetic_v<T>) {
+      zone_map_.Append(val);
+    }
   }
   void Append(std::optional<T> val) {
     if (val) {
@@ -121,10 +166,38 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
       AppendNull();
     }
   }
+  // Appends |count| values, the ith of which is returned by |fn(i)|. Faster
+  // than calling Append() |count| times as the validity of the values is
+  // appended one word at a time.
+  template <typename Fn>
+  void AppendMultiple(uint32_t count, Fn fn) {
+    size_t start = data_.size();
+    for (uint32_t i = 0; i < count; i += BitVector::kBitsInWord) {
+      uint32_t n = std::min(BitVector::kBitsInWord, count - i);
+      uint64_t word = 0;
+      for (uint32_t j = 0; j < n; ++j) {
+        std::optional<T> val = fn(i + j);
+        if (val) {
+          data_.emplace_back(*val);
+          word |= uint64_t(1) << j;
+        } else if (mode_ == Mode::kDense) {
+          data_.emplace_back();
+        }
+      }
+      valid_.AppendBits(word, n);
+    }
+    if constexpr (std::is_arithmetic_v<T>) {
+      zone_map_.AppendMultiple(data_.data() + start,
+                               static_cast<uint32_t>(data_.size() - start));
+    }
+  }
   void Set(uint32_t idx, T val) {
     if (mode_ == Mode::kDense) {
       valid_.Set(idx);
       data_[idx] = val;
+      if constexpr (std::is_arithmetic_v<T>) {
+        zone_map_.Update(idx, val);
+      }
     } else {
       // Generally, we will be setting a null row to non-null so optimize for
       // that path.
@@ -132,8 +205,14 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
       bool was_set = valid_.Set(idx);
       if (PERFETTO_UNLIKELY(was_set)) {
         data_[row] = val;
+        if constexpr (std::is_arithmetic_v<T>) {
+          zone_map_.Update(row, val);
+        }
       } else {
         data_.insert(data_.begin() + static_cast<ptrdiff_t>(row), val);
+        if constexpr (std::is_arithmetic_v<T>) {
+          zone_map_.Insert(data_, row);
+        }
       }
     }
   }
@@ -141,18 +220,27 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   PERFETTO_NO_INLINE void ShrinkToFit() {
     data_.shrink_to_fit();
     valid_.ShrinkToFit();
+    zone_map_.ShrinkToFit();
   }
   // For dense columns the size of the vector is equal to size of the bit
   // vector. For sparse it's equal to count set bits of the bit vector.
   const std::vector<T>& non_null_vector() const& { return data_; }
   const BitVector& non_null_bit_vector() const { return valid_; }
 
+  // Per-block bounds of |non_null_vector()|. Only maintained for arithmetic
+  // types.
+  const column::ZoneMap<T>& non_null_zone_map() const { return zone_map_; }
+
   const void* data() const final { return non_null_vector().data(); }
   const BitVector* bv() const final { return &non_null_bit_vector(); }
   uint32_t size() const final { return valid_.size(); }
   uint32_t non_null_size() const final {
     return static_cast<uint32_t>(non_null_vector().size());
   }
+  size_t memory_usage() const final {
+    return data_.capacity() * sizeof(T) + valid_.memory_usage() +
+           zone_map_.memory_usage();
+  }
 
   template <bool IsDense>
   static ColumnStorage<std::optional<T>> Create() {
@@ -181,6 +269,9 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   void AppendNull() {
     if (mode_ == Mode::kDense) {
       data_.emplace_back();
+      if constexpr (std::is_arithmetic_v<T>) {
+        zone_map_.Append(data_.back());
+      }
     }
     valid_.AppendFalse();
   }
@@ -188,6 +279,7 @@ class ColumnStorage<std::optional<T>> final : public ColumnStorageBase {
   Mode mode_ = Mode::kSparse;
   std::vector<T> data_;
   BitVector valid_;
+  column::ZoneMap<T> zone_map_;
 };
 
 }  // namespace perfetto::trace_processor
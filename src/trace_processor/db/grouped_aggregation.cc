@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/grouped_aggregation.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// Returns an integer identifying |value| among the non-null values of a
+// column.
+int64_t KeyForValue(const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::kLong:
+      return value.long_value;
+    case SqlValue::kDouble: {
+      // -0.0 and 0.0 are in the same group.
+      double d = value.double_value == 0 ? 0.0 : value.double_value;
+      int64_t key;
+      memcpy(&key, &d, sizeof(key));
+      return key;
+    }
+    case SqlValue::kString:
+      // Strings are interned in the string pool so two strings are equal if
+      // and only if they have the same address.
+      return static_cast<int64_t>(
+          reinterpret_cast<uintptr_t>(value.string_value));
+    case SqlValue::kNull:
+    case SqlValue::kBytes:
+      break;
+  }
+  PERFETTO_FATAL("Unsupported value type");
+}
+
+// Compares |a| and |b| like SQLite does with the BINARY collation: nulls
+// first, then numbers, then strings.
+int Compare(const SqlValue& a, const SqlValue& b) {
+  if (a.is_null() || b.is_null()) {
+    return static_cast<int>(b.is_null()) - static_cast<int>(a.is_null());
+  }
+  if (a.type == SqlValue::kString || b.type == SqlValue::kString) {
+    if (a.type != b.type) {
+      return a.type == SqlValue::kString ? 1 : -1;
+    }
+    int res = std::string_view(a.string_value).compare(b.string_value);
+    return (res > 0) - (res < 0);
+  }
+  if (a.type == SqlValue::kLong && b.type == SqlValue::kLong) {
+    return (a.long_value > b.long_value) - (a.long_value < b.long_value);
+  }
+  double a_d = a.type == SqlValue::kLong ? static_cast<double>(a.long_value)
+                                         : a.double_value;
+  double b_d = b.type == SqlValue::kLong ? static_cast<double>(b.long_value)
+                                         : b.double_value;
+  return (a_d > b_d) - (a_d < b_d);
+}
+
+base::Status AddValue(RuntimeTable::Builder& builder,
+                      uint32_t idx,
+                      const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::kNull:
+      return builder.AddNull(idx);
+    case SqlValue::kLong:
+      return builder.AddInteger(idx, value.long_value);
+    case SqlValue::kDouble:
+      return builder.AddFloat(idx, value.double_value);
+    case SqlValue::kString:
+      return builder.AddText(idx, value.string_value);
+    case SqlValue::kBytes:
+      break;
+  }
+  return base::ErrStatus("Bytes columns cannot be aggregated");
+}
+
+// Computes the aggregation |column| for each group of rows and returns the
+// results indexed by group.
+base::StatusOr<std::vector<SqlValue>> ComputeAggregate(
+    const Table& table,
+    const AggregationColumn& column,
+    const std::vector<uint32_t>& row_groups,
+    uint32_t group_count) {
+  std::vector<SqlValue> results(group_count);
+  uint32_t row_count = table.row_count();
+  if (column.type == AggregationColumn::Type::kCountRows) {
+    std::vector<int64_t> counts(group_count);
+    for (uint32_t i = 0; i < row_count; ++i) {
+      counts[row_groups[i]]++;
+    }
+    for (uint32_t g = 0; g < group_count; ++g) {
+      results[g] = SqlValue::Long(counts[g]);
+    }
+    return results;
+  }
+
+  if (column.col_idx >= table.columns().size()) {
+    return base::ErrStatus("Column %u does not exist", column.col_idx);
+  }
+  const ColumnLegacy& col = table.columns()[column.col_idx];
+  switch (column.type) {
+    case AggregationColumn::Type::kCount: {
+      std::vector<int64_t> counts(group_count);
+      for (uint32_t i = 0; i < row_count; ++i) {
+        counts[row_groups[i]] += !col.Get(i).is_null();
+      }
+      for (uint32_t g = 0; g < group_count; ++g) {
+        results[g] = SqlValue::Long(counts[g]);
+      }
+      break;
+    }
+    case AggregationColumn::Type::kMin:
+    case AggregationColumn::Type::kMax: {
+      int sign = column.type == AggregationColumn::Type::kMin ? 1 : -1;
+      for (uint32_t i = 0; i < row_count; ++i) {
+        SqlValue value = col.Get(i);
+        if (value.is_null()) {
+          continue;
+        }
+        SqlValue& res = results[row_groups[i]];
+        if (res.is_null() || sign * Compare(value, res) < 0) {
+          res = value;
+        }
+      }
+      break;
+    }
+    case AggregationColumn::Type::kSum: {
+      if (col.type() != SqlValue::kLong) {
+        return base::ErrStatus("Only integer columns can be summed");
+      }
+      for (uint32_t i = 0; i < row_count; ++i) {
+        SqlValue value = col.Get(i);
+        if (value.is_null()) {
+          continue;
+        }
+        SqlValue& res = results[row_groups[i]];
+        if (res.is_null()) {
+          res = value;
+        } else if (__builtin_add_overflow(res.long_value, value.long_value,
+                                          &res.long_value)) {
+          return base::ErrStatus("integer overflow");
+        }
+      }
+      break;
+    }
+    case AggregationColumn::Type::kGroupColumn:
+    case AggregationColumn::Type::kCountRows:
+      PERFETTO_FATAL("Not an aggregate");
+  }
+  return results;
+}
+
+}  // namespace
+
+base::StatusOr<std::unique_ptr<RuntimeTable>> ComputeGroupedAggregation(
+    const Table& table,
+    StringPool* pool,
+    const std::vector<uint32_t>& group_by,
+    const std::vector<AggregationColumn>& columns) {
+  if (group_by.empty()) {
+    return base::ErrStatus("At least one group by column is needed");
+  }
+  for (uint32_t col_idx : group_by) {
+    if (col_idx >= table.columns().size()) {
+      return base::ErrStatus("Column %u does not exist", col_idx);
+    }
+    if (table.columns()[col_idx].type() == SqlValue::kBytes) {
+      return base::ErrStatus("Bytes columns cannot be grouped");
+    }
+  }
+
+  // Assign a group to each row by refining the groups with the values of each
+  // group by column in turn.
+  uint32_t row_count = table.row_count();
+  std::vector<uint32_t> row_groups(row_count, 0);
+  uint32_t group_count = row_count == 0 ? 0 : 1;
+  for (uint32_t col_idx : group_by) {
+    const ColumnLegacy& col = table.columns()[col_idx];
+
+    // 0 is the id of null.
+    base::FlatHashMap<int64_t, uint32_t> value_ids;
+    base::FlatHashMap<uint64_t, uint32_t> groups;
+    for (uint32_t i = 0; i < row_count; ++i) {
+      SqlValue value = col.Get(i);
+      uint32_t value_id = 0;
+      if (!value.is_null()) {
+        value_id = *value_ids
+                        .Insert(KeyForValue(value),
+                                static_cast<uint32_t>(value_ids.size()) + 1)
+                        .first;
+      }
+      uint64_t key = (static_cast<uint64_t>(row_groups[i]) << 32) | value_id;
+      row_groups[i] =
+          *groups.Insert(key, static_cast<uint32_t>(groups.size())).first;
+    }
+    group_count = static_cast<uint32_t>(groups.size());
+  }
+
+  // Sort the groups by the values of the group by columns of their first row.
+  constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+  std::vector<uint32_t> first_rows(group_count, kNoRow);
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (first_rows[row_groups[i]] == kNoRow) {
+      first_rows[row_groups[i]] = i;
+    }
+  }
+  std::vector<std::vector<SqlValue>> group_values(group_by.size());
+  for (uint32_t c = 0; c < group_by.size(); ++c) {
+    const ColumnLegacy& col = table.columns()[group_by[c]];
+    group_values[c].reserve(group_count);
+    for (uint32_t row : first_rows) {
+      group_values[c].push_back(col.Get(row));
+    }
+  }
+  std::vector<uint32_t> order(group_count);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&group_values](uint32_t a, uint32_t b) {
+    for (const auto& values : group_values) {
+      if (int res = Compare(values[a], values[b]); res != 0) {
+        return res < 0;
+      }
+    }
+    return false;
+  });
+
+  std::vector<std::string> names;
+  std::vector<std::vector<SqlValue>> results;
+  for (const AggregationColumn& column : columns) {
+    names.push_back(column.name);
+    if (column.type != AggregationColumn::Type::kGroupColumn) {
+      ASSIGN_OR_RETURN(
+          std::vector<SqlValue> values,
+          ComputeAggregate(table, column, row_groups, group_count));
+      results.emplace_back(std::move(values));
+      continue;
+    }
+    auto it = std::find(group_by.begin(), group_by.end(), column.col_idx);
+    if (it == group_by.end()) {
+      return base::ErrStatus("Column %u is not grouped by", column.col_idx);
+    }
+    results.emplace_back(
+        group_values[static_cast<size_t>(std::distance(group_by.begin(), it))]);
+  }
+
+  RuntimeTable::Builder builder(pool, std::move(names));
+  for (uint32_t group : order) {
+    for (uint32_t c = 0; c < results.size(); ++c) {
+      RETURN_IF_ERROR(AddValue(builder, c, results[c][group]));
+    }
+  }
+  return std::move(builder).Build(group_count);
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_DB_GROUPED_AGGREGATION_H_
+#define SRC_TRACE_PROCESSOR_DB_GROUPED_AGGREGATION_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/status_or.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/db/table.h"
+
+namespace perfetto::trace_processor {
+
+// A column of the result of |ComputeGroupedAggregation|.
+struct AggregationColumn {
+  enum class Type {
+    // The value of the group by column |col_idx| for the group.
+    kGroupColumn,
+    // The number of rows in the group (i.e. COUNT(*)).
+    kCountRows,
+    // The number of non-null values of |col_idx| (i.e. COUNT(col)).
+    kCount,
+    // The minimum non-null value of |col_idx| or null (i.e. MIN(col)).
+    kMin,
+    // The maximum non-null value of |col_idx| or null (i.e. MAX(col)).
+    kMax,
+    // The sum of the non-null values of |col_idx| or null if there are none
+    // (i.e. SUM(col)). Only supported on integer columns.
+    kSum,
+  };
+  std::string name;
+  Type type;
+  uint32_t col_idx = 0;
+};
+
+// Returns the result of grouping the rows of |table| by the values of the
+// columns |group_by| and computing |columns| for each group. The semantics
+// match the ones of SQLite for the equivalent
+//   SELECT <columns> FROM <table> GROUP BY <group_by>
+// query, including the order of the groups: ascending order of the values of
+// |group_by| with nulls first and strings compared byte by byte.
+//
+// The values of the columns are read directly from the table instead of being
+// passed to SQLite row by row.
+//
+// Returns an error if an integer sum overflows (which is also an error in
+// SQLite) or if |columns| are invalid.
+base::StatusOr<std::unique_ptr<RuntimeTable>> ComputeGroupedAggregation(
+    const Table& table,
+    StringPool* pool,
+    const std::vector<uint32_t>& group_by,
+    const std::vector<AggregationColumn>& columns);
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_DB_GROUPED_AGGREGATION_H_
@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/db/grouped_aggregation.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/base/test/status_matchers.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using base::gtest_matchers::IsOk;
+using testing::Not;
+using Type = AggregationColumn::Type;
+
+class GroupedAggregationTest : public ::testing::Test {
+ protected:
+  // Creates a table with the columns (name, cat, dur, value) from the rows
+  // |names|, |cats|, |durs| and |values| where null strings and
+  // std::nullopt are nulls.
+  std::unique_ptr<RuntimeTable> CreateTable(
+      const std::vector<const char*>& names,
+      const std::vector<int64_t>& cats,
+      const std::vector<std::optional<int64_t>>& durs,
+      const std::vector<double>& values) {
+    RuntimeTable::Builder builder(&pool_, {"name", "cat", "dur", "value"});
+    for (uint32_t i = 0; i < names.size(); ++i) {
+      EXPECT_OK(names[i] ? builder.AddText(0, names[i]) : builder.AddNull(0));
+      EXPECT_OK(builder.AddInteger(1, cats[i]));
+      EXPECT_OK(durs[i] ? builder.AddInteger(2, *durs[i])
+                        : builder.AddNull(2));
+      EXPECT_OK(builder.AddFloat(3, values[i]));
+    }
+    auto table = std::move(builder).Build(static_cast<uint32_t>(names.size()));
+    EXPECT_OK(table.status());
+    return std::move(*table);
+  }
+
+  StringPool pool_;
+};
+
+TEST_F(GroupedAggregationTest, SingleColumn) {
+  auto table = CreateTable({"b", nullptr, "a", "b", "a", "c"},
+                           {0, 1, 0, 1, 0, 1}, {1, 2, std::nullopt, 5, 3, {}},
+                           {1.5, 2, 3, 0.5, 4, 1});
+  ASSERT_OK_AND_ASSIGN(
+      auto res, ComputeGroupedAggregation(*table, &pool_, {0},
+                                          {
+                                              {"name", Type::kGroupColumn, 0},
+                                              {"cnt", Type::kCountRows, 0},
+                                              {"durs", Type::kCount, 2},
+                                              {"max_dur", Type::kMax, 2},
+                                              {"min_value", Type::kMin, 3},
+                                              {"total", Type::kSum, 2},
+                                          }));
+
+  // Groups are sorted with the null group first.
+  ASSERT_EQ(res->row_count(), 4u);
+  const auto& cols = res->columns();
+  ASSERT_TRUE(cols[0].Get(0).is_null());
+  ASSERT_STREQ(cols[0].Get(1).AsString(), "a");
+  ASSERT_STREQ(cols[0].Get(2).AsString(), "b");
+  ASSERT_STREQ(cols[0].Get(3).AsString(), "c");
+
+  ASSERT_EQ(cols[1].Get(0).AsLong(), 1);
+  ASSERT_EQ(cols[1].Get(1).AsLong(), 2);
+  ASSERT_EQ(cols[1].Get(2).AsLong(), 2);
+  ASSERT_EQ(cols[1].Get(3).AsLong(), 1);
+
+  ASSERT_EQ(cols[2].Get(1).AsLong(), 1);
+  ASSERT_EQ(cols[2].Get(3).AsLong(), 0);
+
+  ASSERT_EQ(cols[3].Get(0).AsLong(), 2);
+  ASSERT_EQ(cols[3].Get(1).AsLong(), 3);
+  ASSERT_EQ(cols[3].Get(2).AsLong(), 5);
+  ASSERT_TRUE(cols[3].Get(3).is_null());
+
+  ASSERT_EQ(cols[4].Get(1).AsDouble(), 3.0);
+  ASSERT_EQ(cols[4].Get(2).AsDouble(), 0.5);
+
+  ASSERT_EQ(cols[5].Get(2).AsLong(), 6);
+  ASSERT_TRUE(cols[5].Get(3).is_null());
+}
+
+TEST_F(GroupedAggregationTest, MultipleColumns) {
+  auto table = CreateTable({"b", "a", "b", "a", "b"}, {1, 0, 0, 0, 1},
+                           {1, 2, 3, 4, 5}, {0, 0, 0, 0, 0});
+  ASSERT_OK_AND_ASSIGN(
+      auto res, ComputeGroupedAggregation(*table, &pool_, {0, 1},
+                                          {
+                                              {"cat", Type::kGroupColumn, 1},
+                                              {"name", Type::kGroupColumn, 0},
+                                              {"total", Type::kSum, 2},
+                                          }));
+  ASSERT_EQ(res->row_count(), 3u);
+  const auto& cols = res->columns();
+  ASSERT_STREQ(cols[1].Get(0).AsString(), "a");
+  ASSERT_EQ(cols[0].Get(0).AsLong(), 0);
+  ASSERT_EQ(cols[2].Get(0).AsLong(), 6);
+  ASSERT_STREQ(cols[1].Get(1).AsString(), "b");
+  ASSERT_EQ(cols[0].Get(1).AsLong(), 0);
+  ASSERT_EQ(cols[2].Get(1).AsLong(), 3);
+  ASSERT_STREQ(cols[1].Get(2).AsString(), "b");
+  ASSERT_EQ(cols[0].Get(2).AsLong(), 1);
+  ASSERT_EQ(cols[2].Get(2).AsLong(), 6);
+}
+
+TEST_F(GroupedAggregationTest, EmptyTable) {
+  auto table = CreateTable({}, {}, {}, {});
+  ASSERT_OK_AND_ASSIGN(
+      auto res, ComputeGroupedAggregation(*table, &pool_, {1},
+                                          {{"cnt", Type::kCountRows, 0}}));
+  ASSERT_EQ(res->row_count(), 0u);
+}
+
+TEST_F(GroupedAggregationTest, Errors) {
+  auto table = CreateTable({"a", "a"}, {0, 0},
+                           {std::numeric_limits<int64_t>::max(), 1}, {0, 0});
+
+  // Overflowing sums are errors, like in SQLite.
+  ASSERT_THAT(ComputeGroupedAggregation(*table, &pool_, {0},
+                                        {{"total", Type::kSum, 2}}),
+              Not(IsOk()));
+
+  // Doubles cannot be summed.
+  ASSERT_THAT(ComputeGroupedAggregation(*table, &pool_, {0},
+                                        {{"total", Type::kSum, 3}}),
+              Not(IsOk()));
+
+  // Only grouped columns can be returned as is.
+  ASSERT_THAT(ComputeGroupedAggregation(*table, &pool_, {0},
+                                        {{"cat", Type::kGroupColumn, 1}}),
+              Not(IsOk()));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -15,18 +15,26 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
+#include <mutex>
+#include <optional>
 #include <utility>
 #include <vector>
 
 #include <sys/types.h>
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/no_destructor.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/query_executor.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/util/query_cancellation.h"
 
 namespace perfetto::trace_processor {
 
@@ -34,6 +42,54 @@ namespace {
 
 using Range = RowMap::Range;
 
+// Minimum number of rows of each morsel of a parallel linear search: this is
+// small enough for the data of a morsel to fit in the L2 cache of the thread
+// searching it while making the cost of scheduling it negligible.
+constexpr uint32_t kMinMorselSize = 64 * 1024;
+
+// Linear searches over fewer rows than this are done on the calling thread.
+constexpr uint32_t kMinParallelSearchSize = 8 * kMinMorselSize;
+
+// Returns the number of threads in the pool returned by |GetSearchThreadPool|.
+uint32_t SearchThreadCount() {
+  // The calling thread also searches morsels so one fewer thread is needed.
+  static const uint32_t count = base::ThreadPool::MaxConcurrency() - 1;
+  return count;
+}
+
+// Returns the thread pool shared by all the linear searches of the process
+// or nullptr if searches should not be parallelized.
+base::ThreadPool* GetSearchThreadPool() {
+  if (SearchThreadCount() == 0)
+    return nullptr;
+  static base::NoDestructor<base::ThreadPool> pool(SearchThreadCount());
+  return &pool.ref();
+}
+
+// Appends the rows of |range| which are in [start, end) to |builder|, whose
+// end must be |start|.
+void AppendRange(Range range,
+                 uint32_t start,
+                 uint32_t end,
+                 BitVector::Builder& builder) {
+  uint32_t set_start = std::clamp(range.start, start, end);
+  uint32_t set_end = std::clamp(range.end, set_start, end);
+  for (uint32_t i = start; i < end;) {
+    if (i % BitVector::kBitsInWord != 0 || end - i < BitVector::kBitsInWord) {
+      builder.Append(i >= set_start && i < set_end);
+      ++i;
+      continue;
+    }
+    uint64_t word = 0;
+    for (uint32_t b = 0; b < BitVector::kBitsInWord; ++b) {
+      word |= static_cast<uint64_t>(i + b >= set_start && i + b < set_end)
+              << b;
+    }
+    builder.AppendWord(word);
+    i += BitVector::kBitsInWord;
+  }
+}
+
 }  // namespace
 
 void QueryExecutor::FilterColumn(const Constraint& c,
@@ -89,7 +145,12 @@ void QueryExecutor::LinearSearch(const Constraint& c,
   Range bounds(rm->Get(0), rm->Get(rm->size() - 1) + 1);
 
   // Search the storage.
-  RangeOrBitVector res = chain.Search(c.op, c.value, bounds);
+  base::ThreadPool* pool = GetSearchThreadPool();
+  RangeOrBitVector res =
+      pool && bounds.size() >= kMinParallelSearchSize
+          ? ParallelSearch(c, chain, bounds, pool, SearchThreadCount(),
+                           kMinMorselSize)
+          : chain.Search(c.op, c.value, bounds);
   if (rm->IsRange()) {
     if (res.IsRange()) {
       Range range = std::move(res).TakeIfRange();
@@ -110,6 +171,107 @@ void QueryExecutor::LinearSearch(const Constraint& c,
   rm->Intersect(RowMap(std::move(res).TakeIfBitVector()));
 }
 
+RangeOrBitVector QueryExecutor::ParallelSearch(
+    const Constraint& c,
+    const column::DataLayerChain& chain,
+    Range bounds,
+    base::ThreadPool* pool,
+    uint32_t thread_count,
+    uint32_t morsel_size) {
+  // Splitting the search into a few more morsels than the number of threads
+  // allows threads finishing early to pick up the remaining work. Morsels are
+  // never smaller than |morsel_size| as each search allocates a BitVector
+  // spanning all the rows before the end of its morsel. All the morsels but
+  // the first one start on a word boundary so their results can be merged one
+  // word at a time.
+  uint32_t target_count = 4 * (thread_count + 1);
+  uint32_t size = std::max(morsel_size, bounds.size() / target_count);
+  size = std::max(BitVector::kBitsInWord,
+                  size / BitVector::kBitsInWord * BitVector::kBitsInWord);
+
+  std::vector<Range> morsels;
+  for (uint32_t start = bounds.start; start < bounds.end;) {
+    uint32_t end = (start + size) / size * size;
+    end = std::min(end, bounds.end);
+    morsels.emplace_back(start, end);
+    start = end;
+  }
+  std::vector<std::optional<RangeOrBitVector>> results(morsels.size());
+
+  // The first morsel is searched before any thread is started: searches can
+  // lazily update state shared by all morsels (e.g. the counts of the
+  // BitVector of a NullOverlay) so this makes it read-only for the searches
+  // running in parallel.
+  results[0] = chain.Search(c.op, c.value, morsels[0]);
+
+  // The threads of the pool don't see the query of this thread as current so
+  // it is captured here. The morsels left when the query should stop are
+  // skipped: their (empty) result is never returned to the user as the query
+  // then fails.
+  const QueryCancellation* cancellation = QueryCancellation::Current();
+  std::atomic<uint32_t> next_morsel{1};
+  auto search_morsels = [&]() {
+    for (uint32_t i = next_morsel++; i < morsels.size(); i = next_morsel++) {
+      results[i] = cancellation && cancellation->ShouldStop()
+                       ? RangeOrBitVector(Range(morsels[i].start,
+                                                morsels[i].start))
+                       : chain.Search(c.op, c.value, morsels[i]);
+    }
+  };
+
+  uint32_t task_count =
+      std::min(thread_count, static_cast<uint32_t>(morsels.size() - 1));
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  uint32_t done_count = 0;
+  for (uint32_t i = 0; i < task_count; ++i) {
+    pool->PostTask([&]() {
+      search_morsels();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done_count == task_count)
+        done_cv.notify_one();
+    });
+  }
+  search_morsels();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return done_count == task_count; });
+  }
+
+  // If every morsel matched a Range and the non-empty ones are contiguous,
+  // the result is a single Range.
+  std::optional<Range> merged_range = Range(bounds.start, bounds.start);
+  for (auto& res : results) {
+    if (!res->IsRange()) {
+      merged_range = std::nullopt;
+      break;
+    }
+    Range r = std::move(*res).TakeIfRange();
+    if (r.empty())
+      continue;
+    if (!merged_range->empty() && merged_range->end != r.start) {
+      merged_range = std::nullopt;
+      break;
+    }
+    merged_range =
+        merged_range->empty() ? r : Range(merged_range->start, r.end);
+  }
+  if (merged_range)
+    return RangeOrBitVector(*merged_range);
+
+  BitVector::Builder builder(bounds.end, bounds.start);
+  for (uint32_t i = 0; i < morsels.size(); ++i) {
+    if (results[i]->IsRange()) {
+      AppendRange(std::move(*results[i]).TakeIfRange(), morsels[i].start,
+                  morsels[i].end, builder);
+    } else {
+      builder.AppendBitsAt(std::move(*results[i]).TakeIfBitVector(),
+                           morsels[i].end);
+    }
+  }
+  return RangeOrBitVector(std::move(builder).Build());
+}
+
 void QueryExecutor::IndexSearch(const Constraint& c,
                                 const column::DataLayerChain& chain,
                                 RowMap* rm) {
@@ -131,8 +293,18 @@ void QueryExecutor::IndexSearch(const Constraint& c,
 
 RowMap QueryExecutor::FilterLegacy(const Table* table,
                                    const std::vector<Constraint>& c_vec) {
-  RowMap rm(0, table->row_count());
+  return FilterLegacy(table, c_vec, RowMap(0, table->row_count()));
+}
+
+RowMap QueryExecutor::FilterLegacy(const Table* table,
+                                   const std::vector<Constraint>& c_vec,
+                                   RowMap rm) {
   for (const auto& c : c_vec) {
+    // Each constraint can take a while on large tables: stop early if the
+    // query was cancelled. The caller is expected to check the cancellation
+    // as well and to fail the query instead of using the partial result.
+    if (QueryCancellation::ShouldStopCurrent())
+      return RowMap();
     FilterColumn(c, table->ChainForColumn(c.col_idx), &rm);
   }
   return rm;
@@ -211,4 +383,14 @@ void QueryExecutor::IndexedColumnFilterForTesting(
   IndexSearch(c, col, rm);
 }
 
+RangeOrBitVector QueryExecutor::ParallelSearchForTesting(
+    const Constraint& c,
+    const column::DataLayerChain& col,
+    Range bounds,
+    base::ThreadPool* pool,
+    uint32_t thread_count,
+    uint32_t morsel_size) {
+  return ParallelSearch(c, col, bounds, pool, thread_count, morsel_size);
+}
+
 }  // namespace perfetto::trace_processor
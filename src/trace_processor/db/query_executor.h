@@ -25,7 +25,12 @@
 #include "src/trace_processor/db/column/data_layer.h"
 #include "src/trace_processor/db/column/types.h"
 
-namespace perfetto::trace_processor {
+namespace perfetto {
+namespace base {
+class ThreadPool;
+}  // namespace base
+
+namespace trace_processor {
 
 // Responsible for executing filtering/sorting operations on a single Table.
 // TODO(b/283763282): Introduce sorting.
@@ -47,9 +52,15 @@ class QueryExecutor {
     return rm;
   }
 
-  // Enables QueryExecutor::Filter on Table columns.
+  // Enables QueryExecutor::Filter on Table columns. Returns an empty RowMap if
+  // the query running on this thread should stop (see QueryCancellation).
   static RowMap FilterLegacy(const Table*, const std::vector<Constraint>&);
 
+  // Same as above but only filters the rows of the table already in |rm|.
+  static RowMap FilterLegacy(const Table*,
+                             const std::vector<Constraint>&,
+                             RowMap rm);
+
   // Enables QueryExecutor::Sort on Table columns.
   static void SortLegacy(const Table*,
                          const std::vector<Order>&,
@@ -65,6 +76,15 @@ class QueryExecutor {
                                             const column::DataLayerChain&,
                                             RowMap*);
 
+  // Used only in unittests. Exposes private function.
+  static RangeOrBitVector ParallelSearchForTesting(
+      const Constraint&,
+      const column::DataLayerChain&,
+      Range bounds,
+      base::ThreadPool*,
+      uint32_t thread_count,
+      uint32_t morsel_size);
+
  private:
   // Updates RowMap with result of filtering single column using the Constraint.
   static void FilterColumn(const Constraint&,
@@ -77,6 +97,17 @@ class QueryExecutor {
                            const column::DataLayerChain&,
                            RowMap*);
 
+  // Searches |bounds| of the column by splitting it into morsels of (at least)
+  // |morsel_size| rows which are searched by up to |thread_count| threads of
+  // |pool| and the calling thread. The result contains exactly the same rows
+  // as |chain.Search| over |bounds|.
+  static RangeOrBitVector ParallelSearch(const Constraint&,
+                                         const column::DataLayerChain&,
+                                         Range bounds,
+                                         base::ThreadPool* pool,
+                                         uint32_t thread_count,
+                                         uint32_t morsel_size);
+
   // Filters the column using Index algorithm - finds the indices to filter the
   // storage with.
   static void IndexSearch(const Constraint&,
@@ -89,6 +120,7 @@ class QueryExecutor {
   uint32_t row_count_ = 0;
 };
 
-}  // namespace perfetto::trace_processor
+}  // namespace trace_processor
+}  // namespace perfetto
 
 #endif  // SRC_TRACE_PROCESSOR_DB_QUERY_EXECUTOR_H_
@@ -355,6 +355,26 @@ void BM_QESliceTableNameRegex(benchmark::State& state) {
 }
 BENCHMARK(BM_QESliceTableNameRegex);
 
+// Linear searches on unsorted numeric columns, which use the vectorized
+// kernels of NumericStorage.
+void BM_QESliceTableDurGt(benchmark::State& state) {
+  SliceTableForBenchmark table(state);
+  BenchmarkSliceTableFilter(state, table, {table.table_.dur().gt(1000000)});
+}
+BENCHMARK(BM_QESliceTableDurGt);
+
+void BM_QESliceTableDurNe(benchmark::State& state) {
+  SliceTableForBenchmark table(state);
+  BenchmarkSliceTableFilter(state, table, {table.table_.dur().ne(0)});
+}
+BENCHMARK(BM_QESliceTableDurNe);
+
+void BM_QESliceTableDepthLe(benchmark::State& state) {
+  SliceTableForBenchmark table(state);
+  BenchmarkSliceTableFilter(state, table, {table.table_.depth().le(2)});
+}
+BENCHMARK(BM_QESliceTableDepthLe);
+
 void BM_QESliceTableSorted(benchmark::State& state) {
   SliceTableForBenchmark table(state);
   BenchmarkSliceTableFilter(state, table,
@@ -24,6 +24,7 @@
 #include <vector>
 
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/bit_vector.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -54,6 +55,16 @@ using SelectorOverlay = column::SelectorOverlay;
 
 using Indices = column::DataLayerChain::Indices;
 
+std::vector<uint32_t> ToIndices(RangeOrBitVector res) {
+  if (res.IsRange()) {
+    Range r = std::move(res).TakeIfRange();
+    std::vector<uint32_t> out(r.size());
+    std::iota(out.begin(), out.end(), r.start);
+    return out;
+  }
+  return std::move(res).TakeIfBitVector().GetSetBitIndices();
+}
+
 TEST(QueryExecutor, OnlyStorageRange) {
   std::vector<int64_t> storage_data{1, 2, 3, 4, 5};
   column::NumericStorage<int64_t> storage(&storage_data, ColumnType::kInt64,
@@ -81,6 +92,82 @@ TEST(QueryExecutor, OnlyStorageRangeIsNull) {
   ASSERT_EQ(rm.size(), 0u);
 }
 
+TEST(QueryExecutor, ParallelSearchMatchesSearch) {
+  std::vector<int64_t> storage_data(10000);
+  for (uint32_t i = 0; i < storage_data.size(); ++i) {
+    storage_data[i] = (i * 7919) % 13;
+  }
+  column::NumericStorage<int64_t> storage(&storage_data, ColumnType::kInt64,
+                                          false);
+  auto chain = storage.MakeChain();
+  base::ThreadPool pool(3);
+
+  Constraint c{0, FilterOp::kLt, SqlValue::Long(4)};
+  for (Range bounds : {Range(0, 10000), Range(13, 9871), Range(100, 150)}) {
+    RangeOrBitVector res = QueryExecutor::ParallelSearchForTesting(
+        c, *chain, bounds, &pool, 3, 64);
+    ASSERT_TRUE(res.IsBitVector());
+    ASSERT_EQ(ToIndices(std::move(res)),
+              ToIndices(chain->Search(c.op, c.value, bounds)));
+  }
+}
+
+TEST(QueryExecutor, ParallelSearchSorted) {
+  std::vector<int64_t> storage_data(10000);
+  std::iota(storage_data.begin(), storage_data.end(), 0);
+  column::NumericStorage<int64_t> storage(&storage_data, ColumnType::kInt64,
+                                          true);
+  auto chain = storage.MakeChain();
+  base::ThreadPool pool(3);
+
+  // The matching rows span several morsels: they should still be returned as
+  // a single Range.
+  Constraint c{0, FilterOp::kGe, SqlValue::Long(1234)};
+  RangeOrBitVector res = QueryExecutor::ParallelSearchForTesting(
+      c, *chain, Range(7, 9000), &pool, 3, 64);
+  ASSERT_TRUE(res.IsRange());
+  Range range = std::move(res).TakeIfRange();
+  ASSERT_EQ(range.start, 1234u);
+  ASSERT_EQ(range.end, 9000u);
+
+  Constraint none{0, FilterOp::kLt, SqlValue::Long(0)};
+  res = QueryExecutor::ParallelSearchForTesting(none, *chain, Range(7, 9000),
+                                                &pool, 3, 64);
+  ASSERT_TRUE(ToIndices(std::move(res)).empty());
+}
+
+TEST(QueryExecutor, ParallelSearchNullOverlay) {
+  std::vector<int64_t> storage_data;
+  BitVector bv;
+  for (uint32_t i = 0; i < 5000; ++i) {
+    if (i % 3 == 0) {
+      bv.AppendFalse();
+    } else {
+      bv.AppendTrue();
+      storage_data.push_back(i % 10);
+    }
+  }
+  // Makes the counts of |bv| stale: they should be rebuilt before the morsels
+  // are searched in parallel.
+  bv.Clear(1);
+  storage_data.erase(storage_data.begin());
+  auto numeric = std::make_unique<column::NumericStorage<int64_t>>(
+      &storage_data, ColumnType::kInt64, false);
+  column::NullOverlay storage(&bv);
+  auto chain = storage.MakeChain(numeric->MakeChain());
+  base::ThreadPool pool(3);
+
+  for (FilterOp op : {FilterOp::kEq, FilterOp::kIsNull}) {
+    Constraint c{0, op, SqlValue::Long(4)};
+    if (op == FilterOp::kIsNull)
+      c.value = SqlValue();
+    RangeOrBitVector res = QueryExecutor::ParallelSearchForTesting(
+        c, *chain, Range(1, 5000), &pool, 3, 128);
+    ASSERT_EQ(ToIndices(std::move(res)),
+              ToIndices(chain->Search(c.op, c.value, Range(1, 5000))));
+  }
+}
+
 TEST(QueryExecutor, OnlyStorageIndex) {
   // Setup storage
   std::vector<int64_t> storage_data(10);
@@ -16,12 +16,16 @@
 
 #include "src/trace_processor/db/runtime_table.h"
 
+#include <cstdint>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "perfetto/trace_processor/basic_types.h"
 #include "src/base/test/status_matchers.h"
+#include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column/types.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto::trace_processor {
@@ -62,5 +66,67 @@ TEST_F(RuntimeTableTest, IntThenDouble) {
   ASSERT_EQ(col.Get(1).AsDouble(), 1.3);
 }
 
+TEST_F(RuntimeTableTest, CompositeIndex) {
+  RuntimeTable::Builder builder(&pool_, {"utid", "ts", "dur"});
+  constexpr uint32_t kRows = 1000;
+  for (uint32_t i = 0; i < kRows; ++i) {
+    if (i % 11 == 0) {
+      ASSERT_OK(builder.AddNull(0));
+    } else {
+      ASSERT_OK(builder.AddInteger(0, i % 7));
+    }
+    ASSERT_OK(builder.AddInteger(1, (i * 37) % 101));
+    ASSERT_OK(builder.AddInteger(2, i % 3));
+  }
+  ASSERT_OK_AND_ASSIGN(auto table, std::move(builder).Build(kRows));
+  uint32_t utid = *table->ColumnIdxFromName("utid");
+  uint32_t ts = *table->ColumnIdxFromName("ts");
+  uint32_t dur = *table->ColumnIdxFromName("dur");
+
+  std::vector<std::vector<Constraint>> queries = {
+      {{utid, FilterOp::kEq, SqlValue::Long(3)},
+       {ts, FilterOp::kGe, SqlValue::Long(20)},
+       {ts, FilterOp::kLt, SqlValue::Long(60)}},
+      {{ts, FilterOp::kGt, SqlValue::Long(50)},
+       {dur, FilterOp::kEq, SqlValue::Long(1)},
+       {utid, FilterOp::kEq, SqlValue::Long(3)}},
+      {{utid, FilterOp::kEq, SqlValue::Long(5)}},
+      {{utid, FilterOp::kEq, SqlValue::Long(10)}},
+      {{utid, FilterOp::kIsNull, SqlValue()},
+       {ts, FilterOp::kLe, SqlValue::Long(50)}},
+      {{utid, FilterOp::kGt, SqlValue::Long(4)},
+       {ts, FilterOp::kLe, SqlValue::Long(50)}},
+      {{ts, FilterOp::kLe, SqlValue::Long(50)}},
+  };
+  std::vector<std::vector<uint32_t>> expected;
+  for (const auto& cs : queries) {
+    Query q;
+    q.constraints = cs;
+    expected.push_back(table->QueryToRowMap(q).TakeAsIndexVector());
+  }
+
+  ASSERT_OK(table->CreateIndex("utid_ts", {utid, ts}, false));
+  ASSERT_THAT(table->CreateIndex("utid_ts", {utid}, false), Not(IsOk()));
+
+  uint32_t matched = 0;
+  ASSERT_EQ(table->FindIndexForConstraints(queries[0], &matched),
+            &table->indexes()[0]);
+  ASSERT_EQ(matched, 2u);
+  ASSERT_EQ(table->FindIndexForConstraints(queries[5], &matched),
+            &table->indexes()[0]);
+  ASSERT_EQ(matched, 1u);
+  ASSERT_EQ(table->FindIndexForConstraints(queries[6], &matched), nullptr);
+
+  for (uint32_t i = 0; i < queries.size(); ++i) {
+    Query q;
+    q.constraints = queries[i];
+    ASSERT_EQ(table->QueryToRowMap(q).TakeAsIndexVector(), expected[i]) << i;
+  }
+
+  ASSERT_OK(table->DropIndex("utid_ts"));
+  ASSERT_TRUE(table->indexes().empty());
+  ASSERT_THAT(table->DropIndex("utid_ts"), Not(IsOk()));
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
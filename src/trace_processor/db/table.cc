@@ -17,12 +17,18 @@
 #include "src/trace_processor/db/table.h"
 
 #include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
 #include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/ref_counted.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -33,6 +39,7 @@
 #include "src/trace_processor/db/column/range_overlay.h"
 #include "src/trace_processor/db/column/selector_overlay.h"
 #include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/db/compare.h"
 #include "src/trace_processor/db/column_storage_overlay.h"
 #include "src/trace_processor/db/query_executor.h"
 
@@ -40,8 +47,34 @@ namespace perfetto::trace_processor {
 
 namespace {
 using Indices = column::DataLayerChain::Indices;
+
+// Returns whether |op| returns a contiguous range of rows when applied to
+// rows sorted on the constrained column.
+bool IsIndexOp(FilterOp op) {
+  switch (op) {
+    case FilterOp::kEq:
+    case FilterOp::kIsNull:
+    case FilterOp::kLt:
+    case FilterOp::kLe:
+    case FilterOp::kGt:
+    case FilterOp::kGe:
+    case FilterOp::kIsNotNull:
+      return true;
+    case FilterOp::kNe:
+    case FilterOp::kGlob:
+    case FilterOp::kRegex:
+      return false;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Returns whether |op| only matches rows with a single value.
+bool IsIndexEqOp(FilterOp op) {
+  return op == FilterOp::kEq || op == FilterOp::kIsNull;
 }
 
+}  // namespace
+
 Table::Table(StringPool* pool,
              uint32_t row_count,
              std::vector<ColumnLegacy> columns,
@@ -66,6 +99,7 @@ Table& Table::operator=(Table&& other) noexcept {
   null_layers_ = std::move(other.null_layers_);
   overlay_layers_ = std::move(other.overlay_layers_);
   chains_ = std::move(other.chains_);
+  indexes_ = std::move(other.indexes_);
 
   for (ColumnLegacy& col : columns_) {
     col.table_ = this;
@@ -79,6 +113,7 @@ Table Table::Copy() const {
     table.overlays_.emplace_back(overlay.Copy());
   }
   table.OnConstructionCompleted(storage_layers_, null_layers_, overlay_layers_);
+  table.indexes_ = indexes_;
   return table;
 }
 
@@ -105,7 +140,7 @@ RowMap Table::QueryToRowMap(const Query& q) const {
   }
 
   // Apply the query constraints.
-  RowMap rm = QueryExecutor::FilterLegacy(this, q.constraints);
+  RowMap rm = ApplyConstraints(q.constraints);
 
   if (q.order_type != Query::OrderType::kSort) {
     ApplyDistinct(q, &rm);
@@ -198,6 +233,208 @@ Table Table::Sort(const std::vector<Order>& ob) const {
   return table;
 }
 
+base::Status Table::CreateIndex(const std::string& name,
+                                std::vector<uint32_t> col_idxs,
+                                bool replace) {
+  if (col_idxs.empty()) {
+    return base::ErrStatus("Index %s must have at least one column",
+                           name.c_str());
+  }
+  for (uint32_t col_idx : col_idxs) {
+    PERFETTO_CHECK(col_idx < columns_.size());
+  }
+  auto it =
+      std::find_if(indexes_.begin(), indexes_.end(),
+                   [&name](const ColumnIndex& i) { return i.name == name; });
+  if (it != indexes_.end() && !replace) {
+    return base::ErrStatus("Index %s already exists", name.c_str());
+  }
+
+  Query q;
+  for (uint32_t col_idx : col_idxs) {
+    q.orders.push_back(Order{col_idx, false});
+  }
+  auto sorted_rows = std::make_shared<const std::vector<uint32_t>>(
+      QueryToRowMap(q).TakeAsIndexVector());
+
+  ColumnIndex index{name, std::move(col_idxs), std::move(sorted_rows)};
+  if (it != indexes_.end()) {
+    *it = std::move(index);
+  } else {
+    indexes_.push_back(std::move(index));
+  }
+  return base::OkStatus();
+}
+
+const Table::ColumnIndex& Table::ExtendIndex(const ColumnIndex& index) const {
+  const std::vector<uint32_t>& old_rows = *index.sorted_rows;
+  auto old_size = static_cast<uint32_t>(old_rows.size());
+
+  // Sort the new rows on their own: this is cheap as there are usually far
+  // fewer of them than rows in the index.
+  std::vector<Order> orders;
+  for (uint32_t col_idx : index.columns) {
+    orders.push_back(Order{col_idx, false});
+  }
+  std::vector<uint32_t> new_rows(row_count_ - old_size);
+  std::iota(new_rows.begin(), new_rows.end(), old_size);
+  QueryExecutor::SortLegacy(this, orders, new_rows);
+
+  // Then merge them into the existing rows. Both halves are stably sorted and
+  // all new rows come after the old ones in table order so, on ties, the new
+  // rows go last: this keeps the index identical to one built from scratch.
+  auto less = [this, &index](uint32_t a, uint32_t b) {
+    for (uint32_t col_idx : index.columns) {
+      const ColumnLegacy& col = columns_[col_idx];
+      int res = compare::SqlValue(col.Get(a), col.Get(b));
+      if (res != 0) {
+        return res < 0;
+      }
+    }
+    return false;
+  };
+  auto sorted_rows = std::make_shared<std::vector<uint32_t>>();
+  sorted_rows->reserve(row_count_);
+  std::merge(old_rows.begin(), old_rows.end(), new_rows.begin(),
+             new_rows.end(), std::back_inserter(*sorted_rows), less);
+
+  auto pos = static_cast<size_t>(&index - indexes_.data());
+  indexes_[pos].sorted_rows = std::move(sorted_rows);
+  return indexes_[pos];
+}
+
+base::Status Table::DropIndex(const std::string& name) {
+  auto it =
+      std::find_if(indexes_.begin(), indexes_.end(),
+                   [&name](const ColumnIndex& i) { return i.name == name; });
+  if (it == indexes_.end()) {
+    return base::ErrStatus("Index %s does not exist", name.c_str());
+  }
+  indexes_.erase(it);
+  return base::OkStatus();
+}
+
+const Table::ColumnIndex* Table::FindIndexForConstraints(
+    const std::vector<Constraint>& cs,
+    uint32_t* matched) const {
+  *matched = 0;
+  if (indexes_.empty()) {
+    return nullptr;
+  }
+
+  // An equality constraint on an id column already filters down to a single
+  // row without needing any index.
+  for (const Constraint& c : cs) {
+    if (c.op == FilterOp::kEq && columns_[c.col_idx].IsId()) {
+      return nullptr;
+    }
+  }
+
+  const ColumnIndex* best = nullptr;
+  for (const ColumnIndex& index : indexes_) {
+    uint32_t count = 0;
+    for (uint32_t col_idx : index.columns) {
+      bool has_eq = false;
+      bool has_range = false;
+      for (const Constraint& c : cs) {
+        if (c.col_idx == col_idx && IsIndexOp(c.op)) {
+          has_eq |= IsIndexEqOp(c.op);
+          has_range |= !IsIndexEqOp(c.op);
+        }
+      }
+      if (!has_eq && !has_range) {
+        break;
+      }
+      count++;
+
+      // The rows matching a range constraint are not sorted on the following
+      // columns of the index anymore.
+      if (!has_eq) {
+        break;
+      }
+    }
+    if (count > *matched) {
+      best = &index;
+      *matched = count;
+    }
+  }
+  return best;
+}
+
+std::optional<uint32_t> Table::ColumnIdxFromName(
+    const std::string& name) const {
+  for (uint32_t i = 0; i < columns_.size(); ++i) {
+    if (name == columns_[i].name()) {
+      return i;
+    }
+  }
+  return std::nullopt;
+}
+
+size_t Table::overlays_memory_usage() const {
+  size_t bytes = 0;
+  for (const ColumnStorageOverlay& overlay : overlays_) {
+    bytes += overlay.row_map().memory_usage();
+  }
+  return bytes;
+}
+
+size_t Table::indexes_memory_usage() const {
+  size_t bytes = 0;
+  for (const ColumnIndex& index : indexes_) {
+    bytes += index.sorted_rows->capacity() * sizeof(uint32_t);
+  }
+  return bytes;
+}
+
+RowMap Table::ApplyConstraints(const std::vector<Constraint>& cs) const {
+  uint32_t matched = 0;
+  const ColumnIndex* index = FindIndexForConstraints(cs, &matched);
+
+  if (!index || index->sorted_rows->size() > row_count_) {
+    return QueryExecutor::FilterLegacy(this, cs);
+  }
+  // Rows inserted after the index was created (e.g. while a trace is being
+  // ingested incrementally) are merged into it the first time it is used.
+  if (index->sorted_rows->size() < row_count_) {
+    index = &ExtendIndex(*index);
+  }
+
+  // Narrow down the rows of the index one column at a time: all the rows in
+  // [begin, begin + size) share the same values for the columns already
+  // processed so they are sorted on the next column.
+  const uint32_t* begin = index->sorted_rows->data();
+  auto size = static_cast<uint32_t>(index->sorted_rows->size());
+  std::vector<Constraint> remaining;
+  std::vector<bool> applied(cs.size());
+  for (uint32_t i = 0; i < matched; ++i) {
+    uint32_t col_idx = index->columns[i];
+    for (uint32_t j = 0; j < cs.size(); ++j) {
+      const Constraint& c = cs[j];
+      if (c.col_idx != col_idx || !IsIndexOp(c.op)) {
+        continue;
+      }
+      Range r = ChainForColumn(col_idx).OrderedIndexSearch(
+          c.op, c.value,
+          column::DataLayerChain::OrderedIndices{
+              begin, size, Indices::State::kNonmonotonic});
+      begin += r.start;
+      size = r.size();
+      applied[j] = true;
+    }
+  }
+  for (uint32_t j = 0; j < cs.size(); ++j) {
+    if (!applied[j]) {
+      remaining.push_back(cs[j]);
+    }
+  }
+
+  // The rest of the query (and the callers) expect the rows in table order.
+  std::vector<uint32_t> rows(begin, begin + size);
+  std::sort(rows.begin(), rows.end());
+  return QueryExecutor::FilterLegacy(this, remaining, RowMap(std::move(rows)));
+}
+
 void Table::OnConstructionCompleted(
     std::vector<RefPtr<column::DataLayer>> storage_layers,
     std::vector<RefPtr<column::DataLayer>> null_layers,
@@ -17,13 +17,16 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_TABLE_H_
 #define SRC_TRACE_PROCESSOR_DB_TABLE_H_
 
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/ref_counted.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -116,6 +119,17 @@ class Table {
     std::vector<Column> columns;
   };
 
+  // A composite index over the columns |columns| of the table, created with
+  // CREATE PERFETTO INDEX. |sorted_rows| contains every row of the table
+  // ordered lexicographically by the values of |columns| (with NULLs first):
+  // constraints on a prefix of |columns| can then be applied with binary
+  // searches as long as all but the last one are equality constraints.
+  struct ColumnIndex {
+    std::string name;
+    std::vector<uint32_t> columns;
+    std::shared_ptr<const std::vector<uint32_t>> sorted_rows;
+  };
+
   virtual ~Table();
 
   // We explicitly define the move constructor here because we need to update
@@ -147,9 +161,42 @@ class Table {
   // Creates a copy of this table.
   Table Copy() const;
 
+  // Sorts the rows of the table on |col_idxs| and stores the result as the
+  // index |name|. Returns an error if an index with the same name already
+  // exists and |replace| is false.
+  //
+  // Note: rows inserted later are merged into the index the next time it is
+  // used but changing the values of existing rows is not detected: indexes
+  // should not be created on columns which are updated in place.
+  base::Status CreateIndex(const std::string& name,
+                           std::vector<uint32_t> col_idxs,
+                           bool replace);
+
+  // Removes the index |name| from the table.
+  base::Status DropIndex(const std::string& name);
+
+  // Returns the index which can be used to apply the largest number of the
+  // constraints in |cs| (or nullptr if there is no such index) and sets
+  // |*matched| to the number of its columns which are constrained. Only the
+  // |col_idx| and |op| of each constraint are read so this can also be used
+  // when planning a query.
+  const ColumnIndex* FindIndexForConstraints(const std::vector<Constraint>& cs,
+                                             uint32_t* matched) const;
+
+  // Returns the index of the column called |name|, if any.
+  std::optional<uint32_t> ColumnIdxFromName(const std::string& name) const;
+
+  // Returns the number of bytes of memory used by the overlays of the table
+  // (i.e. the RowMaps selecting the rows of the parent tables).
+  size_t overlays_memory_usage() const;
+
+  // Returns the number of bytes of memory used by the indexes of the table.
+  size_t indexes_memory_usage() const;
+
   uint32_t row_count() const { return row_count_; }
   StringPool* string_pool() const { return string_pool_; }
   const std::vector<ColumnLegacy>& columns() const { return columns_; }
+  const std::vector<ColumnIndex>& indexes() const { return indexes_; }
   const std::vector<RefPtr<column::DataLayer>>& storage_layers() const {
     return storage_layers_;
   }
@@ -198,6 +245,8 @@ class Table {
 
   Table CopyExceptOverlays() const;
 
+  RowMap ApplyConstraints(const std::vector<Constraint>&) const;
+  const ColumnIndex& ExtendIndex(const ColumnIndex&) const;
   void ApplyDistinct(const Query&, RowMap*) const;
   void ApplySort(const Query&, RowMap*) const;
 
@@ -210,6 +259,10 @@ class Table {
   std::vector<RefPtr<column::DataLayer>> null_layers_;
   std::vector<RefPtr<column::DataLayer>> overlay_layers_;
   mutable std::vector<std::unique_ptr<column::DataLayerChain>> chains_;
+
+  // Mutable as indexes are extended lazily with the rows inserted after they
+  // were created.
+  mutable std::vector<ColumnIndex> indexes_;
 };
 
 }  // namespace perfetto::trace_processor
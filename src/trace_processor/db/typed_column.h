@@ -17,6 +17,12 @@
 #ifndef SRC_TRACE_PROCESSOR_DB_TYPED_COLUMN_H_
 #define SRC_TRACE_PROCESSOR_DB_TYPED_COLUMN_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <type_traits>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
 #include "src/trace_processor/db/column.h"
 #include "src/trace_processor/db/typed_column_internal.h"
 
@@ -92,6 +98,28 @@ class TypedColumn : public ColumnLegacy {
   // Inserts the value at the end of the column.
   void Append(T v) { mutable_storage()->Append(Serializer::Serialize(v)); }
 
+  // Inserts |count| values at the end of the column, the ith of which is
+  // returned by |fn(i)|. Faster than calling Append() |count| times.
+  template <typename Fn>
+  void AppendMultiple(uint32_t count, Fn fn) {
+    uint32_t start = storage().size();
+    mutable_storage()->AppendMultiple(
+        count, [&fn](uint32_t i) { return Serializer::Serialize(fn(i)); });
+#if PERFETTO_DCHECK_IS_ON()
+    // Only the new values, and the last one before them, need to be checked
+    // to keep the column sorted.
+    if constexpr (!TH::is_optional && std::is_arithmetic_v<stored_type>) {
+      if (IsSorted()) {
+        const auto& v = storage().vector();
+        PERFETTO_DCHECK(std::is_sorted(v.begin() + (start > 0 ? start - 1 : 0),
+                                       v.end()));
+      }
+    }
+#else
+    base::ignore_result(start);
+#endif
+  }
+
   // Returns the row containing the given value in the Column.
   std::optional<uint32_t> IndexOf(sql_value_type v) const {
     return ColumnLegacy::IndexOf(ToSqlValue(v));
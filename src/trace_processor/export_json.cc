@@ -27,10 +27,13 @@
 #include <deque>
 #include <limits>
 #include <memory>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "src/trace_processor/storage/metadata.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -48,6 +51,8 @@ namespace json {
 
 namespace {
 
+constexpr uint32_t kMaxExportThreads = 8;
+
 class FileWriter : public OutputWriter {
  public:
   FileWriter(FILE* file) : file_(file) {}
@@ -92,16 +97,29 @@ const char* GetNonNullString(const TraceStorage* storage,
              : storage->GetString(*id).c_str();
 }
 
+// All the events are serialized with writers created by this function, so
+// that events serialized on different threads are byte-identical.
+std::unique_ptr<Json::StreamWriter> CreateEventWriter() {
+  Json::StreamWriterBuilder b;
+  b.settings_["indentation"] = "";
+  return std::unique_ptr<Json::StreamWriter>(b.newStreamWriter());
+}
+
 class JsonExporter {
  public:
   JsonExporter(const TraceStorage* storage,
                OutputWriter* output,
                ArgumentFilterPredicate argument_filter,
                MetadataFilterPredicate metadata_filter,
-               LabelFilterPredicate label_filter)
+               LabelFilterPredicate label_filter,
+               uint32_t thread_count)
       : storage_(storage),
         args_builder_(storage_),
-        writer_(output, argument_filter, metadata_filter, label_filter) {}
+        writer_(output, argument_filter, metadata_filter, label_filter),
+        thread_count_(thread_count) {
+    if (thread_count > 0)
+      thread_pool_.reset(new base::ThreadPool(thread_count));
+  }
 
   util::Status Export() {
     util::Status status = MapUniquePidsAndTids();
@@ -163,9 +181,7 @@ class JsonExporter {
           metadata_filter_(metadata_filter),
           label_filter_(label_filter),
           first_event_(true) {
-      Json::StreamWriterBuilder b;
-      b.settings_["indentation"] = "";
-      writer_.reset(b.newStreamWriter());
+      writer_ = CreateEventWriter();
       WriteHeader();
     }
 
@@ -178,25 +194,41 @@ class JsonExporter {
       DoWriteEvent(event);
     }
 
-    void AddAsyncBeginEvent(const Json::Value& event) {
+    // Writes an event which has already been serialized by a writer returned
+    // by CreateEventWriter(). Only valid if there is no argument filter, as
+    // it can't be applied to serialized events.
+    void WriteSerializedCommonEvent(const std::string& serialized) {
+      PERFETTO_DCHECK(!argument_filter_);
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      async_begin_events_.push_back(event);
+      if (!first_event_)
+        output_->AppendString(",\n");
+      output_->AppendString(serialized);
+      first_event_ = false;
     }
 
-    void AddAsyncInstantEvent(const Json::Value& event) {
+    bool has_argument_filter() const { return !!argument_filter_; }
+
+    void AddAsyncBeginEvent(Json::Value event) {
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      async_instant_events_.push_back(event);
+      async_begin_events_.push_back(std::move(event));
     }
 
-    void AddAsyncEndEvent(const Json::Value& event) {
+    void AddAsyncInstantEvent(Json::Value event) {
       if (label_filter_ && !label_filter_("traceEvents"))
         return;
 
-      async_end_events_.push_back(event);
+      async_instant_events_.push_back(std::move(event));
+    }
+
+    void AddAsyncEndEvent(Json::Value event) {
+      if (label_filter_ && !label_filter_("traceEvents"))
+        return;
+
+      async_end_events_.push_back(std::move(event));
     }
 
     void SortAndEmitAsyncEvents() {
@@ -775,9 +807,113 @@ class JsonExporter {
     return last_ts;
   }
 
+  // An event converted from a slice, waiting to be handed to |writer_|.
+  struct SliceEvent {
+    enum Kind { kCommon, kAsyncBegin, kAsyncInstant, kAsyncEnd };
+
+    Kind kind;
+    Json::Value event;
+
+    // Set instead of |event| for kCommon events serialized upfront.
+    std::string serialized;
+  };
+
+  // A range of rows of the slice table and the events they are converted to.
+  struct SliceBatch {
+    void Add(SliceEvent::Kind kind, Json::Value event) {
+      SliceEvent e{kind, Json::Value(), std::string()};
+      if (kind == SliceEvent::kCommon && serializer) {
+        std::ostringstream ss;
+        serializer->write(event, &ss);
+        e.serialized = ss.str();
+      } else {
+        e.event = std::move(event);
+      }
+      events.emplace_back(std::move(e));
+    }
+
+    uint32_t begin_row = 0;
+    uint32_t end_row = 0;
+
+    // If set, kCommon events are serialized as they are added. This moves
+    // most of the cost of writing them to the thread converting the batch.
+    Json::StreamWriter* serializer = nullptr;
+
+    std::vector<SliceEvent> events;
+    base::WaitableEvent converted;
+  };
+
+  // Slices are converted to events in batches, on |thread_pool_| if there is
+  // one, and the events are then handed to |writer_| in the order of the
+  // slice table, so the output doesn't depend on the number of threads. Only
+  // a bounded number of batches is buffered at any time.
   util::Status ExportSlices() {
+    static constexpr uint32_t kRowsPerBatch = 4096;
+    const uint32_t row_count = storage_->slice_table().row_count();
+    const size_t max_batches_in_flight =
+        thread_pool_ ? 2 * thread_count_ : 1;
+
+    std::deque<std::unique_ptr<SliceBatch>> batches;
+    uint32_t next_row = 0;
+    while (next_row < row_count || !batches.empty()) {
+      while (next_row < row_count && batches.size() < max_batches_in_flight) {
+        std::unique_ptr<SliceBatch> batch(new SliceBatch());
+        batch->begin_row = next_row;
+        batch->end_row = std::min(row_count, next_row + kRowsPerBatch);
+        next_row = batch->end_row;
+        SliceBatch* raw_batch = batch.get();
+        if (thread_pool_) {
+          thread_pool_->PostTask([this, raw_batch] {
+            ConvertSlices(raw_batch);
+            raw_batch->converted.Notify();
+          });
+        } else {
+          ConvertSlices(raw_batch);
+          raw_batch->converted.Notify();
+        }
+        batches.emplace_back(std::move(batch));
+      }
+
+      std::unique_ptr<SliceBatch> batch = std::move(batches.front());
+      batches.pop_front();
+      batch->converted.Wait();
+      for (SliceEvent& e : batch->events) {
+        switch (e.kind) {
+          case SliceEvent::kCommon:
+            if (e.serialized.empty()) {
+              writer_.WriteCommonEvent(e.event);
+            } else {
+              writer_.WriteSerializedCommonEvent(e.serialized);
+            }
+            break;
+          case SliceEvent::kAsyncBegin:
+            writer_.AddAsyncBeginEvent(std::move(e.event));
+            break;
+          case SliceEvent::kAsyncInstant:
+            writer_.AddAsyncInstantEvent(std::move(e.event));
+            break;
+          case SliceEvent::kAsyncEnd:
+            writer_.AddAsyncEndEvent(std::move(e.event));
+            break;
+        }
+      }
+    }
+    return util::OkStatus();
+  }
+
+  // Converts the rows of |batch| to events. This only reads the storage and
+  // the state computed before the export of slices starts, so it can run on
+  // any thread.
+  void ConvertSlices(SliceBatch* batch) const {
+    std::unique_ptr<Json::StreamWriter> serializer;
+    if (!writer_.has_argument_filter()) {
+      serializer = CreateEventWriter();
+      batch->serializer = serializer.get();
+    }
+
     const auto& slices = storage_->slice_table();
-    for (auto it = slices.IterateRows(); it; ++it) {
+    for (uint32_t row = batch->begin_row; row < batch->end_row; ++row) {
+      tables::SliceTable::ConstRowReference it(&slices, row);
       // Skip slices with empty category - these are ftrace/system slices that
       // were also imported into the raw table and will be exported from there
       // by trace_to_text.
@@ -911,7 +1047,7 @@ class JsonExporter {
               event["tidelta"] = Json::Int64(*thread_instruction_delta);
           }
         }
-        writer_.WriteCommonEvent(event);
+        batch->Add(SliceEvent::kCommon, std::move(event));
       } else if (is_child_track ||
                  (legacy_chrome_track && track_args->isMember("trace_id"))) {
         // Async event slice.
@@ -991,15 +1127,15 @@ class JsonExporter {
           if (legacy_phase.empty()) {
             // Instant async event.
             event["ph"] = "n";
-            writer_.AddAsyncInstantEvent(event);
+            batch->Add(SliceEvent::kAsyncInstant, std::move(event));
           } else {
             // Async step events.
             event["ph"] = legacy_phase;
-            writer_.AddAsyncBeginEvent(event);
+            batch->Add(SliceEvent::kAsyncBegin, std::move(event));
           }
         } else {  // Async start and end.
           event["ph"] = legacy_phase.empty() ? "b" : legacy_phase;
-          writer_.AddAsyncBeginEvent(event);
+          batch->Add(SliceEvent::kAsyncBegin, event);
           // If the slice didn't finish, the duration may be negative. Don't
           // write the end event in this case.
           if (duration_ns > 0) {
@@ -1015,7 +1151,7 @@ class JsonExporter {
                   (*thread_instruction_count + *thread_instruction_delta));
             }
             event["args"].clear();
-            writer_.AddAsyncEndEvent(event);
+            batch->Add(SliceEvent::kAsyncEnd, std::move(event));
           }
         }
       } else {
@@ -1047,11 +1183,11 @@ class JsonExporter {
           } else {
             event["s"] = "g";
           }
-          writer_.WriteCommonEvent(event);
+          batch->Add(SliceEvent::kCommon, std::move(event));
         }
       }
     }
-    return util::OkStatus();
+    batch->serializer = nullptr;
   }
 
   std::optional<Json::Value> CreateFlowEventV1(uint32_t flow_id,
@@ -1776,13 +1912,13 @@ class JsonExporter {
     return util::OkStatus();
   }
 
-  uint32_t UpidToPid(UniquePid upid) {
+  uint32_t UpidToPid(UniquePid upid) const {
     auto pid_it = upids_to_exported_pids_.find(upid);
     PERFETTO_DCHECK(pid_it != upids_to_exported_pids_.end());
     return pid_it->second;
   }
 
-  std::pair<uint32_t, uint32_t> UtidToPidAndTid(UniqueTid utid) {
+  std::pair<uint32_t, uint32_t> UtidToPidAndTid(UniqueTid utid) const {
     auto pid_and_tid_it = utids_to_exported_pids_and_tids_.find(utid);
     PERFETTO_DCHECK(pid_and_tid_it != utids_to_exported_pids_and_tids_.end());
     return pid_and_tid_it->second;
@@ -1871,6 +2007,8 @@ class JsonExporter {
   const TraceStorage* storage_;
   ArgsBuilder args_builder_;
   TraceFormatWriter writer_;
+  uint32_t thread_count_ = 0;
+  std::unique_ptr<base::ThreadPool> thread_pool_;
 
   // If a pid/tid is duplicated between two or more  different processes/threads
   // (pid/tid reuse), we export the subsequent occurrences with different
@@ -1898,10 +2036,12 @@ util::Status ExportJson(const TraceStorage* storage,
                         OutputWriter* output,
                         ArgumentFilterPredicate argument_filter,
                         MetadataFilterPredicate metadata_filter,
-                        LabelFilterPredicate label_filter) {
+                        LabelFilterPredicate label_filter,
+                        uint32_t thread_count) {
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
   JsonExporter exporter(storage, output, std::move(argument_filter),
-                        std::move(metadata_filter), std::move(label_filter));
+                        std::move(metadata_filter), std::move(label_filter),
+                        thread_count);
   return exporter.Export();
 #else
   perfetto::base::ignore_result(storage);
@@ -1909,6 +2049,7 @@ util::Status ExportJson(const TraceStorage* storage,
   perfetto::base::ignore_result(argument_filter);
   perfetto::base::ignore_result(metadata_filter);
   perfetto::base::ignore_result(label_filter);
+  perfetto::base::ignore_result(thread_count);
   return util::ErrStatus("JSON support is not compiled in this build");
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_TP_JSON)
 }
@@ -1926,8 +2067,13 @@ util::Status ExportJson(TraceProcessorStorage* tp,
 }
 
 util::Status ExportJson(const TraceStorage* storage, FILE* output) {
+  // Slices are converted to JSON on worker threads, leaving the calling thread
+  // free to write them out. Past a handful of threads the writer is the
+  // bottleneck, so there's no point in using more.
+  uint32_t thread_count =
+      std::min(kMaxExportThreads, base::ThreadPool::MaxConcurrency() - 1);
   FileWriter writer(output);
-  return ExportJson(storage, &writer, nullptr, nullptr, nullptr);
+  return ExportJson(storage, &writer, nullptr, nullptr, nullptr, thread_count);
 }
 
 }  // namespace json
@@ -30,12 +30,14 @@ namespace json {
 // Export trace to a file stream in json format.
 util::Status ExportJson(const TraceStorage*, FILE* output);
 
-// For testing.
+// For testing. If |thread_count| is non-zero, slices are converted to JSON on
+// that many worker threads. The output is the same regardless.
 util::Status ExportJson(const TraceStorage* storage,
                         OutputWriter*,
                         ArgumentFilterPredicate = nullptr,
                         MetadataFilterPredicate = nullptr,
-                        LabelFilterPredicate = nullptr);
+                        LabelFilterPredicate = nullptr,
+                        uint32_t thread_count = 0);
 
 }  // namespace json
 }  // namespace trace_processor
@@ -20,6 +20,8 @@
 #include <string.h>
 
 #include <limits>
+#include <string>
+#include <vector>
 
 #include <json/reader.h>
 #include <json/value.h>
@@ -1363,6 +1365,68 @@ TEST_F(ExportJsonTest, AsyncInstantEvent) {
   EXPECT_EQ(event["args"][kArgName].asInt(), kArgValue);
 }
 
+TEST_F(ExportJsonTest, ParallelExportMatchesSerialExport) {
+  StringId cat_id = context_.storage->InternString(base::StringView("cat"));
+  StringId arg_key_id =
+      context_.storage->InternString(base::StringView("arg_name"));
+
+  std::vector<TrackId> tracks;
+  for (uint32_t i = 0; i < 4; ++i) {
+    UniqueTid utid = context_.process_tracker->UpdateThread(10 + i, 1 + i % 2);
+    tracks.push_back(context_.track_tracker->InternThreadTrack(utid));
+  }
+  UniquePid upid = context_.process_tracker->GetOrCreateProcess(1);
+  StringId async_name_id =
+      context_.storage->InternString(base::StringView("async"));
+  for (int64_t source_id = 0; source_id < 4; ++source_id) {
+    tracks.push_back(context_.track_tracker->InternLegacyChromeAsyncTrack(
+        async_name_id, upid, source_id, /*source_id_is_process_scoped=*/true,
+        /*source_scope=*/kNullStringId));
+  }
+  context_.args_tracker->Flush();  // Flush track args.
+
+  // Enough slices to span several batches, mixing complete, unfinished and
+  // instant thread slices with async ones.
+  auto* slices = context_.storage->mutable_slice_table();
+  for (uint32_t i = 0; i < 20000; ++i) {
+    StringId name_id = context_.storage->InternString(
+        base::StringView("name" + std::to_string(i % 100)));
+    int64_t dur = i % 7 == 0 ? 0 : (i % 11 == 0 ? -1 : 1000 * (i % 13 + 1));
+    slices->Insert({int64_t(i) * 1000, dur, tracks[i % tracks.size()], cat_id,
+                    name_id, 0, 0, 0});
+    if (i % 3 == 0) {
+      GlobalArgsTracker::Arg arg;
+      arg.flat_key = arg_key_id;
+      arg.key = arg_key_id;
+      arg.value = Variadic::Integer(i);
+      ArgSetId args = context_.global_args_tracker->AddArgSet({arg}, 0, 1);
+      slices->mutable_arg_set_id()->Set(i, args);
+    }
+  }
+
+  auto export_with_threads = [this](uint32_t thread_count,
+                                    ArgumentFilterPredicate argument_filter) {
+    StringOutputWriter writer;
+    EXPECT_TRUE(ExportJson(context_.storage.get(), &writer, argument_filter,
+                           nullptr, nullptr, thread_count)
+                    .ok());
+    return writer.TakeStr();
+  };
+
+  std::string serial = export_with_threads(0, nullptr);
+  EXPECT_GT(ToJsonValue(serial)["traceEvents"].size(), 20000u);
+  EXPECT_EQ(export_with_threads(1, nullptr), serial);
+  EXPECT_EQ(export_with_threads(4, nullptr), serial);
+
+  ArgumentFilterPredicate argument_filter =
+      [](const char*, const char* name, ArgumentNameFilterPredicate*) {
+        return strcmp(name, "name1") != 0;
+      };
+  std::string filtered_serial = export_with_threads(0, argument_filter);
+  EXPECT_NE(filtered_serial, serial);
+  EXPECT_EQ(export_with_threads(4, argument_filter), filtered_serial);
+}
+
 TEST_F(ExportJsonTest, RawEvent) {
   const int64_t kTimestamp = 10000000;
   const int64_t kDuration = 10000;
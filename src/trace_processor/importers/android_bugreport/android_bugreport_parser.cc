@@ -18,9 +18,15 @@
 
 #include <algorithm>
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/android_bugreport/android_log_parser.h"
@@ -28,6 +34,7 @@
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
 #include "src/trace_processor/types/trace_processor_context.h"
+#include "src/trace_processor/util/streaming_line_reader.h"
 #include "src/trace_processor/util/zip_reader.h"
 
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
@@ -59,12 +66,51 @@ void AndroidBugreportParser::NotifyEndOfFile() {
     return;
   }
 
-  ParsePersistentLogcat();
-  ParseDumpstateTxt();
+  base::ThreadPool* pool = GetThreadPool();
+  if (!pool) {
+    ParsePersistentLogcat(nullptr);
+    ParseDumpstateTxt(nullptr);
+    SortAndStoreLogcat();
+    return;
+  }
+
+  // Inflate the dumpstate file in the background while the persistent logcat
+  // is parsed: it can't be parsed before as its logs are de-duped against the
+  // persistent ones.
+  const util::ZipFile* dumpstate = zip_reader_->Find(dumpstate_fname_);
+  std::vector<uint8_t> dumpstate_data;
+  base::Status dumpstate_status;
+  base::WaitableEvent dumpstate_inflated;
+  pool->PostTask(
+      [dumpstate, &dumpstate_data, &dumpstate_status, &dumpstate_inflated] {
+        dumpstate_status = dumpstate->Decompress(&dumpstate_data);
+        dumpstate_inflated.Notify();
+      });
+  ParsePersistentLogcat(pool);
+  dumpstate_inflated.Wait();
+
+  // On failure, fall back on streaming decompression, which parses the lines
+  // before the error like in the single threaded mode.
+  bool inflated = dumpstate_status.ok() && !dumpstate_data.empty();
+  ParseDumpstateTxt(inflated ? &dumpstate_data : nullptr);
   SortAndStoreLogcat();
 }
 
-void AndroidBugreportParser::ParseDumpstateTxt() {
+base::ThreadPool* AndroidBugreportParser::GetThreadPool() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  const uint32_t thread_count = context_->config.tokenizer_thread_count;
+  if (thread_count > 1) {
+    if (!thread_pool_)
+      thread_pool_.reset(new base::ThreadPool(thread_count));
+    return thread_pool_.get();
+  }
+#endif
+  return nullptr;
+}
+
+void AndroidBugreportParser::ParseDumpstateTxt(
+    const std::vector<uint8_t>* inflated_data) {
   // Dumpstate is organized in a two level hierarchy, beautifully flattened into
   // one text file with load bearing ----- markers:
   // 1. Various dumpstate sections, examples:
@@ -100,7 +146,7 @@ void AndroidBugreportParser::ParseDumpstateTxt() {
   StringId service_id = StringId::Null();  // The current dumpsys service.
   static constexpr size_t npos = base::StringView::npos;
   enum { OTHER = 0, DUMPSYS, LOG } cur_sect = OTHER;
-  zf->DecompressLines([&](const std::vector<base::StringView>& lines) {
+  auto parse_lines = [&](const std::vector<base::StringView>& lines) {
     // Optimization for ParseLogLines() below. Avoids ctor/dtor-ing a new vector
     // on every line.
     std::vector<base::StringView> log_line(1);
@@ -168,10 +214,18 @@ void AndroidBugreportParser::ParseDumpstateTxt() {
       context_->storage->mutable_android_dumpstate_table()->Insert(
           {section_id, service_id, context_->storage->InternString(line)});
     }
-  });
+  };
+  if (inflated_data) {
+    util::StreamingLineReader line_reader(parse_lines);
+    line_reader.Tokenize(base::StringView(
+        reinterpret_cast<const char*>(inflated_data->data()),
+        inflated_data->size()));
+  } else {
+    zf->DecompressLines(parse_lines);
+  }
 }
 
-void AndroidBugreportParser::ParsePersistentLogcat() {
+void AndroidBugreportParser::ParsePersistentLogcat(base::ThreadPool* pool) {
   // 1. List logcat files in reverse timestmap order (old to most recent).
   // 2. Decode events from log lines into a vector. Dedupe and intern strings.
   // 3. Globally sort all extracted events.
@@ -191,13 +245,17 @@ void AndroidBugreportParser::ParsePersistentLogcat() {
   }
   std::sort(log_paths.begin(), log_paths.end());
 
-  // Push all events into the AndroidLogParser. It will take care of string
-  // interning into the pool. Appends entries into `log_events`.
-  for (const auto& kv : log_paths) {
-    util::ZipFile* zf = zip_reader_->Find(kv.second);
-    zf->DecompressLines([&](const std::vector<base::StringView>& lines) {
-      log_parser.ParseLogLines(lines, &log_events_);
-    });
+  if (pool) {
+    DecodeLogcatFiles(pool, log_paths, &log_parser);
+  } else {
+    // Push all events into the AndroidLogParser. It will take care of string
+    // interning into the pool. Appends entries into `log_events`.
+    for (const auto& kv : log_paths) {
+      util::ZipFile* zf = zip_reader_->Find(kv.second);
+      zf->DecompressLines([&](const std::vector<base::StringView>& lines) {
+        log_parser.ParseLogLines(lines, &log_events_);
+      });
+    }
   }
 
   // Do an initial sorting pass. This is not the final sorting because we
@@ -207,6 +265,35 @@ void AndroidBugreportParser::ParsePersistentLogcat() {
   SortLogEvents();
 }
 
+void AndroidBugreportParser::DecodeLogcatFiles(
+    base::ThreadPool* pool,
+    const std::vector<std::pair<uint64_t, std::string>>& log_paths,
+    AndroidLogParser* log_parser) {
+  // The files are inflated and decoded on the pool, then their strings are
+  // interned on this thread in the same order as in the single threaded mode,
+  // so that the result is identical. This is done in batches of files to bound
+  // the memory held by the decoded events.
+  const size_t batch_size = context_->config.tokenizer_thread_count;
+  for (size_t start = 0; start < log_paths.size(); start += batch_size) {
+    const size_t end = std::min(start + batch_size, log_paths.size());
+    std::vector<DecodedAndroidLogs> decoded(end - start);
+    base::WaitableEvent all_done;
+    for (size_t i = start; i < end; ++i) {
+      const util::ZipFile* zf = zip_reader_->Find(log_paths[i].second);
+      DecodedAndroidLogs* out = &decoded[i - start];
+      pool->PostTask([log_parser, zf, out, &all_done] {
+        zf->DecompressLines([&](const std::vector<base::StringView>& lines) {
+          log_parser->DecodeLogLines(lines, out);
+        });
+        all_done.Notify();
+      });
+    }
+    all_done.Wait(end - start);
+    for (const DecodedAndroidLogs& d : decoded)
+      log_parser->AddDecodedLogs(d, &log_events_);
+  }
+}
+
 void AndroidBugreportParser::SortAndStoreLogcat() {
   // Sort the union of all log events parsed from both /data/misc/logd
   // (persistent logcat on disk) and the dumpstate file (last in-memory logcat).
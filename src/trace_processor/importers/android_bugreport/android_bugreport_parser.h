@@ -17,16 +17,29 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_ANDROID_BUGREPORT_ANDROID_BUGREPORT_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_ANDROID_BUGREPORT_ANDROID_BUGREPORT_PARSER_H_
 
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
 namespace trace_processor {
 
 namespace util {
 class ZipReader;
 }
 
+class AndroidLogParser;
 struct AndroidLogEvent;
 class TraceProcessorContext;
 
@@ -42,8 +55,22 @@ class AndroidBugreportParser : public ChunkedTraceReader {
 
  private:
   bool DetectYearAndBrFilename();
-  void ParsePersistentLogcat();
-  void ParseDumpstateTxt();
+
+  // Returns the pool to parse the files of the bugreport on, or nullptr if
+  // they should be parsed on the calling thread, i.e. unless
+  // |Config::tokenizer_thread_count| > 1.
+  base::ThreadPool* GetThreadPool();
+
+  // If |pool| is not null, the logcat files are decoded on it.
+  void ParsePersistentLogcat(base::ThreadPool* pool);
+  void DecodeLogcatFiles(
+      base::ThreadPool* pool,
+      const std::vector<std::pair<uint64_t, std::string>>& log_paths,
+      AndroidLogParser* log_parser);
+
+  // Parses the already inflated |inflated_data| if not null, otherwise
+  // inflates the dumpstate file while parsing it.
+  void ParseDumpstateTxt(const std::vector<uint8_t>* inflated_data);
   void SortAndStoreLogcat();
   void SortLogEvents();
 
@@ -53,6 +80,7 @@ class AndroidBugreportParser : public ChunkedTraceReader {
   std::string build_fpr_;
   bool first_chunk_seen_ = false;
   std::unique_ptr<util::ZipReader> zip_reader_;
+  std::unique_ptr<base::ThreadPool> thread_pool_;
   std::vector<AndroidLogEvent> log_events_;
   size_t log_events_last_sorted_idx_ = 0;
 };
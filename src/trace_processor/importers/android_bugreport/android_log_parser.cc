@@ -17,7 +17,10 @@
 #include "src/trace_processor/importers/android_bugreport/android_log_parser.h"
 
 #include <string.h>
+
 #include <optional>
+#include <string>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
@@ -116,13 +119,14 @@ LogcatFormat DetectFormat(base::StringView line) {
   return LogcatFormat::kUnknown;
 }
 
-}  // namespace
-
-// Parses a bunch of logcat lines and appends broken down events into
-// `log_events`.
-void AndroidLogParser::ParseLogLines(std::vector<base::StringView> lines,
-                                     std::vector<AndroidLogEvent>* log_events,
-                                     size_t dedupe_idx) {
+// Decodes the logcat events of |lines| and calls |on_event| with each of them,
+// passing views on their tag and message. Returns the number of lines which
+// could not be parsed, or std::nullopt if the format of |lines| could not be
+// detected (in which case all the remaining lines are skipped).
+template <typename Fn>
+std::optional<int> DecodeLines(int year,
+                               const std::vector<base::StringView>& lines,
+                               Fn on_event) {
   int parse_failures = 0;
   LogcatFormat fmt = LogcatFormat::kUnknown;
   for (auto line : lines) {
@@ -138,8 +142,7 @@ void AndroidLogParser::ParseLogLines(std::vector<base::StringView> lines,
       if (fmt == LogcatFormat::kUnknown) {
         PERFETTO_DLOG("Could not detect logcat format for: |%s|",
                       line.ToStdString().c_str());
-        storage_->IncrementStats(stats::android_log_format_invalid);
-        return;
+        return std::nullopt;
       }
     }
 
@@ -204,14 +207,30 @@ void AndroidLogParser::ParseLogLines(std::vector<base::StringView> lines,
 
     base::StringView msg = it;  // The rest is the log message.
 
-    int64_t secs = base::MkTime(year_, *month, *day, *hour, *minute, *sec);
+    int64_t secs = base::MkTime(year, *month, *day, *hour, *minute, *sec);
     int64_t ts = secs * 1000000000ll + *ns;
 
+    on_event(ts, static_cast<uint32_t>(*pid), static_cast<uint32_t>(*tid),
+             static_cast<uint32_t>(prio), cat, msg);
+  }  //  for (line : lines)
+  return parse_failures;
+}
+
+}  // namespace
+
+// Parses a bunch of logcat lines and appends broken down events into
+// `log_events`.
+void AndroidLogParser::ParseLogLines(std::vector<base::StringView> lines,
+                                     std::vector<AndroidLogEvent>* log_events,
+                                     size_t dedupe_idx) {
+  auto on_event = [this, log_events, dedupe_idx](
+                      int64_t ts, uint32_t pid, uint32_t tid, uint32_t prio,
+                      base::StringView tag, base::StringView msg) {
     AndroidLogEvent evt{ts,
-                        static_cast<uint32_t>(*pid),
-                        static_cast<uint32_t>(*tid),
-                        static_cast<uint32_t>(prio),
-                        storage_->InternString(cat),
+                        pid,
+                        tid,
+                        prio,
+                        storage_->InternString(tag),
                         storage_->InternString(msg)};
 
     if (dedupe_idx > 0) {
@@ -227,24 +246,61 @@ void AndroidLogParser::ParseLogLines(std::vector<base::StringView> lines,
       etrunc.ts = etrunc.ts / 1000000 * 1000000;
       auto begin = log_events->begin();
       auto end = log_events->begin() + static_cast<ssize_t>(dedupe_idx);
-      bool dupe_found = false;
       for (auto eit = std::lower_bound(begin, end, etrunc); eit < end; ++eit) {
         if (eit->ts / 1000000 * 1000000 != etrunc.ts)
           break;
         if (eit->msg == evt.msg && eit->tag == evt.tag && eit->tid == evt.tid &&
             eit->pid == evt.pid) {
-          dupe_found = true;
-          break;
+          return;  // Skip the current line.
         }
       }
-      if (dupe_found) {
-        continue;  // Skip the current line.
-      }
     }  // if (dedupe_idx)
 
     log_events->emplace_back(std::move(evt));
-  }  //  for (line : lines)
-  storage_->IncrementStats(stats::android_log_num_failed, parse_failures);
+  };
+  std::optional<int> parse_failures = DecodeLines(year_, lines, on_event);
+  if (!parse_failures) {
+    storage_->IncrementStats(stats::android_log_format_invalid);
+    return;
+  }
+  storage_->IncrementStats(stats::android_log_num_failed, *parse_failures);
+}
+
+void AndroidLogParser::DecodeLogLines(
+    const std::vector<base::StringView>& lines,
+    DecodedAndroidLogs* decoded) const {
+  auto on_event = [decoded](int64_t ts, uint32_t pid, uint32_t tid,
+                            uint32_t prio, base::StringView tag,
+                            base::StringView msg) {
+    std::string& strings = decoded->strings;
+    decoded->events.push_back(DecodedAndroidLogs::Event{
+        ts, pid, tid, prio, strings.size(), tag.size(), msg.size()});
+    strings.append(tag.data(), tag.size());
+    strings.append(msg.data(), msg.size());
+  };
+  std::optional<int> parse_failures = DecodeLines(year_, lines, on_event);
+  if (!parse_failures) {
+    decoded->num_format_invalid++;
+    return;
+  }
+  decoded->num_failed += *parse_failures;
+}
+
+void AndroidLogParser::AddDecodedLogs(
+    const DecodedAndroidLogs& decoded,
+    std::vector<AndroidLogEvent>* log_events) {
+  base::StringView strings(decoded.strings);
+  for (const DecodedAndroidLogs::Event& e : decoded.events) {
+    base::StringView tag = strings.substr(e.str_offset, e.tag_size);
+    base::StringView msg =
+        strings.substr(e.str_offset + e.tag_size, e.msg_size);
+    log_events->push_back(AndroidLogEvent{e.ts, e.pid, e.tid, e.prio,
+                                          storage_->InternString(tag),
+                                          storage_->InternString(msg)});
+  }
+  storage_->IncrementStats(stats::android_log_format_invalid,
+                           decoded.num_format_invalid);
+  storage_->IncrementStats(stats::android_log_num_failed, decoded.num_failed);
 }
 
 }  // namespace trace_processor
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <string>
 #include <vector>
 
 #include "perfetto/ext/base/string_view.h"
@@ -45,6 +46,28 @@ struct AndroidLogEvent {
   }
 };
 
+// The events decoded from log lines by AndroidLogParser::DecodeLogLines(). The
+// tags and messages are copied in |strings| rather than interned, so that the
+// decoding doesn't need to touch the storage.
+struct DecodedAndroidLogs {
+  struct Event {
+    int64_t ts;
+    uint32_t pid;
+    uint32_t tid;
+    uint32_t prio;
+    // The tag starts at |str_offset| in |strings| and is followed by the
+    // message.
+    size_t str_offset;
+    size_t tag_size;
+    size_t msg_size;
+  };
+
+  std::vector<Event> events;
+  std::string strings;
+  int64_t num_failed = 0;  // Lines which could not be parsed.
+  int64_t num_format_invalid = 0;  // Batches of lines of unknown format.
+};
+
 // Parses log lines coming from persistent logcat (FS/data/misc/logd), interns
 // string in the TP string pools and populates a vector of AndroidLogEvent
 // structs. Does NOT insert log events into any table (for testing isolation),
@@ -71,6 +94,19 @@ class AndroidLogParser {
                      std::vector<AndroidLogEvent>* log_events,
                      size_t dedupe_idx = 0);
 
+  // Same as ParseLogLines() (without de-duping) but only decodes the events
+  // into `decoded`, leaving the storage untouched. Unlike ParseLogLines(),
+  // this can be called on any thread. AddDecodedLogs() must then be called on
+  // the main thread.
+  void DecodeLogLines(const std::vector<base::StringView>& lines,
+                      DecodedAndroidLogs* decoded) const;
+
+  // Interns the strings of `decoded` and appends its events into
+  // `log_events`. The result is the same as calling ParseLogLines() (without
+  // de-duping) on the lines which were passed to DecodeLogLines().
+  void AddDecodedLogs(const DecodedAndroidLogs& decoded,
+                      std::vector<AndroidLogEvent>* log_events);
+
  private:
   TraceStorage* const storage_;
   int year_ = 0;
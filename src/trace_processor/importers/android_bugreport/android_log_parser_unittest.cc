@@ -187,6 +187,60 @@ TEST(AndroidLogParserTest, Dedupe) {
               }));
 }
 
+TEST(AndroidLogParserTest, DecodeThenAdd) {
+  const std::vector<base::StringView> lines = {
+      "01-02 03:04:05.678901 1000 2000 D Tag: message",
+      "--------- beginning of main",
+      "12-31 23:59:00.123456 1 2 I [tag:with:colon]: moar long message",
+      "12-31 23:59:00.123456 1 W Tag: missing tid",
+      "12-31 23:59:00.123456 1 2 E init   : ",
+  };
+
+  TraceStorage storage;
+  AndroidLogParser alp(2020, &storage);
+  std::vector<AndroidLogEvent> parsed;
+  alp.ParseLogLines(lines, &parsed);
+
+  // Decoding doesn't touch the storage. Adding the decoded events gives the
+  // same result as parsing the lines directly.
+  TraceStorage decoded_storage;
+  AndroidLogParser decoding_alp(2020, &decoded_storage);
+  DecodedAndroidLogs decoded;
+  decoding_alp.DecodeLogLines(lines, &decoded);
+  EXPECT_EQ(decoded.events.size(), 3u);
+  EXPECT_EQ(decoded.num_failed, 1);
+  EXPECT_EQ(decoded_storage.stats()[stats::android_log_num_failed].value, 0);
+
+  std::vector<AndroidLogEvent> added;
+  decoding_alp.AddDecodedLogs(decoded, &added);
+  EXPECT_EQ(decoded_storage.stats()[stats::android_log_num_failed].value, 1);
+  ASSERT_EQ(added.size(), parsed.size());
+  for (size_t i = 0; i < added.size(); ++i) {
+    EXPECT_EQ(added[i].ts, parsed[i].ts);
+    EXPECT_EQ(added[i].pid, parsed[i].pid);
+    EXPECT_EQ(added[i].tid, parsed[i].tid);
+    EXPECT_EQ(added[i].prio, parsed[i].prio);
+    EXPECT_EQ(decoded_storage.GetString(added[i].tag),
+              storage.GetString(parsed[i].tag));
+    EXPECT_EQ(decoded_storage.GetString(added[i].msg),
+              storage.GetString(parsed[i].msg));
+  }
+}
+
+TEST(AndroidLogParserTest, DecodeUnknownFormat) {
+  TraceStorage storage;
+  AndroidLogParser alp(2020, &storage);
+  DecodedAndroidLogs decoded;
+  alp.DecodeLogLines({"this is not a logcat line, but it is long enough"},
+                     &decoded);
+  EXPECT_TRUE(decoded.events.empty());
+
+  std::vector<AndroidLogEvent> events;
+  alp.AddDecodedLogs(decoded, &events);
+  EXPECT_TRUE(events.empty());
+  EXPECT_EQ(storage.stats()[stats::android_log_format_invalid].value, 1);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -21,6 +21,8 @@
 
 #include "src/trace_processor/db/column.h"
 #include "src/trace_processor/importers/common/args_translation_table.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
+#include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/types/variadic.h"
@@ -70,7 +72,36 @@ void ArgsTracker::Flush() {
       return f.row < s.row;
     return f.column < s.column;
   };
-  std::stable_sort(args_.begin(), args_.end(), comparator);
+  // Args are mostly added a few at a time for a single row: sort them in
+  // place with an insertion sort, which is stable, doesn't allocate (unlike
+  // std::stable_sort) and is linear on the common already sorted input.
+  constexpr size_t kMaxInsertionSortSize = 64;
+  if (args_.size() <= kMaxInsertionSortSize) {
+    for (size_t i = 1; i < args_.size(); ++i) {
+      if (!comparator(args_[i], args_[i - 1]))
+        continue;
+      Arg arg = args_[i];
+      size_t j = i;
+      for (; j > 0 && comparator(arg, args_[j - 1]); --j)
+        args_[j] = args_[j - 1];
+      args_[j] = arg;
+    }
+  } else {
+    std::stable_sort(args_.begin(), args_.end(), comparator);
+  }
+
+  // When close to the memory budget, the args of the tables with the most rows
+  // are dropped. The args of e.g. processes and tracks are still kept as they
+  // are few but often needed to make sense of the trace.
+  const bool drop_event_args =
+      MemoryBudget::ShouldDropArgs(context_->memory_budget.get());
+  auto is_event_args_column = [this](const ColumnLegacy* col) {
+    TraceStorage* storage = context_->storage.get();
+    return col == storage->mutable_slice_table()->mutable_arg_set_id() ||
+           col == storage->mutable_counter_table()->mutable_arg_set_id() ||
+           col == storage->mutable_flow_table()->mutable_arg_set_id() ||
+           col == storage->mutable_raw_table()->mutable_arg_set_id();
+  };
 
   for (uint32_t i = 0; i < args_.size();) {
     const GlobalArgsTracker::Arg& arg = args_[i];
@@ -83,6 +114,12 @@ void ArgsTracker::Flush() {
       next_rid_idx++;
     }
 
+    if (drop_event_args && is_event_args_column(col)) {
+      context_->storage->IncrementStats(stats::memory_budget_args_dropped);
+      i = next_rid_idx;
+      continue;
+    }
+
     ArgSetId set_id =
         context_->global_args_tracker->AddArgSet(&args_[0], i, next_rid_idx);
     if (col->IsNullable()) {
@@ -144,16 +144,6 @@ class ArgsTracker {
         context_->storage->mutable_surfaceflinger_layers_snapshot_table(), id);
   }
 
-  BoundInserter AddArgsTo(tables::SurfaceFlingerLayerTable::Id id) {
-    return AddArgsTo(context_->storage->mutable_surfaceflinger_layer_table(),
-                     id);
-  }
-
-  BoundInserter AddArgsTo(tables::SurfaceFlingerTransactionsTable::Id id) {
-    return AddArgsTo(
-        context_->storage->mutable_surfaceflinger_transactions_table(), id);
-  }
-
   BoundInserter AddArgsTo(tables::WindowManagerShellTransitionsTable::Id id) {
     return AddArgsTo(
         context_->storage->mutable_window_manager_shell_transitions_table(),
@@ -206,6 +196,13 @@ class ArgsTracker {
   // Virtual for testing.
   virtual void Flush();
 
+  // Commits the added args to storage and forgets the array indexes of their
+  // rows, so that this ArgsTracker can be reused for unrelated rows.
+  void FlushAndReset() {
+    Flush();
+    array_indexes_.clear();
+  }
+
  private:
   template <typename Table>
   BoundInserter AddArgsTo(Table* table, typename Table::Id id) {
@@ -22,6 +22,8 @@
 #include <atomic>
 #include <cinttypes>
 #include <queue>
+#include <utility>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/hash.h"
@@ -42,13 +44,43 @@ void ClockConverter::MaybeInitialize() {
     return;
 
   is_initialized = true;
-  timelines_.Insert(kRealClock, {});
-  timelines_.Insert(kMonoClock, {});
+  std::vector<std::pair<Timestamp, Timestamp>> real_snapshots;
+  std::vector<std::pair<Timestamp, Timestamp>> mono_snapshots;
   for (auto it = context_->storage->clock_snapshot_table().IterateRows(); it;
        ++it) {
-    if (it.clock_id() == kRealClock || it.clock_id() == kMonoClock)
-      timelines_.Find(it.clock_id())->emplace(it.ts(), it.clock_value());
+    if (it.clock_id() == kRealClock)
+      real_snapshots.emplace_back(it.ts(), it.clock_value());
+    else if (it.clock_id() == kMonoClock)
+      mono_snapshots.emplace_back(it.ts(), it.clock_value());
   }
+  timelines_.Insert(kRealClock, BuildTimeline(std::move(real_snapshots)));
+  timelines_.Insert(kMonoClock, BuildTimeline(std::move(mono_snapshots)));
+}
+
+ClockConverter::Timeline ClockConverter::BuildTimeline(
+    std::vector<std::pair<Timestamp, Timestamp>> snapshots) {
+  // If there are multiple snapshots at the same trace time, the first one
+  // wins.
+  auto key_less = [](const std::pair<Timestamp, Timestamp>& a,
+                     const std::pair<Timestamp, Timestamp>& b) {
+    return a.first < b.first;
+  };
+  auto key_eq = [](const std::pair<Timestamp, Timestamp>& a,
+                   const std::pair<Timestamp, Timestamp>& b) {
+    return a.first == b.first;
+  };
+  std::stable_sort(snapshots.begin(), snapshots.end(), key_less);
+  snapshots.erase(std::unique(snapshots.begin(), snapshots.end(), key_eq),
+                  snapshots.end());
+
+  Timeline timeline;
+  timeline.trace_ts.reserve(snapshots.size());
+  timeline.clock_values.reserve(snapshots.size());
+  for (const auto& snapshot : snapshots) {
+    timeline.trace_ts.push_back(snapshot.first);
+    timeline.clock_values.push_back(snapshot.second);
+  }
+  return timeline;
 }
 
 base::StatusOr<ClockConverter::Timestamp> ClockConverter::FromTraceTime(
@@ -63,33 +95,43 @@ base::StatusOr<ClockConverter::Timestamp> ClockConverter::FromTraceTime(
         "clocks.");
   }
 
-  if (timeline->empty()) {
+  const std::vector<Timestamp>& trace_ts = timeline->trace_ts;
+  const std::vector<Timestamp>& values = timeline->clock_values;
+  if (trace_ts.empty()) {
     return base::ErrStatus("Target clock is not in the trace.");
   }
 
-  auto next_snapshot = timeline->lower_bound(ts);
+  // Find the first snapshot with trace time >= |ts|, trying the one found by
+  // the previous lookup first.
+  size_t next = timeline->last_index;
+  bool is_last_next = (next == trace_ts.size() || trace_ts[next] >= ts) &&
+                      (next == 0 || trace_ts[next - 1] < ts);
+  if (!is_last_next) {
+    next = static_cast<size_t>(
+        std::lower_bound(trace_ts.begin(), trace_ts.end(), ts) -
+        trace_ts.begin());
+    timeline->last_index = next;
+  }
 
   // If lower bound was not found, it means that the ts was higher then the last
   // one. If that's the case we look for thhe last element and return clock
   // value for this + offset.
-  if (next_snapshot == timeline->end()) {
-    next_snapshot--;
-    return next_snapshot->second + ts - next_snapshot->first;
+  if (next == trace_ts.size()) {
+    size_t last = trace_ts.size() - 1;
+    return values[last] + ts - trace_ts[last];
   }
 
   // If there is a snapshot with this ts or lower bound is the first snapshot,
   // we have no other option then to return the clock value for this snapshot.
-  if (next_snapshot == timeline->begin() || next_snapshot->first == ts)
-    return next_snapshot->second;
+  if (next == 0 || trace_ts[next] == ts)
+    return values[next];
 
-  auto prev_snapshot = next_snapshot;
-  prev_snapshot--;
+  size_t prev = next - 1;
 
   // The most truthful way to calculate the clock value is to use this formula,
   // as there is no reason to assume that the clock is monotonistic. This
   // prevents us from going back in time.
-  return std::min(prev_snapshot->second + ts - prev_snapshot->first,
-                  next_snapshot->second);
+  return std::min(values[prev] + ts - trace_ts[prev], values[next]);
 }
 
 std::string ClockConverter::TimeToStr(Timestamp ts) {
@@ -21,9 +21,9 @@
 
 #include <array>
 #include <cinttypes>
-#include <map>
 #include <random>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -72,13 +72,27 @@ class ClockConverter {
   static constexpr int64_t kMonoClock = protos::pbzero::BUILTIN_CLOCK_MONOTONIC;
 
   // Timeline uses Trace Time clock as keys and other clocks time as values.
-  using Timeline = std::map<Timestamp, Timestamp>;
+  // Stored as two parallel vectors sorted by (unique) trace time.
+  struct Timeline {
+    std::vector<Timestamp> trace_ts;
+    std::vector<Timestamp> clock_values;
+
+    // Result of the last lookup, i.e. the index of the first snapshot with
+    // trace time >= the looked up timestamp. SQL functions tend to be called
+    // on sorted timestamps, so consecutive lookups usually resolve to the same
+    // snapshot and can skip the binary search.
+    size_t last_index = 0;
+  };
 
   // Reads the clocks snapshots table and fetches the data required for
   // conversion. We initialize timelines of only selected clocks to minimize
   // memory usage. Currently those are MONO and REAL clocks.
   void MaybeInitialize();
 
+  // Builds a timeline out of (trace time, clock value) pairs.
+  static Timeline BuildTimeline(
+      std::vector<std::pair<Timestamp, Timestamp>> snapshots);
+
   // Converts trace time to provided clock.
   base::StatusOr<Timestamp> FromTraceTime(ClockId, Timestamp);
 
@@ -148,6 +148,28 @@ TEST_F(ClockConverterTest, Realtime) {
   EXPECT_EQ(cc_.ToRealtime(35).value(), 10);
 }
 
+TEST_F(ClockConverterTest, UnsortedLookups) {
+  for (int64_t ts : {30, 10, 20}) {
+    tables::ClockSnapshotTable::Row rows;
+    rows.ts = ts;
+    rows.clock_id = kMonotonic;
+    rows.clock_value = ts * 10;
+    context_.storage->mutable_clock_snapshot_table()->Insert(rows);
+  }
+
+  // Sorted lookups go through the same snapshots, then jump around.
+  EXPECT_EQ(cc_.ToMonotonic(5).value(), 100);
+  EXPECT_EQ(cc_.ToMonotonic(11).value(), 101);
+  EXPECT_EQ(cc_.ToMonotonic(15).value(), 105);
+  EXPECT_EQ(cc_.ToMonotonic(20).value(), 200);
+  EXPECT_EQ(cc_.ToMonotonic(35).value(), 305);
+  EXPECT_EQ(cc_.ToMonotonic(40).value(), 310);
+  EXPECT_EQ(cc_.ToMonotonic(12).value(), 102);
+  EXPECT_EQ(cc_.ToMonotonic(10).value(), 100);
+  EXPECT_EQ(cc_.ToMonotonic(25).value(), 205);
+  EXPECT_EQ(cc_.ToMonotonic(5).value(), 100);
+}
+
 TEST_F(ClockConverterTest, AbsTime) {
   // We will add 3 snapshots for real time clock, and the last snapshot will be
   // earlier then the second one.
@@ -21,7 +21,10 @@
 #include <algorithm>
 #include <atomic>
 #include <cinttypes>
+#include <limits>
+#include <optional>
 #include <queue>
+#include <utility>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/hash.h"
@@ -46,8 +49,10 @@ base::StatusOr<uint32_t> ClockTracker::AddSnapshot(
     const std::vector<ClockTimestamp>& clock_timestamps) {
   const auto snapshot_id = cur_snapshot_id_++;
 
-  // Clear the cache
+  // Clear the caches: the new snapshot can change both the paths and the
+  // segments along them.
   cache_.fill({});
+  path_cache_.clear();
 
   // Compute the fingerprint of the snapshot by hashing all clock ids. This is
   // used by the clock pathfinding logic.
@@ -229,15 +234,60 @@ std::optional<int64_t> ClockTracker::ToTraceTimeFromSnapshot(
   return maybe_found_trace_time_clock->timestamp;
 }
 
-base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
-                                                      int64_t src_timestamp,
-                                                      ClockId target_clock_id) {
+base::Status ClockTracker::ToTraceTimeBatch(ClockId clock_id,
+                                            int64_t* timestamps,
+                                            size_t count) {
+  MarkTraceTimeClockUsed();
+  if (clock_id == trace_time_clock_id_)
+    return base::OkStatus();
+
+  // The segment of the last converted timestamp. As long as the following
+  // ones stay within it, they don't need to go through the cache lookup nor
+  // the path finding.
+  CachedClockPath segment{};
+  for (size_t i = 0; i < count; ++i) {
+    std::optional<int64_t> ns;
+    if (segment.src_domain && !cache_lookups_disabled_for_testing_) {
+      ns = segment.src_domain->ToNs(timestamps[i]);
+      if (PERFETTO_LIKELY(segment.Contains(*ns))) {
+        timestamps[i] = *ns + segment.translation_ns;
+        continue;
+      }
+      segment = {};
+    }
+    base::StatusOr<int64_t> trace_ts =
+        ns ? ConvertSlowpath(clock_id, timestamps[i], ns, trace_time_clock_id_,
+                             &segment)
+           : Convert(clock_id, timestamps[i], trace_time_clock_id_, &segment);
+    if (!trace_ts.ok())
+      return trace_ts.status();
+    timestamps[i] = *trace_ts;
+  }
+  return base::OkStatus();
+}
+
+ClockTracker::ClockPath ClockTracker::FindCachedPath(ClockId src,
+                                                     ClockId target) {
+  auto it = path_cache_.find(std::make_pair(src, target));
+  if (it != path_cache_.end())
+    return it->second;
+  ClockPath path = FindPath(src, target);
+  path_cache_.emplace(std::make_pair(src, target), path);
+  return path;
+}
+
+base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(
+    ClockId src_clock_id,
+    int64_t src_timestamp,
+    std::optional<int64_t> src_timestamp_ns,
+    ClockId target_clock_id,
+    CachedClockPath* segment_out) {
   PERFETTO_DCHECK(!IsSequenceClock(src_clock_id));
   PERFETTO_DCHECK(!IsSequenceClock(target_clock_id));
 
   context_->storage->IncrementStats(stats::clock_sync_cache_miss);
 
-  ClockPath path = FindPath(src_clock_id, target_clock_id);
+  ClockPath path = FindCachedPath(src_clock_id, target_clock_id);
 
   if (!path.valid()) {
     // Too many logs maybe emitted when path is invalid.
@@ -247,19 +297,34 @@ base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
                            src_clock_id, target_clock_id, src_timestamp);
   }
 
-  // We can cache only single-path resolutions between two clocks.
-  // Caching multi-path resolutions is harder because the (src,target) tuple
-  // is not enough as a cache key: at any step the |ns| value can yield to a
-  // different choice of the next snapshot. Multi-path resolutions don't seem
-  // too frequent these days, so we focus only on caching the more frequent
-  // one-step resolutions (typically from any clock to the trace clock).
-  const bool cacheable = path.len == 1;
+  // Multi-hop resolutions are cacheable too, even if at any step the |ns|
+  // value can yield to a different choice of the next snapshot: the bounds of
+  // each step are translated back to the source clock domain and intersected,
+  // so that any timestamp within the cached range goes through exactly the
+  // same snapshots.
+  const int64_t kInt64Min = std::numeric_limits<int64_t>::min();
+  const int64_t kInt64Max = std::numeric_limits<int64_t>::max();
+  bool cacheable = true;
   CachedClockPath cache_entry{};
+  cache_entry.min_ts_ns = kInt64Min;
+  cache_entry.max_ts_ns = kInt64Max;
+
+  // Translates a bound of the current step back to the source clock domain,
+  // saturating on overflow.
+  auto to_src_bound = [](int64_t bound, int64_t translation) {
+    if (translation > 0 && bound < kInt64Min + translation)
+      return kInt64Min;
+    if (translation < 0 && bound > kInt64Max + translation)
+      return kInt64Max;
+    return bound - translation;
+  };
 
   // Iterate trough the path found and translate timestamps onto the new clock
   // domain on each step, until the target domain is reached.
   ClockDomain* src_domain = GetClock(src_clock_id);
-  int64_t ns = src_domain->ToNs(src_timestamp);
+  const int64_t src_ns = src_timestamp_ns ? *src_timestamp_ns
+                                          : src_domain->ToNs(src_timestamp);
+  int64_t ns = src_ns;
   for (uint32_t i = 0; i < path.len; ++i) {
     const ClockGraphEdge edge = path.at(i);
     ClockDomain* cur_clock = GetClock(std::get<0>(edge));
@@ -292,6 +357,7 @@ base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
                                     next_snap.snapshot_ids.end(), snapshot_id);
     if (next_it == next_snap.snapshot_ids.end() || *next_it != snapshot_id) {
       PERFETTO_DFATAL("Snapshot does not exist in clock domain.");
+      cacheable = false;
       continue;
     }
     size_t next_index = static_cast<size_t>(
@@ -299,25 +365,26 @@ base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
     PERFETTO_DCHECK(next_index < next_snap.snapshot_ids.size());
     int64_t next_timestamp_ns = next_snap.timestamps_ns[next_index];
 
+    // Keep track of the bounds for the cache entry. This will allow future
+    // Convert() calls to skip the pathfinder logic as long as the query stays
+    // within the bounds.
+    const int64_t translation = ns - src_ns;
+    if (it != ts_vec.begin()) {
+      cache_entry.min_ts_ns = std::max(cache_entry.min_ts_ns,
+                                       to_src_bound(*it, translation));
+    }
+    auto ubound = it + 1;
+    if (ubound != ts_vec.end()) {
+      cache_entry.max_ts_ns = std::min(cache_entry.max_ts_ns,
+                                       to_src_bound(*ubound, translation));
+    }
+
     // The translated timestamp is the relative delta of the source timestamp
     // from the closest snapshot found (ns - *it), plus the timestamp in
     // the new clock domain for the same snapshot id.
     const int64_t adj = next_timestamp_ns - *it;
     ns += adj;
 
-    // On the first iteration, keep track of the bounds for the cache entry.
-    // This will allow future Convert() calls to skip the pathfinder logic
-    // as long as the query stays within the bound.
-    if (cacheable) {
-      PERFETTO_DCHECK(i == 0);
-      const int64_t kInt64Min = std::numeric_limits<int64_t>::min();
-      const int64_t kInt64Max = std::numeric_limits<int64_t>::max();
-      cache_entry.min_ts_ns = it == ts_vec.begin() ? kInt64Min : *it;
-      auto ubound = it + 1;
-      cache_entry.max_ts_ns = ubound == ts_vec.end() ? kInt64Max : *ubound;
-      cache_entry.translation_ns = adj;
-    }
-
     // The last clock in the path must be the target clock.
     PERFETTO_DCHECK(i < path.len - 1 || std::get<1>(edge) == target_clock_id);
   }
@@ -326,7 +393,10 @@ base::StatusOr<int64_t> ClockTracker::ConvertSlowpath(ClockId src_clock_id,
     cache_entry.src = src_clock_id;
     cache_entry.src_domain = src_domain;
     cache_entry.target = target_clock_id;
+    cache_entry.translation_ns = ns - src_ns;
     cache_[rnd_() % cache_.size()] = cache_entry;
+    if (segment_out)
+      *segment_out = cache_entry;
   }
 
   return ns;
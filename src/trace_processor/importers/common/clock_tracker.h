@@ -25,6 +25,7 @@
 #include <optional>
 #include <random>
 #include <set>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -160,18 +161,22 @@ class ClockTracker {
   base::StatusOr<uint32_t> AddSnapshot(const std::vector<ClockTimestamp>&);
 
   base::StatusOr<int64_t> ToTraceTime(ClockId clock_id, int64_t timestamp) {
-    if (PERFETTO_UNLIKELY(!trace_time_clock_id_used_for_conversion_)) {
-      context_->metadata_tracker->SetMetadata(
-          metadata::trace_time_clock_id,
-          Variadic::Integer(trace_time_clock_id_));
-      trace_time_clock_id_used_for_conversion_ = true;
-    }
-    trace_time_clock_id_used_for_conversion_ = true;
+    MarkTraceTimeClockUsed();
     if (clock_id == trace_time_clock_id_)
       return timestamp;
     return Convert(clock_id, timestamp, trace_time_clock_id_);
   }
 
+  // Converts |count| timestamps of |clock_id| to trace time, in place. This
+  // gives the same results as calling ToTraceTime() on each of them in order,
+  // but the conversion path is only resolved once for each snapshot segment
+  // the timestamps fall into, which makes this much cheaper for sorted runs.
+  // On failure, the timestamps from the first one which could not be
+  // converted onwards are left unchanged.
+  base::Status ToTraceTimeBatch(ClockId clock_id,
+                                int64_t* timestamps,
+                                size_t count);
+
   // If trace clock and source clock are available in the snapshot will return
   // the trace clock time in snapshot.
   std::optional<int64_t> ToTraceTimeFromSnapshot(
@@ -275,9 +280,15 @@ class ClockTracker {
     }
   };
 
-  // Holds data for cached entries. At the moment only single-path resolution
-  // are cached.
+  // Holds data for cached entries. Any source timestamp (in ns) within
+  // [min_ts_ns, max_ts_ns) goes through the same snapshots along the
+  // resolution path, however many hops it has, so it can be converted by
+  // adding |translation_ns|.
   struct CachedClockPath {
+    bool Contains(int64_t ns) const {
+      return ns >= min_ts_ns && ns < max_ts_ns;
+    }
+
     ClockId src;
     ClockId target;
     ClockDomain* src_domain;
@@ -289,28 +300,49 @@ class ClockTracker {
   ClockTracker(const ClockTracker&) = delete;
   ClockTracker& operator=(const ClockTracker&) = delete;
 
-  base::StatusOr<int64_t> ConvertSlowpath(ClockId src_clock_id,
-                                          int64_t src_timestamp,
-                                          ClockId target_clock_id);
+  void MarkTraceTimeClockUsed() {
+    if (PERFETTO_UNLIKELY(!trace_time_clock_id_used_for_conversion_)) {
+      context_->metadata_tracker->SetMetadata(
+          metadata::trace_time_clock_id,
+          Variadic::Integer(trace_time_clock_id_));
+      trace_time_clock_id_used_for_conversion_ = true;
+    }
+  }
+
+  // |src_timestamp_ns| is the result of ToNs(src_timestamp), if the caller
+  // already computed it: it must not be computed twice for incremental clocks.
+  // If |segment_out| is not null and the resolution is cacheable, it is set to
+  // the segment |src_timestamp| belongs to.
+  base::StatusOr<int64_t> ConvertSlowpath(
+      ClockId src_clock_id,
+      int64_t src_timestamp,
+      std::optional<int64_t> src_timestamp_ns,
+      ClockId target_clock_id,
+      CachedClockPath* segment_out = nullptr);
 
   // Converts a timestamp between two clock domains. Tries to use the cache
-  // first (only for single-path resolutions), then falls back on path finding
-  // as described in the header.
+  // first, then falls back on path finding as described in the header.
   base::StatusOr<int64_t> Convert(ClockId src_clock_id,
                                   int64_t src_timestamp,
-                                  ClockId target_clock_id) {
+                                  ClockId target_clock_id,
+                                  CachedClockPath* segment_out = nullptr) {
+    std::optional<int64_t> ns;
     if (PERFETTO_LIKELY(!cache_lookups_disabled_for_testing_)) {
       for (const auto& cached_clock_path : cache_) {
         if (cached_clock_path.src != src_clock_id ||
             cached_clock_path.target != target_clock_id)
           continue;
-        int64_t ns = cached_clock_path.src_domain->ToNs(src_timestamp);
-        if (ns >= cached_clock_path.min_ts_ns &&
-            ns < cached_clock_path.max_ts_ns)
-          return ns + cached_clock_path.translation_ns;
+        if (!ns)
+          ns = cached_clock_path.src_domain->ToNs(src_timestamp);
+        if (cached_clock_path.Contains(*ns)) {
+          if (segment_out)
+            *segment_out = cached_clock_path;
+          return *ns + cached_clock_path.translation_ns;
+        }
       }
     }
-    return ConvertSlowpath(src_clock_id, src_timestamp, target_clock_id);
+    return ConvertSlowpath(src_clock_id, src_timestamp, ns, target_clock_id,
+                           segment_out);
   }
 
   // Returns whether |global_clock_id| represents a sequence-scoped clock, i.e.
@@ -323,6 +355,9 @@ class ClockTracker {
 
   ClockPath FindPath(ClockId src, ClockId target);
 
+  // Same as FindPath() but memoized in |path_cache_|.
+  ClockPath FindCachedPath(ClockId src, ClockId target);
+
   ClockDomain* GetClock(ClockId clock_id) {
     auto it = clocks_.find(clock_id);
     PERFETTO_DCHECK(it != clocks_.end());
@@ -334,6 +369,9 @@ class ClockTracker {
   std::map<ClockId, ClockDomain> clocks_;
   std::set<ClockGraphEdge> graph_;
   std::set<ClockId> non_monotonic_clocks_;
+  // The result of FindPath() for each (src, target) pair. Only valid until the
+  // graph changes, i.e. until the next AddSnapshot().
+  std::map<std::pair<ClockId, ClockId>, ClockPath> path_cache_;
   std::array<CachedClockPath, 2> cache_{};
   bool cache_lookups_disabled_for_testing_ = false;
   std::minstd_rand rnd_;  // For cache eviction.
@@ -18,6 +18,7 @@
 
 #include <optional>
 #include <random>
+#include <vector>
 
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -180,6 +181,76 @@ TEST_F(ClockTrackerTest, ChainedResolutionHard) {
   EXPECT_EQ(*Convert(MONOTONIC_RAW, 753, REALTIME), 753 - 1 - 50 + 9000);
 }
 
+// Multi-hop resolutions are cached as well, for as long as the timestamps
+// stay within the same snapshots on every hop.
+TEST_F(ClockTrackerTest, ChainedResolutionCached) {
+  ct_.AddSnapshot({{MONOTONIC_COARSE, 1}, {MONOTONIC, 11}});
+  ct_.AddSnapshot({{MONOTONIC, 100}, {BOOTTIME, 1100}});
+  ct_.AddSnapshot({{MONOTONIC, 200}, {BOOTTIME, 2200}});
+
+  auto cache_misses = [this] {
+    return context_.storage->stats()[stats::clock_sync_cache_miss].value;
+  };
+
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 100), 100 + 10 + 1000);
+  EXPECT_EQ(cache_misses(), 1);
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 90), 90 + 10 + 1000);
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 189), 189 + 10 + 1000);
+  EXPECT_EQ(cache_misses(), 1);
+
+  // MONOTONIC_COARSE@190 == MONOTONIC@200 goes through the next snapshot on
+  // the second hop.
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 190), 190 + 10 + 2000);
+  EXPECT_EQ(cache_misses(), 2);
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 1000), 1000 + 10 + 2000);
+  EXPECT_EQ(*ct_.ToTraceTime(MONOTONIC_COARSE, 95), 95 + 10 + 1000);
+  EXPECT_EQ(cache_misses(), 2);
+}
+
+TEST_F(ClockTrackerTest, BatchConversion) {
+  ct_.AddSnapshot({{MONOTONIC_COARSE, 1}, {MONOTONIC, 11}});
+  ct_.AddSnapshot({{MONOTONIC, 100}, {BOOTTIME, 1100}});
+  ct_.AddSnapshot({{MONOTONIC, 200}, {BOOTTIME, 2200}});
+  ct_.AddSnapshot({{MONOTONIC, 300}, {BOOTTIME, 3300}});
+
+  std::vector<int64_t> timestamps = {50, 180, 190, 191, 250, 290, 1000};
+  ASSERT_TRUE(ct_.ToTraceTimeBatch(MONOTONIC_COARSE, timestamps.data(),
+                                   timestamps.size())
+                  .ok());
+  EXPECT_THAT(timestamps,
+              ::testing::ElementsAre(1060, 1190, 2200, 2201, 2260, 3300, 4010));
+
+  // Conversions from the trace clock are no-ops.
+  std::vector<int64_t> boot_timestamps = {1, 2, 3};
+  ASSERT_TRUE(ct_.ToTraceTimeBatch(BOOTTIME, boot_timestamps.data(),
+                                   boot_timestamps.size())
+                  .ok());
+  EXPECT_THAT(boot_timestamps, ::testing::ElementsAre(1, 2, 3));
+
+  // On failure, the timestamps are left unchanged.
+  std::vector<int64_t> raw_timestamps = {1, 2, 3};
+  EXPECT_FALSE(ct_.ToTraceTimeBatch(MONOTONIC_RAW, raw_timestamps.data(),
+                                    raw_timestamps.size())
+                   .ok());
+  EXPECT_THAT(raw_timestamps, ::testing::ElementsAre(1, 2, 3));
+}
+
+TEST_F(ClockTrackerTest, BatchConversionIncremental) {
+  ClockTracker::ClockId c64_1 = ct_.SequenceToGlobalClock(1, 64);
+  ct_.AddSnapshot({{MONOTONIC, 1000}, {BOOTTIME, 100000}});
+  ct_.AddSnapshot(
+      {{MONOTONIC, 10000},
+       {c64_1, 10, /*unit_multiplier_ns=*/1000, /*is_incremental=*/true}});
+
+  // Each delta must be applied exactly once.
+  std::vector<int64_t> timestamps = {1, 1, 2, 0, 5};
+  ASSERT_TRUE(
+      ct_.ToTraceTimeBatch(c64_1, timestamps.data(), timestamps.size()).ok());
+  EXPECT_THAT(timestamps,
+              ::testing::ElementsAre(110000, 111000, 113000, 113000, 118000));
+  EXPECT_EQ(*ct_.ToTraceTime(c64_1, 1), 119000);
+}
+
 // Regression test for b/158182858. When taking two snapshots back-to-back,
 // MONOTONIC_COARSE might be stuck to the last value. We should still be able
 // to convert both ways in this case.
@@ -303,6 +374,44 @@ TEST_F(ClockTrackerTest, CacheDoesntAffectResults) {
   }
 }
 
+// Tests that batch conversions give the same results as converting each
+// timestamp on its own.
+TEST_F(ClockTrackerTest, BatchConversionMatchesSingleConversions) {
+  std::minstd_rand rnd;
+  int64_t last_coarse = 0;
+  int64_t last_mono = 0;
+  int64_t last_boot = 0;
+  static const int64_t increments[] = {1, 2, 10};
+  for (int i = 0; i < 100; i++) {
+    last_coarse += increments[rnd() % base::ArraySize(increments)];
+    last_mono += increments[rnd() % base::ArraySize(increments)];
+    ct_.AddSnapshot({{MONOTONIC_COARSE, last_coarse}, {MONOTONIC, last_mono}});
+
+    last_mono += increments[rnd() % base::ArraySize(increments)];
+    last_boot += increments[rnd() % base::ArraySize(increments)];
+    ct_.AddSnapshot({{MONOTONIC, last_mono}, {BOOTTIME, last_boot}});
+  }
+
+  std::vector<int64_t> timestamps;
+  int64_t ts = -10;
+  for (int i = 0; i < 1000; i++) {
+    ts += static_cast<int64_t>(rnd() % 3);
+    timestamps.push_back(ts);
+  }
+
+  for (ClockTracker::ClockId clock : {MONOTONIC_COARSE, MONOTONIC}) {
+    std::vector<int64_t> expected;
+    ct_.set_cache_lookups_disabled_for_testing(true);
+    for (int64_t timestamp : timestamps)
+      expected.push_back(*ct_.ToTraceTime(clock, timestamp));
+    ct_.set_cache_lookups_disabled_for_testing(false);
+
+    std::vector<int64_t> actual = timestamps;
+    ASSERT_TRUE(ct_.ToTraceTimeBatch(clock, actual.data(), actual.size()).ok());
+    ASSERT_EQ(actual, expected);
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -96,7 +96,7 @@ class GlobalArgsTracker {
 
   // Assumes that the interval [begin, end) of |args| is sorted by keys.
   ArgSetId AddArgSet(const Arg* args, uint32_t begin, uint32_t end) {
-    base::SmallVector<uint32_t, 64> valid_indexes;
+    ArgIndexes valid_indexes;
 
     // TODO(eseckler): Also detect "invalid" key combinations in args sets (e.g.
     // "foo" and "foo.bar" in the same arg set)?
@@ -117,6 +117,12 @@ class GlobalArgsTracker {
       valid_indexes.emplace_back(i);
     }
 
+    // Events often carry the same args as the previous one (e.g. the same
+    // debug annotations on every frame): compare with the last arg set before
+    // paying for hashing it.
+    if (IsSameAsLastArgSet(args, valid_indexes))
+      return last_arg_set_id_;
+
     base::Hasher hash;
     for (uint32_t i : valid_indexes) {
       hash.Update(ArgHasher()(args[i]));
@@ -129,12 +135,15 @@ class GlobalArgsTracker {
         arg_row_for_hash_.Insert(digest, arg_table->row_count());
     if (!it_and_inserted.second) {
       // Already inserted.
-      return arg_table->arg_set_id()[*it_and_inserted.first];
+      ArgSetId id = arg_table->arg_set_id()[*it_and_inserted.first];
+      SetLastArgSet(args, valid_indexes, id);
+      return id;
     }
 
     // Taking size() after the Insert() ensures that nothing has an id == 0
     // (0 == kInvalidArgSetId).
     ArgSetId id = static_cast<uint32_t>(arg_row_for_hash_.size());
+    SetLastArgSet(args, valid_indexes, id);
     for (uint32_t i : valid_indexes) {
       const auto& arg = args[i];
 
@@ -182,10 +191,41 @@ class GlobalArgsTracker {
 
  private:
   using ArgSetHash = uint64_t;
+  using ArgIndexes = base::SmallVector<uint32_t, 64>;
+
+  // Args are equal if they would hash the same way, i.e. regardless of their
+  // flat key and update policy.
+  static bool AreArgsEqual(const CompactArg& a, const CompactArg& b) {
+    return a.key == b.key && a.value == b.value;
+  }
+
+  bool IsSameAsLastArgSet(const Arg* args, const ArgIndexes& indexes) const {
+    if (last_arg_set_id_ == kInvalidArgSetId ||
+        indexes.size() != last_arg_set_.size()) {
+      return false;
+    }
+    for (size_t i = 0; i < indexes.size(); ++i) {
+      if (!AreArgsEqual(args[indexes[i]], last_arg_set_[i]))
+        return false;
+    }
+    return true;
+  }
+
+  void SetLastArgSet(const Arg* args, const ArgIndexes& indexes, ArgSetId id) {
+    last_arg_set_.clear();
+    for (uint32_t i : indexes) {
+      last_arg_set_.emplace_back(args[i].ToCompactArg());
+    }
+    last_arg_set_id_ = id;
+  }
 
   base::FlatHashMap<ArgSetHash, uint32_t, base::AlreadyHashed<ArgSetHash>>
       arg_row_for_hash_;
 
+  // The args of the arg set most recently added or looked up, and its id.
+  base::SmallVector<CompactArg, 16> last_arg_set_;
+  ArgSetId last_arg_set_id_ = kInvalidArgSetId;
+
   TraceStorage* storage_;
 };
 
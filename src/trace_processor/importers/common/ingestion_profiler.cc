@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/tables/metadata_tables_py.h"
+
+namespace perfetto::trace_processor {
+
+IngestionProfiler::IngestionProfiler() = default;
+IngestionProfiler::~IngestionProfiler() = default;
+
+// static
+const char* IngestionProfiler::PhaseName(Phase phase) {
+  switch (phase) {
+    case Phase::kTokenize:
+      return "tokenize";
+    case Phase::kParse:
+      return "parse";
+    case Phase::kSort:
+      return "sort";
+    case Phase::kFlush:
+      return "flush";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+IngestionProfiler::Counters* IngestionProfiler::AddField(Phase phase,
+                                                         uint32_t field_id,
+                                                         size_t bytes) {
+  std::vector<Counters>& counters = by_field_[static_cast<size_t>(phase)];
+  if (field_id >= counters.size())
+    counters.resize(field_id + 1);
+  Counters* c = &counters[field_id];
+  c->count++;
+  c->bytes += static_cast<int64_t>(bytes);
+  return c;
+}
+
+IngestionProfiler::Counters* IngestionProfiler::AddNamed(Phase phase,
+                                                         const char* name,
+                                                         size_t bytes) {
+  Counters* c = nullptr;
+  for (NamedCounters& named : by_name_) {
+    if (named.phase == phase &&
+        (named.name == name || strcmp(named.name, name) == 0)) {
+      c = &named.counters;
+      break;
+    }
+  }
+  if (!c) {
+    by_name_.push_back(NamedCounters{phase, name, {}});
+    c = &by_name_.back().counters;
+  }
+  c->count++;
+  c->bytes += static_cast<int64_t>(bytes);
+  return c;
+}
+
+void IngestionProfiler::WriteToTable(
+    TraceStorage* storage,
+    const std::function<std::string(uint32_t)>& field_name) const {
+  auto* table = storage->mutable_ingestion_profile_table();
+  for (size_t p = 0; p < kPhaseCount; ++p) {
+    StringId phase_id =
+        storage->InternString(PhaseName(static_cast<Phase>(p)));
+    const std::vector<Counters>& counters = by_field_[p];
+    for (uint32_t field_id = 0; field_id < counters.size(); ++field_id) {
+      const Counters& c = counters[field_id];
+      if (c.count == 0)
+        continue;
+      tables::IngestionProfileTable::Row row;
+      row.phase = phase_id;
+      row.name = storage->InternString(base::StringView(field_name(field_id)));
+      row.count = c.count;
+      row.dur = c.dur_ns;
+      row.bytes = c.bytes;
+      table->Insert(row);
+    }
+    for (const NamedCounters& named : by_name_) {
+      if (static_cast<size_t>(named.phase) != p)
+        continue;
+      tables::IngestionProfileTable::Row row;
+      row.phase = phase_id;
+      row.name = storage->InternString(named.name);
+      row.count = named.counters.count;
+      row.dur = named.counters.dur_ns;
+      row.bytes = named.counters.bytes;
+      table->Insert(row);
+    }
+  }
+}
+
+}  // namespace perfetto::trace_processor
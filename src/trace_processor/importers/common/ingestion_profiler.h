@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_INGESTION_PROFILER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_INGESTION_PROFILER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/time.h"
+
+namespace perfetto::trace_processor {
+
+class TraceStorage;
+
+// Accumulates the wall time spent and the bytes consumed by each phase of the
+// ingestion of a trace, broken down by TracePacket field (for the tokenize and
+// parse phases) or by named step. Only created when
+// |Config::enable_ingestion_profile| is set: callers pass the (possibly null)
+// pointer from the context to the static Sample*() helpers below, so the cost
+// of a disabled profiler is a null check.
+//
+// Not thread-safe: all the samples must be recorded on the thread driving the
+// ingestion.
+class IngestionProfiler {
+ public:
+  enum class Phase : uint8_t {
+    kTokenize = 0,
+    kParse,
+    kSort,
+    kFlush,
+  };
+  static constexpr size_t kPhaseCount = static_cast<size_t>(Phase::kFlush) + 1;
+
+  struct Counters {
+    int64_t count = 0;
+    int64_t dur_ns = 0;
+    int64_t bytes = 0;
+  };
+
+  // Adds the wall time between its construction and destruction to a
+  // Counters. A no-op if constructed with null counters.
+  class ScopedSample {
+   public:
+    explicit ScopedSample(Counters* counters)
+        : counters_(counters),
+          start_ns_(counters ? base::GetWallTimeNs().count() : 0) {}
+    ~ScopedSample() {
+      if (counters_)
+        counters_->dur_ns += base::GetWallTimeNs().count() - start_ns_;
+    }
+
+    ScopedSample(const ScopedSample&) = delete;
+    ScopedSample& operator=(const ScopedSample&) = delete;
+
+   private:
+    Counters* counters_;
+    int64_t start_ns_;
+  };
+
+  IngestionProfiler();
+  ~IngestionProfiler();
+
+  // Records a sample of |bytes| for the TracePacket field |field_id| in
+  // |phase|. |profiler| can be null.
+  static ScopedSample SampleField(IngestionProfiler* profiler,
+                                  Phase phase,
+                                  uint32_t field_id,
+                                  size_t bytes) {
+    return ScopedSample(profiler ? profiler->AddField(phase, field_id, bytes)
+                                 : nullptr);
+  }
+
+  // Records a sample for the step |name| in |phase|. |name| must be a string
+  // literal. |profiler| can be null.
+  static ScopedSample SampleNamed(IngestionProfiler* profiler,
+                                  Phase phase,
+                                  const char* name,
+                                  size_t bytes = 0) {
+    return ScopedSample(profiler ? profiler->AddNamed(phase, name, bytes)
+                                 : nullptr);
+  }
+
+  // Appends a row to the |__intrinsic_ingestion_profile| table for each
+  // field and step which was sampled at least once. |field_name| maps a
+  // TracePacket field id to its name.
+  void WriteToTable(
+      TraceStorage* storage,
+      const std::function<std::string(uint32_t)>& field_name) const;
+
+  static const char* PhaseName(Phase phase);
+
+ private:
+  struct NamedCounters {
+    Phase phase;
+    const char* name;
+    Counters counters;
+  };
+
+  Counters* AddField(Phase phase, uint32_t field_id, size_t bytes);
+  Counters* AddNamed(Phase phase, const char* name, size_t bytes);
+
+  // Indexed by field id.
+  std::array<std::vector<Counters>, kPhaseCount> by_field_;
+
+  // There are only a handful of named steps so a linear scan is fine.
+  std::vector<NamedCounters> by_name_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_INGESTION_PROFILER_H_
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
+
+#include <cstdint>
+#include <string>
+
+#include "src/trace_processor/storage/trace_storage.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using Phase = IngestionProfiler::Phase;
+
+TEST(IngestionProfilerTest, NullProfilerIsNoop) {
+  auto sample = IngestionProfiler::SampleField(nullptr, Phase::kParse, 1, 10);
+  auto named = IngestionProfiler::SampleNamed(nullptr, Phase::kFlush, "x");
+}
+
+TEST(IngestionProfilerTest, WriteToTable) {
+  IngestionProfiler profiler;
+  IngestionProfiler::SampleField(&profiler, Phase::kTokenize, 3, 10);
+  IngestionProfiler::SampleField(&profiler, Phase::kTokenize, 3, 20);
+  IngestionProfiler::SampleField(&profiler, Phase::kParse, 5, 7);
+  IngestionProfiler::SampleNamed(&profiler, Phase::kFlush, "args_tracker");
+  IngestionProfiler::SampleNamed(&profiler, Phase::kFlush, "args_tracker");
+
+  TraceStorage storage;
+  profiler.WriteToTable(&storage, [](uint32_t field_id) {
+    return "f" + std::to_string(field_id);
+  });
+
+  const auto& table = storage.ingestion_profile_table();
+  ASSERT_EQ(table.row_count(), 3u);
+
+  auto row = [&](uint32_t i) {
+    return std::string(storage.GetString(table.phase()[i]).c_str()) + "/" +
+           storage.GetString(table.name()[i]).c_str();
+  };
+  EXPECT_EQ(row(0), "tokenize/f3");
+  EXPECT_EQ(table.count()[0], 2);
+  EXPECT_EQ(table.bytes()[0], 30);
+
+  EXPECT_EQ(row(1), "parse/f5");
+  EXPECT_EQ(table.count()[1], 1);
+  EXPECT_EQ(table.bytes()[1], 7);
+
+  EXPECT_EQ(row(2), "flush/args_tracker");
+  EXPECT_EQ(table.count()[2], 2);
+  EXPECT_GE(table.dur()[2], 0);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/memory_budget.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/column_storage.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+uint64_t ElementSize(ColumnType type) {
+  switch (type) {
+    case ColumnType::kInt32:
+    case ColumnType::kUint32:
+    case ColumnType::kString:
+      return 4;
+    case ColumnType::kInt64:
+    case ColumnType::kDouble:
+      return 8;
+    case ColumnType::kId:
+    case ColumnType::kDummy:
+      return 0;
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+const char* LevelDescription(MemoryBudget::Level level) {
+  switch (level) {
+    case MemoryBudget::Level::kOk:
+      return "ok";
+    case MemoryBudget::Level::kDropArgs:
+      return "dropping the args of events";
+    case MemoryBudget::Level::kDropRaw:
+      return "dropping the args of events and raw ftrace events";
+    case MemoryBudget::Level::kRefuseTables:
+      return "dropping the args of events and raw ftrace events, refusing "
+             "new PERFETTO TABLEs";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace
+
+MemoryBudget::MemoryBudget(uint64_t budget_bytes, TraceStorage* storage)
+    : budget_bytes_(budget_bytes), storage_(storage) {
+  PERFETTO_DCHECK(budget_bytes_ > 0);
+}
+
+MemoryBudget::~MemoryBudget() = default;
+
+void MemoryBudget::AddTable(std::string name, const Table* table) {
+  auto it =
+      std::find_if(tables_.begin(), tables_.end(),
+                   [table](const TableUsage& t) { return t.table == table; });
+  if (it == tables_.end())
+    tables_.push_back(TableUsage{std::move(name), table, 0});
+}
+
+MemoryBudget::Level MemoryBudget::Update(uint64_t sorter_bytes) {
+  std::unordered_set<const ColumnStorageBase*> seen_storage;
+  usage_bytes_ = 0;
+  for (TableUsage& usage : tables_) {
+    usage.bytes = 0;
+    for (const ColumnLegacy& col : usage.table->columns()) {
+      uint64_t element_size = ElementSize(col.col_type());
+      if (element_size == 0)
+        continue;
+      const ColumnStorageBase& storage = col.storage_base();
+      if (!seen_storage.insert(&storage).second)
+        continue;
+      usage.bytes += storage.non_null_size() * element_size;
+      if (col.IsNullable())
+        usage.bytes += storage.size() / 8;
+    }
+    usage_bytes_ += usage.bytes;
+  }
+  string_pool_bytes_ = storage_->string_pool().memory_usage();
+  sorter_bytes_ = sorter_bytes;
+  usage_bytes_ += string_pool_bytes_ + sorter_bytes_;
+
+  uint64_t percent = usage_bytes_ * 100 / budget_bytes_;
+  Level level = Level::kOk;
+  if (percent >= kRefuseTablesPercent) {
+    level = Level::kRefuseTables;
+  } else if (percent >= kDropRawPercent) {
+    level = Level::kDropRaw;
+  } else if (percent >= kDropArgsPercent) {
+    level = Level::kDropArgs;
+  }
+  if (level > level_) {
+    level_ = level;
+    auto breakdown = UsageBreakdown();
+    std::string largest;
+    for (size_t i = 0; i < std::min<size_t>(3, breakdown.size()); ++i) {
+      largest += " " + breakdown[i].first + ": " +
+                 std::to_string(breakdown[i].second / 1024 / 1024) + " MB";
+    }
+    PERFETTO_ELOG("Memory usage at %" PRIu64 "%% of the budget, %s. Largest:%s",
+                  percent, LevelDescription(level_), largest.c_str());
+  }
+  return level_;
+}
+
+// static
+bool MemoryBudget::ShouldDropRawEvent(MemoryBudget* budget) {
+  if (!budget || budget->level_ < Level::kDropRaw)
+    return false;
+  budget->storage_->IncrementStats(stats::memory_budget_raw_dropped);
+  return true;
+}
+
+// static
+base::Status MemoryBudget::CheckCanCreateTable(MemoryBudget* budget,
+                                               const std::string& name) {
+  if (!budget || budget->level_ < Level::kRefuseTables)
+    return base::OkStatus();
+  budget->storage_->IncrementStats(stats::memory_budget_tables_refused);
+  return base::ErrStatus(
+      "Cannot create table %s: the memory usage of trace processor (%" PRIu64
+      " MB) is close to the memory budget (%" PRIu64 " MB)",
+      name.c_str(), budget->usage_bytes_ / 1024 / 1024,
+      budget->budget_bytes_ / 1024 / 1024);
+}
+
+std::vector<std::pair<std::string, uint64_t>> MemoryBudget::UsageBreakdown()
+    const {
+  std::vector<std::pair<std::string, uint64_t>> breakdown;
+  for (const TableUsage& usage : tables_)
+    breakdown.emplace_back(usage.name, usage.bytes);
+  breakdown.emplace_back("string_pool", string_pool_bytes_);
+  breakdown.emplace_back("sorter", sorter_bytes_);
+  std::stable_sort(
+      breakdown.begin(), breakdown.end(),
+      [](const auto& a, const auto& b) { return a.second > b.second; });
+  return breakdown;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_MEMORY_BUDGET_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_MEMORY_BUDGET_H_
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto::trace_processor {
+
+class Table;
+class TraceStorage;
+
+// Keeps an estimate of the memory used by the tables, the string pool and the
+// sorter and decides which data should be dropped as it approaches
+// |Config::memory_budget_bytes|. Only created when the budget is set: callers
+// pass the (possibly null) pointer from the context to the static helpers
+// below, so the cost of a disabled budget is a null check.
+//
+// The estimate only counts the bytes of the values stored in the columns of
+// the tables (i.e. not their indexes or overlays) and is recomputed by
+// |Update|, which is called after each chunk of the trace is parsed.
+class MemoryBudget {
+ public:
+  // The steps taken as the usage grows, in order. Once reached, a step stays
+  // in effect even if the usage later decreases (e.g. when the sorter is
+  // flushed at the end of the trace): args or events dropped for part of the
+  // trace only would be more confusing than dropping them from then on.
+  enum class Level : uint8_t {
+    kOk = 0,
+    // Args are not added to slices, counters, flows and raw events.
+    kDropArgs,
+    // Ftrace events are not added to the raw table.
+    kDropRaw,
+    // New PERFETTO TABLEs are refused.
+    kRefuseTables,
+  };
+
+  // The fraction of the budget, in percent, at which each level is reached.
+  static constexpr uint64_t kDropArgsPercent = 70;
+  static constexpr uint64_t kDropRawPercent = 85;
+  static constexpr uint64_t kRefuseTablesPercent = 95;
+
+  MemoryBudget(uint64_t budget_bytes, TraceStorage* storage);
+  ~MemoryBudget();
+
+  // Adds |table| to the tables whose memory is counted. Adding the same table
+  // again is a no-op. Columns shared by several tables (e.g. the ones of a
+  // parent table) are only counted once.
+  void AddTable(std::string name, const Table* table);
+
+  // Recomputes the usage, adding |sorter_bytes| for the events held by the
+  // sorter, and updates the level accordingly.
+  Level Update(uint64_t sorter_bytes);
+
+  // Returns whether the args of the high volume event tables should be
+  // dropped. |budget| can be null.
+  static bool ShouldDropArgs(const MemoryBudget* budget) {
+    return budget && budget->level_ >= Level::kDropArgs;
+  }
+
+  // Returns whether an ftrace event should not be added to the raw table,
+  // recording it in the stats if so. |budget| can be null.
+  static bool ShouldDropRawEvent(MemoryBudget* budget);
+
+  // Returns an error, recording it in the stats, if the PERFETTO TABLE
+  // |name| should not be created. |budget| can be null.
+  static base::Status CheckCanCreateTable(MemoryBudget* budget,
+                                          const std::string& name);
+
+  // Returns the bytes used by each of the tables, the string pool and the
+  // sorter as of the last |Update|, largest first.
+  std::vector<std::pair<std::string, uint64_t>> UsageBreakdown() const;
+
+  Level level() const { return level_; }
+  uint64_t budget_bytes() const { return budget_bytes_; }
+  uint64_t usage_bytes() const { return usage_bytes_; }
+
+ private:
+  struct TableUsage {
+    std::string name;
+    const Table* table;
+    uint64_t bytes;
+  };
+
+  uint64_t budget_bytes_;
+  TraceStorage* storage_;
+  std::vector<TableUsage> tables_;
+  uint64_t string_pool_bytes_ = 0;
+  uint64_t sorter_bytes_ = 0;
+  uint64_t usage_bytes_ = 0;
+  Level level_ = Level::kOk;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_MEMORY_BUDGET_H_
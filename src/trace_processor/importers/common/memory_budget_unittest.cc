@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/common/memory_budget.h"
+
+#include <cstdint>
+#include <string>
+
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/tables/metadata_tables_py.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using Level = MemoryBudget::Level;
+
+constexpr uint64_t kBudget = 100ull * 1024 * 1024;
+
+uint64_t BytesOf(const MemoryBudget& budget, const std::string& name) {
+  for (const auto& [usage_name, bytes] : budget.UsageBreakdown()) {
+    if (usage_name == name)
+      return bytes;
+  }
+  return 0;
+}
+
+TEST(MemoryBudgetTest, NullBudgetIsNoop) {
+  EXPECT_FALSE(MemoryBudget::ShouldDropArgs(nullptr));
+  EXPECT_FALSE(MemoryBudget::ShouldDropRawEvent(nullptr));
+  EXPECT_TRUE(MemoryBudget::CheckCanCreateTable(nullptr, "foo").ok());
+}
+
+TEST(MemoryBudgetTest, LevelsFollowUsage) {
+  TraceStorage storage;
+  MemoryBudget budget(kBudget, &storage);
+  ASSERT_EQ(budget.Update(0), Level::kOk);
+  ASSERT_LT(budget.usage_bytes(), kBudget / 100);
+
+  ASSERT_EQ(budget.Update(kBudget * 71 / 100), Level::kDropArgs);
+  ASSERT_TRUE(MemoryBudget::ShouldDropArgs(&budget));
+  ASSERT_FALSE(MemoryBudget::ShouldDropRawEvent(&budget));
+
+  ASSERT_EQ(budget.Update(kBudget * 86 / 100), Level::kDropRaw);
+  ASSERT_TRUE(MemoryBudget::ShouldDropRawEvent(&budget));
+  ASSERT_TRUE(MemoryBudget::CheckCanCreateTable(&budget, "foo").ok());
+  ASSERT_EQ(storage.stats()[stats::memory_budget_raw_dropped].value, 1);
+
+  ASSERT_EQ(budget.Update(kBudget), Level::kRefuseTables);
+  base::Status status = MemoryBudget::CheckCanCreateTable(&budget, "foo");
+  ASSERT_FALSE(status.ok());
+  ASSERT_THAT(status.message(), testing::HasSubstr("Cannot create table foo"));
+  ASSERT_EQ(storage.stats()[stats::memory_budget_tables_refused].value, 1);
+
+  // Levels are never lowered.
+  ASSERT_EQ(budget.Update(0), Level::kRefuseTables);
+}
+
+TEST(MemoryBudgetTest, CountsTablesOnce) {
+  TraceStorage storage;
+  MemoryBudget budget(kBudget, &storage);
+  budget.AddTable("raw", storage.mutable_raw_table());
+  budget.AddTable("ftrace_event", storage.mutable_ftrace_event_table());
+  budget.AddTable("raw", storage.mutable_raw_table());
+  budget.Update(0);
+  uint64_t empty_usage = budget.usage_bytes();
+
+  for (int64_t i = 0; i < 1000; ++i) {
+    tables::FtraceEventTable::Row row;
+    row.ts = i;
+    storage.mutable_ftrace_event_table()->Insert(row);
+  }
+  budget.Update(0);
+
+  // The rows are counted in the parent table, whose columns are shared with
+  // the child one.
+  ASSERT_GE(BytesOf(budget, "raw"), 1000u * sizeof(int64_t));
+  ASSERT_EQ(BytesOf(budget, "ftrace_event"), 0u);
+  ASSERT_EQ(budget.usage_bytes() - empty_usage, BytesOf(budget, "raw"));
+  ASSERT_EQ(budget.UsageBreakdown().size(), 4u);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -42,6 +42,21 @@ struct alignas(8) InlineSchedWaking {
 };
 static_assert(sizeof(InlineSchedWaking) == 16);
 
+// Compact forms of the high volume ETW kernel events, decoded at tokenization
+// time so that the sorter does not have to hold on to the whole event.
+struct alignas(8) InlineEtwCSwitch {
+  int64_t old_thread_state;
+  uint32_t old_thread_id;
+  uint32_t new_thread_id;
+  int32_t new_thread_priority;
+};
+static_assert(sizeof(InlineEtwCSwitch) == 24);
+
+struct alignas(8) InlineEtwReadyThread {
+  uint32_t t_thread_id;
+};
+static_assert(sizeof(InlineEtwReadyThread) == 8);
+
 struct alignas(8) JsonEvent {
   std::string value;
 };
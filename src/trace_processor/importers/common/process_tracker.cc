@@ -33,7 +33,9 @@
 namespace perfetto::trace_processor {
 
 ProcessTracker::ProcessTracker(TraceProcessorContext* context)
-    : context_(context), args_tracker_(context) {
+    : context_(context),
+      args_tracker_(context),
+      thread_cache_(kThreadCacheSize) {
   // Reserve utid/upid 0. These are special as embedders (e.g. Perfetto UI)
   // exclude them from certain views (e.g. thread state) under the assumption
   // that they correspond to the idle (swapper) process. When parsing Linux
@@ -77,6 +79,7 @@ UniqueTid ProcessTracker::StartNewThread(std::optional<int64_t> timestamp,
   auto* thread_table = context_->storage->mutable_thread_table();
   UniqueTid new_utid = thread_table->Insert(row).row;
   tids_[tid].emplace_back(new_utid);
+  InvalidateCachedThread(tid);
 
   if (PERFETTO_UNLIKELY(thread_name_priorities_.size() <= new_utid)) {
     // This condition can happen in a multi-machine tracing session:
@@ -112,6 +115,7 @@ void ProcessTracker::EndThread(int64_t timestamp, uint32_t tid) {
   // this one should be ignored.
   auto& vector = tids_[tid];
   vector.erase(std::remove(vector.begin(), vector.end(), utid), vector.end());
+  InvalidateCachedThread(tid);
 
   auto opt_upid = thread_table->upid()[utid];
   if (!opt_upid.has_value() || process_table->pid()[*opt_upid] != tid)
@@ -122,6 +126,7 @@ void ProcessTracker::EndThread(int64_t timestamp, uint32_t tid) {
   PERFETTO_DCHECK(thread_table->is_main_thread()[utid].value());
   process_table->mutable_end_ts()->Set(*opt_upid, timestamp);
   pids_.Erase(tid);
+  InvalidateThreadCache();
 }
 
 std::optional<UniqueTid> ProcessTracker::GetThreadOrNull(uint32_t tid) {
@@ -203,6 +208,15 @@ bool ProcessTracker::IsThreadAlive(UniqueTid utid) {
 std::optional<UniqueTid> ProcessTracker::GetThreadOrNull(
     uint32_t tid,
     std::optional<uint32_t> pid) {
+  ThreadCacheEntry& cached = thread_cache_[tid & kThreadCacheMask];
+  if (PERFETTO_LIKELY(cached.epoch == thread_cache_epoch_ &&
+                      cached.tid == tid)) {
+    // The cached thread is the first alive one below: it is also the one
+    // picked when filtering by pid if its process is unknown or matches.
+    if (!pid || !cached.pid || *cached.pid == *pid)
+      return cached.utid;
+  }
+
   auto* threads = context_->storage->mutable_thread_table();
   auto* processes = context_->storage->mutable_process_table();
 
@@ -210,6 +224,8 @@ std::optional<UniqueTid> ProcessTracker::GetThreadOrNull(
   if (!vector_it)
     return std::nullopt;
 
+  bool cache_filled = false;
+
   // Iterate backwards through the threads so ones later in the trace are more
   // likely to be picked.
   const auto& vector = *vector_it;
@@ -224,14 +240,25 @@ std::optional<UniqueTid> ProcessTracker::GetThreadOrNull(
     if (!IsThreadAlive(current_utid))
       continue;
 
-    // If we don't know the parent process, we have to choose this thread.
     auto opt_current_upid = threads->upid()[current_utid];
-    if (!opt_current_upid)
+    std::optional<uint32_t> current_pid;
+    if (opt_current_upid)
+      current_pid = processes->pid()[*opt_current_upid];
+
+    if (!cache_filled) {
+      cached.tid = tid;
+      cached.epoch = thread_cache_epoch_;
+      cached.utid = current_utid;
+      cached.pid = current_pid;
+      cache_filled = true;
+    }
+
+    // If we don't know the parent process, we have to choose this thread.
+    if (!current_pid)
       return current_utid;
 
     // We found a thread that matches both the tid and its parent pid.
-    uint32_t current_pid = processes->pid()[*opt_current_upid];
-    if (!pid || current_pid == *pid)
+    if (!pid || *current_pid == *pid)
       return current_utid;
   }
   return std::nullopt;
@@ -307,6 +334,7 @@ UniquePid ProcessTracker::StartNewProcess(std::optional<int64_t> timestamp,
                                           StringId main_thread_name,
                                           ThreadNamePriority priority) {
   pids_.Erase(pid);
+  InvalidateThreadCache();
   // TODO(eseckler): Consider erasing all old entries in |tids_| that match the
   // |pid| (those would be for an older process with the same pid). Right now,
   // we keep them in |tids_| (if they weren't erased by EndThread()), but ignore
@@ -421,6 +449,7 @@ UniquePid ProcessTracker::GetOrCreateProcess(uint32_t pid) {
 
   UniquePid upid = process_table->Insert(row).row;
   *it_and_ins.first = upid;  // Update the newly inserted hashmap entry.
+  InvalidateThreadCache();
 
   // Create an entry for the main thread.
   // We cannot call StartNewThread() here, because threads for this process
@@ -539,12 +568,14 @@ void ProcessTracker::AssociateThreadToProcess(UniqueTid utid, UniquePid upid) {
   auto* process_table = context_->storage->mutable_process_table();
   bool main_thread = thread_table->tid()[utid] == process_table->pid()[upid];
   thread_table->mutable_is_main_thread()->Set(utid, main_thread);
+  InvalidateCachedThread(thread_table->tid()[utid]);
 }
 
 void ProcessTracker::SetPidZeroIsUpidZeroIdleProcess() {
   // Create a mapping from (t|p)id 0 -> u(t|p)id for the idle process.
   tids_.Insert(0, std::vector<UniqueTid>{swapper_utid_});
   pids_.Insert(0, swapper_upid_);
+  InvalidateThreadCache();
 
   auto swapper_id = context_->storage->InternString("swapper");
   UpdateThreadName(0, swapper_id, ThreadNamePriority::kTraceProcessorConstant);
@@ -558,6 +589,7 @@ void ProcessTracker::NotifyEndOfFile() {
   args_tracker_.Flush();
   tids_.Clear();
   pids_.Clear();
+  InvalidateThreadCache();
   pending_assocs_.clear();
   pending_parent_assocs_.clear();
   thread_name_priorities_.clear();
@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_PROCESS_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_PROCESS_TRACKER_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
 #include <unordered_map>
@@ -26,6 +27,7 @@
 
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/public/compiler.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -210,6 +212,23 @@ class ProcessTracker {
   // other threads associated to the passed thread.
   void ResolvePendingAssociations(UniqueTid, UniquePid);
 
+  // Drops the cached lookup result for |tid|, when a thread with that tid is
+  // started, ended or associated to a process.
+  void InvalidateCachedThread(uint32_t tid) {
+    ThreadCacheEntry& entry = thread_cache_[tid & kThreadCacheMask];
+    if (entry.tid == tid)
+      entry.epoch = 0;
+  }
+
+  // Drops all the cached lookup results, when |pids_| or the liveness of
+  // a process changes, as that can change which threads are alive.
+  void InvalidateThreadCache() {
+    if (PERFETTO_UNLIKELY(++thread_cache_epoch_ == 0)) {
+      std::fill(thread_cache_.begin(), thread_cache_.end(), ThreadCacheEntry());
+      thread_cache_epoch_ = 1;
+    }
+  }
+
   // Writes the association that the passed thread belongs to the passed
   // process.
   void AssociateThreadToProcess(UniqueTid, UniquePid);
@@ -229,6 +248,24 @@ class ProcessTracker {
   // Mapping of the most recently seen pid to the associated upid.
   base::FlatHashMap<uint32_t /* pid (aka tgid) */, UniquePid> pids_;
 
+  // Direct-mapped cache, indexed by tid, of the thread GetThreadOrNull()
+  // picks for a tid when not filtering by pid, along with the pid of its
+  // process. Sched and track events look up the same few threads over and
+  // over: a hit avoids the |tids_| lookup and checking that each candidate is
+  // still alive in the thread and process tables.
+  // An entry is only valid if its |epoch| matches |thread_cache_epoch_|.
+  struct ThreadCacheEntry {
+    uint32_t tid = 0;
+    uint32_t epoch = 0;
+    UniqueTid utid = 0;
+    // The pid of the process of |utid|, if known.
+    std::optional<uint32_t> pid;
+  };
+  static constexpr uint32_t kThreadCacheSize = 4096;
+  static constexpr uint32_t kThreadCacheMask = kThreadCacheSize - 1;
+  std::vector<ThreadCacheEntry> thread_cache_;
+  uint32_t thread_cache_epoch_ = 1;
+
   // Pending thread associations. The meaning of a pair<ThreadA, ThreadB> in
   // this vector is: we know that A and B belong to the same process, but we
   // don't know yet which process. A and A are idempotent, as in, pair<A,B> is
@@ -187,6 +187,28 @@ TEST_F(ProcessTrackerTest, TidReuseAfterExplicitEnd) {
   ASSERT_EQ(reuse, reuse_again);
 }
 
+TEST_F(ProcessTrackerTest, TidReuseAfterCachedLookups) {
+  UniqueTid utid = context.process_tracker->UpdateThread(124, 123);
+  ASSERT_EQ(context.process_tracker->GetOrCreateThread(124), utid);
+  ASSERT_EQ(context.process_tracker->UpdateThread(124, 123), utid);
+
+  // A thread with the same tid in another process is a different thread.
+  UniqueTid other = context.process_tracker->UpdateThread(124, 456);
+  ASSERT_NE(other, utid);
+  ASSERT_EQ(context.process_tracker->GetOrCreateThread(124), other);
+
+  // Threads of a process which was replaced are dead.
+  context.process_tracker->StartNewProcess(
+      100, std::nullopt, 456, kNullStringId, ThreadNamePriority::kFtrace);
+  ASSERT_EQ(context.process_tracker->GetOrCreateThread(124), utid);
+
+  context.process_tracker->EndThread(200, 124);
+  ASSERT_FALSE(context.process_tracker->GetThreadOrNull(124).has_value());
+
+  UniqueTid reuse = context.process_tracker->StartNewThread(300, 124);
+  ASSERT_EQ(context.process_tracker->GetOrCreateThread(124), reuse);
+}
+
 TEST_F(ProcessTrackerTest, EndThreadAfterProcessEnd) {
   context.process_tracker->StartNewProcess(
       100, std::nullopt, 123, kNullStringId, ThreadNamePriority::kFtrace);
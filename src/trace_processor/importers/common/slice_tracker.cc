@@ -65,12 +65,12 @@ void SliceTracker::BeginLegacyUnnestable(tables::SliceTable::Row row,
   // Double check that if we've seen this track in the past, it was also
   // marked as unnestable then.
 #if PERFETTO_DCHECK_IS_ON()
-  auto* it = stacks_.Find(row.track_id);
+  auto* it = FindTrackInfo(row.track_id);
   PERFETTO_DCHECK(!it || it->is_legacy_unnestable);
 #endif
 
   // Ensure that StartSlice knows that this track is unnestable.
-  stacks_[row.track_id].is_legacy_unnestable = true;
+  GetOrCreateTrackInfo(row.track_id).is_legacy_unnestable = true;
 
   StartSlice(row.ts, row.track_id, args_callback, [this, &row]() {
     return context_->storage->mutable_slice_table()->Insert(row).id;
@@ -110,7 +110,7 @@ std::optional<uint32_t> SliceTracker::AddArgs(TrackId track_id,
                                               StringId category,
                                               StringId name,
                                               SetArgsCallback args_callback) {
-  auto* it = stacks_.Find(track_id);
+  auto* it = FindTrackInfo(track_id);
   if (!it)
     return std::nullopt;
 
@@ -118,21 +118,18 @@ std::optional<uint32_t> SliceTracker::AddArgs(TrackId track_id,
   if (stack.empty())
     return std::nullopt;
 
-  auto* slices = context_->storage->mutable_slice_table();
   std::optional<uint32_t> stack_idx =
       MatchingIncompleteSliceIndex(stack, name, category);
   if (!stack_idx.has_value())
     return std::nullopt;
 
-  tables::SliceTable::RowNumber num = stack[*stack_idx].row;
-  tables::SliceTable::RowReference ref = num.ToRowReference(slices);
-  PERFETTO_DCHECK(ref.dur() == kPendingDuration);
+  SliceInfo& slice_info = stack[*stack_idx];
+  PERFETTO_DCHECK(slice_info.dur == kPendingDuration);
 
   // Add args to current pending slice.
-  ArgsTracker* tracker = &stack[*stack_idx].args_tracker;
-  auto bound_inserter = tracker->AddArgsTo(ref.id());
+  auto bound_inserter = GetArgsTracker(slice_info).AddArgsTo(slice_info.id);
   args_callback(&bound_inserter);
-  return num.row_number();
+  return slice_info.row.row_number();
 }
 
 std::optional<SliceId> SliceTracker::StartSlice(
@@ -147,7 +144,7 @@ std::optional<SliceId> SliceTracker::StartSlice(
   }
   prev_timestamp_ = timestamp;
 
-  auto& track_info = stacks_[track_id];
+  auto& track_info = GetOrCreateTrackInfo(track_id);
   auto& stack = track_info.slice_stack;
 
   if (track_info.is_legacy_unnestable) {
@@ -164,22 +161,18 @@ std::optional<SliceId> SliceTracker::StartSlice(
   }
 
   auto* slices = context_->storage->mutable_slice_table();
-  MaybeCloseStack(timestamp, stack, track_id);
+  MaybeCloseStack(timestamp, stack);
 
   size_t depth = stack.size();
-
-  std::optional<tables::SliceTable::RowReference> parent_ref =
-      depth == 0 ? std::nullopt
-                 : std::make_optional(stack.back().row.ToRowReference(slices));
-  int64_t parent_stack_id = parent_ref ? parent_ref->stack_id() : 0;
+  const SliceInfo* parent = depth == 0 ? nullptr : &stack.back();
+  int64_t parent_stack_id = parent ? parent->stack_id : 0;
   std::optional<tables::SliceTable::Id> parent_id =
-      parent_ref ? std::make_optional(parent_ref->id()) : std::nullopt;
+      parent ? std::make_optional(parent->id) : std::nullopt;
 
   SliceId id = inserter();
   tables::SliceTable::RowReference ref = *slices->FindById(id);
   if (depth >= std::numeric_limits<uint8_t>::max()) {
-    auto parent_name = context_->storage->GetString(
-        parent_ref->name().value_or(kNullStringId));
+    auto parent_name = context_->storage->GetString(parent->name);
     auto name =
         context_->storage->GetString(ref.name().value_or(kNullStringId));
     PERFETTO_DLOG("Last slice: %s", parent_name.c_str());
@@ -187,18 +180,18 @@ std::optional<SliceId> SliceTracker::StartSlice(
     PERFETTO_DFATAL("Slices with too large depth found.");
     return std::nullopt;
   }
-  StackPush(track_id, ref);
+  StackPush(track_id, stack, ref);
 
   // Post fill all the relevant columns. All the other columns should have
   // been filled by the inserter.
   ref.set_depth(static_cast<uint8_t>(depth));
   ref.set_parent_stack_id(parent_stack_id);
-  ref.set_stack_id(GetStackHash(stack));
+  ref.set_stack_id(stack.back().stack_id);
   if (parent_id)
     ref.set_parent_id(*parent_id);
 
   if (args_callback) {
-    auto bound_inserter = stack.back().args_tracker.AddArgsTo(id);
+    auto bound_inserter = GetArgsTracker(stack.back()).AddArgsTo(id);
     args_callback(&bound_inserter);
   }
   return id;
@@ -216,13 +209,13 @@ std::optional<SliceId> SliceTracker::CompleteSlice(
   }
   prev_timestamp_ = timestamp;
 
-  auto it = stacks_.Find(track_id);
+  auto it = FindTrackInfo(track_id);
   if (!it)
     return std::nullopt;
 
   TrackInfo& track_info = *it;
   SlicesStack& stack = track_info.slice_stack;
-  MaybeCloseStack(timestamp, stack, track_id);
+  MaybeCloseStack(timestamp, stack);
   if (stack.empty())
     return std::nullopt;
 
@@ -234,21 +227,19 @@ std::optional<SliceId> SliceTracker::CompleteSlice(
   if (!stack_idx)
     return std::nullopt;
 
-  const auto& slice_info = stack[stack_idx.value()];
-
-  tables::SliceTable::RowReference ref = slice_info.row.ToRowReference(slices);
-  PERFETTO_DCHECK(ref.dur() == kPendingDuration);
-  ref.set_dur(timestamp - ref.ts());
+  SliceInfo& slice_info = stack[stack_idx.value()];
+  PERFETTO_DCHECK(slice_info.dur == kPendingDuration);
+  slice_info.dur = timestamp - slice_info.ts;
+  slice_info.row.ToRowReference(slices).set_dur(slice_info.dur);
 
-  ArgsTracker& tracker = stack[stack_idx.value()].args_tracker;
   if (args_callback) {
-    auto bound_inserter = tracker.AddArgsTo(ref.id());
+    auto bound_inserter = GetArgsTracker(slice_info).AddArgsTo(slice_info.id);
     args_callback(&bound_inserter);
   }
 
   // Add the legacy unnestable args if they exist.
   if (track_info.is_legacy_unnestable) {
-    auto bound_inserter = tracker.AddArgsTo(ref.id());
+    auto bound_inserter = GetArgsTracker(slice_info).AddArgsTo(slice_info.id);
     bound_inserter.AddArg(
         legacy_unnestable_begin_count_string_id_,
         Variadic::Integer(track_info.legacy_unnestable_begin_count));
@@ -258,10 +249,11 @@ std::optional<SliceId> SliceTracker::CompleteSlice(
   }
 
   // If this slice is the top slice on the stack, pop it off.
+  SliceId id = slice_info.id;
   if (*stack_idx == stack.size() - 1) {
-    StackPop(track_id);
+    StackPop(stack);
   }
-  return ref.id();
+  return id;
 }
 
 // Returns the first incomplete slice in the stack with matching name and
@@ -271,20 +263,17 @@ std::optional<uint32_t> SliceTracker::MatchingIncompleteSliceIndex(
     const SlicesStack& stack,
     StringId name,
     StringId category) {
-  auto* slices = context_->storage->mutable_slice_table();
   for (int i = static_cast<int>(stack.size()) - 1; i >= 0; i--) {
-    tables::SliceTable::RowReference ref =
-        stack[static_cast<size_t>(i)].row.ToRowReference(slices);
-    if (ref.dur() != kPendingDuration)
+    const SliceInfo& slice_info = stack[static_cast<size_t>(i)];
+    if (slice_info.dur != kPendingDuration)
       continue;
-    std::optional<StringId> other_category = ref.category();
-    if (!category.is_null() && (!other_category || other_category->is_null() ||
-                                category != other_category)) {
+    StringId other_category = slice_info.category;
+    if (!category.is_null() &&
+        (other_category.is_null() || category != other_category)) {
       continue;
     }
-    std::optional<StringId> other_name = ref.name();
-    if (!name.is_null() && other_name && !other_name->is_null() &&
-        name != other_name) {
+    StringId other_name = slice_info.name;
+    if (!name.is_null() && !other_name.is_null() && name != other_name) {
       continue;
     }
     return static_cast<uint32_t>(i);
@@ -293,16 +282,15 @@ std::optional<uint32_t> SliceTracker::MatchingIncompleteSliceIndex(
 }
 
 void SliceTracker::MaybeAddTranslatableArgs(SliceInfo& slice_info) {
-  if (!slice_info.args_tracker.NeedsTranslation(
+  if (!slice_info.args_tracker ||
+      !slice_info.args_tracker->NeedsTranslation(
           *context_->args_translation_table)) {
     return;
   }
   const auto& table = context_->storage->slice_table();
-  tables::SliceTable::ConstRowReference ref =
-      slice_info.row.ToRowReference(table);
   translatable_args_.emplace_back(TranslatableArgs{
-      ref.id(),
-      std::move(slice_info.args_tracker)
+      slice_info.id,
+      std::move(*slice_info.args_tracker)
           .ToCompactArgSet(table.arg_set_id(), slice_info.row.row_number())});
 }
 
@@ -333,6 +321,7 @@ void SliceTracker::FlushPendingSlices() {
   translatable_args_.clear();
 
   stacks_.Clear();
+  cached_track_info_ = nullptr;
 }
 
 void SliceTracker::SetOnSliceBeginCallback(OnSliceBeginCallback callback) {
@@ -347,21 +336,16 @@ std::optional<SliceId> SliceTracker::GetTopmostSliceOnTrack(
   const auto& stack = iter->slice_stack;
   if (stack.empty())
     return std::nullopt;
-  const auto& slice = context_->storage->slice_table();
-  return stack.back().row.ToRowReference(slice).id();
+  return stack.back().id;
 }
 
-void SliceTracker::MaybeCloseStack(int64_t ts,
-                                   const SlicesStack& stack,
-                                   TrackId track_id) {
-  auto* slices = context_->storage->mutable_slice_table();
+void SliceTracker::MaybeCloseStack(int64_t ts, SlicesStack& stack) {
   bool incomplete_descendent = false;
   for (int i = static_cast<int>(stack.size()) - 1; i >= 0; i--) {
-    tables::SliceTable::RowReference ref =
-        stack[static_cast<size_t>(i)].row.ToRowReference(slices);
+    const SliceInfo& slice_info = stack[static_cast<size_t>(i)];
 
-    int64_t start_ts = ref.ts();
-    int64_t dur = ref.dur();
+    int64_t start_ts = slice_info.ts;
+    int64_t dur = slice_info.dur;
     int64_t end_ts = start_ts + dur;
     if (dur == kPendingDuration) {
       incomplete_descendent = true;
@@ -387,46 +371,85 @@ void SliceTracker::MaybeCloseStack(int64_t ts,
           "Incorrect ordering of begin/end slice events. "
           "Truncating incomplete descendants to the end of slice "
           "%s[%" PRId64 ", %" PRId64 "] due to an event at ts=%" PRId64 ".",
-          context_->storage->GetString(ref.name().value_or(kNullStringId))
-              .c_str(),
-          start_ts, end_ts, ts);
+          context_->storage->GetString(slice_info.name).c_str(), start_ts,
+          end_ts, ts);
       context_->storage->IncrementStats(stats::misplaced_end_event);
 
       // Every slice below this one should have a pending duration. Update
       // of them to have the end ts of the current slice and pop them
       // all off.
+      auto* slices = context_->storage->mutable_slice_table();
       for (int j = static_cast<int>(stack.size()) - 1; j > i; --j) {
-        tables::SliceTable::RowReference child_ref =
-            stack[static_cast<size_t>(j)].row.ToRowReference(slices);
-        PERFETTO_DCHECK(child_ref.dur() == kPendingDuration);
-        child_ref.set_dur(end_ts - child_ref.ts());
-        StackPop(track_id);
+        SliceInfo& child = stack[static_cast<size_t>(j)];
+        PERFETTO_DCHECK(child.dur == kPendingDuration);
+        child.dur = end_ts - child.ts;
+        child.row.ToRowReference(slices).set_dur(child.dur);
+        StackPop(stack);
       }
 
       // Also pop the current row itself and reset the incomplete flag.
-      StackPop(track_id);
+      StackPop(stack);
       incomplete_descendent = false;
 
       continue;
     }
 
     if (end_ts <= ts) {
-      StackPop(track_id);
+      StackPop(stack);
     }
   }
 }
 
-int64_t SliceTracker::GetStackHash(const SlicesStack& stack) {
-  PERFETTO_DCHECK(!stack.empty());
+SliceTracker::TrackInfo* SliceTracker::FindTrackInfo(TrackId track_id) {
+  if (cached_track_info_ && cached_track_id_ == track_id)
+    return cached_track_info_;
+  TrackInfo* track_info = stacks_.Find(track_id);
+  if (track_info) {
+    cached_track_id_ = track_id;
+    cached_track_info_ = track_info;
+  }
+  return track_info;
+}
+
+SliceTracker::TrackInfo& SliceTracker::GetOrCreateTrackInfo(TrackId track_id) {
+  if (cached_track_info_ && cached_track_id_ == track_id)
+    return *cached_track_info_;
+  cached_track_id_ = track_id;
+  cached_track_info_ = &stacks_[track_id];
+  return *cached_track_info_;
+}
 
-  const auto& slices = context_->storage->slice_table();
+ArgsTracker& SliceTracker::GetArgsTracker(SliceInfo& slice_info) {
+  if (!slice_info.args_tracker) {
+    if (free_args_trackers_.empty()) {
+      slice_info.args_tracker = std::make_unique<ArgsTracker>(context_);
+    } else {
+      slice_info.args_tracker = std::move(free_args_trackers_.back());
+      free_args_trackers_.pop_back();
+    }
+  }
+  return *slice_info.args_tracker;
+}
 
-  base::Hasher hash;
-  for (size_t i = 0; i < stack.size(); i++) {
-    auto ref = stack[i].row.ToRowReference(slices);
-    hash.Update(ref.category().value_or(kNullStringId).raw_id());
-    hash.Update(ref.name().value_or(kNullStringId).raw_id());
+void SliceTracker::StackPop(SlicesStack& stack) {
+  SliceInfo& slice_info = stack.back();
+  MaybeAddTranslatableArgs(slice_info);
+  if (slice_info.args_tracker) {
+    slice_info.args_tracker->FlushAndReset();
+    free_args_trackers_.emplace_back(std::move(slice_info.args_tracker));
   }
+  stack.pop_back();
+}
+
+void SliceTracker::StackPush(TrackId track_id,
+                             SlicesStack& stack,
+                             tables::SliceTable::RowReference ref) {
+  StringId category = ref.category().value_or(kNullStringId);
+  StringId name = ref.name().value_or(kNullStringId);
+  base::Hasher hasher =
+      stack.empty() ? base::Hasher() : stack.back().stack_hasher;
+  hasher.Update(category.raw_id());
+  hasher.Update(name.raw_id());
 
   // For clients which don't have an integer type (i.e. Javascript), returning
   // hashes which have the top 11 bits set leads to numbers which are
@@ -434,19 +457,10 @@ int64_t SliceTracker::GetStackHash(const SlicesStack& stack) {
   // it will be meaningless when passed back to us. For this reason, make sure
   // that the hash is always less than 2^53 - 1.
   constexpr uint64_t kSafeBitmask = (1ull << 53) - 1;
-  return static_cast<int64_t>(hash.digest() & kSafeBitmask);
-}
-
-void SliceTracker::StackPop(TrackId track_id) {
-  auto& stack = stacks_[track_id].slice_stack;
-  MaybeAddTranslatableArgs(stack.back());
-  stack.pop_back();
-}
+  int64_t stack_id = static_cast<int64_t>(hasher.digest() & kSafeBitmask);
 
-void SliceTracker::StackPush(TrackId track_id,
-                             tables::SliceTable::RowReference ref) {
-  stacks_[track_id].slice_stack.push_back(
-      SliceInfo{ref.ToRowNumber(), ArgsTracker(context_)});
+  stack.push_back(SliceInfo{ref.ToRowNumber(), ref.id(), ref.ts(), ref.dur(),
+                            category, name, stack_id, hasher, nullptr});
   if (on_slice_begin_callback_) {
     on_slice_begin_callback_(track_id, ref.id());
   }
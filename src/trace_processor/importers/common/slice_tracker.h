@@ -19,7 +19,10 @@
 
 #include <stdint.h>
 
+#include <memory>
+
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/slice_translation_table.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -118,9 +121,26 @@ class SliceTracker {
   // with this duration placeholder.
   static constexpr int64_t kPendingDuration = -1;
 
+  // The columns of the slice which are needed while it is on the stack are
+  // kept inline so that walking the stack doesn't read the slice table. The
+  // depth of the slice is its index in the stack.
   struct SliceInfo {
     tables::SliceTable::RowNumber row;
-    ArgsTracker args_tracker;
+    SliceId id;
+    int64_t ts;
+    // Kept in sync with the dur column: kPendingDuration until the slice ends.
+    int64_t dur;
+    StringId category;
+    StringId name;
+    int64_t stack_id;
+
+    // Hash of the category and name of this slice and of all its ancestors:
+    // the hash of a child slice extends the one of its parent.
+    base::Hasher stack_hasher;
+
+    // Only set once args are added to the slice. Taken from
+    // |free_args_trackers_| and returned there when the slice is popped.
+    std::unique_ptr<ArgsTracker> args_tracker;
   };
   using SlicesStack = std::vector<SliceInfo>;
 
@@ -152,16 +172,26 @@ class SliceTracker {
       SetArgsCallback args_callback,
       std::function<std::optional<uint32_t>(const SlicesStack&)> finder);
 
-  void MaybeCloseStack(int64_t end_ts, const SlicesStack&, TrackId track_id);
+  void MaybeCloseStack(int64_t end_ts, SlicesStack&);
 
   std::optional<uint32_t> MatchingIncompleteSliceIndex(const SlicesStack& stack,
                                                        StringId name,
                                                        StringId category);
 
-  int64_t GetStackHash(const SlicesStack&);
+  // Returns the stack of |track_id|, or nullptr if there is none. The stack
+  // of the last track looked up is cached: consecutive events are very often
+  // for the same track (e.g. the begin and end of a slice or the nested
+  // slices of a TrackEvent sequence).
+  TrackInfo* FindTrackInfo(TrackId track_id);
+  TrackInfo& GetOrCreateTrackInfo(TrackId track_id);
+
+  // Returns the ArgsTracker of |slice_info|, creating it if needed.
+  ArgsTracker& GetArgsTracker(SliceInfo& slice_info);
 
-  void StackPop(TrackId track_id);
-  void StackPush(TrackId track_id, tables::SliceTable::RowReference);
+  void StackPop(SlicesStack&);
+  void StackPush(TrackId track_id,
+                 SlicesStack&,
+                 tables::SliceTable::RowReference);
   void FlowTrackerUpdate(TrackId track_id);
 
   // If args need translation, adds them to a list of pending translatable args,
@@ -182,6 +212,15 @@ class SliceTracker {
   TraceProcessorContext* const context_;
   StackMap stacks_;
   std::vector<TranslatableArgs> translatable_args_;
+
+  // See FindTrackInfo(). Reset whenever |stacks_| is cleared: inserting in
+  // |stacks_| can move its values so the cache is always updated after that.
+  TrackId cached_track_id_{0};
+  TrackInfo* cached_track_info_ = nullptr;
+
+  // ArgsTrackers of popped slices, reused for the next slices with args to
+  // avoid constructing one for every slice.
+  std::vector<std::unique_ptr<ArgsTracker>> free_args_trackers_;
 };
 
 }  // namespace trace_processor
@@ -474,6 +474,56 @@ TEST_F(SliceTrackerTest, OnSliceBeginCallback) {
   EXPECT_THAT(slice_records, ElementsAre(slice1, slice2, slice3));
 }
 
+TEST_F(SliceTrackerTest, InterleavedTracksWithArgs) {
+  SliceTracker tracker(&context_);
+
+  auto add_arg = [](int64_t value) {
+    return [value](ArgsTracker::BoundInserter* inserter) {
+      inserter->AddArg(StringId::Raw(1), Variadic::Integer(value));
+    };
+  };
+
+  // The same stacks are built on both tracks, switching track at every event.
+  constexpr TrackId track1{1u};
+  constexpr TrackId track2{2u};
+  tracker.Begin(100, track1, StringId::Raw(11), StringId::Raw(21), add_arg(1));
+  tracker.Begin(110, track2, StringId::Raw(11), StringId::Raw(21), add_arg(2));
+  tracker.Begin(120, track1, StringId::Raw(12), StringId::Raw(22), add_arg(3));
+  tracker.Begin(130, track2, StringId::Raw(12), StringId::Raw(22), add_arg(4));
+  tracker.End(140, track1, StringId::Raw(12), StringId::Raw(22));
+  tracker.End(150, track2, StringId::Raw(12), StringId::Raw(22));
+
+  // Slices with args started after others ended get their own arg sets.
+  tracker.Begin(160, track1, StringId::Raw(12), StringId::Raw(22), add_arg(5));
+  tracker.End(170, track1, StringId::Raw(12), StringId::Raw(22));
+  tracker.End(180, track1, StringId::Raw(11), StringId::Raw(21));
+  tracker.FlushPendingSlices();
+
+  const auto& slices = context_.storage->slice_table();
+  EXPECT_THAT(ToSliceInfo(slices),
+              ElementsAre(SliceInfo{100, 80}, SliceInfo{110, -1},
+                          SliceInfo{120, 20}, SliceInfo{130, 20},
+                          SliceInfo{160, 10}));
+  EXPECT_EQ(slices.depth()[2], 1u);
+  EXPECT_EQ(slices.depth()[4], 1u);
+  EXPECT_EQ(slices.parent_id()[3], slices.id()[1]);
+  EXPECT_EQ(slices.parent_id()[4], slices.id()[0]);
+  EXPECT_EQ(slices.stack_id()[0], slices.stack_id()[1]);
+  EXPECT_EQ(slices.stack_id()[2], slices.stack_id()[3]);
+  EXPECT_EQ(slices.stack_id()[2], slices.stack_id()[4]);
+  EXPECT_NE(slices.stack_id()[0], slices.stack_id()[2]);
+  EXPECT_EQ(slices.parent_stack_id()[2], slices.stack_id()[0]);
+
+  const auto& args = context_.storage->arg_table();
+  for (uint32_t i = 0; i < slices.row_count(); ++i) {
+    std::optional<uint32_t> set_id = slices.arg_set_id()[i];
+    ASSERT_TRUE(set_id.has_value());
+    std::optional<uint32_t> row = args.arg_set_id().IndexOf(*set_id);
+    ASSERT_TRUE(row.has_value());
+    EXPECT_EQ(args.int_value()[*row], static_cast<int64_t>(i + 1));
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -18,16 +18,22 @@
 
 #include <cstdint>
 #include <optional>
+#include <vector>
 
+#include "perfetto/base/logging.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 
 namespace perfetto {
 namespace trace_processor {
-ThreadStateTracker::ThreadStateTracker(TraceProcessorContext* context)
+ThreadStateTracker::ThreadStateTracker(
+    TraceProcessorContext* context,
+    ThreadStateTracker* default_machine_tracker)
     : storage_(context->storage.get()),
       context_(context),
       running_string_id_(storage_->InternString("Running")),
-      runnable_string_id_(storage_->InternString("R")) {}
+      runnable_string_id_(storage_->InternString("R")),
+      batch_(default_machine_tracker ? default_machine_tracker->batch_
+                                     : &own_batch_) {}
 ThreadStateTracker::~ThreadStateTracker() = default;
 
 void ThreadStateTracker::PushSchedSwitchEvent(int64_t event_ts,
@@ -37,10 +43,8 @@ void ThreadStateTracker::PushSchedSwitchEvent(int64_t event_ts,
                                               UniqueTid next_utid) {
   // Code related to previous utid. If the thread wasn't running before we know
   // we lost data and should close the slice accordingly.
-  bool data_loss_cond =
-      HasPreviousRowNumbersForUtid(prev_utid) &&
-      !IsRunning(RowNumToRef(prev_row_numbers_for_thread_[prev_utid]->last_row)
-                     .state());
+  bool data_loss_cond = HasLastRow(prev_utid) &&
+                        !IsRunning(threads_[prev_utid].last_state);
   ClosePendingState(event_ts, prev_utid, data_loss_cond);
   AddOpenState(event_ts, prev_utid, prev_state);
 
@@ -61,19 +65,17 @@ void ThreadStateTracker::PushWakingEvent(int64_t event_ts,
                                          std::optional<uint16_t> common_flags) {
   // If thread has not had a sched switch event, just open a runnable state.
   // There's no pending state to close.
-  if (!HasPreviousRowNumbersForUtid(utid)) {
+  if (!HasLastRow(utid)) {
     AddOpenState(event_ts, utid, runnable_string_id_, std::nullopt, waker_utid,
                  common_flags);
     return;
   }
 
-  auto last_row_ref = RowNumToRef(prev_row_numbers_for_thread_[utid]->last_row);
-
   // Occasionally, it is possible to get a waking event for a thread
   // which is already in a runnable state. When this happens (or if the thread
   // is running), we just ignore the waking event. See b/186509316 for details
   // and an example on when this happens. Only blocked events can be waken up.
-  if (!IsBlocked(last_row_ref.state())) {
+  if (!IsBlocked(threads_[utid].last_state)) {
     // If we receive a waking event while we are not blocked, we ignore this
     // in the |thread_state| table but we track in the |sched_wakeup| table.
     // The |thread_state_id| in |sched_wakeup| is the current running/runnable
@@ -83,8 +85,7 @@ void ThreadStateTracker::PushWakingEvent(int64_t event_ts,
             ? std::make_optional(CommonFlagsToIrqContext(*common_flags))
             : std::nullopt;
     storage_->mutable_spurious_sched_wakeup_table()->Insert(
-        {event_ts, prev_row_numbers_for_thread_[utid]->last_row.row_number(),
-         irq_context, utid, waker_utid});
+        {event_ts, threads_[utid].last_row, irq_context, utid, waker_utid});
     return;
   }
 
@@ -105,24 +106,55 @@ void ThreadStateTracker::PushBlockedReason(
     std::optional<bool> io_wait,
     std::optional<StringId> blocked_function) {
   // Return if there is no state, as there is are no previous rows available.
-  if (!HasPreviousRowNumbersForUtid(utid))
+  if (!HasLastRow(utid))
     return;
 
   // Return if no previous bocked row exists.
-  auto blocked_row_number =
-      prev_row_numbers_for_thread_[utid]->last_blocked_row;
-  if (!blocked_row_number.has_value())
+  std::optional<uint32_t> blocked_row = threads_[utid].last_blocked_row;
+  if (!blocked_row.has_value())
     return;
 
-  auto row_reference = RowNumToRef(blocked_row_number.value());
+  tables::ThreadStateTable::Row* row = PendingRow(*blocked_row);
+  if (!row) {
+    batch_->blocked_reasons.push_back(
+        BlockedReason{*blocked_row, io_wait, blocked_function});
+    return;
+  }
   if (io_wait.has_value()) {
-    row_reference.set_io_wait(*io_wait);
+    row->io_wait = *io_wait;
   }
   if (blocked_function.has_value()) {
-    row_reference.set_blocked_function(*blocked_function);
+    row->blocked_function = *blocked_function;
   }
 }
 
+void ThreadStateTracker::Flush() {
+  FlushRows();
+
+  auto* table = storage_->mutable_thread_state_table();
+  for (const BlockedReason& reason : batch_->blocked_reasons) {
+    auto row_ref =
+        tables::ThreadStateTable::RowNumber(reason.row).ToRowReference(table);
+    if (reason.io_wait.has_value()) {
+      row_ref.set_io_wait(*reason.io_wait);
+    }
+    if (reason.blocked_function.has_value()) {
+      row_ref.set_blocked_function(*reason.blocked_function);
+    }
+  }
+  batch_->blocked_reasons.clear();
+}
+
+void ThreadStateTracker::FlushRows() {
+  if (batch_->rows.empty())
+    return;
+  auto* table = storage_->mutable_thread_state_table();
+  uint32_t table_rows = table->row_count();
+  uint32_t first_row = table->InsertBatch(batch_->rows).row_number();
+  PERFETTO_CHECK(first_row == table_rows);
+  batch_->rows.clear();
+}
+
 void ThreadStateTracker::AddOpenState(int64_t ts,
                                       UniqueTid utid,
                                       StringId state,
@@ -147,36 +179,36 @@ void ThreadStateTracker::AddOpenState(int64_t ts,
     row.irq_context = CommonFlagsToIrqContext(*common_flags);
   }
 
-  if (waker_utid.has_value() && HasPreviousRowNumbersForUtid(*waker_utid)) {
-    auto waker_row =
-        RowNumToRef(prev_row_numbers_for_thread_[*waker_utid]->last_row);
-
-    // We expect all wakers to be Running. But there are 2 cases where this
-    // might not be true:
-    // 1. At the start of a trace the 'waker CPU' has not yet started
-    // emitting events.
-    // 2. Data loss.
-    if (IsRunning(waker_row.state())) {
-      row.waker_id = std::make_optional(waker_row.id());
-    }
+  // We expect all wakers to be Running. But there are 2 cases where this
+  // might not be true:
+  // 1. At the start of a trace the 'waker CPU' has not yet started
+  // emitting events.
+  // 2. Data loss.
+  if (waker_utid.has_value() && HasLastRow(*waker_utid) &&
+      IsRunning(threads_[*waker_utid].last_state)) {
+    // The rows of the table are never removed so ids are row numbers.
+    row.waker_id = tables::ThreadStateTable::Id(threads_[*waker_utid].last_row);
   }
 
-  auto row_num = storage_->mutable_thread_state_table()->Insert(row).row_number;
+  auto row_num = storage_->thread_state_table().row_count() +
+                 static_cast<uint32_t>(batch_->rows.size());
+  batch_->rows.emplace_back(row);
 
-  if (utid >= prev_row_numbers_for_thread_.size()) {
-    prev_row_numbers_for_thread_.resize(utid + 1);
+  if (utid >= threads_.size()) {
+    threads_.resize(utid + 1);
   }
-
-  if (!prev_row_numbers_for_thread_[utid].has_value()) {
-    prev_row_numbers_for_thread_[utid] = RelatedRows{std::nullopt, row_num};
-  }
-
+  ThreadRows& thread = threads_[utid];
+  thread.last_row = row_num;
+  thread.last_ts = ts;
+  thread.last_state = state;
   if (IsRunning(state)) {
-    prev_row_numbers_for_thread_[utid] = RelatedRows{std::nullopt, row_num};
+    thread.last_blocked_row = std::nullopt;
   } else if (IsBlocked(state)) {
-    prev_row_numbers_for_thread_[utid] = RelatedRows{row_num, row_num};
-  } else /* if (IsRunnable(state)) */ {
-    prev_row_numbers_for_thread_[utid]->last_row = row_num;
+    thread.last_blocked_row = row_num;
+  }
+
+  if (batch_->rows.size() >= kBatchSize) {
+    FlushRows();
   }
 }
 
@@ -195,15 +227,21 @@ void ThreadStateTracker::ClosePendingState(int64_t end_ts,
                                            UniqueTid utid,
                                            bool data_loss) {
   // Discard close if there is no open state to close.
-  if (!HasPreviousRowNumbersForUtid(utid))
+  if (!HasLastRow(utid))
     return;
 
-  auto row_ref = RowNumToRef(prev_row_numbers_for_thread_[utid]->last_row);
-
   // Update the duration only for states without data loss.
-  if (!data_loss) {
-    row_ref.set_dur(end_ts - row_ref.ts());
+  if (data_loss)
+    return;
+  const ThreadRows& thread = threads_[utid];
+  int64_t dur = end_ts - thread.last_ts;
+  if (tables::ThreadStateTable::Row* row = PendingRow(thread.last_row)) {
+    row->dur = dur;
+    return;
   }
+  tables::ThreadStateTable::RowNumber(thread.last_row)
+      .ToRowReference(storage_->mutable_thread_state_table())
+      .set_dur(dur);
 }
 
 bool ThreadStateTracker::IsRunning(StringId state) {
@@ -17,6 +17,11 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_THREAD_STATE_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_COMMON_THREAD_STATE_TRACKER_H_
 
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/destructible.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -26,9 +31,19 @@ namespace trace_processor {
 
 // Responsible for filling the Thread State table by analysing sched switches,
 // waking events and blocking reasons.
+//
+// The last row of each thread, along with its start and state, is cached so
+// that no row has to be read back from the table. Rows are inserted in the
+// table in batches: until then, they are updated in place in the batch. The
+// blocked reasons of the rows already inserted are only applied by Flush().
 class ThreadStateTracker : public Destructible {
  public:
-  explicit ThreadStateTracker(TraceProcessorContext*);
+  // The rows of the trackers of all the machines must be inserted in timestamp
+  // order: the trackers of remote machines add their rows to the batch of
+  // |default_machine_tracker|.
+  explicit ThreadStateTracker(
+      TraceProcessorContext*,
+      ThreadStateTracker* default_machine_tracker = nullptr);
   ThreadStateTracker(const ThreadStateTracker&) = delete;
   ThreadStateTracker& operator=(const ThreadStateTracker&) = delete;
   ~ThreadStateTracker() override;
@@ -63,7 +78,39 @@ class ThreadStateTracker : public Destructible {
                          std::optional<bool> io_wait,
                          std::optional<StringId> blocked_function);
 
+  // Inserts the pending rows in the table and applies the blocked reasons of
+  // the rows inserted before. Must be called before the table is read.
+  void Flush();
+
  private:
+  // Number of rows inserted in the table at once.
+  static constexpr uint32_t kBatchSize = 4096;
+
+  static constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+
+  struct BlockedReason {
+    uint32_t row;
+    std::optional<bool> io_wait;
+    std::optional<StringId> blocked_function;
+  };
+
+  // The rows not inserted in the table yet. Their row numbers follow the last
+  // row of the table.
+  struct Batch {
+    std::vector<tables::ThreadStateTable::Row> rows;
+    std::vector<BlockedReason> blocked_reasons;
+  };
+
+  struct ThreadRows {
+    // The last row of the thread, with its start and state.
+    uint32_t last_row = kNoRow;
+    int64_t last_ts = 0;
+    StringId last_state = kNullStringId;
+
+    // The last blocked row of the thread, if it has not run since.
+    std::optional<uint32_t> last_blocked_row;
+  };
+
   void AddOpenState(int64_t ts,
                     UniqueTid utid,
                     StringId state,
@@ -72,20 +119,22 @@ class ThreadStateTracker : public Destructible {
                     std::optional<uint16_t> common_flags = std::nullopt);
   void ClosePendingState(int64_t end_ts, UniqueTid utid, bool data_loss);
 
+  // Returns the row |row| if it is still in the batch, nullptr otherwise.
+  tables::ThreadStateTable::Row* PendingRow(uint32_t row) {
+    uint32_t table_rows = storage_->thread_state_table().row_count();
+    return row >= table_rows ? &batch_->rows[row - table_rows] : nullptr;
+  }
+
+  void FlushRows();
+
   uint32_t CommonFlagsToIrqContext(uint32_t common_flags);
 
   bool IsRunning(StringId state);
   bool IsBlocked(StringId state);
   bool IsRunnable(StringId state);
 
-  bool HasPreviousRowNumbersForUtid(UniqueTid utid) {
-    return utid < prev_row_numbers_for_thread_.size() &&
-           prev_row_numbers_for_thread_[utid].has_value();
-  }
-
-  tables::ThreadStateTable::RowReference RowNumToRef(
-      tables::ThreadStateTable::RowNumber row_number) {
-    return row_number.ToRowReference(storage_->mutable_thread_state_table());
+  bool HasLastRow(UniqueTid utid) {
+    return utid < threads_.size() && threads_[utid].last_row != kNoRow;
   }
 
   TraceStorage* const storage_;
@@ -95,12 +144,11 @@ class ThreadStateTracker : public Destructible {
   StringId running_string_id_;
   StringId runnable_string_id_;
 
-  struct RelatedRows {
-    std::optional<tables::ThreadStateTable::RowNumber> last_blocked_row;
-    tables::ThreadStateTable::RowNumber last_row;
-  };
+  // Indexed by utid.
+  std::vector<ThreadRows> threads_;
 
-  std::vector<std::optional<RelatedRows>> prev_row_numbers_for_thread_;
+  Batch own_batch_;
+  Batch* const batch_;
 };
 }  // namespace trace_processor
 }  // namespace perfetto
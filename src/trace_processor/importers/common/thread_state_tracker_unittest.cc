@@ -53,8 +53,14 @@ class ThreadStateTrackerUnittest : public testing::Test {
     return context_.storage->InternString(s);
   }
 
+  // Flushes the rows of the tracker to the table.
+  const tables::ThreadStateTable& ThreadStateTable() {
+    tracker_->Flush();
+    return context_.storage->thread_state_table();
+  }
+
   tables::ThreadStateTable::ConstIterator ThreadStateIterator() {
-    return context_.storage->thread_state_table().FilterToIterator({});
+    return ThreadStateTable().FilterToIterator({});
   }
 
   void VerifyThreadState(
@@ -97,7 +103,7 @@ TEST_F(ThreadStateTrackerUnittest, BasicPushSchedSwitchEvent) {
   tracker_->PushSchedSwitchEvent(10, CPU_A, THREAD_A, StringIdOf("S"),
                                  THREAD_B);
 
-  ASSERT_EQ(context_.storage->thread_state_table().row_count(), 2ul);
+  ASSERT_EQ(ThreadStateTable().row_count(), 2ul);
   auto rows_it = ThreadStateIterator();
   VerifyThreadState(rows_it, 10, std::nullopt, THREAD_A, "S");
   VerifyThreadState(++rows_it, 10, std::nullopt, THREAD_B, kRunning);
@@ -105,7 +111,7 @@ TEST_F(ThreadStateTrackerUnittest, BasicPushSchedSwitchEvent) {
 
 TEST_F(ThreadStateTrackerUnittest, StartWithWakingEvent) {
   tracker_->PushWakingEvent(10, THREAD_A, THREAD_C);
-  ASSERT_EQ(context_.storage->thread_state_table().row_count(), 1ul);
+  ASSERT_EQ(ThreadStateTable().row_count(), 1ul);
 }
 
 TEST_F(ThreadStateTrackerUnittest, BasicWakingEvent) {
@@ -113,7 +119,7 @@ TEST_F(ThreadStateTrackerUnittest, BasicWakingEvent) {
                                  THREAD_B);
   tracker_->PushWakingEvent(20, THREAD_A, THREAD_C);
 
-  ASSERT_EQ(context_.storage->thread_state_table().row_count(), 3ul);
+  ASSERT_EQ(ThreadStateTable().row_count(), 3ul);
   auto row_it = ThreadStateIterator();
   VerifyThreadState(row_it, 10, 20, THREAD_A, "S");
   VerifyThreadState(++row_it, 10, std::nullopt, THREAD_B, kRunning);
@@ -221,6 +227,39 @@ TEST_F(ThreadStateTrackerUnittest, RunningOnMultipleCPUsForcedMigration) {
                     std::nullopt, std::nullopt, std::nullopt, CPU_B);
 }
 
+TEST_F(ThreadStateTrackerUnittest, ManyBatches) {
+  // Keep THREAD_A blocked while THREAD_B and THREAD_C switch enough times for
+  // the blocked row to be inserted in the table before its blocked reason is
+  // known.
+  tracker_->PushSchedSwitchEvent(1, CPU_A, THREAD_A, StringIdOf("D"),
+                                 THREAD_B);
+  for (int64_t ts = 2; ts < 10000; ts += 2) {
+    tracker_->PushSchedSwitchEvent(ts, CPU_A, THREAD_B, StringIdOf(kRunnable),
+                                   THREAD_C);
+    tracker_->PushSchedSwitchEvent(ts + 1, CPU_A, THREAD_C,
+                                   StringIdOf(kRunnable), THREAD_B);
+  }
+  ASSERT_GT(context_.storage->thread_state_table().row_count(), 0u);
+  tracker_->PushBlockedReason(THREAD_A, true, StringIdOf(kBlockedFunction));
+  tracker_->PushWakingEvent(10000, THREAD_A, THREAD_B);
+
+  uint32_t row_count = ThreadStateTable().row_count();
+  ASSERT_EQ(row_count, 2u + 4u * 4999u + 1u);
+  auto rows_it = ThreadStateIterator();
+  VerifyThreadState(rows_it, 1, 10000, THREAD_A, "D", true,
+                    StringIdOf(kBlockedFunction));
+  VerifyThreadState(++rows_it, 1, 2, THREAD_B, kRunning);
+  VerifyThreadState(++rows_it, 2, 3, THREAD_B, kRunnable);
+  VerifyThreadState(++rows_it, 2, 3, THREAD_C, kRunning);
+  for (uint32_t i = 4; i < row_count; ++i) {
+    ++rows_it;
+  }
+  VerifyThreadState(rows_it, 10000, std::nullopt, THREAD_A, kRunnable,
+                    std::nullopt, std::nullopt, THREAD_B);
+  ASSERT_EQ(rows_it.waker_id(),
+            tables::ThreadStateTable::Id(row_count - 2));
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
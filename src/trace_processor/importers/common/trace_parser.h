@@ -29,6 +29,8 @@ struct InlineSchedSwitch;
 class FuchsiaRecord;
 struct SystraceLine;
 struct InlineSchedWaking;
+struct InlineEtwCSwitch;
+struct InlineEtwReadyThread;
 struct TracePacketData;
 struct TrackEventData;
 
@@ -41,6 +43,10 @@ class ProtoTraceParser {
   virtual void ParseFtraceEvent(uint32_t, int64_t, TracePacketData) = 0;
   virtual void ParseInlineSchedSwitch(uint32_t, int64_t, InlineSchedSwitch) = 0;
   virtual void ParseInlineSchedWaking(uint32_t, int64_t, InlineSchedWaking) = 0;
+  virtual void ParseInlineEtwCSwitch(uint32_t, int64_t, InlineEtwCSwitch) = 0;
+  virtual void ParseInlineEtwReadyThread(uint32_t,
+                                         int64_t,
+                                         InlineEtwReadyThread) = 0;
 };
 
 class JsonTraceParser {
@@ -25,5 +25,13 @@ void EtwModule::ParseEtwEventData(uint32_t /*cpu*/,
                                   int64_t /*ts*/,
                                   const TracePacketData&) {}
 
+void EtwModule::ParseInlineCSwitch(uint32_t /*cpu*/,
+                                   int64_t /*ts*/,
+                                   const InlineEtwCSwitch&) {}
+
+void EtwModule::ParseInlineReadyThread(uint32_t /*cpu*/,
+                                       int64_t /*ts*/,
+                                       const InlineEtwReadyThread&) {}
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -28,6 +28,12 @@ class EtwModule : public ProtoImporterModule {
   virtual void ParseEtwEventData(uint32_t cpu,
                                  int64_t ts,
                                  const TracePacketData& data);
+  virtual void ParseInlineCSwitch(uint32_t cpu,
+                                  int64_t ts,
+                                  const InlineEtwCSwitch& data);
+  virtual void ParseInlineReadyThread(uint32_t cpu,
+                                      int64_t ts,
+                                      const InlineEtwReadyThread& data);
 };
 
 }  // namespace trace_processor
@@ -51,6 +51,18 @@ class EtwModuleImpl : public EtwModule {
     }
   }
 
+  void ParseInlineCSwitch(uint32_t cpu,
+                          int64_t ts,
+                          const InlineEtwCSwitch& data) override {
+    parser_.ParseInlineCSwitch(cpu, ts, data);
+  }
+
+  void ParseInlineReadyThread(uint32_t,
+                              int64_t ts,
+                              const InlineEtwReadyThread& data) override {
+    parser_.ParseInlineReadyThread(ts, data);
+  }
+
  private:
   EtwTokenizer tokenizer_;
   EtwParser parser_;
@@ -16,6 +16,11 @@
 
 #include "src/trace_processor/importers/etw/etw_parser.h"
 
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <tuple>
+
 #include "perfetto/ext/base/string_view.h"
 #include "src/trace_processor/importers/common/parser_types.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
@@ -33,8 +38,27 @@ namespace {
 
 using protozero::ConstBytes;
 
+// Descriptions of the ETW thread states, indexed by state.
+constexpr const char* kThreadStateNames[] = {
+    "Initialized",     // INITIALIZED
+    "R",               // READY
+    "Running",         // RUNNING
+    "Stand By",        // STANDBY
+    "T",               // TERMINATED
+    "Waiting",         // WAITING
+    "Transition",      // TRANSITION
+    "Deferred Ready",  // DEFERRED_READY
+};
+
 }  // namespace
-EtwParser::EtwParser(TraceProcessorContext* context) : context_(context) {}
+
+EtwParser::EtwParser(TraceProcessorContext* context) : context_(context) {
+  static_assert(std::size(kThreadStateNames) ==
+                std::tuple_size<decltype(thread_state_ids_)>::value);
+  for (size_t i = 0; i < thread_state_ids_.size(); ++i) {
+    thread_state_ids_[i] = context_->storage->InternString(kThreadStateNames[i]);
+  }
+}
 
 util::Status EtwParser::ParseEtwEvent(uint32_t cpu,
                                       int64_t ts,
@@ -62,8 +86,23 @@ void EtwParser::ParseCswitch(int64_t timestamp, uint32_t cpu, ConstBytes blob) {
 
 void EtwParser::ParseReadyThread(int64_t timestamp, ConstBytes blob) {
   protos::pbzero::ReadyThreadEtwEvent::Decoder rt(blob.data, blob.size);
-  UniqueTid utid =
-      context_->process_tracker->GetOrCreateThread(rt.t_thread_id());
+  PushReadyThread(timestamp, rt.t_thread_id());
+}
+
+void EtwParser::ParseInlineCSwitch(uint32_t cpu,
+                                   int64_t timestamp,
+                                   const InlineEtwCSwitch& data) {
+  PushSchedSwitch(cpu, timestamp, data.old_thread_id, data.old_thread_state,
+                  data.new_thread_id, data.new_thread_priority);
+}
+
+void EtwParser::ParseInlineReadyThread(int64_t timestamp,
+                                       const InlineEtwReadyThread& data) {
+  PushReadyThread(timestamp, data.t_thread_id);
+}
+
+void EtwParser::PushReadyThread(int64_t timestamp, uint32_t tid) {
+  UniqueTid utid = context_->process_tracker->GetOrCreateThread(tid);
   ThreadStateTracker::GetOrCreate(context_)->PushWakingEvent(timestamp, utid,
                                                              utid);
 }
@@ -119,21 +158,8 @@ void EtwParser::PushSchedSwitch(uint32_t cpu,
 
 StringId EtwParser::TaskStateToStringId(int64_t task_state_int) {
   const auto state = static_cast<uint8_t>(task_state_int);
-  // Mapping for the different Etw states with their string description.
-  std::map<uint8_t, base::StringView> etw_states_map = {
-      {0x00, "Initialized"},     // INITIALIZED
-      {0x01, "R"},               // READY
-      {0x02, "Running"},         // RUNNING
-      {0x03, "Stand By"},        // STANDBY
-      {0x04, "T"},               // TERMINATED
-      {0x05, "Waiting"},         // WAITING
-      {0x06, "Transition"},      // TRANSITION
-      {0x07, "Deferred Ready"},  // DEFERRED_READY
-  };
-
-  return etw_states_map.find(state) != etw_states_map.end()
-             ? context_->storage->InternString(etw_states_map[state])
-             : kNullStringId;
+  return state < thread_state_ids_.size() ? thread_state_ids_[state]
+                                          : kNullStringId;
 }
 
 }  // namespace trace_processor
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_ETW_ETW_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_ETW_ETW_PARSER_H_
 
+#include <array>
+
 #include "perfetto/protozero/field.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/importers/common/parser_types.h"
@@ -34,6 +36,14 @@ class EtwParser {
                              int64_t ts,
                              const TracePacketData& data);
 
+  // Parse the compact forms of CSwitch and ReadyThread events produced by
+  // EtwTokenizer.
+  void ParseInlineCSwitch(uint32_t cpu,
+                          int64_t timestamp,
+                          const InlineEtwCSwitch& data);
+  void ParseInlineReadyThread(int64_t timestamp,
+                              const InlineEtwReadyThread& data);
+
  private:
   void ParseCswitch(int64_t timestamp, uint32_t cpu, protozero::ConstBytes);
   void ParseReadyThread(int64_t timestamp, protozero::ConstBytes);
@@ -43,10 +53,14 @@ class EtwParser {
                        int64_t prev_state,
                        uint32_t next_pid,
                        int32_t next_prio);
+  void PushReadyThread(int64_t timestamp, uint32_t tid);
   StringId TaskStateToStringId(int64_t task_state_int);
 
   TraceProcessorContext* context_;
 
+  // Interned names of the ETW thread states, indexed by state.
+  std::array<StringId, 8> thread_state_ids_;
+
   SchedEventState sched_event_state_;
 };
 
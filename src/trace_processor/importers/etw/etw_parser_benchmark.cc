@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "perfetto/trace_processor/trace_processor.h"
+
+#include "protos/perfetto/trace/etw/etw.pbzero.h"
+#include "protos/perfetto/trace/etw/etw_event.pbzero.h"
+#include "protos/perfetto/trace/etw/etw_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace {
+
+using benchmark::Counter;
+using perfetto::trace_processor::Config;
+using perfetto::trace_processor::TraceBlob;
+using perfetto::trace_processor::TraceBlobView;
+using perfetto::trace_processor::TraceProcessor;
+
+bool IsBenchmarkFunctionalOnly() {
+  return getenv("BENCHMARK_FUNCTIONAL_TEST_ONLY") != nullptr;
+}
+
+// Generates a trace shaped like the kernel events of a Windows desktop trace:
+// each CSwitch is preceded by a ReadyThread of the thread being switched in,
+// with bundles of 64 events per CPU.
+std::vector<uint8_t> GenerateEtwTrace(uint32_t event_count) {
+  using perfetto::protos::pbzero::CSwitchEtwEvent;
+  constexpr uint32_t kCpuCount = 8;
+  constexpr uint32_t kThreadCount = 200;
+  constexpr uint32_t kEventsPerBundle = 64;
+
+  protozero::HeapBuffered<perfetto::protos::pbzero::Trace> trace;
+  std::vector<uint32_t> running_tid(kCpuCount, 0);
+  uint64_t ts = 1000000;
+  for (uint32_t i = 0; i < event_count; i += kEventsPerBundle * kCpuCount) {
+    for (uint32_t cpu = 0; cpu < kCpuCount; ++cpu) {
+      auto* packet = trace->add_packet();
+      packet->set_trusted_packet_sequence_id(1);
+      auto* bundle = packet->set_etw_events();
+      bundle->set_cpu(cpu);
+      for (uint32_t j = 0; j < kEventsPerBundle; j += 2) {
+        uint32_t next_tid = 1 + (i + j * 7 + cpu * 31) % kThreadCount;
+
+        auto* ready = bundle->add_event();
+        ready->set_timestamp(ts + j * 1000);
+        ready->set_ready_thread()->set_t_thread_id(next_tid);
+
+        auto* event = bundle->add_event();
+        event->set_timestamp(ts + j * 1000 + 500);
+        auto* cs = event->set_c_switch();
+        cs->set_old_thread_id(running_tid[cpu]);
+        cs->set_old_thread_state(j % 3 ? CSwitchEtwEvent::WAITING
+                                       : CSwitchEtwEvent::READY);
+        cs->set_new_thread_id(next_tid);
+        cs->set_new_thread_priority(8);
+        running_tid[cpu] = next_tid;
+      }
+    }
+    ts += kEventsPerBundle * 1000;
+  }
+  return trace.SerializeAsArray();
+}
+
+// Returns the trace to load: the one pointed by PERFETTO_ETW_BENCHMARK_TRACE
+// (e.g. a trace converted from a real ETL file) if set, a synthetic one
+// otherwise.
+std::vector<uint8_t> LoadTrace() {
+  const char* path = getenv("PERFETTO_ETW_BENCHMARK_TRACE");
+  if (!path)
+    return GenerateEtwTrace(IsBenchmarkFunctionalOnly() ? 1 << 12 : 1 << 20);
+  std::string contents;
+  PERFETTO_CHECK(perfetto::base::ReadFile(path, &contents));
+  return std::vector<uint8_t>(contents.begin(), contents.end());
+}
+
+void BM_EtwImport(benchmark::State& state) {
+  std::vector<uint8_t> trace = LoadTrace();
+  for (auto _ : state) {
+    std::unique_ptr<TraceProcessor> tp =
+        TraceProcessor::CreateInstance(Config());
+    TraceBlob blob = TraceBlob::CopyFrom(trace.data(), trace.size());
+    PERFETTO_CHECK(tp->Parse(TraceBlobView(std::move(blob))).ok());
+    tp->NotifyEndOfFile();
+    benchmark::ClobberMemory();
+  }
+  state.counters["bytes/s"] = Counter(static_cast<double>(trace.size()),
+                                      Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_EtwImport)->Unit(benchmark::kMillisecond);
+
+}  // namespace
@@ -22,18 +22,19 @@
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "src/trace_processor/importers/common/parser_types.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
 #include "src/trace_processor/sorter/trace_sorter.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
 #include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/etw/etw.pbzero.h"
 #include "protos/perfetto/trace/etw/etw_event.pbzero.h"
 #include "protos/perfetto/trace/etw/etw_event_bundle.pbzero.h"
 
 namespace perfetto {
 namespace trace_processor {
 
-using protozero::ProtoDecoder;
 using protozero::proto_utils::MakeTagVarInt;
 using protozero::proto_utils::ParseVarInt;
 
@@ -65,8 +66,6 @@ base::Status EtwTokenizer::TokenizeEtwEvent(
     RefPtr<PacketSequenceStateGeneration> state) {
   const uint8_t* data = event.data();
   const size_t length = event.length();
-  ProtoDecoder decoder(data, length);
-
   protos::pbzero::EtwTraceEvent::Decoder etw_decoder(data, length);
   // Some ETW events lack CPU info; in that case, the bundle may
   // provide it.
@@ -104,6 +103,30 @@ base::Status EtwTokenizer::TokenizeEtwEvent(
     return timestamp.status();
   }
 
+  // CSwitch and ReadyThread make up the bulk of ETW kernel traces: decode them
+  // here into their compact form (like the ftrace compact sched events) so
+  // that neither the event bytes nor the sequence state need to be retained
+  // until the event is sorted and parsed.
+  if (etw_decoder.has_c_switch()) {
+    protozero::ConstBytes blob = etw_decoder.c_switch();
+    protos::pbzero::CSwitchEtwEvent::Decoder cs(blob.data, blob.size);
+    InlineEtwCSwitch c_switch{};
+    c_switch.old_thread_state = cs.old_thread_state();
+    c_switch.old_thread_id = cs.old_thread_id();
+    c_switch.new_thread_id = cs.new_thread_id();
+    c_switch.new_thread_priority = cs.new_thread_priority();
+    context_->sorter->PushInlineEtwEvent(cpu, *timestamp, c_switch);
+    return base::OkStatus();
+  }
+  if (etw_decoder.has_ready_thread()) {
+    protozero::ConstBytes blob = etw_decoder.ready_thread();
+    protos::pbzero::ReadyThreadEtwEvent::Decoder rt(blob.data, blob.size);
+    InlineEtwReadyThread ready_thread{};
+    ready_thread.t_thread_id = rt.t_thread_id();
+    context_->sorter->PushInlineEtwEvent(cpu, *timestamp, ready_thread);
+    return base::OkStatus();
+  }
+
   context_->sorter->PushEtwEvent(cpu, *timestamp, std::move(event),
                                  std::move(state));
 
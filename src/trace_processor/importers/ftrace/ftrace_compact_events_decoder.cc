@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_compact_events_decoder.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/proto_decoder.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using CompactEvents = protos::pbzero::FtraceEventBundle::CompactEvents;
+using VarIntIterator = protozero::PackedRepeatedFieldIterator<
+    protozero::proto_utils::ProtoWireType::kVarInt,
+    uint64_t>;
+
+struct FieldColumn {
+  uint32_t proto_field_id;
+  VarIntIterator value;
+};
+
+}  // namespace
+
+base::Status DecodeFtraceCompactEvents(protozero::ConstBytes compact_events,
+                                       protos::pbzero::FtraceEventBundle* out) {
+  CompactEvents::Decoder decoder(compact_events);
+  if (!decoder.has_proto_field_id())
+    return base::ErrStatus("Compact ftrace events without an event type");
+  const uint32_t proto_field_id = decoder.proto_field_id();
+
+  // The events' fields are stored in a structure-of-arrays style, using packed
+  // repeated fields. Walk each repeated field in step to recover individual
+  // events.
+  bool parse_error = false;
+  auto timestamp_it = decoder.timestamp(&parse_error);
+  auto pid_it = decoder.pid(&parse_error);
+  const bool has_pid = decoder.has_pid();
+  std::vector<FieldColumn> fields;
+  for (auto it = decoder.field(); it; ++it) {
+    CompactEvents::Field::Decoder field(*it);
+    fields.push_back({field.proto_field_id(), field.value(&parse_error)});
+  }
+
+  // Accumulator for timestamp deltas.
+  uint64_t timestamp = 0;
+  bool sizes_match = true;
+  for (; timestamp_it; ++timestamp_it) {
+    sizes_match = !has_pid || pid_it;
+    for (const FieldColumn& field : fields)
+      sizes_match &= static_cast<bool>(field.value);
+    if (!sizes_match)
+      break;
+
+    timestamp += *timestamp_it;
+    protos::pbzero::FtraceEvent* event = out->add_event();
+    event->set_timestamp(timestamp);
+    if (has_pid) {
+      // Same varint as FtraceEvent.pid, see CpuReader::ParseEventCompact().
+      event->AppendVarInt(protos::pbzero::FtraceEvent::kPidFieldNumber,
+                          *pid_it);
+      ++pid_it;
+    }
+    protozero::Message* nested =
+        event->BeginNestedMessage<protozero::Message>(proto_field_id);
+    for (FieldColumn& field : fields) {
+      nested->AppendVarInt(field.proto_field_id, *field.value);
+      ++field.value;
+    }
+  }
+
+  // Check that all packed buffers were decoded correctly, and fully.
+  sizes_match &= !pid_it;
+  for (const FieldColumn& field : fields)
+    sizes_match &= !field.value;
+  if (parse_error || !sizes_match) {
+    return base::ErrStatus("Malformed compact ftrace events (event id %u)",
+                           proto_field_id);
+  }
+  return base::OkStatus();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_COMPACT_EVENTS_DECODER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_COMPACT_EVENTS_DECODER_H_
+
+#include "perfetto/base/status.h"
+#include "perfetto/protozero/field.h"
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+namespace trace_processor {
+
+// Decodes a FtraceEventBundle.CompactEvents message, written by traced_probes
+// when FtraceConfig.CompactSchedConfig.fixed_width_events is set, back into
+// the FtraceEvent protos that it replaces, appending them to |out|. The
+// decoded events are the same as the ones traced_probes writes without the
+// compact encoding, so they go through the regular tokenization and parsing.
+// Returns an error if the message is malformed (e.g. its columns have
+// different sizes), in which case the events that could be decoded have
+// already been appended.
+base::Status DecodeFtraceCompactEvents(protozero::ConstBytes compact_events,
+                                       protos::pbzero::FtraceEventBundle* out);
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_COMPACT_EVENTS_DECODER_H_
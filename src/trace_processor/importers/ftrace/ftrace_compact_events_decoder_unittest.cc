@@ -0,0 +1,138 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_compact_events_decoder.h"
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "perfetto/protozero/message.h"
+#include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/irq.gen.h"
+#include "protos/perfetto/trace/ftrace/irq.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using CompactEvents = protos::pbzero::FtraceEventBundle::CompactEvents;
+using protos::pbzero::IrqHandlerExitFtraceEvent;
+
+// Sets the packed repeated field |field_id| of |msg| to |values|.
+void SetColumn(protozero::Message* msg,
+               uint32_t field_id,
+               const std::vector<int64_t>& values) {
+  protozero::PackedVarInt column;
+  for (int64_t value : values)
+    column.Append(value);
+  msg->AppendBytes(field_id, column.data(), column.size());
+}
+
+// Two irq_handler_exit events, with a negative |ret|.
+std::vector<uint8_t> MakeCompactEvents(bool with_pid) {
+  protozero::HeapBuffered<CompactEvents> compact;
+  compact->set_proto_field_id(
+      protos::pbzero::FtraceEvent::kIrqHandlerExitFieldNumber);
+  SetColumn(compact.get(), CompactEvents::kTimestampFieldNumber, {1000, 10});
+  if (with_pid)
+    SetColumn(compact.get(), CompactEvents::kPidFieldNumber, {42, 43});
+  auto* irq = compact->add_field();
+  irq->set_proto_field_id(IrqHandlerExitFtraceEvent::kIrqFieldNumber);
+  SetColumn(irq, CompactEvents::Field::kValueFieldNumber, {7, 8});
+  auto* ret = compact->add_field();
+  ret->set_proto_field_id(IrqHandlerExitFtraceEvent::kRetFieldNumber);
+  SetColumn(ret, CompactEvents::Field::kValueFieldNumber, {1, -1});
+  return compact.SerializeAsArray();
+}
+
+protos::gen::FtraceEventBundle Decode(const std::vector<uint8_t>& compact,
+                                      base::Status* status) {
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle> out;
+  *status = DecodeFtraceCompactEvents(
+      protozero::ConstBytes{compact.data(), compact.size()}, out.get());
+  protos::gen::FtraceEventBundle bundle;
+  bundle.ParseFromString(out.SerializeAsString());
+  return bundle;
+}
+
+TEST(FtraceCompactEventsDecoderTest, DecodesEvents) {
+  base::Status status;
+  auto bundle = Decode(MakeCompactEvents(/*with_pid=*/true), &status);
+  ASSERT_TRUE(status.ok()) << status.message();
+  ASSERT_EQ(bundle.event().size(), 2u);
+
+  const auto& first = bundle.event()[0];
+  EXPECT_EQ(first.timestamp(), 1000u);
+  EXPECT_EQ(first.pid(), 42u);
+  ASSERT_TRUE(first.has_irq_handler_exit());
+  EXPECT_EQ(first.irq_handler_exit().irq(), 7);
+  EXPECT_EQ(first.irq_handler_exit().ret(), 1);
+
+  const auto& second = bundle.event()[1];
+  EXPECT_EQ(second.timestamp(), 1010u);
+  EXPECT_EQ(second.pid(), 43u);
+  ASSERT_TRUE(second.has_irq_handler_exit());
+  EXPECT_EQ(second.irq_handler_exit().irq(), 8);
+  EXPECT_EQ(second.irq_handler_exit().ret(), -1);
+}
+
+TEST(FtraceCompactEventsDecoderTest, WithoutPid) {
+  base::Status status;
+  auto bundle = Decode(MakeCompactEvents(/*with_pid=*/false), &status);
+  ASSERT_TRUE(status.ok()) << status.message();
+  ASSERT_EQ(bundle.event().size(), 2u);
+  EXPECT_FALSE(bundle.event()[0].has_pid());
+  EXPECT_EQ(bundle.event()[1].irq_handler_exit().ret(), -1);
+}
+
+TEST(FtraceCompactEventsDecoderTest, MismatchedColumns) {
+  protozero::HeapBuffered<CompactEvents> compact;
+  compact->set_proto_field_id(
+      protos::pbzero::FtraceEvent::kIrqHandlerExitFieldNumber);
+  SetColumn(compact.get(), CompactEvents::kTimestampFieldNumber,
+            {1000, 10, 10});
+  auto* irq = compact->add_field();
+  irq->set_proto_field_id(IrqHandlerExitFtraceEvent::kIrqFieldNumber);
+  SetColumn(irq, CompactEvents::Field::kValueFieldNumber, {7, 8});
+
+  // The events that have all their fields are decoded.
+  base::Status status;
+  auto bundle = Decode(compact.SerializeAsArray(), &status);
+  EXPECT_FALSE(status.ok());
+  ASSERT_EQ(bundle.event().size(), 2u);
+  EXPECT_EQ(bundle.event()[1].irq_handler_exit().irq(), 8);
+}
+
+TEST(FtraceCompactEventsDecoderTest, MissingEventType) {
+  protozero::HeapBuffered<CompactEvents> compact;
+  SetColumn(compact.get(), CompactEvents::kTimestampFieldNumber, {1000});
+  base::Status status;
+  auto bundle = Decode(compact.SerializeAsArray(), &status);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(bundle.event().size(), 0u);
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
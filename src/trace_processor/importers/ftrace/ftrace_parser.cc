@@ -24,6 +24,7 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/async_track_set_tracker.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/importers/common/parser_types.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
@@ -108,9 +109,8 @@ struct FtraceEventAndFieldId {
 // Contains a list of all the proto fields in ftrace events which represent
 // kernel functions. This list is used to convert the iids in these fields to
 // proper kernel symbols.
-// TODO(lalitm): going through this array is O(n) on a hot-path (see
-// ParseTypedFtraceToRaw). Consider changing this if we end up adding a lot of
-// events here.
+// This list is only used to precompute the per-event |kernel_function_fields|
+// bitset as going through it is O(n) on a hot-path (see ParseTypedFtraceToRaw).
 constexpr auto kKernelFunctionFields = std::array<FtraceEventAndFieldId, 6>{
     FtraceEventAndFieldId{
         protos::pbzero::FtraceEvent::kSchedBlockedReasonFieldNumber,
@@ -371,6 +371,21 @@ FtraceParser::FtraceParser(TraceProcessorContext* context)
     }
     ftrace_message_strings_.emplace_back(ftrace_strings);
   }
+  for (const FtraceEventAndFieldId& ev : kKernelFunctionFields) {
+    PERFETTO_CHECK(ev.event_id < ftrace_message_strings_.size());
+    PERFETTO_CHECK(ev.field_id < kMaxFtraceEventFields);
+    ftrace_message_strings_[ev.event_id].kernel_function_fields.set(
+        ev.field_id);
+  }
+
+  // Remote machines have their own context which does not outlive the
+  // parsing of the trace, so their args are always decoded right away.
+  if (context->config.ingest_ftrace_in_raw_table &&
+      context->config.lazy_ftrace_raw_args && !context->machine_id()) {
+    context->lazy_ftrace_raw_args.reset(
+        new LazyFtraceRawArgs(context, ftrace_message_strings_));
+    lazy_raw_args_ = LazyFtraceRawArgs::Get(context);
+  }
 
   // Array initialization causes a spurious warning due to llvm bug.
   // See https://bugs.llvm.org/show_bug.cgi?id=21629
@@ -659,7 +674,8 @@ base::Status FtraceParser::ParseFtraceEvent(uint32_t cpu,
       ParseGenericFtrace(ts, cpu, pid, fld_bytes);
     } else if (fld.id() != FtraceEvent::kSchedSwitchFieldNumber) {
       // sched_switch parsing populates the raw table by itself
-      ParseTypedFtraceToRaw(fld.id(), ts, cpu, pid, fld_bytes, seq_state);
+      ParseTypedFtraceToRaw(fld.id(), ts, cpu, pid, event, fld_bytes,
+                            seq_state);
     }
 
     // Skip everything besides the |raw| write if we're at the start of the
@@ -1273,6 +1289,9 @@ void FtraceParser::ParseGenericFtrace(int64_t ts,
                                       uint32_t cpu,
                                       uint32_t tid,
                                       ConstBytes blob) {
+  if (MemoryBudget::ShouldDropRawEvent(context_->memory_budget.get()))
+    return;
+
   protos::pbzero::GenericFtraceEvent::Decoder evt(blob.data, blob.size);
   StringId event_id = context_->storage->InternString(evt.event_name());
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(tid);
@@ -1303,19 +1322,20 @@ void FtraceParser::ParseTypedFtraceToRaw(
     int64_t timestamp,
     uint32_t cpu,
     uint32_t tid,
+    const TraceBlobView& event,
     ConstBytes blob,
     PacketSequenceStateGeneration* seq_state) {
-  if (PERFETTO_UNLIKELY(!context_->config.ingest_ftrace_in_raw_table))
+  if (PERFETTO_UNLIKELY(!context_->config.ingest_ftrace_in_raw_table) ||
+      MemoryBudget::ShouldDropRawEvent(context_->memory_budget.get())) {
     return;
+  }
 
-  ProtoDecoder decoder(blob.data, blob.size);
   if (ftrace_id >= GetDescriptorsSize()) {
     PERFETTO_DLOG("Event with id: %d does not exist and cannot be parsed.",
                   ftrace_id);
     return;
   }
 
-  FtraceMessageDescriptor* m = GetMessageDescriptorForId(ftrace_id);
   const auto& message_strings = ftrace_message_strings_[ftrace_id];
   UniqueTid utid = context_->process_tracker->GetOrCreateThread(tid);
   RawId id = context_->storage->mutable_ftrace_event_table()
@@ -1327,93 +1347,16 @@ void FtraceParser::ParseTypedFtraceToRaw(
                            {},
                            context_->machine_id()})
                  .id;
-  auto inserter = context_->args_tracker->AddArgsTo(id);
-
-  for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
-    uint32_t field_id = fld.id();
-    if (PERFETTO_UNLIKELY(field_id >= kMaxFtraceEventFields)) {
-      PERFETTO_DLOG(
-          "Skipping ftrace arg - proto field id is too large (%" PRIu32 ")",
-          field_id);
-      continue;
-    }
-
-    ProtoSchemaType type = m->fields[field_id].type;
-    StringId name_id = message_strings.field_name_ids[field_id];
-
-    // Check if this field represents a kernel function.
-    const auto it = std::find_if(
-        kKernelFunctionFields.begin(), kKernelFunctionFields.end(),
-        [ftrace_id, field_id](const FtraceEventAndFieldId& ev) {
-          return ev.event_id == ftrace_id && ev.field_id == field_id;
-        });
-    if (it != kKernelFunctionFields.end()) {
-      PERFETTO_CHECK(type == ProtoSchemaType::kUint64);
-
-      auto* interned_string = seq_state->LookupInternedMessage<
-          protos::pbzero::InternedData::kKernelSymbolsFieldNumber,
-          protos::pbzero::InternedString>(fld.as_uint64());
-
-      // If we don't have the string for this field (can happen if
-      // symbolization wasn't enabled, if reading the symbols errored out or
-      // on legacy traces) then just add the field as a normal arg.
-      if (interned_string) {
-        protozero::ConstBytes str = interned_string->str();
-        StringId str_id = context_->storage->InternString(base::StringView(
-            reinterpret_cast<const char*>(str.data), str.size));
-        inserter.AddArg(name_id, Variadic::String(str_id));
-        continue;
-      }
-    }
 
-    switch (type) {
-      case ProtoSchemaType::kInt32:
-      case ProtoSchemaType::kInt64:
-      case ProtoSchemaType::kSfixed32:
-      case ProtoSchemaType::kSfixed64:
-      case ProtoSchemaType::kBool:
-      case ProtoSchemaType::kEnum: {
-        inserter.AddArg(name_id, Variadic::Integer(fld.as_int64()));
-        break;
-      }
-      case ProtoSchemaType::kUint32:
-      case ProtoSchemaType::kUint64:
-      case ProtoSchemaType::kFixed32:
-      case ProtoSchemaType::kFixed64: {
-        // Note that SQLite functions will still treat unsigned values
-        // as a signed 64 bit integers (but the translation back to ftrace
-        // refers to this storage directly).
-        inserter.AddArg(name_id, Variadic::UnsignedInteger(fld.as_uint64()));
-        break;
-      }
-      case ProtoSchemaType::kSint32:
-      case ProtoSchemaType::kSint64: {
-        inserter.AddArg(name_id, Variadic::Integer(fld.as_sint64()));
-        break;
-      }
-      case ProtoSchemaType::kString:
-      case ProtoSchemaType::kBytes: {
-        StringId value = context_->storage->InternString(fld.as_string());
-        inserter.AddArg(name_id, Variadic::String(value));
-        break;
-      }
-      case ProtoSchemaType::kDouble: {
-        inserter.AddArg(name_id, Variadic::Real(fld.as_double()));
-        break;
-      }
-      case ProtoSchemaType::kFloat: {
-        inserter.AddArg(name_id,
-                        Variadic::Real(static_cast<double>(fld.as_float())));
-        break;
-      }
-      case ProtoSchemaType::kUnknown:
-      case ProtoSchemaType::kGroup:
-      case ProtoSchemaType::kMessage:
-        PERFETTO_DLOG("Could not store %s as a field in args table.",
-                      ProtoSchemaToString(type));
-        break;
-    }
+  // Events with kernel symbols are decoded right away as the interned data
+  // they refer to does not outlive the parsing of the trace.
+  if (lazy_raw_args_ && message_strings.kernel_function_fields.none()) {
+    lazy_raw_args_->Defer(id, ftrace_id, event.slice(blob.data, blob.size));
+    return;
   }
+  auto inserter = context_->args_tracker->AddArgsTo(id);
+  AddTypedFtraceArgs(context_->storage.get(), ftrace_id, message_strings, blob,
+                     seq_state, &inserter);
 }
 
 PERFETTO_ALWAYS_INLINE
@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_PARSER_H_
 
+#include <bitset>
 #include <cstdint>
 
 #include <string>
@@ -30,6 +31,7 @@
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/ftrace/drm_tracker.h"
 #include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_args.h"
 #include "src/trace_processor/importers/ftrace/gpu_work_period_tracker.h"
 #include "src/trace_processor/importers/ftrace/iostat_tracker.h"
 #include "src/trace_processor/importers/ftrace/mali_gpu_event_tracker.h"
@@ -67,6 +69,7 @@ class FtraceParser {
                              int64_t timestamp,
                              uint32_t cpu,
                              uint32_t pid,
+                             const TraceBlobView& event,
                              protozero::ConstBytes,
                              PacketSequenceStateGeneration*);
   void ParseSchedSwitch(uint32_t cpu, int64_t timestamp, protozero::ConstBytes);
@@ -400,13 +403,11 @@ class FtraceParser {
   const StringId runtime_status_resuming_id_;
   std::vector<StringId> syscall_arg_name_ids_;
 
-  struct FtraceMessageStrings {
-    // The string id of name of the event field (e.g. sched_switch's id).
-    StringId message_name_id = kNullStringId;
-    std::array<StringId, kMaxFtraceEventFields> field_name_ids;
-  };
   std::vector<FtraceMessageStrings> ftrace_message_strings_;
 
+  // Only set if |Config::lazy_ftrace_raw_args| is true.
+  LazyFtraceRawArgs* lazy_raw_args_ = nullptr;
+
   struct MmEventCounterNames {
     MmEventCounterNames() = default;
     MmEventCounterNames(StringId _count, StringId _max_lat, StringId _avg_lat)
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_args.h"
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/variadic.h"
+
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/profiling/profile_common.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using protozero::ProtoDecoder;
+using protozero::proto_utils::ProtoSchemaType;
+
+// Number of events decoded between two flushes of the ArgsTracker by
+// LazyFtraceRawArgs::Materialize(), to bound the memory of pending args.
+constexpr size_t kMaterializeBatchSize = 4096;
+
+}  // namespace
+
+void AddTypedFtraceArgs(TraceStorage* storage,
+                        uint32_t ftrace_id,
+                        const FtraceMessageStrings& strings,
+                        protozero::ConstBytes blob,
+                        PacketSequenceStateGeneration* seq_state,
+                        ArgsTracker::BoundInserter* inserter) {
+  FtraceMessageDescriptor* m = GetMessageDescriptorForId(ftrace_id);
+  ProtoDecoder decoder(blob.data, blob.size);
+  for (auto fld = decoder.ReadField(); fld.valid(); fld = decoder.ReadField()) {
+    uint32_t field_id = fld.id();
+    if (PERFETTO_UNLIKELY(field_id >= kMaxFtraceEventFields)) {
+      PERFETTO_DLOG(
+          "Skipping ftrace arg - proto field id is too large (%" PRIu32 ")",
+          field_id);
+      continue;
+    }
+
+    ProtoSchemaType type = m->fields[field_id].type;
+    StringId name_id = strings.field_name_ids[field_id];
+
+    // Check if this field represents a kernel function.
+    if (seq_state && strings.kernel_function_fields.test(field_id)) {
+      PERFETTO_CHECK(type == ProtoSchemaType::kUint64);
+
+      auto* interned_string = seq_state->LookupInternedMessage<
+          protos::pbzero::InternedData::kKernelSymbolsFieldNumber,
+          protos::pbzero::InternedString>(fld.as_uint64());
+
+      // If we don't have the string for this field (can happen if
+      // symbolization wasn't enabled, if reading the symbols errored out or
+      // on legacy traces) then just add the field as a normal arg.
+      if (interned_string) {
+        protozero::ConstBytes str = interned_string->str();
+        StringId str_id = storage->InternString(base::StringView(
+            reinterpret_cast<const char*>(str.data), str.size));
+        inserter->AddArg(name_id, Variadic::String(str_id));
+        continue;
+      }
+    }
+
+    switch (type) {
+      case ProtoSchemaType::kInt32:
+      case ProtoSchemaType::kInt64:
+      case ProtoSchemaType::kSfixed32:
+      case ProtoSchemaType::kSfixed64:
+      case ProtoSchemaType::kBool:
+      case ProtoSchemaType::kEnum: {
+        inserter->AddArg(name_id, Variadic::Integer(fld.as_int64()));
+        break;
+      }
+      case ProtoSchemaType::kUint32:
+      case ProtoSchemaType::kUint64:
+      case ProtoSchemaType::kFixed32:
+      case ProtoSchemaType::kFixed64: {
+        // Note that SQLite functions will still treat unsigned values
+        // as a signed 64 bit integers (but the translation back to ftrace
+        // refers to this storage directly).
+        inserter->AddArg(name_id, Variadic::UnsignedInteger(fld.as_uint64()));
+        break;
+      }
+      case ProtoSchemaType::kSint32:
+      case ProtoSchemaType::kSint64: {
+        inserter->AddArg(name_id, Variadic::Integer(fld.as_sint64()));
+        break;
+      }
+      case ProtoSchemaType::kString:
+      case ProtoSchemaType::kBytes: {
+        StringId value = storage->InternString(fld.as_string());
+        inserter->AddArg(name_id, Variadic::String(value));
+        break;
+      }
+      case ProtoSchemaType::kDouble: {
+        inserter->AddArg(name_id, Variadic::Real(fld.as_double()));
+        break;
+      }
+      case ProtoSchemaType::kFloat: {
+        inserter->AddArg(name_id,
+                         Variadic::Real(static_cast<double>(fld.as_float())));
+        break;
+      }
+      case ProtoSchemaType::kUnknown:
+      case ProtoSchemaType::kGroup:
+      case ProtoSchemaType::kMessage:
+        PERFETTO_DLOG("Could not store %s as a field in args table.",
+                      ProtoSchemaToString(type));
+        break;
+    }
+  }
+}
+
+LazyFtraceRawArgs::LazyFtraceRawArgs(TraceProcessorContext* context,
+                                     std::vector<FtraceMessageStrings> strings)
+    : context_(context), strings_(std::move(strings)) {}
+
+LazyFtraceRawArgs::~LazyFtraceRawArgs() = default;
+
+void LazyFtraceRawArgs::Materialize() {
+  if (pending_.empty())
+    return;
+
+  // Only |storage| and |global_args_tracker| of the context are used by
+  // ArgsTracker: both are retained after the end of the trace.
+  PERFETTO_DCHECK(context_->global_args_tracker);
+  ArgsTracker args_tracker(context_);
+  TraceStorage* storage = context_->storage.get();
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    const Pending& p = pending_[i];
+    auto inserter = args_tracker.AddArgsTo(RawId(p.row));
+    AddTypedFtraceArgs(storage, p.ftrace_id, strings_[p.ftrace_id],
+                       protozero::ConstBytes{p.event.data(), p.event.size()},
+                       nullptr, &inserter);
+    if ((i + 1) % kMaterializeBatchSize == 0)
+      args_tracker.Flush();
+  }
+  args_tracker.Flush();
+
+  // Releases the references to the trace blobs.
+  pending_.clear();
+  pending_.shrink_to_fit();
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_ARGS_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_ARGS_H_
+
+#include <array>
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "perfetto/protozero/field.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/common/args_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_descriptors.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/destructible.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class PacketSequenceStateGeneration;
+
+// The interned names of a typed ftrace event and of its fields.
+struct FtraceMessageStrings {
+  // The string id of name of the event field (e.g. sched_switch's id).
+  StringId message_name_id = kNullStringId;
+  std::array<StringId, kMaxFtraceEventFields> field_name_ids;
+  // The fields of the event which hold the iid of a kernel symbol.
+  std::bitset<kMaxFtraceEventFields> kernel_function_fields;
+};
+
+// Decodes the fields of the typed ftrace event |blob| (with id |ftrace_id|)
+// and adds them as args to |inserter|. |seq_state| is used to resolve the
+// |kernel_function_fields| of the event; if null, they are added as integers.
+void AddTypedFtraceArgs(TraceStorage* storage,
+                        uint32_t ftrace_id,
+                        const FtraceMessageStrings& strings,
+                        protozero::ConstBytes blob,
+                        PacketSequenceStateGeneration* seq_state,
+                        ArgsTracker::BoundInserter* inserter);
+
+// Defers decoding the args of the typed ftrace events of the raw table until
+// they are first queried, see |Config::lazy_ftrace_raw_args|. Only the slice
+// of the trace holding each event is retained until then, which is usually
+// much smaller than the rows of the args table it decodes to.
+//
+// This outlives the parsing of the trace: TraceProcessorImpl calls
+// Materialize() before running a query which reads the raw, ftrace_event or
+// args tables.
+class LazyFtraceRawArgs : public Destructible {
+ public:
+  LazyFtraceRawArgs(TraceProcessorContext* context,
+                    std::vector<FtraceMessageStrings> strings);
+  ~LazyFtraceRawArgs() override;
+
+  LazyFtraceRawArgs(const LazyFtraceRawArgs&) = delete;
+  LazyFtraceRawArgs& operator=(const LazyFtraceRawArgs&) = delete;
+
+  static LazyFtraceRawArgs* Get(TraceProcessorContext* context) {
+    return static_cast<LazyFtraceRawArgs*>(
+        context->lazy_ftrace_raw_args.get());
+  }
+
+  // Records that the args of the raw table row |id| are to be decoded from
+  // |event|, a typed ftrace event with id |ftrace_id|. Events with kernel
+  // symbol fields must not be deferred as the interned data they depend on
+  // does not outlive parsing.
+  void Defer(RawId id, uint32_t ftrace_id, TraceBlobView event) {
+    PERFETTO_DCHECK(strings_[ftrace_id].kernel_function_fields.none());
+    pending_.push_back(Pending{std::move(event), id.value, ftrace_id});
+  }
+
+  // Decodes the args of all the deferred events into the args table.
+  void Materialize();
+
+  size_t pending_count() const { return pending_.size(); }
+
+ private:
+  struct Pending {
+    TraceBlobView event;
+    uint32_t row;
+    uint32_t ftrace_id;
+  };
+
+  TraceProcessorContext* const context_;
+  const std::vector<FtraceMessageStrings> strings_;
+  std::vector<Pending> pending_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_ARGS_H_
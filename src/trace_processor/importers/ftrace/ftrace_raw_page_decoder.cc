@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/protozero/message.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+namespace {
+
+using RawPageFormat = protos::pbzero::FtraceEventBundle::RawPageFormat;
+using protos::pbzero::GenericFtraceEvent;
+
+// See CpuReader in src/traced/probes/ftrace and the kernel's
+// include/linux/ring_buffer.h for the layout of the ring buffer pages.
+constexpr uint32_t kTypePadding = 29;
+constexpr uint32_t kTypeTimeExtend = 30;
+constexpr uint32_t kTypeTimeStamp = 31;
+constexpr uint32_t kDataSizeMask = (1u << 27) - 1;
+
+template <typename T>
+T ReadUnaligned(const uint8_t* ptr) {
+  T t;
+  memcpy(&t, ptr, sizeof(T));
+  return t;
+}
+
+bool ReadUint(const uint8_t* ptr, uint32_t size, uint64_t* out) {
+  switch (size) {
+    case 1:
+      *out = ReadUnaligned<uint8_t>(ptr);
+      return true;
+    case 2:
+      *out = ReadUnaligned<uint16_t>(ptr);
+      return true;
+    case 4:
+      *out = ReadUnaligned<uint32_t>(ptr);
+      return true;
+    case 8:
+      *out = ReadUnaligned<uint64_t>(ptr);
+      return true;
+  }
+  return false;
+}
+
+bool ReadInt(const uint8_t* ptr, uint32_t size, int64_t* out) {
+  switch (size) {
+    case 1:
+      *out = ReadUnaligned<int8_t>(ptr);
+      return true;
+    case 2:
+      *out = ReadUnaligned<int16_t>(ptr);
+      return true;
+    case 4:
+      *out = ReadUnaligned<int32_t>(ptr);
+      return true;
+    case 8:
+      *out = ReadUnaligned<int64_t>(ptr);
+      return true;
+  }
+  return false;
+}
+
+// Same as CpuReader::TranslateBlockDeviceIDToUserspace().
+uint64_t KernelDevIdToUserspace(uint64_t kernel_dev) {
+  uint64_t maj = kernel_dev >> 20;
+  uint64_t min = kernel_dev & ((1U << 20) - 1);
+  return ((maj & 0xfffff000ULL) << 32) | ((maj & 0xfffULL) << 8) |
+         ((min & 0xffffff00ULL) << 12) | ((min & 0xffULL));
+}
+
+void AppendString(uint32_t field_id,
+                  const uint8_t* start,
+                  size_t max_len,
+                  protozero::Message* msg) {
+  const char* str = reinterpret_cast<const char*>(start);
+  msg->AppendBytes(field_id, str, strnlen(str, max_len));
+}
+
+}  // namespace
+
+FtraceRawPageDecoder::FtraceRawPageDecoder() = default;
+FtraceRawPageDecoder::~FtraceRawPageDecoder() = default;
+
+void FtraceRawPageDecoder::ParseFormat(protozero::ConstBytes raw_page_format) {
+  RawPageFormat::Decoder decoder(raw_page_format);
+  commit_size_ = decoder.commit_size();
+  common_pid_.reset();
+  if (decoder.has_common_pid())
+    common_pid_ = ParseField(decoder.common_pid());
+
+  events_.Clear();
+  for (auto it = decoder.event(); it; ++it) {
+    RawPageFormat::Event::Decoder event(*it);
+    EventFormat format;
+    format.name = event.name().ToStdString();
+    format.proto_field_id = event.proto_field_id();
+    for (auto field = event.field(); field; ++field)
+      format.fields.emplace_back(ParseField(*field));
+    events_.Insert(event.id(), std::move(format));
+  }
+}
+
+// static
+FtraceRawPageDecoder::FieldFormat FtraceRawPageDecoder::ParseField(
+    protozero::ConstBytes field) {
+  RawPageFormat::Field::Decoder decoder(field);
+  FieldFormat format;
+  format.name = decoder.name().ToStdString();
+  format.offset = decoder.offset();
+  format.size = decoder.size();
+  format.type = decoder.type();
+  format.proto_field_id = decoder.proto_field_id();
+  return format;
+}
+
+base::Status FtraceRawPageDecoder::DecodePage(
+    protozero::ConstBytes page,
+    protos::pbzero::FtraceEventBundle* out) const {
+  if (!has_format())
+    return base::ErrStatus("Raw ftrace page without a format");
+
+  // Page header: a 64-bit timestamp followed by the |commit| field, whose
+  // bottom bits are the size of the data that follows.
+  const size_t header_size = sizeof(uint64_t) + commit_size_;
+  if (commit_size_ < sizeof(uint32_t) || page.size < header_size)
+    return base::ErrStatus("Raw ftrace page with an invalid header");
+  uint64_t timestamp = ReadUnaligned<uint64_t>(page.data);
+  uint32_t data_size =
+      ReadUnaligned<uint32_t>(page.data + sizeof(uint64_t)) & kDataSizeMask;
+  if (data_size > page.size - header_size)
+    return base::ErrStatus("Raw ftrace page shorter than its header says");
+
+  const uint8_t* ptr = page.data + header_size;
+  const uint8_t* const end = ptr + data_size;
+  while (ptr < end) {
+    if (end - ptr < 4)
+      return base::ErrStatus("Short event header in raw ftrace page");
+    uint32_t event_header = ReadUnaligned<uint32_t>(ptr);
+    ptr += 4;
+    uint32_t type_or_length = event_header & 0x1f;
+    uint32_t time_delta = event_header >> 5;
+    timestamp += time_delta;
+
+    switch (type_or_length) {
+      case kTypePadding: {
+        if (time_delta == 0)
+          return base::ErrStatus("Null padding in raw ftrace page");
+        if (end - ptr < 4)
+          return base::ErrStatus("Short padding in raw ftrace page");
+        uint32_t length = ReadUnaligned<uint32_t>(ptr);
+        // Length includes itself (4 bytes).
+        if (length < 4)
+          return base::ErrStatus("Invalid padding in raw ftrace page");
+        ptr += length;
+        break;
+      }
+      case kTypeTimeExtend: {
+        if (end - ptr < 4)
+          return base::ErrStatus("Short time extend in raw ftrace page");
+        timestamp += static_cast<uint64_t>(ReadUnaligned<uint32_t>(ptr)) << 27;
+        ptr += 4;
+        break;
+      }
+      case kTypeTimeStamp: {
+        if (end - ptr < 4)
+          return base::ErrStatus("Short time stamp in raw ftrace page");
+        timestamp = time_delta +
+                    (static_cast<uint64_t>(ReadUnaligned<uint32_t>(ptr)) << 27);
+        ptr += 4;
+        break;
+      }
+      default: {
+        // Data record: for lengths up to 28 words, the length is in the
+        // header, otherwise it is in the first word of the payload.
+        uint32_t event_size = 4 * type_or_length;
+        if (type_or_length == 0) {
+          if (end - ptr < 4)
+            return base::ErrStatus("Short data length in raw ftrace page");
+          event_size = ReadUnaligned<uint32_t>(ptr);
+          ptr += 4;
+          // Size includes itself (4 bytes).
+          if (event_size < 4)
+            return base::ErrStatus("Invalid data length in raw ftrace page");
+          event_size -= 4;
+        }
+        if (event_size > static_cast<size_t>(end - ptr) || event_size < 2)
+          return base::ErrStatus("Data record overflows raw ftrace page");
+
+        const uint8_t* const start = ptr;
+        ptr += event_size;
+        uint16_t event_id = ReadUnaligned<uint16_t>(start);
+        const EventFormat* event = events_.Find(event_id);
+        if (!event)
+          break;
+        if (!WriteEvent(*event, timestamp, start, ptr, out)) {
+          return base::ErrStatus("Malformed %s event in raw ftrace page",
+                                 event->name.c_str());
+        }
+        break;
+      }
+    }
+  }
+  return base::OkStatus();
+}
+
+bool FtraceRawPageDecoder::WriteEvent(
+    const EventFormat& event,
+    uint64_t timestamp,
+    const uint8_t* start,
+    const uint8_t* end,
+    protos::pbzero::FtraceEventBundle* out) const {
+  bool success = true;
+  protos::pbzero::FtraceEvent* ftrace_event = out->add_event();
+  ftrace_event->set_timestamp(timestamp);
+  if (common_pid_)
+    success &= WriteField(*common_pid_, start, end, ftrace_event);
+
+  protozero::Message* nested =
+      ftrace_event->BeginNestedMessage<protozero::Message>(
+          event.proto_field_id);
+  if (event.proto_field_id ==
+      protos::pbzero::FtraceEvent::kGenericFieldNumber) {
+    nested->AppendString(GenericFtraceEvent::kEventNameFieldNumber,
+                         event.name);
+    for (const FieldFormat& field : event.fields) {
+      auto* generic_field = nested->BeginNestedMessage<protozero::Message>(
+          GenericFtraceEvent::kFieldFieldNumber);
+      generic_field->AppendString(GenericFtraceEvent::Field::kNameFieldNumber,
+                                  field.name);
+      success &= WriteField(field, start, end, generic_field);
+    }
+  } else {
+    for (const FieldFormat& field : event.fields)
+      success &= WriteField(field, start, end, nested);
+  }
+  return success;
+}
+
+// static
+bool FtraceRawPageDecoder::WriteField(const FieldFormat& field,
+                                      const uint8_t* start,
+                                      const uint8_t* end,
+                                      protozero::Message* msg) {
+  const size_t record_size = static_cast<size_t>(end - start);
+  if (field.offset > record_size || field.size > record_size - field.offset)
+    return false;
+  const uint8_t* field_start = start + field.offset;
+  const uint32_t id = field.proto_field_id;
+
+  switch (field.type) {
+    case RawPageFormat::Field::TYPE_UINT: {
+      uint64_t value = 0;
+      if (!ReadUint(field_start, field.size, &value))
+        return false;
+      msg->AppendVarInt(id, value);
+      return true;
+    }
+    case RawPageFormat::Field::TYPE_INT: {
+      int64_t value = 0;
+      if (!ReadInt(field_start, field.size, &value))
+        return false;
+      msg->AppendVarInt(id, value);
+      return true;
+    }
+    case RawPageFormat::Field::TYPE_KERNEL_DEV_ID: {
+      uint64_t value = 0;
+      if (!ReadUint(field_start, field.size, &value))
+        return false;
+      msg->AppendVarInt(id, KernelDevIdToUserspace(value));
+      return true;
+    }
+    case RawPageFormat::Field::TYPE_FIXED_STRING:
+      AppendString(id, field_start, field.size, msg);
+      return true;
+    case RawPageFormat::Field::TYPE_CSTRING:
+      AppendString(id, field_start, static_cast<size_t>(end - field_start),
+                   msg);
+      return true;
+    case RawPageFormat::Field::TYPE_DATA_LOC: {
+      // See kernel header include/trace/trace_events.h.
+      if (field.size != 4)
+        return false;
+      uint32_t data = ReadUnaligned<uint32_t>(field_start);
+      const uint32_t offset = data & 0xffff;
+      const uint32_t len = (data >> 16) & 0xffff;
+      if (len == 0)
+        return true;
+      if (offset > record_size || len > record_size - offset)
+        return false;
+      AppendString(id, start + offset, len, msg);
+      return true;
+    }
+  }
+  // Unknown types are from a newer producer: skip them, like unknown fields.
+  return true;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/protozero/field.h"
+
+namespace protozero {
+class Message;
+}  // namespace protozero
+
+namespace perfetto {
+
+namespace protos {
+namespace pbzero {
+class FtraceEventBundle;
+}  // namespace pbzero
+}  // namespace protos
+
+namespace trace_processor {
+
+// Decodes the kernel ring buffer pages written by traced_probes when
+// FtraceConfig.raw_page_passthrough is set (FtraceEventBundle.raw_pages) back
+// into FtraceEvent protos, so that they can go through the same tokenization
+// and parsing as the events serialized by traced_probes itself.
+// The layout of the pages and events comes from the trace itself
+// (FtraceEventBundle.raw_page_format).
+class FtraceRawPageDecoder {
+ public:
+  FtraceRawPageDecoder();
+  ~FtraceRawPageDecoder();
+
+  // Replaces the layout used to decode subsequent pages with the given
+  // FtraceEventBundle.RawPageFormat.
+  void ParseFormat(protozero::ConstBytes raw_page_format);
+
+  bool has_format() const { return commit_size_ != 0; }
+
+  // Decodes the records of a single page, appending an FtraceEvent to |out|
+  // for each event described by the format. Records of events not in the
+  // format (e.g. enabled by a concurrent data source) are skipped.
+  // Returns an error if the page is malformed, in which case the events that
+  // precede the malformed record have already been appended.
+  base::Status DecodePage(protozero::ConstBytes page,
+                          protos::pbzero::FtraceEventBundle* out) const;
+
+ private:
+  struct FieldFormat {
+    std::string name;
+    uint32_t offset = 0;
+    uint32_t size = 0;
+    int32_t type = 0;  // FtraceEventBundle.RawPageFormat.Field.Type.
+    uint32_t proto_field_id = 0;
+  };
+  struct EventFormat {
+    std::string name;
+    uint32_t proto_field_id = 0;
+    std::vector<FieldFormat> fields;
+  };
+
+  static FieldFormat ParseField(protozero::ConstBytes field);
+
+  // Writes the value of |field| from the record [start, end) into |msg|.
+  // Returns false if the field lies outside the record.
+  static bool WriteField(const FieldFormat& field,
+                         const uint8_t* start,
+                         const uint8_t* end,
+                         protozero::Message* msg);
+
+  bool WriteEvent(const EventFormat& event,
+                  uint64_t timestamp,
+                  const uint8_t* start,
+                  const uint8_t* end,
+                  protos::pbzero::FtraceEventBundle* out) const;
+
+  uint32_t commit_size_ = 0;
+  std::optional<FieldFormat> common_pid_;
+  base::FlatHashMap<uint32_t, EventFormat> events_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_FTRACE_FTRACE_RAW_PAGE_DECODER_H_
@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/ftrace/ftrace_event.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/ftrace/generic.gen.h"
+#include "protos/perfetto/trace/ftrace/generic.pbzero.h"
+#include "protos/perfetto/trace/ftrace/sched.gen.h"
+#include "protos/perfetto/trace/ftrace/sched.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using RawPageFormat = protos::pbzero::FtraceEventBundle::RawPageFormat;
+using RawField = RawPageFormat::Field;
+
+constexpr uint16_t kSwitchId = 10;
+constexpr uint16_t kGenericId = 11;
+constexpr uint16_t kUnknownId = 12;
+
+// Records start with: common_type (u16), common_flags (u8),
+// common_preempt_count (u8), common_pid (s32).
+void AddField(RawField* field,
+              const char* name,
+              uint32_t offset,
+              uint32_t size,
+              RawField::Type type,
+              uint32_t proto_field_id) {
+  field->set_name(name);
+  field->set_offset(offset);
+  field->set_size(size);
+  field->set_type(type);
+  field->set_proto_field_id(proto_field_id);
+}
+
+std::vector<uint8_t> MakeFormat() {
+  protozero::HeapBuffered<RawPageFormat> format;
+  format->set_commit_size(8);
+  AddField(format->set_common_pid(), "common_pid", 4, 4, RawField::TYPE_INT,
+           protos::pbzero::FtraceEvent::kPidFieldNumber);
+
+  // sched_switch, limited to three fields.
+  using Switch = protos::pbzero::SchedSwitchFtraceEvent;
+  auto* sched_switch = format->add_event();
+  sched_switch->set_id(kSwitchId);
+  sched_switch->set_name("sched_switch");
+  sched_switch->set_proto_field_id(
+      protos::pbzero::FtraceEvent::kSchedSwitchFieldNumber);
+  AddField(sched_switch->add_field(), "prev_comm", 8, 16,
+           RawField::TYPE_FIXED_STRING, Switch::kPrevCommFieldNumber);
+  AddField(sched_switch->add_field(), "prev_pid", 24, 4, RawField::TYPE_INT,
+           Switch::kPrevPidFieldNumber);
+  AddField(sched_switch->add_field(), "prev_state", 28, 8, RawField::TYPE_INT,
+           Switch::kPrevStateFieldNumber);
+
+  // A generic event with a __data_loc string and an unsigned field.
+  auto* generic = format->add_event();
+  generic->set_id(kGenericId);
+  generic->set_name("my_event");
+  generic->set_proto_field_id(protos::pbzero::FtraceEvent::kGenericFieldNumber);
+  AddField(generic->add_field(), "msg", 8, 4, RawField::TYPE_DATA_LOC,
+           protos::pbzero::GenericFtraceEvent::Field::kStrValueFieldNumber);
+  AddField(generic->add_field(), "count", 12, 2, RawField::TYPE_UINT,
+           protos::pbzero::GenericFtraceEvent::Field::kUintValueFieldNumber);
+  return format.SerializeAsArray();
+}
+
+// Builds a ring buffer page, see CpuReader::ParsePagePayload().
+class PageBuilder {
+ public:
+  explicit PageBuilder(uint64_t timestamp) {
+    Append(&timestamp, sizeof(timestamp));
+    uint64_t commit = 0;
+    Append(&commit, sizeof(commit));
+  }
+
+  void AddRecord(uint32_t time_delta, std::vector<uint8_t> payload) {
+    payload.resize((payload.size() + 3) & ~3u);
+    uint32_t header = (time_delta << 5) |
+                      static_cast<uint32_t>(payload.size() / 4);
+    Append(&header, sizeof(header));
+    Append(payload.data(), payload.size());
+  }
+
+  void AddTimeExtend(uint64_t delta) {
+    uint32_t header = (static_cast<uint32_t>(delta & ((1 << 27) - 1)) << 5) |
+                      30;
+    uint32_t ext = static_cast<uint32_t>(delta >> 27);
+    Append(&header, sizeof(header));
+    Append(&ext, sizeof(ext));
+  }
+
+  std::string Build() const {
+    std::string page = data_;
+    uint64_t commit = page.size() - 16;
+    memcpy(&page[8], &commit, sizeof(commit));
+    // The zero padding at the end of the page is dropped by the producer.
+    return page;
+  }
+
+ private:
+  void Append(const void* data, size_t size) {
+    data_.append(reinterpret_cast<const char*>(data), size);
+  }
+
+  std::string data_;
+};
+
+template <typename T>
+void Put(std::vector<uint8_t>* record, size_t offset, T value) {
+  if (record->size() < offset + sizeof(T))
+    record->resize(offset + sizeof(T));
+  memcpy(record->data() + offset, &value, sizeof(T));
+}
+
+std::vector<uint8_t> Record(uint16_t id, int32_t pid) {
+  std::vector<uint8_t> record;
+  Put<uint16_t>(&record, 0, id);
+  Put<int32_t>(&record, 4, pid);
+  return record;
+}
+
+protos::gen::FtraceEventBundle Decode(const FtraceRawPageDecoder& decoder,
+                                      const std::string& page,
+                                      base::Status* status) {
+  protozero::HeapBuffered<protos::pbzero::FtraceEventBundle> out;
+  *status = decoder.DecodePage(
+      protozero::ConstBytes{reinterpret_cast<const uint8_t*>(page.data()),
+                            page.size()},
+      out.get());
+  protos::gen::FtraceEventBundle bundle;
+  bundle.ParseFromString(out.SerializeAsString());
+  return bundle;
+}
+
+class FtraceRawPageDecoderTest : public ::testing::Test {
+ protected:
+  FtraceRawPageDecoderTest() {
+    std::vector<uint8_t> format = MakeFormat();
+    decoder_.ParseFormat(protozero::ConstBytes{format.data(), format.size()});
+  }
+
+  FtraceRawPageDecoder decoder_;
+};
+
+TEST(FtraceRawPageDecoderNoFormatTest, RequiresFormat) {
+  FtraceRawPageDecoder decoder;
+  EXPECT_FALSE(decoder.has_format());
+  PageBuilder page(1000);
+  page.AddRecord(1, Record(kSwitchId, 42));
+  base::Status status;
+  auto bundle = Decode(decoder, page.Build(), &status);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(bundle.event().size(), 0u);
+}
+
+TEST_F(FtraceRawPageDecoderTest, DecodesKnownEvents) {
+  EXPECT_TRUE(decoder_.has_format());
+
+  std::vector<uint8_t> switch_record = Record(kSwitchId, 42);
+  switch_record.resize(24);
+  memcpy(&switch_record[8], "comm", 5);
+  Put<int32_t>(&switch_record, 24, 43);
+  Put<int64_t>(&switch_record, 28, -1);
+
+  std::vector<uint8_t> generic_record = Record(kGenericId, 44);
+  const char kMsg[] = "hello";
+  Put<uint32_t>(&generic_record, 8, (sizeof(kMsg) << 16) | 16);
+  Put<uint16_t>(&generic_record, 12, 7);
+  generic_record.resize(16);
+  generic_record.insert(generic_record.end(), kMsg, kMsg + sizeof(kMsg));
+
+  PageBuilder page(1000);
+  page.AddRecord(10, switch_record);
+  page.AddRecord(5, Record(kUnknownId, 1));
+  page.AddTimeExtend(1ull << 30);
+  page.AddRecord(20, generic_record);
+
+  base::Status status;
+  auto bundle = Decode(decoder_, page.Build(), &status);
+  ASSERT_TRUE(status.ok()) << status.message();
+
+  // The event with an unknown id is skipped.
+  ASSERT_EQ(bundle.event().size(), 2u);
+
+  const auto& sched_switch = bundle.event()[0];
+  EXPECT_EQ(sched_switch.timestamp(), 1010u);
+  EXPECT_EQ(sched_switch.pid(), 42u);
+  ASSERT_TRUE(sched_switch.has_sched_switch());
+  EXPECT_EQ(sched_switch.sched_switch().prev_comm(), "comm");
+  EXPECT_EQ(sched_switch.sched_switch().prev_pid(), 43);
+  EXPECT_EQ(sched_switch.sched_switch().prev_state(), -1);
+
+  const auto& generic = bundle.event()[1];
+  EXPECT_EQ(generic.timestamp(), 1010u + 5u + (1ull << 30) + 20u);
+  EXPECT_EQ(generic.pid(), 44u);
+  ASSERT_TRUE(generic.has_generic());
+  EXPECT_EQ(generic.generic().event_name(), "my_event");
+  ASSERT_EQ(generic.generic().field().size(), 2u);
+  EXPECT_EQ(generic.generic().field()[0].name(), "msg");
+  EXPECT_EQ(generic.generic().field()[0].str_value(), "hello");
+  EXPECT_EQ(generic.generic().field()[1].name(), "count");
+  EXPECT_EQ(generic.generic().field()[1].uint_value(), 7u);
+}
+
+TEST_F(FtraceRawPageDecoderTest, TruncatedRecord) {
+  PageBuilder page(1000);
+  page.AddRecord(1, Record(kSwitchId, 42));
+  std::string data = page.Build();
+
+  // Claim more data than the page holds.
+  uint64_t commit = data.size();
+  memcpy(&data[8], &commit, sizeof(commit));
+  base::Status status;
+  Decode(decoder_, data, &status);
+  EXPECT_FALSE(status.ok());
+
+  // A record shorter than its fields is reported as an error, after the
+  // events that precede it have been decoded.
+  std::vector<uint8_t> switch_record = Record(kSwitchId, 42);
+  switch_record.resize(36);
+  PageBuilder short_page(1000);
+  short_page.AddRecord(1, switch_record);
+  short_page.AddRecord(1, Record(kGenericId, 42));
+  short_page.AddRecord(1, switch_record);
+  auto bundle = Decode(decoder_, short_page.Build(), &status);
+  EXPECT_FALSE(status.ok());
+  ASSERT_EQ(bundle.event().size(), 2u);
+  EXPECT_TRUE(bundle.event()[0].has_sched_switch());
+  EXPECT_TRUE(bundle.event()[1].has_generic());
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
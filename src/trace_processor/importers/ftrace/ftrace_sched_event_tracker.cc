@@ -21,6 +21,7 @@
 #include "perfetto/ext/base/string_view.h"
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/sched_event_state.h"
 #include "src/trace_processor/importers/common/sched_event_tracker.h"
@@ -234,7 +235,8 @@ void FtraceSchedEventTracker::PushSchedWakingCompact(uint32_t cpu,
   }
   auto curr_utid = pending_sched->last_utid;
 
-  if (PERFETTO_LIKELY(context_->config.ingest_ftrace_in_raw_table)) {
+  if (PERFETTO_LIKELY(context_->config.ingest_ftrace_in_raw_table) &&
+      !MemoryBudget::ShouldDropRawEvent(context_->memory_budget.get())) {
     tables::FtraceEventTable::Row row;
     row.ts = ts;
     row.name = sched_waking_id_;
@@ -277,7 +279,8 @@ void FtraceSchedEventTracker::AddRawSchedSwitchEvent(uint32_t cpu,
                                                      uint32_t next_pid,
                                                      StringId next_comm_id,
                                                      int32_t next_prio) {
-  if (PERFETTO_LIKELY(context_->config.ingest_ftrace_in_raw_table)) {
+  if (PERFETTO_LIKELY(context_->config.ingest_ftrace_in_raw_table) &&
+      !MemoryBudget::ShouldDropRawEvent(context_->memory_budget.get())) {
     // Push the raw event - this is done as the raw ftrace event codepath does
     // not insert sched_switch.
     RawId id = context_->storage->mutable_ftrace_event_table()
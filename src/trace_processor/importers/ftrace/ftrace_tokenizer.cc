@@ -20,9 +20,11 @@
 #include "perfetto/base/status.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/importers/common/machine_tracker.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_compact_events_decoder.h"
 #include "src/trace_processor/sorter/trace_sorter.h"
 #include "src/trace_processor/storage/metadata.h"
 #include "src/trace_processor/storage/stats.h"
@@ -60,6 +62,33 @@ PERFETTO_ALWAYS_INLINE base::StatusOr<int64_t> ResolveTraceTime(
   return context->clock_tracker->ToTraceTime(clock_id, ts);
 }
 
+// Same as ResolveTraceTime() but converts a sorted run of timestamps in
+// place.
+PERFETTO_ALWAYS_INLINE base::Status ResolveTraceTimes(
+    TraceProcessorContext* context,
+    ClockTracker::ClockId clock_id,
+    int64_t* timestamps,
+    size_t count) {
+  if (PERFETTO_LIKELY(clock_id == BuiltinClock::BUILTIN_CLOCK_BOOTTIME))
+    return base::OkStatus();
+  return context->clock_tracker->ToTraceTimeBatch(clock_id, timestamps, count);
+}
+
+// Decodes the delta-encoded timestamps of a compact sched bundle into
+// absolute timestamps.
+void DecodeCompactSchedTimestamps(
+    protozero::PackedRepeatedFieldIterator<
+        protozero::proto_utils::ProtoWireType::kVarInt,
+        uint64_t> it,
+    std::vector<int64_t>* timestamps) {
+  timestamps->clear();
+  int64_t timestamp_acc = 0;
+  for (; it; ++it) {
+    timestamp_acc += static_cast<int64_t>(*it);
+    timestamps->push_back(timestamp_acc);
+  }
+}
+
 // Fast path for parsing the event id of an ftrace event.
 // Speculate on the fact that, if the timestamp was found, the common pid
 // will appear immediately after and the event id immediately after that.
@@ -167,6 +196,15 @@ base::Status FtraceTokenizer::TokenizeFtraceBundle(
                         state);
   }
 
+  if (PERFETTO_UNLIKELY(decoder.has_raw_page_format()))
+    raw_page_decoder_.ParseFormat(decoder.raw_page_format());
+
+  if (PERFETTO_UNLIKELY(decoder.has_raw_pages()))
+    TokenizeFtraceRawPages(cpu, clock_id, decoder, state);
+
+  if (decoder.has_compact_events())
+    TokenizeFtraceCompactEvents(cpu, clock_id, decoder, state);
+
   // First bundle on each cpu is special since ftrace is recorded in per-cpu
   // buffers. In traces written by perfetto v44+ we know the timestamp from
   // which this cpu's data stream is valid. This is important for parsing ring
@@ -284,6 +322,60 @@ void FtraceTokenizer::TokenizeFtraceEvent(
                                     std::move(state), context_->machine_id());
 }
 
+void FtraceTokenizer::TokenizeFtraceRawPages(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    const FtraceEventBundle::Decoder& bundle,
+    RefPtr<PacketSequenceStateGeneration> state) {
+  // Decode the pages into the same FtraceEvent protos that traced_probes
+  // would have written, so they go through the regular tokenization and
+  // parsing.
+  protozero::HeapBuffered<FtraceEventBundle> decoded;
+  for (auto it = bundle.raw_pages(); it; ++it) {
+    base::Status status = raw_page_decoder_.DecodePage(*it, decoded.get());
+    if (PERFETTO_UNLIKELY(!status.ok())) {
+      context_->storage->IncrementStats(stats::ftrace_raw_page_errors);
+      DlogWithLimit(status);
+    }
+  }
+  TokenizeDecodedFtraceEvents(cpu, clock_id, decoded, std::move(state));
+}
+
+void FtraceTokenizer::TokenizeFtraceCompactEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    const FtraceEventBundle::Decoder& bundle,
+    RefPtr<PacketSequenceStateGeneration> state) {
+  // As for raw pages, re-create the FtraceEvent protos that the compact
+  // encoding replaces. Unlike compact_sched, this needs no per-event code as
+  // the events are parsed by FtraceParser as usual.
+  protozero::HeapBuffered<FtraceEventBundle> decoded;
+  for (auto it = bundle.compact_events(); it; ++it) {
+    base::Status status = DecodeFtraceCompactEvents(*it, decoded.get());
+    if (PERFETTO_UNLIKELY(!status.ok())) {
+      context_->storage->IncrementStats(stats::ftrace_compact_events_errors);
+      DlogWithLimit(status);
+    }
+  }
+  TokenizeDecodedFtraceEvents(cpu, clock_id, decoded, std::move(state));
+}
+
+void FtraceTokenizer::TokenizeDecodedFtraceEvents(
+    uint32_t cpu,
+    ClockTracker::ClockId clock_id,
+    protozero::HeapBuffered<FtraceEventBundle>& decoded,
+    RefPtr<PacketSequenceStateGeneration> state) {
+  // All the events share a single blob.
+  std::vector<uint8_t> serialized = decoded.SerializeAsArray();
+  TraceBlobView events(
+      TraceBlob::CopyFrom(serialized.data(), serialized.size()));
+  FtraceEventBundle::Decoder decoded_bundle(events.data(), events.length());
+  for (auto it = decoded_bundle.event(); it; ++it) {
+    TokenizeFtraceEvent(cpu, clock_id, events.slice(it->data(), it->size()),
+                        state);
+  }
+}
+
 PERFETTO_ALWAYS_INLINE
 void FtraceTokenizer::TokenizeFtraceCompactSched(uint32_t cpu,
                                                  ClockTracker::ClockId clock_id,
@@ -307,26 +399,30 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedSwitch(
     ClockTracker::ClockId clock_id,
     const FtraceEventBundle::CompactSched::Decoder& compact,
     const std::vector<StringId>& string_table) {
-  // Accumulator for timestamp deltas.
-  int64_t timestamp_acc = 0;
-
   // The events' fields are stored in a structure-of-arrays style, using packed
-  // repeated fields. Walk each repeated field in step to recover individual
-  // events.
+  // repeated fields. Decode the delta-encoded timestamps first, so that they
+  // can be converted to trace time in one batch, then walk the other repeated
+  // fields in step to recover individual events.
   bool parse_error = false;
-  auto timestamp_it = compact.switch_timestamp(&parse_error);
+  std::vector<int64_t>& timestamps = compact_sched_timestamps_;
+  DecodeCompactSchedTimestamps(compact.switch_timestamp(&parse_error),
+                               &timestamps);
+  base::Status status = ResolveTraceTimes(context_, clock_id,
+                                          timestamps.data(), timestamps.size());
+  if (!status.ok()) {
+    DlogWithLimit(status);
+    return;
+  }
+
+  size_t i = 0;
   auto pstate_it = compact.switch_prev_state(&parse_error);
   auto npid_it = compact.switch_next_pid(&parse_error);
   auto nprio_it = compact.switch_next_prio(&parse_error);
   auto comm_it = compact.switch_next_comm_index(&parse_error);
-  for (; timestamp_it && pstate_it && npid_it && nprio_it && comm_it;
-       ++timestamp_it, ++pstate_it, ++npid_it, ++nprio_it, ++comm_it) {
+  for (; i < timestamps.size() && pstate_it && npid_it && nprio_it && comm_it;
+       ++i, ++pstate_it, ++npid_it, ++nprio_it, ++comm_it) {
     InlineSchedSwitch event{};
 
-    // delta-encoded timestamp
-    timestamp_acc += static_cast<int64_t>(*timestamp_it);
-    int64_t event_timestamp = timestamp_acc;
-
     // index into the interned string table
     PERFETTO_DCHECK(*comm_it < string_table.size());
     event.next_comm = string_table[*comm_it];
@@ -335,19 +431,13 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedSwitch(
     event.next_pid = *npid_it;
     event.next_prio = *nprio_it;
 
-    base::StatusOr<int64_t> timestamp =
-        ResolveTraceTime(context_, clock_id, event_timestamp);
-    if (!timestamp.ok()) {
-      DlogWithLimit(timestamp.status());
-      return;
-    }
-    context_->sorter->PushInlineFtraceEvent(cpu, *timestamp, event,
+    context_->sorter->PushInlineFtraceEvent(cpu, timestamps[i], event,
                                             context_->machine_id());
   }
 
   // Check that all packed buffers were decoded correctly, and fully.
-  bool sizes_match =
-      !timestamp_it && !pstate_it && !npid_it && !nprio_it && !comm_it;
+  bool sizes_match = i == timestamps.size() && !pstate_it && !npid_it &&
+                     !nprio_it && !comm_it;
   if (parse_error || !sizes_match)
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
@@ -357,28 +447,32 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedWaking(
     ClockTracker::ClockId clock_id,
     const FtraceEventBundle::CompactSched::Decoder& compact,
     const std::vector<StringId>& string_table) {
-  // Accumulator for timestamp deltas.
-  int64_t timestamp_acc = 0;
-
   // The events' fields are stored in a structure-of-arrays style, using packed
-  // repeated fields. Walk each repeated field in step to recover individual
-  // events.
+  // repeated fields. Decode the delta-encoded timestamps first, so that they
+  // can be converted to trace time in one batch, then walk the other repeated
+  // fields in step to recover individual events.
   bool parse_error = false;
-  auto timestamp_it = compact.waking_timestamp(&parse_error);
+  std::vector<int64_t>& timestamps = compact_sched_timestamps_;
+  DecodeCompactSchedTimestamps(compact.waking_timestamp(&parse_error),
+                               &timestamps);
+  base::Status status = ResolveTraceTimes(context_, clock_id,
+                                          timestamps.data(), timestamps.size());
+  if (!status.ok()) {
+    DlogWithLimit(status);
+    return;
+  }
+
+  size_t i = 0;
   auto pid_it = compact.waking_pid(&parse_error);
   auto tcpu_it = compact.waking_target_cpu(&parse_error);
   auto prio_it = compact.waking_prio(&parse_error);
   auto comm_it = compact.waking_comm_index(&parse_error);
   auto common_flags_it = compact.waking_common_flags(&parse_error);
 
-  for (; timestamp_it && pid_it && tcpu_it && prio_it && comm_it;
-       ++timestamp_it, ++pid_it, ++tcpu_it, ++prio_it, ++comm_it) {
+  for (; i < timestamps.size() && pid_it && tcpu_it && prio_it && comm_it;
+       ++i, ++pid_it, ++tcpu_it, ++prio_it, ++comm_it) {
     InlineSchedWaking event{};
 
-    // delta-encoded timestamp
-    timestamp_acc += static_cast<int64_t>(*timestamp_it);
-    int64_t event_timestamp = timestamp_acc;
-
     // index into the interned string table
     PERFETTO_DCHECK(*comm_it < string_table.size());
     event.comm = string_table[*comm_it];
@@ -392,19 +486,13 @@ void FtraceTokenizer::TokenizeFtraceCompactSchedWaking(
       common_flags_it++;
     }
 
-    base::StatusOr<int64_t> timestamp =
-        ResolveTraceTime(context_, clock_id, event_timestamp);
-    if (!timestamp.ok()) {
-      DlogWithLimit(timestamp.status());
-      return;
-    }
-    context_->sorter->PushInlineFtraceEvent(cpu, *timestamp, event,
+    context_->sorter->PushInlineFtraceEvent(cpu, timestamps[i], event,
                                             context_->machine_id());
   }
 
   // Check that all packed buffers were decoded correctly, and fully.
-  bool sizes_match =
-      !timestamp_it && !pid_it && !tcpu_it && !prio_it && !comm_it;
+  bool sizes_match = i == timestamps.size() && !pid_it && !tcpu_it &&
+                     !prio_it && !comm_it;
   if (parse_error || !sizes_match)
     context_->storage->IncrementStats(stats::compact_sched_has_parse_errors);
 }
@@ -19,8 +19,10 @@
 
 #include <vector>
 
+#include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_page_decoder.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -44,6 +46,22 @@ class FtraceTokenizer {
                            ClockTracker::ClockId,
                            TraceBlobView event,
                            RefPtr<PacketSequenceStateGeneration> state);
+  void TokenizeFtraceRawPages(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      const protos::pbzero::FtraceEventBundle::Decoder& bundle,
+      RefPtr<PacketSequenceStateGeneration> state);
+  void TokenizeFtraceCompactEvents(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      const protos::pbzero::FtraceEventBundle::Decoder& bundle,
+      RefPtr<PacketSequenceStateGeneration> state);
+  // Tokenizes the events of a bundle re-created from a denser encoding.
+  void TokenizeDecodedFtraceEvents(
+      uint32_t cpu,
+      ClockTracker::ClockId,
+      protozero::HeapBuffered<protos::pbzero::FtraceEventBundle>& decoded,
+      RefPtr<PacketSequenceStateGeneration> state);
   void TokenizeFtraceCompactSched(uint32_t cpu,
                                   ClockTracker::ClockId,
                                   protozero::ConstBytes);
@@ -73,6 +91,10 @@ class FtraceTokenizer {
 
   int64_t latest_ftrace_clock_snapshot_ts_ = 0;
   std::vector<bool> per_cpu_seen_first_bundle_;
+  // Scratch buffer for the timestamps of a compact sched bundle, kept around
+  // to avoid reallocating it for each bundle.
+  std::vector<int64_t> compact_sched_timestamps_;
+  FtraceRawPageDecoder raw_page_decoder_;
   TraceProcessorContext* context_;
 };
 
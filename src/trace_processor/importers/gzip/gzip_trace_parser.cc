@@ -18,11 +18,15 @@
 
 #include <string>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/forwarding_trace_parser.h"
+#include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
 
@@ -33,13 +37,37 @@ namespace {
 
 using ResultCode = util::GzipDecompressor::ResultCode;
 
+// Our default uncompressed buffer size is 32MB as it allows for good
+// throughput.
+constexpr size_t kUncompressedBufferSize = 32 * 1024 * 1024;
+
+std::unique_ptr<base::ThreadPool> MaybeCreateInflateThread(
+    GzipTraceParser::InflateMode mode) {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  base::ignore_result(mode);
+  return nullptr;
+#else
+  if (mode != GzipTraceParser::InflateMode::kBackground)
+    return nullptr;
+  return std::unique_ptr<base::ThreadPool>(new base::ThreadPool(1));
+#endif
+}
+
 }  // namespace
 
 GzipTraceParser::GzipTraceParser(TraceProcessorContext* context)
-    : context_(context) {}
-
-GzipTraceParser::GzipTraceParser(std::unique_ptr<ChunkedTraceReader> reader)
-    : context_(nullptr), inner_(std::move(reader)) {}
+    : context_(context),
+      inflate_thread_(MaybeCreateInflateThread(
+          context->config.tokenizer_thread_count > 1
+              ? InflateMode::kBackground
+              : InflateMode::kInline)) {}
+
+GzipTraceParser::GzipTraceParser(std::unique_ptr<ChunkedTraceReader> reader,
+                                 InflateMode mode)
+    : context_(nullptr),
+      inner_(std::move(reader)),
+      inflate_thread_(MaybeCreateInflateThread(mode)) {}
 
 GzipTraceParser::~GzipTraceParser() = default;
 
@@ -70,14 +98,13 @@ util::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
     first_chunk_parsed_ = true;
   }
 
-  // Our default uncompressed buffer size is 32MB as it allows for good
-  // throughput.
-  constexpr size_t kUncompressedBufferSize = 32 * 1024 * 1024;
-
   needs_more_input_ = false;
   decompressor_.Feed(start, len);
+  return inflate_thread_ ? ParseInflatedInBackground() : ParseInflatedInline();
+}
 
-  for (auto ret = ResultCode::kOk; ret != ResultCode::kEof;) {
+GzipTraceParser::InflateResult GzipTraceParser::Inflate() {
+  for (;;) {
     if (!buffer_) {
       buffer_.reset(new uint8_t[kUncompressedBufferSize]);
       bytes_written_ = 0;
@@ -86,24 +113,71 @@ util::Status GzipTraceParser::ParseUnowned(const uint8_t* data, size_t size) {
     auto result =
         decompressor_.ExtractOutput(buffer_.get() + bytes_written_,
                                     kUncompressedBufferSize - bytes_written_);
-    ret = result.ret;
-    if (ret == ResultCode::kError)
-      return util::ErrStatus("Failed to decompress trace chunk");
+    if (result.ret == ResultCode::kError)
+      return {result.ret, std::nullopt};
 
-    if (ret == ResultCode::kNeedsMoreInput) {
+    if (result.ret == ResultCode::kNeedsMoreInput) {
       PERFETTO_DCHECK(result.bytes_written == 0);
+      return {result.ret, std::nullopt};
+    }
+    bytes_written_ += result.bytes_written;
+
+    if (bytes_written_ == kUncompressedBufferSize ||
+        result.ret == ResultCode::kEof) {
+      return {result.ret,
+              TraceBlob::TakeOwnership(std::move(buffer_), bytes_written_)};
+    }
+  }
+}
+
+util::Status GzipTraceParser::ParseInflatedInline() {
+  for (;;) {
+    InflateResult result = Inflate();
+    if (result.ret == ResultCode::kError)
+      return util::ErrStatus("Failed to decompress trace chunk");
+    if (result.blob)
+      RETURN_IF_ERROR(inner_->Parse(TraceBlobView(std::move(*result.blob))));
+    if (result.ret == ResultCode::kNeedsMoreInput) {
       needs_more_input_ = true;
       return util::OkStatus();
     }
-    bytes_written_ += result.bytes_written;
+    if (result.ret == ResultCode::kEof)
+      return util::OkStatus();
+  }
+}
 
-    if (bytes_written_ == kUncompressedBufferSize || ret == ResultCode::kEof) {
-      TraceBlob blob =
-          TraceBlob::TakeOwnership(std::move(buffer_), bytes_written_);
-      RETURN_IF_ERROR(inner_->Parse(TraceBlobView(std::move(blob))));
+util::Status GzipTraceParser::ParseInflatedInBackground() {
+  // The buffer inflated in the previous iteration: it is parsed on this thread
+  // while the next one is being inflated. Only the inflate thread touches
+  // |decompressor_| and |buffer_| until |inflated| is notified.
+  std::optional<TraceBlob> to_parse;
+  for (;;) {
+    InflateResult result;
+    base::WaitableEvent inflated;
+    inflate_thread_->PostTask([this, &result, &inflated] {
+      result = Inflate();
+      inflated.Notify();
+    });
+
+    util::Status status = util::OkStatus();
+    if (to_parse) {
+      status = inner_->Parse(TraceBlobView(std::move(*to_parse)));
+      to_parse.reset();
+    }
+    inflated.Wait();
+    RETURN_IF_ERROR(status);
+
+    if (result.ret == ResultCode::kError)
+      return util::ErrStatus("Failed to decompress trace chunk");
+    if (result.ret == ResultCode::kOk) {
+      to_parse = std::move(result.blob);
+      continue;
     }
+    if (result.blob)
+      RETURN_IF_ERROR(inner_->Parse(TraceBlobView(std::move(*result.blob))));
+    needs_more_input_ = result.ret == ResultCode::kNeedsMoreInput;
+    return util::OkStatus();
   }
-  return util::OkStatus();
 }
 
 void GzipTraceParser::NotifyEndOfFile() {
@@ -17,18 +17,40 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_GZIP_GZIP_TRACE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_GZIP_GZIP_TRACE_PARSER_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+
+#include "perfetto/trace_processor/trace_blob.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/util/gzip_utils.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
 namespace trace_processor {
 
 class TraceProcessorContext;
 
 class GzipTraceParser : public ChunkedTraceReader {
  public:
+  enum class InflateMode {
+    // Inflating and parsing of the inflated data happen one after the other
+    // on the calling thread.
+    kInline,
+    // Inflating of the next buffer happens on a background thread while the
+    // previous buffer is parsed on the calling thread.
+    kBackground,
+  };
+
+  // Uses kBackground mode if |Config::tokenizer_thread_count| > 1.
   explicit GzipTraceParser(TraceProcessorContext*);
-  explicit GzipTraceParser(std::unique_ptr<ChunkedTraceReader>);
+  explicit GzipTraceParser(std::unique_ptr<ChunkedTraceReader>,
+                           InflateMode = InflateMode::kInline);
   ~GzipTraceParser() override;
 
   // ChunkedTraceReader implementation
@@ -40,6 +62,21 @@ class GzipTraceParser : public ChunkedTraceReader {
   bool needs_more_input() const { return needs_more_input_; }
 
  private:
+  struct InflateResult {
+    util::GzipDecompressor::ResultCode ret =
+        util::GzipDecompressor::ResultCode::kOk;
+    // Set if |buffer_| was filled (or the stream ended) and is ready to be
+    // passed to |inner_|.
+    std::optional<TraceBlob> blob;
+  };
+
+  // Inflates the data fed so far into |buffer_| until either the buffer is
+  // full, the decompressor needs more input or the stream ends.
+  InflateResult Inflate();
+
+  util::Status ParseInflatedInline();
+  util::Status ParseInflatedInBackground();
+
   TraceProcessorContext* const context_;
   util::GzipDecompressor decompressor_;
   std::unique_ptr<ChunkedTraceReader> inner_;
@@ -49,6 +86,9 @@ class GzipTraceParser : public ChunkedTraceReader {
 
   bool first_chunk_parsed_ = false;
   bool needs_more_input_ = false;
+
+  // Only set in InflateMode::kBackground.
+  std::unique_ptr<base::ThreadPool> inflate_thread_;
 };
 
 }  // namespace trace_processor
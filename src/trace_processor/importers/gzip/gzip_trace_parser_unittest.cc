@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "src/trace_processor/importers/common/chunked_trace_reader.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using InflateMode = GzipTraceParser::InflateMode;
+
+// Collects everything passed to Parse() into |output|.
+class CollectingReader : public ChunkedTraceReader {
+ public:
+  explicit CollectingReader(std::string* output) : output_(output) {}
+
+  util::Status Parse(TraceBlobView blob) override {
+    output_->append(reinterpret_cast<const char*>(blob.data()), blob.size());
+    return util::OkStatus();
+  }
+  void NotifyEndOfFile() override {}
+
+ private:
+  std::string* output_;
+};
+
+std::string GzipCompress(const std::string& input) {
+  z_stream stream{};
+  // 16 + MAX_WBITS makes zlib write a gzip (rather than zlib) header.
+  PERFETTO_CHECK(deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED,
+                              16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+  std::string output(deflateBound(&stream, static_cast<uLong>(input.size())),
+                     '\0');
+  stream.next_in =
+      const_cast<Bytef*>(reinterpret_cast<const Bytef*>(input.data()));
+  stream.avail_in = static_cast<uInt>(input.size());
+  stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+  stream.avail_out = static_cast<uInt>(output.size());
+  PERFETTO_CHECK(deflate(&stream, Z_FINISH) == Z_STREAM_END);
+  output.resize(stream.total_out);
+  deflateEnd(&stream);
+  return output;
+}
+
+// Returns ~80MB of data which spans several uncompressed buffers.
+std::string BuildInput() {
+  std::string input;
+  for (uint32_t i = 0; input.size() < 80u * 1024 * 1024; ++i)
+    input += "line " + std::to_string(i) + "\n";
+  return input;
+}
+
+std::string Inflate(const std::string& compressed,
+                    InflateMode mode,
+                    size_t chunk_size) {
+  std::string output;
+  GzipTraceParser parser(std::unique_ptr<ChunkedTraceReader>(
+                             new CollectingReader(&output)),
+                         mode);
+  for (size_t off = 0; off < compressed.size(); off += chunk_size) {
+    size_t size = std::min(chunk_size, compressed.size() - off);
+    util::Status status = parser.ParseUnowned(
+        reinterpret_cast<const uint8_t*>(compressed.data()) + off, size);
+    PERFETTO_CHECK(status.ok());
+  }
+  PERFETTO_CHECK(!parser.needs_more_input());
+  parser.NotifyEndOfFile();
+  return output;
+}
+
+class GzipTraceParserTest : public testing::TestWithParam<InflateMode> {};
+
+TEST_P(GzipTraceParserTest, WholeInputAtOnce) {
+  std::string input = BuildInput();
+  std::string compressed = GzipCompress(input);
+  EXPECT_EQ(Inflate(compressed, GetParam(), compressed.size()), input);
+}
+
+TEST_P(GzipTraceParserTest, SmallChunks) {
+  std::string input = BuildInput();
+  std::string compressed = GzipCompress(input);
+  EXPECT_EQ(Inflate(compressed, GetParam(), 64 * 1024), input);
+}
+
+TEST_P(GzipTraceParserTest, PartialInput) {
+  std::string compressed = GzipCompress(BuildInput());
+  std::string output;
+  GzipTraceParser parser(std::unique_ptr<ChunkedTraceReader>(
+                             new CollectingReader(&output)),
+                         GetParam());
+  ASSERT_TRUE(parser
+                  .ParseUnowned(
+                      reinterpret_cast<const uint8_t*>(compressed.data()),
+                      compressed.size() / 2)
+                  .ok());
+  EXPECT_TRUE(parser.needs_more_input());
+}
+
+TEST_P(GzipTraceParserTest, CorruptInput) {
+  std::string compressed = GzipCompress(BuildInput());
+  compressed[compressed.size() / 2] ^= 0xff;
+  std::string output;
+  GzipTraceParser parser(std::unique_ptr<ChunkedTraceReader>(
+                             new CollectingReader(&output)),
+                         GetParam());
+  EXPECT_FALSE(
+      parser
+          .ParseUnowned(reinterpret_cast<const uint8_t*>(compressed.data()),
+                        compressed.size())
+          .ok());
+}
+
+INSTANTIATE_TEST_SUITE_P(InflateModes,
+                         GzipTraceParserTest,
+                         testing::Values(InflateMode::kInline,
+                                         InflateMode::kBackground));
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
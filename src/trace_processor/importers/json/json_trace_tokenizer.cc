@@ -16,10 +16,14 @@
 
 #include "src/trace_processor/importers/json/json_trace_tokenizer.h"
 
+#include <algorithm>
+#include <cstring>
 #include <memory>
 
 #include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/json/json_utils.h"
@@ -27,11 +31,224 @@
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/util/status_macros.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_X64_CPU_OPT)
+#include <immintrin.h>
+#define PERFETTO_TP_JSON_SCAN_AVX2() 1
+#else
+#define PERFETTO_TP_JSON_SCAN_AVX2() 0
+#endif
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ARCH_CPU_ARM64) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define PERFETTO_TP_JSON_SCAN_NEON() 1
+#else
+#define PERFETTO_TP_JSON_SCAN_NEON() 0
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 
 namespace {
 
+constexpr size_t kBlockSize = 64;
+
+// Bitmasks of the characters of interest in a block of kBlockSize bytes: bit
+// i is set iff the i-th byte of the block is one of those characters.
+struct BlockMasks {
+  uint64_t quote;
+  uint64_t backslash;
+  // { and [.
+  uint64_t open;
+  // } and ].
+  uint64_t close;
+};
+
+#if PERFETTO_TP_JSON_SCAN_AVX2()
+
+PERFETTO_ALWAYS_INLINE uint64_t MatchAvx2(__m256i lo, __m256i hi, char c) {
+  const __m256i v = _mm256_set1_epi8(c);
+  auto lo_bits = static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, v)));
+  auto hi_bits = static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, v)));
+  return static_cast<uint64_t>(lo_bits) | static_cast<uint64_t>(hi_bits) << 32;
+}
+
+PERFETTO_ALWAYS_INLINE BlockMasks ClassifyBlock(const char* block) {
+  __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  __m256i hi =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 32));
+  BlockMasks masks;
+  masks.quote = MatchAvx2(lo, hi, '"');
+  masks.backslash = MatchAvx2(lo, hi, '\\');
+  masks.open = MatchAvx2(lo, hi, '{') | MatchAvx2(lo, hi, '[');
+  masks.close = MatchAvx2(lo, hi, '}') | MatchAvx2(lo, hi, ']');
+  return masks;
+}
+
+#elif PERFETTO_TP_JSON_SCAN_NEON()
+
+// Packs the lanes of a 16 x 8-bit comparison mask into the low 16 bits.
+PERFETTO_ALWAYS_INLINE uint64_t PackNeon(uint8x16_t m) {
+  static constexpr uint8_t kLaneBits[] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                          1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t bits = vandq_u8(m, vld1q_u8(kLaneBits));
+  return static_cast<uint64_t>(vaddv_u8(vget_low_u8(bits))) |
+         static_cast<uint64_t>(vaddv_u8(vget_high_u8(bits))) << 8;
+}
+
+PERFETTO_ALWAYS_INLINE uint64_t MatchNeon(const uint8x16_t* data, char c) {
+  const uint8x16_t v = vdupq_n_u8(static_cast<uint8_t>(c));
+  uint64_t word = 0;
+  for (uint32_t i = 0; i < 4; ++i)
+    word |= PackNeon(vceqq_u8(data[i], v)) << (i * 16);
+  return word;
+}
+
+PERFETTO_ALWAYS_INLINE BlockMasks ClassifyBlock(const char* block) {
+  uint8x16_t data[4];
+  for (uint32_t i = 0; i < 4; ++i)
+    data[i] = vld1q_u8(reinterpret_cast<const uint8_t*>(block + i * 16));
+  BlockMasks masks;
+  masks.quote = MatchNeon(data, '"');
+  masks.backslash = MatchNeon(data, '\\');
+  masks.open = MatchNeon(data, '{') | MatchNeon(data, '[');
+  masks.close = MatchNeon(data, '}') | MatchNeon(data, ']');
+  return masks;
+}
+
+#else
+
+PERFETTO_ALWAYS_INLINE BlockMasks ClassifyBlock(const char* block) {
+  BlockMasks masks{0, 0, 0, 0};
+  for (uint32_t i = 0; i < kBlockSize; ++i) {
+    char c = block[i];
+    uint64_t bit = uint64_t(1) << i;
+    masks.quote |= c == '"' ? bit : 0;
+    masks.backslash |= c == '\\' ? bit : 0;
+    masks.open |= c == '{' || c == '[' ? bit : 0;
+    masks.close |= c == '}' || c == ']' ? bit : 0;
+  }
+  return masks;
+}
+
+#endif
+
+// Returns a mask with bit i set iff an odd number of bits are set in
+// [0, i] in |x|.
+PERFETTO_ALWAYS_INLINE uint64_t PrefixXor(uint64_t x) {
+  x ^= x << 1;
+  x ^= x << 2;
+  x ^= x << 4;
+  x ^= x << 8;
+  x ^= x << 16;
+  x ^= x << 32;
+  return x;
+}
+
+// Finds the brackets of a JSON text which are outside of strings, one block
+// at a time, in the style of simdjson's structural index: the unescaped
+// quotes of a block are turned into a mask of the bytes inside strings with a
+// prefix xor, which is then used to filter out the brackets in strings.
+// The state carried across blocks allows scanning texts of any length.
+class JsonStructuralScanner {
+ public:
+  // Returns the mask of the brackets outside of strings among the |len| (at
+  // most kBlockSize) bytes at |block|.
+  PERFETTO_ALWAYS_INLINE uint64_t NextBlock(const char* block, size_t len) {
+    BlockMasks masks;
+    if (PERFETTO_LIKELY(len == kBlockSize)) {
+      masks = ClassifyBlock(block);
+    } else {
+      // Pad the tail of the input with spaces, which are not interesting.
+      char padded[kBlockSize];
+      memset(padded, ' ', kBlockSize);
+      memcpy(padded, block, len);
+      masks = ClassifyBlock(padded);
+    }
+    uint64_t quotes = masks.quote & ~EscapedChars(masks.backslash);
+    uint64_t strings = PrefixXor(quotes) ^ (in_string_ ? ~uint64_t(0) : 0);
+    in_string_ = strings >> 63;
+    return (masks.open | masks.close) & ~strings;
+  }
+
+ private:
+  // Returns the mask of the characters escaped by a backslash. Backslashes are
+  // rare in traces so, unlike simdjson, this walks them one by one rather than
+  // using carry propagation tricks.
+  PERFETTO_ALWAYS_INLINE uint64_t EscapedChars(uint64_t backslash) {
+    uint64_t escaped = escape_next_block_ ? 1 : 0;
+    escape_next_block_ = false;
+    // An escaped backslash does not escape the character following it.
+    uint64_t escapes = backslash & ~escaped;
+    while (escapes) {
+      auto i = static_cast<uint32_t>(__builtin_ctzll(escapes));
+      if (i == kBlockSize - 1) {
+        escape_next_block_ = true;
+        break;
+      }
+      uint64_t next = uint64_t(1) << (i + 1);
+      escaped |= next;
+      escapes &= ~(next | (uint64_t(1) << i));
+    }
+    return escaped;
+  }
+
+  bool in_string_ = false;
+  bool escape_next_block_ = false;
+};
+
+// Returns the end of the object or array starting at |start|, or nullptr if
+// it's incomplete.
+const char* FindEndOfJsonContainer(const char* start, const char* end) {
+  PERFETTO_DCHECK(*start == '{' || *start == '[');
+  JsonStructuralScanner scanner;
+  uint32_t depth = 0;
+  for (const char* block = start; block < end; block += kBlockSize) {
+    size_t len = std::min(kBlockSize, static_cast<size_t>(end - block));
+    for (uint64_t structurals = scanner.NextBlock(block, len); structurals;
+         structurals &= structurals - 1) {
+      const char* s = block + __builtin_ctzll(structurals);
+      if (*s == '{' || *s == '[') {
+        depth++;
+      } else if (--depth == 0) {
+        return s + 1;
+      }
+    }
+  }
+  return nullptr;
+}
+
+// Reads the string starting at |*s| without unescaping it and moves |*s| past
+// its closing quote.
+bool ReadRawJsonString(const char** s,
+                       const char* end,
+                       base::StringView* value) {
+  PERFETTO_DCHECK(**s == '"');
+  const char* begin = *s + 1;
+  for (const char* p = begin; p < end; ++p) {
+    p = static_cast<const char*>(memchr(p, '"', static_cast<size_t>(end - p)));
+    if (!p)
+      return false;
+    // The quote is escaped iff it follows an odd number of backslashes.
+    size_t backslashes = 0;
+    for (const char* b = p; b > begin && b[-1] == '\\'; --b)
+      backslashes++;
+    if (backslashes % 2 == 0) {
+      *value = base::StringView(begin, static_cast<size_t>(p - begin));
+      *s = p + 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+const char* SkipJsonWhitespace(const char* s, const char* end) {
+  while (s < end && isspace(*s))
+    s++;
+  return s;
+}
+
 base::Status AppendUnescapedCharacter(char c,
                                       bool is_escaping,
                                       std::string* key) {
@@ -184,44 +401,33 @@ ReadDictRes ReadOneJsonDict(const char* start,
   int braces = 0;
   int square_brackets = 0;
   const char* dict_begin = nullptr;
-  bool in_string = false;
-  bool is_escaping = false;
-  for (const char* s = start; s < end; s++) {
-    if (isspace(*s) || *s == ',')
-      continue;
-    if (*s == '"' && !is_escaping) {
-      in_string = !in_string;
-      continue;
-    }
-    if (in_string) {
-      // If we're in a string and we see a backslash and the last character was
-      // not a backslash the next character is escaped:
-      is_escaping = *s == '\\' && !is_escaping;
-      // If we're currently parsing a string we should ignore otherwise special
-      // characters:
-      continue;
-    }
-    if (*s == '{') {
-      if (braces == 0)
-        dict_begin = s;
-      braces++;
-      continue;
-    }
-    if (*s == '}') {
-      if (braces <= 0)
-        return ReadDictRes::kEndOfTrace;
-      if (--braces > 0)
+  JsonStructuralScanner scanner;
+  for (const char* block = start; block < end; block += kBlockSize) {
+    size_t len = std::min(kBlockSize, static_cast<size_t>(end - block));
+    for (uint64_t structurals = scanner.NextBlock(block, len); structurals;
+         structurals &= structurals - 1) {
+      const char* s = block + __builtin_ctzll(structurals);
+      if (*s == '{') {
+        if (braces == 0)
+          dict_begin = s;
+        braces++;
         continue;
-      size_t len = static_cast<size_t>((s + 1) - dict_begin);
-      *value = base::StringView(dict_begin, len);
-      *next = s + 1;
-      return ReadDictRes::kFoundDict;
-    }
-    if (*s == '[') {
-      square_brackets++;
-      continue;
-    }
-    if (*s == ']') {
+      }
+      if (*s == '}') {
+        if (braces <= 0)
+          return ReadDictRes::kEndOfTrace;
+        if (--braces > 0)
+          continue;
+        size_t dict_len = static_cast<size_t>((s + 1) - dict_begin);
+        *value = base::StringView(dict_begin, dict_len);
+        *next = s + 1;
+        return ReadDictRes::kFoundDict;
+      }
+      if (*s == '[') {
+        square_brackets++;
+        continue;
+      }
+      PERFETTO_DCHECK(*s == ']');
       if (square_brackets == 0) {
         // We've reached the end of [traceEvents] array.
         // There might be other top level keys in the json (e.g. metadata)
@@ -402,6 +608,76 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
   return base::OkStatus();
 }
 
+base::Status ExtractValuesForJsonKeys(base::StringView dict,
+                                      const base::StringView* keys,
+                                      size_t key_count,
+                                      std::optional<base::StringView>* values) {
+  const char* s = dict.data();
+  const char* end = dict.data() + dict.size();
+  for (size_t i = 0; i < key_count; ++i)
+    values[i] = std::nullopt;
+
+  s = SkipJsonWhitespace(s, end);
+  if (s == end || *s != '{')
+    return base::ErrStatus("Unexpected character before JSON dict");
+  s++;
+
+  size_t found = 0;
+  while (found < key_count) {
+    s = SkipJsonWhitespace(s, end);
+    if (s == end)
+      return base::ErrStatus("Failure parsing JSON: malformed dictionary");
+    if (*s == '}')
+      break;
+    if (*s == ',') {
+      s++;
+      continue;
+    }
+
+    base::StringView key;
+    if (*s != '"' || !ReadRawJsonString(&s, end, &key)) {
+      return base::ErrStatus(
+          "Failure parsing JSON: encountered fatal error while parsing key for "
+          "value");
+    }
+    s = SkipJsonWhitespace(s, end);
+    if (s == end || *s != ':')
+      return base::ErrStatus("Failure parsing JSON: expected ':' after key");
+    s = SkipJsonWhitespace(s + 1, end);
+    if (s == end)
+      return base::ErrStatus("Failure parsing JSON: partial JSON dictionary");
+
+    base::StringView value;
+    if (*s == '"') {
+      if (!ReadRawJsonString(&s, end, &value))
+        return base::ErrStatus("Failure parsing JSON: unable to parse string");
+    } else if (*s == '{' || *s == '[') {
+      const char* value_end = FindEndOfJsonContainer(s, end);
+      if (!value_end) {
+        return base::ErrStatus(
+            "Failure parsing JSON: unable to parse dictionary or array");
+      }
+      value = base::StringView(s, static_cast<size_t>(value_end - s));
+      s = value_end;
+    } else {
+      const char* value_start = s;
+      while (s < end && *s != ',' && *s != '}' && !isspace(*s))
+        s++;
+      value = base::StringView(value_start,
+                               static_cast<size_t>(s - value_start));
+    }
+
+    for (size_t i = 0; i < key_count; ++i) {
+      if (!values[i] && keys[i] == key) {
+        values[i] = value;
+        found++;
+        break;
+      }
+    }
+  }
+  return base::OkStatus();
+}
+
 ReadSystemLineRes ReadOneSystemTraceLine(const char* start,
                                          const char* end,
                                          std::string* line,
@@ -531,17 +807,22 @@ base::Status JsonTraceTokenizer::HandleTraceEvent(const char* start,
         break;
     }
 
-    std::optional<std::string> opt_raw_ts;
-    RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ts", &opt_raw_ts));
+    // Only the fields needed to sort the event are extracted here: the
+    // parser decodes the rest.
+    base::StringView keys[] = {"ts", "ph"};
+    std::optional<base::StringView> values[base::ArraySize(keys)];
+    RETURN_IF_ERROR(ExtractValuesForJsonKeys(unparsed, keys,
+                                             base::ArraySize(keys), values));
+    const std::optional<base::StringView>& opt_raw_ts = values[0];
+    const std::optional<base::StringView>& opt_raw_ph = values[1];
     std::optional<int64_t> opt_ts =
-        opt_raw_ts ? json::CoerceToTs(*opt_raw_ts) : std::nullopt;
+        opt_raw_ts ? json::CoerceToTs(opt_raw_ts->ToStdString())
+                   : std::nullopt;
     int64_t ts = 0;
     if (opt_ts.has_value()) {
       ts = opt_ts.value();
     } else {
       // Metadata events may omit ts. In all other cases error:
-      std::optional<std::string> opt_raw_ph;
-      RETURN_IF_ERROR(ExtractValueForJsonKey(unparsed, "ph", &opt_raw_ph));
       if (!opt_raw_ph || *opt_raw_ph != "M") {
         context_->storage->IncrementStats(stats::json_tokenizer_failure);
         continue;
@@ -660,7 +941,8 @@ base::Status JsonTraceTokenizer::HandleSystemTraceEvent(const char* start,
       continue;
 
     SystraceLine line;
-    RETURN_IF_ERROR(systrace_line_tokenizer_.Tokenize(raw_line, &line));
+    RETURN_IF_ERROR(
+        systrace_line_tokenizer_.Tokenize(base::StringView(raw_line), &line));
     context_->sorter->PushSystraceLine(std::move(line));
   }
   return SetOutAndReturn(next, out);
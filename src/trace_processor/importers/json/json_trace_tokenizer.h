@@ -19,6 +19,12 @@
 
 #include <stdint.h>
 
+#include <cstddef>
+#include <optional>
+#include <string>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/string_view.h"
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -45,6 +51,9 @@ enum class ReadDictRes {
 // This is to avoid decoding the full trace in memory and reduce heap traffic.
 // E.g.  input:  { a:1 b:{ c:2, d:{ e:3 } } } , { a:4, ... },
 //       output: [   only this is parsed    ] ^return value points here.
+// The input is scanned 64 bytes at a time, building bitmasks of the quotes
+// and brackets of each block (with SIMD where available) so that only the
+// brackets outside of strings are visited one by one.
 // Visible for testing.
 ReadDictRes ReadOneJsonDict(const char* start,
                             const char* end,
@@ -81,6 +90,17 @@ base::Status ExtractValueForJsonKey(base::StringView dict,
                                     const std::string& key,
                                     std::optional<std::string>* value);
 
+// Same as ExtractValueForJsonKey but looks up |key_count| keys in a single
+// pass over |dict|, stopping as soon as all of them are found, and without
+// copying: |values[i]| is set to the value of |keys[i]| and points into
+// |dict|. String values are stripped of their quotes but not unescaped. Any
+// kind of value (including arrays) is supported.
+// Visible for testing.
+base::Status ExtractValuesForJsonKeys(base::StringView dict,
+                                      const base::StringView* keys,
+                                      size_t key_count,
+                                      std::optional<base::StringView>* values);
+
 enum class ReadSystemLineRes {
   kFoundLine,
   kNeedsMoreData,
@@ -18,6 +18,7 @@
 
 #include <json/value.h>
 
+#include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/importers/json/json_utils.h"
 #include "test/gtest_and_gmock.h"
 
@@ -85,6 +86,32 @@ TEST(JsonTraceTokenizerTest, ReadDictNeedMoreData) {
   ASSERT_EQ(next, nullptr);
 }
 
+TEST(JsonTraceTokenizerTest, ReadDictLongStrings) {
+  // Strings spanning several 64 byte blocks, with escaped quotes and
+  // backslashes (including runs crossing block boundaries) and brackets.
+  std::string str;
+  for (int i = 0; i < 40; ++i)
+    str += i % 3 ? R"(}\"]\\)" : R"(\\\\\\\"{[)";
+  std::string trace = R"({"foo": ")" + str + R"(", "bar": [1, {"baz": 2}]},)" +
+                      R"({"foo": 1}])";
+  const char* start = trace.data();
+  const char* end = start + trace.size();
+  const char* next = nullptr;
+  base::StringView value;
+
+  ASSERT_EQ(ReadOneJsonDict(start, end, &value, &next),
+            ReadDictRes::kFoundDict);
+  Json::Value parsed = *json::ParseJsonString(value);
+  ASSERT_EQ(parsed["bar"][1]["baz"].asInt(), 2);
+
+  ASSERT_EQ(ReadOneJsonDict(next, end, &value, &next),
+            ReadDictRes::kFoundDict);
+  ASSERT_EQ(value, R"({"foo": 1})");
+  ASSERT_EQ(ReadOneJsonDict(next, end, &value, &next),
+            ReadDictRes::kEndOfArray);
+  ASSERT_EQ(next, end);
+}
+
 TEST(JsonTraceTokenizerTest, ReadKeyIntValue) {
   const char* start = R"("Test": 01234, )";
   const char* middle = start + strlen(R"("Test": )");
@@ -272,6 +299,26 @@ TEST(JsonTraceTokenizerTest, ExtractValueForJsonKey) {
   ASSERT_EQ(*line, R"({"ts": 149029, "foo": "bar"})");
 }
 
+TEST(JsonTraceTokenizerTest, ExtractValuesForJsonKeys) {
+  base::StringView keys[] = {"ts", "ph", "args", "missing"};
+  std::optional<base::StringView> values[base::ArraySize(keys)];
+
+  ASSERT_TRUE(ExtractValuesForJsonKeys(R"({
+    "name": "a\"b}", "array": [1, "]", {"ts": 1}],
+    "args": {"x": [2, 3]}, "ph" : "X", "ts": 149029.5
+  })",
+                                       keys, base::ArraySize(keys), values)
+                  .ok());
+  ASSERT_EQ(*values[0], "149029.5");
+  ASSERT_EQ(*values[1], "X");
+  ASSERT_EQ(*values[2], R"({"x": [2, 3]})");
+  ASSERT_FALSE(values[3].has_value());
+
+  ASSERT_FALSE(ExtractValuesForJsonKeys(R"({"ts": [1, 2)", keys,
+                                        base::ArraySize(keys), values)
+                   .ok());
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -16,14 +16,17 @@
 
 #include "src/trace_processor/importers/perf/perf_data_parser.h"
 
+#include <cinttypes>
 #include <optional>
-#include <string>
+#include <utility>
 #include <vector>
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/mapping_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
+#include "src/trace_processor/importers/common/stack_profile_tracker.h"
+#include "src/trace_processor/importers/common/virtual_memory_mapping.h"
 #include "src/trace_processor/importers/perf/perf_data_reader.h"
 #include "src/trace_processor/importers/perf/perf_data_tracker.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -33,9 +36,6 @@ namespace perfetto {
 namespace trace_processor {
 namespace perf_importer {
 
-using FramesTable = tables::StackProfileFrameTable;
-using CallsitesTable = tables::StackProfileCallsiteTable;
-
 PerfDataParser::PerfDataParser(TraceProcessorContext* context)
     : context_(context), tracker_(PerfDataTracker::GetOrCreate(context_)) {}
 
@@ -71,7 +71,10 @@ void PerfDataParser::ParsePerfRecord(int64_t ts, TraceBlobView tbv) {
     return;
   }
 
-  std::vector<FramesTable::Row> frame_rows;
+  // Resolve all the frames before interning any of them, as nothing should be
+  // added if the mapping couldn't be found for one of them.
+  std::vector<std::pair<UserMemoryMapping*, uint64_t>> frames;
+  frames.reserve(sample.callchain.size() - 1);
   for (uint32_t i = 1; i < sample.callchain.size(); i++) {
     UserMemoryMapping* mapping =
         context_->mapping_tracker->FindUserMappingForAddress(
@@ -80,37 +83,21 @@ void PerfDataParser::ParsePerfRecord(int64_t ts, TraceBlobView tbv) {
       context_->storage->IncrementStats(stats::perf_samples_skipped);
       return;
     }
-    FramesTable::Row new_row;
-    std::string mock_name =
-        base::StackString<1024>(
-            "%" PRIu64, sample.callchain[i] - mapping->memory_range().start())
-            .ToStdString();
-    new_row.name = context_->storage->InternString(mock_name.c_str());
-    new_row.mapping = mapping->mapping_id();
-    new_row.rel_pc =
-        static_cast<int64_t>(mapping->ToRelativePc(sample.callchain[i]));
-    frame_rows.push_back(new_row);
-  }
-
-  // Insert frames. We couldn't do it before as no frames should be added if the
-  // mapping couldn't be found for any of them.
-  const auto& frames = context_->storage->mutable_stack_profile_frame_table();
-  std::vector<FramesTable::Id> frame_ids;
-  for (const auto& row : frame_rows) {
-    frame_ids.push_back(frames->Insert(row).id);
+    frames.emplace_back(mapping, sample.callchain[i]);
   }
 
-  // Insert callsites.
-  const auto& callsites =
-      context_->storage->mutable_stack_profile_callsite_table();
-
-  std::optional<CallsitesTable::Id> parent_callsite_id;
-  for (uint32_t i = 0; i < frame_ids.size(); i++) {
-    CallsitesTable::Row callsite_row;
-    callsite_row.frame_id = frame_ids[i];
-    callsite_row.depth = i;
-    callsite_row.parent_id = parent_callsite_id;
-    parent_callsite_id = callsites->Insert(callsite_row).id;
+  // Frames and callsites are interned, so that the samples with the same
+  // callchain share their rows rather than adding new ones for each sample.
+  std::optional<CallsiteId> parent_callsite_id;
+  for (uint32_t i = 0; i < frames.size(); i++) {
+    UserMemoryMapping* mapping = frames[i].first;
+    uint64_t address = frames[i].second;
+    base::StackString<1024> mock_name(
+        "%" PRIu64, address - mapping->memory_range().start());
+    FrameId frame_id = mapping->InternFrame(mapping->ToRelativePc(address),
+                                            mock_name.string_view());
+    parent_callsite_id = context_->stack_profile_tracker->InternCallsite(
+        parent_callsite_id, frame_id, i);
   }
 
   // Insert stack sample.
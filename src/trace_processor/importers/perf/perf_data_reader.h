@@ -21,6 +21,7 @@
 #include <cstddef>
 #include <cstring>
 #include <optional>
+#include <utility>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -75,7 +76,17 @@ class PerfDataReader {
   // NOTE: Assumes count of bytes available is higher than sizeof(T).
   template <typename T>
   void ReadVector(std::vector<T>& vec) {
-    PERFETTO_DCHECK(CanReadSize(sizeof(T) * vec.size()));
+    size_t size = sizeof(T) * vec.size();
+    PERFETTO_DCHECK(CanReadSize(size));
+    if (vec.empty()) {
+      return;
+    }
+    // Read from blob in one go (e.g. the callchain of a sample).
+    if (PERFETTO_LIKELY(BytesInBuffer() == 0)) {
+      memcpy(vec.data(), tbv_.data() + blob_offset_, size);
+      Skip(size);
+      return;
+    }
     for (T& val : vec) {
       Read(val);
     }
@@ -152,6 +163,15 @@ class PerfDataReader {
 
   uint64_t current_file_offset() const { return file_offset_; }
 
+  // Gives back the TraceBlobView the reader was created with, so that it can be
+  // reused once read (e.g. when reading on another thread, as the refcount of
+  // TraceBlob is not thread-safe and TraceBlobViews can't be copied there).
+  // NOTE: Assumes nothing has been appended to the reader.
+  TraceBlobView ReleaseTraceBlobView() {
+    PERFETTO_DCHECK(buffer_.empty());
+    return std::move(tbv_);
+  }
+
  private:
   void SkipSlow(size_t bytes_to_skip);
 
@@ -112,6 +112,19 @@ TEST(PerfDataReaderUnittest, ReadVector) {
   EXPECT_EQ(res, valid);
 }
 
+TEST(PerfDataReaderUnittest, ReadVectorBetweenBufferAndBlob) {
+  TraceBlobView tbv = TraceBlobViewFromVector(std::vector<uint64_t>{2, 4});
+  PerfDataReader reader(std::move(tbv));
+  reader.Append(TraceBlobViewFromVector(std::vector<uint64_t>{8, 16}));
+
+  std::vector<uint64_t> res(3);
+  reader.ReadVector(res);
+
+  std::vector<uint64_t> valid{2, 4, 8};
+  EXPECT_EQ(res, valid);
+  EXPECT_EQ(reader.current_file_offset(), sizeof(uint64_t) * 3);
+}
+
 TEST(PerfDataReaderUnittest, Skip) {
   TraceBlobView tbv = TraceBlobViewFromVector(std::vector<uint64_t>{2, 4, 8});
   PerfDataReader reader(std::move(tbv));
@@ -221,6 +234,18 @@ TEST(PerfDataReaderUnittest, GetTraceBlobViewFromBetweenBufferAndBlob) {
   EXPECT_FALSE(new_reader.CanReadSize(sizeof(uint64_t) * 4));
 }
 
+TEST(PerfDataReaderUnittest, ReleaseTraceBlobView) {
+  TraceBlobView tbv = TraceBlobViewFromVector(std::vector<uint64_t>{2, 4, 8});
+  const uint8_t* data = tbv.data();
+  PerfDataReader reader(std::move(tbv));
+  uint64_t val;
+  reader.Read(val);
+
+  TraceBlobView released = reader.ReleaseTraceBlobView();
+  EXPECT_EQ(released.data(), data);
+  EXPECT_EQ(released.size(), sizeof(uint64_t) * 3);
+}
+
 TEST(PerfDataReaderUnittest, CanAccessFileRange) {
   TraceBlobView tbv = TraceBlobViewFromVector(std::vector<uint64_t>{2, 4, 8});
   PerfDataReader reader(std::move(tbv));
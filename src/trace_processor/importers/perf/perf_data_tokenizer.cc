@@ -16,13 +16,19 @@
 
 #include "src/trace_processor/importers/perf/perf_data_tokenizer.h"
 
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
+#include <optional>
+#include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/perf/perf_data_reader.h"
@@ -107,10 +113,13 @@ base::Status PerfDataTokenizer::Parse(TraceBlobView blob) {
       return base::OkStatus();
   }
 
+  // All the records available are split out of the chunk first, so that their
+  // samples can be parsed in parallel. They are then handled in file order.
+  std::vector<Record> records;
   while (reader_.current_file_offset() < header_.data.end()) {
     // Make sure |perf_event_header| of the sample is available.
     if (!reader_.CanReadSize(sizeof(perf_event_header))) {
-      return base::OkStatus();
+      break;
     }
 
     perf_event_header ev_header;
@@ -118,44 +127,95 @@ base::Status PerfDataTokenizer::Parse(TraceBlobView blob) {
     PERFETTO_CHECK(ev_header.size >= sizeof(perf_event_header));
 
     if (!reader_.CanReadSize(ev_header.size)) {
-      return base::OkStatus();
+      break;
     }
 
     reader_.Skip<perf_event_header>();
-    uint64_t record_offset = reader_.current_file_offset();
     uint64_t record_size = ev_header.size - sizeof(perf_event_header);
+    if (ev_header.type == PERF_RECORD_SAMPLE ||
+        ev_header.type == PERF_RECORD_MMAP2) {
+      records.push_back(
+          {ev_header, reader_.PeekTraceBlobView(record_size), std::nullopt});
+    }
+    reader_.Skip(record_size);
+  }
+
+  ParseSamples(records);
+  for (Record& record : records) {
+    RETURN_IF_ERROR(PushRecord(std::move(record)));
+  }
+  return base::OkStatus();
+}
+
+void PerfDataTokenizer::ParseSamples(std::vector<Record>& records) {
+  std::vector<Record*> samples;
+  for (Record& record : records) {
+    if (record.header.type == PERF_RECORD_SAMPLE) {
+      samples.push_back(&record);
+    }
+  }
 
-    switch (ev_header.type) {
-      case PERF_RECORD_SAMPLE: {
-        TraceBlobView tbv = reader_.PeekTraceBlobView(record_size);
-        auto sample_status = tracker_->ParseSample(reader_);
-        if (!sample_status.ok()) {
-          continue;
-        }
-        PerfDataTracker::PerfSample sample = *sample_status;
-        if (!ValidateSample(*sample_status)) {
-          continue;
-        }
-        context_->sorter->PushPerfRecord(
-            static_cast<int64_t>(*sample_status->ts), std::move(tbv));
+  // The reader takes the data of the record and gives it back, as
+  // TraceBlobViews must not be copied or destroyed on other threads.
+  const PerfDataTracker* tracker = tracker_;
+  auto parse_shard = [tracker, &samples](size_t shard, size_t shard_count) {
+    for (size_t i = shard; i < samples.size(); i += shard_count) {
+      PerfDataReader reader(std::move(samples[i]->data));
+      samples[i]->sample = tracker->ParseSample(reader);
+      samples[i]->data = reader.ReleaseTraceBlobView();
+    }
+  };
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  const uint32_t thread_count = context_->config.tokenizer_thread_count;
+  if (thread_count > 1 && samples.size() > 1) {
+    if (!records_pool_) {
+      records_pool_.reset(new base::ThreadPool(thread_count));
+    }
+    const size_t shard_count =
+        std::min(samples.size(), static_cast<size_t>(thread_count));
+    base::WaitableEvent all_done;
+    for (size_t shard = 0; shard < shard_count; ++shard) {
+      records_pool_->PostTask([&parse_shard, &all_done, shard, shard_count] {
+        parse_shard(shard, shard_count);
+        all_done.Notify();
+      });
+    }
+    all_done.Wait(shard_count);
+    return;
+  }
+#endif
+  parse_shard(0, 1);
+}
+
+base::Status PerfDataTokenizer::PushRecord(Record record) {
+  switch (record.header.type) {
+    case PERF_RECORD_SAMPLE: {
+      PERFETTO_DCHECK(record.sample.has_value());
+      if (!record.sample->ok()) {
+        context_->storage->IncrementStats(stats::perf_samples_skipped);
         break;
       }
-      case PERF_RECORD_MMAP2: {
-        PERFETTO_CHECK(ev_header.size >=
-                       sizeof(PerfDataTracker::Mmap2Record::Numeric));
-        auto record = ParseMmap2Record(record_size);
-        RETURN_IF_ERROR(record.status());
-        record->cpu_mode = GetCpuMode(ev_header);
-        tracker_->PushMmap2Record(*record);
+      if (!ValidateSample(**record.sample)) {
         break;
       }
-      default:
-        break;
+      context_->sorter->PushPerfRecord(
+          static_cast<int64_t>(*(*record.sample)->ts), std::move(record.data));
+      break;
     }
-
-    reader_.Skip((record_offset + record_size) - reader_.current_file_offset());
+    case PERF_RECORD_MMAP2: {
+      PERFETTO_CHECK(record.data.size() >=
+                     sizeof(PerfDataTracker::Mmap2Record::Numeric));
+      auto mmap2 = ParseMmap2Record(std::move(record.data));
+      RETURN_IF_ERROR(mmap2.status());
+      mmap2->cpu_mode = GetCpuMode(record.header);
+      tracker_->PushMmap2Record(*mmap2);
+      break;
+    }
+    default:
+      break;
   }
-
   return base::OkStatus();
 }
 
@@ -265,20 +325,20 @@ PerfDataTokenizer::ParseAttrIdsFromBuffer() {
 }
 
 base::StatusOr<PerfDataTracker::Mmap2Record>
-PerfDataTokenizer::ParseMmap2Record(uint64_t record_size) {
-  uint64_t start_offset = reader_.current_file_offset();
+PerfDataTokenizer::ParseMmap2Record(TraceBlobView data) {
+  size_t record_size = data.size();
+  PerfDataReader reader(std::move(data));
   PerfDataTracker::Mmap2Record record;
-  reader_.Read(record.num);
+  reader.Read(record.num);
   std::vector<char> filename_buffer(
-      static_cast<size_t>(record_size) -
-      sizeof(PerfDataTracker::Mmap2Record::Numeric));
-  reader_.ReadVector(filename_buffer);
-  if (filename_buffer.back() != '\0') {
+      record_size - sizeof(PerfDataTracker::Mmap2Record::Numeric));
+  reader.ReadVector(filename_buffer);
+  if (filename_buffer.empty() || filename_buffer.back() != '\0') {
     return base::ErrStatus(
         "Invalid MMAP2 record: filename is not null terminated.");
   }
   record.filename = std::string(filename_buffer.begin(), filename_buffer.end());
-  PERFETTO_CHECK(reader_.current_file_offset() == start_offset + record_size);
+  PERFETTO_CHECK(reader.current_file_offset() == record_size);
   return record;
 }
 
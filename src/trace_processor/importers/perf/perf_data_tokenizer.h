@@ -28,12 +28,19 @@
 
 #include <limits>
 #include <map>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
 namespace trace_processor {
 namespace perf_importer {
 
@@ -77,14 +84,27 @@ class PerfDataTokenizer : public ChunkedTraceReader {
   };
   enum class ParsingResult { NoSpace = 0, Success = 1 };
 
+  // A record of the data section, without its header. Samples are parsed
+  // (into |sample|) for all the records of a chunk at once.
+  struct Record {
+    perf_event_header header;
+    TraceBlobView data;
+    std::optional<base::StatusOr<PerfDataTracker::PerfSample>> sample;
+  };
+
   base::StatusOr<ParsingResult> ParseHeader();
   base::StatusOr<ParsingResult> ParseAfterHeaderBuffer();
   base::StatusOr<ParsingResult> ParseAttrs();
   base::StatusOr<ParsingResult> ParseAttrIds();
   base::StatusOr<ParsingResult> ParseAttrIdsFromBuffer();
 
+  // Parses the samples of |records|, on |records_pool_| if
+  // |Config::tokenizer_thread_count| > 1.
+  void ParseSamples(std::vector<Record>& records);
+  base::Status PushRecord(Record record);
+
   base::StatusOr<PerfDataTracker::Mmap2Record> ParseMmap2Record(
-      uint64_t record_size);
+      TraceBlobView data);
 
   bool ValidateSample(const PerfDataTracker::PerfSample&);
 
@@ -101,6 +121,9 @@ class PerfDataTokenizer : public ChunkedTraceReader {
   std::vector<uint8_t> after_header_buffer_;
 
   perf_importer::PerfDataReader reader_;
+
+  // Created on the first chunk of records parsed in parallel.
+  std::unique_ptr<base::ThreadPool> records_pool_;
 };
 
 }  // namespace perf_importer
@@ -76,16 +76,16 @@ uint64_t PerfDataTracker::ComputeCommonSampleType() {
   return common_sample_type_;
 }
 
-const perf_event_attr* PerfDataTracker::FindAttrWithId(uint64_t id) const {
-  for (const auto& attr_and_ids : attrs_) {
-    if (auto x =
-            std::find(attr_and_ids.ids.begin(), attr_and_ids.ids.end(), id);
-        x == attr_and_ids.ids.end()) {
-      continue;
-    }
-    return &attr_and_ids.attr;
+void PerfDataTracker::PushAttrAndIds(AttrAndIds data) {
+  for (uint64_t id : data.ids) {
+    attr_index_for_id_.Insert(id, attrs_.size());
   }
-  return nullptr;
+  attrs_.push_back(std::move(data));
+}
+
+const perf_event_attr* PerfDataTracker::FindAttrWithId(uint64_t id) const {
+  const size_t* index = attr_index_for_id_.Find(id);
+  return index ? &attrs_[*index].attr : nullptr;
 }
 
 void PerfDataTracker::PushMmap2Record(Mmap2Record record) {
@@ -101,7 +101,7 @@ void PerfDataTracker::PushMmap2Record(Mmap2Record record) {
 }
 
 base::StatusOr<PerfDataTracker::PerfSample> PerfDataTracker::ParseSample(
-    perfetto::trace_processor::perf_importer::PerfDataReader& reader) {
+    perfetto::trace_processor::perf_importer::PerfDataReader& reader) const {
   uint64_t sample_type = common_sample_type();
   PerfDataTracker::PerfSample sample;
 
@@ -156,7 +156,6 @@ base::StatusOr<PerfDataTracker::PerfSample> PerfDataTracker::ParseSample(
   // Ignored.
   // TODO(mayzner): Implement.
   if (sample_type & PERF_SAMPLE_READ) {
-    context_->storage->IncrementStats(stats::perf_samples_skipped);
     return base::ErrStatus("PERF_SAMPLE_READ is not supported");
   }
 
@@ -91,19 +91,23 @@ class PerfDataTracker : public Destructible {
 
   uint64_t ComputeCommonSampleType();
 
-  void PushAttrAndIds(AttrAndIds data) { attrs_.push_back(std::move(data)); }
+  void PushAttrAndIds(AttrAndIds data);
 
   void PushMmap2Record(Mmap2Record record);
 
-  uint64_t common_sample_type() { return common_sample_type_; }
+  uint64_t common_sample_type() const { return common_sample_type_; }
 
+  // Only reads the attrs, so it can be called from several threads at once
+  // once all the attrs have been pushed.
   base::StatusOr<PerfSample> ParseSample(
-      perfetto::trace_processor::perf_importer::PerfDataReader&);
+      perfetto::trace_processor::perf_importer::PerfDataReader&) const;
 
  private:
   const perf_event_attr* FindAttrWithId(uint64_t id) const;
   TraceProcessorContext* context_;
   std::vector<AttrAndIds> attrs_;
+  // Index in |attrs_| of the first attr with each id.
+  base::FlatHashMap<uint64_t, size_t> attr_index_for_id_;
 
   uint64_t common_sample_type_;
 };
@@ -237,6 +237,34 @@ TEST_F(PerfDataTrackerUnittest, ParseSampleWithId) {
   EXPECT_EQ(100u, parsed_sample->ts);
 }
 
+TEST_F(PerfDataTrackerUnittest, ParseSampleWithIdOfSecondAttr) {
+  PerfDataTracker* tracker = PerfDataTracker::GetOrCreate(&context_);
+
+  PerfDataTracker::AttrAndIds first;
+  first.attr.sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_CPU;
+  first.ids = {1, 2};
+  tracker->PushAttrAndIds(first);
+  PerfDataTracker::AttrAndIds second;
+  second.attr.sample_type = PERF_SAMPLE_IDENTIFIER | PERF_SAMPLE_TIME;
+  second.ids = {3, 4};
+  tracker->PushAttrAndIds(second);
+  tracker->ComputeCommonSampleType();
+
+  std::vector<uint64_t> sample{4, 100};
+  TraceBlob blob = TraceBlob::CopyFrom(sample.data(), sizeof(uint64_t) * 2);
+  PerfDataReader reader(TraceBlobView(std::move(blob)));
+
+  auto parsed_sample = tracker->ParseSample(reader);
+  ASSERT_TRUE(parsed_sample.ok());
+  EXPECT_EQ(parsed_sample->id, 4u);
+  EXPECT_EQ(parsed_sample->ts, 100u);
+
+  std::vector<uint64_t> unknown_id{5, 100};
+  blob = TraceBlob::CopyFrom(unknown_id.data(), sizeof(uint64_t) * 2);
+  PerfDataReader unknown_reader(TraceBlobView(std::move(blob)));
+  EXPECT_FALSE(tracker->ParseSample(unknown_reader).ok());
+}
+
 }  // namespace
 }  // namespace perf_importer
 }  // namespace trace_processor
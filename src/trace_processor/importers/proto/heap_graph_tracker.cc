@@ -18,10 +18,10 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cinttypes>
 #include <cstdint>
 #include <cstring>
-#include <deque>
 #include <map>
 #include <memory>
 #include <optional>
@@ -31,8 +31,11 @@
 #include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "protos/perfetto/trace/profiling/heap_graph.pbzero.h"
 #include "src/trace_processor/storage/stats.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -47,6 +50,10 @@ using ClassTable = tables::HeapGraphClassTable;
 using ObjectTable = tables::HeapGraphObjectTable;
 using ReferenceTable = tables::HeapGraphReferenceTable;
 
+// Number of objects of the frontier of the breadth-first search visited by
+// each task when computing reachability.
+constexpr size_t kReachabilityChunkSize = 4096;
+
 // Iterates all the references owned by the object `id`.
 //
 // Calls bool(*fn)(ObjectTable::RowReference) with the each row
@@ -61,13 +68,14 @@ void ForReferenceSet(TraceStorage* storage,
   if (!reference_set_id)
     return;
 
+  // The references of an object are inserted together (see AddObject), so the
+  // id of the set is the row of its first reference.
   auto* ref = storage->mutable_heap_graph_reference_table();
-  Query q;
-  q.constraints = {ref->reference_set_id().eq(*reference_set_id)};
-  auto it = ref->FilterToIterator(q);
-
-  for (; it; ++it) {
-    if (!fn(it.row_reference()))
+  for (uint32_t row = *reference_set_id;
+       row < ref->row_count() &&
+       ref->reference_set_id()[row] == *reference_set_id;
+       ++row) {
+    if (!fn(ReferenceTable::RowNumber(row).ToRowReference(ref)))
       break;
   }
 }
@@ -213,7 +221,8 @@ std::string DenormalizeTypeName(NormalizedType normalized,
   return result;
 }
 
-HeapGraphTracker::HeapGraphTracker(TraceStorage* storage)
+HeapGraphTracker::HeapGraphTracker(TraceStorage* storage,
+                                   uint32_t thread_count)
     : storage_(storage),
       cleaner_thunk_str_id_(storage_->InternString("sun.misc.Cleaner.thunk")),
       referent_str_id_(
@@ -236,6 +245,16 @@ HeapGraphTracker::HeapGraphTracker(TraceStorage* storage)
         base::StringView(protos::pbzero::HeapGraphType_Kind_Name(val));
     type_kind_string_ids_[i] = storage_->InternString(str_view);
   }
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  // The calling thread also visits objects so the pool only needs
+  // |thread_count - 1| threads.
+  if (thread_count > 1)
+    thread_pool_.reset(new base::ThreadPool(thread_count - 1));
+#else
+  base::ignore_result(thread_count);
+#endif
 }
 
 HeapGraphTracker::SequenceState& HeapGraphTracker::GetOrCreateSequence(
@@ -278,6 +297,12 @@ ObjectTable::RowReference HeapGraphTracker::GetOrInsertObject(
     bool inserted;
     std::tie(ptr, inserted) = sequence_state->object_id_to_db_row.Insert(
         object_id, id_and_row.row_number);
+
+    ObjectGraph& graph = sequence_state->graph;
+    uint32_t row = id_and_row.row_number.row_number();
+    if (graph.size() == 0)
+      graph.first_row = row;
+    graph.Grow(row + 1);
   }
   return ptr->ToRowReference(object_table);
 }
@@ -325,36 +350,46 @@ void HeapGraphTracker::AddObject(uint32_t seq_id,
 
   uint32_t reference_set_id =
       storage_->heap_graph_reference_table().row_count();
-  bool any_references = false;
+
+  ObjectGraph& graph = sequence_state.graph;
+  uint32_t owner_idx = graph.IndexOf(owner_row_ref.ToRowNumber());
+  uint32_t children_begin = static_cast<uint32_t>(graph.children.size());
 
   ObjectTable::Id owner_id = owner_row_ref.id();
+  reference_rows_.clear();
   for (size_t i = 0; i < obj.referred_objects.size(); ++i) {
     uint64_t owned_object_id = obj.referred_objects[i];
     // This is true for unset reference fields.
     std::optional<ObjectTable::RowReference> owned_row_ref;
     if (owned_object_id != 0)
       owned_row_ref = GetOrInsertObject(&sequence_state, owned_object_id);
-
-    auto ref_id_and_row =
-        storage_->mutable_heap_graph_reference_table()->Insert(
-            {reference_set_id,
-             owner_id,
-             owned_row_ref ? std::make_optional(owned_row_ref->id())
-                           : std::nullopt,
-             {},
-             {},
-             /*deobfuscated_field_name=*/std::nullopt});
-    if (!obj.field_name_ids.empty()) {
-      sequence_state.references_for_field_name_id[obj.field_name_ids[i]]
-          .push_back(ref_id_and_row.row_number);
-    }
-    any_references = true;
+    graph.children.push_back(
+        owned_row_ref ? graph.IndexOf(owned_row_ref->ToRowNumber())
+                      : ObjectGraph::kNoObject);
+
+    reference_rows_.emplace_back(
+        reference_set_id, owner_id,
+        owned_row_ref ? std::make_optional(owned_row_ref->id()) : std::nullopt,
+        StringId(), StringId(),
+        /*deobfuscated_field_name=*/std::nullopt);
   }
-  if (any_references) {
+  graph.children_begin[owner_idx] = children_begin;
+  graph.children_count[owner_idx] =
+      static_cast<uint32_t>(obj.referred_objects.size());
+  if (!reference_rows_.empty()) {
+    uint32_t first_row = storage_->mutable_heap_graph_reference_table()
+                             ->InsertBatch(reference_rows_)
+                             .row_number();
+    PERFETTO_DCHECK(first_row == reference_set_id);
     owner_row_ref.set_reference_set_id(reference_set_id);
     if (obj.field_name_ids.empty()) {
       sequence_state.deferred_reference_objects_for_type_[type_id].push_back(
           owner_row_ref.ToRowNumber());
+    } else {
+      for (uint32_t i = 0; i < reference_rows_.size(); ++i) {
+        sequence_state.references_for_field_name_id[obj.field_name_ids[i]]
+            .push_back(ReferenceTable::RowNumber(first_row + i));
+      }
     }
   }
 
@@ -461,6 +496,10 @@ void HeapGraphTracker::SetPacketIndex(uint32_t seq_id, uint64_t index) {
   sequence_state.prev_index = index;
 }
 
+void HeapGraphTracker::SetPartial(uint32_t seq_id) {
+  GetOrCreateSequence(seq_id).partial = true;
+}
+
 // This only works on Android S+ traces. We need to have ingested the whole
 // profile before calling this function (e.g. in FinalizeProfile).
 HeapGraphTracker::InternedType* HeapGraphTracker::GetSuperClass(
@@ -609,6 +648,15 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
         static_cast<int>(sequence_state.current_upid));
   }
 
+  if (sequence_state.partial) {
+    storage_->IncrementIndexedStats(
+        stats::heap_graph_partial_graph,
+        static_cast<int>(sequence_state.current_upid));
+    RemoveReferencesToMissingObjects(&sequence_state);
+  }
+  RemoveIgnoredReferences(&sequence_state);
+
+  std::vector<uint32_t> root_indices;
   for (const SourceRoot& root : sequence_state.current_roots) {
     for (uint64_t obj_id : root.object_ids) {
       auto ptr = sequence_state.object_id_to_db_row.Find(obj_id);
@@ -623,11 +671,16 @@ void HeapGraphTracker::FinalizeProfile(uint32_t seq_id) {
                             sequence_state.current_ts)]
           .emplace(*ptr);
       MarkRoot(row_ref, InternRootTypeString(root.root_type));
+      root_indices.push_back(sequence_state.graph.IndexOf(*ptr));
     }
   }
+  MarkReachable(sequence_state.graph, root_indices);
 
   PopulateSuperClasses(sequence_state);
   PopulateNativeSize(sequence_state);
+  graphs_[std::make_pair(sequence_state.current_upid,
+                         sequence_state.current_ts)] =
+      std::move(sequence_state.graph);
   sequence_state_.erase(seq_id);
 }
 
@@ -772,46 +825,137 @@ void HeapGraphTracker::PopulateSuperClasses(const SequenceState& seq) {
   }
 }
 
-void HeapGraphTracker::GetChildren(ObjectTable::RowReference object,
-                                   std::vector<ObjectTable::Id>& children) {
-  children.clear();
+void HeapGraphTracker::RemoveReferencesToMissingObjects(SequenceState* seq) {
+  // Objects which are only referenced get a self_size of -1 until they are
+  // added (see GetOrInsertObject).
+  const auto& objects_tbl = storage_->heap_graph_object_table();
+  ObjectGraph& graph = seq->graph;
+  for (uint32_t& child : graph.children) {
+    if (child != ObjectGraph::kNoObject &&
+        objects_tbl.self_size()[graph.RowOf(child).row_number()] == -1) {
+      child = ObjectGraph::kNoObject;
+    }
+  }
+}
 
-  auto cls_row_ref =
-      *storage_->heap_graph_class_table().FindById(object.type_id());
-
-  StringId kind = cls_row_ref.kind();
-
-  bool is_ignored_reference =
-      kind == InternTypeKindString(
-                  protos::pbzero::HeapGraphType::KIND_WEAK_REFERENCE) ||
-      kind == InternTypeKindString(
-                  protos::pbzero::HeapGraphType::KIND_SOFT_REFERENCE) ||
-      kind == InternTypeKindString(
-                  protos::pbzero::HeapGraphType::KIND_FINALIZER_REFERENCE) ||
-      kind == InternTypeKindString(
-                  protos::pbzero::HeapGraphType::KIND_PHANTOM_REFERENCE);
-
-  ForReferenceSet(
-      storage_, object,
-      [object, &children, is_ignored_reference,
-       this](ReferenceTable::RowReference ref) {
-        PERFETTO_CHECK(ref.owner_id() == object.id());
-        auto opt_owned = ref.owned_id();
-        if (!opt_owned) {
-          return true;
-        }
-        if (is_ignored_reference && ref.field_name() == referent_str_id_) {
-          // If `object` is a special reference kind, its
-          // "java.lang.ref.Reference.referent" field should be ignored.
-          return true;
+void HeapGraphTracker::RemoveIgnoredReferences(SequenceState* seq) {
+  const auto& class_tbl = storage_->heap_graph_class_table();
+  const auto& ref_tbl = storage_->heap_graph_reference_table();
+  auto* objects_tbl = storage_->mutable_heap_graph_object_table();
+
+  // If an object is a special reference kind, its
+  // "java.lang.ref.Reference.referent" field should be ignored.
+  std::array<StringId, 4> ignored_kinds = {
+      InternTypeKindString(protos::pbzero::HeapGraphType::KIND_WEAK_REFERENCE),
+      InternTypeKindString(protos::pbzero::HeapGraphType::KIND_SOFT_REFERENCE),
+      InternTypeKindString(
+          protos::pbzero::HeapGraphType::KIND_FINALIZER_REFERENCE),
+      InternTypeKindString(
+          protos::pbzero::HeapGraphType::KIND_PHANTOM_REFERENCE),
+  };
+  std::vector<bool> is_reference_class(class_tbl.row_count());
+  for (uint32_t i = 0; i < class_tbl.row_count(); ++i) {
+    is_reference_class[i] =
+        std::find(ignored_kinds.begin(), ignored_kinds.end(),
+                  class_tbl.kind()[i]) != ignored_kinds.end();
+  }
+
+  ObjectGraph& graph = seq->graph;
+  for (uint32_t idx = 0; idx < graph.size(); ++idx) {
+    if (graph.children_count[idx] == 0)
+      continue;
+    auto obj_row_ref = graph.RowOf(idx).ToRowReference(objects_tbl);
+    if (!is_reference_class[obj_row_ref.type_id().value])
+      continue;
+    std::optional<uint32_t> reference_set_id = obj_row_ref.reference_set_id();
+    if (!reference_set_id)
+      continue;
+    for (uint32_t i = 0; i < graph.children_count[idx]; ++i) {
+      if (ref_tbl.field_name()[*reference_set_id + i] == referent_str_id_)
+        graph.children[graph.children_begin[idx] + i] = ObjectGraph::kNoObject;
+    }
+  }
+}
+
+void HeapGraphTracker::MarkReachable(const ObjectGraph& graph,
+                                     const std::vector<uint32_t>& roots) {
+  // Shortest distance to a root of each object, -1 if it's not reachable.
+  // Objects are claimed atomically as the objects of each level of the search
+  // are visited in parallel.
+  std::unique_ptr<std::atomic<int32_t>[]> distances(
+      new std::atomic<int32_t>[graph.size()]);
+  for (uint32_t i = 0; i < graph.size(); ++i)
+    distances[i].store(-1, std::memory_order_relaxed);
+
+  std::vector<uint32_t> frontier;
+  for (uint32_t root : roots) {
+    if (root != ObjectGraph::kNoObject &&
+        distances[root].exchange(0, std::memory_order_relaxed) == -1) {
+      frontier.push_back(root);
+    }
+  }
+
+  std::vector<std::vector<uint32_t>> next_frontiers;
+  for (int32_t distance = 1; !frontier.empty(); ++distance) {
+    size_t chunk_count = (frontier.size() + kReachabilityChunkSize - 1) /
+                         kReachabilityChunkSize;
+    next_frontiers.clear();
+    next_frontiers.resize(chunk_count);
+    auto visit_chunk = [&](size_t chunk) {
+      std::vector<uint32_t>& next = next_frontiers[chunk];
+      size_t end =
+          std::min(frontier.size(), (chunk + 1) * kReachabilityChunkSize);
+      for (size_t i = chunk * kReachabilityChunkSize; i < end; ++i) {
+        uint32_t idx = frontier[i];
+        uint32_t begin = graph.children_begin[idx];
+        uint32_t children_end = begin + graph.children_count[idx];
+        for (uint32_t c = begin; c < children_end; ++c) {
+          uint32_t child = graph.children[c];
+          if (child == ObjectGraph::kNoObject ||
+              distances[child].load(std::memory_order_relaxed) != -1) {
+            continue;
+          }
+          int32_t unvisited = -1;
+          if (distances[child].compare_exchange_strong(
+                  unvisited, distance, std::memory_order_relaxed)) {
+            next.push_back(child);
+          }
         }
-        children.push_back(*opt_owned);
-        return true;
-      });
-  std::sort(children.begin(), children.end(),
-            [](const ObjectTable::Id& a, const ObjectTable::Id& b) {
-              return a.value < b.value;
-            });
+      }
+    };
+    if (thread_pool_ && chunk_count > 1) {
+      thread_pool_->ParallelFor(chunk_count, visit_chunk);
+    } else {
+      for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+        visit_chunk(chunk);
+    }
+
+    frontier.clear();
+    for (const std::vector<uint32_t>& next : next_frontiers)
+      frontier.insert(frontier.end(), next.begin(), next.end());
+  }
+
+  auto* objects_tbl = storage_->mutable_heap_graph_object_table();
+  for (uint32_t i = 0; i < graph.size(); ++i) {
+    int32_t distance = distances[i].load(std::memory_order_relaxed);
+    if (distance == -1)
+      continue;
+    auto row_ref = graph.RowOf(i).ToRowReference(objects_tbl);
+    row_ref.set_reachable(true);
+    row_ref.set_root_distance(distance);
+  }
+}
+
+void HeapGraphTracker::GetChildren(const ObjectGraph& graph,
+                                   uint32_t idx,
+                                   std::vector<uint32_t>& children) {
+  children.clear();
+  uint32_t begin = graph.children_begin[idx];
+  for (uint32_t c = begin; c < begin + graph.children_count[idx]; ++c) {
+    if (graph.children[c] != ObjectGraph::kNoObject)
+      children.push_back(graph.children[c]);
+  }
+  std::sort(children.begin(), children.end());
   children.erase(std::unique(children.begin(), children.end()), children.end());
 }
 
@@ -835,58 +979,10 @@ void HeapGraphTracker::MarkRoot(ObjectTable::RowReference row_ref,
     return;
   }
   row_ref.set_root_type(type);
-
-  std::vector<ObjectTable::Id> children;
-
-  // DFS to mark reachability for all children
-  std::vector<ObjectTable::RowReference> stack({row_ref});
-  while (!stack.empty()) {
-    ObjectTable::RowReference cur_node = stack.back();
-    stack.pop_back();
-
-    if (cur_node.reachable())
-      continue;
-    cur_node.set_reachable(true);
-
-    GetChildren(cur_node, children);
-    for (ObjectTable::Id child_node : children) {
-      auto child_ref =
-          *storage_->mutable_heap_graph_object_table()->FindById(child_node);
-      stack.push_back(child_ref);
-    }
-  }
-}
-
-void HeapGraphTracker::UpdateShortestPaths(ObjectTable::RowReference row_ref) {
-  // Calculate shortest distance to a GC root.
-  std::deque<std::pair<int32_t, ObjectTable::RowReference>> reachable_nodes{
-      {0, row_ref}};
-
-  std::vector<ObjectTable::Id> children;
-  while (!reachable_nodes.empty()) {
-    auto pair = reachable_nodes.front();
-
-    int32_t distance = pair.first;
-    ObjectTable::RowReference cur_row_ref = pair.second;
-
-    reachable_nodes.pop_front();
-    int32_t cur_distance = cur_row_ref.root_distance();
-    if (cur_distance == -1 || cur_distance > distance) {
-      cur_row_ref.set_root_distance(distance);
-
-      GetChildren(cur_row_ref, children);
-      for (ObjectTable::Id child_node : children) {
-        auto child_row_ref =
-            *storage_->mutable_heap_graph_object_table()->FindById(child_node);
-        int32_t child_distance = child_row_ref.root_distance();
-        if (child_distance == -1 || child_distance > distance + 1)
-          reachable_nodes.emplace_back(distance + 1, child_row_ref);
-      }
-    }
-  }
 }
 
-void HeapGraphTracker::FindPathFromRoot(ObjectTable::RowReference row_ref,
+void HeapGraphTracker::FindPathFromRoot(const ObjectGraph& graph,
+                                        ObjectTable::RowReference row_ref,
                                         PathFromRoot* path) {
   // We have long retention chains (e.g. from LinkedList). If we use the stack
   // here, we risk running out of stack space. This is why we use a vector to
@@ -897,9 +993,10 @@ void HeapGraphTracker::FindPathFromRoot(ObjectTable::RowReference row_ref,
     size_t i;        // Index of the next child of this node to handle.
     uint32_t depth;  // Depth in the resulting tree
                      // (including artificial root).
-    std::vector<ObjectTable::Id> children;
+    std::vector<uint32_t> children;
   };
 
+  auto* object_table = storage_->mutable_heap_graph_object_table();
   std::vector<StackElem> stack{{row_ref, PathFromRoot::kRoot, 0, 0, {}}};
   while (!stack.empty()) {
     ObjectTable::RowReference object_row_ref = stack.back().node;
@@ -907,7 +1004,7 @@ void HeapGraphTracker::FindPathFromRoot(ObjectTable::RowReference row_ref,
     size_t parent_id = stack.back().parent_id;
     uint32_t depth = stack.back().depth;
     size_t& i = stack.back().i;
-    std::vector<ObjectTable::Id>& children = stack.back().children;
+    std::vector<uint32_t>& children = stack.back().children;
 
     ClassTable::Id type_id = object_row_ref.type_id();
 
@@ -943,7 +1040,8 @@ void HeapGraphTracker::FindPathFromRoot(ObjectTable::RowReference row_ref,
       // size to the relevant node in the resulting tree.
       output_tree_node->size += object_row_ref.self_size();
       output_tree_node->count++;
-      GetChildren(object_row_ref, children);
+      GetChildren(graph, graph.IndexOf(object_row_ref.ToRowNumber()),
+                  children);
 
       if (object_row_ref.native_size()) {
         StringId native_class_name_id = storage_->InternString(
@@ -972,9 +1070,9 @@ void HeapGraphTracker::FindPathFromRoot(ObjectTable::RowReference row_ref,
     // We have already handled this node and just need to get its i-th child.
     if (!children.empty()) {
       PERFETTO_CHECK(i < children.size());
-      ObjectTable::Id child = children[i];
       auto child_row_ref =
-          *storage_->mutable_heap_graph_object_table()->FindById(child);
+          graph.RowOf(children[i]).ToRowReference(object_table);
+      ObjectTable::Id child = child_row_ref.id();
       if (++i == children.size())
         stack.pop_back();
 
@@ -1031,14 +1129,16 @@ HeapGraphTracker::BuildFlamegraph(const int64_t current_ts,
 
   const std::set<ObjectTable::RowNumber>& roots = it->second;
   auto* object_table = storage_->mutable_heap_graph_object_table();
+  auto graph_it = graphs_.find(std::make_pair(current_upid, current_ts));
+  PERFETTO_CHECK(graph_it != graphs_.end());
+  const ObjectGraph& graph = graph_it->second;
 
-  // First pass to calculate shortest paths
-  for (ObjectTable::RowNumber root : roots) {
-    UpdateShortestPaths(root.ToRowReference(object_table));
-  }
+  // The shortest paths to the roots were computed by MarkReachable.
   PathFromRoot init_path;
   for (ObjectTable::RowNumber root : roots) {
-    FindPathFromRoot(root.ToRowReference(object_table), &init_path);
+    if (graph.IndexOf(root) == ObjectGraph::kNoObject)
+      continue;
+    FindPathFromRoot(graph, root.ToRowReference(object_table), &init_path);
   }
 
   std::vector<int64_t> node_to_cumulative_size(init_path.nodes.size());
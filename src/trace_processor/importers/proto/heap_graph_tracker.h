@@ -17,7 +17,10 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_HEAP_GRAPH_TRACKER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_HEAP_GRAPH_TRACKER_H_
 
+#include <cstdint>
+#include <limits>
 #include <map>
+#include <memory>
 #include <optional>
 #include <set>
 #include <utility>
@@ -32,6 +35,11 @@
 #include "src/trace_processor/types/trace_processor_context.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
 namespace trace_processor {
 
 class TraceProcessorContext;
@@ -86,12 +94,14 @@ class HeapGraphTracker : public Destructible {
     std::vector<uint64_t> object_ids;
   };
 
-  explicit HeapGraphTracker(TraceStorage* storage);
+  // |thread_count| is the number of threads (including the calling one) used
+  // to compute the reachability of the objects of each graph.
+  explicit HeapGraphTracker(TraceStorage* storage, uint32_t thread_count = 1);
 
   static HeapGraphTracker* GetOrCreate(TraceProcessorContext* context) {
     if (!context->heap_graph_tracker) {
-      context->heap_graph_tracker.reset(
-          new HeapGraphTracker(context->storage.get()));
+      context->heap_graph_tracker.reset(new HeapGraphTracker(
+          context->storage.get(), context->config.heap_graph_thread_count));
     }
     return static_cast<HeapGraphTracker*>(context->heap_graph_tracker.get());
   }
@@ -117,6 +127,10 @@ class HeapGraphTracker : public Destructible {
   void FinalizeProfile(uint32_t seq);
   void FinalizeAllProfiles();
   void SetPacketIndex(uint32_t seq_id, uint64_t index);
+  // Marks the graph being received on |seq_id| as not containing all the
+  // objects of the heap. References to the objects which are not in the graph
+  // are ignored when computing reachability and flamegraphs.
+  void SetPartial(uint32_t seq_id);
 
   ~HeapGraphTracker() override;
 
@@ -157,6 +171,46 @@ class HeapGraphTracker : public Destructible {
     uint64_t classloader_id;
     protos::pbzero::HeapGraphType::Kind kind;
   };
+  // The references between the objects of a heap graph, in compact arrays
+  // indexed by the rows of the objects in the object table. This is built
+  // while the objects are added, and is traversed to compute reachability and
+  // paths from the roots without looking up the reference table.
+  struct ObjectGraph {
+    static constexpr uint32_t kNoObject = std::numeric_limits<uint32_t>::max();
+
+    // Returns the index of the object at |row|, or kNoObject if it's not part
+    // of this graph.
+    uint32_t IndexOf(tables::HeapGraphObjectTable::RowNumber row) const {
+      uint32_t idx = row.row_number() - first_row;
+      return row.row_number() >= first_row && idx < size() ? idx : kNoObject;
+    }
+    tables::HeapGraphObjectTable::RowNumber RowOf(uint32_t idx) const {
+      return tables::HeapGraphObjectTable::RowNumber(first_row + idx);
+    }
+    uint32_t size() const {
+      return static_cast<uint32_t>(children_begin.size());
+    }
+    // Adds the objects up to (excluding) |row_count|.
+    void Grow(uint32_t row_count) {
+      children_begin.resize(row_count - first_row);
+      children_count.resize(row_count - first_row);
+    }
+
+    // Row of the first object of the graph. The objects of other graphs
+    // ingested concurrently can be interleaved with the ones of this graph:
+    // they have no references and are never reached.
+    uint32_t first_row = 0;
+    // The references of the object with index i are at
+    // [children_begin[i], children_begin[i] + children_count[i]) in
+    // |children|, in the order of their rows in the reference table.
+    std::vector<uint32_t> children_begin;
+    std::vector<uint32_t> children_count;
+    // Index of the object each reference points to, or kNoObject for unset
+    // references and references ignored for reachability (e.g. the referent
+    // of weak references).
+    std::vector<uint32_t> children;
+  };
+
   struct SequenceState {
     UniquePid current_upid = 0;
     int64_t current_ts = 0;
@@ -196,7 +250,9 @@ class HeapGraphTracker : public Destructible {
     // Contains the value of the "size" field for each
     // "libcore.util.NativeAllocationRegistry" object.
     std::map<tables::HeapGraphObjectTable::Id, int64_t> nar_size_by_obj_id;
+    ObjectGraph graph;
     bool truncated = false;
+    bool partial = false;
   };
 
   SequenceState& GetOrCreateSequence(uint32_t seq_id);
@@ -226,12 +282,22 @@ class HeapGraphTracker : public Destructible {
   // all the other tables have been fully populated.
   void PopulateNativeSize(const SequenceState& seq);
 
-  void GetChildren(tables::HeapGraphObjectTable::RowReference,
-                   std::vector<tables::HeapGraphObjectTable::Id>&);
+  // Drops the references to objects which were never added from |seq.graph|.
+  void RemoveReferencesToMissingObjects(SequenceState* seq);
+  // Drops the references which do not keep objects alive from |seq.graph|.
+  // This should be called after the types of the objects are known.
+  void RemoveIgnoredReferences(SequenceState* seq);
+  // Sets the reachable and root_distance columns of all the objects of
+  // |graph| with a breadth-first search from all the |roots| at once.
+  void MarkReachable(const ObjectGraph& graph,
+                     const std::vector<uint32_t>& roots);
+  void GetChildren(const ObjectGraph& graph,
+                   uint32_t idx,
+                   std::vector<uint32_t>& children);
   void MarkRoot(tables::HeapGraphObjectTable::RowReference, StringId type);
   size_t RankRoot(StringId type);
-  void UpdateShortestPaths(tables::HeapGraphObjectTable::RowReference row_ref);
-  void FindPathFromRoot(tables::HeapGraphObjectTable::RowReference,
+  void FindPathFromRoot(const ObjectGraph& graph,
+                        tables::HeapGraphObjectTable::RowReference,
                         PathFromRoot* path);
 
   TraceStorage* const storage_;
@@ -250,6 +316,15 @@ class HeapGraphTracker : public Destructible {
            std::set<tables::HeapGraphObjectTable::RowNumber>>
       roots_;
   std::set<std::pair<UniquePid, int64_t>> truncated_graphs_;
+  // The graphs of all the finalized profiles, used to build flamegraphs.
+  std::map<std::pair<UniquePid, int64_t>, ObjectGraph> graphs_;
+
+  // Only set if more than one thread should be used.
+  std::unique_ptr<base::ThreadPool> thread_pool_;
+
+  // The references of the object being added, inserted together. Kept to
+  // reuse its memory.
+  std::vector<tables::HeapGraphReferenceTable::Row> reference_rows_;
 
   StringId cleaner_thunk_str_id_;
   StringId referent_str_id_;
@@ -424,6 +424,168 @@ TEST(HeapGraphTrackerTest, BuildFlamegraphWeakReferences) {
   EXPECT_THAT(counts, UnorderedElementsAre(1, 1));
 }
 
+TEST(HeapGraphTrackerTest, RootDistanceMultiThreaded) {
+  // The root 1 references kFanOut objects, each of which references one more
+  // object. The root also references the last of the latter directly, and
+  // one more object is not referenced by anything.
+  // There are enough objects on each level to split the search across the
+  // threads.
+  constexpr uint64_t kSeqId = 1;
+  constexpr UniquePid kPid = 1;
+  constexpr int64_t kTimestamp = 1;
+  constexpr uint64_t kFanOut = 10000;
+  constexpr uint64_t kUnreachable = 3 * kFanOut;
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.process_tracker.reset(new ProcessTracker(&context));
+  context.process_tracker->GetOrCreateProcess(kPid);
+
+  HeapGraphTracker tracker(context.storage.get(), /*thread_count=*/4);
+
+  constexpr uint64_t kField = 1;
+  constexpr uint64_t kLocation = 0;
+  constexpr uint64_t kX = 1;
+
+  tracker.AddInternedFieldName(kSeqId, kField, base::StringView("foo"));
+  tracker.AddInternedLocationName(kSeqId, kLocation,
+                                  context.storage->InternString("location"));
+  tracker.AddInternedType(kSeqId, kX, context.storage->InternString("X"),
+                          kLocation, /*object_size=*/0,
+                          /*field_name_ids=*/{}, /*superclass_id=*/0,
+                          /*classloader_id=*/0, /*no_fields=*/false,
+                          protos::pbzero::HeapGraphType::KIND_NORMAL);
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 1;
+    obj.self_size = 1;
+    obj.type_id = kX;
+    for (uint64_t i = 0; i < kFanOut; ++i) {
+      obj.field_name_ids.push_back(kField);
+      obj.referred_objects.push_back(2 + i);
+    }
+    obj.field_name_ids.push_back(kField);
+    obj.referred_objects.push_back(1 + 2 * kFanOut);
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+  for (uint64_t i = 0; i < kFanOut; ++i) {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 2 + i;
+    obj.self_size = 2 + i;
+    obj.type_id = kX;
+    obj.field_name_ids = {kField};
+    obj.referred_objects = {2 + kFanOut + i};
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+  for (uint64_t i = 0; i < kFanOut; ++i) {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 2 + kFanOut + i;
+    obj.self_size = 2 + kFanOut + i;
+    obj.type_id = kX;
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = kUnreachable;
+    obj.self_size = kUnreachable;
+    obj.type_id = kX;
+    obj.field_name_ids = {kField};
+    obj.referred_objects = {2};
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+
+  HeapGraphTracker::SourceRoot root;
+  root.root_type = protos::pbzero::HeapGraphRoot::ROOT_UNKNOWN;
+  root.object_ids.emplace_back(1);
+  tracker.AddRoot(kSeqId, kPid, kTimestamp, root);
+
+  tracker.FinalizeProfile(kSeqId);
+
+  const auto& objects = context.storage->heap_graph_object_table();
+  ASSERT_EQ(objects.row_count(), 2 * kFanOut + 2);
+  for (uint32_t row = 0; row < objects.row_count(); ++row) {
+    int64_t id = objects.self_size()[row];
+    if (id == static_cast<int64_t>(kUnreachable)) {
+      EXPECT_FALSE(objects.reachable()[row]);
+      EXPECT_EQ(objects.root_distance()[row], -1);
+      continue;
+    }
+    int32_t expected_distance;
+    if (id == 1) {
+      expected_distance = 0;
+    } else if (id < static_cast<int64_t>(2 + kFanOut) ||
+               id == static_cast<int64_t>(1 + 2 * kFanOut)) {
+      expected_distance = 1;
+    } else {
+      expected_distance = 2;
+    }
+    EXPECT_TRUE(objects.reachable()[row]) << id;
+    EXPECT_EQ(objects.root_distance()[row], expected_distance) << id;
+  }
+}
+
+TEST(HeapGraphTrackerTest, PartialGraphIgnoresMissingObjects) {
+  // The root 1 references 2, which is in the graph, and 3, which is not.
+  constexpr uint64_t kSeqId = 1;
+  constexpr UniquePid kPid = 1;
+  constexpr int64_t kTimestamp = 1;
+
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.process_tracker.reset(new ProcessTracker(&context));
+  context.process_tracker->GetOrCreateProcess(kPid);
+
+  HeapGraphTracker tracker(context.storage.get());
+
+  constexpr uint64_t kField = 1;
+  constexpr uint64_t kLocation = 0;
+  constexpr uint64_t kX = 1;
+
+  tracker.SetPartial(kSeqId);
+  tracker.AddInternedFieldName(kSeqId, kField, base::StringView("foo"));
+  tracker.AddInternedLocationName(kSeqId, kLocation,
+                                  context.storage->InternString("location"));
+  tracker.AddInternedType(kSeqId, kX, context.storage->InternString("X"),
+                          kLocation, /*object_size=*/0,
+                          /*field_name_ids=*/{}, /*superclass_id=*/0,
+                          /*classloader_id=*/0, /*no_fields=*/false,
+                          protos::pbzero::HeapGraphType::KIND_NORMAL);
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 1;
+    obj.self_size = 1;
+    obj.type_id = kX;
+    obj.field_name_ids = {kField, kField};
+    obj.referred_objects = {2, 3};
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+  {
+    HeapGraphTracker::SourceObject obj;
+    obj.object_id = 2;
+    obj.self_size = 2;
+    obj.type_id = kX;
+    tracker.AddObject(kSeqId, kPid, kTimestamp, std::move(obj));
+  }
+
+  HeapGraphTracker::SourceRoot root;
+  root.root_type = protos::pbzero::HeapGraphRoot::ROOT_UNKNOWN;
+  root.object_ids.emplace_back(1);
+  tracker.AddRoot(kSeqId, kPid, kTimestamp, root);
+
+  tracker.FinalizeProfile(kSeqId);
+
+  const auto& objects = context.storage->heap_graph_object_table();
+  ASSERT_EQ(objects.row_count(), 3u);
+  for (uint32_t row = 0; row < objects.row_count(); ++row) {
+    // The missing object keeps the self_size of -1.
+    bool missing = objects.self_size()[row] == -1;
+    EXPECT_EQ(objects.reachable()[row], !missing);
+  }
+  EXPECT_EQ(context.storage->stats()[stats::heap_graph_partial_graph]
+                .indexed_values.at(static_cast<int>(kPid)),
+            1);
+}
+
 static const char kArray[] = "X[]";
 static const char kDoubleArray[] = "X[][]";
 static const char kNoArray[] = "X";
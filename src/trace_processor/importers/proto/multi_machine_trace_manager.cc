@@ -29,6 +29,7 @@
 #include "src/trace_processor/importers/common/sched_event_tracker.h"
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/stack_profile_tracker.h"
+#include "src/trace_processor/importers/common/thread_state_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
 #include "src/trace_processor/importers/proto/default_modules.h"
 #include "src/trace_processor/importers/proto/perf_sample_tracker.h"
@@ -78,8 +79,14 @@ ProtoTraceReader* MultiMachineTraceManager::GetOrCreateReader(
   // Share the sorter, but enable for the parser.
   context->sorter = default_context_->sorter;
   context->sorter->AddMachineContext(context.get());
+  context->ingestion_profiler = default_context_->ingestion_profiler;
+  context->memory_budget = default_context_->memory_budget;
   context->process_tracker->SetPidZeroIsUpidZeroIdleProcess();
   context->proto_trace_parser.reset(new ProtoTraceParserImpl(context.get()));
+  // The thread_state rows of all the machines are inserted together, in
+  // timestamp order.
+  context->thread_state_tracker.reset(new ThreadStateTracker(
+      context.get(), ThreadStateTracker::GetOrCreate(default_context_)));
 
   auto new_reader = std::make_unique<ProtoTraceReader>(context.get());
   remote_machine_contexts_[raw_machine_id] =
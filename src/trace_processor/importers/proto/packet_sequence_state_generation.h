@@ -47,10 +47,12 @@ class TraceProcessorContext;
 
 class StackProfileSequenceState;
 class ProfilePacketSequenceState;
+class TrackEventSequenceState;
 class V8SequenceState;
 
 using InternedDataTrackers = std::tuple<StackProfileSequenceState,
                                         ProfilePacketSequenceState,
+                                        TrackEventSequenceState,
                                         V8SequenceState>;
 
 class PacketSequenceStateGeneration : public RefCounted {
@@ -16,9 +16,11 @@
 
 #include "src/trace_processor/importers/proto/profile_packet_sequence_state.h"
 
+#include <map>
 #include <memory>
 
 #include "src/trace_processor/importers/common/mapping_tracker.h"
+#include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/stack_profile_tracker.h"
 #include "src/trace_processor/importers/proto/packet_sequence_state.h"
 #include "src/trace_processor/types/trace_processor_context.h"
@@ -54,6 +56,7 @@ static constexpr char kBuildIDName[] = "[build id]";
 static constexpr char kBuildIDHexName[] = "5b6275696c642069645d";
 
 using ::testing::ElementsAre;
+using ::testing::Pair;
 
 class HeapProfileTrackerDupTest : public ::testing::Test {
  public:
@@ -345,6 +348,87 @@ TEST(HeapProfileTrackerTest, Functional) {
   ppss.FinalizeProfile();
 }
 
+// Incremental heapprofd dumps only contain the callstacks that changed since
+// the previous dump. As only the difference to the previous dump of each
+// callstack is stored, the totals are the same as for full dumps.
+TEST(HeapProfileTrackerTest, IncrementalDumps) {
+  TraceProcessorContext context;
+  context.storage.reset(new TraceStorage());
+  context.mapping_tracker.reset(new MappingTracker(&context));
+  context.stack_profile_tracker.reset(new StackProfileTracker(&context));
+  context.process_tracker.reset(new ProcessTracker(&context));
+  PacketSequenceState pss(&context);
+  ProfilePacketSequenceState& ppss =
+      *pss.current_generation()->GetOrCreate<ProfilePacketSequenceState>();
+
+  // The Q-style interning tables are cleared at the end of each profile.
+  auto add_callstacks = [&ppss] {
+    ppss.AddString(1, "buildid");
+    ppss.AddString(2, "map");
+    ppss.AddString(3, "fun1");
+    ppss.AddString(4, "fun2");
+
+    ProfilePacketSequenceState::SourceMapping mapping;
+    mapping.build_id = 1;
+    mapping.start = 1;
+    mapping.end = 2;
+    mapping.name_ids = {2};
+    ppss.AddMapping(0, mapping);
+
+    ProfilePacketSequenceState::SourceFrame frame;
+    frame.name_id = 3;
+    frame.mapping_id = 0;
+    frame.rel_pc = 1;
+    ppss.AddFrame(0, frame);
+    frame.name_id = 4;
+    frame.rel_pc = 2;
+    ppss.AddFrame(1, frame);
+
+    ppss.AddCallstack(0, {0});
+    ppss.AddCallstack(1, {1});
+  };
+  StringId heap_name = context.storage->InternString("malloc");
+  auto add_sample = [&ppss, heap_name](int64_t ts, uint64_t callstack_id,
+                                       uint64_t allocated, uint64_t freed) {
+    ProfilePacketSequenceState::SourceAllocation alloc;
+    alloc.pid = 1;
+    alloc.timestamp = ts;
+    alloc.heap_name = heap_name;
+    alloc.callstack_id = callstack_id;
+    alloc.self_allocated = allocated;
+    alloc.self_freed = freed;
+    alloc.alloc_count = allocated ? 1 : 0;
+    alloc.free_count = freed ? 1 : 0;
+    ppss.StoreAllocation(alloc);
+  };
+
+  // The first dump contains all the callstacks.
+  add_callstacks();
+  add_sample(1, 0, 100, 0);
+  add_sample(1, 1, 50, 0);
+  ppss.FinalizeProfile();
+
+  add_callstacks();
+  add_sample(2, 0, 150, 20);
+  ppss.FinalizeProfile();
+
+  add_callstacks();
+  add_sample(3, 1, 50, 50);
+  ppss.FinalizeProfile();
+
+  const auto& allocs = context.storage->heap_profile_allocation_table();
+  std::map<uint32_t, int64_t> unreleased;
+  std::map<uint32_t, int64_t> allocated;
+  for (uint32_t i = 0; i < allocs.row_count(); ++i) {
+    unreleased[allocs.callsite_id()[i].value] += allocs.size()[i];
+    if (allocs.size()[i] > 0)
+      allocated[allocs.callsite_id()[i].value] += allocs.size()[i];
+  }
+  EXPECT_THAT(unreleased, ElementsAre(Pair(0u, 130), Pair(1u, 0)));
+  EXPECT_THAT(allocated, ElementsAre(Pair(0u, 150), Pair(1u, 50)));
+  EXPECT_EQ(allocs.row_count(), 5u);
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -30,6 +30,7 @@
 
 #include "src/trace_processor/importers/common/args_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
 #include "src/trace_processor/importers/common/machine_tracker.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/importers/common/parser_types.h"
@@ -75,6 +76,9 @@ void ProtoTraceParserImpl::ParseTracePacket(int64_t ts, TracePacketData data) {
   auto& modules = context_->modules_by_field;
   for (uint32_t field_id = 1; field_id < modules.size(); ++field_id) {
     if (!modules[field_id].empty() && packet.Get(field_id).valid()) {
+      auto sample = IngestionProfiler::SampleField(
+          context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+          field_id, blob.length());
       for (ProtoImporterModule* global_module :
            context_->modules_for_all_fields) {
         global_module->ParseTracePacketData(packet, ts, data, field_id);
@@ -108,56 +112,108 @@ void ProtoTraceParserImpl::ParseTracePacket(int64_t ts, TracePacketData data) {
 void ProtoTraceParserImpl::ParseTrackEvent(int64_t ts, TrackEventData data) {
   const TraceBlobView& blob = data.trace_packet_data.packet;
   protos::pbzero::TracePacket::Decoder packet(blob.data(), blob.length());
-  context_->track_module->ParseTrackEventData(packet, ts, data);
-  context_->args_tracker->Flush();
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "track_event", blob.length());
+    context_->track_module->ParseTrackEventData(packet, ts, data);
+  }
+  FlushArgsTracker();
 }
 
 void ProtoTraceParserImpl::ParseEtwEvent(uint32_t cpu,
                                      int64_t ts,
                                      TracePacketData data) {
   PERFETTO_DCHECK(context_->etw_module);
-  context_->etw_module->ParseEtwEventData(cpu, ts, data);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "etw_event", data.packet.length());
+    context_->etw_module->ParseEtwEventData(cpu, ts, data);
+  }
 
   // TODO(lalitm): maybe move this to the flush method in the trace processor
   // once we have it. This may reduce performance in the ArgsTracker though so
   // needs to be handled carefully.
-  context_->args_tracker->Flush();
+  FlushArgsTracker();
+}
+
+void ProtoTraceParserImpl::ParseInlineEtwCSwitch(uint32_t cpu,
+                                             int64_t ts,
+                                             InlineEtwCSwitch data) {
+  PERFETTO_DCHECK(context_->etw_module);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "inline_etw_cswitch");
+    context_->etw_module->ParseInlineCSwitch(cpu, ts, data);
+  }
+  FlushArgsTracker();
+}
+
+void ProtoTraceParserImpl::ParseInlineEtwReadyThread(
+    uint32_t cpu,
+    int64_t ts,
+    InlineEtwReadyThread data) {
+  PERFETTO_DCHECK(context_->etw_module);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "inline_etw_ready_thread");
+    context_->etw_module->ParseInlineReadyThread(cpu, ts, data);
+  }
+  FlushArgsTracker();
 }
 
 void ProtoTraceParserImpl::ParseFtraceEvent(uint32_t cpu,
                                         int64_t ts,
                                         TracePacketData data) {
   PERFETTO_DCHECK(context_->ftrace_module);
-  context_->ftrace_module->ParseFtraceEventData(cpu, ts, data);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "ftrace_event", data.packet.length());
+    context_->ftrace_module->ParseFtraceEventData(cpu, ts, data);
+  }
 
   // TODO(lalitm): maybe move this to the flush method in the trace processor
   // once we have it. This may reduce performance in the ArgsTracker though so
   // needs to be handled carefully.
-  context_->args_tracker->Flush();
+  FlushArgsTracker();
 }
 
 void ProtoTraceParserImpl::ParseInlineSchedSwitch(uint32_t cpu,
                                               int64_t ts,
                                               InlineSchedSwitch data) {
   PERFETTO_DCHECK(context_->ftrace_module);
-  context_->ftrace_module->ParseInlineSchedSwitch(cpu, ts, data);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "inline_sched_switch");
+    context_->ftrace_module->ParseInlineSchedSwitch(cpu, ts, data);
+  }
 
   // TODO(lalitm): maybe move this to the flush method in the trace processor
   // once we have it. This may reduce performance in the ArgsTracker though so
   // needs to be handled carefully.
-  context_->args_tracker->Flush();
+  FlushArgsTracker();
 }
 
 void ProtoTraceParserImpl::ParseInlineSchedWaking(uint32_t cpu,
                                               int64_t ts,
                                               InlineSchedWaking data) {
   PERFETTO_DCHECK(context_->ftrace_module);
-  context_->ftrace_module->ParseInlineSchedWaking(cpu, ts, data);
+  {
+    auto sample = IngestionProfiler::SampleNamed(
+        context_->ingestion_profiler.get(), IngestionProfiler::Phase::kParse,
+        "inline_sched_waking");
+    context_->ftrace_module->ParseInlineSchedWaking(cpu, ts, data);
+  }
 
   // TODO(lalitm): maybe move this to the flush method in the trace processor
   // once we have it. This may reduce performance in the ArgsTracker though so
   // needs to be handled carefully.
-  context_->args_tracker->Flush();
+  FlushArgsTracker();
 }
 
 void ProtoTraceParserImpl::ParseTraceStats(ConstBytes blob) {
@@ -470,6 +526,13 @@ void ProtoTraceParserImpl::ParseMetatraceEvent(int64_t ts, ConstBytes blob) {
     context_->storage->IncrementStats(stats::metatrace_overruns);
 }
 
+void ProtoTraceParserImpl::FlushArgsTracker() {
+  auto sample = IngestionProfiler::SampleNamed(
+      context_->ingestion_profiler.get(), IngestionProfiler::Phase::kFlush,
+      "args_tracker");
+  context_->args_tracker->Flush();
+}
+
 StringId ProtoTraceParserImpl::GetMetatraceInternedString(uint64_t iid) {
   StringId* maybe_id = metatrace_interned_strings_.Find(iid);
   if (!maybe_id)
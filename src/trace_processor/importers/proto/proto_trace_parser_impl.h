@@ -65,6 +65,14 @@ class ProtoTraceParserImpl : public ProtoTraceParser {
                               int64_t /*ts*/,
                               InlineSchedWaking data) override;
 
+  void ParseInlineEtwCSwitch(uint32_t cpu,
+                             int64_t /*ts*/,
+                             InlineEtwCSwitch data) override;
+
+  void ParseInlineEtwReadyThread(uint32_t cpu,
+                                 int64_t /*ts*/,
+                                 InlineEtwReadyThread data) override;
+
   void ParseTraceStats(ConstBytes);
   void ParseChromeEvents(int64_t ts, ConstBytes);
   void ParseMetatraceEvent(int64_t ts, ConstBytes);
@@ -72,6 +80,9 @@ class ProtoTraceParserImpl : public ProtoTraceParser {
  private:
   StringId GetMetatraceInternedString(uint64_t iid);
 
+  // Flushes the args tracker, accounting the time in the ingestion profile.
+  void FlushArgsTracker();
+
   TraceProcessorContext* context_;
 
   const StringId metatrace_id_;
@@ -31,6 +31,7 @@
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/stack_profile_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_args.h"
 #include "src/trace_processor/importers/ftrace/ftrace_sched_event_tracker.h"
 #include "src/trace_processor/importers/proto/additional_modules.h"
 #include "src/trace_processor/importers/proto/default_modules.h"
@@ -247,7 +248,10 @@ class MockSliceTracker : public SliceTracker {
 
 class ProtoTraceParserTest : public ::testing::Test {
  public:
-  ProtoTraceParserTest() {
+  ProtoTraceParserTest() : ProtoTraceParserTest(Config()) {}
+
+  explicit ProtoTraceParserTest(const Config& config) {
+    context_.config = config;
     storage_ = new TraceStorage();
     context_.storage.reset(storage_);
     context_.track_tracker.reset(new TrackTracker(&context_));
@@ -407,6 +411,58 @@ TEST_F(ProtoTraceParserTest, LoadEventsIntoRaw) {
   // and test here.
 }
 
+class ProtoTraceParserLazyRawArgsTest : public ProtoTraceParserTest {
+ public:
+  ProtoTraceParserLazyRawArgsTest() : ProtoTraceParserTest(LazyConfig()) {}
+
+ private:
+  static Config LazyConfig() {
+    Config config;
+    config.lazy_ftrace_raw_args = true;
+    return config;
+  }
+};
+
+TEST_F(ProtoTraceParserLazyRawArgsTest, LoadEventsIntoRawLazily) {
+  auto* bundle = trace_->add_packet()->set_ftrace_events();
+  bundle->set_cpu(10);
+
+  auto* event = bundle->add_event();
+  event->set_timestamp(1000);
+  event->set_pid(12);
+  auto* task = event->set_task_newtask();
+  task->set_pid(123);
+  static const char task_newtask[] = "task_newtask";
+  task->set_comm(task_newtask);
+  task->set_clone_flags(12);
+  task->set_oom_score_adj(15);
+
+  EXPECT_CALL(*process_, GetOrCreateProcess(123));
+
+  Tokenize();
+  context_.sorter->ExtractEventsForced();
+
+  // The raw row is inserted during parsing but its args are not decoded.
+  const auto& raw = context_.storage->raw_table();
+  ASSERT_EQ(raw.row_count(), 1u);
+  const auto& args = context_.storage->arg_table();
+  ASSERT_EQ(args.row_count(), 0u);
+
+  LazyFtraceRawArgs* lazy = LazyFtraceRawArgs::Get(&context_);
+  ASSERT_NE(lazy, nullptr);
+  ASSERT_EQ(lazy->pending_count(), 1u);
+
+  lazy->Materialize();
+  ASSERT_EQ(lazy->pending_count(), 0u);
+  ASSERT_EQ(args.row_count(), 4u);
+  ASSERT_EQ(raw.arg_set_id()[0], args.arg_set_id()[0]);
+  ASSERT_EQ(args.key()[0], context_.storage->InternString("comm"));
+  ASSERT_STREQ(args.string_value().GetString(0).c_str(), task_newtask);
+  ASSERT_EQ(args.int_value()[1], 123);
+  ASSERT_EQ(args.int_value()[2], 15);
+  ASSERT_EQ(args.int_value()[3], 12);
+}
+
 TEST_F(ProtoTraceParserTest, LoadGenericFtrace) {
   auto* packet = trace_->add_packet();
   packet->set_timestamp(100);
@@ -22,6 +22,7 @@
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -29,6 +30,7 @@
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
 #include "src/trace_processor/importers/common/machine_tracker.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
@@ -62,9 +64,20 @@ ProtoTraceReader::ProtoTraceReader(TraceProcessorContext* ctx)
 ProtoTraceReader::~ProtoTraceReader() = default;
 
 util::Status ProtoTraceReader::Parse(TraceBlobView blob) {
-  return tokenizer_.Tokenize(std::move(blob), [this](TraceBlobView packet) {
+  auto parse_packet = [this](TraceBlobView packet) {
     return ParsePacket(std::move(packet));
-  });
+  };
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  const uint32_t thread_count = context_->config.tokenizer_thread_count;
+  if (thread_count > 1) {
+    if (!tokenizer_pool_)
+      tokenizer_pool_.reset(new base::ThreadPool(thread_count));
+    return tokenizer_.TokenizeParallel(std::move(blob), tokenizer_pool_.get(),
+                                       thread_count, parse_packet);
+  }
+#endif
+  return tokenizer_.Tokenize(std::move(blob), parse_packet);
 }
 
 util::Status ProtoTraceReader::ParseExtensionDescriptor(ConstBytes descriptor) {
@@ -233,6 +246,9 @@ util::Status ProtoTraceReader::ParsePacket(TraceBlobView packet) {
   auto& modules = context_->modules_by_field;
   for (uint32_t field_id = 1; field_id < modules.size(); ++field_id) {
     if (!modules[field_id].empty() && decoder.Get(field_id).valid()) {
+      auto sample = IngestionProfiler::SampleField(
+          context_->ingestion_profiler.get(),
+          IngestionProfiler::Phase::kTokenize, field_id, packet.length());
       for (ProtoImporterModule* global_module :
            context_->modules_for_all_fields) {
         ModuleResult res = global_module->TokenizePacket(
@@ -33,6 +33,10 @@ struct ConstBytes;
 
 namespace perfetto {
 
+namespace base {
+class ThreadPool;
+}
+
 namespace protos {
 namespace pbzero {
 class TracePacket_Decoder;
@@ -91,6 +95,10 @@ class ProtoTraceReader : public ChunkedTraceReader {
 
   ProtoTraceTokenizer tokenizer_;
 
+  // Used to inflate compressed packets off the main thread when
+  // |Config::tokenizer_thread_count| > 1. Created on the first Parse() call.
+  std::unique_ptr<base::ThreadPool> tokenizer_pool_;
+
   // Temporary. Currently trace packets do not have a timestamp, so the
   // timestamp given is latest_timestamp_.
   int64_t latest_timestamp_ = 0;
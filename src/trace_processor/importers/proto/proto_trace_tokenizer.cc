@@ -15,9 +15,13 @@
  */
 
 #include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
-#include "perfetto/trace_processor/trace_blob.h"
 
+#include <algorithm>
+
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "perfetto/trace_processor/trace_blob.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -25,18 +29,31 @@ namespace trace_processor {
 ProtoTraceTokenizer::ProtoTraceTokenizer() = default;
 
 util::Status ProtoTraceTokenizer::Decompress(TraceBlobView input,
+                                             Compression compression,
                                              TraceBlobView* output) {
-  PERFETTO_DCHECK(util::IsGzipSupported());
+  PERFETTO_DCHECK(compression != Compression::kNone);
+  base::StatusOr<TraceBlob> blob =
+      compression == Compression::kZstd
+          ? DecompressBuffer(&zstd_decompressor_, input.data(), input.length())
+          : DecompressBuffer(&decompressor_, input.data(), input.length());
+  RETURN_IF_ERROR(blob.status());
+  *output = TraceBlobView(std::move(*blob));
+  return util::OkStatus();
+}
 
+// static
+base::StatusOr<TraceBlob> ProtoTraceTokenizer::DecompressBuffer(
+    util::GzipDecompressor* decompressor,
+    const uint8_t* input,
+    size_t size) {
   std::vector<uint8_t> data;
-  data.reserve(input.length());
+  data.reserve(size);
 
   // Ensure that the decompressor is able to cope with a new stream of data.
-  decompressor_.Reset();
+  decompressor->Reset();
   using ResultCode = util::GzipDecompressor::ResultCode;
-  ResultCode ret = decompressor_.FeedAndExtract(
-      input.data(), input.length(),
-      [&data](const uint8_t* buffer, size_t buffer_len) {
+  ResultCode ret = decompressor->FeedAndExtract(
+      input, size, [&data](const uint8_t* buffer, size_t buffer_len) {
         data.insert(data.end(), buffer, buffer + buffer_len);
       });
 
@@ -44,10 +61,61 @@ util::Status ProtoTraceTokenizer::Decompress(TraceBlobView input,
     return util::ErrStatus("Failed to decompress (error code: %d)",
                            static_cast<int>(ret));
   }
+  return TraceBlob::CopyFrom(data.data(), data.size());
+}
 
-  TraceBlob out_blob = TraceBlob::CopyFrom(data.data(), data.size());
-  *output = TraceBlobView(std::move(out_blob));
-  return util::OkStatus();
+// static
+base::StatusOr<TraceBlob> ProtoTraceTokenizer::DecompressBuffer(
+    util::ZstdDecompressor* decompressor,
+    const uint8_t* input,
+    size_t size) {
+  std::vector<uint8_t> data;
+  data.reserve(size);
+  RETURN_IF_ERROR(decompressor->DecompressFully(input, size, &data));
+  return TraceBlob::CopyFrom(data.data(), data.size());
+}
+
+// static
+void ProtoTraceTokenizer::DecompressBatch(base::ThreadPool* pool,
+                                          uint32_t max_shards,
+                                          std::vector<BatchEntry>* batch) {
+  std::vector<BatchEntry*> jobs;
+  for (BatchEntry& entry : *batch) {
+    if (entry.compression != Compression::kNone)
+      jobs.push_back(&entry);
+  }
+  if (jobs.empty())
+    return;
+
+  // The refcount of TraceBlob is not thread-safe: workers must only read
+  // through the raw pointers of |packet| and never copy or destroy a
+  // TraceBlobView. The blobs they produce are owned by nobody else until
+  // they are handed back to this thread.
+  const size_t shard_count =
+      std::min(jobs.size(), static_cast<size_t>(std::max(max_shards, 1u)));
+  base::WaitableEvent all_done;
+  for (size_t shard = 0; shard < shard_count; ++shard) {
+    pool->PostTask([&jobs, &all_done, shard, shard_count] {
+      util::GzipDecompressor decompressor;
+      util::ZstdDecompressor zstd_decompressor;
+      for (size_t i = shard; i < jobs.size(); i += shard_count) {
+        BatchEntry* entry = jobs[i];
+        auto blob = entry->compression == Compression::kZstd
+                        ? DecompressBuffer(&zstd_decompressor,
+                                           entry->packet.data(),
+                                           entry->packet.length())
+                        : DecompressBuffer(&decompressor, entry->packet.data(),
+                                           entry->packet.length());
+        if (blob.ok()) {
+          entry->decompressed = std::move(*blob);
+        } else {
+          entry->decompress_status = blob.status();
+        }
+      }
+      all_done.Notify();
+    });
+  }
+  all_done.Wait(shard_count);
 }
 
 }  // namespace trace_processor
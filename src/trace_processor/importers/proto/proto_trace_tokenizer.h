@@ -18,9 +18,11 @@
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_PROTO_TRACE_TOKENIZER_H_
 
 #include <cstdint>
+#include <optional>
 #include <vector>
 
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/status_or.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/status.h"
@@ -28,11 +30,17 @@
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
+#include "src/trace_processor/util/zstd_utils.h"
 
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
 namespace perfetto {
+
+namespace base {
+class ThreadPool;
+}
+
 namespace trace_processor {
 
 // Reads a protobuf trace in chunks and extracts boundaries of trace packets
@@ -108,7 +116,55 @@ class ProtoTraceTokenizer {
     return ParseInternal(blob.slice(data, size), callback);
   }
 
+  // Same as Tokenize() but the |compressed_packets| (and
+  // |zstd_compressed_packets|) found in |blob| are inflated on |pool|, split in
+  // up to |max_shards| tasks, before |callback| is invoked. |callback| is still
+  // invoked on the calling thread for every packet and in the same order as
+  // Tokenize() would do.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status TokenizeParallel(TraceBlobView blob,
+                                base::ThreadPool* pool,
+                                uint32_t max_shards,
+                                Callback callback) {
+    PERFETTO_DCHECK(!pending_batch_);
+    std::vector<BatchEntry> batch;
+    pending_batch_ = &batch;
+    util::Status status =
+        Tokenize(std::move(blob), [](TraceBlobView) -> util::Status {
+          PERFETTO_FATAL("Packets should have been added to the batch");
+        });
+    pending_batch_ = nullptr;
+
+    // Even if tokenization failed half way through, deliver the packets seen
+    // before the failure to match the behaviour of Tokenize().
+    DecompressBatch(pool, max_shards, &batch);
+    for (BatchEntry& entry : batch) {
+      if (entry.compression == Compression::kNone) {
+        RETURN_IF_ERROR(callback(std::move(entry.packet)));
+        continue;
+      }
+      RETURN_IF_ERROR(entry.decompress_status);
+      PERFETTO_DCHECK(entry.decompressed.has_value());
+      RETURN_IF_ERROR(ParseDecompressedPackets(
+          TraceBlobView(std::move(*entry.decompressed)), callback));
+    }
+    return status;
+  }
+
  private:
+  enum class Compression { kNone, kDeflate, kZstd };
+
+  // A packet collected by TokenizeParallel(). If |compression| is not kNone,
+  // |packet| is the payload of a |compressed_packets| (or
+  // |zstd_compressed_packets|) field and, once inflated, |decompressed| holds
+  // its contents (or |decompress_status| the reason why inflating failed).
+  struct BatchEntry {
+    TraceBlobView packet;
+    Compression compression;
+    std::optional<TraceBlob> decompressed;
+    util::Status decompress_status;
+  };
+
   static constexpr uint8_t kTracePacketTag =
       protozero::proto_utils::MakeTagLengthDelimited(
           protos::pbzero::Trace::kPacketFieldNumber);
@@ -141,42 +197,92 @@ class ProtoTraceTokenizer {
   util::Status ParsePacket(TraceBlobView packet, Callback callback) {
     protos::pbzero::TracePacket::Decoder decoder(packet.data(),
                                                  packet.length());
+    Compression compression = Compression::kNone;
+    protozero::ConstBytes field{};
     if (decoder.has_compressed_packets()) {
       if (!util::IsGzipSupported()) {
         return util::Status(
             "Cannot decode compressed packets. Zlib not enabled");
       }
+      compression = Compression::kDeflate;
+      field = decoder.compressed_packets();
+    } else if (decoder.has_zstd_compressed_packets()) {
+      if (!util::IsZstdSupported()) {
+        return util::Status(
+            "Cannot decode zstd compressed packets. Zstd not enabled");
+      }
+      compression = Compression::kZstd;
+      field = decoder.zstd_compressed_packets();
+    }
 
-      protozero::ConstBytes field = decoder.compressed_packets();
+    if (compression != Compression::kNone) {
       TraceBlobView compressed_packets = packet.slice(field.data, field.size);
-      TraceBlobView packets;
-
-      RETURN_IF_ERROR(Decompress(std::move(compressed_packets), &packets));
-
-      const uint8_t* start = packets.data();
-      const uint8_t* end = packets.data() + packets.length();
-      const uint8_t* ptr = start;
-      while ((end - ptr) > 2) {
-        const uint8_t* packet_outer = ptr;
-        if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
-          return util::ErrStatus("Expected TracePacket tag");
-        uint64_t packet_size = 0;
-        ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
-        const uint8_t* packet_start = ptr;
-        ptr += packet_size;
-        if (PERFETTO_UNLIKELY((ptr - packet_outer) < 2 || ptr > end))
-          return util::ErrStatus("Invalid packet size");
-
-        TraceBlobView sliced =
-            packets.slice(packet_start, static_cast<size_t>(packet_size));
-        RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+      if (pending_batch_) {
+        pending_batch_->push_back(
+            {std::move(compressed_packets), compression, std::nullopt, {}});
+        return util::OkStatus();
       }
+
+      TraceBlobView packets;
+      RETURN_IF_ERROR(
+          Decompress(std::move(compressed_packets), compression, &packets));
+      return ParseDecompressedPackets(std::move(packets), callback);
+    }
+    if (pending_batch_) {
+      pending_batch_->push_back(
+          {std::move(packet), Compression::kNone, std::nullopt, {}});
       return util::OkStatus();
     }
     return callback(std::move(packet));
   }
 
-  util::Status Decompress(TraceBlobView input, TraceBlobView* output);
+  // Splits the inflated contents of a |compressed_packets| (or
+  // |zstd_compressed_packets|) field into packets.
+  template <typename Callback = util::Status(TraceBlobView)>
+  util::Status ParseDecompressedPackets(TraceBlobView packets,
+                                        Callback callback) {
+    const uint8_t* start = packets.data();
+    const uint8_t* end = packets.data() + packets.length();
+    const uint8_t* ptr = start;
+    while ((end - ptr) > 2) {
+      const uint8_t* packet_outer = ptr;
+      if (PERFETTO_UNLIKELY(*ptr != kTracePacketTag))
+        return util::ErrStatus("Expected TracePacket tag");
+      uint64_t packet_size = 0;
+      ptr = protozero::proto_utils::ParseVarInt(++ptr, end, &packet_size);
+      const uint8_t* packet_start = ptr;
+      ptr += packet_size;
+      if (PERFETTO_UNLIKELY((ptr - packet_outer) < 2 || ptr > end))
+        return util::ErrStatus("Invalid packet size");
+
+      TraceBlobView sliced =
+          packets.slice(packet_start, static_cast<size_t>(packet_size));
+      RETURN_IF_ERROR(ParsePacket(std::move(sliced), callback));
+    }
+    return util::OkStatus();
+  }
+
+  util::Status Decompress(TraceBlobView input,
+                          Compression compression,
+                          TraceBlobView* output);
+
+  // Inflates the compressed entries of |batch| on |pool|.
+  static void DecompressBatch(base::ThreadPool* pool,
+                              uint32_t max_shards,
+                              std::vector<BatchEntry>* batch);
+
+  // Inflates |size| bytes at |data| (which must contain a whole gzip stream)
+  // using |decompressor|.
+  static base::StatusOr<TraceBlob> DecompressBuffer(
+      util::GzipDecompressor* decompressor,
+      const uint8_t* data,
+      size_t size);
+
+  // Same as above, for a whole zstd stream.
+  static base::StatusOr<TraceBlob> DecompressBuffer(
+      util::ZstdDecompressor* decompressor,
+      const uint8_t* data,
+      size_t size);
 
   // Used to glue together trace packets that span across two (or more)
   // Parse() boundaries.
@@ -184,6 +290,11 @@ class ProtoTraceTokenizer {
 
   // Allows support for compressed trace packets.
   util::GzipDecompressor decompressor_;
+  util::ZstdDecompressor zstd_decompressor_;
+
+  // Set only for the duration of TokenizeParallel(): when set, packets are
+  // collected here instead of being passed to the callback.
+  std::vector<BatchEntry>* pending_batch_ = nullptr;
 };
 
 }  // namespace trace_processor
@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/proto_trace_tokenizer.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::testing::ElementsAreArray;
+
+std::string Compress(const std::string& input) {
+  uLongf output_len = compressBound(static_cast<uLong>(input.size()));
+  std::string output(output_len, '\0');
+  int ret = compress(reinterpret_cast<Bytef*>(&output[0]), &output_len,
+                     reinterpret_cast<const Bytef*>(input.data()),
+                     static_cast<uLong>(input.size()));
+  PERFETTO_CHECK(ret == Z_OK);
+  output.resize(output_len);
+  return output;
+}
+
+// Builds a trace with |count| packets where every other group of packets is
+// wrapped inside a |compressed_packets| field.
+std::vector<uint8_t> BuildTrace(uint32_t count) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  for (uint32_t i = 0; i < count;) {
+    if (i % 20 < 10) {
+      trace->add_packet()->set_timestamp(i++);
+      continue;
+    }
+    protozero::HeapBuffered<protos::pbzero::Trace> inner;
+    for (uint32_t j = 0; j < 10 && i < count; ++j)
+      inner->add_packet()->set_timestamp(i++);
+    trace->add_packet()->set_compressed_packets(
+        Compress(inner.SerializeAsString()));
+  }
+  return trace.SerializeAsArray();
+}
+
+std::vector<uint64_t> Tokenize(const std::vector<uint8_t>& trace,
+                               base::ThreadPool* pool,
+                               size_t chunk_size) {
+  ProtoTraceTokenizer tokenizer;
+  std::vector<uint64_t> timestamps;
+  auto callback = [&timestamps](TraceBlobView packet) {
+    protos::pbzero::TracePacket::Decoder decoder(packet.data(),
+                                                 packet.length());
+    timestamps.push_back(decoder.timestamp());
+    return util::OkStatus();
+  };
+  for (size_t off = 0; off < trace.size(); off += chunk_size) {
+    size_t size = std::min(chunk_size, trace.size() - off);
+    TraceBlobView chunk(TraceBlob::CopyFrom(trace.data() + off, size));
+    util::Status status =
+        pool ? tokenizer.TokenizeParallel(std::move(chunk), pool, 4, callback)
+             : tokenizer.Tokenize(std::move(chunk), callback);
+    PERFETTO_CHECK(status.ok());
+  }
+  return timestamps;
+}
+
+TEST(ProtoTraceTokenizerTest, ParallelMatchesSerial) {
+  std::vector<uint8_t> trace = BuildTrace(1000);
+  base::ThreadPool pool(4);
+  for (size_t chunk_size : {trace.size(), size_t(4096), size_t(33)}) {
+    std::vector<uint64_t> serial = Tokenize(trace, nullptr, chunk_size);
+    ASSERT_EQ(serial.size(), 1000u);
+    EXPECT_THAT(Tokenize(trace, &pool, chunk_size), ElementsAreArray(serial));
+  }
+}
+
+TEST(ProtoTraceTokenizerTest, ParallelReportsCorruptCompressedPackets) {
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  trace->add_packet()->set_timestamp(1);
+  trace->add_packet()->set_compressed_packets("not a zlib stream");
+  trace->add_packet()->set_timestamp(2);
+  std::vector<uint8_t> data = trace.SerializeAsArray();
+
+  base::ThreadPool pool(2);
+  ProtoTraceTokenizer tokenizer;
+  std::vector<uint64_t> timestamps;
+  util::Status status = tokenizer.TokenizeParallel(
+      TraceBlobView(TraceBlob::CopyFrom(data.data(), data.size())), &pool, 2,
+      [&timestamps](TraceBlobView packet) {
+        protos::pbzero::TracePacket::Decoder decoder(packet.data(),
+                                                     packet.length());
+        timestamps.push_back(decoder.timestamp());
+        return util::OkStatus();
+      });
+  EXPECT_FALSE(status.ok());
+  EXPECT_THAT(timestamps, ElementsAreArray({1u}));
+}
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+std::string ZstdCompress(const std::string& input) {
+  std::string output(ZSTD_compressBound(input.size()), '\0');
+  size_t size = ZSTD_compress(&output[0], output.size(), input.data(),
+                              input.size(), ZSTD_CLEVEL_DEFAULT);
+  PERFETTO_CHECK(!ZSTD_isError(size));
+  output.resize(size);
+  return output;
+}
+
+TEST(ProtoTraceTokenizerTest, ZstdCompressedPackets) {
+  // Alternates groups of packets compressed with zlib and with zstd.
+  protozero::HeapBuffered<protos::pbzero::Trace> trace;
+  uint32_t ts = 0;
+  for (uint32_t group = 0; group < 10; ++group) {
+    protozero::HeapBuffered<protos::pbzero::Trace> inner;
+    for (uint32_t j = 0; j < 10; ++j)
+      inner->add_packet()->set_timestamp(ts++);
+    std::string packets = inner.SerializeAsString();
+    if (group % 2) {
+      trace->add_packet()->set_zstd_compressed_packets(ZstdCompress(packets));
+    } else {
+      trace->add_packet()->set_compressed_packets(Compress(packets));
+    }
+  }
+  std::vector<uint8_t> data = trace.SerializeAsArray();
+
+  std::vector<uint64_t> expected(100);
+  std::iota(expected.begin(), expected.end(), 0);
+  base::ThreadPool pool(4);
+  EXPECT_THAT(Tokenize(data, nullptr, data.size()), ElementsAreArray(expected));
+  EXPECT_THAT(Tokenize(data, &pool, 64), ElementsAreArray(expected));
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
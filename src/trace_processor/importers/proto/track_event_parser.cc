@@ -35,6 +35,7 @@
 #include "src/trace_processor/importers/proto/packet_analyzer.h"
 #include "src/trace_processor/importers/proto/profile_packet_utils.h"
 #include "src/trace_processor/importers/proto/stack_profile_sequence_state.h"
+#include "src/trace_processor/importers/proto/track_event_sequence_state.h"
 #include "src/trace_processor/importers/proto/track_event_tracker.h"
 #include "src/trace_processor/util/debug_annotation_parser.h"
 #include "src/trace_processor/util/proto_to_args_parser.h"
@@ -170,18 +171,6 @@ class TrackEventArgsParser : public util::ProtoToArgsParser::Delegate {
 
 TrackEventArgsParser::~TrackEventArgsParser() = default;
 
-// Paths on Windows use backslash rather than slash as a separator.
-// Normalise the paths by replacing backslashes with slashes to make it
-// easier to write cross-platform scripts.
-std::string NormalizePathSeparators(const protozero::ConstChars& path) {
-  std::string result(path.data, path.size);
-  for (char& c : result) {
-    if (c == '\\')
-      c = '/';
-  }
-  return result;
-}
-
 std::optional<base::Status> MaybeParseUnsymbolizedSourceLocation(
     std::string prefix,
     const protozero::Field& field,
@@ -213,22 +202,28 @@ std::optional<base::Status> MaybeParseUnsymbolizedSourceLocation(
 std::optional<base::Status> MaybeParseSourceLocation(
     std::string prefix,
     const protozero::Field& field,
-    util::ProtoToArgsParser::Delegate& delegate) {
-  auto* decoder = delegate.GetInternedMessage(
-      protos::pbzero::InternedData::kSourceLocations, field.as_uint64());
-  if (!decoder) {
+    util::ProtoToArgsParser::Delegate& delegate,
+    const TraceStorage& storage) {
+  auto location = delegate.seq_state()
+                      ->GetOrCreate<TrackEventSequenceState>()
+                      ->GetSourceLocation(field.as_uint64());
+  if (!location) {
     // Lookup failed fall back on default behaviour which will just put
     // the source_location_iid into the args table.
     return std::nullopt;
   }
 
+  NullTermStringView file_name = storage.GetString(location->file_name);
+  NullTermStringView function_name =
+      storage.GetString(location->function_name);
   delegate.AddString(util::ProtoToArgsParser::Key(prefix + ".file_name"),
-                     NormalizePathSeparators(decoder->file_name()));
-  delegate.AddString(util::ProtoToArgsParser::Key(prefix + ".function_name"),
-                     decoder->function_name());
-  if (decoder->has_line_number()) {
+                     protozero::ConstChars{file_name.data(), file_name.size()});
+  delegate.AddString(
+      util::ProtoToArgsParser::Key(prefix + ".function_name"),
+      protozero::ConstChars{function_name.data(), function_name.size()});
+  if (location->line_number) {
     delegate.AddInteger(util::ProtoToArgsParser::Key(prefix + ".line_number"),
-                        decoder->line_number());
+                        *location->line_number);
   }
 
   return base::OkStatus();
@@ -274,6 +269,8 @@ class TrackEventParser::EventImporter {
         ts_(ts),
         event_data_(event_data),
         sequence_state_(event_data->trace_packet_data.sequence_state.get()),
+        track_event_state_(
+            sequence_state_->GetOrCreate<TrackEventSequenceState>()),
         blob_(std::move(blob)),
         event_(blob_),
         legacy_event_(event_.legacy_event()),
@@ -373,11 +370,10 @@ class TrackEventParser::EventImporter {
     // string.
     if (PERFETTO_LIKELY(category_iids.size() == 1 &&
                         category_strings.empty())) {
-      auto* decoder = sequence_state_->LookupInternedMessage<
-          protos::pbzero::InternedData::kEventCategoriesFieldNumber,
-          protos::pbzero::EventCategory>(category_iids[0]);
-      if (decoder) {
-        category_id = storage_->InternString(decoder->name());
+      std::optional<StringId> interned_category_id =
+          track_event_state_->GetEventCategory(category_iids[0]);
+      if (interned_category_id) {
+        category_id = *interned_category_id;
       } else {
         char buffer[32];
         base::StringWriter writer(buffer, sizeof(buffer));
@@ -394,12 +390,11 @@ class TrackEventParser::EventImporter {
       // TODO(eseckler): Support multi-category events in the table schema.
       std::string categories;
       for (uint64_t iid : category_iids) {
-        auto* decoder = sequence_state_->LookupInternedMessage<
-            protos::pbzero::InternedData::kEventCategoriesFieldNumber,
-            protos::pbzero::EventCategory>(iid);
-        if (!decoder)
+        std::optional<StringId> interned_category_id =
+            track_event_state_->GetEventCategory(iid);
+        if (!interned_category_id)
           continue;
-        base::StringView name = decoder->name();
+        NullTermStringView name = storage_->GetString(*interned_category_id);
         if (!categories.empty())
           categories.append(",");
         categories.append(name.data(), name.size());
@@ -422,11 +417,10 @@ class TrackEventParser::EventImporter {
       name_iid = legacy_event_.name_iid();
 
     if (PERFETTO_LIKELY(name_iid)) {
-      auto* decoder = sequence_state_->LookupInternedMessage<
-          protos::pbzero::InternedData::kEventNamesFieldNumber,
-          protos::pbzero::EventName>(name_iid);
-      if (decoder)
-        return storage_->InternString(decoder->name());
+      std::optional<StringId> name_id =
+          track_event_state_->GetEventName(name_iid);
+      if (name_id)
+        return *name_id;
     } else if (event_.has_name()) {
       return storage_->InternString(event_.name());
     }
@@ -1238,9 +1232,8 @@ class TrackEventParser::EventImporter {
 
     {
       auto key = parser_->args_parser_.EnterDictionary("debug");
-      util::DebugAnnotationParser parser(parser_->args_parser_);
       for (auto it = event_.debug_annotations(); it; ++it) {
-        log_errors(parser.Parse(*it, args_writer));
+        log_errors(parser_->debug_annotation_parser_.Parse(*it, args_writer));
       }
     }
 
@@ -1258,27 +1251,17 @@ class TrackEventParser::EventImporter {
     if (!iid)
       return util::ErrStatus("TaskExecution with invalid posted_from_iid");
 
-    auto* decoder = sequence_state_->LookupInternedMessage<
-        protos::pbzero::InternedData::kSourceLocationsFieldNumber,
-        protos::pbzero::SourceLocation>(iid);
-    if (!decoder)
+    auto location = track_event_state_->GetSourceLocation(iid);
+    if (!location)
       return util::ErrStatus("TaskExecution with invalid posted_from_iid");
 
-    StringId file_name_id = kNullStringId;
-    StringId function_name_id = kNullStringId;
-    uint32_t line_number = 0;
-
-    std::string file_name = NormalizePathSeparators(decoder->file_name());
-    file_name_id = storage_->InternString(base::StringView(file_name));
-    function_name_id = storage_->InternString(decoder->function_name());
-    line_number = decoder->line_number();
-
     inserter->AddArg(parser_->task_file_name_args_key_id_,
-                     Variadic::String(file_name_id));
+                     Variadic::String(location->file_name));
     inserter->AddArg(parser_->task_function_name_args_key_id_,
-                     Variadic::String(function_name_id));
-    inserter->AddArg(parser_->task_line_number_args_key_id_,
-                     Variadic::UnsignedInteger(line_number));
+                     Variadic::String(location->function_name));
+    inserter->AddArg(
+        parser_->task_line_number_args_key_id_,
+        Variadic::UnsignedInteger(location->line_number.value_or(0)));
     return util::OkStatus();
   }
 
@@ -1286,27 +1269,17 @@ class TrackEventParser::EventImporter {
     if (!iid)
       return util::ErrStatus("SourceLocation with invalid iid");
 
-    auto* decoder = sequence_state_->LookupInternedMessage<
-        protos::pbzero::InternedData::kSourceLocationsFieldNumber,
-        protos::pbzero::SourceLocation>(iid);
-    if (!decoder)
+    auto location = track_event_state_->GetSourceLocation(iid);
+    if (!location)
       return util::ErrStatus("SourceLocation with invalid iid");
 
-    StringId file_name_id = kNullStringId;
-    StringId function_name_id = kNullStringId;
-    uint32_t line_number = 0;
-
-    std::string file_name = NormalizePathSeparators(decoder->file_name());
-    file_name_id = storage_->InternString(base::StringView(file_name));
-    function_name_id = storage_->InternString(decoder->function_name());
-    line_number = decoder->line_number();
-
     inserter->AddArg(parser_->source_location_file_name_key_id_,
-                     Variadic::String(file_name_id));
+                     Variadic::String(location->file_name));
     inserter->AddArg(parser_->source_location_function_name_key_id_,
-                     Variadic::String(function_name_id));
-    inserter->AddArg(parser_->source_location_line_number_key_id_,
-                     Variadic::UnsignedInteger(line_number));
+                     Variadic::String(location->function_name));
+    inserter->AddArg(
+        parser_->source_location_line_number_key_id_,
+        Variadic::UnsignedInteger(location->line_number.value_or(0)));
     return util::OkStatus();
   }
 
@@ -1414,6 +1387,7 @@ class TrackEventParser::EventImporter {
   int64_t ts_;
   const TrackEventData* event_data_;
   PacketSequenceStateGeneration* sequence_state_;
+  TrackEventSequenceState* const track_event_state_;
   ConstBytes blob_;
   TrackEvent::Decoder event_;
   LegacyEvent::Decoder legacy_event_;
@@ -1440,6 +1414,7 @@ class TrackEventParser::EventImporter {
 TrackEventParser::TrackEventParser(TraceProcessorContext* context,
                                    TrackEventTracker* track_event_tracker)
     : args_parser_(*context->descriptor_pool_.get()),
+      debug_annotation_parser_(args_parser_),
       context_(context),
       track_event_tracker_(track_event_tracker),
       counter_name_thread_time_id_(
@@ -1543,32 +1518,32 @@ TrackEventParser::TrackEventParser(TraceProcessorContext* context,
   // Switch |source_location_iid| into its interned data variant.
   args_parser_.AddParsingOverrideForField(
       "begin_impl_frame_args.current_args.source_location_iid",
-      [](const protozero::Field& field,
-         util::ProtoToArgsParser::Delegate& delegate) {
+      [this](const protozero::Field& field,
+             util::ProtoToArgsParser::Delegate& delegate) {
         return MaybeParseSourceLocation("begin_impl_frame_args.current_args",
-                                        field, delegate);
+                                        field, delegate, *context_->storage);
       });
   args_parser_.AddParsingOverrideForField(
       "begin_impl_frame_args.last_args.source_location_iid",
-      [](const protozero::Field& field,
-         util::ProtoToArgsParser::Delegate& delegate) {
+      [this](const protozero::Field& field,
+             util::ProtoToArgsParser::Delegate& delegate) {
         return MaybeParseSourceLocation("begin_impl_frame_args.last_args",
-                                        field, delegate);
+                                        field, delegate, *context_->storage);
       });
   args_parser_.AddParsingOverrideForField(
       "begin_frame_observer_state.last_begin_frame_args.source_location_iid",
-      [](const protozero::Field& field,
-         util::ProtoToArgsParser::Delegate& delegate) {
+      [this](const protozero::Field& field,
+             util::ProtoToArgsParser::Delegate& delegate) {
         return MaybeParseSourceLocation(
             "begin_frame_observer_state.last_begin_frame_args", field,
-            delegate);
+            delegate, *context_->storage);
       });
   args_parser_.AddParsingOverrideForField(
       "chrome_memory_pressure_notification.creation_location_iid",
-      [](const protozero::Field& field,
-         util::ProtoToArgsParser::Delegate& delegate) {
+      [this](const protozero::Field& field,
+             util::ProtoToArgsParser::Delegate& delegate) {
         return MaybeParseSourceLocation("chrome_memory_pressure_notification",
-                                        field, delegate);
+                                        field, delegate, *context_->storage);
       });
 
   // Parse DebugAnnotations.
@@ -1579,8 +1554,7 @@ TrackEventParser::TrackEventParser(TraceProcessorContext* context,
           util::ProtoToArgsParser::Delegate& delegate) {
         // Do not add "debug_annotations" to the final key.
         key.RemoveFieldSuffix();
-        util::DebugAnnotationParser annotation_parser(args_parser_);
-        return annotation_parser.Parse(data, delegate);
+        return debug_annotation_parser_.Parse(data, delegate);
       });
 
   args_parser_.AddParsingOverrideForField(
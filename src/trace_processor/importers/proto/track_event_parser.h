@@ -29,6 +29,7 @@
 #include "src/trace_processor/importers/proto/active_chrome_processes_tracker.h"
 #include "src/trace_processor/importers/proto/chrome_string_lookup.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/util/debug_annotation_parser.h"
 #include "src/trace_processor/util/proto_to_args_parser.h"
 
 #include "protos/perfetto/trace/track_event/track_event.pbzero.h"
@@ -45,7 +46,7 @@ namespace trace_processor {
 // TODO(ddrone): replace with a predicate on field id to import new fields
 // automatically
 static constexpr uint16_t kReflectFields[] = {
-    24, 25, 26, 27, 28, 29, 32, 33, 34, 35, 38, 39, 40, 41, 43, 49, 50};
+    24, 25, 26, 27, 28, 29, 32, 33, 34, 35, 38, 39, 40, 41, 43, 49, 50, 52};
 
 class PacketSequenceStateGeneration;
 class TraceProcessorContext;
@@ -79,6 +80,8 @@ class TrackEventParser {
 
   // Reflection-based proto TrackEvent field parser.
   util::ProtoToArgsParser args_parser_;
+  // Shared by all the events, to reuse its buffers.
+  util::DebugAnnotationParser debug_annotation_parser_;
 
   TraceProcessorContext* context_;
   TrackEventTracker* track_event_tracker_;
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/importers/proto/track_event_sequence_state.h"
+
+#include <string>
+
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/track_event/source_location.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+using ::perfetto::protos::pbzero::InternedData;
+
+}  // namespace
+
+TrackEventSequenceState::TrackEventSequenceState(
+    TraceProcessorContext* context)
+    : storage_(context->storage.get()) {}
+
+TrackEventSequenceState::~TrackEventSequenceState() = default;
+
+std::optional<StringId> TrackEventSequenceState::GetEventName(uint64_t iid) {
+  if (auto* id = event_names_.Find(iid); id != nullptr) {
+    return *id;
+  }
+
+  auto* decoder = LookupInternedMessage<InternedData::kEventNamesFieldNumber,
+                                        protos::pbzero::EventName>(iid);
+  if (!decoder) {
+    return std::nullopt;
+  }
+
+  StringId name_id = storage_->InternString(decoder->name());
+  event_names_.Insert(iid, name_id);
+  return name_id;
+}
+
+std::optional<StringId> TrackEventSequenceState::GetEventCategory(
+    uint64_t iid) {
+  if (auto* id = event_categories_.Find(iid); id != nullptr) {
+    return *id;
+  }
+
+  auto* decoder =
+      LookupInternedMessage<InternedData::kEventCategoriesFieldNumber,
+                            protos::pbzero::EventCategory>(iid);
+  if (!decoder) {
+    return std::nullopt;
+  }
+
+  StringId category_id = storage_->InternString(decoder->name());
+  event_categories_.Insert(iid, category_id);
+  return category_id;
+}
+
+std::optional<TrackEventSequenceState::SourceLocation>
+TrackEventSequenceState::GetSourceLocation(uint64_t iid) {
+  if (auto* location = source_locations_.Find(iid); location != nullptr) {
+    return *location;
+  }
+
+  auto* decoder =
+      LookupInternedMessage<InternedData::kSourceLocationsFieldNumber,
+                            protos::pbzero::SourceLocation>(iid);
+  if (!decoder) {
+    return std::nullopt;
+  }
+
+  // Paths on Windows use backslash rather than slash as a separator.
+  // Normalise the paths by replacing backslashes with slashes to make it
+  // easier to write cross-platform scripts.
+  std::string file_name = decoder->file_name().ToStdString();
+  for (char& c : file_name) {
+    if (c == '\\')
+      c = '/';
+  }
+
+  SourceLocation location;
+  location.file_name = storage_->InternString(base::StringView(file_name));
+  location.function_name = storage_->InternString(decoder->function_name());
+  if (decoder->has_line_number())
+    location.line_number = decoder->line_number();
+  source_locations_.Insert(iid, location);
+  return location;
+}
+
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_TRACK_EVENT_SEQUENCE_STATE_H_
+#define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_TRACK_EVENT_SEQUENCE_STATE_H_
+
+#include <cstdint>
+#include <optional>
+
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "src/trace_processor/importers/proto/packet_sequence_state_generation.h"
+#include "src/trace_processor/storage/trace_storage.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+class TraceProcessorContext;
+
+// Resolves the interned data most track events refer to (names, categories
+// and source locations) to interned strings. Each entry is decoded and
+// interned in the string pool the first time it is looked up in an interning
+// context; later lookups of the same iid are a single hash map lookup.
+class TrackEventSequenceState final
+    : public PacketSequenceStateGeneration::InternedDataTracker {
+ public:
+  struct SourceLocation {
+    // With path separators normalized to slashes.
+    StringId file_name;
+    StringId function_name;
+    std::optional<uint32_t> line_number;
+  };
+
+  explicit TrackEventSequenceState(TraceProcessorContext* context);
+
+  ~TrackEventSequenceState() override;
+
+  // All these return std::nullopt (and record a stat) if |iid| was not
+  // interned.
+  std::optional<StringId> GetEventName(uint64_t iid);
+  std::optional<StringId> GetEventCategory(uint64_t iid);
+  std::optional<SourceLocation> GetSourceLocation(uint64_t iid);
+
+ private:
+  TraceStorage* const storage_;
+
+  using InterningId = uint64_t;
+  base::FlatHashMap<InterningId, StringId> event_names_;
+  base::FlatHashMap<InterningId, StringId> event_categories_;
+  base::FlatHashMap<InterningId, SourceLocation> source_locations_;
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_TRACK_EVENT_SEQUENCE_STATE_H_
@@ -62,19 +62,14 @@ void SurfaceFlingerLayersParser::Parse(int64_t timestamp,
 void SurfaceFlingerLayersParser::ParseLayer(
     protozero::ConstBytes blob,
     tables::SurfaceFlingerLayersSnapshotTable::Id snapshot_id) {
+  // Layers make up the bulk of the snapshot: rather than turning every field
+  // into args, retain the raw proto and let winscope_proto_to_args decode it
+  // when the layer is queried.
   tables::SurfaceFlingerLayerTable::Row layer;
   layer.snapshot_id = snapshot_id;
-  auto layerId =
-      context_->storage->mutable_surfaceflinger_layer_table()->Insert(layer).id;
-
-  ArgsTracker tracker(context_);
-  auto inserter = tracker.AddArgsTo(layerId);
-  WinscopeArgsParser writer(inserter, *context_->storage.get());
-  base::Status status = args_parser_.ParseMessage(
-      blob, kLayerProtoName, nullptr /* parse all fields */, writer);
-  if (!status.ok()) {
-    context_->storage->IncrementStats(stats::winscope_sf_layers_parse_errors);
-  }
+  layer.proto_index =
+      context_->storage->mutable_winscope_protos()->Append(blob);
+  context_->storage->mutable_surfaceflinger_layer_table()->Insert(layer);
 }
 
 }  // namespace trace_processor
@@ -37,7 +37,6 @@ class SurfaceFlingerLayersParser {
                                                                     6, 7, 8};
   static constexpr auto* kLayersSnapshotProtoName =
       ".perfetto.protos.LayersSnapshotProto";
-  static constexpr auto* kLayerProtoName = ".perfetto.protos.LayerProto";
 
   void ParseLayer(protozero::ConstBytes blob,
                   tables::SurfaceFlingerLayersSnapshotTable::Id);
@@ -16,10 +16,6 @@
 
 #include "src/trace_processor/importers/proto/winscope/surfaceflinger_transactions_parser.h"
 
-#include "protos/perfetto/trace/android/surfaceflinger_transactions.pbzero.h"
-#include "src/trace_processor/importers/common/args_tracker.h"
-#include "src/trace_processor/importers/proto/winscope/winscope.descriptor.h"
-#include "src/trace_processor/importers/proto/winscope/winscope_args_parser.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 
@@ -28,29 +24,16 @@ namespace trace_processor {
 
 SurfaceFlingerTransactionsParser::SurfaceFlingerTransactionsParser(
     TraceProcessorContext* context)
-    : context_{context}, args_parser_{pool_} {
-  pool_.AddFromFileDescriptorSet(kWinscopeDescriptor.data(),
-                                 kWinscopeDescriptor.size());
-}
+    : context_{context} {}
 
 void SurfaceFlingerTransactionsParser::Parse(int64_t timestamp,
                                              protozero::ConstBytes blob) {
+  // The transactions are only decoded into args when queried through
+  // winscope_proto_to_args.
   tables::SurfaceFlingerTransactionsTable::Row row;
   row.ts = timestamp;
-  auto rowId = context_->storage->mutable_surfaceflinger_transactions_table()
-                   ->Insert(row)
-                   .id;
-
-  ArgsTracker tracker(context_);
-  auto inserter = tracker.AddArgsTo(rowId);
-  WinscopeArgsParser writer(inserter, *context_->storage.get());
-  base::Status status =
-      args_parser_.ParseMessage(blob, kTransactionTraceEntryProtoName,
-                                nullptr /* parse all fields */, writer);
-  if (!status.ok()) {
-    context_->storage->IncrementStats(
-        stats::winscope_sf_transactions_parse_errors);
-  }
+  row.proto_index = context_->storage->mutable_winscope_protos()->Append(blob);
+  context_->storage->mutable_surfaceflinger_transactions_table()->Insert(row);
 }
 
 }  // namespace trace_processor
@@ -17,8 +17,9 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_WINSCOPE_SURFACEFLINGER_TRANSACTIONS_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_PROTO_WINSCOPE_SURFACEFLINGER_TRANSACTIONS_PARSER_H_
 
-#include "src/trace_processor/util/descriptors.h"
-#include "src/trace_processor/util/proto_to_args_parser.h"
+#include <cstdint>
+
+#include "perfetto/protozero/field.h"
 
 namespace perfetto {
 
@@ -32,12 +33,7 @@ class SurfaceFlingerTransactionsParser {
   void Parse(int64_t timestamp, protozero::ConstBytes);
 
  private:
-  static constexpr auto* kTransactionTraceEntryProtoName =
-      ".perfetto.protos.TransactionTraceEntry";
-
   TraceProcessorContext* const context_;
-  DescriptorPool pool_;
-  util::ProtoToArgsParser args_parser_;
 };
 }  // namespace trace_processor
 }  // namespace perfetto
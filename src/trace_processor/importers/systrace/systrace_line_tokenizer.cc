@@ -16,6 +16,10 @@
 
 #include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
 
+#include <cstring>
+#include <limits>
+#include <optional>
+
 #include "perfetto/ext/base/string_utils.h"
 
 // On windows std::isspace if overloaded in <locale>. MSBUILD via bazel
@@ -27,26 +31,160 @@ namespace perfetto {
 namespace trace_processor {
 
 namespace {
-std::string SubstrTrim(const std::string& input) {
-  std::string s = input;
-  s.erase(s.begin(), std::find_if(s.begin(), s.end(),
-                                  [](char ch) { return !std::isspace(ch); }));
-  s.erase(std::find_if(s.rbegin(), s.rend(),
-                       [](char ch) { return !std::isspace(ch); })
-              .base(),
-          s.end());
+
+// The fields of a line matched by MatchPrefix(). All the views point into the
+// line.
+struct PrefixMatch {
+  base::StringView pid;
+  base::StringView tgid;
+  base::StringView cpu;
+  base::StringView ts;
+  base::StringView event_name;
+  // The rest of the line, after the ':' following the event name.
+  const char* suffix;
+};
+
+bool IsSpace(char c) {
+  return std::isspace(static_cast<unsigned char>(c));
+}
+
+bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+bool IsFlag(char c) {
+  return std::isalnum(static_cast<unsigned char>(c)) || c == '.';
+}
+
+const char* SkipSpaces(const char* s, const char* end) {
+  while (s < end && IsSpace(*s))
+    s++;
+  return s;
+}
+
+const char* SkipDigits(const char* s, const char* end) {
+  while (s < end && IsDigit(*s))
+    s++;
   return s;
 }
-}  // namespace
 
-SystraceLineTokenizer::SystraceLineTokenizer()
-    : line_matcher_(std::regex(R"(-(\d+)\s+\(?\s*(\d+|-+)?\)?\s?\[(\d+)\]\s*)"
-                               R"([a-zA-Z0-9.]{0,5}\s+(\d+\.\d+):\s+(\S+):)")) {
+base::StringView MakeView(const char* begin, const char* end) {
+  return base::StringView(begin, static_cast<size_t>(end - begin));
 }
 
+base::StringView Trim(const char* begin, const char* end) {
+  while (begin < end && IsSpace(*begin))
+    begin++;
+  while (end > begin && IsSpace(end[-1]))
+    end--;
+  return MakeView(begin, end);
+}
+
+// Matches "(\d+\.\d+):\s+(\S+):" at |s|.
+bool MatchTimestampAndEvent(const char* s, const char* end, PrefixMatch* m) {
+  const char* ts_begin = s;
+  s = SkipDigits(s, end);
+  if (s == ts_begin || s == end || *s != '.')
+    return false;
+  const char* frac_begin = ++s;
+  s = SkipDigits(s, end);
+  if (s == frac_begin || s == end || *s != ':')
+    return false;
+  m->ts = MakeView(ts_begin, s);
+
+  const char* spaces_begin = ++s;
+  s = SkipSpaces(s, end);
+  if (s == spaces_begin)
+    return false;
+
+  // The event name extends until the last ':' of the following run of
+  // non-space characters (\S+ being greedy).
+  const char* name_begin = s;
+  const char* colon = nullptr;
+  for (; s < end && !IsSpace(*s); ++s) {
+    if (*s == ':' && s != name_begin)
+      colon = s;
+  }
+  if (!colon)
+    return false;
+  m->event_name = MakeView(name_begin, colon);
+  m->suffix = colon + 1;
+  return true;
+}
+
+// Matches the fixed prefix of a systrace line, starting at the '-' which
+// separates the task name from the pid.
+bool MatchPrefixAt(const char* s, const char* end, PrefixMatch* m) {
+  PERFETTO_DCHECK(*s == '-');
+
+  // -(\d+)\s+
+  const char* pid_begin = ++s;
+  s = SkipDigits(s, end);
+  if (s == pid_begin)
+    return false;
+  m->pid = MakeView(pid_begin, s);
+  const char* spaces_begin = s;
+  s = SkipSpaces(s, end);
+  if (s == spaces_begin)
+    return false;
+
+  // \(?\s*(\d+|-+)?\)?\s?
+  if (s < end && *s == '(')
+    s = SkipSpaces(s + 1, end);
+  const char* tgid_begin = s;
+  if (s < end && IsDigit(*s)) {
+    s = SkipDigits(s, end);
+  } else {
+    while (s < end && *s == '-')
+      s++;
+  }
+  m->tgid = MakeView(tgid_begin, s);
+  if (s < end && *s == ')')
+    s++;
+  if (s < end && IsSpace(*s) && s + 1 < end && s[1] == '[')
+    s++;
+
+  // \[(\d+)\]
+  if (s == end || *s != '[')
+    return false;
+  const char* cpu_begin = ++s;
+  s = SkipDigits(s, end);
+  if (s == cpu_begin || s == end || *s != ']')
+    return false;
+  m->cpu = MakeView(cpu_begin, s);
+  const char* after_cpu = ++s;
+
+  // \s*[a-zA-Z0-9.]{0,5}\s+: the irq flags are optional. Try with them first,
+  // as the regex would.
+  const char* flags_begin = SkipSpaces(after_cpu, end);
+  const char* flags_end = flags_begin;
+  while (flags_end < end && IsFlag(*flags_end))
+    flags_end++;
+  if (flags_end > flags_begin && flags_end - flags_begin <= 5) {
+    const char* ts_begin = SkipSpaces(flags_end, end);
+    if (ts_begin > flags_end && MatchTimestampAndEvent(ts_begin, end, m))
+      return true;
+  }
+  return flags_begin > after_cpu &&
+         MatchTimestampAndEvent(flags_begin, end, m);
+}
+
+std::optional<uint32_t> ParseUInt32(base::StringView digits) {
+  if (digits.empty() || digits.size() > 10)
+    return std::nullopt;
+  uint64_t value = 0;
+  for (char c : digits)
+    value = value * 10 + static_cast<uint64_t>(c - '0');
+  if (value > std::numeric_limits<uint32_t>::max())
+    return std::nullopt;
+  return static_cast<uint32_t>(value);
+}
+
+}  // namespace
+
 // TODO(hjd): This should be more robust to being passed random input.
 // This can happen if we mess up detecting a gzip trace for example.
-util::Status SystraceLineTokenizer::Tokenize(const std::string& buffer,
+util::Status SystraceLineTokenizer::Tokenize(base::StringView buffer,
                                              SystraceLine* line) {
   // An example line from buffer looks something like the following:
   // kworker/u16:1-77    (   77) [004] ....   316.196720: 0:
@@ -59,38 +197,41 @@ util::Status SystraceLineTokenizer::Tokenize(const std::string& buffer,
   // <idle>-0     [000]  0.002188: task_newtask: pid=1 ...
   //
   // The task name can contain any characters e.g -:[(/ and for this reason
-  // it is much easier to use a regex (even though it is slower than parsing
-  // manually)
-
-  std::smatch matches;
-  bool matched = std::regex_search(buffer, matches, line_matcher_);
-  if (!matched) {
-    return util::ErrStatus("Not a known systrace event format (line: %s)",
-                           buffer.c_str());
+  // the prefix is matched from each '-' in turn, leftmost first, until the
+  // rest of the line fits.
+  const char* begin = buffer.data();
+  const char* end = buffer.data() + buffer.size();
+  PrefixMatch match;
+  const char* dash = begin;
+  for (;; ++dash) {
+    dash = static_cast<const char*>(
+        memchr(dash, '-', static_cast<size_t>(end - dash)));
+    if (!dash) {
+      return util::ErrStatus("Not a known systrace event format (line: %s)",
+                             buffer.ToStdString().c_str());
+    }
+    if (MatchPrefixAt(dash, end, &match))
+      break;
   }
 
-  std::string pid_str = matches[1].str();
-  std::string cpu_str = matches[3].str();
-  std::string ts_str = matches[4].str();
-
-  line->task = SubstrTrim(matches.prefix());
-  line->tgid_str = matches[2].str();
-  line->event_name = matches[5].str();
-  line->args_str = SubstrTrim(matches.suffix());
+  line->task = Trim(begin, dash).ToStdString();
+  line->tgid_str = match.tgid.ToStdString();
+  line->event_name = match.event_name.ToStdString();
+  line->args_str = Trim(match.suffix, end).ToStdString();
 
-  std::optional<uint32_t> maybe_pid = base::StringToUInt32(pid_str);
+  std::optional<uint32_t> maybe_pid = ParseUInt32(match.pid);
   if (!maybe_pid.has_value()) {
-    return util::Status("Could not convert pid " + pid_str);
+    return util::Status("Could not convert pid " + match.pid.ToStdString());
   }
   line->pid = maybe_pid.value();
 
-  std::optional<uint32_t> maybe_cpu = base::StringToUInt32(cpu_str);
+  std::optional<uint32_t> maybe_cpu = ParseUInt32(match.cpu);
   if (!maybe_cpu.has_value()) {
-    return util::Status("Could not convert cpu " + cpu_str);
+    return util::Status("Could not convert cpu " + match.cpu.ToStdString());
   }
   line->cpu = maybe_cpu.value();
 
-  std::optional<double> maybe_ts = base::StringToDouble(ts_str);
+  std::optional<double> maybe_ts = base::StringToDouble(match.ts.ToStdString());
   if (!maybe_ts.has_value()) {
     return util::Status("Could not convert ts");
   }
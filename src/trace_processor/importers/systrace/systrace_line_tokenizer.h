@@ -17,8 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_TOKENIZER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_LINE_TOKENIZER_H_
 
-#include <regex>
-
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/trace_processor/status.h"
 
 #include "src/trace_processor/importers/systrace/systrace_line.h"
@@ -26,14 +25,15 @@
 namespace perfetto {
 namespace trace_processor {
 
+// Splits a line of systrace text into the fields of the fixed prefix
+// (task-pid, tgid, cpu, flags, ts) and the event name and args which follow.
+// This is a hand-written scanner equivalent to the regex
+//   -(\d+)\s+\(?\s*(\d+|-+)?\)?\s?\[(\d+)\]\s*[a-zA-Z0-9.]{0,5}\s+
+//   (\d+\.\d+):\s+(\S+):
+// searched from the start of the line.
 class SystraceLineTokenizer {
  public:
-  SystraceLineTokenizer();
-
-  util::Status Tokenize(const std::string& line, SystraceLine*);
-
- private:
-  const std::regex line_matcher_;
+  util::Status Tokenize(base::StringView line, SystraceLine*);
 };
 
 }  // namespace trace_processor
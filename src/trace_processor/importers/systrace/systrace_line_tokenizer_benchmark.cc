@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/string_view.h"
+#include "src/trace_processor/importers/systrace/systrace_line.h"
+#include "src/trace_processor/importers/systrace/systrace_line_tokenizer.h"
+#include "src/trace_processor/util/streaming_line_reader.h"
+
+namespace {
+
+using benchmark::Counter;
+using perfetto::base::StringView;
+using perfetto::trace_processor::SystraceLine;
+using perfetto::trace_processor::SystraceLineTokenizer;
+using perfetto::trace_processor::util::StreamingLineReader;
+
+// A mix of the line formats seen in systrace text dumps: with and without
+// tgid and irq flags, and task names containing '-'.
+std::string GenerateSystraceText(size_t line_count) {
+  static const char* const kFormats[] = {
+      "     kworker/u16:1-77    (   77) [004] ....   %" PRIu64
+      ".%06u: sched_waking: comm=foo pid=1234 prio=120 target_cpu=002\n",
+      "          <idle>-0     [000] d..2     %" PRIu64
+      ".%06u: sched_switch: prev_comm=swapper/0 prev_pid=0 prev_prio=120 "
+      "prev_state=R ==> next_comm=surfaceflinger next_pid=598 next_prio=97\n",
+      " Binder:1234-5678  ( 1234) [002]  %" PRIu64
+      ".%06u: tracing_mark_write: B|1234|binder transaction async\n",
+  };
+  std::string text;
+  for (size_t i = 0; i < line_count; ++i) {
+    char line[512];
+    snprintf(line, sizeof(line), kFormats[i % 3],
+             static_cast<uint64_t>(100 + i / 1000),
+             static_cast<unsigned>((i % 1000) * 1000));
+    text += line;
+  }
+  return text;
+}
+
+void BM_SystraceLineTokenizer(benchmark::State& state) {
+  std::string text = GenerateSystraceText(10000);
+  std::vector<StringView> lines;
+  for (size_t pos = 0, next; (next = text.find('\n', pos)) != std::string::npos;
+       pos = next + 1) {
+    lines.emplace_back(text.data() + pos, next - pos);
+  }
+
+  SystraceLineTokenizer tokenizer;
+  for (auto _ : state) {
+    for (StringView line : lines) {
+      SystraceLine parsed;
+      PERFETTO_CHECK(tokenizer.Tokenize(line, &parsed).ok());
+      benchmark::DoNotOptimize(parsed);
+    }
+  }
+  state.counters["lines/s"] = Counter(static_cast<double>(lines.size()),
+                                      Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_SystraceLineTokenizer);
+
+void BM_SystraceStreamingLineReader(benchmark::State& state) {
+  std::string text = GenerateSystraceText(100000);
+
+  size_t line_count = 0;
+  StreamingLineReader reader(
+      [&line_count](const std::vector<StringView>& lines) {
+        line_count += lines.size();
+      });
+  for (auto _ : state) {
+    reader.Tokenize(StringView(text));
+    benchmark::ClobberMemory();
+  }
+  benchmark::DoNotOptimize(line_count);
+  state.counters["bytes/s"] = Counter(static_cast<double>(text.size()),
+                                      Counter::kIsIterationInvariantRate);
+}
+BENCHMARK(BM_SystraceStreamingLineReader);
+
+}  // namespace
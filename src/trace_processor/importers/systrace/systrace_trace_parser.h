@@ -17,8 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_TRACE_PARSER_H_
 #define SRC_TRACE_PROCESSOR_IMPORTERS_SYSTRACE_SYSTRACE_TRACE_PARSER_H_
 
-#include <deque>
-#include <regex>
+#include <vector>
 
 #include "src/trace_processor/importers/common/chunked_trace_reader.h"
 #include "src/trace_processor/importers/systrace/systrace_line_parser.h"
@@ -54,7 +53,7 @@ class SystraceTraceParser : public ChunkedTraceReader {
 
   // Used to glue together trace packets that span across two (or more)
   // Parse() boundaries.
-  std::deque<uint8_t> partial_buf_;
+  std::vector<char> partial_buf_;
 
   SystraceLineTokenizer line_tokenizer_;
   SystraceLineParser line_parser_;
@@ -29,10 +29,12 @@ namespace trace_processor {
 IteratorImpl::IteratorImpl(
     TraceProcessorImpl* trace_processor,
     base::StatusOr<PerfettoSqlEngine::ExecutionResult> result,
-    uint32_t sql_stats_row)
+    uint32_t sql_stats_row,
+    std::unique_ptr<QueryCancellation> cancellation)
     : trace_processor_(trace_processor),
       result_(std::move(result)),
-      sql_stats_row_(sql_stats_row) {}
+      sql_stats_row_(sql_stats_row),
+      cancellation_(std::move(cancellation)) {}
 
 IteratorImpl::~IteratorImpl() {
   if (trace_processor_) {
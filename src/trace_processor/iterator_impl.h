@@ -20,6 +20,7 @@
 #include <sqlite3.h>
 #include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
 
 #include "perfetto/base/logging.h"
@@ -30,6 +31,7 @@
 #include "perfetto/trace_processor/iterator.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/sqlite_engine.h"
+#include "src/trace_processor/util/query_cancellation.h"
 
 namespace perfetto {
 namespace trace_processor {
@@ -40,7 +42,8 @@ class IteratorImpl {
  public:
   IteratorImpl(TraceProcessorImpl* impl,
                base::StatusOr<PerfettoSqlEngine::ExecutionResult>,
-               uint32_t sql_stats_row);
+               uint32_t sql_stats_row,
+               std::unique_ptr<QueryCancellation>);
   ~IteratorImpl();
 
   IteratorImpl(IteratorImpl&) noexcept = delete;
@@ -72,10 +75,15 @@ class IteratorImpl {
       return false;
     }
 
+    QueryCancellation::ScopedCurrent scoped_cancellation(cancellation_.get());
     bool has_more = result_->stmt.Step();
     if (!result_->stmt.status().ok()) {
       PERFETTO_DCHECK(!has_more);
-      result_ = result_->stmt.status();
+      // Report why the query stopped rather than the SQLite "interrupted"
+      // error it causes.
+      result_ = cancellation_ && cancellation_->ShouldStop()
+                    ? cancellation_->ToStatus()
+                    : result_->stmt.status();
     }
     return has_more;
   }
@@ -120,6 +128,14 @@ class IteratorImpl {
                         : "";
   }
 
+  // Returns the type the column was declared with if it comes directly from
+  // a table column, or nullptr otherwise (e.g. for expressions).
+  const char* GetColumnDeclType(uint32_t col) const {
+    return result_.ok() ? sqlite3_column_decltype(result_->stmt.sqlite_stmt(),
+                                                  static_cast<int>(col))
+                        : nullptr;
+  }
+
   base::Status Status() const { return result_.status(); }
 
   uint32_t ColumnCount() const {
@@ -157,6 +173,10 @@ class IteratorImpl {
   base::StatusOr<PerfettoSqlEngine::ExecutionResult> result_;
   uint32_t sql_stats_row_ = 0;
   bool called_next_ = false;
+  // Made current while stepping through the rows, as the statement does most
+  // of its work lazily. On the heap so that it can be found by the code of the
+  // query even if the iterator is moved.
+  std::unique_ptr<QueryCancellation> cancellation_;
 };
 
 }  // namespace trace_processor
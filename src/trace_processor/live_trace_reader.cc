@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/live_trace_reader.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
+#include "perfetto/ext/tracing/ipc/consumer_ipc_client.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "perfetto/tracing/default_socket.h"
+
+namespace perfetto::trace_processor {
+
+LiveTraceReader::LiveTraceReader(TraceProcessor* tp,
+                                 LiveTraceReaderConfig config)
+    : tp_(tp),
+      config_(std::move(config)),
+      task_runner_(base::ThreadTaskRunner::CreateAndStart("TPLiveReader")) {}
+
+LiveTraceReader::~LiveTraceReader() {
+  // The endpoint must be destroyed on the thread it was created on.
+  base::WaitableEvent reset_done;
+  task_runner_.PostTask([this, &reset_done] {
+    consumer_endpoint_.reset();
+    reset_done.Notify();
+  });
+  reset_done.Wait();
+}
+
+base::Status LiveTraceReader::Start() {
+  task_runner_.PostTask([this] {
+    consumer_endpoint_ = ConsumerIPCClient::Connect(GetConsumerSocket(), this,
+                                                    task_runner_.get());
+  });
+  attach_done_.Wait();
+  return attach_status_;
+}
+
+void LiveTraceReader::OnConnect() {
+  consumer_endpoint_->Attach(config_.session_key);
+}
+
+void LiveTraceReader::OnAttach(bool success, const TraceConfig&) {
+  if (!success) {
+    attach_status_ = base::ErrStatus(
+        "Failed to attach to the tracing session '%s': was it started with "
+        "perfetto --detach=%s?",
+        config_.session_key.c_str(), config_.session_key.c_str());
+    attach_done_.Notify();
+    return;
+  }
+  attached_ = true;
+  attach_done_.Notify();
+  ReadBuffersPeriodically();
+}
+
+void LiveTraceReader::OnDisconnect() {
+  if (!attached_) {
+    attach_status_ = base::ErrStatus(
+        "Failed to connect to the tracing service at %s",
+        GetConsumerSocket());
+    attach_done_.Notify();
+    return;
+  }
+  PERFETTO_ELOG("Disconnected from the tracing service");
+  NotifyEndOfFile();
+}
+
+void LiveTraceReader::OnTracingDisabled(const std::string& error) {
+  if (!error.empty())
+    PERFETTO_ELOG("Tracing session stopped: %s", error.c_str());
+  tracing_disabled_ = true;
+
+  // Drain the data written since the last read: the end of the trace is
+  // notified once it has been parsed (see OnTraceData()).
+  if (!read_pending_) {
+    read_pending_ = true;
+    consumer_endpoint_->ReadBuffers();
+  }
+}
+
+void LiveTraceReader::OnTraceData(std::vector<TracePacket> packets,
+                                  bool has_more) {
+  // Re-serialize the packets as a Trace proto, as the tokenizer expects.
+  size_t size = 0;
+  for (TracePacket& packet : packets) {
+    size += std::get<1>(packet.GetProtoPreamble()) + packet.size();
+  }
+  if (size > 0) {
+    TraceBlob blob = TraceBlob::Allocate(size);
+    uint8_t* wptr = blob.data();
+    for (TracePacket& packet : packets) {
+      auto [preamble, preamble_size] = packet.GetProtoPreamble();
+      memcpy(wptr, preamble, preamble_size);
+      wptr += preamble_size;
+      for (const Slice& slice : packet.slices()) {
+        memcpy(wptr, slice.start, slice.size);
+        wptr += slice.size;
+      }
+    }
+    std::lock_guard<std::mutex> lock(tp_mutex_);
+    base::Status status = tp_->Parse(TraceBlobView(std::move(blob)));
+    if (!status.ok())
+      PERFETTO_ELOG("Failed to parse trace data: %s", status.c_message());
+  }
+
+  if (has_more)
+    return;
+  read_pending_ = false;
+  if (tracing_disabled_)
+    NotifyEndOfFile();
+}
+
+void LiveTraceReader::ReadBuffersPeriodically() {
+  if (!consumer_endpoint_ || tracing_disabled_)
+    return;
+  if (!read_pending_) {
+    read_pending_ = true;
+    consumer_endpoint_->ReadBuffers();
+  }
+  task_runner_.PostDelayedTask([this] { ReadBuffersPeriodically(); },
+                               config_.read_period_ms);
+}
+
+void LiveTraceReader::NotifyEndOfFile() {
+  if (eof_notified_)
+    return;
+  eof_notified_ = true;
+  {
+    std::lock_guard<std::mutex> lock(tp_mutex_);
+    tp_->NotifyEndOfFile();
+  }
+  PERFETTO_ILOG("Tracing session ended: the trace is fully loaded");
+}
+
+}  // namespace perfetto::trace_processor
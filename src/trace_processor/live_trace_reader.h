@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_LIVE_TRACE_READER_H_
+#define SRC_TRACE_PROCESSOR_LIVE_TRACE_READER_H_
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "perfetto/ext/tracing/core/consumer.h"
+#include "perfetto/ext/tracing/core/tracing_service.h"
+
+namespace perfetto::trace_processor {
+
+class TraceProcessor;
+
+struct LiveTraceReaderConfig {
+  // The key the tracing session was detached with (perfetto --detach=KEY).
+  std::string session_key;
+
+  // How often the buffers of the tracing service are read.
+  uint32_t read_period_ms = 1000;
+};
+
+// Attaches to a tracing session running in the tracing service and feeds its
+// data to a TraceProcessor instance while the session is still running, so
+// that the trace can be queried without waiting for it to be stopped.
+//
+// The buffers of the session are read periodically, on a dedicated thread,
+// and each batch of packets is passed to TraceProcessor::Parse(). Events are
+// pushed to the tables as the sorter window moves forward: queries see the
+// trace up to the ingestion_watermark() SQL function. The end of the trace is
+// notified once the session stops.
+//
+// TraceProcessor is not thread-safe: queries must be run while holding
+// mutex().
+class LiveTraceReader : public Consumer {
+ public:
+  LiveTraceReader(TraceProcessor*, LiveTraceReaderConfig);
+  ~LiveTraceReader() override;
+
+  // Connects to the tracing service and attaches to the session. Blocks until
+  // the session has been attached or this failed.
+  base::Status Start();
+
+  // The ingestion of new data is blocked for as long as this is held.
+  std::mutex* mutex() { return &tp_mutex_; }
+
+  // Consumer implementation.
+  void OnConnect() override;
+  void OnDisconnect() override;
+  void OnTracingDisabled(const std::string& error) override;
+  void OnTraceData(std::vector<TracePacket>, bool has_more) override;
+  void OnDetach(bool) override {}
+  void OnAttach(bool success, const TraceConfig&) override;
+  void OnTraceStats(bool, const TraceStats&) override {}
+  void OnObservableEvents(const ObservableEvents&) override {}
+
+ private:
+  void ReadBuffersPeriodically();
+  void NotifyEndOfFile();
+
+  TraceProcessor* const tp_;
+  const LiveTraceReaderConfig config_;
+
+  std::mutex tp_mutex_;
+
+  // Accessed only on |task_runner_|.
+  std::unique_ptr<TracingService::ConsumerEndpoint> consumer_endpoint_;
+  bool attached_ = false;
+  bool read_pending_ = false;
+  bool tracing_disabled_ = false;
+  bool eof_notified_ = false;
+
+  // Set on |task_runner_| before |attach_done_| is notified.
+  base::Status attach_status_;
+  base::WaitableEvent attach_done_;
+
+  // Keep last: stops the thread, which accesses the members above, first.
+  base::ThreadTaskRunner task_runner_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_LIVE_TRACE_READER_H_
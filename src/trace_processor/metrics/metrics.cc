@@ -35,6 +35,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
@@ -668,8 +669,12 @@ base::Status RunMetric::Run(RunMetric::Context* ctx,
         metric_it->sql.c_str());
   }
 
+  if (ctx->cache->IsUpToDate(path, subbed_sql))
+    return base::OkStatus();
   auto res = ctx->engine->Execute(SqlSource::FromMetricFile(subbed_sql, path));
-  return res.status();
+  RETURN_IF_ERROR(res.status());
+  ctx->cache->OnRun(path, subbed_sql);
+  return base::OkStatus();
 }
 
 base::Status UnwrapMetricProto::Run(Context*,
@@ -721,67 +726,130 @@ base::Status UnwrapMetricProto::Run(Context*,
   return base::OkStatus();
 }
 
-base::Status ComputeMetrics(PerfettoSqlEngine* engine,
-                            const std::vector<std::string>& metrics_to_compute,
-                            const std::vector<SqlMetricFile>& sql_metrics,
-                            const DescriptorPool& pool,
-                            const ProtoDescriptor& root_descriptor,
-                            std::vector<uint8_t>* metrics_proto) {
-  ProtoBuilder metric_builder(&pool, &root_descriptor);
-  for (const auto& name : metrics_to_compute) {
-    auto metric_it =
-        std::find_if(sql_metrics.begin(), sql_metrics.end(),
-                     [&name](const SqlMetricFile& metric) {
-                       return metric.proto_field_name.has_value() &&
-                              name == metric.proto_field_name.value();
-                     });
-    if (metric_it == sql_metrics.end()) {
-      return base::ErrStatus("Unknown metric %s", name.c_str());
-    }
+void RunMetricCache::Disable() {
+  enabled_ = false;
+  Invalidate();
+}
+
+bool RunMetricCache::IsUpToDate(const std::string& path,
+                                const std::string& sql) {
+  if (!enabled_)
+    return false;
+  auto it = last_run_sql_.find(path);
+  if (it == last_run_sql_.end())
+    return false;
+  if (it->second == sql) {
+    skipped_runs_++;
+    return true;
+  }
+  // The file is about to be run with different arguments. If it recreates
+  // tables or views with the same names, this changes what any file run
+  // before depends on, so none of them can be assumed to be up to date.
+  Invalidate();
+  return false;
+}
+
+void RunMetricCache::OnRun(const std::string& path, const std::string& sql) {
+  runs_++;
+  if (enabled_)
+    last_run_sql_[path] = sql;
+}
 
-    const SqlMetricFile& sql_metric = *metric_it;
+namespace {
+
+base::Status ComputeMetric(PerfettoSqlEngine* engine,
+                           const std::string& name,
+                           const std::vector<SqlMetricFile>& sql_metrics,
+                           RunMetricCache* cache,
+                           ProtoBuilder* metric_builder) {
+  auto metric_it =
+      std::find_if(sql_metrics.begin(), sql_metrics.end(),
+                   [&name](const SqlMetricFile& metric) {
+                     return metric.proto_field_name.has_value() &&
+                            name == metric.proto_field_name.value();
+                   });
+  if (metric_it == sql_metrics.end()) {
+    return base::ErrStatus("Unknown metric %s", name.c_str());
+  }
+
+  const SqlMetricFile& sql_metric = *metric_it;
+  if (!cache->IsUpToDate(sql_metric.path, sql_metric.sql)) {
     auto prep_it =
         engine->Execute(SqlSource::FromMetric(sql_metric.sql, metric_it->path));
     RETURN_IF_ERROR(prep_it.status());
+    cache->OnRun(sql_metric.path, sql_metric.sql);
+  }
 
-    auto output_query =
-        "SELECT * FROM " + sql_metric.output_table_name.value() + ";";
-    PERFETTO_TP_TRACE(
-        metatrace::Category::QUERY_TIMELINE, "COMPUTE_METRIC_QUERY",
-        [&](metatrace::Record* r) { r->AddArg("SQL", output_query); });
-
-    auto it = engine->ExecuteUntilLastStatement(
-        SqlSource::FromTraceProcessorImplementation(std::move(output_query)));
-    RETURN_IF_ERROR(it.status());
-
-    // Allow the query to return no rows. This has the same semantic as an
-    // empty proto being returned.
-    const auto& field_name = sql_metric.proto_field_name.value();
-    if (it->stmt.IsDone()) {
-      metric_builder.AppendSqlValue(field_name, SqlValue::Bytes(nullptr, 0));
-      continue;
-    }
+  auto output_query =
+      "SELECT * FROM " + sql_metric.output_table_name.value() + ";";
+  PERFETTO_TP_TRACE(
+      metatrace::Category::QUERY_TIMELINE, "COMPUTE_METRIC_QUERY",
+      [&](metatrace::Record* r) { r->AddArg("SQL", output_query); });
 
-    if (it->stats.column_count != 1) {
-      return base::ErrStatus("Output table %s should have exactly one column",
-                             sql_metric.output_table_name.value().c_str());
-    }
+  auto it = engine->ExecuteUntilLastStatement(
+      SqlSource::FromTraceProcessorImplementation(std::move(output_query)));
+  RETURN_IF_ERROR(it.status());
 
-    SqlValue col = sqlite::utils::SqliteValueToSqlValue(
-        sqlite3_column_value(it->stmt.sqlite_stmt(), 0));
-    if (col.type != SqlValue::kBytes) {
-      return base::ErrStatus("Output table %s column has invalid type",
-                             sql_metric.output_table_name.value().c_str());
-    }
-    RETURN_IF_ERROR(metric_builder.AppendSqlValue(field_name, col));
+  // Allow the query to return no rows. This has the same semantic as an
+  // empty proto being returned.
+  const auto& field_name = sql_metric.proto_field_name.value();
+  if (it->stmt.IsDone()) {
+    metric_builder->AppendSqlValue(field_name, SqlValue::Bytes(nullptr, 0));
+    return base::OkStatus();
+  }
+
+  if (it->stats.column_count != 1) {
+    return base::ErrStatus("Output table %s should have exactly one column",
+                           sql_metric.output_table_name.value().c_str());
+  }
+
+  SqlValue col = sqlite::utils::SqliteValueToSqlValue(
+      sqlite3_column_value(it->stmt.sqlite_stmt(), 0));
+  if (col.type != SqlValue::kBytes) {
+    return base::ErrStatus("Output table %s column has invalid type",
+                           sql_metric.output_table_name.value().c_str());
+  }
+  RETURN_IF_ERROR(metric_builder->AppendSqlValue(field_name, col));
+
+  bool has_next = it->stmt.Step();
+  if (has_next) {
+    return base::ErrStatus("Output table %s should have at most one row",
+                           sql_metric.output_table_name.value().c_str());
+  }
+  return it->stmt.status();
+}
 
-    bool has_next = it->stmt.Step();
-    if (has_next) {
-      return base::ErrStatus("Output table %s should have at most one row",
-                             sql_metric.output_table_name.value().c_str());
+}  // namespace
+
+base::Status ComputeMetrics(PerfettoSqlEngine* engine,
+                            const std::vector<std::string>& metrics_to_compute,
+                            const std::vector<SqlMetricFile>& sql_metrics,
+                            const DescriptorPool& pool,
+                            const ProtoDescriptor& root_descriptor,
+                            RunMetricCache* cache,
+                            std::vector<uint8_t>* metrics_proto,
+                            std::vector<MetricProfile>* profile) {
+  ProtoBuilder metric_builder(&pool, &root_descriptor);
+  cache->Enable();
+  base::Status status;
+  for (const auto& name : metrics_to_compute) {
+    int64_t start_ns = base::GetWallTimeNs().count();
+    uint32_t runs = cache->runs();
+    uint32_t skipped_runs = cache->skipped_runs();
+    status = ComputeMetric(engine, name, sql_metrics, cache, &metric_builder);
+    if (!status.ok())
+      break;
+    if (profile) {
+      MetricProfile p;
+      p.name = name;
+      p.dur_ns = base::GetWallTimeNs().count() - start_ns;
+      p.runs = cache->runs() - runs;
+      p.skipped_runs = cache->skipped_runs() - skipped_runs;
+      profile->emplace_back(std::move(p));
     }
-    RETURN_IF_ERROR(it->stmt.status());
   }
+  cache->Disable();
+  RETURN_IF_ERROR(status);
   *metrics_proto = metric_builder.SerializeRaw();
   return base::OkStatus();
 }
@@ -64,6 +64,56 @@ struct SqlMetricFile {
   std::string sql;
 };
 
+// Remembers the metric files run while a set of metrics is being computed.
+//
+// Many metrics RUN_METRIC the same files (e.g. android/process_metadata.sql)
+// and running a file again with the same arguments only recreates the same
+// tables and views. While enabled, such runs are skipped, so shared imports
+// are computed once per ComputeMetrics() call rather than once per metric.
+class RunMetricCache {
+ public:
+  // Starts remembering the files which are run.
+  void Enable() { enabled_ = true; }
+
+  // Stops remembering the files which are run and forgets the ones run so
+  // far: the tables they created can be changed by any query afterwards.
+  void Disable();
+
+  // Forgets the files run so far, e.g. because a metric file was redefined:
+  // the files run before may depend on the tables it creates.
+  void Invalidate() { last_run_sql_.clear(); }
+
+  // Returns true if the file at |path| has already been run with |sql| (i.e.
+  // its SQL after the substitution of the arguments), in which case it
+  // doesn't need to run again. As the SQL text is compared, a file redefined
+  // with different SQL is always run again.
+  bool IsUpToDate(const std::string& path, const std::string& sql);
+
+  // Records that the file at |path| has been run with |sql|.
+  void OnRun(const std::string& path, const std::string& sql);
+
+  uint32_t runs() const { return runs_; }
+  uint32_t skipped_runs() const { return skipped_runs_; }
+
+ private:
+  bool enabled_ = false;
+  std::unordered_map<std::string, std::string> last_run_sql_;
+  uint32_t runs_ = 0;
+  uint32_t skipped_runs_ = 0;
+};
+
+// Time spent computing a metric by ComputeMetrics().
+struct MetricProfile {
+  std::string name;
+  int64_t dur_ns = 0;
+
+  // The number of metric files (including the one of the metric itself) run
+  // to compute the metric and the number of those which were skipped as they
+  // had already been run for a previous metric.
+  uint32_t runs = 0;
+  uint32_t skipped_runs = 0;
+};
+
 // Helper class to build a nested (metric) proto checking the schema against
 // a descriptor.
 // Visible for testing.
@@ -176,6 +226,7 @@ struct RunMetric : public SqlFunction {
   struct Context {
     PerfettoSqlEngine* engine;
     std::vector<SqlMetricFile>* metrics;
+    RunMetricCache* cache;
   };
   static constexpr bool kVoidReturn = true;
   static base::Status Run(Context* ctx,
@@ -200,12 +251,17 @@ struct RepeatedField : public SqliteAggregateFunction<RepeatedField> {
   static void Final(sqlite3_context* ctx);
 };
 
+// Computes |metrics_to_compute| in order, sharing the files they run through
+// |cache|. If |profile| is not null, the time spent on each metric is appended
+// to it.
 base::Status ComputeMetrics(PerfettoSqlEngine*,
                             const std::vector<std::string>& metrics_to_compute,
                             const std::vector<SqlMetricFile>& metrics,
                             const DescriptorPool& pool,
                             const ProtoDescriptor& root_descriptor,
-                            std::vector<uint8_t>* metrics_proto);
+                            RunMetricCache* cache,
+                            std::vector<uint8_t>* metrics_proto,
+                            std::vector<MetricProfile>* profile = nullptr);
 
 }  // namespace perfetto::trace_processor::metrics
 
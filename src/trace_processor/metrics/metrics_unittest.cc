@@ -320,5 +320,56 @@ TEST_F(ProtoBuilderTest, AppendEnums) {
   ASSERT_EQ(str_proto.Get(1).as_int32(), 2);
 }
 
+TEST(RunMetricCacheTest, SkipsFilesAlreadyRun) {
+  RunMetricCache cache;
+
+  // Nothing is remembered while disabled.
+  cache.OnRun("a.sql", "SELECT 1");
+  ASSERT_FALSE(cache.IsUpToDate("a.sql", "SELECT 1"));
+
+  cache.Enable();
+  cache.OnRun("a.sql", "SELECT 1");
+  cache.OnRun("b.sql", "SELECT 2");
+  ASSERT_TRUE(cache.IsUpToDate("a.sql", "SELECT 1"));
+  ASSERT_TRUE(cache.IsUpToDate("b.sql", "SELECT 2"));
+  ASSERT_FALSE(cache.IsUpToDate("c.sql", "SELECT 3"));
+  ASSERT_EQ(cache.runs(), 3u);
+  ASSERT_EQ(cache.skipped_runs(), 2u);
+
+  cache.Disable();
+  ASSERT_FALSE(cache.IsUpToDate("a.sql", "SELECT 1"));
+}
+
+TEST(RunMetricCacheTest, DifferentArgumentsInvalidateAllFiles) {
+  RunMetricCache cache;
+  cache.Enable();
+  cache.OnRun("a.sql", "SELECT 1");
+  cache.OnRun("b.sql", "SELECT 2");
+
+  // b.sql may have been built on top of the tables created by a.sql, so
+  // neither is up to date once a.sql runs with different arguments.
+  ASSERT_FALSE(cache.IsUpToDate("a.sql", "SELECT 10"));
+  ASSERT_FALSE(cache.IsUpToDate("b.sql", "SELECT 2"));
+  cache.OnRun("a.sql", "SELECT 10");
+  ASSERT_TRUE(cache.IsUpToDate("a.sql", "SELECT 10"));
+  ASSERT_FALSE(cache.IsUpToDate("a.sql", "SELECT 1"));
+}
+
+TEST(RunMetricCacheTest, RedefinedFilesAreRunAgain) {
+  RunMetricCache cache;
+  cache.Enable();
+  cache.OnRun("a.sql", "SELECT 1");
+  cache.OnRun("b.sql", "SELECT 2");
+
+  // The new SQL of a redefined file doesn't match the one it was run with.
+  ASSERT_FALSE(cache.IsUpToDate("b.sql", "SELECT 3"));
+  cache.OnRun("b.sql", "SELECT 3");
+
+  // Redefining a.sql also invalidates the files which may depend on it.
+  cache.Invalidate();
+  ASSERT_FALSE(cache.IsUpToDate("a.sql", "SELECT 1"));
+  ASSERT_FALSE(cache.IsUpToDate("b.sql", "SELECT 3"));
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor::metrics
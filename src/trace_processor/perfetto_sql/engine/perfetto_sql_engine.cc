@@ -23,6 +23,7 @@
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <string_view>
@@ -32,10 +33,15 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/no_destructor.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/utils.h"
 #include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/grouped_aggregation.h"
 #include "src/trace_processor/db/runtime_table.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/perfetto_sql/engine/created_function.h"
@@ -48,6 +54,7 @@
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/sqlite/sqlite_engine.h"
+#include "src/trace_processor/sqlite/sqlite_tokenizer.h"
 #include "src/trace_processor/tp_metatrace.h"
 #include "src/trace_processor/util/sql_argument.h"
 #include "src/trace_processor/util/sql_modules.h"
@@ -164,6 +171,290 @@ std::string GetTokenNamesAllowedInMacro() {
   return base::Join(result, ", ");
 }
 
+// The maximum number of queries whose result (or uncacheability) is kept in
+// the query result cache.
+constexpr size_t kMaxQueryResultCacheEntries = 64;
+
+// The maximum number of rows of a result stored in the query result cache:
+// the materialization of larger results is abandoned as soon as they cross it
+// and they are executed as usual.
+constexpr uint32_t kMaxQueryResultCacheRows = 1u << 20;
+
+// Returns the key of |sql| in the query result cache: runs of whitespace
+// outside of string literals and quoted identifiers are collapsed into single
+// spaces and leading and trailing whitespace and semicolons are removed.
+std::string NormalizeSqlForResultCache(const std::string& sql) {
+  std::string key;
+  key.reserve(sql.size());
+  char quote = 0;
+  bool pending_space = false;
+  for (char c : sql) {
+    if (quote == 0 && std::isspace(static_cast<unsigned char>(c))) {
+      pending_space = !key.empty();
+      continue;
+    }
+    if (pending_space) {
+      key.push_back(' ');
+      pending_space = false;
+    }
+    key.push_back(c);
+    if (quote == 0 && (c == '\'' || c == '"' || c == '`')) {
+      quote = c;
+    } else if (c == quote) {
+      quote = 0;
+    }
+  }
+  while (!key.empty() && (key.back() == ';' || key.back() == ' ')) {
+    key.pop_back();
+  }
+  return key;
+}
+
+// The maximum number of views followed to find the table backing a grouped
+// aggregation.
+constexpr uint32_t kMaxAggregationViewDepth = 4;
+
+// A "SELECT <columns> FROM <table> GROUP BY <group_by>" statement.
+struct GroupedAggregationQuery {
+  struct Column {
+    // The name of the column in the result or empty if it is the name of
+    // |arg|.
+    std::string name;
+    AggregationColumn::Type type;
+    // The column which is grouped by or aggregated (empty for COUNT(*)).
+    std::string arg;
+  };
+  std::vector<Column> columns;
+  std::string table;
+  std::vector<std::string> group_by;
+};
+
+bool IsKeyword(const SqliteTokenizer::Token& token, const char* keyword) {
+  return token.token_type == SqliteTokenType::TK_GENERIC_KEYWORD &&
+         base::CaseInsensitiveEqual(std::string(token.str), keyword);
+}
+
+// Returns whether |sql| is a CREATE VIRTUAL TABLE statement.
+bool IsCreateVirtualTable(const SqlSource& sql) {
+  SqliteTokenizer tokenizer(sql);
+  return IsKeyword(tokenizer.NextNonWhitespace(), "create") &&
+         IsKeyword(tokenizer.NextNonWhitespace(), "virtual") &&
+         IsKeyword(tokenizer.NextNonWhitespace(), "table");
+}
+
+// Returns the name in |token| if it is an unquoted identifier.
+std::optional<std::string> GetIdentifier(const SqliteTokenizer::Token& token) {
+  if (token.token_type != SqliteTokenType::TK_ID || token.str.empty() ||
+      !(std::isalpha(static_cast<unsigned char>(token.str[0])) ||
+        token.str[0] == '_')) {
+    return std::nullopt;
+  }
+  return std::string(token.str);
+}
+
+// Returns whether |sql| contains the GROUP keyword, ignoring case. Allows the
+// vast majority of statements, which are not grouped aggregations, to skip
+// tokenization by |ParseGroupedAggregationQuery|.
+bool MayBeGroupedAggregationQuery(const std::string& sql) {
+  static constexpr std::string_view kGroup = "group";
+  auto it = std::search(sql.begin(), sql.end(), kGroup.begin(), kGroup.end(),
+                        [](char a, char b) {
+                          return std::tolower(static_cast<unsigned char>(a)) ==
+                                 b;
+                        });
+  return it != sql.end();
+}
+
+std::optional<GroupedAggregationQuery> ParseGroupedAggregationQuery(
+    const SqlSource& sql) {
+  using Token = SqliteTokenizer::Token;
+  using Type = AggregationColumn::Type;
+
+  if (!MayBeGroupedAggregationQuery(sql.sql())) {
+    return std::nullopt;
+  }
+  SqliteTokenizer tokenizer(sql);
+  if (!IsKeyword(tokenizer.NextNonWhitespace(), "select")) {
+    return std::nullopt;
+  }
+  GroupedAggregationQuery query;
+  for (;;) {
+    Token start = tokenizer.NextNonWhitespace();
+    std::optional<std::string> id = GetIdentifier(start);
+    if (!id) {
+      return std::nullopt;
+    }
+    GroupedAggregationQuery::Column column{"", Type::kGroupColumn, *id};
+    Token token = tokenizer.NextNonWhitespace();
+    if (token.token_type == SqliteTokenType::TK_LP) {
+      std::string function = base::ToLower(*id);
+      Token arg = tokenizer.NextNonWhitespace();
+      if (function == "count" && arg.token_type == SqliteTokenType::TK_STAR) {
+        column.type = Type::kCountRows;
+        column.arg.clear();
+      } else if (std::optional<std::string> arg_id = GetIdentifier(arg);
+                 arg_id) {
+        column.arg = *arg_id;
+        if (function == "count") {
+          column.type = Type::kCount;
+        } else if (function == "min") {
+          column.type = Type::kMin;
+        } else if (function == "max") {
+          column.type = Type::kMax;
+        } else if (function == "sum") {
+          column.type = Type::kSum;
+        } else {
+          return std::nullopt;
+        }
+      } else {
+        return std::nullopt;
+      }
+      Token end = tokenizer.NextNonWhitespace();
+      if (end.token_type != SqliteTokenType::TK_RP) {
+        return std::nullopt;
+      }
+      // Like SQLite, unaliased aggregates are named after their text.
+      column.name = std::string(
+          start.str.data(),
+          static_cast<size_t>(end.str.data() + end.str.size() -
+                              start.str.data()));
+      token = tokenizer.NextNonWhitespace();
+    }
+    if (IsKeyword(token, "as")) {
+      token = tokenizer.NextNonWhitespace();
+      std::optional<std::string> alias = GetIdentifier(token);
+      if (!alias) {
+        return std::nullopt;
+      }
+      column.name = *alias;
+      token = tokenizer.NextNonWhitespace();
+    } else if (std::optional<std::string> alias = GetIdentifier(token); alias) {
+      column.name = *alias;
+      token = tokenizer.NextNonWhitespace();
+    }
+    query.columns.emplace_back(std::move(column));
+    if (IsKeyword(token, "from")) {
+      break;
+    }
+    if (token.token_type != SqliteTokenType::TK_COMMA) {
+      return std::nullopt;
+    }
+  }
+
+  std::optional<std::string> table =
+      GetIdentifier(tokenizer.NextNonWhitespace());
+  if (!table || !IsKeyword(tokenizer.NextNonWhitespace(), "group") ||
+      !IsKeyword(tokenizer.NextNonWhitespace(), "by")) {
+    return std::nullopt;
+  }
+  query.table = std::move(*table);
+  for (;;) {
+    std::optional<std::string> id = GetIdentifier(tokenizer.NextNonWhitespace());
+    if (!id) {
+      return std::nullopt;
+    }
+    query.group_by.emplace_back(std::move(*id));
+    Token token = tokenizer.NextNonWhitespace();
+    if (token.IsTerminal()) {
+      break;
+    }
+    if (token.token_type != SqliteTokenType::TK_COMMA) {
+      return std::nullopt;
+    }
+  }
+
+  // GROUP BY terms can also refer to aliases of the result columns: leave
+  // these to SQLite.
+  for (const auto& column : query.columns) {
+    for (const std::string& group_by : query.group_by) {
+      if (!column.name.empty() &&
+          base::CaseInsensitiveEqual(column.name, group_by)) {
+        return std::nullopt;
+      }
+    }
+  }
+  return query;
+}
+
+std::string QuoteIdentifier(const std::string& name) {
+  return "\"" + base::ReplaceAll(name, "\"", "\"\"") + "\"";
+}
+
+// The statements parsed from the SQL of included module files, shared by all
+// the engines in the process: this avoids preprocessing and parsing the same
+// modules of the standard library again for every trace.
+class ParsedModuleCache {
+ public:
+  // Entries are evicted, least recently used first, once the SQL of the cached
+  // modules (which the size of their parsed statements is proportional to) is
+  // larger than this. This is many times the size of the standard library but
+  // bounds the cache when many different modules are registered over the
+  // lifetime of the process.
+  static constexpr size_t kMaxSqlBytes = 16 * 1024 * 1024;
+
+  static ParsedModuleCache& GetInstance() {
+    static base::NoDestructor<ParsedModuleCache> cache;
+    return cache.ref();
+  }
+
+  // Returns the statements parsed from the module file |key| if its SQL was
+  // |sql| or nullptr if it was not parsed yet.
+  std::shared_ptr<const PerfettoSqlParser::ParsedStatements> Find(
+      const std::string& key,
+      const std::string& sql) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry* entry = entries_.Find(key);
+    if (!entry || entry->sql != sql) {
+      return nullptr;
+    }
+    entry->last_use = next_use_++;
+    return entry->statements;
+  }
+
+  void Insert(const std::string& key,
+              std::string sql,
+              PerfettoSqlParser::ParsedStatements statements) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (Entry* old = entries_.Find(key); old) {
+      sql_bytes_ -= old->sql.size();
+    }
+    sql_bytes_ += sql.size();
+    entries_[key] = Entry{
+        std::move(sql),
+        std::make_shared<const PerfettoSqlParser::ParsedStatements>(
+            std::move(statements)),
+        next_use_++};
+    while (sql_bytes_ > kMaxSqlBytes && entries_.size() > 1) {
+      EvictLeastRecentlyUsed();
+    }
+  }
+
+ private:
+  struct Entry {
+    std::string sql;
+    std::shared_ptr<const PerfettoSqlParser::ParsedStatements> statements;
+    uint64_t last_use;
+  };
+
+  void EvictLeastRecentlyUsed() {
+    std::optional<std::string> lru_key;
+    uint64_t lru_use = 0;
+    for (auto it = entries_.GetIterator(); it; ++it) {
+      if (!lru_key || it.value().last_use < lru_use) {
+        lru_key = it.key();
+        lru_use = it.value().last_use;
+      }
+    }
+    sql_bytes_ -= entries_.Find(*lru_key)->sql.size();
+    entries_.Erase(*lru_key);
+  }
+
+  std::mutex mutex_;
+  base::FlatHashMap<std::string, Entry> entries_;
+  size_t sql_bytes_ = 0;
+  uint64_t next_use_ = 0;
+};
+
 }  // namespace
 
 PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool)
@@ -178,6 +469,9 @@ PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool)
   if (err != SQLITE_OK) {
     PERFETTO_FATAL("Failed to initialize perfetto_tables: %s", errmsg_raw);
   }
+  engine_->set_missing_table_handler([this](const std::string& name) {
+    return MaterializeDeferredTable(name);
+  });
 
   {
     auto ctx = std::make_unique<RuntimeTableFunctionModule::Context>();
@@ -187,32 +481,35 @@ PerfettoSqlEngine::PerfettoSqlEngine(StringPool* pool)
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->profile = &profile_;
     runtime_table_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("runtime_table",
                                                         std::move(ctx));
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->profile = &profile_;
     static_table_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("static_table",
                                                         std::move(ctx));
   }
   {
     auto ctx = std::make_unique<DbSqliteModule::Context>();
+    ctx->profile = &profile_;
     static_table_fn_context_ = ctx.get();
     engine_->RegisterVirtualTableModule<DbSqliteModule>("static_table_function",
                                                         std::move(ctx));
   }
 }
 
-void PerfettoSqlEngine::RegisterStaticTable(const Table& table,
+void PerfettoSqlEngine::RegisterStaticTable(Table* table,
                                             const std::string& table_name,
                                             Table::Schema schema) {
   // Make sure we didn't accidentally leak a state from a previous table
   // creation.
   PERFETTO_CHECK(!static_table_context_->temporary_create_state);
   static_table_context_->temporary_create_state =
-      std::make_unique<DbSqliteModule::State>(&table, std::move(schema));
+      std::make_unique<DbSqliteModule::State>(table, std::move(schema));
 
   base::StackString<1024> sql(
       R"(
@@ -252,7 +549,13 @@ void PerfettoSqlEngine::RegisterStaticTableFunction(
 
 base::StatusOr<PerfettoSqlEngine::ExecutionStats> PerfettoSqlEngine::Execute(
     SqlSource sql) {
-  auto res = ExecuteUntilLastStatement(std::move(sql));
+  PerfettoSqlParser parser(std::move(sql), macros_);
+  return ExecuteParsed(parser);
+}
+
+base::StatusOr<PerfettoSqlEngine::ExecutionStats>
+PerfettoSqlEngine::ExecuteParsed(PerfettoSqlParser& parser) {
+  auto res = ExecuteParsedUntilLastStatement(parser);
   RETURN_IF_ERROR(res.status());
   if (res->stmt.IsDone()) {
     return res->stats;
@@ -265,6 +568,12 @@ base::StatusOr<PerfettoSqlEngine::ExecutionStats> PerfettoSqlEngine::Execute(
 
 base::StatusOr<PerfettoSqlEngine::ExecutionResult>
 PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
+  PerfettoSqlParser parser(std::move(sql_source), macros_);
+  return ExecuteParsedUntilLastStatement(parser);
+}
+
+base::StatusOr<PerfettoSqlEngine::ExecutionResult>
+PerfettoSqlEngine::ExecuteParsedUntilLastStatement(PerfettoSqlParser& parser) {
   // A SQL string can contain several statements. Some of them might be comment
   // only, e.g. "SELECT 1; /* comment */; SELECT 2;". Some statements can also
   // be PerfettoSQL statements which we need to transpile before execution or
@@ -283,10 +592,35 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
   //    take hold *before* we step into the next statement.
   //  - Once no further statements are encountered, we return the prepared
   //    statement for the last valid statement.
+  // Temporary tables which are not read by a statement anymore (e.g. the
+  // ones created by |RewriteGroupedAggregation| for previous queries).
+  DropPendingTemporaryTables();
+
   std::optional<SqliteEngine::PreparedStatement> res;
+  // The profile entry of |res|, if profiling.
+  std::optional<uint32_t> res_profile_id;
   ExecutionStats stats;
-  PerfettoSqlParser parser(std::move(sql_source), macros_);
   while (parser.Next()) {
+    // The time spent executing the statement is accounted to its profile
+    // entry, except while the previous statement is stepped until done.
+    std::optional<uint32_t> profile_id;
+    std::optional<SqlProfile::ScopedStatement> profile_scope;
+    if (PERFETTO_UNLIKELY(profile_.enabled())) {
+      profile_id = profile_.AddStatement(parser.statement_sql().sql());
+      profile_scope.emplace(&profile_, *profile_id);
+    }
+
+    // The temporary table created by |RewriteGroupedAggregation|, if any. It
+    // is only queued for dropping once the statement has been stepped: before
+    // that, nested executions (e.g. by functions) would drop it.
+    std::optional<std::string> aggregation_table;
+    auto queue_aggregation_table = base::OnScopeExit([this,
+                                                      &aggregation_table] {
+      if (aggregation_table) {
+        temporary_tables_to_drop_.emplace_back(std::move(*aggregation_table));
+      }
+    });
+
     std::optional<SqlSource> source;
     if (auto* cf = std::get_if<PerfettoSqlParser::CreateFunction>(
             &parser.statement())) {
@@ -295,8 +629,10 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
       source = RewriteToDummySql(parser.statement_sql());
     } else if (auto* cst = std::get_if<PerfettoSqlParser::CreateTable>(
                    &parser.statement())) {
-      RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteCreateTable(*cst),
-                                           parser.statement_sql()));
+      base::Status status = CanDeferCreateTable(*cst)
+                                ? DeferCreateTable(*cst, parser.statement_sql())
+                                : ExecuteCreateTable(*cst);
+      RETURN_IF_ERROR(AddTracebackIfNeeded(status, parser.statement_sql()));
       source = RewriteToDummySql(parser.statement_sql());
     } else if (auto* create_view = std::get_if<PerfettoSqlParser::CreateView>(
                    &parser.statement())) {
@@ -312,15 +648,40 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
       auto sql = macro->sql;
       RETURN_IF_ERROR(ExecuteCreateMacro(*macro));
       source = RewriteToDummySql(sql);
+    } else if (auto* create_index = std::get_if<PerfettoSqlParser::CreateIndex>(
+                   &parser.statement())) {
+      RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteCreateIndex(*create_index),
+                                           parser.statement_sql()));
+      source = RewriteToDummySql(parser.statement_sql());
+    } else if (auto* drop_index = std::get_if<PerfettoSqlParser::DropIndex>(
+                   &parser.statement())) {
+      RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteDropIndex(*drop_index),
+                                           parser.statement_sql()));
+      source = RewriteToDummySql(parser.statement_sql());
     } else {
       // If none of the above matched, this must just be an SQL statement
       // directly executable by SQLite.
       auto* sql =
           std::get_if<PerfettoSqlParser::SqliteSql>(&parser.statement());
       PERFETTO_CHECK(sql);
-      source = parser.statement_sql();
+      source = RewriteGroupedAggregation(parser.statement_sql(),
+                                         &aggregation_table);
+      if (!source) {
+        source = parser.statement_sql();
+      }
     }
 
+    // Any PerfettoSQL statement can change the result of cached queries.
+    if (!std::holds_alternative<PerfettoSqlParser::SqliteSql>(
+            parser.statement())) {
+      InvalidateQueryResultCache();
+    }
+
+    // Creating a virtual table does not change the contents of any existing
+    // table: this allows the operators (e.g. mipmaps) to reuse state computed
+    // for previously created tables (see |data_generation|).
+    bool is_create_virtual_table = IsCreateVirtualTable(*source);
+
     // Try to get SQLite to prepare the statement.
     std::optional<SqliteEngine::PreparedStatement> cur_stmt;
     {
@@ -335,9 +696,20 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
     // parser should filter out such statements so this should never happen.
     PERFETTO_DCHECK(cur_stmt->sqlite_stmt());
 
+    // Neither can we know which tables are modified by a SQLite statement
+    // writing to the database.
+    if (!sqlite3_stmt_readonly(cur_stmt->sqlite_stmt())) {
+      if (is_create_virtual_table) {
+        ClearQueryResultCache();
+      } else {
+        InvalidateQueryResultCache();
+      }
+    }
+
     // Before stepping into |cur_stmt|, we need to finish iterating through
     // the previous statement so we don't have two clashing statements (e.g.
     // SELECT * FROM v and DROP VIEW v) partially stepped into.
+    profile_scope.reset();
     if (res && !res->IsDone()) {
       PERFETTO_TP_TRACE(metatrace::Category::QUERY_TIMELINE,
                         "STMT_STEP_UNTIL_DONE",
@@ -345,13 +717,28 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
                           record->AddArg("Original SQL", res->original_sql());
                           record->AddArg("Executed SQL", res->sql());
                         });
+      std::optional<SqlProfile::ScopedStatement> res_profile_scope;
+      if (res_profile_id) {
+        res_profile_scope.emplace(&profile_, *res_profile_id);
+      }
+      int64_t rows = 0;
       while (res->Step()) {
+        rows++;
       }
       RETURN_IF_ERROR(res->status());
+      if (SqlProfile::Entry* entry =
+              res_profile_id ? profile_.Find(*res_profile_id) : nullptr;
+          entry) {
+        entry->rows += rows;
+      }
+    }
+    if (profile_id) {
+      profile_scope.emplace(&profile_, *profile_id);
     }
 
     // Propogate the current statement to the next iteration.
     res = std::move(cur_stmt);
+    res_profile_id = profile_id;
 
     // Step the newly prepared statement once. This is considered to be
     // "executing" the statement.
@@ -367,6 +754,11 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
       res->Step();
       RETURN_IF_ERROR(res->status());
     }
+    if (SqlProfile::Entry* entry =
+            profile_id ? profile_.Find(*profile_id) : nullptr;
+        entry && !res->IsDone()) {
+      entry->rows++;
+    }
 
     // Increment the neecessary counts for the statement.
     IncrementCountForStmt(*res, &stats);
@@ -384,6 +776,500 @@ PerfettoSqlEngine::ExecuteUntilLastStatement(SqlSource sql_source) {
   return ExecutionResult{std::move(*res), stats};
 }
 
+base::StatusOr<PerfettoSqlEngine::ExecutionResult>
+PerfettoSqlEngine::ExecuteUntilLastStatementWithResultCache(
+    SqlSource sql_source) {
+  std::string key = NormalizeSqlForResultCache(sql_source.sql());
+  if (const std::string* table = query_result_cache_.Find(key); table) {
+    if (table->empty()) {
+      return ExecuteUntilLastStatement(std::move(sql_source));
+    }
+    return ExecuteFromQueryResultCache(*table, /*hit=*/true);
+  }
+
+  // Only SQL made of a single SQLite statement can be cached: anything else
+  // either has side effects or would need the results of several statements
+  // to be stored.
+  std::optional<SqlSource> stmt_sql;
+  {
+    PerfettoSqlParser parser(sql_source, macros_);
+    if (parser.Next() && std::holds_alternative<PerfettoSqlParser::SqliteSql>(
+                             parser.statement())) {
+      stmt_sql = parser.statement_sql();
+      if (parser.Next() || !parser.status().ok()) {
+        stmt_sql = std::nullopt;
+      }
+    }
+  }
+  if (!stmt_sql) {
+    return ExecuteUntilLastStatement(std::move(sql_source));
+  }
+  std::optional<std::string> table =
+      MaterializeQueryResult(std::move(*stmt_sql), key);
+  if (!table) {
+    return ExecuteUntilLastStatement(std::move(sql_source));
+  }
+  return ExecuteFromQueryResultCache(*table, /*hit=*/false);
+}
+
+void PerfettoSqlEngine::InvalidateQueryResultCache() {
+  data_generation_++;
+  ClearQueryResultCache();
+}
+
+void PerfettoSqlEngine::ClearQueryResultCache() {
+  query_result_cache_generation_++;
+  for (const std::string& key : query_result_cache_keys_) {
+    std::string* table = query_result_cache_.Find(key);
+    PERFETTO_DCHECK(table);
+    if (!table->empty()) {
+      temporary_tables_to_drop_.emplace_back(std::move(*table));
+    }
+  }
+  query_result_cache_.Clear();
+  query_result_cache_keys_.clear();
+  DropPendingTemporaryTables();
+}
+
+std::optional<std::string> PerfettoSqlEngine::MaterializeQueryResult(
+    SqlSource stmt_sql,
+    const std::string& key) {
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY_TIMELINE,
+                    "QUERY_RESULT_CACHE_MATERIALIZE");
+  // Remembers that the result of |key| cannot be cached so that the checks
+  // below are not repeated for each execution.
+  auto cannot_cache = [this, &key]() -> std::optional<std::string> {
+    AddToQueryResultCache(key, "");
+    return std::nullopt;
+  };
+
+  query_result_uncacheable_ = false;
+  auto stmt = engine_->PrepareStatement(std::move(stmt_sql));
+  if (!stmt.status().ok()) {
+    // Let the normal execution report the error.
+    return std::nullopt;
+  }
+  sqlite3_stmt* raw_stmt = stmt.sqlite_stmt();
+  if (query_result_uncacheable_) {
+    return cannot_cache();
+  }
+
+  // Statements writing to the database invalidate the cache when executed so
+  // there is no point in remembering them.
+  if (!sqlite3_stmt_readonly(raw_stmt)) {
+    return std::nullopt;
+  }
+  if (sqlite3_column_count(raw_stmt) == 0) {
+    return cannot_cache();
+  }
+  base::StatusOr<std::vector<std::string>> column_names =
+      GetColumnNamesFromSelectStatement(stmt, "Query result cache");
+  if (!column_names.ok()) {
+    return cannot_cache();
+  }
+
+  // If the statement has side effects on the engine (e.g. by calling a
+  // function which runs PerfettoSQL), the cache is invalidated while stepping
+  // through it. The materialized result can be served but must not be kept.
+  uint64_t generation = query_result_cache_generation_;
+
+  size_t column_count = column_names->size();
+  std::vector<int> column_types(column_count, SQLITE_NULL);
+  RuntimeTable::Builder builder(pool_, std::move(*column_names));
+  uint32_t rows = 0;
+  int res;
+  for (res = sqlite3_step(raw_stmt); res == SQLITE_ROW;
+       ++rows, res = sqlite3_step(raw_stmt)) {
+    if (rows == kMaxQueryResultCacheRows) {
+      return cannot_cache();
+    }
+    for (uint32_t i = 0; i < column_count; ++i) {
+      int int_i = static_cast<int>(i);
+      int type = sqlite3_column_type(raw_stmt, int_i);
+
+      // The runtime table would change the type of the values of columns
+      // mixing integers and doubles so only cache columns with a single type.
+      // Void functions (see |WrapSqlFunction|) can also not be cached as the
+      // pointer they return cannot be stored.
+      if (type != SQLITE_NULL) {
+        if (column_types[i] != SQLITE_NULL && column_types[i] != type) {
+          return cannot_cache();
+        }
+        column_types[i] = type;
+      } else if (sqlite3_value_pointer(sqlite3_column_value(raw_stmt, int_i),
+                                       "VOID")) {
+        return cannot_cache();
+      }
+
+      base::Status status;
+      switch (type) {
+        case SQLITE_NULL:
+          status = builder.AddNull(i);
+          break;
+        case SQLITE_INTEGER:
+          status =
+              builder.AddInteger(i, sqlite3_column_int64(raw_stmt, int_i));
+          break;
+        case SQLITE_FLOAT:
+          status = builder.AddFloat(i, sqlite3_column_double(raw_stmt, int_i));
+          break;
+        case SQLITE_TEXT:
+          status = builder.AddText(
+              i, reinterpret_cast<const char*>(
+                     sqlite3_column_text(raw_stmt, int_i)));
+          break;
+        case SQLITE_BLOB:
+          return cannot_cache();
+      }
+      if (!status.ok()) {
+        return cannot_cache();
+      }
+    }
+  }
+  if (res != SQLITE_DONE) {
+    // Let the normal execution report the error.
+    return std::nullopt;
+  }
+  base::StatusOr<std::unique_ptr<RuntimeTable>> table =
+      std::move(builder).Build(rows);
+  if (!table.ok()) {
+    return cannot_cache();
+  }
+
+  std::optional<std::string> table_name =
+      CreateTemporaryTable("__intrinsic_query_result_cache", std::move(*table));
+  if (!table_name) {
+    return cannot_cache();
+  }
+
+  if (generation != query_result_cache_generation_) {
+    temporary_tables_to_drop_.push_back(*table_name);
+  } else {
+    AddToQueryResultCache(key, *table_name);
+  }
+  return table_name;
+}
+
+base::StatusOr<PerfettoSqlEngine::ExecutionResult>
+PerfettoSqlEngine::ExecuteFromQueryResultCache(const std::string& table,
+                                               bool hit) {
+  auto stmt = engine_->PrepareStatement(
+      SqlSource::FromTraceProcessorImplementation("SELECT * FROM " + table));
+  RETURN_IF_ERROR(stmt.status());
+  stmt.Step();
+  RETURN_IF_ERROR(stmt.status());
+
+  ExecutionStats stats;
+  IncrementCountForStmt(stmt, &stats);
+  stats.column_count =
+      static_cast<uint32_t>(sqlite3_column_count(stmt.sqlite_stmt()));
+  stats.result_cache_hit = hit;
+  return ExecutionResult{std::move(stmt), stats};
+}
+
+void PerfettoSqlEngine::AddToQueryResultCache(const std::string& key,
+                                              std::string table) {
+  if (query_result_cache_keys_.size() >= kMaxQueryResultCacheEntries) {
+    std::string* evicted =
+        query_result_cache_.Find(query_result_cache_keys_.front());
+    PERFETTO_DCHECK(evicted);
+    if (!evicted->empty()) {
+      DropTemporaryTable(std::move(*evicted));
+    }
+    query_result_cache_.Erase(query_result_cache_keys_.front());
+    query_result_cache_keys_.pop_front();
+  }
+  query_result_cache_.Insert(key, std::move(table));
+  query_result_cache_keys_.push_back(key);
+}
+
+std::optional<std::string> PerfettoSqlEngine::CreateTemporaryTable(
+    const char* prefix,
+    std::unique_ptr<RuntimeTable> table) {
+  std::string name =
+      std::string(prefix) + "_" + std::to_string(next_temporary_table_++);
+  base::StackString<1024> create("CREATE VIRTUAL TABLE %s USING runtime_table",
+                                 name.c_str());
+  PERFETTO_CHECK(!runtime_table_context_->temporary_create_state);
+  runtime_table_context_->temporary_create_state =
+      std::make_unique<DbSqliteModule::State>(std::move(table));
+
+  // The table is created directly with SQLite as it must not invalidate the
+  // query result cache.
+  char* errmsg_raw = nullptr;
+  int err =
+      sqlite3_exec(engine_->db(), create.c_str(), nullptr, nullptr, &errmsg_raw);
+  ScopedSqliteString errmsg(errmsg_raw);
+  runtime_table_context_->temporary_create_state.reset();
+  if (err != SQLITE_OK) {
+    // This happens if two columns have the same name.
+    return std::nullopt;
+  }
+  return name;
+}
+
+void PerfettoSqlEngine::DropTemporaryTable(std::string table) {
+  base::StackString<1024> drop("DROP TABLE %s", table.c_str());
+  char* errmsg_raw = nullptr;
+  int err =
+      sqlite3_exec(engine_->db(), drop.c_str(), nullptr, nullptr, &errmsg_raw);
+  ScopedSqliteString errmsg(errmsg_raw);
+  if (err != SQLITE_OK) {
+    // The table is still being read by a statement (e.g. an iterator which
+    // was not fully consumed): try again later.
+    temporary_tables_to_drop_.emplace_back(std::move(table));
+  }
+}
+
+void PerfettoSqlEngine::DropPendingTemporaryTables() {
+  if (temporary_tables_to_drop_.empty()) {
+    return;
+  }
+  std::vector<std::string> tables;
+  tables.swap(temporary_tables_to_drop_);
+  for (std::string& table : tables) {
+    DropTemporaryTable(std::move(table));
+  }
+}
+
+std::optional<SqlSource> PerfettoSqlEngine::RewriteGroupedAggregation(
+    const SqlSource& sql,
+    std::optional<std::string>* table_name) {
+  std::optional<GroupedAggregationQuery> query =
+      ParseGroupedAggregationQuery(sql);
+  if (!query) {
+    return std::nullopt;
+  }
+  std::optional<AggregationSource> source =
+      ResolveAggregationSource(query->table, 0);
+  if (!source) {
+    return std::nullopt;
+  }
+
+  // Returns the position of |name| in the columns of |source|.
+  auto find_column = [&source](const std::string& name) {
+    for (uint32_t i = 0; i < source->columns.size(); ++i) {
+      if (base::CaseInsensitiveEqual(source->columns[i].first, name)) {
+        return source->columns[i].second ? std::make_optional(i)
+                                         : std::nullopt;
+      }
+    }
+    return std::optional<uint32_t>();
+  };
+
+  std::vector<uint32_t> group_by;
+  for (const std::string& name : query->group_by) {
+    std::optional<uint32_t> col = find_column(name);
+    if (!col) {
+      return std::nullopt;
+    }
+    group_by.push_back(*source->columns[*col].second);
+  }
+
+  // The columns of the temporary table are renamed in the rewritten statement
+  // as their names do not need to be identifiers.
+  std::vector<AggregationColumn> columns;
+  std::vector<std::string> select;
+  for (uint32_t i = 0; i < query->columns.size(); ++i) {
+    const GroupedAggregationQuery::Column& column = query->columns[i];
+    AggregationColumn agg_column{"c" + std::to_string(i), column.type, 0};
+    std::string name = column.name;
+    if (column.type != AggregationColumn::Type::kCountRows) {
+      std::optional<uint32_t> col = find_column(column.arg);
+      if (!col) {
+        return std::nullopt;
+      }
+      agg_column.col_idx = *source->columns[*col].second;
+      if (name.empty()) {
+        name = source->columns[*col].first;
+      }
+    }
+
+    // Leave the queries which SQLite would reject (or accept with different
+    // semantics) to SQLite.
+    if (column.type == AggregationColumn::Type::kGroupColumn &&
+        std::find(group_by.begin(), group_by.end(), agg_column.col_idx) ==
+            group_by.end()) {
+      return std::nullopt;
+    }
+    if (column.type == AggregationColumn::Type::kSum &&
+        source->table->columns()[agg_column.col_idx].type() !=
+            SqlValue::kLong) {
+      return std::nullopt;
+    }
+    select.push_back(agg_column.name + " AS " + QuoteIdentifier(name));
+    columns.emplace_back(std::move(agg_column));
+  }
+
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY_TIMELINE,
+                    "GROUPED_AGGREGATION_PUSHDOWN");
+  base::StatusOr<std::unique_ptr<RuntimeTable>> table =
+      ComputeGroupedAggregation(*source->table, pool_, group_by, columns);
+  if (!table.ok()) {
+    // Let SQLite report the error (e.g. an integer overflow).
+    return std::nullopt;
+  }
+  *table_name = CreateTemporaryTable("__intrinsic_grouped_aggregation",
+                                     std::move(*table));
+  if (!*table_name) {
+    return std::nullopt;
+  }
+  return sql.RewriteAllIgnoreExisting(
+      SqlSource::FromTraceProcessorImplementation(
+          "SELECT " + base::Join(select, ", ") + " FROM " + **table_name));
+}
+
+std::optional<PerfettoSqlEngine::AggregationSource>
+PerfettoSqlEngine::ResolveAggregationSource(const std::string& name,
+                                            uint32_t depth) {
+  if (!MaterializeDeferredTable(name).ok()) {
+    return std::nullopt;
+  }
+  const Table* table = GetRuntimeTableOrNull(name);
+  if (!table) {
+    table = GetStaticTableOrNull(name);
+  }
+  if (table) {
+    AggregationSource source;
+    source.table = table;
+    for (uint32_t i = 0; i < table->columns().size(); ++i) {
+      const ColumnLegacy& col = table->columns()[i];
+      if (!col.IsHidden()) {
+        source.columns.emplace_back(col.name(), i);
+      }
+    }
+    return source;
+  }
+  if (depth >= kMaxAggregationViewDepth) {
+    return std::nullopt;
+  }
+
+  // |name| comes from an unquoted identifier so it can be inlined.
+  auto stmt = engine_->PrepareStatement(SqlSource::FromTraceProcessorImplementation(
+      "SELECT sql FROM sqlite_master WHERE type = 'view' AND name = '" + name +
+      "' COLLATE NOCASE"));
+  stmt.Step();
+  if (!stmt.status().ok() || stmt.IsDone()) {
+    return std::nullopt;
+  }
+  const char* view_sql =
+      reinterpret_cast<const char*>(sqlite3_column_text(stmt.sqlite_stmt(), 0));
+  if (!view_sql) {
+    return std::nullopt;
+  }
+
+  // Parses "CREATE VIEW <name> AS SELECT <items> FROM <table>" where each item
+  // is either "*", a column, or an expression which is not followed.
+  using Token = SqliteTokenizer::Token;
+  SqliteTokenizer tokenizer(SqlSource::FromTraceProcessorImplementation(view_sql));
+  if (!IsKeyword(tokenizer.NextNonWhitespace(), "create")) {
+    return std::nullopt;
+  }
+  for (Token token = tokenizer.NextNonWhitespace(); !IsKeyword(token, "as");
+       token = tokenizer.NextNonWhitespace()) {
+    // Views with a column list are not supported.
+    if (token.IsTerminal() || token.token_type == SqliteTokenType::TK_LP) {
+      return std::nullopt;
+    }
+  }
+  if (!IsKeyword(tokenizer.NextNonWhitespace(), "select")) {
+    return std::nullopt;
+  }
+
+  // The columns of the view: a null |name| stands for "*".
+  struct Item {
+    std::optional<std::string> name;
+    std::optional<std::string> column;
+  };
+  std::vector<Item> items;
+  for (bool done = false; !done;) {
+    std::vector<Token> tokens;
+    uint32_t parens = 0;
+    for (Token token = tokenizer.NextNonWhitespace();;
+         token = tokenizer.NextNonWhitespace()) {
+      if (token.IsTerminal()) {
+        return std::nullopt;
+      }
+      if (parens == 0 && token.token_type == SqliteTokenType::TK_COMMA) {
+        break;
+      }
+      if (parens == 0 && IsKeyword(token, "from")) {
+        done = true;
+        break;
+      }
+      if (token.token_type == SqliteTokenType::TK_LP) {
+        parens++;
+      } else if (token.token_type == SqliteTokenType::TK_RP && parens > 0) {
+        parens--;
+      }
+      tokens.push_back(token);
+    }
+    if (tokens.empty()) {
+      return std::nullopt;
+    }
+    if (tokens.size() == 1 &&
+        tokens[0].token_type == SqliteTokenType::TK_STAR) {
+      items.push_back(Item{std::nullopt, std::nullopt});
+      continue;
+    }
+    std::optional<std::string> first = GetIdentifier(tokens.front());
+    std::optional<std::string> alias =
+        tokens.size() > 1 ? GetIdentifier(tokens.back()) : first;
+    bool is_column =
+        first && (tokens.size() == 1 ||
+                  (tokens.size() == 2 && alias) ||
+                  (tokens.size() == 3 && IsKeyword(tokens[1], "as") && alias));
+    if (is_column) {
+      items.push_back(Item{alias, first});
+    } else if (alias && tokens.size() > 2 &&
+               IsKeyword(tokens[tokens.size() - 2], "as")) {
+      items.push_back(Item{alias, std::nullopt});
+    } else if (tokens.size() == 3 &&
+               tokens[1].token_type == SqliteTokenType::TK_DOT) {
+      // Qualified columns are not supported.
+      return std::nullopt;
+    } else {
+      // Unaliased expressions are named after their text, which cannot be an
+      // identifier.
+      items.push_back(Item{"", std::nullopt});
+    }
+  }
+
+  std::optional<std::string> from = GetIdentifier(tokenizer.NextNonWhitespace());
+  if (!from || !tokenizer.NextNonWhitespace().IsTerminal()) {
+    return std::nullopt;
+  }
+  std::optional<AggregationSource> inner =
+      ResolveAggregationSource(*from, depth + 1);
+  if (!inner) {
+    return std::nullopt;
+  }
+
+  AggregationSource source;
+  source.table = inner->table;
+  for (const Item& item : items) {
+    if (!item.name) {
+      source.columns.insert(source.columns.end(), inner->columns.begin(),
+                            inner->columns.end());
+      continue;
+    }
+    std::optional<uint32_t> col_idx;
+    if (item.column) {
+      auto it = std::find_if(
+          inner->columns.begin(), inner->columns.end(),
+          [&item](const std::pair<std::string, std::optional<uint32_t>>& c) {
+            return base::CaseInsensitiveEqual(c.first, *item.column);
+          });
+      if (it == inner->columns.end()) {
+        return std::nullopt;
+      }
+      col_idx = it->second;
+    }
+    source.columns.emplace_back(*item.name, col_idx);
+  }
+  return source;
+}
+
 base::Status PerfettoSqlEngine::RegisterRuntimeFunction(
     bool replace,
     const FunctionPrototype& prototype,
@@ -433,6 +1319,10 @@ base::Status PerfettoSqlEngine::ExecuteCreateTable(
                     [&create_table](metatrace::Record* record) {
                       record->AddArg("Table", create_table.name);
                     });
+  if (create_table_check_)
+    RETURN_IF_ERROR(create_table_check_(create_table.name));
+  // An eager creation supersedes any deferred one for the same table.
+  deferred_tables_.Erase(base::ToLower(create_table.name));
   auto stmt_or = engine_->PrepareStatement(create_table.sql);
   RETURN_IF_ERROR(stmt_or.status());
   SqliteEngine::PreparedStatement stmt = std::move(stmt_or);
@@ -628,7 +1518,23 @@ base::Status PerfettoSqlEngine::IncludeFileImpl(
     return base::OkStatus();
   }
 
-  auto it = Execute(SqlSource::FromModuleInclude(file.sql, key));
+  // Module files are only parsed the first time they are included in the
+  // process: afterwards, the parsed statements are reused.
+  ParsedModuleCache& cache = ParsedModuleCache::GetInstance();
+  std::shared_ptr<const PerfettoSqlParser::ParsedStatements> parsed =
+      cache.Find(key, file.sql);
+  PerfettoSqlParser::ParsedStatements parsed_out;
+  std::unique_ptr<PerfettoSqlParser> module_parser;
+  if (parsed) {
+    module_parser = std::make_unique<PerfettoSqlParser>(parsed, macros_);
+  } else {
+    module_parser = std::make_unique<PerfettoSqlParser>(
+        SqlSource::FromModuleInclude(file.sql, key), macros_);
+    module_parser->set_parsed_statements_out(&parsed_out);
+  }
+  module_include_depth_++;
+  auto it = ExecuteParsed(*module_parser);
+  module_include_depth_--;
   if (!it.status().ok()) {
     return base::ErrStatus("%s%s",
                            parser.statement_sql().AsTraceback(0).c_str(),
@@ -636,6 +1542,9 @@ base::Status PerfettoSqlEngine::IncludeFileImpl(
   }
   if (it->statement_count_with_output > 0)
     return base::ErrStatus("INCLUDE: Included module returning values.");
+  if (!parsed) {
+    cache.Insert(key, file.sql, std::move(parsed_out));
+  }
   file.included = true;
   return base::OkStatus();
 }
@@ -815,6 +1724,78 @@ base::Status PerfettoSqlEngine::ExecuteCreateMacro(
   return base::OkStatus();
 }
 
+bool PerfettoSqlEngine::CanDeferCreateTable(
+    const PerfettoSqlParser::CreateTable& create_table) {
+  if (!lazy_module_tables_ || module_include_depth_ == 0) {
+    return false;
+  }
+  // Replacing an existing table cannot be deferred as statements would see the
+  // old table rather than triggering the creation of the new one.
+  return !GetMutableTableOrNull(create_table.name);
+}
+
+base::Status PerfettoSqlEngine::DeferCreateTable(
+    const PerfettoSqlParser::CreateTable& create_table,
+    const SqlSource& statement_sql) {
+  std::string key = base::ToLower(create_table.name);
+  if (!create_table.replace && deferred_tables_.Find(key)) {
+    return base::ErrStatus("CREATE PERFETTO TABLE: table '%s' already exists",
+                           create_table.name.c_str());
+  }
+  deferred_tables_.Erase(key);
+  deferred_tables_.Insert(key, DeferredTable{create_table, statement_sql});
+  return base::OkStatus();
+}
+
+base::StatusOr<bool> PerfettoSqlEngine::MaterializeDeferredTable(
+    const std::string& name) {
+  std::string key = base::ToLower(name);
+  DeferredTable* deferred = deferred_tables_.Find(key);
+  if (!deferred) {
+    return false;
+  }
+  // Removed before the table is created so that a table (indirectly)
+  // referencing itself fails as usual rather than recursing.
+  DeferredTable table = std::move(*deferred);
+  deferred_tables_.Erase(key);
+  RETURN_IF_ERROR(AddTracebackIfNeeded(ExecuteCreateTable(table.create_table),
+                                       table.statement_sql));
+  return true;
+}
+
+base::Status PerfettoSqlEngine::ExecuteCreateIndex(
+    const PerfettoSqlParser::CreateIndex& create_index) {
+  RETURN_IF_ERROR(MaterializeDeferredTable(create_index.table_name).status());
+  Table* table = GetMutableTableOrNull(create_index.table_name);
+  if (!table) {
+    return base::ErrStatus("CREATE PERFETTO INDEX: table '%s' not found",
+                           create_index.table_name.c_str());
+  }
+  std::vector<uint32_t> col_idxs;
+  for (const std::string& col_name : create_index.col_names) {
+    std::optional<uint32_t> col_idx = table->ColumnIdxFromName(col_name);
+    if (!col_idx) {
+      return base::ErrStatus(
+          "CREATE PERFETTO INDEX: column '%s' not found in table '%s'",
+          col_name.c_str(), create_index.table_name.c_str());
+    }
+    col_idxs.push_back(*col_idx);
+  }
+  return table->CreateIndex(create_index.name, std::move(col_idxs),
+                            create_index.replace);
+}
+
+base::Status PerfettoSqlEngine::ExecuteDropIndex(
+    const PerfettoSqlParser::DropIndex& drop_index) {
+  RETURN_IF_ERROR(MaterializeDeferredTable(drop_index.table_name).status());
+  Table* table = GetMutableTableOrNull(drop_index.table_name);
+  if (!table) {
+    return base::ErrStatus("DROP PERFETTO INDEX: table '%s' not found",
+                           drop_index.table_name.c_str());
+  }
+  return table->DropIndex(drop_index.name);
+}
+
 base::StatusOr<std::vector<std::string>>
 PerfettoSqlEngine::GetColumnNamesFromSelectStatement(
     const SqliteEngine::PreparedStatement& stmt,
@@ -913,4 +1894,28 @@ const Table* PerfettoSqlEngine::GetStaticTableOrNull(
   return state ? state->static_table : nullptr;
 }
 
+Table* PerfettoSqlEngine::GetMutableTableOrNull(std::string_view name) {
+  if (auto* state = runtime_table_context_->manager.FindStateByName(name);
+      state) {
+    return state->runtime_table.get();
+  }
+  auto* state = static_table_context_->manager.FindStateByName(name);
+  return state ? state->static_table : nullptr;
+}
+
+std::vector<PerfettoSqlEngine::RegisteredTable>
+PerfettoSqlEngine::GetAllTables() const {
+  std::vector<RegisteredTable> tables;
+  static_table_context_->manager.ForEachState(
+      [&tables](const std::string& name, DbSqliteModule::State* state) {
+        tables.push_back(RegisteredTable{name, state->static_table, false});
+      });
+  runtime_table_context_->manager.ForEachState(
+      [&tables](const std::string& name, DbSqliteModule::State* state) {
+        tables.push_back(
+            RegisteredTable{name, state->runtime_table.get(), true});
+      });
+  return tables;
+}
+
 }  // namespace perfetto::trace_processor
@@ -18,7 +18,10 @@
 #define SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_PERFETTO_SQL_ENGINE_H_
 
 #include <cstdint>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <optional>
 #include <string>
 #include <string_view>
 #include <utility>
@@ -41,6 +44,7 @@
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_window_function.h"
 #include "src/trace_processor/sqlite/db_sqlite_table.h"
+#include "src/trace_processor/sqlite/sql_profile.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/sqlite/sqlite_engine.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
@@ -58,6 +62,10 @@ class PerfettoSqlEngine {
     uint32_t column_count = 0;
     uint32_t statement_count = 0;
     uint32_t statement_count_with_output = 0;
+
+    // Whether the result was served from the query result cache (true) or
+    // computed and stored into it (false). Unset if the cache was not used.
+    std::optional<bool> result_cache_hit;
   };
   struct ExecutionResult {
     SqliteEngine::PreparedStatement stmt;
@@ -83,6 +91,38 @@ class PerfettoSqlEngine {
   // no valid SQL to run.
   base::StatusOr<ExecutionResult> ExecuteUntilLastStatement(SqlSource sql);
 
+  // Same as |ExecuteUntilLastStatement| but, if |sql| is a single read-only
+  // SQLite statement, its full result is materialized into a hidden table the
+  // first time it is executed and served from that table when the same
+  // (whitespace normalized) SQL is executed again.
+  //
+  // The cache is invalidated whenever any table, view, function, macro or
+  // index is created or dropped, a module is included, any statement which
+  // writes to the database is executed or |InvalidateQueryResultCache| is
+  // called. Note that the results of non-deterministic functions (e.g.
+  // random()) are also cached: callers opt in by using this function.
+  base::StatusOr<ExecutionResult> ExecuteUntilLastStatementWithResultCache(
+      SqlSource sql);
+
+  // Discards all the results stored by
+  // |ExecuteUntilLastStatementWithResultCache|. Should be called whenever the
+  // contents of tables change outside of the SQL engine (e.g. when more of
+  // the trace is parsed).
+  void InvalidateQueryResultCache();
+
+  // Marks the statement being prepared as reading data which changes outside
+  // of the SQL engine without invalidating the query result cache (e.g. the
+  // stats tables): its result will not be cached. Should be called from the
+  // SQLite authorizer when such a table is read.
+  void MarkQueryResultUncacheable() { query_result_uncacheable_ = true; }
+
+  // Returns a number which changes whenever the result of a query over the
+  // existing tables and views may have changed. Unlike the query result cache,
+  // it is not changed by the creation of virtual tables, allowing operators
+  // (e.g. mipmaps) to share state derived from their input between the tables
+  // created over it.
+  uint64_t data_generation() const { return data_generation_; }
+
   // Registers a trace processor C++ function to be runnable from SQL.
   //
   // The format of the function is given by the |SqlFunction|.
@@ -163,8 +203,8 @@ class PerfettoSqlEngine {
   base::Status EnableSqlFunctionMemoization(const std::string& name);
 
   // Registers a trace processor C++ table with SQLite with an SQL name of
-  // |name|.
-  void RegisterStaticTable(const Table&,
+  // |name|. The table is only mutated by CREATE PERFETTO INDEX statements.
+  void RegisterStaticTable(Table*,
                            const std::string& name,
                            Table::Schema schema);
 
@@ -173,6 +213,23 @@ class PerfettoSqlEngine {
 
   SqliteEngine* sqlite_engine() { return engine_.get(); }
 
+  // Returns the profile of the statements executed by this engine and of the
+  // cursors of its C++ tables. Recording is disabled by default.
+  SqlProfile* profile() { return &profile_; }
+
+  // Sets whether the PERFETTO TABLEs created by included modules are only
+  // computed when they are first referenced (see
+  // |Config::enable_lazy_module_tables|).
+  void set_lazy_module_tables(bool lazy) { lazy_module_tables_ = lazy; }
+
+  // Sets a function called with the name of each PERFETTO TABLE before it is
+  // computed. If it returns an error, the table is not created and the
+  // statement fails with this error.
+  using CreateTableCheck = std::function<base::Status(const std::string&)>;
+  void set_create_table_check(CreateTableCheck check) {
+    create_table_check_ = std::move(check);
+  }
+
   // Makes new SQL module available to import.
   void RegisterModule(const std::string& name,
                       sql_modules::RegisteredModule module) {
@@ -214,7 +271,29 @@ class PerfettoSqlEngine {
   // Find static table registered with engine with provided name.
   const Table* GetStaticTableOrNull(std::string_view) const;
 
+  // Find the runtime or static table registered with engine with the provided
+  // name.
+  Table* GetMutableTableOrNull(std::string_view);
+
+  // A table registered with the engine, as returned by |GetAllTables|.
+  struct RegisteredTable {
+    std::string name;
+    const Table* table;
+    // Whether the table was created with CREATE PERFETTO TABLE (as opposed to
+    // a static table, usually backed by TraceStorage).
+    bool is_runtime;
+  };
+
+  // Returns all the static and runtime tables registered with the engine.
+  std::vector<RegisteredTable> GetAllTables() const;
+
  private:
+  // Same as |Execute| and |ExecuteUntilLastStatement| but for the statements
+  // returned by |parser|.
+  base::StatusOr<ExecutionStats> ExecuteParsed(PerfettoSqlParser& parser);
+  base::StatusOr<ExecutionResult> ExecuteParsedUntilLastStatement(
+      PerfettoSqlParser& parser);
+
   base::Status ExecuteCreateFunction(const PerfettoSqlParser::CreateFunction&);
 
   base::Status ExecuteInclude(const PerfettoSqlParser::Include&,
@@ -224,10 +303,27 @@ class PerfettoSqlEngine {
   base::Status ExecuteCreateTable(
       const PerfettoSqlParser::CreateTable& create_table);
 
+  // Returns whether the creation of |create_table| can be deferred until the
+  // table is first referenced.
+  bool CanDeferCreateTable(const PerfettoSqlParser::CreateTable& create_table);
+
+  // Records |create_table| to be executed when the table is first referenced.
+  base::Status DeferCreateTable(
+      const PerfettoSqlParser::CreateTable& create_table,
+      const SqlSource& statement_sql);
+
+  // Creates the table |name| if its creation was deferred. Returns whether the
+  // table was created.
+  base::StatusOr<bool> MaterializeDeferredTable(const std::string& name);
+
   base::Status ExecuteCreateView(const PerfettoSqlParser::CreateView&);
 
   base::Status ExecuteCreateMacro(const PerfettoSqlParser::CreateMacro&);
 
+  base::Status ExecuteCreateIndex(const PerfettoSqlParser::CreateIndex&);
+
+  base::Status ExecuteDropIndex(const PerfettoSqlParser::DropIndex&);
+
   template <typename Function>
   base::Status RegisterFunctionWithSqlite(
       const char* name,
@@ -235,6 +331,66 @@ class PerfettoSqlEngine {
       std::unique_ptr<typename Function::Context> ctx,
       bool deterministic = true);
 
+  // Fully executes the read-only statement |stmt_sql| and stores its result
+  // in a new query result cache table for |key|. Returns the name of the
+  // table or std::nullopt if the result cannot be materialized, in which case
+  // the statement should be executed as usual.
+  std::optional<std::string> MaterializeQueryResult(SqlSource stmt_sql,
+                                                    const std::string& key);
+
+  // Discards all the results stored in the query result cache without
+  // changing |data_generation_|.
+  void ClearQueryResultCache();
+
+  // Returns the prepared statement reading the query result cache table
+  // |table|, stepped once.
+  base::StatusOr<ExecutionResult> ExecuteFromQueryResultCache(
+      const std::string& table,
+      bool hit);
+
+  // Stores |table| as the query result cache table of |key|, evicting the
+  // oldest entry if the cache is full.
+  void AddToQueryResultCache(const std::string& key, std::string table);
+
+  // Registers |table| with SQLite under a new name starting with |prefix|
+  // without invalidating the query result cache. Returns the name of the
+  // table or std::nullopt if SQLite rejected its schema.
+  std::optional<std::string> CreateTemporaryTable(
+      const char* prefix,
+      std::unique_ptr<RuntimeTable> table);
+
+  // Drops the temporary table |table|. If it is still being read by a
+  // statement, it will be dropped by |DropPendingTemporaryTables| instead.
+  void DropTemporaryTable(std::string table);
+
+  // Drops the temporary tables which could not be dropped before.
+  void DropPendingTemporaryTables();
+
+  // If |sql| is a "SELECT <columns> FROM <table> GROUP BY <columns>"
+  // statement where |table| is a trace processor table (or a view selecting
+  // columns of one) and all the columns are grouped by columns or
+  // COUNT/MIN/MAX/SUM aggregates of columns, computes the result with
+  // |ComputeGroupedAggregation| and returns |sql| rewritten to read it from a
+  // temporary table, whose name is stored in |table_name|. Returns
+  // std::nullopt if |sql| should be executed as is.
+  std::optional<SqlSource> RewriteGroupedAggregation(
+      const SqlSource& sql,
+      std::optional<std::string>* table_name);
+
+  // The table backing a table or view for |RewriteGroupedAggregation|.
+  struct AggregationSource {
+    const Table* table = nullptr;
+    // The columns of the table or view and the index of the column of |table|
+    // backing each of them (std::nullopt for columns computed by the view).
+    std::vector<std::pair<std::string, std::optional<uint32_t>>> columns;
+  };
+
+  // Returns the table backing the table or view |name|, following views of
+  // the form "SELECT *, <column> AS <alias>, ... FROM <table or view>".
+  std::optional<AggregationSource> ResolveAggregationSource(
+      const std::string& name,
+      uint32_t depth);
+
   // Get the column names from a statement.
   // |operator_name| is used in the error message if the statement is invalid.
   static base::StatusOr<std::vector<std::string>>
@@ -274,6 +430,39 @@ class PerfettoSqlEngine {
   DbSqliteModule::Context* static_table_fn_context_ = nullptr;
   base::FlatHashMap<std::string, sql_modules::RegisteredModule> modules_;
   base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro> macros_;
+  // Maps the normalized SQL of each cached query to the name of the table
+  // containing its result or to an empty string if the result of the query
+  // cannot be cached.
+  base::FlatHashMap<std::string, std::string> query_result_cache_;
+  // The keys of |query_result_cache_| in insertion order, used for eviction.
+  std::deque<std::string> query_result_cache_keys_;
+  // Incremented on each invalidation of the query result cache.
+  uint64_t query_result_cache_generation_ = 0;
+  // See |data_generation|.
+  uint64_t data_generation_ = 0;
+  // Set by |MarkQueryResultUncacheable| while a statement is prepared.
+  bool query_result_uncacheable_ = false;
+
+  // Temporary tables (see |CreateTemporaryTable|) which are not used anymore
+  // but could not be dropped yet.
+  std::vector<std::string> temporary_tables_to_drop_;
+  uint32_t next_temporary_table_ = 0;
+
+  // A PERFETTO TABLE whose creation was deferred until it is first referenced.
+  struct DeferredTable {
+    PerfettoSqlParser::CreateTable create_table;
+    SqlSource statement_sql;
+  };
+  bool lazy_module_tables_ = false;
+  CreateTableCheck create_table_check_;
+  // The number of modules currently being included.
+  uint32_t module_include_depth_ = 0;
+  // Keyed by the lowercased name of the table.
+  base::FlatHashMap<std::string, DeferredTable> deferred_tables_;
+
+  // Should outlive |engine_| as its tables record their cursors in it.
+  SqlProfile profile_;
+
   std::unique_ptr<SqliteEngine> engine_;
 };
 
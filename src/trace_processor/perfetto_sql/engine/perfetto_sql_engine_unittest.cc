@@ -16,6 +16,8 @@
 
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 
+#include <cstring>
+
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/tables/slice_tables_py.h"
 #include "test/gtest_and_gmock.h"
@@ -148,6 +150,32 @@ TEST_F(PerfettoSqlEngineTest, Table_IncorrectSchema) {
                         "folowing columns exist, but are not declared: y"));
 }
 
+TEST_F(PerfettoSqlEngineTest, Index_CreateAndDrop) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE foo AS SELECT 1 AS x, 2 AS y;"
+      "CREATE PERFETTO INDEX foo_idx ON foo(x, y);"
+      "DROP PERFETTO INDEX foo_idx ON foo"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+}
+
+TEST_F(PerfettoSqlEngineTest, Index_Invalid) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE foo AS SELECT 1 AS x"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO INDEX foo_idx ON bar(x)"));
+  ASSERT_FALSE(res.ok());
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO INDEX foo_idx ON foo(z)"));
+  ASSERT_FALSE(res.ok());
+
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("DROP PERFETTO INDEX foo_idx ON foo"));
+  ASSERT_FALSE(res.ok());
+}
+
 TEST_F(PerfettoSqlEngineTest, Table_Drop) {
   auto res_create = engine_.Execute(SqlSource::FromExecuteQuery(
       "CREATE PERFETTO TABLE foo AS SELECT 'foo' AS bar"));
@@ -295,14 +323,48 @@ TEST_F(PerfettoSqlEngineTest, Include_Module) {
       engine_.FindModule("bar")->include_key_to_file["bar.bar"].included);
 }
 
+TEST_F(PerfettoSqlEngineTest, Include_LazyTables) {
+  engine_.set_lazy_module_tables(true);
+  engine_.RegisterModule(
+      "lazy",
+      CreateTestModule({
+          {"lazy.lazy",
+           "CREATE PERFETTO TABLE lazy_base AS SELECT 42 AS x;"
+           "CREATE PERFETTO TABLE lazy_derived AS SELECT x + 1 AS y "
+           "FROM lazy_base;"
+           "CREATE PERFETTO INDEX lazy_idx ON lazy_derived(y);"
+           "CREATE PERFETTO TABLE lazy_unused AS SELECT 1 AS z;"
+           "CREATE PERFETTO TABLE lazy_broken AS SELECT * FROM missing;"},
+      }));
+
+  // The broken table is only reported when used.
+  auto res = engine_.Execute(
+      SqlSource::FromExecuteQuery("INCLUDE PERFETTO MODULE lazy.lazy"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+  ASSERT_TRUE(engine_.GetRuntimeTableOrNull("lazy_base"));
+  ASSERT_TRUE(engine_.GetRuntimeTableOrNull("lazy_derived"));
+  ASSERT_FALSE(engine_.GetRuntimeTableOrNull("lazy_unused"));
+  ASSERT_FALSE(engine_.GetRuntimeTableOrNull("lazy_broken"));
+
+  auto query = engine_.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("SELECT z FROM lazy_unused"));
+  ASSERT_TRUE(query.ok()) << query.status().c_message();
+  ASSERT_EQ(sqlite3_column_int64(query->stmt.sqlite_stmt(), 0), 1);
+  ASSERT_TRUE(engine_.GetRuntimeTableOrNull("lazy_unused"));
+
+  query = engine_.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("SELECT * FROM lazy_broken"));
+  ASSERT_FALSE(query.ok());
+}
+
 TEST_F(PerfettoSqlEngineTest, MismatchedRange) {
   tables::SliceTable parent(&pool_);
   tables::ExpectedFrameTimelineSliceTable child(&pool_, &parent);
 
-  engine_.RegisterStaticTable(parent, "parent",
+  engine_.RegisterStaticTable(&parent, "parent",
                               tables::SliceTable::ComputeStaticSchema());
   engine_.RegisterStaticTable(
-      child, "child",
+      &child, "child",
       tables::ExpectedFrameTimelineSliceTable::ComputeStaticSchema());
 
   for (uint32_t i = 0; i < 5; i++) {
@@ -318,6 +380,216 @@ TEST_F(PerfettoSqlEngineTest, MismatchedRange) {
   ASSERT_TRUE(res.ok()) << res.status().c_message();
 }
 
+TEST_F(PerfettoSqlEngineTest, Table_RepeatedEqualityJoin) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE build AS "
+      "SELECT 1 AS k, 'a' AS v UNION ALL SELECT 2, 'b' UNION ALL "
+      "SELECT 1, 'c' UNION ALL SELECT NULL, 'd' UNION ALL SELECT 3, 'e';"
+      "CREATE PERFETTO TABLE probe AS "
+      "SELECT 1 AS x UNION ALL SELECT 2 UNION ALL SELECT 3 UNION ALL "
+      "SELECT 4 UNION ALL SELECT 1 UNION ALL SELECT 2 UNION ALL "
+      "SELECT 4 UNION ALL SELECT 3 UNION ALL SELECT 1"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  // The first probes of |build| filter the table, the later ones use the
+  // hash index built on |k|: both must return the rows in table order.
+  auto join = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT x, v FROM probe CROSS JOIN build ON build.k = probe.x"));
+  ASSERT_TRUE(join.ok()) << join.status().c_message();
+  std::string result;
+  for (bool has_row = !join->stmt.IsDone(); has_row;
+       has_row = join->stmt.Step()) {
+    result += std::to_string(sqlite3_column_int64(join->stmt.sqlite_stmt(), 0));
+    result += reinterpret_cast<const char*>(
+        sqlite3_column_text(join->stmt.sqlite_stmt(), 1));
+    result += ",";
+  }
+  ASSERT_TRUE(join->stmt.status().ok());
+  ASSERT_EQ(result, "1a,1c,2b,3e,1a,1c,2b,3e,1a,1c,");
+}
+
+TEST_F(PerfettoSqlEngineTest, GroupedAggregationPushdown) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO TABLE foo AS "
+      "SELECT 'b' AS name, 2 AS dur UNION ALL SELECT 'a', 5 UNION ALL "
+      "SELECT 'b', 7 UNION ALL SELECT 'a', NULL UNION ALL SELECT 'c', 1;"
+      "CREATE VIEW foo_view AS SELECT *, name AS label FROM foo"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto agg = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT label, count(*), MAX(dur) AS max_dur, sum(dur) "
+      "FROM foo_view GROUP BY label"));
+  ASSERT_TRUE(agg.ok()) << agg.status().c_message();
+  ASSERT_NE(std::string(agg->stmt.sql()).find("grouped_aggregation"),
+            std::string::npos);
+  sqlite3_stmt* stmt = agg->stmt.sqlite_stmt();
+  ASSERT_STREQ(sqlite3_column_name(stmt, 0), "label");
+  ASSERT_STREQ(sqlite3_column_name(stmt, 1), "count(*)");
+  ASSERT_STREQ(sqlite3_column_name(stmt, 2), "max_dur");
+  ASSERT_STREQ(sqlite3_column_name(stmt, 3), "sum(dur)");
+  std::string result;
+  for (bool has_row = !agg->stmt.IsDone(); has_row;
+       has_row = agg->stmt.Step()) {
+    result += reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+    for (int i = 1; i < 4; ++i) {
+      result += " " + std::to_string(sqlite3_column_int64(stmt, i));
+    }
+    result += ",";
+  }
+  ASSERT_TRUE(agg->stmt.status().ok());
+  ASSERT_EQ(result, "a 2 5 5,b 2 7 9,c 1 1 1,");
+
+  // Queries which do not have the exact shape are left to SQLite.
+  auto filtered = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+      "SELECT name, count(*) FROM foo WHERE dur > 1 GROUP BY name"));
+  ASSERT_TRUE(filtered.ok()) << filtered.status().c_message();
+  ASSERT_EQ(std::string(filtered->stmt.sql()).find("grouped_aggregation"),
+            std::string::npos);
+
+  // Neither are queries without GROUP BY.
+  auto plain = engine_.ExecuteUntilLastStatement(
+      SqlSource::FromExecuteQuery("SELECT name FROM foo"));
+  ASSERT_TRUE(plain.ok()) << plain.status().c_message();
+  ASSERT_EQ(std::string(plain->stmt.sql()).find("grouped_aggregation"),
+            std::string::npos);
+}
+
+TEST_F(PerfettoSqlEngineTest, ResultCache_HitAndInvalidate) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE TABLE foo(x INT, y TEXT, z DOUBLE);"
+      "INSERT INTO foo VALUES(1, 'a', 1.5), (2, NULL, 2.5)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto miss = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT x, y, z FROM foo ORDER BY x;"));
+  ASSERT_TRUE(miss.ok()) << miss.status().c_message();
+  ASSERT_EQ(miss->stats.result_cache_hit, false);
+  ASSERT_EQ(miss->stats.column_count, 3u);
+  ASSERT_EQ(sqlite3_column_int64(miss->stmt.sqlite_stmt(), 0), 1);
+  ASSERT_STREQ(reinterpret_cast<const char*>(
+                   sqlite3_column_text(miss->stmt.sqlite_stmt(), 1)),
+               "a");
+  ASSERT_TRUE(miss->stmt.Step());
+  ASSERT_EQ(sqlite3_column_type(miss->stmt.sqlite_stmt(), 1), SQLITE_NULL);
+  ASSERT_EQ(sqlite3_column_double(miss->stmt.sqlite_stmt(), 2), 2.5);
+  ASSERT_FALSE(miss->stmt.Step());
+
+  auto hit = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT x, y, z\n  FROM   foo ORDER BY x"));
+  ASSERT_TRUE(hit.ok()) << hit.status().c_message();
+  ASSERT_EQ(hit->stats.result_cache_hit, true);
+  ASSERT_EQ(hit->stats.statement_count_with_output, 1u);
+  ASSERT_EQ(sqlite3_column_type(hit->stmt.sqlite_stmt(), 0), SQLITE_INTEGER);
+  ASSERT_EQ(sqlite3_column_int64(hit->stmt.sqlite_stmt(), 0), 1);
+  ASSERT_TRUE(hit->stmt.Step());
+  ASSERT_EQ(sqlite3_column_int64(hit->stmt.sqlite_stmt(), 0), 2);
+  ASSERT_FALSE(hit->stmt.Step());
+
+  // Writing to the database must invalidate the cached result.
+  res = engine_.Execute(
+      SqlSource::FromExecuteQuery("INSERT INTO foo VALUES(3, 'c', 3.5)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto after = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT x, y, z FROM foo ORDER BY x"));
+  ASSERT_TRUE(after.ok()) << after.status().c_message();
+  ASSERT_EQ(after->stats.result_cache_hit, false);
+  uint32_t rows = 1;
+  while (after->stmt.Step()) {
+    rows++;
+  }
+  ASSERT_EQ(rows, 3u);
+}
+
+TEST_F(PerfettoSqlEngineTest, ResultCache_PerfettoSqlInvalidates) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO FUNCTION foo() RETURNS INT AS SELECT 1"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto first = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT foo() AS x"));
+  ASSERT_TRUE(first.ok()) << first.status().c_message();
+  ASSERT_EQ(sqlite3_column_int64(first->stmt.sqlite_stmt(), 0), 1);
+  ASSERT_FALSE(first->stmt.Step());
+
+  res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE OR REPLACE PERFETTO FUNCTION foo() RETURNS INT AS SELECT 2"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  auto second = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT foo() AS x"));
+  ASSERT_TRUE(second.ok()) << second.status().c_message();
+  ASSERT_EQ(second->stats.result_cache_hit, false);
+  ASSERT_EQ(sqlite3_column_int64(second->stmt.sqlite_stmt(), 0), 2);
+}
+
+TEST_F(PerfettoSqlEngineTest, ResultCache_Uncacheable) {
+  // Columns with mixed types and names which are not identifiers are served
+  // without the cache.
+  for (const char* sql : {"SELECT 1 AS x UNION ALL SELECT 1.5",
+                          "SELECT 1 + 1", "SELECT 1 AS x; SELECT 2 AS x"}) {
+    for (uint32_t i = 0; i < 2; ++i) {
+      auto res = engine_.ExecuteUntilLastStatementWithResultCache(
+          SqlSource::FromExecuteQuery(sql));
+      ASSERT_TRUE(res.ok()) << res.status().c_message();
+      ASSERT_FALSE(res->stats.result_cache_hit.has_value()) << sql;
+    }
+  }
+
+  // Errors are reported as usual.
+  auto res = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT * FROM missing_table"));
+  ASSERT_FALSE(res.ok());
+}
+
+TEST_F(PerfettoSqlEngineTest, ResultCache_UncacheableTable) {
+  auto res = engine_.Execute(SqlSource::FromExecuteQuery(
+      "CREATE TABLE foo(x INT); INSERT INTO foo VALUES(1)"));
+  ASSERT_TRUE(res.ok()) << res.status().c_message();
+
+  // Mimics the authorizer of trace processor for tables which change outside
+  // of the engine.
+  sqlite3_set_authorizer(
+      engine_.sqlite_engine()->db(),
+      [](void* self, int action, const char* table, const char*, const char*,
+         const char*) {
+        if (action == SQLITE_READ && table && strcmp(table, "foo") == 0) {
+          static_cast<PerfettoSqlEngine*>(self)->MarkQueryResultUncacheable();
+        }
+        return SQLITE_OK;
+      },
+      &engine_);
+  for (uint32_t i = 0; i < 2; ++i) {
+    auto query = engine_.ExecuteUntilLastStatementWithResultCache(
+        SqlSource::FromExecuteQuery("SELECT x FROM foo"));
+    ASSERT_TRUE(query.ok()) << query.status().c_message();
+    ASSERT_FALSE(query->stats.result_cache_hit.has_value());
+    ASSERT_EQ(sqlite3_column_int64(query->stmt.sqlite_stmt(), 0), 1);
+  }
+  auto other = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT 1 AS x"));
+  ASSERT_TRUE(other.ok()) << other.status().c_message();
+  ASSERT_EQ(other->stats.result_cache_hit, false);
+  sqlite3_set_authorizer(engine_.sqlite_engine()->db(), nullptr, nullptr);
+}
+
+TEST_F(PerfettoSqlEngineTest, ResultCache_TooManyRows) {
+  constexpr char kSql[] =
+      "WITH RECURSIVE n(x) AS (SELECT 0 UNION ALL SELECT x + 1 FROM n "
+      "WHERE x < 1048576) SELECT x FROM n";
+  for (uint32_t i = 0; i < 2; ++i) {
+    auto res = engine_.ExecuteUntilLastStatementWithResultCache(
+        SqlSource::FromExecuteQuery(kSql));
+    ASSERT_TRUE(res.ok()) << res.status().c_message();
+    ASSERT_FALSE(res->stats.result_cache_hit.has_value());
+    uint32_t rows = 1;
+    while (res->stmt.Step()) {
+      rows++;
+    }
+    ASSERT_EQ(rows, (1u << 20) + 1);
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -18,7 +18,9 @@
 
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <optional>
 #include <string>
 #include <utility>
@@ -27,6 +29,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_preprocessor.h"
 #include "src/trace_processor/sqlite/sql_source.h"
@@ -48,6 +51,8 @@ enum class State {
   kCreateOrReplace,
   kCreateOrReplacePerfetto,
   kCreatePerfetto,
+  kDrop,
+  kDropPerfetto,
   kPassthrough,
 };
 
@@ -93,18 +98,86 @@ bool ValidateModuleName(const std::string& name) {
                       std::not_fn(IsValidModuleWord)) == packages.end();
 }
 
+uint64_t HashMacro(const PerfettoSqlPreprocessor::Macro& macro) {
+  base::Hasher hasher;
+  hasher.Update(macro.name.size());
+  hasher.Update(macro.name);
+  for (const std::string& arg : macro.args) {
+    hasher.Update(arg.size());
+    hasher.Update(arg);
+  }
+  hasher.Update(macro.sql.sql());
+  return hasher.digest();
+}
+
 }  // namespace
 
 PerfettoSqlParser::PerfettoSqlParser(
     SqlSource source,
     const base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro>&
         macros)
-    : preprocessor_(std::move(source), macros),
+    : macros_(&macros),
+      preprocessor_(std::move(source), macros),
       tokenizer_(SqlSource::FromTraceProcessorImplementation("")) {}
 
+PerfettoSqlParser::PerfettoSqlParser(
+    std::shared_ptr<const ParsedStatements> parsed_statements,
+    const base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro>&
+        macros)
+    : macros_(&macros),
+      preprocessor_(SqlSource::FromTraceProcessorImplementation(""), macros),
+      tokenizer_(SqlSource::FromTraceProcessorImplementation("")),
+      parsed_statements_(std::move(parsed_statements)) {}
+
 bool PerfettoSqlParser::Next() {
   PERFETTO_CHECK(status_.ok());
+  if (parsed_statements_) {
+    return NextParsedStatement();
+  }
+  if (!ParseNextStatement()) {
+    return false;
+  }
+  if (parsed_statements_out_) {
+    ParsedStatement parsed{*statement_, *statement_sql_,
+                           preprocessor_.unexpanded_statement(), {}};
+    for (const auto* macro : preprocessor_.expanded_macros()) {
+      parsed.expanded_macros.emplace_back(macro->name, HashMacro(*macro));
+    }
+    parsed_statements_out_->emplace_back(std::move(parsed));
+  }
+  return true;
+}
 
+bool PerfettoSqlParser::NextParsedStatement() {
+  if (parsed_statement_idx_ == parsed_statements_->size()) {
+    return false;
+  }
+  const ParsedStatement& parsed =
+      (*parsed_statements_)[parsed_statement_idx_++];
+  bool macros_unchanged = std::all_of(
+      parsed.expanded_macros.begin(), parsed.expanded_macros.end(),
+      [this](const std::pair<std::string, uint64_t>& name_and_hash) {
+        const auto* macro = macros_->Find(name_and_hash.first);
+        return macro && HashMacro(*macro) == name_and_hash.second;
+      });
+  if (macros_unchanged) {
+    statement_ = parsed.statement;
+    statement_sql_ = parsed.statement_sql;
+    return true;
+  }
+
+  // The statement would not expand to the same SQL anymore: parse it again.
+  PerfettoSqlParser parser(parsed.unexpanded_sql, *macros_);
+  if (!parser.Next()) {
+    status_ = parser.status();
+    return false;
+  }
+  statement_ = std::move(parser.statement());
+  statement_sql_ = parser.statement_sql();
+  return true;
+}
+
+bool PerfettoSqlParser::ParseNextStatement() {
   if (!preprocessor_.NextStatement()) {
     status_ = preprocessor_.status();
     return false;
@@ -153,6 +226,8 @@ bool PerfettoSqlParser::Next() {
           state = State::kCreate;
         } else if (TokenIsCustomKeyword("include", token)) {
           state = State::kInclude;
+        } else if (TokenIsSqliteKeyword("drop", token)) {
+          state = State::kDrop;
         } else {
           state = State::kPassthrough;
         }
@@ -172,6 +247,16 @@ bool PerfettoSqlParser::Next() {
           return ErrorAtToken(token,
                               "Use 'INCLUDE PERFETTO MODULE {include_key}'.");
         }
+      case State::kDrop:
+        state = TokenIsCustomKeyword("perfetto", token) ? State::kDropPerfetto
+                                                        : State::kPassthrough;
+        break;
+      case State::kDropPerfetto:
+        if (TokenIsSqliteKeyword("index", token)) {
+          return ParseDropPerfettoIndex(*first_non_space_token);
+        }
+        return ErrorAtToken(token,
+                            "Use 'DROP PERFETTO INDEX {name} ON {table}'.");
       case State::kCreate:
         if (TokenIsSqliteKeyword("trigger", token)) {
           // TODO(lalitm): add this to the "errors" documentation page
@@ -213,9 +298,12 @@ bool PerfettoSqlParser::Next() {
         if (TokenIsCustomKeyword("macro", token)) {
           return ParseCreatePerfettoMacro(replace);
         }
+        if (TokenIsSqliteKeyword("index", token)) {
+          return ParseCreatePerfettoIndex(replace, *first_non_space_token);
+        }
         base::StackString<1024> err(
-            "Expected 'FUNCTION', 'TABLE' or 'MACRO' after 'CREATE PERFETTO', "
-            "received '%*s'.",
+            "Expected 'FUNCTION', 'TABLE', 'VIEW', 'MACRO' or 'INDEX' after "
+            "'CREATE PERFETTO', received '%*s'.",
             static_cast<int>(token.str.size()), token.str.data());
         return ErrorAtToken(token, err.c_str());
     }
@@ -420,6 +508,97 @@ bool PerfettoSqlParser::ParseCreatePerfettoMacro(bool replace) {
   return true;
 }
 
+bool PerfettoSqlParser::ParseCreatePerfettoIndex(bool replace,
+                                                 Token first_non_space_token) {
+  Token index_name = tokenizer_.NextNonWhitespace();
+  if (index_name.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid index name %.*s",
+                                static_cast<int>(index_name.str.size()),
+                                index_name.str.data());
+    return ErrorAtToken(index_name, err.c_str());
+  }
+
+  if (Token on = tokenizer_.NextNonWhitespace();
+      !TokenIsSqliteKeyword("on", on)) {
+    return ErrorAtToken(on, "Expected keyword 'on'");
+  }
+
+  Token table_name = tokenizer_.NextNonWhitespace();
+  if (table_name.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid table name %.*s",
+                                static_cast<int>(table_name.str.size()),
+                                table_name.str.data());
+    return ErrorAtToken(table_name, err.c_str());
+  }
+
+  // TK_LP == '(' (i.e. left parenthesis).
+  if (Token lp = tokenizer_.NextNonWhitespace();
+      lp.token_type != SqliteTokenType::TK_LP) {
+    return ErrorAtToken(lp, "Malformed index: '(' expected");
+  }
+
+  std::vector<std::string> col_names;
+  Token token = tokenizer_.NextNonWhitespace();
+  for (;; token = tokenizer_.NextNonWhitespace()) {
+    if (token.token_type != SqliteTokenType::TK_ID) {
+      base::StackString<1024> err("Invalid column name %.*s",
+                                  static_cast<int>(token.str.size()),
+                                  token.str.data());
+      return ErrorAtToken(token, err.c_str());
+    }
+    col_names.emplace_back(token.str);
+
+    token = tokenizer_.NextNonWhitespace();
+    if (token.token_type == SqliteTokenType::TK_RP) {
+      break;
+    }
+    if (token.token_type != SqliteTokenType::TK_COMMA) {
+      return ErrorAtToken(token, "')' or ',' expected");
+    }
+  }
+
+  Token terminal = tokenizer_.NextNonWhitespace();
+  if (!terminal.IsTerminal()) {
+    return ErrorAtToken(terminal, "Expected end of statement after index");
+  }
+  statement_ = CreateIndex{replace, std::string(index_name.str),
+                           std::string(table_name.str), std::move(col_names)};
+  statement_sql_ = tokenizer_.Substr(first_non_space_token, terminal);
+  return true;
+}
+
+bool PerfettoSqlParser::ParseDropPerfettoIndex(Token first_non_space_token) {
+  Token index_name = tokenizer_.NextNonWhitespace();
+  if (index_name.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid index name %.*s",
+                                static_cast<int>(index_name.str.size()),
+                                index_name.str.data());
+    return ErrorAtToken(index_name, err.c_str());
+  }
+
+  if (Token on = tokenizer_.NextNonWhitespace();
+      !TokenIsSqliteKeyword("on", on)) {
+    return ErrorAtToken(on, "Expected keyword 'on'");
+  }
+
+  Token table_name = tokenizer_.NextNonWhitespace();
+  if (table_name.token_type != SqliteTokenType::TK_ID) {
+    base::StackString<1024> err("Invalid table name %.*s",
+                                static_cast<int>(table_name.str.size()),
+                                table_name.str.data());
+    return ErrorAtToken(table_name, err.c_str());
+  }
+
+  Token terminal = tokenizer_.NextNonWhitespace();
+  if (!terminal.IsTerminal()) {
+    return ErrorAtToken(terminal, "Expected end of statement after index");
+  }
+  statement_ =
+      DropIndex{std::string(index_name.str), std::string(table_name.str)};
+  statement_sql_ = tokenizer_.Substr(first_non_space_token, terminal);
+  return true;
+}
+
 bool PerfettoSqlParser::ParseRawArguments(std::vector<RawArgument>& args) {
   enum TokenType {
     kIdOrRp,
@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_PERFETTO_SQL_PARSER_H_
 #define SRC_TRACE_PROCESSOR_PERFETTO_SQL_ENGINE_PERFETTO_SQL_PARSER_H_
 
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
 #include <utility>
@@ -91,12 +93,40 @@ class PerfettoSqlParser {
     SqlSource returns;
     SqlSource sql;
   };
+  // Indicates that the specified SQL was a CREATE PERFETTO INDEX statement
+  // with the following parameters.
+  struct CreateIndex {
+    bool replace;
+    std::string name;
+    std::string table_name;
+    std::vector<std::string> col_names;
+  };
+  // Indicates that the specified SQL was a DROP PERFETTO INDEX statement
+  // with the following parameters.
+  struct DropIndex {
+    std::string name;
+    std::string table_name;
+  };
   using Statement = std::variant<SqliteSql,
                                  CreateFunction,
                                  CreateTable,
                                  CreateView,
                                  Include,
-                                 CreateMacro>;
+                                 CreateMacro,
+                                 CreateIndex,
+                                 DropIndex>;
+
+  // A statement parsed by a previous parser alongside what is needed to check
+  // that parsing its SQL again would give the same statement.
+  struct ParsedStatement {
+    Statement statement;
+    SqlSource statement_sql;
+    // The SQL of the statement before any macro was expanded.
+    SqlSource unexpanded_sql;
+    // The name and the hash of the definition of every expanded macro.
+    std::vector<std::pair<std::string, uint64_t>> expanded_macros;
+  };
+  using ParsedStatements = std::vector<ParsedStatement>;
 
   // Creates a new SQL parser with the a block of PerfettoSQL statements.
   // Concretely, the passed string can contain >1 statement.
@@ -104,6 +134,13 @@ class PerfettoSqlParser {
       SqlSource,
       const base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro>&);
 
+  // Creates a new SQL parser returning the statements recorded by a previous
+  // parser (see |set_parsed_statements_out|). Only the statements expanding a
+  // macro whose definition changed since are parsed again.
+  PerfettoSqlParser(
+      std::shared_ptr<const ParsedStatements>,
+      const base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro>&);
+
   // Attempts to parse to the next statement in the SQL. Returns true if
   // a statement was successfully parsed and false if EOF was reached or the
   // statement was not parsed correctly.
@@ -131,12 +168,24 @@ class PerfettoSqlParser {
   // until an unrecoverable error is encountered.
   const base::Status& status() const { return status_; }
 
+  // Makes every statement successfully parsed from now on be appended to
+  // |out|.
+  void set_parsed_statements_out(ParsedStatements* out) {
+    parsed_statements_out_ = out;
+  }
+
  private:
   // This cannot be moved because we keep pointers into |sql_| in
   // |preprocessor_|.
   PerfettoSqlParser(PerfettoSqlParser&&) = delete;
   PerfettoSqlParser& operator=(PerfettoSqlParser&&) = delete;
 
+  // Returns the next statement of |parsed_statements_|.
+  bool NextParsedStatement();
+
+  // Parses the next statement of the SQL.
+  bool ParseNextStatement();
+
   // Most of the code needs sql_argument::ArgumentDefinition, but we explcitly
   // track raw arguments separately, as macro implementations need access to
   // the underlying tokens.
@@ -162,6 +211,11 @@ class PerfettoSqlParser {
 
   bool ParseCreatePerfettoMacro(bool replace);
 
+  bool ParseCreatePerfettoIndex(bool replace,
+                                SqliteTokenizer::Token first_non_space_token);
+
+  bool ParseDropPerfettoIndex(SqliteTokenizer::Token first_non_space_token);
+
   // Convert a "raw" argument (i.e. one that points to specific tokens) to the
   // argument definition consumed by the rest of the SQL code.
   // Guarantees to call ErrorAtToken if std::nullopt is returned.
@@ -174,9 +228,15 @@ class PerfettoSqlParser {
 
   bool ErrorAtToken(const SqliteTokenizer::Token&, const char* error, ...);
 
+  const base::FlatHashMap<std::string, PerfettoSqlPreprocessor::Macro>*
+      macros_;
   PerfettoSqlPreprocessor preprocessor_;
   SqliteTokenizer tokenizer_;
 
+  std::shared_ptr<const ParsedStatements> parsed_statements_;
+  size_t parsed_statement_idx_ = 0;
+  ParsedStatements* parsed_statements_out_ = nullptr;
+
   base::Status status_;
   std::optional<SqlSource> statement_sql_;
   std::optional<Statement> statement_;
@@ -17,6 +17,7 @@
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_parser.h"
 
 #include <cstdint>
+#include <memory>
 #include <variant>
 #include <vector>
 
@@ -37,6 +38,8 @@ using CreateTable = PerfettoSqlParser::CreateTable;
 using CreateView = PerfettoSqlParser::CreateView;
 using Include = PerfettoSqlParser::Include;
 using CreateMacro = PerfettoSqlParser::CreateMacro;
+using CreateIndex = PerfettoSqlParser::CreateIndex;
+using DropIndex = PerfettoSqlParser::DropIndex;
 
 namespace {
 
@@ -362,6 +365,91 @@ TEST_F(PerfettoSqlParserTest, CreatePerfettoViewWithSchema) {
   ASSERT_FALSE(parser.Next());
 }
 
+TEST_F(PerfettoSqlParserTest, CreatePerfettoIndex) {
+  auto res = SqlSource::FromExecuteQuery(
+      "CREATE PERFETTO INDEX foo ON bar(utid, ts); select 1");
+  PerfettoSqlParser parser(res, macros_);
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(),
+            Statement(CreateIndex{false, "foo", "bar", {"utid", "ts"}}));
+  ASSERT_EQ(parser.statement_sql(),
+            FindSubstr(res, "CREATE PERFETTO INDEX foo ON bar(utid, ts)"));
+  ASSERT_TRUE(parser.Next());
+  ASSERT_EQ(parser.statement(), Statement(SqliteSql{}));
+  ASSERT_FALSE(parser.Next());
+
+  res = SqlSource::FromExecuteQuery(
+      "create or replace perfetto index foo on bar ( utid )");
+  ASSERT_THAT(*Parse(res), testing::ElementsAre(
+                               CreateIndex{true, "foo", "bar", {"utid"}}));
+}
+
+TEST_F(PerfettoSqlParserTest, CreatePerfettoIndexInvalid) {
+  ASSERT_FALSE(Parse(SqlSource::FromExecuteQuery(
+                         "CREATE PERFETTO INDEX foo bar(utid)"))
+                   .ok());
+  ASSERT_FALSE(Parse(SqlSource::FromExecuteQuery(
+                         "CREATE PERFETTO INDEX foo ON bar()"))
+                   .ok());
+  ASSERT_FALSE(Parse(SqlSource::FromExecuteQuery(
+                         "CREATE PERFETTO INDEX foo ON bar(utid ts)"))
+                   .ok());
+  ASSERT_FALSE(Parse(SqlSource::FromExecuteQuery(
+                         "CREATE PERFETTO INDEX foo ON bar(utid) WHERE 1"))
+                   .ok());
+}
+
+TEST_F(PerfettoSqlParserTest, DropPerfettoIndex) {
+  auto res = SqlSource::FromExecuteQuery("DROP PERFETTO INDEX foo ON bar");
+  ASSERT_THAT(*Parse(res), testing::ElementsAre(DropIndex{"foo", "bar"}));
+
+  // Other DROP statements are passed through to SQLite.
+  res = SqlSource::FromExecuteQuery("DROP TABLE foo");
+  ASSERT_THAT(*Parse(res), testing::ElementsAre(SqliteSql{}));
+
+  ASSERT_FALSE(
+      Parse(SqlSource::FromExecuteQuery("DROP PERFETTO TABLE foo")).ok());
+}
+
+TEST_F(PerfettoSqlParserTest, ParsedStatements) {
+  macros_.Insert("foo", PerfettoSqlPreprocessor::Macro{
+                            false, "foo", {},
+                            SqlSource::FromExecuteQuery("SELECT 1")});
+  auto parsed = std::make_shared<PerfettoSqlParser::ParsedStatements>();
+  {
+    PerfettoSqlParser parser(
+        SqlSource::FromExecuteQuery("INCLUDE PERFETTO MODULE a; foo!()"),
+        macros_);
+    parser.set_parsed_statements_out(parsed.get());
+    while (parser.Next()) {
+    }
+    ASSERT_TRUE(parser.status().ok());
+  }
+  ASSERT_EQ(parsed->size(), 2u);
+
+  {
+    PerfettoSqlParser parser(parsed, macros_);
+    ASSERT_TRUE(parser.Next());
+    ASSERT_EQ(parser.statement(), Statement{Include{"a"}});
+    ASSERT_TRUE(parser.Next());
+    ASSERT_EQ(parser.statement(), Statement{SqliteSql{}});
+    ASSERT_EQ(parser.statement_sql().sql(), "SELECT 1");
+    ASSERT_FALSE(parser.Next());
+    ASSERT_TRUE(parser.status().ok());
+  }
+
+  // Statements expanding a macro which changed are parsed again.
+  macros_.Find("foo")->sql = SqlSource::FromExecuteQuery("SELECT 2");
+  {
+    PerfettoSqlParser parser(parsed, macros_);
+    ASSERT_TRUE(parser.Next());
+    ASSERT_TRUE(parser.Next());
+    ASSERT_EQ(parser.statement_sql().sql(), "SELECT 2");
+    ASSERT_FALSE(parser.Next());
+    ASSERT_TRUE(parser.status().ok());
+  }
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
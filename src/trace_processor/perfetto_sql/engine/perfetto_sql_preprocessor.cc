@@ -51,9 +51,11 @@ bool PerfettoSqlPreprocessor::NextStatement() {
 
   SqlSource stmt =
       global_tokenizer_.Substr(tok, global_tokenizer_.NextTerminal());
+  expanded_macros_.clear();
   auto stmt_or = RewriteInternal(stmt, {});
   if (stmt_or.ok()) {
     statement_ = std::move(*stmt_or);
+    unexpanded_statement_ = std::move(stmt);
     return true;
   }
   status_ = stmt_or.status();
@@ -91,6 +93,7 @@ base::StatusOr<SqlSource> PerfettoSqlPreprocessor::RewriteInternal(
         ParseMacroInvocation(tokenizer, tok, prev, arg_bindings);
     RETURN_IF_ERROR(invocation_or.status());
 
+    expanded_macros_.push_back(invocation_or->macro);
     seen_macros_.emplace(invocation_or->macro->name);
     auto source_or =
         RewriteInternal(invocation_or->macro->sql, invocation_or->arg_bindings);
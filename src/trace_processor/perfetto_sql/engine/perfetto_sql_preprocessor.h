@@ -67,6 +67,23 @@ class PerfettoSqlPreprocessor {
   // true.
   SqlSource& statement() { return *statement_; }
 
+  // Returns the most-recent SQL statement before any macro was expanded.
+  //
+  // Note: this function must not be called unless |NextStatement()| returned
+  // true.
+  const SqlSource& unexpanded_statement() const {
+    return *unexpanded_statement_;
+  }
+
+  // Returns the macros expanded in the most-recent SQL statement, including
+  // the ones invoked by other macros.
+  //
+  // Note: this function must not be called unless |NextStatement()| returned
+  // true.
+  const std::vector<const Macro*>& expanded_macros() const {
+    return expanded_macros_;
+  }
+
  private:
   struct MacroInvocation {
     const Macro* macro;
@@ -98,6 +115,8 @@ class PerfettoSqlPreprocessor {
   const base::FlatHashMap<std::string, Macro>* macros_ = nullptr;
   std::unordered_set<std::string> seen_macros_;
   std::optional<SqlSource> statement_;
+  std::optional<SqlSource> unexpanded_statement_;
+  std::vector<const Macro*> expanded_macros_;
   base::Status status_;
 };
 
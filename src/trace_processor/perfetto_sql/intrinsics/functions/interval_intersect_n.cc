@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/interval_intersect_n.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/no_destructor.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/public/compiler.h"
+#include "src/trace_processor/db/runtime_table.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_aggregate_function.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_result.h"
+#include "src/trace_processor/sqlite/sqlite_value.h"
+#include "src/trace_processor/util/status_macros.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// Partitions are intersected on the calling thread if the inputs have fewer
+// intervals than this.
+constexpr size_t kMinParallelIntervalCount = 64 * 1024;
+
+struct Interval {
+  // Intervals with a null partition are sorted before all the others.
+  bool has_partition;
+  int64_t partition;
+  int64_t ts;
+  int64_t end;
+  int64_t id;
+
+  bool IsBefore(const Interval& o) const {
+    return std::tie(has_partition, partition, ts) <
+           std::tie(o.has_partition, o.partition, o.ts);
+  }
+  bool IsInEarlierPartition(const Interval& o) const {
+    return std::tie(has_partition, partition) <
+           std::tie(o.has_partition, o.partition);
+  }
+  bool IsSamePartition(const Interval& o) const {
+    return has_partition == o.has_partition && partition == o.partition;
+  }
+};
+
+struct Input {
+  std::vector<Interval> intervals;
+  bool sorted = true;
+};
+
+struct AggCtx : SqliteAggregateContext<AggCtx> {
+  std::array<Input, IntervalIntersectN::kMaxInputCount> inputs;
+  uint32_t input_count = 0;
+};
+
+// The rows of each input in a single partition.
+struct Partition {
+  std::array<uint32_t, IntervalIntersectN::kMaxInputCount> begin;
+  std::array<uint32_t, IntervalIntersectN::kMaxInputCount> end;
+};
+
+// The intersections in a single partition, in |ts| order.
+struct Intersections {
+  std::vector<int64_t> ts;
+  std::vector<int64_t> dur;
+  // |input_count| ids for each intersection.
+  std::vector<int64_t> ids;
+};
+
+// Returns the number of threads in the pool returned by |GetThreadPool|.
+uint32_t ThreadCount() {
+  // The calling thread also intersects partitions so one fewer thread is
+  // needed.
+  static const uint32_t count = base::ThreadPool::MaxConcurrency() - 1;
+  return count;
+}
+
+// Returns the thread pool shared by all the intersections of the process or
+// nullptr if intersections should not be parallelized.
+base::ThreadPool* GetThreadPool() {
+  if (ThreadCount() == 0)
+    return nullptr;
+  static base::NoDestructor<base::ThreadPool> pool(ThreadCount());
+  return &pool.ref();
+}
+
+// Splits the intervals of all the inputs into the partitions present in all
+// of them: intervals of other partitions cannot intersect with anything.
+std::vector<Partition> FindPartitions(const AggCtx& ctx) {
+  std::vector<Partition> partitions;
+  Partition p{};
+  for (uint32_t i = 0; i < ctx.input_count; ++i) {
+    if (ctx.inputs[i].intervals.empty()) {
+      return partitions;
+    }
+  }
+  const auto& first = ctx.inputs[0].intervals;
+  std::array<uint32_t, IntervalIntersectN::kMaxInputCount> pos{};
+  while (pos[0] < first.size()) {
+    const Interval& key = first[pos[0]];
+    bool present_in_all = true;
+    for (uint32_t i = 0; i < ctx.input_count; ++i) {
+      const auto& intervals = ctx.inputs[i].intervals;
+      while (pos[i] < intervals.size() &&
+             intervals[pos[i]].IsInEarlierPartition(key)) {
+        ++pos[i];
+      }
+      p.begin[i] = pos[i];
+      while (pos[i] < intervals.size() &&
+             intervals[pos[i]].IsSamePartition(key)) {
+        ++pos[i];
+      }
+      p.end[i] = pos[i];
+      present_in_all &= p.begin[i] != p.end[i];
+    }
+    if (present_in_all) {
+      partitions.push_back(p);
+    }
+  }
+  return partitions;
+}
+
+// Intersects the intervals of a single partition by sweeping over all the
+// inputs at once: at each step, the interval ending first is replaced by the
+// next interval of its input.
+void Intersect(const AggCtx& ctx, const Partition& p, Intersections* out) {
+  std::array<uint32_t, IntervalIntersectN::kMaxInputCount> pos = p.begin;
+  for (;;) {
+    int64_t start = std::numeric_limits<int64_t>::min();
+    for (uint32_t i = 0; i < ctx.input_count; ++i) {
+      if (pos[i] == p.end[i]) {
+        return;
+      }
+      start = std::max(start, ctx.inputs[i].intervals[pos[i]].ts);
+    }
+
+    // The intervals intersect if they all contain |start|: zero duration
+    // intervals contain their own timestamp.
+    bool intersect = true;
+    uint32_t first_end_idx = 0;
+    int64_t first_end = std::numeric_limits<int64_t>::max();
+    for (uint32_t i = 0; i < ctx.input_count; ++i) {
+      const Interval& interval = ctx.inputs[i].intervals[pos[i]];
+      intersect &= interval.end > start || interval.ts == start;
+      if (interval.end < first_end) {
+        first_end = interval.end;
+        first_end_idx = i;
+      }
+    }
+    if (intersect) {
+      out->ts.push_back(start);
+      out->dur.push_back(first_end - start);
+      for (uint32_t i = 0; i < ctx.input_count; ++i) {
+        out->ids.push_back(ctx.inputs[i].intervals[pos[i]].id);
+      }
+    }
+    ++pos[first_end_idx];
+  }
+}
+
+// Intersects all the |partitions|, in parallel if there are enough intervals.
+std::vector<Intersections> IntersectAll(
+    const AggCtx& ctx,
+    const std::vector<Partition>& partitions) {
+  std::vector<Intersections> results(partitions.size());
+  std::atomic<uint32_t> next_partition{0};
+  auto intersect_partitions = [&]() {
+    for (uint32_t i = next_partition++; i < partitions.size();
+         i = next_partition++) {
+      Intersect(ctx, partitions[i], &results[i]);
+    }
+  };
+
+  size_t interval_count = 0;
+  for (uint32_t i = 0; i < ctx.input_count; ++i) {
+    interval_count += ctx.inputs[i].intervals.size();
+  }
+  base::ThreadPool* pool = GetThreadPool();
+  if (!pool || partitions.size() < 2 ||
+      interval_count < kMinParallelIntervalCount) {
+    intersect_partitions();
+    return results;
+  }
+
+  uint32_t task_count =
+      std::min(ThreadCount(), static_cast<uint32_t>(partitions.size() - 1));
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  uint32_t done_count = 0;
+  for (uint32_t i = 0; i < task_count; ++i) {
+    pool->PostTask([&]() {
+      intersect_partitions();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done_count == task_count)
+        done_cv.notify_one();
+    });
+  }
+  intersect_partitions();
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&]() { return done_count == task_count; });
+  return results;
+}
+
+base::StatusOr<std::unique_ptr<RuntimeTable>> BuildTable(
+    StringPool* pool,
+    const AggCtx* ctx,
+    const std::vector<Partition>& partitions,
+    const std::vector<Intersections>& results) {
+  // Without any rows the number of inputs is unknown: create the columns for
+  // the maximum number of inputs so any of them can be bound.
+  uint32_t input_count =
+      ctx ? ctx->input_count : IntervalIntersectN::kMaxInputCount;
+  std::vector<std::string> col_names{"ts", "dur", "partition"};
+  for (uint32_t i = 0; i < input_count; ++i) {
+    col_names.push_back("id_" + std::to_string(i));
+  }
+  RuntimeTable::Builder builder(pool, std::move(col_names));
+  uint32_t rows = 0;
+  for (uint32_t p = 0; p < partitions.size(); ++p) {
+    const Intersections& res = results[p];
+    const Interval& key = ctx->inputs[0].intervals[partitions[p].begin[0]];
+    for (uint32_t r = 0; r < res.ts.size(); ++r, ++rows) {
+      RETURN_IF_ERROR(builder.AddInteger(0, res.ts[r]));
+      RETURN_IF_ERROR(builder.AddInteger(1, res.dur[r]));
+      RETURN_IF_ERROR(key.has_partition ? builder.AddInteger(2, key.partition)
+                                        : builder.AddNull(2));
+      for (uint32_t i = 0; i < input_count; ++i) {
+        RETURN_IF_ERROR(
+            builder.AddInteger(3 + i, res.ids[r * input_count + i]));
+      }
+    }
+  }
+  return std::move(builder).Build(rows);
+}
+
+}  // namespace
+
+void IntervalIntersectN::Step(sqlite3_context* ctx,
+                              int argc,
+                              sqlite3_value** argv) {
+  if (argc != kArgCount) {
+    return sqlite::result::Error(
+        ctx, "interval_intersect: incorrect number of arguments");
+  }
+
+  auto& agg_ctx = AggCtx::GetOrCreateContextForStep(ctx);
+
+  // For performance reasons, we don't typecheck the arguments and assume they
+  // are longs.
+  auto input_count = static_cast<uint32_t>(sqlite::value::Long(argv[1]));
+  if (PERFETTO_UNLIKELY(input_count != agg_ctx.input_count)) {
+    if (agg_ctx.input_count != 0) {
+      return sqlite::result::Error(
+          ctx, "interval_intersect: input count should be the same for all "
+               "rows");
+    }
+    if (input_count == 0 || input_count > kMaxInputCount) {
+      return sqlite::result::Error(
+          ctx, "interval_intersect: unsupported number of inputs");
+    }
+    agg_ctx.input_count = input_count;
+  }
+  auto input_idx = static_cast<uint32_t>(sqlite::value::Long(argv[0]));
+  if (PERFETTO_UNLIKELY(input_idx >= input_count)) {
+    return sqlite::result::Error(ctx,
+                                 "interval_intersect: invalid input index");
+  }
+  int64_t ts = sqlite::value::Long(argv[3]);
+  int64_t dur = sqlite::value::Long(argv[4]);
+  if (PERFETTO_UNLIKELY(dur < 0)) {
+    return sqlite::result::Error(ctx, "interval_intersect: negative duration");
+  }
+  bool has_partition = !sqlite::value::IsNull(argv[5]);
+  Interval interval{has_partition,
+                    has_partition ? sqlite::value::Long(argv[5]) : 0, ts,
+                    ts + dur, sqlite::value::Long(argv[2])};
+
+  Input& input = agg_ctx.inputs[input_idx];
+  if (!input.intervals.empty() && interval.IsBefore(input.intervals.back())) {
+    input.sorted = false;
+  }
+  input.intervals.push_back(interval);
+}
+
+void IntervalIntersectN::Final(sqlite3_context* ctx) {
+  auto scoped_agg_ctx = AggCtx::GetContextOrNullForFinal(ctx);
+
+  // If Step was never called, this will be null: an empty table is returned in
+  // that case.
+  AggCtx* agg_ctx = scoped_agg_ctx.get();
+  std::vector<Partition> partitions;
+  std::vector<Intersections> results;
+  if (agg_ctx) {
+    for (uint32_t i = 0; i < agg_ctx->input_count; ++i) {
+      Input& input = agg_ctx->inputs[i];
+      if (!input.sorted) {
+        std::stable_sort(input.intervals.begin(), input.intervals.end(),
+                         [](const Interval& a, const Interval& b) {
+                           return a.IsBefore(b);
+                         });
+      }
+    }
+    partitions = FindPartitions(*agg_ctx);
+    results = IntersectAll(*agg_ctx, partitions);
+  }
+
+  auto table = BuildTable(GetUserData(ctx), agg_ctx, partitions, results);
+  if (!table.ok()) {
+    return sqlite::result::Error(ctx, table.status().c_message());
+  }
+  return sqlite::result::RawPointer(
+      ctx, table->release(), "TABLE",
+      [](void* ptr) { delete static_cast<RuntimeTable*>(ptr); });
+}
+
+}  // namespace perfetto::trace_processor
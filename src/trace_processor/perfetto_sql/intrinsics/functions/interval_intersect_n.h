@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_INTERVAL_INTERSECT_N_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_INTERVAL_INTERSECT_N_H_
+
+#include <cstdint>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_aggregate_function.h"
+
+namespace perfetto::trace_processor {
+
+// An SQL aggregate-function which computes the intersection of the intervals
+// of any number of tables in a single pass.
+//
+// Each of the input tables should be a set of non-overlapping intervals
+// (inside each partition, if partitioned). The input does not need to be
+// sorted but sorting is skipped for the inputs which already are sorted by
+// (partition, ts): in particular, this is the case for the output of this
+// function.
+//
+// Arguments:
+//  1) |input_idx|: a non-null uint32 identifying the input table of the
+//     interval: should be smaller than |input_count|.
+//  2) |input_count|: a non-null uint32 with the number of input tables. Should
+//     be the same for all the rows and not greater than |kMaxInputCount|.
+//  3) |id|: a non-null int64 with the id of the interval.
+//  4) |ts|: a non-null int64 with the start of the interval.
+//  5) |dur|: a non-null, non-negative int64 with the duration of the interval.
+//  6) |partition|: a possibly null int64 with the partition of the interval:
+//     only intervals with the same partition are intersected. Partitions are
+//     intersected independently (and in parallel if there are many
+//     intervals).
+//
+// Returns:
+//  A value table with the schema (ts, dur, partition, id_0, ..., id_{n-1})
+//  containing the intervals where one interval of each input table overlaps
+//  with the ids of those intervals. The rows are sorted by (partition, ts)
+//  with null partitions first.
+//
+// Note: this function is not intended to be used directly from SQL: instead
+// macros exist in the standard library, wrapping it and making it
+// user-friendly.
+struct IntervalIntersectN : public SqliteAggregateFunction<IntervalIntersectN> {
+  static constexpr char kName[] = "__intrinsic_interval_intersect_n";
+  static constexpr int kArgCount = 6;
+  static constexpr uint32_t kMaxInputCount = 8;
+  using UserDataContext = StringPool;
+
+  static void Step(sqlite3_context*, int argc, sqlite3_value** argv);
+  static void Final(sqlite3_context* ctx);
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_FUNCTIONS_INTERVAL_INTERSECT_N_H_
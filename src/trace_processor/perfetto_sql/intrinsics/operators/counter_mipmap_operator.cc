@@ -23,17 +23,23 @@
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "src/trace_processor/containers/implicit_segment_forest.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/operators/mipmap_utils.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/tables/counter_tables_py.h"
+#include "src/trace_processor/util/status_macros.h"
 
 namespace perfetto::trace_processor {
 namespace {
@@ -71,6 +77,53 @@ bool IsArgColumn(size_t index) {
 using Counter = CounterMipmapOperator::Counter;
 using Agg = CounterMipmapOperator::Agg;
 using Forest = ImplicitSegmentForest<Counter, Agg>;
+using Mipmap = CounterMipmapOperator::Mipmap;
+
+// Returns the mipmap of the counter track |track_id|, building the mipmaps of
+// all the counter tracks if needed.
+std::shared_ptr<const Mipmap> GetTrackMipmap(
+    CounterMipmapOperator::Context* ctx,
+    uint32_t track_id) {
+  const tables::CounterTable& counters = *ctx->counter_table;
+  if (ctx->track_mipmaps_row_count != counters.row_count()) {
+    base::FlatHashMap<uint32_t, std::unique_ptr<Mipmap>> mipmaps;
+    for (uint32_t i = 0; i < counters.row_count(); ++i) {
+      auto& mipmap = mipmaps[counters.track_id()[i].value];
+      if (!mipmap) {
+        mipmap = std::make_unique<Mipmap>();
+      }
+      auto value = static_cast<float>(counters.value()[i]);
+      mipmap->timestamps.push_back(counters.ts()[i]);
+      mipmap->forest.Push(Counter{value, value});
+    }
+    ctx->track_mipmaps.Clear();
+    for (auto it = mipmaps.GetIterator(); it; ++it) {
+      ctx->track_mipmaps[it.key()] = std::move(it.value());
+    }
+    ctx->track_mipmaps_row_count = counters.row_count();
+  }
+  auto* mipmap = ctx->track_mipmaps.Find(track_id);
+  return mipmap ? *mipmap : std::make_shared<const Mipmap>();
+}
+
+// Returns the mipmap of the (ts, value) rows returned by |sql|.
+base::StatusOr<std::shared_ptr<const Mipmap>> BuildMipmap(
+    PerfettoSqlEngine* engine,
+    std::string sql) {
+  auto mipmap = std::make_shared<Mipmap>();
+  auto res = engine->ExecuteUntilLastStatement(
+      SqlSource::FromTraceProcessorImplementation(std::move(sql)));
+  RETURN_IF_ERROR(res.status());
+  do {
+    int64_t ts = sqlite3_column_int64(res->stmt.sqlite_stmt(), 0);
+    auto value =
+        static_cast<float>(sqlite3_column_double(res->stmt.sqlite_stmt(), 1));
+    mipmap->timestamps.push_back(ts);
+    mipmap->forest.Push(Counter{value, value});
+  } while (res->stmt.Step());
+  RETURN_IF_ERROR(res->stmt.status());
+  return std::shared_ptr<const Mipmap>(std::move(mipmap));
+}
 
 }  // namespace
 
@@ -92,24 +145,18 @@ int CounterMipmapOperator::Create(sqlite3* db,
   auto* ctx = GetContext(raw_ctx);
   auto state = std::make_unique<State>();
 
-  std::string sql = "SELECT ts, value FROM ";
-  sql.append(argv[3]);
-  auto res = ctx->engine->ExecuteUntilLastStatement(
-      SqlSource::FromTraceProcessorImplementation(std::move(sql)));
-  if (!res.ok()) {
-    *zErr = sqlite3_mprintf("%s", res.status().c_message());
-    return SQLITE_ERROR;
-  }
-  do {
-    int64_t ts = sqlite3_column_int64(res->stmt.sqlite_stmt(), 0);
-    auto value =
-        static_cast<float>(sqlite3_column_double(res->stmt.sqlite_stmt(), 1));
-    state->timestamps.push_back(ts);
-    state->forest.Push(Counter{value, value});
-  } while (res->stmt.Step());
-  if (!res->stmt.status().ok()) {
-    *zErr = sqlite3_mprintf("%s", res->stmt.status().c_message());
-    return SQLITE_ERROR;
+  std::optional<uint32_t> track_id = base::StringToUInt32(argv[3]);
+  if (track_id && ctx->counter_table) {
+    state->mipmap = GetTrackMipmap(ctx, *track_id);
+  } else {
+    std::string sql = "SELECT ts, value FROM ";
+    sql.append(argv[3]);
+    auto mipmap = BuildMipmap(ctx->engine, std::move(sql));
+    if (!mipmap.ok()) {
+      *zErr = sqlite3_mprintf("%s", mipmap.status().c_message());
+      return SQLITE_ERROR;
+    }
+    state->mipmap = std::move(*mipmap);
   }
 
   std::unique_ptr<Vtab> vtab_res = std::make_unique<Vtab>();
@@ -177,8 +224,9 @@ int CounterMipmapOperator::Filter(sqlite3_vtab_cursor* cursor,
                                   sqlite3_value** argv) {
   auto* c = GetCursor(cursor);
   auto* t = GetVtab(c->pVtab);
-  auto* state =
-      sqlite::ModuleStateManager<CounterMipmapOperator>::GetState(t->state);
+  const Mipmap& mipmap =
+      *sqlite::ModuleStateManager<CounterMipmapOperator>::GetState(t->state)
+           ->mipmap;
   PERFETTO_CHECK(argc == kArgCount);
 
   int64_t start_ts = sqlite3_value_int64(argv[0]);
@@ -194,27 +242,26 @@ int CounterMipmapOperator::Filter(sqlite3_vtab_cursor* cursor,
   // If there is a counter value before the start of this window, include it in
   // the aggregation as well becaue it contributes to what should be rendered
   // here.
-  auto ts_lb = std::lower_bound(state->timestamps.begin(),
-                                state->timestamps.end(), start_ts);
-  if (ts_lb != state->timestamps.begin() &&
-      (ts_lb == state->timestamps.end() || *ts_lb != start_ts)) {
+  const auto& timestamps = mipmap.timestamps;
+  auto ts_lb = std::lower_bound(timestamps.begin(), timestamps.end(), start_ts);
+  if (ts_lb != timestamps.begin() &&
+      (ts_lb == timestamps.end() || *ts_lb != start_ts)) {
     --ts_lb;
   }
-  int64_t start_idx = std::distance(state->timestamps.begin(), ts_lb);
+  int64_t start_idx = std::distance(timestamps.begin(), ts_lb);
   for (int64_t s = start_ts; s < end_ts; s += step_ts) {
-    int64_t end_idx =
-        std::distance(state->timestamps.begin(),
-                      std::lower_bound(state->timestamps.begin() +
-                                           static_cast<int64_t>(start_idx),
-                                       state->timestamps.end(), s + step_ts));
+    int64_t end_idx = std::distance(
+        timestamps.begin(),
+        GallopLowerBound(timestamps.begin() + start_idx, timestamps.end(),
+                         s + step_ts));
     if (start_idx == end_idx) {
       continue;
     }
     c->counters.emplace_back(Cursor::Result{
-        state->forest.Query(static_cast<uint32_t>(start_idx),
+        mipmap.forest.Query(static_cast<uint32_t>(start_idx),
                             static_cast<uint32_t>(end_idx)),
-        state->forest[static_cast<uint32_t>(end_idx) - 1],
-        state->timestamps[static_cast<uint32_t>(end_idx) - 1],
+        mipmap.forest[static_cast<uint32_t>(end_idx) - 1],
+        timestamps[static_cast<uint32_t>(end_idx) - 1],
     });
     start_idx = end_idx;
   }
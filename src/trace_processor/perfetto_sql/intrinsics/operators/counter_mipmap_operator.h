@@ -19,12 +19,15 @@
 
 #include <sqlite3.h>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/trace_processor/containers/implicit_segment_forest.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
+#include "src/trace_processor/tables/counter_tables_py.h"
 
 namespace perfetto::trace_processor {
 
@@ -50,6 +53,15 @@ namespace perfetto::trace_processor {
 // but in O(logn) time by using a segment-tree like data structure (see
 // ImplicitSegmentForest).
 //
+// The input can either be a subquery returning the (ts, value) of the counter
+// or the id of a track in the counter table:
+// ```
+//   create virtual table x using __intrinsic_counter_mipmap(42);
+// ```
+// In the latter case, the mipmaps of all the counter tracks are built in a
+// single pass over the counter table when the first such table is created
+// and are shared by all the tables created for the same track afterwards.
+//
 // [1] https://en.wikipedia.org/wiki/Mipmap
 struct CounterMipmapOperator : sqlite::Module<CounterMipmapOperator> {
   struct Counter {
@@ -64,14 +76,28 @@ struct CounterMipmapOperator : sqlite::Module<CounterMipmapOperator> {
       return res;
     }
   };
-  struct State {
+  // The mipmap of a single counter: immutable once built so it can be shared
+  // between all the tables created over the same counter track.
+  struct Mipmap {
     ImplicitSegmentForest<Counter, Agg> forest;
     std::vector<int64_t> timestamps;
   };
+  struct State {
+    std::shared_ptr<const Mipmap> mipmap;
+  };
   struct Context {
-    explicit Context(PerfettoSqlEngine* _engine) : engine(_engine) {}
+    explicit Context(PerfettoSqlEngine* _engine,
+                     const tables::CounterTable* _counter_table = nullptr)
+        : engine(_engine), counter_table(_counter_table) {}
     PerfettoSqlEngine* engine;
+    const tables::CounterTable* counter_table;
     sqlite::ModuleStateManager<CounterMipmapOperator> manager;
+
+    // The mipmaps of all the tracks of |counter_table|, keyed by track id.
+    // Built on first use and rebuilt if rows were added to |counter_table|
+    // since then.
+    base::FlatHashMap<uint32_t, std::shared_ptr<const Mipmap>> track_mipmaps;
+    uint32_t track_mipmaps_row_count = 0;
   };
   struct Vtab : sqlite::Module<CounterMipmapOperator>::Vtab {
     sqlite::ModuleStateManager<CounterMipmapOperator>::PerVtabState* state;
@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_OPERATORS_MIPMAP_UTILS_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_OPERATORS_MIPMAP_UTILS_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace perfetto::trace_processor {
+
+// Returns the first iterator in [begin, end) pointing to a timestamp not
+// smaller than |ts|. Starts by galloping from |begin| as consecutive buckets
+// of a mipmap usually only contain a few values.
+inline std::vector<int64_t>::const_iterator GallopLowerBound(
+    std::vector<int64_t>::const_iterator begin,
+    std::vector<int64_t>::const_iterator end,
+    int64_t ts) {
+  std::ptrdiff_t step = 1;
+  while (step < end - begin && *(begin + step - 1) < ts) {
+    begin += step;
+    step *= 2;
+  }
+  return std::lower_bound(begin, begin + std::min(step, end - begin), ts);
+}
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_OPERATORS_MIPMAP_UTILS_H_
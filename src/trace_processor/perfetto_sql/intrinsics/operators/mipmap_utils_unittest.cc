@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/operators/mipmap_utils.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+TEST(MipmapUtilsTest, GallopLowerBoundMatchesLowerBound) {
+  std::vector<int64_t> tses;
+  for (int64_t i = 0; i < 100; ++i) {
+    // Repeated values and gaps of various sizes.
+    tses.push_back(i * i / 7);
+  }
+  for (auto begin = tses.cbegin(); begin != tses.cend(); ++begin) {
+    for (int64_t ts = -1; ts <= tses.back() + 1; ++ts) {
+      ASSERT_EQ(GallopLowerBound(begin, tses.cend(), ts),
+                std::lower_bound(begin, tses.cend(), ts))
+          << "begin " << (begin - tses.cbegin()) << " ts " << ts;
+    }
+  }
+}
+
+TEST(MipmapUtilsTest, GallopLowerBoundEmpty) {
+  std::vector<int64_t> tses;
+  ASSERT_EQ(GallopLowerBound(tses.cbegin(), tses.cend(), 10), tses.cend());
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
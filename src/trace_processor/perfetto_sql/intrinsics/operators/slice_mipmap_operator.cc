@@ -24,16 +24,19 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/public/compiler.h"
 #include "src/trace_processor/containers/implicit_segment_forest.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/operators/mipmap_utils.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
 #include "src/trace_processor/sqlite/sql_source.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
+#include "src/trace_processor/util/status_macros.h"
 
 namespace perfetto::trace_processor {
 namespace {
@@ -68,8 +71,98 @@ bool IsArgColumn(size_t index) {
   return index < kArgCount;
 }
 
+using Index = SliceMipmapOperator::Index;
+using Slice = SliceMipmapOperator::Slice;
+using CachedBucket = SliceMipmapOperator::CachedBucket;
+
+base::StatusOr<std::shared_ptr<Index>> BuildIndex(PerfettoSqlEngine* engine,
+                                                  const std::string& input) {
+  auto index = std::make_shared<Index>();
+  std::string sql = "SELECT * FROM ";
+  sql.append(input);
+  auto res = engine->ExecuteUntilLastStatement(
+      SqlSource::FromTraceProcessorImplementation(std::move(sql)));
+  RETURN_IF_ERROR(res.status());
+  do {
+    auto id =
+        static_cast<uint32_t>(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0));
+    int64_t ts = sqlite3_column_int64(res->stmt.sqlite_stmt(), 1);
+    int64_t dur = sqlite3_column_int64(res->stmt.sqlite_stmt(), 2);
+    auto depth =
+        static_cast<uint32_t>(sqlite3_column_int64(res->stmt.sqlite_stmt(), 3));
+    if (PERFETTO_UNLIKELY(depth >= index->by_depth.size())) {
+      index->by_depth.resize(depth + 1);
+    }
+    auto& by_depth = index->by_depth[depth];
+    by_depth.forest.Push(
+        Slice{dur, id, static_cast<uint32_t>(by_depth.forest.size())});
+    by_depth.timestamps.push_back(ts);
+  } while (res->stmt.Step());
+  RETURN_IF_ERROR(res->stmt.status());
+  return index;
+}
+
+// Removes the indexes which are stale or, least recently used first, over
+// the memory budget from the cache of |ctx|.
+void EvictCachedIndexes(SliceMipmapOperator::Context* ctx) {
+  uint64_t generation = ctx->engine->data_generation();
+  std::vector<std::pair<uint64_t, std::string>> by_last_use;
+  std::vector<std::string> stale;
+  size_t bytes = 0;
+  for (auto it = ctx->index_cache.GetIterator(); it; ++it) {
+    if (it.value().generation != generation) {
+      stale.push_back(it.key());
+      continue;
+    }
+    bytes += it.value().index->memory_usage();
+    by_last_use.emplace_back(it.value().last_use, it.key());
+  }
+  for (const std::string& key : stale) {
+    ctx->index_cache.Erase(key);
+  }
+  std::sort(by_last_use.begin(), by_last_use.end());
+  for (const auto& [last_use, key] : by_last_use) {
+    if (bytes <= SliceMipmapOperator::kMaxCachedIndexBytes) {
+      break;
+    }
+    auto* cached = ctx->index_cache.Find(key);
+    bytes -= cached->index->memory_usage();
+    ctx->index_cache.Erase(key);
+  }
+}
+
+// Returns the index of |input|, reusing the one built for a previous table if
+// the result of |input| cannot have changed since.
+base::StatusOr<std::shared_ptr<Index>> GetOrBuildIndex(
+    SliceMipmapOperator::Context* ctx,
+    const std::string& input) {
+  uint64_t generation = ctx->engine->data_generation();
+  uint64_t use = ctx->next_use++;
+  auto* cached = ctx->index_cache.Find(input);
+  if (cached && cached->generation == generation) {
+    cached->last_use = use;
+    return cached->index;
+  }
+  ASSIGN_OR_RETURN(std::shared_ptr<Index> index,
+                   BuildIndex(ctx->engine, input));
+  ctx->index_cache[input] =
+      SliceMipmapOperator::CachedIndex{index, generation, use};
+  EvictCachedIndexes(ctx);
+  return index;
+}
+
 }  // namespace
 
+size_t SliceMipmapOperator::Index::memory_usage() const {
+  // Each cached bucket also uses a hash table slot: roughly double its size.
+  size_t bytes = cached_bucket_count * sizeof(CachedBucket) * 2;
+  for (const PerDepth& depth : by_depth) {
+    bytes += depth.forest.size() * 2 * sizeof(Slice) +
+             depth.timestamps.size() * sizeof(int64_t);
+  }
+  return bytes;
+}
+
 int SliceMipmapOperator::Create(sqlite3* db,
                                 void* raw_ctx,
                                 int argc,
@@ -86,35 +179,13 @@ int SliceMipmapOperator::Create(sqlite3* db,
   }
 
   auto* ctx = GetContext(raw_ctx);
-  auto state = std::make_unique<State>();
-
-  std::string sql = "SELECT * FROM ";
-  sql.append(argv[3]);
-  auto res = ctx->engine->ExecuteUntilLastStatement(
-      SqlSource::FromTraceProcessorImplementation(std::move(sql)));
-  if (!res.ok()) {
-    *zErr = sqlite3_mprintf("%s", res.status().c_message());
-    return SQLITE_ERROR;
-  }
-  do {
-    auto id =
-        static_cast<uint32_t>(sqlite3_column_int64(res->stmt.sqlite_stmt(), 0));
-    int64_t ts = sqlite3_column_int64(res->stmt.sqlite_stmt(), 1);
-    int64_t dur = sqlite3_column_int64(res->stmt.sqlite_stmt(), 2);
-    auto depth =
-        static_cast<uint32_t>(sqlite3_column_int64(res->stmt.sqlite_stmt(), 3));
-    if (PERFETTO_UNLIKELY(depth >= state->by_depth.size())) {
-      state->by_depth.resize(depth + 1);
-    }
-    auto& by_depth = state->by_depth[depth];
-    by_depth.forest.Push(
-        Slice{dur, id, static_cast<uint32_t>(by_depth.forest.size())});
-    by_depth.timestamps.push_back(ts);
-  } while (res->stmt.Step());
-  if (!res->stmt.status().ok()) {
-    *zErr = sqlite3_mprintf("%s", res->stmt.status().c_message());
+  auto index = GetOrBuildIndex(ctx, argv[3]);
+  if (!index.ok()) {
+    *zErr = sqlite3_mprintf("%s", index.status().c_message());
     return SQLITE_ERROR;
   }
+  auto state = std::make_unique<State>();
+  state->index = std::move(*index);
 
   std::unique_ptr<Vtab> vtab_res = std::make_unique<Vtab>();
   vtab_res->state = ctx->manager.OnCreate(argv, std::move(state));
@@ -181,8 +252,9 @@ int SliceMipmapOperator::Filter(sqlite3_vtab_cursor* cursor,
                                 sqlite3_value** argv) {
   auto* c = GetCursor(cursor);
   auto* t = GetVtab(c->pVtab);
-  auto* state =
-      sqlite::ModuleStateManager<SliceMipmapOperator>::GetState(t->state);
+  Index& index =
+      *sqlite::ModuleStateManager<SliceMipmapOperator>::GetState(t->state)
+           ->index;
   PERFETTO_CHECK(argc == kArgCount);
 
   c->results.clear();
@@ -196,8 +268,21 @@ int SliceMipmapOperator::Filter(sqlite3_vtab_cursor* cursor,
     return sqlite::utils::SetError(t, "slice_mipmap: empty range provided");
   }
 
-  for (uint32_t depth = 0; depth < state->by_depth.size(); ++depth) {
-    auto& by_depth = state->by_depth[depth];
+  // Buckets aligned to a multiple of their size (other than the first one,
+  // which also contains the slice overlapping with the start of the window)
+  // do not depend on the window: cache their result.
+  CachedLevel* level = nullptr;
+  if (step > 0 && start % step == 0) {
+    if (index.cached_bucket_count > kMaxCachedBuckets) {
+      index.levels.Clear();
+      index.cached_bucket_count = 0;
+    }
+    level = &index.levels[step];
+    level->resize(index.by_depth.size());
+  }
+
+  for (uint32_t depth = 0; depth < index.by_depth.size(); ++depth) {
+    auto& by_depth = index.by_depth[depth];
     const auto& tses = by_depth.timestamps;
 
     // If the slice before this window overlaps with the current window, move
@@ -212,21 +297,39 @@ int SliceMipmapOperator::Filter(sqlite3_vtab_cursor* cursor,
     }
 
     for (int64_t s = start; s < end; s += step) {
-      auto end_idx = static_cast<uint32_t>(std::distance(
-          tses.begin(),
-          std::lower_bound(tses.begin() + static_cast<int64_t>(start_idx),
-                           tses.end(), s + step)));
-      if (start_idx == end_idx) {
-        continue;
+      bool cacheable = level && s != start;
+      CachedBucket* cached =
+          cacheable ? (*level)[depth].Find(s / step) : nullptr;
+      if (!cached) {
+        CachedBucket bucket{};
+        bucket.end_idx = static_cast<uint32_t>(std::distance(
+            tses.begin(),
+            GallopLowerBound(tses.begin() + static_cast<int64_t>(start_idx),
+                             tses.end(), s + step)));
+        bucket.has_result = start_idx != bucket.end_idx;
+        if (bucket.has_result) {
+          auto res = by_depth.forest.Query(start_idx, bucket.end_idx);
+          bucket.result = Result{
+              tses[res.idx],
+              res.dur,
+              res.id,
+              depth,
+          };
+        }
+        if (!cacheable) {
+          if (bucket.has_result) {
+            c->results.emplace_back(bucket.result);
+          }
+          start_idx = bucket.end_idx;
+          continue;
+        }
+        cached = (*level)[depth].Insert(s / step, bucket).first;
+        index.cached_bucket_count++;
+      }
+      if (cached->has_result) {
+        c->results.emplace_back(cached->result);
       }
-      auto res = by_depth.forest.Query(start_idx, end_idx);
-      c->results.emplace_back(Cursor::Result{
-          tses[res.idx],
-          res.dur,
-          res.id,
-          depth,
-      });
-      start_idx = end_idx;
+      start_idx = cached->end_idx;
     }
   }
   return SQLITE_OK;
@@ -18,9 +18,13 @@
 #define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_OPERATORS_SLICE_MIPMAP_OPERATOR_H_
 
 #include <sqlite3.h>
+#include <cstddef>
 #include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "src/trace_processor/containers/implicit_segment_forest.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
@@ -49,6 +53,15 @@ namespace perfetto::trace_processor {
 // but in O(logn) time by using a segment-tree like data structure (see
 // ImplicitSegmentForest).
 //
+// The index built for an input is shared by all the tables created with the
+// same input until the result of the input may have changed (see
+// |PerfettoSqlEngine::data_generation|). The indexes of tables which were
+// destroyed are kept, up to |kMaxCachedIndexBytes|, so recreating the table
+// for a track is only a lookup. The results of buckets aligned to a
+// multiple of their size (as requested by UIs) are also cached in the index,
+// so panning at a zoom level which was visited before does not query the
+// segment forests again.
+//
 // [1] https://en.wikipedia.org/wiki/Mipmap
 struct SliceMipmapOperator : sqlite::Module<SliceMipmapOperator> {
   struct Slice {
@@ -65,24 +78,60 @@ struct SliceMipmapOperator : sqlite::Module<SliceMipmapOperator> {
     ImplicitSegmentForest<Slice, Agg> forest;
     std::vector<int64_t> timestamps;
   };
-  struct State {
+  struct Result {
+    int64_t timestamp;
+    int64_t dur;
+    uint32_t id;
+    uint32_t depth;
+  };
+  // The outcome of the aggregation of a bucket at a single depth.
+  struct CachedBucket {
+    // The index of the first slice after the bucket.
+    uint32_t end_idx;
+    bool has_result;
+    Result result;
+  };
+  // The cached buckets of a single bucket size, by depth and then by index of
+  // the bucket (i.e. bucket start / bucket size).
+  using CachedLevel = std::vector<base::FlatHashMap<int64_t, CachedBucket>>;
+  struct Index {
+    size_t memory_usage() const;
+
     std::vector<PerDepth> by_depth;
+    base::FlatHashMap<int64_t, CachedLevel> levels;
+    size_t cached_bucket_count = 0;
+  };
+  struct State {
+    std::shared_ptr<Index> index;
+  };
+  struct CachedIndex {
+    std::shared_ptr<Index> index;
+    uint64_t generation;
+    uint64_t last_use;
   };
   struct Context {
     explicit Context(PerfettoSqlEngine* _engine) : engine(_engine) {}
     PerfettoSqlEngine* engine;
     sqlite::ModuleStateManager<SliceMipmapOperator> manager;
+
+    // The indexes built for previous tables, keyed by their input.
+    base::FlatHashMap<std::string, CachedIndex> index_cache;
+    uint64_t next_use = 0;
   };
+
+  // Indexes are evicted from |Context::index_cache|, least recently used
+  // first, once they use more memory than this. Tables still using an evicted
+  // index keep it alive.
+  static constexpr size_t kMaxCachedIndexBytes = 512 * 1024 * 1024;
+
+  // The buckets cached in an index are discarded once there are more than
+  // this many.
+  static constexpr size_t kMaxCachedBuckets = 1024 * 1024;
+
   struct Vtab : sqlite::Module<SliceMipmapOperator>::Vtab {
     sqlite::ModuleStateManager<SliceMipmapOperator>::PerVtabState* state;
   };
   struct Cursor : sqlite::Module<SliceMipmapOperator>::Cursor {
-    struct Result {
-      int64_t timestamp;
-      int64_t dur;
-      uint32_t id;
-      uint32_t depth;
-    };
     std::vector<Result> results;
     uint32_t index = 0;
   };
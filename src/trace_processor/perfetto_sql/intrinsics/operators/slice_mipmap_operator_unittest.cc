@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/operators/slice_mipmap_operator.h"
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
+#include "src/trace_processor/sqlite/sql_source.h"
+#include "src/trace_processor/sqlite/sqlite_engine.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+class SliceMipmapOperatorTest : public ::testing::Test {
+ public:
+  SliceMipmapOperatorTest() {
+    auto ctx = std::make_unique<SliceMipmapOperator::Context>(&engine_);
+    ctx_ = ctx.get();
+    engine_.sqlite_engine()->RegisterVirtualTableModule<SliceMipmapOperator>(
+        "__intrinsic_slice_mipmap", std::move(ctx));
+    Execute(
+        "CREATE TABLE slices(id INT, ts INT, dur INT, depth INT);"
+        "INSERT INTO slices VALUES (0, 0, 5, 0), (1, 10, 30, 0), "
+        "(2, 50, 2, 0), (3, 55, 20, 0), (4, 12, 3, 1), (5, 60, 1, 1)");
+  }
+
+  void Execute(const std::string& sql) {
+    auto res = engine_.Execute(SqlSource::FromExecuteQuery(sql));
+    ASSERT_TRUE(res.ok()) << res.status().c_message();
+  }
+
+  void CreateMipmap(const std::string& name) {
+    Execute("CREATE VIRTUAL TABLE " + name +
+            " USING __intrinsic_slice_mipmap((SELECT id, ts, dur, depth FROM "
+            "slices ORDER BY ts))");
+  }
+
+  // Returns the rows of the window [0, 100) with buckets of 10 in |table|,
+  // with their columns separated by commas.
+  std::vector<std::string> QueryWindow(const std::string& table) {
+    std::vector<std::string> rows;
+    auto res = engine_.ExecuteUntilLastStatement(SqlSource::FromExecuteQuery(
+        "SELECT ts, id, dur, depth FROM " + table +
+        " WHERE in_window_start = 0 AND in_window_end = 100 AND "
+        "in_window_step = 10"));
+    EXPECT_TRUE(res.ok()) << res.status().c_message();
+    if (!res.ok()) {
+      return rows;
+    }
+    for (bool has_row = !res->stmt.IsDone(); has_row;
+         has_row = res->stmt.Step()) {
+      std::string row;
+      for (int i = 0; i < 4; ++i) {
+        row += std::to_string(sqlite3_column_int64(res->stmt.sqlite_stmt(), i));
+        row += i == 3 ? "" : ",";
+      }
+      rows.push_back(std::move(row));
+    }
+    EXPECT_TRUE(res->stmt.status().ok());
+    return rows;
+  }
+
+  // Returns the only index in the cache of the operator.
+  std::shared_ptr<SliceMipmapOperator::Index> CachedIndex() {
+    EXPECT_EQ(ctx_->index_cache.size(), 1u);
+    auto it = ctx_->index_cache.GetIterator();
+    return it ? it.value().index : nullptr;
+  }
+
+ protected:
+  StringPool pool_;
+  PerfettoSqlEngine engine_{&pool_};
+  SliceMipmapOperator::Context* ctx_ = nullptr;
+};
+
+TEST_F(SliceMipmapOperatorTest, AlignedBucketsAreCached) {
+  CreateMipmap("mipmap");
+  std::vector<std::string> rows = QueryWindow("mipmap");
+  ASSERT_THAT(rows, ElementsAre("0,0,5,0", "10,1,30,0", "55,3,20,0",
+                                "12,4,3,1", "60,5,1,1"));
+
+  // All the buckets but the first one, for both depths.
+  std::shared_ptr<SliceMipmapOperator::Index> index = CachedIndex();
+  ASSERT_TRUE(index);
+  ASSERT_EQ(index->cached_bucket_count, 18u);
+
+  // Querying the same zoom level again is served from the cached buckets.
+  ASSERT_EQ(QueryWindow("mipmap"), rows);
+  ASSERT_EQ(index->cached_bucket_count, 18u);
+}
+
+TEST_F(SliceMipmapOperatorTest, IndexSharedUntilInputChanges) {
+  CreateMipmap("first");
+  std::shared_ptr<SliceMipmapOperator::Index> index = CachedIndex();
+  ASSERT_TRUE(index);
+
+  // Creating a virtual table does not change the input: the index is reused.
+  uint64_t generation = engine_.data_generation();
+  CreateMipmap("second");
+  ASSERT_EQ(engine_.data_generation(), generation);
+  ASSERT_EQ(CachedIndex(), index);
+  ASSERT_EQ(QueryWindow("second"), QueryWindow("first"));
+
+  // Writing to the input does: a new index is built.
+  Execute("INSERT INTO slices VALUES (6, 80, 4, 0)");
+  ASSERT_NE(engine_.data_generation(), generation);
+  CreateMipmap("third");
+  ASSERT_NE(CachedIndex(), index);
+  ASSERT_THAT(QueryWindow("third"),
+              ElementsAre("0,0,5,0", "10,1,30,0", "55,3,20,0", "80,6,4,0",
+                          "12,4,3,1", "60,5,1,1"));
+}
+
+TEST_F(SliceMipmapOperatorTest, CreateInvalidatesQueryResultCache) {
+  auto first = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT id FROM slices"));
+  ASSERT_TRUE(first.ok()) << first.status().c_message();
+  ASSERT_EQ(first->stats.result_cache_hit, false);
+
+  CreateMipmap("mipmap");
+
+  auto second = engine_.ExecuteUntilLastStatementWithResultCache(
+      SqlSource::FromExecuteQuery("SELECT id FROM slices"));
+  ASSERT_TRUE(second.ok()) << second.status().c_message();
+  ASSERT_EQ(second->stats.result_cache_hit, false);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -18,10 +18,13 @@
 
 #include <sqlite3.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdint>
 #include <cstring>
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <tuple>
@@ -34,6 +37,7 @@
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
@@ -131,6 +135,83 @@ std::string EscapedSqliteValueAsString(sqlite3_value* value) {
   }
 }
 
+// Reads all the rows returned by |sql| on the table |defn| into |table|.
+base::Status Materialize(PerfettoSqlEngine* engine,
+                         const SpanJoinOperatorModule::TableDefinition& defn,
+                         const std::string& sql,
+                         SpanJoinOperatorModule::MaterializedTable* table) {
+  auto stmt = engine->sqlite_engine()->PrepareStatement(
+      SqlSource::FromTraceProcessorImplementation(sql));
+  RETURN_IF_ERROR(stmt.status());
+  sqlite3_stmt* raw_stmt = stmt.sqlite_stmt();
+
+  auto column_count = static_cast<uint32_t>(defn.columns().size());
+  auto ts_idx = static_cast<int>(defn.ts_idx());
+  auto dur_idx = static_cast<int>(defn.dur_idx());
+  auto partition_idx = static_cast<int>(defn.partition_idx());
+  table->column_count = column_count;
+  while (stmt.Step()) {
+    int partition_type = sqlite3_column_type(raw_stmt, partition_idx);
+    if (partition_type == SQLITE_NULL) {
+      continue;
+    }
+    if (partition_type != SQLITE_INTEGER) {
+      return base::ErrStatus("SPAN_JOIN: partition is not an INT column");
+    }
+    table->ts.push_back(sqlite3_column_int64(raw_stmt, ts_idx));
+    table->dur.push_back(sqlite3_column_int64(raw_stmt, dur_idx));
+    table->partition.push_back(sqlite3_column_int64(raw_stmt, partition_idx));
+    for (uint32_t i = 0; i < column_count; ++i) {
+      int idx = static_cast<int>(i);
+      switch (sqlite3_column_type(raw_stmt, idx)) {
+        case SQLITE_INTEGER:
+          table->values.push_back(
+              SqlValue::Long(sqlite3_column_int64(raw_stmt, idx)));
+          break;
+        case SQLITE_FLOAT:
+          table->values.push_back(
+              SqlValue::Double(sqlite3_column_double(raw_stmt, idx)));
+          break;
+        case SQLITE_TEXT:
+          table->storage.emplace_back(
+              reinterpret_cast<const char*>(sqlite3_column_text(raw_stmt, idx)));
+          table->values.push_back(
+              SqlValue::String(table->storage.back().c_str()));
+          break;
+        case SQLITE_BLOB: {
+          const auto* blob =
+              static_cast<const char*>(sqlite3_column_blob(raw_stmt, idx));
+          auto size = static_cast<size_t>(sqlite3_column_bytes(raw_stmt, idx));
+          table->storage.emplace_back(blob ? std::string(blob, size) : "");
+          table->values.push_back(SqlValue::Bytes(
+              table->storage.back().data(), table->storage.back().size()));
+          break;
+        }
+        default:
+          table->values.emplace_back();
+          break;
+      }
+    }
+  }
+  return stmt.status();
+}
+
+void ReportSqlValue(sqlite3_context* context, const SqlValue& value) {
+  switch (value.type) {
+    case SqlValue::kLong:
+      return sqlite::result::Long(context, value.long_value);
+    case SqlValue::kDouble:
+      return sqlite::result::Double(context, value.double_value);
+    case SqlValue::kString:
+      return sqlite::result::TransientString(context, value.string_value);
+    case SqlValue::kBytes:
+      return sqlite::result::TransientBytes(
+          context, value.bytes_value, static_cast<int>(value.bytes_count));
+    case SqlValue::kNull:
+      return sqlite::result::Null(context);
+  }
+}
+
 }  // namespace
 
 void SpanJoinOperatorModule::State::PopulateColumnLocatorMap(uint32_t offset) {
@@ -332,6 +413,25 @@ base::Status SpanJoinOperatorModule::Query::Initialize(
   return status;
 }
 
+base::Status SpanJoinOperatorModule::Query::InitializeMaterialized(
+    const MaterializedTable* table,
+    uint32_t begin,
+    uint32_t end,
+    InitialEofBehavior eof_behavior) {
+  *this = Query(in_state_, definition());
+  materialized_ = table;
+  materialized_begin_ = begin;
+  materialized_end_ = end;
+  base::Status status = Rewind();
+  if (!status.ok())
+    return status;
+  if (eof_behavior == InitialEofBehavior::kTreatAsMissingPartitionShadow &&
+      IsEof()) {
+    state_ = State::kMissingPartitionShadow;
+  }
+  return status;
+}
+
 base::Status SpanJoinOperatorModule::Query::Next() {
   RETURN_IF_ERROR(NextSliceState());
   return FindNextValidSlice();
@@ -444,11 +544,16 @@ base::Status SpanJoinOperatorModule::Query::NextSliceState() {
 }
 
 base::Status SpanJoinOperatorModule::Query::Rewind() {
-  auto res = in_state_->engine->sqlite_engine()->PrepareStatement(
-      SqlSource::FromTraceProcessorImplementation(sql_query_));
-  cursor_eof_ = false;
-  RETURN_IF_ERROR(res.status());
-  stmt_ = std::move(res);
+  if (materialized_) {
+    cursor_eof_ = false;
+    next_row_ = materialized_begin_;
+  } else {
+    auto res = in_state_->engine->sqlite_engine()->PrepareStatement(
+        SqlSource::FromTraceProcessorImplementation(sql_query_));
+    cursor_eof_ = false;
+    RETURN_IF_ERROR(res.status());
+    stmt_ = std::move(res);
+  }
 
   RETURN_IF_ERROR(CursorNext());
 
@@ -473,6 +578,14 @@ base::Status SpanJoinOperatorModule::Query::Rewind() {
 }
 
 base::Status SpanJoinOperatorModule::Query::CursorNext() {
+  if (materialized_) {
+    // Rows with null partition keys were skipped when materializing.
+    cursor_eof_ = next_row_ == materialized_end_;
+    if (!cursor_eof_) {
+      row_ = next_row_++;
+    }
+    return base::OkStatus();
+  }
   if (defn_->IsPartitioned()) {
     auto partition_idx = static_cast<int>(defn_->partition_idx());
     // Fastforward through any rows with null partition keys.
@@ -613,6 +726,8 @@ int SpanJoinOperatorModule::Create(sqlite3* db,
   auto* context = GetContext(ctx);
   auto state = std::make_unique<State>();
   state->engine = context->engine;
+  state->thread_pool = context->thread_pool;
+  state->thread_count = context->thread_count;
   state->module_name = argv[0];
 
   TableDescriptor t1_desc;
@@ -854,8 +969,19 @@ int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
   auto t1_eof = state->IsOuterJoin() && !t1_partitioned_mixed
                     ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
                     : Query::InitialEofBehavior::kTreatAsEof;
-  base::Status status =
-      c->t1.Initialize(state->t1_defn.CreateSqlQuery(splitter, argv), t1_eof);
+  std::string t1_sql = state->t1_defn.CreateSqlQuery(splitter, argv);
+  std::string t2_sql = state->t2_defn.CreateSqlQuery(splitter, argv);
+  c->materialized = false;
+  if (state->thread_pool &&
+      state->partitioning == PartitioningType::kSamePartitioning) {
+    base::Status status = c->MaterializeAndJoin(t1_sql, t2_sql);
+    if (!status.ok()) {
+      return sqlite::utils::SetError(table, status.c_message());
+    }
+    return SQLITE_OK;
+  }
+
+  base::Status status = c->t1.Initialize(std::move(t1_sql), t1_eof);
   if (!status.ok()) {
     return sqlite::utils::SetError(table, status.c_message());
   }
@@ -867,8 +993,7 @@ int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
       (state->IsLeftJoin() || state->IsOuterJoin()) && !t2_partitioned_mixed
           ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
           : Query::InitialEofBehavior::kTreatAsEof;
-  status =
-      c->t2.Initialize(state->t2_defn.CreateSqlQuery(splitter, argv), t2_eof);
+  status = c->t2.Initialize(std::move(t2_sql), t2_eof);
   if (!status.ok()) {
     return sqlite::utils::SetError(table, status.c_message());
   }
@@ -882,6 +1007,10 @@ int SpanJoinOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
 
 int SpanJoinOperatorModule::Next(sqlite3_vtab_cursor* cursor) {
   Cursor* c = GetCursor(cursor);
+  if (c->materialized) {
+    c->joined_row++;
+    return SQLITE_OK;
+  }
   Vtab* table = GetVtab(cursor->pVtab);
   base::Status status = c->next_query->Next();
   if (!status.ok()) {
@@ -896,6 +1025,9 @@ int SpanJoinOperatorModule::Next(sqlite3_vtab_cursor* cursor) {
 
 int SpanJoinOperatorModule::Eof(sqlite3_vtab_cursor* cur) {
   Cursor* c = GetCursor(cur);
+  if (c->materialized) {
+    return c->joined_row >= c->joined_rows.size();
+  }
   return c->t1.IsEof() || c->t2.IsEof();
 }
 
@@ -907,6 +1039,37 @@ int SpanJoinOperatorModule::Column(sqlite3_vtab_cursor* cursor,
   State* state = sqlite::ModuleStateManager<SpanJoinOperatorModule>::GetState(
       table->state);
 
+  if (c->materialized) {
+    const JoinedRow& row = c->joined_rows[c->joined_row];
+    switch (N) {
+      case Column::kTimestamp:
+        sqlite::result::Long(context, row.ts);
+        break;
+      case Column::kDuration:
+        sqlite::result::Long(context, row.dur);
+        break;
+      case Column::kPartition:
+        sqlite::result::Long(context, row.partition);
+        break;
+      default: {
+        const auto* locator =
+            state->global_index_to_column_locator.Find(static_cast<size_t>(N));
+        PERFETTO_CHECK(locator);
+        bool is_t1 = locator->defn == &state->t1_defn;
+        const MaterializedTable& rows = is_t1 ? c->t1_rows : c->t2_rows;
+        uint32_t row_idx = is_t1 ? row.t1_row : row.t2_row;
+        if (row_idx == JoinedRow::kNoRow) {
+          sqlite::result::Null(context);
+          break;
+        }
+        ReportSqlValue(context, rows.values[static_cast<size_t>(row_idx) *
+                                                rows.column_count +
+                                            locator->col_index]);
+      }
+    }
+    return SQLITE_OK;
+  }
+
   PERFETTO_DCHECK(c->t1.IsReal() || c->t2.IsReal());
 
   switch (N) {
@@ -1042,6 +1205,130 @@ base::Status SpanJoinOperatorModule::Cursor::FindOverlappingSpan() {
   return base::OkStatus();
 }
 
+base::Status SpanJoinOperatorModule::Cursor::MaterializeAndJoin(
+    const std::string& t1_sql,
+    const std::string& t2_sql) {
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY_DETAILED,
+                    "SPAN_JOIN_MATERIALIZE_AND_JOIN");
+  PERFETTO_DCHECK(state->partitioning == PartitioningType::kSamePartitioning);
+  materialized = true;
+  t1_rows = MaterializedTable();
+  t2_rows = MaterializedTable();
+  joined_rows.clear();
+  joined_row = 0;
+  RETURN_IF_ERROR(Materialize(state->engine, state->t1_defn, t1_sql, &t1_rows));
+  RETURN_IF_ERROR(Materialize(state->engine, state->t2_defn, t2_sql, &t2_rows));
+
+  // Both tables are sorted by partition: find the rows of each partition
+  // present in either of them.
+  struct Partition {
+    uint32_t t1_begin;
+    uint32_t t1_end;
+    uint32_t t2_begin;
+    uint32_t t2_end;
+  };
+  std::vector<Partition> partitions;
+  auto t1_size = static_cast<uint32_t>(t1_rows.partition.size());
+  auto t2_size = static_cast<uint32_t>(t2_rows.partition.size());
+  for (uint32_t i1 = 0, i2 = 0; i1 < t1_size || i2 < t2_size;) {
+    int64_t partition =
+        i1 == t1_size   ? t2_rows.partition[i2]
+        : i2 == t2_size ? t1_rows.partition[i1]
+                        : std::min(t1_rows.partition[i1], t2_rows.partition[i2]);
+    Partition p{i1, i1, i2, i2};
+    for (; i1 < t1_size && t1_rows.partition[i1] == partition; ++i1) {
+    }
+    for (; i2 < t2_size && t2_rows.partition[i2] == partition; ++i2) {
+    }
+    p.t1_end = i1;
+    p.t2_end = i2;
+    partitions.push_back(p);
+  }
+  if (partitions.empty()) {
+    return base::OkStatus();
+  }
+
+  // The spans of a partition only overlap with spans of the same partition or
+  // with missing partition shadows, which are the same whether the other
+  // partitions are present or not. This allows joining each partition on its
+  // own.
+  std::vector<std::vector<JoinedRow>> results(partitions.size());
+  std::vector<base::Status> statuses(partitions.size());
+  std::atomic<uint32_t> next_partition{0};
+  auto join_partitions = [&]() {
+    for (uint32_t i = next_partition++; i < partitions.size();
+         i = next_partition++) {
+      const Partition& p = partitions[i];
+      statuses[i] = JoinMaterialized(p.t1_begin, p.t1_end, p.t2_begin,
+                                     p.t2_end, &results[i]);
+    }
+  };
+
+  uint32_t task_count = std::min(
+      state->thread_count, static_cast<uint32_t>(partitions.size() - 1));
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  uint32_t done_count = 0;
+  for (uint32_t i = 0; i < task_count; ++i) {
+    state->thread_pool->PostTask([&]() {
+      join_partitions();
+      std::lock_guard<std::mutex> lock(mutex);
+      if (++done_count == task_count)
+        done_cv.notify_one();
+    });
+  }
+  join_partitions();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&]() { return done_count == task_count; });
+  }
+
+  size_t row_count = 0;
+  for (uint32_t i = 0; i < partitions.size(); ++i) {
+    RETURN_IF_ERROR(statuses[i]);
+    row_count += results[i].size();
+  }
+  joined_rows.reserve(row_count);
+  for (const auto& rows : results) {
+    joined_rows.insert(joined_rows.end(), rows.begin(), rows.end());
+  }
+  return base::OkStatus();
+}
+
+base::Status SpanJoinOperatorModule::Cursor::JoinMaterialized(
+    uint32_t t1_begin,
+    uint32_t t1_end,
+    uint32_t t2_begin,
+    uint32_t t2_end,
+    std::vector<JoinedRow>* out) const {
+  // The same shadows are emitted as in |Filter| for the same partitioning.
+  auto t1_eof = state->IsOuterJoin()
+                    ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
+                    : Query::InitialEofBehavior::kTreatAsEof;
+  auto t2_eof = state->IsLeftJoin() || state->IsOuterJoin()
+                    ? Query::InitialEofBehavior::kTreatAsMissingPartitionShadow
+                    : Query::InitialEofBehavior::kTreatAsEof;
+  Cursor c(state);
+  RETURN_IF_ERROR(
+      c.t1.InitializeMaterialized(&t1_rows, t1_begin, t1_end, t1_eof));
+  RETURN_IF_ERROR(
+      c.t2.InitializeMaterialized(&t2_rows, t2_begin, t2_end, t2_eof));
+  RETURN_IF_ERROR(c.FindOverlappingSpan());
+  while (!c.t1.IsEof() && !c.t2.IsEof()) {
+    int64_t ts = std::max(c.t1.ts(), c.t2.ts());
+    int64_t ts_end = std::min(c.t1.raw_ts_end(), c.t2.raw_ts_end());
+    out->push_back(JoinedRow{
+        ts, ts_end - ts,
+        c.t1.IsReal() ? c.t1.partition() : c.t2.partition(),
+        c.t1.IsReal() ? c.t1.materialized_row() : JoinedRow::kNoRow,
+        c.t2.IsReal() ? c.t2.materialized_row() : JoinedRow::kNoRow,
+    });
+    RETURN_IF_ERROR(c.next_query->Next());
+    RETURN_IF_ERROR(c.FindOverlappingSpan());
+  }
+  return base::OkStatus();
+}
+
 SpanJoinOperatorModule::Query*
 SpanJoinOperatorModule::Cursor::FindEarliestFinishQuery() {
   int64_t t1_part;
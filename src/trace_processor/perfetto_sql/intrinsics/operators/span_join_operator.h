@@ -19,6 +19,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <optional>
 #include <string>
@@ -30,6 +31,7 @@
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
@@ -72,6 +74,12 @@ struct SpanJoinOperatorModule;
 //
 // All other columns apart from timestamp (ts), duration (dur) and the join key
 // are passed through unchanged.
+//
+// Parallel mode:
+// When the module is given a thread pool and both tables are partitioned on
+// the same column, the rows of both tables are read fully when filtering and
+// the partitions are joined independently on the thread pool. The joined rows
+// are then returned in partition order, exactly as in the serial mode.
 struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
  public:
   static constexpr uint32_t kSourceGeqOpCode =
@@ -105,6 +113,35 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     std::string partition_col;
   };
 
+  // The rows of a child table, read fully for a parallel span join. Rows with
+  // a null partition are skipped.
+  struct MaterializedTable {
+    // The ts, dur and partition of each row.
+    std::vector<int64_t> ts;
+    std::vector<int64_t> dur;
+    std::vector<int64_t> partition;
+
+    // The values of all the columns of each row, one row after the other.
+    std::vector<SqlValue> values;
+    uint32_t column_count = 0;
+
+    // Backing storage of the strings and bytes in |values|.
+    std::deque<std::string> storage;
+  };
+
+  // A row of the result of a parallel span join.
+  struct JoinedRow {
+    static constexpr uint32_t kNoRow = std::numeric_limits<uint32_t>::max();
+
+    int64_t ts;
+    int64_t dur;
+    int64_t partition;
+
+    // The rows of the child tables (or kNoRow for shadows).
+    uint32_t t1_row;
+    uint32_t t2_row;
+  };
+
   // Contains the definition of the child tables.
   class TableDefinition {
    public:
@@ -208,6 +245,15 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
         std::string sql,
         InitialEofBehavior eof_behavior = InitialEofBehavior::kTreatAsEof);
 
+    // Initializes the query to read the rows [begin, end) of |table| instead
+    // of running SQL. Such queries never call into SQLite so can be used on
+    // any thread.
+    base::Status InitializeMaterialized(
+        const MaterializedTable* table,
+        uint32_t begin,
+        uint32_t end,
+        InitialEofBehavior eof_behavior = InitialEofBehavior::kTreatAsEof);
+
     // Forwards the query to the next valid slice.
     base::Status Next();
 
@@ -266,6 +312,12 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
       return ts_end_;
     }
 
+    // Returns the row of the materialized table of the current real slice.
+    uint32_t materialized_row() const {
+      PERFETTO_DCHECK(IsReal() && materialized_);
+      return row_;
+    }
+
     const TableDefinition* definition() const { return defn_; }
 
    private:
@@ -306,12 +358,18 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
 
     int64_t CursorTs() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (materialized_) {
+        return materialized_->ts[row_];
+      }
       auto ts_idx = static_cast<int>(defn_->ts_idx());
       return sqlite3_column_int64(stmt_->sqlite_stmt(), ts_idx);
     }
 
     int64_t CursorDur() const {
       PERFETTO_DCHECK(!cursor_eof_);
+      if (materialized_) {
+        return materialized_->dur[row_];
+      }
       auto dur_idx = static_cast<int>(defn_->dur_idx());
       return sqlite3_column_int64(stmt_->sqlite_stmt(), dur_idx);
     }
@@ -319,6 +377,9 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     int64_t CursorPartition() const {
       PERFETTO_DCHECK(!cursor_eof_);
       PERFETTO_DCHECK(defn_->IsPartitioned());
+      if (materialized_) {
+        return materialized_->partition[row_];
+      }
       auto partition_idx = static_cast<int>(defn_->partition_idx());
       return sqlite3_column_int64(stmt_->sqlite_stmt(), partition_idx);
     }
@@ -340,6 +401,15 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     std::string sql_query_;
     std::optional<SqliteEngine::PreparedStatement> stmt_;
 
+    // Only set for queries initialized with |InitializeMaterialized|: the
+    // rows [materialized_begin_, materialized_end_) of |materialized_| are
+    // read instead of |stmt_|. |row_| is the row the cursor points to.
+    const MaterializedTable* materialized_ = nullptr;
+    uint32_t materialized_begin_ = 0;
+    uint32_t materialized_end_ = 0;
+    uint32_t row_ = 0;
+    uint32_t next_row_ = 0;
+
     const TableDefinition* defn_ = nullptr;
     SpanJoinOperatorModule::State* in_state_ = nullptr;
   };
@@ -371,9 +441,20 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
   };
 
   struct Context {
-    explicit Context(PerfettoSqlEngine* _engine) : engine(_engine) {}
+    explicit Context(PerfettoSqlEngine* _engine,
+                     base::ThreadPool* _thread_pool = nullptr,
+                     uint32_t _thread_count = 0)
+        : engine(_engine),
+          thread_pool(_thread_pool),
+          thread_count(_thread_count) {}
 
     PerfettoSqlEngine* engine;
+
+    // If set, span joins between tables partitioned on the same column are
+    // computed in parallel using this pool of |thread_count| threads.
+    base::ThreadPool* thread_pool;
+    uint32_t thread_count;
+
     sqlite::ModuleStateManager<SpanJoinOperatorModule> manager;
   };
   struct State {
@@ -398,6 +479,8 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     void PopulateColumnLocatorMap(uint32_t);
 
     PerfettoSqlEngine* engine;
+    base::ThreadPool* thread_pool = nullptr;
+    uint32_t thread_count = 0;
     std::string module_name;
     std::string create_table_stmt;
     TableDefinition t1_defn;
@@ -420,11 +503,34 @@ struct SpanJoinOperatorModule : public sqlite::Module<SpanJoinOperatorModule> {
     base::Status FindOverlappingSpan();
     Query* FindEarliestFinishQuery();
 
+    // Reads the rows returned by |t1_sql| and |t2_sql| and computes all the
+    // rows of the span join into |joined_rows|, joining partitions in
+    // parallel.
+    base::Status MaterializeAndJoin(const std::string& t1_sql,
+                                    const std::string& t2_sql);
+
+    // Appends the rows of the span join of the rows [t1_begin, t1_end) of
+    // |t1_rows| and [t2_begin, t2_end) of |t2_rows| to |out|. Does not call
+    // into SQLite.
+    base::Status JoinMaterialized(uint32_t t1_begin,
+                                  uint32_t t1_end,
+                                  uint32_t t2_begin,
+                                  uint32_t t2_end,
+                                  std::vector<JoinedRow>* out) const;
+
     Query t1;
     Query t2;
 
     Query* next_query = nullptr;
 
+    // Only used for parallel span joins: the rows of the child tables and the
+    // joined rows, with |joined_row| the row the cursor points to.
+    bool materialized = false;
+    MaterializedTable t1_rows;
+    MaterializedTable t2_rows;
+    std::vector<JoinedRow> joined_rows;
+    uint32_t joined_row = 0;
+
     // Only valid for kMixedPartition.
     int64_t last_mixed_partition_ = std::numeric_limits<int64_t>::min();
 
@@ -23,6 +23,7 @@
 #include <string>
 #include <vector>
 
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "src/trace_processor/containers/string_pool.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
@@ -57,6 +58,22 @@ class SpanJoinOperatorTableTest : public ::testing::Test {
     ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
   }
 
+  // Returns all the rows of |sql| with their columns separated by commas.
+  std::vector<std::string> QueryRows(const std::string& sql) {
+    std::vector<std::string> rows;
+    PrepareValidStatement(sql);
+    while (sqlite3_step(stmt_.get()) == SQLITE_ROW) {
+      std::string row;
+      for (int i = 0; i < sqlite3_column_count(stmt_.get()); ++i) {
+        const auto* value = sqlite3_column_text(stmt_.get(), i);
+        row += value ? reinterpret_cast<const char*>(value) : "NULL";
+        row += ",";
+      }
+      rows.push_back(std::move(row));
+    }
+    return rows;
+  }
+
   void AssertNextRow(const std::vector<int64_t>& elements) {
     ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_ROW);
     for (size_t i = 0; i < elements.size(); ++i) {
@@ -387,5 +404,59 @@ TEST_F(SpanJoinOperatorTableTest, CapitalizedLeftJoin) {
   ASSERT_EQ(sqlite3_step(stmt_.get()), SQLITE_DONE);
 }
 
+TEST_F(SpanJoinOperatorTableTest, ParallelMatchesSerial) {
+  base::ThreadPool thread_pool(2);
+  engine_.sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
+      "span_outer_join",
+      std::make_unique<SpanJoinOperatorModule::Context>(&engine_));
+  for (const char* name :
+       {"span_join_parallel", "span_left_join_parallel",
+        "span_outer_join_parallel"}) {
+    engine_.sqlite_engine()
+        ->RegisterVirtualTableModule<SpanJoinOperatorModule>(
+            name, std::make_unique<SpanJoinOperatorModule::Context>(
+                      &engine_, &thread_pool, 2));
+  }
+
+  RunStatement(
+      "CREATE TEMP TABLE f("
+      "ts BIGINT PRIMARY KEY, "
+      "dur BIGINT, "
+      "cpu UNSIGNED INT, "
+      "name STRING"
+      ");");
+  RunStatement(
+      "CREATE TEMP TABLE s("
+      "ts BIGINT PRIMARY KEY, "
+      "dur BIGINT, "
+      "cpu UNSIGNED INT, "
+      "value DOUBLE"
+      ");");
+  RunStatement("INSERT INTO f VALUES(100, 10, 0, 'a');");
+  RunStatement("INSERT INTO f VALUES(110, 40, 2, 'b');");
+  RunStatement("INSERT INTO f VALUES(120, 10, 0, NULL);");
+  RunStatement("INSERT INTO f VALUES(130, 30, NULL, 'c');");
+  RunStatement("INSERT INTO f VALUES(140, 20, 3, 'd');");
+  RunStatement("INSERT INTO s VALUES(95, 30, 0, 1.5);");
+  RunStatement("INSERT INTO s VALUES(105, 100, 1, 2.5);");
+  RunStatement("INSERT INTO s VALUES(125, 10, 2, NULL);");
+  RunStatement("INSERT INTO s VALUES(135, 10, 2, 3.5);");
+
+  for (const char* type : {"span_join", "span_left_join", "span_outer_join"}) {
+    RunStatement("CREATE VIRTUAL TABLE serial USING " + std::string(type) +
+                 "(f PARTITIONED cpu, s PARTITIONED cpu);");
+    RunStatement("CREATE VIRTUAL TABLE parallel USING " + std::string(type) +
+                 "_parallel(f PARTITIONED cpu, s PARTITIONED cpu);");
+    std::vector<std::string> serial = QueryRows("SELECT * FROM serial");
+    ASSERT_FALSE(serial.empty()) << type;
+    ASSERT_EQ(QueryRows("SELECT * FROM parallel"), serial) << type;
+    ASSERT_EQ(QueryRows("SELECT * FROM parallel WHERE ts >= 120"),
+              QueryRows("SELECT * FROM serial WHERE ts >= 120"))
+        << type;
+    RunStatement("DROP TABLE serial;");
+    RunStatement("DROP TABLE parallel;");
+  }
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
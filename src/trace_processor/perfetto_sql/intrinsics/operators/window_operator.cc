@@ -17,8 +17,13 @@
 #include "src/trace_processor/perfetto_sql/intrinsics/operators/window_operator.h"
 
 #include <sqlite3.h>
+#include <algorithm>
 #include <cstdint>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
 
 #include "perfetto/base/logging.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
@@ -40,8 +45,82 @@ constexpr char kSchema[] = R"(
       PRIMARY KEY(rowid)
     ) WITHOUT ROWID
   )";
+
+// The constraints passed to |Filter|: |idxStr| contains one of these
+// characters for each argument.
+constexpr char kRowIdEq = 'r';
+constexpr char kTsEq = '=';
+constexpr char kTsGt = '>';
+constexpr char kTsGe = 'g';
+constexpr char kTsLt = '<';
+constexpr char kTsLe = 'l';
+
+std::optional<char> ConstraintCode(int column, int op) {
+  if (column == WindowOperatorModule::kRowId) {
+    return sqlite::utils::IsOpEq(op) ? std::make_optional(kRowIdEq)
+                                     : std::nullopt;
+  }
+  if (column != WindowOperatorModule::kTs) {
+    return std::nullopt;
+  }
+  if (sqlite::utils::IsOpEq(op)) {
+    return kTsEq;
+  }
+  if (sqlite::utils::IsOpGt(op)) {
+    return kTsGt;
+  }
+  if (sqlite::utils::IsOpGe(op)) {
+    return kTsGe;
+  }
+  if (sqlite::utils::IsOpLt(op)) {
+    return kTsLt;
+  }
+  if (sqlite::utils::IsOpLe(op)) {
+    return kTsLe;
+  }
+  return std::nullopt;
 }
 
+constexpr int64_t kMaxIndex = std::numeric_limits<int64_t>::max();
+
+// Returns the number of spans of |step| needed to cover |dur|.
+int64_t SpanCount(int64_t dur, int64_t step) {
+  if (dur <= 0 || step <= 0) {
+    return 0;
+  }
+  auto d = static_cast<uint64_t>(dur);
+  auto s = static_cast<uint64_t>(step);
+  return static_cast<int64_t>(d / s + (d % s != 0));
+}
+
+// Returns the index of the first span starting at or after |ts|.
+int64_t FirstIndexAtOrAfter(const WindowOperatorModule::Cursor& c,
+                            int64_t ts) {
+  if (ts <= c.window_start) {
+    return 0;
+  }
+  uint64_t diff =
+      static_cast<uint64_t>(ts) - static_cast<uint64_t>(c.window_start);
+  auto step = static_cast<uint64_t>(c.step_size);
+  uint64_t index = diff / step + (diff % step != 0);
+  return static_cast<int64_t>(
+      std::min(index, static_cast<uint64_t>(kMaxIndex)));
+}
+
+// Returns the index past the last span starting at or before |ts|.
+int64_t EndIndexAtOrBefore(const WindowOperatorModule::Cursor& c, int64_t ts) {
+  if (ts < c.window_start) {
+    return 0;
+  }
+  uint64_t diff =
+      static_cast<uint64_t>(ts) - static_cast<uint64_t>(c.window_start);
+  auto step = static_cast<uint64_t>(c.step_size);
+  return static_cast<int64_t>(
+      std::min(diff / step, static_cast<uint64_t>(kMaxIndex - 1)) + 1);
+}
+
+}  // namespace
+
 int WindowOperatorModule::Create(sqlite3* db,
                                  void* raw_ctx,
                                  int argc,
@@ -93,18 +172,26 @@ int WindowOperatorModule::BestIndex(sqlite3_vtab*, sqlite3_index_info* info) {
                           info->aOrderBy[0].iColumn == Column::kTs &&
                           !info->aOrderBy[0].desc;
 
-  // Set return first if there is a equals constraint on the row id asking to
-  // return the first row.
-  bool is_row_id_constraint = info->nConstraint == 1 &&
-                              info->aConstraint[0].iColumn == Column::kRowId &&
-                              info->aConstraint[0].usable &&
-                              sqlite::utils::IsOpEq(info->aConstraint[0].op);
-  if (is_row_id_constraint) {
-    info->idxNum = 1;
-    info->aConstraintUsage[0].argvIndex = 1;
-  } else {
-    info->idxNum = 0;
+  // Constraints on rowid and ts restrict the range of spans generated. SQLite
+  // still checks them as non-integer values are not used to restrict the
+  // range.
+  std::string codes;
+  for (int i = 0; i < info->nConstraint; ++i) {
+    const auto& c = info->aConstraint[i];
+    if (!c.usable) {
+      continue;
+    }
+    if (auto code = ConstraintCode(c.iColumn, c.op); code) {
+      codes.push_back(*code);
+      info->aConstraintUsage[i].argvIndex = static_cast<int>(codes.size());
+    }
+  }
+  info->idxNum = 0;
+  if (!codes.empty()) {
+    info->idxStr = sqlite3_mprintf("%s", codes.c_str());
+    info->needToFreeIdxStr = true;
   }
+  info->estimatedCost = codes.empty() ? 1000000 : 10;
   return SQLITE_OK;
 }
 
@@ -120,8 +207,8 @@ int WindowOperatorModule::Close(sqlite3_vtab_cursor* cursor) {
 }
 
 int WindowOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
-                                 int is_row_id_constraint,
-                                 const char*,
+                                 int,
+                                 const char* idx_str,
                                  int argc,
                                  sqlite3_value** argv) {
   auto* t = GetVtab(cursor->pVtab);
@@ -129,38 +216,78 @@ int WindowOperatorModule::Filter(sqlite3_vtab_cursor* cursor,
   auto* s =
       sqlite::ModuleStateManager<WindowOperatorModule>::GetState(t->state);
 
-  c->window_end = s->window_start + s->window_dur;
+  c->window_start = s->window_start;
   c->step_size = s->quantum == 0 ? s->window_dur : s->quantum;
-  c->current_ts = s->window_start;
+  c->index = 0;
+  c->end_index = SpanCount(s->window_dur, c->step_size);
 
-  if (is_row_id_constraint) {
-    PERFETTO_CHECK(argc == 1);
-    c->filter_type = sqlite3_value_int(argv[0]) == 0 ? FilterType::kReturnFirst
-                                                     : FilterType::kReturnAll;
-  } else {
-    c->filter_type = FilterType::kReturnAll;
+  std::string_view codes = idx_str ? idx_str : "";
+  PERFETTO_CHECK(codes.size() == static_cast<size_t>(argc));
+  for (uint32_t i = 0; i < codes.size(); ++i) {
+    // Other types are left for SQLite to compare.
+    if (sqlite3_value_type(argv[i]) != SQLITE_INTEGER) {
+      continue;
+    }
+    int64_t value = sqlite3_value_int64(argv[i]);
+    std::optional<int64_t> min_ts;
+    std::optional<int64_t> max_ts;
+    switch (codes[i]) {
+      case kRowIdEq:
+        if (value < c->index || value >= c->end_index) {
+          c->end_index = 0;
+        } else {
+          c->index = value;
+          c->end_index = value + 1;
+        }
+        break;
+      case kTsEq:
+        min_ts = value;
+        max_ts = value;
+        break;
+      case kTsGt:
+        if (value == std::numeric_limits<int64_t>::max()) {
+          c->end_index = 0;
+        } else {
+          min_ts = value + 1;
+        }
+        break;
+      case kTsGe:
+        min_ts = value;
+        break;
+      case kTsLt:
+        if (value == std::numeric_limits<int64_t>::min()) {
+          c->end_index = 0;
+        } else {
+          max_ts = value - 1;
+        }
+        break;
+      case kTsLe:
+        max_ts = value;
+        break;
+      default:
+        PERFETTO_FATAL("Unknown constraint %c", codes[i]);
+    }
+    if (c->end_index == 0) {
+      break;
+    }
+    if (min_ts) {
+      c->index = std::max(c->index, FirstIndexAtOrAfter(*c, *min_ts));
+    }
+    if (max_ts) {
+      c->end_index = std::min(c->end_index, EndIndexAtOrBefore(*c, *max_ts));
+    }
   }
   return SQLITE_OK;
 }
 
 int WindowOperatorModule::Next(sqlite3_vtab_cursor* cursor) {
-  auto* c = GetCursor(cursor);
-  switch (c->filter_type) {
-    case FilterType::kReturnFirst:
-      c->current_ts = c->window_end;
-      break;
-    case FilterType::kReturnAll:
-      c->current_ts += c->step_size;
-      c->quantum_ts++;
-      break;
-  }
-  c->row_id++;
+  GetCursor(cursor)->index++;
   return SQLITE_OK;
 }
 
 int WindowOperatorModule::Eof(sqlite3_vtab_cursor* cursor) {
   auto* c = GetCursor(cursor);
-  return c->current_ts >= c->window_end;
+  return c->index >= c->end_index;
 }
 
 int WindowOperatorModule::Column(sqlite3_vtab_cursor* cursor,
@@ -184,7 +311,8 @@ int WindowOperatorModule::Column(sqlite3_vtab_cursor* cursor,
       break;
     }
     case Column::kTs: {
-      sqlite::result::Long(ctx, static_cast<sqlite_int64>(c->current_ts));
+      sqlite::result::Long(ctx, static_cast<sqlite_int64>(
+                                    c->window_start + c->index * c->step_size));
       break;
     }
     case Column::kDuration: {
@@ -192,11 +320,11 @@ int WindowOperatorModule::Column(sqlite3_vtab_cursor* cursor,
       break;
     }
     case Column::kQuantumTs: {
-      sqlite::result::Long(ctx, static_cast<sqlite_int64>(c->quantum_ts));
+      sqlite::result::Long(ctx, static_cast<sqlite_int64>(c->index));
       break;
     }
     case Column::kRowId: {
-      sqlite::result::Long(ctx, static_cast<sqlite_int64>(c->row_id));
+      sqlite::result::Long(ctx, static_cast<sqlite_int64>(c->index));
       break;
     }
     default: {
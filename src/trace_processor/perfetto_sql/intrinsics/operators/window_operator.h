@@ -31,14 +31,11 @@ namespace perfetto::trace_processor {
 class TraceStorage;
 
 // Operator table which can emit spans of a configurable duration.
+//
+// The spans are generated on demand by the cursor: constraints on |ts| and
+// |rowid| are used to only generate the spans which can match them, so
+// filtering a fine-grained window does not iterate over all of its spans.
 struct WindowOperatorModule : sqlite::Module<WindowOperatorModule> {
-  // Defines the data to be generated by the table.
-  enum FilterType {
-    // Returns all the spans.
-    kReturnAll = 0,
-    // Only returns the first span of the table. Useful for UPDATE operations.
-    kReturnFirst = 1,
-  };
   struct State {
     int64_t quantum = 0;
     int64_t window_start = 0;
@@ -54,14 +51,13 @@ struct WindowOperatorModule : sqlite::Module<WindowOperatorModule> {
     sqlite::ModuleStateManager<WindowOperatorModule>::PerVtabState* state;
   };
   struct Cursor : sqlite::Module<WindowOperatorModule>::Cursor {
-    int64_t window_end = 0;
+    int64_t window_start = 0;
     int64_t step_size = 0;
 
-    int64_t current_ts = 0;
-    int64_t quantum_ts = 0;
-    int64_t row_id = 0;
-
-    FilterType filter_type = FilterType::kReturnAll;
+    // The index of the current span (which is also its rowid and quantum_ts)
+    // and the index past the last span to return.
+    int64_t index = 0;
+    int64_t end_index = 0;
   };
   enum Column {
     kRowId = 0,
@@ -48,8 +48,12 @@ ConnectedFlowTable::~ConnectedFlowTable() = default;
 
 }  // namespace tables
 
-ConnectedFlow::ConnectedFlow(Mode mode, const TraceStorage* storage)
-    : mode_(mode), storage_(storage) {}
+ConnectedFlow::ConnectedFlow(Mode mode,
+                             const TraceStorage* storage,
+                             std::shared_ptr<SliceTreeIndex> slice_tree_index)
+    : mode_(mode),
+      storage_(storage),
+      slice_tree_index_(std::move(slice_tree_index)) {}
 
 ConnectedFlow::~ConnectedFlow() = default;
 
@@ -70,7 +74,7 @@ enum RelativesVisitMode : uint8_t {
 
 // Searches through the slice table recursively to find connected flows.
 // Usage:
-//  BFS bfs = BFS(context);
+//  BFS bfs = BFS(storage, slice_tree_index);
 //  bfs
 //    // Add list of slices to start with.
 //    .Start(start_id).Start(start_id2)
@@ -82,7 +86,8 @@ enum RelativesVisitMode : uint8_t {
 //  bfs.TakeResultingFlows();
 class BFS {
  public:
-  explicit BFS(const TraceStorage* storage) : storage_(storage) {}
+  BFS(const TraceStorage* storage, SliceTreeIndex* slice_tree_index)
+      : storage_(storage), slice_tree_index_(slice_tree_index) {}
 
   std::vector<tables::FlowTable::RowNumber> TakeResultingFlows() && {
     return std::move(flow_rows_);
@@ -131,7 +136,7 @@ class BFS {
     }
     if (visit_relatives & VISIT_DESCENDANTS) {
       auto opt_descendants =
-          Descendant::GetDescendantSlices(slice_table, slice_id);
+          Descendant::GetDescendantSlices(*slice_tree_index_, slice_id);
       if (opt_descendants)
         GoToRelativesImpl(*opt_descendants);
     }
@@ -196,6 +201,7 @@ class BFS {
   std::vector<tables::FlowTable::RowNumber> flow_rows_;
 
   const TraceStorage* storage_;
+  SliceTreeIndex* slice_tree_index_;
 };
 
 }  // namespace
@@ -221,7 +227,7 @@ base::StatusOr<std::unique_ptr<Table>> ConnectedFlow::ComputeTable(
                            static_cast<uint32_t>(start_id.value));
   }
 
-  BFS bfs(storage_);
+  BFS bfs(storage_, slice_tree_index_.get());
   switch (mode_) {
     case Mode::kDirectlyConnectedFlow:
       bfs.Start(start_id).VisitAll(VISIT_INCOMING_AND_OUTGOING,
@@ -25,6 +25,7 @@
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
 #include "src/trace_processor/storage/trace_storage.h"
 
@@ -50,7 +51,9 @@ class ConnectedFlow : public StaticTableFunction {
     kFollowingFlow,
   };
 
-  ConnectedFlow(Mode mode, const TraceStorage*);
+  ConnectedFlow(Mode mode,
+                const TraceStorage*,
+                std::shared_ptr<SliceTreeIndex> slice_tree_index);
   ~ConnectedFlow() override;
 
   Table::Schema CreateSchema() override;
@@ -62,6 +65,7 @@ class ConnectedFlow : public StaticTableFunction {
  private:
   Mode mode_;
   const TraceStorage* storage_ = nullptr;
+  std::shared_ptr<SliceTreeIndex> slice_tree_index_;
 };
 
 }  // namespace perfetto::trace_processor
@@ -22,6 +22,7 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/base/test/status_matchers.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "test/gtest_and_gmock.h"
 
@@ -34,8 +35,9 @@ TEST(ConnectedFlow, SliceTableNullConstraint) {
   TraceStorage storage;
   storage.mutable_slice_table()->Insert({});
 
-  ConnectedFlow generator{ConnectedFlow::Mode::kDirectlyConnectedFlow,
-                          &storage};
+  ConnectedFlow generator{
+      ConnectedFlow::Mode::kDirectlyConnectedFlow, &storage,
+      std::make_shared<SliceTreeIndex>(&storage.slice_table())};
 
   // Check that if we pass start_id = NULL as a constraint, we correctly return
   // an empty table.
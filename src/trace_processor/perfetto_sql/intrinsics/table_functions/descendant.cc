@@ -16,8 +16,6 @@
 
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/descendant.h"
 
-#include <algorithm>
-#include <cinttypes>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -61,48 +59,14 @@ std::unique_ptr<Table> ExtendWithStartId(
                                            std::move(start_ids));
 }
 
-base::Status GetDescendants(
-    const tables::SliceTable& slices,
-    SliceId starting_id,
-    std::vector<tables::SliceTable::RowNumber>& row_numbers_accumulator) {
-  auto start_ref = slices.FindById(starting_id);
-  // The query gave an invalid ID that doesn't exist in the slice table.
-  if (!start_ref) {
-    return base::ErrStatus("no row with id %" PRIu32 "",
-                           static_cast<uint32_t>(starting_id.value));
-  }
-
-  // As an optimization, for any finished slices, we only need to consider
-  // slices which started before the end of this slice (because slices on a
-  // track are always perfectly stacked).
-  // For unfinshed slices (i.e. -1 dur), we need to consider until the end of
-  // the trace so we cannot add any similar constraint.
-  Query q;
-  if (start_ref->dur() >= 0) {
-    q.constraints.emplace_back(
-        slices.ts().le(start_ref->ts() + start_ref->dur()));
-  }
-
-  // All nested descendents must be on the same track, with a ts greater than
-  // |start_ref.ts| and whose depth is larger than |start_ref|'s.
-  q.constraints.emplace_back(slices.ts().ge(start_ref->ts()));
-  q.constraints.emplace_back(slices.track_id().eq(start_ref->track_id().value));
-  q.constraints.emplace_back(slices.depth().gt(start_ref->depth()));
-
-  // It's important we insert directly into |row_numbers_accumulator| and not
-  // overwrite it because we expect the existing elements in
-  // |row_numbers_accumulator| to be preserved.
-
-  for (auto it = slices.FilterToIterator(q); it; ++it) {
-    row_numbers_accumulator.emplace_back(it.row_number());
-  }
-  return base::OkStatus();
-}
-
 }  // namespace
 
-Descendant::Descendant(Type type, const TraceStorage* storage)
-    : type_(type), storage_(storage) {}
+Descendant::Descendant(Type type,
+                       const TraceStorage* storage,
+                       std::shared_ptr<SliceTreeIndex> slice_tree_index)
+    : type_(type),
+      storage_(storage),
+      slice_tree_index_(std::move(slice_tree_index)) {}
 
 base::StatusOr<std::unique_ptr<Table>> Descendant::ComputeTable(
     const std::vector<SqlValue>& arguments) {
@@ -131,8 +95,8 @@ base::StatusOr<std::unique_ptr<Table>> Descendant::ComputeTable(
     case Type::kSlice: {
       // Build up all the children row ids.
       uint32_t start_id_uint = static_cast<uint32_t>(start_id);
-      RETURN_IF_ERROR(GetDescendants(
-          slices, tables::SliceTable::Id(start_id_uint), descendants));
+      RETURN_IF_ERROR(slice_tree_index_->GetDescendants(
+          tables::SliceTable::Id(start_id_uint), descendants));
       return ExtendWithStartId<tables::DescendantSliceTable>(
           start_id_uint, slices, std::move(descendants));
     }
@@ -140,7 +104,8 @@ base::StatusOr<std::unique_ptr<Table>> Descendant::ComputeTable(
       Query q;
       q.constraints = {slices.stack_id().eq(start_id)};
       for (auto it = slices.FilterToIterator(q); it; ++it) {
-        RETURN_IF_ERROR(GetDescendants(slices, it.id(), descendants));
+        RETURN_IF_ERROR(
+            slice_tree_index_->GetDescendants(it.id(), descendants));
       }
       return ExtendWithStartId<tables::DescendantSliceByStackTable>(
           start_id, slices, std::move(descendants));
@@ -175,10 +140,10 @@ uint32_t Descendant::EstimateRowCount() {
 
 // static
 std::optional<std::vector<tables::SliceTable::RowNumber>>
-Descendant::GetDescendantSlices(const tables::SliceTable& slices,
+Descendant::GetDescendantSlices(SliceTreeIndex& slice_tree_index,
                                 SliceId slice_id) {
   std::vector<tables::SliceTable::RowNumber> ret;
-  auto status = GetDescendants(slices, slice_id, ret);
+  auto status = slice_tree_index.GetDescendants(slice_id, ret);
   if (!status.ok())
     return std::nullopt;
   return std::move(ret);
@@ -26,6 +26,7 @@
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/tables/slice_tables_py.h"
@@ -43,7 +44,9 @@ class Descendant : public StaticTableFunction {
  public:
   enum class Type { kSlice = 1, kSliceByStack = 2 };
 
-  Descendant(Type type, const TraceStorage*);
+  Descendant(Type type,
+             const TraceStorage*,
+             std::shared_ptr<SliceTreeIndex> slice_tree_index);
 
   Table::Schema CreateSchema() override;
   std::string TableName() override;
@@ -55,11 +58,12 @@ class Descendant : public StaticTableFunction {
   // std::nullopt if an invalid |slice_id| is given. This is used by
   // ConnectedFlow to traverse flow indirectly connected flow events.
   static std::optional<std::vector<tables::SliceTable::RowNumber>>
-  GetDescendantSlices(const tables::SliceTable& slices, SliceId slice_id);
+  GetDescendantSlices(SliceTreeIndex& slice_tree_index, SliceId slice_id);
 
  private:
   Type type_;
   const TraceStorage* storage_ = nullptr;
+  std::shared_ptr<SliceTreeIndex> slice_tree_index_;
 };
 
 }  // namespace perfetto::trace_processor
@@ -16,12 +16,17 @@
 
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/descendant.h"
 
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <vector>
 
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
 #include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/tables/slice_tables_py.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto::trace_processor {
@@ -33,7 +38,9 @@ TEST(Descendant, SliceTableNullConstraint) {
   TraceStorage storage;
   storage.mutable_slice_table()->Insert({});
 
-  Descendant generator{Descendant::Type::kSlice, &storage};
+  Descendant generator{
+      Descendant::Type::kSlice, &storage,
+      std::make_shared<SliceTreeIndex>(&storage.slice_table())};
 
   // Check that if we pass start_id = NULL as a constraint, we correctly return
   // an empty table.
@@ -49,7 +56,9 @@ TEST(Descendant, SliceByStackTableNullConstraint) {
   TraceStorage storage;
   storage.mutable_slice_table()->Insert({});
 
-  Descendant generator{Descendant::Type::kSliceByStack, &storage};
+  Descendant generator{
+      Descendant::Type::kSliceByStack, &storage,
+      std::make_shared<SliceTreeIndex>(&storage.slice_table())};
 
   // Check that if we pass start_id = NULL as a constraint, we correctly return
   // an empty table.
@@ -59,5 +68,74 @@ TEST(Descendant, SliceByStackTableNullConstraint) {
   ASSERT_EQ(res->get()->row_count(), 0u);
 }
 
+std::vector<uint32_t> DescendantRows(SliceTreeIndex& index, uint32_t id) {
+  std::vector<tables::SliceTable::RowNumber> rows;
+  EXPECT_TRUE(index.GetDescendants(SliceId(id), rows).ok());
+  std::vector<uint32_t> res;
+  for (auto row : rows) {
+    res.push_back(row.row_number());
+  }
+  return res;
+}
+
+TEST(Descendant, SliceTreeIndex) {
+  TraceStorage storage;
+  auto* slices = storage.mutable_slice_table();
+  auto insert = [slices](std::optional<uint32_t> parent) {
+    tables::SliceTable::Row row;
+    if (parent) {
+      row.parent_id = SliceId(*parent);
+    }
+    return slices->Insert(row).id.value;
+  };
+
+  // 0 -> {1 -> {2}, 3}, 4 -> {5}
+  insert(std::nullopt);
+  insert(0);
+  insert(1);
+  insert(0);
+  insert(std::nullopt);
+  insert(4);
+
+  SliceTreeIndex index(slices);
+  ASSERT_EQ(DescendantRows(index, 0), (std::vector<uint32_t>{1, 2, 3}));
+  ASSERT_EQ(DescendantRows(index, 1), (std::vector<uint32_t>{2}));
+  ASSERT_EQ(DescendantRows(index, 3), (std::vector<uint32_t>{}));
+  ASSERT_EQ(DescendantRows(index, 4), (std::vector<uint32_t>{5}));
+
+  // Slices added after the index was built are taken into account.
+  insert(1);
+  ASSERT_EQ(DescendantRows(index, 0), (std::vector<uint32_t>{1, 2, 3, 6}));
+  ASSERT_EQ(DescendantRows(index, 1), (std::vector<uint32_t>{2, 6}));
+
+  std::vector<tables::SliceTable::RowNumber> rows;
+  ASSERT_FALSE(index.GetDescendants(SliceId(100u), rows).ok());
+}
+
+TEST(Descendant, SliceTreeIndexParentAfterChild) {
+  TraceStorage storage;
+  auto* slices = storage.mutable_slice_table();
+
+  // 1 -> {2 -> {0}}, 3 -> {5 -> {4}}: the parents of 0 and 4 are rows after
+  // them.
+  for (uint32_t i = 0; i < 6; ++i) {
+    slices->Insert({});
+  }
+  auto set_parent = [slices](uint32_t row, uint32_t parent) {
+    slices->mutable_parent_id()->Set(row, SliceId(parent));
+  };
+  set_parent(0, 2);
+  set_parent(2, 1);
+  set_parent(4, 5);
+  set_parent(5, 3);
+
+  SliceTreeIndex index(slices);
+  ASSERT_EQ(DescendantRows(index, 1), (std::vector<uint32_t>{0, 2}));
+  ASSERT_EQ(DescendantRows(index, 2), (std::vector<uint32_t>{0}));
+  ASSERT_EQ(DescendantRows(index, 0), (std::vector<uint32_t>{}));
+  ASSERT_EQ(DescendantRows(index, 3), (std::vector<uint32_t>{4, 5}));
+  ASSERT_EQ(DescendantRows(index, 5), (std::vector<uint32_t>{4}));
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
@@ -338,14 +338,15 @@ base::StatusOr<std::unique_ptr<Table>> ExperimentalFlamegraph::ComputeTable(
             "experimental_flamegraph: ts and upid must be present for heap "
             "profile");
       }
-      table = BuildHeapProfileFlamegraph(context_->storage.get(), *values.upid,
+      table = BuildHeapProfileFlamegraph(context_->storage.get(),
+                                         &callsite_tree_, *values.upid,
                                          *values.ts);
       break;
     }
     case ProfileType::kPerf: {
       table = BuildNativeCallStackSamplingFlamegraph(
-          context_->storage.get(), values.upid, values.upid_group,
-          values.time_constraints);
+          context_->storage.get(), &callsite_tree_, values.upid,
+          values.upid_group, values.time_constraints);
       break;
     }
   }
@@ -58,6 +58,8 @@ class ExperimentalFlamegraph : public StaticTableFunction {
 
  private:
   TraceProcessorContext* context_ = nullptr;
+  // Shared by all the native heap profile and perf flamegraphs.
+  MergedCallsiteTree callsite_tree_;
 };
 
 }  // namespace perfetto::trace_processor
@@ -17,6 +17,8 @@
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/flamegraph_construction_algorithms.h"
 
 #include <algorithm>
+#include <array>
+#include <cstddef>
 #include <cstdint>
 #include <map>
 #include <memory>
@@ -32,7 +34,6 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/trace_processor/basic_types.h"
-#include "src/trace_processor/containers/row_map.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/storage/trace_storage.h"
@@ -54,11 +55,6 @@ struct MergedCallsite {
   }
 };
 
-struct FlamegraphTableAndMergedCallsites {
-  std::unique_ptr<tables::ExperimentalFlamegraphTable> tbl;
-  std::vector<uint32_t> callsite_to_merged_callsite;
-};
-
 std::vector<MergedCallsite> GetMergedCallsites(TraceStorage* storage,
                                                uint32_t callstack_row) {
   const tables::StackProfileCallsiteTable& callsites_tbl =
@@ -102,23 +98,112 @@ std::vector<MergedCallsite> GetMergedCallsites(TraceStorage* storage,
   std::reverse(result.begin(), result.end());
   return result;
 }
-}  // namespace
 
-static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
+// The values of a node of the flamegraph, excluding its descendants.
+struct NodeValues {
+  int64_t size = 0;
+  int64_t count = 0;
+  int64_t alloc_size = 0;
+  int64_t alloc_count = 0;
+  std::optional<int64_t> ts;
+};
+
+std::unique_ptr<tables::ExperimentalFlamegraphTable> BuildFlamegraphTable(
     TraceStorage* storage,
+    const MergedCallsiteTree& callsite_tree,
+    const std::vector<NodeValues>& values,
     std::optional<UniquePid> upid,
     std::optional<std::string> upid_group,
     int64_t default_timestamp,
     StringId profile_type) {
-  const tables::StackProfileCallsiteTable& callsites_tbl =
-      storage->stack_profile_callsite_table();
+  const std::vector<MergedCallsiteTree::Node>& nodes = callsite_tree.nodes();
+  PERFETTO_CHECK(values.size() == nodes.size());
 
-  std::vector<uint32_t> callsite_to_merged_callsite(callsites_tbl.row_count(),
-                                                    0);
-  std::map<MergedCallsite, uint32_t> merged_callsites_to_table_idx;
+  // BACKWARD PASS:
+  // Propagate sizes to parents.
+  std::vector<NodeValues> cumulative = values;
+  for (size_t i = nodes.size(); i-- > 0;) {
+    if (std::optional<uint32_t> parent = nodes[i].parent_idx; parent) {
+      cumulative[*parent].size += cumulative[i].size;
+      cumulative[*parent].count += cumulative[i].count;
+      cumulative[*parent].alloc_size += cumulative[i].alloc_size;
+      cumulative[*parent].alloc_count += cumulative[i].alloc_count;
+    }
+  }
 
+  std::optional<StringId> upid_group_id;
+  if (upid_group) {
+    upid_group_id = storage->InternString(base::StringView(*upid_group));
+  }
   std::unique_ptr<tables::ExperimentalFlamegraphTable> tbl(
       new tables::ExperimentalFlamegraphTable(storage->mutable_string_pool()));
+  std::vector<tables::ExperimentalFlamegraphTable::Id> ids;
+  ids.reserve(nodes.size());
+  for (uint32_t i = 0; i < nodes.size(); ++i) {
+    const MergedCallsiteTree::Node& node = nodes[i];
+    tables::ExperimentalFlamegraphTable::Row row{};
+    row.depth = node.depth;
+    if (node.parent_idx) {
+      row.parent_id = ids[*node.parent_idx];
+    }
+
+    // The 'ts' column is given a default value, taken from the query.
+    // So if the query is:
+    // `select * from experimental_flamegraph(
+    //   'native',
+    //   605908369259172,
+    //   NULL,
+    //   1,
+    //   NULL,
+    //   NULL
+    // )`
+    // then row.ts == 605908369259172, for all rows
+    // This is not accurate. However, at present there is no other
+    // straightforward way of assigning timestamps to non-leaf nodes in the
+    // flamegraph tree. Non-leaf nodes would have to be assigned >= 1
+    // timestamps, which would increase data size without an advantage.
+    row.ts = values[i].ts.value_or(default_timestamp);
+    if (upid) {
+      row.upid = *upid;
+    }
+    row.upid_group = upid_group_id;
+    row.profile_type = profile_type;
+    row.name = node.name;
+    row.map_name = node.map_name;
+    row.source_file = node.source_file;
+    row.line_number = node.line_number;
+
+    row.size = values[i].size;
+    row.count = values[i].count;
+    row.alloc_size = values[i].alloc_size;
+    row.alloc_count = values[i].alloc_count;
+    row.cumulative_size = cumulative[i].size;
+    row.cumulative_count = cumulative[i].count;
+    row.cumulative_alloc_size = cumulative[i].alloc_size;
+    row.cumulative_alloc_count = cumulative[i].alloc_count;
+    ids.push_back(tbl->Insert(row).id);
+  }
+  return tbl;
+}
+
+}  // namespace
+
+void MergedCallsiteTree::BuildIfNeeded(TraceStorage* storage) {
+  const tables::StackProfileCallsiteTable& callsites_tbl =
+      storage->stack_profile_callsite_table();
+  std::array<uint32_t, 4> row_counts{
+      callsites_tbl.row_count(),
+      storage->stack_profile_frame_table().row_count(),
+      storage->symbol_table().row_count(),
+      storage->stack_profile_mapping_table().row_count(),
+  };
+  if (built_row_counts_ == row_counts) {
+    return;
+  }
+
+  nodes_.clear();
+  callsite_to_node_.assign(callsites_tbl.row_count(), 0);
+  std::map<MergedCallsite, uint32_t> merged_callsites_to_node;
 
   // FORWARD PASS:
   // Aggregate callstacks by frame name / mapping name. Use symbolization
@@ -131,199 +216,37 @@ static FlamegraphTableAndMergedCallsites BuildFlamegraphTableTreeStructure(
       parent_idx = callsites_tbl.id().IndexOf(*opt_parent_id);
       // Make sure what we index into has been populated already.
       PERFETTO_CHECK(*parent_idx < i);
-      parent_idx = callsite_to_merged_callsite[*parent_idx];
+      parent_idx = callsite_to_node_[*parent_idx];
     }
 
     auto callsites = GetMergedCallsites(storage, i);
     // Loop below needs to run at least once for parent_idx to get updated.
     PERFETTO_CHECK(!callsites.empty());
-    std::map<MergedCallsite, uint32_t> callsites_to_rowid;
     for (MergedCallsite& merged_callsite : callsites) {
       merged_callsite.parent_idx = parent_idx;
-      auto it = merged_callsites_to_table_idx.find(merged_callsite);
-      if (it == merged_callsites_to_table_idx.end()) {
-        std::tie(it, std::ignore) = merged_callsites_to_table_idx.emplace(
-            merged_callsite, merged_callsites_to_table_idx.size());
-        tables::ExperimentalFlamegraphTable::Row row{};
-        if (parent_idx) {
-          row.depth = tbl->depth()[*parent_idx] + 1;
-          row.parent_id = tbl->id()[*parent_idx];
-        } else {
-          row.depth = 0;
-          row.parent_id = std::nullopt;
-        }
-
-        // The 'ts' column is given a default value, taken from the query.
-        // So if the query is:
-        // `select * from experimental_flamegraph(
-        //   'native',
-        //   605908369259172,
-        //   NULL,
-        //   1,
-        //   NULL,
-        //   NULL
-        // )`
-        // then row.ts == 605908369259172, for all rows
-        // This is not accurate. However, at present there is no other
-        // straightforward way of assigning timestamps to non-leaf nodes in the
-        // flamegraph tree. Non-leaf nodes would have to be assigned >= 1
-        // timestamps, which would increase data size without an advantage.
-        row.ts = default_timestamp;
-        if (upid) {
-          row.upid = *upid;
-        }
-        if (upid_group) {
-          row.upid_group = storage->InternString(base::StringView(*upid_group));
-        }
-        row.profile_type = profile_type;
-        row.name = merged_callsite.frame_name;
-        row.map_name = merged_callsite.mapping_name;
-        tbl->Insert(row);
-        callsites_to_rowid[merged_callsite] =
-            static_cast<uint32_t>(merged_callsites_to_table_idx.size() - 1);
-
-        PERFETTO_CHECK(merged_callsites_to_table_idx.size() ==
-                       tbl->row_count());
-      } else {
-        MergedCallsite saved_callsite = it->first;
-        callsites_to_rowid.erase(saved_callsite);
-        if (saved_callsite.source_file != merged_callsite.source_file) {
-          saved_callsite.source_file = std::nullopt;
-        }
-        if (saved_callsite.line_number != merged_callsite.line_number) {
-          saved_callsite.line_number = std::nullopt;
-        }
-        callsites_to_rowid[saved_callsite] = it->second;
+      auto [it, inserted] = merged_callsites_to_node.emplace(
+          merged_callsite, static_cast<uint32_t>(nodes_.size()));
+      if (inserted) {
+        // The source location of a node is the one of the first callsite
+        // merged into it.
+        uint32_t depth = parent_idx ? nodes_[*parent_idx].depth + 1 : 0;
+        nodes_.push_back(Node{merged_callsite.frame_name,
+                              merged_callsite.mapping_name,
+                              merged_callsite.source_file,
+                              merged_callsite.line_number, parent_idx, depth});
       }
       parent_idx = it->second;
     }
 
-    for (const auto& it : callsites_to_rowid) {
-      if (it.first.source_file) {
-        tbl->mutable_source_file()->Set(it.second, *it.first.source_file);
-      }
-      if (it.first.line_number) {
-        tbl->mutable_line_number()->Set(it.second, *it.first.line_number);
-      }
-    }
-
     PERFETTO_CHECK(parent_idx);
-    callsite_to_merged_callsite[i] = *parent_idx;
+    callsite_to_node_[i] = *parent_idx;
   }
-
-  return {std::move(tbl), callsite_to_merged_callsite};
-}
-
-static std::unique_ptr<tables::ExperimentalFlamegraphTable>
-BuildFlamegraphTableHeapSizeAndCount(
-    std::unique_ptr<tables::ExperimentalFlamegraphTable> tbl,
-    const std::vector<uint32_t>& callsite_to_merged_callsite,
-    tables::HeapProfileAllocationTable::ConstIterator it) {
-  for (; it; ++it) {
-    int64_t size = it.size();
-    int64_t count = it.count();
-    tables::StackProfileCallsiteTable::Id callsite_id = it.callsite_id();
-
-    PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
-    uint32_t merged_idx = callsite_to_merged_callsite[callsite_id.value];
-    // On old heapprofd producers, the count field is incorrectly set and we
-    // zero it in proto_trace_parser.cc.
-    // As such, we cannot depend on count == 0 to imply size == 0, so we check
-    // for both of them separately.
-    if (size > 0) {
-      tbl->mutable_alloc_size()->Set(merged_idx,
-                                     tbl->alloc_size()[merged_idx] + size);
-    }
-    if (count > 0) {
-      tbl->mutable_alloc_count()->Set(merged_idx,
-                                      tbl->alloc_count()[merged_idx] + count);
-    }
-
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + size);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + count);
-  }
-
-  // BACKWARD PASS:
-  // Propagate sizes to parents.
-  for (int64_t i = tbl->row_count() - 1; i >= 0; --i) {
-    auto idx = static_cast<uint32_t>(i);
-
-    tbl->mutable_cumulative_size()->Set(
-        idx, tbl->cumulative_size()[idx] + tbl->size()[idx]);
-    tbl->mutable_cumulative_count()->Set(
-        idx, tbl->cumulative_count()[idx] + tbl->count()[idx]);
-
-    tbl->mutable_cumulative_alloc_size()->Set(
-        idx, tbl->cumulative_alloc_size()[idx] + tbl->alloc_size()[idx]);
-    tbl->mutable_cumulative_alloc_count()->Set(
-        idx, tbl->cumulative_alloc_count()[idx] + tbl->alloc_count()[idx]);
-
-    auto parent = tbl->parent_id()[idx];
-    if (parent) {
-      uint32_t parent_idx =
-          *tbl->id().IndexOf(tables::ExperimentalFlamegraphTable::Id(*parent));
-      tbl->mutable_cumulative_size()->Set(
-          parent_idx,
-          tbl->cumulative_size()[parent_idx] + tbl->cumulative_size()[idx]);
-      tbl->mutable_cumulative_count()->Set(
-          parent_idx,
-          tbl->cumulative_count()[parent_idx] + tbl->cumulative_count()[idx]);
-
-      tbl->mutable_cumulative_alloc_size()->Set(
-          parent_idx, tbl->cumulative_alloc_size()[parent_idx] +
-                          tbl->cumulative_alloc_size()[idx]);
-      tbl->mutable_cumulative_alloc_count()->Set(
-          parent_idx, tbl->cumulative_alloc_count()[parent_idx] +
-                          tbl->cumulative_alloc_count()[idx]);
-    }
-  }
-
-  return tbl;
-}
-
-static std::unique_ptr<tables::ExperimentalFlamegraphTable>
-BuildFlamegraphTableCallstackSizeAndCount(
-    std::unique_ptr<tables::ExperimentalFlamegraphTable> tbl,
-    const std::vector<uint32_t>& callsite_to_merged_callsite,
-    Table::Iterator it) {
-  for (; it; ++it) {
-    int64_t callsite_id =
-        it.Get(tables::PerfSampleTable::ColumnIndex::callsite_id).long_value;
-    int64_t ts = it.Get(tables::PerfSampleTable::ColumnIndex::ts).long_value;
-    uint32_t merged_idx =
-        callsite_to_merged_callsite[static_cast<uint32_t>(callsite_id)];
-    tbl->mutable_size()->Set(merged_idx, tbl->size()[merged_idx] + 1);
-    tbl->mutable_count()->Set(merged_idx, tbl->count()[merged_idx] + 1);
-    tbl->mutable_ts()->Set(merged_idx, ts);
-  }
-
-  // BACKWARD PASS:
-  // Propagate sizes to parents.
-  for (int64_t i = tbl->row_count() - 1; i >= 0; --i) {
-    auto idx = static_cast<uint32_t>(i);
-
-    tbl->mutable_cumulative_size()->Set(
-        idx, tbl->cumulative_size()[idx] + tbl->size()[idx]);
-    tbl->mutable_cumulative_count()->Set(
-        idx, tbl->cumulative_count()[idx] + tbl->count()[idx]);
-
-    auto parent = tbl->parent_id()[idx];
-    if (parent) {
-      uint32_t parent_idx =
-          *tbl->id().IndexOf(tables::ExperimentalFlamegraphTable::Id(*parent));
-      tbl->mutable_cumulative_size()->Set(
-          parent_idx,
-          tbl->cumulative_size()[parent_idx] + tbl->cumulative_size()[idx]);
-      tbl->mutable_cumulative_count()->Set(
-          parent_idx,
-          tbl->cumulative_count()[parent_idx] + tbl->cumulative_count()[idx]);
-    }
-  }
-  return tbl;
+  built_row_counts_ = row_counts;
 }
 
 std::unique_ptr<tables::ExperimentalFlamegraphTable> BuildHeapProfileFlamegraph(
     TraceStorage* storage,
+    MergedCallsiteTree* callsite_tree,
     UniquePid upid,
     int64_t timestamp) {
   const tables::HeapProfileAllocationTable& allocation_tbl =
@@ -337,18 +260,38 @@ std::unique_ptr<tables::ExperimentalFlamegraphTable> BuildHeapProfileFlamegraph(
   if (!it) {
     return nullptr;
   }
-  StringId profile_type = storage->InternString("native");
-  FlamegraphTableAndMergedCallsites table_and_callsites =
-      BuildFlamegraphTableTreeStructure(storage, upid, std::nullopt, timestamp,
-                                        profile_type);
-  return BuildFlamegraphTableHeapSizeAndCount(
-      std::move(table_and_callsites.tbl),
-      table_and_callsites.callsite_to_merged_callsite, std::move(it));
+  callsite_tree->BuildIfNeeded(storage);
+  std::vector<NodeValues> values(callsite_tree->nodes().size());
+  for (; it; ++it) {
+    int64_t size = it.size();
+    int64_t count = it.count();
+    tables::StackProfileCallsiteTable::Id callsite_id = it.callsite_id();
+
+    PERFETTO_CHECK((size <= 0 && count <= 0) || (size >= 0 && count >= 0));
+    NodeValues& node =
+        values[callsite_tree->NodeForCallsiteRow(callsite_id.value)];
+    // On old heapprofd producers, the count field is incorrectly set and we
+    // zero it in proto_trace_parser.cc.
+    // As such, we cannot depend on count == 0 to imply size == 0, so we check
+    // for both of them separately.
+    if (size > 0) {
+      node.alloc_size += size;
+    }
+    if (count > 0) {
+      node.alloc_count += count;
+    }
+    node.size += size;
+    node.count += count;
+  }
+  return BuildFlamegraphTable(storage, *callsite_tree, values, upid,
+                              std::nullopt, timestamp,
+                              storage->InternString("native"));
 }
 
 std::unique_ptr<tables::ExperimentalFlamegraphTable>
 BuildNativeCallStackSamplingFlamegraph(
     TraceStorage* storage,
+    MergedCallsiteTree* callsite_tree,
     std::optional<UniquePid> upid,
     std::optional<std::string> upid_group,
     const std::vector<TimeConstraints>& time_constraints) {
@@ -425,16 +368,20 @@ BuildNativeCallStackSamplingFlamegraph(
     }
   }
 
-  // 4. Build the flamegraph structure.
-  FlamegraphTableAndMergedCallsites table_and_callsites =
-      BuildFlamegraphTableTreeStructure(storage, upid, upid_group,
-                                        default_timestamp,
-                                        storage->InternString("perf"));
-  return BuildFlamegraphTableCallstackSizeAndCount(
-      std::move(table_and_callsites.tbl),
-      table_and_callsites.callsite_to_merged_callsite,
-      storage->perf_sample_table().ApplyAndIterateRows(
-          RowMap(std::move(cs_rows))));
+  // 4. Aggregate the samples into the flamegraph structure.
+  callsite_tree->BuildIfNeeded(storage);
+  std::vector<NodeValues> values(callsite_tree->nodes().size());
+  const tables::PerfSampleTable& samples = storage->perf_sample_table();
+  for (uint32_t row : cs_rows) {
+    uint32_t callsite_row = samples.callsite_id()[row]->value;
+    NodeValues& node = values[callsite_tree->NodeForCallsiteRow(callsite_row)];
+    node.size++;
+    node.count++;
+    node.ts = samples.ts()[row];
+  }
+  return BuildFlamegraphTable(storage, *callsite_tree, values, upid,
+                              std::move(upid_group), default_timestamp,
+                              storage->InternString("perf"));
 }
 
 }  // namespace perfetto::trace_processor
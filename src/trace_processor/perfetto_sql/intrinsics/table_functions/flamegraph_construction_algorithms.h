@@ -17,6 +17,7 @@
 #ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_FLAMEGRAPH_CONSTRUCTION_ALGORITHMS_H_
 #define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_FLAMEGRAPH_CONSTRUCTION_ALGORITHMS_H_
 
+#include <array>
 #include <cstdint>
 #include <memory>
 #include <optional>
@@ -35,14 +36,53 @@ struct TimeConstraints {
   int64_t value;
 };
 
+// The callsites of all the profiles of a trace, merged by frame name and
+// mapping name (after expanding inlined frames using the symbolization data).
+//
+// The tree only depends on the callsite, frame, symbol and mapping tables so
+// it is built once and shared by all the flamegraphs built afterwards. It is
+// rebuilt if rows were added to these tables since it was built.
+class MergedCallsiteTree {
+ public:
+  struct Node {
+    StringId name;
+    StringId map_name;
+    std::optional<StringId> source_file;
+    std::optional<uint32_t> line_number;
+    // Always smaller than the index of the node itself.
+    std::optional<uint32_t> parent_idx;
+    uint32_t depth;
+  };
+
+  // Builds the tree for the current content of |storage| unless it was
+  // already built for it.
+  void BuildIfNeeded(TraceStorage* storage);
+
+  const std::vector<Node>& nodes() const { return nodes_; }
+
+  // Returns the index of the (leaf) node for the callsite at row |row|.
+  uint32_t NodeForCallsiteRow(uint32_t row) const {
+    return callsite_to_node_[row];
+  }
+
+ private:
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> callsite_to_node_;
+
+  // The row counts of the tables used to build the tree.
+  std::optional<std::array<uint32_t, 4>> built_row_counts_;
+};
+
 std::unique_ptr<tables::ExperimentalFlamegraphTable> BuildHeapProfileFlamegraph(
     TraceStorage* storage,
+    MergedCallsiteTree* callsite_tree,
     UniquePid upid,
     int64_t timestamp);
 
 std::unique_ptr<tables::ExperimentalFlamegraphTable>
 BuildNativeCallStackSamplingFlamegraph(
     TraceStorage* storage,
+    MergedCallsiteTree* callsite_tree,
     std::optional<UniquePid> upid,
     std::optional<std::string> upid_group,
     const std::vector<TimeConstraints>& time_constraints);
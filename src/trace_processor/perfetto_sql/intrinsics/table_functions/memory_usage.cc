@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/memory_usage.h"
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/column.h"
+#include "src/trace_processor/db/column_storage.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/tables_py.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/trace_processor_context.h"
+
+namespace perfetto::trace_processor {
+namespace tables {
+
+PerfettoMemoryUsageTable::~PerfettoMemoryUsageTable() = default;
+
+}  // namespace tables
+
+namespace {
+
+using MemoryUsageTable = tables::PerfettoMemoryUsageTable;
+
+class RowWriter {
+ public:
+  RowWriter(MemoryUsageTable* table, StringPool* pool)
+      : table_(table), pool_(pool) {}
+
+  void Add(const char* subsystem,
+           const std::string& name,
+           std::optional<std::string> column_name,
+           const char* kind,
+           uint64_t bytes) {
+    if (bytes == 0)
+      return;
+    MemoryUsageTable::Row row;
+    row.subsystem = pool_->InternString(subsystem);
+    row.name = pool_->InternString(base::StringView(name));
+    if (column_name)
+      row.column_name = pool_->InternString(base::StringView(*column_name));
+    row.kind = pool_->InternString(kind);
+    row.bytes = static_cast<int64_t>(bytes);
+    table_->Insert(row);
+  }
+
+ private:
+  MemoryUsageTable* table_;
+  StringPool* pool_;
+};
+
+void AddTables(const PerfettoSqlEngine& engine, RowWriter& writer) {
+  std::vector<PerfettoSqlEngine::RegisteredTable> tables =
+      engine.GetAllTables();
+
+  // Tables created with ExtendParent share the storage of the columns of
+  // their parent: visit tables with fewer columns first so that the storage
+  // is attributed to the parent, which always has fewer columns than its
+  // children.
+  std::stable_sort(tables.begin(), tables.end(),
+                   [](const PerfettoSqlEngine::RegisteredTable& a,
+                      const PerfettoSqlEngine::RegisteredTable& b) {
+                     return a.table->columns().size() <
+                            b.table->columns().size();
+                   });
+
+  std::unordered_set<const ColumnStorageBase*> seen_storage;
+  for (const auto& t : tables) {
+    const char* subsystem = t.is_runtime ? "perfetto_table" : "table";
+    for (const ColumnLegacy& col : t.table->columns()) {
+      if (col.IsId() || col.IsDummy())
+        continue;
+      const ColumnStorageBase& storage = col.storage_base();
+      if (!seen_storage.insert(&storage).second)
+        continue;
+      writer.Add(subsystem, t.name, col.name(), "storage",
+                 storage.memory_usage());
+    }
+    writer.Add(subsystem, t.name, std::nullopt, "overlays",
+               t.table->overlays_memory_usage());
+    writer.Add(subsystem, t.name, std::nullopt, "indexes",
+               t.table->indexes_memory_usage());
+  }
+}
+
+void AddSqlite(sqlite3* db, RowWriter& writer) {
+  struct Status {
+    int op;
+    const char* kind;
+  };
+  static constexpr Status kStatuses[] = {
+      {SQLITE_DBSTATUS_CACHE_USED, "page_cache"},
+      {SQLITE_DBSTATUS_SCHEMA_USED, "schema"},
+      {SQLITE_DBSTATUS_STMT_USED, "statements"},
+  };
+  for (const Status& status : kStatuses) {
+    int current = 0;
+    int highwater = 0;
+    if (sqlite3_db_status(db, status.op, &current, &highwater, 0) !=
+        SQLITE_OK) {
+      continue;
+    }
+    writer.Add("sqlite", "sqlite", std::nullopt, status.kind,
+               static_cast<uint64_t>(current));
+  }
+}
+
+}  // namespace
+
+MemoryUsage::MemoryUsage(TraceProcessorContext* context,
+                         PerfettoSqlEngine* engine)
+    : context_(context), engine_(engine) {}
+
+base::StatusOr<std::unique_ptr<Table>> MemoryUsage::ComputeTable(
+    const std::vector<SqlValue>& arguments) {
+  PERFETTO_CHECK(arguments.empty());
+  StringPool* pool = context_->storage->mutable_string_pool();
+
+  // Snapshot the string pool before writing to it below.
+  StringPool::MemoryUsage strings = pool->GetMemoryUsage();
+
+  auto table = std::make_unique<MemoryUsageTable>(pool);
+  RowWriter writer(table.get(), pool);
+
+  AddTables(*engine_, writer);
+
+  writer.Add("string_pool", "string_pool", std::nullopt, "small_strings",
+             strings.small_strings);
+  writer.Add("string_pool", "string_pool", std::nullopt, "large_strings",
+             strings.large_strings);
+  writer.Add("string_pool", "string_pool", std::nullopt, "index",
+             strings.index);
+
+  if (context_->sorter) {
+    writer.Add("sorter", "sorter", std::nullopt, "queues",
+               context_->sorter->memory_usage());
+  }
+
+  writer.Add("trace_blobs", "trace_blobs", std::nullopt, "heap",
+             TraceBlob::heap_bytes_in_use());
+  writer.Add("trace_blobs", "trace_blobs", std::nullopt, "mmap",
+             TraceBlob::mmap_bytes_in_use());
+
+  AddSqlite(engine_->sqlite_engine()->db(), writer);
+
+  return std::unique_ptr<Table>(std::move(table));
+}
+
+Table::Schema MemoryUsage::CreateSchema() {
+  return MemoryUsageTable::ComputeStaticSchema();
+}
+
+std::string MemoryUsage::TableName() {
+  return MemoryUsageTable::Name();
+}
+
+uint32_t MemoryUsage::EstimateRowCount() {
+  // A few rows for each column of each table.
+  return 4096;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_MEMORY_USAGE_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_MEMORY_USAGE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
+
+namespace perfetto::trace_processor {
+
+class PerfettoSqlEngine;
+class TraceProcessorContext;
+
+// Reports the memory used by trace processor, broken down by subsystem, e.g.
+//   SELECT name, SUM(bytes) AS bytes
+//   FROM perfetto_memory_usage()
+//   WHERE subsystem = 'table'
+//   GROUP BY name ORDER BY bytes DESC;
+// The following subsystems are reported:
+//  * table/perfetto_table: the storage of each column of the static and
+//    PERFETTO tables, the overlays of each table and its indexes. Columns
+//    shared with a parent table are only reported in the parent.
+//  * string_pool: small and large strings, the deduplication index.
+//  * sorter: the events buffered by the sorter, waiting to be parsed.
+//  * trace_blobs: the trace data retained (e.g. by the sorter or the
+//    tokenizers), on the heap or memory-mapped. This is process-wide.
+//  * sqlite: the page cache, the schema and the prepared statements.
+// Only allocations which are not empty are reported.
+class MemoryUsage : public StaticTableFunction {
+ public:
+  MemoryUsage(TraceProcessorContext*, PerfettoSqlEngine*);
+
+  Table::Schema CreateSchema() override;
+  std::string TableName() override;
+  uint32_t EstimateRowCount() override;
+  base::StatusOr<std::unique_ptr<Table>> ComputeTable(
+      const std::vector<SqlValue>& arguments) override;
+
+ private:
+  TraceProcessorContext* context_ = nullptr;
+  PerfettoSqlEngine* engine_ = nullptr;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_MEMORY_USAGE_H_
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "src/trace_processor/tables/slice_tables_py.h"
+
+namespace perfetto::trace_processor {
+
+SliceTreeIndex::SliceTreeIndex(const tables::SliceTable* slices)
+    : slices_(slices) {}
+
+base::Status SliceTreeIndex::GetDescendants(
+    tables::SliceTable::Id slice_id,
+    std::vector<tables::SliceTable::RowNumber>& out) {
+  std::optional<uint32_t> row = slices_->id().IndexOf(slice_id);
+  if (!row) {
+    return base::ErrStatus("no row with id %" PRIu32 "", slice_id.value);
+  }
+  BuildIfNeeded();
+
+  uint32_t start = preorder_positions_[*row] + 1;
+  uint32_t end = preorder_positions_[*row] + subtree_sizes_[*row];
+  size_t first = out.size();
+  for (uint32_t pos = start; pos < end; ++pos) {
+    out.emplace_back(preorder_rows_[pos]);
+  }
+  std::sort(out.begin() + static_cast<std::ptrdiff_t>(first), out.end());
+  return base::OkStatus();
+}
+
+void SliceTreeIndex::BuildIfNeeded() {
+  uint32_t row_count = slices_->row_count();
+  if (row_count == indexed_row_count_) {
+    return;
+  }
+
+  // Parents are usually inserted before their children but not always (e.g.
+  // slices whose parent_id was set after they were inserted): the trees are
+  // traversed explicitly rather than relying on the row order.
+  std::vector<std::optional<uint32_t>> parents(row_count);
+  std::vector<uint32_t> child_offsets(row_count + 1);
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (std::optional<tables::SliceTable::Id> parent_id = slices_->parent_id()[i];
+        parent_id) {
+      // Slices whose parent does not exist are treated as roots.
+      parents[i] = slices_->id().IndexOf(*parent_id);
+      if (parents[i]) {
+        child_offsets[*parents[i] + 1]++;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < row_count; ++i) {
+    child_offsets[i + 1] += child_offsets[i];
+  }
+  std::vector<uint32_t> children(child_offsets[row_count]);
+  std::vector<uint32_t> next_child(child_offsets.begin(),
+                                   child_offsets.end() - 1);
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (parents[i]) {
+      children[next_child[*parents[i]]++] = i;
+    }
+  }
+
+  // Depth-first traversal of the trees, each one starting at a root (or, for
+  // rows in a parent_id cycle, at the first row of the cycle). Children are
+  // visited in row order.
+  static constexpr uint32_t kUnvisited = std::numeric_limits<uint32_t>::max();
+  preorder_positions_.assign(row_count, kUnvisited);
+  preorder_rows_.resize(row_count);
+  uint32_t next_position = 0;
+  std::vector<uint32_t> stack;
+  auto traverse = [&](uint32_t root) {
+    stack.push_back(root);
+    while (!stack.empty()) {
+      uint32_t row = stack.back();
+      stack.pop_back();
+      preorder_positions_[row] = next_position;
+      preorder_rows_[next_position++] = row;
+      for (uint32_t c = child_offsets[row + 1]; c-- > child_offsets[row];) {
+        if (preorder_positions_[children[c]] == kUnvisited) {
+          stack.push_back(children[c]);
+        }
+      }
+    }
+  };
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (!parents[i]) {
+      traverse(i);
+    }
+  }
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (preorder_positions_[i] == kUnvisited) {
+      parents[i] = std::nullopt;
+      traverse(i);
+    }
+  }
+
+  // Subtree sizes are accumulated in reverse preorder (i.e. children before
+  // their parent).
+  subtree_sizes_.assign(row_count, 1);
+  for (uint32_t pos = row_count; pos-- > 0;) {
+    uint32_t row = preorder_rows_[pos];
+    if (parents[row]) {
+      subtree_sizes_[*parents[row]] += subtree_sizes_[row];
+    }
+  }
+  indexed_row_count_ = row_count;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_SLICE_TREE_INDEX_H_
+#define SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_SLICE_TREE_INDEX_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "src/trace_processor/tables/slice_tables_py.h"
+
+namespace perfetto::trace_processor {
+
+// Index of the trees formed by the slices of a slice table through their
+// |parent_id|.
+//
+// The slices are numbered in the preorder of a depth-first traversal of the
+// trees: the descendants of any slice are then the slices whose number is in
+// a contiguous range following the number of the slice. This makes computing
+// the descendants of a slice proportional to their number rather than to the
+// number of slices overlapping with it.
+//
+// The index is built on first use, in time linear in the number of slices,
+// and rebuilt if slices were added to the table since it was built.
+class SliceTreeIndex {
+ public:
+  explicit SliceTreeIndex(const tables::SliceTable*);
+
+  // Appends the row numbers of the descendants of |slice_id| to |out|, in row
+  // order. Returns an error if there is no slice with this id.
+  base::Status GetDescendants(tables::SliceTable::Id slice_id,
+                              std::vector<tables::SliceTable::RowNumber>& out);
+
+ private:
+  void BuildIfNeeded();
+
+  const tables::SliceTable* slices_ = nullptr;
+  uint32_t indexed_row_count_ = 0;
+
+  // The row of the slice at each position of the preorder.
+  std::vector<uint32_t> preorder_rows_;
+  // The position in the preorder of each row and the number of slices in the
+  // subtree rooted at each row (including itself).
+  std::vector<uint32_t> preorder_positions_;
+  std::vector<uint32_t> subtree_sizes_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_PERFETTO_SQL_INTRINSICS_TABLE_FUNCTIONS_SLICE_TREE_INDEX_H_
@@ -42,6 +42,18 @@ TABLE_INFO_TABLE = Table(
         C('sorted', CppInt64()),
     ])
 
+MEMORY_USAGE_TABLE = Table(
+    python_module=__file__,
+    class_name="PerfettoMemoryUsageTable",
+    sql_name="perfetto_memory_usage",
+    columns=[
+        C('subsystem', CppString()),
+        C('name', CppString()),
+        C('column_name', CppOptional(CppString())),
+        C('kind', CppString()),
+        C('bytes', CppInt64()),
+    ])
+
 ANCESTOR_SLICE_TABLE = Table(
     python_module=__file__,
     class_name="AncestorSliceTable",
@@ -195,6 +207,22 @@ DFS_WEIGHT_BOUNDED_TABLE = Table(
           flags=ColumnFlag.HIDDEN),
     ])
 
+WINSCOPE_PROTO_TO_ARGS_TABLE = Table(
+    python_module=__file__,
+    class_name="WinscopeProtoToArgsTable",
+    sql_name="winscope_proto_to_args",
+    columns=[
+        C("flat_key", CppString()),
+        C("key", CppString()),
+        C("int_value", CppOptional(CppInt64())),
+        C("string_value", CppOptional(CppString())),
+        C("real_value", CppOptional(CppDouble())),
+        C("value_type", CppString()),
+        C("display_value", CppOptional(CppString())),
+        C("in_table_name", CppOptional(CppString()), flags=ColumnFlag.HIDDEN),
+        C("in_id", CppOptional(CppUint32()), flags=ColumnFlag.HIDDEN),
+    ])
+
 # Keep this list sorted.
 ALL_TABLES = [
     ANCESTOR_SLICE_BY_STACK_TABLE,
@@ -210,5 +238,7 @@ ALL_TABLES = [
     EXPERIMENTAL_SCHED_UPID_TABLE,
     EXPERIMENTAL_SLICE_LAYOUT_TABLE,
     INTERVAL_INTERSECT_TABLE,
+    MEMORY_USAGE_TABLE,
     TABLE_INFO_TABLE,
+    WINSCOPE_PROTO_TO_ARGS_TABLE,
 ]
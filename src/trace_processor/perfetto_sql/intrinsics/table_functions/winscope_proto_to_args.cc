@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/winscope_proto_to_args.h"
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/containers/string_pool.h"
+#include "src/trace_processor/db/table.h"
+#include "src/trace_processor/importers/proto/winscope/winscope.descriptor.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/tables_py.h"
+#include "src/trace_processor/storage/stats.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "src/trace_processor/types/variadic.h"
+#include "src/trace_processor/util/proto_to_args_parser.h"
+
+namespace perfetto::trace_processor {
+namespace tables {
+
+WinscopeProtoToArgsTable::~WinscopeProtoToArgsTable() = default;
+
+}  // namespace tables
+
+namespace {
+
+using ArgsTable = tables::WinscopeProtoToArgsTable;
+
+constexpr char kLayerProtoName[] = ".perfetto.protos.LayerProto";
+constexpr char kTransactionTraceEntryProtoName[] =
+    ".perfetto.protos.TransactionTraceEntry";
+
+// Formats |value| the way SQLite casts a REAL to text so that display_value
+// matches the one of the args view.
+std::string RealToDisplayString(double value) {
+  base::StackString<32> str("%.15g", value);
+  std::string result = str.ToStdString();
+  if (result.find_first_of(".eni") == std::string::npos)
+    result += ".0";
+  return result;
+}
+
+// Appends one row to |table| for each arg produced by ProtoToArgsParser,
+// mirroring how the args would have been stored in the args table.
+class RowWriter : public util::ProtoToArgsParser::Delegate {
+ public:
+  using Key = util::ProtoToArgsParser::Key;
+
+  RowWriter(ArgsTable* table, TraceStorage* storage, ArgsTable::Row base_row)
+      : table_(table), storage_(storage), base_row_(base_row) {}
+
+  void AddInteger(const Key& key, int64_t value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kInt);
+    row.int_value = value;
+    row.display_value = Intern(std::to_string(value));
+    table_->Insert(row);
+  }
+
+  void AddUnsignedInteger(const Key& key, uint64_t value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kUint);
+    row.int_value = static_cast<int64_t>(value);
+    row.display_value = Intern(std::to_string(*row.int_value));
+    table_->Insert(row);
+  }
+
+  void AddString(const Key& key, const protozero::ConstChars& value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kString);
+    row.string_value = storage_->InternString(value);
+    row.display_value = row.string_value;
+    table_->Insert(row);
+  }
+
+  void AddString(const Key& key, const std::string& value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kString);
+    row.string_value = Intern(value);
+    row.display_value = row.string_value;
+    table_->Insert(row);
+  }
+
+  void AddDouble(const Key& key, double value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kReal);
+    row.real_value = value;
+    row.display_value = Intern(RealToDisplayString(value));
+    table_->Insert(row);
+  }
+
+  void AddPointer(const Key& key, const void* value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kPointer);
+    auto ptr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value));
+    row.int_value = static_cast<int64_t>(ptr);
+    base::StackString<32> hex("0x%" PRIx64, ptr);
+    row.display_value = Intern(hex.ToStdString());
+    table_->Insert(row);
+  }
+
+  void AddBoolean(const Key& key, bool value) override {
+    ArgsTable::Row row = NewRow(key, Variadic::kBool);
+    row.int_value = value;
+    row.display_value = Intern(value ? "true" : "false");
+    table_->Insert(row);
+  }
+
+  bool AddJson(const Key&, const protozero::ConstChars&) override {
+    PERFETTO_FATAL("Unexpected JSON value when parsing SurfaceFlinger data");
+  }
+
+  void AddNull(const Key& key) override {
+    table_->Insert(NewRow(key, Variadic::kNull));
+  }
+
+  size_t GetArrayEntryIndex(const std::string& array_key) override {
+    return array_indexes_[array_key];
+  }
+
+  size_t IncrementArrayEntryIndex(const std::string& array_key) override {
+    return ++array_indexes_[array_key];
+  }
+
+  PacketSequenceStateGeneration* seq_state() override { return nullptr; }
+
+ protected:
+  InternedMessageView* GetInternedMessageView(uint32_t, uint64_t) override {
+    return nullptr;
+  }
+
+ private:
+  ArgsTable::Row NewRow(const Key& key, Variadic::Type type) {
+    ArgsTable::Row row = base_row_;
+    row.flat_key = Intern(key.flat_key);
+    row.key = Intern(key.key);
+    row.value_type = storage_->GetIdForVariadicType(type);
+    return row;
+  }
+
+  StringPool::Id Intern(const std::string& str) {
+    return storage_->InternString(base::StringView(str));
+  }
+
+  ArgsTable* table_;
+  TraceStorage* storage_;
+  ArgsTable::Row base_row_;
+  base::FlatHashMap<std::string, size_t> array_indexes_;
+};
+
+}  // namespace
+
+WinscopeProtoToArgs::WinscopeProtoToArgs(TraceStorage* storage)
+    : storage_(storage), args_parser_(pool_) {
+  pool_.AddFromFileDescriptorSet(kWinscopeDescriptor.data(),
+                                 kWinscopeDescriptor.size());
+}
+
+WinscopeProtoToArgs::~WinscopeProtoToArgs() = default;
+
+base::StatusOr<std::unique_ptr<Table>> WinscopeProtoToArgs::ComputeTable(
+    const std::vector<SqlValue>& arguments) {
+  PERFETTO_CHECK(arguments.size() == 2);
+  if (arguments[0].type != SqlValue::kString ||
+      arguments[1].type != SqlValue::kLong) {
+    return base::ErrStatus(
+        "winscope_proto_to_args takes a table name and a row id.");
+  }
+  std::string table_name = arguments[0].AsString();
+  int64_t id = arguments[1].AsLong();
+
+  std::optional<uint32_t> proto_index;
+  const char* proto_name = nullptr;
+  size_t parse_error_stat = 0;
+  if (table_name == "surfaceflinger_layer") {
+    const auto& layers = storage_->surfaceflinger_layer_table();
+    if (id >= 0 && id < layers.row_count()) {
+      proto_index = layers.proto_index()[static_cast<uint32_t>(id)];
+    }
+    proto_name = kLayerProtoName;
+    parse_error_stat = stats::winscope_sf_layers_parse_errors;
+  } else if (table_name == "surfaceflinger_transactions") {
+    const auto& transactions = storage_->surfaceflinger_transactions_table();
+    if (id >= 0 && id < transactions.row_count()) {
+      proto_index = transactions.proto_index()[static_cast<uint32_t>(id)];
+    }
+    proto_name = kTransactionTraceEntryProtoName;
+    parse_error_stat = stats::winscope_sf_transactions_parse_errors;
+  } else {
+    return base::ErrStatus(
+        "winscope_proto_to_args: table '%s' has no retained protos.",
+        table_name.c_str());
+  }
+
+  auto table = std::make_unique<ArgsTable>(storage_->mutable_string_pool());
+  if (!proto_index) {
+    return std::unique_ptr<Table>(std::move(table));
+  }
+
+  ArgsTable::Row base_row;
+  base_row.in_table_name = storage_->InternString(base::StringView(table_name));
+  base_row.in_id = static_cast<uint32_t>(id);
+  RowWriter writer(table.get(), storage_, base_row);
+  protozero::ConstBytes blob = storage_->winscope_protos().Get(*proto_index);
+  base::Status status = args_parser_.ParseMessage(
+      blob, proto_name, nullptr /* parse all fields */, writer);
+  if (!status.ok()) {
+    // As when the args were parsed at import time, keep whatever was decoded
+    // before the error.
+    storage_->IncrementStats(parse_error_stat);
+  }
+  return std::unique_ptr<Table>(std::move(table));
+}
+
+Table::Schema WinscopeProtoToArgs::CreateSchema() {
+  return ArgsTable::ComputeStaticSchema();
+}
+
+std::string WinscopeProtoToArgs::TableName() {
+  return ArgsTable::Name();
+}
+
+uint32_t WinscopeProtoToArgs::EstimateRowCount() {
+  // A single layer or transaction usually expands to a few dozen args.
+  return 64;
+}
+
+}  // namespace perfetto::trace_processor
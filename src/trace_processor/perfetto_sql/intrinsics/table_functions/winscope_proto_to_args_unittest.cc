@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/winscope_proto_to_args.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/tables_py.h"
+#include "src/trace_processor/storage/trace_storage.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/android/surfaceflinger_layers.pbzero.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+using ::testing::Pair;
+
+class WinscopeProtoToArgsTest : public ::testing::Test {
+ protected:
+  void AddLayer(int32_t id, const char* name, std::vector<int32_t> children) {
+    protozero::HeapBuffered<protos::pbzero::LayerProto> layer;
+    layer->set_id(id);
+    layer->set_name(name);
+    protozero::PackedVarInt packed;
+    for (int32_t child : children)
+      packed.Append(child);
+    layer->set_children(packed);
+    std::vector<uint8_t> blob = layer.SerializeAsArray();
+
+    tables::SurfaceFlingerLayerTable::Row row;
+    row.proto_index = storage_.mutable_winscope_protos()->Append(
+        protozero::ConstBytes{blob.data(), blob.size()});
+    storage_.mutable_surfaceflinger_layer_table()->Insert(row);
+  }
+
+  // Returns the display value of each arg of |id|, keyed by arg key.
+  std::map<std::string, std::string> Args(const char* table_name, int64_t id) {
+    auto table = function_.ComputeTable(
+        {SqlValue::String(table_name), SqlValue::Long(id)});
+    EXPECT_TRUE(table.ok());
+    std::map<std::string, std::string> args;
+    const auto& result =
+        static_cast<const tables::WinscopeProtoToArgsTable&>(**table);
+    for (auto it = result.IterateRows(); it; ++it) {
+      args[storage_.GetString(it.key()).ToStdString()] =
+          storage_.GetString(*it.display_value()).ToStdString();
+    }
+    return args;
+  }
+
+  TraceStorage storage_;
+  WinscopeProtoToArgs function_{&storage_};
+};
+
+TEST_F(WinscopeProtoToArgsTest, DecodesRequestedLayerOnly) {
+  AddLayer(1, "Wallpaper", {});
+  AddLayer(2, "Display", {3, 4});
+
+  EXPECT_THAT(Args("surfaceflinger_layer", 1),
+              ElementsAre(Pair("children[0]", "3"), Pair("children[1]", "4"),
+                          Pair("id", "2"), Pair("name", "Display")));
+  EXPECT_THAT(Args("surfaceflinger_layer", 0),
+              ElementsAre(Pair("id", "1"), Pair("name", "Wallpaper")));
+}
+
+TEST_F(WinscopeProtoToArgsTest, UnknownRowIsEmpty) {
+  AddLayer(1, "Wallpaper", {});
+  EXPECT_TRUE(Args("surfaceflinger_layer", 1).empty());
+  EXPECT_TRUE(Args("surfaceflinger_transactions", 0).empty());
+}
+
+TEST_F(WinscopeProtoToArgsTest, UnsupportedTable) {
+  auto table = function_.ComputeTable(
+      {SqlValue::String("slice"), SqlValue::Long(0)});
+  EXPECT_FALSE(table.ok());
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
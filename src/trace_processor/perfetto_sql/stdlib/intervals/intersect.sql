@@ -51,3 +51,101 @@ CREATE PERFETTO MACRO _interval_intersect_single(
     )
   )
 )
+
+-- Intersects the intervals of |left_table| and |right_table| with the same
+-- value of |partition_column| (e.g. cpu or utid): partitions are intersected
+-- independently and in parallel.
+--
+-- Both tables should have |id|, |ts|, |dur| and |partition_column| columns
+-- and the intervals of each table should not overlap inside a partition.
+-- The result is sorted by (partition, ts).
+CREATE PERFETTO MACRO _interval_intersect_partitioned(
+  left_table TableOrSubquery,
+  right_table TableOrSubquery,
+  partition_column ColumnName
+)
+RETURNS TableOrSubquery AS
+(
+  SELECT c0 AS ts, c1 AS dur, c2 AS $partition_column, c3 AS left_id,
+    c4 AS right_id
+  FROM __intrinsic_table_ptr((
+    SELECT __intrinsic_interval_intersect_n(
+      input_idx, 2, id, ts, dur, partition_value)
+    FROM (
+      SELECT 0 AS input_idx, id, ts, dur, $partition_column AS partition_value
+      FROM $left_table
+      UNION ALL
+      SELECT 1, id, ts, dur, $partition_column
+      FROM $right_table
+    )
+  ))
+  WHERE __intrinsic_table_ptr_bind(c0, 'ts')
+    AND __intrinsic_table_ptr_bind(c1, 'dur')
+    AND __intrinsic_table_ptr_bind(c2, 'partition')
+    AND __intrinsic_table_ptr_bind(c3, 'id_0')
+    AND __intrinsic_table_ptr_bind(c4, 'id_1')
+);
+
+-- Intersects the intervals of three tables in a single pass.
+--
+-- All the tables should have |id|, |ts| and |dur| columns and the intervals of
+-- each table should not overlap. Each row of the result is an interval where
+-- one interval of each table overlaps, with the ids of those intervals in
+-- |id_0|, |id_1| and |id_2|. The result is sorted by ts.
+CREATE PERFETTO MACRO _interval_intersect_3(
+  t0 TableOrSubquery,
+  t1 TableOrSubquery,
+  t2 TableOrSubquery
+)
+RETURNS TableOrSubquery AS
+(
+  SELECT c0 AS ts, c1 AS dur, c2 AS id_0, c3 AS id_1, c4 AS id_2
+  FROM __intrinsic_table_ptr((
+    SELECT __intrinsic_interval_intersect_n(input_idx, 3, id, ts, dur, NULL)
+    FROM (
+      SELECT 0 AS input_idx, id, ts, dur FROM $t0
+      UNION ALL
+      SELECT 1, id, ts, dur FROM $t1
+      UNION ALL
+      SELECT 2, id, ts, dur FROM $t2
+    )
+  ))
+  WHERE __intrinsic_table_ptr_bind(c0, 'ts')
+    AND __intrinsic_table_ptr_bind(c1, 'dur')
+    AND __intrinsic_table_ptr_bind(c2, 'id_0')
+    AND __intrinsic_table_ptr_bind(c3, 'id_1')
+    AND __intrinsic_table_ptr_bind(c4, 'id_2')
+);
+
+-- Same as |_interval_intersect_3| but only intersects intervals with the same
+-- value of |partition_column| (e.g. cpu or utid): partitions are intersected
+-- independently and in parallel. The result is sorted by (partition, ts).
+CREATE PERFETTO MACRO _interval_intersect_3_partitioned(
+  t0 TableOrSubquery,
+  t1 TableOrSubquery,
+  t2 TableOrSubquery,
+  partition_column ColumnName
+)
+RETURNS TableOrSubquery AS
+(
+  SELECT c0 AS ts, c1 AS dur, c2 AS $partition_column, c3 AS id_0,
+    c4 AS id_1, c5 AS id_2
+  FROM __intrinsic_table_ptr((
+    SELECT __intrinsic_interval_intersect_n(
+      input_idx, 3, id, ts, dur, partition_value)
+    FROM (
+      SELECT 0 AS input_idx, id, ts, dur, $partition_column AS partition_value
+      FROM $t0
+      UNION ALL
+      SELECT 1, id, ts, dur, $partition_column FROM $t1
+      UNION ALL
+      SELECT 2, id, ts, dur, $partition_column FROM $t2
+    )
+  ))
+  WHERE __intrinsic_table_ptr_bind(c0, 'ts')
+    AND __intrinsic_table_ptr_bind(c1, 'dur')
+    AND __intrinsic_table_ptr_bind(c2, 'partition')
+    AND __intrinsic_table_ptr_bind(c3, 'id_0')
+    AND __intrinsic_table_ptr_bind(c4, 'id_1')
+    AND __intrinsic_table_ptr_bind(c5, 'id_2')
+);
@@ -37,4 +37,12 @@ SELECT end_ts FROM trace_bounds;
 CREATE PERFETTO FUNCTION trace_dur()
 -- Duration of the trace in nanoseconds.
 RETURNS LONG AS
-SELECT trace_end() - trace_start();
\ No newline at end of file
+SELECT trace_end() - trace_start();
+-- Fetch the timestamp up to which the trace has been ingested. While a trace
+-- is still being loaded incrementally (e.g. from a live tracing session), all
+-- the events older than this timestamp are in the tables; `trace_end()` is
+-- only updated once the trace is flushed or fully loaded.
+CREATE PERFETTO FUNCTION ingestion_watermark()
+-- Ingestion watermark in nanoseconds, NULL if no event was parsed yet.
+RETURNS LONG AS
+SELECT __intrinsic_ingestion_watermark();
@@ -16,10 +16,15 @@
 
 #include "perfetto/trace_processor/read_trace.h"
 
+#include <memory>
+#include <vector>
+
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
+#include "perfetto/protozero/field.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "perfetto/trace_processor/trace_processor.h"
 
@@ -31,6 +36,7 @@
 #include "src/trace_processor/read_trace_internal.h"
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/status_macros.h"
+#include "src/trace_processor/util/zstd_utils.h"
 
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -70,20 +76,87 @@ class SerializingProtoTraceReader : public ChunkedTraceReader {
   std::vector<uint8_t>* output_;
 };
 
+// Compressed packets are inflated in rounds of this many packets per thread,
+// which bounds the memory used by the inflated packets waiting to be
+// appended to the output.
+constexpr size_t kPacketsPerThread = 4;
+
+// A packet of the trace. If it is compressed, it's inflated into |inflated|.
+struct DecompressJob {
+  enum class Compression { kNone, kDeflate, kZstd };
+
+  protozero::Field packet;
+  Compression compression = Compression::kNone;
+  protozero::ConstBytes compressed{};
+  std::vector<uint8_t> inflated;
+  util::Status status;
+};
+
+void Inflate(DecompressJob* job) {
+  const protozero::ConstBytes& bytes = job->compressed;
+  if (job->compression == DecompressJob::Compression::kZstd) {
+    util::ZstdDecompressor decompressor;
+    job->status =
+        decompressor.DecompressFully(bytes.data, bytes.size, &job->inflated);
+    return;
+  }
+
+  util::GzipDecompressor decompressor;
+  using ResultCode = util::GzipDecompressor::ResultCode;
+  ResultCode ret = decompressor.FeedAndExtract(
+      bytes.data, bytes.size, [job](const uint8_t* buf, size_t buf_len) {
+        job->inflated.insert(job->inflated.end(), buf, buf + buf_len);
+      });
+  if (ret == ResultCode::kError || ret == ResultCode::kNeedsMoreInput) {
+    job->status = util::ErrStatus("Failed while decompressing stream");
+  }
+}
+
+// Inflates the compressed packets of |jobs| (on |pool| if not null) and then
+// appends all of them, in order, to |output|.
+util::Status FlushDecompressJobs(base::ThreadPool* pool,
+                                 std::vector<DecompressJob>* jobs,
+                                 std::vector<uint8_t>* output) {
+  std::vector<DecompressJob*> compressed;
+  for (DecompressJob& job : *jobs) {
+    if (job.compression != DecompressJob::Compression::kNone)
+      compressed.push_back(&job);
+  }
+  auto fn = [&compressed](size_t i) { Inflate(compressed[i]); };
+  if (pool && compressed.size() > 1) {
+    pool->ParallelFor(compressed.size(), fn);
+  } else {
+    for (size_t i = 0; i < compressed.size(); ++i)
+      fn(i);
+  }
+
+  for (DecompressJob& job : *jobs) {
+    if (job.compression == DecompressJob::Compression::kNone) {
+      job.packet.SerializeAndAppendTo(output);
+      continue;
+    }
+    RETURN_IF_ERROR(job.status);
+    output->insert(output->end(), job.inflated.begin(), job.inflated.end());
+  }
+  jobs->clear();
+  return util::OkStatus();
+}
+
 }  // namespace
 
 util::Status ReadTrace(
     TraceProcessor* tp,
     const char* filename,
     const std::function<void(uint64_t parsed_size)>& progress_callback) {
-  ReadTraceUnfinalized(tp, filename, progress_callback);
+  RETURN_IF_ERROR(ReadTraceUnfinalized(tp, filename, progress_callback));
   tp->NotifyEndOfFile();
   return util::OkStatus();
 }
 
 util::Status DecompressTrace(const uint8_t* data,
                              size_t size,
-                             std::vector<uint8_t>* output) {
+                             std::vector<uint8_t>* output,
+                             uint32_t thread_count) {
   TraceType type = GuessTraceType(data, size);
   if (type != TraceType::kGzipTraceType && type != TraceType::kProtoTraceType) {
     return util::ErrStatus(
@@ -105,30 +178,42 @@ util::Status DecompressTrace(const uint8_t* data,
 
   PERFETTO_CHECK(type == TraceType::kProtoTraceType);
 
+  if (thread_count == 0)
+    thread_count = base::ThreadPool::MaxConcurrency();
+
+  // The calling thread takes part in the work too.
+  std::unique_ptr<base::ThreadPool> pool;
+  if (thread_count > 1)
+    pool = std::make_unique<base::ThreadPool>(thread_count - 1);
+  const size_t max_compressed_jobs = thread_count * kPacketsPerThread;
+
   protos::pbzero::Trace::Decoder decoder(data, size);
-  util::GzipDecompressor decompressor;
   if (size > 0 && !decoder.packet()) {
     return util::ErrStatus("Trace does not contain valid packets");
   }
+  std::vector<DecompressJob> jobs;
+  size_t compressed_jobs = 0;
   for (auto it = decoder.packet(); it; ++it) {
     protos::pbzero::TracePacket::Decoder packet(*it);
-    if (!packet.has_compressed_packets()) {
-      it->SerializeAndAppendTo(output);
-      continue;
+    DecompressJob job;
+    job.packet = it.field();
+    if (packet.has_zstd_compressed_packets()) {
+      job.compression = DecompressJob::Compression::kZstd;
+      job.compressed = packet.zstd_compressed_packets();
+    } else if (packet.has_compressed_packets()) {
+      job.compression = DecompressJob::Compression::kDeflate;
+      job.compressed = packet.compressed_packets();
     }
+    if (job.compression != DecompressJob::Compression::kNone)
+      compressed_jobs++;
+    jobs.emplace_back(std::move(job));
 
-    // Make sure that to reset the stream between the gzip streams.
-    auto bytes = packet.compressed_packets();
-    decompressor.Reset();
-    using ResultCode = util::GzipDecompressor::ResultCode;
-    ResultCode ret = decompressor.FeedAndExtract(
-        bytes.data, bytes.size, [&output](const uint8_t* buf, size_t buf_len) {
-          output->insert(output->end(), buf, buf + buf_len);
-        });
-    if (ret == ResultCode::kError || ret == ResultCode::kNeedsMoreInput) {
-      return util::ErrStatus("Failed while decompressing stream");
+    if (compressed_jobs == max_compressed_jobs) {
+      RETURN_IF_ERROR(FlushDecompressJobs(pool.get(), &jobs, output));
+      compressed_jobs = 0;
     }
   }
+  RETURN_IF_ERROR(FlushDecompressJobs(pool.get(), &jobs, output));
   return util::OkStatus();
 }
 
@@ -18,6 +18,7 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/read_trace.h"
+#include "perfetto/trace_processor/trace_processor.h"
 
 #include "src/base/test/utils.h"
 #include "test/gtest_and_gmock.h"
@@ -84,6 +85,22 @@ TEST_F(ReadTraceIntegrationTest, CompressedTrace) {
   ASSERT_EQ(packet_count, 2412u);
 }
 
+TEST_F(ReadTraceIntegrationTest, CompressedTraceMultipleThreads) {
+  base::ScopedFstream f = OpenTestTrace("test/data/compressed.pb");
+  std::vector<uint8_t> raw_trace = ReadAllData(f);
+
+  std::vector<uint8_t> serial;
+  util::Status status = trace_processor::DecompressTrace(
+      raw_trace.data(), raw_trace.size(), &serial, /*thread_count=*/1);
+  ASSERT_TRUE(status.ok());
+
+  std::vector<uint8_t> parallel;
+  status = trace_processor::DecompressTrace(
+      raw_trace.data(), raw_trace.size(), &parallel, /*thread_count=*/4);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(parallel, serial);
+}
+
 TEST_F(ReadTraceIntegrationTest, NonProtobufShouldNotDecompress) {
   base::ScopedFstream f = OpenTestTrace("test/data/unsorted_trace.json");
   std::vector<uint8_t> raw_trace = ReadAllData(f);
@@ -132,6 +149,42 @@ TEST_F(ReadTraceIntegrationTest, DoubleGzipDecompressTrace) {
   ASSERT_EQ(packet_count, 2412u);
 }
 
+int64_t CountSchedSlicesAfterReadTrace(const Config& config = Config()) {
+  auto tp = TraceProcessor::CreateInstance(config);
+  // No progress callback on purpose: it is optional.
+  util::Status status = ReadTrace(
+      tp.get(), base::GetTestDataPath("test/data/compressed.pb").c_str());
+  EXPECT_TRUE(status.ok()) << status.message();
+  auto it = tp->ExecuteQuery("SELECT COUNT(*) FROM sched");
+  EXPECT_TRUE(it.Next());
+  return it.Get(0).long_value;
+}
+
+TEST_F(ReadTraceIntegrationTest, MmapAndReadProduceSameTrace) {
+  int64_t mmap_slices = CountSchedSlicesAfterReadTrace();
+  EXPECT_GT(mmap_slices, 0);
+
+  base::SetEnv("TRACE_PROCESSOR_NO_MMAP", "1");
+  int64_t read_slices = CountSchedSlicesAfterReadTrace();
+  base::UnsetEnv("TRACE_PROCESSOR_NO_MMAP");
+  EXPECT_EQ(mmap_slices, read_slices);
+}
+
+TEST_F(ReadTraceIntegrationTest, ReadAheadProducesSameTrace) {
+  int64_t mmap_slices = CountSchedSlicesAfterReadTrace();
+  EXPECT_GT(mmap_slices, 0);
+
+  Config config;
+  config.read_ahead_chunks = 4;
+  EXPECT_EQ(CountSchedSlicesAfterReadTrace(config), mmap_slices);
+}
+
+TEST_F(ReadTraceIntegrationTest, ReadTraceMissingFileFails) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  util::Status status = ReadTrace(tp.get(), "/this/trace/does/not/exist.pb");
+  ASSERT_FALSE(status.ok());
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
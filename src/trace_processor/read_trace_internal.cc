@@ -16,6 +16,15 @@
 
 #include "src/trace_processor/read_trace_internal.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -35,6 +44,15 @@
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) &&  \
+    (!PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+     PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS))
+#include <unistd.h>
+#define PERFETTO_TP_HAS_READ_AHEAD() 1
+#else
+#define PERFETTO_TP_HAS_READ_AHEAD() 0
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 namespace {
@@ -68,6 +86,143 @@ util::Status ReadTraceUsingRead(
   }
   return util::OkStatus();
 }
+
+#if PERFETTO_TP_HAS_READ_AHEAD()
+// Reads a file in chunks of kChunkSize bytes with pread() on |read_ahead|
+// threads, each reading a different chunk, up to |read_ahead| chunks ahead of
+// the one returned by Next(). As several reads are in flight at any time, the
+// latency of each of them is hidden behind the parsing of the chunks already
+// read.
+class ReadAheadFileReader {
+ public:
+  ReadAheadFileReader(int fd, uint32_t read_ahead)
+      : fd_(fd), chunks_(read_ahead) {
+    for (uint32_t i = 0; i < read_ahead; ++i)
+      threads_.emplace_back([this] { ReadChunks(); });
+  }
+
+  ~ReadAheadFileReader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      quit_ = true;
+    }
+    cv_.notify_all();
+    for (std::thread& thread : threads_)
+      thread.join();
+  }
+
+  // Returns the next chunk of the file, waiting for it to be read if needed.
+  // |chunk| is empty at the end of the file.
+  util::Status Next(TraceBlobView* chunk) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (next_to_return_ >= end_) {
+      *chunk = TraceBlobView();
+      return util::OkStatus();
+    }
+    Chunk& next = chunks_[next_to_return_ % chunks_.size()];
+    cv_.wait(lock, [&next] { return next.done; });
+    *chunk = std::move(next.data);
+    int error = next.error;
+    next = Chunk();
+    next_to_return_++;
+    lock.unlock();
+    cv_.notify_all();
+
+    if (error) {
+      return util::ErrStatus("Reading trace file failed (errno: %d, %s)",
+                             error, strerror(error));
+    }
+    return util::OkStatus();
+  }
+
+ private:
+  struct Chunk {
+    TraceBlobView data;
+    int error = 0;
+    bool done = false;
+  };
+
+  void ReadChunks() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      // Chunk |i| is stored in |chunks_[i % chunks_.size()]| so it can only
+      // be read once chunk |i - chunks_.size()| has been returned.
+      cv_.wait(lock, [this] {
+        return quit_ || (next_to_read_ < end_ &&
+                         next_to_read_ < next_to_return_ + chunks_.size());
+      });
+      if (quit_)
+        return;
+      uint64_t index = next_to_read_++;
+      lock.unlock();
+
+      TraceBlob blob = TraceBlob::Allocate(kChunkSize);
+      const auto offset = static_cast<off_t>(index * kChunkSize);
+      size_t size = 0;
+      int error = 0;
+      while (size < kChunkSize) {
+        ssize_t rsize =
+            PERFETTO_EINTR(pread(fd_, blob.data() + size, kChunkSize - size,
+                                 offset + static_cast<off_t>(size)));
+        if (rsize < 0) {
+          error = errno;
+          break;
+        }
+        if (rsize == 0)
+          break;
+        size += static_cast<size_t>(rsize);
+      }
+
+      lock.lock();
+      // A short read means the end of the file was reached: there is no need
+      // to read the following chunks.
+      if (size < kChunkSize)
+        end_ = std::min(end_, index + 1);
+      Chunk& chunk = chunks_[index % chunks_.size()];
+      chunk.data = TraceBlobView(std::move(blob), 0, size);
+      chunk.error = error;
+      chunk.done = true;
+      cv_.notify_all();
+    }
+  }
+
+  const int fd_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Chunk> chunks_;
+  uint64_t next_to_read_ = 0;
+  uint64_t next_to_return_ = 0;
+  // Index of the first chunk past the end of the file, once known.
+  uint64_t end_ = std::numeric_limits<uint64_t>::max();
+  bool quit_ = false;
+
+  // Keep last: the threads access the members above.
+  std::vector<std::thread> threads_;
+};
+
+util::Status ReadTraceUsingReadAhead(
+    TraceProcessor* tp,
+    int fd,
+    uint32_t read_ahead,
+    uint64_t* file_size,
+    const std::function<void(uint64_t parsed_size)>& progress_callback) {
+  ReadAheadFileReader reader(fd, read_ahead);
+  for (int i = 0;; i++) {
+    if (progress_callback && i % 128 == 0)
+      progress_callback(*file_size);
+
+    TraceBlobView chunk;
+    RETURN_IF_ERROR(reader.Next(&chunk));
+    if (chunk.length() == 0)
+      break;
+
+    *file_size += chunk.length();
+    RETURN_IF_ERROR(tp->Parse(std::move(chunk)));
+  }
+  return util::OkStatus();
+}
+#endif  // PERFETTO_TP_HAS_READ_AHEAD()
 }  // namespace
 
 util::Status ReadTraceUnfinalized(
@@ -76,9 +231,14 @@ util::Status ReadTraceUnfinalized(
     const std::function<void(uint64_t parsed_size)>& progress_callback) {
   uint64_t bytes_read = 0;
 
+  uint32_t read_ahead = 0;
+#if PERFETTO_TP_HAS_READ_AHEAD()
+  read_ahead = tp->config().read_ahead_chunks;
+#endif
+
 #if PERFETTO_HAS_MMAP()
   char* no_mmap = getenv("TRACE_PROCESSOR_NO_MMAP");
-  bool use_mmap = !no_mmap || *no_mmap != '1';
+  bool use_mmap = (!no_mmap || *no_mmap != '1') && read_ahead == 0;
 
   if (use_mmap) {
     base::ScopedMmap mapped = base::ReadMmapWholeFile(filename);
@@ -88,7 +248,8 @@ util::Status ReadTraceUnfinalized(
       // Parse the file in chunks so we get some status update on stdio.
       static constexpr size_t kMmapChunkSize = 128ul * 1024 * 1024;
       while (bytes_read < length) {
-        progress_callback(bytes_read);
+        if (progress_callback)
+          progress_callback(bytes_read);
         const size_t bytes_read_z = static_cast<size_t>(bytes_read);
         size_t slice_size = std::min(length - bytes_read_z, kMmapChunkSize);
         TraceBlobView slice = whole_mmap.slice_off(bytes_read_z, slice_size);
@@ -97,15 +258,23 @@ util::Status ReadTraceUnfinalized(
       }  // while (slices)
     }  // if (mapped.IsValid())
   }  // if (use_mmap)
-  if (bytes_read == 0)
+  if (use_mmap && bytes_read == 0)
     PERFETTO_LOG("Cannot use mmap on this system. Falling back on read()");
 #endif  // PERFETTO_HAS_MMAP()
   if (bytes_read == 0) {
     base::ScopedFile fd(base::OpenFile(filename, O_RDONLY));
     if (!fd)
       return util::ErrStatus("Could not open trace file (path: %s)", filename);
-    RETURN_IF_ERROR(
-        ReadTraceUsingRead(tp, *fd, &bytes_read, progress_callback));
+#if PERFETTO_TP_HAS_READ_AHEAD()
+    if (read_ahead > 0) {
+      RETURN_IF_ERROR(ReadTraceUsingReadAhead(tp, *fd, read_ahead, &bytes_read,
+                                              progress_callback));
+    }
+#endif
+    if (read_ahead == 0) {
+      RETURN_IF_ERROR(
+          ReadTraceUsingRead(tp, *fd, &bytes_read, progress_callback));
+    }
   }
   tp->SetCurrentTraceName(filename);
 
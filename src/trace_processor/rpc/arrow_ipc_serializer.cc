@@ -0,0 +1,577 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/arrow_ipc_serializer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/iterator.h"
+#include "src/trace_processor/iterator_impl.h"
+
+namespace perfetto::trace_processor {
+
+namespace {
+
+// Ends a batch early if its string/blob payload grows past this size, to
+// bound the memory usage with very large cells.
+constexpr size_t kMaxBatchPayloadBytes = 64 * 1024 * 1024;
+
+// Constants from the Arrow flatbuffer schemas (Message.fbs and Schema.fbs).
+constexpr uint16_t kMetadataVersionV5 = 4;
+constexpr uint8_t kMessageHeaderSchema = 1;
+constexpr uint8_t kMessageHeaderRecordBatch = 3;
+constexpr uint8_t kTypeNull = 1;
+constexpr uint8_t kTypeInt = 2;
+constexpr uint8_t kTypeFloatingPoint = 3;
+constexpr uint8_t kTypeBinary = 4;
+constexpr uint8_t kTypeUtf8 = 5;
+constexpr uint16_t kPrecisionDouble = 2;
+
+constexpr uint32_t kContinuationMarker = 0xFFFFFFFF;
+
+// A minimal FlatBuffers encoder, sufficient for the Arrow IPC metadata.
+// Unlike the reference builder, which writes back to front, objects are
+// appended parent first and the offsets to their children are backpatched
+// once the children are written. This is valid as FlatBuffers only requires
+// that offsets point forward, and keeps this code dependency-free.
+class FlatBufferWriter {
+ public:
+  struct Field {
+    uint16_t id;
+    uint8_t size;  // 1, 2, 4 or 8 bytes. Offsets are 4 bytes.
+    uint64_t value;
+  };
+
+  struct Table {
+    uint32_t pos;
+    // The position of each field, in the same order as passed to AddTable().
+    std::vector<uint32_t> field_pos;
+  };
+
+  // Reserves the root offset, which is the first word of the buffer.
+  FlatBufferWriter() : buf_(sizeof(uint32_t)) {}
+
+  Table AddTable(const std::vector<Field>& fields) {
+    // Lay out the fields in decreasing size order, so that they are naturally
+    // aligned with no padding other than (possibly) after the vtable offset.
+    std::vector<size_t> order(fields.size());
+    for (size_t i = 0; i < order.size(); ++i)
+      order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return fields[a].size > fields[b].size;
+    });
+    uint16_t num_slots = 0;
+    bool has_8_byte_field = false;
+    for (const Field& f : fields) {
+      num_slots = std::max(num_slots, static_cast<uint16_t>(f.id + 1));
+      has_8_byte_field |= f.size == 8;
+    }
+
+    Pad(2);
+    const uint32_t vtable_pos = size();
+    const uint32_t vtable_size = 4 + 2 * num_slots;
+    uint32_t table_pos =
+        static_cast<uint32_t>(base::AlignUp<4>(vtable_pos + vtable_size));
+    if (has_8_byte_field && (table_pos + 4) % 8 != 0)
+      table_pos += 4;
+
+    Table table{table_pos, std::vector<uint32_t>(fields.size())};
+    uint32_t table_end = table_pos + 4;
+    for (size_t i : order) {
+      uint32_t size = fields[i].size;
+      table_end = (table_end + size - 1) / size * size;
+      table.field_pos[i] = table_end;
+      table_end += size;
+    }
+    buf_.resize(table_end);
+
+    Write<uint16_t>(vtable_pos, static_cast<uint16_t>(vtable_size));
+    Write<uint16_t>(vtable_pos + 2,
+                    static_cast<uint16_t>(table_end - table_pos));
+    for (size_t i = 0; i < fields.size(); ++i) {
+      Write<uint16_t>(vtable_pos + 4 + 2 * fields[i].id,
+                      static_cast<uint16_t>(table.field_pos[i] - table_pos));
+      memcpy(&buf_[table.field_pos[i]], &fields[i].value, fields[i].size);
+    }
+    Write<int32_t>(table_pos, static_cast<int32_t>(table_pos - vtable_pos));
+    return table;
+  }
+
+  // Writes the length prefix of a vector. The caller is expected to append
+  // exactly |count| elements right after this call. Returns the position of
+  // the vector, i.e. the target for the offsets pointing to it.
+  uint32_t BeginVector(uint32_t count, uint32_t elem_align) {
+    uint32_t align = std::max(elem_align, 4u);
+    while ((size() + 4) % align != 0)
+      buf_.push_back(0);
+    uint32_t pos = size();
+    Append<uint32_t>(count);
+    return pos;
+  }
+
+  uint32_t AddString(const std::string& str) {
+    Pad(4);
+    uint32_t pos = size();
+    Append<uint32_t>(static_cast<uint32_t>(str.size()));
+    buf_.insert(buf_.end(), str.begin(), str.end());
+    buf_.push_back(0);
+    return pos;
+  }
+
+  void PatchOffset(uint32_t field_pos, uint32_t target_pos) {
+    PERFETTO_DCHECK(target_pos > field_pos);
+    Write<uint32_t>(field_pos, target_pos - field_pos);
+  }
+
+  void SetRoot(uint32_t table_pos) { PatchOffset(0, table_pos); }
+
+  template <typename T>
+  void Append(T value) {
+    size_t pos = buf_.size();
+    buf_.resize(pos + sizeof(T));
+    memcpy(&buf_[pos], &value, sizeof(T));
+  }
+
+  void Pad(uint32_t align) {
+    while (buf_.size() % align != 0)
+      buf_.push_back(0);
+  }
+
+  uint32_t size() const { return static_cast<uint32_t>(buf_.size()); }
+  const std::vector<uint8_t>& buf() const { return buf_; }
+
+ private:
+  template <typename T>
+  void Write(uint32_t pos, T value) {
+    memcpy(&buf_[pos], &value, sizeof(T));
+  }
+
+  std::vector<uint8_t> buf_;
+};
+
+// Appends an encapsulated IPC message: continuation marker, metadata size and
+// the flatbuffer Message padded to 8 bytes. The body, if any, follows.
+void AppendMessageMetadata(const FlatBufferWriter& fb,
+                           std::vector<uint8_t>* out) {
+  uint32_t metadata_size = static_cast<uint32_t>(base::AlignUp<8>(fb.size()));
+  size_t pos = out->size();
+  out->resize(pos + 8);
+  memcpy(&(*out)[pos], &kContinuationMarker, sizeof(uint32_t));
+  memcpy(&(*out)[pos + 4], &metadata_size, sizeof(uint32_t));
+  out->insert(out->end(), fb.buf().begin(), fb.buf().end());
+  out->resize(pos + 8 + metadata_size);
+}
+
+// Adds a Message table with the given header and returns the position of the
+// |header| offset, to be patched by the caller.
+uint32_t AddMessageTable(FlatBufferWriter* fb,
+                         uint8_t header_type,
+                         uint64_t body_length) {
+  auto message = fb->AddTable({
+      {0, 2, kMetadataVersionV5},  // version
+      {1, 1, header_type},         // header_type
+      {2, 4, 0},                   // header
+      {3, 8, body_length},         // bodyLength
+  });
+  fb->SetRoot(message.pos);
+  return message.field_pos[2];
+}
+
+const char* SqlTypeName(SqlValue::Type type) {
+  switch (type) {
+    case SqlValue::Type::kNull:
+      return "NULL";
+    case SqlValue::Type::kLong:
+      return "INTEGER";
+    case SqlValue::Type::kDouble:
+      return "REAL";
+    case SqlValue::Type::kString:
+      return "TEXT";
+    case SqlValue::Type::kBytes:
+      return "BLOB";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+}  // namespace
+
+// Maps a SQLite declared type to a column type, following the rules SQLite
+// uses to derive the column affinity (https://sqlite.org/datatype3.html).
+// NUMERIC affinity can hold both integers and reals, so is left untyped.
+// static
+ArrowIpcSerializer::ColumnType ArrowIpcSerializer::ColumnTypeFromDeclType(
+    const char* decl_type) {
+  if (!decl_type)
+    return ColumnType::kUnknown;
+  std::string upper = base::ToUpper(decl_type);
+  auto contains = [&upper](const char* s) {
+    return upper.find(s) != std::string::npos;
+  };
+  if (contains("INT"))
+    return ColumnType::kInt64;
+  if (contains("CHAR") || contains("CLOB") || contains("TEXT"))
+    return ColumnType::kUtf8;
+  if (contains("BLOB"))
+    return ColumnType::kBinary;
+  if (contains("REAL") || contains("FLOA") || contains("DOUB"))
+    return ColumnType::kDouble;
+  return ColumnType::kUnknown;
+}
+
+void ArrowIpcSerializer::ColumnBuilder::Clear() {
+  length = 0;
+  null_count = 0;
+  validity.clear();
+  values.clear();
+  offsets.clear();
+  data.clear();
+  if (type == ColumnType::kUtf8 || type == ColumnType::kBinary)
+    offsets.push_back(0);
+}
+
+void ArrowIpcSerializer::ColumnBuilder::SetType(ColumnType new_type) {
+  PERFETTO_DCHECK(type == ColumnType::kUnknown);
+  type = new_type;
+  if (type == ColumnType::kInt64 || type == ColumnType::kDouble) {
+    values.resize(length * sizeof(int64_t));
+  } else if (type == ColumnType::kUtf8 || type == ColumnType::kBinary) {
+    offsets.assign(length + 1, 0);
+  }
+}
+
+ArrowIpcSerializer::ArrowIpcSerializer(Iterator it, IteratorState state)
+    : iter_(it.take_impl()),
+      row_ready_(state == IteratorState::kOnFirstRow),
+      eof_(state == IteratorState::kAtEnd) {
+  columns_.resize(iter_->ColumnCount());
+  for (uint32_t c = 0; c < columns_.size(); ++c) {
+    columns_[c].name = iter_->GetColumnName(c);
+    columns_[c].declared_type =
+        ColumnTypeFromDeclType(iter_->GetColumnDeclType(c));
+  }
+}
+
+ArrowIpcSerializer::~ArrowIpcSerializer() = default;
+
+bool ArrowIpcSerializer::Serialize(std::vector<uint8_t>* out) {
+  PERFETTO_CHECK(!done_);
+  uint32_t num_rows = FillBatch();
+  if (!status_.ok()) {
+    done_ = true;
+    return false;
+  }
+  if (!did_write_schema_) {
+    // Columns without any non-NULL value in the first batch fall back to their
+    // declared type, if any.
+    for (ColumnBuilder& col : columns_) {
+      if (col.type == ColumnType::kUnknown) {
+        col.SetType(col.declared_type == ColumnType::kUnknown
+                        ? ColumnType::kNull
+                        : col.declared_type);
+      }
+    }
+    AppendSchemaMessage(out);
+    did_write_schema_ = true;
+  }
+  if (num_rows > 0)
+    AppendRecordBatchMessage(num_rows, out);
+  if (eof_) {
+    // End-of-stream marker: continuation followed by a zero metadata size.
+    size_t pos = out->size();
+    out->resize(pos + 8);
+    memcpy(&(*out)[pos], &kContinuationMarker, sizeof(uint32_t));
+    memset(&(*out)[pos + 4], 0, sizeof(uint32_t));
+    done_ = true;
+  }
+  return !done_;
+}
+
+uint32_t ArrowIpcSerializer::FillBatch() {
+  for (ColumnBuilder& col : columns_)
+    col.Clear();
+  batch_payload_bytes_ = 0;
+
+  uint32_t num_rows = 0;
+  if (eof_) {
+    status_ = iter_->Status();
+    return num_rows;
+  }
+  uint32_t max_rows =
+      did_write_schema_ ? rows_per_batch_
+                        : std::max(rows_per_batch_, kMaxRowsForTypeInference);
+  while (num_rows < max_rows &&
+         batch_payload_bytes_ < kMaxBatchPayloadBytes) {
+    if (num_rows >= rows_per_batch_ && CanTypeAllColumns())
+      break;
+    if (!row_ready_ && !iter_->Next()) {
+      eof_ = true;
+      status_ = iter_->Status();
+      break;
+    }
+    row_ready_ = false;
+    for (uint32_t c = 0; c < columns_.size(); ++c) {
+      status_ = AppendCell(c);
+      if (!status_.ok())
+        return num_rows;
+    }
+    ++num_rows;
+  }
+  return num_rows;
+}
+
+bool ArrowIpcSerializer::CanTypeAllColumns() const {
+  return std::all_of(columns_.begin(), columns_.end(),
+                     [](const ColumnBuilder& col) {
+                       return col.type != ColumnType::kUnknown ||
+                              col.declared_type != ColumnType::kUnknown;
+                     });
+}
+
+base::Status ArrowIpcSerializer::AppendCell(uint32_t c) {
+  ColumnBuilder& col = columns_[c];
+  SqlValue value = iter_->Get(c);
+
+  if (col.length % 8 == 0)
+    col.validity.push_back(0);
+
+  if (value.is_null()) {
+    ++col.null_count;
+    ++col.length;
+    switch (col.type) {
+      case ColumnType::kUnknown:
+      case ColumnType::kNull:
+        break;
+      case ColumnType::kInt64:
+      case ColumnType::kDouble:
+        col.values.resize(col.values.size() + sizeof(int64_t));
+        break;
+      case ColumnType::kUtf8:
+      case ColumnType::kBinary:
+        col.offsets.push_back(col.offsets.back());
+        break;
+    }
+    return base::OkStatus();
+  }
+
+  ColumnType type = ColumnType::kUnknown;
+  switch (value.type) {
+    case SqlValue::Type::kLong:
+      type = ColumnType::kInt64;
+      break;
+    case SqlValue::Type::kDouble:
+      type = ColumnType::kDouble;
+      break;
+    case SqlValue::Type::kString:
+      type = ColumnType::kUtf8;
+      break;
+    case SqlValue::Type::kBytes:
+      type = ColumnType::kBinary;
+      break;
+    case SqlValue::Type::kNull:
+      PERFETTO_FATAL("Handled above");
+  }
+
+  if (col.type == ColumnType::kUnknown) {
+    // First non-NULL value of the stream: backfill the NULLs seen so far.
+    col.SetType(type);
+  } else if (col.type == ColumnType::kDouble && type == ColumnType::kInt64) {
+    value = SqlValue::Double(static_cast<double>(value.long_value));
+    type = ColumnType::kDouble;
+  } else if (col.type != type) {
+    return base::ErrStatus(
+        "Arrow export: column '%s' has a %s value which doesn't match the "
+        "type inferred from its first value: CAST the column to a single "
+        "type in the query",
+        col.name.c_str(), SqlTypeName(value.type));
+  }
+
+  col.validity[col.length / 8] |= static_cast<uint8_t>(1u << (col.length % 8));
+  ++col.length;
+  switch (type) {
+    case ColumnType::kInt64: {
+      size_t pos = col.values.size();
+      col.values.resize(pos + sizeof(int64_t));
+      memcpy(&col.values[pos], &value.long_value, sizeof(int64_t));
+      break;
+    }
+    case ColumnType::kDouble: {
+      size_t pos = col.values.size();
+      col.values.resize(pos + sizeof(double));
+      memcpy(&col.values[pos], &value.double_value, sizeof(double));
+      break;
+    }
+    case ColumnType::kUtf8:
+    case ColumnType::kBinary: {
+      const auto* begin =
+          type == ColumnType::kUtf8
+              ? reinterpret_cast<const uint8_t*>(value.string_value)
+              : static_cast<const uint8_t*>(value.bytes_value);
+      size_t size = type == ColumnType::kUtf8 ? strlen(value.string_value)
+                                              : value.bytes_count;
+      if (col.data.size() + size >
+          static_cast<size_t>(std::numeric_limits<int32_t>::max())) {
+        return base::ErrStatus(
+            "Arrow export: column '%s' exceeds 2GB in a single batch",
+            col.name.c_str());
+      }
+      col.data.insert(col.data.end(), begin, begin + size);
+      col.offsets.push_back(static_cast<int32_t>(col.data.size()));
+      batch_payload_bytes_ += size;
+      break;
+    }
+    case ColumnType::kUnknown:
+    case ColumnType::kNull:
+      PERFETTO_FATAL("Unexpected column type");
+  }
+  return base::OkStatus();
+}
+
+void ArrowIpcSerializer::AppendSchemaMessage(std::vector<uint8_t>* out) {
+  FlatBufferWriter fb;
+  uint32_t header_pos = AddMessageTable(&fb, kMessageHeaderSchema, 0);
+
+  auto schema = fb.AddTable({{1, 4, 0}});  // fields
+  fb.PatchOffset(header_pos, schema.pos);
+
+  uint32_t fields_pos =
+      fb.BeginVector(static_cast<uint32_t>(columns_.size()), 4);
+  fb.PatchOffset(schema.field_pos[0], fields_pos);
+  for (uint32_t i = 0; i < columns_.size(); ++i)
+    fb.Append<uint32_t>(0);
+
+  for (uint32_t i = 0; i < columns_.size(); ++i) {
+    const ColumnBuilder& col = columns_[i];
+    uint8_t type_type = kTypeNull;
+    switch (col.type) {
+      case ColumnType::kUnknown:
+      case ColumnType::kNull:
+        type_type = kTypeNull;
+        break;
+      case ColumnType::kInt64:
+        type_type = kTypeInt;
+        break;
+      case ColumnType::kDouble:
+        type_type = kTypeFloatingPoint;
+        break;
+      case ColumnType::kUtf8:
+        type_type = kTypeUtf8;
+        break;
+      case ColumnType::kBinary:
+        type_type = kTypeBinary;
+        break;
+    }
+    auto field = fb.AddTable({
+        {0, 4, 0},          // name
+        {1, 1, 1},          // nullable
+        {2, 1, type_type},  // type_type
+        {3, 4, 0},          // type
+        {5, 4, 0},          // children
+    });
+    fb.PatchOffset(fields_pos + 4 + 4 * i, field.pos);
+    fb.PatchOffset(field.field_pos[0], fb.AddString(col.name));
+
+    FlatBufferWriter::Table type;
+    if (type_type == kTypeInt) {
+      type = fb.AddTable({{0, 4, 64}, {1, 1, 1}});  // bitWidth, is_signed
+    } else if (type_type == kTypeFloatingPoint) {
+      type = fb.AddTable({{0, 2, kPrecisionDouble}});  // precision
+    } else {
+      type = fb.AddTable({});
+    }
+    fb.PatchOffset(field.field_pos[3], type.pos);
+    fb.PatchOffset(field.field_pos[4], fb.BeginVector(0, 4));
+  }
+  AppendMessageMetadata(fb, out);
+}
+
+void ArrowIpcSerializer::AppendRecordBatchMessage(uint32_t num_rows,
+                                                  std::vector<uint8_t>* out) {
+  struct BodyBuffer {
+    const void* data;
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  // First lay out the body, as the metadata needs the offset and size of each
+  // buffer. Each buffer starts at a 8-byte aligned offset.
+  std::vector<BodyBuffer> buffers;
+  uint64_t body_size = 0;
+  auto add_buffer = [&](const void* data, size_t size) {
+    buffers.push_back({data, body_size, size});
+    body_size += base::AlignUp<8>(size);
+  };
+  for (const ColumnBuilder& col : columns_) {
+    if (col.type == ColumnType::kNull)
+      continue;  // The null layout has no buffers.
+    if (col.null_count > 0) {
+      add_buffer(col.validity.data(), col.validity.size());
+    } else {
+      add_buffer(nullptr, 0);
+    }
+    if (col.type == ColumnType::kInt64 || col.type == ColumnType::kDouble) {
+      add_buffer(col.values.data(), col.values.size());
+    } else {
+      add_buffer(col.offsets.data(), col.offsets.size() * sizeof(int32_t));
+      add_buffer(col.data.data(), col.data.size());
+    }
+  }
+
+  FlatBufferWriter fb;
+  uint32_t header_pos =
+      AddMessageTable(&fb, kMessageHeaderRecordBatch, body_size);
+  auto batch = fb.AddTable({
+      {0, 8, num_rows},  // length
+      {1, 4, 0},         // nodes
+      {2, 4, 0},         // buffers
+  });
+  fb.PatchOffset(header_pos, batch.pos);
+
+  // FieldNode and Buffer are structs of two int64s.
+  fb.PatchOffset(batch.field_pos[1],
+                 fb.BeginVector(static_cast<uint32_t>(columns_.size()), 8));
+  for (const ColumnBuilder& col : columns_) {
+    fb.Append<int64_t>(col.length);
+    fb.Append<int64_t>(col.type == ColumnType::kNull ? col.length
+                                                     : col.null_count);
+  }
+  fb.PatchOffset(batch.field_pos[2],
+                 fb.BeginVector(static_cast<uint32_t>(buffers.size()), 8));
+  for (const BodyBuffer& buffer : buffers) {
+    fb.Append<int64_t>(static_cast<int64_t>(buffer.offset));
+    fb.Append<int64_t>(static_cast<int64_t>(buffer.size));
+  }
+  AppendMessageMetadata(fb, out);
+
+  out->reserve(out->size() + body_size);
+  for (const BodyBuffer& buffer : buffers) {
+    const auto* begin = static_cast<const uint8_t*>(buffer.data);
+    out->insert(out->end(), begin, begin + buffer.size);
+    out->resize(base::AlignUp<8>(out->size()));
+  }
+}
+
+}  // namespace perfetto::trace_processor
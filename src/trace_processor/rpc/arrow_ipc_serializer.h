@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_ARROW_IPC_SERIALIZER_H_
+#define SRC_TRACE_PROCESSOR_RPC_ARROW_IPC_SERIALIZER_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto::trace_processor {
+
+class Iterator;
+class IteratorImpl;
+
+// Serializes the rows of an Iterator as an Apache Arrow IPC stream (see
+// https://arrow.apache.org/docs/format/Columnar.html#ipc-streaming-format),
+// which can be read directly by pyarrow, pandas, DuckDB, Polars etc. and
+// converted to Parquet without going through a text representation.
+//
+// Like QueryResultSerializer, the stream is produced in chunks: each call to
+// Serialize() appends one record batch of up to |rows_per_batch_| rows, so
+// the memory usage is bounded regardless of the size of the result.
+//
+// The Arrow schema is fixed at the start of the stream, while SQLite values
+// are dynamically typed: the type of each column is inferred from its first
+// non-NULL value (INTEGER -> int64, REAL -> double, TEXT -> utf8,
+// BLOB -> binary). While a column has only seen NULLs, the first batch keeps
+// growing past |rows_per_batch_| (up to kMaxRowsForTypeInference rows) unless
+// the column has a SQLite declared type, which is used instead; columns still
+// untyped at that point become null. Later INTEGER values in a double column
+// are converted; any other type mismatch fails the serialization, and should
+// be fixed by CASTing the column in the query.
+class ArrowIpcSerializer {
+ public:
+  static constexpr uint32_t kDefaultRowsPerBatch = 64 * 1024;
+  static constexpr uint32_t kMaxRowsForTypeInference = 1024 * 1024;
+
+  // Where the iterator passed to the constructor is. This allows callers to
+  // call Next() once (e.g. to check for errors) before serializing.
+  enum class IteratorState {
+    kNotStarted,  // Next() was never called.
+    kOnFirstRow,  // Next() was called once and returned true.
+    kAtEnd,       // Next() was called once and returned false.
+  };
+
+  explicit ArrowIpcSerializer(
+      Iterator,
+      IteratorState state = IteratorState::kNotStarted);
+  ~ArrowIpcSerializer();
+
+  ArrowIpcSerializer(const ArrowIpcSerializer&) = delete;
+  ArrowIpcSerializer& operator=(const ArrowIpcSerializer&) = delete;
+
+  // Appends the next chunk of the stream to |out|: the schema followed by the
+  // first record batch on the first call, one record batch on each following
+  // call and the end-of-stream marker on the last one. Returns true if more
+  // chunks are available. If an error occurs (either from the query or a
+  // type mismatch), returns false without terminating the stream: status()
+  // tells the two cases apart.
+  bool Serialize(std::vector<uint8_t>* out);
+
+  const base::Status& status() const { return status_; }
+
+  void set_rows_per_batch_for_testing(uint32_t rows) {
+    rows_per_batch_ = rows;
+  }
+
+ private:
+  enum class ColumnType { kUnknown, kNull, kInt64, kDouble, kUtf8, kBinary };
+
+  struct ColumnBuilder {
+    void Clear();
+    // Fixes the type of a column which only had NULLs so far.
+    void SetType(ColumnType);
+
+    std::string name;
+    ColumnType type = ColumnType::kUnknown;
+    // From the SQLite declared type, used if all the values in the first
+    // batch are NULL.
+    ColumnType declared_type = ColumnType::kUnknown;
+    uint32_t length = 0;
+    uint32_t null_count = 0;
+    std::vector<uint8_t> validity;
+    std::vector<uint8_t> values;   // int64/double values.
+    std::vector<int32_t> offsets;  // utf8/binary offsets.
+    std::vector<uint8_t> data;     // utf8/binary payload.
+  };
+
+  // Reads rows into |columns_| until the batch is full or the iterator is
+  // exhausted. The first batch is only full once all the columns can be
+  // typed. Returns the number of rows read.
+  uint32_t FillBatch();
+  bool CanTypeAllColumns() const;
+  base::Status AppendCell(uint32_t col);
+  static ColumnType ColumnTypeFromDeclType(const char* decl_type);
+  void AppendSchemaMessage(std::vector<uint8_t>* out);
+  void AppendRecordBatchMessage(uint32_t num_rows, std::vector<uint8_t>* out);
+
+  std::unique_ptr<IteratorImpl> iter_;
+  bool row_ready_ = false;
+  bool eof_ = false;
+  bool done_ = false;
+  bool did_write_schema_ = false;
+  base::Status status_;
+  std::vector<ColumnBuilder> columns_;
+  size_t batch_payload_bytes_ = 0;
+  uint32_t rows_per_batch_ = kDefaultRowsPerBatch;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_ARROW_IPC_SERIALIZER_H_
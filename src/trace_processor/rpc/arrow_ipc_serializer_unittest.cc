@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/arrow_ipc_serializer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using ::testing::ElementsAre;
+
+template <typename T>
+T ReadAt(const uint8_t* buf, size_t pos) {
+  T value;
+  memcpy(&value, buf + pos, sizeof(T));
+  return value;
+}
+
+// Accessor for a table of a flatbuffer, following the encoding rules
+// (vtable, forward offsets) independently of the serializer.
+struct FbTable {
+  uint32_t FieldPos(uint16_t id) const {
+    uint32_t vtable =
+        static_cast<uint32_t>(pos - ReadAt<int32_t>(buf, pos));
+    uint16_t vtable_size = ReadAt<uint16_t>(buf, vtable);
+    if (4u + 2u * id >= vtable_size)
+      return 0;
+    uint16_t off = ReadAt<uint16_t>(buf, vtable + 4 + 2 * id);
+    return off ? pos + off : 0;
+  }
+
+  template <typename T>
+  T Scalar(uint16_t id) const {
+    uint32_t field = FieldPos(id);
+    EXPECT_EQ(field % sizeof(T), 0u) << "Misaligned field " << id;
+    return field ? ReadAt<T>(buf, field) : T();
+  }
+
+  // Returns the position of the object (table, vector or string) pointed by
+  // the offset field |id|.
+  uint32_t Deref(uint16_t id) const {
+    uint32_t field = FieldPos(id);
+    return field ? field + ReadAt<uint32_t>(buf, field) : 0;
+  }
+
+  FbTable Table(uint16_t id) const { return FbTable{buf, Deref(id)}; }
+
+  const uint8_t* buf;
+  uint32_t pos;
+};
+
+// Decodes an Arrow IPC stream, rendering each cell as a string.
+struct ArrowStream {
+  void Parse(const std::vector<uint8_t>& stream);
+  void ParseBatch(const FbTable& batch, const uint8_t* body);
+
+  std::vector<std::string> names;
+  std::vector<uint8_t> types;
+  std::vector<std::vector<std::string>> rows;
+  uint32_t num_batches = 0;
+  bool eos = false;
+};
+
+void ArrowStream::Parse(const std::vector<uint8_t>& stream) {
+  for (size_t off = 0; off < stream.size();) {
+    ASSERT_FALSE(eos);
+    ASSERT_EQ(off % 8, 0u);
+    ASSERT_EQ(ReadAt<uint32_t>(stream.data(), off), 0xFFFFFFFF);
+    uint32_t metadata_size = ReadAt<uint32_t>(stream.data(), off + 4);
+    off += 8;
+    if (metadata_size == 0) {
+      eos = true;
+      continue;
+    }
+    ASSERT_EQ(metadata_size % 8, 0u);
+    const uint8_t* fb = stream.data() + off;
+    FbTable message{fb, ReadAt<uint32_t>(fb, 0)};
+    EXPECT_EQ(message.Scalar<int16_t>(0), 4);  // MetadataVersion.V5
+    uint8_t header_type = message.Scalar<uint8_t>(1);
+    int64_t body_size = message.Scalar<int64_t>(3);
+    off += metadata_size;
+    ASSERT_LE(off + static_cast<size_t>(body_size), stream.size());
+
+    FbTable header = message.Table(2);
+    if (header_type == 1) {  // Schema
+      uint32_t fields = header.Deref(1);
+      uint32_t count = ReadAt<uint32_t>(fb, fields);
+      for (uint32_t i = 0; i < count; ++i) {
+        uint32_t elem = fields + 4 + 4 * i;
+        FbTable field{fb, elem + ReadAt<uint32_t>(fb, elem)};
+        uint32_t name = field.Deref(0);
+        names.emplace_back(reinterpret_cast<const char*>(fb + name + 4),
+                           ReadAt<uint32_t>(fb, name));
+        types.push_back(field.Scalar<uint8_t>(2));
+        EXPECT_NE(field.FieldPos(3), 0u);  // type
+        EXPECT_NE(field.FieldPos(5), 0u);  // children
+        if (types.back() == 2) {
+          EXPECT_EQ(field.Table(3).Scalar<int32_t>(0), 64);  // bitWidth
+          EXPECT_EQ(field.Table(3).Scalar<uint8_t>(1), 1);   // is_signed
+        }
+      }
+    } else {
+      ASSERT_EQ(header_type, 3);  // RecordBatch
+      ParseBatch(header, stream.data() + off);
+    }
+    off += static_cast<size_t>(body_size);
+  }
+}
+
+void ArrowStream::ParseBatch(const FbTable& batch, const uint8_t* body) {
+  ++num_batches;
+  const uint8_t* fb = batch.buf;
+  int64_t length = batch.Scalar<int64_t>(0);
+  uint32_t nodes = batch.Deref(1);
+  uint32_t buffers = batch.Deref(2);
+  ASSERT_EQ(ReadAt<uint32_t>(fb, nodes), types.size());
+  ASSERT_EQ((nodes + 4) % 8, 0u);
+  ASSERT_EQ((buffers + 4) % 8, 0u);
+
+  size_t first_row = rows.size();
+  rows.resize(first_row + static_cast<size_t>(length));
+  uint32_t buffer_idx = 0;
+  auto next_buffer = [&]() {
+    uint32_t pos = buffers + 4 + 16 * buffer_idx++;
+    int64_t offset = ReadAt<int64_t>(fb, pos);
+    EXPECT_EQ(offset % 8, 0);
+    return body + offset;
+  };
+  for (uint32_t c = 0; c < types.size(); ++c) {
+    uint32_t node = nodes + 4 + 16 * c;
+    EXPECT_EQ(ReadAt<int64_t>(fb, node), length);
+    int64_t null_count = ReadAt<int64_t>(fb, node + 8);
+    if (types[c] == 1) {  // Null
+      EXPECT_EQ(null_count, length);
+      for (int64_t r = 0; r < length; ++r)
+        rows[first_row + static_cast<size_t>(r)].push_back("NULL");
+      continue;
+    }
+    const uint8_t* validity = next_buffer();
+    const uint8_t* values = next_buffer();
+    const uint8_t* data = types[c] == 4 || types[c] == 5 ? next_buffer()
+                                                          : nullptr;
+    int64_t nulls_seen = 0;
+    for (int64_t r = 0; r < length; ++r) {
+      auto& row = rows[first_row + static_cast<size_t>(r)];
+      size_t i = static_cast<size_t>(r);
+      if (null_count > 0 && !((validity[i / 8] >> (i % 8)) & 1)) {
+        row.push_back("NULL");
+        ++nulls_seen;
+        continue;
+      }
+      if (types[c] == 2) {
+        row.push_back(std::to_string(ReadAt<int64_t>(values, i * 8)));
+      } else if (types[c] == 3) {
+        row.push_back(std::to_string(ReadAt<double>(values, i * 8)));
+      } else {
+        int32_t begin = ReadAt<int32_t>(values, i * 4);
+        int32_t end = ReadAt<int32_t>(values, (i + 1) * 4);
+        std::string str(reinterpret_cast<const char*>(data + begin),
+                        static_cast<size_t>(end - begin));
+        row.push_back(types[c] == 5 ? str : "X'" + base::ToHex(str) + "'");
+      }
+    }
+    EXPECT_EQ(nulls_seen, null_count);
+  }
+}
+
+void SerializeAll(ArrowIpcSerializer* serializer, ArrowStream* stream) {
+  std::vector<uint8_t> buf;
+  while (serializer->Serialize(&buf)) {
+  }
+  stream->Parse(buf);
+}
+
+TEST(ArrowIpcSerializerTest, TypesAndNulls) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery(
+      "select 1 as i, 2.5 as d, 'foo' as s, x'0102' as b, null as n "
+      "union all select null, 1, null, x'', null "
+      "union all select -3, null, '', null, null");
+  ArrowIpcSerializer serializer(std::move(iter));
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok()) << serializer.status().message();
+  EXPECT_TRUE(stream.eos);
+  EXPECT_THAT(stream.names, ElementsAre("i", "d", "s", "b", "n"));
+  EXPECT_THAT(stream.types, ElementsAre(2, 3, 5, 4, 1));
+  ASSERT_EQ(stream.rows.size(), 3u);
+  EXPECT_THAT(stream.rows[0],
+              ElementsAre("1", "2.500000", "foo", "X'0102'", "NULL"));
+  // The INTEGER in the double column is converted.
+  EXPECT_THAT(stream.rows[1],
+              ElementsAre("NULL", "1.000000", "NULL", "X''", "NULL"));
+  EXPECT_THAT(stream.rows[2], ElementsAre("-3", "NULL", "", "NULL", "NULL"));
+}
+
+TEST(ArrowIpcSerializerTest, MultipleBatches) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery(
+      "with recursive r(x) as (select 0 union all select x + 1 from r "
+      "where x < 99) select x, iif(x % 3 = 0, null, 'v' || x) as s from r");
+  ArrowIpcSerializer serializer(std::move(iter));
+  serializer.set_rows_per_batch_for_testing(16);
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok()) << serializer.status().message();
+  EXPECT_EQ(stream.num_batches, 7u);
+  ASSERT_THAT(stream.types, ElementsAre(2, 5));
+  ASSERT_EQ(stream.rows.size(), 100u);
+  for (uint32_t i = 0; i < 100; ++i) {
+    EXPECT_EQ(stream.rows[i][0], std::to_string(i));
+    EXPECT_EQ(stream.rows[i][1], i % 3 ? "v" + std::to_string(i) : "NULL");
+  }
+}
+
+TEST(ArrowIpcSerializerTest, FirstBatchGrowsUntilTyped) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery(
+      "with recursive r(x) as (select 0 union all select x + 1 from r "
+      "where x < 39) select x, iif(x < 20, null, x) as late from r");
+  ArrowIpcSerializer serializer(std::move(iter));
+  serializer.set_rows_per_batch_for_testing(16);
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok()) << serializer.status().message();
+  // The first batch ends with the first non-NULL value of |late| (21 rows).
+  EXPECT_EQ(stream.num_batches, 3u);
+  ASSERT_THAT(stream.types, ElementsAre(2, 2));
+  ASSERT_EQ(stream.rows.size(), 40u);
+  EXPECT_THAT(stream.rows[19], ElementsAre("19", "NULL"));
+  EXPECT_THAT(stream.rows[39], ElementsAre("39", "39"));
+}
+
+TEST(ArrowIpcSerializerTest, DeclaredTypeOfNullColumn) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto setup = tp->ExecuteQuery(
+      "create table t(i BIGINT, s TEXT, d DOUBLE, n); "
+      "insert into t values (null, null, null, null), (1, 'a', 2.5, null)");
+  ASSERT_FALSE(setup.Next());
+  ASSERT_TRUE(setup.Status().ok()) << setup.Status().message();
+  auto iter = tp->ExecuteQuery("select * from t");
+  ArrowIpcSerializer serializer(std::move(iter));
+  serializer.set_rows_per_batch_for_testing(1);
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok()) << serializer.status().message();
+  // |n| has no declared type, so keeps the first batch growing until the end.
+  EXPECT_EQ(stream.num_batches, 1u);
+  ASSERT_THAT(stream.types, ElementsAre(2, 5, 3, 1));
+  ASSERT_EQ(stream.rows.size(), 2u);
+  EXPECT_THAT(stream.rows[0], ElementsAre("NULL", "NULL", "NULL", "NULL"));
+  EXPECT_THAT(stream.rows[1], ElementsAre("1", "a", "2.500000", "NULL"));
+}
+
+TEST(ArrowIpcSerializerTest, TypeMismatch) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery("select 1 as x union all select 'foo'");
+  ArrowIpcSerializer serializer(std::move(iter));
+  std::vector<uint8_t> buf;
+  EXPECT_FALSE(serializer.Serialize(&buf));
+  EXPECT_FALSE(serializer.status().ok());
+}
+
+TEST(ArrowIpcSerializerTest, IteratorOnFirstRow) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery("select 1 as x union all select 2");
+  ASSERT_TRUE(iter.Next());
+  ArrowIpcSerializer serializer(
+      std::move(iter), ArrowIpcSerializer::IteratorState::kOnFirstRow);
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok());
+  ASSERT_EQ(stream.rows.size(), 2u);
+  EXPECT_THAT(stream.rows[0], ElementsAre("1"));
+  EXPECT_THAT(stream.rows[1], ElementsAre("2"));
+}
+
+TEST(ArrowIpcSerializerTest, EmptyResult) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery("select 1 as x where 0");
+  ArrowIpcSerializer serializer(std::move(iter));
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok());
+  EXPECT_TRUE(stream.eos);
+  EXPECT_THAT(stream.names, ElementsAre("x"));
+  EXPECT_EQ(stream.num_batches, 0u);
+}
+
+TEST(ArrowIpcSerializerTest, IteratorAtEnd) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  auto iter = tp->ExecuteQuery("select 1 as x where 0");
+  ASSERT_FALSE(iter.Next());
+  ArrowIpcSerializer serializer(std::move(iter),
+                                ArrowIpcSerializer::IteratorState::kAtEnd);
+  ArrowStream stream;
+  SerializeAll(&serializer, &stream);
+
+  ASSERT_TRUE(serializer.status().ok());
+  EXPECT_TRUE(stream.eos);
+  EXPECT_THAT(stream.names, ElementsAre("x"));
+  EXPECT_EQ(stream.num_batches, 0u);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
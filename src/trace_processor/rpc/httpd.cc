@@ -14,12 +14,15 @@
  * limitations under the License.
  */
 
+#include <cinttypes>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <initializer_list>
 #include <memory>
 #include <optional>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
@@ -29,10 +32,12 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/unix_task_runner.h"
+#include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/trace_processor/rpc/httpd.h"
 #include "src/trace_processor/rpc/rpc.h"
+#include "src/trace_processor/rpc/trace_instance_pool.h"
 
 #include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
 
@@ -56,13 +61,14 @@ class Httpd : public base::HttpRequestHandler {
   ~Httpd() override;
   void Run(int port);
 
+  // Also used by MultiTraceHttpd.
+  static void ServeHelpPage(const base::HttpRequest&);
+
  private:
   // HttpRequestHandler implementation.
   void OnHttpRequest(const base::HttpRequest&) override;
   void OnWebsocketMessage(const base::WebsocketMessage&) override;
 
-  static void ServeHelpPage(const base::HttpRequest&);
-
   Rpc global_trace_processor_rpc_;
   base::UnixTaskRunner task_runner_;
   base::HttpServer http_srv_;
@@ -72,6 +78,16 @@ base::StringView Vec2Sv(const std::vector<uint8_t>& v) {
   return {reinterpret_cast<const char*>(v.data()), v.size()};
 }
 
+// Sends one chunk of a reply using the chunked transfer encoding.
+void SendHttpChunk(base::HttpServerConnection* conn,
+                   const void* data,
+                   size_t len) {
+  base::StackString<32> chunk_hdr("%zx\r\n", len);
+  conn->SendResponseBody(chunk_hdr.c_str(), chunk_hdr.len());
+  conn->SendResponseBody(data, len);
+  conn->SendResponseBody("\r\n", 2);
+}
+
 // Used both by websockets and /rpc chunked HTTP endpoints.
 void SendRpcChunk(base::HttpServerConnection* conn,
                   const void* data,
@@ -86,10 +102,7 @@ void SendRpcChunk(base::HttpServerConnection* conn,
   if (conn->is_websocket()) {
     conn->SendWebsocketMessage(data, len);
   } else {
-    base::StackString<32> chunk_hdr("%x\r\n", len);
-    conn->SendResponseBody(chunk_hdr.c_str(), chunk_hdr.len());
-    conn->SendResponseBody(data, len);
-    conn->SendResponseBody("\r\n", 2);
+    SendHttpChunk(conn, data, len);
   }
 }
 
@@ -258,6 +271,323 @@ void Httpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
   global_trace_processor_rpc_.SetRpcResponseFunction(nullptr);
 }
 
+// The HTTP server used in multi-trace mode (see RunMultiTraceHttpRPCServer()).
+// This class, and hence all the socket I/O, lives on the main thread, while
+// the requests are dispatched to the worker thread of their trace instance
+// (see TraceInstancePool). The replies are posted back to the main thread as
+// they are produced. As their size is not known when the request is handed
+// over, all the HTTP replies use the chunked transfer encoding.
+class MultiTraceHttpd : public base::HttpRequestHandler {
+ public:
+  explicit MultiTraceHttpd(const TraceInstancePool::Config&);
+  ~MultiTraceHttpd() override;
+  void Run(int port);
+
+ private:
+  // Runs a function on the main thread with a connection, as long as the
+  // connection is still open by then. Can be called on any thread.
+  using ConnTask = std::function<void(base::HttpServerConnection*)>;
+  using ConnPoster = std::function<void(ConnTask)>;
+
+  // HttpRequestHandler implementation.
+  void OnHttpRequest(const base::HttpRequest&) override;
+  void OnWebsocketMessage(const base::WebsocketMessage&) override;
+  void OnHttpConnectionClosed(base::HttpServerConnection*) override;
+
+  ConnPoster MakeConnPoster(base::HttpServerConnection*);
+  void ServeTraceList(base::HttpServerConnection*);
+
+  static Rpc::RpcResponseFunction MakeRpcResponseFunction(const ConnPoster&);
+
+  base::UnixTaskRunner task_runner_;
+  base::HttpServer http_srv_;
+  TraceInstancePool pool_;
+
+  // Open connections, each with a unique generation number. This tells apart
+  // a connection from a newer one allocated at the same address after the
+  // first one has been closed.
+  std::unordered_map<base::HttpServerConnection*, uint64_t> conn_generations_;
+  uint64_t last_conn_generation_ = 0;
+
+  // The trace id of each websocket connection, taken from the handshake URI.
+  std::unordered_map<base::HttpServerConnection*, std::string>
+      websocket_trace_ids_;
+
+  base::WeakPtrFactory<MultiTraceHttpd> weak_factory_{this};  // Keep last.
+};
+
+constexpr char kTraceIdHeader[] = "x-perfetto-trace-id";
+constexpr char kWebsocketUriPrefix[] = "/websocket/";
+constexpr char kDefaultTraceId[] = "default";
+constexpr size_t kMaxTraceIdLength = 128;
+
+// Returns the trace id of a request, taken from the x-perfetto-trace-id header
+// or, for websockets (for which browsers can't set headers), from the URI
+// (/websocket/$trace_id). Returns std::nullopt if the id is not valid.
+std::optional<std::string> GetTraceId(const base::HttpRequest& req) {
+  base::StringView id;
+  if (req.is_websocket_handshake) {
+    base::StringView prefix(kWebsocketUriPrefix);
+    if (req.uri.StartsWith(prefix))
+      id = req.uri.substr(prefix.size());
+  } else {
+    id = req.GetHeader(kTraceIdHeader).value_or(base::StringView());
+  }
+  if (id.empty())
+    return kDefaultTraceId;
+  if (id.size() > kMaxTraceIdLength)
+    return std::nullopt;
+  for (char c : id) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_' &&
+        c != '.') {
+      return std::nullopt;
+    }
+  }
+  return id.ToStdString();
+}
+
+MultiTraceHttpd::MultiTraceHttpd(const TraceInstancePool::Config& config)
+    : http_srv_(&task_runner_, this), pool_(&task_runner_, config) {}
+MultiTraceHttpd::~MultiTraceHttpd() = default;
+
+void MultiTraceHttpd::Run(int port) {
+  PERFETTO_ILOG("[HTTP] Starting multi-trace RPC server on localhost:%d", port);
+  PERFETTO_LOG(
+      "[HTTP] Each client selects its trace with the \"%s\" header (or with "
+      "the %s$trace_id URI for websockets). The list of loaded traces is "
+      "available at /traces.",
+      kTraceIdHeader, kWebsocketUriPrefix);
+
+  for (const auto& kAllowedCORSOrigin : kAllowedCORSOrigins) {
+    http_srv_.AddAllowedOrigin(kAllowedCORSOrigin);
+  }
+  http_srv_.Start(port);
+  task_runner_.Run();
+}
+
+MultiTraceHttpd::ConnPoster MultiTraceHttpd::MakeConnPoster(
+    base::HttpServerConnection* conn) {
+  uint64_t generation = conn_generations_[conn];
+  auto weak_this = weak_factory_.GetWeakPtr();
+  base::TaskRunner* task_runner = &task_runner_;
+  return [weak_this, task_runner, conn, generation](ConnTask conn_task) {
+    task_runner->PostTask([weak_this, conn, generation, conn_task] {
+      if (!weak_this)
+        return;
+      auto it = weak_this->conn_generations_.find(conn);
+      if (it == weak_this->conn_generations_.end() || it->second != generation)
+        return;  // The connection has been closed in the meantime.
+      conn_task(conn);
+    });
+  };
+}
+
+// static
+Rpc::RpcResponseFunction MultiTraceHttpd::MakeRpcResponseFunction(
+    const ConnPoster& post) {
+  return [post](const void* data, uint32_t len) {
+    if (data == nullptr) {
+      post([](base::HttpServerConnection* conn) {
+        SendRpcChunk(conn, nullptr, 0);
+      });
+      return;
+    }
+    // |data| is only valid for the duration of this call.
+    const auto* bytes = static_cast<const uint8_t*>(data);
+    std::vector<uint8_t> chunk(bytes, bytes + len);
+    post([chunk](base::HttpServerConnection* conn) {
+      SendRpcChunk(conn, chunk.data(), static_cast<uint32_t>(chunk.size()));
+    });
+  };
+}
+
+void MultiTraceHttpd::OnHttpRequest(const base::HttpRequest& req) {
+  base::HttpServerConnection& conn = *req.conn;
+  if (conn_generations_.count(req.conn) == 0)
+    conn_generations_[req.conn] = ++last_conn_generation_;
+
+  std::initializer_list<const char*> default_headers = {
+      "Cache-Control: no-cache",               //
+      "Content-Type: application/x-protobuf",  //
+  };
+  std::initializer_list<const char*> chunked_headers = {
+      "Cache-Control: no-cache",               //
+      "Content-Type: application/x-protobuf",  //
+      "Transfer-Encoding: chunked",            //
+  };
+
+  if (req.uri == "/")
+    return Httpd::ServeHelpPage(req);
+
+  if (req.uri == "/traces")
+    return ServeTraceList(req.conn);
+
+  std::optional<std::string> trace_id = GetTraceId(req);
+  if (!trace_id) {
+    return conn.SendResponseAndClose("400 Bad Request", default_headers,
+                                     "Invalid trace id");
+  }
+
+  if (req.is_websocket_handshake &&
+      (req.uri == "/websocket" || req.uri.StartsWith(kWebsocketUriPrefix))) {
+    websocket_trace_ids_[req.conn] = *trace_id;
+    return conn.UpgradeToWebsocket(req);
+  }
+
+  if (req.uri == "/close_trace") {
+    bool found = pool_.DestroyInstance(*trace_id);
+    return conn.SendResponse(found ? "200 OK" : "404 Not Found",
+                             default_headers);
+  }
+
+  // Handled here rather than on the worker thread of the trace, which is busy
+  // running the query to interrupt.
+  if (req.uri == "/interrupt_query") {
+    bool found = pool_.InterruptQuery(*trace_id);
+    return conn.SendResponse(found ? "200 OK" : "404 Not Found",
+                             default_headers);
+  }
+
+  // All the other endpoints run on the worker thread of the trace. The body
+  // must be copied as it points into the receive buffer of the connection.
+  const auto* body_data = reinterpret_cast<const uint8_t*>(req.body.data());
+  std::vector<uint8_t> body(body_data, body_data + req.body.size());
+  ConnPoster post = MakeConnPoster(req.conn);
+  auto end_reply = [](base::HttpServerConnection* c) {
+    c->SendResponseBody("0\r\n\r\n", 5);
+  };
+
+  TraceInstancePool::RpcTask task;
+  if (req.uri == "/rpc") {
+    task = [body, post, end_reply](Rpc* rpc) {
+      rpc->SetRpcResponseFunction(MakeRpcResponseFunction(post));
+      rpc->OnRpcRequest(body.data(), body.size());
+      rpc->SetRpcResponseFunction(nullptr);
+      post(end_reply);
+    };
+  } else if (req.uri == "/query") {
+    task = [body, post, end_reply](Rpc* rpc) {
+      rpc->Query(body.data(), body.size(),
+                 [&](const uint8_t* buf, size_t len, bool has_more) {
+                   std::vector<uint8_t> chunk(buf, buf + len);
+                   post([chunk, has_more,
+                         end_reply](base::HttpServerConnection* c) {
+                     SendHttpChunk(c, chunk.data(), chunk.size());
+                     if (!has_more)
+                       end_reply(c);
+                   });
+                 });
+    };
+  } else {
+    // The legacy REST endpoints, which reply with a single message.
+    using Handler = std::function<std::vector<uint8_t>(
+        Rpc*, const std::vector<uint8_t>&)>;
+    Handler handler;
+    if (req.uri == "/status") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>&) {
+        return rpc->GetStatus();
+      };
+    } else if (req.uri == "/parse") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>& args) {
+        base::Status status = rpc->Parse(args.data(), args.size());
+        protozero::HeapBuffered<protos::pbzero::AppendTraceDataResult> result;
+        if (!status.ok()) {
+          result->set_error(status.c_message());
+        }
+        return result.SerializeAsArray();
+      };
+    } else if (req.uri == "/notify_eof") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>&) {
+        rpc->NotifyEndOfFile();
+        return std::vector<uint8_t>();
+      };
+    } else if (req.uri == "/restore_initial_tables") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>&) {
+        rpc->RestoreInitialTables();
+        return std::vector<uint8_t>();
+      };
+    } else if (req.uri == "/compute_metric") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>& args) {
+        return rpc->ComputeMetric(args.data(), args.size());
+      };
+    } else if (req.uri == "/enable_metatrace") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>& args) {
+        rpc->EnableMetatrace(args.data(), args.size());
+        return std::vector<uint8_t>();
+      };
+    } else if (req.uri == "/disable_and_read_metatrace") {
+      handler = [](Rpc* rpc, const std::vector<uint8_t>&) {
+        return rpc->DisableAndReadMetatrace();
+      };
+    } else {
+      return conn.SendResponseAndClose("404 Not Found", default_headers);
+    }
+    task = [body, post, end_reply, handler](Rpc* rpc) {
+      std::vector<uint8_t> res = handler(rpc, body);
+      post([res, end_reply](base::HttpServerConnection* c) {
+        if (!res.empty())
+          SendHttpChunk(c, res.data(), res.size());
+        end_reply(c);
+      });
+    };
+  }
+
+  base::Status status = pool_.PostTask(*trace_id, std::move(task));
+  if (!status.ok()) {
+    return conn.SendResponseAndClose("503 Service Unavailable",
+                                     default_headers,
+                                     base::StringView(status.message()));
+  }
+  // The chunks posted by the task can only be sent after this returns.
+  conn.SendResponseHeaders("200 OK", chunked_headers,
+                           base::HttpServerConnection::kOmitContentLength);
+}
+
+void MultiTraceHttpd::OnWebsocketMessage(const base::WebsocketMessage& msg) {
+  auto it = websocket_trace_ids_.find(msg.conn);
+  PERFETTO_DCHECK(it != websocket_trace_ids_.end());
+  if (it == websocket_trace_ids_.end())
+    return;
+
+  const auto* data = reinterpret_cast<const uint8_t*>(msg.data.data());
+  std::vector<uint8_t> req(data, data + msg.data.size());
+  ConnPoster post = MakeConnPoster(msg.conn);
+  base::Status status = pool_.PostTask(it->second, [req, post](Rpc* rpc) {
+    rpc->SetRpcResponseFunction(MakeRpcResponseFunction(post));
+    // OnRpcRequest() will call the response function one or more times.
+    rpc->OnRpcRequest(req.data(), req.size());
+    rpc->SetRpcResponseFunction(nullptr);
+  });
+  if (!status.ok()) {
+    PERFETTO_ELOG("[HTTP] %s", status.c_message());
+    msg.conn->Close();
+  }
+}
+
+void MultiTraceHttpd::OnHttpConnectionClosed(
+    base::HttpServerConnection* conn) {
+  conn_generations_.erase(conn);
+  websocket_trace_ids_.erase(conn);
+}
+
+void MultiTraceHttpd::ServeTraceList(base::HttpServerConnection* conn) {
+  std::string page = base::StackString<256>("%-40s %15s %10s %10s\n",
+                                            "trace_id", "trace_bytes",
+                                            "pending", "idle_s")
+                         .ToStdString();
+  for (const auto& s : pool_.GetStats()) {
+    page += base::StackString<256>("%-40s %15" PRIu64 " %10u %10" PRId64 "\n",
+                                   s.trace_id.c_str(), s.trace_bytes,
+                                   s.pending_tasks, s.idle_ms / 1000)
+                .ToStdString();
+  }
+  page += base::StackString<64>("Total trace bytes: %" PRIu64 "\n",
+                                pool_.total_trace_bytes())
+              .ToStdString();
+  conn->SendResponse("200 OK", {"Content-Type: text/plain"},
+                     base::StringView(page));
+}
+
 }  // namespace
 
 void RunHttpRPCServer(std::unique_ptr<TraceProcessor> preloaded_instance,
@@ -268,6 +598,14 @@ void RunHttpRPCServer(std::unique_ptr<TraceProcessor> preloaded_instance,
   srv.Run(port);
 }
 
+void RunMultiTraceHttpRPCServer(const std::string& port_number,
+                                const TraceInstancePool::Config& config) {
+  MultiTraceHttpd srv(config);
+  std::optional<int> port_opt = base::StringToInt32(port_number);
+  int port = port_opt.has_value() ? *port_opt : kBindPort;
+  srv.Run(port);
+}
+
 void Httpd::ServeHelpPage(const base::HttpRequest& req) {
   static const char kPage[] = R"(Perfetto Trace Processor RPC Server
 
@@ -20,6 +20,8 @@
 #include <memory>
 #include <string>
 
+#include "src/trace_processor/rpc/trace_instance_pool.h"
+
 namespace perfetto::trace_processor {
 
 class TraceProcessor;
@@ -31,6 +33,17 @@ class TraceProcessor;
 // instance when pushing data into the /parse endpoint.
 void RunHttpRPCServer(std::unique_ptr<TraceProcessor>, const std::string&);
 
+// Like RunHttpRPCServer(), but hosts one independent TraceProcessor instance
+// per trace, each on its own thread (see TraceInstancePool). Clients select
+// their trace with the x-perfetto-trace-id header or, for websockets, with the
+// /websocket/$trace_id URI. Requests without a trace id go to the "default"
+// trace. The /traces endpoint lists the loaded traces and their memory usage
+// and /close_trace destroys the instance of a trace. /interrupt_query
+// cancels the query the instance of a trace is running, e.g. when the client
+// supersedes it with a new one.
+void RunMultiTraceHttpRPCServer(const std::string&,
+                                const TraceInstancePool::Config&);
+
 }  // namespace perfetto::trace_processor
 
 #endif  // SRC_TRACE_PROCESSOR_RPC_HTTPD_H_
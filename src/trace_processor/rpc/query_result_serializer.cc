@@ -16,6 +16,8 @@
 
 #include "perfetto/ext/trace_processor/rpc/query_result_serializer.h"
 
+#include <algorithm>
+#include <string>
 #include <vector>
 
 #include "perfetto/protozero/packed_repeated_fields.h"
@@ -43,10 +45,71 @@ uint8_t MakeLenDelimTag(uint32_t field_num) {
   return static_cast<uint8_t>(tag);
 }
 
+// Appends |size| bytes of packed doubles as the |field_num| field of |msg|,
+// so that the payload starts at a 64-bit aligned offset of |writer|. The gap
+// is filled, if necessary, with the padding field which both CellsBatch and
+// CellsBatch.Column reserve.
+void AppendAlignedFloat64s(protozero::Message* msg,
+                           uint32_t field_num,
+                           const uint8_t* data,
+                           uint32_t size,
+                           const protozero::ScatteredStreamWriter& writer) {
+  uint8_t preamble[16];
+  uint8_t* preamble_end = &preamble[0];
+  *(preamble_end++) = MakeLenDelimTag(field_num);
+  preamble_end = pu::WriteVarInt(size, preamble_end);
+  uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
+
+  // The byte after the preamble must start at a 64bit-aligned offset.
+  // The padding needs to be > 1 Byte because of proto encoding.
+  const uint32_t off = static_cast<uint32_t>(writer.written() + preamble_size);
+  const uint32_t aligned_off = (off + 7) & ~7u;
+  uint32_t padding = aligned_off - off;
+  padding = padding == 1 ? 9 : padding;
+  if (padding > 0) {
+    uint8_t pad_buf[10];
+    uint8_t* pad = pad_buf;
+    *(pad++) = pu::MakeTagVarInt(kPaddingFieldId);
+    for (uint32_t i = 0; i < padding - 2; i++)
+      *(pad++) = 0x80;
+    *(pad++) = 0;
+    msg->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
+  }
+  msg->AppendRawProtoBytes(preamble, preamble_size);
+  PERFETTO_CHECK(writer.written() % 8 == 0);
+  msg->AppendRawProtoBytes(data, size);
+}
+
 }  // namespace
 
-QueryResultSerializer::QueryResultSerializer(Iterator iter)
-    : iter_(iter.take_impl()), num_cols_(iter_->ColumnCount()) {}
+struct QueryResultSerializer::ColumnBuffer {
+  void Clear() {
+    null_bitmap.clear();
+    cell_types.clear();
+    varints.clear();
+    doubles.clear();
+    strings.clear();
+    blobs.clear();
+    has_nulls = false;
+  }
+
+  std::vector<uint8_t> null_bitmap;
+  std::vector<uint8_t> cell_types;  // One entry per non-NULL cell.
+  std::vector<uint8_t> varints;     // Already varint-encoded.
+  std::vector<double> doubles;
+  std::string strings;              // NUL-separated.
+  std::vector<uint8_t> blobs;       // Already encoded as |blob_values|.
+  bool has_nulls = false;
+};
+
+QueryResultSerializer::QueryResultSerializer(Iterator iter,
+                                             BatchEncoding encoding)
+    : iter_(iter.take_impl()),
+      num_cols_(iter_->ColumnCount()),
+      encoding_(encoding) {
+  if (encoding_ == BatchEncoding::kColumnar)
+    column_buffers_.resize(num_cols_);
+}
 
 QueryResultSerializer::~QueryResultSerializer() = default;
 
@@ -71,7 +134,11 @@ bool QueryResultSerializer::Serialize(protos::pbzero::QueryResult* res) {
   // write an empty batch with the EOF marker. Errors can happen also in the
   // middle of a query, not just before starting it.
 
-  SerializeBatch(res);
+  if (encoding_ == BatchEncoding::kColumnar) {
+    SerializeColumnarBatch(res);
+  } else {
+    SerializeBatch(res);
+  }
   MaybeSerializeError(res);
   return !eof_reached_;
 }
@@ -208,32 +275,9 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   // a TypedArray, without extra copies.
   const uint32_t doubles_size = static_cast<uint32_t>(doubles.size());
   if (doubles_size > 0) {
-    uint8_t preamble[16];
-    uint8_t* preamble_end = &preamble[0];
-    *(preamble_end++) = MakeLenDelimTag(BatchProto::kFloat64CellsFieldNumber);
-    preamble_end = pu::WriteVarInt(doubles_size, preamble_end);
-    uint32_t preamble_size = static_cast<uint32_t>(preamble_end - &preamble[0]);
-
-    // The byte after the preamble must start at a 64bit-aligned offset.
-    // The padding needs to be > 1 Byte because of proto encoding.
-    const uint32_t off =
-        static_cast<uint32_t>(writer.written() + preamble_size);
-    const uint32_t aligned_off = (off + 7) & ~7u;
-    uint32_t padding = aligned_off - off;
-    padding = padding == 1 ? 9 : padding;
-    if (padding > 0) {
-      uint8_t pad_buf[10];
-      uint8_t* pad = pad_buf;
-      *(pad++) = pu::MakeTagVarInt(kPaddingFieldId);
-      for (uint32_t i = 0; i < padding - 2; i++)
-        *(pad++) = 0x80;
-      *(pad++) = 0;
-      batch->AppendRawProtoBytes(pad_buf, static_cast<size_t>(pad - pad_buf));
-    }
-    batch->AppendRawProtoBytes(preamble, preamble_size);
-    PERFETTO_CHECK(writer.written() % 8 == 0);
-    batch->AppendRawProtoBytes(doubles.data(), doubles_size);
-  }  // if (doubles_size > 0)
+    AppendAlignedFloat64s(batch, BatchProto::kFloat64CellsFieldNumber,
+                          doubles.data(), doubles_size, writer);
+  }
 
   // Append the blobs.
   if (blobs.size() > 0) {
@@ -250,6 +294,144 @@ void QueryResultSerializer::SerializeBatch(protos::pbzero::QueryResult* res) {
   batch->Finalize();
 }
 
+void QueryResultSerializer::SerializeColumnarBatch(
+    protos::pbzero::QueryResult* res) {
+  // Rows are still pulled from the iterator one at a time, so the cells are
+  // first scattered into per-column buffers and each column is written as a
+  // whole at the end of the batch. The batch splitting logic is the same as
+  // SerializeBatch().
+  using ColumnProto = BatchProto::Column;
+
+  const auto& writer = *res->stream_writer();
+  auto* batch = res->add_batch();
+
+  for (ColumnBuffer& col_buf : column_buffers_)
+    col_buf.Clear();
+
+  uint32_t approx_batch_size = 16;
+  uint32_t row = 0;
+  bool batch_full = false;
+
+  for (;; ++row) {
+    // As in SerializeBatch(), col_ == 0 here means that a row was fetched by
+    // the previous batch but didn't fit in it.
+    if (col_ >= num_cols_) {
+      col_ = 0;
+      if (!iter_->Next())
+        break;  // EOF or error.
+    }
+    PERFETTO_DCHECK(num_cols_ > 0);
+    if ((row + 1) * num_cols_ > cells_per_batch_ ||
+        approx_batch_size > batch_split_threshold_) {
+      batch_full = true;
+      break;
+    }
+
+    const uint32_t bitmap_byte = row / 8;
+    const uint8_t bitmap_bit = static_cast<uint8_t>(1u << (row % 8));
+    for (uint32_t c = 0; c < num_cols_; ++c) {
+      ColumnBuffer& col_buf = column_buffers_[c];
+      if (bitmap_byte >= col_buf.null_bitmap.size())
+        col_buf.null_bitmap.push_back(0);
+
+      auto value = iter_->Get(c);
+      switch (value.type) {
+        case SqlValue::Type::kNull: {
+          col_buf.null_bitmap[bitmap_byte] |= bitmap_bit;
+          col_buf.has_nulls = true;
+          break;
+        }
+        case SqlValue::Type::kLong: {
+          col_buf.cell_types.push_back(BatchProto::CELL_VARINT);
+          uint8_t varint[pu::kMaxSimpleFieldEncodedSize];
+          uint8_t* varint_end = pu::WriteVarInt(value.long_value, varint);
+          col_buf.varints.insert(col_buf.varints.end(), varint, varint_end);
+          approx_batch_size += 4;
+          break;
+        }
+        case SqlValue::Type::kDouble: {
+          col_buf.cell_types.push_back(BatchProto::CELL_FLOAT64);
+          col_buf.doubles.push_back(value.double_value);
+          approx_batch_size += sizeof(double);
+          break;
+        }
+        case SqlValue::Type::kString: {
+          col_buf.cell_types.push_back(BatchProto::CELL_STRING);
+          size_t len_with_nul = strlen(value.string_value) + 1;
+          col_buf.strings.append(value.string_value, len_with_nul);
+          approx_batch_size += static_cast<uint32_t>(len_with_nul);
+          break;
+        }
+        case SqlValue::Type::kBytes: {
+          col_buf.cell_types.push_back(BatchProto::CELL_BLOB);
+          auto* src = static_cast<const uint8_t*>(value.bytes_value);
+          uint32_t len = static_cast<uint32_t>(value.bytes_count);
+          uint8_t preamble[16];
+          uint8_t* preamble_end = &preamble[0];
+          *(preamble_end++) =
+              MakeLenDelimTag(ColumnProto::kBlobValuesFieldNumber);
+          preamble_end = pu::WriteVarInt(len, preamble_end);
+          col_buf.blobs.insert(col_buf.blobs.end(), preamble, preamble_end);
+          col_buf.blobs.insert(col_buf.blobs.end(), src, src + len);
+          approx_batch_size += len + 4;
+          break;
+        }
+      }
+    }
+    col_ = num_cols_;
+  }  // for (row)
+
+  for (uint32_t c = 0; c < num_cols_ && row > 0; ++c) {
+    const ColumnBuffer& col_buf = column_buffers_[c];
+    auto* column = batch->add_columns();
+    if (col_buf.has_nulls) {
+      column->set_null_bitmap(col_buf.null_bitmap.data(),
+                              col_buf.null_bitmap.size());
+    }
+
+    // Emit a single type for the whole column unless the types are mixed,
+    // which SQLite allows but is rare in practice.
+    const auto& types = col_buf.cell_types;
+    if (!types.empty()) {
+      bool mixed = std::any_of(types.begin(), types.end(),
+                               [&](uint8_t t) { return t != types[0]; });
+      if (mixed) {
+        column->AppendBytes(ColumnProto::kCellTypesFieldNumber, types.data(),
+                            types.size());
+      } else {
+        column->set_type(static_cast<BatchProto::CellType>(types[0]));
+      }
+    }
+
+    if (!col_buf.varints.empty()) {
+      column->AppendBytes(ColumnProto::kVarintValuesFieldNumber,
+                          col_buf.varints.data(), col_buf.varints.size());
+    }
+    if (!col_buf.doubles.empty()) {
+      AppendAlignedFloat64s(
+          column, ColumnProto::kFloat64ValuesFieldNumber,
+          reinterpret_cast<const uint8_t*>(col_buf.doubles.data()),
+          static_cast<uint32_t>(col_buf.doubles.size() * sizeof(double)),
+          writer);
+    }
+    if (!col_buf.strings.empty()) {
+      column->AppendBytes(ColumnProto::kStringValuesFieldNumber,
+                          col_buf.strings.data(), col_buf.strings.size());
+    }
+    if (!col_buf.blobs.empty())
+      column->AppendRawProtoBytes(col_buf.blobs.data(), col_buf.blobs.size());
+    column->Finalize();
+  }
+  if (row > 0)
+    batch->set_row_count(row);
+
+  if (!batch_full) {
+    eof_reached_ = true;
+    batch->set_is_last_batch(true);
+  }
+  batch->Finalize();
+}
+
 void QueryResultSerializer::MaybeSerializeError(
     protos::pbzero::QueryResult* res) {
   if (iter_->Status().ok())
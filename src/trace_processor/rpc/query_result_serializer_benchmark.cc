@@ -16,6 +16,10 @@
 
 #include "perfetto/ext/trace_processor/rpc/query_result_serializer.h"
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
 #include "perfetto/trace_processor/basic_types.h"
@@ -25,6 +29,7 @@ using perfetto::trace_processor::Config;
 using perfetto::trace_processor::QueryResultSerializer;
 using perfetto::trace_processor::TraceProcessor;
 using VectorType = std::vector<uint8_t>;
+using BatchEncoding = QueryResultSerializer::BatchEncoding;
 
 namespace {
 
@@ -46,51 +51,73 @@ void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   PERFETTO_CHECK(iter.Status().ok());
 }
 
-}  // namespace
-
-static void BM_QueryResultSerializer_Mixed(benchmark::State& state) {
-  auto tp = TraceProcessor::CreateInstance(Config());
-  RunQueryChecked(tp.get(), "create virtual table win using window;");
-  RunQueryChecked(tp.get(),
-                  "update win set window_start=0, window_dur=50000, quantum=1 "
-                  "where rowid = 0");
+// Serializes the result of |query| in batches, dropping each batch before
+// pulling the next one (as Rpc::Query() does), and reports the throughput in
+// terms of serialized bytes and rows.
+void RunSerializer(benchmark::State& state,
+                   TraceProcessor* tp,
+                   const char* query,
+                   uint32_t num_rows,
+                   BatchEncoding encoding) {
   VectorType buf;
+  size_t total_bytes = 0;
   for (auto _ : state) {
-    auto iter = tp->ExecuteQuery(
-        "select dur || dur as x, ts, dur * 1.0 as dur, quantum_ts from win");
-    QueryResultSerializer serializer(std::move(iter));
+    auto iter = tp->ExecuteQuery(query);
+    QueryResultSerializer serializer(std::move(iter), encoding);
     serializer.set_batch_size_for_testing(
         static_cast<uint32_t>(state.range(0)),
         static_cast<uint32_t>(state.range(1)));
-    while (serializer.Serialize(&buf)) {
+    for (bool has_more = true; has_more;) {
+      has_more = serializer.Serialize(&buf);
+      benchmark::DoNotOptimize(buf.data());
+      total_bytes += buf.size();
+      buf.clear();
     }
-    benchmark::DoNotOptimize(buf.data());
-    buf.clear();
   }
   benchmark::ClobberMemory();
+  state.SetBytesProcessed(static_cast<int64_t>(total_bytes));
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) * num_rows);
 }
 
-static void BM_QueryResultSerializer_Strings(benchmark::State& state) {
+std::unique_ptr<TraceProcessor> CreateWindowTable(uint32_t num_rows) {
   auto tp = TraceProcessor::CreateInstance(Config());
   RunQueryChecked(tp.get(), "create virtual table win using window;");
-  RunQueryChecked(tp.get(),
-                  "update win set window_start=0, window_dur=100000, quantum=1 "
-                  "where rowid = 0");
-  VectorType buf;
-  for (auto _ : state) {
-    auto iter = tp->ExecuteQuery(
-        "select  ts || '-' || ts , (dur * 1.0) || dur from win");
-    QueryResultSerializer serializer(std::move(iter));
-    serializer.set_batch_size_for_testing(
-        static_cast<uint32_t>(state.range(0)),
-        static_cast<uint32_t>(state.range(1)));
-    while (serializer.Serialize(&buf)) {
-    }
-    benchmark::DoNotOptimize(buf.data());
-    buf.clear();
-  }
-  benchmark::ClobberMemory();
+  RunQueryChecked(tp.get(), "update win set window_start=0, window_dur=" +
+                                std::to_string(num_rows) +
+                                ", quantum=1 where rowid = 0");
+  return tp;
+}
+
+constexpr char kMixedQuery[] =
+    "select dur || dur as x, ts, dur * 1.0 as dur, quantum_ts from win";
+constexpr char kStringsQuery[] =
+    "select  ts || '-' || ts , (dur * 1.0) || dur from win";
+
+}  // namespace
+
+static void BM_QueryResultSerializer_Mixed(benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  RunSerializer(state, tp.get(), kMixedQuery, 50000, BatchEncoding::kRowMajor);
+}
+
+static void BM_QueryResultSerializer_Strings(benchmark::State& state) {
+  auto tp = CreateWindowTable(100000);
+  RunSerializer(state, tp.get(), kStringsQuery, 100000,
+                BatchEncoding::kRowMajor);
+}
+
+static void BM_QueryResultSerializer_MixedColumnar(benchmark::State& state) {
+  auto tp = CreateWindowTable(50000);
+  RunSerializer(state, tp.get(), kMixedQuery, 50000, BatchEncoding::kColumnar);
+}
+
+static void BM_QueryResultSerializer_StringsColumnar(benchmark::State& state) {
+  auto tp = CreateWindowTable(100000);
+  RunSerializer(state, tp.get(), kStringsQuery, 100000,
+                BatchEncoding::kColumnar);
 }
 
 BENCHMARK(BM_QueryResultSerializer_Mixed)->Apply(BenchmarkArgs);
 BENCHMARK(BM_QueryResultSerializer_Strings)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_MixedColumnar)->Apply(BenchmarkArgs);
+BENCHMARK(BM_QueryResultSerializer_StringsColumnar)->Apply(BenchmarkArgs);
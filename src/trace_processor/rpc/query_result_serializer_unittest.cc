@@ -79,7 +79,8 @@ void RunQueryChecked(TraceProcessor* tp, const std::string& query) {
   ASSERT_TRUE(iter.Status().ok()) << iter.Status().message();
 }
 
-// Implements a minimal deserializer for QueryResultSerializer.
+// Implements a minimal deserializer for QueryResultSerializer. Both the
+// row-major and the columnar batches are flattened into |cells|, row by row.
 class TestDeserializer {
  public:
   void SerializeAndDeserialize(QueryResultSerializer*);
@@ -89,8 +90,21 @@ class TestDeserializer {
   std::vector<SqlValue> cells;
   std::string error;
   bool eof_reached = false;
+  uint32_t columnar_batches = 0;
 
  private:
+  // The not-yet-consumed payloads of a batch (or of a column).
+  struct Payloads {
+    std::deque<int64_t> varints;
+    std::deque<double> doubles;
+    std::deque<std::string> strings;
+    std::deque<std::string> blobs;
+  };
+
+  void DeserializeColumnarBatch(const BatchProto::Decoder&);
+  void AppendCell(uint8_t cell_type, Payloads*, std::vector<SqlValue>* out);
+  static std::deque<std::string> SplitStrings(const std::string& merged);
+
   std::vector<std::unique_ptr<char[]>> copied_buf_;
 };
 
@@ -117,72 +131,28 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
 
     ResultProto::CellsBatch::Decoder batch(batch_bytes.data, batch_bytes.size);
     eof_reached = batch.is_last_batch();
-    std::deque<int64_t> varints;
-    std::deque<double> doubles;
-    std::deque<std::string> blobs;
+    if (batch.has_row_count()) {
+      EXPECT_FALSE(batch.has_cells());
+      DeserializeColumnarBatch(batch);
+      continue;
+    }
 
+    Payloads payloads;
     bool parse_error = false;
     for (auto it = batch.varint_cells(&parse_error); it; ++it)
-      varints.emplace_back(*it);
+      payloads.varints.emplace_back(*it);
 
     for (auto it = batch.float64_cells(&parse_error); it; ++it)
-      doubles.emplace_back(*it);
+      payloads.doubles.emplace_back(*it);
 
     for (auto it = batch.blob_cells(); it; ++it)
-      blobs.emplace_back((*it).ToStdString());
+      payloads.blobs.emplace_back((*it).ToStdString());
 
-    std::string merged_strings = batch.string_cells().ToStdString();
-    std::deque<std::string> strings;
-    for (size_t pos = 0; pos < merged_strings.size();) {
-      // Will return npos for the last string, but it's fine
-      size_t next_sep = merged_strings.find('\0', pos);
-      strings.emplace_back(merged_strings.substr(pos, next_sep - pos));
-      pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
-    }
+    payloads.strings = SplitStrings(batch.string_cells().ToStdString());
 
     uint32_t num_cells = 0;
     for (auto it = batch.cells(&parse_error); it; ++it, ++num_cells) {
-      uint8_t cell_type = static_cast<uint8_t>(*it);
-      switch (cell_type) {
-        case BatchProto::CELL_INVALID:
-          break;
-        case BatchProto::CELL_NULL:
-          cells.emplace_back(SqlValue());
-          break;
-        case BatchProto::CELL_VARINT:
-          ASSERT_GT(varints.size(), 0u);
-          cells.emplace_back(SqlValue::Long(varints.front()));
-          varints.pop_front();
-          break;
-        case BatchProto::CELL_FLOAT64:
-          ASSERT_GT(doubles.size(), 0u);
-          cells.emplace_back(SqlValue::Double(doubles.front()));
-          doubles.pop_front();
-          break;
-        case BatchProto::CELL_STRING: {
-          ASSERT_GT(strings.size(), 0u);
-          const std::string& str = strings.front();
-          copied_buf_.emplace_back(new char[str.size() + 1]);
-          char* new_buf = copied_buf_.back().get();
-          memcpy(new_buf, str.c_str(), str.size() + 1);
-          cells.emplace_back(SqlValue::String(new_buf));
-          strings.pop_front();
-          break;
-        }
-        case BatchProto::CELL_BLOB: {
-          ASSERT_GT(blobs.size(), 0u);
-          auto bytes = blobs.front();
-          copied_buf_.emplace_back(new char[bytes.size()]);
-          memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
-          cells.emplace_back(
-              SqlValue::Bytes(copied_buf_.back().get(), bytes.size()));
-          blobs.pop_front();
-          break;
-        }
-        default:
-          FAIL() << "Unknown cell type " << cell_type;
-      }
-
+      AppendCell(static_cast<uint8_t>(*it), &payloads, &cells);
       EXPECT_FALSE(parse_error);
     }
     if (columns.empty()) {
@@ -193,6 +163,117 @@ void TestDeserializer::DeserializeBuffer(const uint8_t* start, size_t size) {
   }
 }
 
+void TestDeserializer::DeserializeColumnarBatch(
+    const BatchProto::Decoder& batch) {
+  ++columnar_batches;
+  const uint32_t row_count = batch.row_count();
+  std::vector<std::vector<SqlValue>> column_cells;
+  for (auto col_it = batch.columns(); col_it; ++col_it) {
+    auto col_bytes = col_it->as_bytes();
+    BatchProto::Column::Decoder col(col_bytes.data, col_bytes.size);
+
+    Payloads payloads;
+    bool parse_error = false;
+    for (auto it = col.varint_values(&parse_error); it; ++it)
+      payloads.varints.emplace_back(*it);
+    for (auto it = col.float64_values(&parse_error); it; ++it)
+      payloads.doubles.emplace_back(*it);
+    for (auto it = col.blob_values(); it; ++it)
+      payloads.blobs.emplace_back((*it).ToStdString());
+    payloads.strings = SplitStrings(col.string_values().ToStdString());
+
+    std::deque<uint8_t> cell_types;
+    for (auto it = col.cell_types(&parse_error); it; ++it)
+      cell_types.emplace_back(static_cast<uint8_t>(*it));
+    EXPECT_FALSE(parse_error);
+    EXPECT_TRUE(!col.has_type() || cell_types.empty());
+
+    protozero::ConstBytes null_bitmap = col.null_bitmap();
+    column_cells.emplace_back();
+    for (uint32_t row = 0; row < row_count; ++row) {
+      bool is_null = row / 8 < null_bitmap.size &&
+                     ((null_bitmap.data[row / 8] >> (row % 8)) & 1);
+      if (is_null) {
+        column_cells.back().emplace_back(SqlValue());
+        continue;
+      }
+      uint8_t cell_type = static_cast<uint8_t>(col.type());
+      if (!col.has_type()) {
+        ASSERT_GT(cell_types.size(), 0u);
+        cell_type = cell_types.front();
+        cell_types.pop_front();
+      }
+      AppendCell(cell_type, &payloads, &column_cells.back());
+    }
+    EXPECT_TRUE(payloads.varints.empty());
+    EXPECT_TRUE(payloads.doubles.empty());
+    EXPECT_TRUE(payloads.strings.empty());
+    EXPECT_TRUE(payloads.blobs.empty());
+  }
+
+  ASSERT_EQ(column_cells.size(), columns.size());
+  for (uint32_t row = 0; row < row_count; ++row) {
+    for (const auto& column : column_cells)
+      cells.emplace_back(column[row]);
+  }
+}
+
+void TestDeserializer::AppendCell(uint8_t cell_type,
+                                  Payloads* payloads,
+                                  std::vector<SqlValue>* out) {
+  switch (cell_type) {
+    case BatchProto::CELL_INVALID:
+      break;
+    case BatchProto::CELL_NULL:
+      out->emplace_back(SqlValue());
+      break;
+    case BatchProto::CELL_VARINT:
+      ASSERT_GT(payloads->varints.size(), 0u);
+      out->emplace_back(SqlValue::Long(payloads->varints.front()));
+      payloads->varints.pop_front();
+      break;
+    case BatchProto::CELL_FLOAT64:
+      ASSERT_GT(payloads->doubles.size(), 0u);
+      out->emplace_back(SqlValue::Double(payloads->doubles.front()));
+      payloads->doubles.pop_front();
+      break;
+    case BatchProto::CELL_STRING: {
+      ASSERT_GT(payloads->strings.size(), 0u);
+      const std::string& str = payloads->strings.front();
+      copied_buf_.emplace_back(new char[str.size() + 1]);
+      char* new_buf = copied_buf_.back().get();
+      memcpy(new_buf, str.c_str(), str.size() + 1);
+      out->emplace_back(SqlValue::String(new_buf));
+      payloads->strings.pop_front();
+      break;
+    }
+    case BatchProto::CELL_BLOB: {
+      ASSERT_GT(payloads->blobs.size(), 0u);
+      auto bytes = payloads->blobs.front();
+      copied_buf_.emplace_back(new char[bytes.size()]);
+      memcpy(copied_buf_.back().get(), bytes.data(), bytes.size());
+      out->emplace_back(
+          SqlValue::Bytes(copied_buf_.back().get(), bytes.size()));
+      payloads->blobs.pop_front();
+      break;
+    }
+    default:
+      FAIL() << "Unknown cell type " << cell_type;
+  }
+}
+
+std::deque<std::string> TestDeserializer::SplitStrings(
+    const std::string& merged) {
+  std::deque<std::string> strings;
+  for (size_t pos = 0; pos < merged.size();) {
+    // Will return npos for the last string, but it's fine
+    size_t next_sep = merged.find('\0', pos);
+    strings.emplace_back(merged.substr(pos, next_sep - pos));
+    pos = next_sep == std::string::npos ? next_sep : next_sep + 1;
+  }
+  return strings;
+}
+
 TEST(QueryResultSerializerTest, ShortBatch) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
 
@@ -385,10 +466,15 @@ TEST(QueryResultSerializerTest, RandomSizes) {
     }
   }
 
-  // Serialize and de-serialize with different batch and payload sizes.
-  for (int rep = 0; rep < 10; rep++) {
+  // Serialize and de-serialize with different batch and payload sizes, using
+  // both encodings. The columns have mixed types, which also exercises the
+  // |cell_types| fallback of the columnar encoding.
+  for (int rep = 0; rep < 20; rep++) {
     auto iter = tp->ExecuteQuery("select * from tab");
-    QueryResultSerializer ser(std::move(iter));
+    QueryResultSerializer ser(
+        std::move(iter),
+        rep % 2 ? QueryResultSerializer::BatchEncoding::kColumnar
+                : QueryResultSerializer::BatchEncoding::kRowMajor);
     uint32_t cells_per_batch = 1 << (rnd_engine() % 8 + 2);
     uint32_t binary_payload_size = 1 << (rnd_engine() % 8 + 8);
     ser.set_batch_size_for_testing(cells_per_batch, binary_payload_size);
@@ -401,6 +487,40 @@ TEST(QueryResultSerializerTest, RandomSizes) {
   }
 }
 
+TEST(QueryResultSerializerTest, ColumnarBatches) {
+  auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+
+  RunQueryChecked(tp.get(), "create virtual table win using window;");
+  RunQueryChecked(tp.get(),
+                  "update win set window_start=0, window_dur=1000, quantum=1 "
+                  "where rowid = 0");
+  auto iter = tp->ExecuteQuery(
+      "select 'x' || ts as x, ts, dur * 1.0 as dur, "
+      "iif(ts % 3 = 0, null, ts) as maybe_null from win");
+  QueryResultSerializer ser(std::move(iter),
+                            QueryResultSerializer::BatchEncoding::kColumnar);
+  ser.set_batch_size_for_testing(400, 4096);
+
+  TestDeserializer deser;
+  deser.SerializeAndDeserialize(&ser);
+
+  ASSERT_THAT(deser.columns, ElementsAre("x", "ts", "dur", "maybe_null"));
+  ASSERT_EQ(deser.cells.size(), 4 * 1000u);
+  EXPECT_GT(deser.columnar_batches, 1u);
+  for (uint32_t row = 0; row < 1000; row++) {
+    uint32_t cell = row * 4;
+    ASSERT_EQ(deser.cells[cell], SqlValue::String(
+                                     ("x" + std::to_string(row)).c_str()));
+    ASSERT_EQ(deser.cells[cell + 1], SqlValue::Long(row));
+    ASSERT_EQ(deser.cells[cell + 2], SqlValue::Double(1.0));
+    if (row % 3 == 0) {
+      ASSERT_EQ(deser.cells[cell + 3], SqlValue());
+    } else {
+      ASSERT_EQ(deser.cells[cell + 3], SqlValue::Long(row));
+    }
+  }
+}
+
 TEST(QueryResultSerializerTest, ErrorBeforeStartingQuery) {
   auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
   auto iter = tp->ExecuteQuery("insert into incomplete_input");
@@ -21,13 +21,16 @@
 #include <cstdio>
 #include <cstring>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/version.h"
 #include "perfetto/ext/protozero/proto_ring_buffer.h"
 #include "perfetto/ext/trace_processor/rpc/query_result_serializer.h"
@@ -36,6 +39,8 @@
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/metatrace_config.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/rpc/arrow_ipc_serializer.h"
+#include "src/trace_processor/rpc/trace_index.h"
 #include "src/trace_processor/tp_metatrace.h"
 
 #include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
@@ -93,12 +98,28 @@ void Response::Send(Rpc::RpcResponseFunction send_fn) {
   }
 }
 
+// Returns the config of the TraceProcessor instances, before the options sent
+// by the client are applied.
+Config DefaultConfig() {
+  Config config;
+#if PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  // The UI only loads the Wasm module with threads when they can be used, and
+  // has no way to set these, so turn on the parallel ingestion, span joins
+  // and heap graph analysis. Their pools, along with all the others, share
+  // a fixed number of threads (see base::ThreadPool).
+  config.tokenizer_thread_count = base::ThreadPool::MaxConcurrency();
+  config.span_join_thread_count = base::ThreadPool::MaxConcurrency();
+  config.heap_graph_thread_count = base::ThreadPool::MaxConcurrency();
+#endif
+  return config;
+}
+
 }  // namespace
 
 Rpc::Rpc(std::unique_ptr<TraceProcessor> preloaded_instance)
     : trace_processor_(std::move(preloaded_instance)) {
   if (!trace_processor_)
-    ResetTraceProcessorInternal(Config());
+    ResetTraceProcessorInternal(DefaultConfig());
 }
 
 Rpc::Rpc() : Rpc(nullptr) {}
@@ -106,7 +127,12 @@ Rpc::~Rpc() = default;
 
 void Rpc::ResetTraceProcessorInternal(const Config& config) {
   trace_processor_config_ = config;
-  trace_processor_ = TraceProcessor::CreateInstance(config);
+  std::unique_ptr<TraceProcessor> trace_processor =
+      TraceProcessor::CreateInstance(config);
+  {
+    std::lock_guard<std::mutex> lock(interrupt_mutex_);
+    trace_processor_.swap(trace_processor);
+  }
   bytes_parsed_ = bytes_last_progress_ = 0;
   t_parse_started_ = base::GetWallTimeNs().count();
   // Deliberately not resetting the RPC channel state (rxbuf_, {tx,rx}_seq_id_).
@@ -222,12 +248,47 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
         resp.Send(rpc_response_fn_);
       } else {
         protozero::ConstBytes args = req.query_args();
-        auto it = QueryInternal(args.data, args.size);
-        QueryResultSerializer serializer(std::move(it));
+        if (const auto* batches = FindIndexedResult(args.data, args.size)) {
+          for (const std::string& batch : *batches) {
+            Response resp(tx_seq_id_++, req_type);
+            resp->AppendBytes(RpcProto::kQueryResultFieldNumber, batch.data(),
+                              batch.size());
+            resp.Send(rpc_response_fn_);
+          }
+          break;
+        }
+        auto serializer = StartQuery(args.data, args.size);
+        for (bool has_more = true; has_more;) {
+          Response resp(tx_seq_id_++, req_type);
+          has_more = serializer->Serialize(resp->set_query_result());
+          resp.Send(rpc_response_fn_);
+        }
+      }
+      break;
+    }
+    case RpcProto::TPM_QUERY_ARROW: {
+      if (!req.has_query_args()) {
+        Response resp(tx_seq_id_++, req_type);
+        auto* result = resp->set_arrow_query_result();
+        result->set_error(kErrFieldNotSet);
+        result->set_is_last(true);
+        resp.Send(rpc_response_fn_);
+      } else {
+        protozero::ConstBytes args = req.query_args();
+        ArrowIpcSerializer serializer(QueryInternal(args.data, args.size));
+        std::vector<uint8_t> chunk;
         for (bool has_more = true; has_more;) {
+          has_more = serializer.Serialize(&chunk);
           Response resp(tx_seq_id_++, req_type);
-          has_more = serializer.Serialize(resp->set_query_result());
+          auto* result = resp->set_arrow_query_result();
+          result->set_ipc_stream_chunk(chunk.data(), chunk.size());
+          if (!has_more) {
+            if (!serializer.status().ok())
+              result->set_error(serializer.status().message());
+            result->set_is_last(true);
+          }
           resp.Send(rpc_response_fn_);
+          chunk.clear();
         }
       }
       break;
@@ -253,7 +314,7 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       break;
     }
     case RpcProto::TPM_RESTORE_INITIAL_TABLES: {
-      trace_processor_->RestoreInitialTables();
+      RestoreInitialTables();
       Response resp(tx_seq_id_++, req_type);
       resp.Send(rpc_response_fn_);
       break;
@@ -287,6 +348,21 @@ void Rpc::ParseRpcRequest(const uint8_t* data, size_t len) {
       resp.Send(rpc_response_fn_);
       break;
     }
+    case RpcProto::TPM_LOAD_TRACE_INDEX: {
+      Response resp(tx_seq_id_++, req_type);
+      auto* result = resp->set_load_trace_index_result();
+      if (!req.has_trace_index()) {
+        result->set_error(kErrFieldNotSet);
+      } else {
+        protozero::ConstBytes args = req.trace_index();
+        base::Status status = LoadTraceIndex(args.data, args.size);
+        if (!status.ok())
+          result->set_error(status.message());
+        result->set_query_count(static_cast<uint32_t>(trace_index_.size()));
+      }
+      resp.Send(rpc_response_fn_);
+      break;
+    }
     default: {
       // This can legitimately happen if the client is newer. We reply with a
       // generic "unkown request" response, so the client can do feature
@@ -315,6 +391,15 @@ base::Status Rpc::Parse(const uint8_t* data, size_t len) {
   bytes_parsed_ += len;
   MaybePrintProgress();
 
+  if (!trace_index_.empty() &&
+      bytes_parsed_ > trace_index_.trace_size_bytes()) {
+    PERFETTO_ELOG(
+        "The trace is larger than the one of the trace index (%" PRIu64
+        " bytes), ignoring the index",
+        trace_index_.trace_size_bytes());
+    trace_index_.Clear();
+  }
+
   if (len == 0)
     return base::OkStatus();
 
@@ -331,12 +416,42 @@ void Rpc::NotifyEndOfFile() {
   trace_processor_->NotifyEndOfFile();
   eof_ = true;
   MaybePrintProgress();
+
+  // From now on the trace itself can answer the queries of the index.
+  trace_index_.Clear();
+}
+
+base::Status Rpc::LoadTraceIndex(const uint8_t* data, size_t len) {
+  base::Status status = trace_index_.Parse(data, len);
+  if (!status.ok())
+    return status;
+  if (bytes_parsed_ > trace_index_.trace_size_bytes()) {
+    uint64_t trace_size_bytes = trace_index_.trace_size_bytes();
+    trace_index_.Clear();
+    return base::ErrStatus(
+        "The trace index is for a trace of %" PRIu64
+        " bytes but %zu bytes were already loaded",
+        trace_size_bytes, bytes_parsed_);
+  }
+  PERFETTO_ILOG("Loaded trace index with %zu queries", trace_index_.size());
+  return base::OkStatus();
+}
+
+const std::vector<std::string>* Rpc::FindIndexedResult(const uint8_t* args,
+                                                       size_t len) {
+  if (trace_index_.empty())
+    return nullptr;
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  // The index only holds results with the row-major encoding.
+  if (query.columnar_batches())
+    return nullptr;
+  return trace_index_.Find(query.sql_query().ToStdString());
 }
 
 void Rpc::ResetTraceProcessor(const uint8_t* args, size_t len) {
   protos::pbzero::ResetTraceProcessorArgs::Decoder reset_trace_processor_args(
       args, len);
-  Config config;
+  Config config = DefaultConfig();
   if (reset_trace_processor_args.has_drop_track_event_data_before()) {
     config.drop_track_event_data_before =
         reset_trace_processor_args.drop_track_event_data_before() ==
@@ -349,6 +464,10 @@ void Rpc::ResetTraceProcessor(const uint8_t* args, size_t len) {
     config.ingest_ftrace_in_raw_table =
         reset_trace_processor_args.ingest_ftrace_in_raw_table();
   }
+  if (reset_trace_processor_args.has_lazy_ftrace_raw_args()) {
+    config.lazy_ftrace_raw_args =
+        reset_trace_processor_args.lazy_ftrace_raw_args();
+  }
   if (reset_trace_processor_args.has_analyze_trace_proto_content()) {
     config.analyze_trace_proto_content =
         reset_trace_processor_args.analyze_trace_proto_content();
@@ -359,6 +478,7 @@ void Rpc::ResetTraceProcessor(const uint8_t* args, size_t len) {
             ? SoftDropFtraceDataBefore::kAllPerCpuBuffersValid
             : SoftDropFtraceDataBefore::kNoDrop;
   }
+  trace_index_.Clear();
   ResetTraceProcessorInternal(config);
 }
 
@@ -379,17 +499,36 @@ void Rpc::MaybePrintProgress() {
 void Rpc::Query(const uint8_t* args,
                 size_t len,
                 const QueryResultBatchCallback& result_callback) {
-  auto it = QueryInternal(args, len);
-  QueryResultSerializer serializer(std::move(it));
+  if (const auto* batches = FindIndexedResult(args, len)) {
+    for (size_t i = 0; i < batches->size(); ++i) {
+      const std::string& batch = (*batches)[i];
+      result_callback(reinterpret_cast<const uint8_t*>(batch.data()),
+                      batch.size(), i + 1 < batches->size());
+    }
+    return;
+  }
 
+  // Pull the next batch only after the callback has consumed the previous
+  // one, so that at most one batch is alive at any time.
+  auto serializer = StartQuery(args, len);
   std::vector<uint8_t> res;
   for (bool has_more = true; has_more;) {
-    has_more = serializer.Serialize(&res);
+    has_more = serializer->Serialize(&res);
     result_callback(res.data(), res.size(), has_more);
     res.clear();
   }
 }
 
+std::unique_ptr<QueryResultSerializer> Rpc::StartQuery(const uint8_t* args,
+                                                       size_t len) {
+  protos::pbzero::QueryArgs::Decoder query(args, len);
+  auto encoding = query.columnar_batches()
+                      ? QueryResultSerializer::BatchEncoding::kColumnar
+                      : QueryResultSerializer::BatchEncoding::kRowMajor;
+  return std::make_unique<QueryResultSerializer>(QueryInternal(args, len),
+                                                 encoding);
+}
+
 Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
   protos::pbzero::QueryArgs::Decoder query(args, len);
   std::string sql = query.sql_query().ToStdString();
@@ -402,10 +541,18 @@ Iterator Rpc::QueryInternal(const uint8_t* args, size_t len) {
                       }
                     });
 
+  if (query.timeout_ms())
+    return trace_processor_->ExecuteQuery(sql, query.timeout_ms());
   return trace_processor_->ExecuteQuery(sql);
 }
 
+void Rpc::InterruptQuery() {
+  std::lock_guard<std::mutex> lock(interrupt_mutex_);
+  trace_processor_->InterruptQuery();
+}
+
 void Rpc::RestoreInitialTables() {
+  std::lock_guard<std::mutex> lock(interrupt_mutex_);
   trace_processor_->RestoreInitialTables();
 }
 
@@ -21,6 +21,7 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -28,6 +29,7 @@
 #include "perfetto/base/status.h"
 #include "perfetto/ext/protozero/proto_ring_buffer.h"
 #include "perfetto/trace_processor/basic_types.h"
+#include "src/trace_processor/rpc/trace_index.h"
 
 namespace perfetto {
 
@@ -39,6 +41,7 @@ class DisableAndReadMetatraceResult;
 namespace trace_processor {
 
 class Iterator;
+class QueryResultSerializer;
 class TraceProcessor;
 
 // This class handles the binary {,un}marshalling for the Trace Processor RPC
@@ -111,6 +114,14 @@ class Rpc {
   std::vector<uint8_t> DisableAndReadMetatrace();
   std::vector<uint8_t> GetStatus();
 
+  // Loads a serialized TraceIndex proto (see trace_processor.proto). Until
+  // NotifyEndOfFile() is called, queries matching one of the queries of the
+  // index are answered from it by Query() and the TPM_QUERY_STREAMING method.
+  base::Status LoadTraceIndex(const uint8_t*, size_t);
+
+  // Number of trace bytes pushed into the current TraceProcessor instance.
+  size_t bytes_parsed() const { return bytes_parsed_; }
+
   // Creates a new RPC session by deleting all tables and views that have been
   // created (by the UI or user) after the trace was loaded; built-in
   // tables/view created by the ingestion process are preserved.
@@ -128,11 +139,26 @@ class Rpc {
       void(const uint8_t* /*buf*/, size_t /*len*/, bool /*has_more*/)>;
   void Query(const uint8_t*, size_t, const QueryResultBatchCallback&);
 
+  // Interrupts the query being run, which fails with a "cancelled" error.
+  // Unlike the other methods, this can be called from any thread: it is used
+  // to cancel a query while the thread using this object is busy running it.
+  void InterruptQuery();
+
  private:
   void ParseRpcRequest(const uint8_t*, size_t);
   void ResetTraceProcessorInternal(const Config&);
   void MaybePrintProgress();
   Iterator QueryInternal(const uint8_t*, size_t);
+  // Runs the query in the QueryArgs |args| and returns a serializer from which
+  // batches are pulled one at a time, so that at most one batch is alive at
+  // any time. If QueryArgs.columnar_batches is set, the batches use the
+  // columnar encoding.
+  std::unique_ptr<QueryResultSerializer> StartQuery(const uint8_t* args,
+                                                    size_t len);
+  // Returns the result of the query in the QueryArgs |args| from the trace
+  // index, or nullptr if it should be run on the trace.
+  const std::vector<std::string>* FindIndexedResult(const uint8_t* args,
+                                                    size_t len);
   void ComputeMetricInternal(const uint8_t*,
                              size_t,
                              protos::pbzero::ComputeMetricResult*);
@@ -141,11 +167,15 @@ class Rpc {
 
   Config trace_processor_config_;
   std::unique_ptr<TraceProcessor> trace_processor_;
+  // Held by InterruptQuery() and while |trace_processor_| is replaced or its
+  // tables restored, which must not be concurrent with interrupting it.
+  std::mutex interrupt_mutex_;
   RpcResponseFunction rpc_response_fn_;
   protozero::ProtoRingBuffer rxbuf_;
   int64_t tx_seq_id_ = 0;
   int64_t rx_seq_id_ = 0;
   bool eof_ = false;
+  TraceIndex trace_index_;
   int64_t t_parse_started_ = 0;
   size_t bytes_last_progress_ = 0;
   size_t bytes_parsed_ = 0;
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/trace_index.h"
+
+#include <cinttypes>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/status_or.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/trace_processor/rpc/query_result_serializer.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/trace_processor.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto::trace_processor {
+
+namespace {
+
+// The size is stored as an unsigned integer but is an int64 everywhere else
+// (e.g. the trace_size_bytes metadata): larger values are most likely a
+// negative size written by a client using signed integers.
+bool IsValidTraceSize(uint64_t trace_size_bytes) {
+  return trace_size_bytes > 0 &&
+         trace_size_bytes <=
+             static_cast<uint64_t>(std::numeric_limits<int64_t>::max());
+}
+
+}  // namespace
+
+// static
+std::vector<std::string> TraceIndex::DefaultQueries() {
+  return {
+      "SELECT start_ts, end_ts FROM trace_bounds",
+      "SELECT upid, pid, name, parent_upid, uid, cmdline FROM process "
+      "ORDER BY upid",
+      "SELECT utid, tid, name, upid, is_main_thread FROM thread ORDER BY utid",
+      "SELECT id, type, name, parent_id FROM track ORDER BY id",
+      "SELECT id, utid FROM thread_track ORDER BY id",
+      "SELECT id, upid FROM process_track ORDER BY id",
+  };
+}
+
+// static
+base::StatusOr<std::vector<uint8_t>> TraceIndex::Build(
+    TraceProcessor* tp,
+    const std::vector<std::string>& queries,
+    uint64_t trace_size_bytes) {
+  if (!IsValidTraceSize(trace_size_bytes)) {
+    return base::ErrStatus("Invalid trace size %" PRIu64, trace_size_bytes);
+  }
+  protozero::HeapBuffered<protos::pbzero::TraceIndex> index;
+  index->set_trace_size_bytes(trace_size_bytes);
+  for (const std::string& sql : queries) {
+    auto* query = index->add_queries();
+    std::string trimmed_sql = base::TrimWhitespace(sql);
+    query->set_sql(trimmed_sql);
+    QueryResultSerializer serializer(tp->ExecuteQuery(trimmed_sql));
+    std::vector<uint8_t> batch;
+    for (bool has_more = true; has_more; batch.clear()) {
+      has_more = serializer.Serialize(&batch);
+      protos::pbzero::QueryResult::Decoder result(batch.data(), batch.size());
+      if (result.has_error()) {
+        return base::ErrStatus("Trace index query \"%s\" failed: %s",
+                               trimmed_sql.c_str(),
+                               result.error().ToStdString().c_str());
+      }
+      query->add_result_batches(batch.data(), batch.size());
+    }
+  }
+  return index.SerializeAsArray();
+}
+
+TraceIndex::TraceIndex() = default;
+TraceIndex::~TraceIndex() = default;
+
+base::Status TraceIndex::Parse(const uint8_t* data, size_t size) {
+  Clear();
+  protos::pbzero::TraceIndex::Decoder index(data, size);
+  if (index.bytes_left() != 0)
+    return base::ErrStatus("Failed to parse the trace index");
+  if (!index.has_trace_size_bytes())
+    return base::ErrStatus("The trace index has no trace size");
+  if (!IsValidTraceSize(index.trace_size_bytes())) {
+    return base::ErrStatus("The trace index has an invalid trace size %" PRIu64,
+                           index.trace_size_bytes());
+  }
+  for (auto it = index.queries(); it; ++it) {
+    protos::pbzero::TraceIndex::Query::Decoder query(*it);
+    std::vector<std::string>& batches =
+        results_[base::TrimWhitespace(query.sql().ToStdString())];
+    batches.clear();
+    for (auto batch = query.result_batches(); batch; ++batch)
+      batches.emplace_back(batch->as_std_string());
+    if (batches.empty()) {
+      Clear();
+      return base::ErrStatus("Trace index query \"%s\" has no result",
+                             query.sql().ToStdString().c_str());
+    }
+  }
+  trace_size_bytes_ = index.trace_size_bytes();
+  return base::OkStatus();
+}
+
+const std::vector<std::string>* TraceIndex::Find(
+    const std::string& sql) const {
+  auto it = results_.find(base::TrimWhitespace(sql));
+  return it == results_.end() ? nullptr : &it->second;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_TRACE_INDEX_H_
+#define SRC_TRACE_PROCESSOR_RPC_TRACE_INDEX_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/status_or.h"
+
+namespace perfetto::trace_processor {
+
+class TraceProcessor;
+
+// Holds the query results of a trace index, a small sidecar file of a trace
+// which allows to answer the queries needed to show a summary of the trace
+// before it has been loaded. See TraceIndex in trace_processor.proto.
+class TraceIndex {
+ public:
+  // The queries run by Build() when none are specified: the bounds,
+  // processes, threads and tracks of the trace.
+  static std::vector<std::string> DefaultQueries();
+
+  // Runs |queries| on |tp|, which should have fully loaded the trace, and
+  // returns the serialized TraceIndex proto holding their results. Fails if
+  // any of the queries fails or if |trace_size_bytes| is not a valid size
+  // (zero or larger than INT64_MAX).
+  static base::StatusOr<std::vector<uint8_t>> Build(
+      TraceProcessor* tp,
+      const std::vector<std::string>& queries,
+      uint64_t trace_size_bytes);
+
+  TraceIndex();
+  ~TraceIndex();
+
+  // Replaces the content of this index with the serialized TraceIndex proto
+  // |data|. Fails if the proto is malformed or its trace size is missing or
+  // invalid. On failure the index is left empty.
+  base::Status Parse(const uint8_t* data, size_t size);
+
+  // Returns the serialized QueryResult batches of |sql| or nullptr if |sql|
+  // is not in the index. Leading and trailing whitespace is ignored.
+  const std::vector<std::string>* Find(const std::string& sql) const;
+
+  void Clear() {
+    results_.clear();
+    trace_size_bytes_ = 0;
+  }
+  bool empty() const { return results_.empty(); }
+  size_t size() const { return results_.size(); }
+
+  // The size of the trace the index was written for, 0 if empty.
+  uint64_t trace_size_bytes() const { return trace_size_bytes_; }
+
+ private:
+  std::map<std::string, std::vector<std::string>> results_;
+  uint64_t trace_size_bytes_ = 0;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_TRACE_INDEX_H_
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/trace_index.h"
+
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "perfetto/ext/trace_processor/rpc/query_result_serializer.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+class TraceIndexTest : public ::testing::Test {
+ protected:
+  TraceIndexTest() : tp_(TraceProcessor::CreateInstance(Config())) {
+    tp_->NotifyEndOfFile();
+  }
+
+  std::unique_ptr<TraceProcessor> tp_;
+};
+
+TEST_F(TraceIndexTest, ResultsMatchTheQueries) {
+  const std::string kQuery = "SELECT 1 AS a, 'foo' AS b";
+  auto index_or = TraceIndex::Build(tp_.get(), {"  " + kQuery + "\n"}, 42);
+  ASSERT_TRUE(index_or.ok()) << index_or.status().message();
+
+  TraceIndex index;
+  ASSERT_TRUE(index.Parse(index_or->data(), index_or->size()).ok());
+  ASSERT_EQ(index.size(), 1u);
+  ASSERT_EQ(index.Find("SELECT 1"), nullptr);
+
+  // The stored batches are the ones the query would return from the trace.
+  const std::vector<std::string>* batches = index.Find(kQuery + " ");
+  ASSERT_NE(batches, nullptr);
+  QueryResultSerializer serializer(tp_->ExecuteQuery(kQuery));
+  std::vector<std::string> expected;
+  std::vector<uint8_t> batch;
+  for (bool has_more = true; has_more; batch.clear()) {
+    has_more = serializer.Serialize(&batch);
+    expected.emplace_back(batch.begin(), batch.end());
+  }
+  ASSERT_EQ(*batches, expected);
+
+  protos::pbzero::TraceIndex::Decoder decoder(index_or->data(),
+                                              index_or->size());
+  ASSERT_EQ(decoder.trace_size_bytes(), 42u);
+
+  index.Clear();
+  ASSERT_TRUE(index.empty());
+  ASSERT_EQ(index.Find(kQuery), nullptr);
+}
+
+TEST_F(TraceIndexTest, FailedQuery) {
+  auto index_or =
+      TraceIndex::Build(tp_.get(), {"SELECT * FROM no_such_table"}, 42);
+  ASSERT_FALSE(index_or.ok());
+}
+
+TEST_F(TraceIndexTest, DefaultQueries) {
+  auto index_or =
+      TraceIndex::Build(tp_.get(), TraceIndex::DefaultQueries(), 42);
+  ASSERT_TRUE(index_or.ok()) << index_or.status().message();
+
+  TraceIndex index;
+  ASSERT_TRUE(index.Parse(index_or->data(), index_or->size()).ok());
+  ASSERT_EQ(index.size(), TraceIndex::DefaultQueries().size());
+}
+
+TEST_F(TraceIndexTest, InvalidTraceSize) {
+  constexpr uint64_t kMaxSize = std::numeric_limits<int64_t>::max();
+  ASSERT_TRUE(TraceIndex::Build(tp_.get(), {"SELECT 1"}, kMaxSize).ok());
+  ASSERT_FALSE(TraceIndex::Build(tp_.get(), {"SELECT 1"}, 0).ok());
+  ASSERT_FALSE(TraceIndex::Build(tp_.get(), {"SELECT 1"}, kMaxSize + 1).ok());
+
+  auto parse = [](std::optional<uint64_t> trace_size_bytes) {
+    protozero::HeapBuffered<protos::pbzero::TraceIndex> proto;
+    if (trace_size_bytes)
+      proto->set_trace_size_bytes(*trace_size_bytes);
+    std::vector<uint8_t> buf = proto.SerializeAsArray();
+    TraceIndex index;
+    return index.Parse(buf.data(), buf.size());
+  };
+  ASSERT_TRUE(parse(42).ok());
+  ASSERT_FALSE(parse(std::nullopt).ok());
+  ASSERT_FALSE(parse(0).ok());
+  // A negative size written as an unsigned integer.
+  ASSERT_FALSE(parse(static_cast<uint64_t>(-1)).ok());
+  ASSERT_FALSE(parse(kMaxSize + 1).ok());
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
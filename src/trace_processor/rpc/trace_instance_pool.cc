@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/trace_instance_pool.h"
+
+#include <cinttypes>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/status.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/base/time.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "src/trace_processor/rpc/rpc.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+constexpr uint32_t kIdleCheckPeriodMs = 10 * 1000;
+
+int64_t NowMs() {
+  return base::GetWallTimeMs().count();
+}
+
+}  // namespace
+
+TraceInstancePool::Instance::Instance(const std::string& id)
+    : trace_id(id),
+      runner(base::ThreadTaskRunner::CreateAndStart("TPInstance")),
+      last_used_ms(NowMs()) {}
+
+TraceInstancePool::Instance::~Instance() = default;
+
+TraceInstancePool::TraceInstancePool(base::TaskRunner* task_runner,
+                                     Config config)
+    : task_runner_(task_runner), config_(config) {
+  ScheduleIdleCheck();
+}
+
+TraceInstancePool::~TraceInstancePool() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+}
+
+base::Status TraceInstancePool::PostTask(const std::string& trace_id,
+                                         RpcTask task,
+                                         std::function<void()> on_done) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = instances_.find(trace_id);
+  if (it == instances_.end()) {
+    if (config_.max_instances > 0 &&
+        instances_.size() >= config_.max_instances &&
+        !EvictLeastRecentlyUsed(nullptr)) {
+      return base::ErrStatus(
+          "Cannot create an instance for trace \"%s\": all the %u instances "
+          "are busy",
+          trace_id.c_str(), config_.max_instances);
+    }
+    PERFETTO_ILOG("Creating trace processor instance for trace \"%s\"",
+                  trace_id.c_str());
+    std::unique_ptr<Instance> new_inst(new Instance(trace_id));
+    Instance* raw_inst = new_inst.get();
+
+    // The Rpc (and its TraceProcessor) is created, used and destroyed only on
+    // the worker thread of the instance.
+    raw_inst->runner.PostTask([raw_inst] {
+      std::lock_guard<std::mutex> lock(raw_inst->rpc_mutex);
+      raw_inst->rpc.reset(new Rpc());
+    });
+    it = instances_.emplace(trace_id, std::move(new_inst)).first;
+  }
+
+  Instance* inst = it->second.get();
+  inst->pending_tasks++;
+  inst->last_used_ms = NowMs();
+  inst->last_use_seq = ++last_use_seq_;
+
+  // |inst| stays valid for as long as its worker thread runs: instances are
+  // destroyed only after their thread has drained all the tasks (see
+  // RetireInstance()) or when the pool, and hence every thread, goes away.
+  auto weak_this = weak_factory_.GetWeakPtr();
+  base::TaskRunner* task_runner = task_runner_;
+  inst->runner.PostTask(
+      [inst, task = std::move(task), on_done = std::move(on_done), weak_this,
+       task_runner] {
+        task(inst->rpc.get());
+        uint64_t trace_bytes = inst->rpc->bytes_parsed();
+        task_runner->PostTask([weak_this, inst, trace_bytes, on_done] {
+          if (!weak_this)
+            return;
+          weak_this->OnTaskDone(inst, trace_bytes);
+          if (on_done)
+            on_done();
+        });
+      });
+  return base::OkStatus();
+}
+
+void TraceInstancePool::OnTaskDone(Instance* inst, uint64_t trace_bytes) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  PERFETTO_DCHECK(inst->pending_tasks > 0);
+  inst->pending_tasks--;
+  inst->trace_bytes = trace_bytes;
+  inst->last_used_ms = NowMs();
+
+  // Retired instances don't count towards the memory budget anymore.
+  auto it = instances_.find(inst->trace_id);
+  if (it == instances_.end() || it->second.get() != inst)
+    return;
+  if (config_.max_trace_bytes == 0)
+    return;
+
+  // Never evict the instance which has just been used: if a single trace is
+  // larger than the budget, evicting it would only cause the client to load
+  // it again.
+  while (total_trace_bytes() > config_.max_trace_bytes) {
+    if (!EvictLeastRecentlyUsed(inst)) {
+      PERFETTO_ELOG(
+          "Trace instances use %" PRIu64 " bytes, over the %" PRIu64
+          " bytes budget, but none of them can be evicted",
+          total_trace_bytes(), config_.max_trace_bytes);
+      break;
+    }
+  }
+}
+
+bool TraceInstancePool::EvictLeastRecentlyUsed(const Instance* keep) {
+  auto lru = instances_.end();
+  for (auto it = instances_.begin(); it != instances_.end(); ++it) {
+    const Instance& inst = *it->second;
+    if (&inst == keep || inst.pending_tasks > 0)
+      continue;
+    if (lru == instances_.end() ||
+        inst.last_use_seq < lru->second->last_use_seq) {
+      lru = it;
+    }
+  }
+  if (lru == instances_.end())
+    return false;
+  PERFETTO_ILOG("Evicting trace processor instance for trace \"%s\" (%" PRIu64
+                " bytes)",
+                lru->first.c_str(), lru->second->trace_bytes);
+  RetireInstance(lru);
+  return true;
+}
+
+bool TraceInstancePool::DestroyInstance(const std::string& trace_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = instances_.find(trace_id);
+  if (it == instances_.end())
+    return false;
+  RetireInstance(it);
+  return true;
+}
+
+bool TraceInstancePool::InterruptQuery(const std::string& trace_id) {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  auto it = instances_.find(trace_id);
+  if (it == instances_.end())
+    return false;
+  Instance* inst = it->second.get();
+  std::lock_guard<std::mutex> lock(inst->rpc_mutex);
+  if (inst->rpc)
+    inst->rpc->InterruptQuery();
+  return true;
+}
+
+void TraceInstancePool::EvictIdleInstances() {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  int64_t now_ms = NowMs();
+  for (auto it = instances_.begin(); it != instances_.end();) {
+    auto cur = it++;
+    const Instance& inst = *cur->second;
+    if (inst.pending_tasks > 0 ||
+        now_ms - inst.last_used_ms < config_.idle_timeout_ms) {
+      continue;
+    }
+    PERFETTO_ILOG("Evicting idle trace processor instance for trace \"%s\"",
+                  cur->first.c_str());
+    RetireInstance(cur);
+  }
+}
+
+void TraceInstancePool::RetireInstance(InstanceMap::iterator it) {
+  Instance* inst = it->second.get();
+  retiring_instances_.emplace_back(std::move(it->second));
+  instances_.erase(it);
+
+  // Destroying a TraceProcessor can take a while for large traces, so this is
+  // done on the worker thread, after the tasks already queued there. Only
+  // then the (by now idle) thread is joined, on the main thread.
+  auto weak_this = weak_factory_.GetWeakPtr();
+  base::TaskRunner* task_runner = task_runner_;
+  inst->runner.PostTask([inst, weak_this, task_runner] {
+    inst->rpc.reset();
+    task_runner->PostTask([weak_this, inst] {
+      if (!weak_this)
+        return;
+      weak_this->retiring_instances_.remove_if(
+          [inst](const std::unique_ptr<Instance>& i) {
+            return i.get() == inst;
+          });
+    });
+  });
+}
+
+void TraceInstancePool::ScheduleIdleCheck() {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (!weak_this)
+          return;
+        weak_this->EvictIdleInstances();
+        weak_this->ScheduleIdleCheck();
+      },
+      kIdleCheckPeriodMs);
+}
+
+std::vector<TraceInstancePool::InstanceStats> TraceInstancePool::GetStats()
+    const {
+  PERFETTO_DCHECK_THREAD(thread_checker_);
+  int64_t now_ms = NowMs();
+  std::vector<InstanceStats> stats;
+  for (const auto& id_and_inst : instances_) {
+    const Instance& inst = *id_and_inst.second;
+    InstanceStats s;
+    s.trace_id = inst.trace_id;
+    s.trace_bytes = inst.trace_bytes;
+    s.pending_tasks = inst.pending_tasks;
+    s.idle_ms = inst.pending_tasks > 0 ? 0 : now_ms - inst.last_used_ms;
+    stats.emplace_back(std::move(s));
+  }
+  return stats;
+}
+
+uint64_t TraceInstancePool::total_trace_bytes() const {
+  uint64_t total = 0;
+  for (const auto& id_and_inst : instances_)
+    total += id_and_inst.second->trace_bytes;
+  return total;
+}
+
+}  // namespace perfetto::trace_processor
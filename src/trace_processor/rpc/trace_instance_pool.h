@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_RPC_TRACE_INSTANCE_POOL_H_
+#define SRC_TRACE_PROCESSOR_RPC_TRACE_INSTANCE_POOL_H_
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/thread_checker.h"
+#include "perfetto/ext/base/thread_task_runner.h"
+#include "perfetto/ext/base/weak_ptr.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}  // namespace base
+
+namespace trace_processor {
+
+class Rpc;
+
+// Hosts a set of independent Rpc (and hence TraceProcessor) instances, keyed
+// by an opaque trace id chosen by the client. This is used by the multi-trace
+// mode of the HTTP RPC server, where many users share the same server, each
+// with their own trace.
+//
+// Each instance has a dedicated worker thread which owns its Rpc object and
+// runs the tasks posted for it in order. Instances don't share any queue, so a
+// slow query (or trace load) on one trace does not block the others.
+//
+// Instances are created on the first task posted for their trace id and are
+// destroyed either explicitly, when they have been idle for longer than
+// Config::idle_timeout_ms or when the total memory accounted to the pool
+// exceeds Config::max_trace_bytes.
+//
+// The memory of each instance is accounted as the number of trace bytes it has
+// ingested: the in-memory representation of a trace is roughly proportional
+// to its size and, unlike the process RSS, this can be attributed to a single
+// instance.
+//
+// All methods must be called on the thread of the |task_runner| passed to the
+// constructor, which is also where the |on_done| callbacks are invoked.
+class TraceInstancePool {
+ public:
+  struct Config {
+    // Instances which have not received any task for this long are destroyed.
+    uint32_t idle_timeout_ms = 60 * 60 * 1000;
+
+    // If non-zero, the least recently used idle instances are destroyed
+    // whenever the total number of trace bytes across all instances exceeds
+    // this value.
+    uint64_t max_trace_bytes = 0;
+
+    // If non-zero, caps the number of live instances. When a new instance is
+    // needed and the cap is reached, the least recently used idle instance is
+    // destroyed. If all instances are busy, PostTask() fails.
+    uint32_t max_instances = 0;
+  };
+
+  struct InstanceStats {
+    std::string trace_id;
+    uint64_t trace_bytes = 0;
+    uint32_t pending_tasks = 0;
+    int64_t idle_ms = 0;
+  };
+
+  // The task is run on the worker thread of the instance and is the only code
+  // which is allowed to touch the Rpc object it receives.
+  using RpcTask = std::function<void(Rpc*)>;
+
+  TraceInstancePool(base::TaskRunner*, Config);
+  ~TraceInstancePool();
+
+  TraceInstancePool(const TraceInstancePool&) = delete;
+  TraceInstancePool& operator=(const TraceInstancePool&) = delete;
+
+  // Runs |task| on the worker thread of the instance for |trace_id|, creating
+  // the instance if it doesn't exist yet. |on_done| (optional) is invoked once
+  // |task| has completed.
+  base::Status PostTask(const std::string& trace_id,
+                        RpcTask task,
+                        std::function<void()> on_done = nullptr);
+
+  // Destroys the instance for |trace_id|, once the tasks already posted for it
+  // have completed. Returns false if there is no such instance.
+  bool DestroyInstance(const std::string& trace_id);
+
+  // Interrupts the query the instance for |trace_id| is running, if any,
+  // without waiting for the tasks posted for it. Returns false if there is no
+  // such instance.
+  bool InterruptQuery(const std::string& trace_id);
+
+  // Destroys all the instances which have been idle for longer than
+  // Config::idle_timeout_ms. This is also called periodically.
+  void EvictIdleInstances();
+
+  std::vector<InstanceStats> GetStats() const;
+
+  size_t instance_count() const { return instances_.size(); }
+  uint64_t total_trace_bytes() const;
+
+ private:
+  struct Instance {
+    explicit Instance(const std::string& id);
+    ~Instance();
+
+    std::string trace_id;
+
+    // Accessed only on |runner|, except by InterruptQuery(). Declared before
+    // |runner| so that, when an instance is destroyed without being retired
+    // first (i.e. when the pool is destroyed), the worker thread is joined
+    // before this is destroyed.
+    std::unique_ptr<Rpc> rpc;
+    // Guards the creation of |rpc| against InterruptQuery(). Its destruction
+    // needs no guard as retired instances can't be interrupted.
+    std::mutex rpc_mutex;
+    base::ThreadTaskRunner runner;
+
+    uint32_t pending_tasks = 0;
+    uint64_t trace_bytes = 0;
+    int64_t last_used_ms = 0;
+
+    // Orders instances by recency of use (ties on |last_used_ms| are common).
+    uint64_t last_use_seq = 0;
+  };
+
+  using InstanceMap = std::map<std::string, std::unique_ptr<Instance>>;
+
+  void OnTaskDone(Instance*, uint64_t trace_bytes);
+  // Retires the least recently used instance which has no pending tasks,
+  // other than |keep|. Returns false if there is no such instance.
+  bool EvictLeastRecentlyUsed(const Instance* keep);
+  void RetireInstance(InstanceMap::iterator);
+  void ScheduleIdleCheck();
+
+  base::TaskRunner* const task_runner_;
+  const Config config_;
+  InstanceMap instances_;
+  uint64_t last_use_seq_ = 0;
+
+  // Instances which have been evicted but whose worker thread is still
+  // draining the tasks posted before the eviction.
+  std::list<std::unique_ptr<Instance>> retiring_instances_;
+
+  PERFETTO_THREAD_CHECKER(thread_checker_)
+  base::WeakPtrFactory<TraceInstancePool> weak_factory_{this};  // Keep last.
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_RPC_TRACE_INSTANCE_POOL_H_
@@ -0,0 +1,276 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/rpc/trace_instance_pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/trace_processor/rpc/rpc.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace_processor/trace_processor.pbzero.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+// A proto trace made of |n| empty packets: 2 bytes each.
+std::vector<uint8_t> EmptyPackets(size_t n) {
+  std::vector<uint8_t> trace;
+  for (size_t i = 0; i < n; ++i) {
+    trace.push_back(0x0a);  // Field 1 (packet), length delimited.
+    trace.push_back(0x00);  // Empty.
+  }
+  return trace;
+}
+
+// A query which never completes on its own.
+constexpr char kEndlessQuery[] =
+    "WITH RECURSIVE r(i) AS (SELECT 1 UNION ALL SELECT i + 1 FROM r) "
+    "SELECT COUNT(*) FROM r";
+
+// Runs |sql| with Rpc::Query() and returns the error of its result, if any.
+std::string QueryError(Rpc* rpc, const std::string& sql, uint32_t timeout_ms) {
+  protozero::HeapBuffered<protos::pbzero::QueryArgs> args;
+  args->set_sql_query(sql);
+  args->set_timeout_ms(timeout_ms);
+  std::vector<uint8_t> buf = args.SerializeAsArray();
+  std::string error;
+  rpc->Query(buf.data(), buf.size(),
+             [&](const uint8_t* data, size_t len, bool) {
+               protos::pbzero::QueryResult::Decoder result(data, len);
+               if (result.has_error())
+                 error = result.error().ToStdString();
+             });
+  return error;
+}
+
+class TraceInstancePoolTest : public ::testing::Test {
+ protected:
+  // Posts |task| for |trace_id| and waits for it to complete.
+  void RunTask(TraceInstancePool* pool,
+               const std::string& trace_id,
+               TraceInstancePool::RpcTask task = [](Rpc*) {}) {
+    std::string checkpoint = "done_" + std::to_string(++num_tasks_);
+    ASSERT_TRUE(pool->PostTask(trace_id, std::move(task),
+                               task_runner_.CreateCheckpoint(checkpoint))
+                    .ok());
+    task_runner_.RunUntilCheckpoint(checkpoint);
+  }
+
+  void LoadTrace(TraceInstancePool* pool,
+                 const std::string& trace_id,
+                 size_t num_packets) {
+    std::vector<uint8_t> trace = EmptyPackets(num_packets);
+    RunTask(pool, trace_id, [trace](Rpc* rpc) {
+      ASSERT_TRUE(rpc->Parse(trace.data(), trace.size()).ok());
+      rpc->NotifyEndOfFile();
+    });
+  }
+
+  base::TestTaskRunner task_runner_;
+  int num_tasks_ = 0;
+};
+
+TEST_F(TraceInstancePoolTest, InstancesAreIndependent) {
+  TraceInstancePool pool(&task_runner_, {});
+
+  // Block the instance for "slow" until the task for "fast" has run: if the
+  // two instances shared a thread or a queue, this would deadlock.
+  std::promise<void> fast_done;
+  std::future<void> fast_done_future = fast_done.get_future();
+  std::atomic<bool> slow_done{false};
+  ASSERT_TRUE(pool.PostTask("slow", [&](Rpc*) {
+                    fast_done_future.wait();
+                    slow_done = true;
+                  })
+                  .ok());
+
+  std::thread::id fast_thread;
+  RunTask(&pool, "fast", [&](Rpc*) {
+    fast_thread = std::this_thread::get_id();
+    fast_done.set_value();
+  });
+  EXPECT_NE(fast_thread, std::this_thread::get_id());
+
+  RunTask(&pool, "slow");
+  EXPECT_TRUE(slow_done);
+  EXPECT_EQ(pool.instance_count(), 2u);
+}
+
+TEST_F(TraceInstancePoolTest, TasksOfAnInstanceSeeTheSameRpc) {
+  TraceInstancePool pool(&task_runner_, {});
+  LoadTrace(&pool, "a", 10);
+
+  Rpc* first = nullptr;
+  Rpc* second = nullptr;
+  RunTask(&pool, "a", [&](Rpc* rpc) { first = rpc; });
+  RunTask(&pool, "a", [&](Rpc* rpc) { second = rpc; });
+  EXPECT_EQ(first, second);
+
+  auto stats = pool.GetStats();
+  ASSERT_EQ(stats.size(), 1u);
+  EXPECT_EQ(stats[0].trace_id, "a");
+  EXPECT_EQ(stats[0].trace_bytes, 20u);
+  EXPECT_EQ(stats[0].pending_tasks, 0u);
+}
+
+TEST_F(TraceInstancePoolTest, IdleEviction) {
+  TraceInstancePool::Config config;
+  config.idle_timeout_ms = 0;
+  TraceInstancePool pool(&task_runner_, config);
+
+  LoadTrace(&pool, "a", 10);
+  LoadTrace(&pool, "b", 10);
+  EXPECT_EQ(pool.instance_count(), 2u);
+
+  pool.EvictIdleInstances();
+  EXPECT_EQ(pool.instance_count(), 0u);
+  EXPECT_EQ(pool.total_trace_bytes(), 0u);
+
+  // A new task for an evicted trace gets a fresh instance.
+  LoadTrace(&pool, "a", 5);
+  ASSERT_EQ(pool.GetStats().size(), 1u);
+  EXPECT_EQ(pool.GetStats()[0].trace_bytes, 10u);
+}
+
+TEST_F(TraceInstancePoolTest, BusyInstancesAreNotEvicted) {
+  TraceInstancePool::Config config;
+  config.idle_timeout_ms = 0;
+  TraceInstancePool pool(&task_runner_, config);
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  ASSERT_TRUE(
+      pool.PostTask("busy", [unblocked](Rpc*) { unblocked.wait(); }).ok());
+  pool.EvictIdleInstances();
+  EXPECT_EQ(pool.instance_count(), 1u);
+
+  unblock.set_value();
+  RunTask(&pool, "busy");
+  pool.EvictIdleInstances();
+  EXPECT_EQ(pool.instance_count(), 0u);
+}
+
+TEST_F(TraceInstancePoolTest, MemoryBudgetEvictsLeastRecentlyUsed) {
+  TraceInstancePool::Config config;
+  config.max_trace_bytes = 250;
+  TraceInstancePool pool(&task_runner_, config);
+
+  LoadTrace(&pool, "a", 50);
+  LoadTrace(&pool, "b", 50);
+  RunTask(&pool, "a");
+  EXPECT_EQ(pool.total_trace_bytes(), 200u);
+
+  // "b" is the least recently used one and goes away to make room for "c".
+  LoadTrace(&pool, "c", 50);
+  auto stats = pool.GetStats();
+  ASSERT_EQ(stats.size(), 2u);
+  EXPECT_EQ(stats[0].trace_id, "a");
+  EXPECT_EQ(stats[1].trace_id, "c");
+  EXPECT_EQ(pool.total_trace_bytes(), 200u);
+
+  // A single trace over the budget is kept, as it is the one being used.
+  LoadTrace(&pool, "d", 200);
+  stats = pool.GetStats();
+  ASSERT_EQ(stats.size(), 1u);
+  EXPECT_EQ(stats[0].trace_id, "d");
+}
+
+TEST_F(TraceInstancePoolTest, MaxInstances) {
+  TraceInstancePool::Config config;
+  config.max_instances = 1;
+  TraceInstancePool pool(&task_runner_, config);
+
+  std::promise<void> unblock;
+  std::shared_future<void> unblocked = unblock.get_future().share();
+  ASSERT_TRUE(pool.PostTask("a", [unblocked](Rpc*) { unblocked.wait(); }).ok());
+
+  // "a" is busy, so it cannot make room for "b".
+  EXPECT_FALSE(pool.PostTask("b", [](Rpc*) {}).ok());
+
+  unblock.set_value();
+  RunTask(&pool, "a");
+  RunTask(&pool, "b");
+  auto stats = pool.GetStats();
+  ASSERT_EQ(stats.size(), 1u);
+  EXPECT_EQ(stats[0].trace_id, "b");
+}
+
+TEST_F(TraceInstancePoolTest, DestroyInstanceDrainsPendingTasks) {
+  TraceInstancePool pool(&task_runner_, {});
+
+  std::atomic<bool> ran{false};
+  auto done = task_runner_.CreateCheckpoint("done");
+  ASSERT_TRUE(pool.PostTask("a", [&](Rpc*) { ran = true; }, done).ok());
+  EXPECT_TRUE(pool.DestroyInstance("a"));
+  EXPECT_FALSE(pool.DestroyInstance("a"));
+  EXPECT_EQ(pool.instance_count(), 0u);
+
+  task_runner_.RunUntilCheckpoint("done");
+  EXPECT_TRUE(ran);
+}
+
+TEST_F(TraceInstancePoolTest, QueryTimeout) {
+  TraceInstancePool pool(&task_runner_, {});
+  LoadTrace(&pool, "a", 10);
+
+  std::string error;
+  RunTask(&pool, "a",
+          [&](Rpc* rpc) { error = QueryError(rpc, kEndlessQuery, 10); });
+  EXPECT_THAT(error, testing::HasSubstr("timed out after 10 ms"));
+
+  // The timeout only applies to the query it was set for.
+  RunTask(&pool, "a",
+          [&](Rpc* rpc) { error = QueryError(rpc, "SELECT 1", 0); });
+  EXPECT_EQ(error, "");
+}
+
+TEST_F(TraceInstancePoolTest, InterruptQuery) {
+  TraceInstancePool pool(&task_runner_, {});
+  EXPECT_FALSE(pool.InterruptQuery("a"));
+  LoadTrace(&pool, "a", 10);
+
+  // The interrupt only cancels the queries already running so keep sending it
+  // until the query returns. The timeout only keeps the test from hanging if
+  // the interrupt doesn't work.
+  std::promise<std::string> error;
+  std::future<std::string> error_future = error.get_future();
+  auto done = task_runner_.CreateCheckpoint("done");
+  ASSERT_TRUE(pool.PostTask("a",
+                            [&](Rpc* rpc) {
+                              error.set_value(
+                                  QueryError(rpc, kEndlessQuery, 60 * 1000));
+                            },
+                            done)
+                  .ok());
+  while (error_future.wait_for(std::chrono::milliseconds(10)) !=
+         std::future_status::ready) {
+    EXPECT_TRUE(pool.InterruptQuery("a"));
+  }
+  task_runner_.RunUntilCheckpoint("done");
+  EXPECT_THAT(error_future.get(), testing::HasSubstr("Query cancelled"));
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SORTER_TOURNAMENT_TREE_H_
+#define SRC_TRACE_PROCESSOR_SORTER_TOURNAMENT_TREE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+namespace trace_processor {
+
+// A tournament (winner) tree over a fixed number of int64_t keys, used to
+// drive the k-way merge of the TraceSorter queues.
+//
+// Finding the smallest key is O(1), finding the runner-up and updating a key
+// are O(log(N)). Ties are won by the key with the smallest index, matching a
+// linear scan which only replaces the current minimum on a strictly smaller
+// key.
+class TournamentTree {
+ public:
+  static constexpr int64_t kMaxKey = std::numeric_limits<int64_t>::max();
+
+  // Resets the tree to |size| keys, all set to |kMaxKey|.
+  void Reset(size_t size) {
+    PERFETTO_DCHECK(size <= std::numeric_limits<uint32_t>::max());
+    size_ = size;
+    leaves_ = 1;
+    while (leaves_ < size)
+      leaves_ *= 2;
+    keys_.assign(leaves_, kMaxKey);
+
+    // Leaf i lives in node |leaves_ + i|, the root in node 1. Node 0 is
+    // unused.
+    nodes_.resize(2 * leaves_);
+    for (size_t i = 0; i < leaves_; ++i)
+      nodes_[leaves_ + i] = static_cast<uint32_t>(i);
+    for (size_t node = leaves_ - 1; node > 0; --node)
+      nodes_[node] = Winner(nodes_[2 * node], nodes_[2 * node + 1]);
+  }
+
+  // Sets the key at |index| without updating the tree. Rebuild() must be
+  // called before querying the tree again. Useful to initialize all the keys
+  // in O(N) rather than O(N*log(N)).
+  void SetWithoutRebuild(size_t index, int64_t key) {
+    PERFETTO_DCHECK(index < size_);
+    keys_[index] = key;
+  }
+
+  // Recomputes all the internal nodes of the tree.
+  void Rebuild() {
+    for (size_t node = leaves_ - 1; node > 0; --node)
+      nodes_[node] = Winner(nodes_[2 * node], nodes_[2 * node + 1]);
+  }
+
+  // Sets the key at |index| and replays the matches on its path to the root.
+  void Update(size_t index, int64_t key) {
+    PERFETTO_DCHECK(index < size_);
+    keys_[index] = key;
+    for (size_t node = (leaves_ + index) / 2; node > 0; node /= 2)
+      nodes_[node] = Winner(nodes_[2 * node], nodes_[2 * node + 1]);
+  }
+
+  // Returns the index of the smallest key. Only valid if size() > 0.
+  size_t min_index() const {
+    PERFETTO_DCHECK(size_ > 0);
+    return leaves_ == 1 ? 0 : nodes_[1];
+  }
+
+  int64_t min_key() const { return keys_[min_index()]; }
+
+  // Returns the smallest key excluding the one at min_index() (or |kMaxKey|
+  // if there is no other key). The runner-up must have lost directly against
+  // the winner, so it is the smallest of the winners of the sibling subtrees
+  // along the path from the winner to the root.
+  int64_t SecondMinKey() const {
+    int64_t second = kMaxKey;
+    for (size_t node = leaves_ + min_index(); node > 1; node /= 2) {
+      int64_t key = keys_[nodes_[node ^ 1]];
+      second = key < second ? key : second;
+    }
+    return second;
+  }
+
+  int64_t key(size_t index) const { return keys_[index]; }
+  size_t size() const { return size_; }
+
+ private:
+  uint32_t Winner(uint32_t a, uint32_t b) const {
+    // Callers always pass the left subtree as |a| so |a| < |b|.
+    return keys_[b] < keys_[a] ? b : a;
+  }
+
+  size_t size_ = 0;
+  size_t leaves_ = 1;
+  std::vector<int64_t> keys_ = std::vector<int64_t>(1, kMaxKey);
+  std::vector<uint32_t> nodes_ = std::vector<uint32_t>(2, 0);
+};
+
+}  // namespace trace_processor
+}  // namespace perfetto
+
+#endif  // SRC_TRACE_PROCESSOR_SORTER_TOURNAMENT_TREE_H_
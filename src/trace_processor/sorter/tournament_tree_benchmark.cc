@@ -0,0 +1,93 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_processor/sorter/tournament_tree.h"
+
+using perfetto::trace_processor::TournamentTree;
+
+namespace {
+
+// Emulates the access pattern of TraceSorter::SortAndExtractEventsUntilAllocId
+// on N queues whose events interleave finely: on each step the two queues with
+// the smallest head timestamps are found, and the head of the first one is
+// advanced past the head of the second one.
+
+static void MergeArgs(benchmark::internal::Benchmark* b) {
+  b->Arg(10);
+  b->Arg(100);
+  b->Arg(10000);
+}
+
+int64_t NextTs(std::minstd_rand0& rnd, int64_t ts, int64_t second) {
+  return std::max(ts, second) + 1 + static_cast<int64_t>(rnd() % 1000);
+}
+
+std::vector<int64_t> InitialHeads(size_t num_queues) {
+  std::minstd_rand0 rnd(42);
+  std::vector<int64_t> heads(num_queues);
+  for (auto& head : heads)
+    head = static_cast<int64_t>(rnd() % 1000000);
+  return heads;
+}
+
+static void BM_SorterMergeLinearScan(benchmark::State& state) {
+  std::vector<int64_t> heads =
+      InitialHeads(static_cast<size_t>(state.range(0)));
+  std::minstd_rand0 rnd(43);
+  for (auto _ : state) {
+    size_t min_idx = 0;
+    int64_t min_ts[2]{TournamentTree::kMaxKey, TournamentTree::kMaxKey};
+    for (size_t i = 0; i < heads.size(); i++) {
+      if (heads[i] < min_ts[0]) {
+        min_ts[1] = min_ts[0];
+        min_ts[0] = heads[i];
+        min_idx = i;
+      } else if (heads[i] < min_ts[1]) {
+        min_ts[1] = heads[i];
+      }
+    }
+    heads[min_idx] = NextTs(rnd, min_ts[0], min_ts[1]);
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_SorterMergeLinearScan)->Apply(MergeArgs);
+
+static void BM_SorterMergeTournamentTree(benchmark::State& state) {
+  std::vector<int64_t> heads =
+      InitialHeads(static_cast<size_t>(state.range(0)));
+  TournamentTree tree;
+  tree.Reset(heads.size());
+  for (size_t i = 0; i < heads.size(); i++)
+    tree.SetWithoutRebuild(i, heads[i]);
+  tree.Rebuild();
+
+  std::minstd_rand0 rnd(43);
+  for (auto _ : state) {
+    size_t min_idx = tree.min_index();
+    int64_t second = tree.SecondMinKey();
+    tree.Update(min_idx, NextTs(rnd, tree.min_key(), second));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_SorterMergeTournamentTree)->Apply(MergeArgs);
+
+}  // namespace
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sorter/tournament_tree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace trace_processor {
+namespace {
+
+constexpr int64_t kMax = TournamentTree::kMaxKey;
+
+TEST(TournamentTreeTest, SingleKey) {
+  TournamentTree tree;
+  tree.Reset(1);
+  ASSERT_EQ(tree.min_index(), 0u);
+  ASSERT_EQ(tree.min_key(), kMax);
+  ASSERT_EQ(tree.SecondMinKey(), kMax);
+
+  tree.Update(0, 42);
+  ASSERT_EQ(tree.min_index(), 0u);
+  ASSERT_EQ(tree.min_key(), 42);
+  ASSERT_EQ(tree.SecondMinKey(), kMax);
+}
+
+TEST(TournamentTreeTest, MinAndSecondMin) {
+  TournamentTree tree;
+  tree.Reset(5);
+  tree.SetWithoutRebuild(0, 30);
+  tree.SetWithoutRebuild(1, 10);
+  tree.SetWithoutRebuild(2, 50);
+  tree.SetWithoutRebuild(4, 20);
+  tree.Rebuild();
+
+  ASSERT_EQ(tree.min_index(), 1u);
+  ASSERT_EQ(tree.min_key(), 10);
+  ASSERT_EQ(tree.SecondMinKey(), 20);
+
+  tree.Update(1, 40);
+  ASSERT_EQ(tree.min_index(), 4u);
+  ASSERT_EQ(tree.SecondMinKey(), 30);
+
+  tree.Update(4, kMax);
+  tree.Update(0, kMax);
+  ASSERT_EQ(tree.min_index(), 1u);
+  ASSERT_EQ(tree.SecondMinKey(), 50);
+}
+
+TEST(TournamentTreeTest, TiesWonBySmallestIndex) {
+  TournamentTree tree;
+  tree.Reset(6);
+  for (size_t i = 0; i < 6; ++i)
+    tree.Update(i, 7);
+  ASSERT_EQ(tree.min_index(), 0u);
+  ASSERT_EQ(tree.SecondMinKey(), 7);
+
+  tree.Update(0, 8);
+  ASSERT_EQ(tree.min_index(), 1u);
+
+  // All the keys being |kMax| must still return a valid index.
+  for (size_t i = 0; i < 6; ++i)
+    tree.Update(i, kMax);
+  ASSERT_EQ(tree.min_index(), 0u);
+}
+
+TEST(TournamentTreeTest, MatchesLinearScan) {
+  constexpr size_t kSize = 37;
+  std::minstd_rand0 rnd(42);
+  std::vector<int64_t> keys(kSize, kMax);
+  TournamentTree tree;
+  tree.Reset(kSize);
+
+  for (int iter = 0; iter < 10000; ++iter) {
+    size_t index = rnd() % kSize;
+    keys[index] = rnd() % 8 == 0 ? kMax : static_cast<int64_t>(rnd() % 1000);
+    tree.Update(index, keys[index]);
+
+    size_t min_index = 0;
+    int64_t min[2]{kMax, kMax};
+    for (size_t i = 0; i < kSize; ++i) {
+      if (keys[i] < min[0]) {
+        min[1] = min[0];
+        min[0] = keys[i];
+        min_index = i;
+      } else if (keys[i] < min[1]) {
+        min[1] = keys[i];
+      }
+    }
+    ASSERT_EQ(tree.min_index(), min_index);
+    ASSERT_EQ(tree.min_key(), min[0]);
+    ASSERT_EQ(tree.SecondMinKey(), min[1]);
+  }
+}
+
+}  // namespace
+}  // namespace trace_processor
+}  // namespace perfetto
@@ -17,8 +17,13 @@
 #include <algorithm>
 #include <memory>
 #include <utility>
+#include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/waitable_event.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
 #include "src/trace_processor/importers/common/parser_types.h"
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_record.h"
@@ -32,12 +37,20 @@ namespace trace_processor {
 
 TraceSorter::TraceSorter(TraceProcessorContext* context,
                          SortingMode sorting_mode)
-    : sorting_mode_(sorting_mode), storage_(context->storage) {
+    : sorting_mode_(sorting_mode),
+      storage_(context->storage),
+      ingestion_profiler_(context->ingestion_profiler),
+      thread_count_(context->config.tokenizer_thread_count) {
   AddMachineContext(context);
   const char* env = getenv("TRACE_PROCESSOR_SORT_ONLY");
   bypass_next_stage_for_testing_ = env && !strcmp(env, "1");
   if (bypass_next_stage_for_testing_)
     PERFETTO_ELOG("TEST MODE: bypassing protobuf parsing stage");
+  if (sorting_mode_ == SortingMode::kFullSort &&
+      context->config.spill_full_sort_to_disk &&
+      !token_buffer_.EnableSpillToDisk()) {
+    PERFETTO_ELOG("Spilling to disk is not supported on this platform");
+  }
 }
 
 TraceSorter::~TraceSorter() {
@@ -76,6 +89,58 @@ void TraceSorter::Queue::Sort() {
   PERFETTO_DCHECK(std::is_sorted(events_.begin(), events_.end()));
 }
 
+void TraceSorter::SortQueuesInParallel() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  if (thread_count_ <= 1)
+    return;
+
+  std::vector<Queue*> queues;
+  for (auto& sorter_data : sorter_data_by_machine_) {
+    for (auto& queue : sorter_data.queues) {
+      if (queue.needs_sorting())
+        queues.push_back(&queue);
+    }
+  }
+  if (queues.size() < 2)
+    return;
+
+  auto sample = IngestionProfiler::SampleNamed(
+      ingestion_profiler_.get(), IngestionProfiler::Phase::kSort,
+      "parallel_queue_sort");
+  if (!sort_pool_)
+    sort_pool_.reset(new base::ThreadPool(thread_count_));
+
+  // Each queue (e.g. the ftrace queue of a CPU of a machine) only holds the
+  // timestamps and token buffer ids of its events, so queues can be sorted
+  // concurrently without touching the token buffer or the storage. Larger
+  // queues are handed out first so the shards get similar amounts of work.
+  std::sort(queues.begin(), queues.end(), [](const Queue* a, const Queue* b) {
+    return a->events_.size() > b->events_.size();
+  });
+  const size_t shard_count =
+      std::min(queues.size(), static_cast<size_t>(thread_count_));
+  base::WaitableEvent all_done;
+  for (size_t shard = 0; shard < shard_count; ++shard) {
+    sort_pool_->PostTask([&queues, &all_done, shard, shard_count] {
+      for (size_t i = shard; i < queues.size(); i += shard_count)
+        queues[i]->Sort();
+      all_done.Notify();
+    });
+  }
+  all_done.Wait(shard_count);
+#endif
+}
+
+uint64_t TraceSorter::memory_usage() const {
+  uint64_t bytes = token_buffer_.memory_usage();
+  for (const auto& sorter_data : sorter_data_by_machine_) {
+    for (const auto& queue : sorter_data.queues)
+      bytes += queue.events_.capacity() * sizeof(TimestampedEvent);
+  }
+  return bytes;
+}
+
 // Removes all the events in |queues_| that are earlier than the given
 // packet index and moves them to the next parser stages, respecting global
 // timestamp order. This function is a "extract min from N sorted queues", with
@@ -90,53 +155,59 @@ void TraceSorter::Queue::Sort() {
 //  q2              {min_ts: 12    max_ts: 40}
 //
 // We know that we can extract all events from q1 until we hit ts=10 without
-// looking at any other queue. After hitting ts=10, we need to re-look to all of
-// them to figure out the next min-event.
-// There are more suitable data structures to do this (e.g. keeping a min-heap
-// to avoid re-scanning all the queues all the times) but doesn't seem worth it.
-// With Android traces (that have 8 CPUs) this function accounts for ~1-3% cpu
-// time in a profiler.
+// looking at any other queue. After hitting ts=10, we need to find the next
+// min-event again.
+// The min_ts of all the queues (across all machines) is kept in a tournament
+// tree: finding the two oldest queues and updating the min_ts of the queue
+// we extracted from is O(log(N)) rather than O(N). This matters for traces
+// with thousands of queues (e.g. Chrome traces with many threads or traces
+// from many machines) where events of different queues interleave finely.
 void TraceSorter::SortAndExtractEventsUntilAllocId(
     BumpAllocator::AllocId limit_alloc_id) {
   constexpr int64_t kTsMax = std::numeric_limits<int64_t>::max();
-  for (;;) {
-    size_t min_machine_idx = 0;
-    size_t min_queue_idx = 0;  // The index of the queue with the min(ts).
-
-    // The top-2 min(ts) among all queues.
-    // queues_[min_queue_idx].events.timestamp == min_queue_ts[0].
-    int64_t min_queue_ts[2]{kTsMax, kTsMax};
-
-    // This loop identifies the queue which starts with the earliest event and
-    // also remembers the earliest event of the 2nd queue (in min_queue_ts[1]).
-    bool all_queues_empty = true;
-    for (size_t m = 0; m < sorter_data_by_machine_.size(); m++) {
-      TraceSorterData& sorter_data = sorter_data_by_machine_[m];
-      for (size_t i = 0; i < sorter_data.queues.size(); i++) {
-        auto& queue = sorter_data.queues[i];
-        if (queue.events_.empty())
-          continue;
-        all_queues_empty = false;
-
-        PERFETTO_DCHECK(queue.max_ts_ <= append_max_ts_);
-        if (queue.min_ts_ < min_queue_ts[0]) {
-          min_queue_ts[1] = min_queue_ts[0];
-          min_queue_ts[0] = queue.min_ts_;
-          min_queue_idx = i;
-          min_machine_idx = m;
-        } else if (queue.min_ts_ < min_queue_ts[1]) {
-          min_queue_ts[1] = queue.min_ts_;
-        }
-      }
-    }
-    if (all_queues_empty)
-      break;
 
+  // Queues are not added or removed while extracting so the tree (and the
+  // mapping from its leaves to queues) can be built once per call.
+  merge_tree_queues_.clear();
+  for (uint32_t m = 0; m < sorter_data_by_machine_.size(); m++) {
+    const TraceSorterData& sorter_data = sorter_data_by_machine_[m];
+    for (uint32_t i = 0; i < sorter_data.queues.size(); i++)
+      merge_tree_queues_.emplace_back(m, i);
+  }
+  if (merge_tree_queues_.empty())
+    return;
+
+  SortQueuesInParallel();
+
+  merge_tree_.Reset(merge_tree_queues_.size());
+  for (size_t leaf = 0; leaf < merge_tree_queues_.size(); leaf++) {
+    auto [m, i] = merge_tree_queues_[leaf];
+    const Queue& queue = sorter_data_by_machine_[m].queues[i];
+    if (queue.events_.empty())
+      continue;
+    PERFETTO_DCHECK(queue.max_ts_ <= append_max_ts_);
+    merge_tree_.SetWithoutRebuild(leaf, queue.min_ts_);
+  }
+  merge_tree_.Rebuild();
+
+  for (;;) {
+    size_t min_leaf = merge_tree_.min_index();
+    auto [min_machine_idx, min_queue_idx] = merge_tree_queues_[min_leaf];
     auto& sorter_data = sorter_data_by_machine_[min_machine_idx];
     auto& queue = sorter_data.queues[min_queue_idx];
     auto& events = queue.events_;
-    if (queue.needs_sorting())
+    if (events.empty())
+      break;
+
+    // The min(ts) of all the other queues.
+    int64_t second_min_queue_ts = merge_tree_.SecondMinKey();
+
+    if (queue.needs_sorting()) {
+      auto sample = IngestionProfiler::SampleNamed(
+          ingestion_profiler_.get(), IngestionProfiler::Phase::kSort,
+          "queue_sort");
       queue.Sort();
+    }
     PERFETTO_DCHECK(queue.min_ts_ == events.front().ts);
 
     // Now that we identified the min-queue, extract all events from it until
@@ -148,9 +219,9 @@ void TraceSorter::SortAndExtractEventsUntilAllocId(
         break;
       }
 
-      if (event.ts > min_queue_ts[1]) {
+      if (event.ts > second_min_queue_ts) {
         // We should never hit this condition on the first extraction as by
-        // the algorithm above (event.ts =) min_queue_ts[0] <= min_queue[1].
+        // the algorithm above (event.ts =) min_queue_ts <= second_min_queue_ts.
         PERFETTO_DCHECK(num_extracted > 0);
         break;
       }
@@ -179,6 +250,7 @@ void TraceSorter::SortAndExtractEventsUntilAllocId(
     } else {
       queue.min_ts_ = queue.events_.front().ts;
     }
+    merge_tree_.Update(min_leaf, queue.min_ts_);
   }  // for(;;)
 }
 
@@ -213,6 +285,8 @@ void TraceSorter::ParseTracePacket(TraceProcessorContext& context,
     case TimestampedEvent::Type::kInlineSchedSwitch:
     case TimestampedEvent::Type::kInlineSchedWaking:
     case TimestampedEvent::Type::kEtwEvent:
+    case TimestampedEvent::Type::kInlineEtwCSwitch:
+    case TimestampedEvent::Type::kInlineEtwReadyThread:
     case TimestampedEvent::Type::kFtraceEvent:
       PERFETTO_FATAL("Invalid event type");
   }
@@ -228,6 +302,14 @@ void TraceSorter::ParseEtwPacket(TraceProcessorContext& context,
       context.proto_trace_parser->ParseEtwEvent(
           cpu, event.ts, token_buffer_.Extract<TracePacketData>(id));
       return;
+    case TimestampedEvent::Type::kInlineEtwCSwitch:
+      context.proto_trace_parser->ParseInlineEtwCSwitch(
+          cpu, event.ts, token_buffer_.Extract<InlineEtwCSwitch>(id));
+      return;
+    case TimestampedEvent::Type::kInlineEtwReadyThread:
+      context.proto_trace_parser->ParseInlineEtwReadyThread(
+          cpu, event.ts, token_buffer_.Extract<InlineEtwReadyThread>(id));
+      return;
     case TimestampedEvent::Type::kInlineSchedSwitch:
     case TimestampedEvent::Type::kInlineSchedWaking:
     case TimestampedEvent::Type::kFtraceEvent:
@@ -260,6 +342,8 @@ void TraceSorter::ParseFtracePacket(TraceProcessorContext& context,
           cpu, event.ts, token_buffer_.Extract<TracePacketData>(id));
       return;
     case TimestampedEvent::Type::kEtwEvent:
+    case TimestampedEvent::Type::kInlineEtwCSwitch:
+    case TimestampedEvent::Type::kInlineEtwReadyThread:
     case TimestampedEvent::Type::kTrackEvent:
     case TimestampedEvent::Type::kSystraceLine:
     case TimestampedEvent::Type::kTracePacket:
@@ -305,6 +389,12 @@ void TraceSorter::ExtractAndDiscardTokenizedObject(
     case TimestampedEvent::Type::kEtwEvent:
       base::ignore_result(token_buffer_.Extract<TracePacketData>(id));
       return;
+    case TimestampedEvent::Type::kInlineEtwCSwitch:
+      base::ignore_result(token_buffer_.Extract<InlineEtwCSwitch>(id));
+      return;
+    case TimestampedEvent::Type::kInlineEtwReadyThread:
+      base::ignore_result(token_buffer_.Extract<InlineEtwReadyThread>(id));
+      return;
   }
   PERFETTO_FATAL("For GCC");
 }
@@ -334,7 +424,9 @@ void TraceSorter::MaybeExtractEvent(size_t min_machine_idx,
     uint32_t cpu = static_cast<uint32_t>(queue_idx - 1);
     auto event_type = static_cast<TimestampedEvent::Type>(event.event_type);
 
-    if (event_type == TimestampedEvent::Type::kEtwEvent) {
+    if (event_type == TimestampedEvent::Type::kEtwEvent ||
+        event_type == TimestampedEvent::Type::kInlineEtwCSwitch ||
+        event_type == TimestampedEvent::Type::kInlineEtwReadyThread) {
       ParseEtwPacket(*machine_context, static_cast<uint32_t>(cpu), event);
     } else {
       ParseFtracePacket(*machine_context, cpu, event);
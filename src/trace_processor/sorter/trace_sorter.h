@@ -32,12 +32,17 @@
 #include "src/trace_processor/importers/common/trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_record.h"
 #include "src/trace_processor/importers/systrace/systrace_line.h"
+#include "src/trace_processor/sorter/tournament_tree.h"
 #include "src/trace_processor/sorter/trace_token_buffer.h"
 #include "src/trace_processor/storage/trace_storage.h"
 #include "src/trace_processor/types/trace_processor_context.h"
 #include "src/trace_processor/util/bump_allocator.h"
 
 namespace perfetto {
+namespace base {
+class ThreadPool;
+}  // namespace base
+
 namespace trace_processor {
 
 // This class takes care of sorting events parsed from the trace stream in
@@ -170,6 +175,30 @@ class TraceSorter {
     UpdateAppendMaxTs(queue);
   }
 
+  inline void PushInlineEtwEvent(
+      uint32_t cpu,
+      int64_t timestamp,
+      InlineEtwCSwitch inline_c_switch,
+      std::optional<MachineId> machine_id = std::nullopt) {
+    TraceTokenBuffer::Id id = token_buffer_.Append(std::move(inline_c_switch));
+    auto* queue = GetQueue(cpu + 1, machine_id);
+    queue->Append(timestamp, TimestampedEvent::Type::kInlineEtwCSwitch, id);
+    UpdateAppendMaxTs(queue);
+  }
+
+  inline void PushInlineEtwEvent(
+      uint32_t cpu,
+      int64_t timestamp,
+      InlineEtwReadyThread inline_ready_thread,
+      std::optional<MachineId> machine_id = std::nullopt) {
+    TraceTokenBuffer::Id id =
+        token_buffer_.Append(std::move(inline_ready_thread));
+    auto* queue = GetQueue(cpu + 1, machine_id);
+    queue->Append(timestamp, TimestampedEvent::Type::kInlineEtwReadyThread,
+                  id);
+    UpdateAppendMaxTs(queue);
+  }
+
   inline void PushFtraceEvent(
       uint32_t cpu,
       int64_t timestamp,
@@ -243,6 +272,17 @@ class TraceSorter {
 
   int64_t max_timestamp() const { return append_max_ts_; }
 
+  // Returns the timestamp of the latest event pushed to the parsers, i.e.
+  // the point up to which the trace has been ingested: events older than this
+  // which are pushed to the sorter later are out of order (and counted in the
+  // sorter_push_event_out_of_order stat). Returns INT64_MIN if no event was
+  // pushed to the parsers yet.
+  int64_t latest_pushed_event_ts() const { return latest_pushed_event_ts_; }
+
+  // Returns the number of bytes of memory used by the events held by the
+  // sorter, i.e. by the tokenized objects and the queues sorting them.
+  uint64_t memory_usage() const;
+
  private:
   struct TimestampedEvent {
     enum class Type : uint8_t {
@@ -256,7 +296,9 @@ class TraceSorter {
       kTrackEvent,
       kSystraceLine,
       kEtwEvent,
-      kMax = kEtwEvent,
+      kInlineEtwCSwitch,
+      kInlineEtwReadyThread,
+      kMax = kInlineEtwReadyThread,
     };
 
     // Number of bits required to store the max element in |Type|.
@@ -351,6 +393,11 @@ class TraceSorter {
 
   void SortAndExtractEventsUntilAllocId(BumpAllocator::AllocId alloc_id);
 
+  // Sorts, on |sort_pool_|, all the queues which need sorting. Returns
+  // immediately if there are less than two such queues or threads are
+  // disabled (see |Config::tokenizer_thread_count|).
+  void SortQueuesInParallel();
+
   inline Queue* GetQueue(size_t index,
                          std::optional<MachineId> machine_id = std::nullopt) {
     // sorter_data_by_machine_[0] corresponds to the default machine.
@@ -358,14 +405,21 @@ class TraceSorter {
     auto* queues = &sorter_data_by_machine_[0].queues;
 
     // Find the TraceSorterData instance when |machine_id| is not nullopt.
+    // Events of a machine tend to be pushed in runs, so remember the last
+    // machine looked up rather than scanning all the machines every time.
     if (PERFETTO_UNLIKELY(!!machine_id)) {
-      auto it = std::find_if(sorter_data_by_machine_.begin() + 1,
-                             sorter_data_by_machine_.end(),
-                             [machine_id](const TraceSorterData& item) {
-                               return item.machine_id == machine_id;
-                             });
-      PERFETTO_DCHECK(it != sorter_data_by_machine_.end());
-      queues = &it->queues;
+      if (sorter_data_by_machine_[last_machine_idx_].machine_id !=
+          machine_id) {
+        auto it = std::find_if(sorter_data_by_machine_.begin() + 1,
+                               sorter_data_by_machine_.end(),
+                               [machine_id](const TraceSorterData& item) {
+                                 return item.machine_id == machine_id;
+                               });
+        PERFETTO_DCHECK(it != sorter_data_by_machine_.end());
+        last_machine_idx_ =
+            static_cast<size_t>(it - sorter_data_by_machine_.begin());
+      }
+      queues = &sorter_data_by_machine_[last_machine_idx_].queues;
     }
 
     if (PERFETTO_UNLIKELY(index >= queues->size()))
@@ -418,12 +472,31 @@ class TraceSorter {
   };
   std::vector<TraceSorterData> sorter_data_by_machine_;
 
+  // Index in |sorter_data_by_machine_| of the last non-default machine
+  // looked up by GetQueue().
+  size_t last_machine_idx_ = 0;
+
+  // Used by SortAndExtractEventsUntilAllocId() to find the queue with the
+  // earliest event. Each leaf of |merge_tree_| is keyed by the min_ts_ of the
+  // queue at the same index of |merge_tree_queues_|, which stores the
+  // (machine index, queue index) pairs of all the queues.
+  TournamentTree merge_tree_;
+  std::vector<std::pair<uint32_t, uint32_t>> merge_tree_queues_;
+
   // Whether we should ignore incremental extraction and just wait for
   // forced extractionn at the end of the trace.
   SortingMode sorting_mode_ = SortingMode::kDefault;
 
   std::shared_ptr<TraceStorage> storage_;
 
+  // Null unless |Config::enable_ingestion_profile| is set.
+  std::shared_ptr<IngestionProfiler> ingestion_profiler_;
+
+  // See |Config::tokenizer_thread_count|. |sort_pool_| is created on the first
+  // extraction which has more than one queue to sort.
+  uint32_t thread_count_ = 1;
+  std::unique_ptr<base::ThreadPool> sort_pool_;
+
   // Buffer for storing tokenized objects while the corresponding events are
   // being sorted.
   TraceTokenBuffer token_buffer_;
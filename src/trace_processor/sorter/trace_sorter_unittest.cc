@@ -97,6 +97,10 @@ class TraceSorterTest : public ::testing::Test {
     context_.sorter.reset(new TraceSorter(&context_, sorting_mode));
   }
 
+  // Pushes random ftrace events from several machines and checks that they
+  // are parsed in timestamp order.
+  void TestMultiMachineSorting();
+
  protected:
   TraceProcessorContext context_;
   MockTraceParser* parser_;
@@ -330,7 +334,7 @@ TEST_F(TraceSorterTest, MultiQueueSorting) {
 }
 
 // An generalized version of MultiQueueSorting with multiple machines.
-TEST_F(TraceSorterTest, MultiMachineSorting) {
+void TraceSorterTest::TestMultiMachineSorting() {
   PacketSequenceState state(&context_);
   std::minstd_rand0 rnd_engine(0);
 
@@ -437,6 +441,17 @@ TEST_F(TraceSorterTest, MultiMachineSorting) {
   EXPECT_TRUE(expectations.empty());
 }
 
+TEST_F(TraceSorterTest, MultiMachineSorting) {
+  TestMultiMachineSorting();
+}
+
+// The queues of the machines are sorted on a thread pool before being merged.
+TEST_F(TraceSorterTest, MultiMachineSortingOnThreadPool) {
+  context_.config.tokenizer_thread_count = 4;
+  CreateSorter();
+  TestMultiMachineSorting();
+}
+
 }  // namespace
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -27,6 +27,7 @@
 #include <utility>
 
 #include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/trace_processor/trace_blob.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_processor/importers/common/parser_types.h"
@@ -249,6 +250,10 @@ void TraceTokenBuffer::FreeMemory() {
   PERFETTO_CHECK(interned_blobs_.size() == interned_seqs_.size());
 }
 
+bool TraceTokenBuffer::EnableSpillToDisk() {
+  return allocator_.SetSpillFile(base::TempFile::CreateUnlinked().ReleaseFD());
+}
+
 BumpAllocator::AllocId TraceTokenBuffer::AllocAndResizeInternedVectors(
     uint32_t size) {
   uint64_t erased = allocator_.erased_front_chunks_count();
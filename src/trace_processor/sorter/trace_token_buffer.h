@@ -93,10 +93,18 @@ class TraceTokenBuffer {
     return allocator_.PastTheEndId();
   }
 
+  // Returns the number of bytes of memory used to store the appended objects.
+  uint64_t memory_usage() const { return allocator_.memory_usage(); }
+
   // Attempts to free any memory retained by this buffer and the underlying
   // allocator. The amount of memory free is implementation defined.
   void FreeMemory();
 
+  // Makes the memory of the objects appended from now on be backed by an
+  // unlinked temporary file (see BumpAllocator::SetSpillFile). Returns false
+  // if this is not supported on this platform.
+  bool EnableSpillToDisk();
+
  private:
   struct BlobWithOffset {
     TraceBlob* blob;
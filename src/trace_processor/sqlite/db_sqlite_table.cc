@@ -22,6 +22,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <iterator>
+#include <limits>
 #include <memory>
 #include <numeric>
 #include <optional>
@@ -32,11 +33,13 @@
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/small_vector.h"
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/containers/row_map.h"
@@ -45,8 +48,10 @@
 #include "src/trace_processor/db/table.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/static_table_function.h"
 #include "src/trace_processor/sqlite/module_lifecycle_manager.h"
+#include "src/trace_processor/sqlite/sql_profile.h"
 #include "src/trace_processor/sqlite/sqlite_utils.h"
 #include "src/trace_processor/tp_metatrace.h"
+#include "src/trace_processor/util/query_cancellation.h"
 #include "src/trace_processor/util/regex.h"
 
 #include "protos/perfetto/trace_processor/metatrace_categories.pbzero.h"
@@ -225,19 +230,64 @@ int ReadIdxStrAndUpdateCursor(DbSqliteModule::Cursor* cursor,
   return SQLITE_OK;
 }
 
+DbSqliteModule::Cursor::HashJoinIndex BuildHashJoinIndex(const Table& table,
+                                                         uint32_t col_idx) {
+  PERFETTO_TP_TRACE(metatrace::Category::QUERY_DETAILED,
+                    "DB_TABLE_BUILD_HASH_JOIN_INDEX");
+  const ColumnLegacy& col = table.columns()[col_idx];
+  uint32_t row_count = table.row_count();
+
+  // First pass: assign a bucket to each distinct value and count the rows of
+  // each bucket.
+  constexpr uint32_t kNoBucket = std::numeric_limits<uint32_t>::max();
+  DbSqliteModule::Cursor::HashJoinIndex index;
+  std::vector<uint32_t> row_buckets(row_count, kNoBucket);
+  std::vector<uint32_t> bucket_sizes;
+  for (uint32_t i = 0; i < row_count; ++i) {
+    SqlValue value = col.Get(i);
+    if (value.type != SqlValue::kLong) {
+      continue;
+    }
+    auto [bucket, inserted] = index.buckets.Insert(
+        value.AsLong(), static_cast<uint32_t>(bucket_sizes.size()));
+    if (inserted) {
+      bucket_sizes.push_back(0);
+    }
+    bucket_sizes[*bucket]++;
+    row_buckets[i] = *bucket;
+  }
+
+  // Second pass: lay out the rows of each bucket contiguously.
+  index.bucket_starts.resize(bucket_sizes.size() + 1);
+  index.bucket_starts[0] = 0;
+  for (uint32_t b = 0; b < bucket_sizes.size(); ++b) {
+    index.bucket_starts[b + 1] = index.bucket_starts[b] + bucket_sizes[b];
+  }
+  std::vector<uint32_t> next(index.bucket_starts.begin(),
+                             index.bucket_starts.end() - 1);
+  index.rows.resize(index.bucket_starts.back());
+  for (uint32_t i = 0; i < row_count; ++i) {
+    if (row_buckets[i] != kNoBucket) {
+      index.rows[next[row_buckets[i]]++] = i;
+    }
+  }
+  return index;
+}
+
 PERFETTO_ALWAYS_INLINE void TryCacheCreateSortedTable(
     DbSqliteModule::Cursor* cursor,
     const Table::Schema& schema,
     bool is_same_idx) {
   if (!is_same_idx) {
     cursor->repeated_cache_count = 0;
+    cursor->hash_join_index = std::nullopt;
     return;
   }
 
   // Only try and create the cached table on exactly the third time we see
   // this constraint set.
   constexpr uint32_t kRepeatedThreshold = 3;
-  if (cursor->sorted_cache_table ||
+  if (cursor->sorted_cache_table || cursor->hash_join_index ||
       cursor->repeated_cache_count++ != kRepeatedThreshold) {
     return;
   }
@@ -260,11 +310,73 @@ PERFETTO_ALWAYS_INLINE void TryCacheCreateSortedTable(
     return;
   }
 
+  // On integer columns, if the rows can be returned in table order, a hash
+  // index answers each probe with a single lookup: this makes the join a hash
+  // join with this table as the build side.
+  const Query& q = cursor->query;
+  if (schema.columns[c.col_idx].type == SqlValue::kLong && q.orders.empty() &&
+      !q.limit && q.offset == 0) {
+    cursor->hash_join_index =
+        BuildHashJoinIndex(*cursor->upstream_table, c.col_idx);
+    return;
+  }
+
   // Try again to get the result or start caching it.
   cursor->sorted_cache_table =
       cursor->upstream_table->Sort({Order{c.col_idx, false}});
 }
 
+const char* FilterOpToString(FilterOp op) {
+  switch (op) {
+    case FilterOp::kEq:
+      return "=";
+    case FilterOp::kGe:
+      return ">=";
+    case FilterOp::kGt:
+      return ">";
+    case FilterOp::kLe:
+      return "<=";
+    case FilterOp::kLt:
+      return "<";
+    case FilterOp::kNe:
+      return "!=";
+    case FilterOp::kIsNull:
+      return "IS";
+    case FilterOp::kIsNotNull:
+      return "IS NOT";
+    case FilterOp::kGlob:
+      return "GLOB";
+    case FilterOp::kRegex:
+      return "REGEXP";
+  }
+  PERFETTO_FATAL("For GCC");
+}
+
+// Returns the constraints and orders of the query of |cursor|, without the
+// values of the constraints, for the SQL profile.
+std::string DescribeQueryForProfile(const Table::Schema& schema,
+                                    const DbSqliteModule::Cursor* cursor) {
+  std::string res;
+  for (const Constraint& c : cursor->query.constraints) {
+    res += res.empty() ? "WHERE " : " AND ";
+    res += schema.columns[c.col_idx].name;
+    res += " ";
+    res += FilterOpToString(c.op);
+    if (c.op != FilterOp::kIsNull && c.op != FilterOp::kIsNotNull) {
+      res += " ?";
+    }
+  }
+  for (size_t i = 0; i < cursor->query.orders.size(); ++i) {
+    const Order& o = cursor->query.orders[i];
+    res += i == 0 ? (res.empty() ? "ORDER BY " : " ORDER BY ") : ", ";
+    res += schema.columns[o.col_idx].name;
+    if (o.desc) {
+      res += " DESC";
+    }
+  }
+  return res.empty() ? "full scan" : res;
+}
+
 void FilterAndSortMetatrace(const std::string& table_name,
                             const Table::Schema& schema,
                             DbSqliteModule::Cursor* cursor,
@@ -275,38 +387,7 @@ void FilterAndSortMetatrace(const std::string& table_name,
     writer.AppendString(schema.columns[c.col_idx].name);
 
     writer.AppendString(" ");
-    switch (c.op) {
-      case FilterOp::kEq:
-        writer.AppendString("=");
-        break;
-      case FilterOp::kGe:
-        writer.AppendString(">=");
-        break;
-      case FilterOp::kGt:
-        writer.AppendString(">");
-        break;
-      case FilterOp::kLe:
-        writer.AppendString("<=");
-        break;
-      case FilterOp::kLt:
-        writer.AppendString("<");
-        break;
-      case FilterOp::kNe:
-        writer.AppendString("!=");
-        break;
-      case FilterOp::kIsNull:
-        writer.AppendString("IS");
-        break;
-      case FilterOp::kIsNotNull:
-        writer.AppendString("IS NOT");
-        break;
-      case FilterOp::kGlob:
-        writer.AppendString("GLOB");
-        break;
-      case FilterOp::kRegex:
-        writer.AppendString("REGEXP");
-        break;
-    }
+    writer.AppendString(FilterOpToString(c.op));
     writer.AppendString(" ");
 
     switch (c.value.type) {
@@ -360,6 +441,7 @@ int DbSqliteModule::Create(sqlite3* db,
   std::unique_ptr<Vtab> res = std::make_unique<Vtab>();
   res->state = context->manager.OnCreate(argv, std::move(state));
   res->table_name = argv[2];
+  res->profile = context->profile;
   *vtab = res.release();
   return SQLITE_OK;
 }
@@ -389,6 +471,7 @@ int DbSqliteModule::Connect(sqlite3* db,
   std::unique_ptr<Vtab> res = std::make_unique<Vtab>();
   res->state = context->manager.OnConnect(argv);
   res->table_name = argv[2];
+  res->profile = context->profile;
 
   auto* state =
       sqlite::ModuleStateManager<DbSqliteModule>::GetState(res->state);
@@ -415,13 +498,16 @@ int DbSqliteModule::BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
 
   uint32_t row_count;
   int argv_index;
+  const Table* table = nullptr;
   switch (s->computation) {
     case TableComputation::kStatic:
-      row_count = s->static_table->row_count();
+      table = s->static_table;
+      row_count = table->row_count();
       argv_index = 1;
       break;
     case TableComputation::kRuntime:
-      row_count = s->runtime_table->row_count();
+      table = s->runtime_table.get();
+      row_count = table->row_count();
       argv_index = 1;
       break;
     case TableComputation::kTableFunction:
@@ -497,6 +583,35 @@ int DbSqliteModule::BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
     });
   }
 
+  // If an index can be used for some of the constraints, move them to the
+  // front in the order of the columns of the index.
+  uint32_t indexed_cs_count = 0;
+  if (table && !table->indexes().empty()) {
+    std::vector<Constraint> cs;
+    cs.reserve(cs_idxes.size());
+    for (int i : cs_idxes) {
+      const auto& c = info->aConstraint[i];
+      cs.push_back(Constraint{static_cast<uint32_t>(c.iColumn),
+                              *SqliteOpToFilterOp(c.op), SqlValue()});
+    }
+    uint32_t matched = 0;
+    if (const auto* index = table->FindIndexForConstraints(cs, &matched);
+        index) {
+      auto index_pos = [&](int c_idx) {
+        auto col = static_cast<uint32_t>(info->aConstraint[c_idx].iColumn);
+        auto end = index->columns.begin() + matched;
+        auto it = std::find(index->columns.begin(), end, col);
+        return static_cast<uint32_t>(std::distance(index->columns.begin(), it));
+      };
+      std::stable_sort(
+          cs_idxes.begin(), cs_idxes.end(),
+          [&](int a, int b) { return index_pos(a) < index_pos(b); });
+      indexed_cs_count = static_cast<uint32_t>(
+          std::count_if(cs_idxes.begin(), cs_idxes.end(),
+                        [&](int c) { return index_pos(c) < matched; }));
+    }
+  }
+
   // Remove any order by constraints which also have an equality constraint.
   {
     auto p = [info, &cs_idxes](int o_idx) {
@@ -626,8 +741,8 @@ int DbSqliteModule::BestIndex(sqlite3_vtab* vtab, sqlite3_index_info* info) {
   // We can sort on any column correctly.
   info->orderByConsumed = true;
 
-  auto cost_and_rows =
-      EstimateCost(s->schema, row_count, info, cs_idxes, ob_idxes);
+  auto cost_and_rows = EstimateCost(s->schema, row_count, info, cs_idxes,
+                                    ob_idxes, indexed_cs_count);
   info->estimatedCost = cost_and_rows.cost;
   info->estimatedRows = cost_and_rows.rows;
 
@@ -650,12 +765,29 @@ int DbSqliteModule::Open(sqlite3_vtab* tab, sqlite3_vtab_cursor** cursor) {
           static_cast<size_t>(s->argument_count));
       break;
   }
+  if (PERFETTO_UNLIKELY(t->profile && t->profile->enabled())) {
+    c->profile_id = t->profile->AddOperator(t->table_name);
+  }
   *cursor = c.release();
   return SQLITE_OK;
 }
 
 int DbSqliteModule::Close(sqlite3_vtab_cursor* cursor) {
   std::unique_ptr<Cursor> c(GetCursor(cursor));
+  if (PERFETTO_UNLIKELY(c->profile_id)) {
+    auto* t = GetVtab(cursor->pVtab);
+    if (SqlProfile::Entry* entry = t->profile->Find(*c->profile_id); entry) {
+      entry->dur = c->profile_dur;
+      entry->rows = c->profile_rows;
+      entry->filter_count = c->profile_filter_count;
+      entry->detail = std::move(c->profile_detail);
+      if (c->hash_join_index) {
+        entry->detail += "; using hash join index";
+      } else if (c->sorted_cache_table) {
+        entry->detail += "; using sorted table cache";
+      }
+    }
+  }
   return SQLITE_OK;
 }
 
@@ -668,6 +800,18 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
   auto* t = GetVtab(cursor->pVtab);
   auto* s = sqlite::ModuleStateManager<DbSqliteModule>::GetState(t->state);
 
+  int64_t profile_start = 0;
+  if (PERFETTO_UNLIKELY(c->profile_id)) {
+    profile_start = base::GetWallTimeNs().count();
+    c->profile_filter_count++;
+  }
+  auto profile = base::OnScopeExit([c, profile_start] {
+    if (PERFETTO_UNLIKELY(c->profile_id)) {
+      c->profile_dur += base::GetWallTimeNs().count() - profile_start;
+      c->profile_rows += !c->eof;
+    }
+  });
+
   // Clear out the iterator before filtering to ensure the destructor is run
   // before the table's destructor.
   c->iterator = std::nullopt;
@@ -688,6 +832,13 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
       return r;
     }
     c->last_idx_num = idx_num;
+    if (PERFETTO_UNLIKELY(c->profile_id)) {
+      std::string query = DescribeQueryForProfile(s->schema, c);
+      if (c->profile_detail.find(query) == std::string::npos) {
+        c->profile_detail += c->profile_detail.empty() ? "" : " | ";
+        c->profile_detail += query;
+      }
+    }
   }
 
   // Setup the upstream table based on the computation state.
@@ -719,6 +870,26 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
     }
   }
 
+  // Probing the hash index does not need the constraint values to be
+  // validated by the table so only use it for integer values: anything else
+  // takes the slow path below.
+  if (c->hash_join_index &&
+      c->query.constraints.front().value.type == SqlValue::kLong) {
+    const auto& index = *c->hash_join_index;
+    c->mode = Cursor::Mode::kHashJoinRows;
+    c->hash_join_row = nullptr;
+    c->hash_join_rows_end = nullptr;
+    if (const uint32_t* bucket =
+            index.buckets.Find(c->query.constraints.front().value.AsLong());
+        bucket) {
+      c->hash_join_row = index.rows.data() + index.bucket_starts[*bucket];
+      c->hash_join_rows_end =
+          index.rows.data() + index.bucket_starts[*bucket + 1];
+    }
+    c->eof = c->hash_join_row == c->hash_join_rows_end;
+    return SQLITE_OK;
+  }
+
   PERFETTO_TP_TRACE(metatrace::Category::QUERY_DETAILED,
                     "DB_TABLE_FILTER_AND_SORT",
                     [s, t, c](metatrace::Record* r) {
@@ -728,6 +899,13 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
   const auto* source_table =
       c->sorted_cache_table ? &*c->sorted_cache_table : c->upstream_table;
   RowMap filter_map = source_table->QueryToRowMap(c->query);
+  if (const auto* cancellation = QueryCancellation::Current();
+      cancellation && cancellation->ShouldStop()) {
+    // The filter stops early when the query should stop so |filter_map| may be
+    // partial: fail the query rather than returning it.
+    c->eof = true;
+    return sqlite::utils::SetError(t, cancellation->ToStatus().c_message());
+  }
   if (filter_map.IsRange() && filter_map.size() <= 1) {
     // Currently, our criteria where we have a special fast path is if it's
     // a single ranged row. We have this fast path for joins on id columns
@@ -753,11 +931,21 @@ int DbSqliteModule::Filter(sqlite3_vtab_cursor* cursor,
 
 int DbSqliteModule::Next(sqlite3_vtab_cursor* cursor) {
   auto* c = GetCursor(cursor);
+  int64_t profile_start = 0;
+  if (PERFETTO_UNLIKELY(c->profile_id)) {
+    profile_start = base::GetWallTimeNs().count();
+  }
   if (c->mode == Cursor::Mode::kSingleRow) {
     c->eof = true;
+  } else if (c->mode == Cursor::Mode::kHashJoinRows) {
+    c->eof = ++c->hash_join_row == c->hash_join_rows_end;
   } else {
     c->eof = !++*c->iterator;
   }
+  if (PERFETTO_UNLIKELY(c->profile_id)) {
+    c->profile_dur += base::GetWallTimeNs().count() - profile_start;
+    c->profile_rows += !c->eof;
+  }
   return SQLITE_OK;
 }
 
@@ -772,9 +960,20 @@ int DbSqliteModule::Column(sqlite3_vtab_cursor* cursor,
   auto idx = static_cast<uint32_t>(N);
   const auto* source_table =
       c->sorted_cache_table ? &*c->sorted_cache_table : c->upstream_table;
-  SqlValue value = c->mode == Cursor::Mode::kSingleRow
-                       ? source_table->columns()[idx].Get(*c->single_row)
-                       : c->iterator->Get(idx);
+  SqlValue value;
+  switch (c->mode) {
+    case Cursor::Mode::kSingleRow:
+      value = source_table->columns()[idx].Get(*c->single_row);
+      break;
+    case Cursor::Mode::kHashJoinRows:
+      // The hash index is built on |upstream_table|, never on
+      // |sorted_cache_table|.
+      value = c->upstream_table->columns()[idx].Get(*c->hash_join_row);
+      break;
+    case Cursor::Mode::kTable:
+      value = c->iterator->Get(idx);
+      break;
+  }
   // We can say kSqliteStatic for strings because all strings are expected
   // to come from the string pool. Thus they will be valid for the lifetime
   // of trace processor. Similarily, for bytes, we can also use
@@ -796,7 +995,8 @@ DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
     uint32_t row_count,
     sqlite3_index_info* info,
     const std::vector<int>& cs_idxes,
-    const std::vector<int>& ob_idxes) {
+    const std::vector<int>& ob_idxes,
+    uint32_t indexed_cs_count) {
   // Currently our cost estimation algorithm is quite simplistic but is good
   // enough for the simplest cases.
   // TODO(lalitm): replace hardcoded constants with either more heuristics
@@ -822,10 +1022,11 @@ DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
 
   // Setup the variables for estimating the cost of filtering.
   double filter_cost = 0.0;
-  for (int i : cs_idxes) {
+  for (uint32_t k = 0; k < cs_idxes.size(); ++k) {
     if (current_row_count < 2) {
       break;
     }
+    int i = cs_idxes[k];
     const auto& c = info->aConstraint[i];
     PERFETTO_DCHECK(c.usable);
     PERFETTO_DCHECK(info->aConstraintUsage[i].omit);
@@ -840,14 +1041,22 @@ DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
       // an entire filter call is ~10x the cost of iterating a single row.
       filter_cost += 10;
       current_row_count = 1;
+    } else if (k < indexed_cs_count) {
+      // Constraints covered by an index only need a binary search on the
+      // rows left by the previous columns of the index.
+      filter_cost += log2(current_row_count);
+
+      // Use the same heuristic as for equality constraints below.
+      double estimated_rows = current_row_count / (2 * log2(current_row_count));
+      current_row_count = std::max(static_cast<uint32_t>(estimated_rows), 1u);
     } else if (sqlite::utils::IsOpEq(c.op)) {
       // If there is only a single equality constraint, we have special logic
-      // to sort by that column and then binary search if we see the
-      // constraint set often. Model this by dividing by the log of the number
-      // of rows as a good approximation. Otherwise, we'll need to do a full
-      // table scan. Alternatively, if the column is sorted, we can use the
-      // same binary search logic so we have the same low cost (even
-      // better because we don't // have to sort at all).
+      // to sort by that column and then binary search (or to hash integer
+      // columns) if we see the constraint set often. Model this by dividing
+      // by the log of the number of rows as a good approximation. Otherwise,
+      // we'll need to do a full table scan. Alternatively, if the column is
+      // sorted, we can use the same binary search logic so we have the same
+      // low cost (even better because we don't // have to sort at all).
       filter_cost += cs_idxes.size() == 1 || col_schema.is_sorted
                          ? log2(current_row_count)
                          : current_row_count;
@@ -896,7 +1105,7 @@ DbSqliteModule::QueryCost DbSqliteModule::EstimateCost(
   return QueryCost{final_cost, current_row_count};
 }
 
-DbSqliteModule::State::State(const Table* _table, Table::Schema _schema)
+DbSqliteModule::State::State(Table* _table, Table::Schema _schema)
     : State(TableComputation::kStatic, std::move(_schema)) {
   static_table = _table;
 }
@@ -24,6 +24,7 @@
 #include <string>
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "src/trace_processor/db/column/types.h"
 #include "src/trace_processor/db/runtime_table.h"
@@ -34,6 +35,8 @@
 
 namespace perfetto::trace_processor {
 
+class SqlProfile;
+
 enum class TableComputation {
   // Table is statically defined.
   kStatic,
@@ -48,7 +51,7 @@ enum class TableComputation {
 // Implements the SQLite table interface for db tables.
 struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   struct State {
-    State(const Table*, Table::Schema);
+    State(Table*, Table::Schema);
     explicit State(std::unique_ptr<RuntimeTable>);
     explicit State(std::unique_ptr<StaticTableFunction>);
 
@@ -57,7 +60,7 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
     int argument_count = 0;
 
     // Only valid when computation == TableComputation::kStatic.
-    const Table* static_table = nullptr;
+    Table* static_table = nullptr;
 
     // Only valid when computation == TableComputation::kRuntime.
     std::unique_ptr<RuntimeTable> runtime_table;
@@ -71,16 +74,34 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   struct Context {
     std::unique_ptr<State> temporary_create_state;
     sqlite::ModuleStateManager<DbSqliteModule> manager;
+    // The profile recording the cursors of the tables, if any.
+    SqlProfile* profile = nullptr;
   };
   struct Vtab : public sqlite::Module<DbSqliteModule>::Vtab {
     sqlite::ModuleStateManager<DbSqliteModule>::PerVtabState* state;
     int best_index_num = 0;
     std::string table_name;
+    SqlProfile* profile = nullptr;
   };
   struct Cursor : public sqlite::Module<DbSqliteModule>::Cursor {
     enum class Mode {
       kSingleRow,
       kTable,
+      kHashJoinRows,
+    };
+
+    // Index of the rows of |upstream_table| by the value of an integer
+    // column. Built when a single equality constraint on that column is
+    // repeated (i.e. |upstream_table| is the inner table of an equi-join) so
+    // that each probe is a single hash lookup instead of a filter of the
+    // table.
+    struct HashJoinIndex {
+      // Maps each non-null value of the column to its bucket.
+      base::FlatHashMap<int64_t, uint32_t> buckets;
+      // The rows of bucket b are |rows[bucket_starts[b]]| to
+      // |rows[bucket_starts[b + 1]]| (exclusive), in ascending order.
+      std::vector<uint32_t> bucket_starts;
+      std::vector<uint32_t> rows;
     };
 
     const Table* upstream_table = nullptr;
@@ -102,16 +123,36 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
     // significantly.
     std::optional<Table> sorted_cache_table;
 
+    // Stores the hash index of |upstream_table| on the column of a repeated
+    // equality constraint on an integer column. Used instead of
+    // |sorted_cache_table| when the query has no order by, limit or offset.
+    std::optional<HashJoinIndex> hash_join_index;
+
     // Stores the count of repeated equality queries to decide whether it is
-    // wortwhile to sort |db_table| to create |sorted_cache_table|.
+    // wortwhile to sort |db_table| to create |sorted_cache_table| (or to
+    // create |hash_join_index|).
     uint32_t repeated_cache_count = 0;
 
+    // Only valid for Mode::kHashJoinRows: the rows of |hash_join_index|
+    // left to iterate.
+    const uint32_t* hash_join_row = nullptr;
+    const uint32_t* hash_join_rows_end = nullptr;
+
     Mode mode = Mode::kSingleRow;
 
     int last_idx_num = -1;
     Query query;
 
     std::vector<SqlValue> table_function_arguments;
+
+    // The id of the entry of this cursor in the SQL profile, if profiling was
+    // enabled when it was opened, and the statistics to record in it when
+    // the cursor is closed.
+    std::optional<uint32_t> profile_id;
+    int64_t profile_dur = 0;
+    int64_t profile_rows = 0;
+    uint32_t profile_filter_count = 0;
+    std::string profile_detail;
   };
   struct QueryCost {
     double cost;
@@ -152,12 +193,14 @@ struct DbSqliteModule : public sqlite::Module<DbSqliteModule> {
   static int Column(sqlite3_vtab_cursor*, sqlite3_context*, int);
   static int Rowid(sqlite3_vtab_cursor*, sqlite_int64*);
 
-  // static for testing.
+  // static for testing. The first |indexed_cs_count| constraints are the
+  // ones which will be applied using an index (see Table::ColumnIndex).
   static QueryCost EstimateCost(const Table::Schema&,
                                 uint32_t row_count,
                                 sqlite3_index_info* info,
                                 const std::vector<int>&,
-                                const std::vector<int>&);
+                                const std::vector<int>&,
+                                uint32_t indexed_cs_count = 0);
 };
 
 }  // namespace perfetto::trace_processor
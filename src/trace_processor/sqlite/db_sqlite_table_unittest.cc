@@ -204,5 +204,23 @@ TEST(DbSqliteModule, OrderByOnSortedCheaper) {
   ASSERT_EQ(sorted_cost.rows, a_cost.rows);
 }
 
+TEST(DbSqliteModule, IndexedEqAndRangeCheaperThanUnindexed) {
+  auto schema = CreateSchema();
+  constexpr uint32_t kRowCount = 1234;
+
+  std::array c{CreateConstraint(3, SQLITE_INDEX_CONSTRAINT_EQ),
+               CreateConstraint(4, SQLITE_INDEX_CONSTRAINT_GE),
+               CreateConstraint(4, SQLITE_INDEX_CONSTRAINT_LT)};
+  std::array u{CreateUsage(), CreateUsage(), CreateUsage()};
+  auto info = CreateCsIndexInfo(c.size(), c.data(), u.data());
+
+  auto unindexed_cost =
+      DbSqliteModule::EstimateCost(schema, kRowCount, &info, {0, 1, 2}, {});
+  auto indexed_cost =
+      DbSqliteModule::EstimateCost(schema, kRowCount, &info, {0, 1, 2}, {}, 3);
+
+  ASSERT_LT(indexed_cost.cost, unindexed_cost.cost);
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor
@@ -128,6 +128,16 @@ class ModuleStateManager {
     return nullptr;
   }
 
+  // Calls |fn| with the name and the state of each module currently alive
+  // (including disconnected ones). As |FindStateByName|, this function should
+  // only be called from outside the module implementation.
+  template <typename Fn>
+  void ForEachState(Fn fn) {
+    for (auto it = state_by_name_.GetIterator(); it; ++it) {
+      fn(it.key(), GetState(it.value().get()));
+    }
+  }
+
  private:
   base::FlatHashMap<std::string, std::unique_ptr<PerVtabState>> state_by_name_;
 };
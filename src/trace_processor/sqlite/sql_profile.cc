@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/sql_profile.h"
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
+
+namespace perfetto::trace_processor {
+
+SqlProfile::ScopedStatement::ScopedStatement(SqlProfile* profile, uint32_t id)
+    : profile_(profile), id_(id), start_(base::GetWallTimeNs().count()) {
+  profile_->statement_stack_.push_back(id);
+}
+
+SqlProfile::ScopedStatement::~ScopedStatement() {
+  PERFETTO_DCHECK(!profile_->statement_stack_.empty() &&
+                  profile_->statement_stack_.back() == id_);
+  profile_->statement_stack_.pop_back();
+  if (Entry* entry = profile_->Find(id_); entry) {
+    entry->dur += base::GetWallTimeNs().count() - start_;
+  }
+}
+
+uint32_t SqlProfile::AddStatement(std::string sql) {
+  return Add(Type::kStatement, std::move(sql));
+}
+
+uint32_t SqlProfile::AddOperator(std::string table) {
+  return Add(Type::kOperator, std::move(table));
+}
+
+SqlProfile::Entry* SqlProfile::Find(uint32_t id) {
+  if (id < evicted_count_ || id - evicted_count_ >= entries_.size()) {
+    return nullptr;
+  }
+  return &entries_[id - evicted_count_];
+}
+
+void SqlProfile::Clear() {
+  evicted_count_ += static_cast<uint32_t>(entries_.size());
+  entries_.clear();
+}
+
+uint32_t SqlProfile::Add(Type type, std::string name) {
+  if (entries_.size() >= kMaxEntries) {
+    entries_.pop_front();
+    evicted_count_++;
+  }
+  Entry entry;
+  entry.type = type;
+  if (!statement_stack_.empty()) {
+    entry.parent_id = statement_stack_.back();
+  }
+  entry.name = std::move(name);
+  entry.ts = base::GetWallTimeNs().count();
+  entries_.emplace_back(std::move(entry));
+  return evicted_count_ + static_cast<uint32_t>(entries_.size()) - 1;
+}
+
+}  // namespace perfetto::trace_processor
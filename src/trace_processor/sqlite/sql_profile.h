@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace perfetto::trace_processor {
+
+// Profile of the execution of SQL: while enabled, records the wall time spent
+// in and the rows produced by every statement executed by the PerfettoSQL
+// engine (including the ones of included modules) and by every cursor of the
+// tables implemented in C++ (see DbSqliteModule).
+//
+// Statements executed while executing another statement (e.g. the statements
+// of a module included by an INCLUDE PERFETTO MODULE statement) and the
+// cursors opened by a statement are its children.
+class SqlProfile {
+ public:
+  static constexpr size_t kMaxEntries = 100 * 1000;
+
+  enum class Type {
+    kStatement,
+    kOperator,
+  };
+
+  struct Entry {
+    Type type;
+    // The id of the statement executing when the entry was added, if any.
+    std::optional<uint32_t> parent_id;
+    // The SQL of the statement or the name of the table of the operator.
+    std::string name;
+    // For operators, the constraints and orders requested by SQLite and how
+    // they were computed.
+    std::string detail;
+    // Wall time at which the statement started executing or the cursor was
+    // opened.
+    int64_t ts = 0;
+    // Wall time spent executing the statement (including its children) or in
+    // the filter and next calls of the cursor.
+    int64_t dur = 0;
+    // Number of rows stepped through by the engine (i.e. not counting the
+    // ones returned to the caller by the last statement of a query) or
+    // returned by the cursor.
+    int64_t rows = 0;
+    // Number of filter calls on the cursor.
+    uint32_t filter_count = 0;
+  };
+
+  // Accounts the wall time spent until its destruction to the statement |id|
+  // and makes it the parent of entries added meanwhile.
+  class ScopedStatement {
+   public:
+    ScopedStatement(SqlProfile*, uint32_t id);
+    ~ScopedStatement();
+
+    ScopedStatement(const ScopedStatement&) = delete;
+    ScopedStatement& operator=(const ScopedStatement&) = delete;
+
+   private:
+    SqlProfile* profile_;
+    uint32_t id_;
+    int64_t start_;
+  };
+
+  bool enabled() const { return enabled_; }
+  void set_enabled(bool enabled) { enabled_ = enabled; }
+
+  // Adds the entry of a statement with the given SQL and returns its id.
+  uint32_t AddStatement(std::string sql);
+
+  // Adds the entry of a cursor on |table| and returns its id.
+  uint32_t AddOperator(std::string table);
+
+  // Returns the entry with the given id or nullptr if it was evicted to make
+  // space for newer entries.
+  Entry* Find(uint32_t id);
+
+  // Removes all the entries.
+  void Clear();
+
+  uint32_t first_id() const { return evicted_count_; }
+  const std::deque<Entry>& entries() const { return entries_; }
+
+ private:
+  uint32_t Add(Type, std::string name);
+
+  bool enabled_ = false;
+  uint32_t evicted_count_ = 0;
+  std::deque<Entry> entries_;
+  std::vector<uint32_t> statement_stack_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_H_
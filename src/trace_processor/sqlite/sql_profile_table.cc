@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/sql_profile_table.h"
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <memory>
+
+#include "perfetto/base/logging.h"
+#include "src/trace_processor/sqlite/bindings/sqlite_result.h"
+#include "src/trace_processor/sqlite/sql_profile.h"
+
+namespace perfetto::trace_processor {
+
+int SqlProfileModule::Connect(sqlite3* db,
+                              void* aux,
+                              int,
+                              const char* const*,
+                              sqlite3_vtab** vtab,
+                              char**) {
+  static constexpr char kSchema[] = R"(
+    CREATE TABLE x(
+      id BIGINT,
+      parent_id BIGINT,
+      type TEXT,
+      name TEXT,
+      detail TEXT,
+      ts BIGINT,
+      dur BIGINT,
+      rows BIGINT,
+      filter_count BIGINT,
+      PRIMARY KEY(id)
+    ) WITHOUT ROWID
+  )";
+  if (int ret = sqlite3_declare_vtab(db, kSchema); ret != SQLITE_OK) {
+    return ret;
+  }
+  std::unique_ptr<Vtab> res = std::make_unique<Vtab>();
+  res->profile = GetContext(aux);
+  *vtab = res.release();
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Disconnect(sqlite3_vtab* vtab) {
+  delete GetVtab(vtab);
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::BestIndex(sqlite3_vtab*, sqlite3_index_info*) {
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Open(sqlite3_vtab* raw_vtab,
+                           sqlite3_vtab_cursor** cursor) {
+  std::unique_ptr<Cursor> c = std::make_unique<Cursor>();
+  c->profile = GetVtab(raw_vtab)->profile;
+  *cursor = c.release();
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Close(sqlite3_vtab_cursor* cursor) {
+  delete GetCursor(cursor);
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Filter(sqlite3_vtab_cursor* cursor,
+                             int,
+                             const char*,
+                             int,
+                             sqlite3_value**) {
+  auto* c = GetCursor(cursor);
+  c->row = 0;
+  // Entries added while this table is read (e.g. for its own cursor) are not
+  // returned.
+  c->first_id = c->profile->first_id();
+  c->num_rows = c->profile->entries().size();
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Next(sqlite3_vtab_cursor* cursor) {
+  GetCursor(cursor)->row++;
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Eof(sqlite3_vtab_cursor* cursor) {
+  auto* c = GetCursor(cursor);
+  return c->row >= c->num_rows;
+}
+
+int SqlProfileModule::Column(sqlite3_vtab_cursor* cursor,
+                             sqlite3_context* ctx,
+                             int N) {
+  auto* c = GetCursor(cursor);
+  auto id = static_cast<uint32_t>(c->first_id + c->row);
+  // The entry might have been evicted by the ones added since the filter.
+  const SqlProfile::Entry* entry = c->profile->Find(id);
+  if (!entry) {
+    sqlite::result::Null(ctx);
+    return SQLITE_OK;
+  }
+  switch (N) {
+    case Column::kId:
+      sqlite::result::Long(ctx, id);
+      break;
+    case Column::kParentId:
+      if (entry->parent_id) {
+        sqlite::result::Long(ctx, *entry->parent_id);
+      } else {
+        sqlite::result::Null(ctx);
+      }
+      break;
+    case Column::kEntryType:
+      sqlite::result::StaticString(
+          ctx,
+          entry->type == SqlProfile::Type::kStatement ? "statement" : "operator");
+      break;
+    case Column::kName:
+      sqlite::result::TransientString(ctx, entry->name.c_str());
+      break;
+    case Column::kDetail:
+      if (entry->detail.empty()) {
+        sqlite::result::Null(ctx);
+      } else {
+        sqlite::result::TransientString(ctx, entry->detail.c_str());
+      }
+      break;
+    case Column::kTs:
+      sqlite::result::Long(ctx, entry->ts);
+      break;
+    case Column::kDur:
+      sqlite::result::Long(ctx, entry->dur);
+      break;
+    case Column::kRows:
+      sqlite::result::Long(ctx, entry->rows);
+      break;
+    case Column::kFilterCount:
+      if (entry->type == SqlProfile::Type::kOperator) {
+        sqlite::result::Long(ctx, entry->filter_count);
+      } else {
+        sqlite::result::Null(ctx);
+      }
+      break;
+    default:
+      PERFETTO_FATAL("Unknown column %d", N);
+      break;
+  }
+  return SQLITE_OK;
+}
+
+int SqlProfileModule::Rowid(sqlite3_vtab_cursor*, sqlite_int64*) {
+  return SQLITE_ERROR;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_TABLE_H_
+#define SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_TABLE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "src/trace_processor/sqlite/bindings/sqlite_module.h"
+
+namespace perfetto::trace_processor {
+
+class SqlProfile;
+
+// A virtual table exposing the entries of the SQL profile (see SqlProfile):
+// the per-statement and per-operator counterpart of the per-query |sqlstats|
+// table.
+struct SqlProfileModule : sqlite::Module<SqlProfileModule> {
+  using Context = SqlProfile;
+  struct Vtab : sqlite::Module<SqlProfileModule>::Vtab {
+    SqlProfile* profile = nullptr;
+  };
+  struct Cursor : sqlite::Module<SqlProfileModule>::Cursor {
+    SqlProfile* profile = nullptr;
+    uint32_t first_id = 0;
+    size_t row = 0;
+    size_t num_rows = 0;
+  };
+  enum Column {
+    kId = 0,
+    kParentId = 1,
+    kEntryType = 2,
+    kName = 3,
+    kDetail = 4,
+    kTs = 5,
+    kDur = 6,
+    kRows = 7,
+    kFilterCount = 8,
+  };
+
+  static constexpr auto kType = kEponymousOnly;
+  static constexpr bool kSupportsWrites = false;
+  static constexpr bool kDoesOverloadFunctions = false;
+
+  static int Connect(sqlite3*,
+                     void*,
+                     int,
+                     const char* const*,
+                     sqlite3_vtab**,
+                     char**);
+  static int Disconnect(sqlite3_vtab*);
+
+  static int BestIndex(sqlite3_vtab*, sqlite3_index_info*);
+
+  static int Open(sqlite3_vtab*, sqlite3_vtab_cursor**);
+  static int Close(sqlite3_vtab_cursor*);
+
+  static int Filter(sqlite3_vtab_cursor*,
+                    int,
+                    const char*,
+                    int,
+                    sqlite3_value**);
+  static int Next(sqlite3_vtab_cursor*);
+  static int Eof(sqlite3_vtab_cursor*);
+  static int Column(sqlite3_vtab_cursor*, sqlite3_context*, int);
+  static int Rowid(sqlite3_vtab_cursor*, sqlite_int64*);
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_SQLITE_SQL_PROFILE_TABLE_H_
@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/sqlite/sql_profile.h"
+
+#include <cstdint>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+TEST(SqlProfileTest, Parents) {
+  SqlProfile profile;
+  uint32_t include = profile.AddStatement("INCLUDE PERFETTO MODULE foo");
+  uint32_t table;
+  uint32_t op;
+  {
+    SqlProfile::ScopedStatement scope(&profile, include);
+    table = profile.AddStatement("CREATE PERFETTO TABLE bar AS SELECT 1");
+    SqlProfile::ScopedStatement nested_scope(&profile, table);
+    op = profile.AddOperator("slice");
+  }
+  uint32_t after = profile.AddStatement("SELECT 1");
+
+  ASSERT_EQ(profile.Find(include)->parent_id, std::nullopt);
+  ASSERT_EQ(profile.Find(table)->parent_id, include);
+  ASSERT_EQ(profile.Find(op)->parent_id, table);
+  ASSERT_EQ(profile.Find(op)->type, SqlProfile::Type::kOperator);
+  ASSERT_EQ(profile.Find(after)->parent_id, std::nullopt);
+  ASSERT_GE(profile.Find(include)->dur, profile.Find(table)->dur);
+}
+
+TEST(SqlProfileTest, Eviction) {
+  SqlProfile profile;
+  uint32_t first = profile.AddStatement("SELECT 0");
+  for (size_t i = 0; i < SqlProfile::kMaxEntries; ++i) {
+    profile.AddOperator("slice");
+  }
+  ASSERT_EQ(profile.Find(first), nullptr);
+  ASSERT_EQ(profile.first_id(), first + 1);
+  ASSERT_EQ(profile.entries().size(), SqlProfile::kMaxEntries);
+
+  uint32_t last = profile.AddStatement("SELECT 1");
+  ASSERT_EQ(profile.Find(last)->name, "SELECT 1");
+  profile.Clear();
+  ASSERT_EQ(profile.Find(last), nullptr);
+  ASSERT_EQ(profile.AddStatement("SELECT 2"), last + 1);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
@@ -18,6 +18,7 @@
 
 #include <sqlite3.h>
 #include <memory>
+#include <optional>
 
 #include "perfetto/base/logging.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
@@ -37,6 +38,7 @@ int SqlStatsModule::Connect(sqlite3* db,
       started BIGINT,
       first_next BIGINT,
       ended BIGINT,
+      cache_hit BOOL,
       PRIMARY KEY(started)
     ) WITHOUT ROWID
   )";
@@ -109,6 +111,13 @@ int SqlStatsModule::Column(sqlite3_vtab_cursor* cursor,
     case Column::kTimeEnded:
       sqlite::result::Long(ctx, stats.times_ended()[c->row]);
       break;
+    case Column::kCacheHit:
+      if (std::optional<bool> hit = stats.result_cache_hits()[c->row]; hit) {
+        sqlite::result::Long(ctx, *hit);
+      } else {
+        sqlite::result::Null(ctx);
+      }
+      break;
     default:
       PERFETTO_FATAL("Unknown column %d", N);
       break;
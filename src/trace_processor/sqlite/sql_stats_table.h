@@ -43,6 +43,7 @@ struct SqlStatsModule : sqlite::Module<SqlStatsModule> {
     kTimeStarted = 1,
     kTimeFirstNext = 2,
     kTimeEnded = 3,
+    kCacheHit = 4,
   };
 
   static constexpr auto kType = kEponymousOnly;
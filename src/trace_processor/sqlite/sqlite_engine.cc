@@ -20,6 +20,7 @@
 #include <cstdint>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
 #include "perfetto/base/build_config.h"
@@ -82,6 +83,21 @@ std::optional<uint32_t> GetErrorOffsetDb(sqlite3* db) {
                       : std::make_optional(static_cast<uint32_t>(offset));
 }
 
+// Returns the name of the table in a "no such table" error message or nullopt
+// if the error is of any other kind.
+std::optional<std::string> GetMissingTableName(std::string_view errmsg) {
+  static constexpr std::string_view kPrefix = "no such table: ";
+  if (errmsg.substr(0, kPrefix.size()) != kPrefix) {
+    return std::nullopt;
+  }
+  std::string_view name = errmsg.substr(kPrefix.size());
+  static constexpr std::string_view kMainSchema = "main.";
+  if (name.substr(0, kMainSchema.size()) == kMainSchema) {
+    name = name.substr(kMainSchema.size());
+  }
+  return std::string(name);
+}
+
 }  // namespace
 
 SqliteEngine::SqliteEngine() {
@@ -120,6 +136,28 @@ SqliteEngine::PreparedStatement SqliteEngine::PrepareStatement(SqlSource sql) {
   sqlite3_stmt* raw_stmt = nullptr;
   int err =
       sqlite3_prepare_v2(db_.get(), sql.sql().c_str(), -1, &raw_stmt, nullptr);
+
+  // If the statement references tables which do not exist (yet), give the
+  // handler the chance to create them and try again.
+  while (err != SQLITE_OK && missing_table_handler_) {
+    std::optional<std::string> table =
+        GetMissingTableName(sqlite3_errmsg(db_.get()));
+    if (!table) {
+      break;
+    }
+    base::StatusOr<bool> created = missing_table_handler_(*table);
+    if (!created.ok()) {
+      PreparedStatement statement{ScopedStmt(nullptr), std::move(sql)};
+      statement.status_ = created.status();
+      return statement;
+    }
+    if (!*created) {
+      break;
+    }
+    err = sqlite3_prepare_v2(db_.get(), sql.sql().c_str(), -1, &raw_stmt,
+                             nullptr);
+  }
+
   PreparedStatement statement{ScopedStmt(raw_stmt), std::move(sql)};
   if (err != SQLITE_OK) {
     const char* errmsg = sqlite3_errmsg(db_.get());
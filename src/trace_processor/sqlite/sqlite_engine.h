@@ -20,6 +20,7 @@
 #include <sqlite3.h>
 #include <cstddef>
 #include <cstdint>
+#include <functional>
 #include <memory>
 #include <optional>
 #include <string>
@@ -28,6 +29,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/hash.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_module.h"
@@ -61,6 +63,12 @@ class SqliteEngine {
   using WindowFnFinal = void(sqlite3_context* ctx);
   using FnCtxDestructor = void(void*);
 
+  // Called with the name of a table which does not exist when preparing a
+  // statement which references it. Should return true if the table was
+  // created, in which case the statement is prepared again.
+  using MissingTableHandler =
+      std::function<base::StatusOr<bool>(const std::string& name)>;
+
   // Wrapper class for SQLite's |sqlite3_stmt| struct and associated functions.
   struct PreparedStatement {
    public:
@@ -137,6 +145,12 @@ class SqliteEngine {
   // Declares a virtual table with SQLite.
   base::Status DeclareVirtualTable(const std::string& create_stmt);
 
+  // Sets the function called when a statement being prepared references a
+  // table which does not exist: this allows tables to be created lazily.
+  void set_missing_table_handler(MissingTableHandler handler) {
+    missing_table_handler_ = std::move(handler);
+  }
+
   // Gets the context for a registered SQL function.
   void* GetFunctionContext(const std::string& name, int argc);
 
@@ -155,6 +169,7 @@ class SqliteEngine {
   std::optional<uint32_t> GetErrorOffset() const;
 
   base::FlatHashMap<std::pair<std::string, int>, void*, FnHasher> fn_ctx_;
+  MissingTableHandler missing_table_handler_;
   ScopedDb db_;
 };
 
@@ -42,6 +42,13 @@ namespace stats {
   F(frame_timeline_event_parser_errors,   kSingle,  kInfo,     kAnalysis, ""), \
   F(frame_timeline_unpaired_end_event,    kSingle,  kInfo,     kAnalysis, ""), \
   F(ftrace_bundle_tokenizer_errors,       kSingle,  kError,    kAnalysis, ""), \
+  F(ftrace_raw_page_errors,               kSingle,  kError,    kAnalysis,      \
+      "Number of raw ftrace pages (FtraceConfig.raw_page_passthrough) that "   \
+      "could not be fully decoded, because either they were malformed or "     \
+      "the trace lacked the description of their layout."),                    \
+  F(ftrace_compact_events_errors,         kSingle,  kError,    kTrace,         \
+      "Number of malformed compact encoded ftrace event batches "              \
+      "(FtraceEventBundle.CompactEvents). Some of their events are missing."), \
   F(ftrace_cpu_bytes_begin,               kIndexed, kInfo,     kTrace,    ""), \
   F(ftrace_cpu_bytes_end,                 kIndexed, kInfo,     kTrace,    ""), \
   F(ftrace_cpu_bytes_delta,               kIndexed, kInfo,     kTrace,    ""), \
@@ -201,6 +208,9 @@ namespace stats {
   F(heap_graph_non_finalized_graph,       kSingle,  kError,    kTrace,    ""), \
   F(heap_graph_malformed_packet,          kIndexed, kError,    kTrace,    ""), \
   F(heap_graph_missing_packet,            kIndexed, kError,    kTrace,    ""), \
+  F(heap_graph_partial_graph,             kIndexed, kInfo,     kTrace,         \
+      "A Java heap graph only contains some of the objects of the heap "       \
+      "(e.g. because of type sampling). Indexed by target upid."),             \
   F(heapprofd_buffer_corrupted,           kIndexed, kError,    kTrace,         \
       "Shared memory buffer corrupted. This is a bug or memory corruption "    \
       "in the target. Indexed by target upid."),                               \
@@ -342,7 +352,18 @@ namespace stats {
   F(ftrace_missing_event_id,              kSingle,  kInfo,    kAnalysis,       \
       "Indicates that the ftrace event was dropped because the event id was "  \
       "missing. This is an 'info' stat rather than an error stat because "     \
-      "this can be legitimately missing due to proto filtering.")
+      "this can be legitimately missing due to proto filtering."),             \
+  F(memory_budget_args_dropped,           kSingle,  kDataLoss, kAnalysis,      \
+      "The number of arg sets of slices, counters, flows and raw events "      \
+      "which were dropped because the memory usage was close to "              \
+      "Config::memory_budget_bytes."),                                         \
+  F(memory_budget_raw_dropped,            kSingle,  kDataLoss, kAnalysis,      \
+      "The number of ftrace events which were not added to the ftrace_event "  \
+      "table because the memory usage was close to "                           \
+      "Config::memory_budget_bytes."),                                         \
+  F(memory_budget_tables_refused,         kSingle,  kInfo,     kAnalysis,      \
+      "The number of PERFETTO TABLEs which were not created because the "      \
+      "memory usage was close to Config::memory_budget_bytes.")
 // clang-format on
 
 enum Type {
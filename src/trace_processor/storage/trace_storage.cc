@@ -85,12 +85,14 @@ uint32_t TraceStorage::SqlStats::RecordQueryBegin(const std::string& query,
     times_started_.pop_front();
     times_first_next_.pop_front();
     times_ended_.pop_front();
+    result_cache_hits_.pop_front();
     popped_queries_++;
   }
   queries_.push_back(query);
   times_started_.push_back(time_started);
   times_first_next_.push_back(0);
   times_ended_.push_back(0);
+  result_cache_hits_.push_back(std::nullopt);
   return static_cast<uint32_t>(popped_queries_ + queries_.size() - 1);
 }
 
@@ -115,6 +117,15 @@ void TraceStorage::SqlStats::RecordQueryEnd(uint32_t row, int64_t time_ended) {
   times_ended_[queue_row] = time_ended;
 }
 
+void TraceStorage::SqlStats::RecordQueryResultCacheHit(uint32_t row,
+                                                       bool hit) {
+  if (popped_queries_ > row)
+    return;
+  uint32_t queue_row = row - popped_queries_;
+  PERFETTO_DCHECK(queue_row < queries_.size());
+  result_cache_hits_[queue_row] = hit;
+}
+
 std::pair<int64_t, int64_t> TraceStorage::GetTraceTimestampBoundsNs() const {
   int64_t start_ns = std::numeric_limits<int64_t>::max();
   int64_t end_ns = std::numeric_limits<int64_t>::min();
@@ -34,6 +34,7 @@
 #include "perfetto/base/logging.h"
 #include "perfetto/base/time.h"
 #include "perfetto/ext/base/string_view.h"
+#include "perfetto/protozero/field.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/status.h"
 #include "src/trace_processor/containers/null_term_string_view.h"
@@ -198,6 +199,7 @@ class TraceStorage {
     uint32_t RecordQueryBegin(const std::string& query, int64_t time_started);
     void RecordQueryFirstNext(uint32_t row, int64_t time_first_next);
     void RecordQueryEnd(uint32_t row, int64_t time_end);
+    void RecordQueryResultCacheHit(uint32_t row, bool hit);
     size_t size() const { return queries_.size(); }
     const std::deque<std::string>& queries() const { return queries_; }
     const std::deque<int64_t>& times_started() const { return times_started_; }
@@ -205,6 +207,9 @@ class TraceStorage {
       return times_first_next_;
     }
     const std::deque<int64_t>& times_ended() const { return times_ended_; }
+    const std::deque<std::optional<bool>>& result_cache_hits() const {
+      return result_cache_hits_;
+    }
 
    private:
     uint32_t popped_queries_ = 0;
@@ -213,6 +218,33 @@ class TraceStorage {
     std::deque<int64_t> times_started_;
     std::deque<int64_t> times_first_next_;
     std::deque<int64_t> times_ended_;
+    std::deque<std::optional<bool>> result_cache_hits_;
+  };
+
+  // Serialized protos retained at import time so that they can be decoded on
+  // demand at query time instead of being eagerly turned into args. The
+  // protos are copied back to back into a single buffer and are identified by
+  // their index in the store.
+  class RetainedProtos {
+   public:
+    uint32_t Append(protozero::ConstBytes blob) {
+      offsets_.push_back(data_.size());
+      data_.insert(data_.end(), blob.data, blob.data + blob.size);
+      return size() - 1;
+    }
+
+    protozero::ConstBytes Get(uint32_t index) const {
+      PERFETTO_DCHECK(index < size());
+      size_t begin = offsets_[index];
+      size_t end = index + 1 < size() ? offsets_[index + 1] : data_.size();
+      return protozero::ConstBytes{data_.data() + begin, end - begin};
+    }
+
+    uint32_t size() const { return static_cast<uint32_t>(offsets_.size()); }
+
+   private:
+    std::vector<uint8_t> data_;
+    std::vector<size_t> offsets_;
   };
 
   struct Stats {
@@ -528,6 +560,20 @@ class TraceStorage {
     return &clock_snapshot_table_;
   }
 
+  const tables::IngestionProfileTable& ingestion_profile_table() const {
+    return ingestion_profile_table_;
+  }
+  tables::IngestionProfileTable* mutable_ingestion_profile_table() {
+    return &ingestion_profile_table_;
+  }
+
+  const tables::MetricProfileTable& metric_profile_table() const {
+    return metric_profile_table_;
+  }
+  tables::MetricProfileTable* mutable_metric_profile_table() {
+    return &metric_profile_table_;
+  }
+
   const tables::ArgTable& arg_table() const { return arg_table_; }
   tables::ArgTable* mutable_arg_table() { return &arg_table_; }
 
@@ -845,6 +891,9 @@ class TraceStorage {
     return &surfaceflinger_transactions_table_;
   }
 
+  const RetainedProtos& winscope_protos() const { return winscope_protos_; }
+  RetainedProtos* mutable_winscope_protos() { return &winscope_protos_; }
+
   const tables::WindowManagerShellTransitionsTable&
   window_manager_shell_transitions_table() const {
     return window_manager_shell_transitions_table_;
@@ -1000,6 +1049,12 @@ class TraceStorage {
   // Contains data from all the clock snapshots in the trace.
   tables::ClockSnapshotTable clock_snapshot_table_{&string_pool_};
 
+  // Per-phase timings of the ingestion of the trace, see IngestionProfiler.
+  tables::IngestionProfileTable ingestion_profile_table_{&string_pool_};
+
+  // Time spent computing each metric, see metrics::ComputeMetrics().
+  tables::MetricProfileTable metric_profile_table_{&string_pool_};
+
   // Metadata for tracks.
   tables::TrackTable track_table_{&string_pool_};
   tables::ThreadStateTable thread_state_table_{&string_pool_};
@@ -1147,6 +1202,8 @@ class TraceStorage {
   tables::SurfaceFlingerLayerTable surfaceflinger_layer_table_{&string_pool_};
   tables::SurfaceFlingerTransactionsTable surfaceflinger_transactions_table_{
       &string_pool_};
+  // The layers and transactions protos referenced by the tables above.
+  RetainedProtos winscope_protos_;
   tables::WindowManagerShellTransitionsTable
       window_manager_shell_transitions_table_{&string_pool_};
   tables::WindowManagerShellTransitionHandlersTable
@@ -113,6 +113,12 @@ class MacroTable : public Table {
     IncrementRowCountAndAddToLastOverlay();
   }
 
+  PERFETTO_NO_INLINE void UpdateSelfOverlayAfterInsertBatch(uint32_t count) {
+    for (uint32_t i = 0; i < count; ++i) {
+      IncrementRowCountAndAddToLastOverlay();
+    }
+  }
+
   PERFETTO_NO_INLINE static std::vector<ColumnLegacy>
   CopyColumnsFromParentOrAddRootColumns(MacroTable* self,
                                         const MacroTable* parent) {
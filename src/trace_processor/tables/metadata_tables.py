@@ -443,6 +443,69 @@ otherwise.''',
                 ''',
         }))
 
+INGESTION_PROFILE_TABLE = Table(
+    python_module=__file__,
+    class_name='IngestionProfileTable',
+    sql_name='__intrinsic_ingestion_profile',
+    columns=[
+        C('phase', CppString()),
+        C('name', CppString()),
+        C('count', CppInt64()),
+        C('dur', CppInt64()),
+        C('bytes', CppInt64()),
+    ],
+    tabledoc=TableDoc(
+        doc='''
+          Time spent and bytes consumed by each stage of the ingestion of the
+          trace. Only populated when the trace processor is configured with
+          |enable_ingestion_profile| (--print-ingestion-profile in the shell).
+        ''',
+        group='Metadata',
+        columns={
+            'phase':
+                '''The ingestion phase: one of "tokenize", "parse", "sort" or
+"flush".''',
+            'name':
+                '''The name of the TracePacket field (e.g. "ftrace_events")
+or of the step being measured.''',
+            'count':
+                '''The number of times this step ran.''',
+            'dur':
+                '''The total wall time spent in this step, in nanoseconds.''',
+            'bytes':
+                '''The total size of the packets processed by this step, if
+applicable.''',
+        }))
+
+METRIC_PROFILE_TABLE = Table(
+    python_module=__file__,
+    class_name='MetricProfileTable',
+    sql_name='__intrinsic_metric_profile',
+    columns=[
+        C('name', CppString()),
+        C('dur', CppInt64()),
+        C('runs', CppUint32()),
+        C('skipped_runs', CppUint32()),
+    ],
+    tabledoc=TableDoc(
+        doc='''
+          Time spent computing each v1 metric. A row is added for every metric
+          computed, in the order they were computed.
+        ''',
+        group='Metadata',
+        columns={
+            'name':
+                '''The name of the metric.''',
+            'dur':
+                '''The wall time spent computing the metric, in nanoseconds.''',
+            'runs':
+                '''The number of metric files run (directly or through
+RUN_METRIC) to compute the metric.''',
+            'skipped_runs':
+                '''The number of metric files which were not run as they had
+already been run with the same arguments for a previous metric.''',
+        }))
+
 # Keep this list sorted.
 ALL_TABLES = [
     ARG_TABLE,
@@ -451,7 +514,9 @@ ALL_TABLES = [
     CPU_TABLE,
     EXP_MISSING_CHROME_PROC_TABLE,
     FILEDESCRIPTOR_TABLE,
+    INGESTION_PROFILE_TABLE,
     METADATA_TABLE,
+    METRIC_PROFILE_TABLE,
     PROCESS_TABLE,
     RAW_TABLE,
     THREAD_TABLE,
@@ -89,6 +89,31 @@ TEST_F(PyTablesUnittest, InsertEventSpecifyCols) {
   ASSERT_EQ(event_.arg_set_id()[0], 0u);
 }
 
+TEST_F(PyTablesUnittest, InsertBatch) {
+  event_.Insert(TestEventTable::Row(50, 1));
+  std::vector<TestEventTable::Row> rows;
+  for (uint32_t i = 0; i < 100; ++i) {
+    rows.emplace_back(100 + i, i);
+  }
+  ASSERT_EQ(event_.InsertBatch(rows).row_number(), 1u);
+  ASSERT_EQ(event_.InsertBatch({}).row_number(), 101u);
+
+  ASSERT_EQ(event_.row_count(), 101u);
+  ASSERT_EQ(event_.type().GetString(100).ToStdString(), "event");
+  ASSERT_EQ(event_.id()[100], TestEventTable::Id{100});
+  ASSERT_EQ(event_.ts()[100], 199);
+  ASSERT_EQ(event_.arg_set_id()[100], 99u);
+
+  // Rows inserted one at a time can follow the batch.
+  auto id_and_row = event_.Insert(TestEventTable::Row(300, 0));
+  ASSERT_EQ(id_and_row.row, 101u);
+  ASSERT_EQ(event_.FindById(id_and_row.id)->ts(), 300);
+
+  Query q;
+  q.constraints = {event_.ts().ge(150)};
+  ASSERT_EQ(event_.FilterToIterator(q).row_number().row_number(), 51u);
+}
+
 TEST_F(PyTablesUnittest, MutableColumn) {
   event_.Insert(TestEventTable::Row(100, 0));
 
@@ -314,5 +339,43 @@ TEST_F(PyTablesUnittest, SetIdColumns) {
   }
 }
 
+TEST_F(PyTablesUnittest, IndexExtendedWithNewRows) {
+  static constexpr uint32_t kRows = 100;
+  auto insert_rows = [this](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      event_.Insert(TestEventTable::Row(i, (i * 37) % 7));
+    }
+  };
+  auto expected_rows = [this](uint32_t arg_set_id, int64_t min_ts) {
+    std::vector<uint32_t> rows;
+    for (uint32_t i = 0; i < event_.row_count(); ++i) {
+      if (event_.arg_set_id()[i] == arg_set_id && event_.ts()[i] >= min_ts) {
+        rows.push_back(i);
+      }
+    }
+    return rows;
+  };
+
+  insert_rows(0, kRows);
+  ASSERT_TRUE(event_
+                  .CreateIndex("arg_set_id_ts",
+                               {TestEventTable::ColumnIndex::arg_set_id,
+                                TestEventTable::ColumnIndex::ts},
+                               false)
+                  .ok());
+
+  // Rows inserted after the index was created must be returned by queries
+  // using the index.
+  insert_rows(kRows, 2 * kRows);
+  Query q;
+  q.constraints = {event_.arg_set_id().eq(3), event_.ts().ge(50)};
+  ASSERT_EQ(event_.QueryToRowMap(q).TakeAsIndexVector(), expected_rows(3, 50));
+  ASSERT_EQ(event_.indexes()[0].sorted_rows->size(), 2 * kRows);
+
+  insert_rows(2 * kRows, 2 * kRows + 1);
+  q.constraints = {event_.arg_set_id().eq(5), event_.ts().ge(0)};
+  ASSERT_EQ(event_.QueryToRowMap(q).TakeAsIndexVector(), expected_rows(5, 0));
+}
+
 }  // namespace
 }  // namespace perfetto::trace_processor::tables
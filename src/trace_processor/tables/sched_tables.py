@@ -125,7 +125,7 @@ THREAD_STATE_TABLE = Table(
         C('cpu', CppOptional(CppUint32())),
         C('utid', CppUint32()),
         C('state', CppString()),
-        C('io_wait', CppOptional(CppUint32())),
+        C('io_wait', CppOptional(CppUint32()), flags=ColumnFlag.DENSE),
         C('blocked_function', CppOptional(CppString())),
         C('waker_utid', CppOptional(CppUint32())),
         C('waker_id', CppOptional(CppSelfTableId())),
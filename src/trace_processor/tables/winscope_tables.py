@@ -90,14 +90,15 @@ SURFACE_FLINGER_LAYER_TABLE = Table(
     sql_name='surfaceflinger_layer',
     columns=[
         C('snapshot_id', CppTableId(SURFACE_FLINGER_LAYERS_SNAPSHOT_TABLE)),
-        C('arg_set_id', CppUint32()),
+        C('proto_index', CppUint32()),
     ],
     tabledoc=TableDoc(
-        doc='SurfaceFlinger layer',
+        doc='SurfaceFlinger layer. The fields of the layer proto are decoded ' +
+        'on demand with winscope_proto_to_args(\'surfaceflinger_layer\', id).',
         group='Winscope',
         columns={
             'snapshot_id': 'The snapshot that generated this layer',
-            'arg_set_id': 'Extra args parsed from the proto message',
+            'proto_index': 'Index of the raw layer proto retained at import',
         }))
 
 SURFACE_FLINGER_TRANSACTIONS_TABLE = Table(
@@ -106,15 +107,18 @@ SURFACE_FLINGER_TRANSACTIONS_TABLE = Table(
     sql_name='surfaceflinger_transactions',
     columns=[
         C('ts', CppInt64()),
-        C('arg_set_id', CppUint32()),
+        C('proto_index', CppUint32()),
     ],
     tabledoc=TableDoc(
         doc='SurfaceFlinger transactions. Each row contains a set of ' +
-        'transactions that SurfaceFlinger committed together.',
+        'transactions that SurfaceFlinger committed together. The fields ' +
+        'of the proto are decoded on demand with ' +
+        'winscope_proto_to_args(\'surfaceflinger_transactions\', id).',
         group='Winscope',
         columns={
             'ts': 'Timestamp of the transactions commit',
-            'arg_set_id': 'Extra args parsed from the proto message',
+            'proto_index': 'Index of the raw transactions proto retained at ' +
+                           'import',
         }))
 
 WINDOW_MANAGER_SHELL_TRANSITIONS_TABLE = Table(
@@ -26,6 +26,8 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
+#include <cstdint>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
@@ -36,6 +38,16 @@
 
 namespace perfetto {
 namespace trace_processor {
+namespace {
+
+std::atomic<uint64_t> g_heap_bytes_in_use{0};
+std::atomic<uint64_t> g_mmap_bytes_in_use{0};
+
+std::atomic<uint64_t>& BytesInUse(bool heap) {
+  return heap ? g_heap_bytes_in_use : g_mmap_bytes_in_use;
+}
+
+}  // namespace
 
 // static
 TraceBlob TraceBlob::Allocate(size_t size) {
@@ -86,9 +98,14 @@ TraceBlob TraceBlob::FromMmap(void* data, size_t size) {
 }
 
 TraceBlob::TraceBlob(Ownership ownership, uint8_t* data, size_t size)
-    : ownership_(ownership), data_(data), size_(size) {}
+    : ownership_(ownership), data_(data), size_(size) {
+  BytesInUse(ownership_ == Ownership::kHeapBuf)
+      .fetch_add(size_, std::memory_order_relaxed);
+}
 
 TraceBlob::~TraceBlob() {
+  BytesInUse(ownership_ == Ownership::kHeapBuf)
+      .fetch_sub(size_, std::memory_order_relaxed);
   switch (ownership_) {
     case Ownership::kHeapBuf:
       delete[] data_;
@@ -121,6 +138,16 @@ TraceBlob::TraceBlob(TraceBlob&& other) noexcept
   other.mapping_ = nullptr;
 }
 
+// static
+uint64_t TraceBlob::heap_bytes_in_use() {
+  return g_heap_bytes_in_use.load(std::memory_order_relaxed);
+}
+
+// static
+uint64_t TraceBlob::mmap_bytes_in_use() {
+  return g_mmap_bytes_in_use.load(std::memory_order_relaxed);
+}
+
 TraceBlob& TraceBlob::operator=(TraceBlob&& other) noexcept {
   if (this == &other)
     return *this;
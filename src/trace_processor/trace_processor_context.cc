@@ -28,8 +28,10 @@
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/common/flow_tracker.h"
 #include "src/trace_processor/importers/common/global_args_tracker.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
 #include "src/trace_processor/importers/common/machine_tracker.h"
 #include "src/trace_processor/importers/common/mapping_tracker.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/sched_event_tracker.h"
@@ -74,6 +76,12 @@ TraceProcessorContext::TraceProcessorContext(const InitArgs& args)
   stack_profile_tracker.reset(new StackProfileTracker(this));
   metadata_tracker.reset(new MetadataTracker(storage.get()));
   global_args_tracker.reset(new GlobalArgsTracker(storage.get()));
+  if (config.enable_ingestion_profile)
+    ingestion_profiler.reset(new IngestionProfiler());
+  if (config.memory_budget_bytes > 0) {
+    memory_budget.reset(
+        new MemoryBudget(config.memory_budget_bytes, storage.get()));
+  }
   {
     descriptor_pool_.reset(new DescriptorPool());
     auto status = descriptor_pool_->AddFromFileDescriptorSet(
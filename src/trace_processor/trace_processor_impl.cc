@@ -21,6 +21,7 @@
 #include <cinttypes>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <limits>
 #include <memory>
 #include <optional>
@@ -29,6 +30,7 @@
 #include <utility>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/status.h"
 #include "perfetto/base/time.h"
@@ -37,6 +39,7 @@
 #include "perfetto/ext/base/status_or.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
 #include "perfetto/public/compiler.h"
 #include "perfetto/trace_processor/basic_types.h"
@@ -45,7 +48,10 @@
 #include "perfetto/trace_processor/trace_processor.h"
 #include "src/trace_processor/importers/android_bugreport/android_bugreport_parser.h"
 #include "src/trace_processor/importers/common/clock_tracker.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
+#include "src/trace_processor/importers/ftrace/ftrace_raw_args.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_parser.h"
 #include "src/trace_processor/importers/fuchsia/fuchsia_trace_tokenizer.h"
 #include "src/trace_processor/importers/gzip/gzip_trace_parser.h"
@@ -57,6 +63,7 @@
 #include "src/trace_processor/importers/perf/perf_data_tokenizer.h"
 #include "src/trace_processor/importers/proto/additional_modules.h"
 #include "src/trace_processor/importers/proto/content_analyzer.h"
+#include "src/trace_processor/importers/proto/trace.descriptor.h"
 #include "src/trace_processor/importers/systrace/systrace_trace_parser.h"
 #include "src/trace_processor/iterator_impl.h"
 #include "src/trace_processor/metrics/all_chrome_metrics.descriptor.h"
@@ -72,9 +79,11 @@
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/create_view_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/dfs.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/import.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/interval_intersect_n.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/layout_functions.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/math.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/pprof_functions.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/sql_function.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/sqlite3_str_split.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/stack_functions.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/functions/structural_tree_partition.h"
@@ -96,14 +105,19 @@
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/experimental_flat_slice.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/experimental_sched_upid.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/experimental_slice_layout.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/slice_tree_index.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/interval_intersect.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/memory_usage.h"
 #include "src/trace_processor/perfetto_sql/intrinsics/table_functions/table_info.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/table_functions/winscope_proto_to_args.h"
 #include "src/trace_processor/perfetto_sql/prelude/tables_views.h"
 #include "src/trace_processor/perfetto_sql/stdlib/stdlib.h"
+#include "src/trace_processor/sorter/trace_sorter.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_aggregate_function.h"
 #include "src/trace_processor/sqlite/bindings/sqlite_result.h"
 #include "src/trace_processor/sqlite/scoped_db.h"
 #include "src/trace_processor/sqlite/sql_source.h"
+#include "src/trace_processor/sqlite/sql_profile_table.h"
 #include "src/trace_processor/sqlite/sql_stats_table.h"
 #include "src/trace_processor/sqlite/stats_table.h"
 #include "src/trace_processor/storage/metadata.h"
@@ -116,6 +130,7 @@
 #include "src/trace_processor/util/gzip_utils.h"
 #include "src/trace_processor/util/protozero_to_json.h"
 #include "src/trace_processor/util/protozero_to_text.h"
+#include "src/trace_processor/util/query_cancellation.h"
 #include "src/trace_processor/util/regex.h"
 #include "src/trace_processor/util/sql_modules.h"
 #include "src/trace_processor/util/status_macros.h"
@@ -130,6 +145,10 @@
 namespace perfetto::trace_processor {
 namespace {
 
+// Number of SQLite VM instructions between two checks of whether the running
+// query should stop: this is a few hundred microseconds of work.
+constexpr int kSqliteProgressInstructions = 10000;
+
 template <typename SqlFunction, typename Ptr = typename SqlFunction::Context*>
 void RegisterFunction(PerfettoSqlEngine* engine,
                       const char* name,
@@ -263,6 +282,27 @@ void RegisterValueAtMaxTsFunction(PerfettoSqlEngine& engine) {
   }
 }
 
+// Returns the timestamp up to which the trace has been ingested (see
+// TraceProcessorImpl::ingestion_watermark()), or NULL if nothing was ingested
+// yet.
+struct IngestionWatermark : public SqlFunction {
+  using Context = TraceProcessorImpl;
+  static base::Status Run(TraceProcessorImpl* tp,
+                          size_t argc,
+                          sqlite3_value**,
+                          SqlValue& out,
+                          Destructors&) {
+    if (argc != 0) {
+      return base::ErrStatus("INGESTION_WATERMARK: no arguments expected");
+    }
+    if (std::optional<int64_t> watermark = tp->ingestion_watermark();
+        watermark) {
+      out = SqlValue::Long(*watermark);
+    }
+    return base::OkStatus();
+  }
+};
+
 std::vector<std::string> SanitizeMetricMountPaths(
     const std::vector<std::string>& mount_paths) {
   std::vector<std::string> sanitized;
@@ -335,6 +375,27 @@ void InitializePreludeTablesViews(sqlite3* db) {
   }
 }
 
+// Fills the |__intrinsic_ingestion_profile| table, naming the TracePacket
+// fields using the trace descriptor.
+void WriteIngestionProfile(const IngestionProfiler& profiler,
+                           TraceStorage* storage) {
+  DescriptorPool pool;
+  base::Status status = pool.AddFromFileDescriptorSet(kTraceDescriptor.data(),
+                                                      kTraceDescriptor.size());
+  std::optional<uint32_t> packet_idx;
+  if (status.ok())
+    packet_idx = pool.FindDescriptorIdx(".perfetto.protos.TracePacket");
+  profiler.WriteToTable(storage, [&](uint32_t field_id) {
+    if (packet_idx) {
+      const FieldDescriptor* field =
+          pool.descriptors()[*packet_idx].FindFieldByTag(field_id);
+      if (field)
+        return field->name();
+    }
+    return "field_" + std::to_string(field_id);
+  });
+}
+
 }  // namespace
 
 TraceProcessorImpl::TraceProcessorImpl(const Config& cfg)
@@ -408,7 +469,24 @@ TraceProcessorImpl::~TraceProcessorImpl() = default;
 
 base::Status TraceProcessorImpl::Parse(TraceBlobView blob) {
   bytes_parsed_ += blob.size();
-  return TraceProcessorStorageImpl::Parse(std::move(blob));
+  base::Status status = TraceProcessorStorageImpl::Parse(std::move(blob));
+  UpdateIngestionWatermark();
+  return status;
+}
+
+void TraceProcessorImpl::UpdateIngestionWatermark() {
+  // With the default sorting mode, the sorter pushes the events which fall out
+  // of its window to the parsers (and so to the tables) while the trace is
+  // being parsed, not only on Flush() and NotifyEndOfFile().
+  if (!context_.sorter)
+    return;
+  int64_t ts = context_.sorter->latest_pushed_event_ts();
+  if (ts == std::numeric_limits<int64_t>::min() || ts == ingestion_watermark_)
+    return;
+  ingestion_watermark_ = ts;
+
+  // The contents of the tables have changed.
+  engine_->InvalidateQueryResultCache();
 }
 
 std::string TraceProcessorImpl::GetCurrentTraceName() {
@@ -434,6 +512,10 @@ void TraceProcessorImpl::Flush() {
                                          Variadic::String(trace_type_id));
   BuildBoundsTable(engine_->sqlite_engine()->db(),
                    context_.storage->GetTraceTimestampBoundsNs());
+  UpdateIngestionWatermark();
+
+  // The contents of the tables have changed.
+  engine_->InvalidateQueryResultCache();
 }
 
 void TraceProcessorImpl::NotifyEndOfFile() {
@@ -452,6 +534,10 @@ void TraceProcessorImpl::NotifyEndOfFile() {
   Flush();
 
   TraceProcessorStorageImpl::NotifyEndOfFile();
+  if (context_.ingestion_profiler) {
+    WriteIngestionProfile(*context_.ingestion_profiler,
+                          context_.storage.get());
+  }
   context_.storage->ShrinkToFitTables();
 
   // Rebuild the bounds table once everything has been completed: we do this
@@ -459,13 +545,19 @@ void TraceProcessorImpl::NotifyEndOfFile() {
   // TraceProcessorStorageImpl::NotifyEndOfFile, this will be counted in
   // trace bounds: this is important for parsers like ninja which wait until
   // the end to flush all their data.
-  BuildBoundsTable(engine_->sqlite_engine()->db(),
-                   context_.storage->GetTraceTimestampBoundsNs());
+  std::pair<int64_t, int64_t> bounds =
+      context_.storage->GetTraceTimestampBoundsNs();
+  BuildBoundsTable(engine_->sqlite_engine()->db(), bounds);
+  ingestion_watermark_ = bounds.second;
+  engine_->InvalidateQueryResultCache();
 
   TraceProcessorStorageImpl::DestroyContext();
 }
 
 size_t TraceProcessorImpl::RestoreInitialTables() {
+  // The tables of the query result cache are not part of the initial tables.
+  engine_->InvalidateQueryResultCache();
+
   // We should always have at least as many objects now as we did in the
   // constructor.
   uint64_t registered_count_before = engine_->SqliteRegisteredObjectCount();
@@ -482,24 +574,40 @@ size_t TraceProcessorImpl::RestoreInitialTables() {
 }
 
 Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql) {
+  return ExecuteQuery(sql, config_.query_timeout_ms);
+}
+
+Iterator TraceProcessorImpl::ExecuteQuery(const std::string& sql,
+                                          uint32_t timeout_ms) {
   PERFETTO_TP_TRACE(metatrace::Category::API_TIMELINE, "EXECUTE_QUERY");
 
+  auto cancellation =
+      std::make_unique<QueryCancellation>(&interrupt_count_, timeout_ms);
+  QueryCancellation::ScopedCurrent scoped_cancellation(cancellation.get());
   uint32_t sql_stats_row =
       context_.storage->mutable_sql_stats()->RecordQueryBegin(
           sql, base::GetWallTimeNs().count());
   std::string non_breaking_sql = base::ReplaceAll(sql, "\u00A0", " ");
+  SqlSource source = SqlSource::FromExecuteQuery(std::move(non_breaking_sql));
   base::StatusOr<PerfettoSqlEngine::ExecutionResult> result =
-      engine_->ExecuteUntilLastStatement(
-          SqlSource::FromExecuteQuery(std::move(non_breaking_sql)));
-  std::unique_ptr<IteratorImpl> impl(
-      new IteratorImpl(this, std::move(result), sql_stats_row));
+      config_.enable_query_result_cache
+          ? engine_->ExecuteUntilLastStatementWithResultCache(std::move(source))
+          : engine_->ExecuteUntilLastStatement(std::move(source));
+  if (result.ok() && result->stats.result_cache_hit) {
+    context_.storage->mutable_sql_stats()->RecordQueryResultCacheHit(
+        sql_stats_row, *result->stats.result_cache_hit);
+  }
+  if (!result.ok() && cancellation->ShouldStop())
+    result = cancellation->ToStatus();
+  std::unique_ptr<IteratorImpl> impl(new IteratorImpl(
+      this, std::move(result), sql_stats_row, std::move(cancellation)));
   return Iterator(std::move(impl));
 }
 
 void TraceProcessorImpl::InterruptQuery() {
   if (!engine_->sqlite_engine()->db())
     return;
-  query_interrupted_.store(true);
+  interrupt_count_.fetch_add(1, std::memory_order_relaxed);
   sqlite3_interrupt(engine_->sqlite_engine()->db());
 }
 
@@ -548,7 +656,10 @@ base::Status TraceProcessorImpl::RegisterMetric(const std::string& path,
       sql_metrics_.begin(), sql_metrics_.end(),
       [&path](const metrics::SqlMetricFile& m) { return m.path == path; });
   if (it != sql_metrics_.end()) {
-    it->sql = sql;
+    if (it->sql != sql) {
+      it->sql = sql;
+      run_metric_cache_.Invalidate();
+    }
     return base::OkStatus();
   }
 
@@ -618,8 +729,21 @@ base::Status TraceProcessorImpl::ComputeMetric(
     return base::Status("Root metrics proto descriptor not found");
 
   const auto& root_descriptor = pool_.descriptors()[opt_idx.value()];
-  return metrics::ComputeMetrics(engine_.get(), metric_names, sql_metrics_,
-                                 pool_, root_descriptor, metrics_proto);
+  std::vector<metrics::MetricProfile> profile;
+  base::Status status = metrics::ComputeMetrics(
+      engine_.get(), metric_names, sql_metrics_, pool_, root_descriptor,
+      &run_metric_cache_, metrics_proto, &profile);
+
+  auto* profile_table = context_.storage->mutable_metric_profile_table();
+  for (const metrics::MetricProfile& p : profile) {
+    tables::MetricProfileTable::Row row;
+    row.name = context_.storage->InternString(base::StringView(p.name));
+    row.dur = p.dur_ns;
+    row.runs = p.runs;
+    row.skipped_runs = p.skipped_runs;
+    profile_table->Insert(row);
+  }
+  return status;
 }
 
 base::Status TraceProcessorImpl::ComputeMetricText(
@@ -656,10 +780,61 @@ void TraceProcessorImpl::EnableMetatrace(MetatraceConfig config) {
   metatrace::Enable(config);
 }
 
+// static
+int TraceProcessorImpl::OnSqliteAuthorize(void* self,
+                                          int action,
+                                          const char* table,
+                                          const char*,
+                                          const char*,
+                                          const char*) {
+  if (action != SQLITE_READ || !table)
+    return SQLITE_OK;
+  auto* tp = static_cast<TraceProcessorImpl*>(self);
+
+  // The stats tables change while queries run (sqlstats with each query) so
+  // their contents must never be served from the query result cache.
+  if (tp->config_.enable_query_result_cache &&
+      (strcmp(table, "stats") == 0 || strcmp(table, "sqlstats") == 0)) {
+    tp->engine_->MarkQueryResultUncacheable();
+  }
+
+  auto* lazy_args = LazyFtraceRawArgs::Get(&tp->context_);
+  if (PERFETTO_LIKELY(!lazy_args || lazy_args->pending_count() == 0))
+    return SQLITE_OK;
+
+  // Views (e.g. args) are reported with the name of the tables they read.
+  if (strcmp(table, tables::RawTable::Name()) == 0 ||
+      strcmp(table, tables::FtraceEventTable::Name()) == 0 ||
+      strcmp(table, tables::ArgTable::Name()) == 0) {
+    PERFETTO_TP_TRACE(metatrace::Category::QUERY_DETAILED,
+                      "MATERIALIZE_FTRACE_RAW_ARGS");
+    lazy_args->Materialize();
+  }
+  return SQLITE_OK;
+}
+
+// static
+int TraceProcessorImpl::OnSqliteProgress(void*) {
+  return QueryCancellation::ShouldStopCurrent() ? 1 : 0;
+}
+
 void TraceProcessorImpl::InitPerfettoSqlEngine() {
   engine_.reset(new PerfettoSqlEngine(context_.storage->mutable_string_pool()));
+  engine_->profile()->set_enabled(config_.enable_sql_profile);
+  engine_->set_lazy_module_tables(config_.enable_lazy_module_tables);
+  if (context_.memory_budget) {
+    engine_->set_create_table_check([this](const std::string& name) {
+      return MemoryBudget::CheckCanCreateTable(context_.memory_budget.get(),
+                                               name);
+    });
+  }
   sqlite3* db = engine_->sqlite_engine()->db();
   sqlite3_str_split_init(db);
+  sqlite3_progress_handler(db, kSqliteProgressInstructions,
+                           &TraceProcessorImpl::OnSqliteProgress, nullptr);
+
+  if (config_.lazy_ftrace_raw_args || config_.enable_query_result_cache)
+    sqlite3_set_authorizer(db, &TraceProcessorImpl::OnSqliteAuthorize, this);
 
   // Register SQL functions only used in local development instances.
   if (config_.enable_dev_features) {
@@ -670,6 +845,8 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
   RegisterFunction<Base64Encode>(engine_.get(), "BASE64_ENCODE", 1);
   RegisterFunction<Demangle>(engine_.get(), "DEMANGLE", 1);
   RegisterFunction<SourceGeq>(engine_.get(), "SOURCE_GEQ", -1);
+  RegisterFunction<IngestionWatermark>(
+      engine_.get(), "__intrinsic_ingestion_watermark", 0, this, false);
   RegisterFunction<TablePtrBind>(engine_.get(), "__intrinsic_table_ptr_bind",
                                  -1);
   RegisterFunction<ExportJson>(engine_.get(), "EXPORT_JSON", 1,
@@ -739,20 +916,35 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
   TraceStorage* storage = context_.storage.get();
 
   // Operator tables.
+  // The calling thread also joins partitions so the pool only needs
+  // |span_join_thread_count - 1| threads.
+  uint32_t span_join_threads = 0;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM) || \
+    PERFETTO_BUILDFLAG(PERFETTO_WASM_THREADS)
+  if (config_.span_join_thread_count > 1) {
+    span_join_threads = config_.span_join_thread_count - 1;
+    if (!span_join_thread_pool_)
+      span_join_thread_pool_.reset(new base::ThreadPool(span_join_threads));
+  }
+#endif
   engine_->sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
       "span_join",
-      std::make_unique<SpanJoinOperatorModule::Context>(engine_.get()));
+      std::make_unique<SpanJoinOperatorModule::Context>(
+          engine_.get(), span_join_thread_pool_.get(), span_join_threads));
   engine_->sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
       "span_left_join",
-      std::make_unique<SpanJoinOperatorModule::Context>(engine_.get()));
+      std::make_unique<SpanJoinOperatorModule::Context>(
+          engine_.get(), span_join_thread_pool_.get(), span_join_threads));
   engine_->sqlite_engine()->RegisterVirtualTableModule<SpanJoinOperatorModule>(
       "span_outer_join",
-      std::make_unique<SpanJoinOperatorModule::Context>(engine_.get()));
+      std::make_unique<SpanJoinOperatorModule::Context>(
+          engine_.get(), span_join_thread_pool_.get(), span_join_threads));
   engine_->sqlite_engine()->RegisterVirtualTableModule<WindowOperatorModule>(
       "window", std::make_unique<WindowOperatorModule::Context>());
   engine_->sqlite_engine()->RegisterVirtualTableModule<CounterMipmapOperator>(
       "__intrinsic_counter_mipmap",
-      std::make_unique<CounterMipmapOperator::Context>(engine_.get()));
+      std::make_unique<CounterMipmapOperator::Context>(
+          engine_.get(), &storage->counter_table()));
   engine_->sqlite_engine()->RegisterVirtualTableModule<SliceMipmapOperator>(
       "__intrinsic_slice_mipmap",
       std::make_unique<SliceMipmapOperator::Context>(engine_.get()));
@@ -784,13 +976,16 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
   RegisterFunction<metrics::RunMetric>(
       engine_.get(), "RUN_METRIC", -1,
       std::make_unique<metrics::RunMetric::Context>(
-          metrics::RunMetric::Context{engine_.get(), &sql_metrics_}));
+          metrics::RunMetric::Context{engine_.get(), &sql_metrics_,
+                                      &run_metric_cache_}));
 
   // Legacy tables.
   engine_->sqlite_engine()->RegisterVirtualTableModule<SqlStatsModule>(
       "sqlstats", storage);
   engine_->sqlite_engine()->RegisterVirtualTableModule<StatsModule>("stats",
                                                                     storage);
+  engine_->sqlite_engine()->RegisterVirtualTableModule<SqlProfileModule>(
+      "__intrinsic_sql_profile", engine_->profile());
   engine_->sqlite_engine()->RegisterVirtualTableModule<TablePointerModule>(
       "__intrinsic_table_ptr", nullptr);
 
@@ -798,109 +993,113 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
   // Note: if adding a table here which might potentially contain many rows
   // (O(rows in sched/slice/counter)), then consider calling ShrinkToFit on
   // that table in TraceStorage::ShrinkToFitTables.
-  RegisterStaticTable(storage->arg_table());
-  RegisterStaticTable(storage->raw_table());
-  RegisterStaticTable(storage->ftrace_event_table());
-  RegisterStaticTable(storage->thread_table());
-  RegisterStaticTable(storage->process_table());
-  RegisterStaticTable(storage->filedescriptor_table());
-
-  RegisterStaticTable(storage->slice_table());
-  RegisterStaticTable(storage->flow_table());
-  RegisterStaticTable(storage->sched_slice_table());
-  RegisterStaticTable(storage->spurious_sched_wakeup_table());
-  RegisterStaticTable(storage->thread_state_table());
-  RegisterStaticTable(storage->gpu_slice_table());
-
-  RegisterStaticTable(storage->track_table());
-  RegisterStaticTable(storage->thread_track_table());
-  RegisterStaticTable(storage->process_track_table());
-  RegisterStaticTable(storage->cpu_track_table());
-  RegisterStaticTable(storage->gpu_track_table());
-  RegisterStaticTable(storage->uid_track_table());
-  RegisterStaticTable(storage->gpu_work_period_track_table());
-
-  RegisterStaticTable(storage->counter_table());
-
-  RegisterStaticTable(storage->counter_track_table());
-  RegisterStaticTable(storage->process_counter_track_table());
-  RegisterStaticTable(storage->thread_counter_track_table());
-  RegisterStaticTable(storage->cpu_counter_track_table());
-  RegisterStaticTable(storage->irq_counter_track_table());
-  RegisterStaticTable(storage->softirq_counter_track_table());
-  RegisterStaticTable(storage->gpu_counter_track_table());
-  RegisterStaticTable(storage->gpu_counter_group_table());
-  RegisterStaticTable(storage->perf_counter_track_table());
-  RegisterStaticTable(storage->energy_counter_track_table());
-  RegisterStaticTable(storage->linux_device_track_table());
-  RegisterStaticTable(storage->uid_counter_track_table());
-  RegisterStaticTable(storage->energy_per_uid_counter_track_table());
-
-  RegisterStaticTable(storage->heap_graph_object_table());
-  RegisterStaticTable(storage->heap_graph_reference_table());
-  RegisterStaticTable(storage->heap_graph_class_table());
-
-  RegisterStaticTable(storage->symbol_table());
-  RegisterStaticTable(storage->heap_profile_allocation_table());
-  RegisterStaticTable(storage->cpu_profile_stack_sample_table());
-  RegisterStaticTable(storage->perf_sample_table());
-  RegisterStaticTable(storage->stack_profile_callsite_table());
-  RegisterStaticTable(storage->stack_profile_mapping_table());
-  RegisterStaticTable(storage->stack_profile_frame_table());
-  RegisterStaticTable(storage->package_list_table());
-  RegisterStaticTable(storage->profiler_smaps_table());
-
-  RegisterStaticTable(storage->android_log_table());
-  RegisterStaticTable(storage->android_dumpstate_table());
-  RegisterStaticTable(storage->android_game_intervention_list_table());
-
-  RegisterStaticTable(storage->vulkan_memory_allocations_table());
-
-  RegisterStaticTable(storage->graphics_frame_slice_table());
-
-  RegisterStaticTable(storage->expected_frame_timeline_slice_table());
-  RegisterStaticTable(storage->actual_frame_timeline_slice_table());
-
-  RegisterStaticTable(storage->v8_isolate_table());
-  RegisterStaticTable(storage->v8_js_script_table());
-  RegisterStaticTable(storage->v8_wasm_script_table());
-  RegisterStaticTable(storage->v8_js_function_table());
-  RegisterStaticTable(storage->v8_js_code_table());
-  RegisterStaticTable(storage->v8_internal_code_table());
-  RegisterStaticTable(storage->v8_wasm_code_table());
-  RegisterStaticTable(storage->v8_regexp_code_table());
-
-  RegisterStaticTable(storage->jit_code_table());
-  RegisterStaticTable(storage->jit_frame_table());
-
-  RegisterStaticTable(storage->inputmethod_clients_table());
-  RegisterStaticTable(storage->inputmethod_manager_service_table());
-  RegisterStaticTable(storage->inputmethod_service_table());
-
-  RegisterStaticTable(storage->surfaceflinger_layers_snapshot_table());
-  RegisterStaticTable(storage->surfaceflinger_layer_table());
-  RegisterStaticTable(storage->surfaceflinger_transactions_table());
-
-  RegisterStaticTable(storage->window_manager_shell_transitions_table());
+  RegisterStaticTable(storage->mutable_arg_table());
+  RegisterStaticTable(storage->mutable_raw_table());
+  RegisterStaticTable(storage->mutable_ftrace_event_table());
+  RegisterStaticTable(storage->mutable_thread_table());
+  RegisterStaticTable(storage->mutable_process_table());
+  RegisterStaticTable(storage->mutable_filedescriptor_table());
+
+  RegisterStaticTable(storage->mutable_slice_table());
+  RegisterStaticTable(storage->mutable_flow_table());
+  RegisterStaticTable(storage->mutable_sched_slice_table());
+  RegisterStaticTable(storage->mutable_spurious_sched_wakeup_table());
+  RegisterStaticTable(storage->mutable_thread_state_table());
+  RegisterStaticTable(storage->mutable_gpu_slice_table());
+
+  RegisterStaticTable(storage->mutable_track_table());
+  RegisterStaticTable(storage->mutable_thread_track_table());
+  RegisterStaticTable(storage->mutable_process_track_table());
+  RegisterStaticTable(storage->mutable_cpu_track_table());
+  RegisterStaticTable(storage->mutable_gpu_track_table());
+  RegisterStaticTable(storage->mutable_uid_track_table());
+  RegisterStaticTable(storage->mutable_gpu_work_period_track_table());
+
+  RegisterStaticTable(storage->mutable_counter_table());
+
+  RegisterStaticTable(storage->mutable_counter_track_table());
+  RegisterStaticTable(storage->mutable_process_counter_track_table());
+  RegisterStaticTable(storage->mutable_thread_counter_track_table());
+  RegisterStaticTable(storage->mutable_cpu_counter_track_table());
+  RegisterStaticTable(storage->mutable_irq_counter_track_table());
+  RegisterStaticTable(storage->mutable_softirq_counter_track_table());
+  RegisterStaticTable(storage->mutable_gpu_counter_track_table());
+  RegisterStaticTable(storage->mutable_gpu_counter_group_table());
+  RegisterStaticTable(storage->mutable_perf_counter_track_table());
+  RegisterStaticTable(storage->mutable_energy_counter_track_table());
+  RegisterStaticTable(storage->mutable_linux_device_track_table());
+  RegisterStaticTable(storage->mutable_uid_counter_track_table());
+  RegisterStaticTable(storage->mutable_energy_per_uid_counter_track_table());
+
+  RegisterStaticTable(storage->mutable_heap_graph_object_table());
+  RegisterStaticTable(storage->mutable_heap_graph_reference_table());
+  RegisterStaticTable(storage->mutable_heap_graph_class_table());
+
+  RegisterStaticTable(storage->mutable_symbol_table());
+  RegisterStaticTable(storage->mutable_heap_profile_allocation_table());
+  RegisterStaticTable(storage->mutable_cpu_profile_stack_sample_table());
+  RegisterStaticTable(storage->mutable_perf_sample_table());
+  RegisterStaticTable(storage->mutable_stack_profile_callsite_table());
+  RegisterStaticTable(storage->mutable_stack_profile_mapping_table());
+  RegisterStaticTable(storage->mutable_stack_profile_frame_table());
+  RegisterStaticTable(storage->mutable_package_list_table());
+  RegisterStaticTable(storage->mutable_profiler_smaps_table());
+
+  RegisterStaticTable(storage->mutable_android_log_table());
+  RegisterStaticTable(storage->mutable_android_dumpstate_table());
+  RegisterStaticTable(storage->mutable_android_game_intervenion_list_table());
+
+  RegisterStaticTable(storage->mutable_vulkan_memory_allocations_table());
+
+  RegisterStaticTable(storage->mutable_graphics_frame_slice_table());
+
+  RegisterStaticTable(storage->mutable_expected_frame_timeline_slice_table());
+  RegisterStaticTable(storage->mutable_actual_frame_timeline_slice_table());
+
+  RegisterStaticTable(storage->mutable_v8_isolate_table());
+  RegisterStaticTable(storage->mutable_v8_js_script_table());
+  RegisterStaticTable(storage->mutable_v8_wasm_script_table());
+  RegisterStaticTable(storage->mutable_v8_js_function_table());
+  RegisterStaticTable(storage->mutable_v8_js_code_table());
+  RegisterStaticTable(storage->mutable_v8_internal_code_table());
+  RegisterStaticTable(storage->mutable_v8_wasm_code_table());
+  RegisterStaticTable(storage->mutable_v8_regexp_code_table());
+
+  RegisterStaticTable(storage->mutable_jit_code_table());
+  RegisterStaticTable(storage->mutable_jit_frame_table());
+
+  RegisterStaticTable(storage->mutable_inputmethod_clients_table());
+  RegisterStaticTable(storage->mutable_inputmethod_manager_service_table());
+  RegisterStaticTable(storage->mutable_inputmethod_service_table());
+
+  RegisterStaticTable(storage->mutable_surfaceflinger_layers_snapshot_table());
+  RegisterStaticTable(storage->mutable_surfaceflinger_layer_table());
+  RegisterStaticTable(storage->mutable_surfaceflinger_transactions_table());
+
+  RegisterStaticTable(
+      storage->mutable_window_manager_shell_transitions_table());
   RegisterStaticTable(
-      storage->window_manager_shell_transition_handlers_table());
+      storage->mutable_window_manager_shell_transition_handlers_table());
 
-  RegisterStaticTable(storage->protolog_table());
+  RegisterStaticTable(storage->mutable_protolog_table());
 
-  RegisterStaticTable(storage->metadata_table());
-  RegisterStaticTable(storage->cpu_table());
-  RegisterStaticTable(storage->cpu_freq_table());
-  RegisterStaticTable(storage->clock_snapshot_table());
+  RegisterStaticTable(storage->mutable_metadata_table());
+  RegisterStaticTable(storage->mutable_cpu_table());
+  RegisterStaticTable(storage->mutable_cpu_freq_table());
+  RegisterStaticTable(storage->mutable_clock_snapshot_table());
+  RegisterStaticTable(storage->mutable_ingestion_profile_table());
+  RegisterStaticTable(storage->mutable_metric_profile_table());
 
-  RegisterStaticTable(storage->memory_snapshot_table());
-  RegisterStaticTable(storage->process_memory_snapshot_table());
-  RegisterStaticTable(storage->memory_snapshot_node_table());
-  RegisterStaticTable(storage->memory_snapshot_edge_table());
+  RegisterStaticTable(storage->mutable_memory_snapshot_table());
+  RegisterStaticTable(storage->mutable_process_memory_snapshot_table());
+  RegisterStaticTable(storage->mutable_memory_snapshot_node_table());
+  RegisterStaticTable(storage->mutable_memory_snapshot_edge_table());
 
-  RegisterStaticTable(storage->experimental_proto_path_table());
-  RegisterStaticTable(storage->experimental_proto_content_table());
+  RegisterStaticTable(storage->mutable_experimental_proto_path_table());
+  RegisterStaticTable(storage->mutable_experimental_proto_content_table());
 
-  RegisterStaticTable(storage->experimental_missing_chrome_processes_table());
+  RegisterStaticTable(
+      storage->mutable_experimental_missing_chrome_processes_table());
 
   // Tables dynamically generated at query time.
   engine_->RegisterStaticTableFunction(
@@ -912,22 +1111,30 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
           context_.storage->mutable_string_pool(), &storage->slice_table()));
   engine_->RegisterStaticTableFunction(std::make_unique<TableInfo>(
       context_.storage->mutable_string_pool(), engine_.get()));
+  engine_->RegisterStaticTableFunction(
+      std::make_unique<MemoryUsage>(&context_, engine_.get()));
   engine_->RegisterStaticTableFunction(std::make_unique<Ancestor>(
       Ancestor::Type::kSlice, context_.storage.get()));
   engine_->RegisterStaticTableFunction(std::make_unique<Ancestor>(
       Ancestor::Type::kStackProfileCallsite, context_.storage.get()));
   engine_->RegisterStaticTableFunction(std::make_unique<Ancestor>(
       Ancestor::Type::kSliceByStack, context_.storage.get()));
+  auto slice_tree_index =
+      std::make_shared<SliceTreeIndex>(&storage->slice_table());
   engine_->RegisterStaticTableFunction(std::make_unique<Descendant>(
-      Descendant::Type::kSlice, context_.storage.get()));
-  engine_->RegisterStaticTableFunction(std::make_unique<Descendant>(
-      Descendant::Type::kSliceByStack, context_.storage.get()));
+      Descendant::Type::kSlice, context_.storage.get(), slice_tree_index));
+  engine_->RegisterStaticTableFunction(
+      std::make_unique<Descendant>(Descendant::Type::kSliceByStack,
+                                   context_.storage.get(), slice_tree_index));
   engine_->RegisterStaticTableFunction(std::make_unique<ConnectedFlow>(
-      ConnectedFlow::Mode::kDirectlyConnectedFlow, context_.storage.get()));
+      ConnectedFlow::Mode::kDirectlyConnectedFlow, context_.storage.get(),
+      slice_tree_index));
   engine_->RegisterStaticTableFunction(std::make_unique<ConnectedFlow>(
-      ConnectedFlow::Mode::kPrecedingFlow, context_.storage.get()));
+      ConnectedFlow::Mode::kPrecedingFlow, context_.storage.get(),
+      slice_tree_index));
   engine_->RegisterStaticTableFunction(std::make_unique<ConnectedFlow>(
-      ConnectedFlow::Mode::kFollowingFlow, context_.storage.get()));
+      ConnectedFlow::Mode::kFollowingFlow, context_.storage.get(),
+      slice_tree_index));
   engine_->RegisterStaticTableFunction(std::make_unique<ExperimentalSchedUpid>(
       storage->sched_slice_table(), storage->thread_table()));
   engine_->RegisterStaticTableFunction(
@@ -940,6 +1147,8 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
       context_.storage->mutable_string_pool()));
   engine_->RegisterStaticTableFunction(std::make_unique<DfsWeightBounded>(
       context_.storage->mutable_string_pool()));
+  engine_->RegisterStaticTableFunction(
+      std::make_unique<WinscopeProtoToArgs>(context_.storage.get()));
 
   // Value table aggregate functions.
   engine_->RegisterSqliteAggregateFunction<Dfs>(
@@ -947,6 +1156,9 @@ void TraceProcessorImpl::InitPerfettoSqlEngine() {
   engine_->RegisterSqliteAggregateFunction<StructuralTreePartition>(
       StructuralTreePartition::kName, StructuralTreePartition::kArgCount,
       context_.storage->mutable_string_pool());
+  engine_->RegisterSqliteAggregateFunction<IntervalIntersectN>(
+      IntervalIntersectN::kName, IntervalIntersectN::kArgCount,
+      context_.storage->mutable_string_pool());
 
   // Metrics.
   RegisterAllProtoBuilderFunctions(&pool_, engine_.get(), this);
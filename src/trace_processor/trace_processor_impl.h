@@ -23,14 +23,17 @@
 #include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/trace_processor/basic_types.h"
 #include "perfetto/trace_processor/trace_blob_view.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/iterator_impl.h"
 #include "src/trace_processor/metrics/metrics.h"
 #include "src/trace_processor/perfetto_sql/engine/perfetto_sql_engine.h"
@@ -62,7 +65,10 @@ class TraceProcessorImpl : public TraceProcessor,
   void NotifyEndOfFile() override;
 
   // TraceProcessor implementation:
+  const Config& config() const override { return config_; }
+
   Iterator ExecuteQuery(const std::string& sql) override;
+  Iterator ExecuteQuery(const std::string& sql, uint32_t timeout_ms) override;
 
   base::Status RegisterMetric(const std::string& path,
                               const std::string& sql) override;
@@ -97,31 +103,72 @@ class TraceProcessorImpl : public TraceProcessor,
   base::Status DisableAndReadMetatrace(
       std::vector<uint8_t>* trace_proto) override;
 
+  // Returns the timestamp up to which the trace has been ingested into the
+  // tables, if any: when the trace is parsed incrementally, the events older
+  // than this are in the tables and queries between two calls to Parse() see
+  // a consistent snapshot of the trace up to this point. Set to the end of the
+  // trace once NotifyEndOfFile() is called.
+  std::optional<int64_t> ingestion_watermark() const {
+    return ingestion_watermark_;
+  }
+
+  // The engine queries run on, for callers which need more than the public
+  // API, e.g. prepared statements with bound values.
+  PerfettoSqlEngine* engine() { return engine_.get(); }
+
  private:
   // Needed for iterators to be able to access the context.
   friend class IteratorImpl;
 
   template <typename Table>
-  void RegisterStaticTable(const Table& table) {
+  void RegisterStaticTable(Table* table) {
     engine_->RegisterStaticTable(table, Table::Name(),
                                  Table::ComputeStaticSchema());
+    if (context_.memory_budget)
+      context_.memory_budget->AddTable(Table::Name(), table);
   }
 
   bool IsRootMetricField(const std::string& metric_name);
 
+  // Updates |ingestion_watermark_| from the sorter, invalidating the cached
+  // query results if the tables changed.
+  void UpdateIngestionWatermark();
+
   void InitPerfettoSqlEngine();
 
+  // SQLite progress handler: stops the statement being run if its query
+  // should stop (see QueryCancellation).
+  static int OnSqliteProgress(void*);
+
+  // SQLite authorizer callback, only installed if
+  // |Config::lazy_ftrace_raw_args| is set: decodes the deferred ftrace args
+  // while preparing the first statement which reads a table holding them.
+  static int OnSqliteAuthorize(void* self,
+                               int action,
+                               const char* table,
+                               const char* column,
+                               const char* db,
+                               const char* trigger_or_view);
+
   const Config config_;
+
+  // Pool on which the partitions of span joins are joined. Only created if
+  // |Config::span_join_thread_count| is greater than one. Declared before
+  // |engine_| so it outlives the span join tables.
+  std::unique_ptr<base::ThreadPool> span_join_thread_pool_;
+
   std::unique_ptr<PerfettoSqlEngine> engine_;
 
   DescriptorPool pool_;
 
   std::vector<metrics::SqlMetricFile> sql_metrics_;
+  metrics::RunMetricCache run_metric_cache_;
   std::unordered_map<std::string, std::string> proto_field_to_sql_metric_path_;
 
-  // This is atomic because it is set by the CTRL-C signal handler and we need
-  // to prevent single-flow compiler optimizations in ExecuteQuery().
-  std::atomic<bool> query_interrupted_{false};
+  // Incremented by InterruptQuery() to cancel the queries started before (see
+  // QueryCancellation). This is atomic because it is set by the CTRL-C signal
+  // handler and by the RPC server from other threads.
+  std::atomic<uint32_t> interrupt_count_{0};
 
   // Track the number of objects registered with SQLite after the constructor.
   uint64_t sqlite_objects_post_constructor_initialization_ = 0;
@@ -132,6 +179,8 @@ class TraceProcessorImpl : public TraceProcessor,
   // NotifyEndOfFile should only be called once. Set to true whenever it is
   // called.
   bool notify_eof_called_ = false;
+
+  std::optional<int64_t> ingestion_watermark_;
 };
 
 }  // namespace perfetto::trace_processor
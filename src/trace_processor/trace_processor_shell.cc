@@ -18,12 +18,15 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/stat.h>
+#include <algorithm>
 #include <cctype>
 #include <cinttypes>
 #include <functional>
 #include <iostream>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <thread>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -48,11 +51,14 @@
 #include "perfetto/trace_processor/metatrace_config.h"
 #include "perfetto/trace_processor/read_trace.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/batch_query_runner.h"
 #include "src/trace_processor/metrics/all_chrome_metrics.descriptor.h"
 #include "src/trace_processor/metrics/all_webview_metrics.descriptor.h"
 #include "src/trace_processor/metrics/metrics.descriptor.h"
 #include "src/trace_processor/read_trace_internal.h"
+#include "src/trace_processor/rpc/arrow_ipc_serializer.h"
 #include "src/trace_processor/rpc/stdiod.h"
+#include "src/trace_processor/rpc/trace_index.h"
 #include "src/trace_processor/util/sql_modules.h"
 #include "src/trace_processor/util/status_macros.h"
 
@@ -61,6 +67,9 @@
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
 #include "src/trace_processor/rpc/httpd.h"
 #endif
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_LIVE)
+#include "src/trace_processor/live_trace_reader.h"
+#endif
 #include "src/profiling/deobfuscator.h"
 #include "src/profiling/symbolizer/local_symbolizer.h"
 #include "src/profiling/symbolizer/symbolize_database.h"
@@ -89,6 +98,8 @@
 #define ftruncate _chsize
 #else
 #include <dirent.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif
 
 #if PERFETTO_BUILDFLAG(PERFETTO_TP_LINENOISE) && \
@@ -252,6 +263,105 @@ base::Status PrintStats() {
   return base::OkStatus();
 }
 
+base::Status PrintIngestionProfile() {
+  auto it = g_tp->ExecuteQuery(
+      "SELECT phase, name, count, dur, bytes "
+      "FROM __intrinsic_ingestion_profile "
+      "ORDER BY dur DESC");
+
+  fprintf(stderr, "Ingestion profile for this trace:\n");
+  fprintf(stderr, "%-10s %-40s %12s %12s %14s\n", "phase", "name", "count",
+          "dur_ms", "bytes");
+  while (it.Next()) {
+    fprintf(stderr, "%-10s %-40.40s %12" PRIi64 " %12.3f %14" PRIi64 "\n",
+            it.Get(0).AsString(), it.Get(1).AsString(), it.Get(2).AsLong(),
+            static_cast<double>(it.Get(3).AsLong()) / 1e6, it.Get(4).AsLong());
+  }
+
+  base::Status status = it.Status();
+  if (!status.ok()) {
+    return base::ErrStatus("Error while iterating ingestion profile (%s)",
+                           status.c_message());
+  }
+  return base::OkStatus();
+}
+
+base::Status PrintMetricsProfile() {
+  auto it = g_tp->ExecuteQuery(
+      "SELECT name, dur, runs, skipped_runs FROM __intrinsic_metric_profile");
+
+  fprintf(stderr, "Metrics profile:\n");
+  fprintf(stderr, "%-50s %12s %8s %12s\n", "name", "dur_ms", "runs",
+          "skipped_runs");
+  while (it.Next()) {
+    fprintf(stderr, "%-50.50s %12.3f %8" PRIi64 " %12" PRIi64 "\n",
+            it.Get(0).AsString(),
+            static_cast<double>(it.Get(1).AsLong()) / 1e6, it.Get(2).AsLong(),
+            it.Get(3).AsLong());
+  }
+
+  base::Status status = it.Status();
+  if (!status.ok()) {
+    return base::ErrStatus("Error while iterating metrics profile (%s)",
+                           status.c_message());
+  }
+  return base::OkStatus();
+}
+
+base::Status PrintQueryProfile() {
+  auto it = g_tp->ExecuteQuery(
+      "SELECT type, name, detail, dur, rows, filter_count "
+      "FROM __intrinsic_sql_profile "
+      "ORDER BY dur DESC "
+      "LIMIT 100");
+
+  fprintf(stderr, "Query profile (slowest statements and operators):\n");
+  fprintf(stderr, "%-9s %-60s %-40s %12s %12s %8s\n", "type", "name",
+          "detail", "dur_ms", "rows", "filters");
+  while (it.Next()) {
+    // Only show the first line of statements.
+    std::string name = it.Get(1).AsString();
+    name = name.substr(0, name.find('\n'));
+    SqlValue filters = it.Get(5);
+    fprintf(stderr, "%-9s %-60.60s %-40.40s %12.3f %12" PRIi64 " %8s\n",
+            it.Get(0).AsString(), name.c_str(),
+            it.Get(2).is_null() ? "" : it.Get(2).AsString(),
+            static_cast<double>(it.Get(3).AsLong()) / 1e6, it.Get(4).AsLong(),
+            filters.is_null() ? ""
+                              : std::to_string(filters.AsLong()).c_str());
+  }
+
+  base::Status status = it.Status();
+  if (!status.ok()) {
+    return base::ErrStatus("Error while iterating query profile (%s)",
+                           status.c_message());
+  }
+  return base::OkStatus();
+}
+
+base::Status WriteTraceIndex(const std::string& output_path,
+                             const std::string& trace_file_path) {
+  std::optional<uint64_t> trace_size = base::GetFileSize(trace_file_path);
+  if (!trace_size) {
+    return base::ErrStatus("Failed to get the size of %s",
+                           trace_file_path.c_str());
+  }
+  ASSIGN_OR_RETURN(std::vector<uint8_t> index,
+                   TraceIndex::Build(g_tp, TraceIndex::DefaultQueries(),
+                                     *trace_size));
+  base::ScopedFile fd(base::OpenFile(output_path, O_CREAT | O_TRUNC | O_WRONLY,
+                                     0600));
+  if (!fd)
+    return base::ErrStatus("Failed to create file: %s", output_path.c_str());
+  if (base::WriteAll(*fd, index.data(), index.size()) !=
+      static_cast<ssize_t>(index.size())) {
+    return base::ErrStatus("Failed to write %s", output_path.c_str());
+  }
+  PERFETTO_ILOG("Trace index written to %s (%zu bytes)", output_path.c_str(),
+                index.size());
+  return base::OkStatus();
+}
+
 base::Status ExportTraceToDatabase(const std::string& output_name) {
   PERFETTO_CHECK(output_name.find('\'') == std::string::npos);
   {
@@ -535,6 +645,30 @@ base::Status PrintQueryResultAsCsv(Iterator* it, bool has_more, FILE* output) {
   return it->Status();
 }
 
+base::Status WriteQueryResultAsArrow(Iterator it,
+                                     bool has_more,
+                                     const std::string& output_path) {
+  auto fd(base::OpenFile(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0666));
+  if (!fd) {
+    return base::ErrStatus("Failed to open %s for writing",
+                           output_path.c_str());
+  }
+  using IteratorState = ArrowIpcSerializer::IteratorState;
+  ArrowIpcSerializer serializer(
+      std::move(it), has_more ? IteratorState::kOnFirstRow
+                              : IteratorState::kAtEnd);
+  std::vector<uint8_t> buf;
+  for (bool more = true; more;) {
+    more = serializer.Serialize(&buf);
+    if (base::WriteAll(fd.get(), buf.data(), buf.size()) !=
+        static_cast<ssize_t>(buf.size())) {
+      return base::ErrStatus("Failed to write to %s", output_path.c_str());
+    }
+    buf.clear();
+  }
+  return serializer.status();
+}
+
 base::Status RunQueriesWithoutOutput(const std::string& sql_query) {
   auto it = g_tp->ExecuteQuery(sql_query);
   if (it.StatementWithOutputCount() > 0)
@@ -546,6 +680,7 @@ base::Status RunQueriesWithoutOutput(const std::string& sql_query) {
 }
 
 base::Status RunQueriesAndPrintResult(const std::string& sql_query,
+                                      const std::string& arrow_output_path,
                                       FILE* output) {
   PERFETTO_DLOG("Executing query: %s", sql_query.c_str());
   auto query_start = std::chrono::steady_clock::now();
@@ -578,7 +713,12 @@ base::Status RunQueriesAndPrintResult(const std::string& sql_query,
   }
 
   auto query_end = std::chrono::steady_clock::now();
-  RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, has_more, output));
+  if (arrow_output_path.empty()) {
+    RETURN_IF_ERROR(PrintQueryResultAsCsv(&it, has_more, output));
+  } else {
+    RETURN_IF_ERROR(
+        WriteQueryResultAsArrow(std::move(it), has_more, arrow_output_path));
+  }
 
   auto dur = query_end - query_start;
   PERFETTO_ILOG(
@@ -666,6 +806,8 @@ metatrace::MetatraceCategories ParseMetatraceCategories(std::string s) {
 struct CommandLineOptions {
   std::string perf_file_path;
   std::string query_file_path;
+  std::string arrow_output_path;
+  std::string trace_index_path;
   std::string pre_metrics_path;
   std::string sqlite_file_path;
   std::string sql_module_path;
@@ -678,9 +820,26 @@ struct CommandLineOptions {
   std::vector<std::string> raw_metric_extensions;
   bool launch_shell = false;
   bool enable_httpd = false;
+  bool httpd_multi_trace = false;
+  std::optional<uint32_t> httpd_idle_timeout_ms;
+  uint64_t httpd_max_trace_bytes = 0;
+  uint32_t httpd_max_traces = 0;
+  std::string batch_traces_path;
+  std::string attach_session_key;
+  uint32_t batch_concurrency = 0;
+  uint64_t batch_max_bytes = 0;
+  std::string batch_merge_query_path;
+  bool test_host = false;
+  uint32_t test_host_jobs = 0;
   bool enable_stdiod = false;
   bool wide = false;
   bool force_full_sort = false;
+  bool spill_to_disk = false;
+  bool print_ingestion_profile = false;
+  bool query_result_cache = false;
+  bool print_query_profile = false;
+  bool print_metrics_profile = false;
+  bool lazy_module_tables = false;
   std::string metatrace_path;
   size_t metatrace_buffer_capacity = 0;
   metatrace::MetatraceCategories metatrace_categories =
@@ -689,8 +848,15 @@ struct CommandLineOptions {
           metatrace::MetatraceCategories::API_TIMELINE);
   bool dev = false;
   bool no_ftrace_raw = false;
+  bool lazy_ftrace_raw = false;
   bool analyze_trace_proto_content = false;
   bool crop_track_events = false;
+  uint32_t tokenizer_threads = 1;
+  uint32_t span_join_threads = 1;
+  uint32_t heap_graph_threads = 1;
+  uint64_t memory_budget_mb = 0;
+  uint32_t query_timeout_ms = 0;
+  uint32_t read_ahead_chunks = 0;
   std::vector<std::string> dev_flags;
 };
 
@@ -714,29 +880,138 @@ Options:
                                       If used with --run-metrics, the query is
                                       executed after the selected metrics and
                                       the metrics output is suppressed.
+ --arrow-output FILE                  Writes the result of the query passed
+                                      with -q to FILE as an Apache Arrow IPC
+                                      stream instead of printing it as CSV.
+                                      Column types are inferred from the first
+                                      rows of the result.
  -D, --httpd                          Enables the HTTP RPC server.
  --http-port PORT                     Specify what port to run HTTP RPC server.
+ --httpd-multi-trace                  Enables the HTTP RPC server in multi-trace
+                                      mode: each client selects a trace with
+                                      the x-perfetto-trace-id header and every
+                                      trace gets its own TraceProcessor
+                                      instance, running on its own thread.
+                                      The trace file argument is ignored.
+ --httpd-idle-timeout-s SECONDS       In multi-trace mode, destroys the traces
+                                      which have not been queried for this
+                                      long (default: 3600).
+ --httpd-max-trace-mb MB              In multi-trace mode, destroys the least
+                                      recently used traces when the loaded
+                                      traces exceed this size in total.
+ --httpd-max-traces N                 In multi-trace mode, caps the number of
+                                      loaded traces.
+ --batch-traces FILE                  Runs the query file given with -q over
+                                      each of the traces listed in FILE (one
+                                      path per line) instead of a single
+                                      trace, within this process. The results
+                                      are printed as CSV, with the trace path
+                                      as first column.
+ --batch-concurrency N                In batch mode, the number of traces
+                                      loaded at the same time (default: the
+                                      number of CPUs).
+ --batch-max-mb MB                    In batch mode, only starts loading a
+                                      trace while the traces being loaded
+                                      total less than this size on disk.
+ --batch-merge-query FILE             In batch mode, gathers the results of
+                                      all the traces into the batch_results
+                                      table (with trace_id and trace columns
+                                      first) and prints the result of the
+                                      query in FILE run on it instead.
+ --test-host                          Loads the trace, then runs the tests
+                                      read from stdin, one per line, each in a
+                                      process forked after the trace was
+                                      loaded. A test is a tab-separated list:
+                                      its id, the files its stdout and stderr
+                                      are written to, then any of the -q,
+                                      --run-metrics, --metrics-output and
+                                      --perf-file options, each followed by
+                                      its value. "ID EXIT_CODE" is printed
+                                      once it completes. Used by the diff
+                                      tests to load each test trace once.
+ --test-host-jobs N                   In test host mode, the number of tests
+                                      run at the same time (default: the
+                                      number of CPUs).
  --stdiod                             Enables the stdio RPC server.
+ --attach SESSION_KEY                 Attaches to the tracing session started
+                                      with perfetto --detach=SESSION_KEY and
+                                      loads its data while it is running. Only
+                                      valid in interactive mode, without a
+                                      trace file.
  -i, --interactive                    Starts interactive mode even after a query
                                       file is specified with -q or
                                       --run-metrics.
  -e, --export FILE                    Export the contents of trace processor
                                       into an SQLite database after running any
                                       metrics or queries specified.
+ --write-trace-index FILE             Writes a trace index, a small sidecar
+                                      file with the bounds, processes, threads
+                                      and tracks of the trace, to FILE after
+                                      loading the trace. Clients can load it
+                                      (TPM_LOAD_TRACE_INDEX) to show a summary
+                                      of the trace while it is being loaded.
 
 Feature flags:
  --full-sort                          Forces the trace processor into performing
                                       a full sort ignoring any windowing
                                       logic.
+ --spill-to-disk                      When fully sorting, keeps the events
+                                      waiting to be sorted in a temporary file
+                                      (in $TMPDIR) which the kernel can evict
+                                      under memory pressure.
+ --print-ingestion-profile            Measures the time spent tokenizing and
+                                      parsing each kind of packet, sorting and
+                                      flushing while loading the trace and
+                                      prints it after loading. The data is
+                                      also available in the
+                                      __intrinsic_ingestion_profile table.
+ --query-result-cache                 Stores the result of read-only queries
+                                      and serves it again when the same query
+                                      is executed, until any table or function
+                                      is created or dropped.
+ --query-profile                      Measures the time spent in and the rows
+                                      produced by each statement and each
+                                      table cursor while running the queries
+                                      and prints the slowest ones. The data
+                                      is also available in the
+                                      __intrinsic_sql_profile table.
+ --lazy-module-tables                 Only computes the tables created by
+                                      included modules when they are first
+                                      used. Errors in these tables are also
+                                      only reported when they are first used.
  --no-ftrace-raw                      Prevents ingestion of typed ftrace events
                                       into the raw table. This significantly
                                       reduces the memory usage of trace
                                       processor when loading traces containing
                                       ftrace events.
+ --lazy-ftrace-raw                    Adds typed ftrace events to the raw table
+                                      but only decodes their args on the first
+                                      query reading the raw or args tables.
  --analyze-trace-proto-content        Enables trace proto content analysis in
                                       trace processor.
  --crop-track-events                  Ignores track event outside of the
                                       range of interest in trace processor.
+ --tokenizer-threads N                Uses N threads to decompress compressed
+                                      packets while loading proto traces and
+                                      to parse perf.data samples and, for
+                                      N > 1, to inflate gzip traces in the
+                                      background.
+ --span-join-threads N                Uses N threads to join the partitions
+                                      of span joins where both tables are
+                                      partitioned by the same column.
+ --heap-graph-threads N               Uses N threads to compute which objects
+                                      of Java heap graphs are reachable.
+ --memory-budget-mb N                 Drops the args of events, then raw
+                                      ftrace events and then refuses new
+                                      PERFETTO TABLEs as the estimated memory
+                                      usage approaches N MB, rather than
+                                      running out of memory.
+ --query-timeout-ms N                 Fails the queries which run for longer
+                                      than N ms with a "timed out" error.
+ --read-ahead-chunks N                Reads the trace file on N threads, up
+                                      to N MB ahead of the parser, rather
+                                      than mapping it in memory. Speeds up
+                                      loading from network file systems.
  --dev                                Enables features which are reserved for
                                       local development use only and
                                       *should not* be enabled on production
@@ -777,6 +1052,10 @@ Metrics:
                                       DISK_PATH/protos and DISK_PATH/sql
                                       respectively, and mounts them onto
                                       VIRTUAL_PATH.
+ --print-metrics-profile              Prints the time spent computing each
+                                      metric after running --run-metrics. The
+                                      data is also available in the
+                                      __intrinsic_metric_profile table.
 
 Metatracing:
  -m, --metatrace FILE                 Enables metatracing of trace processor
@@ -795,19 +1074,45 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     OPT_PRE_METRICS,
     OPT_METRICS_OUTPUT,
     OPT_FORCE_FULL_SORT,
+    OPT_SPILL_TO_DISK,
+    OPT_PRINT_INGESTION_PROFILE,
+    OPT_QUERY_RESULT_CACHE,
+    OPT_QUERY_PROFILE,
+    OPT_LAZY_MODULE_TABLES,
     OPT_HTTP_PORT,
+    OPT_HTTPD_MULTI_TRACE,
+    OPT_HTTPD_IDLE_TIMEOUT,
+    OPT_HTTPD_MAX_TRACE_MB,
+    OPT_HTTPD_MAX_TRACES,
+    OPT_BATCH_TRACES,
+    OPT_BATCH_CONCURRENCY,
+    OPT_BATCH_MAX_MB,
+    OPT_BATCH_MERGE_QUERY,
+    OPT_ARROW_OUTPUT,
+    OPT_WRITE_TRACE_INDEX,
     OPT_ADD_SQL_MODULE,
     OPT_METRIC_EXTENSION,
+    OPT_PRINT_METRICS_PROFILE,
     OPT_DEV,
     OPT_OVERRIDE_STDLIB,
     OPT_OVERRIDE_SQL_MODULE,
     OPT_NO_FTRACE_RAW,
+    OPT_LAZY_FTRACE_RAW,
     OPT_METATRACE_BUFFER_CAPACITY,
     OPT_METATRACE_CATEGORIES,
     OPT_ANALYZE_TRACE_PROTO_CONTENT,
     OPT_CROP_TRACK_EVENTS,
+    OPT_TOKENIZER_THREADS,
+    OPT_SPAN_JOIN_THREADS,
+    OPT_HEAP_GRAPH_THREADS,
+    OPT_MEMORY_BUDGET_MB,
+    OPT_QUERY_TIMEOUT_MS,
+    OPT_READ_AHEAD_CHUNKS,
     OPT_DEV_FLAG,
     OPT_STDIOD,
+    OPT_ATTACH,
+    OPT_TEST_HOST,
+    OPT_TEST_HOST_JOBS,
   };
 
   static const option long_options[] = {
@@ -816,21 +1121,52 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"wide", no_argument, nullptr, 'W'},
       {"perf-file", required_argument, nullptr, 'p'},
       {"query-file", required_argument, nullptr, 'q'},
+      {"arrow-output", required_argument, nullptr, OPT_ARROW_OUTPUT},
       {"httpd", no_argument, nullptr, 'D'},
       {"http-port", required_argument, nullptr, OPT_HTTP_PORT},
+      {"httpd-multi-trace", no_argument, nullptr, OPT_HTTPD_MULTI_TRACE},
+      {"httpd-idle-timeout-s", required_argument, nullptr,
+       OPT_HTTPD_IDLE_TIMEOUT},
+      {"httpd-max-trace-mb", required_argument, nullptr,
+       OPT_HTTPD_MAX_TRACE_MB},
+      {"httpd-max-traces", required_argument, nullptr, OPT_HTTPD_MAX_TRACES},
+      {"batch-traces", required_argument, nullptr, OPT_BATCH_TRACES},
+      {"batch-concurrency", required_argument, nullptr, OPT_BATCH_CONCURRENCY},
+      {"batch-max-mb", required_argument, nullptr, OPT_BATCH_MAX_MB},
+      {"batch-merge-query", required_argument, nullptr,
+       OPT_BATCH_MERGE_QUERY},
       {"stdiod", no_argument, nullptr, OPT_STDIOD},
+      {"attach", required_argument, nullptr, OPT_ATTACH},
+      {"test-host", no_argument, nullptr, OPT_TEST_HOST},
+      {"test-host-jobs", required_argument, nullptr, OPT_TEST_HOST_JOBS},
       {"interactive", no_argument, nullptr, 'i'},
       {"export", required_argument, nullptr, 'e'},
+      {"write-trace-index", required_argument, nullptr, OPT_WRITE_TRACE_INDEX},
       {"metatrace", required_argument, nullptr, 'm'},
       {"metatrace-buffer-capacity", required_argument, nullptr,
        OPT_METATRACE_BUFFER_CAPACITY},
       {"metatrace-categories", required_argument, nullptr,
        OPT_METATRACE_CATEGORIES},
       {"full-sort", no_argument, nullptr, OPT_FORCE_FULL_SORT},
+      {"spill-to-disk", no_argument, nullptr, OPT_SPILL_TO_DISK},
+      {"print-ingestion-profile", no_argument, nullptr,
+       OPT_PRINT_INGESTION_PROFILE},
+      {"query-result-cache", no_argument, nullptr, OPT_QUERY_RESULT_CACHE},
+      {"query-profile", no_argument, nullptr, OPT_QUERY_PROFILE},
+      {"lazy-module-tables", no_argument, nullptr, OPT_LAZY_MODULE_TABLES},
       {"no-ftrace-raw", no_argument, nullptr, OPT_NO_FTRACE_RAW},
+      {"lazy-ftrace-raw", no_argument, nullptr, OPT_LAZY_FTRACE_RAW},
       {"analyze-trace-proto-content", no_argument, nullptr,
        OPT_ANALYZE_TRACE_PROTO_CONTENT},
       {"crop-track-events", no_argument, nullptr, OPT_CROP_TRACK_EVENTS},
+      {"tokenizer-threads", required_argument, nullptr, OPT_TOKENIZER_THREADS},
+      {"span-join-threads", required_argument, nullptr, OPT_SPAN_JOIN_THREADS},
+      {"heap-graph-threads", required_argument, nullptr,
+       OPT_HEAP_GRAPH_THREADS},
+      {"memory-budget-mb", required_argument, nullptr, OPT_MEMORY_BUDGET_MB},
+      {"query-timeout-ms", required_argument, nullptr, OPT_QUERY_TIMEOUT_MS},
+      {"read-ahead-chunks", required_argument, nullptr,
+       OPT_READ_AHEAD_CHUNKS},
       {"dev", no_argument, nullptr, OPT_DEV},
       {"add-sql-module", required_argument, nullptr, OPT_ADD_SQL_MODULE},
       {"override-sql-module", required_argument, nullptr,
@@ -840,6 +1176,8 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       {"pre-metrics", required_argument, nullptr, OPT_PRE_METRICS},
       {"metrics-output", required_argument, nullptr, OPT_METRICS_OUTPUT},
       {"metric-extension", required_argument, nullptr, OPT_METRIC_EXTENSION},
+      {"print-metrics-profile", no_argument, nullptr,
+       OPT_PRINT_METRICS_PROFILE},
       {"dev-flag", required_argument, nullptr, OPT_DEV_FLAG},
       {nullptr, 0, nullptr, 0}};
 
@@ -887,11 +1225,111 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_HTTPD_MULTI_TRACE) {
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
+      command_line_options.enable_httpd = true;
+      command_line_options.httpd_multi_trace = true;
+#else
+      PERFETTO_FATAL("HTTP RPC module not supported in this build");
+#endif
+      continue;
+    }
+
+    if (option == OPT_HTTPD_IDLE_TIMEOUT) {
+      std::optional<uint32_t> secs = base::CStringToUInt32(optarg);
+      if (!secs || *secs > UINT32_MAX / 1000) {
+        PERFETTO_ELOG("Invalid --httpd-idle-timeout-s value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.httpd_idle_timeout_ms = *secs * 1000;
+      continue;
+    }
+
+    if (option == OPT_HTTPD_MAX_TRACE_MB) {
+      std::optional<uint32_t> mb = base::CStringToUInt32(optarg);
+      if (!mb || *mb == 0) {
+        PERFETTO_ELOG("Invalid --httpd-max-trace-mb value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.httpd_max_trace_bytes =
+          static_cast<uint64_t>(*mb) * 1024 * 1024;
+      continue;
+    }
+
+    if (option == OPT_HTTPD_MAX_TRACES) {
+      std::optional<uint32_t> traces = base::CStringToUInt32(optarg);
+      if (!traces || *traces == 0) {
+        PERFETTO_ELOG("Invalid --httpd-max-traces value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.httpd_max_traces = *traces;
+      continue;
+    }
+
+    if (option == OPT_BATCH_TRACES) {
+      command_line_options.batch_traces_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_BATCH_CONCURRENCY) {
+      std::optional<uint32_t> concurrency = base::CStringToUInt32(optarg);
+      if (!concurrency || *concurrency == 0) {
+        PERFETTO_ELOG("Invalid --batch-concurrency value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.batch_concurrency = *concurrency;
+      continue;
+    }
+
+    if (option == OPT_BATCH_MAX_MB) {
+      std::optional<uint32_t> mb = base::CStringToUInt32(optarg);
+      if (!mb || *mb == 0) {
+        PERFETTO_ELOG("Invalid --batch-max-mb value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.batch_max_bytes =
+          static_cast<uint64_t>(*mb) * 1024 * 1024;
+      continue;
+    }
+
+    if (option == OPT_BATCH_MERGE_QUERY) {
+      command_line_options.batch_merge_query_path = optarg;
+      continue;
+    }
+
     if (option == OPT_STDIOD) {
       command_line_options.enable_stdiod = true;
       continue;
     }
 
+    if (option == OPT_TEST_HOST) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+      command_line_options.test_host = true;
+#else
+      PERFETTO_FATAL("--test-host is not supported on Windows");
+#endif
+      continue;
+    }
+
+    if (option == OPT_TEST_HOST_JOBS) {
+      std::optional<uint32_t> jobs = base::CStringToUInt32(optarg);
+      if (!jobs || *jobs == 0) {
+        PERFETTO_ELOG("Invalid --test-host-jobs value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.test_host_jobs = *jobs;
+      continue;
+    }
+
+    if (option == OPT_ATTACH) {
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_LIVE)
+      command_line_options.attach_session_key = optarg;
+#else
+      PERFETTO_FATAL("Live trace loading not supported in this build");
+#endif
+      continue;
+    }
+
     if (option == 'i') {
       explicit_interactive = true;
       continue;
@@ -902,6 +1340,16 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_ARROW_OUTPUT) {
+      command_line_options.arrow_output_path = optarg;
+      continue;
+    }
+
+    if (option == OPT_WRITE_TRACE_INDEX) {
+      command_line_options.trace_index_path = optarg;
+      continue;
+    }
+
     if (option == 'm') {
       command_line_options.metatrace_path = optarg;
       continue;
@@ -924,11 +1372,41 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_SPILL_TO_DISK) {
+      command_line_options.spill_to_disk = true;
+      continue;
+    }
+
+    if (option == OPT_PRINT_INGESTION_PROFILE) {
+      command_line_options.print_ingestion_profile = true;
+      continue;
+    }
+
+    if (option == OPT_QUERY_RESULT_CACHE) {
+      command_line_options.query_result_cache = true;
+      continue;
+    }
+
+    if (option == OPT_QUERY_PROFILE) {
+      command_line_options.print_query_profile = true;
+      continue;
+    }
+
+    if (option == OPT_LAZY_MODULE_TABLES) {
+      command_line_options.lazy_module_tables = true;
+      continue;
+    }
+
     if (option == OPT_NO_FTRACE_RAW) {
       command_line_options.no_ftrace_raw = true;
       continue;
     }
 
+    if (option == OPT_LAZY_FTRACE_RAW) {
+      command_line_options.lazy_ftrace_raw = true;
+      continue;
+    }
+
     if (option == OPT_ANALYZE_TRACE_PROTO_CONTENT) {
       command_line_options.analyze_trace_proto_content = true;
       continue;
@@ -939,6 +1417,66 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_TOKENIZER_THREADS) {
+      std::optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads || *threads == 0) {
+        PERFETTO_ELOG("Invalid --tokenizer-threads value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.tokenizer_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_SPAN_JOIN_THREADS) {
+      std::optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads || *threads == 0) {
+        PERFETTO_ELOG("Invalid --span-join-threads value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.span_join_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_HEAP_GRAPH_THREADS) {
+      std::optional<uint32_t> threads = base::CStringToUInt32(optarg);
+      if (!threads || *threads == 0) {
+        PERFETTO_ELOG("Invalid --heap-graph-threads value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.heap_graph_threads = *threads;
+      continue;
+    }
+
+    if (option == OPT_MEMORY_BUDGET_MB) {
+      std::optional<uint64_t> mb = base::CStringToUInt64(optarg);
+      if (!mb || *mb == 0) {
+        PERFETTO_ELOG("Invalid --memory-budget-mb value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.memory_budget_mb = *mb;
+      continue;
+    }
+
+    if (option == OPT_QUERY_TIMEOUT_MS) {
+      std::optional<uint32_t> ms = base::CStringToUInt32(optarg);
+      if (!ms || *ms == 0) {
+        PERFETTO_ELOG("Invalid --query-timeout-ms value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.query_timeout_ms = *ms;
+      continue;
+    }
+
+    if (option == OPT_READ_AHEAD_CHUNKS) {
+      std::optional<uint32_t> chunks = base::CStringToUInt32(optarg);
+      if (!chunks || *chunks == 0) {
+        PERFETTO_ELOG("Invalid --read-ahead-chunks value: %s", optarg);
+        exit(1);
+      }
+      command_line_options.read_ahead_chunks = *chunks;
+      continue;
+    }
+
     if (option == OPT_DEV) {
       command_line_options.dev = true;
       continue;
@@ -979,6 +1517,11 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       continue;
     }
 
+    if (option == OPT_PRINT_METRICS_PROFILE) {
+      command_line_options.print_metrics_profile = true;
+      continue;
+    }
+
     if (option == OPT_DEV_FLAG) {
       command_line_options.dev_flags.push_back(optarg);
       continue;
@@ -992,7 +1535,8 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
       explicit_interactive || (command_line_options.pre_metrics_path.empty() &&
                                command_line_options.metric_names.empty() &&
                                command_line_options.query_file_path.empty() &&
-                               command_line_options.sqlite_file_path.empty());
+                               command_line_options.sqlite_file_path.empty() &&
+                               command_line_options.trace_index_path.empty());
 
   // Only allow non-interactive queries to emit perf data.
   if (!command_line_options.perf_file_path.empty() &&
@@ -1001,6 +1545,60 @@ CommandLineOptions ParseCommandLineOptions(int argc, char** argv) {
     exit(1);
   }
 
+  // The Arrow output is only for the query file.
+  if (!command_line_options.arrow_output_path.empty() &&
+      command_line_options.query_file_path.empty()) {
+    PrintUsage(argv);
+    exit(1);
+  }
+
+  // Batch mode runs the query file over the traces listed in a file.
+  if (!command_line_options.batch_merge_query_path.empty() &&
+      command_line_options.batch_traces_path.empty()) {
+    PrintUsage(argv);
+    exit(1);
+  }
+  if (!command_line_options.batch_traces_path.empty()) {
+    if (command_line_options.query_file_path.empty() ||
+        optind != argc || command_line_options.enable_httpd ||
+        command_line_options.enable_stdiod || explicit_interactive) {
+      PrintUsage(argv);
+      exit(1);
+    }
+    return command_line_options;
+  }
+
+  // In test host mode, the queries and metrics are given for each test.
+  if (command_line_options.test_host_jobs && !command_line_options.test_host) {
+    PrintUsage(argv);
+    exit(1);
+  }
+  if (command_line_options.test_host &&
+      (!command_line_options.query_file_path.empty() ||
+       !command_line_options.metric_names.empty() ||
+       !command_line_options.perf_file_path.empty() ||
+       command_line_options.enable_httpd ||
+       command_line_options.enable_stdiod || explicit_interactive)) {
+    PrintUsage(argv);
+    exit(1);
+  }
+
+  // Attaching to a tracing session loads the trace from the tracing service
+  // while the shell is running.
+  if (!command_line_options.attach_session_key.empty()) {
+    if (!command_line_options.query_file_path.empty() ||
+        !command_line_options.metric_names.empty() ||
+        !command_line_options.pre_metrics_path.empty() ||
+        !command_line_options.sqlite_file_path.empty() ||
+        !command_line_options.trace_index_path.empty() || optind != argc ||
+        command_line_options.enable_httpd ||
+        command_line_options.enable_stdiod) {
+      PrintUsage(argv);
+      exit(1);
+    }
+    return command_line_options;
+  }
+
   // The only case where we allow omitting the trace file path is when running
   // in --httpd or --stdiod mode. In all other cases, the last argument must be
   // the trace file.
@@ -1079,7 +1677,8 @@ base::Status LoadTrace(const std::string& trace_file_path, double* size_mb) {
 }
 
 base::Status RunQueries(const std::string& query_file_path,
-                        bool expect_output) {
+                        bool expect_output,
+                        const std::string& arrow_output_path) {
   std::string queries;
   if (!base::ReadFile(query_file_path.c_str(), &queries)) {
     return base::ErrStatus("Unable to read file %s", query_file_path.c_str());
@@ -1087,7 +1686,7 @@ base::Status RunQueries(const std::string& query_file_path,
 
   base::Status status;
   if (expect_output) {
-    status = RunQueriesAndPrintResult(queries, stdout);
+    status = RunQueriesAndPrintResult(queries, arrow_output_path, stdout);
   } else {
     status = RunQueriesWithoutOutput(queries);
   }
@@ -1097,6 +1696,47 @@ base::Status RunQueries(const std::string& query_file_path,
   return base::OkStatus();
 }
 
+base::Status RunBatch(const CommandLineOptions& options, const Config& config) {
+  std::string traces;
+  if (!base::ReadFile(options.batch_traces_path, &traces)) {
+    return base::ErrStatus("Unable to read file %s",
+                           options.batch_traces_path.c_str());
+  }
+  std::vector<std::string> trace_paths;
+  for (base::StringSplitter ss(std::move(traces), '\n'); ss.Next();) {
+    std::string path = base::TrimWhitespace(ss.cur_token());
+    if (!path.empty())
+      trace_paths.emplace_back(std::move(path));
+  }
+
+  std::string sql;
+  if (!base::ReadFile(options.query_file_path, &sql)) {
+    return base::ErrStatus("Unable to read file %s",
+                           options.query_file_path.c_str());
+  }
+
+  BatchQueryConfig batch_config;
+  batch_config.config = config;
+  batch_config.concurrency =
+      options.batch_concurrency
+          ? options.batch_concurrency
+          : std::max(1u, std::thread::hardware_concurrency());
+  batch_config.max_loaded_bytes = options.batch_max_bytes;
+  if (!options.batch_merge_query_path.empty() &&
+      !base::ReadFile(options.batch_merge_query_path,
+                      &batch_config.merge_sql)) {
+    return base::ErrStatus("Unable to read file %s",
+                           options.batch_merge_query_path.c_str());
+  }
+
+  base::TimeNanos t_start = base::GetWallTimeNs();
+  base::Status status = RunBatchQueries(batch_config, trace_paths, sql, stdout);
+  double t_s =
+      static_cast<double>((base::GetWallTimeNs() - t_start).count()) / 1E9;
+  PERFETTO_ILOG("Processed %zu traces in %.2fs", trace_paths.size(), t_s);
+  return status;
+}
+
 base::Status ParseSingleMetricExtensionPath(bool dev,
                                             const std::string& raw_extension,
                                             MetricExtension& parsed_extension) {
@@ -1432,6 +2072,8 @@ struct InteractiveOptions {
   std::vector<MetricExtension> extensions;
   std::vector<MetricNameAndPath> metrics;
   const google::protobuf::DescriptorPool* pool;
+  // If set, held while running each command (see LiveTraceReader).
+  std::mutex* trace_mutex = nullptr;
 };
 
 base::Status StartInteractiveShell(const InteractiveOptions& options) {
@@ -1446,6 +2088,9 @@ base::Status StartInteractiveShell(const InteractiveOptions& options) {
       printf("If you want to quit either type .q or press CTRL-D (EOF)\n");
       continue;
     }
+    std::unique_lock<std::mutex> trace_lock;
+    if (options.trace_mutex)
+      trace_lock = std::unique_lock<std::mutex>(*options.trace_mutex);
     if (line.get()[0] == '.') {
       char command[32] = {};
       char arg[1024] = {};
@@ -1460,7 +2105,7 @@ base::Status StartInteractiveShell(const InteractiveOptions& options) {
       } else if (strcmp(command, "reset") == 0) {
         g_tp->RestoreInitialTables();
       } else if (strcmp(command, "read") == 0 && strlen(arg)) {
-        base::Status status = RunQueries(arg, true);
+        base::Status status = RunQueries(arg, true, "");
         if (!status.ok()) {
           PERFETTO_ELOG("%s", status.c_message());
         }
@@ -1549,19 +2194,182 @@ base::Status MaybeUpdateSqlModules(const CommandLineOptions& options) {
   return base::OkStatus();
 }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+// Runs a test of --test-host mode. This is in a process forked after the trace
+// was loaded: it sees the tables of the host, while what the test changes
+// (e.g. the modules it includes) is discarded when the process exits.
+base::Status RunHostedTest(const CommandLineOptions& test,
+                           google::protobuf::DescriptorPool& pool,
+                           base::TimeNanos t_load) {
+  base::TimeNanos t_query_start = base::GetWallTimeNs();
+  if (!test.metric_names.empty()) {
+    std::vector<MetricNameAndPath> metrics;
+    RETURN_IF_ERROR(LoadMetrics(test.metric_names, pool, metrics));
+    RETURN_IF_ERROR(RunMetrics(metrics, ParseOutputFormat(test)));
+  }
+  if (!test.query_file_path.empty())
+    RETURN_IF_ERROR(RunQueries(test.query_file_path, true, ""));
+  base::TimeNanos t_query = base::GetWallTimeNs() - t_query_start;
+  if (!test.perf_file_path.empty())
+    RETURN_IF_ERROR(PrintPerfFile(test.perf_file_path, t_load, t_query));
+  return base::OkStatus();
+}
+
+// Parses a line of --test-host mode (see PrintUsage()) into |test|, on top of
+// the options of the host.
+base::Status ParseHostedTest(const std::string& line,
+                             std::string* id,
+                             std::string* stdout_path,
+                             std::string* stderr_path,
+                             CommandLineOptions* test) {
+  std::vector<std::string> fields = base::SplitString(line, "\t");
+  if (fields.size() < 3 || (fields.size() - 3) % 2 != 0)
+    return base::ErrStatus("Invalid test: '%s'", line.c_str());
+  *id = fields[0];
+  *stdout_path = fields[1];
+  *stderr_path = fields[2];
+  for (size_t i = 3; i < fields.size(); i += 2) {
+    const std::string& value = fields[i + 1];
+    if (fields[i] == "-q") {
+      test->query_file_path = value;
+    } else if (fields[i] == "--run-metrics") {
+      test->metric_names = value;
+    } else if (fields[i] == "--metrics-output") {
+      test->metric_output = value;
+    } else if (fields[i] == "--perf-file") {
+      test->perf_file_path = value;
+    } else {
+      return base::ErrStatus("Invalid option for test %s: %s", id->c_str(),
+                             fields[i].c_str());
+    }
+  }
+  return base::OkStatus();
+}
+
+// Reads tests from stdin and runs each in a forked process, with up to
+// |options.test_host_jobs| running at the same time. Forking is what makes the
+// tests share the trace loaded once by this process: pages are only copied
+// when written.
+base::Status RunTestHost(const CommandLineOptions& options,
+                         google::protobuf::DescriptorPool& pool,
+                         base::TimeNanos t_load) {
+  const uint32_t jobs = options.test_host_jobs
+                            ? options.test_host_jobs
+                            : std::max(1u, std::thread::hardware_concurrency());
+  std::unordered_map<pid_t, std::string> running;  // pid -> test id.
+  auto wait_for_test = [&running] {
+    int wstatus = 0;
+    pid_t pid = PERFETTO_EINTR(waitpid(-1, &wstatus, 0));
+    PERFETTO_CHECK(pid > 0);
+    auto it = running.find(pid);
+    PERFETTO_CHECK(it != running.end());
+    int exit_code = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                                       : 128 + WTERMSIG(wstatus);
+    printf("%s %d\n", it->second.c_str(), exit_code);
+    fflush(stdout);
+    running.erase(it);
+  };
+
+  base::Status status;
+  char* line = nullptr;
+  size_t line_capacity = 0;
+  for (ssize_t len; (len = getline(&line, &line_capacity, stdin)) > 0;) {
+    std::string trimmed =
+        base::TrimWhitespace(std::string(line, static_cast<size_t>(len)));
+    if (trimmed.empty())
+      continue;
+    std::string id;
+    std::string stdout_path;
+    std::string stderr_path;
+    CommandLineOptions test = options;
+    status = ParseHostedTest(trimmed, &id, &stdout_path, &stderr_path, &test);
+    if (!status.ok())
+      break;
+
+    if (running.size() >= jobs)
+      wait_for_test();
+
+    // Not to print the buffered output of the host from the test too.
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    PERFETTO_CHECK(pid >= 0);
+    if (pid == 0) {
+      base::ScopedFile out_fd(base::OpenFile(stdout_path, O_WRONLY | O_CREAT |
+                                                              O_TRUNC, 0644));
+      base::ScopedFile err_fd(base::OpenFile(stderr_path, O_WRONLY | O_CREAT |
+                                                              O_TRUNC, 0644));
+      if (!out_fd || !err_fd) {
+        PERFETTO_PLOG("Failed to open the output files of test %s", id.c_str());
+        _exit(1);
+      }
+      PERFETTO_CHECK(dup2(*out_fd, STDOUT_FILENO) != -1);
+      PERFETTO_CHECK(dup2(*err_fd, STDERR_FILENO) != -1);
+      base::Status test_status = RunHostedTest(test, pool, t_load);
+      if (!test_status.ok())
+        fprintf(stderr, "%s\n", test_status.c_message());
+      fflush(stdout);
+      fflush(stderr);
+      // Skips the destruction of the trace processor instance, which is only
+      // a copy of the host's.
+      _exit(test_status.ok() ? 0 : 1);
+    }
+    running.emplace(pid, std::move(id));
+  }
+  free(line);
+
+  while (!running.empty())
+    wait_for_test();
+  return status;
+}
+#endif  // !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+
 base::Status TraceProcessorMain(int argc, char** argv) {
   CommandLineOptions options = ParseCommandLineOptions(argc, argv);
 
+  // In multi-trace mode the traces are pushed by the clients, each into its
+  // own TraceProcessor instance: there is nothing to load upfront.
+  if (options.httpd_multi_trace) {
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_HTTPD)
+#if PERFETTO_HAS_SIGNAL_H()
+    signal(SIGINT, SIG_DFL);
+#endif
+    TraceInstancePool::Config pool_config;
+    if (options.httpd_idle_timeout_ms)
+      pool_config.idle_timeout_ms = *options.httpd_idle_timeout_ms;
+    pool_config.max_trace_bytes = options.httpd_max_trace_bytes;
+    pool_config.max_instances = options.httpd_max_traces;
+    RunMultiTraceHttpRPCServer(options.port_number, pool_config);
+    PERFETTO_FATAL("Should never return");
+#endif
+  }
+
   Config config;
   config.sorting_mode = options.force_full_sort
                             ? SortingMode::kForceFullSort
                             : SortingMode::kDefaultHeuristics;
   config.ingest_ftrace_in_raw_table = !options.no_ftrace_raw;
+  config.lazy_ftrace_raw_args = options.lazy_ftrace_raw;
   config.analyze_trace_proto_content = options.analyze_trace_proto_content;
   config.drop_track_event_data_before =
       options.crop_track_events
           ? DropTrackEventDataBefore::kTrackEventRangeOfInterest
           : DropTrackEventDataBefore::kNoDrop;
+  config.tokenizer_thread_count = options.tokenizer_threads;
+  config.span_join_thread_count = options.span_join_threads;
+  config.heap_graph_thread_count = options.heap_graph_threads;
+  config.memory_budget_bytes = options.memory_budget_mb * 1024 * 1024;
+  config.query_timeout_ms = options.query_timeout_ms;
+  config.read_ahead_chunks = options.read_ahead_chunks;
+  config.spill_full_sort_to_disk = options.spill_to_disk;
+  config.enable_ingestion_profile = options.print_ingestion_profile;
+  config.enable_query_result_cache = options.query_result_cache;
+  config.enable_sql_profile = options.print_query_profile;
+  config.enable_lazy_module_tables = options.lazy_module_tables;
+  // fork() only duplicates the calling thread: the forked tests couldn't use
+  // the thread pool of the host.
+  if (options.test_host)
+    config.span_join_thread_count = 1;
 
   std::vector<MetricExtension> metric_extensions;
   RETURN_IF_ERROR(ParseMetricExtensionPaths(
@@ -1583,6 +2391,9 @@ base::Status TraceProcessorMain(int argc, char** argv) {
     }
   }
 
+  if (!options.batch_traces_path.empty())
+    return RunBatch(options, config);
+
   std::unique_ptr<TraceProcessor> tp = TraceProcessor::CreateInstance(config);
   g_tp = tp.get();
 
@@ -1630,8 +2441,34 @@ base::Status TraceProcessorMain(int argc, char** argv) {
                   t_load_s, size_mb / t_load_s);
 
     RETURN_IF_ERROR(PrintStats());
+    if (options.print_ingestion_profile)
+      RETURN_IF_ERROR(PrintIngestionProfile());
+    if (!options.trace_index_path.empty()) {
+      RETURN_IF_ERROR(
+          WriteTraceIndex(options.trace_index_path, options.trace_file_path));
+    }
   }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (options.test_host)
+    return RunTestHost(options, pool, t_load);
+#endif
+
+  std::mutex* trace_mutex = nullptr;
+#if PERFETTO_BUILDFLAG(PERFETTO_TP_LIVE)
+  std::unique_ptr<LiveTraceReader> live_reader;
+  if (!options.attach_session_key.empty()) {
+    live_reader = std::make_unique<LiveTraceReader>(
+        tp.get(), LiveTraceReaderConfig{options.attach_session_key});
+    RETURN_IF_ERROR(live_reader->Start());
+    PERFETTO_ILOG(
+        "Attached to tracing session '%s': the trace is loaded as it is "
+        "recorded, SELECT ingestion_watermark() to see how far",
+        options.attach_session_key.c_str());
+    trace_mutex = live_reader->mutex();
+  }
+#endif
+
 #if PERFETTO_HAS_SIGNAL_H()
   // Set up interrupt signal to allow the user to abort query.
   signal(SIGINT, [](int) { g_tp->InterruptQuery(); });
@@ -1639,7 +2476,7 @@ base::Status TraceProcessorMain(int argc, char** argv) {
 
   base::TimeNanos t_query_start = base::GetWallTimeNs();
   if (!options.pre_metrics_path.empty()) {
-    RETURN_IF_ERROR(RunQueries(options.pre_metrics_path, false));
+    RETURN_IF_ERROR(RunQueries(options.pre_metrics_path, false, ""));
   }
 
   std::vector<MetricNameAndPath> metrics;
@@ -1650,10 +2487,13 @@ base::Status TraceProcessorMain(int argc, char** argv) {
   OutputFormat metric_format = ParseOutputFormat(options);
   if (!metrics.empty()) {
     RETURN_IF_ERROR(RunMetrics(metrics, metric_format));
+    if (options.print_metrics_profile)
+      RETURN_IF_ERROR(PrintMetricsProfile());
   }
 
   if (!options.query_file_path.empty()) {
-    base::Status status = RunQueries(options.query_file_path, true);
+    base::Status status = RunQueries(options.query_file_path, true,
+                                     options.arrow_output_path);
     if (!status.ok()) {
       // Write metatrace if needed before exiting.
       RETURN_IF_ERROR(MaybeWriteMetatrace(options.metatrace_path));
@@ -1661,6 +2501,9 @@ base::Status TraceProcessorMain(int argc, char** argv) {
     }
   }
   base::TimeNanos t_query = base::GetWallTimeNs() - t_query_start;
+  if (options.print_query_profile) {
+    RETURN_IF_ERROR(PrintQueryProfile());
+  }
 
   if (!options.sqlite_file_path.empty()) {
     RETURN_IF_ERROR(ExportTraceToDatabase(options.sqlite_file_path));
@@ -1697,7 +2540,7 @@ base::Status TraceProcessorMain(int argc, char** argv) {
   if (options.launch_shell) {
     RETURN_IF_ERROR(StartInteractiveShell(
         InteractiveOptions{options.wide ? 40u : 20u, metric_format,
-                           metric_extensions, metrics, &pool}));
+                           metric_extensions, metrics, &pool, trace_mutex}));
   } else if (!options.perf_file_path.empty()) {
     RETURN_IF_ERROR(PrintPerfFile(options.perf_file_path, t_load, t_query));
   }
@@ -27,14 +27,17 @@
 #include "src/trace_processor/importers/common/clock_tracker.h"
 #include "src/trace_processor/importers/common/event_tracker.h"
 #include "src/trace_processor/importers/common/flow_tracker.h"
+#include "src/trace_processor/importers/common/ingestion_profiler.h"
 #include "src/trace_processor/importers/common/machine_tracker.h"
 #include "src/trace_processor/importers/common/mapping_tracker.h"
+#include "src/trace_processor/importers/common/memory_budget.h"
 #include "src/trace_processor/importers/common/metadata_tracker.h"
 #include "src/trace_processor/importers/common/process_tracker.h"
 #include "src/trace_processor/importers/common/sched_event_tracker.h"
 #include "src/trace_processor/importers/common/slice_tracker.h"
 #include "src/trace_processor/importers/common/slice_translation_table.h"
 #include "src/trace_processor/importers/common/stack_profile_tracker.h"
+#include "src/trace_processor/importers/common/thread_state_tracker.h"
 #include "src/trace_processor/importers/common/track_tracker.h"
 #include "src/trace_processor/importers/proto/chrome_track_event.descriptor.h"
 #include "src/trace_processor/importers/proto/default_modules.h"
@@ -85,6 +88,10 @@ util::Status TraceProcessorStorageImpl::Parse(TraceBlobView blob) {
 
   util::Status status = context_.chunk_reader->Parse(std::move(blob));
   unrecoverable_parse_error_ |= !status.ok();
+  if (context_.memory_budget) {
+    context_.memory_budget->Update(
+        context_.sorter ? context_.sorter->memory_usage() : 0);
+  }
   return status;
 }
 
@@ -94,6 +101,8 @@ void TraceProcessorStorageImpl::Flush() {
 
   if (context_.sorter)
     context_.sorter->ExtractEventsForced();
+  if (context_.thread_state_tracker)
+    ThreadStateTracker::GetOrCreate(&context_)->Flush();
   context_.args_tracker->Flush();
 }
 
@@ -101,6 +110,9 @@ void TraceProcessorStorageImpl::NotifyEndOfFile() {
   if (unrecoverable_parse_error_ || !context_.chunk_reader)
     return;
   Flush();
+  auto sample = IngestionProfiler::SampleNamed(
+      context_.ingestion_profiler.get(), IngestionProfiler::Phase::kFlush,
+      "notify_end_of_file");
   context_.chunk_reader->NotifyEndOfFile();
   for (std::unique_ptr<ProtoImporterModule>& module : context_.modules) {
     module->NotifyEndOfFile();
@@ -112,6 +124,9 @@ void TraceProcessorStorageImpl::NotifyEndOfFile() {
   context_.slice_tracker->FlushPendingSlices();
   context_.args_tracker->Flush();
   context_.process_tracker->NotifyEndOfFile();
+  // All the events have now left the sorter and been added to the tables.
+  if (context_.memory_budget)
+    context_.memory_budget->Update(0);
 }
 
 void TraceProcessorStorageImpl::DestroyContext() {
@@ -126,6 +141,16 @@ void TraceProcessorStorageImpl::DestroyContext() {
   // kernel version (inside system_info_tracker) to know how to textualise
   // sched_switch.prev_state bitflags.
   context.system_info_tracker = std::move(context_.system_info_tracker);
+  // The typed ftrace args deferred by |Config::lazy_ftrace_raw_args| are
+  // decoded on the first query which needs them: this requires the args
+  // trackers to stay around.
+  if (context_.lazy_ftrace_raw_args) {
+    context.lazy_ftrace_raw_args = std::move(context_.lazy_ftrace_raw_args);
+    context.global_args_tracker = std::move(context_.global_args_tracker);
+  }
+  // The memory budget keeps refusing new PERFETTO TABLEs once the trace is
+  // loaded.
+  context.memory_budget = std::move(context_.memory_budget);
 
   context_ = std::move(context);
 
@@ -57,9 +57,11 @@ class FtraceModule;
 class FuchsiaRecordParser;
 class GlobalArgsTracker;
 class HeapGraphTracker;
+class IngestionProfiler;
 class JsonTraceParser;
 class MachineTracker;
 class MappingTracker;
+class MemoryBudget;
 class MetadataTracker;
 class MultiMachineTraceManager;
 class PacketAnalyzer;
@@ -105,6 +107,14 @@ class TraceProcessorContext {
   // multiple machines.
   std::shared_ptr<TraceSorter> sorter;
 
+  // Only set if |config.enable_ingestion_profile| is true. Shared among
+  // multiple machines, like the sorter.
+  std::shared_ptr<IngestionProfiler> ingestion_profiler;
+
+  // Only set if |config.memory_budget_bytes| is greater than zero. Shared
+  // among multiple machines, like the sorter.
+  std::shared_ptr<MemoryBudget> memory_budget;
+
   // Keep the global tracker before the args tracker as we access the global
   // tracker in the destructor of the args tracker. Also keep it before other
   // trackers, as they may own ArgsTrackers themselves.
@@ -151,6 +161,7 @@ class TraceProcessorContext {
   std::unique_ptr<Destructible> ftrace_sched_tracker;      // FtraceSchedEventTracker
   std::unique_ptr<Destructible> v8_tracker;                // V8Tracker
   std::unique_ptr<Destructible> jit_tracker;               // JitTracker
+  std::unique_ptr<Destructible> lazy_ftrace_raw_args;      // LazyFtraceRawArgs
   // clang-format on
 
   // These fields are trace readers which will be called by |forwarding_parser|
@@ -19,10 +19,22 @@
 #include <limits>
 #include <optional>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/utils.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define PERFETTO_BUMP_ALLOCATOR_CAN_SPILL() 1
+#else
+#define PERFETTO_BUMP_ALLOCATOR_CAN_SPILL() 0
+#endif
+
 namespace perfetto {
 namespace trace_processor {
 namespace {
@@ -45,6 +57,11 @@ BumpAllocator::~BumpAllocator() {
   for (const auto& chunk : chunks_) {
     PERFETTO_CHECK(chunk.unfreed_allocations == 0);
   }
+  while (!spill_regions_.empty()) {
+    PERFETTO_ASAN_UNPOISON(spill_regions_.front().mapping.data(),
+                           kSpillRegionSize);
+    spill_regions_.pop_front();
+  }
 }
 
 BumpAllocator::AllocId BumpAllocator::Alloc(uint32_t size) {
@@ -63,7 +80,13 @@ BumpAllocator::AllocId BumpAllocator::Alloc(uint32_t size) {
 
   // Slow path: we don't have enough space in the last chunk so we create one.
   Chunk chunk;
-  chunk.allocation = Allocate(kChunkSize);
+  if (spill_file_) {
+    chunk.data = AllocSpilledChunk();
+  }
+  if (!chunk.data) {
+    chunk.allocation = Allocate(kChunkSize);
+    chunk.data = chunk.allocation.get();
+  }
   chunks_.emplace_back(std::move(chunk));
 
   // Ensure that we haven't exceeded the maximum number of chunks.
@@ -87,23 +110,30 @@ void BumpAllocator::Free(AllocId id) {
 void* BumpAllocator::GetPointer(AllocId id) {
   uint64_t queue_index = ChunkIndexToQueueIndex(id.chunk_index);
   PERFETTO_CHECK(queue_index <= std::numeric_limits<size_t>::max());
-  return chunks_.at(static_cast<size_t>(queue_index)).allocation.get() +
-         id.chunk_offset;
+  return chunks_.at(static_cast<size_t>(queue_index)).data + id.chunk_offset;
 }
 
 uint64_t BumpAllocator::EraseFrontFreeChunks() {
   size_t to_erase_chunks = 0;
   for (; to_erase_chunks < chunks_.size(); ++to_erase_chunks) {
     // Break on the first chunk which still has unfreed allocations.
-    if (chunks_.at(to_erase_chunks).unfreed_allocations > 0) {
+    const Chunk& chunk = chunks_.at(to_erase_chunks);
+    if (chunk.unfreed_allocations > 0) {
       break;
     }
+    if (!chunk.allocation) {
+      EraseSpilledChunk();
+    }
   }
   chunks_.erase_front(to_erase_chunks);
   erased_front_chunks_count_ += to_erase_chunks;
   return to_erase_chunks;
 }
 
+uint64_t BumpAllocator::memory_usage() const {
+  return (chunks_.size() - live_spilled_chunks_) * kChunkSize;
+}
+
 BumpAllocator::AllocId BumpAllocator::PastTheEndId() {
   if (chunks_.empty()) {
     return AllocId{erased_front_chunks_count_, 0};
@@ -114,6 +144,88 @@ BumpAllocator::AllocId BumpAllocator::PastTheEndId() {
   return AllocId{LastChunkIndex(), chunks_.back().bump_offset};
 }
 
+bool BumpAllocator::SetSpillFile(base::ScopedFile file) {
+  PERFETTO_DCHECK(file);
+  PERFETTO_DCHECK(!spill_file_);
+#if PERFETTO_BUMP_ALLOCATOR_CAN_SPILL()
+  spill_file_ = std::move(file);
+  spill_file_size_ = 0;
+  return true;
+#else
+  base::ignore_result(file);
+  return false;
+#endif
+}
+
+uint8_t* BumpAllocator::AllocSpilledChunk() {
+#if PERFETTO_BUMP_ALLOCATOR_CAN_SPILL()
+  if (spill_regions_.empty() ||
+      spill_regions_.back().carved_chunks == kChunksPerSpillRegion) {
+    auto offset = static_cast<off_t>(spill_file_size_);
+    auto size = static_cast<off_t>(kSpillRegionSize);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+    bool grown = ftruncate(*spill_file_, offset + size) == 0;
+#else
+    // Reserve the space upfront: running out of disk space while writing to a
+    // sparse file through a mapping would cause a SIGBUS.
+    bool grown = posix_fallocate(*spill_file_, offset, size) == 0;
+#endif
+    if (!grown) {
+      PERFETTO_ELOG("Failed to grow the spill file, using heap memory");
+      return nullptr;
+    }
+    void* ptr = mmap(nullptr, kSpillRegionSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED, *spill_file_, offset);
+    if (ptr == MAP_FAILED) {
+      PERFETTO_PLOG("Failed to map the spill file, using heap memory");
+      return nullptr;
+    }
+    SpillRegion region;
+    region.mapping =
+        base::ScopedMmap::InheritMmappedRange(ptr, kSpillRegionSize);
+    region.file_offset = spill_file_size_;
+    spill_file_size_ += kSpillRegionSize;
+    spill_regions_.emplace_back(std::move(region));
+  }
+
+  SpillRegion& region = spill_regions_.back();
+  uint8_t* data = static_cast<uint8_t*>(region.mapping.data()) +
+                  region.carved_chunks * kChunkSize;
+  region.carved_chunks++;
+  region.live_chunks++;
+  live_spilled_chunks_++;
+
+  // Poison the region to try and catch out of bound accesses.
+  PERFETTO_ASAN_POISON(data, kChunkSize);
+  return data;
+#else
+  return nullptr;
+#endif
+}
+
+void BumpAllocator::EraseSpilledChunk() {
+  // Chunks are carved out of regions (and erased) in order so the chunk being
+  // erased must belong to the first region.
+  PERFETTO_DCHECK(!spill_regions_.empty());
+  SpillRegion& region = spill_regions_.front();
+  PERFETTO_DCHECK(region.live_chunks > 0);
+  live_spilled_chunks_--;
+  if (--region.live_chunks > 0 ||
+      region.carved_chunks < kChunksPerSpillRegion) {
+    return;
+  }
+
+  // All the chunks of the region have been carved and erased: unmap it and,
+  // where supported, give the disk space back to the filesystem.
+  PERFETTO_ASAN_UNPOISON(region.mapping.data(), region.mapping.length());
+#if PERFETTO_BUMP_ALLOCATOR_CAN_SPILL() && defined(FALLOC_FL_PUNCH_HOLE)
+  fallocate(*spill_file_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            static_cast<off_t>(region.file_offset),
+            static_cast<off_t>(kSpillRegionSize));
+#endif
+  spill_regions_.pop_front();
+}
+
 std::optional<BumpAllocator::AllocId> BumpAllocator::TryAllocInLastChunk(
     uint32_t size) {
   if (chunks_.empty()) {
@@ -127,7 +239,7 @@ std::optional<BumpAllocator::AllocId> BumpAllocator::TryAllocInLastChunk(
   // Verify some invariants:
   // 1) The allocation must exist
   // 2) The bump must be in the bounds of the chunk.
-  PERFETTO_DCHECK(chunk.allocation);
+  PERFETTO_DCHECK(chunk.data);
   PERFETTO_DCHECK(chunk.bump_offset <= kChunkSize);
 
   // If the end of the allocation ends up after this chunk, we cannot service it
@@ -144,7 +256,7 @@ std::optional<BumpAllocator::AllocId> BumpAllocator::TryAllocInLastChunk(
   chunk.unfreed_allocations++;
 
   // Unpoison the allocation range to allow access to it on ASAN builds.
-  PERFETTO_ASAN_UNPOISON(chunk.allocation.get() + alloc_offset, size);
+  PERFETTO_ASAN_UNPOISON(chunk.data + alloc_offset, size);
 
   return AllocId{LastChunkIndex(), alloc_offset};
 }
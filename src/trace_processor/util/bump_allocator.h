@@ -26,6 +26,8 @@
 #include <tuple>
 
 #include "perfetto/ext/base/circular_queue.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/scoped_mmap.h"
 #include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
@@ -49,6 +51,12 @@ namespace trace_processor {
 // object. The destructor will CHECK if it detects any allocation which is
 // unfreed.
 //
+// Optionally (see |SetSpillFile|), chunks can be carved out of shared mappings
+// of a file instead of being obtained from the system allocator. This allows
+// the kernel to write back and evict the memory of chunks which are not
+// being accessed (e.g. when holding all the events of a trace until the end
+// of a full sort), even on systems without swap.
+//
 // [1] https://rust-hosted-langs.github.io/book/chapter-simple-bump.html
 class BumpAllocator {
  public:
@@ -64,6 +72,12 @@ class BumpAllocator {
   // of going to the system allocator. 64KB feels a good trade-off there.
   static constexpr uint64_t kChunkSize = 64ull * 1024;  // 64KB
 
+  // The size of each mapping of the spill file (see |SetSpillFile|). Chunks
+  // are carved out of these to avoid a mapping (and a syscall) per chunk.
+  static constexpr uint64_t kSpillRegionSize = 64ull * 1024 * 1024;  // 64MB
+  static constexpr uint64_t kChunksPerSpillRegion =
+      kSpillRegionSize / kChunkSize;
+
   // The maximum number of chunks which this allocator can have.
   static constexpr uint64_t kMaxChunkCount = kAllocLimit / kChunkSize;
 
@@ -138,10 +152,23 @@ class BumpAllocator {
   // Returns the number of chunks freed.
   uint64_t EraseFrontFreeChunks();
 
+  // Returns the number of bytes of the chunks allocated from the system which
+  // were not erased yet. Chunks backed by the spill file are not included.
+  uint64_t memory_usage() const;
+
   // Returns a "past the end" serialized AllocId i.e. a serialized value
   // greater than all previously returned AllocIds.
   AllocId PastTheEndId();
 
+  // Makes all the chunks created from now on be backed by shared mappings of
+  // |file| (which should be an empty, unlinked, temporary file) rather than by
+  // the system allocator. The file grows as chunks are created and the space
+  // of erased chunks is given back to the filesystem where supported.
+  //
+  // Returns false (and keeps using the system allocator) if mmap is not
+  // supported on this platform.
+  bool SetSpillFile(base::ScopedFile file);
+
   // Returns the number of erased chunks from the start of this allocator.
   //
   // This value may change any time |EraseFrontFreeChunks| is called but is
@@ -155,8 +182,14 @@ class BumpAllocator {
     // The allocation from the system for this chunk. Because all allocations
     // need to be 8 byte aligned, the chunk also needs to be 8-byte aligned.
     // base::AlignedUniquePtr ensures this is the case.
+    //
+    // Null if the chunk was carved out of a spill region.
     base::AlignedUniquePtr<uint8_t[]> allocation;
 
+    // The start of the memory of this chunk: either |allocation| or a
+    // (page aligned) slice of |SpillRegion::mapping|.
+    uint8_t* data = nullptr;
+
     // The bump offset relative to |allocation.data|. Incremented to service
     // Alloc requests.
     uint32_t bump_offset = 0;
@@ -165,10 +198,32 @@ class BumpAllocator {
     uint32_t unfreed_allocations = 0;
   };
 
+  struct SpillRegion {
+    base::ScopedMmap mapping;
+
+    // The offset of |mapping| in |spill_file_|.
+    uint64_t file_offset = 0;
+
+    // The number of chunks carved out of this region so far.
+    uint32_t carved_chunks = 0;
+
+    // The number of chunks carved out of this region which were not erased
+    // yet.
+    uint32_t live_chunks = 0;
+  };
+
   // Tries to allocate |size| bytes in the final chunk in |chunks_|. Returns
   // an AllocId if this was successful or std::nullopt otherwise.
   std::optional<AllocId> TryAllocInLastChunk(uint32_t size);
 
+  // Returns the memory for a new chunk out of |spill_regions_|, mapping a new
+  // region if needed. Returns nullptr if the spill file cannot be grown or
+  // mapped.
+  uint8_t* AllocSpilledChunk();
+
+  // Called when a chunk carved out of a spill region is erased.
+  void EraseSpilledChunk();
+
   uint64_t ChunkIndexToQueueIndex(uint64_t chunk_index) const {
     return chunk_index - erased_front_chunks_count_;
   }
@@ -182,6 +237,14 @@ class BumpAllocator {
 
   base::CircularQueue<Chunk> chunks_;
   uint64_t erased_front_chunks_count_ = 0;
+
+  // Only valid after a successful call to |SetSpillFile|.
+  base::ScopedFile spill_file_;
+  uint64_t spill_file_size_ = 0;
+  base::CircularQueue<SpillRegion> spill_regions_;
+
+  // The number of chunks in |chunks_| carved out of |spill_regions_|.
+  uint64_t live_spilled_chunks_ = 0;
 };
 
 }  // namespace trace_processor
@@ -20,6 +20,9 @@
 #include <random>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "test/gtest_and_gmock.h"
 
@@ -111,5 +114,37 @@ TEST_F(BumpAllocatorUnittest, StressTest) {
   }
 }
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
+TEST_F(BumpAllocatorUnittest, SpillFile) {
+  base::ScopedFile file = base::TempFile::CreateUnlinked().ReleaseFD();
+  int fd = *file;
+  ASSERT_TRUE(allocator_.SetSpillFile(std::move(file)));
+
+  // Fill one whole region and spill into a second one.
+  constexpr uint32_t kSize = static_cast<uint32_t>(BumpAllocator::kChunkSize);
+  std::vector<BumpAllocator::AllocId> ids;
+  for (uint64_t i = 0; i < BumpAllocator::kChunksPerSpillRegion + 1; ++i) {
+    ids.push_back(allocator_.Alloc(kSize));
+    memset(allocator_.GetPointer(ids.back()), static_cast<int>(i), kSize);
+  }
+  ASSERT_EQ(base::GetFileSize(fd), 2 * BumpAllocator::kSpillRegionSize);
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    auto* ptr = static_cast<uint8_t*>(allocator_.GetPointer(ids[i]));
+    ASSERT_EQ(ptr[0], static_cast<uint8_t>(i));
+    ASSERT_EQ(ptr[kSize - 1], static_cast<uint8_t>(i));
+    allocator_.Free(ids[i]);
+  }
+  ASSERT_EQ(allocator_.EraseFrontFreeChunks(), ids.size());
+
+  // The partially carved region is kept around and used for new chunks.
+  AllocateWriteReadAndFree(8);
+  ASSERT_EQ(base::GetFileSize(fd), 2 * BumpAllocator::kSpillRegionSize);
+  allocator_.EraseFrontFreeChunks();
+}
+#endif
+
 }  // namespace trace_processor
 }  // namespace perfetto
@@ -28,12 +28,13 @@ namespace util {
 
 namespace {
 
-std::string SanitizeDebugAnnotationName(const std::string& raw_name) {
-  std::string result = raw_name;
-  std::replace(result.begin(), result.end(), '.', '_');
-  std::replace(result.begin(), result.end(), '[', '_');
-  std::replace(result.begin(), result.end(), ']', '_');
-  return result;
+void SanitizeDebugAnnotationName(protozero::ConstChars raw_name,
+                                 std::string& result) {
+  result.assign(raw_name.data, raw_name.size);
+  for (char& c : result) {
+    if (c == '.' || c == '[' || c == ']')
+      c = '_';
+  }
 }
 
 bool IsJsonSupported() {
@@ -60,9 +61,9 @@ base::Status DebugAnnotationParser::ParseDebugAnnotationName(
     if (!decoder)
       return base::ErrStatus("Debug annotation with invalid name_iid");
 
-    result = SanitizeDebugAnnotationName(decoder->name().ToStdString());
+    SanitizeDebugAnnotationName(decoder->name(), result);
   } else if (annotation.has_name()) {
-    result = SanitizeDebugAnnotationName(annotation.name().ToStdString());
+    SanitizeDebugAnnotationName(annotation.name(), result);
   } else {
     return base::ErrStatus("Debug annotation without name");
   }
@@ -92,7 +93,10 @@ DebugAnnotationParser::ParseDebugAnnotationValue(
       return {base::ErrStatus("Debug annotation with invalid string_value_iid"),
               false};
     }
-    delegate.AddString(context_name, decoder->str().ToStdString());
+    protozero::ConstBytes str = decoder->str();
+    delegate.AddString(context_name,
+                       protozero::ConstChars{
+                           reinterpret_cast<const char*>(str.data), str.size});
   } else if (annotation.has_pointer_value()) {
     delegate.AddPointer(context_name, reinterpret_cast<const void*>(
                                           annotation.pointer_value()));
@@ -100,13 +104,12 @@ DebugAnnotationParser::ParseDebugAnnotationValue(
     bool added_entry = false;
     for (auto it = annotation.dict_entries(); it; ++it) {
       protos::pbzero::DebugAnnotation::Decoder key_value(*it);
-      std::string key;
       base::Status key_parse_result =
-          ParseDebugAnnotationName(key_value, delegate, key);
+          ParseDebugAnnotationName(key_value, delegate, name_buffer_);
       if (!key_parse_result.ok())
         return {key_parse_result, added_entry};
 
-      auto nested_key = proto_to_args_parser_.EnterDictionary(key);
+      auto nested_key = proto_to_args_parser_.EnterDictionary(name_buffer_);
       ParseResult value_parse_result =
           ParseDebugAnnotationValue(key_value, delegate, nested_key.key());
       added_entry |= value_parse_result.added_entry;
@@ -117,15 +120,17 @@ DebugAnnotationParser::ParseDebugAnnotationValue(
     size_t index = delegate.GetArrayEntryIndex(context_name.key);
     bool added_entry = false;
     for (auto it = annotation.array_values(); it; ++it) {
-      std::string array_key = context_name.key;
       protos::pbzero::DebugAnnotation::Decoder value(*it);
 
       auto nested_key = proto_to_args_parser_.EnterArray(index);
       ParseResult value_parse_result =
           ParseDebugAnnotationValue(value, delegate, nested_key.key());
 
+      // |context_name| is the key being built by the parser: strip the index
+      // to get back the key of the array, without copying it upfront.
+      nested_key.RemoveFieldSuffix();
       if (value_parse_result.added_entry) {
-        index = delegate.IncrementArrayEntryIndex(array_key);
+        index = delegate.IncrementArrayEntryIndex(context_name.key);
         added_entry = true;
       }
       if (!value_parse_result.status.ok())
@@ -174,13 +179,12 @@ base::Status DebugAnnotationParser::Parse(
     ProtoToArgsParser::Delegate& delegate) {
   protos::pbzero::DebugAnnotation::Decoder annotation(data);
 
-  std::string name;
   base::Status name_parse_result =
-      ParseDebugAnnotationName(annotation, delegate, name);
+      ParseDebugAnnotationName(annotation, delegate, name_buffer_);
   if (!name_parse_result.ok())
     return name_parse_result;
 
-  auto context = proto_to_args_parser_.EnterDictionary(name);
+  auto context = proto_to_args_parser_.EnterDictionary(name_buffer_);
 
   return ParseDebugAnnotationValue(annotation, delegate, context.key()).status;
 }
@@ -216,9 +220,8 @@ DebugAnnotationParser::ParseResult DebugAnnotationParser::ParseNestedValueArgs(
       auto key_it = value.dict_keys();
       auto value_it = value.dict_values();
       for (; key_it && value_it; ++key_it, ++value_it) {
-        std::string child_name =
-            SanitizeDebugAnnotationName((*key_it).ToStdString());
-        auto nested_key = proto_to_args_parser_.EnterDictionary(child_name);
+        SanitizeDebugAnnotationName(*key_it, name_buffer_);
+        auto nested_key = proto_to_args_parser_.EnterDictionary(name_buffer_);
         ParseResult result =
             ParseNestedValueArgs(*value_it, nested_key.key(), delegate);
         added_entry |= result.added_entry;
@@ -229,7 +232,6 @@ DebugAnnotationParser::ParseResult DebugAnnotationParser::ParseNestedValueArgs(
     }
 
     case protos::pbzero::DebugAnnotation::NestedValue::ARRAY: {
-      std::string array_key = context_name.key;
       size_t array_index = delegate.GetArrayEntryIndex(context_name.key);
       bool added_entry = false;
 
@@ -238,9 +240,10 @@ DebugAnnotationParser::ParseResult DebugAnnotationParser::ParseNestedValueArgs(
         ParseResult result =
             ParseNestedValueArgs(*value_it, nested_key.key(), delegate);
 
+        nested_key.RemoveFieldSuffix();
         if (result.added_entry) {
           ++array_index;
-          delegate.IncrementArrayEntryIndex(array_key);
+          delegate.IncrementArrayEntryIndex(context_name.key);
           added_entry = true;
         }
         if (!result.status.ok())
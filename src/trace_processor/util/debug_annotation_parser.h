@@ -17,6 +17,8 @@
 #ifndef SRC_TRACE_PROCESSOR_UTIL_DEBUG_ANNOTATION_PARSER_H_
 #define SRC_TRACE_PROCESSOR_UTIL_DEBUG_ANNOTATION_PARSER_H_
 
+#include <string>
+
 #include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
 #include "src/trace_processor/util/proto_to_args_parser.h"
 
@@ -29,6 +31,7 @@ namespace util {
 // |DebugAnnotationParser| is a logical extension of |ProtoToArgsParser|:
 // it uses |ProtoToArgsParser::Delegate| for writing the results and uses
 // |ProtoToArgsParser| to parse arbitrary protos nested inside DebugAnnotation.
+// Instances should be reused across events, to reuse their buffers.
 class DebugAnnotationParser {
  public:
   explicit DebugAnnotationParser(ProtoToArgsParser& proto_to_args_parser);
@@ -57,6 +60,11 @@ class DebugAnnotationParser {
                                    ProtoToArgsParser::Delegate& delegate);
 
   ProtoToArgsParser& proto_to_args_parser_;
+
+  // Holds the name of the dictionary entry being entered: names are copied
+  // into the key of |proto_to_args_parser_| right away, so one buffer can be
+  // reused for all of them instead of allocating a string for each one.
+  std::string name_buffer_;
 };
 
 }  // namespace util
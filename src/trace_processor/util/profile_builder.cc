@@ -78,29 +78,27 @@ int64_t GProfileBuilder::StringTable::InternString(base::StringView str) {
     return kEmptyStringIndex;
   }
   auto hash = str.Hash();
-  auto it = seen_strings_.find(hash);
-  if (it != seen_strings_.end()) {
-    return it->second;
+  if (int64_t* index = seen_strings_.Find(hash); index) {
+    return *index;
   }
 
   auto pool_id = string_pool_.GetId(str);
   int64_t index = pool_id ? InternString(*pool_id) : WriteString(str);
 
-  seen_strings_.insert({hash, index});
+  seen_strings_.Insert(hash, index);
   return index;
 }
 
 int64_t GProfileBuilder::StringTable::InternString(
     StringPool::Id string_pool_id) {
-  auto it = seen_string_pool_ids_.find(string_pool_id);
-  if (it != seen_string_pool_ids_.end()) {
-    return it->second;
+  if (int64_t* index = seen_string_pool_ids_.Find(string_pool_id); index) {
+    return *index;
   }
 
   NullTermStringView str = string_pool_.Get(string_pool_id);
 
   int64_t index = str.empty() ? kEmptyStringIndex : WriteString(str);
-  seen_string_pool_ids_.insert({string_pool_id, index});
+  seen_string_pool_ids_.Insert(string_pool_id, index);
   return index;
 }
 
@@ -199,13 +197,11 @@ int64_t GProfileBuilder::Mapping::ComputeMainBinaryScore() const {
 }
 
 bool GProfileBuilder::SampleAggregator::AddSample(
-    const protozero::PackedVarInt& location_ids,
+    const SerializedLocationId& location_ids,
     const std::vector<int64_t>& values) {
-  SerializedLocationId key(location_ids.data(),
-                           location_ids.data() + location_ids.size());
-  std::vector<int64_t>* agg_values = samples_.Find(key);
+  std::vector<int64_t>* agg_values = samples_.Find(location_ids);
   if (!agg_values) {
-    samples_.Insert(std::move(key), values);
+    samples_.Insert(location_ids, values);
     return true;
   }
   // All samples must have the same number of values.
@@ -218,15 +214,14 @@ bool GProfileBuilder::SampleAggregator::AddSample(
 }
 
 void GProfileBuilder::SampleAggregator::WriteTo(Profile& profile) {
-  protozero::PackedVarInt values;
   for (auto it = samples_.GetIterator(); it; ++it) {
-    values.Reset();
+    Sample* sample = profile.add_sample();
+    auto values = sample->begin_value();
     for (int64_t value : it.value()) {
       values.Append(value);
     }
-    Sample* sample = profile.add_sample();
-    sample->set_value(values);
-    // Map key is the serialized varint. Just append the bytes.
+    // Map key is the serialized varint. Just append the bytes. This also ends
+    // the packed |values| field above.
     sample->AppendBytes(Sample::kLocationIdFieldNumber, it.key().data(),
                         it.key().size());
   }
@@ -290,6 +285,7 @@ bool GProfileBuilder::AddSample(const Stack::Decoder& stack,
   // Note pprof orders the stacks leafs first. That is also the ordering
   // StackBlob uses for entries
   protozero::PackedVarInt location_ids;
+  SerializedLocationId serialized_ids;
   for (; it; ++it) {
     Stack::Entry::Decoder entry(it->as_bytes());
     if (entry.has_name()) {
@@ -300,9 +296,9 @@ bool GProfileBuilder::AddSample(const Stack::Decoder& stack,
       uint32_t callsite_id = entry.has_callsite_id()
                                  ? entry.callsite_id()
                                  : entry.annotated_callsite_id();
-      const protozero::PackedVarInt& ids =
+      const SerializedLocationId& ids =
           GetLocationIdsForCallsite(CallsiteId(callsite_id), annotated);
-      for (auto* p = ids.data(); p < ids.data() + ids.size();) {
+      for (const uint8_t* p = ids.data(); p < ids.data() + ids.size();) {
         uint64_t location_id;
         p = protozero::proto_utils::ParseVarInt(p, ids.data() + ids.size(),
                                                 &location_id);
@@ -313,7 +309,9 @@ bool GProfileBuilder::AddSample(const Stack::Decoder& stack,
                                                 CallsiteAnnotation::kNone));
     }
   }
-  return samples_.AddSample(location_ids, values);
+  serialized_ids.assign(location_ids.data(),
+                        location_ids.data() + location_ids.size());
+  return samples_.AddSample(serialized_ids, values);
 }
 
 void GProfileBuilder::Finalize() {
@@ -332,48 +330,39 @@ std::string GProfileBuilder::Build() {
   return result_.SerializeAsString();
 }
 
-const protozero::PackedVarInt& GProfileBuilder::GetLocationIdsForCallsite(
-    const CallsiteId& callsite_id,
-    bool annotated) {
-  auto it = cached_location_ids_.find({callsite_id, annotated});
-  if (it != cached_location_ids_.end()) {
-    return it->second;
+const GProfileBuilder::SerializedLocationId&
+GProfileBuilder::GetLocationIdsForCallsite(const CallsiteId& callsite_id,
+                                           bool annotated) {
+  MaybeAnnotatedCallsiteId key{callsite_id, annotated};
+  if (SerializedLocationId* cached = cached_location_ids_.Find(key); cached) {
+    return *cached;
   }
 
-  protozero::PackedVarInt& location_ids =
-      cached_location_ids_[{callsite_id, annotated}];
-
   const auto& cs_table = context_.storage->stack_profile_callsite_table();
 
-  std::optional<tables::StackProfileCallsiteTable::ConstRowReference>
-      start_ref = cs_table.FindById(callsite_id);
-  if (!start_ref) {
-    return location_ids;
-  }
-
-  location_ids.Append(WriteLocationIfNeeded(
-      start_ref->frame_id(), annotated ? annotations_.GetAnnotation(*start_ref)
-                                       : CallsiteAnnotation::kNone));
-
-  std::optional<CallsiteId> parent_id = start_ref->parent_id();
-  while (parent_id) {
-    auto parent_ref = cs_table.FindById(*parent_id);
+  protozero::PackedVarInt location_ids;
+  std::optional<tables::StackProfileCallsiteTable::ConstRowReference> ref =
+      cs_table.FindById(callsite_id);
+  while (ref) {
     location_ids.Append(WriteLocationIfNeeded(
-        parent_ref->frame_id(), annotated
-                                    ? annotations_.GetAnnotation(*parent_ref)
-                                    : CallsiteAnnotation::kNone));
-    parent_id = parent_ref->parent_id();
+        ref->frame_id(), annotated ? annotations_.GetAnnotation(*ref)
+                                   : CallsiteAnnotation::kNone));
+    std::optional<CallsiteId> parent_id = ref->parent_id();
+    ref = parent_id ? cs_table.FindById(*parent_id) : std::nullopt;
   }
 
-  return location_ids;
+  return *cached_location_ids_
+              .Insert(key, SerializedLocationId(
+                               location_ids.data(),
+                               location_ids.data() + location_ids.size()))
+              .first;
 }
 
 uint64_t GProfileBuilder::WriteLocationIfNeeded(FrameId frame_id,
                                                 CallsiteAnnotation annotation) {
   AnnotatedFrameId key{frame_id, annotation};
-  auto it = seen_locations_.find(key);
-  if (it != seen_locations_.end()) {
-    return it->second;
+  if (uint64_t* seen_id = seen_locations_.Find(key); seen_id) {
+    return *seen_id;
   }
 
   auto& frames = context_.storage->stack_profile_frame_table();
@@ -391,16 +380,15 @@ uint64_t GProfileBuilder::WriteLocationIfNeeded(FrameId frame_id,
     id = locations_.size();
   }
 
-  seen_locations_.insert({key, id});
+  seen_locations_.Insert(key, id);
 
   return id;
 }
 
 uint64_t GProfileBuilder::WriteFakeLocationIfNeeded(const std::string& name) {
   int64_t name_id = string_table_.InternString(base::StringView(name));
-  auto it = seen_fake_locations_.find(name_id);
-  if (it != seen_fake_locations_.end()) {
-    return it->second;
+  if (uint64_t* seen_id = seen_fake_locations_.Find(name_id); seen_id) {
+    return *seen_id;
   }
 
   uint64_t& id =
@@ -410,7 +398,7 @@ uint64_t GProfileBuilder::WriteFakeLocationIfNeeded(const std::string& name) {
     id = locations_.size();
   }
 
-  seen_fake_locations_.insert({name_id, id});
+  seen_fake_locations_.Insert(name_id, id);
 
   return id;
 }
@@ -552,9 +540,8 @@ uint64_t GProfileBuilder::WriteFunctionIfNeeded(
     CallsiteAnnotation annotation,
     uint64_t mapping_id) {
   AnnotatedFrameId key{frame.id(), annotation};
-  auto it = seen_functions_.find(key);
-  if (it != seen_functions_.end()) {
-    return it->second;
+  if (uint64_t* seen_id = seen_functions_.Find(key); seen_id) {
+    return *seen_id;
   }
 
   auto ins = functions_.insert(
@@ -562,7 +549,7 @@ uint64_t GProfileBuilder::WriteFunctionIfNeeded(
                 GetSystemNameForFrame(frame), kEmptyStringIndex},
        functions_.size() + 1});
   uint64_t id = ins.first->second;
-  seen_functions_.insert({key, id});
+  seen_functions_.Insert(key, id);
 
   if (ins.second && (ins.first->first.name != kEmptyStringIndex ||
                      ins.first->first.system_name != kEmptyStringIndex)) {
@@ -593,9 +580,8 @@ void GProfileBuilder::WriteFunctions() {
 
 uint64_t GProfileBuilder::WriteMappingIfNeeded(
     const tables::StackProfileMappingTable::ConstRowReference& mapping_ref) {
-  auto it = seen_mappings_.find(mapping_ref.id());
-  if (it != seen_mappings_.end()) {
-    return it->second;
+  if (uint64_t* seen_id = seen_mappings_.Find(mapping_ref.id()); seen_id) {
+    return *seen_id;
   }
 
   auto ins = mapping_keys_.insert(
@@ -606,6 +592,7 @@ uint64_t GProfileBuilder::WriteMappingIfNeeded(
         Mapping(mapping_ref, context_.storage->string_pool(), string_table_));
   }
 
+  seen_mappings_.Insert(mapping_ref.id(), ins.first->second);
   return ins.first->second;
 }
 
@@ -116,9 +116,9 @@ class GProfileBuilder {
     protozero::HeapBuffered<third_party::perftools::profiles::pbzero::Profile>&
         result_;
 
-    std::unordered_map<StringPool::Id, int64_t> seen_string_pool_ids_;
+    base::FlatHashMap<StringPool::Id, int64_t> seen_string_pool_ids_;
     // Maps strings (hashes thereof) to indexes in the table.
-    std::unordered_map<uint64_t, int64_t> seen_strings_;
+    base::FlatHashMap<uint64_t, int64_t> seen_strings_;
     // Index where the next string will be written to
     int64_t next_index_{0};
   };
@@ -254,21 +254,23 @@ class GProfileBuilder {
     }
   };
 
+  // Serialized value of the Sample::location_id proto field (packed varint).
+  // Unlike protozero::PackedVarInt, it doesn't reserve an on-stack buffer, so
+  // it's cheap to keep one per callsite.
+  using SerializedLocationId = std::vector<uint8_t>;
+
   // Aggregates samples with the same location_ids (i.e. stack) by computing the
   // sum of their values. This helps keep the generated profiles small as it
   // potentially removes a lot of duplication from having multiple samples with
   // the same stack.
   class SampleAggregator {
    public:
-    bool AddSample(const protozero::PackedVarInt& location_ids,
+    bool AddSample(const SerializedLocationId& location_ids,
                    const std::vector<int64_t>& values);
 
     void WriteTo(third_party::perftools::profiles::pbzero::Profile& profile);
 
    private:
-    // Key holds the serialized value of the Sample::location_id proto field
-    // (packed varint).
-    using SerializedLocationId = std::vector<uint8_t>;
     struct Hasher {
       size_t operator()(const SerializedLocationId& data) const {
         base::Hasher hasher;
@@ -280,7 +282,8 @@ class GProfileBuilder {
         samples_;
   };
 
-  const protozero::PackedVarInt& GetLocationIdsForCallsite(
+  // The returned reference is only valid until the next call.
+  const SerializedLocationId& GetLocationIdsForCallsite(
       const CallsiteId& callsite_id,
       bool annotated);
 
@@ -363,19 +366,19 @@ class GProfileBuilder {
       return callsite_id == other.callsite_id && annotate == other.annotate;
     }
   };
-  std::unordered_map<MaybeAnnotatedCallsiteId,
-                     protozero::PackedVarInt,
-                     MaybeAnnotatedCallsiteId::Hash>
+  base::FlatHashMap<MaybeAnnotatedCallsiteId,
+                    SerializedLocationId,
+                    MaybeAnnotatedCallsiteId::Hash>
       cached_location_ids_;
 
   // Helpers to map TraceProcessor rows to already written Profile entities
   // (their ids).
-  std::unordered_map<AnnotatedFrameId, uint64_t, AnnotatedFrameId::Hash>
+  base::FlatHashMap<AnnotatedFrameId, uint64_t, AnnotatedFrameId::Hash>
       seen_locations_;
-  std::unordered_map<AnnotatedFrameId, uint64_t, AnnotatedFrameId::Hash>
+  base::FlatHashMap<AnnotatedFrameId, uint64_t, AnnotatedFrameId::Hash>
       seen_functions_;
-  std::unordered_map<MappingId, uint64_t> seen_mappings_;
-  std::unordered_map<int64_t, uint64_t> seen_fake_locations_;
+  base::FlatHashMap<MappingId, uint64_t> seen_mappings_;
+  base::FlatHashMap<int64_t, uint64_t> seen_fake_locations_;
 
   // Helpers to deduplicate entries. Map entity to its id. These also serve as a
   // staging area until written out to the profile proto during `Finalize`. Ids
@@ -19,6 +19,7 @@
 #include <stdint.h>
 
 #include "perfetto/base/status.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/protozero/proto_decoder.h"
 #include "perfetto/protozero/proto_utils.h"
 #include "protos/perfetto/common/descriptor.pbzero.h"
@@ -40,6 +41,11 @@ void AppendProtoType(std::string& target, const std::string& value) {
   target += value;
 }
 
+void AppendArrayIndex(std::string& target, size_t index) {
+  base::StackString<32> suffix("[%zu]", index);
+  target.append(suffix.c_str(), suffix.len());
+}
+
 }  // namespace
 
 ProtoToArgsParser::Key::Key() = default;
@@ -167,21 +173,17 @@ base::Status ProtoToArgsParser::ParseField(
     protozero::Field field,
     Delegate& delegate,
     int* unknown_extensions) {
-  std::string prefix_part = field_descriptor.name();
-  if (field_descriptor.is_repeated()) {
-    std::string number = std::to_string(repeated_field_number);
-    prefix_part.reserve(prefix_part.length() + number.length() + 2);
-    prefix_part.append("[");
-    prefix_part.append(number);
-    prefix_part.append("]");
-  }
-
   // In the args table we build up message1.message2.field1 as the column
   // name. This will append the ".field1" suffix to |key_prefix| and then
-  // remove it when it goes out of scope.
+  // remove it when it goes out of scope. The suffix is appended in place, as
+  // this runs for every field of every event.
   ScopedNestedKeyContext key_context(key_prefix_);
   AppendProtoType(key_prefix_.flat_key, field_descriptor.name());
-  AppendProtoType(key_prefix_.key, prefix_part);
+  AppendProtoType(key_prefix_.key, field_descriptor.name());
+  if (field_descriptor.is_repeated()) {
+    AppendArrayIndex(key_prefix_.key,
+                     static_cast<size_t>(repeated_field_number));
+  }
 
   // If we have an override parser then use that instead and move onto the
   // next loop.
@@ -367,7 +369,7 @@ base::Status ProtoToArgsParser::ParseSimpleField(
 ProtoToArgsParser::ScopedNestedKeyContext ProtoToArgsParser::EnterArray(
     size_t index) {
   ScopedNestedKeyContext context(key_prefix_);
-  key_prefix_.key += "[" + std::to_string(index) + "]";
+  AppendArrayIndex(key_prefix_.key, index);
   return context;
 }
 
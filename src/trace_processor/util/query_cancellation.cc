@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/query_cancellation.h"
+
+#include <atomic>
+#include <cstdint>
+
+#include "perfetto/base/status.h"
+#include "perfetto/base/time.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+thread_local const QueryCancellation* g_current = nullptr;
+
+uint32_t LoadCount(const std::atomic<uint32_t>* count) {
+  return count ? count->load(std::memory_order_relaxed) : 0;
+}
+
+}  // namespace
+
+QueryCancellation::QueryCancellation(
+    const std::atomic<uint32_t>* interrupt_count,
+    uint32_t timeout_ms)
+    : interrupt_count_(interrupt_count),
+      interrupt_count_at_start_(LoadCount(interrupt_count)),
+      timeout_ms_(timeout_ms),
+      deadline_ns_(timeout_ms ? base::GetWallTimeNs().count() +
+                                    int64_t(timeout_ms) * 1000 * 1000
+                              : 0) {}
+
+QueryCancellation::~QueryCancellation() = default;
+
+bool QueryCancellation::ShouldStop() const {
+  return cancelled_.load(std::memory_order_relaxed) || IsInterrupted() ||
+         IsPastDeadline();
+}
+
+base::Status QueryCancellation::ToStatus() const {
+  if (!cancelled_.load(std::memory_order_relaxed) && !IsInterrupted() &&
+      IsPastDeadline()) {
+    return base::ErrStatus("Query timed out after %u ms", timeout_ms_);
+  }
+  return base::ErrStatus("Query cancelled");
+}
+
+bool QueryCancellation::IsInterrupted() const {
+  return LoadCount(interrupt_count_) != interrupt_count_at_start_;
+}
+
+bool QueryCancellation::IsPastDeadline() const {
+  return deadline_ns_ && base::GetWallTimeNs().count() >= deadline_ns_;
+}
+
+// static
+const QueryCancellation* QueryCancellation::Current() {
+  return g_current;
+}
+
+QueryCancellation::ScopedCurrent::ScopedCurrent(
+    const QueryCancellation* cancellation)
+    : previous_(g_current) {
+  g_current = cancellation;
+}
+
+QueryCancellation::ScopedCurrent::~ScopedCurrent() {
+  g_current = previous_;
+}
+
+}  // namespace perfetto::trace_processor
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_QUERY_CANCELLATION_H_
+#define SRC_TRACE_PROCESSOR_UTIL_QUERY_CANCELLATION_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto::trace_processor {
+
+// Decides whether a query should stop early, either because it was cancelled
+// or because it ran past its deadline.
+//
+// Long running code (the SQLite progress handler, QueryExecutor, ...) polls
+// ShouldStop() on the token of the query being run, which is found with
+// Current(): this avoids threading the token through every layer between the
+// query and the code doing the work. The token is made current, on the thread
+// running the query, with ScopedCurrent for as long as the query is executed.
+//
+// Cancellation is cooperative: ShouldStop() only returns true at the next
+// check, after which the code polling it should bail out and let the error
+// returned by ToStatus() propagate to the caller.
+class QueryCancellation {
+ public:
+  // |interrupt_count| (optional) is a counter shared by all the queries of a
+  // TraceProcessor instance: incrementing it cancels all the queries created
+  // before. This allows to cancel the running query without knowing which one
+  // it is, lock-free (e.g. from a signal handler). |timeout_ms| is the time,
+  // from now, after which the query should stop; zero means no timeout.
+  QueryCancellation(const std::atomic<uint32_t>* interrupt_count,
+                    uint32_t timeout_ms);
+  ~QueryCancellation();
+
+  QueryCancellation(const QueryCancellation&) = delete;
+  QueryCancellation& operator=(const QueryCancellation&) = delete;
+
+  // Cancels this query only. Can be called from any thread.
+  void Cancel() { cancelled_.store(true, std::memory_order_relaxed); }
+
+  // Returns true if the query was cancelled or its deadline has passed.
+  bool ShouldStop() const;
+
+  // Returns the error to report for a stopped query.
+  base::Status ToStatus() const;
+
+  // Returns the token of the query running on the calling thread, or nullptr.
+  static const QueryCancellation* Current();
+
+  // Returns true if there is a query running on the calling thread and it
+  // should stop.
+  static bool ShouldStopCurrent() {
+    const QueryCancellation* current = Current();
+    return current && current->ShouldStop();
+  }
+
+  // Makes |cancellation| the token returned by Current() on the calling
+  // thread, until destroyed. Nests: the previous token is restored on
+  // destruction. |cancellation| can be null.
+  class ScopedCurrent {
+   public:
+    explicit ScopedCurrent(const QueryCancellation* cancellation);
+    ~ScopedCurrent();
+
+    ScopedCurrent(const ScopedCurrent&) = delete;
+    ScopedCurrent& operator=(const ScopedCurrent&) = delete;
+
+   private:
+    const QueryCancellation* previous_;
+  };
+
+ private:
+  bool IsInterrupted() const;
+  bool IsPastDeadline() const;
+
+  std::atomic<bool> cancelled_{false};
+  const std::atomic<uint32_t>* const interrupt_count_;
+  const uint32_t interrupt_count_at_start_;
+  const uint32_t timeout_ms_;
+  // Zero if there is no deadline.
+  const int64_t deadline_ns_;
+};
+
+}  // namespace perfetto::trace_processor
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_QUERY_CANCELLATION_H_
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/query_cancellation.h"
+
+#include <atomic>
+#include <cstdint>
+
+#include "perfetto/base/time.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor {
+namespace {
+
+using testing::HasSubstr;
+
+TEST(QueryCancellationTest, Cancel) {
+  QueryCancellation cancellation(nullptr, 0);
+  ASSERT_FALSE(cancellation.ShouldStop());
+  cancellation.Cancel();
+  ASSERT_TRUE(cancellation.ShouldStop());
+  ASSERT_THAT(cancellation.ToStatus().message(), HasSubstr("cancelled"));
+}
+
+TEST(QueryCancellationTest, InterruptOnlyStopsEarlierQueries) {
+  std::atomic<uint32_t> interrupt_count{0};
+  QueryCancellation before(&interrupt_count, 0);
+  interrupt_count++;
+  QueryCancellation after(&interrupt_count, 0);
+  ASSERT_TRUE(before.ShouldStop());
+  ASSERT_FALSE(after.ShouldStop());
+}
+
+TEST(QueryCancellationTest, Timeout) {
+  QueryCancellation no_timeout(nullptr, 0);
+  QueryCancellation timeout(nullptr, 1);
+  base::SleepMicroseconds(5 * 1000);
+  ASSERT_FALSE(no_timeout.ShouldStop());
+  ASSERT_TRUE(timeout.ShouldStop());
+  ASSERT_THAT(timeout.ToStatus().message(), HasSubstr("timed out after 1 ms"));
+}
+
+TEST(QueryCancellationTest, ScopedCurrentNests) {
+  QueryCancellation outer(nullptr, 0);
+  QueryCancellation inner(nullptr, 0);
+  inner.Cancel();
+  ASSERT_EQ(QueryCancellation::Current(), nullptr);
+  ASSERT_FALSE(QueryCancellation::ShouldStopCurrent());
+  {
+    QueryCancellation::ScopedCurrent scoped_outer(&outer);
+    ASSERT_FALSE(QueryCancellation::ShouldStopCurrent());
+    {
+      QueryCancellation::ScopedCurrent scoped_inner(&inner);
+      ASSERT_EQ(QueryCancellation::Current(), &inner);
+      ASSERT_TRUE(QueryCancellation::ShouldStopCurrent());
+    }
+    ASSERT_EQ(QueryCancellation::Current(), &outer);
+  }
+  ASSERT_EQ(QueryCancellation::Current(), nullptr);
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor
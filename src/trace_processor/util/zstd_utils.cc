@@ -0,0 +1,95 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/zstd_utils.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// For bazel build.
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/status.h"
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include <zstd.h>
+#endif
+
+namespace perfetto::trace_processor::util {
+
+bool IsZstdSupported() {
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+  return true;
+#else
+  return false;
+#endif
+}
+
+ZstdDecompressor::ZstdDecompressor() = default;
+ZstdDecompressor::~ZstdDecompressor() = default;
+
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)  // Real Implementation
+
+void ZstdDecompressor::DCtxDeleter::operator()(ZSTD_DCtx_s* dctx) const {
+  ZSTD_freeDCtx(dctx);
+}
+
+base::Status ZstdDecompressor::DecompressFully(const uint8_t* data,
+                                               size_t size,
+                                               std::vector<uint8_t>* output) {
+  // The context is allocated lazily, as most traces don't contain zstd data.
+  if (!dctx_)
+    dctx_.reset(ZSTD_createDCtx());
+  if (!dctx_)
+    return base::ErrStatus("Failed to allocate the zstd context");
+  ZSTD_DCtx_reset(dctx_.get(), ZSTD_reset_session_only);
+
+  ZSTD_inBuffer in{data, size, 0};
+  // Zero once the last frame was fully decoded and flushed.
+  size_t ret = 0;
+  for (;;) {
+    size_t old_size = output->size();
+    output->resize(old_size + ZSTD_DStreamOutSize());
+    ZSTD_outBuffer out{output->data() + old_size, ZSTD_DStreamOutSize(), 0};
+    ret = ZSTD_decompressStream(dctx_.get(), &out, &in);
+    output->resize(old_size + out.pos);
+    if (ZSTD_isError(ret)) {
+      return base::ErrStatus("Failed to decompress zstd stream: %s",
+                             ZSTD_getErrorName(ret));
+    }
+    // If the output buffer was filled, the decoder might have more data to
+    // flush even if all the input was consumed.
+    if (in.pos == in.size && out.pos < out.size)
+      break;
+  }
+  if (ret != 0)
+    return base::ErrStatus("Failed to decompress zstd stream: truncated input");
+  return base::OkStatus();
+}
+
+#else  // Dummy Implementation
+
+void ZstdDecompressor::DCtxDeleter::operator()(ZSTD_DCtx_s*) const {}
+
+base::Status ZstdDecompressor::DecompressFully(const uint8_t*,
+                                               size_t,
+                                               std::vector<uint8_t>*) {
+  return base::ErrStatus("Cannot decompress zstd data. Zstd not enabled");
+}
+
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
+}  // namespace perfetto::trace_processor::util
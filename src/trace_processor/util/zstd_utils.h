@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
+#define SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/status.h"
+
+struct ZSTD_DCtx_s;
+
+namespace perfetto::trace_processor::util {
+
+// Returns whether zstd related functionality is supported with the current
+// build flags.
+bool IsZstdSupported();
+
+// Decompresses zstd streams, e.g. the |zstd_compressed_packets| written by the
+// tracing service. Can be reused for several streams, which avoids to allocate
+// a new decompression context each time.
+class ZstdDecompressor {
+ public:
+  ZstdDecompressor();
+  ~ZstdDecompressor();
+  ZstdDecompressor(const ZstdDecompressor&) = delete;
+  ZstdDecompressor& operator=(const ZstdDecompressor&) = delete;
+
+  // Decompresses the |size| bytes at |data|, which must contain one or more
+  // whole zstd frames, and appends the result to |output|.
+  base::Status DecompressFully(const uint8_t* data,
+                               size_t size,
+                               std::vector<uint8_t>* output);
+
+ private:
+  struct DCtxDeleter {
+    void operator()(ZSTD_DCtx_s*) const;
+  };
+
+  std::unique_ptr<ZSTD_DCtx_s, DCtxDeleter> dctx_;
+};
+
+}  // namespace perfetto::trace_processor::util
+
+#endif  // SRC_TRACE_PROCESSOR_UTIL_ZSTD_UTILS_H_
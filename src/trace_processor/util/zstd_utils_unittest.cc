@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/trace_processor/util/zstd_utils.h"
+
+#include <zstd.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto::trace_processor::util {
+namespace {
+
+std::vector<uint8_t> Compress(const std::string& data) {
+  std::vector<uint8_t> out(ZSTD_compressBound(data.size()));
+  size_t size =
+      ZSTD_compress(out.data(), out.size(), data.data(), data.size(), 3);
+  EXPECT_FALSE(ZSTD_isError(size));
+  out.resize(size);
+  return out;
+}
+
+std::string Decompress(ZstdDecompressor* decompressor,
+                       const std::vector<uint8_t>& data) {
+  std::vector<uint8_t> out;
+  base::Status status =
+      decompressor->DecompressFully(data.data(), data.size(), &out);
+  EXPECT_TRUE(status.ok()) << status.message();
+  return std::string(out.begin(), out.end());
+}
+
+TEST(ZstdUtilsTest, RoundTrip) {
+  ZstdDecompressor decompressor;
+  ASSERT_EQ(Decompress(&decompressor, Compress("abc")), "abc");
+  ASSERT_EQ(Decompress(&decompressor, Compress("")), "");
+
+  // Bigger than the internal output chunk size.
+  std::string big;
+  for (size_t i = 0; big.size() < 4 * ZSTD_DStreamOutSize(); ++i)
+    big += std::to_string(i);
+  ASSERT_EQ(Decompress(&decompressor, Compress(big)), big);
+}
+
+TEST(ZstdUtilsTest, ConcatenatedFrames) {
+  ZstdDecompressor decompressor;
+  std::vector<uint8_t> data = Compress("foo");
+  std::vector<uint8_t> second = Compress("bar");
+  data.insert(data.end(), second.begin(), second.end());
+  ASSERT_EQ(Decompress(&decompressor, data), "foobar");
+}
+
+TEST(ZstdUtilsTest, Errors) {
+  ZstdDecompressor decompressor;
+  std::vector<uint8_t> out;
+  std::vector<uint8_t> garbage = {1, 2, 3, 4, 5, 6, 7, 8};
+  ASSERT_FALSE(
+      decompressor.DecompressFully(garbage.data(), garbage.size(), &out).ok());
+
+  std::vector<uint8_t> truncated = Compress(std::string(1000, 'a') + "b");
+  truncated.resize(truncated.size() - 2);
+  ASSERT_FALSE(
+      decompressor.DecompressFully(truncated.data(), truncated.size(), &out)
+          .ok());
+
+  // The decompressor can be reused after an error.
+  ASSERT_EQ(Decompress(&decompressor, Compress("abc")), "abc");
+}
+
+}  // namespace
+}  // namespace perfetto::trace_processor::util
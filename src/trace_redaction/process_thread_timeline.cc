@@ -28,9 +28,12 @@ namespace {
 // number of iterations.
 constexpr size_t kMaxSearchDepth = 10;
 
-bool OrderByPid(const ProcessThreadTimeline::Event& left,
-                const ProcessThreadTimeline::Event& right) {
-  return left.pid() < right.pid();
+bool OrderByPidThenTs(const ProcessThreadTimeline::Event& left,
+                      const ProcessThreadTimeline::Event& right) {
+  if (left.pid() != right.pid()) {
+    return left.pid() < right.pid();
+  }
+  return left.ts() < right.ts();
 }
 
 }  // namespace
@@ -41,7 +44,20 @@ void ProcessThreadTimeline::Append(const Event& event) {
 }
 
 void ProcessThreadTimeline::Sort() {
-  std::sort(events_.begin(), events_.end(), OrderByPid);
+  // Stable, so that events with the same pid and ts stay in the order they
+  // were appended (the last one wins).
+  std::stable_sort(events_.begin(), events_.end(), OrderByPidThenTs);
+
+  pids_.Clear();
+  Range range;
+  for (uint32_t i = 1; i <= events_.size(); ++i) {
+    if (i == events_.size() || events_[i].pid() != events_[range.begin].pid()) {
+      range.end = i;
+      pids_.Insert(events_[range.begin].pid(), range);
+      range.begin = i;
+    }
+  }
+
   mode_ = Mode::kRead;
 }
 
@@ -86,58 +102,29 @@ std::optional<ProcessThreadTimeline::Event>
 ProcessThreadTimeline::FindPreviousEvent(uint64_t ts, int32_t pid) const {
   PERFETTO_DCHECK(mode_ == Mode::kRead);
 
-  Event fake = Event::Close(ts, pid);
-
-  // Events are in ts-order within each pid-group. See Optimize(), Because each
-  // group is small (the vast majority will have two events [start + event, no
-  // reuse]).
-  //
-  // Find the first process event. Then perform a linear search. There won't be
-  // many events per process.
-  auto at = std::lower_bound(events_.begin(), events_.end(), fake, OrderByPid);
+  const Range* range = pids_.Find(pid);
 
   // `pid` was not found in `events_`.
-  if (at == events_.end()) {
+  if (!range) {
     return std::nullopt;
   }
 
-  // "no best option".
-  std::optional<Event> best;
-
-  // Run through all events (related to this pid) and find the last event that
-  // comes before ts. If the events were in order by time, the search could be
-  // more efficient, but the gains are margin because:
-  //
-  // 1. The number of edge cases go up.
-  //
-  // 2. The code is harder to read.
-  //
-  // 3. The performance gains are minimal or non-existant because of the small
-  //    number of events.
-  for (; at != events_.end() && at->pid() == pid; ++at) {
-    if (at->ts() > ts) {
-      continue;  // Ignore events in the future.
-    }
+  auto begin = events_.begin() + range->begin;
+  auto end = events_.begin() + range->end;
 
-    // All ts values are positive. However, ts_at and ts_best are both less than
-    // ts (see early condition), meaning they can be considered negative values.
-    //
-    //      at        best            ts
-    //   <---+-----------+-------------+---->
-    //      31          64            93
-    //
-    //      at        best            ts
-    //   <---+-----------+-------------+---->
-    //     -62         -29             0
-    //
-    // This means that the latest ts value under ts is the closest to ts.
-    if (!best.has_value() || at->ts() > best->ts()) {
-      best = *at;
-    }
+  // The events of the pid are sorted by time: the last event at or before ts
+  // is the one right before the first event after ts.
+  auto after = std::upper_bound(
+      begin, end, ts, [](uint64_t t, const Event& e) { return t < e.ts(); });
+
+  // All events are in the future.
+  if (after == begin) {
+    return std::nullopt;
   }
 
-  if (best.has_value() &&
-      best->type() != ProcessThreadTimeline::Event::Type::kOpen) {
+  const Event& best = *(after - 1);
+
+  if (best.type() != ProcessThreadTimeline::Event::Type::kOpen) {
     return std::nullopt;
   }
 
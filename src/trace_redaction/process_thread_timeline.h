@@ -21,6 +21,8 @@
 #include <optional>
 #include <vector>
 
+#include "perfetto/ext/base/flat_hash_map.h"
+
 namespace perfetto::trace_redaction {
 
 class ProcessThreadTimeline {
@@ -115,9 +117,9 @@ class ProcessThreadTimeline {
 
   void Append(const Event& event);
 
-  // REQUIRED: Sorts all events by pid, making it possible to locate the subset
-  // of events connected to a pid. Events are not sorted by time because the
-  // subset of events will, on average, be trivally small.
+  // REQUIRED: Sorts all events by pid and then by time, and indexes the events
+  // of each pid. This makes it possible to find the events of a pid in
+  // constant time and the event at a point in time with a binary search.
   void Sort();
 
   // Returns a snapshot that contains a process's pid and ppid, but contains the
@@ -139,6 +141,12 @@ class ProcessThreadTimeline {
     kWrite
   };
 
+  // The events of a pid: events_[begin, end).
+  struct Range {
+    uint32_t begin = 0;
+    uint32_t end = 0;
+  };
+
   // Effectively this is the same as:
   //
   //  events_for(pid).before(ts).sort_by_time().last()
@@ -150,6 +158,11 @@ class ProcessThreadTimeline {
 
   std::vector<Event> events_;
 
+  // Built by Sort(). Search() is called concurrently by the transforms (see
+  // TraceRedactor), so this must not change after Sort() (e.g. there is no
+  // last-hit cache).
+  base::FlatHashMap<int32_t, Range> pids_;
+
   Mode mode_ = Mode::kRead;
 };
 
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "src/trace_redaction/process_thread_timeline.h"
+
+namespace perfetto::trace_redaction {
+namespace {
+
+constexpr uint64_t kTraceDuration = 1000000000;
+constexpr size_t kQueryCount = 1 << 16;
+
+// Each process has a uid and a few threads, which inherit the uid through
+// their parent. Every other thread is reused once, i.e. its pid has two
+// lifespans. |state.range(0)| is the number of processes.
+void FillTimeline(benchmark::State& state, ProcessThreadTimeline* timeline) {
+  constexpr int32_t kThreadsPerProcess = 8;
+
+  std::minstd_rand rnd(0);
+  auto process_count = static_cast<int32_t>(state.range(0));
+  int32_t next_pid = 1;
+
+  for (int32_t p = 0; p < process_count; ++p) {
+    int32_t pid = next_pid++;
+    uint64_t start = rnd() % (kTraceDuration / 2);
+    timeline->Append(ProcessThreadTimeline::Event::Open(
+        start, pid, 0, static_cast<uint64_t>(10000 + p)));
+
+    for (int32_t t = 0; t < kThreadsPerProcess; ++t) {
+      int32_t tid = next_pid++;
+      uint64_t open = start + rnd() % (kTraceDuration / 4);
+      uint64_t close = open + rnd() % (kTraceDuration / 8);
+      timeline->Append(ProcessThreadTimeline::Event::Open(open, tid, pid));
+      timeline->Append(ProcessThreadTimeline::Event::Close(close, tid));
+
+      if (t % 2) {
+        timeline->Append(ProcessThreadTimeline::Event::Open(close + 1, tid,
+                                                            pid));
+      }
+    }
+  }
+}
+
+std::vector<std::pair<uint64_t, int32_t>> MakeQueries(
+    benchmark::State& state) {
+  // Same as FillTimeline().
+  auto pid_count = static_cast<uint32_t>(state.range(0) * 9);
+
+  std::minstd_rand rnd(1);
+  std::vector<std::pair<uint64_t, int32_t>> queries(kQueryCount);
+  for (auto& query : queries) {
+    query.first = rnd() % kTraceDuration;
+    query.second = static_cast<int32_t>(1 + rnd() % pid_count);
+  }
+  return queries;
+}
+
+void BM_ProcessThreadTimelineSort(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    ProcessThreadTimeline timeline;
+    FillTimeline(state, &timeline);
+    state.ResumeTiming();
+
+    timeline.Sort();
+    benchmark::ClobberMemory();
+  }
+}
+
+void BM_ProcessThreadTimelineSearch(benchmark::State& state) {
+  ProcessThreadTimeline timeline;
+  FillTimeline(state, &timeline);
+  timeline.Sort();
+
+  auto queries = MakeQueries(state);
+
+  for (auto _ : state) {
+    for (const auto& [ts, pid] : queries) {
+      benchmark::DoNotOptimize(timeline.Search(ts, pid));
+    }
+  }
+
+  state.SetItemsProcessed(
+      static_cast<int64_t>(state.iterations() * queries.size()));
+}
+
+}  // namespace
+
+// Arg is the number of processes, each with 8 threads.
+BENCHMARK(BM_ProcessThreadTimelineSort)->RangeMultiplier(10)->Range(10, 10000);
+BENCHMARK(BM_ProcessThreadTimelineSearch)
+    ->RangeMultiplier(10)
+    ->Range(10, 10000);
+
+}  // namespace perfetto::trace_redaction
@@ -200,4 +200,31 @@ INSTANTIATE_TEST_SUITE_P(
                     SliceTestParams(kTimeD, kPidB, kUidA),
                     SliceTestParams(kTimeE, kPidB, kNoPackage)));
 
+// The pid is freed and reused at the same time. The events are appended in
+// order, so the last one wins.
+TEST_F(TimelineEventsTest, PidReusedAtSameTime) {
+  timeline_.Append(ProcessThreadTimeline::Event::Open(kTimeA, kPidB, 0, kUidA));
+  timeline_.Append(ProcessThreadTimeline::Event::Close(kTimeC, kPidB));
+  timeline_.Append(ProcessThreadTimeline::Event::Open(kTimeC, kPidB, 0, kUidB));
+
+  timeline_.Sort();
+
+  ASSERT_EQ(timeline_.Search(kTimeB, kPidB).uid, static_cast<uint64_t>(kUidA));
+  ASSERT_EQ(timeline_.Search(kTimeC, kPidB).uid, static_cast<uint64_t>(kUidB));
+  ASSERT_EQ(timeline_.Search(kTimeD, kPidB).uid, static_cast<uint64_t>(kUidB));
+}
+
+// Events don't need to be appended in time order.
+TEST_F(TimelineEventsTest, OutOfOrderEvents) {
+  timeline_.Append(ProcessThreadTimeline::Event::Close(kTimeE, kPidB));
+  timeline_.Append(ProcessThreadTimeline::Event::Open(kTimeC, kPidB, kPidA));
+  timeline_.Append(ProcessThreadTimeline::Event::Open(kTimeA, kPidA, 0, kUidA));
+
+  timeline_.Sort();
+
+  ASSERT_EQ(timeline_.Search(kTimeB, kPidB).uid, kNoPackage);
+  ASSERT_EQ(timeline_.Search(kTimeD, kPidB).uid, static_cast<uint64_t>(kUidA));
+  ASSERT_EQ(timeline_.Search(kTimeF, kPidB).uid, kNoPackage);
+}
+
 }  // namespace perfetto::trace_redaction
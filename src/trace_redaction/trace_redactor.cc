@@ -17,16 +17,19 @@
 #include "src/trace_redaction/trace_redactor.h"
 
 #include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "perfetto/base/status.h"
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
-#include "perfetto/ext/base/scoped_mmap.h"
-#include "perfetto/protozero/scattered_heap_buffer.h"
-#include "perfetto/trace_processor/trace_blob.h"
-#include "perfetto/trace_processor/trace_blob_view.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/protozero/proto_ring_buffer.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/trace_processor/util/status_macros.h"
 #include "src/trace_redaction/trace_redaction_framework.h"
 
@@ -37,6 +40,73 @@ namespace perfetto::trace_redaction {
 using Trace = protos::pbzero::Trace;
 using TracePacket = protos::pbzero::TracePacket;
 
+namespace {
+
+// Packets are handed to the threads in batches of roughly this many bytes, to
+// amortize the synchronization. Each thread gets a few batches at a time, so
+// uneven batches (e.g. mostly dropped packets) don't leave threads idle. This
+// also bounds the memory used by the pending output.
+constexpr size_t kBatchSizeBytes = 1024 * 1024;
+constexpr size_t kBatchesPerThread = 4;
+
+// The trace is never loaded as a whole: each pass reads it in chunks of this
+// size.
+constexpr size_t kReadChunkSize = 1024 * 1024;
+
+// Calls |fn| for each packet of the trace at |path|. Only the current chunk
+// (and the packet straddling its end, if any) is kept in memory. The packet
+// passed to |fn| is valid only for the duration of the call.
+template <typename Fn>
+base::Status ForEachPacket(const std::string& path, Fn fn) {
+  base::ScopedFile fd = base::OpenFile(path, O_RDONLY);
+  if (!fd) {
+    return base::ErrStatus("TraceRedactor: failed to open trace (%s)",
+                           path.c_str());
+  }
+
+  protozero::ProtoRingBuffer reader;
+  std::vector<uint8_t> chunk(kReadChunkSize);
+
+  for (;;) {
+    auto rsize = base::Read(*fd, chunk.data(), chunk.size());
+    if (rsize < 0) {
+      return base::ErrStatus("TraceRedactor: failed to read trace (%s)",
+                             path.c_str());
+    }
+    if (rsize == 0) {
+      return base::OkStatus();
+    }
+
+    reader.Append(chunk.data(), static_cast<size_t>(rsize));
+
+    for (;;) {
+      auto msg = reader.ReadMessage();
+      if (msg.fatal_framing_error) {
+        return base::ErrStatus("TraceRedactor: invalid trace (%s)",
+                               path.c_str());
+      }
+      if (!msg.valid()) {
+        break;
+      }
+      if (msg.field_id == Trace::kPacketFieldNumber) {
+        RETURN_IF_ERROR(fn(protozero::ConstBytes{msg.start, msg.len}));
+      }
+    }
+  }
+}
+
+}  // namespace
+
+struct TraceRedactor::TransformBatch {
+  // Copies of the packets, transformed in place.
+  std::vector<std::string> packets;
+  size_t size = 0;
+
+  // The serialized trace packets which survived the transformations.
+  std::string output;
+  base::Status status;
+};
+
 TraceRedactor::TraceRedactor() = default;
 
 TraceRedactor::~TraceRedactor() = default;
@@ -45,41 +115,31 @@ base::Status TraceRedactor::Redact(std::string_view source_filename,
                                    std::string_view dest_filename,
                                    Context* context) const {
   const std::string source_filename_str(source_filename);
-  base::ScopedMmap mapped =
-      base::ReadMmapWholeFile(source_filename_str.c_str());
-  if (!mapped.IsValid()) {
-    return base::ErrStatus("TraceRedactor: failed to map pages for trace (%s)",
-                           source_filename_str.c_str());
-  }
-
-  trace_processor::TraceBlobView whole_view(
-      trace_processor::TraceBlob::FromMmap(std::move(mapped)));
 
-  RETURN_IF_ERROR(Collect(context, whole_view));
+  RETURN_IF_ERROR(Collect(context, source_filename_str));
 
   for (const auto& builder : builders_) {
     RETURN_IF_ERROR(builder->Build(context));
   }
 
-  return Transform(*context, whole_view, std::string(dest_filename));
+  return Transform(*context, source_filename_str, std::string(dest_filename));
 }
 
-base::Status TraceRedactor::Collect(
-    Context* context,
-    const trace_processor::TraceBlobView& view) const {
+base::Status TraceRedactor::Collect(Context* context,
+                                    const std::string& source_file) const {
   for (const auto& collector : collectors_) {
     RETURN_IF_ERROR(collector->Begin(context));
   }
 
-  const Trace::Decoder trace_decoder(view.data(), view.length());
+  RETURN_IF_ERROR(
+      ForEachPacket(source_file, [&](protozero::ConstBytes bytes) {
+        const TracePacket::Decoder packet(bytes);
 
-  for (auto packet_it = trace_decoder.packet(); packet_it; ++packet_it) {
-    const TracePacket::Decoder packet(packet_it->as_bytes());
-
-    for (auto& collector : collectors_) {
-      RETURN_IF_ERROR(collector->Collect(packet, context));
-    }
-  }
+        for (auto& collector : collectors_) {
+          RETURN_IF_ERROR(collector->Collect(packet, context));
+        }
+        return base::OkStatus();
+      }));
 
   for (const auto& collector : collectors_) {
     RETURN_IF_ERROR(collector->End(context));
@@ -88,11 +148,9 @@ base::Status TraceRedactor::Collect(
   return base::OkStatus();
 }
 
-base::Status TraceRedactor::Transform(
-    const Context& context,
-    const trace_processor::TraceBlobView& view,
-    const std::string& dest_file) const {
-  std::ignore = context;
+base::Status TraceRedactor::Transform(const Context& context,
+                                      const std::string& source_file,
+                                      const std::string& dest_file) const {
   const auto dest_fd = base::OpenFile(dest_file, O_RDWR | O_CREAT, 0666);
 
   if (dest_fd.get() == -1) {
@@ -100,10 +158,73 @@ base::Status TraceRedactor::Transform(
         "Failed to open destination file; can't write redacted trace.");
   }
 
-  const Trace::Decoder trace_decoder(view.data(), view.length());
-  for (auto packet_it = trace_decoder.packet(); packet_it; ++packet_it) {
-    auto packet = packet_it->as_std_string();
+  uint32_t thread_count =
+      thread_count_ ? thread_count_ : base::ThreadPool::MaxConcurrency();
+
+  // The calling thread takes part in the work too.
+  std::unique_ptr<base::ThreadPool> thread_pool;
+  if (thread_count > 1) {
+    thread_pool = std::make_unique<base::ThreadPool>(thread_count - 1);
+  }
+
+  std::vector<TransformBatch> batches(thread_count * kBatchesPerThread);
+  size_t batch_count = 0;
+
+  // Transforms the first |batch_count| batches and writes them to disk, in
+  // order.
+  auto flush = [&]() -> base::Status {
+    auto fn = [&](size_t i) { TransformPackets(context, &batches[i]); };
+    if (thread_pool && batch_count > 1) {
+      thread_pool->ParallelFor(batch_count, fn);
+    } else {
+      for (size_t i = 0; i < batch_count; ++i) {
+        fn(i);
+      }
+    }
+
+    for (size_t i = 0; i < batch_count; ++i) {
+      TransformBatch& batch = batches[i];
+      RETURN_IF_ERROR(batch.status);
 
+      if (!batch.output.empty() &&
+          base::WriteAll(dest_fd.get(), batch.output.data(),
+                         batch.output.size()) <= 0) {
+        return base::ErrStatus(
+            "TraceRedactor: failed to write redacted trace to disk");
+      }
+
+      batch.packets.clear();
+      batch.size = 0;
+      batch.output.clear();
+    }
+
+    batch_count = 0;
+    return base::OkStatus();
+  };
+
+  RETURN_IF_ERROR(
+      ForEachPacket(source_file, [&](protozero::ConstBytes bytes) {
+        if (batch_count == 0 ||
+            batches[batch_count - 1].size >= kBatchSizeBytes) {
+          if (batch_count == batches.size()) {
+            RETURN_IF_ERROR(flush());
+          }
+          ++batch_count;
+        }
+
+        TransformBatch& batch = batches[batch_count - 1];
+        batch.packets.emplace_back(reinterpret_cast<const char*>(bytes.data),
+                                   bytes.size);
+        batch.size += bytes.size;
+        return base::OkStatus();
+      }));
+
+  return flush();
+}
+
+void TraceRedactor::TransformPackets(const Context& context,
+                                     TransformBatch* batch) const {
+  for (std::string& packet : batch->packets) {
     for (const auto& transformer : transformers_) {
       // If the packet has been cleared, it means a tranformation has removed it
       // from the trace. Stop processing it. This saves transforms from having
@@ -112,7 +233,10 @@ base::Status TraceRedactor::Transform(
         break;
       }
 
-      RETURN_IF_ERROR(transformer->Transform(context, &packet));
+      batch->status = transformer->Transform(context, &packet);
+      if (!batch->status.ok()) {
+        return;
+      }
     }
 
     // The packet has been removed from the trace. Don't write an empty packet
@@ -121,19 +245,16 @@ base::Status TraceRedactor::Transform(
       continue;
     }
 
-    protozero::HeapBuffered<protos::pbzero::Trace> serializer;
-    serializer->add_packet()->AppendRawProtoBytes(packet.data(), packet.size());
-    packet.assign(serializer.SerializeAsString());
-
-    if (const auto exported_data =
-            base::WriteAll(dest_fd.get(), packet.data(), packet.size());
-        exported_data <= 0) {
-      return base::ErrStatus(
-          "TraceRedactor: failed to write redacted trace to disk");
-    }
+    uint8_t preamble[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+    uint8_t* pos = protozero::proto_utils::WriteVarInt(
+        protozero::proto_utils::MakeTagLengthDelimited(
+            Trace::kPacketFieldNumber),
+        preamble);
+    pos = protozero::proto_utils::WriteVarInt(packet.size(), pos);
+    batch->output.append(reinterpret_cast<const char*>(preamble),
+                         static_cast<size_t>(pos - preamble));
+    batch->output.append(packet);
   }
-
-  return base::OkStatus();
 }
 
 }  // namespace perfetto::trace_redaction
@@ -17,13 +17,13 @@
 #ifndef SRC_TRACE_REDACTION_TRACE_REDACTOR_H_
 #define SRC_TRACE_REDACTION_TRACE_REDACTOR_H_
 
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <string_view>
 #include <vector>
 
 #include "perfetto/base/status.h"
-#include "perfetto/trace_processor/trace_blob_view.h"
 #include "src/trace_redaction/trace_redaction_framework.h"
 
 namespace perfetto::trace_redaction {
@@ -31,6 +31,11 @@ namespace perfetto::trace_redaction {
 // Removes sensitive information from Perfetto traces by executing collect,
 // build, and transforms primtives in the correct order.
 //
+// The source trace is read twice (once for the collectors, once for the
+// transforms), in chunks, and the output is written in chunks too. Hence the
+// memory usage depends on the size of the context, not on the size of the
+// trace.
+//
 // The caller is responsible for adding all neccessary primitives. Primitives
 // are not directly dependent on each other, but rather dependent on the
 // information inside of the context.
@@ -72,7 +77,17 @@ class TraceRedactor {
     return ptr;
   }
 
+  // Number of threads (including the calling one) used to run the transforms.
+  // Transforms only read the context, so packets are transformed in parallel,
+  // in batches. The output order matches the input order. Zero (the default)
+  // means base::ThreadPool::MaxConcurrency().
+  void set_thread_count(uint32_t thread_count) {
+    thread_count_ = thread_count;
+  }
+
  private:
+  struct TransformBatch;
+
   // Run all collectors on a packet because moving to the next package.
   //
   // ```
@@ -81,8 +96,7 @@ class TraceRedactor {
   //     for collector in collectors:
   //       collector(context, packet)
   // ```
-  base::Status Collect(Context* context,
-                       const trace_processor::TraceBlobView& view) const;
+  base::Status Collect(Context* context, const std::string& source_file) const;
 
   // Runs builders once.
   //
@@ -102,12 +116,18 @@ class TraceRedactor {
   //       transform(context, packet)
   // ```
   base::Status Transform(const Context& context,
-                         const trace_processor::TraceBlobView& view,
+                         const std::string& source_file,
                          const std::string& dest_file) const;
 
+  // Runs all transformers on the packets of a batch and serializes the
+  // remaining packets in the batch's output. Can run on any thread.
+  void TransformPackets(const Context& context, TransformBatch* batch) const;
+
   std::vector<std::unique_ptr<CollectPrimitive>> collectors_;
   std::vector<std::unique_ptr<BuildPrimitive>> builders_;
   std::vector<std::unique_ptr<TransformPrimitive>> transformers_;
+
+  uint32_t thread_count_ = 0;
 };
 
 }  // namespace perfetto::trace_redaction
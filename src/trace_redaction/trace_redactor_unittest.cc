@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cinttypes>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "perfetto/base/status.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "src/base/test/status_matchers.h"
+#include "src/base/test/tmp_dir_tree.h"
+#include "src/trace_redaction/trace_redaction_framework.h"
+#include "src/trace_redaction/trace_redactor.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto::trace_redaction {
+
+namespace {
+
+// Enough packets to span several batches, and several rounds of batches.
+constexpr uint64_t kPacketCount = 20000;
+constexpr size_t kPayloadSize = 512;
+
+// Removes the packets with an odd timestamp.
+class DropOddPackets : public TransformPrimitive {
+ public:
+  base::Status Transform(const Context&, std::string* packet) const override {
+    protos::pbzero::TracePacket::Decoder decoder(*packet);
+    if (decoder.timestamp() % 2) {
+      packet->clear();
+    }
+    return base::OkStatus();
+  }
+};
+
+class FailOnPacket : public TransformPrimitive {
+ public:
+  base::Status Transform(const Context&, std::string* packet) const override {
+    protos::pbzero::TracePacket::Decoder decoder(*packet);
+    if (decoder.timestamp() == kPacketCount / 2) {
+      return base::ErrStatus("FailOnPacket: %" PRIu64, decoder.timestamp());
+    }
+    return base::OkStatus();
+  }
+};
+
+class TraceRedactorTest : public testing::TestWithParam<uint32_t> {
+ protected:
+  void SetUp() override { redactor_.set_thread_count(GetParam()); }
+
+  void WriteTrace(uint64_t packet_count, size_t payload_size) {
+    protozero::HeapBuffered<protos::pbzero::Trace> trace;
+    std::vector<uint8_t> payload(payload_size, 0xaa);
+
+    for (uint64_t i = 0; i < packet_count; ++i) {
+      auto* packet = trace->add_packet();
+      packet->set_timestamp(i);
+      packet->set_synchronization_marker(payload.data(), payload.size());
+    }
+
+    std::string buffer = trace.SerializeAsString();
+    auto fd = base::OpenFile(tmp_dir_.AbsolutePath("src.pftrace"),
+                             O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    ASSERT_TRUE(fd);
+    ASSERT_EQ(base::WriteAll(*fd, buffer.data(), buffer.size()),
+              static_cast<ssize_t>(buffer.size()));
+    tmp_dir_.TrackFile("src.pftrace");
+  }
+
+  base::Status Redact() {
+    auto status = redactor_.Redact(tmp_dir_.AbsolutePath("src.pftrace"),
+                                   tmp_dir_.AbsolutePath("dst.pftrace"),
+                                   &context_);
+    tmp_dir_.TrackFile("dst.pftrace");
+    return status;
+  }
+
+  std::vector<uint64_t> ReadTimestamps() {
+    std::string buffer;
+    EXPECT_TRUE(base::ReadFile(tmp_dir_.AbsolutePath("dst.pftrace"), &buffer));
+
+    std::vector<uint64_t> timestamps;
+    protos::pbzero::Trace::Decoder trace(buffer);
+    for (auto it = trace.packet(); it; ++it) {
+      protos::pbzero::TracePacket::Decoder packet(*it);
+      timestamps.push_back(packet.timestamp());
+    }
+    return timestamps;
+  }
+
+  base::TmpDirTree tmp_dir_;
+  Context context_;
+  TraceRedactor redactor_;
+};
+
+TEST_P(TraceRedactorTest, PreservesPacketOrder) {
+  WriteTrace(kPacketCount, kPayloadSize);
+  redactor_.emplace_transform<DropOddPackets>();
+  ASSERT_OK(Redact());
+
+  std::vector<uint64_t> expected;
+  for (uint64_t i = 0; i < kPacketCount; i += 2) {
+    expected.push_back(i);
+  }
+  ASSERT_EQ(ReadTimestamps(), expected);
+}
+
+TEST_P(TraceRedactorTest, ReturnsTransformError) {
+  WriteTrace(kPacketCount, kPayloadSize);
+  redactor_.emplace_transform<FailOnPacket>();
+  auto status = Redact();
+  ASSERT_FALSE(status.ok());
+  ASSERT_EQ(status.message(), "FailOnPacket: 10000");
+}
+
+// The trace is read in chunks: packets larger than a chunk must be stitched
+// back together.
+TEST_P(TraceRedactorTest, PacketsLargerThanReadChunk) {
+  WriteTrace(5, 3 * 1024 * 1024);
+  redactor_.emplace_transform<DropOddPackets>();
+  ASSERT_OK(Redact());
+
+  ASSERT_THAT(ReadTimestamps(), testing::ElementsAre(0, 2, 4));
+}
+
+INSTANTIATE_TEST_SUITE_P(ThreadCounts,
+                         TraceRedactorTest,
+                         testing::Values(1u, 2u, 4u));
+
+}  // namespace
+
+}  // namespace perfetto::trace_redaction
@@ -19,6 +19,7 @@
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <optional>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -26,6 +27,7 @@
 #include "perfetto/ext/base/version.h"
 #include "src/traceconv/deobfuscate_profile.h"
 #include "src/traceconv/symbolize_profile.h"
+#include "src/traceconv/trace_slice.h"
 #include "src/traceconv/trace_to_hprof.h"
 #include "src/traceconv/trace_to_json.h"
 #include "src/traceconv/trace_to_profile.h"
@@ -49,7 +51,7 @@ int Usage(const char* argv0) {
           "Usage: %s MODE [OPTIONS] [input file] [output file]\n"
           "modes:\n"
           "  systrace|json|ctrace|text|profile|hprof|symbolize|deobfuscate"
-          "|decompress_packets\n"
+          "|decompress_packets|slice\n"
           "options:\n"
           "  [--truncate start|end]\n"
           "  [--full-sort]\n"
@@ -59,7 +61,16 @@ int Usage(const char* argv0) {
           "annotations\n"
           "  [--timestamps TIMESTAMP1,TIMESTAMP2,...] generate profiles "
           "only for these *specific* timestamps\n"
-          "  [--pid PID] generate profiles only for this process id\n",
+          "  [--pid PID] generate profiles only for this process id\n"
+          "\"decompress_packets\" mode options:\n"
+          "  [--threads N] inflate the compressed packets on N threads "
+          "(0: one per core, default: 1)\n"
+          "\"slice\" mode options:\n"
+          "  [--start-ts TS] [--end-ts TS] keep only the packets in this "
+          "range of trace (BOOTTIME) time\n"
+          "  [--producer-pid PID] keep only the packets written by this "
+          "producer process (e.g. traced_probes for ftrace), not the events "
+          "of this pid\n",
           argv0);
   return 1;
 }
@@ -82,6 +93,10 @@ int Main(int argc, char** argv) {
   bool full_sort = false;
   bool perf_profile = false;
   bool profile_no_annotations = false;
+  std::optional<uint32_t> threads;
+  std::optional<uint64_t> start_ts;
+  std::optional<uint64_t> end_ts;
+  std::optional<int32_t> producer_pid;
   for (int i = 1; i < argc; i++) {
     if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "--version") == 0) {
       printf("%s\n", base::GetVersionString());
@@ -114,6 +129,18 @@ int Main(int argc, char** argv) {
       profile_no_annotations = true;
     } else if (strcmp(argv[i], "--full-sort") == 0) {
       full_sort = true;
+    } else if (i <= argc && strcmp(argv[i], "--threads") == 0) {
+      i++;
+      threads = static_cast<uint32_t>(StringToUint64OrDie(argv[i]));
+    } else if (i <= argc && strcmp(argv[i], "--start-ts") == 0) {
+      i++;
+      start_ts = StringToUint64OrDie(argv[i]);
+    } else if (i <= argc && strcmp(argv[i], "--end-ts") == 0) {
+      i++;
+      end_ts = StringToUint64OrDie(argv[i]);
+    } else if (i <= argc && strcmp(argv[i], "--producer-pid") == 0) {
+      i++;
+      producer_pid = static_cast<int32_t>(StringToUint64OrDie(argv[i]));
     } else {
       positional_args.push_back(argv[i]);
     }
@@ -162,17 +189,29 @@ int Main(int argc, char** argv) {
 
   std::string format(positional_args[0]);
 
-  if ((format != "profile" && format != "hprof") &&
-      (pid != 0 || !timestamps.empty())) {
+  if ((format != "profile" && format != "hprof") && !timestamps.empty()) {
+    PERFETTO_ELOG("--timestamps is supported only for profile formats.");
+    return 1;
+  }
+  if ((format != "profile" && format != "hprof") && pid != 0) {
     PERFETTO_ELOG(
-        "--pid and --timestamps are supported only for profile "
-        "formats.");
+        "--pid is supported only for profile formats. For slice, see "
+        "--producer-pid.");
     return 1;
   }
   if (perf_profile && format != "profile") {
     PERFETTO_ELOG("--perf requires profile format.");
     return 1;
   }
+  if (threads && format != "decompress_packets") {
+    PERFETTO_ELOG("--threads requires decompress_packets format.");
+    return 1;
+  }
+  if ((start_ts || end_ts || producer_pid) && format != "slice") {
+    PERFETTO_ELOG(
+        "--start-ts, --end-ts and --producer-pid require slice format.");
+    return 1;
+  }
 
   if (format == "json")
     return TraceToJson(input_stream, output_stream, /*compress=*/false,
@@ -189,14 +228,14 @@ int Main(int argc, char** argv) {
   if (truncate_keep != Keep::kAll) {
     PERFETTO_ELOG(
         "--truncate is unsupported for "
-        "text|profile|symbolize|decompress_packets format.");
+        "text|profile|symbolize|decompress_packets|slice format.");
     return 1;
   }
 
   if (full_sort) {
     PERFETTO_ELOG(
         "--full-sort is unsupported for "
-        "text|profile|symbolize|decompress_packets format.");
+        "text|profile|symbolize|decompress_packets|slice format.");
     return 1;
   }
 
@@ -222,7 +261,18 @@ int Main(int argc, char** argv) {
     return DeobfuscateProfile(input_stream, output_stream);
 
   if (format == "decompress_packets")
-    return UnpackCompressedPackets(input_stream, output_stream);
+    return UnpackCompressedPackets(input_stream, output_stream,
+                                   threads.value_or(1))
+               ? 0
+               : 1;
+
+  if (format == "slice") {
+    TraceSliceOptions options;
+    options.start_ts = start_ts;
+    options.end_ts = end_ts;
+    options.producer_pid = producer_pid;
+    return SliceTrace(input_stream, output_stream, options) ? 0 : 1;
+  }
 
   return Usage(argv[0]);
 }
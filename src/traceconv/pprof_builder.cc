@@ -31,6 +31,7 @@
 #include <vector>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
 #include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
@@ -183,7 +184,9 @@ std::optional<int64_t> GetStatsEntry(
 // Interns Locations, Lines, and Functions. Interning is done by the entity's
 // contents, and has no relation to the row ids in the SQL tables.
 // Contains all data for the trace, so can be reused when emitting multiple
-// profiles.
+// profiles. Callstacks are kept as a tree (the location and parent of each
+// callsite) rather than as the full list of locations of each callsite, so
+// memory grows with the number of callsites rather than with their depth.
 //
 // TODO(rsavitski): consider moving mappings into here as well. For now, they're
 // still emitted in a single scan during profile building. Mappings should be
@@ -192,57 +195,94 @@ std::optional<int64_t> GetStatsEntry(
 class LocationTracker {
  public:
   int64_t InternLocation(Location loc) {
-    auto it = locations_.find(loc);
-    if (it == locations_.end()) {
-      bool inserted = false;
-      std::tie(it, inserted) = locations_.emplace(
-          std::move(loc), static_cast<int64_t>(locations_.size()));
-      PERFETTO_DCHECK(inserted);
-    }
-    return it->second;
+    int64_t next_id = static_cast<int64_t>(locations_.size());
+    return *locations_.Insert(std::move(loc), next_id).first;
   }
 
   int64_t InternFunction(Function func) {
-    auto it = functions_.find(func);
-    if (it == functions_.end()) {
-      bool inserted = false;
-      std::tie(it, inserted) =
-          functions_.emplace(func, static_cast<int64_t>(functions_.size()));
-      PERFETTO_DCHECK(inserted);
+    int64_t next_id = static_cast<int64_t>(functions_.size());
+    return *functions_.Insert(func, next_id).first;
+  }
+
+  bool IsCallsiteProcessed(int64_t callsite_id) const {
+    return static_cast<size_t>(callsite_id) < callsites_.size() &&
+           callsites_[static_cast<size_t>(callsite_id)].location_id >= 0;
+  }
+
+  // Sets the location of |callsite_id|, whose parent (-1 for a root) has been
+  // set before. nop if already set.
+  void MaybeSetCallsiteLocation(int64_t callsite_id,
+                                int64_t parent_id,
+                                int64_t location_id) {
+    PERFETTO_DCHECK(callsite_id >= 0);
+    size_t idx = static_cast<size_t>(callsite_id);
+    if (idx >= callsites_.size())
+      callsites_.resize(idx + 1);
+    if (callsites_[idx].location_id >= 0)
+      return;
+    callsites_[idx] = CallsiteLocation{parent_id, location_id};
+  }
+
+  // Calls |fn| with the location ids of |callsite_id| and of its ancestors,
+  // leaf-first. Returns the number of locations, 0 for an unknown callsite.
+  template <typename Fn>
+  size_t ForEachCallsiteLocation(int64_t callsite_id, Fn fn) const {
+    size_t count = 0;
+    while (IsCallsiteProcessed(callsite_id)) {
+      const CallsiteLocation& callsite =
+          callsites_[static_cast<size_t>(callsite_id)];
+      fn(callsite.location_id);
+      ++count;
+      callsite_id = callsite.parent_id;
     }
-    return it->second;
+    return count;
   }
 
-  bool IsCallsiteProcessed(int64_t callstack_id) const {
-    return callsite_to_locations_.find(callstack_id) !=
-           callsite_to_locations_.end();
+  const base::FlatHashMap<Location, int64_t>& AllLocations() const {
+    return locations_;
   }
-
-  void MaybeSetCallsiteLocations(int64_t callstack_id,
-                                 const std::vector<int64_t>& locs) {
-    // nop if already set
-    callsite_to_locations_.emplace(callstack_id, locs);
+  const base::FlatHashMap<Function, int64_t>& AllFunctions() const {
+    return functions_;
   }
 
-  const std::vector<int64_t>& LocationsForCallstack(
-      int64_t callstack_id) const {
-    auto it = callsite_to_locations_.find(callstack_id);
-    PERFETTO_CHECK(callstack_id >= 0 && it != callsite_to_locations_.end());
-    return it->second;
-  }
+ private:
+  struct CallsiteLocation {
+    int64_t parent_id = -1;
+    int64_t location_id = -1;
+  };
+
+  // Indexed by callsite id, as those are the (dense) row ids of the
+  // stack_profile_callsite table.
+  std::vector<CallsiteLocation> callsites_;
+  base::FlatHashMap<Location, int64_t> locations_;
+  base::FlatHashMap<Function, int64_t> functions_;
+};
 
-  const std::unordered_map<Location, int64_t>& AllLocations() const {
-    return locations_;
+// Set of the ids interned by LocationTracker, which are dense, so that it
+// only takes a bit per id.
+class InternedIdSet {
+ public:
+  void Insert(int64_t id) {
+    PERFETTO_DCHECK(id >= 0);
+    size_t idx = static_cast<size_t>(id);
+    if (idx >= bits_.size())
+      bits_.resize(idx + 1);
+    if (!bits_[idx]) {
+      bits_[idx] = true;
+      size_++;
+    }
   }
-  const std::unordered_map<Function, int64_t>& AllFunctions() const {
-    return functions_;
+
+  bool Contains(int64_t id) const {
+    return static_cast<size_t>(id) < bits_.size() &&
+           bits_[static_cast<size_t>(id)];
   }
 
+  size_t size() const { return size_; }
+
  private:
-  // Root-first location ids for a given callsite id.
-  std::unordered_map<int64_t, std::vector<int64_t>> callsite_to_locations_;
-  std::unordered_map<Location, int64_t> locations_;
-  std::unordered_map<Function, int64_t> functions_;
+  std::vector<bool> bits_;
+  size_t size_ = 0;
 };
 
 struct PreprocessedInline {
@@ -333,7 +373,7 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
         "order by depth asc";
     Iterator c_it = tp->ExecuteQuery(annotated_query);
 
-    std::vector<int64_t> callstack_loc_ids;
+    int64_t parent_cid = -1;
     while (c_it.Next()) {
       int64_t cid = c_it.Get(0).AsLong();
       auto annotation = c_it.Get(1).is_null() ? "" : c_it.Get(1).AsString();
@@ -393,10 +433,10 @@ LocationTracker PreprocessLocations(trace_processor::TraceProcessor* tp,
 
       int64_t loc_id = tracker.InternLocation(std::move(loc));
 
-      // Update the tracker with the locations so far (for example, at depth 2,
-      // we'll have 3 root-most locations in |callstack_loc_ids|).
-      callstack_loc_ids.push_back(loc_id);
-      tracker.MaybeSetCallsiteLocations(cid, callstack_loc_ids);
+      // Update the tracker with the location of this callsite, the ones of its
+      // parents were set by the previous iterations.
+      tracker.MaybeSetCallsiteLocation(cid, parent_cid, loc_id);
+      parent_cid = cid;
     }
 
     if (!c_it.Status().ok()) {
@@ -439,31 +479,29 @@ class GProfileBuilder {
   }
 
   bool AddSample(const protozero::PackedVarInt& values, int64_t callstack_id) {
-    const auto& location_ids = locations_.LocationsForCallstack(callstack_id);
-    if (location_ids.empty()) {
+    // The pprof format requires leaf-first location lists.
+    packed_locs_.Reset();
+    size_t depth = locations_.ForEachCallsiteLocation(
+        callstack_id, [this](int64_t location_id) {
+          packed_locs_.Append(ToPprofId(location_id));
+          // Remember the locations s.t. we only serialize the referenced ones.
+          seen_locations_.Insert(location_id);
+        });
+    if (depth == 0) {
       PERFETTO_DFATAL_OR_ELOG(
           "Failed to find frames for callstack id %" PRIi64 "", callstack_id);
       return false;
     }
 
-    // LocationTracker stores location lists root-first, but the pprof format
-    // requires leaf-first.
-    protozero::PackedVarInt packed_locs;
-    for (auto it = location_ids.rbegin(); it != location_ids.rend(); ++it)
-      packed_locs.Append(ToPprofId(*it));
-
     auto* gsample = result_->add_sample();
     gsample->set_value(values);
-    gsample->set_location_id(packed_locs);
-
-    // Remember the locations s.t. we only serialize the referenced ones.
-    seen_locations_.insert(location_ids.cbegin(), location_ids.cend());
+    gsample->set_location_id(packed_locs_);
     return true;
   }
 
   std::string CompleteProfile(trace_processor::TraceProcessor* tp) {
     std::set<int64_t> seen_mappings;
-    std::set<int64_t> seen_functions;
+    InternedIdSet seen_functions;
 
     if (!WriteLocations(&seen_mappings, &seen_functions))
       return {};
@@ -479,16 +517,13 @@ class GProfileBuilder {
  private:
   // Serializes the Profile.Location entries referenced by this profile.
   bool WriteLocations(std::set<int64_t>* seen_mappings,
-                      std::set<int64_t>* seen_functions) {
-    const std::unordered_map<Location, int64_t>& locations =
-        locations_.AllLocations();
-
+                      InternedIdSet* seen_functions) {
     size_t written_locations = 0;
-    for (const auto& loc_and_id : locations) {
-      const auto& loc = loc_and_id.first;
-      int64_t id = loc_and_id.second;
+    for (auto it = locations_.AllLocations().GetIterator(); it; ++it) {
+      const Location& loc = it.key();
+      int64_t id = it.value();
 
-      if (seen_locations_.find(id) == seen_locations_.end())
+      if (!seen_locations_.Contains(id))
         continue;
 
       written_locations += 1;
@@ -500,14 +535,14 @@ class GProfileBuilder {
 
       if (!loc.inlined_functions.empty()) {
         for (const auto& line : loc.inlined_functions) {
-          seen_functions->insert(line.function_id);
+          seen_functions->Insert(line.function_id);
 
           auto* gline = glocation->add_line();
           gline->set_function_id(ToPprofId(line.function_id));
           gline->set_line(line.line_no);
         }
       } else {
-        seen_functions->insert(loc.single_function_id);
+        seen_functions->Insert(loc.single_function_id);
 
         glocation->add_line()->set_function_id(
             ToPprofId(loc.single_function_id));
@@ -524,16 +559,13 @@ class GProfileBuilder {
   }
 
   // Serializes the Profile.Function entries referenced by this profile.
-  bool WriteFunctions(const std::set<int64_t>& seen_functions) {
-    const std::unordered_map<Function, int64_t>& functions =
-        locations_.AllFunctions();
-
+  bool WriteFunctions(const InternedIdSet& seen_functions) {
     size_t written_functions = 0;
-    for (const auto& func_and_id : functions) {
-      const auto& func = func_and_id.first;
-      int64_t id = func_and_id.second;
+    for (auto it = locations_.AllFunctions().GetIterator(); it; ++it) {
+      const Function& func = it.key();
+      int64_t id = it.value();
 
-      if (seen_functions.find(id) == seen_functions.end())
+      if (!seen_functions.Contains(id))
         continue;
 
       written_functions += 1;
@@ -602,16 +634,12 @@ class GProfileBuilder {
   }
 
   int64_t ToStringTableId(StringId interned_id) {
-    auto it = interning_remapper_.find(interned_id);
-    if (it == interning_remapper_.end()) {
-      int64_t table_id = static_cast<int64_t>(string_table_.size());
+    int64_t next_table_id = static_cast<int64_t>(string_table_.size());
+    auto id_and_inserted =
+        interning_remapper_.Insert(interned_id, next_table_id);
+    if (id_and_inserted.second)
       string_table_.push_back(interned_id);
-      bool inserted = false;
-      std::tie(it, inserted) =
-          interning_remapper_.emplace(interned_id, table_id);
-      PERFETTO_DCHECK(inserted);
-    }
-    return it->second;
+    return *id_and_inserted.first;
   }
 
   // Contains all locations, lines, functions (in memory):
@@ -625,7 +653,7 @@ class GProfileBuilder {
   // implicit id, so these structures remap the interned strings into sequential
   // ids. Only the strings referenced by this GProfileBuilder instance will be
   // added to the table.
-  std::unordered_map<StringId, int64_t> interning_remapper_;
+  base::FlatHashMap<StringId, int64_t> interning_remapper_;
   std::vector<StringId> string_table_;
 
   // Profile proto being serialized.
@@ -633,7 +661,10 @@ class GProfileBuilder {
       result_;
 
   // Set of locations referenced by the added samples.
-  std::set<int64_t> seen_locations_;
+  InternedIdSet seen_locations_;
+
+  // Scratch buffer for the location ids of the sample being added.
+  protozero::PackedVarInt packed_locs_;
 };
 
 namespace heap_profile {
@@ -930,17 +961,20 @@ static bool TraceToPerfPprof(trace_processor::TraceProcessor* tp,
     GProfileBuilder builder(locations, &interner);
     builder.WriteSampleTypes({{"samples", "count"}});
 
-    std::string query = "select callsite_id from perf_sample where utid in (" +
-                        AsCsvString(process.utids) +
-                        ") and callsite_id is not null order by ts asc;";
-
-    protozero::PackedVarInt single_count_value;
-    single_count_value.Append(1);
+    // Samples with the same callstack are aggregated into a single one, so
+    // that the size of the profile doesn't grow with the number of samples.
+    std::string query =
+        "select callsite_id, count(*) from perf_sample where utid in (" +
+        AsCsvString(process.utids) +
+        ") and callsite_id is not null group by callsite_id;";
 
+    protozero::PackedVarInt count_value;
     Iterator it = tp->ExecuteQuery(query);
     while (it.Next()) {
       int64_t callsite_id = static_cast<int64_t>(it.Get(0).AsLong());
-      builder.AddSample(single_count_value, callsite_id);
+      count_value.Reset();
+      count_value.Append(it.Get(1).AsLong());
+      builder.AddSample(count_value, callsite_id);
     }
     if (!it.Status().ok()) {
       PERFETTO_DFATAL_OR_ELOG("Failed to iterate over samples: %s",
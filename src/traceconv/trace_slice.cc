@@ -0,0 +1,518 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traceconv/trace_slice.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <utility>
+#include <vector>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/protozero/proto_ring_buffer.h"
+#include "perfetto/protozero/field.h"
+#include "perfetto/protozero/proto_decoder.h"
+#include "perfetto/protozero/proto_utils.h"
+#include "perfetto/trace_processor/read_trace.h"
+#include "src/trace_processor/forwarding_trace_parser.h"
+#include "src/trace_processor/util/gzip_utils.h"
+#include "src/traceconv/utils.h"
+
+#include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/clock_snapshot.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/trace_packet_defaults.pbzero.h"
+
+namespace perfetto {
+namespace trace_to_text {
+namespace {
+
+using protos::pbzero::ClockSnapshot;
+using protos::pbzero::FtraceEvent;
+using protos::pbzero::FtraceEventBundle;
+using protos::pbzero::TracePacket;
+using protos::pbzero::TracePacketDefaults;
+
+constexpr uint32_t kBoottimeClockId = protos::pbzero::BUILTIN_CLOCK_BOOTTIME;
+constexpr uint32_t kFirstSequenceScopedClockId = 64;
+
+struct TimeRange {
+  uint64_t start;
+  uint64_t end;
+};
+
+// Maps timestamps of any clock seen in a ClockSnapshot to CLOCK_BOOTTIME, the
+// default trace clock. Unlike trace processor's ClockTracker this only knows
+// about direct conversions to BOOTTIME, which is all the snapshots emitted by
+// the tracing service need.
+class ClockIndex {
+ public:
+  void AddSnapshot(uint32_t seq_id, const ClockSnapshot::Decoder& snapshot) {
+    std::optional<uint64_t> boottime;
+    for (auto it = snapshot.clocks(); it; ++it) {
+      ClockSnapshot::Clock::Decoder clock(*it);
+      if (clock.clock_id() == kBoottimeClockId)
+        boottime = clock.timestamp();
+    }
+    if (!boottime)
+      return;
+    for (auto it = snapshot.clocks(); it; ++it) {
+      ClockSnapshot::Clock::Decoder clock(*it);
+      // Incremental clocks and custom units would require replaying the
+      // whole sequence: leave the packets using them alone.
+      if (clock.clock_id() == kBoottimeClockId || clock.is_incremental() ||
+          clock.unit_multiplier_ns() > 1) {
+        continue;
+      }
+      Sample sample{clock.timestamp(), *boottime};
+      samples_[Key(seq_id, clock.clock_id())].push_back(sample);
+    }
+  }
+
+  // Must be called once all the snapshots have been added.
+  void Sort() {
+    for (auto it = samples_.GetIterator(); it; ++it) {
+      std::sort(it.value().begin(), it.value().end(),
+                [](const Sample& a, const Sample& b) { return a.ts < b.ts; });
+    }
+  }
+
+  std::optional<uint64_t> ToBoottime(uint32_t seq_id,
+                                     uint32_t clock_id,
+                                     uint64_t ts) const {
+    if (clock_id == kBoottimeClockId)
+      return ts;
+    const std::vector<Sample>* samples = samples_.Find(Key(seq_id, clock_id));
+    if (!samples || samples->empty())
+      return std::nullopt;
+
+    // Use the closest snapshot taken before |ts|, falling back on the first
+    // one for events which precede all snapshots.
+    auto it = std::upper_bound(
+        samples->begin(), samples->end(), ts,
+        [](uint64_t value, const Sample& s) { return value < s.ts; });
+    const Sample& sample = it == samples->begin() ? *it : *std::prev(it);
+    int64_t delta = static_cast<int64_t>(ts - sample.ts);
+    return static_cast<uint64_t>(static_cast<int64_t>(sample.boottime) +
+                                 delta);
+  }
+
+ private:
+  struct Sample {
+    uint64_t ts;
+    uint64_t boottime;
+  };
+
+  static uint64_t Key(uint32_t seq_id, uint32_t clock_id) {
+    if (clock_id < kFirstSequenceScopedClockId)
+      seq_id = 0;
+    return (static_cast<uint64_t>(seq_id) << 32) | clock_id;
+  }
+
+  base::FlatHashMap<uint64_t, std::vector<Sample>> samples_;
+};
+
+// The incremental state of a packet sequence which hasn't been written to the
+// output yet.
+struct SequenceState {
+  std::optional<uint32_t> default_clock_id;
+
+  // The packets carrying interned data, packet defaults or incremental state
+  // clears since the last clear, already stripped of their payload, which
+  // will need to be re-emitted before the next packet kept on this sequence.
+  std::string pending_state;
+
+  // Whether the state of the sequence has been flushed to the output. After
+  // that, state packets are emitted as they come.
+  bool state_written = false;
+};
+
+bool IsMetadata(const TracePacket::Decoder& packet) {
+  return packet.has_clock_snapshot() || packet.has_trace_config() ||
+         packet.has_trace_uuid() || packet.has_system_info() ||
+         packet.has_trace_stats() || packet.has_service_event() ||
+         packet.has_synchronization_marker() || packet.has_process_tree() ||
+         packet.has_track_descriptor() || packet.has_packages_list();
+}
+
+bool ClearsIncrementalState(const TracePacket::Decoder& packet) {
+  return packet.incremental_state_cleared() ||
+         (packet.sequence_flags() &
+          TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+}
+
+// Ftrace bundles hold the events read from one cpu buffer in a single packet:
+// compute the range they span rather than relying on the packet timestamp.
+std::optional<TimeRange> GetFtraceBundleRange(protozero::ConstBytes bytes) {
+  FtraceEventBundle::Decoder bundle(bytes);
+  uint64_t min_ts = std::numeric_limits<uint64_t>::max();
+  uint64_t max_ts = 0;
+  auto add_ts = [&min_ts, &max_ts](uint64_t ts) {
+    min_ts = std::min(min_ts, ts);
+    max_ts = std::max(max_ts, ts);
+  };
+
+  for (auto it = bundle.event(); it; ++it) {
+    FtraceEvent::Decoder event(*it);
+    if (event.has_timestamp())
+      add_ts(event.timestamp());
+  }
+
+  bool parse_error = false;
+  if (bundle.has_compact_sched()) {
+    FtraceEventBundle::CompactSched::Decoder sched(bundle.compact_sched());
+    uint64_t ts = 0;
+    for (auto it = sched.switch_timestamp(&parse_error); it; ++it)
+      add_ts(ts += *it);
+    ts = 0;
+    for (auto it = sched.waking_timestamp(&parse_error); it; ++it)
+      add_ts(ts += *it);
+  }
+  for (auto ce = bundle.compact_events(); ce; ++ce) {
+    FtraceEventBundle::CompactEvents::Decoder events(*ce);
+    uint64_t ts = 0;
+    for (auto it = events.timestamp(&parse_error); it; ++it)
+      add_ts(ts += *it);
+  }
+  if (parse_error || min_ts > max_ts)
+    return std::nullopt;
+
+  // Bundles recorded with a non-boot ftrace clock carry the offset to apply.
+  if (bundle.ftrace_clock() != 0) {
+    if (!bundle.has_ftrace_timestamp() || !bundle.has_boot_timestamp())
+      return std::nullopt;
+    int64_t offset = bundle.boot_timestamp() - bundle.ftrace_timestamp();
+    min_ts = static_cast<uint64_t>(static_cast<int64_t>(min_ts) + offset);
+    max_ts = static_cast<uint64_t>(static_cast<int64_t>(max_ts) + offset);
+  }
+  return TimeRange{min_ts, max_ts};
+}
+
+// Returns the BOOTTIME range covered by |packet|, or nullopt if it can't be
+// determined.
+std::optional<TimeRange> GetPacketRange(const TracePacket::Decoder& packet,
+                                        const SequenceState& seq,
+                                        const ClockIndex& clocks) {
+  if (packet.has_ftrace_events())
+    return GetFtraceBundleRange(packet.ftrace_events());
+  if (!packet.has_timestamp())
+    return std::nullopt;
+
+  uint32_t clock_id = kBoottimeClockId;
+  if (packet.has_timestamp_clock_id()) {
+    clock_id = packet.timestamp_clock_id();
+  } else if (seq.default_clock_id) {
+    clock_id = *seq.default_clock_id;
+  }
+  auto ts = clocks.ToBoottime(packet.trusted_packet_sequence_id(), clock_id,
+                              packet.timestamp());
+  if (!ts)
+    return std::nullopt;
+  return TimeRange{*ts, *ts};
+}
+
+bool ShouldKeep(const TracePacket::Decoder& packet,
+                const SequenceState& seq,
+                const ClockIndex& clocks,
+                const TraceSliceOptions& options) {
+  if (IsMetadata(packet))
+    return true;
+  if (options.producer_pid && packet.has_trusted_pid() &&
+      packet.trusted_pid() != *options.producer_pid) {
+    return false;
+  }
+  if (!options.start_ts && !options.end_ts)
+    return true;
+
+  // Packets we can't place in time are kept: dropping them silently would be
+  // worse than a slightly larger output.
+  std::optional<TimeRange> range = GetPacketRange(packet, seq, clocks);
+  if (!range)
+    return true;
+  if (options.start_ts && range->end < *options.start_ts)
+    return false;
+  if (options.end_ts && range->start > *options.end_ts)
+    return false;
+  return true;
+}
+
+void AppendPacket(const uint8_t* data, size_t size, std::string* output) {
+  uint8_t preamble[16];
+  uint8_t* end = protozero::proto_utils::WriteVarInt(
+      protozero::proto_utils::MakeTagLengthDelimited(
+          protos::pbzero::Trace::kPacketFieldNumber),
+      preamble);
+  end = protozero::proto_utils::WriteVarInt(size, end);
+  output->append(reinterpret_cast<const char*>(preamble),
+                 static_cast<size_t>(end - preamble));
+  output->append(reinterpret_cast<const char*>(data), size);
+}
+
+// Re-emits |bytes| keeping only the fields that make up the incremental state
+// of the sequence, dropping the payload which is outside the slice.
+void AppendStrippedStatePacket(protozero::ConstBytes bytes,
+                               std::string* output) {
+  std::string stripped;
+  protozero::ProtoDecoder decoder(bytes);
+  for (auto field = decoder.ReadField(); field.valid();
+       field = decoder.ReadField()) {
+    switch (field.id()) {
+      case TracePacket::kTrustedUidFieldNumber:
+      case TracePacket::kTrustedPacketSequenceIdFieldNumber:
+      case TracePacket::kTrustedPidFieldNumber:
+      case TracePacket::kInternedDataFieldNumber:
+      case TracePacket::kSequenceFlagsFieldNumber:
+      case TracePacket::kIncrementalStateClearedFieldNumber:
+      case TracePacket::kTracePacketDefaultsFieldNumber:
+      case TracePacket::kFirstPacketOnSequenceFieldNumber:
+      case TracePacket::kMachineIdFieldNumber:
+        field.SerializeAndAppendTo(&stripped);
+        break;
+    }
+  }
+  AppendPacket(reinterpret_cast<const uint8_t*>(stripped.data()),
+               stripped.size(), output);
+}
+
+// Calls |fn| with |bytes|, or with each of the packets it holds if it has
+// compressed packets, which are inflated one packet at a time.
+base::Status ForEachInflatedPacket(
+    protozero::ConstBytes bytes,
+    const std::function<void(protozero::ConstBytes)>& fn) {
+  TracePacket::Decoder packet(bytes);
+  if (!packet.has_compressed_packets() &&
+      !packet.has_zstd_compressed_packets()) {
+    fn(bytes);
+    return base::OkStatus();
+  }
+  std::string framed;
+  AppendPacket(bytes.data, bytes.size, &framed);
+  std::vector<uint8_t> inflated;
+  base::Status status = trace_processor::DecompressTrace(
+      reinterpret_cast<const uint8_t*>(framed.data()), framed.size(),
+      &inflated);
+  if (!status.ok())
+    return status;
+  protos::pbzero::Trace::Decoder trace(inflated.data(), inflated.size());
+  for (auto it = trace.packet(); it; ++it)
+    fn(*it);
+  return base::OkStatus();
+}
+
+// Slices a trace seen as two passes over its packets.
+class TraceSlicer {
+ public:
+  explicit TraceSlicer(const TraceSliceOptions& options) : options_(options) {}
+
+  // First pass: indexes the clock snapshots, so packets of any clock can be
+  // placed on the trace timeline, whatever their position in the trace.
+  void IndexPacket(protozero::ConstBytes bytes) {
+    TracePacket::Decoder packet(bytes);
+    if (packet.has_clock_snapshot()) {
+      clocks_.AddSnapshot(packet.trusted_packet_sequence_id(),
+                          ClockSnapshot::Decoder(packet.clock_snapshot()));
+    }
+  }
+
+  void FinishIndexing() { clocks_.Sort(); }
+
+  // Second pass: appends to |output| the packet if it is in the slice, along
+  // with the incremental state it depends on.
+  void SlicePacket(protozero::ConstBytes bytes, std::string* output) {
+    TracePacket::Decoder packet(bytes);
+    SequenceState* seq =
+        sequences_.Insert(packet.trusted_packet_sequence_id(), {}).first;
+
+    bool has_state = false;
+    if (ClearsIncrementalState(packet)) {
+      *seq = SequenceState();
+      has_state = true;
+    }
+    if (packet.has_trace_packet_defaults()) {
+      TracePacketDefaults::Decoder defaults(packet.trace_packet_defaults());
+      if (defaults.has_timestamp_clock_id())
+        seq->default_clock_id = defaults.timestamp_clock_id();
+      has_state = true;
+    }
+    has_state |= packet.has_interned_data();
+
+    if (ShouldKeep(packet, *seq, clocks_, options_)) {
+      output->append(seq->pending_state);
+      std::string().swap(seq->pending_state);
+      seq->state_written = true;
+      AppendPacket(bytes.data, bytes.size, output);
+    } else if (has_state) {
+      AppendStrippedStatePacket(
+          bytes, seq->state_written ? output : &seq->pending_state);
+    }
+  }
+
+ private:
+  const TraceSliceOptions& options_;
+  ClockIndex clocks_;
+  base::FlatHashMap<uint32_t, SequenceState> sequences_;
+};
+
+// Reads |input| in chunks, inflating it if gzipped, and calls |fn| with each
+// of its packets.
+base::Status ForEachPacket(
+    std::istream* input,
+    const std::function<void(protozero::ConstBytes)>& fn) {
+  constexpr size_t kChunkSize = 1024 * 1024;
+  std::unique_ptr<char[]> chunk(new char[kChunkSize]);
+  protozero::ProtoRingBuffer ring_buffer;
+  base::Status status;
+  auto feed = [&ring_buffer, &status, &fn](const uint8_t* data, size_t len) {
+    if (!status.ok())
+      return;
+    ring_buffer.Append(data, len);
+    for (;;) {
+      auto token = ring_buffer.ReadMessage();
+      if (token.fatal_framing_error) {
+        status = base::ErrStatus("Trace is truncated or corrupted");
+        return;
+      }
+      if (!token.valid())
+        return;
+      if (token.field_id != protos::pbzero::Trace::kPacketFieldNumber)
+        continue;
+      status = ForEachInflatedPacket({token.start, token.len}, fn);
+      if (!status.ok())
+        return;
+    }
+  };
+
+  std::optional<trace_processor::util::GzipDecompressor> decompressor;
+  for (bool first = true;; first = false) {
+    input->read(chunk.get(), static_cast<std::streamsize>(kChunkSize));
+    if (input->bad())
+      return base::ErrStatus("Failed while reading trace");
+    size_t len = static_cast<size_t>(input->gcount());
+    if (len == 0)
+      break;
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(chunk.get());
+    if (first &&
+        trace_processor::GuessTraceType(data, len) ==
+            trace_processor::TraceType::kGzipTraceType) {
+      decompressor.emplace();
+    }
+    if (decompressor) {
+      using ResultCode = trace_processor::util::GzipDecompressor::ResultCode;
+      if (decompressor->FeedAndExtract(data, len, feed) == ResultCode::kError)
+        return base::ErrStatus("Failed while decompressing trace");
+    } else {
+      feed(data, len);
+    }
+    if (!status.ok())
+      return status;
+  }
+  if (ring_buffer.capacity() != ring_buffer.avail())
+    return base::ErrStatus("Trace is truncated or corrupted");
+  return base::OkStatus();
+}
+
+base::Status SliceStream(std::istream* input,
+                         std::ostream* output,
+                         const TraceSliceOptions& options) {
+  // The trace is read twice, from a file, rather than held in memory. A pipe
+  // can't be rewound, so it is buffered first.
+  std::stringstream buffered;
+  std::streampos start = input->tellg();
+  if (start == std::streampos(-1)) {
+    buffered << input->rdbuf();
+    input = &buffered;
+    start = 0;
+  }
+
+  TraceSlicer slicer(options);
+  base::Status status = ForEachPacket(
+      input, [&slicer](protozero::ConstBytes p) { slicer.IndexPacket(p); });
+  if (!status.ok())
+    return status;
+  slicer.FinishIndexing();
+
+  input->clear();
+  input->seekg(start);
+  if (!*input)
+    return base::ErrStatus("Failed to rewind the trace");
+
+  // The sliced packets are written out as they are found.
+  constexpr size_t kFlushSize = 1024 * 1024;
+  TraceWriter trace_writer(output);
+  std::string sliced;
+  status = ForEachPacket(
+      input, [&slicer, &sliced, &trace_writer](protozero::ConstBytes p) {
+        slicer.SlicePacket(p, &sliced);
+        if (sliced.size() >= kFlushSize) {
+          trace_writer.Write(sliced);
+          sliced.clear();
+        }
+      });
+  trace_writer.Write(sliced);
+  return status;
+}
+
+}  // namespace
+
+base::Status SliceTrace(const uint8_t* data,
+                        size_t size,
+                        const TraceSliceOptions& options,
+                        std::string* output) {
+  TraceSlicer slicer(options);
+  protos::pbzero::Trace::Decoder index_trace(data, size);
+  for (auto it = index_trace.packet(); it; ++it) {
+    base::Status status = ForEachInflatedPacket(
+        *it, [&slicer](protozero::ConstBytes p) { slicer.IndexPacket(p); });
+    if (!status.ok())
+      return status;
+  }
+  if (index_trace.bytes_left() != 0)
+    return base::ErrStatus("Trace is truncated or corrupted");
+  slicer.FinishIndexing();
+
+  protos::pbzero::Trace::Decoder trace(data, size);
+  for (auto it = trace.packet(); it; ++it) {
+    base::Status status = ForEachInflatedPacket(
+        *it, [&slicer, output](protozero::ConstBytes p) {
+          slicer.SlicePacket(p, output);
+        });
+    if (!status.ok())
+      return status;
+  }
+  return base::OkStatus();
+}
+
+bool SliceTrace(std::istream* input,
+                std::ostream* output,
+                const TraceSliceOptions& options) {
+  base::Status status = SliceStream(input, output, options);
+  if (!status.ok()) {
+    PERFETTO_ELOG("%s", status.c_message());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace trace_to_text
+}  // namespace perfetto
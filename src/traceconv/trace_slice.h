@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACECONV_TRACE_SLICE_H_
+#define SRC_TRACECONV_TRACE_SLICE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <optional>
+#include <string>
+
+#include "perfetto/base/status.h"
+
+namespace perfetto {
+namespace trace_to_text {
+
+struct TraceSliceOptions {
+  // Inclusive bounds, in trace time (CLOCK_BOOTTIME nanoseconds).
+  std::optional<uint64_t> start_ts;
+  std::optional<uint64_t> end_ts;
+
+  // If set, drops the packets written by any other producer process, as
+  // given by their |trusted_pid|. This is not the pid of the events within
+  // the packets: e.g. all the ftrace and process stats packets come from
+  // traced_probes. Packets without a |trusted_pid| and trace-wide metadata
+  // (clock snapshots, process tree, track descriptors, ...) are always kept.
+  std::optional<int32_t> producer_pid;
+};
+
+// Serialised trace -> serialised trace containing only the packets which
+// overlap the requested time range and/or producer. The interned data and
+// packet defaults that the kept packets depend on are re-emitted (stripped of
+// any payload) so the output can be parsed on its own.
+//
+// The input is read twice, in chunks, and the output written as it is
+// produced, so that neither is held in memory. Input which can't be rewound
+// (e.g. a pipe) is buffered in memory first. Gzipped traces and compressed
+// packets are inflated on the fly.
+bool SliceTrace(std::istream* input,
+                std::ostream* output,
+                const TraceSliceOptions& options);
+
+// As above, on a trace held in memory, which can have compressed packets but
+// not be gzipped. The sliced trace is appended to |output|.
+base::Status SliceTrace(const uint8_t* data,
+                        size_t size,
+                        const TraceSliceOptions& options,
+                        std::string* output);
+
+}  // namespace trace_to_text
+}  // namespace perfetto
+
+#endif  // SRC_TRACECONV_TRACE_SLICE_H_
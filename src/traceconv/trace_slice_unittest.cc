@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traceconv/trace_slice.h"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "perfetto/protozero/scattered_heap_buffer.h"
+#include "test/gtest_and_gmock.h"
+
+#include "protos/perfetto/common/builtin_clock.pbzero.h"
+#include "protos/perfetto/trace/clock_snapshot.pbzero.h"
+#include "protos/perfetto/trace/interned_data/interned_data.pbzero.h"
+#include "protos/perfetto/trace/test_event.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
+#include "protos/perfetto/trace/trace.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.pbzero.h"
+
+namespace perfetto {
+namespace trace_to_text {
+namespace {
+
+using protos::pbzero::TracePacket;
+using ::testing::ElementsAre;
+
+constexpr uint32_t kSeqId = 42;
+constexpr uint32_t kMonotonicClockId = 3;
+
+struct ParsedPacket {
+  uint64_t timestamp;
+  bool has_interned_data;
+  bool has_payload;
+};
+
+class TraceSliceTest : public ::testing::Test {
+ protected:
+  // Adds a packet on |kSeqId| whose payload is a for_testing message.
+  TracePacket* AddPacket(uint64_t ts) {
+    auto* packet = trace_->add_packet();
+    packet->set_trusted_packet_sequence_id(kSeqId);
+    packet->set_timestamp(ts);
+    packet->set_for_testing()->set_str("payload");
+    return packet;
+  }
+
+  std::vector<ParsedPacket> Slice(const TraceSliceOptions& options) {
+    std::vector<uint8_t> trace = trace_.SerializeAsArray();
+    std::string sliced;
+    EXPECT_TRUE(
+        SliceTrace(trace.data(), trace.size(), options, &sliced).ok());
+
+    std::vector<ParsedPacket> packets;
+    protos::pbzero::Trace::Decoder decoder(sliced);
+    for (auto it = decoder.packet(); it; ++it) {
+      TracePacket::Decoder packet(*it);
+      if (packet.has_clock_snapshot())
+        continue;
+      packets.push_back({packet.timestamp(), packet.has_interned_data(),
+                         packet.has_for_testing()});
+    }
+    return packets;
+  }
+
+  protozero::HeapBuffered<protos::pbzero::Trace> trace_;
+};
+
+MATCHER_P3(IsPacket, ts, interned, payload, "") {
+  return arg.timestamp == ts && arg.has_interned_data == interned &&
+         arg.has_payload == payload;
+}
+
+TEST_F(TraceSliceTest, KeepsPacketsInRange) {
+  for (uint64_t ts = 100; ts <= 500; ts += 100)
+    AddPacket(ts);
+
+  TraceSliceOptions options;
+  options.start_ts = 200;
+  options.end_ts = 400;
+  EXPECT_THAT(Slice(options),
+              ElementsAre(IsPacket(200u, false, true),
+                          IsPacket(300u, false, true),
+                          IsPacket(400u, false, true)));
+}
+
+TEST_F(TraceSliceTest, ReemitsIncrementalState) {
+  auto* first = AddPacket(100);
+  first->set_sequence_flags(TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+  first->set_interned_data()->add_event_names()->set_iid(1);
+  AddPacket(200);
+  AddPacket(300)->set_interned_data()->add_event_names()->set_iid(2);
+
+  TraceSliceOptions options;
+  options.start_ts = 250;
+  // The interned data of the packet at 100 is needed by the one at 300, but
+  // not its payload.
+  EXPECT_THAT(Slice(options), ElementsAre(IsPacket(0u, true, false),
+                                          IsPacket(300u, true, true)));
+}
+
+TEST_F(TraceSliceTest, ConvertsClocks) {
+  auto* snapshot = trace_->add_packet()->set_clock_snapshot();
+  auto* boottime = snapshot->add_clocks();
+  boottime->set_clock_id(protos::pbzero::BUILTIN_CLOCK_BOOTTIME);
+  boottime->set_timestamp(10000);
+  auto* monotonic = snapshot->add_clocks();
+  monotonic->set_clock_id(kMonotonicClockId);
+  monotonic->set_timestamp(1000);
+
+  // MONOTONIC 1100 and 1200 are BOOTTIME 10100 and 10200.
+  AddPacket(1100)->set_timestamp_clock_id(kMonotonicClockId);
+  AddPacket(1200)->set_timestamp_clock_id(kMonotonicClockId);
+
+  TraceSliceOptions options;
+  options.start_ts = 10150;
+  EXPECT_THAT(Slice(options), ElementsAre(IsPacket(1200u, false, true)));
+}
+
+TEST_F(TraceSliceTest, FiltersByProducerPid) {
+  AddPacket(100)->set_trusted_pid(1);
+  AddPacket(200)->set_trusted_pid(2);
+  AddPacket(300);
+
+  TraceSliceOptions options;
+  options.producer_pid = 2;
+  EXPECT_THAT(Slice(options), ElementsAre(IsPacket(200u, false, true),
+                                          IsPacket(300u, false, true)));
+}
+
+TEST_F(TraceSliceTest, StreamMatchesInMemory) {
+  for (uint64_t ts = 100; ts <= 500; ts += 100)
+    AddPacket(ts)->set_interned_data()->add_event_names()->set_iid(ts);
+  std::vector<uint8_t> trace = trace_.SerializeAsArray();
+
+  TraceSliceOptions options;
+  options.start_ts = 250;
+  std::string expected;
+  ASSERT_TRUE(
+      SliceTrace(trace.data(), trace.size(), options, &expected).ok());
+
+  std::istringstream input(std::string(trace.begin(), trace.end()));
+  std::ostringstream output;
+  ASSERT_TRUE(SliceTrace(&input, &output, options));
+  EXPECT_EQ(output.str(), expected);
+}
+
+TEST_F(TraceSliceTest, StreamRejectsTruncatedTrace) {
+  AddPacket(100);
+  std::vector<uint8_t> trace = trace_.SerializeAsArray();
+  std::istringstream input(std::string(trace.begin(), trace.end() - 1));
+  std::ostringstream output;
+  EXPECT_FALSE(SliceTrace(&input, &output, TraceSliceOptions()));
+}
+
+}  // namespace
+}  // namespace trace_to_text
+}  // namespace perfetto
@@ -18,10 +18,8 @@
 
 #include <algorithm>
 #include <limits>
-#include <optional>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include "perfetto/base/logging.h"
@@ -71,136 +69,97 @@ class BigEndianBuffer {
   void WriteByte(uint8_t val) { buf_.emplace_back(val); }
 
   void Write(const char* val, uint32_t sz) {
-    const char* end = val + sz;
-    while (val < end) {
-      WriteByte(static_cast<uint8_t>(*val));
-      val++;
-    }
+    buf_.insert(buf_.end(), val, val + sz);
   }
 
   size_t written() const { return buf_.size(); }
+  const char* data() const { return buf_.data(); }
 
-  void Flush(std::ostream* out) const {
-    out->write(buf_.data(), static_cast<std::streamsize>(buf_.size()));
-  }
+  void Clear() { buf_.clear(); }
 
  private:
   std::vector<char> buf_;
 };
 
+// Writes the records to the output as they are produced, through a buffer
+// of fixed size: the hprof is never held in memory as a whole.
 class HprofWriter {
  public:
-  HprofWriter(std::ostream* output) : output_(output) {}
-
-  void WriteBuffer(const BigEndianBuffer& buf) { buf.Flush(output_); }
+  explicit HprofWriter(std::ostream* output) : output_(output) {
+    out_buf_.reserve(kOutBufferSize);
+  }
+  ~HprofWriter() { Flush(); }
+
+  void WriteBuffer(const BigEndianBuffer& buf) {
+    if (out_buf_.size() + buf.written() > kOutBufferSize)
+      Flush();
+    if (buf.written() > kOutBufferSize) {
+      output_->write(buf.data(), static_cast<std::streamsize>(buf.written()));
+      return;
+    }
+    out_buf_.insert(out_buf_.end(), buf.data(), buf.data() + buf.written());
+  }
 
-  void WriteRecord(const uint8_t type,
-                   const std::function<void(BigEndianBuffer*)>&& writer) {
-    BigEndianBuffer buf;
-    buf.WriteByte(type);
+  template <typename Fn>
+  void WriteRecord(const uint8_t type, Fn writer) {
+    // The buffer is reused across records to avoid reallocating it.
+    record_.Clear();
+    record_.WriteByte(type);
     // ts offset
-    buf.WriteU4(0);
+    record_.WriteU4(0);
     // size placeholder
-    buf.WriteU4(0);
-    writer(&buf);
-    uint32_t record_sz = static_cast<uint32_t>(buf.written() - 9);
-    buf.SetU4(record_sz, 5);
-    WriteBuffer(buf);
+    record_.WriteU4(0);
+    writer(&record_);
+    uint32_t record_sz = static_cast<uint32_t>(record_.written() - 9);
+    record_.SetU4(record_sz, 5);
+    WriteBuffer(record_);
   }
 
- private:
-  std::ostream* output_;
-};
-
-// A Class from the heap dump.
-class ClassData {
- public:
-  explicit ClassData(uint64_t class_name_string_id)
-      : class_name_string_id_(class_name_string_id) {}
-
-  // Writes a HPROF LOAD_CLASS record for this Class
-  void WriteHprofLoadClass(HprofWriter* writer,
-                           uint64_t class_object_id,
-                           uint32_t class_serial_number) const {
-    writer->WriteRecord(0x02, [class_object_id, class_serial_number,
-                               this](BigEndianBuffer* buf) {
-      buf->WriteU4(class_serial_number);
-      buf->WriteId(class_object_id);
-      buf->WriteU4(kStackTraceSerialNumber);
-      buf->WriteId(class_name_string_id_);
-    });
+  void Flush() {
+    output_->write(out_buf_.data(),
+                   static_cast<std::streamsize>(out_buf_.size()));
+    out_buf_.clear();
   }
 
  private:
-  uint64_t class_name_string_id_;
-};
-
-// Ingested data from a Java Heap Profile for a name, location pair.
-// We need to support multiple class datas per pair as name, location is
-// not unique. Classloader should guarantee uniqueness but is not available
-// until S.
-class RawClassData {
- public:
-  void AddClass(uint64_t id, std::optional<uint64_t> superclass_id) {
-    ids_.push_back(std::make_pair(id, superclass_id));
-  }
-
-  void AddTemplate(uint64_t template_id) {
-    template_ids_.push_back(template_id);
-  }
-
-  // Transforms the raw data into one or more ClassData and adds them to the
-  // parameter map.
-  void ToClassData(std::unordered_map<uint64_t, ClassData>* id_to_class,
-                   uint64_t class_name_string_id) const {
-    // TODO(dinoderek) assert the two vectors have same length, iterate on both
-    for (auto it_ids = ids_.begin(); it_ids != ids_.end(); ++it_ids) {
-      // TODO(dinoderek) more data will be needed to write CLASS_DUMP
-      id_to_class->emplace(it_ids->first, ClassData(class_name_string_id));
-    }
-  }
+  static constexpr size_t kOutBufferSize = 1024 * 1024;
 
- private:
-  // Pair contains class ID and super class ID.
-  std::vector<std::pair<uint64_t, std::optional<uint64_t>>> ids_;
-  // Class id of the template
-  std::vector<uint64_t> template_ids_;
+  std::ostream* output_;
+  BigEndianBuffer record_;
+  std::vector<char> out_buf_;
 };
 
-// The Heap Dump data
+// The Heap Dump data. The records are written as the heap graph tables are
+// iterated, rather than collected first: the only state kept is the set of
+// strings already written.
 class HeapDump {
  public:
-  explicit HeapDump(trace_processor::TraceProcessor* tp) : tp_(tp) {}
-
-  void Ingest() { IngestClasses(); }
+  HeapDump(trace_processor::TraceProcessor* tp, HprofWriter* writer)
+      : tp_(tp), writer_(writer) {}
 
-  void Write(HprofWriter* writer) {
-    WriteStrings(writer);
-    WriteLoadClass(writer);
-  }
+  void Write() { WriteClasses(); }
 
  private:
   trace_processor::TraceProcessor* tp_;
+  HprofWriter* writer_;
 
   // String IDs start from 1 as 0 appears to be reserved.
   uint64_t next_string_id_ = 1;
-  // Strings to corresponding String ID
+  // Strings already written to corresponding String ID
   std::unordered_map<std::string, uint64_t> string_to_id_;
-  // Type ID to corresponding Class
-  std::unordered_map<uint64_t, ClassData> id_to_class_;
-
-  // Ingests and processes the class data from the heap dump.
-  void IngestClasses() {
-    // TODO(dinoderek): heap_graph_class does not support pid or ts filtering
 
-    std::map<std::pair<uint64_t, std::string>, RawClassData> raw_classes;
+  uint32_t next_class_serial_number_ = 1;
 
+  // Writes a LOAD CLASS record for each class of the heap dump, in id order,
+  // preceded by the STRING records of the class names seen for the first
+  // time.
+  void WriteClasses() {
+    // TODO(dinoderek): heap_graph_class does not support pid or ts filtering
     auto it = tp_->ExecuteQuery(R"(SELECT
           id,
-          IFNULL(deobfuscated_name, name),
-          superclass_id,
-          location
-        FROM heap_graph_class )");
+          IFNULL(deobfuscated_name, name)
+        FROM heap_graph_class
+        ORDER BY id)");
 
     while (it.Next()) {
       uint64_t id = static_cast<uint64_t>(it.Get(0).AsLong());
@@ -214,64 +173,41 @@ class HeapDump {
       } else {
         dname = raw_dname;
       }
-      uint64_t name_id = IngestString(dname);
-
-      auto raw_super_id = it.Get(2);
-      std::optional<uint64_t> maybe_super_id =
-          raw_super_id.is_null()
-              ? std::nullopt
-              : std::optional<uint64_t>(
-                    static_cast<uint64_t>(raw_super_id.AsLong()));
-
-      std::string location(it.Get(3).AsString());
-
-      auto raw_classes_it =
-          raw_classes.emplace(std::make_pair(name_id, location), RawClassData())
-              .first;
-      if (is_template_class) {
-        raw_classes_it->second.AddTemplate(id);
-      } else {
-        raw_classes_it->second.AddClass(id, maybe_super_id);
-      }
-    }
-
-    for (const auto& raw : raw_classes) {
-      auto class_name_string_id = raw.first.first;
-      raw.second.ToClassData(&id_to_class_, class_name_string_id);
-    }
-  }
+      uint64_t name_id = WriteString(dname);
 
-  // Ingests the parameter string and returns the HPROF ID for the string.
-  uint64_t IngestString(const std::string& s) {
-    auto maybe_id = string_to_id_.find(s);
-    if (maybe_id != string_to_id_.end()) {
-      return maybe_id->second;
-    } else {
-      auto id = next_string_id_;
-      next_string_id_ += 1;
-      string_to_id_[s] = id;
-      return id;
+      // TODO(dinoderek) more data will be needed to write CLASS_DUMP and
+      // to make use of the template classes.
+      if (!is_template_class)
+        WriteLoadClass(id, name_id);
     }
   }
 
-  // Writes STRING sections to the output
-  void WriteStrings(HprofWriter* writer) {
-    for (const auto& it : string_to_id_) {
-      writer->WriteRecord(0x01, [it](BigEndianBuffer* buf) {
-        buf->WriteId(it.second);
-        // TODO(dinoderek): UTF-8 encoding
-        buf->Write(it.first.c_str(), static_cast<uint32_t>(it.first.length()));
-      });
-    }
+  // Returns the HPROF ID for the parameter string, writing its STRING record
+  // the first time it is seen.
+  uint64_t WriteString(const std::string& s) {
+    auto it_and_inserted = string_to_id_.emplace(s, next_string_id_);
+    if (!it_and_inserted.second)
+      return it_and_inserted.first->second;
+
+    uint64_t id = next_string_id_++;
+    writer_->WriteRecord(0x01, [&s, id](BigEndianBuffer* buf) {
+      buf->WriteId(id);
+      // TODO(dinoderek): UTF-8 encoding
+      buf->Write(s.c_str(), static_cast<uint32_t>(s.length()));
+    });
+    return id;
   }
 
-  // Writes LOAD CLASS sections to the output
-  void WriteLoadClass(HprofWriter* writer) {
-    uint32_t class_serial_number = 1;
-    for (const auto& it : id_to_class_) {
-      it.second.WriteHprofLoadClass(writer, it.first, class_serial_number);
-      class_serial_number += 1;
-    }
+  // Writes a HPROF LOAD_CLASS record for a Class
+  void WriteLoadClass(uint64_t class_object_id, uint64_t class_name_string_id) {
+    uint32_t class_serial_number = next_class_serial_number_++;
+    writer_->WriteRecord(0x02, [class_object_id, class_serial_number,
+                                class_name_string_id](BigEndianBuffer* buf) {
+      buf->WriteU4(class_serial_number);
+      buf->WriteId(class_object_id);
+      buf->WriteU4(kStackTraceSerialNumber);
+      buf->WriteId(class_name_string_id);
+    });
   }
 };
 
@@ -302,11 +238,11 @@ int TraceToHprof(trace_processor::TraceProcessor* tp,
   PERFETTO_DCHECK(tp != nullptr && pid != 0 && ts != 0);
 
   HprofWriter writer(output);
-  HeapDump dump(tp);
+  HeapDump dump(tp, &writer);
 
-  dump.Ingest();
   WriteHeaderAndStack(&writer);
-  dump.Write(&writer);
+  dump.Write();
+  writer.Flush();
 
   return 0;
 }
@@ -23,14 +23,23 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <optional>
+#include <string>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_writer.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/trace_processor/trace_processor.h"
+#include "src/trace_processor/db/column/types.h"
+#include "src/trace_processor/importers/common/system_info_tracker.h"
+#include "src/trace_processor/perfetto_sql/intrinsics/functions/to_ftrace.h"
+#include "src/trace_processor/trace_processor_impl.h"
+#include "src/trace_processor/types/trace_processor_context.h"
 #include "src/traceconv/utils.h"
 
 namespace perfetto {
@@ -159,19 +168,153 @@ class QueryWriter {
   TraceWriter* trace_writer_;
 };
 
-int ExtractRawEvents(TraceWriter* trace_writer,
-                     QueryWriter& q_writer,
+// Events are formatted in chunks of this many rows. Each thread gets a few
+// chunks at a time, so that a chunk of slow events (e.g. with many args)
+// doesn't leave the other threads idle. This also bounds the memory used by
+// the formatted events which are waiting to be written.
+constexpr uint32_t kEventsPerChunk = 8192;
+constexpr uint32_t kChunksPerThread = 4;
+
+void AppendEvent(const char* line, bool wrapped_in_json, std::string* out) {
+  if (!wrapped_in_json) {
+    out->append(line);
+    out->push_back('\n');
+    return;
+  }
+  for (uint32_t i = 0; line[i] != '\0'; i++) {
+    char c = line[i];
+    switch (c) {
+      case '\n':
+        out->append("\\n");
+        break;
+      case '\f':
+        out->append("\\f");
+        break;
+      case '\b':
+        out->append("\\b");
+        break;
+      case '\r':
+        out->append("\\r");
+        break;
+      case '\t':
+        out->append("\\t");
+        break;
+      case '\\':
+        out->append("\\\\");
+        break;
+      case '"':
+        out->append("\\\"");
+        break;
+      default:
+        out->push_back(c);
+        break;
+    }
+  }
+  out->append("\\n");
+}
+
+struct EventChunk {
+  uint32_t begin = 0;
+  uint32_t end = 0;
+
+  // The formatted events, escaped if wrapped in JSON.
+  std::string output;
+
+  // The id of the first event which could not be formatted, if any.
+  std::optional<uint32_t> failed_id;
+};
+
+// Formats the ftrace_event rows in [chunk->begin, chunk->end). Only reads
+// the storage, so different chunks can be formatted concurrently.
+void FormatEvents(trace_processor::TraceProcessorContext* context,
+                  bool wrapped_in_json,
+                  EventChunk* chunk) {
+  const auto& events = context->storage->ftrace_event_table();
+
+  // The serializer caches the arg layout of each event, so it can't be shared
+  // between threads.
+  trace_processor::SystraceSerializer serializer(context);
+  for (uint32_t row = chunk->begin; row < chunk->end; ++row) {
+    uint32_t id = events.id()[row].value;
+    auto line = serializer.SerializeToString(id);
+    if (!line) {
+      chunk->failed_id = id;
+      return;
+    }
+    AppendEvent(line.get(), wrapped_in_json, &chunk->output);
+  }
+}
+
+// Formats the ftrace_event rows in [begin, end) on all the available cores
+// and writes them to |trace_writer| in order.
+bool WriteEvents(trace_processor::TraceProcessorContext* context,
+                 uint32_t begin,
+                 uint32_t end,
+                 bool wrapped_in_json,
+                 TraceWriter* trace_writer) {
+  // The storage lazily creates a few things the first time they are needed:
+  // do that on this thread, before the workers start reading concurrently.
+  trace_processor::SystemInfoTracker::GetOrCreate(context);
+  context->storage->arg_table().QueryToRowMap(trace_processor::Query());
+
+  uint32_t thread_count = base::ThreadPool::MaxConcurrency();
+
+  // The calling thread takes part in the work too.
+  std::unique_ptr<base::ThreadPool> thread_pool;
+  if (thread_count > 1) {
+    thread_pool = std::make_unique<base::ThreadPool>(thread_count - 1);
+  }
+
+  std::vector<EventChunk> chunks(thread_count * kChunksPerThread);
+  uint32_t written = 0;
+  for (uint32_t row = begin; row < end;) {
+    size_t chunk_count = 0;
+    for (; chunk_count < chunks.size() && row < end; ++chunk_count) {
+      EventChunk& chunk = chunks[chunk_count];
+      chunk.begin = row;
+      chunk.end = std::min(end, row + kEventsPerChunk);
+      chunk.output.clear();
+      chunk.failed_id = std::nullopt;
+      row = chunk.end;
+    }
+
+    auto fn = [&](size_t i) {
+      FormatEvents(context, wrapped_in_json, &chunks[i]);
+    };
+    if (thread_pool && chunk_count > 1) {
+      thread_pool->ParallelFor(chunk_count, fn);
+    } else {
+      for (size_t i = 0; i < chunk_count; ++i) {
+        fn(i);
+      }
+    }
+
+    for (size_t i = 0; i < chunk_count; ++i) {
+      const EventChunk& chunk = chunks[i];
+      if (chunk.failed_id) {
+        PERFETTO_ELOG(
+            "Error while writing systrace to_ftrace: Cannot serialize row id "
+            "%u",
+            *chunk.failed_id);
+        return false;
+      }
+      trace_writer->Write(chunk.output);
+      written += chunk.end - chunk.begin;
+    }
+    fprintf(stderr, "Writing row %" PRIu32 "%c", written, kProgressChar);
+  }
+  return true;
+}
+
+int ExtractRawEvents(trace_processor::TraceProcessor* tp,
+                     TraceWriter* trace_writer,
                      bool wrapped_in_json,
                      Keep truncate_keep) {
-  using trace_processor::Iterator;
-
-  static const char kRawEventsCountSql[] = "select count(1) from ftrace_event";
-  uint32_t raw_events = 0;
-  auto e_callback = [&raw_events](Iterator* it, base::StringWriter*) {
-    raw_events = static_cast<uint32_t>(it->Get(0).long_value);
-  };
-  if (!q_writer.RunQuery(kRawEventsCountSql, e_callback))
-    return 1;
+  // The events are formatted straight from the storage rather than through
+  // SQL, which would serialize the formatting on a single thread.
+  trace_processor::TraceProcessorContext* context =
+      static_cast<trace_processor::TraceProcessorImpl*>(tp)->context();
+  uint32_t raw_events = context->storage->ftrace_event_table().row_count();
 
   if (raw_events == 0) {
     if (!wrapped_in_json) {
@@ -185,54 +328,10 @@ int ExtractRawEvents(TraceWriter* trace_writer,
   fprintf(stderr, "Converting ftrace events%c", kProgressChar);
   fflush(stderr);
 
-  auto raw_callback = [wrapped_in_json](Iterator* it,
-                                        base::StringWriter* writer) {
-    const char* line = it->Get(0 /* col */).string_value;
-    if (wrapped_in_json) {
-      for (uint32_t i = 0; line[i] != '\0'; i++) {
-        char c = line[i];
-        switch (c) {
-          case '\n':
-            writer->AppendLiteral("\\n");
-            break;
-          case '\f':
-            writer->AppendLiteral("\\f");
-            break;
-          case '\b':
-            writer->AppendLiteral("\\b");
-            break;
-          case '\r':
-            writer->AppendLiteral("\\r");
-            break;
-          case '\t':
-            writer->AppendLiteral("\\t");
-            break;
-          case '\\':
-            writer->AppendLiteral("\\\\");
-            break;
-          case '"':
-            writer->AppendLiteral("\\\"");
-            break;
-          default:
-            writer->AppendChar(c);
-            break;
-        }
-      }
-      writer->AppendChar('\\');
-      writer->AppendChar('n');
-    } else {
-      writer->AppendString(line);
-      writer->AppendChar('\n');
-    }
-  };
-
   // An estimate of 130b per ftrace event, allowing some space for the processes
   // and threads.
   const uint32_t max_ftrace_events = (140 * 1024 * 1024) / 130;
 
-  static const char kRawEventsQuery[] =
-      "select to_ftrace(id) from ftrace_event";
-
   // 1. Write the appropriate header for the file type.
   if (wrapped_in_json) {
     trace_writer->Write(",\n");
@@ -243,21 +342,15 @@ int ExtractRawEvents(TraceWriter* trace_writer,
   }
 
   // 2. Write the actual events.
+  uint32_t begin = 0;
+  uint32_t end = raw_events;
   if (truncate_keep == Keep::kEnd && raw_events > max_ftrace_events) {
-    base::StackString<150> end_truncate("%s limit %d offset %d",
-                                        kRawEventsQuery, max_ftrace_events,
-                                        raw_events - max_ftrace_events);
-    if (!q_writer.RunQuery(end_truncate.ToStdString(), raw_callback))
-      return 1;
+    begin = raw_events - max_ftrace_events;
   } else if (truncate_keep == Keep::kStart) {
-    base::StackString<150> start_truncate("%s limit %d", kRawEventsQuery,
-                                          max_ftrace_events);
-    if (!q_writer.RunQuery(start_truncate.ToStdString(), raw_callback))
-      return 1;
-  } else {
-    if (!q_writer.RunQuery(kRawEventsQuery, raw_callback))
-      return 1;
+    end = std::min(raw_events, max_ftrace_events);
   }
+  if (!WriteEvents(context, begin, end, wrapped_in_json, trace_writer))
+    return 1;
 
   // 3. Write the footer for JSON.
   if (wrapped_in_json)
@@ -340,8 +433,7 @@ int ExtractSystrace(trace_processor::TraceProcessor* tp,
 
     trace_writer->Write(kProcessDumpFooter);
   }
-  return ExtractRawEvents(trace_writer, q_writer, wrapped_in_json,
-                          truncate_keep);
+  return ExtractRawEvents(tp, trace_writer, wrapped_in_json, truncate_keep);
 }
 
 }  // namespace trace_to_text
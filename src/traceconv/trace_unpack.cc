@@ -29,12 +29,15 @@ namespace trace_to_text {
 
 // Naive: puts multiple copies of the trace in memory, but good enough for
 // manual workflows.
-bool UnpackCompressedPackets(std::istream* input, std::ostream* output) {
+bool UnpackCompressedPackets(std::istream* input,
+                             std::ostream* output,
+                             uint32_t thread_count) {
   std::vector<char> packed(std::istreambuf_iterator<char>{*input},
                            std::istreambuf_iterator<char>{});
   std::vector<uint8_t> unpacked;
   auto status = trace_processor::DecompressTrace(
-      reinterpret_cast<uint8_t*>(packed.data()), packed.size(), &unpacked);
+      reinterpret_cast<uint8_t*>(packed.data()), packed.size(), &unpacked,
+      thread_count);
   if (!status.ok())
     return false;
 
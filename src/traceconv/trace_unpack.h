@@ -17,6 +17,7 @@
 #ifndef SRC_TRACECONV_TRACE_UNPACK_H_
 #define SRC_TRACECONV_TRACE_UNPACK_H_
 
+#include <cstdint>
 #include <iostream>
 
 namespace perfetto {
@@ -24,7 +25,11 @@ namespace trace_to_text {
 
 // Serialised trace with compressed_packets -> serialised trace with those
 // packets in their decompressed form. Mostly for use with protoprofile.
-bool UnpackCompressedPackets(std::istream* input, std::ostream* output);
+// Compressed packets are inflated on |thread_count| threads (0 means one per
+// core).
+bool UnpackCompressedPackets(std::istream* input,
+                             std::ostream* output,
+                             uint32_t thread_count);
 
 }  // namespace trace_to_text
 }  // namespace perfetto
@@ -15,8 +15,13 @@
  */
 
 #include "src/traced/probes/android_log/android_log_data_source.h"
+
+#include <string.h>
+
+#include <algorithm>
 #include <optional>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
 #include "perfetto/base/time.h"
@@ -25,6 +30,7 @@
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/unix_socket.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/tracing/core/data_source_config.h"
@@ -34,6 +40,11 @@
 #include "protos/perfetto/trace/android/android_log.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+#include <sys/socket.h>
+#endif
+
 namespace perfetto {
 
 namespace {
@@ -42,6 +53,8 @@ using protos::pbzero::AndroidLogConfig;
 using protos::pbzero::AndroidLogId;
 
 constexpr size_t kBufSize = 4096;
+// How many events are received with a single recvmmsg().
+constexpr size_t kMaxEventsPerRecv = 32;
 const char kLogTagsPath[] = "/system/etc/event-log-tags";
 const char kLogdrSocket[] = "/dev/socket/logdr";
 
@@ -140,11 +153,13 @@ AndroidLogDataSource::AndroidLogDataSource(DataSourceConfig ds_config,
   }
   filter_tags_strbuf_.shrink_to_fit();
   // At this point pointers to |filter_tags_strbuf_| are stable.
-  for (const auto& it : tag_boundaries)
+  for (const auto& it : tag_boundaries) {
     filter_tags_.emplace(&filter_tags_strbuf_[it.first], it.second);
+    filter_tag_sizes_ |= 1ull << std::min(it.second, size_t(63));
+  }
 
   min_prio_ = cfg.min_prio();
-  buf_ = base::PagedMemory::Allocate(kBufSize);
+  buf_ = base::PagedMemory::Allocate(kBufSize * kMaxEventsPerRecv);
 }
 
 AndroidLogDataSource::~AndroidLogDataSource() {
@@ -226,10 +241,12 @@ void AndroidLogDataSource::ReadLogSocket() {
   protos::pbzero::AndroidLogPacket* log_packet = nullptr;
   size_t num_events = 0;
   bool stop = false;
-  ssize_t rsize;
-  while (!stop && (rsize = logdr_sock_.Receive(buf_.Get(), kBufSize)) > 0) {
-    num_events++;
-    stats_.num_total++;
+  size_t sizes[kMaxEventsPerRecv];
+  size_t num_received;
+  while (!stop &&
+         (num_received = ReceiveLogEvents(sizes, kMaxEventsPerRecv)) > 0) {
+    num_events += num_received;
+    stats_.num_total += num_received;
     // Don't hold the message loop for too long. If there are so many events
     // in the queue, stop at some point and parse the remaining ones in another
     // task (posted after this while loop).
@@ -241,66 +258,85 @@ void AndroidLogDataSource::ReadLogSocket() {
           weak_this->ReadLogSocket();
       });
     }
-    char* buf = reinterpret_cast<char*>(buf_.Get());
-    PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
-    size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
-    size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
-    if (payload_size + hdr_size > static_cast<size_t>(rsize)) {
-      PERFETTO_DLOG(
-          "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zd)",
-          hdr_size, payload_size, rsize);
-      stats_.num_failed++;
-      continue;
-    }
-    char* const end = buf + hdr_size + payload_size;
-
-    // In older versions of Android the logger_entry struct can contain less
-    // fields. Copy that in a temporary struct, so that unset fields are
-    // always zero-initialized.
-    logger_entry_v4 entry{};
-    memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
-    buf += hdr_size;
-
-    if (!packet) {
-      // Lazily add the packet on the first event. This is to avoid creating
-      // empty packets if there are no events in a task.
-      packet = writer_->NewTracePacket();
-      packet->set_timestamp(
-          static_cast<uint64_t>(base::GetBootTimeNs().count()));
-      log_packet = packet->set_android_log();
-    }
-
-    protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
-
-    if (entry.lid == AndroidLogId::LID_EVENTS) {
-      // Entries in the EVENTS buffer are special, they are binary encoded.
-      // See https://developer.android.com/reference/android/util/EventLog.
-      if (!ParseBinaryEvent(buf, end, log_packet, &evt)) {
-        PERFETTO_DLOG("Failed to parse Android log binary event");
+    for (size_t i = 0; i < num_received; i++) {
+      char* buf = reinterpret_cast<char*>(buf_.Get()) + i * kBufSize;
+      const size_t rsize = sizes[i];
+      PERFETTO_DCHECK(reinterpret_cast<uintptr_t>(buf) % 16 == 0);
+      size_t payload_size = reinterpret_cast<logger_entry_v4*>(buf)->len;
+      size_t hdr_size = reinterpret_cast<logger_entry_v4*>(buf)->hdr_size;
+      if (rsize < sizeof(uint16_t) * 2 || payload_size + hdr_size > rsize) {
+        PERFETTO_DLOG(
+            "Invalid Android log frame (hdr: %zu, payload: %zu, rsize: %zu)",
+            hdr_size, payload_size, rsize);
         stats_.num_failed++;
         continue;
       }
-    } else {
-      if (!ParseTextEvent(buf, end, log_packet, &evt)) {
+      char* const end = buf + hdr_size + payload_size;
+
+      // In older versions of Android the logger_entry struct can contain less
+      // fields. Copy that in a temporary struct, so that unset fields are
+      // always zero-initialized.
+      logger_entry_v4 entry{};
+      memcpy(&entry, buf, std::min(hdr_size, sizeof(entry)));
+      const char* payload = buf + hdr_size;
+
+      // Apply the filters before creating the packet or parsing anything.
+      const EventFormat* fmt = nullptr;
+      bool skip = false;
+      if (entry.lid == AndroidLogId::LID_EVENTS) {
+        // Entries in the EVENTS buffer are special, they are binary encoded.
+        // See https://developer.android.com/reference/android/util/EventLog.
+        int32_t eid;
+        if (!ReadAndAdvance(&payload, end, &eid) ||
+            !(fmt = GetEventFormat(eid))) {
+          // We got an event which doesn't have a corresponding entry in
+          // /system/etc/event-log-tags. In most cases this is a bug in the App
+          // that produced the event, which forgot to update the log tags
+          // dictionary.
+          PERFETTO_DLOG("Failed to parse Android log binary event");
+          stats_.num_failed++;
+          continue;
+        }
+        skip = fmt->filtered_out;
+      } else if (!FilterTextEvent(payload, end, &skip)) {
         PERFETTO_DLOG("Failed to parse Android log text event");
         stats_.num_failed++;
         continue;
       }
-    }
-    if (!evt) {
-      // Parsing succeeded but the event was skipped due to filters.
-      stats_.num_skipped++;
-      continue;
-    }
+      if (skip) {
+        stats_.num_skipped++;
+        continue;
+      }
 
-    // Add the common fields to the event.
-    uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
-    evt->set_timestamp(ts);
-    evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
-    evt->set_pid(entry.pid);
-    evt->set_tid(static_cast<int32_t>(entry.tid));
-    evt->set_uid(static_cast<int32_t>(entry.uid));
-  }  // while(logdr_sock_.Receive())
+      if (!packet) {
+        // Lazily add the packet on the first event. This is to avoid creating
+        // empty packets if there are no events in a task.
+        packet = writer_->NewTracePacket();
+        packet->set_timestamp(
+            static_cast<uint64_t>(base::GetBootTimeNs().count()));
+        log_packet = packet->set_android_log();
+      }
+
+      protos::pbzero::AndroidLogPacket::LogEvent* evt = nullptr;
+      bool parsed =
+          fmt ? ParseBinaryEvent(*fmt, payload, end, log_packet, &evt)
+              : ParseTextEvent(payload, end, log_packet, &evt);
+      if (!parsed) {
+        PERFETTO_DLOG("Failed to parse Android log %s event",
+                      fmt ? "binary" : "text");
+        stats_.num_failed++;
+        continue;
+      }
+
+      // Add the common fields to the event.
+      uint64_t ts = entry.sec * 1000000000ULL + entry.nsec;
+      evt->set_timestamp(ts);
+      evt->set_log_id(static_cast<protos::pbzero::AndroidLogId>(entry.lid));
+      evt->set_pid(entry.pid);
+      evt->set_tid(static_cast<int32_t>(entry.tid));
+      evt->set_uid(static_cast<int32_t>(entry.uid));
+    }  // for (i < num_received)
+  }    // while (ReceiveLogEvents())
 
   // Only print the log message if we have seen a bunch of events. This is to
   // avoid that we keep re-triggering the log socket by writing into the log
@@ -309,17 +345,47 @@ void AndroidLogDataSource::ReadLogSocket() {
     PERFETTO_DLOG("Seen %zu Android log events", num_events);
 }
 
-bool AndroidLogDataSource::ParseTextEvent(
-    const char* start,
-    const char* end,
-    protos::pbzero::AndroidLogPacket* packet,
-    protos::pbzero::AndroidLogPacket::LogEvent** out_evt) {
+size_t AndroidLogDataSource::ReceiveLogEvents(size_t* sizes,
+                                              size_t max_events) {
+  PERFETTO_DCHECK(max_events <= kMaxEventsPerRecv);
+  char* buf = reinterpret_cast<char*>(buf_.Get());
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // logdr is a SOCK_SEQPACKET socket, which returns a single event per recv():
+  // receive a batch of them with a single syscall instead.
+  struct iovec iovs[kMaxEventsPerRecv];
+  struct mmsghdr msgs[kMaxEventsPerRecv];
+  for (size_t i = 0; i < max_events; i++) {
+    iovs[i].iov_base = buf + i * kBufSize;
+    iovs[i].iov_len = kBufSize;
+    msgs[i] = {};
+    msgs[i].msg_hdr.msg_iov = &iovs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  int res = PERFETTO_EINTR(recvmmsg(logdr_sock_.fd(), msgs,
+                                    static_cast<unsigned>(max_events),
+                                    MSG_DONTWAIT, nullptr));
+  if (res <= 0)
+    return 0;
+  for (int i = 0; i < res; i++)
+    sizes[i] = msgs[i].msg_len;
+  return static_cast<size_t>(res);
+#else
+  ssize_t rsize = logdr_sock_.Receive(buf, kBufSize);
+  if (rsize <= 0 || max_events == 0)
+    return 0;
+  sizes[0] = static_cast<size_t>(rsize);
+  return 1;
+#endif
+}
+
+bool AndroidLogDataSource::FilterTextEvent(const char* start,
+                                           const char* end,
+                                           bool* skip) const {
   // Format: [Priority 1 byte] [ tag ] [ NUL ] [ message ]
-  const char* buf = start;
-  int8_t prio;
-  if (!ReadAndAdvance(&buf, end, &prio))
+  if (start >= end)
     return false;
-
+  int8_t prio = static_cast<int8_t>(*start);
   if (prio > 10) {
     PERFETTO_DLOG("Skipping log event with suspiciously high priority %d",
                   prio);
@@ -327,20 +393,44 @@ bool AndroidLogDataSource::ParseTextEvent(
   }
 
   // Skip if the user specified a min-priority filter in the config.
-  if (prio < min_prio_)
+  if (prio < min_prio_) {
+    *skip = true;
     return true;
+  }
 
-  // Find the null terminator that separates |tag| from |message|.
-  const char* str_end;
-  for (str_end = buf; str_end < end && *str_end; str_end++) {
+  if (filter_tags_.empty()) {
+    *skip = false;
+    return true;
   }
-  if (str_end >= end - 2)
+  const char* tag = start + 1;
+  const char* tag_end = static_cast<const char*>(
+      memchr(tag, '\0', static_cast<size_t>(end - tag)));
+  if (!tag_end || tag_end >= end - 2)
     return false;
+  size_t tag_size = static_cast<size_t>(tag_end - tag);
+  *skip = !(filter_tag_sizes_ & (1ull << std::min(tag_size, size_t(63)))) ||
+          filter_tags_.count(base::StringView(tag, tag_size)) == 0;
+  return true;
+}
 
-  auto tag = base::StringView(buf, static_cast<size_t>(str_end - buf));
-  if (!filter_tags_.empty() && filter_tags_.count(tag) == 0)
-    return true;
+bool AndroidLogDataSource::ParseTextEvent(
+    const char* start,
+    const char* end,
+    protos::pbzero::AndroidLogPacket* packet,
+    protos::pbzero::AndroidLogPacket::LogEvent** out_evt) {
+  // Format: [Priority 1 byte] [ tag ] [ NUL ] [ message ]
+  const char* buf = start;
+  int8_t prio;
+  if (!ReadAndAdvance(&buf, end, &prio))
+    return false;
+
+  // Find the null terminator that separates |tag| from |message|.
+  const char* str_end = static_cast<const char*>(
+      memchr(buf, '\0', static_cast<size_t>(end - buf)));
+  if (!str_end || str_end >= end - 2)
+    return false;
 
+  auto tag = base::StringView(buf, static_cast<size_t>(str_end - buf));
   auto* evt = packet->add_events();
   *out_evt = evt;
   evt->set_prio(static_cast<protos::pbzero::AndroidLogPriority>(prio));
@@ -359,37 +449,21 @@ bool AndroidLogDataSource::ParseTextEvent(
 }
 
 bool AndroidLogDataSource::ParseBinaryEvent(
+    const EventFormat& fmt,
     const char* start,
     const char* end,
     protos::pbzero::AndroidLogPacket* packet,
     protos::pbzero::AndroidLogPacket::LogEvent** out_evt) {
   const char* buf = start;
-  int32_t eid;
-  if (!ReadAndAdvance(&buf, end, &eid))
-    return false;
-
-  const EventFormat* fmt = GetEventFormat(eid);
-  if (!fmt) {
-    // We got an event which doesn't have a corresponding entry in
-    // /system/etc/event-log-tags. In most cases this is a bug in the App that
-    // produced the event, which forgot to update the log tags dictionary.
-    return false;
-  }
-
-  if (!filter_tags_.empty() &&
-      filter_tags_.count(base::StringView(fmt->name)) == 0) {
-    return true;
-  }
-
   auto* evt = packet->add_events();
   *out_evt = evt;
-  evt->set_tag(fmt->name.c_str());
+  evt->set_tag(fmt.name.c_str());
   size_t field_num = 0;
   while (buf < end) {
     char type = *(buf++);
-    if (field_num >= fmt->fields.size())
+    if (field_num >= fmt.fields.size())
       return true;
-    const char* field_name = fmt->fields[field_num].c_str();
+    const char* field_name = fmt.fields[field_num].c_str();
     switch (type) {
       case EVENT_TYPE_INT: {
         int32_t value;
@@ -446,7 +520,7 @@ bool AndroidLogDataSource::ParseBinaryEvent(
         PERFETTO_DLOG(
             "Skipping unknown Android log binary event of type %d for %s at pos"
             " %zd after parsing %zu fields",
-            static_cast<int>(type), fmt->name.c_str(), buf - start, field_num);
+            static_cast<int>(type), fmt.name.c_str(), buf - start, field_num);
         return true;
     }  // switch(type)
   }    // while(buf < end)
@@ -479,6 +553,13 @@ void AndroidLogDataSource::ParseEventLogDefinitions() {
       PERFETTO_DLOG("Could not parse event log format: %s", ss.cur_token());
     }
   }
+  // Resolve the tag filter once per format rather than once per event.
+  if (!filter_tags_.empty()) {
+    for (auto& it : event_formats_) {
+      it.second.filtered_out =
+          filter_tags_.count(base::StringView(it.second.name)) == 0;
+    }
+  }
 }
 
 bool AndroidLogDataSource::ParseEventLogDefinitionLine(char* line, size_t len) {
@@ -57,6 +57,8 @@ class AndroidLogDataSource : public ProbesDataSource {
   struct EventFormat {
     std::string name;
     std::vector<std::string> fields;
+    // Whether events of this format are dropped by the tag filter.
+    bool filtered_out = false;
   };
 
   AndroidLogDataSource(DataSourceConfig,
@@ -88,26 +90,36 @@ class AndroidLogDataSource : public ProbesDataSource {
   void OnSocketDataAvailable();
   void ReadLogSocket();
 
+  // Receives up to |max_events| log events from the logdr socket, the i-th
+  // one into the i-th |kBufSize| slot of |buf_|, and stores their size into
+  // |sizes|. Returns the number of events received.
+  size_t ReceiveLogEvents(size_t* sizes, size_t max_events);
+
+  // Decides whether a text event (i.e. [prio][tag][NUL][message]) passes the
+  // prio and tag filters of the config, only looking at its prio and at the
+  // size of its tag for most events. Returns false if the event is malformed,
+  // in which case |skip| is left unset.
+  bool FilterTextEvent(const char* start, const char* end, bool* skip) const;
+
   // Parses one line of /system/etc/event-log-tags.
   bool ParseEventLogDefinitionLine(char* line, size_t len);
 
   // Parses a textual (i.e. tag + message) event, which is the majority of
-  // log events. All buffers but the LID_EVENTS contain text events.
+  // log events. All buffers but the LID_EVENTS contain text events. The
+  // event must have passed FilterTextEvent().
   // If parsing fails returns false and leaves the |out_evt| field unset.
-  // If parsing succeeds returns true and:
-  // - If the event is skipped due to filters, |out_evt| is left unset.
-  // - If a new event is aded to the packet, |out_evt| is set to that.
+  // If parsing succeeds returns true and sets |out_evt| to the new event.
   bool ParseTextEvent(const char* start,
                       const char* end,
                       protos::pbzero::AndroidLogPacket* packet,
                       protos::pbzero::AndroidLogPacket_LogEvent** out_evt);
 
-  // Parses a binary event from the "events" buffer.
+  // Parses a binary event from the "events" buffer, whose format is |fmt|.
+  // [start, end) are the bytes after the event id.
   // If parsing fails returns false and leaves the |out_evt| field unset.
-  // If parsing succeeds returns true and:
-  // - If the event is skipped due to filters, |out_evt| is left unset.
-  // - If a new event is aded to the packet, |out_evt| is set to that.
-  bool ParseBinaryEvent(const char* start,
+  // If parsing succeeds returns true and sets |out_evt| to the new event.
+  bool ParseBinaryEvent(const EventFormat& fmt,
+                        const char* start,
                         const char* end,
                         protos::pbzero::AndroidLogPacket* packet,
                         protos::pbzero::AndroidLogPacket_LogEvent** out_evt);
@@ -123,14 +135,18 @@ class AndroidLogDataSource : public ProbesDataSource {
   // For filtering events based on tags.
   std::unordered_set<base::StringView> filter_tags_;
   std::vector<char> filter_tags_strbuf_;
+  // Bit N is set if a tag of N chars (or of 63+ chars for bit 63) is in
+  // |filter_tags_|, to reject most tags before hashing them.
+  uint64_t filter_tag_sizes_ = 0;
 
   // Lookup map for binary events (log_id=EVENTS). Translates a numeric id into
   // a corresponding field descriptor. This is generated by parsing
   // /system/etc/event-log-tags when starting.
   std::unordered_map<int, EventFormat> event_formats_;
 
-  // Buffer used for parsing. It's safer (read: fails sooner) than using the
-  // stack, due to red zones around the boundaries.
+  // Buffer the events are received into, a batch at a time, and parsed from.
+  // It's safer (read: fails sooner) than using the stack, due to red zones
+  // around the boundaries.
   base::PagedMemory buf_;
   Stats stats_;
   bool fd_watch_task_enabled_ = false;
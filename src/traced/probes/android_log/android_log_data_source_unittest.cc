@@ -298,6 +298,27 @@ TEST_F(AndroidLogDataSourceTest, TextEventsWithPrioFiltering) {
   EXPECT_EQ(decoded[0].tag(), "libprocessgroup");
 }
 
+TEST_F(AndroidLogDataSourceTest, TextEventsAllFiltered) {
+  DataSourceConfig cfg;
+  AndroidLogConfig acfg;
+  acfg.add_filter_tags("Zygote2");
+  acfg.add_filter_tags("ActivityManageR");
+  acfg.set_min_prio(protos::gen::AndroidLogPriority::PRIO_WARN);
+  cfg.set_android_log_config_raw(acfg.SerializeAsString());
+
+  CreateInstance(cfg);
+  EXPECT_CALL(*data_source_, ReadEventLogDefinitions()).WillOnce(Return(""));
+  StartAndSimulateLogd(kValidTextEvents);
+
+  // No packet is started for events that are all filtered out.
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 1u);
+  const auto& stats = packets[0].android_log().stats();
+  EXPECT_EQ(stats.num_total(), 3u);
+  EXPECT_EQ(stats.num_skipped(), 3u);
+  EXPECT_EQ(stats.num_failed(), 0u);
+}
+
 TEST_F(AndroidLogDataSourceTest, BinaryEvents) {
   DataSourceConfig cfg;
   CreateInstance(cfg);
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/common/cpu_freq_info.h"
 
+#include <fcntl.h>
+#include <inttypes.h>
 #include <unistd.h>
 
 #include <set>
@@ -23,6 +25,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 
 namespace perfetto {
 
@@ -46,6 +49,11 @@ void ReadAndAppendFreqs(std::set<CpuAndFreq>* freqs,
 
 CpuFreqInfo::CpuFreqInfo(std::string sysfs_cpu_path)
     : sysfs_cpu_path_{sysfs_cpu_path} {
+  auto tables = std::make_shared<Tables>();
+  tables_ = tables;
+  std::vector<uint32_t>& frequencies = tables->frequencies;
+  std::vector<size_t>& frequencies_index = tables->frequencies_index;
+  tables->online_cpus = ReadFile(sysfs_cpu_path_ + "/online");
   base::ScopedDir cpu_dir(opendir(sysfs_cpu_path_.c_str()));
   if (!cpu_dir) {
     PERFETTO_PLOG("Failed to opendir(%s)", sysfs_cpu_path_.c_str());
@@ -78,28 +86,43 @@ CpuFreqInfo::CpuFreqInfo(std::string sysfs_cpu_path)
   // Build index with guards.
   uint32_t last_cpu = 0;
   uint32_t index = 0;
-  frequencies_index_.push_back(0);
+  frequencies_index.push_back(0);
   for (const auto& cpu_freq : freqs) {
-    frequencies_.push_back(cpu_freq.second);
+    frequencies.push_back(cpu_freq.second);
     if (cpu_freq.first != last_cpu)
-      frequencies_index_.push_back(index);
+      frequencies_index.push_back(index);
     last_cpu = cpu_freq.first;
     index++;
   }
-  frequencies_.push_back(0);
-  frequencies_index_.push_back(index);
+  frequencies.push_back(0);
+  frequencies_index.push_back(index);
 }
 
+CpuFreqInfo::CpuFreqInfo(std::string sysfs_cpu_path,
+                         std::shared_ptr<const Tables> tables)
+    : sysfs_cpu_path_(std::move(sysfs_cpu_path)), tables_(std::move(tables)) {}
+
 CpuFreqInfo::~CpuFreqInfo() = default;
 
+std::unique_ptr<CpuFreqInfo> CpuFreqInfo::Clone() const {
+  return std::unique_ptr<CpuFreqInfo>(
+      new CpuFreqInfo(sysfs_cpu_path_, tables_));
+}
+
+bool CpuFreqInfo::IsStale() {
+  return ReadFile(sysfs_cpu_path_ + "/online") != tables_->online_cpus;
+}
+
 CpuFreqInfo::Range CpuFreqInfo::GetFreqs(uint32_t cpu) {
-  if (cpu >= frequencies_index_.size() - 1) {
+  const std::vector<uint32_t>& frequencies = tables_->frequencies;
+  const std::vector<size_t>& frequencies_index = tables_->frequencies_index;
+  if (cpu >= frequencies_index.size() - 1) {
     PERFETTO_DLOG("No frequencies for cpu%" PRIu32, cpu);
-    const uint32_t* end = frequencies_.data() + frequencies_.size();
+    const uint32_t* end = frequencies.data() + frequencies.size();
     return {end, end};
   }
-  auto* start = &frequencies_[frequencies_index_[cpu]];
-  auto* end = &frequencies_[frequencies_index_[cpu + 1]];
+  auto* start = &frequencies[frequencies_index[cpu]];
+  auto* end = &frequencies[frequencies_index[cpu + 1]];
   return {start, end};
 }
 
@@ -108,7 +131,8 @@ uint32_t CpuFreqInfo::GetCpuFreqIndex(uint32_t cpu, uint32_t freq) {
   uint32_t index = 0;
   for (const uint32_t* it = range.first; it != range.second; it++, index++) {
     if (*it == freq) {
-      return static_cast<uint32_t>(frequencies_index_[cpu]) + index + 1;
+      return static_cast<uint32_t>(tables_->frequencies_index[cpu]) + index +
+             1;
     }
   }
   return 0;
@@ -122,25 +146,38 @@ std::string CpuFreqInfo::ReadFile(std::string path) {
 }
 
 const std::vector<uint32_t>& CpuFreqInfo::ReadCpuCurrFreq() {
-  // Check if capacity of cpu_curr_freq_ is enough for all CPUs
-  auto num_cpus = static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF));
-  if (cpu_curr_freq_.size() < num_cpus)
+  // The number of configured CPUs doesn't change, so it's only queried on the
+  // first read (sysconf() reads sysfs).
+  if (cpu_curr_freq_.empty()) {
+    auto num_cpus = static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF));
     cpu_curr_freq_.resize(num_cpus);
+    cpu_curr_freq_fds_.resize(num_cpus);
+  }
 
   for (uint32_t i = 0; i < cpu_curr_freq_.size(); i++) {
-    // Read CPU current frequency. Set 0 for offline/disabled cpus.
-    std::string buf(ReadFile(sysfs_cpu_path_ + "/cpu" + std::to_string(i) +
-                             "/cpufreq/scaling_cur_freq"));
-    if (buf.empty()) {
-      cpu_curr_freq_[i] = 0;
-      continue;
+    // Read CPU current frequency. Set 0 for offline/disabled cpus. The files
+    // are kept open across reads. Those that can't be opened (offline cpus)
+    // are tried again on the next read.
+    cpu_curr_freq_[i] = 0;
+    base::ScopedFile& fd = cpu_curr_freq_fds_[i];
+    if (!fd) {
+      base::StackString<256> path("%s/cpu%" PRIu32 "/cpufreq/scaling_cur_freq",
+                                  sysfs_cpu_path_.c_str(), i);
+      fd = base::OpenFile(path.c_str(), O_RDONLY);
+      if (!fd)
+        continue;
     }
-    auto freq = base::StringToUInt32(base::StripSuffix(buf, "\n"));
-    if (!freq.has_value()) {
-      cpu_curr_freq_[i] = 0;
+    char buf[32];
+    ssize_t rsize = PERFETTO_EINTR(pread(*fd, buf, sizeof(buf) - 1, 0));
+    if (rsize <= 0) {
+      fd.reset();
       continue;
     }
-    cpu_curr_freq_[i] = freq.value();
+    size_t len = static_cast<size_t>(rsize);
+    if (buf[len - 1] == '\n')
+      len--;
+    buf[len] = '\0';
+    cpu_curr_freq_[i] = base::CStringToUInt32(buf).value_or(0);
   }
   return cpu_curr_freq_;
 }
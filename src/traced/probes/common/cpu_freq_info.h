@@ -18,6 +18,7 @@
 #define SRC_TRACED_PROBES_COMMON_CPU_FREQ_INFO_H_
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -37,17 +38,38 @@ class CpuFreqInfo {
 
   const std::vector<uint32_t>& ReadCpuCurrFreq();
 
+  // Returns a CpuFreqInfo sharing the frequency tables of this one, which
+  // are only read from sysfs when constructing a CpuFreqInfo from its path.
+  std::unique_ptr<CpuFreqInfo> Clone() const;
+
+  // Returns true if the online CPUs changed (hotplug) since the frequency
+  // tables were read, as they might be missing the CPUs that were offline.
+  bool IsStale();
+
+  // The contents of <cpu_dir_path>/online when the frequency tables were read
+  // (e.g. "0-7").
+  const std::string& online_cpus() const { return tables_->online_cpus; }
+
  private:
+  struct Tables {
+    // All frequencies of all CPUs, ordered by CPU and frequency. Includes a
+    // guard at the end.
+    std::vector<uint32_t> frequencies;
+    // frequencies_index[cpu] points to first frequency in frequencies.
+    // Includes a guard at the end.
+    std::vector<size_t> frequencies_index;
+    std::string online_cpus;
+  };
+
+  CpuFreqInfo(std::string cpu_dir_path, std::shared_ptr<const Tables> tables);
+
   // e.g. /sys/devices/system/cpu
   std::string sysfs_cpu_path_;
-  // All frequencies of all CPUs, ordered by CPU and frequency. Includes a guard
-  // at the end.
-  std::vector<uint32_t> frequencies_;
-  // frequencies_index_[cpu] points to first frequency in frequencies_. Includes
-  // a guard at the end.
-  std::vector<size_t> frequencies_index_;
+  std::shared_ptr<const Tables> tables_;
   // Placeholder for CPU current frequency, refresh in ReadCpuCurrFreq()
   std::vector<uint32_t> cpu_curr_freq_;
+  // The scaling_cur_freq file of each CPU, kept open across reads.
+  std::vector<base::ScopedFile> cpu_curr_freq_fds_;
 
   std::string ReadFile(std::string path);
 };
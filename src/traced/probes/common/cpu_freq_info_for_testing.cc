@@ -16,8 +16,13 @@
 
 #include "src/traced/probes/common/cpu_freq_info_for_testing.h"
 
+#include <fcntl.h>
+
 #include <memory>
 
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+
 namespace perfetto {
 
 namespace {
@@ -54,10 +59,18 @@ CpuFreqInfoForTesting::CpuFreqInfoForTesting() {
                   kCpuBoostFrequenciesAndroidBigCore);
   tmpdir_.AddFile("cpu1/cpufreq/scaling_cur_freq", "3698200");
   tmpdir_.AddDir("power");
+  tmpdir_.AddFile("online", "0-1\n");
 }
 
 std::unique_ptr<CpuFreqInfo> CpuFreqInfoForTesting::GetInstance() {
   return std::unique_ptr<CpuFreqInfo>(new CpuFreqInfo(tmpdir_.path()));
 }
 
+void CpuFreqInfoForTesting::SetOnlineCpus(const std::string& cpus) {
+  base::ScopedFile fd(base::OpenFile(tmpdir_.AbsolutePath("online"),
+                                     O_WRONLY | O_TRUNC));
+  PERFETTO_CHECK(base::WriteAll(*fd, cpus.data(), cpus.size()) ==
+                 static_cast<ssize_t>(cpus.size()));
+}
+
 }  // namespace perfetto
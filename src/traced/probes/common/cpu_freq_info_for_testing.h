@@ -20,6 +20,7 @@
 #include "src/traced/probes/common/cpu_freq_info.h"
 
 #include <memory>
+#include <string>
 
 #include "src/base/test/tmp_dir_tree.h"
 
@@ -31,6 +32,9 @@ class CpuFreqInfoForTesting {
 
   std::unique_ptr<CpuFreqInfo> GetInstance();
 
+  // Rewrites the list of online CPUs (initially "0-1").
+  void SetOnlineCpus(const std::string& cpus);
+
  private:
   base::TmpDirTree tmpdir_;
 };
@@ -60,5 +60,20 @@ TEST_F(CpuFreqInfoTest, CpuFreqInfo) {
   EXPECT_EQ(cpu_freq_info->GetCpuFreqIndex(1u, 5u), 0u);
 }
 
+TEST_F(CpuFreqInfoTest, Clone) {
+  auto cpu_freq_info = GetCpuFreqInfo();
+  EXPECT_EQ(cpu_freq_info->online_cpus(), "0-1\n");
+  EXPECT_FALSE(cpu_freq_info->IsStale());
+
+  // The clone shares the tables rather than reading them again.
+  auto clone = cpu_freq_info->Clone();
+  EXPECT_EQ(clone->GetFreqs(1u), cpu_freq_info->GetFreqs(1u));
+  EXPECT_EQ(clone->GetCpuFreqIndex(1u, 2803200), 20u);
+
+  cpu_freq_info_for_testing.SetOnlineCpus("0\n");
+  EXPECT_TRUE(cpu_freq_info->IsStale());
+  EXPECT_TRUE(clone->IsStale());
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/common/proc_file_reader.h"
+
+#include <unistd.h>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+
+ProcFileReader::ProcFileReader(size_t buf_size)
+    : buf_(base::PagedMemory::Allocate(buf_size)), buf_size_(buf_size) {
+  PERFETTO_CHECK(buf_size > 1);
+}
+
+ProcFileReader::~ProcFileReader() = default;
+
+size_t ProcFileReader::Read(base::ScopedFile* fd, const char* path) {
+  if (!*fd)
+    return 0;
+  // A single read, as procfs and sysfs return as much of the file as fits.
+  char* buf = this->buf();
+  ssize_t res = PERFETTO_EINTR(pread(**fd, buf, buf_size_ - 1, 0));
+  if (res <= 0) {
+    PERFETTO_PLOG("Failed reading %s", path);
+    fd->reset();
+    return 0;
+  }
+  size_t rsize = static_cast<size_t>(res);
+  buf[rsize] = '\0';
+  return rsize + 1;  // Include null terminator in the count.
+}
+
+}  // namespace perfetto
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_COMMON_PROC_FILE_READER_H_
+#define SRC_TRACED_PROBES_COMMON_PROC_FILE_READER_H_
+
+#include <stddef.h>
+
+#include "perfetto/ext/base/paged_memory.h"
+#include "perfetto/ext/base/scoped_file.h"
+
+namespace perfetto {
+
+// Reads the /proc and /sys files polled by a data source into a scratch buffer
+// allocated once and reused by every read, so that polling them doesn't
+// allocate. The files are kept open by the caller: reading them again from
+// their start makes the kernel generate their contents again.
+// The contents of the buffer are only valid until the next Read().
+class ProcFileReader {
+ public:
+  static constexpr size_t kDefaultBufSize = 16 * 1024;
+
+  // The pages of the buffer are only backed by memory once touched, so a
+  // large |buf_size| only costs the size of the largest file read.
+  explicit ProcFileReader(size_t buf_size = kDefaultBufSize);
+  ~ProcFileReader();
+
+  // Reads the file |*fd| from its start into buf() and null-terminates it.
+  // Files larger than the buffer are truncated to |buf_size| - 1 bytes.
+  // Returns the size read, including the null terminator, as expected by
+  // base::StringSplitter(char*, size_t). Returns 0 if |*fd| isn't open or
+  // the read fails, in which case |*fd| is closed. |path| is only used for
+  // logging.
+  size_t Read(base::ScopedFile* fd, const char* path);
+
+  char* buf() { return static_cast<char*>(buf_.Get()); }
+  size_t buf_size() const { return buf_size_; }
+
+ private:
+  base::PagedMemory buf_;
+  size_t buf_size_ = 0;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_COMMON_PROC_FILE_READER_H_
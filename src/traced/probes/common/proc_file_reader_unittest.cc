@@ -0,0 +1,80 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/common/proc_file_reader.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+void Rewrite(const base::TempFile& file, const std::string& contents) {
+  base::ScopedFile fd(base::OpenFile(file.path(), O_WRONLY | O_TRUNC));
+  ASSERT_TRUE(fd);
+  ASSERT_EQ(base::WriteAll(*fd, contents.data(), contents.size()),
+            static_cast<ssize_t>(contents.size()));
+}
+
+TEST(ProcFileReaderTest, ReadsFromStartEachTime) {
+  base::TempFile file = base::TempFile::Create();
+  Rewrite(file, "MemTotal: 1 kB\n");
+  base::ScopedFile fd(base::OpenFile(file.path(), O_RDONLY));
+  ProcFileReader reader;
+
+  // The size includes the null terminator.
+  ASSERT_EQ(reader.Read(&fd, file.path().c_str()), 16u);
+  EXPECT_STREQ(reader.buf(), "MemTotal: 1 kB\n");
+  char* buf = reader.buf();
+
+  Rewrite(file, "MemTotal: 2 kB\n");
+  ASSERT_EQ(reader.Read(&fd, file.path().c_str()), 16u);
+  EXPECT_STREQ(reader.buf(), "MemTotal: 2 kB\n");
+  EXPECT_EQ(reader.buf(), buf);
+  EXPECT_TRUE(fd);
+}
+
+TEST(ProcFileReaderTest, Truncates) {
+  base::TempFile file = base::TempFile::Create();
+  Rewrite(file, "0123456789");
+  base::ScopedFile fd(base::OpenFile(file.path(), O_RDONLY));
+  ProcFileReader reader(5);
+
+  ASSERT_EQ(reader.Read(&fd, file.path().c_str()), 5u);
+  EXPECT_STREQ(reader.buf(), "0123");
+}
+
+TEST(ProcFileReaderTest, ClosesOnFailure) {
+  ProcFileReader reader;
+  base::ScopedFile fd;
+  EXPECT_EQ(reader.Read(&fd, "closed"), 0u);
+
+  // Reading a directory fails with EISDIR.
+  base::TempDir dir = base::TempDir::Create();
+  fd = base::OpenFile(dir.path(), O_RDONLY);
+  ASSERT_TRUE(fd);
+  EXPECT_EQ(reader.Read(&fd, dir.path().c_str()), 0u);
+  EXPECT_FALSE(fd);
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -17,28 +17,114 @@
 #include "src/traced/probes/filesystem/file_scanner.h"
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/utils.h"
 #include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 
 namespace perfetto {
 namespace {
 
-std::string JoinPaths(const std::string& one, const std::string& other) {
+// Large enough for a few hundred entries per getdents64() call.
+constexpr size_t kDirentBufSize = 32 * 1024;
+
+// The layout of the records returned by getdents64(), which libc doesn't
+// always declare.
+struct LinuxDirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  uint16_t d_reclen;
+  uint8_t d_type;
+  char d_name[1];
+};
+
+std::string JoinPaths(const std::string& one, const char* other) {
+  size_t other_size = strlen(other);
   std::string result;
-  result.reserve(one.size() + other.size() + 1);
+  result.reserve(one.size() + other_size + 1);
   result += one;
   if (!result.empty() && result.back() != '/')
     result += '/';
-  result += other;
+  result.append(other, other_size);
   return result;
 }
 
+// d_type is DT_UNKNOWN on the filesystems that don't store the file type in
+// their directory entries.
+InodeFileMap_Entry_Type EntryType(unsigned char d_type) {
+  if (d_type == DT_DIR)
+    return protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY;
+  if (d_type == DT_REG)
+    return protos::pbzero::InodeFileMap::Entry::Type::FILE;
+  return protos::pbzero::InodeFileMap::Entry::Type::UNKNOWN;
+}
+
 }  // namespace
 
+FileScanner::DirectoryReader::DirectoryReader() = default;
+FileScanner::DirectoryReader::~DirectoryReader() = default;
+
+bool FileScanner::DirectoryReader::Open(const std::string& path) {
+  buf_pos_ = buf_size_ = 0;
+  fd_ = base::OpenFile(path, O_RDONLY | O_DIRECTORY);
+  if (!fd_) {
+    PERFETTO_DPLOG("open %s", path.c_str());
+    return false;
+  }
+  struct stat buf;
+  if (fstat(*fd_, &buf) != 0) {
+    PERFETTO_DPLOG("fstat %s", path.c_str());
+    fd_.reset();
+    return false;
+  }
+  block_device_id_ = buf.st_dev;
+  if (!buf_)
+    buf_.reset(new char[kDirentBufSize]);
+  return true;
+}
+
+void FileScanner::DirectoryReader::Close() {
+  fd_.reset();
+}
+
+bool FileScanner::DirectoryReader::Next(Inode* inode,
+                                        unsigned char* d_type,
+                                        const char** name) {
+  for (;;) {
+    if (buf_pos_ >= buf_size_) {
+      auto res = PERFETTO_EINTR(
+          syscall(SYS_getdents64, *fd_, buf_.get(), kDirentBufSize));
+      if (res <= 0) {
+        if (res < 0)
+          PERFETTO_DPLOG("getdents64");
+        return false;
+      }
+      buf_pos_ = 0;
+      buf_size_ = static_cast<size_t>(res);
+    }
+    const auto* dirent =
+        reinterpret_cast<const LinuxDirent64*>(buf_.get() + buf_pos_);
+    buf_pos_ += dirent->d_reclen;
+    const char* n = dirent->d_name;
+    if (n[0] == '.' && (n[1] == '\0' || (n[1] == '.' && n[2] == '\0')))
+      continue;
+    *inode = static_cast<Inode>(dirent->d_ino);
+    *d_type = dirent->d_type;
+    *name = n;
+    return true;
+  }
+}
+
+FileScanner::Worker::Worker(base::ThreadTaskRunner r)
+    : reader(new DirectoryReader()), runner(std::move(r)) {}
+
 FileScanner::FileScanner(std::vector<std::string> root_directories,
                          Delegate* delegate,
                          uint32_t scan_interval_ms,
@@ -56,6 +142,12 @@ FileScanner::FileScanner(std::vector<std::string> root_directories,
                   0 /* scan_interval_ms */,
                   0 /* scan_steps */) {}
 
+FileScanner::~FileScanner() {
+  // Makes the jobs in progress return early, before |workers_| join their
+  // threads.
+  cancelled_.store(true, std::memory_order_relaxed);
+}
+
 void FileScanner::Scan() {
   while (!Done())
     Step();
@@ -76,70 +168,56 @@ void FileScanner::Scan(base::TaskRunner* task_runner) {
       scan_interval_ms_);
 }
 
+void FileScanner::ScanInBackground(base::TaskRunner* task_runner,
+                                   uint32_t num_threads) {
+  PERFETTO_DCHECK(scan_steps_ && num_threads && workers_.empty());
+  if (queue_.empty())
+    return delegate_->OnInodeScanDone();
+  task_runner_ = task_runner;
+  workers_.reserve(num_threads);
+  for (uint32_t i = 0; i < num_threads; i++)
+    workers_.emplace_back(base::ThreadTaskRunner::CreateAndStart("fs_scan"));
+  DispatchDirectories();
+}
+
 void FileScanner::NextDirectory() {
   std::string directory = std::move(queue_.back());
   queue_.pop_back();
-  current_dir_handle_.reset(opendir(directory.c_str()));
-  if (!current_dir_handle_) {
-    PERFETTO_DPLOG("opendir %s", directory.c_str());
+  if (!current_dir_.Open(directory)) {
     current_directory_.clear();
     return;
   }
   current_directory_ = std::move(directory);
-
-  struct stat buf;
-  if (fstat(dirfd(current_dir_handle_.get()), &buf) != 0) {
-    PERFETTO_DPLOG("fstat %s", current_directory_.c_str());
-    current_dir_handle_.reset();
-    current_directory_.clear();
-    return;
-  }
-
-  if (S_ISLNK(buf.st_mode)) {
-    current_dir_handle_.reset();
-    current_directory_.clear();
-    return;
-  }
-  current_block_device_id_ = buf.st_dev;
 }
 
 void FileScanner::Step() {
-  if (!current_dir_handle_) {
+  if (!current_dir_.is_open()) {
     if (queue_.empty())
       return;
     NextDirectory();
   }
 
-  if (!current_dir_handle_)
+  if (!current_dir_.is_open())
     return;
 
-  struct dirent* entry = readdir(current_dir_handle_.get());
-  if (entry == nullptr) {
-    current_dir_handle_.reset();
+  Inode inode;
+  unsigned char d_type;
+  const char* name;
+  if (!current_dir_.Next(&inode, &d_type, &name)) {
+    current_dir_.Close();
     return;
   }
 
-  std::string filename = entry->d_name;
-  if (filename == "." || filename == "..")
-    return;
-
-  std::string filepath = JoinPaths(current_directory_, filename);
+  std::string filepath = JoinPaths(current_directory_, name);
 
-  protos::pbzero::InodeFileMap_Entry_Type type =
-      protos::pbzero::InodeFileMap::Entry::Type::UNKNOWN;
-  // Readdir and stat not guaranteed to have directory info for all systems
-  if (entry->d_type == DT_DIR) {
-    // Continue iterating through files if current entry is a directory
+  // Continue iterating through files if current entry is a directory
+  if (d_type == DT_DIR)
     queue_.emplace_back(filepath);
-    type = protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY;
-  } else if (entry->d_type == DT_REG) {
-    type = protos::pbzero::InodeFileMap::Entry::Type::FILE;
-  }
 
-  if (!delegate_->OnInodeFound(current_block_device_id_, entry->d_ino, filepath,
-                               type)) {
+  if (!delegate_->OnInodeFound(current_dir_.block_device_id(), inode,
+                               filepath, EntryType(d_type))) {
     queue_.clear();
-    current_dir_handle_.reset();
+    current_dir_.Close();
   }
 }
 
@@ -149,7 +227,89 @@ void FileScanner::Steps(uint32_t n) {
 }
 
 bool FileScanner::Done() {
-  return !current_dir_handle_ && queue_.empty();
+  return !current_dir_.is_open() && queue_.empty();
+}
+
+// static
+FileScanner::Batch FileScanner::ScanSubtrees(
+    DirectoryReader* reader,
+    std::vector<std::string> directories,
+    size_t max_entries,
+    const std::atomic<bool>* cancelled) {
+  Batch batch;
+  std::vector<std::string>& stack = batch.directories;
+  stack = std::move(directories);
+  while (!stack.empty() && batch.entries.size() < max_entries &&
+         !cancelled->load(std::memory_order_relaxed)) {
+    std::string directory = std::move(stack.back());
+    stack.pop_back();
+    if (!reader->Open(directory))
+      continue;
+    Inode inode;
+    unsigned char d_type;
+    const char* name;
+    while (reader->Next(&inode, &d_type, &name)) {
+      Entry entry{reader->block_device_id(), inode,
+                  JoinPaths(directory, name), EntryType(d_type)};
+      if (d_type == DT_DIR)
+        stack.push_back(entry.path);
+      batch.entries.push_back(std::move(entry));
+    }
+    reader->Close();
+  }
+  return batch;
+}
+
+void FileScanner::DispatchDirectories() {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  base::TaskRunner* task_runner = task_runner_;
+  const std::atomic<bool>* cancelled = &cancelled_;
+  const size_t max_entries = scan_steps_;
+  for (size_t i = 0; i < workers_.size() && !queue_.empty(); i++) {
+    Worker& worker = workers_[i];
+    if (worker.busy)
+      continue;
+    worker.busy = true;
+    // Each job starts from a single directory. The subdirectories it doesn't
+    // get to are handed back, to be spread over the idle workers.
+    std::vector<std::string> directories;
+    directories.emplace_back(std::move(queue_.back()));
+    queue_.pop_back();
+    DirectoryReader* reader = worker.reader.get();
+    worker.runner.PostTask([reader, directories, max_entries, cancelled,
+                            task_runner, weak_this, i]() mutable {
+      Batch batch = ScanSubtrees(reader, std::move(directories), max_entries,
+                                 cancelled);
+      task_runner->PostTask([weak_this, i, batch]() mutable {
+        if (weak_this)
+          weak_this->OnBatchScanned(i, std::move(batch));
+      });
+    });
+  }
+}
+
+void FileScanner::OnBatchScanned(size_t worker_idx, Batch batch) {
+  if (cancelled_.load(std::memory_order_relaxed))
+    return;
+  workers_[worker_idx].busy = false;
+  for (const Entry& entry : batch.entries) {
+    if (!delegate_->OnInodeFound(entry.block_device_id, entry.inode,
+                                 entry.path, entry.type)) {
+      // The jobs still in progress are abandoned.
+      cancelled_.store(true, std::memory_order_relaxed);
+      queue_.clear();
+      return delegate_->OnInodeScanDone();
+    }
+  }
+  for (std::string& directory : batch.directories)
+    queue_.emplace_back(std::move(directory));
+  DispatchDirectories();
+  for (const Worker& worker : workers_) {
+    if (worker.busy)
+      return;
+  }
+  if (queue_.empty())
+    delegate_->OnInodeScanDone();
 }
 
 FileScanner::Delegate::~Delegate() = default;
@@ -17,11 +17,14 @@
 #ifndef SRC_TRACED_PROBES_FILESYSTEM_FILE_SCANNER_H_
 #define SRC_TRACED_PROBES_FILESYSTEM_FILE_SCANNER_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/traced/data_source_types.h"
 
@@ -47,26 +50,94 @@ class FileScanner {
   // Ctor when only the blocking version of Scan is used.
   FileScanner(std::vector<std::string> root_directories, Delegate* delegate);
 
+  ~FileScanner();
+
   FileScanner(const FileScanner&) = delete;
   FileScanner& operator=(const FileScanner&) = delete;
 
   void Scan(base::TaskRunner* task_runner);
   void Scan();
 
+  // Scans on |num_threads| background threads, each walking a different
+  // subtree. The entries found are passed to the delegate on |task_runner|,
+  // in batches of about |scan_steps| entries, as soon as they are read.
+  void ScanInBackground(base::TaskRunner* task_runner, uint32_t num_threads);
+
  private:
+  // Reads the entries of a directory with getdents64(), a large buffer at a
+  // time, rather than an entry at a time like readdir().
+  class DirectoryReader {
+   public:
+    DirectoryReader();
+    ~DirectoryReader();
+
+    // Returns false if |path| can't be opened as a directory.
+    bool Open(const std::string& path);
+    void Close();
+    bool is_open() const { return !!fd_; }
+    BlockDeviceID block_device_id() const { return block_device_id_; }
+
+    // Returns false at the end of the directory. Skips "." and "..".
+    bool Next(Inode* inode, unsigned char* d_type, const char** name);
+
+   private:
+    base::ScopedFile fd_;
+    BlockDeviceID block_device_id_ = 0;
+    std::unique_ptr<char[]> buf_;
+    size_t buf_pos_ = 0;
+    size_t buf_size_ = 0;
+  };
+
+  struct Entry {
+    BlockDeviceID block_device_id;
+    Inode inode;
+    std::string path;
+    InodeFileMap_Entry_Type type;
+  };
+
+  // The result of a background job: the entries read and the directories
+  // that are left to scan.
+  struct Batch {
+    std::vector<Entry> entries;
+    std::vector<std::string> directories;
+  };
+
+  struct Worker {
+    explicit Worker(base::ThreadTaskRunner);
+
+    // Only used on |runner|'s thread. Declared first so that it outlives the
+    // thread.
+    std::unique_ptr<DirectoryReader> reader;
+    base::ThreadTaskRunner runner;
+    bool busy = false;
+  };
+
   void NextDirectory();
   void Step();
   void Steps(uint32_t n);
   bool Done();
 
+  // Runs on a worker thread. Walks |directories| depth first until at least
+  // |max_entries| entries were read.
+  static Batch ScanSubtrees(DirectoryReader* reader,
+                            std::vector<std::string> directories,
+                            size_t max_entries,
+                            const std::atomic<bool>* cancelled);
+  void DispatchDirectories();
+  void OnBatchScanned(size_t worker_idx, Batch batch);
+
   Delegate* delegate_;
   const uint32_t scan_interval_ms_;
   const uint32_t scan_steps_;
 
   std::vector<std::string> queue_;
-  base::ScopedDir current_dir_handle_;
+  DirectoryReader current_dir_;
   std::string current_directory_;
-  BlockDeviceID current_block_device_id_;
+
+  // Only for ScanInBackground().
+  base::TaskRunner* task_runner_ = nullptr;
+  std::atomic<bool> cancelled_{false};
+  std::vector<Worker> workers_;
   base::WeakPtrFactory<FileScanner> weak_factory_;  // Keep last.
 };
 
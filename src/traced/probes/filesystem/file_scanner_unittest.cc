@@ -197,5 +197,62 @@ TEST(FileScannerTest, TestAsynchronousFindFiles) {
               protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY))));
 }
 
+TEST(FileScannerTest, TestBackgroundStop) {
+  uint64_t seen = 0;
+  base::TestTaskRunner task_runner;
+  TestDelegate delegate(
+      [&seen](BlockDeviceID, Inode, const std::string&,
+              InodeFileMap_Entry_Type) {
+        ++seen;
+        return false;
+      },
+      task_runner.CreateCheckpoint("done"));
+
+  FileScanner fs(
+      {base::GetTestDataPath("src/traced/probes/filesystem/testdata")},
+      &delegate, 1, 1);
+  fs.ScanInBackground(&task_runner, 2);
+
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_EQ(seen, 1u);
+}
+
+TEST(FileScannerTest, TestBackgroundFindFiles) {
+  base::TestTaskRunner task_runner;
+  std::vector<FileEntry> file_entries;
+  TestDelegate delegate(
+      [&file_entries](BlockDeviceID block_device_id, Inode inode,
+                      const std::string& path, InodeFileMap_Entry_Type type) {
+        file_entries.emplace_back(block_device_id, inode, path, type);
+        return true;
+      },
+      task_runner.CreateCheckpoint("done"));
+
+  // Batches of a single entry, so that the subtrees are spread over both
+  // threads.
+  FileScanner fs(
+      {base::GetTestDataPath("src/traced/probes/filesystem/testdata")},
+      &delegate, 1, 1);
+  fs.ScanInBackground(&task_runner, 2);
+
+  task_runner.RunUntilCheckpoint("done");
+
+  EXPECT_THAT(
+      file_entries,
+      UnorderedElementsAre(
+          Eq(StatFileEntry(
+              base::GetTestDataPath(
+                  "src/traced/probes/filesystem/testdata/dir1/file1"),
+              protos::pbzero::InodeFileMap::Entry::Type::FILE)),
+          Eq(StatFileEntry(base::GetTestDataPath(
+                               "src/traced/probes/filesystem/testdata/file2"),
+                           protos::pbzero::InodeFileMap::Entry::Type::FILE)),
+          Eq(StatFileEntry(
+              base::GetTestDataPath(
+                  "src/traced/probes/filesystem/testdata/dir1"),
+              protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY))));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -20,6 +20,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 #include <queue>
 #include <unordered_map>
 
@@ -38,6 +39,7 @@ namespace {
 constexpr uint32_t kScanIntervalMs = 10000;  // 10s
 constexpr uint32_t kScanDelayMs = 10000;     // 10s
 constexpr uint32_t kScanBatchSize = 15000;
+constexpr uint32_t kMaxScanThreads = 8;
 
 uint32_t OrDefault(uint32_t value, uint32_t def) {
   return value ? value : def;
@@ -136,6 +138,7 @@ InodeFileDataSource::InodeFileDataSource(
   scan_delay_ms_ = OrDefault(cfg.scan_delay_ms(), kScanDelayMs);
   scan_batch_size_ = OrDefault(cfg.scan_batch_size(), kScanBatchSize);
   do_not_scan_ = cfg.do_not_scan();
+  scan_threads_ = std::min(cfg.scan_threads(), kMaxScanThreads);
 }
 
 InodeFileDataSource::~InodeFileDataSource() = default;
@@ -177,15 +180,15 @@ void InodeFileDataSource::AddInodesFromLRUCache(
   uint64_t cache_found_count = 0;
   for (auto it = inode_numbers->begin(); it != inode_numbers->end();) {
     Inode inode_number = *it;
-    auto value = cache_->Get(std::make_pair(block_device_id, inode_number));
-    if (value == nullptr) {
+    InodeMapValue value;
+    if (!cache_->Get(std::make_pair(block_device_id, inode_number), &value)) {
       ++it;
       continue;
     }
     cache_found_count++;
     it = inode_numbers->erase(it);
     FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
-                   *value);
+                   value);
   }
   if (cache_found_count > 0)
     PERFETTO_DLOG("%" PRIu64 " inodes found in cache", cache_found_count);
@@ -316,17 +319,15 @@ bool InodeFileDataSource::OnInodeFound(BlockDeviceID block_device_id,
   RemoveFromNextMissingInodes(block_device_id, inode_number);
 
   std::pair<BlockDeviceID, Inode> key{block_device_id, inode_number};
-  auto cur_val = cache_->Get(key);
-  if (cur_val) {
-    cur_val->AddPath(path);
-    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
-                   *cur_val);
+  InodeMapValue value;
+  if (cache_->Get(key, &value)) {
+    value.AddPath(path);
   } else {
-    InodeMapValue new_val(InodeMapValue(inode_type, {path}));
-    cache_->Insert(key, new_val);
-    FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
-                   new_val);
+    value = InodeMapValue(inode_type, {path});
   }
+  cache_->Insert(key, value);
+  FillInodeEntry(AddToCurrentTracePacket(block_device_id), inode_number,
+                 value);
   PERFETTO_DLOG("Filled %s", path.c_str());
   return !missing_inodes_.empty();
 }
@@ -398,7 +399,11 @@ void InodeFileDataSource::FindMissingInodes() {
   file_scanner_ = std::unique_ptr<FileScanner>(new FileScanner(
       std::move(roots), this, scan_interval_ms_, scan_batch_size_));
 
-  file_scanner_->Scan(task_runner_);
+  if (scan_threads_) {
+    file_scanner_->ScanInBackground(task_runner_, scan_threads_);
+  } else {
+    file_scanner_->Scan(task_runner_);
+  }
 }
 
 base::WeakPtr<InodeFileDataSource> InodeFileDataSource::GetWeakPtr() const {
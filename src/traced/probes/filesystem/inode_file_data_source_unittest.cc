@@ -33,8 +33,6 @@ namespace {
 using ::testing::_;
 using ::testing::Eq;
 using ::testing::InvokeWithoutArgs;
-using ::testing::IsNull;
-using ::testing::Pointee;
 
 class TestInodeFileDataSource : public InodeFileDataSource {
  public:
@@ -81,7 +79,7 @@ class InodeFileDataSourceTest : public ::testing::Test {
         std::unique_ptr<NullTraceWriter>(new NullTraceWriter)));
   }
 
-  LRUInodeCache cache_{100};
+  LRUInodeCache cache_{64 * 1024};
   std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
       static_file_map_;
   base::TestTaskRunner task_runner_;
@@ -112,8 +110,9 @@ TEST_F(InodeFileDataSourceTest, TestFileSystemScan) {
   task_runner_.RunUntilCheckpoint("done");
 
   // Expect that the found inode is added in the LRU cache.
-  EXPECT_THAT(cache_.Get(std::make_pair(buf.st_dev, buf.st_ino)),
-              Pointee(Eq(value)));
+  InodeMapValue cached;
+  ASSERT_TRUE(cache_.Get(std::make_pair(buf.st_dev, buf.st_ino), &cached));
+  EXPECT_EQ(cached, value);
 }
 
 TEST_F(InodeFileDataSourceTest, TestStaticMap) {
@@ -136,7 +135,8 @@ TEST_F(InodeFileDataSourceTest, TestStaticMap) {
 
   data_source->OnInodes({{buf.st_ino, buf.st_dev}});
   // Expect that the found inode is not added the LRU cache.
-  EXPECT_THAT(cache_.Get(std::make_pair(buf.st_dev, buf.st_ino)), IsNull());
+  InodeMapValue cached;
+  EXPECT_FALSE(cache_.Get(std::make_pair(buf.st_dev, buf.st_ino), &cached));
 }
 
 TEST_F(InodeFileDataSourceTest, TestCache) {
@@ -16,43 +16,306 @@
 
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
 
+#include <string.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/hash.h"
+
 namespace perfetto {
+namespace {
 
-InodeMapValue* LRUInodeCache::Get(const InodeKey& k) {
-  const auto& map_it = map_.find(k);
-  if (map_it == map_.end()) {
-    return nullptr;
-  }
-  auto list_entry = map_it->second;
+constexpr size_t kMinBuckets = 64;
+
+size_t HashKey(const LRUInodeCache::InodeKey& k) {
+  return static_cast<size_t>(base::Hasher::Combine(k.first, k.second));
+}
+
+size_t HashDir(uint32_t parent, const char* name, size_t size) {
+  base::Hasher hasher;
+  hasher.Update(parent);
+  hasher.Update(name, size);
+  return static_cast<size_t>(hasher.digest());
+}
+
+}  // namespace
+
+LRUInodeCache::LRUInodeCache(size_t capacity_bytes)
+    : capacity_bytes_(capacity_bytes) {}
+
+LRUInodeCache::~LRUInodeCache() = default;
+
+bool LRUInodeCache::Get(const InodeKey& k, InodeMapValue* v) {
+  uint32_t idx = FindEntry(k);
+  if (idx == kNone)
+    return false;
   // Bump this item to the front of the cache.
-  // We can borrow both elements of the pair stored in the list because
-  // insert does not need them.
-  Insert(map_it, std::move(list_entry->first), std::move(list_entry->second));
-  return &list_.begin()->second;
+  Unlink(idx);
+  PushFront(idx);
+
+  const Entry& entry = entries_[idx];
+  std::set<std::string> paths;
+  if (entry.num_paths > 0)
+    paths.emplace(PathToString(entry.first_dir, entry.first_name));
+  if (entry.more_paths) {
+    for (const Path& path : *entry.more_paths)
+      paths.emplace(PathToString(path.dir, path.name));
+  }
+  *v = InodeMapValue(entry.type, std::move(paths));
+  return true;
+}
+
+void LRUInodeCache::Insert(const InodeKey& k, const InodeMapValue& v) {
+  uint32_t idx = FindEntry(k);
+  if (idx == kNone) {
+    idx = AddEntry(k);
+  } else {
+    bytes_used_ -= EntryBytes(entries_[idx]);
+    ClearPaths(idx);
+    Unlink(idx);
+  }
+  entries_[idx].type = v.type();
+  SetPaths(idx, v);
+  bytes_used_ += EntryBytes(entries_[idx]);
+  PushFront(idx);
+
+  // The new entry is kept even if it doesn't fit on its own.
+  while (bytes_used_ > capacity_bytes_ && lru_tail_ != idx)
+    EvictLeastRecentlyUsed();
+}
+
+uint32_t LRUInodeCache::FindEntry(const InodeKey& k) const {
+  if (buckets_.empty())
+    return kNone;
+  uint32_t idx = buckets_[HashKey(k) & (buckets_.size() - 1)];
+  while (idx != kNone && entries_[idx].key != k)
+    idx = entries_[idx].bucket_next;
+  return idx;
+}
+
+uint32_t LRUInodeCache::AddEntry(const InodeKey& k) {
+  uint32_t idx;
+  if (free_entries_ != kNone) {
+    idx = free_entries_;
+    free_entries_ = entries_[idx].next;
+  } else {
+    idx = static_cast<uint32_t>(entries_.size());
+    entries_.emplace_back();
+  }
+  Entry& entry = entries_[idx];
+  entry.key = k;
+  entry.prev = entry.next = kNone;
+  entry.num_paths = 0;
+
+  if (++num_entries_ > buckets_.size()) {
+    // Rehash the entries in use, which are all in the LRU list.
+    buckets_.assign(std::max(buckets_.size() * 2, kMinBuckets), kNone);
+    const size_t mask = buckets_.size() - 1;
+    for (uint32_t i = lru_head_; i != kNone; i = entries_[i].next) {
+      uint32_t& head = buckets_[HashKey(entries_[i].key) & mask];
+      entries_[i].bucket_next = head;
+      head = i;
+    }
+  }
+  uint32_t& head = buckets_[HashKey(k) & (buckets_.size() - 1)];
+  entry.bucket_next = head;
+  head = idx;
+  return idx;
+}
+
+void LRUInodeCache::EvictLeastRecentlyUsed() {
+  uint32_t idx = lru_tail_;
+  PERFETTO_DCHECK(idx != kNone);
+  Entry& entry = entries_[idx];
+  bytes_used_ -= EntryBytes(entry);
+  ClearPaths(idx);
+  Unlink(idx);
+
+  uint32_t* link = &buckets_[HashKey(entry.key) & (buckets_.size() - 1)];
+  while (*link != idx)
+    link = &entries_[*link].bucket_next;
+  *link = entry.bucket_next;
+
+  entry.next = free_entries_;
+  free_entries_ = idx;
+  num_entries_--;
+}
+
+void LRUInodeCache::Unlink(uint32_t idx) {
+  Entry& entry = entries_[idx];
+  if (entry.prev != kNone) {
+    entries_[entry.prev].next = entry.next;
+  } else {
+    lru_head_ = entry.next;
+  }
+  if (entry.next != kNone) {
+    entries_[entry.next].prev = entry.prev;
+  } else {
+    lru_tail_ = entry.prev;
+  }
+  entry.prev = entry.next = kNone;
+}
+
+void LRUInodeCache::PushFront(uint32_t idx) {
+  Entry& entry = entries_[idx];
+  entry.prev = kNone;
+  entry.next = lru_head_;
+  if (lru_head_ != kNone)
+    entries_[lru_head_].prev = idx;
+  lru_head_ = idx;
+  if (lru_tail_ == kNone)
+    lru_tail_ = idx;
+}
+
+void LRUInodeCache::SetPaths(uint32_t idx, const InodeMapValue& v) {
+  for (const std::string& path : v.paths()) {
+    // Interning may grow |dirs_| but not |entries_|.
+    Entry& entry = entries_[idx];
+    if (entry.num_paths++ == 0) {
+      entry.first_dir = InternPath(path, &entry.first_name);
+      continue;
+    }
+    if (!entry.more_paths)
+      entry.more_paths.reset(new std::vector<Path>());
+    Path p;
+    p.dir = InternPath(path, &p.name);
+    entry.more_paths->emplace_back(std::move(p));
+  }
+}
+
+void LRUInodeCache::ClearPaths(uint32_t idx) {
+  Entry& entry = entries_[idx];
+  if (entry.num_paths > 0)
+    ReleaseDir(entry.first_dir);
+  entry.first_name = std::string();
+  if (entry.more_paths) {
+    for (const Path& path : *entry.more_paths)
+      ReleaseDir(path.dir);
+    entry.more_paths.reset();
+  }
+  entry.num_paths = 0;
 }
 
-void LRUInodeCache::Insert(InodeKey k, InodeMapValue v) {
-  auto it = map_.find(k);
-  return Insert(it, std::move(k), std::move(v));
+size_t LRUInodeCache::EntryBytes(const Entry& entry) const {
+  size_t bytes = sizeof(Entry) + sizeof(uint32_t) + entry.first_name.size();
+  if (entry.more_paths) {
+    bytes += sizeof(std::vector<Path>);
+    for (const Path& path : *entry.more_paths)
+      bytes += sizeof(Path) + path.name.size();
+  }
+  return bytes;
+}
+
+uint32_t LRUInodeCache::InternPath(const std::string& path,
+                                   std::string* name) {
+  // "/system/bin/ls" is stored as the directory "", "system", "bin" and the
+  // name "ls", which joined with '/' give back the same string.
+  uint32_t dir = kNone;
+  size_t start = 0;
+  for (;;) {
+    const char* slash = static_cast<const char*>(
+        memchr(path.data() + start, '/', path.size() - start));
+    if (!slash)
+      break;
+    size_t end = static_cast<size_t>(slash - path.data());
+    dir = InternDir(dir, path.data() + start, end - start);
+    start = end + 1;
+  }
+  if (dir != kNone)
+    dirs_[dir].refcount++;
+  name->assign(path, start, std::string::npos);
+  return dir;
 }
 
-void LRUInodeCache::Insert(typename MapType::iterator map_it,
-                           InodeKey k,
-                           InodeMapValue v) {
-  list_.emplace_front(k, std::move(v));
-  if (map_it != map_.end()) {
-    ListIteratorType& list_it = map_it->second;
-    list_.erase(list_it);
-    list_it = list_.begin();
+uint32_t LRUInodeCache::InternDir(uint32_t parent,
+                                  const char* name,
+                                  size_t size) {
+  const size_t hash = HashDir(parent, name, size);
+  if (!dir_buckets_.empty()) {
+    uint32_t idx = dir_buckets_[hash & (dir_buckets_.size() - 1)];
+    for (; idx != kNone; idx = dirs_[idx].next) {
+      const Dir& dir = dirs_[idx];
+      if (dir.parent == parent && dir.name.size() == size &&
+          !memcmp(dir.name.data(), name, size)) {
+        return idx;
+      }
+    }
+  }
+
+  uint32_t idx;
+  if (free_dirs_ != kNone) {
+    idx = free_dirs_;
+    free_dirs_ = dirs_[idx].next;
   } else {
-    map_.emplace(std::move(k), list_.begin());
+    idx = static_cast<uint32_t>(dirs_.size());
+    dirs_.emplace_back();
   }
+  Dir& dir = dirs_[idx];
+  dir.parent = parent;
+  dir.refcount = 0;
+  dir.name.assign(name, size);
+  if (parent != kNone)
+    dirs_[parent].refcount++;
+  bytes_used_ += sizeof(Dir) + sizeof(uint32_t) + dir.name.size();
 
-  if (map_.size() > capacity_) {
-    auto list_last_it = list_.end();
-    list_last_it--;
-    map_.erase(list_last_it->first);
-    list_.erase(list_last_it);
+  if (++num_dirs_ > dir_buckets_.size()) {
+    // Rehash the directories in use, i.e. all but the free slots and |dir|.
+    dir_buckets_.assign(std::max(dir_buckets_.size() * 2, kMinBuckets), kNone);
+    const size_t mask = dir_buckets_.size() - 1;
+    for (uint32_t i = 0; i < dirs_.size(); i++) {
+      Dir& d = dirs_[i];
+      if (d.refcount == 0)
+        continue;
+      uint32_t& head =
+          dir_buckets_[HashDir(d.parent, d.name.data(), d.name.size()) & mask];
+      d.next = head;
+      head = i;
+    }
   }
+  uint32_t& head = dir_buckets_[hash & (dir_buckets_.size() - 1)];
+  dir.next = head;
+  head = idx;
+  return idx;
 }
+
+void LRUInodeCache::ReleaseDir(uint32_t idx) {
+  while (idx != kNone) {
+    Dir& dir = dirs_[idx];
+    PERFETTO_DCHECK(dir.refcount > 0);
+    if (--dir.refcount > 0)
+      return;
+
+    size_t hash = HashDir(dir.parent, dir.name.data(), dir.name.size());
+    uint32_t* link = &dir_buckets_[hash & (dir_buckets_.size() - 1)];
+    while (*link != idx)
+      link = &dirs_[*link].next;
+    *link = dir.next;
+
+    bytes_used_ -= sizeof(Dir) + sizeof(uint32_t) + dir.name.size();
+    uint32_t parent = dir.parent;
+    dir.name = std::string();
+    dir.next = free_dirs_;
+    free_dirs_ = idx;
+    num_dirs_--;
+    idx = parent;
+  }
+}
+
+std::string LRUInodeCache::PathToString(uint32_t dir,
+                                        const std::string& name) const {
+  std::vector<const std::string*> components;
+  size_t size = name.size();
+  for (uint32_t idx = dir; idx != kNone; idx = dirs_[idx].parent) {
+    components.push_back(&dirs_[idx].name);
+    size += dirs_[idx].name.size() + 1;
+  }
+  std::string res;
+  res.reserve(size);
+  for (auto it = components.rbegin(); it != components.rend(); ++it)
+    res.append(**it).push_back('/');
+  res.append(name);
+  return res;
+}
+
 }  // namespace perfetto
@@ -17,37 +17,120 @@
 #ifndef SRC_TRACED_PROBES_FILESYSTEM_LRU_INODE_CACHE_H_
 #define SRC_TRACED_PROBES_FILESYSTEM_LRU_INODE_CACHE_H_
 
-#include <list>
-#include <map>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <limits>
+#include <memory>
 #include <string>
-#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "perfetto/ext/traced/data_source_types.h"
 
 namespace perfetto {
 
-// LRUInodeCache keeps up to |capacity| entries in a mapping from InodeKey
-// to InodeMapValue. This is used to map <block device, inode> tuples to file
-// paths.
+// LRUInodeCache maps <block device, inode> tuples to the type and paths of
+// the file, keeping the most recently used entries that fit in a budget of
+// |capacity_bytes|.
+//
+// Entries are kept compact so that a given budget holds as many of them as
+// possible: the directories of the paths are interned in a tree of path
+// components shared by all entries, like in PrefixFinder, so that an entry
+// only stores the file name. Entries and directories live in slabs, linked
+// in an intrusive LRU list and in the chains of flat bucket arrays, rather
+// than in node-based containers.
 class LRUInodeCache {
  public:
   using InodeKey = std::pair<BlockDeviceID, Inode>;
 
-  explicit LRUInodeCache(size_t capacity) : capacity_(capacity) {}
+  explicit LRUInodeCache(size_t capacity_bytes);
+  ~LRUInodeCache();
+
+  LRUInodeCache(const LRUInodeCache&) = delete;
+  LRUInodeCache& operator=(const LRUInodeCache&) = delete;
+
+  // If |k| is cached, makes it the most recently used entry, copies its
+  // value into |v| and returns true.
+  bool Get(const InodeKey& k, InodeMapValue* v);
+  void Insert(const InodeKey& k, const InodeMapValue& v);
 
-  InodeMapValue* Get(const InodeKey& k);
-  void Insert(InodeKey k, InodeMapValue v);
+  size_t size() const { return num_entries_; }
+
+  // An estimate of the memory used by the entries and the directories they
+  // reference, which is kept within |capacity_bytes|. It doesn't include the
+  // unused capacity of the slabs.
+  size_t bytes_used() const { return bytes_used_; }
 
  private:
-  using ItemType = std::pair<const InodeKey, InodeMapValue>;
-  using ListIteratorType = std::list<ItemType>::iterator;
-  using MapType = std::map<const InodeKey, ListIteratorType>;
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+  // A path, as the id of its directory in |dirs_| (kNone if it has none)
+  // and the file name.
+  struct Path {
+    uint32_t dir;
+    std::string name;
+  };
+
+  struct Entry {
+    InodeKey key;
+    // Towards the most (|prev|) and least (|next|) recently used entries.
+    // |next| also links the free slots.
+    uint32_t prev;
+    uint32_t next;
+    // The next entry in the same bucket of |buckets_|.
+    uint32_t bucket_next;
+    InodeFileMap_Entry_Type type;
+    uint32_t num_paths;
+    // The first path is inline, the other ones (hard links) are rare.
+    uint32_t first_dir;
+    std::string first_name;
+    std::unique_ptr<std::vector<Path>> more_paths;
+  };
+
+  // A path component, e.g. "bin" for "/system/bin".
+  struct Dir {
+    uint32_t parent;  // kNone for the first component.
+    // The child directories and the paths of entries referencing this one.
+    // 0 for the free slots.
+    uint32_t refcount;
+    // The next directory in the same bucket of |dir_buckets_|, or the next
+    // free slot.
+    uint32_t next;
+    std::string name;
+  };
+
+  uint32_t FindEntry(const InodeKey& k) const;
+  uint32_t AddEntry(const InodeKey& k);
+  void EvictLeastRecentlyUsed();
+  void Unlink(uint32_t idx);
+  void PushFront(uint32_t idx);
+  void SetPaths(uint32_t idx, const InodeMapValue& v);
+  void ClearPaths(uint32_t idx);
+  size_t EntryBytes(const Entry& entry) const;
+
+  // Interns the directory of |path|, returning its id, and sets |name|.
+  uint32_t InternPath(const std::string& path, std::string* name);
+  uint32_t InternDir(uint32_t parent, const char* name, size_t size);
+  void ReleaseDir(uint32_t dir);
+  std::string PathToString(uint32_t dir, const std::string& name) const;
+
+  const size_t capacity_bytes_;
+  size_t bytes_used_ = 0;
 
-  void Insert(MapType::iterator map_it, InodeKey k, InodeMapValue v);
+  std::vector<Entry> entries_;
+  size_t num_entries_ = 0;
+  uint32_t free_entries_ = kNone;
+  uint32_t lru_head_ = kNone;  // The most recently used entry.
+  uint32_t lru_tail_ = kNone;
+  // Hash of the key -> first entry of the chain, a power of two long.
+  std::vector<uint32_t> buckets_;
 
-  const size_t capacity_;
-  MapType map_;
-  std::list<ItemType> list_;
+  std::vector<Dir> dirs_;
+  size_t num_dirs_ = 0;
+  uint32_t free_dirs_ = kNone;
+  // Hash of (parent, name) -> first directory of the chain.
+  std::vector<uint32_t> dir_buckets_;
 };
 
 }  // namespace perfetto
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/filesystem/lru_inode_cache.h"
 
+#include <limits>
+#include <optional>
 #include <string>
 #include <tuple>
 
@@ -27,8 +29,7 @@ namespace perfetto {
 namespace {
 
 using ::testing::Eq;
-using ::testing::IsNull;
-using ::testing::Pointee;
+using ::testing::Optional;
 
 const std::pair<BlockDeviceID, Inode> key1{0, 0};
 const std::pair<BlockDeviceID, Inode> key2{0, 1};
@@ -49,28 +50,101 @@ InodeMapValue val3() {
                        std::set<std::string>{"Value 2"});
 }
 
+std::optional<InodeMapValue> Get(LRUInodeCache* cache,
+                                 const LRUInodeCache::InodeKey& key) {
+  InodeMapValue value;
+  if (!cache->Get(key, &value))
+    return std::nullopt;
+  return value;
+}
+
+// The budget needed for two entries like the ones above.
+size_t TwoEntriesBytes() {
+  LRUInodeCache cache(std::numeric_limits<size_t>::max());
+  cache.Insert(key1, val1());
+  cache.Insert(key2, val2());
+  return cache.bytes_used();
+}
+
 TEST(LRUInodeCacheTest, Basic) {
-  LRUInodeCache cache(2);
+  LRUInodeCache cache(TwoEntriesBytes());
   cache.Insert(key1, val1());
-  EXPECT_THAT(cache.Get(key1), Pointee(Eq(val1())));
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(val1())));
   cache.Insert(key2, val2());
-  EXPECT_THAT(cache.Get(key1), Pointee(Eq(val1())));
-  EXPECT_THAT(cache.Get(key2), Pointee(Eq(val2())));
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(val1())));
+  EXPECT_THAT(Get(&cache, key2), Optional(Eq(val2())));
   cache.Insert(key1, val2());
-  EXPECT_THAT(cache.Get(key1), Pointee(Eq(val2())));
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(val2())));
 }
 
 TEST(LRUInodeCacheTest, Overflow) {
-  LRUInodeCache cache(2);
+  LRUInodeCache cache(TwoEntriesBytes());
   cache.Insert(key1, val1());
   cache.Insert(key2, val2());
-  EXPECT_THAT(cache.Get(key1), Pointee(Eq(val1())));
-  EXPECT_THAT(cache.Get(key2), Pointee(Eq(val2())));
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(val1())));
+  EXPECT_THAT(Get(&cache, key2), Optional(Eq(val2())));
   cache.Insert(key3, val3());
   // key1 is the LRU and should be evicted.
-  EXPECT_THAT(cache.Get(key1), IsNull());
-  EXPECT_THAT(cache.Get(key2), Pointee(Eq(val2())));
-  EXPECT_THAT(cache.Get(key3), Pointee(Eq(val3())));
+  EXPECT_EQ(Get(&cache, key1), std::nullopt);
+  EXPECT_THAT(Get(&cache, key2), Optional(Eq(val2())));
+  EXPECT_THAT(Get(&cache, key3), Optional(Eq(val3())));
+}
+
+TEST(LRUInodeCacheTest, SharedDirectories) {
+  const InodeMapValue file(
+      protos::pbzero::InodeFileMap::Entry::Type::FILE,
+      std::set<std::string>{"/system/bin/ls", "/system/xbin/ls"});
+  const InodeMapValue dir(protos::pbzero::InodeFileMap::Entry::Type::DIRECTORY,
+                          std::set<std::string>{"/system/bin/"});
+  const InodeMapValue relative(
+      protos::pbzero::InodeFileMap::Entry::Type::FILE,
+      std::set<std::string>{"bin//sh", "sh"});
+
+  LRUInodeCache cache(std::numeric_limits<size_t>::max());
+  cache.Insert(key1, file);
+  size_t one_entry_bytes = cache.bytes_used();
+  cache.Insert(key2, dir);
+  cache.Insert(key3, relative);
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(file)));
+  EXPECT_THAT(Get(&cache, key2), Optional(Eq(dir)));
+  EXPECT_THAT(Get(&cache, key3), Optional(Eq(relative)));
+
+  // Replacing the paths releases the directories only used by the old ones.
+  cache.Insert(key2, val1());
+  cache.Insert(key3, val2());
+  cache.Insert(key3, relative);
+  cache.Insert(key3, val2());
+  LRUInodeCache expected(std::numeric_limits<size_t>::max());
+  expected.Insert(key1, file);
+  expected.Insert(key2, val1());
+  expected.Insert(key3, val2());
+  EXPECT_EQ(cache.bytes_used(), expected.bytes_used());
+  EXPECT_THAT(Get(&cache, key1), Optional(Eq(file)));
+
+  // "/system/bin" is interned once.
+  LRUInodeCache two_files(std::numeric_limits<size_t>::max());
+  two_files.Insert(key1, file);
+  two_files.Insert(
+      key2, InodeMapValue(protos::pbzero::InodeFileMap::Entry::Type::FILE,
+                          std::set<std::string>{"/system/bin/sh"}));
+  EXPECT_LT(two_files.bytes_used(), 2 * one_entry_bytes);
+}
+
+TEST(LRUInodeCacheTest, StaysWithinBudget) {
+  const size_t kBudget = 16 * 1024;
+  LRUInodeCache cache(kBudget);
+  for (Inode i = 0; i < 10000; i++) {
+    std::string path = "/data/app/" + std::to_string(i % 97) + "/lib/" +
+                       std::to_string(i) + ".so";
+    cache.Insert({0, i}, InodeMapValue(0, std::set<std::string>{path}));
+    ASSERT_LE(cache.bytes_used(), kBudget);
+  }
+  EXPECT_GT(cache.size(), 50u);
+  // The most recently inserted entries are kept.
+  EXPECT_THAT(Get(&cache, {0, 9999}),
+              Optional(Eq(InodeMapValue(
+                  0, std::set<std::string>{"/data/app/8/lib/9999.so"}))));
+  EXPECT_EQ(Get(&cache, {0, 0}), std::nullopt);
 }
 
 }  // namespace
@@ -280,8 +280,136 @@ void CommInterner::Reset() {
   interned_comms_size_ = 0;
 }
 
+bool IsEventCompactEncodable(const Event& event) {
+  using protos::pbzero::FtraceEvent;
+
+  // Events with a dedicated encoding, or handled specially by CpuReader.
+  switch (event.proto_field_id) {
+    case FtraceEvent::kGenericFieldNumber:
+    case FtraceEvent::kSysEnterFieldNumber:
+    case FtraceEvent::kSysExitFieldNumber:
+    case FtraceEvent::kTaskRenameFieldNumber:
+      return false;
+    default:
+      break;
+  }
+  if (event.fields.empty())
+    return false;
+
+  for (const Field& field : event.fields) {
+    switch (field.strategy) {
+      case kUint8ToUint32:
+      case kUint8ToUint64:
+      case kUint16ToUint32:
+      case kUint16ToUint64:
+      case kUint32ToUint32:
+      case kUint32ToUint64:
+      case kUint64ToUint64:
+      case kInt8ToInt32:
+      case kInt8ToInt64:
+      case kInt16ToInt32:
+      case kInt16ToInt64:
+      case kInt32ToInt32:
+      case kInt32ToInt64:
+      case kInt64ToInt64:
+      case kBoolToUint32:
+      case kBoolToUint64:
+      case kInode32ToUint64:
+      case kInode64ToUint64:
+      case kPid32ToInt32:
+      case kPid32ToInt64:
+      case kCommonPid32ToInt32:
+      case kCommonPid32ToInt64:
+      case kDevId32ToUint64:
+      case kDevId64ToUint64:
+      case kFtraceSymAddr64ToUint64:
+        break;
+      case kFixedCStringToString:
+      case kCStringToString:
+      case kStringPtrToString:
+      case kDataLocToString:
+      case kInvalidTranslationStrategy:
+        return false;
+    }
+  }
+  return true;
+}
+
+CompactEventsBuffer::Batch::Batch(const Event* event)
+    : event_(event), fields_(event->fields.size()) {}
+
+CompactEventsBuffer::Batch::~Batch() = default;
+
+void CompactEventsBuffer::Batch::Write(
+    protos::pbzero::FtraceEventBundle::CompactEvents* compact_out) const {
+  using CompactEvents = protos::pbzero::FtraceEventBundle::CompactEvents;
+  compact_out->set_proto_field_id(event_->proto_field_id);
+  compact_out->AppendBytes(CompactEvents::kTimestampFieldNumber,
+                           timestamp_.data(), timestamp_.size());
+  if (!pid_.empty()) {
+    compact_out->AppendBytes(CompactEvents::kPidFieldNumber, pid_.data(),
+                             pid_.size());
+  }
+  for (size_t i = 0; i < fields_.size(); i++) {
+    auto* field_out = compact_out->add_field();
+    field_out->set_proto_field_id(event_->fields[i].proto_field_id);
+    field_out->AppendBytes(CompactEvents::Field::kValueFieldNumber,
+                           fields_[i].data(), fields_[i].size());
+  }
+}
+
+void CompactEventsBuffer::Batch::Reset() {
+  size_ = 0;
+  last_timestamp_ = 0;
+  // clear() keeps the capacity of the columns for the next bundle.
+  timestamp_.clear();
+  pid_.clear();
+  for (auto& field : fields_)
+    field.clear();
+}
+
+CompactEventsBuffer::CompactEventsBuffer() = default;
+CompactEventsBuffer::~CompactEventsBuffer() = default;
+
+CompactEventsBuffer::Batch* CompactEventsBuffer::CreateBatch(
+    const Event& event) {
+  const size_t id = event.ftrace_event_id;
+  if (id >= batches_.size())
+    batches_.resize(id + 1);
+  // Replaces the batch of an event with the same id from another translation
+  // table (i.e. another ftrace instance), which must have been written out.
+  PERFETTO_DCHECK(!batches_[id] || batches_[id]->size() == 0);
+  batches_[id] = std::make_unique<Batch>(&event);
+  return batches_[id].get();
+}
+
+size_t CompactEventsBuffer::size() const {
+  size_t size = 0;
+  for (const auto& batch : batches_) {
+    if (batch)
+      size += batch->size();
+  }
+  return size;
+}
+
+void CompactEventsBuffer::Write(
+    protos::pbzero::FtraceEventBundle* bundle) const {
+  for (const auto& batch : batches_) {
+    if (batch && batch->size() > 0)
+      batch->Write(bundle->add_compact_events());
+  }
+}
+
+void CompactEventsBuffer::Reset() {
+  for (auto& batch : batches_) {
+    if (batch)
+      batch->Reset();
+  }
+}
+
 void CompactSchedBuffer::WriteAndReset(
     protos::pbzero::FtraceEventBundle* bundle) {
+  events_.Write(bundle);
   if (switch_.size() > 0 || waking_.size() > 0) {
     auto* compact_out = bundle->set_compact_sched();
 
@@ -301,6 +429,7 @@ void CompactSchedBuffer::Reset() {
   interner_.Reset();
   switch_.Reset();
   waking_.Reset();
+  events_.Reset();
 }
 
 }  // namespace perfetto
@@ -19,8 +19,13 @@
 
 #include <stdint.h>
 
+#include <memory>
+#include <vector>
+
+#include "perfetto/base/logging.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/protozero/packed_repeated_fields.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 #include "src/traced/probes/ftrace/event_info_constants.h"
 #include "src/traced/probes/ftrace/ftrace_config_utils.h"
@@ -218,7 +223,98 @@ class CommInterner {
   uint32_t interned_comms_size_ = 0;
 };
 
-// Mutable state for buffering parts of scheduling events, that can later be
+// Returns true if |event| can be encoded by |CompactEventsBuffer|: all of its
+// fields are fixed-width integers that are translated into a single varint
+// (see TranslationStrategy), and it doesn't need special handling when parsed
+// (e.g. syscalls or generic events).
+bool IsEventCompactEncodable(const Event& event);
+
+// Collects the fields of the events accepted by |IsEventCompactEncodable|, one
+// batch per event type, allowing them to be written out in a compact encoding
+// (FtraceEventBundle.CompactEvents).
+class CompactEventsBuffer {
+ public:
+  // The buffered events of a single type. Each field is stored in its own
+  // column of varints, in the order of |Event::fields|.
+  class Batch {
+   public:
+    explicit Batch(const Event* event);
+    ~Batch();
+
+    const Event* event() const { return event_; }
+
+    size_t size() const {
+      // Caller should fill all columns at the same rate.
+      return size_;
+    }
+
+    inline void AppendTimestamp(uint64_t timestamp) {
+      AppendVarInt(&timestamp_, timestamp - last_timestamp_);
+      last_timestamp_ = timestamp;
+      size_++;
+    }
+
+    inline void AppendPid(int32_t pid) { AppendVarInt(&pid_, pid); }
+
+    // |value| is the 64-bit value of the field's varint encoding.
+    inline void AppendField(size_t index, uint64_t value) {
+      PERFETTO_DCHECK(index < fields_.size());
+      AppendVarInt(&fields_[index], value);
+    }
+
+    void Write(
+        protos::pbzero::FtraceEventBundle::CompactEvents* compact_out) const;
+    void Reset();
+
+   private:
+    template <typename T>
+    static inline void AppendVarInt(std::vector<uint8_t>* column, T value) {
+      uint8_t buf[protozero::proto_utils::kMaxSimpleFieldEncodedSize];
+      uint8_t* end = protozero::proto_utils::WriteVarInt(value, buf);
+      column->insert(column->end(), buf, end);
+    }
+
+    const Event* const event_;
+    size_t size_ = 0;
+
+    // First timestamp in a bundle is absolute. The rest are all delta-encoded,
+    // each relative to the preceding event of the same batch.
+    uint64_t last_timestamp_ = 0;
+
+    std::vector<uint8_t> timestamp_;
+    std::vector<uint8_t> pid_;
+    std::vector<std::vector<uint8_t>> fields_;
+  };
+
+  CompactEventsBuffer();
+  ~CompactEventsBuffer();
+
+  // Returns the batch collecting the events of type |event|. The batches are
+  // kept across bundles, to reuse the memory of their columns.
+  Batch* GetOrCreateBatch(const Event& event) {
+    const size_t id = event.ftrace_event_id;
+    if (PERFETTO_LIKELY(id < batches_.size() && batches_[id] &&
+                        batches_[id]->event() == &event)) {
+      return batches_[id].get();
+    }
+    return CreateBatch(event);
+  }
+
+  // Number of events buffered across all batches.
+  size_t size() const;
+
+  void Write(protos::pbzero::FtraceEventBundle* bundle) const;
+  void Reset();
+
+ private:
+  Batch* CreateBatch(const Event& event);
+
+  // Indexed by ftrace event id.
+  std::vector<std::unique_ptr<Batch>> batches_;
+};
+
+// Mutable state for buffering parts of scheduling events (and other events
+// with a compact encoding, see |CompactEventsBuffer|), that can later be
 // written out in a compact format with |WriteAndReset|. Used by the ftrace
 // reader.
 class CompactSchedBuffer {
@@ -226,6 +322,7 @@ class CompactSchedBuffer {
   CompactSchedSwitchBuffer& sched_switch() { return switch_; }
   CompactSchedWakingBuffer& sched_waking() { return waking_; }
   CommInterner& interner() { return interner_; }
+  CompactEventsBuffer& compact_events() { return events_; }
 
   // Writes out the currently buffered events, and starts the next batch
   // internally.
@@ -238,6 +335,7 @@ class CompactSchedBuffer {
   CommInterner interner_;
   CompactSchedSwitchBuffer switch_;
   CompactSchedWakingBuffer waking_;
+  CompactEventsBuffer events_;
 };
 
 }  // namespace perfetto
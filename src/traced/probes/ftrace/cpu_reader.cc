@@ -22,11 +22,13 @@
 #include <algorithm>
 #include <optional>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
+#include "perfetto/protozero/proto_utils.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
@@ -81,9 +83,8 @@ void ReadIntoString(const uint8_t* start,
 bool ReadDataLoc(const uint8_t* start,
                  const uint8_t* field_start,
                  const uint8_t* end,
-                 const Field& field,
+                 uint32_t field_id,
                  protozero::Message* message) {
-  PERFETTO_DCHECK(field.ftrace_size == 4);
   // See kernel header include/trace/trace_events.h
   uint32_t data = 0;
   const uint8_t* ptr = field_start;
@@ -102,7 +103,7 @@ bool ReadDataLoc(const uint8_t* start,
     PERFETTO_DFATAL("__data_loc points at invalid location");
     return false;
   }
-  ReadIntoString(string_start, len, field.proto_field_id, message);
+  ReadIntoString(string_start, len, field_id, message);
   return true;
 }
 
@@ -113,6 +114,15 @@ T ReadValue(const uint8_t* ptr) {
   return t;
 }
 
+// Reads a T as the 64-bit value of its varint encoding, i.e. what
+// Message::AppendVarInt<T>() would write.
+template <typename T>
+uint64_t ReadVarIntValue(const uint8_t* ptr) {
+  return static_cast<uint64_t>(
+      protozero::proto_utils::ExtendValueForVarIntSerialization(
+          ReadValue<T>(ptr)));
+}
+
 // Reads a signed ftrace value as an int64_t, sign extending if necessary.
 int64_t ReadSignedFtraceValue(const uint8_t* ptr, FtraceFieldType ftrace_type) {
   if (ftrace_type == kFtraceInt32) {
@@ -128,6 +138,124 @@ int64_t ReadSignedFtraceValue(const uint8_t* ptr, FtraceFieldType ftrace_type) {
   PERFETTO_FATAL("unexpected ftrace type");
 }
 
+// Runs the EventProgram of an event, i.e. does what CpuReader::ParseField()
+// does for each of its fields. The varints are serialized into a stack buffer
+// and written into |message| together, which only needs to be flushed before
+// writing a string. |kVarIntsOnly| is EventProgram.varints_only: the buffer
+// can then hold all the ops and is never flushed.
+// The caller must guarantee that the fixed-size fields fit in [start, end).
+template <bool kVarIntsOnly>
+bool RunEventProgram(const EventProgram& program,
+                     const uint8_t* start,
+                     const uint8_t* end,
+                     const ProtoTranslationTable* table,
+                     protozero::Message* message,
+                     FtraceMetadata* metadata) {
+  using protozero::proto_utils::kMaxSimpleFieldEncodedSize;
+  using protozero::proto_utils::WriteVarInt;
+
+  uint8_t buf[EventProgram::kMaxVarIntOps * kMaxSimpleFieldEncodedSize];
+  uint8_t* pos = buf;
+  auto flush = [&] {
+    if (pos != buf)
+      message->AppendRawProtoBytes(buf, static_cast<size_t>(pos - buf));
+    pos = buf;
+  };
+
+  bool success = true;
+  for (const FieldOp& op : program.ops) {
+    if (!kVarIntsOnly && pos + kMaxSimpleFieldEncodedSize > buf + sizeof(buf))
+      flush();
+    const uint8_t* field_start = start + op.offset;
+    uint64_t value;
+    switch (op.op) {
+      case FieldOp::kUint8:
+        value = ReadVarIntValue<uint8_t>(field_start);
+        break;
+      case FieldOp::kUint16:
+        value = ReadVarIntValue<uint16_t>(field_start);
+        break;
+      case FieldOp::kUint32:
+        value = ReadVarIntValue<uint32_t>(field_start);
+        break;
+      case FieldOp::kUint64:
+        value = ReadVarIntValue<uint64_t>(field_start);
+        break;
+      case FieldOp::kInt8:
+        value = ReadVarIntValue<int8_t>(field_start);
+        break;
+      case FieldOp::kInt16:
+        value = ReadVarIntValue<int16_t>(field_start);
+        break;
+      case FieldOp::kInt32:
+        value = ReadVarIntValue<int32_t>(field_start);
+        break;
+      case FieldOp::kInt64:
+        value = ReadVarIntValue<int64_t>(field_start);
+        break;
+      case FieldOp::kInode32:
+        value = ReadValue<uint32_t>(field_start);
+        metadata->AddInode(static_cast<Inode>(value));
+        break;
+      case FieldOp::kInode64:
+        value = ReadValue<uint64_t>(field_start);
+        metadata->AddInode(static_cast<Inode>(value));
+        break;
+      case FieldOp::kPid32:
+        value = ReadVarIntValue<int32_t>(field_start);
+        metadata->AddPid(ReadValue<int32_t>(field_start));
+        break;
+      case FieldOp::kCommonPid32:
+        value = ReadVarIntValue<int32_t>(field_start);
+        metadata->AddCommonPid(ReadValue<int32_t>(field_start));
+        break;
+      case FieldOp::kDevId32:
+        value = CpuReader::TranslateBlockDeviceIDToUserspace(
+            ReadValue<uint32_t>(field_start));
+        metadata->AddDevice(value);
+        break;
+      case FieldOp::kDevId64:
+        value = CpuReader::TranslateBlockDeviceIDToUserspace(
+            ReadValue<uint64_t>(field_start));
+        metadata->AddDevice(value);
+        break;
+      case FieldOp::kSymAddr64:
+        // See CpuReader::ReadSymbolAddr().
+        value = metadata->AddSymbolAddr(ReadValue<uint64_t>(field_start));
+        break;
+      case FieldOp::kFixedCString:
+        flush();
+        ReadIntoString(field_start, op.size, op.proto_field_id, message);
+        continue;
+      case FieldOp::kCString:
+        flush();
+        ReadIntoString(field_start, static_cast<size_t>(end - field_start),
+                       op.proto_field_id, message);
+        continue;
+      case FieldOp::kStringPtr: {
+        flush();
+        // See CpuReader::ParseField().
+        uint64_t n = 0;
+        size_t size = std::min<size_t>(op.size, sizeof(n));
+        memcpy(base::AssumeLittleEndian(&n),
+               reinterpret_cast<const void*>(field_start), size);
+        base::StringView name = table->LookupTraceString(n);
+        message->AppendBytes(op.proto_field_id, name.begin(), name.size());
+        continue;
+      }
+      case FieldOp::kDataLoc:
+        flush();
+        success &=
+            ReadDataLoc(start, field_start, end, op.proto_field_id, message);
+        continue;
+    }
+    pos = WriteVarInt(op.tag, pos);
+    pos = WriteVarInt(value, pos);
+  }
+  flush();
+  return success;
+}
+
 bool SetBlocking(int fd, bool is_blocking) {
   int flags = fcntl(fd, F_GETFL, 0);
   flags = (is_blocking) ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
@@ -135,12 +263,13 @@ bool SetBlocking(int fd, bool is_blocking) {
 }
 
 void SetParseError(const std::set<FtraceDataSource*>& started_data_sources,
+                   size_t reader_id,
                    size_t cpu,
                    FtraceParseStatus status) {
   PERFETTO_DPLOG("[cpu%zu]: unexpected ftrace read error: %s", cpu,
                  protos::pbzero::FtraceParseStatus_Name(status));
   for (FtraceDataSource* data_source : started_data_sources) {
-    data_source->mutable_parse_errors()->insert(status);
+    data_source->GetReaderOutput(reader_id).parse_errors->insert(status);
   }
 }
 
@@ -157,6 +286,55 @@ void WriteAndSetParseError(CpuReader::Bundler* bundler,
   proto->set_status(status);
 }
 
+using RawPageField = protos::pbzero::FtraceEventBundle::RawPageFormat::Field;
+
+// Maps the type of a field to the encoding used to decode it from the raw
+// pages at trace processing time. Returns TYPE_UNSPECIFIED for the fields that
+// can't be decoded without the kernel's help.
+RawPageField::Type ToRawPageFieldType(FtraceFieldType type) {
+  switch (type) {
+    case kFtraceUint8:
+    case kFtraceUint16:
+    case kFtraceUint32:
+    case kFtraceUint64:
+    case kFtraceBool:
+    case kFtraceInode32:
+    case kFtraceInode64:
+      return RawPageField::TYPE_UINT;
+    case kFtraceInt8:
+    case kFtraceInt16:
+    case kFtraceInt32:
+    case kFtraceInt64:
+    case kFtracePid32:
+    case kFtraceCommonPid32:
+      return RawPageField::TYPE_INT;
+    case kFtraceFixedCString:
+      return RawPageField::TYPE_FIXED_STRING;
+    case kFtraceCString:
+      return RawPageField::TYPE_CSTRING;
+    case kFtraceDataLoc:
+      return RawPageField::TYPE_DATA_LOC;
+    case kFtraceDevId32:
+    case kFtraceDevId64:
+      return RawPageField::TYPE_KERNEL_DEV_ID;
+    // Pointers into kernel memory, which are resolved through
+    // printk_formats and kallsyms.
+    case kFtraceStringPtr:
+    case kFtraceSymAddr64:
+    case kInvalidFtraceFieldType:
+      break;
+  }
+  return RawPageField::TYPE_UNSPECIFIED;
+}
+
+void WriteRawPageField(const Field& field, RawPageField* out) {
+  out->set_name(field.ftrace_name);
+  out->set_offset(field.ftrace_offset);
+  out->set_size(field.ftrace_size);
+  out->set_type(ToRawPageFieldType(field.ftrace_type));
+  out->set_proto_field_id(field.proto_field_id);
+}
+
 }  // namespace
 
 using protos::pbzero::GenericFtraceEvent;
@@ -182,7 +360,8 @@ CpuReader::~CpuReader() = default;
 size_t CpuReader::ReadCycle(
     ParsingBuffers* parsing_bufs,
     size_t max_pages,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::set<FtraceDataSource*>& started_data_sources,
+    size_t reader_id) {
   PERFETTO_DCHECK(max_pages > 0 && parsing_bufs->ftrace_data_buf_pages() > 0);
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_READ_CYCLE);
@@ -194,7 +373,7 @@ size_t CpuReader::ReadCycle(
                                   max_pages - total_pages_read);
     size_t pages_read = ReadAndProcessBatch(
         parsing_bufs->ftrace_data_buf(), batch_pages, is_first_batch,
-        parsing_bufs->compact_sched_buf(), started_data_sources);
+        parsing_bufs->compact_sched_buf(), started_data_sources, reader_id);
 
     PERFETTO_DCHECK(pages_read <= batch_pages);
     total_pages_read += pages_read;
@@ -221,7 +400,8 @@ size_t CpuReader::ReadAndProcessBatch(
     size_t max_pages,
     bool first_batch_in_cycle,
     CompactSchedBuffer* compact_sched_buf,
-    const std::set<FtraceDataSource*>& started_data_sources) {
+    const std::set<FtraceDataSource*>& started_data_sources,
+    size_t reader_id) {
   const uint32_t sys_page_size = base::GetSysPageSize();
   size_t pages_read = 0;
   {
@@ -237,7 +417,7 @@ size_t CpuReader::ReadAndProcessBatch(
         // ENODEV: the cpu is offline (b/145583318).
         if (errno != EAGAIN && errno != ENOMEM && errno != EBUSY &&
             errno != ENODEV) {
-          SetParseError(started_data_sources, cpu_,
+          SetParseError(started_data_sources, reader_id, cpu_,
                         FtraceParseStatus::FTRACE_STATUS_UNEXPECTED_READ_ERROR);
         }
         break;  // stop reading regardless of errno
@@ -255,7 +435,7 @@ size_t CpuReader::ReadAndProcessBatch(
         break;
       }
       if (res != static_cast<ssize_t>(sys_page_size)) {
-        SetParseError(started_data_sources, cpu_,
+        SetParseError(started_data_sources, reader_id, cpu_,
                       FtraceParseStatus::FTRACE_STATUS_PARTIAL_PAGE_READ);
         break;
       }
@@ -281,6 +461,8 @@ size_t CpuReader::ReadAndProcessBatch(
         // The header error will be logged by ProcessPagesForDataSource.
         break;
       }
+      read_stats_.bytes += hdr->size;
+      read_stats_.lost_events |= hdr->lost_events;
       // Note that the first read after starting the read cycle being small is
       // normal. It means that we're given the remainder of events from a
       // page that we've partially consumed during the last read of the previous
@@ -299,12 +481,22 @@ size_t CpuReader::ReadAndProcessBatch(
 
   uint64_t last_read_ts = last_read_event_ts_;
   for (FtraceDataSource* data_source : started_data_sources) {
+    FtraceDataSource::ReaderOutput out =
+        data_source->GetReaderOutput(reader_id);
+    if (data_source->parsing_config()->raw_page_passthrough) {
+      WriteRawPagesForDataSource(
+          out.trace_writer, out.metadata, cpu_, data_source->parsing_config(),
+          out.parse_errors, out.raw_page_format_written, last_read_event_ts_,
+          parsing_buf, pages_read, table_, ftrace_clock_snapshot_,
+          ftrace_clock_);
+      continue;
+    }
     last_read_ts = last_read_event_ts_;
     ProcessPagesForDataSource(
-        data_source->trace_writer(), data_source->mutable_metadata(), cpu_,
-        data_source->parsing_config(), data_source->mutable_parse_errors(),
-        &last_read_ts, parsing_buf, pages_read, compact_sched_buf, table_,
-        symbolizer_, ftrace_clock_snapshot_, ftrace_clock_);
+        out.trace_writer, out.metadata, cpu_, data_source->parsing_config(),
+        out.parse_errors, &last_read_ts, parsing_buf, pages_read,
+        compact_sched_buf, table_, symbolizer_, ftrace_clock_snapshot_,
+        ftrace_clock_);
   }
   last_read_event_ts_ = last_read_ts;
 
@@ -359,11 +551,20 @@ void CpuReader::Bundler::FinalizeAndRunSymbolizer() {
     PERFETTO_DCHECK(max_index_at_start <= metadata_->kernel_addrs.size());
     protos::pbzero::InternedData* interned_data = nullptr;
     auto* ksyms_map = symbolizer_->GetOrCreateKernelSymbolMap();
-    bool wrote_at_least_one_symbol = false;
+    // |kernel_addrs| is sorted by address, which lets the new addresses be
+    // symbolized in a single pass over the symbol map.
+    std::vector<uint64_t> new_addrs;
+    std::vector<uint32_t> new_indexes;
     for (const FtraceMetadata::KernelAddr& kaddr : metadata_->kernel_addrs) {
       if (kaddr.index <= max_index_at_start)
         continue;
-      std::string sym_name = ksyms_map->Lookup(kaddr.addr);
+      new_addrs.push_back(kaddr.addr);
+      new_indexes.push_back(kaddr.index);
+    }
+    std::vector<std::string> sym_names = ksyms_map->LookupSorted(new_addrs);
+    bool wrote_at_least_one_symbol = false;
+    for (size_t i = 0; i < sym_names.size(); i++) {
+      const std::string& sym_name = sym_names[i];
       if (sym_name.empty()) {
         // Lookup failed. This can genuinely happen in many occasions. E.g.,
         // workqueue_execute_start has two pointers: one is a pointer to a
@@ -386,7 +587,7 @@ void CpuReader::Bundler::FinalizeAndRunSymbolizer() {
         interned_data = packet_->set_interned_data();
       }
       auto* interned_sym = interned_data->add_kernel_symbols();
-      interned_sym->set_iid(kaddr.index);
+      interned_sym->set_iid(new_indexes[i]);
       interned_sym->set_str(sym_name);
       wrote_at_least_one_symbol = true;
     }
@@ -433,10 +634,13 @@ bool CpuReader::ProcessPagesForDataSource(
     const FtraceClockSnapshot* ftrace_clock_snapshot,
     protos::pbzero::FtraceClock ftrace_clock) {
   const uint32_t sys_page_size = base::GetSysPageSize();
+  // The compact buffer holds both the compact sched events and the other
+  // compact encoded events, see CompactSchedBuffer.
   Bundler bundler(trace_writer, metadata,
                   ds_config->symbolize_ksyms ? symbolizer : nullptr, cpu,
                   ftrace_clock_snapshot, ftrace_clock, compact_sched_buf,
-                  ds_config->compact_sched.enabled, *last_read_event_ts);
+                  ds_config->compact_sched.enabled || ds_config->compact_events,
+                  *last_read_event_ts);
 
   bool success = true;
   size_t pages_parsed = 0;
@@ -492,6 +696,88 @@ bool CpuReader::ProcessPagesForDataSource(
   return success;
 }
 
+// static
+bool CpuReader::WriteRawPagesForDataSource(
+    TraceWriter* trace_writer,
+    FtraceMetadata* metadata,
+    size_t cpu,
+    const FtraceDataSourceConfig* ds_config,
+    base::FlatSet<protos::pbzero::FtraceParseStatus>* parse_errors,
+    bool* format_written,
+    uint64_t last_read_event_ts,
+    const uint8_t* parsing_buf,
+    const size_t pages_read,
+    const ProtoTranslationTable* table,
+    const FtraceClockSnapshot* ftrace_clock_snapshot,
+    protos::pbzero::FtraceClock ftrace_clock) {
+  const uint32_t sys_page_size = base::GetSysPageSize();
+  Bundler bundler(trace_writer, metadata, /*symbolizer=*/nullptr, cpu,
+                  ftrace_clock_snapshot, ftrace_clock,
+                  /*compact_sched_buf=*/nullptr,
+                  /*compact_sched_enabled=*/false, last_read_event_ts);
+
+  if (!*format_written) {
+    WriteRawPageFormat(table, ds_config, bundler.GetOrCreateBundle());
+    *format_written = true;
+  }
+
+  bool success = true;
+  for (size_t i = 0; i < pages_read; i++) {
+    const uint8_t* curr_page = parsing_buf + (i * sys_page_size);
+    const uint8_t* curr_page_end = curr_page + sys_page_size;
+    const uint8_t* payload = curr_page;
+    std::optional<PageHeader> page_header =
+        ParsePageHeader(&payload, table->page_header_size_len());
+
+    if (!page_header.has_value() || page_header->size == 0 ||
+        payload >= curr_page_end ||
+        payload + page_header->size > curr_page_end) {
+      WriteAndSetParseError(
+          &bundler, parse_errors,
+          page_header.has_value() ? page_header->timestamp : 0,
+          FtraceParseStatus::FTRACE_STATUS_ABI_INVALID_PAGE_HEADER);
+      success = false;
+      continue;
+    }
+
+    // Same as the parsing path: a bundle has a single |lost_events| flag.
+    if (page_header->lost_events)
+      bundler.StartNewPacket(true, last_read_event_ts);
+
+    // Drop the zero-filled tail of the page, which is the bulk of it when
+    // reading in real-time.
+    size_t len = static_cast<size_t>(payload - curr_page) + page_header->size;
+    bundler.GetOrCreateBundle()->add_raw_pages(curr_page, len);
+  }
+  return success;
+}
+
+// static
+void CpuReader::WriteRawPageFormat(const ProtoTranslationTable* table,
+                                   const FtraceDataSourceConfig* ds_config,
+                                   protos::pbzero::FtraceEventBundle* bundle) {
+  auto* format = bundle->set_raw_page_format();
+  format->set_commit_size(table->page_header_size_len());
+  if (const Field* common_pid = table->common_pid())
+    WriteRawPageField(*common_pid, format->set_common_pid());
+
+  for (const Event& event : table->events()) {
+    if (!ds_config->event_filter.IsEventEnabled(event.ftrace_event_id))
+      continue;
+    auto* event_format = format->add_event();
+    event_format->set_id(event.ftrace_event_id);
+    event_format->set_name(event.name);
+    event_format->set_proto_field_id(event.proto_field_id);
+    for (const Field& field : event.fields) {
+      if (ToRawPageFieldType(field.ftrace_type) ==
+          RawPageField::TYPE_UNSPECIFIED) {
+        continue;
+      }
+      WriteRawPageField(field, event_format->add_field());
+    }
+  }
+}
+
 // A page header consists of:
 // * timestamp: 8 bytes
 // * commit: 8 bytes on 64 bit, 4 bytes on 32 bit kernels
@@ -673,6 +959,17 @@ protos::pbzero::FtraceParseStatus CpuReader::ParsePagePayload(
             ParseSchedWakingCompact(start, timestamp, &sched_waking_format,
                                     bundler->compact_sched_buf(), metadata);
 
+            // other events with only fixed-width fields
+          } else if (ds_config->compact_events &&
+                     table->IsCompactEncodable(ftrace_event_id)) {
+            const Event& info = *table->GetEventById(ftrace_event_id);
+            if (event_size < info.size)
+              return FtraceParseStatus::FTRACE_STATUS_SHORT_COMPACT_EVENT;
+
+            ParseEventCompact(
+                info, start, timestamp, table,
+                &bundler->compact_sched_buf()->compact_events(), metadata);
+
           } else if (ftrace_print_filter_enabled &&
                      ftrace_event_id == ds_config->print_filter->event_id()) {
             if (ds_config->print_filter->IsEventInteresting(start, next)) {
@@ -752,7 +1049,19 @@ bool CpuReader::ParseEvent(uint16_t ftrace_event_id,
                  info.proto_field_id ==
                  protos::pbzero::FtraceEvent::kSysExitFieldNumber)) {
     success &= ParseSysExit(info, start, end, ds_config, nested, metadata);
-  } else {  // Parse all other events.
+  } else if (const EventProgram* program =
+                 table->GetEventProgram(ftrace_event_id)) {
+    // Parse all other events with their precompiled fields.
+    if (program->varints_only) {
+      success &= RunEventProgram</*kVarIntsOnly=*/true>(*program, start, end,
+                                                        table, nested,
+                                                        metadata);
+    } else {
+      success &= RunEventProgram</*kVarIntsOnly=*/false>(*program, start, end,
+                                                         table, nested,
+                                                         metadata);
+    }
+  } else {
     for (const Field& field : info.fields) {
       success &= ParseField(field, start, end, table, nested, metadata);
     }
@@ -844,7 +1153,8 @@ bool CpuReader::ParseField(const Field& field,
       return true;
     }
     case kDataLocToString:
-      return ReadDataLoc(start, field_start, end, field, message);
+      PERFETTO_DCHECK(field.ftrace_size == 4);
+      return ReadDataLoc(start, field_start, end, field_id, message);
     case kBoolToUint32:
     case kBoolToUint64:
       ReadIntoVarInt<uint8_t>(field_start, field_id, message);
@@ -1032,4 +1342,109 @@ void CpuReader::ParseSchedWakingCompact(const uint8_t* start,
   compact_buf->sched_waking().common_flags().Append(common_flags);
 }
 
+// Parse an event accepted by IsEventCompactEncodable(), and buffer the
+// individual fields in the given compact encoding batch. The values and the
+// metadata are the same as the ones ParseEvent() would produce.
+void CpuReader::ParseEventCompact(const Event& info,
+                                  const uint8_t* start,
+                                  uint64_t timestamp,
+                                  const ProtoTranslationTable* table,
+                                  CompactEventsBuffer* compact_buf,
+                                  FtraceMetadata* metadata) {
+  CompactEventsBuffer::Batch* batch = compact_buf->GetOrCreateBatch(info);
+  batch->AppendTimestamp(timestamp);
+
+  const Field* common_pid_field = table->common_pid();
+  if (PERFETTO_LIKELY(common_pid_field)) {
+    int32_t pid = ReadValue<int32_t>(start + common_pid_field->ftrace_offset);
+    batch->AppendPid(pid);
+    metadata->AddCommonPid(pid);
+  }
+
+  for (size_t i = 0; i < info.fields.size(); i++) {
+    const Field& field = info.fields[i];
+    const uint8_t* field_start = start + field.ftrace_offset;
+    uint64_t value = 0;
+    switch (field.strategy) {
+      case kUint8ToUint32:
+      case kUint8ToUint64:
+      case kBoolToUint32:
+      case kBoolToUint64:
+        value = ReadVarIntValue<uint8_t>(field_start);
+        break;
+      case kUint16ToUint32:
+      case kUint16ToUint64:
+        value = ReadVarIntValue<uint16_t>(field_start);
+        break;
+      case kUint32ToUint32:
+      case kUint32ToUint64:
+        value = ReadVarIntValue<uint32_t>(field_start);
+        break;
+      case kUint64ToUint64:
+        value = ReadVarIntValue<uint64_t>(field_start);
+        break;
+      case kInt8ToInt32:
+      case kInt8ToInt64:
+        value = ReadVarIntValue<int8_t>(field_start);
+        break;
+      case kInt16ToInt32:
+      case kInt16ToInt64:
+        value = ReadVarIntValue<int16_t>(field_start);
+        break;
+      case kInt32ToInt32:
+      case kInt32ToInt64:
+        value = ReadVarIntValue<int32_t>(field_start);
+        break;
+      case kInt64ToInt64:
+        value = ReadVarIntValue<int64_t>(field_start);
+        break;
+      case kInode32ToUint64:
+        value = ReadVarIntValue<uint32_t>(field_start);
+        metadata->AddInode(static_cast<Inode>(value));
+        break;
+      case kInode64ToUint64:
+        value = ReadVarIntValue<uint64_t>(field_start);
+        metadata->AddInode(static_cast<Inode>(value));
+        break;
+      case kPid32ToInt32:
+      case kPid32ToInt64:
+        value = ReadVarIntValue<int32_t>(field_start);
+        metadata->AddPid(static_cast<int32_t>(value));
+        break;
+      case kCommonPid32ToInt32:
+      case kCommonPid32ToInt64:
+        value = ReadVarIntValue<int32_t>(field_start);
+        metadata->AddCommonPid(static_cast<int32_t>(value));
+        break;
+      case kDevId32ToUint64: {
+        BlockDeviceID dev_id = TranslateBlockDeviceIDToUserspace<uint32_t>(
+            ReadValue<uint32_t>(field_start));
+        value = dev_id;
+        metadata->AddDevice(dev_id);
+        break;
+      }
+      case kDevId64ToUint64: {
+        BlockDeviceID dev_id = TranslateBlockDeviceIDToUserspace<uint64_t>(
+            ReadValue<uint64_t>(field_start));
+        value = dev_id;
+        metadata->AddDevice(dev_id);
+        break;
+      }
+      case kFtraceSymAddr64ToUint64:
+        value = metadata->AddSymbolAddr(ReadValue<uint64_t>(field_start));
+        break;
+      case kFixedCStringToString:
+      case kCStringToString:
+      case kStringPtrToString:
+      case kDataLocToString:
+      case kInvalidTranslationStrategy:
+        // Excluded by IsEventCompactEncodable().
+        PERFETTO_DFATAL("Unexpected field in compact event");
+        break;
+    }
+    batch->AppendField(i, value);
+  }
+  metadata->FinishEvent();
+}
+
 }  // namespace perfetto
@@ -189,9 +189,12 @@ class CpuReader {
 
   // Reads and parses all ftrace data for this cpu (in batches), until we catch
   // up to the writer, or hit |max_pages|. Returns number of pages read.
+  // The data is written into the outputs of |reader_id| of the data sources
+  // (see FtraceDataSource::GetReaderOutput()).
   size_t ReadCycle(ParsingBuffers* parsing_bufs,
                    size_t max_pages,
-                   const std::set<FtraceDataSource*>& started_data_sources);
+                   const std::set<FtraceDataSource*>& started_data_sources,
+                   size_t reader_id);
 
   template <typename T>
   static bool ReadAndAdvance(const uint8_t** ptr, const uint8_t* end, T* out) {
@@ -361,6 +364,16 @@ class CpuReader {
                                       CompactSchedBuffer* compact_buf,
                                       FtraceMetadata* metadata);
 
+  // Parse an event whose fields are all fixed-width integers (see
+  // IsEventCompactEncodable()), and buffer the individual fields in the given
+  // compact encoding batch.
+  static void ParseEventCompact(const Event& info,
+                                const uint8_t* start,
+                                uint64_t timestamp,
+                                const ProtoTranslationTable* table,
+                                CompactEventsBuffer* compact_buf,
+                                FtraceMetadata* metadata);
+
   // Parses & encodes the given range of contiguous tracing pages. Called by
   // |ReadAndProcessBatch| for each active data source.
   //
@@ -383,9 +396,53 @@ class CpuReader {
       const FtraceClockSnapshot* ftrace_clock_snapshot,
       protos::pbzero::FtraceClock ftrace_clock);
 
+  // Writes the given range of contiguous tracing pages into the trace without
+  // parsing them, for data sources with FtraceConfig.raw_page_passthrough.
+  // Each page is trimmed to its committed size. The first call for a given
+  // data source (i.e. while |*format_written| is false, which is reset when
+  // the incremental state of the data source is cleared) also writes the
+  // layout of the events enabled by |ds_config|, needed to decode the pages.
+  //
+  // Returns true if all page headers were valid. Pages with an invalid header
+  // are skipped and recorded as errors in the FtraceEventBundle proto.
+  //
+  // public and static for testing
+  static bool WriteRawPagesForDataSource(
+      TraceWriter* trace_writer,
+      FtraceMetadata* metadata,
+      size_t cpu,
+      const FtraceDataSourceConfig* ds_config,
+      base::FlatSet<protos::pbzero::FtraceParseStatus>* parse_errors,
+      bool* format_written,
+      uint64_t last_read_event_ts,
+      const uint8_t* parsing_buf,
+      size_t pages_read,
+      const ProtoTranslationTable* table,
+      const FtraceClockSnapshot* ftrace_clock_snapshot,
+      protos::pbzero::FtraceClock ftrace_clock);
+
+  // Writes the layout of the ring buffer pages and of the events enabled by
+  // |ds_config| into |bundle|. Fields that can't be decoded without the
+  // kernel's help (e.g. pointers to strings or kernel symbols) are omitted.
+  static void WriteRawPageFormat(const ProtoTranslationTable* table,
+                                 const FtraceDataSourceConfig* ds_config,
+                                 protos::pbzero::FtraceEventBundle* bundle);
+
   // For FtraceController, which manages poll callbacks on per-cpu buffer fds.
   int RawBufferFd() const { return trace_fd_.get(); }
 
+  // What was read from the buffer since the last call, for FtraceController
+  // to adapt the read period to the rate at which the buffer fills up.
+  struct ReadStats {
+    uint64_t bytes = 0;  // Payload of the pages, without the padding.
+    bool lost_events = false;
+  };
+  ReadStats TakeReadStats() {
+    ReadStats stats = read_stats_;
+    read_stats_ = ReadStats();
+    return stats;
+  }
+
  private:
   // Reads at most |max_pages| of ftrace data, parses it, and writes it
   // into |started_data_sources|. Returns number of pages read.
@@ -396,13 +453,15 @@ class CpuReader {
       size_t max_pages,
       bool first_batch_in_cycle,
       CompactSchedBuffer* compact_sched_buf,
-      const std::set<FtraceDataSource*>& started_data_sources);
+      const std::set<FtraceDataSource*>& started_data_sources,
+      size_t reader_id);
 
   size_t cpu_;
   const ProtoTranslationTable* table_;
   LazyKernelSymbolizer* symbolizer_;
   base::ScopedFile trace_fd_;
   uint64_t last_read_event_ts_ = 0;
+  ReadStats read_stats_;
   protos::pbzero::FtraceClock ftrace_clock_{};
   const FtraceClockSnapshot* ftrace_clock_snapshot_;
 };
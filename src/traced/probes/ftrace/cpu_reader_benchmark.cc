@@ -28,6 +28,7 @@
 #include "src/traced/probes/ftrace/test/cpu_reader_support.h"
 #include "src/tracing/core/null_trace_writer.h"
 
+#include "protos/perfetto/trace/ftrace/ftrace_event.pbzero.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.pbzero.h"
 #include "protos/perfetto/trace/ftrace/ftrace_stats.pbzero.h"
 
@@ -928,6 +929,126 @@ void BM_ParsePageFullOfAtracePrintWithFilterRules(benchmark::State& state) {
 }
 BENCHMARK(BM_ParsePageFullOfAtracePrintWithFilterRules)->DenseRange(0, 16, 1);
 
+// A mix of the events of a busy system, with their share of the records.
+struct MixEvent {
+  const char* group;
+  const char* name;
+  uint32_t weight;
+};
+constexpr MixEvent kEventsMix[] = {
+    {"sched", "sched_switch", 30},
+    {"sched", "sched_waking", 25},
+    {"power", "cpu_idle", 15},
+    {"power", "cpu_frequency", 4},
+    {"irq", "irq_handler_entry", 5},
+    {"irq", "irq_handler_exit", 5},
+    {"binder", "binder_transaction", 5},
+    {"ext4", "ext4_da_write_begin", 5},
+    {"ftrace", "print", 6},
+};
+
+struct MixRecord {
+  uint16_t ftrace_event_id;
+  std::vector<uint8_t> data;
+};
+
+// Builds 100 records of the events of |kEventsMix|, interleaved, with
+// arbitrary field values (but valid strings).
+std::vector<MixRecord> BuildEventsMix(const ProtoTranslationTable* table) {
+  std::vector<MixRecord> records;
+  for (const MixEvent& mix_event : kEventsMix) {
+    const Event* event =
+        table->GetEvent(GroupAndName(mix_event.group, mix_event.name));
+    PERFETTO_CHECK(event);
+    MixRecord record{static_cast<uint16_t>(event->ftrace_event_id), {}};
+    record.data.resize(event->size + 32u);
+    for (size_t i = 0; i < record.data.size(); i++)
+      record.data[i] = static_cast<uint8_t>('a' + i % 26);
+    memcpy(&record.data[0], &record.ftrace_event_id, sizeof(uint16_t));
+    for (const Field& field : event->fields) {
+      if (field.strategy == kDataLocToString) {
+        // A 16 bytes string at the end of the record.
+        uint32_t data_loc = (16u << 16) | event->size;
+        memcpy(&record.data[field.ftrace_offset], &data_loc, sizeof(data_loc));
+      } else if (field.strategy == kFixedCStringToString) {
+        record.data[field.ftrace_offset + field.ftrace_size - 1u] = 0;
+      }
+    }
+    record.data.back() = 0;
+    for (uint32_t i = 0; i < mix_event.weight; i++)
+      records.push_back(record);
+  }
+  // Interleave the events like a real trace would.
+  std::vector<MixRecord> mix;
+  for (size_t i = 0; i < records.size(); i++)
+    mix.push_back(records[(i * 37) % records.size()]);
+  return mix;
+}
+
+// Benchmark for CpuReader::ParseEvent on a realistic mix of events.
+// |field_by_field| parses them as before the fields of the events were
+// compiled into EventProgram(s), through CpuReader::ParseField.
+void DoParseEventsMix(bool field_by_field, benchmark::State& state) {
+  ProtoTranslationTable* table =
+      GetTable("android_walleye_OPM5.171019.017.A1_4.4.88");
+  std::vector<MixRecord> mix = BuildEventsMix(table);
+  FtraceDataSourceConfig ds_config{EventFilter{},
+                                   EventFilter{},
+                                   DisabledCompactSchedConfigForTesting(),
+                                   std::nullopt,
+                                   {},
+                                   {},
+                                   false /*symbolize_ksyms*/,
+                                   false /*preserve_ftrace_buffer*/,
+                                   {}};
+
+  ScatteredStreamWriterNullDelegate delegate(base::GetSysPageSize());
+  ScatteredStreamWriter stream(&delegate);
+  protozero::RootMessage<FtraceEventBundle> bundle;
+  FtraceMetadata metadata{};
+  size_t bytes = 0;
+  for (const MixRecord& record : mix)
+    bytes += record.data.size();
+
+  for (auto _ : state) {
+    bundle.Reset(&stream);
+    for (const MixRecord& record : mix) {
+      const uint8_t* start = record.data.data();
+      const uint8_t* end = start + record.data.size();
+      auto* event = bundle.add_event();
+      if (field_by_field) {
+        const Event& info = *table->GetEventById(record.ftrace_event_id);
+        CpuReader::ParseField(*table->common_pid(), start, end, table, event,
+                              &metadata);
+        auto* nested =
+            event->BeginNestedMessage<protozero::Message>(info.proto_field_id);
+        for (const Field& field : info.fields)
+          CpuReader::ParseField(field, start, end, table, nested, &metadata);
+        event->Finalize();
+        metadata.FinishEvent();
+      } else {
+        CpuReader::ParseEvent(record.ftrace_event_id, start, end, table,
+                              &ds_config, event, &metadata);
+      }
+    }
+    bundle.Finalize();
+    metadata.Clear();
+  }
+  auto iterations = static_cast<size_t>(state.iterations());
+  state.SetItemsProcessed(static_cast<int64_t>(iterations * mix.size()));
+  state.SetBytesProcessed(static_cast<int64_t>(iterations * bytes));
+}
+
+void BM_ParseEventsMix(benchmark::State& state) {
+  DoParseEventsMix(/*field_by_field=*/false, state);
+}
+BENCHMARK(BM_ParseEventsMix);
+
+void BM_ParseEventsMixFieldByField(benchmark::State& state) {
+  DoParseEventsMix(/*field_by_field=*/true, state);
+}
+BENCHMARK(BM_ParseEventsMixFieldByField);
+
 // Higher level benchmark for the CpuReader::ProcessPagesForDataSource function.
 void DoProcessPages(const ExamplePage& test_case,
                     const size_t page_repetition,
@@ -20,6 +20,9 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 
+#include <map>
+#include <vector>
+
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -401,11 +404,13 @@ class CpuReaderParsePagePayloadTest : public testing::Test {
     PERFETTO_CHECK(!bundler_.has_value());
     writer_.emplace();
     compact_sched_buf_ = std::make_unique<CompactSchedBuffer>();
+    bool compact_enabled =
+        ds_config.compact_sched.enabled || ds_config.compact_events;
     bundler_.emplace(&writer_.value(), &metadata_, /*symbolizer=*/nullptr,
                      /*cpu=*/0,
                      /*ftrace_clock_snapshot=*/nullptr,
                      protos::pbzero::FTRACE_CLOCK_UNSPECIFIED,
-                     compact_sched_buf_.get(), ds_config.compact_sched.enabled,
+                     compact_sched_buf_.get(), compact_enabled,
                      /*last_read_event_ts=*/0);
     return &bundler_.value();
   }
@@ -1554,6 +1559,62 @@ TEST(CpuReaderTest, TaskRenameEvent) {
   EXPECT_THAT(metadata.pids, Contains(9999));
 }
 
+// The compiled programs of the events must serialize them exactly like
+// ParseField() does for each of their fields.
+TEST(CpuReaderTest, EventProgramsMatchParseField) {
+  using protos::pbzero::FtraceEvent;
+  ProtoTranslationTable* table =
+      GetTable("android_walleye_OPM5.171019.017.A1_4.4.88");
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  size_t events_checked = 0;
+  for (const Event& event : table->events()) {
+    const EventProgram* program = table->GetEventProgram(event.ftrace_event_id);
+    if (!program || event.proto_field_id == FtraceEvent::kSysEnterFieldNumber ||
+        event.proto_field_id == FtraceEvent::kSysExitFieldNumber) {
+      continue;
+    }
+    // Arbitrary field values, but empty __data_loc strings.
+    std::vector<uint8_t> record(event.size + 16u);
+    for (size_t i = 0; i < record.size(); i++)
+      record[i] = static_cast<uint8_t>(i * 37 + 1);
+    for (const Field& field : event.fields) {
+      if (field.strategy == kDataLocToString)
+        memset(&record[field.ftrace_offset], 0, 4);
+    }
+    record.back() = 0;
+    const uint8_t* start = record.data();
+    const uint8_t* end = start + record.size();
+
+    protozero::HeapBuffered<protozero::Message> actual;
+    FtraceMetadata actual_metadata{};
+    ASSERT_TRUE(CpuReader::ParseEvent(
+        static_cast<uint16_t>(event.ftrace_event_id), start, end, table,
+        &ds_config, actual.get(), &actual_metadata))
+        << event.name;
+
+    protozero::HeapBuffered<protozero::Message> expected;
+    FtraceMetadata expected_metadata{};
+    CpuReader::ParseField(*table->common_pid(), start, end, table,
+                          expected.get(), &expected_metadata);
+    auto* nested =
+        expected->BeginNestedMessage<protozero::Message>(event.proto_field_id);
+    for (const Field& field : event.fields) {
+      ASSERT_TRUE(CpuReader::ParseField(field, start, end, table, nested,
+                                        &expected_metadata));
+    }
+
+    EXPECT_EQ(actual.SerializeAsString(), expected.SerializeAsString())
+        << event.name;
+    EXPECT_EQ(actual_metadata.pids.size(), expected_metadata.pids.size());
+    EXPECT_EQ(actual_metadata.inode_and_device.size(),
+              expected_metadata.inode_and_device.size());
+    EXPECT_EQ(actual_metadata.kernel_addrs.size(),
+              expected_metadata.kernel_addrs.size());
+    events_checked++;
+  }
+  EXPECT_GT(events_checked, 100u);
+}
+
 // Regression test for b/205763418: Kernels without f0a515780393("tracing: Don't
 // make assumptions about length of string on task rename") can output non
 // zero-terminated strings in some cases. Even though it's a kernel bug, there's
@@ -1737,6 +1798,88 @@ TEST(CpuReaderTest, ProcessPagesForDataSourceError) {
                    Property(&Error::status, FTRACE_STATUS_ABI_END_OVERFLOW))));
 }
 
+TEST(CpuReaderTest, WriteRawPagesForDataSource) {
+  auto page_ok = PageFromXxd(g_switch_page);
+  const size_t page_size = base::GetSysPageSize();
+
+  // The last page is zero-filled, hence has an invalid header.
+  static constexpr size_t kTestPages = 3;
+  std::unique_ptr<uint8_t[]> buf(new uint8_t[page_size * kTestPages]());
+  memcpy(buf.get(), page_ok.get(), page_size);
+  memcpy(buf.get() + page_size, page_ok.get(), page_size);
+  memset(buf.get() + 2 * page_size, 0, page_size);
+
+  ProtoTranslationTable* table = GetTable("synthetic");
+  FtraceMetadata metadata{};
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.raw_page_passthrough = true;
+  size_t switch_id =
+      table->EventToFtraceId(GroupAndName("sched", "sched_switch"));
+  ds_config.event_filter.AddEnabledEvent(switch_id);
+
+  const uint8_t* parse_pos = page_ok.get();
+  std::optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  ASSERT_TRUE(page_header.has_value());
+  const size_t committed_size =
+      static_cast<size_t>(parse_pos - page_ok.get()) + page_header->size;
+
+  TraceWriterForTesting trace_writer;
+  base::FlatSet<protos::pbzero::FtraceParseStatus> parse_errors;
+  bool format_written = false;
+  for (int i = 0; i < 2; i++) {
+    bool success = CpuReader::WriteRawPagesForDataSource(
+        &trace_writer, &metadata, /*cpu=*/1, &ds_config, &parse_errors,
+        &format_written, /*last_read_event_ts=*/0, buf.get(), kTestPages,
+        table, /*ftrace_clock_snapshot=*/nullptr,
+        protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+    EXPECT_FALSE(success);
+    EXPECT_TRUE(format_written);
+  }
+  EXPECT_EQ(parse_errors.count(
+                FtraceParseStatus::FTRACE_STATUS_ABI_INVALID_PAGE_HEADER),
+            1u);
+
+  std::vector<protos::gen::TracePacket> packets =
+      trace_writer.GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 2u);
+
+  // The pages are written as-is, without the zero padding at their end.
+  std::string expected_page(reinterpret_cast<const char*>(page_ok.get()),
+                            committed_size);
+  for (const auto& packet : packets) {
+    const protos::gen::FtraceEventBundle& bundle = packet.ftrace_events();
+    EXPECT_EQ(bundle.cpu(), 1u);
+    EXPECT_EQ(bundle.event().size(), 0u);
+    EXPECT_EQ(bundle.error().size(), 1u);
+    ASSERT_EQ(bundle.raw_pages().size(), 2u);
+    EXPECT_EQ(bundle.raw_pages()[0], expected_page);
+    EXPECT_EQ(bundle.raw_pages()[1], expected_page);
+  }
+
+  // Only the first packet describes the layout, and only for the enabled
+  // events.
+  ASSERT_FALSE(packets[1].ftrace_events().has_raw_page_format());
+  ASSERT_TRUE(packets[0].ftrace_events().has_raw_page_format());
+  const auto& format = packets[0].ftrace_events().raw_page_format();
+  EXPECT_EQ(format.commit_size(), table->page_header_size_len());
+  EXPECT_EQ(format.common_pid().name(), "common_pid");
+  ASSERT_EQ(format.event().size(), 1u);
+  const auto& event = format.event()[0];
+  EXPECT_EQ(event.id(), switch_id);
+  EXPECT_EQ(event.name(), "sched_switch");
+  EXPECT_EQ(event.proto_field_id(),
+            static_cast<uint32_t>(
+                protos::pbzero::FtraceEvent::kSchedSwitchFieldNumber));
+  using RawField = protos::gen::FtraceEventBundle::RawPageFormat::Field;
+  std::map<std::string, RawField::Type> field_types;
+  for (const auto& field : event.field())
+    field_types[field.name()] = field.type();
+  EXPECT_EQ(field_types["prev_comm"], RawField::TYPE_FIXED_STRING);
+  EXPECT_EQ(field_types["prev_pid"], RawField::TYPE_INT);
+  EXPECT_EQ(field_types["next_pid"], RawField::TYPE_INT);
+}
+
 // Page containing an absolute timestamp (RINGBUF_TYPE_TIME_STAMP).
 static char g_abs_timestamp[] =
     R"(
@@ -3452,6 +3595,58 @@ TEST_F(CpuReaderParsePagePayloadTest, F2fsTruncatePartialNodesNew) {
   EXPECT_EQ(event.f2fs_truncate_partial_nodes().err(), 0);
 }
 
+TEST_F(CpuReaderParsePagePayloadTest, F2fsTruncatePartialNodesCompact) {
+  const ExamplePage* test_case = &g_f2fs_truncate_partial_nodes_new;
+
+  ProtoTranslationTable* table = GetTable(test_case->name);
+  auto page = PageFromXxd(test_case->data);
+
+  FtraceDataSourceConfig ds_config = EmptyConfig();
+  ds_config.compact_events = true;
+  size_t ftrace_id = table->EventToFtraceId(
+      GroupAndName("f2fs", "f2fs_truncate_partial_nodes"));
+  ds_config.event_filter.AddEnabledEvent(ftrace_id);
+  EXPECT_TRUE(table->IsCompactEncodable(ftrace_id));
+
+  const uint8_t* parse_pos = page.get();
+  std::optional<CpuReader::PageHeader> page_header =
+      CpuReader::ParsePageHeader(&parse_pos, table->page_header_size_len());
+  ASSERT_TRUE(page_header.has_value());
+
+  FtraceParseStatus status = CpuReader::ParsePagePayload(
+      parse_pos, &page_header.value(), table, &ds_config,
+      CreateBundler(ds_config), &metadata_, &last_read_event_ts_);
+
+  EXPECT_EQ(status, FtraceParseStatus::FTRACE_STATUS_OK);
+  EXPECT_EQ(bundler_->compact_sched_buf()->compact_events().size(), 1u);
+  EXPECT_THAT(metadata_.pids, ElementsAre(0x38c6));
+
+  auto bundle = GetBundle();
+  EXPECT_THAT(bundle.event(), IsEmpty());
+  ASSERT_THAT(bundle.compact_events(), SizeIs(1));
+  const auto& compact = bundle.compact_events()[0];
+  EXPECT_EQ(compact.proto_field_id(),
+            static_cast<uint32_t>(protos::pbzero::FtraceEvent::
+                                      kF2fsTruncatePartialNodesFieldNumber));
+  ASSERT_THAT(compact.timestamp(), SizeIs(1));
+  EXPECT_EQ(compact.timestamp()[0], last_read_event_ts_);
+  EXPECT_THAT(compact.pid(), ElementsAre(0x38c6u));
+
+  // Same fields as the FtraceEvent, see F2fsTruncatePartialNodesNew.
+  using F2fsEvent = protos::gen::F2fsTruncatePartialNodesFtraceEvent;
+  std::map<uint32_t, std::vector<uint64_t>> fields;
+  for (const auto& field : compact.field())
+    fields[field.proto_field_id()] = field.value();
+  EXPECT_THAT(fields, ElementsAre(Pair(F2fsEvent::kDevFieldNumber,
+                                       ElementsAre(65081u)),
+                                  Pair(F2fsEvent::kInoFieldNumber,
+                                       ElementsAre(26033u)),
+                                  Pair(F2fsEvent::kDepthFieldNumber,
+                                       ElementsAre(4u)),
+                                  Pair(F2fsEvent::kErrFieldNumber,
+                                       ElementsAre(0u))));
+}
+
 // Kernel code:
 // trace_f2fs_truncate_partial_nodes(... nid = {1,2,3}, depth = 4, err = 0)
 //
@@ -16,6 +16,7 @@
 
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
 
+#include <dirent.h>
 #include <string.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -26,6 +27,8 @@
 #include <limits>
 
 #include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/traced/probes/ftrace/atrace_wrapper.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
@@ -61,6 +64,9 @@ constexpr const char* kClocks[] = {"boot", "global", "local"};
 // Enabled by the "use_monotonic_raw_clock" option in the ftrace config.
 constexpr const char* kClockMonoRaw = "mono_raw";
 
+// Event filter expressions must fit in a page, keep some margin.
+constexpr size_t kMaxPidFilterSize = 3072;
+
 void AddEventGroup(const ProtoTranslationTable* table,
                    const std::string& group,
                    std::set<GroupAndName>* to) {
@@ -91,6 +97,44 @@ std::pair<std::string, std::string> EventToStringGroupAndName(
                         event.substr(slash_pos + 1));
 }
 
+// Returns the thread ids of the given processes, which is what the kernel pid
+// filters match on. The processes whose threads can't be listed (e.g. that
+// have already exited) are kept as they are.
+std::set<int32_t> GetThreadIds(const std::vector<int32_t>& pids) {
+  std::set<int32_t> tids;
+  for (int32_t pid : pids) {
+    tids.insert(pid);
+    base::StackString<64> task_path("/proc/%d/task", pid);
+    base::ScopedDir task_dir(opendir(task_path.c_str()));
+    if (!task_dir)
+      continue;
+    while (struct dirent* entry = readdir(*task_dir)) {
+      std::optional<int32_t> tid = base::CStringToInt32(entry->d_name);
+      if (tid)
+        tids.insert(*tid);
+    }
+  }
+  return tids;
+}
+
+// Returns the filter expression matching the records of |event| whose
+// common_pid, or any of the pid fields, is one of |tids|. Returns an empty
+// string if the expression would be too long for the kernel.
+std::string BuildPidFilter(const Event& event, const std::set<int32_t>& tids) {
+  std::vector<std::string> fields = {"common_pid"};
+  for (const Field& field : event.fields) {
+    if (field.ftrace_type == kFtracePid32)
+      fields.push_back(field.ftrace_name);
+  }
+  std::vector<std::string> parts;
+  for (const std::string& field : fields) {
+    for (int32_t tid : tids)
+      parts.push_back(field + " == " + std::to_string(tid));
+  }
+  std::string filter = base::Join(parts, " || ");
+  return filter.size() > kMaxPidFilterSize ? std::string() : filter;
+}
+
 void UnionInPlace(const std::vector<std::string>& unsorted_a,
                   std::vector<std::string>* out) {
   std::vector<std::string> a = unsorted_a;
@@ -577,6 +621,75 @@ bool FtraceConfigMuxer::SetSyscallEventFilter(
   return true;
 }
 
+void FtraceConfigMuxer::UpdatePidFilters() {
+  bool all_scoped = !ds_configs_.empty();
+  std::set<int32_t> event_pids;
+  for (const auto& id_config : ds_configs_) {
+    const FtraceDataSourceConfig& config = id_config.second;
+    all_scoped &= !config.target_tids.empty();
+    event_pids.insert(config.target_tids.begin(), config.target_tids.end());
+  }
+  if (!all_scoped)
+    event_pids.clear();
+  if (current_state_.event_pids != event_pids) {
+    if (ftrace_->SetEventPidFilter(event_pids)) {
+      current_state_.event_pids = std::move(event_pids);
+    } else {
+      PERFETTO_ELOG("Failed to set set_event_pid");
+    }
+  }
+
+  // When every config is scoped, set_event_pid already covers all the events.
+  std::map<size_t, std::string> filters;
+  std::set<size_t> event_ids;
+  if (!all_scoped)
+    event_ids = current_state_.ftrace_events.GetEnabledEvents();
+  for (size_t id : event_ids) {
+    const Event* event = table_->GetEventById(id);
+    // The filter of the syscall events is owned by SetSyscallEventFilter().
+    if (!event || std::string("raw_syscalls") == event->group)
+      continue;
+    bool scoped = true;
+    std::set<int32_t> tids;
+    for (const auto& id_config : ds_configs_) {
+      const FtraceDataSourceConfig& config = id_config.second;
+      if (!config.event_filter.IsEventEnabled(id))
+        continue;
+      scoped &= !config.target_tids.empty();
+      tids.insert(config.target_tids.begin(), config.target_tids.end());
+    }
+    if (!scoped || tids.empty())
+      continue;
+    std::string filter = BuildPidFilter(*event, tids);
+    if (!filter.empty())
+      filters[id] = std::move(filter);
+  }
+
+  std::map<size_t, std::string> applied;
+  for (const auto& id_filter : current_state_.event_pid_filters) {
+    if (filters.count(id_filter.first))
+      continue;
+    const Event* event = table_->GetEventById(id_filter.first);
+    if (event && !ftrace_->SetEventFilter(event->group, event->name, ""))
+      applied.insert(id_filter);
+  }
+  for (auto& id_filter : filters) {
+    auto it = current_state_.event_pid_filters.find(id_filter.first);
+    const Event* event = table_->GetEventById(id_filter.first);
+    if ((it != current_state_.event_pid_filters.end() &&
+         it->second == id_filter.second) ||
+        ftrace_->SetEventFilter(event->group, event->name, id_filter.second)) {
+      applied.insert(std::move(id_filter));
+    } else {
+      PERFETTO_DPLOG("Failed to set the pid filter of %s/%s", event->group,
+                     event->name);
+      if (it != current_state_.event_pid_filters.end())
+        applied.insert(*it);
+    }
+  }
+  current_state_.event_pid_filters = std::move(applied);
+}
+
 FtraceConfigMuxer::FtraceConfigMuxer(
     FtraceProcfs* ftrace,
     AtraceWrapper* atrace_wrapper,
@@ -761,13 +874,20 @@ bool FtraceConfigMuxer::SetupConfig(FtraceConfigId id,
 
   std::vector<std::string> apps(request.atrace_apps());
   std::vector<std::string> categories(request.atrace_categories());
-  ds_configs_.emplace(
+  auto it_and_inserted = ds_configs_.emplace(
       std::piecewise_construct, std::forward_as_tuple(id),
       std::forward_as_tuple(
           std::move(filter), std::move(syscall_filter), compact_sched,
           std::move(ftrace_print_filter), std::move(apps),
           std::move(categories), request.symbolize_ksyms(),
           request.drain_buffer_percent(), GetSyscallsReturningFds(syscalls_)));
+  it_and_inserted.first->second.raw_page_passthrough =
+      request.raw_page_passthrough();
+  it_and_inserted.first->second.compact_events =
+      request.compact_sched().fixed_width_events();
+  it_and_inserted.first->second.target_tids =
+      GetThreadIds(request.target_pids());
+  UpdatePidFilters();
   return true;
 }
 
@@ -844,6 +964,8 @@ bool FtraceConfigMuxer::RemoveConfig(FtraceConfigId config_id) {
       current_state_.ftrace_events.DisableEvent(event->ftrace_event_id);
   }
 
+  UpdatePidFilters();
+
   auto active_it = active_configs_.find(config_id);
   if (active_it != active_configs_.end()) {
     active_configs_.erase(active_it);
@@ -87,6 +87,19 @@ struct FtraceDataSourceConfig {
 
   // List of syscalls monitored to return a new filedescriptor upon success
   base::FlatSet<int64_t> syscalls_returning_fd;
+
+  // FtraceConfig.raw_page_passthrough: write the kernel ring buffer pages into
+  // the trace as-is, without parsing them.
+  bool raw_page_passthrough = false;
+
+  // FtraceConfig.CompactSchedConfig.fixed_width_events: encode the events
+  // accepted by IsEventCompactEncodable() in the compact format.
+  bool compact_events = false;
+
+  // Thread ids of the processes in FtraceConfig.target_pids, whose events
+  // the kernel is asked to record. Empty if the config is not scoped to
+  // processes.
+  std::set<int32_t> target_tids;
 };
 
 // Ftrace is a bunch of globally modifiable persistent state.
@@ -187,6 +200,9 @@ class FtraceConfigMuxer {
     std::vector<std::string> atrace_apps;
     std::vector<std::string> atrace_categories;
     bool saved_tracing_on;  // Backup for the original tracing_on.
+    std::set<int32_t> event_pids;  // set_event_pid
+    // Pid filter expressions of the events, by ftrace event id.
+    std::map<size_t, std::string> event_pid_filters;
   };
 
   FtraceConfigMuxer(const FtraceConfigMuxer&) = delete;
@@ -226,6 +242,13 @@ class FtraceConfigMuxer {
   // so the filter can be updated before ds_configs_.
   bool SetSyscallEventFilter(const EventFilter& extra_syscalls);
 
+  // Updates set_event_pid and the per-event filters so that the kernel drops
+  // the events of processes that no ds_configs_ wants. If every config is
+  // scoped to processes, set_event_pid is set to the union of their threads.
+  // Otherwise, each event enabled only by scoped configs gets a filter on its
+  // pids, while the other events are not filtered.
+  void UpdatePidFilters();
+
   FtraceProcfs* ftrace_;
   AtraceWrapper* atrace_wrapper_;
   ProtoTranslationTable* table_;
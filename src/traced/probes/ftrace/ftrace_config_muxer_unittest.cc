@@ -30,8 +30,10 @@
 using testing::_;
 using testing::AnyNumber;
 using testing::Contains;
+using testing::ElementsAre;
 using testing::ElementsAreArray;
 using testing::Eq;
+using testing::HasSubstr;
 using testing::Invoke;
 using testing::IsEmpty;
 using testing::MatchesRegex;
@@ -200,6 +202,10 @@ class FtraceConfigMuxerTest : public ::testing::Test {
       event.name = "sched_switch";
       event.group = "sched";
       event.ftrace_event_id = kFakeSchedSwitchEventId;
+      Field next_pid = {};
+      next_pid.ftrace_type = kFtracePid32;
+      next_pid.ftrace_name = "next_pid";
+      event.fields.push_back(next_pid);
       events.push_back(event);
     }
 
@@ -453,6 +459,112 @@ TEST_F(FtraceConfigMuxerFakeTableTest, SyscallFilterMuxing) {
   ASSERT_THAT(model_.GetSyscallFilterForTesting(), UnorderedElementsAre());
 }
 
+TEST_F(FtraceConfigMuxerFakeTableTest, PidFilterMuxing) {
+  // Pids above pid_max: they have no /proc/<pid>/task to expand.
+  constexpr int32_t kPidA = 5000001;
+  constexpr int32_t kPidB = 5000002;
+  FtraceConfig config_a =
+      CreateFtraceConfig({"sched/sched_switch", "cgroup/cgroup_mkdir"});
+  config_a.add_target_pids(kPidA);
+  FtraceConfig config_b = CreateFtraceConfig({"sched/sched_switch"});
+  config_b.add_target_pids(kPidB);
+  FtraceConfig unscoped_config = CreateFtraceConfig({"sched/sched_switch"});
+
+  ON_CALL(ftrace_, ReadFileIntoString("/root/current_tracer"))
+      .WillByDefault(Return("nop"));
+  // The writes not checked below, e.g. to enable the events.
+  auto allow_other_writes = [this] {
+    EXPECT_CALL(ftrace_, WriteToFile(_, _)).Times(AnyNumber());
+    EXPECT_CALL(ftrace_, ClearFile(_)).Times(AnyNumber());
+    EXPECT_CALL(ftrace_, AppendToFile(_, _)).Times(AnyNumber());
+  };
+
+  // A single scoped config: everything goes through set_event_pid.
+  allow_other_writes();
+  EXPECT_CALL(ftrace_, ClearFile("/root/set_event_pid"));
+  EXPECT_CALL(ftrace_, AppendToFile("/root/set_event_pid", "5000001"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, WriteToFile("/root/options/event-fork", "1"));
+  EXPECT_CALL(ftrace_, WriteToFile(HasSubstr("/filter"), _)).Times(0);
+  FtraceConfigId id_a = 1;
+  ASSERT_TRUE(model_.SetupConfig(id_a, config_a));
+  const FtraceDataSourceConfig* ds_config = model_.GetDataSourceConfig(id_a);
+  ASSERT_TRUE(ds_config);
+  EXPECT_THAT(ds_config->target_tids, ElementsAre(kPidA));
+  ASSERT_TRUE(testing::Mock::VerifyAndClearExpectations(&ftrace_));
+  allow_other_writes();
+
+  // Two scoped configs: the union of their pids.
+  EXPECT_CALL(ftrace_, ClearFile("/root/set_event_pid"));
+  EXPECT_CALL(ftrace_, AppendToFile("/root/set_event_pid", "5000001 5000002"))
+      .WillOnce(Return(true));
+  FtraceConfigId id_b = 2;
+  ASSERT_TRUE(model_.SetupConfig(id_b, config_b));
+  ASSERT_TRUE(testing::Mock::VerifyAndClearExpectations(&ftrace_));
+  allow_other_writes();
+
+  // An unscoped config: set_event_pid is cleared, and only the events that no
+  // unscoped config wants are filtered, on all their pid fields.
+  EXPECT_CALL(ftrace_, ClearFile("/root/set_event_pid"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, WriteToFile("/root/options/event-fork", "0"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, WriteToFile("/root/events/sched/sched_switch/filter", _))
+      .Times(0);
+  EXPECT_CALL(ftrace_, WriteToFile("/root/events/cgroup/cgroup_mkdir/filter",
+                                   "common_pid == 5000001"))
+      .WillOnce(Return(true));
+  FtraceConfigId unscoped_id = 3;
+  ASSERT_TRUE(model_.SetupConfig(unscoped_id, unscoped_config));
+  ASSERT_TRUE(testing::Mock::VerifyAndClearExpectations(&ftrace_));
+  allow_other_writes();
+
+  // Without config_a, cgroup_mkdir is disabled and its filter cleared.
+  EXPECT_CALL(ftrace_, WriteToFile("/root/events/cgroup/cgroup_mkdir/filter",
+                                   "0"))
+      .WillOnce(Return(true));
+  ASSERT_TRUE(model_.RemoveConfig(id_a));
+  ASSERT_TRUE(testing::Mock::VerifyAndClearExpectations(&ftrace_));
+  allow_other_writes();
+
+  // Without the unscoped config, sched_switch is only wanted by config_b.
+  EXPECT_CALL(ftrace_, ClearFile("/root/set_event_pid"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, AppendToFile("/root/set_event_pid", "5000002"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, WriteToFile(HasSubstr("/filter"), _)).Times(0);
+  ASSERT_TRUE(model_.RemoveConfig(unscoped_id));
+  ASSERT_TRUE(testing::Mock::VerifyAndClearExpectations(&ftrace_));
+  allow_other_writes();
+
+  // Once all configs are gone, so is the filter.
+  EXPECT_CALL(ftrace_, ClearFile("/root/set_event_pid"))
+      .WillOnce(Return(true));
+  EXPECT_CALL(ftrace_, WriteToFile("/root/options/event-fork", "0"))
+      .WillOnce(Return(true));
+  ASSERT_TRUE(model_.RemoveConfig(id_b));
+}
+
+TEST_F(FtraceConfigMuxerFakeTableTest, PidFilterOnPidFields) {
+  FtraceConfig scoped_config = CreateFtraceConfig({"sched/sched_switch"});
+  scoped_config.add_target_pids(5000001);
+  FtraceConfig unscoped_config = CreateFtraceConfig({"sched/sched_wakeup"});
+
+  ON_CALL(ftrace_, ReadFileIntoString("/root/current_tracer"))
+      .WillByDefault(Return("nop"));
+  EXPECT_CALL(ftrace_, WriteToFile(_, _)).Times(AnyNumber());
+  EXPECT_CALL(ftrace_, WriteToFile("/root/events/sched/sched_wakeup/filter",
+                                   _))
+      .Times(0);
+  EXPECT_CALL(
+      ftrace_,
+      WriteToFile("/root/events/sched/sched_switch/filter",
+                  "common_pid == 5000001 || next_pid == 5000001"))
+      .WillOnce(Return(true));
+  ASSERT_TRUE(model_.SetupConfig(/*id=*/1, unscoped_config));
+  ASSERT_TRUE(model_.SetupConfig(/*id=*/2, scoped_config));
+}
+
 TEST_F(FtraceConfigMuxerFakeTableTest, TurnFtraceOnOff) {
   FtraceConfig config = CreateFtraceConfig({"sched_switch", "foo"});
 
@@ -26,12 +26,15 @@
 #include <unistd.h>
 #include <cstdint>
 
+#include <algorithm>
 #include <limits>
 #include <memory>
+#include <numeric>
 #include <optional>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
@@ -40,6 +43,8 @@
 #include "perfetto/ext/base/metatrace.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/threading/thread_pool.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/kallsyms/kernel_symbol_map.h"
 #include "src/kallsyms/lazy_kernel_symbolizer.h"
@@ -64,6 +69,10 @@ constexpr uint32_t kDefaultTickPeriodMs = 100;
 constexpr uint32_t kPollBackingTickPeriodMs = 1000;
 constexpr uint32_t kMinTickPeriodMs = 1;
 constexpr uint32_t kMaxTickPeriodMs = 1000 * 60;
+// Lower bound of the adaptive read period (FtraceConfig.max_drain_period_ms).
+// Bursts that fill the buffers faster are handled by reposting the read task
+// until the buffers are drained.
+constexpr uint32_t kMinAdaptiveTickPeriodMs = 10;
 constexpr int kPollRequiredMajorVersion = 6;
 constexpr int kPollRequiredMinorVersion = 1;
 
@@ -72,6 +81,9 @@ constexpr int kPollRequiredMinorVersion = 1;
 // tasks get some cpu time before continuing reading.
 constexpr size_t kMaxPagesPerCpuPerReadTick = 256;  // 1 MB per cpu
 
+// Upper bound for FtraceConfig.reader_threads.
+constexpr uint32_t kMaxReaderThreads = 8;
+
 bool WriteToFile(const char* path, const char* str) {
   auto fd = base::OpenFile(path, O_WRONLY);
   if (!fd)
@@ -240,6 +252,7 @@ void FtraceController::StartIfNeeded(FtraceInstanceState* instance,
   // period the next time it executes.
   if (instance->started_data_sources.size() > 1) {
     UpdateBufferWatermarkWatches(instance, instance_name);
+    UpdateReaders();
     return;
   }
 
@@ -257,6 +270,7 @@ void FtraceController::StartIfNeeded(FtraceInstanceState* instance,
         instance->table.get(), &symbolizer_, ftrace_clock,
         &ftrace_clock_snapshot_);
   }
+  UpdateReaders();
 
   // Special case for primary instance: if not using the boot clock, take
   // manual clock snapshots so that the trace parser can do a best effort
@@ -271,6 +285,13 @@ void FtraceController::StartIfNeeded(FtraceInstanceState* instance,
   // Set up poll callbacks for the buffers if requested by at least one DS.
   UpdateBufferWatermarkWatches(instance, instance_name);
 
+  // The first tick reads the instance, whatever the schedule of the others.
+  instance->next_read_ms = 0;
+  instance->read_pending = false;
+  instance->adaptive_period_ms = 0;
+  instance->watermark_cpu_reads = 0;
+  instance->watermark_cpu_reads_skipped = 0;
+
   // Start a new repeating read task (even if there is already one posted due
   // to a different ftrace instance). Any old tasks will stop due to generation
   // checks.
@@ -299,6 +320,9 @@ void FtraceController::StartIfNeeded(FtraceInstanceState* instance,
 // want to yield to the event loop, re-enqueueing a continuation task at the end
 // of the immediate queue (letting other enqueued tasks to run before
 // continuing). Therefore we introduce |kMaxPagesPerCpuPerReadTick|.
+//
+// Each instance is read at its own period (see UpdateReadPeriod()), aligned to
+// multiples of that period, and the task is posted for the earliest one.
 void FtraceController::ReadTick(int generation) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_READ_TICK);
@@ -307,10 +331,22 @@ void FtraceController::ReadTick(int generation) {
   }
   MaybeSnapshotFtraceClock();
 
-  // Read all per-cpu buffers.
-  bool all_cpus_done = ReadPassForInstance(&primary_);
+  // Read the per-cpu buffers of the instances that are due.
+  const uint64_t now_ms = NowMs();
+  bool all_cpus_done = true;
+  uint64_t next_read_ms = std::numeric_limits<uint64_t>::max();
   ForEachInstance([&](FtraceInstanceState* instance) {
-    all_cpus_done &= ReadPassForInstance(instance);
+    if (instance->started_data_sources.empty())
+      return;
+    if (instance->read_pending || now_ms >= instance->next_read_ms) {
+      instance->read_pending = !ReadPassForInstance(instance);
+      if (!instance->read_pending) {
+        uint32_t period_ms = UpdateReadPeriod(instance, now_ms);
+        instance->next_read_ms = now_ms + period_ms - (now_ms % period_ms);
+      }
+    }
+    all_cpus_done &= !instance->read_pending;
+    next_read_ms = std::min(next_read_ms, instance->next_read_ms);
   });
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
 
@@ -322,14 +358,14 @@ void FtraceController::ReadTick(int generation) {
         weak_this->ReadTick(generation);
     });
   } else {
-    // Done until next period.
-    auto tick_period_ms = GetTickPeriodMs();
+    // Done until the next instance is due.
+    PERFETTO_DCHECK(next_read_ms > now_ms);
     task_runner_->PostDelayedTask(
         [weak_this, generation] {
           if (weak_this)
             weak_this->ReadTick(generation);
         },
-        tick_period_ms - (NowMs() % tick_period_ms));
+        static_cast<uint32_t>(next_read_ms - now_ms));
   }
 
 #if PERFETTO_DCHECK_IS_ON()
@@ -349,19 +385,108 @@ bool FtraceController::ReadPassForInstance(FtraceInstanceState* instance) {
   if (instance->started_data_sources.empty())
     return true;
 
-  bool all_cpus_done = true;
-  for (size_t i = 0; i < instance->cpu_readers.size(); i++) {
-    size_t max_pages = kMaxPagesPerCpuPerReadTick;
-    size_t pages_read = instance->cpu_readers[i].ReadCycle(
-        &parsing_mem_, max_pages, instance->started_data_sources);
-    PERFETTO_DCHECK(pages_read <= max_pages);
-    if (pages_read == max_pages) {
-      all_cpus_done = false;
+  return ReadAllCpus(instance, kMaxPagesPerCpuPerReadTick);
+}
+
+// With FtraceConfig.reader_threads > 1, the cpus are split between the
+// readers, which run in parallel and write into their own TraceWriter of each
+// data source. This thread waits for them: the data sources, the instance and
+// the clock snapshot can't change while the readers run, and the readers are
+// done by the time the data sources process the metadata.
+bool FtraceController::ReadAllCpus(FtraceInstanceState* instance,
+                                   size_t max_pages) {
+  std::vector<size_t> cpus(instance->cpu_readers.size());
+  std::iota(cpus.begin(), cpus.end(), 0);
+  return ReadCpus(instance, cpus, max_pages, /*undrained_cpus=*/nullptr);
+}
+
+// With FtraceConfig.reader_threads > 1, the cpus are split between the
+// readers, which run in parallel and write into their own TraceWriter of each
+// data source. This thread waits for them: the data sources, the instance and
+// the clock snapshot can't change while the readers run, and the readers are
+// done by the time the data sources process the metadata.
+bool FtraceController::ReadCpus(FtraceInstanceState* instance,
+                                const std::vector<size_t>& cpus,
+                                size_t max_pages,
+                                std::vector<size_t>* undrained_cpus) {
+  const std::set<FtraceDataSource*>& data_sources =
+      instance->started_data_sources;
+  std::vector<CpuReader>& cpu_readers = instance->cpu_readers;
+  const size_t num_readers =
+      std::min(1 + extra_parsing_mem_.size(), cpus.size());
+  if (num_readers <= 1) {
+    bool all_cpus_done = true;
+    for (size_t cpu : cpus) {
+      size_t pages_read = cpu_readers[cpu].ReadCycle(
+          &parsing_mem_, max_pages, data_sources, /*reader_id=*/0);
+      PERFETTO_DCHECK(pages_read <= max_pages);
+      if (pages_read == max_pages) {
+        all_cpus_done = false;
+        if (undrained_cpus)
+          undrained_cpus->push_back(cpu);
+      }
     }
+    return all_cpus_done;
+  }
+
+  for (FtraceDataSource* data_source : data_sources) {
+    data_source->SetUpReaders(num_readers);
+  }
+  // The cpus are interleaved between the readers (reader r reads the cpus r,
+  // r + num_readers, ...) so that each reader gets a mix of the big and
+  // little cpus, which are usually numbered by cluster.
+  // Each reader only writes the |drained| entries of its own cpus.
+  std::vector<uint8_t> drained(cpus.size(), 1);
+  reader_pool_->ParallelFor(num_readers, [&](size_t reader_id) {
+    CpuReader::ParsingBuffers* parsing_mem =
+        reader_id == 0 ? &parsing_mem_ : &extra_parsing_mem_[reader_id - 1];
+    for (size_t i = reader_id; i < cpus.size(); i += num_readers) {
+      size_t pages_read = cpu_readers[cpus[i]].ReadCycle(
+          parsing_mem, max_pages, data_sources, reader_id);
+      PERFETTO_DCHECK(pages_read <= max_pages);
+      drained[i] = pages_read < max_pages;
+    }
+  });
+  for (FtraceDataSource* data_source : data_sources) {
+    data_source->MergeReaderOutputs();
+  }
+  bool all_cpus_done = true;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    if (drained[i])
+      continue;
+    all_cpus_done = false;
+    if (undrained_cpus)
+      undrained_cpus->push_back(cpus[i]);
   }
   return all_cpus_done;
 }
 
+void FtraceController::UpdateReaders() {
+  uint32_t num_readers = 1;
+  size_t num_cpus = 0;
+  ForEachInstance([&](FtraceInstanceState* instance) {
+    for (FtraceDataSource* ds : instance->started_data_sources) {
+      num_readers = std::max(num_readers, ds->config().reader_threads());
+    }
+    num_cpus = std::max(num_cpus, instance->cpu_readers.size());
+  });
+  num_readers = std::min(num_readers, kMaxReaderThreads);
+  num_readers = static_cast<uint32_t>(
+      std::max<size_t>(1, std::min<size_t>(num_readers, num_cpus)));
+
+  if (num_readers != 1 + extra_parsing_mem_.size()) {
+    reader_pool_.reset();
+    if (num_readers > 1) {
+      // The calling thread is one of the readers.
+      reader_pool_ = std::make_unique<base::ThreadPool>(num_readers - 1);
+    }
+    extra_parsing_mem_.resize(num_readers - 1);
+  }
+  for (CpuReader::ParsingBuffers& parsing_mem : extra_parsing_mem_) {
+    parsing_mem.AllocateIfNeeded();
+  }
+}
+
 uint32_t FtraceController::GetTickPeriodMs() {
   if (data_sources_.empty())
     return kDefaultTickPeriodMs;
@@ -396,6 +521,79 @@ uint32_t FtraceController::GetTickPeriodMs() {
   return min_period_ms;
 }
 
+uint32_t FtraceController::GetMaxDrainPeriodMs(
+    const FtraceInstanceState* instance) {
+  uint32_t max_period_ms = std::numeric_limits<uint32_t>::max();
+  for (const FtraceDataSource* ds : instance->started_data_sources) {
+    if (!ds->config().has_max_drain_period_ms())
+      return 0;
+    max_period_ms = std::min(max_period_ms, ds->config().max_drain_period_ms());
+  }
+  if (instance->started_data_sources.empty())
+    return 0;
+  return std::clamp(max_period_ms, kMinAdaptiveTickPeriodMs, kMaxTickPeriodMs);
+}
+
+uint32_t FtraceController::UpdateReadPeriod(FtraceInstanceState* instance,
+                                            uint64_t now_ms) {
+  uint32_t max_period_ms = GetMaxDrainPeriodMs(instance);
+  if (!max_period_ms) {
+    instance->adaptive_period_ms = 0;
+    return GetTickPeriodMs();
+  }
+
+  // The fullest buffer decides, as the buffers of all the cpus are read
+  // together.
+  uint64_t bytes = 0;
+  bool lost_events = false;
+  for (CpuReader& cpu_reader : instance->cpu_readers) {
+    CpuReader::ReadStats stats = cpu_reader.TakeReadStats();
+    bytes = std::max(bytes, stats.bytes);
+    lost_events |= stats.lost_events;
+  }
+
+  if (!instance->adaptive_period_ms) {
+    // Start from the fixed period, discarding the stats read until now.
+    instance->adaptive_period_ms = std::clamp(
+        GetTickPeriodMs(), kMinAdaptiveTickPeriodMs, max_period_ms);
+  } else {
+    uint64_t cpu_buffer_bytes =
+        instance->ftrace_config_muxer->GetPerCpuBufferSizePages() *
+        base::GetSysPageSize();
+    instance->adaptive_period_ms = ComputeAdaptiveDrainPeriodMs(
+        instance->adaptive_period_ms, max_period_ms,
+        now_ms - instance->last_adapted_ms, bytes, cpu_buffer_bytes,
+        lost_events);
+  }
+  instance->last_adapted_ms = now_ms;
+  return instance->adaptive_period_ms;
+}
+
+uint32_t ComputeAdaptiveDrainPeriodMs(uint32_t period_ms,
+                                      uint32_t max_period_ms,
+                                      uint64_t elapsed_ms,
+                                      uint64_t bytes,
+                                      uint64_t cpu_buffer_bytes,
+                                      bool lost_events) {
+  uint64_t next_ms;
+  if (lost_events) {
+    // The buffer filled up and the kernel dropped events: catch up quickly.
+    next_ms = period_ms / 4;
+  } else if (bytes == 0) {
+    next_ms = uint64_t{period_ms} * 2;
+  } else {
+    // Aim at reading the buffers when a quarter full, which leaves room for
+    // bursts, moving by at most 2x per read to smooth out the noise.
+    next_ms =
+        std::max<uint64_t>(elapsed_ms, 1) * (cpu_buffer_bytes / 4) / bytes;
+    next_ms = std::clamp<uint64_t>(next_ms, period_ms / 2,
+                                   uint64_t{period_ms} * 2);
+  }
+  max_period_ms = std::max(max_period_ms, kMinAdaptiveTickPeriodMs);
+  return static_cast<uint32_t>(
+      std::clamp<uint64_t>(next_ms, kMinAdaptiveTickPeriodMs, max_period_ms));
+}
+
 void FtraceController::UpdateBufferWatermarkWatches(
     FtraceInstanceState* instance,
     const std::string& instance_name) {
@@ -414,10 +612,9 @@ void FtraceController::UpdateBufferWatermarkWatches(
   auto weak_this = weak_factory_.GetWeakPtr();
   for (size_t i = 0; i < instance->cpu_readers.size(); i++) {
     int fd = instance->cpu_readers[i].RawBufferFd();
-    task_runner_->AddFileDescriptorWatch(fd, [weak_this, instance_name, i] {
+    task_runner_->AddFileDescriptorWatch(fd, [weak_this, instance_name] {
       if (weak_this)
-        weak_this->OnBufferPastWatermark(instance_name, i,
-                                         /*repoll_watermark=*/true);
+        weak_this->OnBufferPastWatermark(instance_name);
     });
   }
   instance->buffer_watches_posted = true;
@@ -438,59 +635,77 @@ void FtraceController::RemoveBufferWatermarkWatches(
 // TODO(rsavitski): consider calling OnFtraceData only if we're not reposting
 // a continuation. It's a tradeoff between procfs scrape freshness and urgency
 // to drain ftrace kernel buffers.
-void FtraceController::OnBufferPastWatermark(std::string instance_name,
-                                             size_t cpu,
-                                             bool repoll_watermark) {
+void FtraceController::OnBufferPastWatermark(std::string instance_name) {
   metatrace::ScopedEvent evt(metatrace::TAG_FTRACE,
                              metatrace::FTRACE_CPU_BUFFER_WATERMARK);
 
   // Instance might have been stopped before this callback runs.
   FtraceInstanceState* instance = GetInstance(instance_name);
-  if (!instance || cpu >= instance->cpu_readers.size())
+  if (!instance || instance->started_data_sources.empty())
     return;
 
-  // Repoll all per-cpu buffers with zero timeout to confirm that at least
-  // one is still past the watermark. This might not be true if a different
-  // callback / readtick / flush did a read pass before this callback reached
-  // the front of the task runner queue.
-  if (repoll_watermark) {
-    size_t num_cpus = instance->cpu_readers.size();
-    std::vector<struct pollfd> pollfds(num_cpus);
-    for (size_t i = 0; i < num_cpus; i++) {
-      pollfds[i].fd = instance->cpu_readers[i].RawBufferFd();
-      pollfds[i].events = POLLIN;
-    }
-    int r = PERFETTO_EINTR(poll(pollfds.data(), num_cpus, 0));
-    if (r < 0) {
-      PERFETTO_DPLOG("poll failed");
-      return;
-    } else if (r == 0) {  // no buffers below the watermark -> we're done.
-      return;
-    }
-    // Count the number of readable fds, as some poll results might be POLLERR,
-    // as seen in cases with offlined cores. It's still fine to attempt reading
-    // from those buffers as CpuReader will handle the ENODEV.
-    bool has_readable_fd = false;
-    for (size_t i = 0; i < num_cpus; i++) {
-      has_readable_fd |= (pollfds[i].revents & POLLIN);
-    }
-    if (!has_readable_fd) {
-      return;
-    }
+  // Repoll all per-cpu buffers with zero timeout, and read only the ones that
+  // are still past the watermark. Buffers of other cpus might have crossed it
+  // too, while the one that woke us up might have been drained by a different
+  // callback / readtick / flush before this callback reached the front of the
+  // task runner queue.
+  size_t num_cpus = instance->cpu_readers.size();
+  std::vector<struct pollfd> pollfds(num_cpus);
+  for (size_t i = 0; i < num_cpus; i++) {
+    pollfds[i].fd = instance->cpu_readers[i].RawBufferFd();
+    pollfds[i].events = POLLIN;
+  }
+  int r = PERFETTO_EINTR(poll(pollfds.data(), num_cpus, 0));
+  if (r < 0) {
+    PERFETTO_DPLOG("poll failed");
+    return;
+  } else if (r == 0) {  // no buffers past the watermark -> we're done.
+    return;
   }
+  // Only read the readable fds, as some poll results might be POLLERR, as
+  // seen in cases with offlined cores.
+  std::vector<size_t> ready_cpus;
+  for (size_t i = 0; i < num_cpus; i++) {
+    if (pollfds[i].revents & POLLIN)
+      ready_cpus.push_back(i);
+  }
+  if (ready_cpus.empty())
+    return;
+  instance->watermark_cpu_reads += ready_cpus.size();
+  instance->watermark_cpu_reads_skipped += num_cpus - ready_cpus.size();
+
+  ReadWatermarkCpus(std::move(instance_name), std::move(ready_cpus));
+}
+
+void FtraceController::ReadWatermarkCpus(std::string instance_name,
+                                         std::vector<size_t> cpus) {
+  FtraceInstanceState* instance = GetInstance(instance_name);
+  if (!instance || instance->started_data_sources.empty())
+    return;
+  // The readers might have been recreated, for fewer cpus, since the task
+  // was posted.
+  cpus.erase(std::remove_if(cpus.begin(), cpus.end(),
+                            [instance](size_t cpu) {
+                              return cpu >= instance->cpu_readers.size();
+                            }),
+             cpus.end());
 
   MaybeSnapshotFtraceClock();
-  bool all_cpus_done = ReadPassForInstance(instance);
+  std::vector<size_t> undrained_cpus;
+  bool all_cpus_done = ReadCpus(instance, cpus, kMaxPagesPerCpuPerReadTick,
+                                &undrained_cpus);
   observer_->OnFtraceDataWrittenIntoDataSourceBuffers();
   if (!all_cpus_done) {
     // More data to be read, but we want to let other task_runner tasks to run.
     // Repost a continuation task.
     auto weak_this = weak_factory_.GetWeakPtr();
-    task_runner_->PostTask([weak_this, instance_name, cpu] {
-      if (weak_this)
-        weak_this->OnBufferPastWatermark(instance_name, cpu,
-                                         /*repoll_watermark=*/false);
-    });
+    task_runner_->PostTask(
+        [weak_this, instance_name, undrained_cpus]() mutable {
+          if (weak_this) {
+            weak_this->ReadWatermarkCpus(std::move(instance_name),
+                                         std::move(undrained_cpus));
+          }
+        });
   }
 }
 
@@ -518,10 +733,7 @@ void FtraceController::FlushForInstance(FtraceInstanceState* instance) {
   // don't get stuck chasing the writer if there's a very high bandwidth of
   // events.
   size_t max_pages = instance->ftrace_config_muxer->GetPerCpuBufferSizePages();
-  for (size_t i = 0; i < instance->cpu_readers.size(); i++) {
-    instance->cpu_readers[i].ReadCycle(&parsing_mem_, max_pages,
-                                       instance->started_data_sources);
-  }
+  ReadAllCpus(instance, max_pages);
 }
 
 // We are not implicitly flushing on Stop. The tracing service is supposed to
@@ -553,6 +765,8 @@ void FtraceController::StopIfNeeded(FtraceInstanceState* instance) {
 
   // Note: might have never been allocated if data sources were rejected.
   parsing_mem_.Release();
+  reader_pool_.reset();
+  extra_parsing_mem_.clear();
 }
 
 bool FtraceController::AddDataSource(FtraceDataSource* data_source) {
@@ -628,6 +842,8 @@ void FtraceController::RemoveDataSource(FtraceDataSource* data_source) {
   instance->ftrace_config_muxer->RemoveConfig(data_source->config_id());
   instance->started_data_sources.erase(data_source);
   StopIfNeeded(instance);
+  if (!data_sources_.empty())
+    UpdateReaders();
 }
 
 void FtraceController::DumpFtraceStats(FtraceDataSource* data_source,
@@ -639,6 +855,9 @@ void FtraceController::DumpFtraceStats(FtraceDataSource* data_source,
     return;
 
   DumpAllCpuStats(instance->ftrace_procfs.get(), stats_out);
+  stats_out->watermark_cpu_reads = instance->watermark_cpu_reads;
+  stats_out->watermark_cpu_reads_skipped =
+      instance->watermark_cpu_reads_skipped;
   if (symbolizer_.is_valid()) {
     auto* symbol_map = symbolizer_.GetOrCreateKernelSymbolMap();
     stats_out->kernel_symbols_parsed =
@@ -24,6 +24,7 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/weak_ptr.h"
@@ -35,6 +36,10 @@
 
 namespace perfetto {
 
+namespace base {
+class ThreadPool;
+}  // namespace base
+
 class FtraceConfigMuxer;
 class FtraceDataSource;
 class FtraceProcfs;
@@ -45,6 +50,17 @@ struct FtraceStats;
 // Method of last resort to reset ftrace state.
 bool HardResetFtraceState();
 
+// Returns the next read period of a tracefs instance using
+// FtraceConfig.max_drain_period_ms, given the |bytes| read from its fullest
+// per-cpu buffer of |cpu_buffer_bytes| over the last |elapsed_ms|, and whether
+// the kernel reported |lost_events| in the meantime.
+uint32_t ComputeAdaptiveDrainPeriodMs(uint32_t period_ms,
+                                      uint32_t max_period_ms,
+                                      uint64_t elapsed_ms,
+                                      uint64_t bytes,
+                                      uint64_t cpu_buffer_bytes,
+                                      bool lost_events);
+
 // Stores the a snapshot of the timestamps from ftrace's trace clock
 // and CLOCK_BOOTITME.
 //
@@ -116,6 +132,19 @@ class FtraceController {
     std::vector<CpuReader> cpu_readers;  // empty if no started data sources
     std::set<FtraceDataSource*> started_data_sources;
     bool buffer_watches_posted = false;
+
+    // When ReadTick() reads the buffers next, unless a read pass stopped
+    // before draining them (|read_pending|).
+    uint64_t next_read_ms = 0;
+    bool read_pending = false;
+    // Read period adapted to the fill rate of the buffers, zero if not all
+    // the data sources set FtraceConfig.max_drain_period_ms.
+    uint32_t adaptive_period_ms = 0;
+    uint64_t last_adapted_ms = 0;
+
+    // Per-cpu buffers read, and left alone, by OnBufferPastWatermark().
+    uint64_t watermark_cpu_reads = 0;
+    uint64_t watermark_cpu_reads_skipped = 0;
   };
 
   FtraceInstanceState* GetInstance(const std::string& instance_name);
@@ -138,13 +167,34 @@ class FtraceController {
   // instances.
   void ReadTick(int generation);
   bool ReadPassForInstance(FtraceInstanceState* instance);
+  // Reads at most |max_pages| from each per-cpu buffer of |instance|, with all
+  // the readers. Returns true if all the buffers were drained.
+  bool ReadAllCpus(FtraceInstanceState* instance, size_t max_pages);
+  // Same as ReadAllCpus(), for the per-cpu buffers in |cpus| only. The cpus
+  // whose buffer wasn't drained are appended to |undrained_cpus|.
+  bool ReadCpus(FtraceInstanceState* instance,
+                const std::vector<size_t>& cpus,
+                size_t max_pages,
+                std::vector<size_t>* undrained_cpus);
+  // Sets the number of readers to the highest FtraceConfig.reader_threads of
+  // the started data sources.
+  void UpdateReaders();
   uint32_t GetTickPeriodMs();
+  // Returns the lowest FtraceConfig.max_drain_period_ms of the started data
+  // sources of |instance|, or zero if any of them doesn't set it.
+  uint32_t GetMaxDrainPeriodMs(const FtraceInstanceState* instance);
+  // Returns the period until the next read of |instance|, adapting it to what
+  // was read since the last call if the instance uses an adaptive period.
+  uint32_t UpdateReadPeriod(FtraceInstanceState* instance, uint64_t now_ms);
   // Optional: additional reads based on buffer capacity. Per tracefs instance.
   void UpdateBufferWatermarkWatches(FtraceInstanceState* instance,
                                     const std::string& instance_name);
-  void OnBufferPastWatermark(std::string instance_name,
-                             size_t cpu,
-                             bool repoll_watermark);
+  // Reads the per-cpu buffers of the instance that are past the watermark,
+  // when the buffer of any cpu gets there.
+  void OnBufferPastWatermark(std::string instance_name);
+  // Reads |cpus| of the instance, and keeps reading those that aren't
+  // drained in continuation tasks.
+  void ReadWatermarkCpus(std::string instance_name, std::vector<size_t> cpus);
   void RemoveBufferWatermarkWatches(FtraceInstanceState* instance);
   PollSupport VerifyKernelSupportForBufferWatermark();
 
@@ -166,6 +216,11 @@ class FtraceController {
   base::TaskRunner* const task_runner_;
   Observer* const observer_;
   CpuReader::ParsingBuffers parsing_mem_;
+  // Used when FtraceConfig.reader_threads > 1. The first reader runs on the
+  // |task_runner_| thread and uses |parsing_mem_|, the other ones run on
+  // |reader_pool_| and use |extra_parsing_mem_|.
+  std::vector<CpuReader::ParsingBuffers> extra_parsing_mem_;
+  std::unique_ptr<base::ThreadPool> reader_pool_;
   LazyKernelSymbolizer symbolizer_;
   FtraceConfigId next_cfg_id_ = 1;
   int tick_generation_ = 0;
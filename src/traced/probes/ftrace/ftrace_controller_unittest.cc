@@ -21,6 +21,8 @@
 #include <sys/types.h>
 
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "src/traced/probes/ftrace/compact_sched.h"
 #include "src/traced/probes/ftrace/cpu_reader.h"
 #include "src/traced/probes/ftrace/ftrace_config_muxer.h"
@@ -31,6 +33,7 @@
 #include "src/tracing/core/trace_writer_for_testing.h"
 #include "test/gtest_and_gmock.h"
 
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
 #include "protos/perfetto/trace/ftrace/ftrace_stats.gen.h"
 #include "protos/perfetto/trace/ftrace/ftrace_stats.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.gen.h"
@@ -178,10 +181,17 @@ class MockFtraceProcfs : public FtraceProcfs {
     return current_tracer_;
   }
 
-  base::ScopedFile OpenPipeForCpu(size_t /*cpu*/) override {
+  base::ScopedFile OpenPipeForCpu(size_t cpu) override {
+    if (cpu < cpu_buffer_paths_.size())
+      return base::OpenFile(cpu_buffer_paths_[cpu], O_RDONLY);
     return base::ScopedFile(base::OpenFile("/dev/null", O_RDONLY));
   }
 
+  // The per-cpu buffers are read from these files rather than /dev/null.
+  void set_cpu_buffer_paths(std::vector<std::string> paths) {
+    cpu_buffer_paths_ = std::move(paths);
+  }
+
   MOCK_METHOD(bool,
               WriteToFile,
               (const std::string& path, const std::string& str),
@@ -200,6 +210,7 @@ class MockFtraceProcfs : public FtraceProcfs {
  private:
   bool tracing_on_ = true;
   std::string current_tracer_ = "nop";
+  std::vector<std::string> cpu_buffer_paths_;
 };
 
 class MockAtraceWrapper : public AtraceWrapper {
@@ -231,6 +242,10 @@ class TestFtraceController : public FtraceController,
   MockTaskRunner* runner() { return runner_.get(); }
   MockFtraceProcfs* procfs() { return primary_procfs_; }
   uint32_t tick_period_ms() { return GetTickPeriodMs(); }
+  size_t num_readers() { return 1 + extra_parsing_mem_.size(); }
+  void set_buffer_watermark_supported() {
+    buffer_watermark_support_ = PollSupport::kSupported;
+  }
 
   std::unique_ptr<FtraceDataSource> AddFakeDataSource(const FtraceConfig& cfg) {
     std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
@@ -240,6 +255,25 @@ class TestFtraceController : public FtraceController,
     return data_source;
   }
 
+  // Same as AddFakeDataSource(), but the data source (and each of its
+  // readers) writes into a TraceWriterForTesting, appended to |writers|.
+  std::unique_ptr<FtraceDataSource> AddDataSourceWithWriters(
+      const FtraceConfig& cfg,
+      std::vector<TraceWriterForTesting*>* writers) {
+    auto writer = std::make_unique<TraceWriterForTesting>();
+    writers->push_back(writer.get());
+    std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
+        GetWeakPtr(), 0 /* session id */, cfg, std::move(writer)));
+    data_source->set_trace_writer_factory([writers] {
+      auto extra_writer = std::make_unique<TraceWriterForTesting>();
+      writers->push_back(extra_writer.get());
+      return extra_writer;
+    });
+    if (!AddDataSource(data_source.get()))
+      return nullptr;
+    return data_source;
+  }
+
   uint64_t NowMs() const override { return 0; }
   void OnFtraceDataWrittenIntoDataSourceBuffers() override {}
 
@@ -608,6 +642,188 @@ TEST(FtraceControllerTest, PeriodicDrainConfig) {
   }
 }
 
+TEST(FtraceControllerTest, AdaptiveDrainPeriod) {
+  constexpr uint64_t kBufferBytes = 1024 * 1024;
+
+  // The period moves towards reading the buffer when a quarter full, by at
+  // most 2x per read.
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(100, 1000, 100, kBufferBytes / 8,
+                                         kBufferBytes, false),
+            200u);
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(100, 1000, 100, kBufferBytes / 5,
+                                         kBufferBytes, false),
+            125u);
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(100, 1000, 100, kBufferBytes,
+                                         kBufferBytes, false),
+            50u);
+
+  // Idle buffers back off up to the maximum period.
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(400, 1000, 400, 0, kBufferBytes,
+                                         false),
+            800u);
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(800, 1000, 800, 0, kBufferBytes,
+                                         false),
+            1000u);
+
+  // Lost events shrink the period quickly, down to the minimum period.
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(1000, 1000, 1000, kBufferBytes,
+                                         kBufferBytes, true),
+            250u);
+  EXPECT_EQ(ComputeAdaptiveDrainPeriodMs(20, 1000, 20, kBufferBytes,
+                                         kBufferBytes, true),
+            10u);
+}
+
+TEST(FtraceControllerTest, ReaderThreads) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 4 /* cpu_count */);
+
+  // Each cpu buffer holds a page with a truncated record, which is reported
+  // as an error in the bundle of that cpu.
+  std::vector<base::TempFile> buffers;
+  std::vector<std::string> paths;
+  for (uint32_t cpu = 0; cpu < 4; cpu++) {
+    std::vector<uint8_t> page(base::GetSysPageSize());
+    uint64_t timestamp = 1000 + cpu;
+    uint64_t commit = 4;
+    uint32_t event_header = 2;  // An 8 bytes record.
+    memcpy(&page[0], &timestamp, sizeof(timestamp));
+    memcpy(&page[8], &commit, sizeof(commit));
+    memcpy(&page[16], &event_header, sizeof(event_header));
+    buffers.emplace_back(base::TempFile::Create());
+    base::WriteAll(buffers.back().fd(), page.data(), page.size());
+    paths.push_back(buffers.back().path());
+  }
+  controller->procfs()->set_cpu_buffer_paths(paths);
+
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_reader_threads(3);
+  std::vector<TraceWriterForTesting*> writers;
+  auto data_source = controller->AddDataSourceWithWriters(config, &writers);
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  EXPECT_EQ(controller->num_readers(), 3u);
+
+  controller->Flush(/*flush_id=*/1);
+
+  // Reader r reads the cpus r, r + 3, ... into its own writer.
+  ASSERT_EQ(writers.size(), 3u);
+  std::vector<std::vector<uint32_t>> cpus_by_writer;
+  for (TraceWriterForTesting* writer : writers) {
+    cpus_by_writer.emplace_back();
+    for (const auto& packet : writer->GetAllTracePackets()) {
+      ASSERT_TRUE(packet.has_ftrace_events());
+      cpus_by_writer.back().push_back(packet.ftrace_events().cpu());
+      ASSERT_EQ(packet.ftrace_events().error().size(), 1u);
+      EXPECT_EQ(packet.ftrace_events().error()[0].status(),
+                protos::gen::FTRACE_STATUS_ABI_END_OVERFLOW);
+    }
+  }
+  EXPECT_THAT(cpus_by_writer[0], ElementsAre(0u, 3u));
+  EXPECT_THAT(cpus_by_writer[1], ElementsAre(1u));
+  EXPECT_THAT(cpus_by_writer[2], ElementsAre(2u));
+
+  // The errors of all the readers are reported in the stats of the data
+  // source.
+  EXPECT_THAT(*data_source->mutable_parse_errors(),
+              ElementsAre(protos::pbzero::FTRACE_STATUS_ABI_END_OVERFLOW));
+
+  // A data source asking for fewer threads doesn't change the number of
+  // readers, which goes back to one without data sources asking for more.
+  FtraceConfig single_config = CreateFtraceConfig({"group/foo"});
+  auto single_data_source = controller->AddFakeDataSource(single_config);
+  ASSERT_TRUE(controller->StartDataSource(single_data_source.get()));
+  EXPECT_EQ(controller->num_readers(), 3u);
+  data_source.reset();
+  EXPECT_EQ(controller->num_readers(), 1u);
+}
+
+TEST(FtraceControllerTest, WatermarkReadsOnlyReadyCpus) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 4 /* cpu_count */);
+  controller->set_buffer_watermark_supported();
+
+  // The per-cpu buffers are pipes, which are past the watermark (readable)
+  // only when they hold data.
+  std::vector<base::Pipe> pipes;
+  std::vector<std::string> paths;
+  for (uint32_t cpu = 0; cpu < 4; cpu++) {
+    pipes.emplace_back(base::Pipe::Create());
+    paths.push_back("/proc/self/fd/" + std::to_string(*pipes.back().rd));
+  }
+  controller->procfs()->set_cpu_buffer_paths(paths);
+
+  std::vector<std::function<void()>> watches;
+  EXPECT_CALL(*controller->runner(), AddFileDescriptorWatch(_, _))
+      .Times(4)
+      .WillRepeatedly(Invoke([&watches](int, std::function<void()> cb) {
+        watches.push_back(std::move(cb));
+      }));
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_drain_buffer_percent(50);
+  std::vector<TraceWriterForTesting*> writers;
+  auto data_source = controller->AddDataSourceWithWriters(config, &writers);
+  ASSERT_TRUE(data_source);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  ASSERT_EQ(watches.size(), 4u);
+
+  // Fill the buffer of cpu 2 with a page, then EOF.
+  std::vector<uint8_t> page(base::GetSysPageSize());
+  uint64_t commit = 4;
+  uint32_t event_header = 2;
+  memcpy(&page[8], &commit, sizeof(commit));
+  memcpy(&page[16], &event_header, sizeof(event_header));
+  base::WriteAll(*pipes[2].wr, page.data(), page.size());
+  pipes[2].wr.reset();
+
+  // Only the buffer of cpu 2 is read, whichever watch fires.
+  watches[0]();
+  std::vector<uint32_t> cpus_read;
+  for (const auto& packet : writers[0]->GetAllTracePackets())
+    cpus_read.push_back(packet.ftrace_events().cpu());
+  EXPECT_THAT(cpus_read, ElementsAre(2u));
+
+  FtraceStats stats;
+  controller->DumpFtraceStats(data_source.get(), &stats);
+  EXPECT_EQ(stats.watermark_cpu_reads, 1u);
+  EXPECT_EQ(stats.watermark_cpu_reads_skipped, 3u);
+
+  // Once drained, no buffer is past the watermark.
+  watches[2]();
+  controller->DumpFtraceStats(data_source.get(), &stats);
+  EXPECT_EQ(stats.watermark_cpu_reads, 1u);
+  EXPECT_EQ(stats.watermark_cpu_reads_skipped, 3u);
+}
+
+TEST(FtraceControllerTest, ReaderThreadsCappedByCpus) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 2 /* cpu_count */);
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_reader_threads(64);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(controller->StartDataSource(data_source.get()));
+  EXPECT_EQ(controller->num_readers(), 2u);
+}
+
+TEST(FtraceControllerTest, ClearIncrementalStateRewritesRawPageFormat) {
+  auto controller =
+      CreateTestController(true /* nice procfs */, 2 /* cpu_count */);
+  FtraceConfig config = CreateFtraceConfig({"group/foo"});
+  config.set_raw_page_passthrough(true);
+  config.set_reader_threads(2);
+  auto data_source = controller->AddFakeDataSource(config);
+  ASSERT_TRUE(data_source);
+  EXPECT_TRUE(FtraceDataSource::descriptor.flags &
+              ProbesDataSource::Descriptor::kHandlesIncrementalState);
+
+  data_source->SetUpReaders(2);
+  *data_source->GetReaderOutput(0).raw_page_format_written = true;
+  *data_source->GetReaderOutput(1).raw_page_format_written = true;
+  data_source->ClearIncrementalState();
+  EXPECT_FALSE(*data_source->GetReaderOutput(0).raw_page_format_written);
+  EXPECT_FALSE(*data_source->GetReaderOutput(1).raw_page_format_written);
+}
+
 TEST(FtraceMetadataTest, Clear) {
   FtraceMetadata metadata;
   metadata.inode_and_device.insert(std::make_pair(1, 1));
@@ -76,7 +76,8 @@ void FillFtraceDataSourceDescriptor(DataSourceDescriptor* dsd) {
 // static
 const ProbesDataSource::Descriptor FtraceDataSource::descriptor = {
     /*name*/ "linux.ftrace",
-    /*flags*/ Descriptor::kFlagsNone,
+    /*flags*/ Descriptor::kFillDescriptorAsync |
+        Descriptor::kHandlesIncrementalState,
     /*fill_descriptor_func*/ &FillFtraceDataSourceDescriptor,
 };
 
@@ -103,6 +104,57 @@ void FtraceDataSource::Initialize(
   parsing_config_ = parsing_config;
 }
 
+void FtraceDataSource::SetUpReaders(size_t num_readers) {
+  while (extra_readers_.size() + 1 < num_readers) {
+    auto reader = std::make_unique<ExtraReader>();
+    if (trace_writer_factory_)
+      reader->writer = trace_writer_factory_();
+    extra_readers_.emplace_back(std::move(reader));
+  }
+}
+
+FtraceDataSource::ReaderOutput FtraceDataSource::GetReaderOutput(
+    size_t reader_id) {
+  if (reader_id == 0) {
+    return ReaderOutput{writer_.get(), &metadata_, &parse_errors_,
+                        &raw_page_format_written_};
+  }
+  PERFETTO_DCHECK(reader_id <= extra_readers_.size());
+  ExtraReader* reader = extra_readers_[reader_id - 1].get();
+  return ReaderOutput{reader->writer.get(), &reader->metadata,
+                      &reader->parse_errors, &reader->raw_page_format_written};
+}
+
+void FtraceDataSource::ClearIncrementalState() {
+  // In ring buffer mode the packet with the layout of the raw pages can be
+  // overwritten, so it's written again after each clear.
+  raw_page_format_written_ = false;
+  for (auto& reader : extra_readers_)
+    reader->raw_page_format_written = false;
+}
+
+void FtraceDataSource::MergeReaderOutputs() {
+  for (auto& reader : extra_readers_) {
+    FtraceMetadata& metadata = reader->metadata;
+    for (const auto& inode : metadata.inode_and_device)
+      metadata_.inode_and_device.insert(inode);
+    for (int32_t pid : metadata.rename_pids)
+      metadata_.AddRenamePid(pid);
+    for (int32_t pid : metadata.pids)
+      metadata_.AddPid(pid);
+    for (const auto& fd : metadata.fds)
+      metadata_.fds.insert(fd);
+    // The kernel symbols are interned per packet sequence, hence per reader:
+    // they are dropped here, like the ones of the first reader are dropped
+    // once the metadata is consumed.
+    metadata.Clear();
+
+    for (auto error : reader->parse_errors)
+      parse_errors_.insert(error);
+    reader->parse_errors.clear();
+  }
+}
+
 void FtraceDataSource::Start() {
   if (!controller_weak_)
     return;
@@ -152,6 +204,12 @@ void FtraceDataSource::OnFtraceFlushComplete(FlushRequestID flush_request_id) {
   }
   auto callback = std::move(it->second);
   pending_flushes_.erase(it);
+  // The data written by the other readers is committed before the flush of
+  // the main writer, whose callback acks the flush.
+  for (auto& reader : extra_readers_) {
+    if (reader->writer)
+      reader->writer->Flush();
+  }
   if (writer_) {
     WriteStats();
     writer_->Flush(std::move(callback));
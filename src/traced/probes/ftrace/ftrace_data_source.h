@@ -21,6 +21,7 @@
 #include <map>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "perfetto/base/flat_set.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -56,6 +57,18 @@ class FtraceDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
+  using TraceWriterFactory = std::function<std::unique_ptr<TraceWriter>()>;
+
+  // Where the ftrace reader |reader_id| (see FtraceConfig.reader_threads)
+  // writes the data of this data source. All the pointers are owned by the
+  // data source.
+  struct ReaderOutput {
+    TraceWriter* trace_writer;
+    FtraceMetadata* metadata;
+    base::FlatSet<protos::pbzero::FtraceParseStatus>* parse_errors;
+    bool* raw_page_format_written;
+  };
+
   FtraceDataSource(base::WeakPtr<FtraceController>,
                    TracingSessionID,
                    const FtraceConfig&,
@@ -74,6 +87,9 @@ class FtraceDataSource : public ProbesDataSource {
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void OnFtraceFlushComplete(FlushRequestID);
 
+  // Makes the readers write the layout of the raw pages again.
+  void ClearIncrementalState() override;
+
   FtraceConfigId config_id() const { return config_id_; }
   const FtraceConfig& config() const { return config_; }
   const FtraceDataSourceConfig* parsing_config() const {
@@ -87,8 +103,28 @@ class FtraceDataSource : public ProbesDataSource {
   base::FlatSet<protos::pbzero::FtraceParseStatus>* mutable_parse_errors() {
     return &parse_errors_;
   }
+  bool* mutable_raw_page_format_written() { return &raw_page_format_written_; }
   TraceWriter* trace_writer() { return writer_.get(); }
 
+  // Used to create the writers of the readers other than the first one.
+  void set_trace_writer_factory(TraceWriterFactory factory) {
+    trace_writer_factory_ = std::move(factory);
+  }
+
+  // Creates the state of the readers [1, num_readers), if not created
+  // already. Must be called before the readers run.
+  void SetUpReaders(size_t num_readers);
+
+  // Reader 0 writes into the writer, metadata and errors of the data source
+  // itself. The others write into their own, which are set up by
+  // SetUpReaders(). Can be called concurrently for different readers.
+  ReaderOutput GetReaderOutput(size_t reader_id);
+
+  // Moves the metadata and errors collected by the readers other than the
+  // first one into the ones of the data source. Must be called once the
+  // readers are done, before the metadata is consumed.
+  void MergeReaderOutputs();
+
  private:
   // Hands out internal pointers to callbacks.
   FtraceDataSource(const FtraceDataSource&) = delete;
@@ -98,6 +134,14 @@ class FtraceDataSource : public ProbesDataSource {
 
   void WriteStats();
 
+  // State of the readers other than the first one, see GetReaderOutput().
+  struct ExtraReader {
+    std::unique_ptr<TraceWriter> writer;
+    FtraceMetadata metadata;
+    base::FlatSet<protos::pbzero::FtraceParseStatus> parse_errors;
+    bool raw_page_format_written = false;
+  };
+
   const FtraceConfig config_;
   FtraceMetadata metadata_;
   // Stats as saved during data source setup, will be emitted with phase
@@ -106,7 +150,13 @@ class FtraceDataSource : public ProbesDataSource {
   // Accumulates errors encountered while parsing the binary ftrace data (e.g.
   // data disagreeing with our understanding of the ring buffer ABI):
   base::FlatSet<protos::pbzero::FtraceParseStatus> parse_errors_;
+  // Whether the layout of the raw pages has already been written into the
+  // trace since the incremental state was last cleared. Used only when
+  // FtraceConfig.raw_page_passthrough is set.
+  bool raw_page_format_written_ = false;
   std::map<FlushRequestID, std::function<void()>> pending_flushes_;
+  TraceWriterFactory trace_writer_factory_;
+  std::vector<std::unique_ptr<ExtraReader>> extra_readers_;
 
   // -- Fields initialized by the Initialize() call:
   FtraceConfigId config_id_ = 0;
@@ -76,9 +76,8 @@ struct FtraceMetadata {
 #if PERFETTO_DCHECK_IS_ON()
     PERFETTO_DCHECK(seen_device_id);
 #endif
-    static int32_t cached_pid = 0;
-    if (!cached_pid)
-      cached_pid = getpid();
+    // Thread-safe, as events can be parsed by several reader threads.
+    static const int32_t cached_pid = getpid();
 
     PERFETTO_DCHECK(last_seen_common_pid);
     PERFETTO_DCHECK(cached_pid == getpid());
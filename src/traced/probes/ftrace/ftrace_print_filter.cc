@@ -18,6 +18,10 @@
 
 #include <string.h>
 
+#include <algorithm>
+#include <limits>
+#include <map>
+
 #include "protos/perfetto/config/ftrace/ftrace_config.gen.h"
 #include "src/traced/probes/ftrace/event_info_constants.h"
 
@@ -25,86 +29,121 @@ namespace perfetto {
 namespace {
 using ::perfetto::protos::gen::FtraceConfig;
 
-bool PrefixMatches(const std::string& prefix, const char* start, size_t size) {
-  if (prefix.size() > size) {
-    return false;
-  }
-  return strncmp(prefix.c_str(), start, prefix.size()) == 0;
-}
-
-bool AtraceMessageMatches(const std::string& before_pid_part,
-                          const std::string& after_pid_prefix,
-                          const char* start,
-                          size_t size) {
-  base::StringView s(start, size);
-  if (!s.StartsWith(base::StringView(before_pid_part))) {
-    return false;
-  }
-  s = s.substr(before_pid_part.size());
-
-  if (!s.StartsWith("|")) {
-    return false;
-  }
-  s = s.substr(1);
-
-  size_t skip_pid_count = 0;
-  for (;; skip_pid_count++) {
-    if (skip_pid_count == s.size()) {
-      return false;
-    }
-    if (s.at(skip_pid_count) == '|') {
-      break;
-    }
-    if (!isdigit(s.at(skip_pid_count))) {
-      return false;
+struct BuilderNode {
+  std::map<char, uint32_t> children;
+  uint32_t rule = std::numeric_limits<uint32_t>::max();
+  uint32_t atrace_root = 0;
+};
+
+// Returns the node of |str|, appended to |node|, creating the missing ones.
+uint32_t AddString(std::vector<BuilderNode>* nodes,
+                   uint32_t node,
+                   const std::string& str) {
+  for (char c : str) {
+    auto it = (*nodes)[node].children.find(c);
+    if (it != (*nodes)[node].children.end()) {
+      node = it->second;
+      continue;
     }
+    auto child = static_cast<uint32_t>(nodes->size());
+    (*nodes)[node].children.emplace(c, child);
+    nodes->emplace_back();
+    node = child;
   }
-  skip_pid_count++;
-  s = s.substr(skip_pid_count);
-
-  return PrefixMatches(after_pid_prefix, s.data(), s.size());
+  return node;
 }
 
 }  // namespace
 
-// static
-bool FtracePrintFilter::RuleMatches(const Rule& rule,
-                                    const char* start,
-                                    size_t size) {
-  switch (rule.type) {
-    case Rule::Type::kAtraceMessage:
-      return AtraceMessageMatches(rule.before_pid_part, rule.prefix, start,
-                                  size);
-    case Rule::Type::kPrefixMatch:
-      break;
-  }
-  return PrefixMatches(rule.prefix, start, size);
-}
-
 FtracePrintFilter::FtracePrintFilter(const FtraceConfig::PrintFilter& conf) {
-  rules_.reserve(conf.rules().size());
+  // The root is node 0.
+  std::vector<BuilderNode> nodes(1);
+  allow_.reserve(conf.rules().size());
   for (const FtraceConfig::PrintFilter::Rule& conf_rule : conf.rules()) {
-    Rule rule;
-    rule.allow = conf_rule.allow();
+    auto rule = static_cast<uint32_t>(allow_.size());
+    allow_.push_back(conf_rule.allow());
+    uint32_t node;
     if (conf_rule.has_atrace_msg()) {
-      rule.type = Rule::Type::kAtraceMessage;
-      rule.before_pid_part = conf_rule.atrace_msg().type();
-      rule.prefix = conf_rule.atrace_msg().prefix();
+      // "<type>|<pid>|<prefix>": the pid part is skipped when walking, so the
+      // prefix lives in its own trie, rooted at the "<type>|" node.
+      uint32_t type_node =
+          AddString(&nodes, 0, conf_rule.atrace_msg().type() + "|");
+      if (!nodes[type_node].atrace_root) {
+        nodes[type_node].atrace_root = static_cast<uint32_t>(nodes.size());
+        nodes.emplace_back();
+      }
+      node = AddString(&nodes, nodes[type_node].atrace_root,
+                       conf_rule.atrace_msg().prefix());
     } else {
-      rule.type = Rule::Type::kPrefixMatch;
-      rule.prefix = conf_rule.prefix();
+      node = AddString(&nodes, 0, conf_rule.prefix());
+    }
+    // If the same prefix appears more than once, the first rule wins.
+    nodes[node].rule = std::min(nodes[node].rule, rule);
+  }
+
+  nodes_.resize(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++) {
+    Node& node = nodes_[i];
+    node.first_edge = static_cast<uint32_t>(edges_.size());
+    node.num_edges = static_cast<uint32_t>(nodes[i].children.size());
+    node.rule = nodes[i].rule;
+    node.atrace_root = nodes[i].atrace_root;
+    for (const auto& [c, child] : nodes[i].children)
+      edges_.push_back(Edge{c, child});
+  }
+  // Children are always created after their parent.
+  for (size_t i = nodes_.size(); i-- > 0;) {
+    Node& node = nodes_[i];
+    node.min_rule_below = node.rule;
+    for (uint32_t e = 0; e < node.num_edges; e++) {
+      node.min_rule_below =
+          std::min(node.min_rule_below,
+                   nodes_[edges_[node.first_edge + e].node].min_rule_below);
+    }
+    if (node.atrace_root) {
+      node.min_rule_below =
+          std::min(node.min_rule_below, nodes_[node.atrace_root].min_rule_below);
     }
-    rules_.push_back(std::move(rule));
   }
 }
 
-bool FtracePrintFilter::IsAllowed(const char* start, size_t size) const {
-  for (const Rule& rule : rules_) {
-    if (RuleMatches(rule, start, size)) {
-      return rule.allow;
+void FtracePrintFilter::Walk(uint32_t node_idx,
+                             const char* start,
+                             const char* end,
+                             uint32_t* best) const {
+  const char* ptr = start;
+  for (;;) {
+    const Node& node = nodes_[node_idx];
+    if (node.min_rule_below >= *best)
+      return;
+    *best = std::min(*best, node.rule);
+
+    if (node.atrace_root) {
+      const char* pid_end = ptr;
+      while (pid_end != end && *pid_end >= '0' && *pid_end <= '9')
+        pid_end++;
+      if (pid_end != end && *pid_end == '|')
+        Walk(node.atrace_root, pid_end + 1, end, best);
     }
+
+    if (ptr == end || *ptr == '\0')
+      return;
+    const Edge* edges_begin = edges_.data() + node.first_edge;
+    const Edge* edges_end = edges_begin + node.num_edges;
+    const Edge* edge = std::lower_bound(
+        edges_begin, edges_end, *ptr,
+        [](const Edge& e, char c) { return e.c < c; });
+    if (edge == edges_end || edge->c != *ptr)
+      return;
+    node_idx = edge->node;
+    ptr++;
   }
-  return true;
+}
+
+bool FtracePrintFilter::IsAllowed(const char* start, size_t size) const {
+  uint32_t best = kNoRule;
+  Walk(0, start, start + size, &best);
+  return best == kNoRule ? true : allow_[best];
 }
 
 // static
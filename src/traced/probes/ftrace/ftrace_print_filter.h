@@ -17,6 +17,9 @@
 #ifndef SRC_TRACED_PROBES_FTRACE_FTRACE_PRINT_FILTER_H_
 #define SRC_TRACED_PROBES_FTRACE_FTRACE_PRINT_FILTER_H_
 
+#include <stdint.h>
+
+#include <limits>
 #include <optional>
 #include <string>
 #include <vector>
@@ -33,6 +36,9 @@ class FtraceConfig_PrintFilter;
 }  // namespace gen
 }  // namespace protos
 
+// The rules are compiled into a trie of their prefixes, which is walked once
+// over the string: the rule that applies is the first (in config order) of
+// the rules whose prefix is on the path of the string.
 class FtracePrintFilter {
  public:
   // Builds a filter from a proto config.
@@ -44,20 +50,38 @@ class FtracePrintFilter {
   bool IsAllowed(const char* start, size_t size) const;
 
  private:
-  struct Rule {
-    enum class Type {
-      kPrefixMatch,
-      kAtraceMessage,
-    };
-    Type type;
-    std::string before_pid_part;
-    std::string prefix;
-    bool allow;
+  static constexpr uint32_t kNoRule = std::numeric_limits<uint32_t>::max();
+
+  struct Node {
+    // Children of the node: edges_[first_edge, first_edge + num_edges),
+    // sorted by character.
+    uint32_t first_edge = 0;
+    uint32_t num_edges = 0;
+    // Index of the first rule whose prefix ends at this node, if any.
+    uint32_t rule = kNoRule;
+    // Index of the first rule that ends at this node or below it (including
+    // the atrace subtree), used to stop the walk early.
+    uint32_t min_rule_below = kNoRule;
+    // For the node of "<type>|" of atrace rules: the root of the trie of the
+    // prefixes that follow the "<pid>|" part of the message, or 0 (the root
+    // of the main trie can't be an atrace subtree).
+    uint32_t atrace_root = 0;
+  };
+  struct Edge {
+    char c;
+    uint32_t node;
   };
 
-  static bool RuleMatches(const Rule&, const char* start, size_t size);
+  // Walks the trie from |node| over the string, lowering |*best| to the
+  // index of the first rule that matches.
+  void Walk(uint32_t node,
+            const char* start,
+            const char* end,
+            uint32_t* best) const;
 
-  std::vector<Rule> rules_;
+  std::vector<Node> nodes_;
+  std::vector<Edge> edges_;
+  std::vector<bool> allow_;
 };
 
 class FtracePrintFilterConfig {
@@ -16,6 +16,8 @@
 
 #include "src/traced/probes/ftrace/ftrace_print_filter.h"
 
+#include <string>
+
 #include "protos/perfetto/config/ftrace/ftrace_config.gen.h"
 
 #include "test/gtest_and_gmock.h"
@@ -222,5 +224,45 @@ TEST(FtracePrintFilterTest, AtraceRuleMatches) {
   EXPECT_FALSE(filter.IsAllowed("C|111111|mycounter...", 21));
 }
 
+TEST(FtracePrintFilterTest, ManyRulesFirstMatchWins) {
+  FtraceConfig::PrintFilter conf;
+  auto add_prefix = [&conf](const char* prefix, bool allow) {
+    auto* rule = conf.add_rules();
+    rule->set_prefix(prefix);
+    rule->set_allow(allow);
+  };
+  auto add_atrace = [&conf](const char* type, const char* prefix,
+                            bool allow) {
+    auto* rule = conf.add_rules();
+    rule->mutable_atrace_msg()->set_type(type);
+    rule->mutable_atrace_msg()->set_prefix(prefix);
+    rule->set_allow(allow);
+  };
+  add_prefix("B|1|keep", true);
+  add_atrace("B", "drop", false);
+  add_prefix("B|", true);
+  add_atrace("C", "", false);
+  add_prefix("word", true);
+  add_prefix("wo", false);
+  add_prefix("word", false);
+  add_prefix("", true);
+  FtracePrintFilter filter(conf);
+
+  auto is_allowed = [&filter](const std::string& str) {
+    return filter.IsAllowed(str.c_str(), str.size() + 1);
+  };
+  EXPECT_TRUE(is_allowed("B|1|keep"));
+  EXPECT_FALSE(is_allowed("B|1|drop"));
+  EXPECT_FALSE(is_allowed("B|12|dropped"));
+  EXPECT_TRUE(is_allowed("B|12|other"));
+  EXPECT_TRUE(is_allowed("B|x|drop"));
+  EXPECT_FALSE(is_allowed("C|1|anything"));
+  EXPECT_TRUE(is_allowed("C|1"));
+  EXPECT_TRUE(is_allowed("words"));
+  EXPECT_FALSE(is_allowed("wor"));
+  EXPECT_TRUE(is_allowed("other"));
+  EXPECT_TRUE(is_allowed(""));
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -130,6 +130,34 @@ bool FtraceProcfs::SetSyscallFilter(const std::set<size_t>& filter) {
   return true;
 }
 
+bool FtraceProcfs::SetEventFilter(const std::string& group,
+                                  const std::string& name,
+                                  const std::string& filter) {
+  std::string path = root_ + "events/" + group + "/" + name + "/filter";
+  return WriteToFile(path, filter.empty() ? "0" : filter);
+}
+
+bool FtraceProcfs::SetEventPidFilter(const std::set<int32_t>& pids) {
+  // Writes to set_event_pid add to the list, which is only reset when the
+  // file is truncated.
+  std::string path = root_ + "set_event_pid";
+  if (!ClearFile(path))
+    return false;
+  std::string fork_path = root_ + "options/event-fork";
+  if (pids.empty())
+    return WriteToFile(fork_path, "0");
+
+  std::vector<std::string> parts;
+  for (int32_t pid : pids)
+    parts.push_back(std::to_string(pid));
+  if (!AppendToFile(path, base::Join(parts, " ")))
+    return false;
+  // Not available on older kernels, in which case the threads and children
+  // created by the targets are not traced.
+  WriteToFile(fork_path, "1");
+  return true;
+}
+
 bool FtraceProcfs::EnableEvent(const std::string& group,
                                const std::string& name) {
   std::string path = root_ + "events/" + group + "/" + name + "/enable";
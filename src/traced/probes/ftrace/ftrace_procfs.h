@@ -17,6 +17,7 @@
 #ifndef SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 #define SRC_TRACED_PROBES_FTRACE_FTRACE_PROCFS_H_
 
+#include <cstdint>
 #include <memory>
 #include <set>
 #include <string>
@@ -46,6 +47,16 @@ class FtraceProcfs {
   // Set the filter for syscall events. If empty, clear the filter.
   bool SetSyscallFilter(const std::set<size_t>& filter);
 
+  // Set the filter expression of the event with the given |group| and |name|.
+  // If empty, clear the filter.
+  bool SetEventFilter(const std::string& group,
+                      const std::string& name,
+                      const std::string& filter);
+
+  // Only record the events of the given thread ids (set_event_pid), and of
+  // the tasks they fork. If empty, clear the filter.
+  bool SetEventPidFilter(const std::set<int32_t>& pids);
+
   // Enable the event under with the given |group| and |name|.
   bool EnableEvent(const std::string& group, const std::string& name);
 
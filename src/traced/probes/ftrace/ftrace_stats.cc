@@ -26,6 +26,10 @@ void FtraceStats::Write(protos::pbzero::FtraceStats* writer) const {
   }
   writer->set_kernel_symbols_parsed(kernel_symbols_parsed);
   writer->set_kernel_symbols_mem_kb(kernel_symbols_mem_kb);
+  if (watermark_cpu_reads || watermark_cpu_reads_skipped) {
+    writer->set_watermark_cpu_reads(watermark_cpu_reads);
+    writer->set_watermark_cpu_reads_skipped(watermark_cpu_reads_skipped);
+  }
   if (!setup_errors.atrace_errors.empty())
     writer->set_atrace_errors(setup_errors.atrace_errors);
   for (const std::string& err : setup_errors.unknown_ftrace_events)
@@ -55,6 +55,8 @@ struct FtraceStats {
   FtraceSetupErrors setup_errors;
   uint32_t kernel_symbols_parsed = 0;
   uint32_t kernel_symbols_mem_kb = 0;
+  uint64_t watermark_cpu_reads = 0;
+  uint64_t watermark_cpu_reads_skipped = 0;
 
   void Write(protos::pbzero::FtraceStats*) const;
 };
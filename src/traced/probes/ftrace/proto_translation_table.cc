@@ -407,6 +407,95 @@ ProtoTranslationTable::DefaultPageHeaderSpecForTesting() {
   return MakeFtracePageHeaderSpec(page_header_fields);
 }
 
+std::optional<EventProgram> CompileEventProgram(const Event& event) {
+  EventProgram program;
+  program.varints_only = event.fields.size() <= EventProgram::kMaxVarIntOps;
+  program.ops.reserve(event.fields.size());
+  for (const Field& field : event.fields) {
+    FieldOp::Op op;
+    switch (field.strategy) {
+      case kUint8ToUint32:
+      case kUint8ToUint64:
+      case kBoolToUint32:
+      case kBoolToUint64:
+        op = FieldOp::kUint8;
+        break;
+      case kUint16ToUint32:
+      case kUint16ToUint64:
+        op = FieldOp::kUint16;
+        break;
+      case kUint32ToUint32:
+      case kUint32ToUint64:
+        op = FieldOp::kUint32;
+        break;
+      case kUint64ToUint64:
+        op = FieldOp::kUint64;
+        break;
+      case kInt8ToInt32:
+      case kInt8ToInt64:
+        op = FieldOp::kInt8;
+        break;
+      case kInt16ToInt32:
+      case kInt16ToInt64:
+        op = FieldOp::kInt16;
+        break;
+      case kInt32ToInt32:
+      case kInt32ToInt64:
+        op = FieldOp::kInt32;
+        break;
+      case kInt64ToInt64:
+        op = FieldOp::kInt64;
+        break;
+      case kInode32ToUint64:
+        op = FieldOp::kInode32;
+        break;
+      case kInode64ToUint64:
+        op = FieldOp::kInode64;
+        break;
+      case kPid32ToInt32:
+      case kPid32ToInt64:
+        op = FieldOp::kPid32;
+        break;
+      case kCommonPid32ToInt32:
+      case kCommonPid32ToInt64:
+        op = FieldOp::kCommonPid32;
+        break;
+      case kDevId32ToUint64:
+        op = FieldOp::kDevId32;
+        break;
+      case kDevId64ToUint64:
+        op = FieldOp::kDevId64;
+        break;
+      case kFtraceSymAddr64ToUint64:
+        op = FieldOp::kSymAddr64;
+        break;
+      case kFixedCStringToString:
+        op = FieldOp::kFixedCString;
+        break;
+      case kCStringToString:
+        op = FieldOp::kCString;
+        break;
+      case kStringPtrToString:
+        op = FieldOp::kStringPtr;
+        break;
+      case kDataLocToString:
+        if (field.ftrace_size != 4)
+          return std::nullopt;
+        op = FieldOp::kDataLoc;
+        break;
+      case kInvalidTranslationStrategy:
+        return std::nullopt;
+    }
+    if (op >= FieldOp::kFixedCString)
+      program.varints_only = false;
+    program.ops.push_back(
+        FieldOp{field.ftrace_offset, field.ftrace_size, op,
+                field.proto_field_id,
+                protozero::proto_utils::MakeTagVarInt(field.proto_field_id)});
+  }
+  return program;
+}
+
 // static
 std::unique_ptr<ProtoTranslationTable> ProtoTranslationTable::Create(
     const FtraceProcfs* ftrace_procfs,
@@ -522,12 +611,16 @@ ProtoTranslationTable::ProtoTranslationTable(
       common_fields_(std::move(common_fields)),
       ftrace_page_header_spec_(ftrace_page_header_spec),
       compact_sched_format_(compact_sched_format),
+      compact_encodable_(events_.size()),
+      programs_(events_.size()),
       printk_formats_(printk_formats) {
   for (const Event& event : events) {
     group_and_name_to_event_[GroupAndName(event.group, event.name)] =
         &events_.at(event.ftrace_event_id);
     name_to_events_[event.name].push_back(&events_.at(event.ftrace_event_id));
     group_to_events_[event.group].push_back(&events_.at(event.ftrace_event_id));
+    compact_encodable_[event.ftrace_event_id] = IsEventCompactEncodable(event);
+    programs_[event.ftrace_event_id] = CompileEventProgram(event);
   }
   for (const Field& field : common_fields_) {
     if (field.proto_field_id == protos::pbzero::FtraceEvent::kPidFieldNumber) {
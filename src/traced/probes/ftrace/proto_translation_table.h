@@ -78,6 +78,58 @@ bool InferFtraceType(const std::string& type_and_name,
                      bool is_signed,
                      FtraceFieldType* out);
 
+// A single step of an EventProgram: translates the field at |offset| into
+// the proto field |proto_field_id|. The TranslationStrategy values that only
+// differ by the type of the proto field collapse into the same |op|.
+struct FieldOp {
+  enum Op : uint8_t {
+    kUint8,
+    kUint16,
+    kUint32,
+    kUint64,
+    kInt8,
+    kInt16,
+    kInt32,
+    kInt64,
+    kInode32,
+    kInode64,
+    kPid32,
+    kCommonPid32,
+    kDevId32,
+    kDevId64,
+    kSymAddr64,
+    kFixedCString,
+    kCString,
+    kStringPtr,
+    kDataLoc,
+  };
+
+  uint16_t offset;
+  uint16_t size;
+  Op op;
+  uint32_t proto_field_id;
+  // MakeTagVarInt(proto_field_id), unused by the string ops.
+  uint32_t tag;
+};
+
+// The fields of an event, compiled by the ProtoTranslationTable into a flat
+// list of ops that CpuReader runs for each event, instead of dispatching on
+// the TranslationStrategy of each Field.
+struct EventProgram {
+  // Upper bound of the ops of the programs that only write varints.
+  static constexpr size_t kMaxVarIntOps = 16;
+
+  std::vector<FieldOp> ops;
+  // True if all the ops write varints (no strings) and there are at most
+  // |kMaxVarIntOps| of them: CpuReader then serializes the whole event into
+  // a stack buffer, without bounds checks, and writes it at once.
+  bool varints_only = false;
+};
+
+// Returns the program of |event|, or std::nullopt if one of its fields
+// doesn't have a valid translation strategy.
+std::optional<EventProgram> CompileEventProgram(const Event& event);
+
 class ProtoTranslationTable {
  public:
   struct FtracePageHeaderSpec {
@@ -144,7 +196,7 @@ class ProtoTranslationTable {
     return group_and_name_to_event_.at(group_and_name)->ftrace_event_id;
   }
 
-  const std::deque<Event>& events() { return events_; }
+  const std::deque<Event>& events() const { return events_; }
   const FtracePageHeaderSpec& ftrace_page_header_spec() const {
     return ftrace_page_header_spec_;
   }
@@ -174,6 +226,21 @@ class ProtoTranslationTable {
     return compact_sched_format_;
   }
 
+  // Returns true if the event with the given id can be encoded in the compact
+  // format for events with fixed-width fields (see IsEventCompactEncodable()).
+  bool IsCompactEncodable(size_t id) const {
+    return id < compact_encodable_.size() && compact_encodable_[id];
+  }
+
+  // Returns the compiled fields of the event with the given id, or nullptr if
+  // the event was created at runtime by GetOrCreateEvent() (generic events
+  // are parsed field by field), or couldn't be compiled.
+  const EventProgram* GetEventProgram(size_t id) const {
+    if (id >= programs_.size() || !programs_[id].has_value())
+      return nullptr;
+    return &programs_[id].value();
+  }
+
   base::StringView LookupTraceString(uint64_t address) const {
     return printk_formats_.at(address);
   }
@@ -199,6 +266,11 @@ class ProtoTranslationTable {
   FtracePageHeaderSpec ftrace_page_header_spec_{};
   std::set<std::string> interned_strings_;
   CompactSchedEventFormat compact_sched_format_;
+  // Indexed by ftrace event id. Events created at runtime by
+  // GetOrCreateEvent() are generic, so never compact encodable.
+  std::vector<bool> compact_encodable_;
+  // Indexed by ftrace event id, compiled once when the table is created.
+  std::vector<std::optional<EventProgram>> programs_;
   PrintkMap printk_formats_;
 };
 
@@ -526,6 +526,53 @@ print fmt: "some format")"));
   EXPECT_EQ(uint_field.ftrace_offset, 33);
 }
 
+TEST(TranslationTableTest, CompileEventProgram) {
+  auto add_field = [](Event* event, uint16_t offset, uint16_t size,
+                      TranslationStrategy strategy) {
+    Field field{};
+    field.ftrace_offset = offset;
+    field.ftrace_size = size;
+    field.proto_field_id = static_cast<uint32_t>(event->fields.size() + 1);
+    field.strategy = strategy;
+    event->fields.push_back(field);
+  };
+
+  Event ints{};
+  add_field(&ints, 8, 4, kUint32ToUint64);
+  add_field(&ints, 12, 1, kBoolToUint32);
+  add_field(&ints, 16, 4, kPid32ToInt32);
+  std::optional<EventProgram> program = CompileEventProgram(ints);
+  ASSERT_TRUE(program.has_value());
+  EXPECT_TRUE(program->varints_only);
+  ASSERT_EQ(program->ops.size(), 3u);
+  EXPECT_EQ(program->ops[0].op, FieldOp::kUint32);
+  EXPECT_EQ(program->ops[0].offset, 8u);
+  EXPECT_EQ(program->ops[0].tag, (1u << 3));
+  EXPECT_EQ(program->ops[1].op, FieldOp::kUint8);
+  EXPECT_EQ(program->ops[2].op, FieldOp::kPid32);
+  EXPECT_EQ(program->ops[2].proto_field_id, 3u);
+
+  // Strings are written directly into the message.
+  Event strings = ints;
+  add_field(&strings, 20, 4, kDataLocToString);
+  program = CompileEventProgram(strings);
+  ASSERT_TRUE(program.has_value());
+  EXPECT_FALSE(program->varints_only);
+  EXPECT_EQ(program->ops.back().op, FieldOp::kDataLoc);
+
+  // Too many fields for the stack buffer of the varints only programs.
+  Event many_ints{};
+  for (uint16_t i = 0; i <= EventProgram::kMaxVarIntOps; i++)
+    add_field(&many_ints, static_cast<uint16_t>(8 + i * 8), 8, kInt64ToInt64);
+  program = CompileEventProgram(many_ints);
+  ASSERT_TRUE(program.has_value());
+  EXPECT_FALSE(program->varints_only);
+
+  Event invalid = ints;
+  add_field(&invalid, 20, 4, kInvalidTranslationStrategy);
+  EXPECT_FALSE(CompileEventProgram(invalid).has_value());
+}
+
 TEST(EventFilterTest, EnableEventsFrom) {
   EventFilter filter;
   filter.AddEnabledEvent(1);
@@ -16,6 +16,12 @@
 
 #include "src/traced/probes/packages_list/packages_list_data_source.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 
@@ -28,6 +34,28 @@ using perfetto::protos::pbzero::PackagesListConfig;
 
 namespace perfetto {
 
+namespace {
+
+constexpr uint32_t kMinPollMs = 100;
+
+void WritePackage(protos::pbzero::PackagesList::PackageInfo* package,
+                  const Package& pkg) {
+  package->set_name(pkg.name.c_str(), pkg.name.size());
+  package->set_uid(pkg.uid);
+  package->set_debuggable(pkg.debuggable);
+  package->set_profileable_from_shell(pkg.profileable_from_shell);
+  package->set_version_code(pkg.version_code);
+}
+
+// Whether the fields written by WritePackage() are the same.
+bool SameWrittenFields(const Package& a, const Package& b) {
+  return a.uid == b.uid && a.debuggable == b.debuggable &&
+         a.profileable_from_shell == b.profileable_from_shell &&
+         a.version_code == b.version_code;
+}
+
+}  // namespace
+
 // static
 const ProbesDataSource::Descriptor PackagesListDataSource::descriptor = {
     /*name*/ "android.packages_list",
@@ -50,54 +78,150 @@ bool ParsePackagesListStream(protos::pbzero::PackagesList* packages_list_packet,
         package_name_filter.count(pkg_struct.name) == 0) {
       continue;
     }
-    auto* package = packages_list_packet->add_packages();
-    package->set_name(pkg_struct.name.c_str(), pkg_struct.name.size());
-    package->set_uid(pkg_struct.uid);
-    package->set_debuggable(pkg_struct.debuggable);
-    package->set_profileable_from_shell(pkg_struct.profileable_from_shell);
-    package->set_version_code(pkg_struct.version_code);
+    WritePackage(packages_list_packet->add_packages(), pkg_struct);
   }
   return parsed_fully;
 }
 
+PackagesListCache::PackagesListCache(std::string path)
+    : path_(std::move(path)) {}
+
+PackagesListCache::~PackagesListCache() = default;
+
+std::shared_ptr<const PackagesListCache::Snapshot> PackagesListCache::Get() {
+  base::ScopedFile fd = base::OpenFile(path_, O_RDONLY);
+  struct stat st;
+  if (!fd || fstat(*fd, &st) != 0) {
+    PERFETTO_ELOG("Failed to open packages.list");
+    return nullptr;
+  }
+  FileKey key;
+  key.dev = st.st_dev;
+  key.ino = st.st_ino;
+  key.size = st.st_size;
+  key.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+                 static_cast<int64_t>(st.st_mtim.tv_nsec);
+  if (snapshot_ && key == key_)
+    return snapshot_;
+
+  std::string contents;
+  if (!base::ReadFileDescriptor(*fd, &contents)) {
+    PERFETTO_ELOG("Failed to read packages.list");
+    return nullptr;
+  }
+  auto snapshot = std::make_shared<Snapshot>();
+  for (base::StringSplitter ss(std::move(contents), '\n'); ss.Next();) {
+    Package pkg;
+    if (!ReadPackagesListLine(ss.cur_token(), &pkg)) {
+      snapshot->parse_error = true;
+      continue;
+    }
+    snapshot->packages.emplace_back(std::move(pkg));
+  }
+  std::sort(snapshot->packages.begin(), snapshot->packages.end(),
+            [](const Package& a, const Package& b) { return a.name < b.name; });
+  key_ = key;
+  snapshot_ = std::move(snapshot);
+  return snapshot_;
+}
+
 PackagesListDataSource::PackagesListDataSource(
     const DataSourceConfig& ds_config,
+    base::TaskRunner* task_runner,
     TracingSessionID session_id,
-    std::unique_ptr<TraceWriter> writer)
-    : ProbesDataSource(session_id, &descriptor), writer_(std::move(writer)) {
+    std::unique_ptr<TraceWriter> writer,
+    PackagesListCache* cache)
+    : ProbesDataSource(session_id, &descriptor),
+      task_runner_(task_runner),
+      cache_(cache),
+      writer_(std::move(writer)),
+      weak_factory_(this) {
   PackagesListConfig::Decoder cfg(ds_config.packages_list_config_raw());
   for (auto name = cfg.package_name_filter(); name; ++name) {
     package_name_filter_.emplace((*name).ToStdString());
   }
+  if (cfg.poll_ms())
+    poll_ms_ = std::max(cfg.poll_ms(), kMinPollMs);
 }
 
 void PackagesListDataSource::Start() {
-  base::ScopedFstream fs(fopen("/data/system/packages.list", "r"));
-  auto trace_packet = writer_->NewTracePacket();
-  auto* packages_list_packet = trace_packet->set_packages_list();
-  if (!fs) {
-    PERFETTO_ELOG("Failed to open packages.list");
-    packages_list_packet->set_read_error(true);
+  last_snapshot_ = cache_->Get();
+  if (last_snapshot_) {
+    WritePackages(nullptr, *last_snapshot_);
+  } else {
+    auto trace_packet = writer_->NewTracePacket();
+    trace_packet->set_packages_list()->set_read_error(true);
     trace_packet->Finalize();
     writer_->Flush();
-    return;
   }
+  if (poll_ms_)
+    PostTick();
+}
 
-  bool parsed_fully =
-      ParsePackagesListStream(packages_list_packet, fs, package_name_filter_);
-  if (!parsed_fully)
-    packages_list_packet->set_parse_error(true);
+void PackagesListDataSource::PostTick() {
+  auto weak_this = weak_factory_.GetWeakPtr();
+  task_runner_->PostDelayedTask(
+      [weak_this] {
+        if (weak_this)
+          weak_this->Tick();
+      },
+      poll_ms_);
+}
+
+void PackagesListDataSource::Tick() {
+  PostTick();
+  std::shared_ptr<const Snapshot> snapshot = cache_->Get();
+  // Keep the last snapshot if the file can't be read temporarily.
+  if (!snapshot || snapshot == last_snapshot_)
+    return;
+  WritePackages(last_snapshot_.get(), *snapshot);
+  last_snapshot_ = std::move(snapshot);
+}
 
-  if (ferror(*fs))
-    packages_list_packet->set_read_error(true);
+void PackagesListDataSource::WritePackages(const Snapshot* prev,
+                                           const Snapshot& cur) {
+  // Both lists are sorted by name: walk them side by side.
+  std::vector<const Package*> changed;
+  std::vector<const std::string*> removed;
+  const Package* prev_it = prev ? prev->packages.data() : nullptr;
+  const Package* prev_end = prev ? prev_it + prev->packages.size() : nullptr;
+  for (const Package& pkg : cur.packages) {
+    for (; prev_it != prev_end && prev_it->name < pkg.name; prev_it++) {
+      if (!IsFilteredOut(prev_it->name))
+        removed.push_back(&prev_it->name);
+    }
+    bool unchanged = false;
+    if (prev_it != prev_end && prev_it->name == pkg.name) {
+      unchanged = SameWrittenFields(*prev_it, pkg);
+      prev_it++;
+    }
+    if (!unchanged && !IsFilteredOut(pkg.name))
+      changed.push_back(&pkg);
+  }
+  for (; prev_it != prev_end; prev_it++) {
+    if (!IsFilteredOut(prev_it->name))
+      removed.push_back(&prev_it->name);
+  }
+  if (prev && changed.empty() && removed.empty())
+    return;
 
+  auto trace_packet = writer_->NewTracePacket();
+  auto* packages_list_packet = trace_packet->set_packages_list();
+  if (prev)
+    packages_list_packet->set_incremental(true);
+  for (const Package* pkg : changed)
+    WritePackage(packages_list_packet->add_packages(), *pkg);
+  for (const std::string* name : removed)
+    packages_list_packet->add_removed_packages(*name);
+  if (cur.parse_error)
+    packages_list_packet->set_parse_error(true);
   trace_packet->Finalize();
   writer_->Flush();
 }
 
 void PackagesListDataSource::Flush(FlushRequestID,
                                    std::function<void()> callback) {
-  // Flush is no-op. We flush after the first write.
+  // Flush is no-op. We flush after each write.
   callback();
 }
 
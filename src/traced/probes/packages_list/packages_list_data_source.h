@@ -17,18 +17,24 @@
 #ifndef SRC_TRACED_PROBES_PACKAGES_LIST_PACKAGES_LIST_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_PACKAGES_LIST_PACKAGES_LIST_DATA_SOURCE_H_
 
+#include <sys/types.h>
+
 #include <functional>
 #include <memory>
 #include <set>
+#include <string>
+#include <vector>
 
 #include "perfetto/base/task_runner.h"
 #include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/weak_ptr.h"
 
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "protos/perfetto/config/android/packages_list_config.pbzero.h"
 #include "protos/perfetto/trace/android/packages_list.pbzero.h"
 
+#include "src/traced/probes/packages_list/packages_list_parser.h"
 #include "src/traced/probes/probes_data_source.h"
 
 namespace perfetto {
@@ -39,25 +45,89 @@ bool ParsePackagesListStream(protos::pbzero::PackagesList* packages_list,
                              const base::ScopedFstream& fs,
                              const std::set<std::string>& package_name_filter);
 
+// The last parse of packages.list, shared by the data sources of all the
+// tracing sessions. The file is only parsed again when its inode, size or
+// mtime changed: the package manager replaces it atomically (rename) on each
+// update, so a new inode is enough to notice the changes in practice.
+class PackagesListCache {
+ public:
+  struct Snapshot {
+    std::vector<Package> packages;  // Sorted by name.
+    bool parse_error = false;
+  };
+
+  explicit PackagesListCache(
+      std::string path = "/data/system/packages.list");
+  ~PackagesListCache();
+
+  // Returns the packages currently in the file, or nullptr if it can't be
+  // read. Returns the same snapshot as the previous call if the file didn't
+  // change since then.
+  std::shared_ptr<const Snapshot> Get();
+
+ private:
+  struct FileKey {
+    dev_t dev = 0;
+    ino_t ino = 0;
+    off_t size = 0;
+    int64_t mtime_ns = 0;
+
+    bool operator==(const FileKey& o) const {
+      return dev == o.dev && ino == o.ino && size == o.size &&
+             mtime_ns == o.mtime_ns;
+    }
+  };
+
+  const std::string path_;
+  FileKey key_;
+  std::shared_ptr<const Snapshot> snapshot_;
+};
+
 class PackagesListDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
   PackagesListDataSource(const DataSourceConfig& ds_config,
+                         base::TaskRunner* task_runner,
                          TracingSessionID session_id,
-                         std::unique_ptr<TraceWriter> writer);
+                         std::unique_ptr<TraceWriter> writer,
+                         PackagesListCache* cache);
   // ProbesDataSource implementation.
   void Start() override;
   void Flush(FlushRequestID, std::function<void()> callback) override;
 
   ~PackagesListDataSource() override;
 
+  // Emits the packages that changed since the previous packet, if any, and
+  // posts the next call. Called every |poll_ms_|, only if set. Public for
+  // testing.
+  void Tick();
+
  private:
+  using Snapshot = PackagesListCache::Snapshot;
+
+  void PostTick();
+
+  // Writes a packet with the packages of |cur|, or only with the differences
+  // from |prev| if not null (skipping the packet if there are none).
+  void WritePackages(const Snapshot* prev, const Snapshot& cur);
+  bool IsFilteredOut(const std::string& name) const {
+    return !package_name_filter_.empty() &&
+           package_name_filter_.count(name) == 0;
+  }
+
+  base::TaskRunner* const task_runner_;
+  PackagesListCache* const cache_;
+  uint32_t poll_ms_ = 0;
+  // The snapshot that was last emitted.
+  std::shared_ptr<const Snapshot> last_snapshot_;
+
   // If empty, include all package names. std::set over std::unordered_set as
   // this should be trivially small (or empty) in practice, and the latter uses
   // ever so slightly more memory.
   std::set<std::string> package_name_filter_;
   std::unique_ptr<TraceWriter> writer_;
+  base::WeakPtrFactory<PackagesListDataSource> weak_factory_;  // Keep last.
 };
 
 }  // namespace perfetto
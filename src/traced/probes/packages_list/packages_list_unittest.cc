@@ -21,16 +21,43 @@
 #include <set>
 #include <string>
 
+#include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/pipe.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/protozero/scattered_heap_buffer.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "protos/perfetto/config/android/packages_list_config.gen.h"
 #include "protos/perfetto/trace/android/packages_list.gen.h"
 #include "protos/perfetto/trace/android/packages_list.pbzero.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+#include "src/base/test/test_task_runner.h"
 #include "src/traced/probes/packages_list/packages_list_parser.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
 namespace {
 
+using ::testing::ElementsAre;
+
+// Replaces |path| with |contents|, like the package manager does.
+void ReplaceFile(const std::string& path, const std::string& contents) {
+  std::string tmp_path = path + ".tmp";
+  base::ScopedFile fd(
+      base::OpenFile(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  PERFETTO_CHECK(base::WriteAll(*fd, contents.data(), contents.size()) ==
+                 static_cast<ssize_t>(contents.size()));
+  PERFETTO_CHECK(rename(tmp_path.c_str(), path.c_str()) == 0);
+}
+
+std::vector<std::string> Names(
+    const std::vector<protos::gen::PackagesList::PackageInfo>& packages) {
+  std::vector<std::string> names;
+  for (const auto& package : packages)
+    names.push_back(package.name());
+  return names;
+}
+
 TEST(PackagesListDataSourceTest, ParseLineNonProfileNonDebug) {
   char kLine[] =
       "com.test.app 1234 0 /data/user/0/com.test.app "
@@ -151,5 +178,86 @@ TEST(PackagesListDataSourceTest, NameFilter) {
   EXPECT_EQ(parsed_list.packages()[1].version_code(), 30);
 }
 
+TEST(PackagesListDataSourceTest, CacheParsesOnlyChangedFile) {
+  base::TempDir dir = base::TempDir::Create();
+  std::string path = dir.path() + "/packages.list";
+  PackagesListCache cache(path);
+  EXPECT_EQ(cache.Get(), nullptr);
+
+  ReplaceFile(path,
+              "com.test.two 1001 0 /data/user/0/com.test.two "
+              "default:targetSdkVersion=10 none 0 20\n"
+              "com.test.one 1000 0 /data/user/0/com.test.one "
+              "default:targetSdkVersion=10 none 0 10\n");
+  auto snapshot = cache.Get();
+  ASSERT_NE(snapshot, nullptr);
+  EXPECT_FALSE(snapshot->parse_error);
+  ASSERT_EQ(snapshot->packages.size(), 2u);
+  EXPECT_EQ(snapshot->packages[0].name, "com.test.one");
+  EXPECT_EQ(snapshot->packages[1].name, "com.test.two");
+  EXPECT_EQ(cache.Get(), snapshot);
+
+  ReplaceFile(path,
+              "com.test.one 1000 0 /data/user/0/com.test.one "
+              "default:targetSdkVersion=10 none 0 11\n"
+              "com.test.bad uid\n");
+  auto new_snapshot = cache.Get();
+  ASSERT_NE(new_snapshot, nullptr);
+  EXPECT_NE(new_snapshot, snapshot);
+  EXPECT_TRUE(new_snapshot->parse_error);
+  ASSERT_EQ(new_snapshot->packages.size(), 1u);
+  EXPECT_EQ(new_snapshot->packages[0].version_code, 11);
+
+  remove(path.c_str());
+}
+
+TEST(PackagesListDataSourceTest, IncrementalPackets) {
+  base::TempDir dir = base::TempDir::Create();
+  std::string path = dir.path() + "/packages.list";
+  ReplaceFile(path,
+              "com.test.one 1000 0 /data/user/0/com.test.one "
+              "default:targetSdkVersion=10 none 0 10\n"
+              "com.test.two 1001 0 /data/user/0/com.test.two "
+              "default:targetSdkVersion=10 none 0 20\n"
+              "com.test.three 1002 0 /data/user/0/com.test.three "
+              "default:targetSdkVersion=10 none 0 30\n");
+
+  base::TestTaskRunner task_runner;
+  PackagesListCache cache(path);
+  protos::gen::PackagesListConfig cfg;
+  cfg.set_poll_ms(1000);
+  DataSourceConfig ds_config;
+  ds_config.set_packages_list_config_raw(cfg.SerializeAsString());
+  auto writer = std::make_unique<TraceWriterForTesting>();
+  TraceWriterForTesting* writer_raw = writer.get();
+  PackagesListDataSource data_source(ds_config, &task_runner, 0,
+                                     std::move(writer), &cache);
+  data_source.Start();
+  data_source.Tick();  // Nothing changed.
+  ReplaceFile(path,
+              "com.test.four 1003 0 /data/user/0/com.test.four "
+              "default:targetSdkVersion=10 none 0 40\n"
+              "com.test.one 1000 0 /data/user/0/com.test.one "
+              "default:targetSdkVersion=10 none 0 10\n"
+              "com.test.three 1002 0 /data/user/0/com.test.three "
+              "default:targetSdkVersion=10 none 0 31\n");
+  data_source.Tick();
+
+  auto packets = writer_raw->GetAllTracePackets();
+  ASSERT_EQ(packets.size(), 2u);
+  const auto& full = packets[0].packages_list();
+  EXPECT_FALSE(full.incremental());
+  EXPECT_THAT(Names(full.packages()),
+              ElementsAre("com.test.one", "com.test.three", "com.test.two"));
+  const auto& incremental = packets[1].packages_list();
+  EXPECT_TRUE(incremental.incremental());
+  EXPECT_THAT(Names(incremental.packages()),
+              ElementsAre("com.test.four", "com.test.three"));
+  EXPECT_EQ(incremental.packages()[1].version_code(), 31);
+  EXPECT_THAT(incremental.removed_packages(), ElementsAre("com.test.two"));
+
+  remove(path.c_str());
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -17,7 +17,10 @@
 #include "src/traced/probes/power/linux_power_sysfs_data_source.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <unistd.h>
+
 #include <optional>
 
 #include "perfetto/base/logging.h"
@@ -26,6 +29,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/tracing/core/data_source_config.h"
@@ -38,11 +42,21 @@ namespace perfetto {
 namespace {
 constexpr uint32_t kDefaultPollIntervalMs = 1000;
 
-std::optional<int64_t> ReadFileAsInt64(std::string path) {
-  std::string buf;
-  if (!base::ReadFile(path, &buf))
+// Reads the integer in the sysfs file |path| without allocating, as the files
+// are read on every poll.
+std::optional<int64_t> ReadFileAsInt64(const char* path) {
+  base::ScopedFile fd = base::OpenFile(path, O_RDONLY);
+  if (!fd)
+    return std::nullopt;
+  char buf[32];
+  ssize_t rsize = PERFETTO_EINTR(read(*fd, buf, sizeof(buf) - 1));
+  if (rsize <= 0)
     return std::nullopt;
-  return base::StringToInt64(base::StripSuffix(buf, "\n"));
+  size_t len = static_cast<size_t>(rsize);
+  if (buf[len - 1] == '\n')
+    len--;
+  buf[len] = '\0';
+  return base::CStringToInt64(buf);
 }
 }  // namespace
 
@@ -79,49 +93,47 @@ size_t LinuxPowerSysfsDataSource::BatteryInfo::num_batteries() const {
 std::optional<int64_t>
 LinuxPowerSysfsDataSource::BatteryInfo::GetChargeCounterUah(
     size_t battery_idx) {
-  PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/charge_now");
+  return ReadBatteryFile(battery_idx, "charge_now");
 }
 
 std::optional<int64_t>
 LinuxPowerSysfsDataSource::BatteryInfo::GetEnergyCounterUah(
     size_t battery_idx) {
-  PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/energy_now");
+  return ReadBatteryFile(battery_idx, "energy_now");
 }
 
 std::optional<int64_t> LinuxPowerSysfsDataSource::BatteryInfo::GetVoltageUv(
     size_t battery_idx) {
-  PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/voltage_now");
+  return ReadBatteryFile(battery_idx, "voltage_now");
 }
 
 std::optional<int64_t>
 LinuxPowerSysfsDataSource::BatteryInfo::GetCapacityPercent(size_t battery_idx) {
-  PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/capacity");
+  return ReadBatteryFile(battery_idx, "capacity");
 }
 
 std::optional<int64_t> LinuxPowerSysfsDataSource::BatteryInfo::GetCurrentNowUa(
     size_t battery_idx) {
-  PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/current_now");
+  return ReadBatteryFile(battery_idx, "current_now");
 }
 
 std::optional<int64_t>
 LinuxPowerSysfsDataSource::BatteryInfo::GetAverageCurrentUa(
     size_t battery_idx) {
+  return ReadBatteryFile(battery_idx, "current_avg");
+}
+
+std::optional<int64_t> LinuxPowerSysfsDataSource::BatteryInfo::ReadBatteryFile(
+    size_t battery_idx,
+    const char* name) {
   PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
-  return ReadFileAsInt64(power_supply_dir_path_ + "/" +
-                         sysfs_battery_subdirs_[battery_idx] + "/current_avg");
+  base::StackString<256> path("%s/%s/%s", power_supply_dir_path_.c_str(),
+                              sysfs_battery_subdirs_[battery_idx].c_str(),
+                              name);
+  return ReadFileAsInt64(path.c_str());
 }
 
-std::string LinuxPowerSysfsDataSource::BatteryInfo::GetBatteryName(
+const std::string& LinuxPowerSysfsDataSource::BatteryInfo::GetBatteryName(
     size_t battery_idx) {
   PERFETTO_CHECK(battery_idx < sysfs_battery_subdirs_.size());
   return sysfs_battery_subdirs_[battery_idx];
@@ -196,8 +208,10 @@ void LinuxPowerSysfsDataSource::WriteBatteryCounters() {
     if (value)
       counters_proto->set_voltage_uv(*value);
     // On systems with multiple batteries, disambiguate with battery names.
-    if (battery_info_->num_batteries() > 1)
-      counters_proto->set_name(battery_info_->GetBatteryName(battery_idx));
+    if (battery_info_->num_batteries() > 1) {
+      const std::string& name = battery_info_->GetBatteryName(battery_idx);
+      counters_proto->set_name(name.data(), name.size());
+    }
   }
 }
 
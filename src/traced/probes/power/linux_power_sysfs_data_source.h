@@ -58,11 +58,15 @@ class LinuxPowerSysfsDataSource : public ProbesDataSource {
     std::optional<int64_t> GetAverageCurrentUa(size_t battery_idx);
 
     // Name of the battery.
-    std::string GetBatteryName(size_t battery_idx);
+    const std::string& GetBatteryName(size_t battery_idx);
 
     size_t num_batteries() const;
 
    private:
+    // Reads <power_supply_dir_path>/<battery subdir>/<name> as an integer.
+    std::optional<int64_t> ReadBatteryFile(size_t battery_idx,
+                                           const char* name);
+
     std::string power_supply_dir_path_;
     // The subdirectories that contain info of a battery power supply, e.g.
     // BAT0.
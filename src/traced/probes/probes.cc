@@ -28,6 +28,7 @@
 #include "perfetto/ext/traced/traced.h"
 #include "perfetto/tracing/default_socket.h"
 
+#include "src/kallsyms/lazy_kernel_symbolizer.h"
 #include "src/traced/probes/ftrace/ftrace_procfs.h"
 #include "src/traced/probes/kmem_activity_trigger.h"
 #include "src/traced/probes/probes_producer.h"
@@ -40,6 +41,7 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
     OPT_VERSION,
     OPT_BACKGROUND,
     OPT_RESET_FTRACE,
+    OPT_KALLSYMS_CACHE,
   };
 
   bool background = false;
@@ -49,6 +51,7 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
       {"background", no_argument, nullptr, OPT_BACKGROUND},
       {"cleanup-after-crash", no_argument, nullptr, OPT_CLEANUP_AFTER_CRASH},
       {"reset-ftrace", no_argument, nullptr, OPT_RESET_FTRACE},
+      {"kallsyms-cache", required_argument, nullptr, OPT_KALLSYMS_CACHE},
       {"version", no_argument, nullptr, OPT_VERSION},
       {nullptr, 0, nullptr, 0}};
 
@@ -69,6 +72,10 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         // This is like --cleanup-after-crash but doesn't quit.
         reset_ftrace = true;
         break;
+      case OPT_KALLSYMS_CACHE:
+        // Points into argv, which outlives the process' tracing.
+        LazyKernelSymbolizer::g_cache_file = optarg;
+        break;
       case OPT_VERSION:
         printf("%s\n", base::GetVersionString());
         return 0;
@@ -76,7 +83,7 @@ int PERFETTO_EXPORT_ENTRYPOINT ProbesMain(int argc, char** argv) {
         fprintf(
             stderr,
             "Usage: %s [--background] [--reset-ftrace] [--cleanup-after-crash] "
-            "[--version]\n",
+            "[--kallsyms-cache=FILE] [--version]\n",
             argv[0]);
         return 1;
     }
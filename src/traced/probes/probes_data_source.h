@@ -35,6 +35,11 @@ class ProbesDataSource {
     enum Flags : uint32_t {
       kFlagsNone = 0,
       kHandlesIncrementalState = 1 << 0,
+      // |fill_descriptor_func| is slow (e.g. it runs a subprocess): the data
+      // source is registered without it and its descriptor is updated once
+      // filled on a background thread, not to delay the registration of all
+      // the data sources.
+      kFillDescriptorAsync = 1 << 1,
     };
     const char* const name;
     uint32_t flags;
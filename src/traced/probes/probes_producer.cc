@@ -105,6 +105,12 @@ void ProbesProducer::Restart() {
   ConnectWithRetries(socket_name, task_runner);
 }
 
+std::unique_ptr<CpuFreqInfo> ProbesProducer::CreateCpuFreqInfo() {
+  if (!cpu_freq_info_ || cpu_freq_info_->IsStale())
+    cpu_freq_info_.reset(new CpuFreqInfo());
+  return cpu_freq_info_->Clone();
+}
+
 template <>
 std::unique_ptr<ProbesDataSource>
 ProbesProducer::CreateDSInstance<FtraceDataSource>(
@@ -134,6 +140,10 @@ ProbesProducer::CreateDSInstance<FtraceDataSource>(
   std::unique_ptr<FtraceDataSource> data_source(new FtraceDataSource(
       ftrace_->GetWeakPtr(), session_id, std::move(ftrace_config),
       endpoint_->CreateTraceWriter(buffer_id)));
+  // Used when the buffers are read by more than one thread, see
+  // FtraceConfig.reader_threads.
+  data_source->set_trace_writer_factory(
+      [this, buffer_id] { return endpoint_->CreateTraceWriter(buffer_id); });
   if (!ftrace_->AddDataSource(data_source.get())) {
     PERFETTO_ELOG("Failed to setup ftrace");
     return nullptr;
@@ -218,7 +228,8 @@ ProbesProducer::CreateDSInstance<PackagesListDataSource>(
     const DataSourceConfig& config) {
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<ProbesDataSource>(new PackagesListDataSource(
-      config, session_id, endpoint_->CreateTraceWriter(buffer_id)));
+      config, task_runner_, session_id, endpoint_->CreateTraceWriter(buffer_id),
+      &packages_list_cache_));
 }
 
 template <>
@@ -240,7 +251,7 @@ ProbesProducer::CreateDSInstance<SysStatsDataSource>(
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<SysStatsDataSource>(new SysStatsDataSource(
       task_runner_, session_id, endpoint_->CreateTraceWriter(buffer_id), config,
-      std::unique_ptr<CpuFreqInfo>(new CpuFreqInfo())));
+      CreateCpuFreqInfo()));
 }
 
 template <>
@@ -260,8 +271,8 @@ ProbesProducer::CreateDSInstance<SystemInfoDataSource>(
     const DataSourceConfig& config) {
   auto buffer_id = static_cast<BufferID>(config.target_buffer());
   return std::unique_ptr<ProbesDataSource>(new SystemInfoDataSource(
-      session_id, endpoint_->CreateTraceWriter(buffer_id),
-      std::unique_ptr<CpuFreqInfo>(new CpuFreqInfo())));
+      session_id, endpoint_->CreateTraceWriter(buffer_id), CreateCpuFreqInfo(),
+      &system_info_cache_));
 }
 
 template <>
@@ -351,7 +362,13 @@ void ProbesProducer::OnConnect() {
     if (desc->flags & Flags::kHandlesIncrementalState)
       proto_desc.set_handles_incremental_state_clear(true);
     if (desc->fill_descriptor_func) {
-      desc->fill_descriptor_func(&proto_desc);
+      if (desc->flags & Flags::kFillDescriptorAsync) {
+        // UpdateDataSource() needs a non-zero id to match the descriptor.
+        proto_desc.set_id(i + 1);
+        FillDescriptorAsync(desc, proto_desc);
+      } else {
+        desc->fill_descriptor_func(&proto_desc);
+      }
     }
   }
 
@@ -368,6 +385,27 @@ void ProbesProducer::OnConnect() {
   }
 }
 
+void ProbesProducer::FillDescriptorAsync(
+    const ProbesDataSource::Descriptor* desc,
+    DataSourceDescriptor proto_desc) {
+  if (!descriptor_task_runner_) {
+    descriptor_task_runner_.emplace(
+        base::ThreadTaskRunner::CreateAndStart("probes.desc"));
+  }
+  // The updated descriptor is posted back after the registration of all the
+  // data sources (see OnConnect()), as this is also on |task_runner_|.
+  auto weak_this = weak_factory_.GetWeakPtr();
+  base::TaskRunner* task_runner = task_runner_;
+  descriptor_task_runner_->PostTask(
+      [weak_this, task_runner, desc, proto_desc]() mutable {
+        desc->fill_descriptor_func(&proto_desc);
+        task_runner->PostTask([weak_this, proto_desc] {
+          if (weak_this && weak_this->state_ == kConnected)
+            weak_this->endpoint_->UpdateDataSource(proto_desc);
+        });
+      });
+}
+
 void ProbesProducer::OnDisconnect() {
   PERFETTO_DCHECK(state_ == kConnected || state_ == kConnecting);
   PERFETTO_LOG("Disconnected from tracing service");
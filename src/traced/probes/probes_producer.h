@@ -19,18 +19,23 @@
 
 #include <functional>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <utility>
 
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/producer.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/ext/tracing/core/tracing_service.h"
+#include "src/traced/probes/common/cpu_freq_info.h"
 #include "src/traced/probes/filesystem/inode_file_data_source.h"
 #include "src/traced/probes/ftrace/ftrace_controller.h"
 #include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/packages_list/packages_list_data_source.h"
+#include "src/traced/probes/system_info/system_info_data_source.h"
 
 #include "protos/perfetto/trace/filesystem/inode_file_map.pbzero.h"
 
@@ -38,7 +43,7 @@ namespace perfetto {
 
 class ProbesDataSource;
 
-const uint64_t kLRUInodeCacheSize = 1000;
+const uint64_t kLRUInodeCacheSizeBytes = 1024 * 1024;
 
 class ProbesProducer : public Producer, public FtraceController::Observer {
  public:
@@ -96,6 +101,13 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
 
   void Connect();
   void Restart();
+  // Returns a CpuFreqInfo sharing the frequency tables read by the previous
+  // sessions, unless CPUs were hotplugged since.
+  std::unique_ptr<CpuFreqInfo> CreateCpuFreqInfo();
+  // Fills |proto_desc| with |desc|'s fill_descriptor_func off the main thread
+  // and updates the registered data source with it.
+  void FillDescriptorAsync(const ProbesDataSource::Descriptor* desc,
+                           DataSourceDescriptor proto_desc);
   void ResetConnectionBackoff();
   void IncreaseConnectionBackoff();
   void OnDataSourceFlushComplete(FlushRequestID, DataSourceInstanceID);
@@ -132,9 +144,18 @@ class ProbesProducer : public Producer, public FtraceController::Observer {
   std::function<void()> all_data_sources_registered_cb_;
 
   std::unordered_map<DataSourceInstanceID, base::Watchdog::Timer> watchdogs_;
-  LRUInodeCache cache_{kLRUInodeCacheSize};
+  LRUInodeCache cache_{kLRUInodeCacheSizeBytes};
   std::map<BlockDeviceID, std::unordered_map<Inode, InodeMapValue>>
       system_inodes_;
+  PackagesListCache packages_list_cache_;
+  // The static system info parsed by the previous sessions. This process
+  // doesn't outlive a boot, so they are only invalidated by CPU hotplug.
+  std::unique_ptr<CpuFreqInfo> cpu_freq_info_;
+  SystemInfoDataSource::Cache system_info_cache_;
+
+  // Runs the slow fill_descriptor_func of the data sources, see
+  // ProbesDataSource::Descriptor::kFillDescriptorAsync. Started on demand.
+  std::optional<base::ThreadTaskRunner> descriptor_task_runner_;
 
   base::WeakPtrFactory<ProbesProducer> weak_factory_;  // Keep last.
 };
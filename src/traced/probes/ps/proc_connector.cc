@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <errno.h>
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+
+#include "perfetto/base/logging.h"
+#include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/utils.h"
+
+namespace perfetto {
+namespace {
+
+// Each event is a datagram of ~100 bytes. Bounds the work done per wakeup,
+// the fd watch fires again if there is more to read.
+constexpr size_t kMaxDatagramsPerRead = 1024;
+
+// Best effort: the kernel caps it to net.core.rmem_max.
+constexpr int kSocketRcvBufBytes = 1024 * 1024;
+
+bool SendMcastOp(int sock, proc_cn_mcast_op op) {
+  alignas(nlmsghdr) char buf[NLMSG_SPACE(sizeof(cn_msg) + sizeof(op))] = {};
+  auto* hdr = reinterpret_cast<nlmsghdr*>(buf);
+  hdr->nlmsg_len = NLMSG_LENGTH(sizeof(cn_msg) + sizeof(op));
+  hdr->nlmsg_type = NLMSG_DONE;
+  auto* msg = reinterpret_cast<cn_msg*>(NLMSG_DATA(hdr));
+  msg->id.idx = CN_IDX_PROC;
+  msg->id.val = CN_VAL_PROC;
+  msg->len = sizeof(op);
+  memcpy(msg->data, &op, sizeof(op));
+  return PERFETTO_EINTR(send(sock, buf, hdr->nlmsg_len, 0)) ==
+         static_cast<ssize_t>(hdr->nlmsg_len);
+}
+
+}  // namespace
+
+ProcConnector::Delegate::~Delegate() = default;
+
+// static
+std::unique_ptr<ProcConnector> ProcConnector::Create(
+    base::TaskRunner* task_runner,
+    Delegate* delegate) {
+  base::ScopedFile sock(socket(PF_NETLINK,
+                               SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                               NETLINK_CONNECTOR));
+  if (!sock) {
+    PERFETTO_PLOG("socket(NETLINK_CONNECTOR)");
+    return nullptr;
+  }
+  setsockopt(*sock, SOL_SOCKET, SO_RCVBUF, &kSocketRcvBufBytes,
+             sizeof(kSocketRcvBufBytes));
+
+  sockaddr_nl addr{};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = CN_IDX_PROC;
+  if (bind(*sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+    PERFETTO_PLOG("bind(CN_IDX_PROC)");
+    return nullptr;
+  }
+  if (!SendMcastOp(*sock, PROC_CN_MCAST_LISTEN)) {
+    PERFETTO_PLOG("Failed to subscribe to the proc connector");
+    return nullptr;
+  }
+  return std::unique_ptr<ProcConnector>(
+      new ProcConnector(task_runner, delegate, std::move(sock)));
+}
+
+ProcConnector::ProcConnector(base::TaskRunner* task_runner,
+                             Delegate* delegate,
+                             base::ScopedFile sock)
+    : task_runner_(task_runner), delegate_(delegate), sock_(std::move(sock)) {
+  task_runner_->AddFileDescriptorWatch(*sock_, [this] { OnSocketReadable(); });
+}
+
+ProcConnector::~ProcConnector() {
+  task_runner_->RemoveFileDescriptorWatch(*sock_);
+  SendMcastOp(*sock_, PROC_CN_MCAST_IGNORE);
+}
+
+void ProcConnector::OnSocketReadable() {
+  alignas(nlmsghdr) uint8_t buf[4096];
+  bool events_lost = false;
+  events_.clear();
+  for (size_t i = 0; i < kMaxDatagramsPerRead; i++) {
+    ssize_t res = PERFETTO_EINTR(recv(*sock_, buf, sizeof(buf), 0));
+    if (res < 0) {
+      // ENOBUFS: the kernel dropped datagrams, the socket can still be read.
+      if (errno == ENOBUFS) {
+        events_lost = true;
+        continue;
+      }
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        PERFETTO_DPLOG("recv(NETLINK_CONNECTOR)");
+      break;
+    }
+    if (!ParseDatagram(buf, static_cast<size_t>(res), &events_))
+      PERFETTO_DLOG("Malformed proc connector datagram");
+  }
+  if (!events_.empty() || events_lost)
+    delegate_->OnProcEvents(events_, events_lost);
+}
+
+// static
+bool ProcConnector::ParseDatagram(const uint8_t* data,
+                                  size_t size,
+                                  std::vector<Event>* events) {
+  size_t off = 0;
+  while (size - off >= sizeof(nlmsghdr)) {
+    nlmsghdr hdr;
+    memcpy(&hdr, data + off, sizeof(hdr));
+    if (hdr.nlmsg_len < NLMSG_HDRLEN || hdr.nlmsg_len > size - off)
+      return false;
+    const uint8_t* payload = data + off + NLMSG_HDRLEN;
+    const size_t payload_size = hdr.nlmsg_len - NLMSG_HDRLEN;
+    off += std::min<size_t>(NLMSG_ALIGN(hdr.nlmsg_len), size - off);
+
+    if (hdr.nlmsg_type == NLMSG_ERROR)
+      return false;
+    if (hdr.nlmsg_type != NLMSG_DONE || payload_size < sizeof(cn_msg))
+      continue;
+    cn_msg msg;
+    memcpy(&msg, payload, sizeof(msg));
+    if (msg.id.idx != CN_IDX_PROC || msg.id.val != CN_VAL_PROC)
+      continue;
+    if (msg.len > payload_size - sizeof(cn_msg))
+      return false;
+
+    // Older kernels send shorter events (e.g. without the parent of exit
+    // events), the fields that are not sent are left zeroed.
+    proc_event ev{};
+    memcpy(&ev, payload + sizeof(cn_msg),
+           std::min<size_t>(msg.len, sizeof(ev)));
+    switch (ev.what) {
+      case proc_event::PROC_EVENT_FORK:
+        events->push_back({Event::kFork, ev.event_data.fork.child_pid,
+                           ev.event_data.fork.child_tgid});
+        break;
+      case proc_event::PROC_EVENT_EXEC:
+        events->push_back({Event::kExec, ev.event_data.exec.process_pid,
+                           ev.event_data.exec.process_tgid});
+        break;
+      case proc_event::PROC_EVENT_UID:
+        events->push_back({Event::kUid, ev.event_data.id.process_pid,
+                           ev.event_data.id.process_tgid});
+        break;
+      case proc_event::PROC_EVENT_COMM:
+        events->push_back({Event::kComm, ev.event_data.comm.process_pid,
+                           ev.event_data.comm.process_tgid});
+        break;
+      case proc_event::PROC_EVENT_EXIT:
+        events->push_back({Event::kExit, ev.event_data.exit.process_pid,
+                           ev.event_data.exit.process_tgid});
+        break;
+      default:
+        // Acks of the subscription and events we don't track.
+        break;
+    }
+  }
+  return true;
+}
+
+}  // namespace perfetto
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+#define SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <vector>
+
+#include "perfetto/ext/base/scoped_file.h"
+
+namespace perfetto {
+
+namespace base {
+class TaskRunner;
+}
+
+// Subscribes to the process events connector of the kernel (see
+// include/uapi/linux/cn_proc.h), which multicasts a netlink message for each
+// fork, exec, uid change, comm change and exit of any task in the system.
+// Subscribing requires CAP_NET_ADMIN and a kernel with CONFIG_PROC_EVENTS.
+class ProcConnector {
+ public:
+  struct Event {
+    enum Type { kFork, kExec, kUid, kComm, kExit };
+    Type type;
+    int32_t pid;   // Thread id (the kernel's pid).
+    int32_t tgid;  // Process id (the kernel's tgid).
+  };
+
+  class Delegate {
+   public:
+    virtual ~Delegate();
+
+    // Called with the events received since the last call, in the order they
+    // were sent by the kernel. |events_lost| is true if the kernel dropped
+    // events since the last call because the socket buffer was full, in
+    // which case the delegate should rescan /proc.
+    virtual void OnProcEvents(const std::vector<Event>& events,
+                              bool events_lost) = 0;
+  };
+
+  // Returns nullptr if the connector is not available (e.g. missing
+  // capability or kernel support).
+  static std::unique_ptr<ProcConnector> Create(base::TaskRunner*, Delegate*);
+
+  ~ProcConnector();
+
+  // Appends to |events| the events contained in the netlink datagram
+  // [data, data + size). Returns false if the datagram is malformed.
+  static bool ParseDatagram(const uint8_t* data,
+                            size_t size,
+                            std::vector<Event>* events);
+
+ private:
+  ProcConnector(base::TaskRunner*, Delegate*, base::ScopedFile);
+  ProcConnector(const ProcConnector&) = delete;
+  ProcConnector& operator=(const ProcConnector&) = delete;
+
+  void OnSocketReadable();
+
+  base::TaskRunner* const task_runner_;
+  Delegate* const delegate_;
+  base::ScopedFile sock_;
+  std::vector<Event> events_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_PS_PROC_CONNECTOR_H_
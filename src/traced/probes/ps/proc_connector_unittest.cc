@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/ps/proc_connector.h"
+
+#include <linux/cn_proc.h>
+#include <linux/connector.h>
+#include <linux/netlink.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+
+bool operator==(const ProcConnector::Event& a, const ProcConnector::Event& b) {
+  return a.type == b.type && a.pid == b.pid && a.tgid == b.tgid;
+}
+
+namespace {
+
+using Event = ProcConnector::Event;
+
+// Appends a netlink message carrying |ev| (of |ev_size| bytes, the kernel
+// sends shorter events than the struct for some types) to |buf|.
+void AppendEvent(std::vector<uint8_t>* buf,
+                 const proc_event& ev,
+                 size_t ev_size = sizeof(proc_event),
+                 uint32_t idx = CN_IDX_PROC) {
+  const size_t len = NLMSG_LENGTH(sizeof(cn_msg) + ev_size);
+  const size_t offset = buf->size();
+  buf->resize(offset + NLMSG_ALIGN(len));
+  nlmsghdr hdr{};
+  hdr.nlmsg_len = static_cast<uint32_t>(len);
+  hdr.nlmsg_type = NLMSG_DONE;
+  memcpy(buf->data() + offset, &hdr, sizeof(hdr));
+  cn_msg msg{};
+  msg.id.idx = idx;
+  msg.id.val = CN_VAL_PROC;
+  msg.len = static_cast<uint16_t>(ev_size);
+  memcpy(buf->data() + offset + NLMSG_HDRLEN, &msg, sizeof(msg));
+  memcpy(buf->data() + offset + NLMSG_HDRLEN + sizeof(msg), &ev, ev_size);
+}
+
+proc_event MakeEvent(decltype(proc_event::what) what) {
+  proc_event ev{};
+  ev.what = what;
+  return ev;
+}
+
+TEST(ProcConnectorTest, ParseDatagram) {
+  std::vector<uint8_t> buf;
+
+  proc_event fork = MakeEvent(proc_event::PROC_EVENT_FORK);
+  fork.event_data.fork.parent_pid = 1;
+  fork.event_data.fork.parent_tgid = 1;
+  fork.event_data.fork.child_pid = 11;
+  fork.event_data.fork.child_tgid = 10;
+  AppendEvent(&buf, fork);
+
+  proc_event comm = MakeEvent(proc_event::PROC_EVENT_COMM);
+  comm.event_data.comm.process_pid = 11;
+  comm.event_data.comm.process_tgid = 10;
+  strcpy(comm.event_data.comm.comm, "worker");
+  AppendEvent(&buf, comm);
+
+  // Not tracked.
+  proc_event sid = MakeEvent(proc_event::PROC_EVENT_SID);
+  sid.event_data.sid.process_pid = 10;
+  AppendEvent(&buf, sid);
+
+  // Not from the proc connector.
+  proc_event other = MakeEvent(proc_event::PROC_EVENT_EXEC);
+  AppendEvent(&buf, other, sizeof(proc_event), CN_IDX_PROC + 1);
+
+  // Exit events of older kernels don't have the parent.
+  proc_event exit = MakeEvent(proc_event::PROC_EVENT_EXIT);
+  exit.event_data.exit.process_pid = 10;
+  exit.event_data.exit.process_tgid = 10;
+  AppendEvent(&buf, exit, offsetof(proc_event, event_data.exit.parent_pid));
+
+  std::vector<Event> events;
+  ASSERT_TRUE(ProcConnector::ParseDatagram(buf.data(), buf.size(), &events));
+  EXPECT_THAT(events, testing::ElementsAre(Event{Event::kFork, 11, 10},
+                                           Event{Event::kComm, 11, 10},
+                                           Event{Event::kExit, 10, 10}));
+}
+
+TEST(ProcConnectorTest, MalformedDatagram) {
+  proc_event exec = MakeEvent(proc_event::PROC_EVENT_EXEC);
+  exec.event_data.exec.process_pid = 10;
+  exec.event_data.exec.process_tgid = 10;
+  std::vector<uint8_t> buf;
+  AppendEvent(&buf, exec);
+
+  std::vector<Event> events;
+  ASSERT_TRUE(ProcConnector::ParseDatagram(buf.data(), buf.size(), &events));
+  EXPECT_THAT(events, testing::ElementsAre(Event{Event::kExec, 10, 10}));
+
+  // The netlink message is longer than the datagram.
+  events.clear();
+  EXPECT_FALSE(
+      ProcConnector::ParseDatagram(buf.data(), buf.size() - 8, &events));
+  EXPECT_TRUE(events.empty());
+}
+
+}  // namespace
+}  // namespace perfetto
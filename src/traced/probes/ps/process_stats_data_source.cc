@@ -16,7 +16,9 @@
 
 #include "src/traced/probes/ps/process_stats_data_source.h"
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <sys/resource.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -30,6 +32,7 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/tracing/core/data_source_config.h"
 
 #include "protos/perfetto/config/process_stats/process_stats_config.pbzero.h"
@@ -48,7 +51,9 @@
 // forgotten on every |ClearIncrementalState| if the trace config sets
 // |incremental_state_config|. Additionally, there's a proactive invalidation
 // whenever we see a task rename ftrace event, as that's a good signal that the
-// /proc/pid/cmdline needs updating.
+// /proc/pid/cmdline needs updating. With |track_process_events|, pids are also
+// invalidated on the fork, exec, uid change, comm change and exit events of
+// the kernel's process events connector.
 // TODO(rsavitski): consider invalidating on task creation or death ftrace
 // events if available.
 //
@@ -152,6 +157,35 @@ inline uint32_t ToUInt32(const char* str) {
   return static_cast<uint32_t>(strtoul(str, nullptr, 10));
 }
 
+// The files read on every tick by WriteAllProcessStats(), whose fds are kept
+// open across the ticks.
+constexpr const char* kPolledFiles[] = {"stat", "status", "oom_score_adj",
+                                        "smaps_rollup"};
+
+// Upper bound of the fds kept open for the polled files, further limited to a
+// quarter of RLIMIT_NOFILE.
+constexpr size_t kMaxPolledFds = 1024;
+
+// Reads the whole contents of the /proc file |fd| from the start. procfs
+// generates the contents again on each read at offset 0, so the same fd can be
+// read on every tick. Returns false if the read fails, e.g. with ESRCH once
+// the process exited.
+bool ReadProcFileFromStart(int fd, std::string* out) {
+  constexpr size_t kChunkSize = 4096;
+  out->clear();
+  for (;;) {
+    size_t off = out->size();
+    out->resize(off + kChunkSize);
+    ssize_t rsize = PERFETTO_EINTR(
+        pread(fd, &(*out)[off], kChunkSize, static_cast<off_t>(off)));
+    if (rsize <= 0) {
+      out->resize(off);
+      return rsize == 0;
+    }
+    out->resize(off + static_cast<size_t>(rsize));
+  }
+}
+
 }  // namespace
 
 // static
@@ -178,6 +212,7 @@ ProcessStatsDataSource::ProcessStatsDataSource(
   scan_smaps_rollup_ = cfg.scan_smaps_rollup();
   record_process_age_ = cfg.record_process_age();
   record_process_runtime_ = cfg.record_process_runtime();
+  track_process_events_ = cfg.track_process_events();
 
   enable_on_demand_dumps_ = true;
   for (auto quirk = cfg.quirks(); quirk; ++quirk) {
@@ -197,12 +232,22 @@ ProcessStatsDataSource::ProcessStatsDataSource(
     auto proc_stats_ttl_ms = cfg.proc_stats_cache_ttl_ms();
     process_stats_cache_ttl_ticks_ =
         std::max(proc_stats_ttl_ms / poll_period_ms_, 1u);
+
+    struct rlimit rl {};
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+      max_polled_fds_ =
+          std::min(kMaxPolledFds, static_cast<size_t>(rl.rlim_cur / 4));
+    }
   }
 }
 
 ProcessStatsDataSource::~ProcessStatsDataSource() = default;
 
 void ProcessStatsDataSource::Start() {
+  // Subscribe before scanning /proc, so that no process is missed in between.
+  if (track_process_events_)
+    proc_events_active_ = SubscribeToProcEvents();
+
   if (dump_all_procs_on_start_) {
     WriteAllProcesses();
   }
@@ -283,6 +328,58 @@ void ProcessStatsDataSource::WriteProcessTree(
   PERFETTO_METATRACE_COUNTER(TAG_PROC_POLLERS, PS_PIDS_SCANNED, pids_scanned);
 }
 
+void ProcessStatsDataSource::OnProcEvents(
+    const std::vector<ProcConnector::Event>& events,
+    bool events_lost) {
+  PERFETTO_METATRACE_SCOPED(TAG_PROC_POLLERS, PS_ON_PROC_EVENTS);
+  using Event = ProcConnector::Event;
+  // The pids to (re)write in the process tree.
+  base::FlatSet<int32_t> pids;
+  for (const Event& event : events) {
+    switch (event.type) {
+      case Event::kFork:
+        // The pid might be a reused one whose exit we didn't see.
+        seen_pids_.erase(event.pid);
+        if (event.pid == event.tgid)
+          live_tgids_.insert(event.tgid);
+        pids.insert(event.pid);
+        break;
+      case Event::kExec:
+      case Event::kUid:
+        // The cmdline and uid of the process entry (e.g. the processes forked
+        // by zygote change uid without exec()).
+        seen_pids_.erase(event.tgid);
+        pids.insert(event.tgid);
+        break;
+      case Event::kComm:
+        // The name of the thread, or of the process if it has no cmdline.
+        if (record_thread_names_ || event.pid == event.tgid) {
+          seen_pids_.erase(event.pid);
+          pids.insert(event.pid);
+        }
+        break;
+      case Event::kExit: {
+        seen_pids_.erase(event.pid);
+        pids.erase(event.pid);
+        if (event.pid != event.tgid)
+          break;
+        live_tgids_.erase(event.tgid);
+        process_stats_cache_.erase(event.tgid);
+        ClosePolledFds(event.tgid);
+        uint32_t pid_u = static_cast<uint32_t>(event.tgid);
+        if (skip_mem_for_pids_.size() > pid_u)
+          skip_mem_for_pids_[pid_u] = false;
+        break;
+      }
+    }
+  }
+  // We don't know which processes were missed, list /proc on the next tick.
+  if (events_lost)
+    live_tgids_stale_ = true;
+  if (!pids.empty())
+    WriteProcessTree(pids);
+}
+
 void ProcessStatsDataSource::OnRenamePids(const base::FlatSet<int32_t>& pids) {
   PERFETTO_METATRACE_SCOPED(TAG_PROC_POLLERS, PS_ON_RENAME_PIDS);
   if (!enable_on_demand_dumps_)
@@ -439,16 +536,62 @@ base::ScopedDir ProcessStatsDataSource::OpenProcDir() {
   return proc_dir;
 }
 
+bool ProcessStatsDataSource::SubscribeToProcEvents() {
+  proc_connector_ = ProcConnector::Create(task_runner_, this);
+  if (!proc_connector_) {
+    PERFETTO_ELOG("Process events connector unavailable, scanning /proc");
+    return false;
+  }
+  return true;
+}
+
 std::string ProcessStatsDataSource::ReadProcPidFile(int32_t pid,
                                                     const std::string& file) {
-  base::StackString<128> path("/proc/%" PRId32 "/%s", pid, file.c_str());
   std::string contents;
-  contents.reserve(4096);
-  if (!base::ReadFile(path.c_str(), &contents))
+  base::ScopedFile* polled_fd = GetPolledFdSlot(pid, file);
+  if (polled_fd && *polled_fd) {
+    if (ReadProcFileFromStart(polled_fd->get(), &contents))
+      return contents;
+    // The process exited, and the pid might have been reused since: open the
+    // file again.
+    polled_fd->reset();
+    num_polled_fds_--;
+  }
+
+  base::StackString<128> path("/proc/%" PRId32 "/%s", pid, file.c_str());
+  base::ScopedFile fd = base::OpenFile(path.c_str(), O_RDONLY);
+  if (!fd || !ReadProcFileFromStart(*fd, &contents))
     return "";
+  if (polled_fd && num_polled_fds_ < max_polled_fds_) {
+    *polled_fd = std::move(fd);
+    num_polled_fds_++;
+  }
   return contents;
 }
 
+base::ScopedFile* ProcessStatsDataSource::GetPolledFdSlot(
+    int32_t pid,
+    const std::string& file) {
+  static_assert(base::ArraySize(kPolledFiles) == kNumPolledFiles,
+                "kPolledFiles and kNumPolledFiles out of sync");
+  if (!poll_period_ms_ || !live_tgids_.count(pid))
+    return nullptr;
+  for (size_t i = 0; i < kNumPolledFiles; i++) {
+    if (file == kPolledFiles[i])
+      return &polled_fds_[pid][i];
+  }
+  return nullptr;
+}
+
+void ProcessStatsDataSource::ClosePolledFds(int32_t pid) {
+  auto it = polled_fds_.find(pid);
+  if (it == polled_fds_.end())
+    return;
+  for (const base::ScopedFile& fd : it->second)
+    num_polled_fds_ -= fd ? 1 : 0;
+  polled_fds_.erase(it);
+}
+
 void ProcessStatsDataSource::StartNewPacketIfNeeded() {
   if (cur_packet_)
     return;
@@ -529,11 +672,11 @@ void ProcessStatsDataSource::Tick(
 void ProcessStatsDataSource::WriteAllProcessStats() {
   CacheProcFsScanStartTimestamp();
   PERFETTO_METATRACE_SCOPED(TAG_PROC_POLLERS, PS_WRITE_ALL_PROCESS_STATS);
-  base::ScopedDir proc_dir = OpenProcDir();
-  if (!proc_dir)
+  if ((!proc_events_active_ || live_tgids_stale_) && !ScanProcDir())
     return;
-  base::FlatSet<int32_t> pids;
-  while (int32_t pid = ReadNextNumericDir(*proc_dir)) {
+  base::FlatSet<int32_t>& pids = polled_pids_;
+  pids.clear();
+  for (int32_t pid : live_tgids_) {
     cur_ps_stats_process_ = nullptr;
     uint32_t pid_u = static_cast<uint32_t>(pid);
 
@@ -590,6 +733,22 @@ void ProcessStatsDataSource::WriteAllProcessStats() {
   WriteProcessTree(pids);
 }
 
+bool ProcessStatsDataSource::ScanProcDir() {
+  base::ScopedDir proc_dir = OpenProcDir();
+  if (!proc_dir)
+    return false;
+  live_tgids_.clear();
+  while (int32_t pid = ReadNextNumericDir(*proc_dir))
+    live_tgids_.insert(pid);
+  live_tgids_stale_ = false;
+  for (auto it = polled_fds_.begin(); it != polled_fds_.end();) {
+    int32_t pid = (it++)->first;
+    if (!live_tgids_.count(pid))
+      ClosePolledFds(pid);
+  }
+  return true;
+}
+
 bool ProcessStatsDataSource::WriteProcessRuntimes(
     int32_t pid,
     const std::string& proc_stat) {
@@ -627,126 +786,107 @@ bool ProcessStatsDataSource::WriteMemCounters(int32_t pid,
   // VmSize:     5992 kB
   // VmLck:         0 kB
   // ...
-  std::vector<char> key;
-  std::vector<char> value;
-  enum { kKey, kSeparator, kValue } state = kKey;
-  for (char c : proc_status) {
-    if (c == '\n') {
-      key.push_back('\0');
-      value.push_back('\0');
-
-      // |value| will contain "1234 KB". We rely on ToUInt32() to stop parsing
-      // at the first non-numeric character.
-      if (strcmp(key.data(), "VmSize") == 0) {
-        // Assume that if we see VmSize we'll see also the others.
-        proc_status_has_mem_counters = true;
-
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.vm_size_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
-          cached.vm_size_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmLck") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.vm_locked_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
-          cached.vm_locked_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmHWM") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.vm_hvm_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
-          cached.vm_hvm_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmRSS") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.vm_rss_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
-          cached.vm_rss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssAnon") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.rss_anon_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
-          cached.rss_anon_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssFile") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.rss_file_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
-          cached.rss_file_kb = counter;
-        }
-      } else if (strcmp(key.data(), "RssShmem") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.rss_shmem_kb) {
-          GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
-          cached.rss_shmem_kb = counter;
-        }
-      } else if (strcmp(key.data(), "VmSwap") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.vm_swap_kb) {
-          GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
-          cached.vm_swap_kb = counter;
-        }
-        // The entries below come from smaps_rollup, WriteAllProcessStats merges
-        // everything into the same buffer for convenience.
-      } else if (strcmp(key.data(), "Rss") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.smr_rss_kb) {
-          GetOrCreateStatsProcess(pid)->set_smr_rss_kb(counter);
-          cached.smr_rss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "Pss") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.smr_pss_kb) {
-          GetOrCreateStatsProcess(pid)->set_smr_pss_kb(counter);
-          cached.smr_pss_kb = counter;
-        }
-      } else if (strcmp(key.data(), "Pss_Anon") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.smr_pss_anon_kb) {
-          GetOrCreateStatsProcess(pid)->set_smr_pss_anon_kb(counter);
-          cached.smr_pss_anon_kb = counter;
-        }
-      } else if (strcmp(key.data(), "Pss_File") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.smr_pss_file_kb) {
-          GetOrCreateStatsProcess(pid)->set_smr_pss_file_kb(counter);
-          cached.smr_pss_file_kb = counter;
-        }
-      } else if (strcmp(key.data(), "Pss_Shmem") == 0) {
-        auto counter = ToUInt32(value.data());
-        if (counter != cached.smr_pss_shmem_kb) {
-          GetOrCreateStatsProcess(pid)->set_smr_pss_shmem_kb(counter);
-          cached.smr_pss_shmem_kb = counter;
-        }
+  // The lines are parsed in place. A line without a trailing newline (i.e. a
+  // truncated read) is ignored.
+  const char* const end = proc_status.data() + proc_status.size();
+  for (const char* line = proc_status.data(); line < end;) {
+    const char* eol = static_cast<const char*>(
+        memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (!eol)
+      break;
+    const char* sep = static_cast<const char*>(
+        memchr(line, ':', static_cast<size_t>(eol - line)));
+    base::StringView key(line, static_cast<size_t>((sep ? sep : eol) - line));
+    const char* value = sep ? sep + 1 : eol;
+    while (value < eol && isspace(*value))
+      value++;
+    line = eol + 1;
+
+    // |value| points to "1234 kB". We rely on ToUInt32() to stop parsing at
+    // the first non-numeric character (at the latest the newline).
+    if (key == "VmSize") {
+      // Assume that if we see VmSize we'll see also the others.
+      proc_status_has_mem_counters = true;
+
+      auto counter = ToUInt32(value);
+      if (counter != cached.vm_size_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_size_kb(counter);
+        cached.vm_size_kb = counter;
       }
-
-      key.clear();
-      state = kKey;
-      continue;
-    }
-
-    if (state == kKey) {
-      if (c == ':') {
-        state = kSeparator;
-        continue;
+    } else if (key == "VmLck") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.vm_locked_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_locked_kb(counter);
+        cached.vm_locked_kb = counter;
+      }
+    } else if (key == "VmHWM") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.vm_hvm_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_hwm_kb(counter);
+        cached.vm_hvm_kb = counter;
+      }
+    } else if (key == "VmRSS") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.vm_rss_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_rss_kb(counter);
+        cached.vm_rss_kb = counter;
+      }
+    } else if (key == "RssAnon") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.rss_anon_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_anon_kb(counter);
+        cached.rss_anon_kb = counter;
+      }
+    } else if (key == "RssFile") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.rss_file_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_file_kb(counter);
+        cached.rss_file_kb = counter;
+      }
+    } else if (key == "RssShmem") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.rss_shmem_kb) {
+        GetOrCreateStatsProcess(pid)->set_rss_shmem_kb(counter);
+        cached.rss_shmem_kb = counter;
+      }
+    } else if (key == "VmSwap") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.vm_swap_kb) {
+        GetOrCreateStatsProcess(pid)->set_vm_swap_kb(counter);
+        cached.vm_swap_kb = counter;
+      }
+      // The entries below come from smaps_rollup, WriteAllProcessStats merges
+      // everything into the same buffer for convenience.
+    } else if (key == "Rss") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.smr_rss_kb) {
+        GetOrCreateStatsProcess(pid)->set_smr_rss_kb(counter);
+        cached.smr_rss_kb = counter;
+      }
+    } else if (key == "Pss") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.smr_pss_kb) {
+        GetOrCreateStatsProcess(pid)->set_smr_pss_kb(counter);
+        cached.smr_pss_kb = counter;
+      }
+    } else if (key == "Pss_Anon") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.smr_pss_anon_kb) {
+        GetOrCreateStatsProcess(pid)->set_smr_pss_anon_kb(counter);
+        cached.smr_pss_anon_kb = counter;
+      }
+    } else if (key == "Pss_File") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.smr_pss_file_kb) {
+        GetOrCreateStatsProcess(pid)->set_smr_pss_file_kb(counter);
+        cached.smr_pss_file_kb = counter;
+      }
+    } else if (key == "Pss_Shmem") {
+      auto counter = ToUInt32(value);
+      if (counter != cached.smr_pss_shmem_kb) {
+        GetOrCreateStatsProcess(pid)->set_smr_pss_shmem_kb(counter);
+        cached.smr_pss_shmem_kb = counter;
       }
-      key.push_back(c);
-      continue;
-    }
-
-    if (state == kSeparator) {
-      if (isspace(c))
-        continue;
-      value.clear();
-      value.push_back(c);
-      state = kValue;
-      continue;
-    }
-
-    if (state == kValue) {
-      value.push_back(c);
     }
   }
   return proc_status_has_mem_counters;
@@ -17,9 +17,11 @@
 #ifndef SRC_TRACED_PROBES_PS_PROCESS_STATS_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_PS_PROCESS_STATS_DATA_SOURCE_H_
 
+#include <array>
 #include <functional>
 #include <limits>
 #include <memory>
+#include <string>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -31,6 +33,7 @@
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/tracing/core/forward_decls.h"
 #include "src/traced/probes/probes_data_source.h"
+#include "src/traced/probes/ps/proc_connector.h"
 
 namespace perfetto {
 
@@ -46,7 +49,8 @@ class ProcessStats_Process;
 }  // namespace pbzero
 }  // namespace protos
 
-class ProcessStatsDataSource : public ProbesDataSource {
+class ProcessStatsDataSource : public ProbesDataSource,
+                               public ProcConnector::Delegate {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
@@ -67,12 +71,20 @@ class ProcessStatsDataSource : public ProbesDataSource {
   void Flush(FlushRequestID, std::function<void()> callback) override;
   void ClearIncrementalState() override;
 
+  // ProcConnector::Delegate implementation.
+  void OnProcEvents(const std::vector<ProcConnector::Event>& events,
+                    bool events_lost) override;
+
   bool on_demand_dumps_enabled() const { return enable_on_demand_dumps_; }
 
   // Virtual for testing.
   virtual const char* GetProcMountpoint();
   virtual base::ScopedDir OpenProcDir();
+  // The files of the sampled processes that are read on every tick
+  // (see kPolledFiles) are read through fds kept open across the ticks.
   virtual std::string ReadProcPidFile(int32_t pid, const std::string& file);
+  // Returns false if the process events connector is not available.
+  virtual bool SubscribeToProcEvents();
 
  private:
   struct CachedProcessStats {
@@ -96,6 +108,10 @@ class ProcessStatsDataSource : public ProbesDataSource {
     base::FlatSet<uint64_t> seen_fds;
   };
 
+  // The /proc/pid files read by WriteAllProcessStats().
+  static constexpr size_t kNumPolledFiles = 4;
+  using PolledFds = std::array<base::ScopedFile, kNumPolledFiles>;
+
   // Common functions.
   ProcessStatsDataSource(const ProcessStatsDataSource&) = delete;
   ProcessStatsDataSource& operator=(const ProcessStatsDataSource&) = delete;
@@ -127,6 +143,14 @@ class ProcessStatsDataSource : public ProbesDataSource {
   // Scans /proc/pid/status and writes the ProcessTree packet for input pids.
   void WriteProcessTree(const base::FlatSet<int32_t>&);
 
+  // Lists the processes in /proc into |live_tgids_|.
+  bool ScanProcDir();
+
+  // Returns the slot of the fd kept open for /proc/|pid|/|file|, or nullptr
+  // if the file is not polled for |pid|.
+  base::ScopedFile* GetPolledFdSlot(int32_t pid, const std::string& file);
+  void ClosePolledFds(int32_t pid);
+
   // Read and "latch" the current procfs scan-start timestamp, which
   // we reset only in FinalizeCurPacket.
   uint64_t CacheProcFsScanStartTimestamp();
@@ -156,6 +180,7 @@ class ProcessStatsDataSource : public ProbesDataSource {
   bool scan_smaps_rollup_ = false;
   bool record_process_age_ = false;
   bool record_process_runtime_ = false;
+  bool track_process_events_ = false;
 
   // This set contains PIDs as per the Linux kernel notion of a PID (which is
   // really a TID). In practice this set will contain all TIDs for all processes
@@ -171,6 +196,17 @@ class ProcessStatsDataSource : public ProbesDataSource {
   };
   base::FlatSet<SeenPid> seen_pids_;
 
+  // Set if |track_process_events_| and the subscription succeeded.
+  std::unique_ptr<ProcConnector> proc_connector_;
+  bool proc_events_active_ = false;
+
+  // The processes sampled by WriteAllProcessStats(). With
+  // |proc_events_active_| it is kept up to date by OnProcEvents() and /proc is
+  // only listed again if events were lost, otherwise /proc is listed on every
+  // tick.
+  base::FlatSet<int32_t> live_tgids_;
+  bool live_tgids_stale_ = true;
+
   // Fields for keeping track of the periodic stats/counters.
   uint32_t poll_period_ms_ = 0;
   uint64_t cache_ticks_ = 0;
@@ -183,6 +219,17 @@ class ProcessStatsDataSource : public ProbesDataSource {
   uint32_t process_stats_cache_ttl_ticks_ = 0;
   std::unordered_map<int32_t, CachedProcessStats> process_stats_cache_;
 
+  // The fds of the polled files of the processes in |live_tgids_|, to save
+  // the path lookup and open() of each file on every tick. Limited to
+  // |max_polled_fds_| fds overall, based on RLIMIT_NOFILE.
+  std::unordered_map<int32_t, PolledFds> polled_fds_;
+  size_t num_polled_fds_ = 0;
+  size_t max_polled_fds_ = 0;
+
+  // The pids written by the current WriteAllProcessStats(), kept across ticks
+  // to reuse its storage.
+  base::FlatSet<int32_t> polled_pids_;
+
   // If true, the next trace packet will have the |incremental_state_cleared|
   // flag set. Set initially and when handling a ClearIncrementalState call.
   bool did_clear_incremental_state_ = true;
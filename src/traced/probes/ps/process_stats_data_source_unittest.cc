@@ -79,8 +79,31 @@ class TestProcessStatsDataSource : public ProcessStatsDataSource {
               ReadProcPidFile,
               (int32_t pid, const std::string&),
               (override));
+  MOCK_METHOD(bool, SubscribeToProcEvents, (), (override));
 };
 
+// Reads the real /proc/pid files, of the processes in a fake /proc.
+class ProcFilesProcessStatsDataSource : public ProcessStatsDataSource {
+ public:
+  using ProcessStatsDataSource::ProcessStatsDataSource;
+
+  MOCK_METHOD(base::ScopedDir, OpenProcDir, (), (override));
+};
+
+// Returns the number of fds of the test process open on |path|.
+size_t CountOpenFds(const std::string& path) {
+  size_t count = 0;
+  base::ScopedDir fd_dir(opendir("/proc/self/fd"));
+  while (struct dirent* ent = readdir(*fd_dir)) {
+    char target[256];
+    std::string link = std::string("/proc/self/fd/") + ent->d_name;
+    ssize_t len = readlink(link.c_str(), target, sizeof(target));
+    if (len > 0 && path == std::string(target, static_cast<size_t>(len)))
+      count++;
+  }
+  return count;
+}
+
 class ProcessStatsDataSourceTest : public ::testing::Test {
  protected:
   ProcessStatsDataSourceTest() {}
@@ -681,5 +704,158 @@ TEST_F(ProcessStatsDataSourceTest, WriteProcessStartFromBoot) {
   EXPECT_EQ(first_process.process_start_from_boot(), 15842 * NsPerClockTick());
 }
 
+TEST_F(ProcessStatsDataSourceTest, ProcEventsUpdateProcessTree) {
+  using Event = ProcConnector::Event;
+  DataSourceConfig ds_config;
+  ProcessStatsConfig cfg;
+  cfg.set_track_process_events(true);
+  ds_config.set_process_stats_config_raw(cfg.SerializeAsString());
+  auto data_source = GetProcessStatsDataSource(ds_config);
+  EXPECT_CALL(*data_source, SubscribeToProcEvents()).WillOnce(Return(true));
+  data_source->Start();
+
+  auto status = [](int32_t pid, int32_t tgid) {
+    return "Name: foo\nTgid:\t" + std::to_string(tgid) +
+           "\nPid:   " + std::to_string(pid) + "\nPPid:  1\n";
+  };
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "status"))
+      .WillRepeatedly(Return(status(10, 10)));
+  EXPECT_CALL(*data_source, ReadProcPidFile(11, "status"))
+      .WillOnce(Return(status(11, 10)));
+  EXPECT_CALL(*data_source, ReadProcPidFile(10, "cmdline"))
+      .WillOnce(Return(std::string("zygote\0", 7)))
+      .WillOnce(Return(std::string("app\0", 4)));
+  // Exited before the events were handled: never read.
+  EXPECT_CALL(*data_source, ReadProcPidFile(12, _)).Times(0);
+
+  data_source->OnProcEvents({{Event::kFork, 10, 10},
+                             {Event::kFork, 11, 10},
+                             {Event::kFork, 12, 12},
+                             {Event::kExit, 12, 12}},
+                            /*events_lost=*/false);
+  // Without record_thread_names, renaming a thread doesn't need a rescan.
+  data_source->OnProcEvents({{Event::kComm, 11, 10}}, /*events_lost=*/false);
+  data_source->OnProcEvents({{Event::kUid, 10, 10}}, /*events_lost=*/false);
+
+  auto trace = writer_raw_->GetAllTracePackets();
+  ASSERT_EQ(trace.size(), 2u);
+  const auto& first_tree = trace[0].process_tree();
+  ASSERT_EQ(first_tree.processes_size(), 1);
+  EXPECT_EQ(first_tree.processes()[0].pid(), 10);
+  EXPECT_THAT(first_tree.processes()[0].cmdline(), ElementsAre("zygote"));
+  ASSERT_EQ(first_tree.threads_size(), 1);
+  EXPECT_EQ(first_tree.threads()[0].tid(), 11);
+  EXPECT_EQ(first_tree.threads()[0].tgid(), 10);
+
+  const auto& second_tree = trace[1].process_tree();
+  ASSERT_EQ(second_tree.processes_size(), 1);
+  EXPECT_THAT(second_tree.processes()[0].cmdline(), ElementsAre("app"));
+  EXPECT_EQ(second_tree.threads_size(), 0);
+}
+
+TEST_F(ProcessStatsDataSourceTest, ProcEventsReplaceProcScans) {
+  using Event = ProcConnector::Event;
+  DataSourceConfig ds_config;
+  ProcessStatsConfig cfg;
+  cfg.set_proc_stats_poll_ms(100);
+  cfg.set_track_process_events(true);
+  cfg.add_quirks(ProcessStatsConfig::DISABLE_ON_DEMAND);
+  ds_config.set_process_stats_config_raw(cfg.SerializeAsString());
+  auto data_source = GetProcessStatsDataSource(ds_config);
+  EXPECT_CALL(*data_source, SubscribeToProcEvents()).WillOnce(Return(true));
+
+  auto fake_proc = base::TempDir::Create();
+  base::StackString<256> path("%s/1", fake_proc.path().c_str());
+  mkdir(path.c_str(), 0755);
+
+  // /proc is only listed on the first tick, after that processes come from
+  // the events.
+  EXPECT_CALL(*data_source, OpenProcDir()).WillOnce(Invoke([&fake_proc] {
+    return base::ScopedDir(opendir(fake_proc.path().c_str()));
+  }));
+  for (int32_t pid : {1, 2}) {
+    EXPECT_CALL(*data_source, ReadProcPidFile(pid, "status"))
+        .WillRepeatedly(Invoke([](int32_t p, const std::string&) {
+          return "Name: foo\nTgid:  " + std::to_string(p) +
+                 "\nPid:   " + std::to_string(p) +
+                 "\nPPid:  0\nVmSize:\t" + std::to_string(p * 100) +
+                 " kB\n";
+        }));
+    EXPECT_CALL(*data_source, ReadProcPidFile(pid, "cmdline"))
+        .WillOnce(Return(std::string("foo\0", 4)));
+  }
+  EXPECT_CALL(*data_source, ReadProcPidFile(1, "oom_score_adj"))
+      .WillOnce(Invoke([&](int32_t, const std::string&) {
+        task_runner_.PostTask([&data_source] {
+          data_source->OnProcEvents(
+              {{Event::kFork, 2, 2}, {Event::kExit, 1, 1}},
+              /*events_lost=*/false);
+        });
+        return "0";
+      }));
+  auto checkpoint = task_runner_.CreateCheckpoint("all_done");
+  EXPECT_CALL(*data_source, ReadProcPidFile(2, "oom_score_adj"))
+      .WillOnce(Invoke([checkpoint](int32_t, const std::string&) {
+        checkpoint();
+        return "0";
+      }));
+
+  data_source->Start();
+  task_runner_.RunUntilCheckpoint("all_done");
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  std::vector<int32_t> tree_pids;
+  std::vector<int32_t> stats_pids;
+  for (const auto& packet : writer_raw_->GetAllTracePackets()) {
+    for (const auto& process : packet.process_tree().processes())
+      tree_pids.push_back(process.pid());
+    for (const auto& process : packet.process_stats().processes())
+      stats_pids.push_back(process.pid());
+  }
+  EXPECT_THAT(tree_pids, ElementsAre(1, 2));
+  EXPECT_THAT(stats_pids, ElementsAre(1, 2));
+
+  base::Rmdir(path.ToStdString());
+}
+
+TEST_F(ProcessStatsDataSourceTest, PolledFilesStayOpen) {
+  DataSourceConfig ds_config;
+  ProcessStatsConfig cfg;
+  cfg.set_proc_stats_poll_ms(100);
+  cfg.add_quirks(ProcessStatsConfig::DISABLE_ON_DEMAND);
+  ds_config.set_process_stats_config_raw(cfg.SerializeAsString());
+  auto writer = std::make_unique<TraceWriterForTesting>();
+  writer_raw_ = writer.get();
+  auto data_source = std::make_unique<ProcFilesProcessStatsDataSource>(
+      &task_runner_, 0, std::move(writer), ds_config);
+
+  const int32_t pid = getpid();
+  auto fake_proc = base::TempDir::Create();
+  base::StackString<256> path("%s/%d", fake_proc.path().c_str(), pid);
+  mkdir(path.c_str(), 0755);
+  EXPECT_CALL(*data_source, OpenProcDir())
+      .WillRepeatedly(Invoke([&fake_proc] {
+        return base::ScopedDir(opendir(fake_proc.path().c_str()));
+      }));
+
+  const std::string status_path = "/proc/" + std::to_string(pid) + "/status";
+  ASSERT_EQ(CountOpenFds(status_path), 0u);
+  data_source->Start();
+  task_runner_.RunUntilIdle();
+  EXPECT_EQ(CountOpenFds(status_path), 1u);
+  data_source->Flush(1 /* FlushRequestId */, []() {});
+
+  auto packets = writer_raw_->GetAllTracePackets();
+  ASSERT_FALSE(packets.empty());
+  const auto& processes = packets[0].process_stats().processes();
+  ASSERT_EQ(processes.size(), 1u);
+  EXPECT_EQ(processes[0].pid(), pid);
+  EXPECT_GT(processes[0].vm_rss_kb(), 0u);
+
+  data_source.reset();
+  EXPECT_EQ(CountOpenFds(status_path), 0u);
+  base::Rmdir(path.ToStdString());
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/sys_stats/keyed_counter_parser.h"
+
+#include "perfetto/base/logging.h"
+
+namespace perfetto {
+
+KeyedCounterParser::KeyedCounterParser() = default;
+KeyedCounterParser::~KeyedCounterParser() = default;
+
+void KeyedCounterParser::AddKey(const char* key, int32_t id) {
+  keys_.Insert(base::StringView(key), id);
+}
+
+int32_t KeyedCounterParser::LearnLine(size_t line_idx,
+                                      const char* line,
+                                      const char* eol) {
+  // Lines are learned in order, so a mismatch means that the layout changed
+  // from this line on (or that this is the first read): forget the rest.
+  PERFETTO_DCHECK(line_idx <= lines_.size());
+  if (line_idx < lines_.size()) {
+    line_keys_.resize(lines_[line_idx].key_off);
+    lines_.resize(line_idx);
+  }
+
+  const char* key_end = line;
+  while (key_end < eol && !IsKeySeparator(*key_end))
+    key_end++;
+  base::StringView key(line, static_cast<size_t>(key_end - line));
+  const int32_t* id = keys_.Find(key);
+
+  Line l{};
+  l.key_off = static_cast<uint32_t>(line_keys_.size());
+  l.key_size = static_cast<uint32_t>(key.size());
+  l.id = id ? *id : -1;
+  line_keys_.append(key.data(), key.size());
+  lines_.push_back(l);
+  return l.id;
+}
+
+// static
+bool KeyedCounterParser::ParseValue(const char* ptr,
+                                    const char* end,
+                                    uint64_t* value) {
+  while (ptr < end && (*ptr == ':' || *ptr == ' ' || *ptr == '\t'))
+    ptr++;
+  bool negative = ptr < end && *ptr == '-';
+  if (negative)
+    ptr++;
+  if (ptr == end || *ptr < '0' || *ptr > '9')
+    return false;
+  uint64_t v = 0;
+  for (; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++)
+    v = v * 10 + static_cast<uint64_t>(*ptr - '0');
+  *value = negative ? ~v + 1 : v;
+  return true;
+}
+
+}  // namespace perfetto
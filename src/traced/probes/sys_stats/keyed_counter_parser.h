@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SRC_TRACED_PROBES_SYS_STATS_KEYED_COUNTER_PARSER_H_
+#define SRC_TRACED_PROBES_SYS_STATS_KEYED_COUNTER_PARSER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/string_view.h"
+
+namespace perfetto {
+
+// Parses the counters of the /proc files made of "key value" lines, like
+// /proc/meminfo ("MemTotal:  3624928 kB") and /proc/vmstat
+// ("nr_free_pages 85163"), for the keys added upfront.
+//
+// The kernel writes the lines of these files in the same order on every read,
+// so the parser remembers the key of each line: on the next reads it only
+// checks that each line still starts with the same key, and skips the lines
+// of the keys that were not requested without parsing them. Keys are only
+// looked up on the first read, or after the layout of the file changed.
+class KeyedCounterParser {
+ public:
+  KeyedCounterParser();
+  ~KeyedCounterParser();
+
+  // |key| must outlive the parser (e.g. a string literal).
+  void AddKey(const char* key, int32_t id);
+
+  // Calls |fn(id, value)| for each line of [buf, buf + size) whose key was
+  // added, in the order of the lines. Lines without a numeric value are
+  // skipped. Negative values are passed as their two's complement, like
+  // strtoll() followed by a cast.
+  template <typename Fn>
+  void Parse(const char* buf, size_t size, Fn fn) {
+    const char* const end = buf + size;
+    size_t line_idx = 0;
+    for (const char* line = buf; line < end; line_idx++) {
+      const char* eol = static_cast<const char*>(
+          memchr(line, '\n', static_cast<size_t>(end - line)));
+      if (!eol)
+        eol = end;
+      int32_t id = LineId(line_idx, line, eol);
+      uint64_t value;
+      if (id >= 0 && ParseValue(line + lines_[line_idx].key_size, eol, &value))
+        fn(id, value);
+      line = eol + 1;
+    }
+  }
+
+ private:
+  struct Line {
+    uint32_t key_off;  // Into |line_keys_|.
+    uint32_t key_size;
+    int32_t id;  // -1 if the key was not added.
+  };
+
+  static bool IsKeySeparator(char c) { return c == ':' || c == ' '; }
+
+  // Returns the id of the key of the line [line, eol), which is the
+  // |line_idx|-th of the file, updating |lines_| if the layout changed.
+  int32_t LineId(size_t line_idx, const char* line, const char* eol) {
+    if (PERFETTO_LIKELY(line_idx < lines_.size())) {
+      const Line& l = lines_[line_idx];
+      size_t line_size = static_cast<size_t>(eol - line);
+      if (line_size >= l.key_size &&
+          (line_size == l.key_size || IsKeySeparator(line[l.key_size])) &&
+          !memcmp(line, line_keys_.data() + l.key_off, l.key_size)) {
+        return l.id;
+      }
+    }
+    return LearnLine(line_idx, line, eol);
+  }
+
+  int32_t LearnLine(size_t line_idx, const char* line, const char* eol);
+
+  static bool ParseValue(const char* ptr, const char* end, uint64_t* value);
+
+  base::FlatHashMap<base::StringView, int32_t, base::StringViewHash> keys_;
+  std::vector<Line> lines_;
+  // The keys of |lines_|, back to back.
+  std::string line_keys_;
+};
+
+}  // namespace perfetto
+
+#endif  // SRC_TRACED_PROBES_SYS_STATS_KEYED_COUNTER_PARSER_H_
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "src/traced/probes/sys_stats/keyed_counter_parser.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+using ::testing::ElementsAre;
+using KV = std::pair<int32_t, uint64_t>;
+
+std::vector<KV> Parse(KeyedCounterParser* parser, const std::string& text) {
+  std::vector<KV> res;
+  parser->Parse(text.data(), text.size(), [&res](int32_t id, uint64_t value) {
+    res.emplace_back(id, value);
+  });
+  return res;
+}
+
+TEST(KeyedCounterParserTest, Meminfo) {
+  KeyedCounterParser parser;
+  parser.AddKey("MemTotal", 1);
+  parser.AddKey("Active(anon)", 2);
+  parser.AddKey("CmaFree", 3);
+  const std::string kMeminfo =
+      "MemTotal:        3624928 kB\n"
+      "MemFree:           93248 kB\n"
+      "Active(anon):     911860 kB\n"
+      "Active:          1287156 kB\n"
+      "CmaFree:               0 kB";
+  // The second read goes through the lines learned by the first one.
+  for (int i = 0; i < 2; i++) {
+    EXPECT_THAT(Parse(&parser, kMeminfo),
+                ElementsAre(KV{1, 3624928}, KV{2, 911860}, KV{3, 0}));
+  }
+}
+
+TEST(KeyedCounterParserTest, Vmstat) {
+  KeyedCounterParser parser;
+  parser.AddKey("nr_free_pages", 1);
+  parser.AddKey("nr_dirty", 2);
+  parser.AddKey("pgfault", 3);
+  EXPECT_THAT(Parse(&parser,
+                    "nr_free_pages 16449\n"
+                    "nr_dirty_threshold 4096\n"
+                    "nr_dirty -3\n"
+                    "pgfault\n"
+                    "pgfault2 7\n"),
+              ElementsAre(KV{1, 16449}, KV{2, static_cast<uint64_t>(-3)}));
+}
+
+TEST(KeyedCounterParserTest, LayoutChange) {
+  KeyedCounterParser parser;
+  parser.AddKey("a", 1);
+  parser.AddKey("b", 2);
+  parser.AddKey("c", 3);
+  EXPECT_THAT(Parse(&parser, "a 1\nx 0\nb 2\nc 3\n"),
+              ElementsAre(KV{1, 1}, KV{2, 2}, KV{3, 3}));
+  // A line inserted, one removed and a key that is a prefix of the old one.
+  EXPECT_THAT(Parse(&parser, "a 4\ny 0\nx 0\nbb 5\nc 6\n"),
+              ElementsAre(KV{1, 4}, KV{3, 6}));
+  EXPECT_THAT(Parse(&parser, "a 7\nb 8\n"), ElementsAre(KV{1, 7}, KV{2, 8}));
+  EXPECT_THAT(Parse(&parser, "a 9\nb 10\nc 11\n"),
+              ElementsAre(KV{1, 9}, KV{2, 10}, KV{3, 11}));
+}
+
+}  // namespace
+}  // namespace perfetto
@@ -17,6 +17,7 @@
 #include "src/traced/probes/sys_stats/sys_stats_data_source.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <algorithm>
@@ -32,6 +33,7 @@
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/traced/sys_stats_counters.h"
 
@@ -45,7 +47,6 @@ namespace perfetto {
 using protos::pbzero::SysStatsConfig;
 
 namespace {
-constexpr size_t kReadBufSize = 1024 * 16;
 
 base::ScopedFile OpenReadOnly(const char* path) {
   base::ScopedFile fd(base::OpenFile(path, O_RDONLY));
@@ -54,6 +55,25 @@ base::ScopedFile OpenReadOnly(const char* path) {
   return fd;
 }
 
+// Parses the decimal number at |*ptr|, after the spaces that precede it, and
+// moves |*ptr| past it. Returns false at the end of the line. Tokens that are
+// not numbers are read as 0, like strtoll() does.
+bool ParseNextUint(const char** ptr, const char* end, uint64_t* value) {
+  const char* p = *ptr;
+  while (p < end && *p == ' ')
+    p++;
+  if (p == end)
+    return false;
+  uint64_t v = 0;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + static_cast<uint64_t>(*p - '0');
+  while (p < end && *p != ' ')
+    p++;
+  *ptr = p;
+  *value = v;
+  return true;
+}
+
 uint32_t ClampTo10Ms(uint32_t period_ms, const char* counter_name) {
   if (period_ms > 0 && period_ms < 10) {
     PERFETTO_ILOG("%s %" PRIu32
@@ -97,11 +117,8 @@ SysStatsDataSource::SysStatsDataSource(
   psi_io_fd_ = open_fn("/proc/pressure/io");
   psi_memory_fd_ = open_fn("/proc/pressure/memory");
 
-  read_buf_ = base::PagedMemory::Allocate(kReadBufSize);
-
-  // Build a lookup map that allows to quickly translate strings like "MemTotal"
-  // into the corresponding enum value, only for the counters enabled in the
-  // config.
+  // Build the key tables that translate strings like "MemTotal" into the
+  // corresponding enum value, only for the counters enabled in the config.
 
   using protos::pbzero::SysStatsConfig;
   SysStatsConfig::Decoder cfg(ds_config.sys_stats_config_raw());
@@ -121,7 +138,7 @@ SysStatsDataSource::SysStatsDataSource(
   for (size_t i = 0; i < base::ArraySize(kMeminfoKeys); i++) {
     const auto& k = kMeminfoKeys[i];
     if (meminfo_counters_enabled[static_cast<size_t>(k.id)])
-      meminfo_counters_.emplace(k.str, k.id);
+      meminfo_parser_.AddKey(k.str, k.id);
   }
 
   constexpr size_t kMaxVmstatEnum = protos::pbzero::VmstatCounters_MAX;
@@ -139,7 +156,7 @@ SysStatsDataSource::SysStatsDataSource(
   for (size_t i = 0; i < base::ArraySize(kVmstatKeys); i++) {
     const auto& k = kVmstatKeys[i];
     if (vmstat_counters_enabled[static_cast<size_t>(k.id)])
-      vmstat_counters_.emplace(k.str, k.id);
+      vmstat_parser_.AddKey(k.str, k.id);
   }
 
   if (!cfg.has_stat_counters())
@@ -248,18 +265,18 @@ void SysStatsDataSource::ReadSysStats() {
 }
 
 void SysStatsDataSource::ReadDiskStat(protos::pbzero::SysStats* sys_stats) {
-  size_t rsize = ReadFile(&diskstat_fd_, "/proc/diskstats");
+  size_t rsize = reader_.Read(&diskstat_fd_, "/proc/diskstats");
   if (!rsize) {
     return;
   }
 
-  char* buf = static_cast<char*>(read_buf_.Get());
+  char* buf = reader_.buf();
   for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
     uint32_t index = 0;
     auto* disk_stat = sys_stats->add_disk_stat();
     for (base::StringSplitter words(&lines, ' '); words.Next(); index++) {
       if (index == 2) {  // index for device name (string)
-        disk_stat->set_device_name(words.cur_token());
+        disk_stat->set_device_name(words.cur_token(), words.cur_token_size());
       } else if (index >= 5) {  // integer values from index 5
         std::optional<uint64_t> value_address =
             base::CStringToUInt64(words.cur_token());
@@ -307,12 +324,12 @@ void SysStatsDataSource::ReadPsi(protos::pbzero::SysStats* sys_stats) {
                                base::ScopedFile* file, const char* path,
                                PsiSample::PsiResource resource_some,
                                PsiSample::PsiResource resource_full) {
-    size_t rsize = ReadFile(file, path);
+    size_t rsize = reader_.Read(file, path);
     if (!rsize) {
       return;
     }
 
-    char* buf = static_cast<char*>(read_buf_.Get());
+    char* buf = reader_.buf();
     for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
       uint32_t index = 0;
       auto* psi = sys_stats->add_psi();
@@ -354,22 +371,22 @@ void SysStatsDataSource::ReadPsi(protos::pbzero::SysStats* sys_stats) {
 }
 
 void SysStatsDataSource::ReadBuddyInfo(protos::pbzero::SysStats* sys_stats) {
-  size_t rsize = ReadFile(&buddy_fd_, "/proc/buddyinfo");
+  size_t rsize = reader_.Read(&buddy_fd_, "/proc/buddyinfo");
   if (!rsize) {
     return;
   }
 
-  char* buf = static_cast<char*>(read_buf_.Get());
+  char* buf = reader_.buf();
   for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
     uint32_t index = 0;
     auto* buddy_info = sys_stats->add_buddy_info();
     for (base::StringSplitter words(&lines, ' '); words.Next();) {
       if (index == 1) {
-        std::string token = words.cur_token();
-        token = token.substr(0, token.find(","));
-        buddy_info->set_node(token);
+        // e.g. "0," -> "0".
+        const char* token = words.cur_token();
+        buddy_info->set_node(token, strcspn(token, ","));
       } else if (index == 3) {
-        buddy_info->set_zone(words.cur_token());
+        buddy_info->set_zone(words.cur_token(), words.cur_token_size());
       } else if (index > 3) {
         buddy_info->add_order_pages(
             static_cast<uint32_t>(strtoul(words.cur_token(), nullptr, 0)));
@@ -380,20 +397,25 @@ void SysStatsDataSource::ReadBuddyInfo(protos::pbzero::SysStats* sys_stats) {
 }
 
 void SysStatsDataSource::ReadDevfreq(protos::pbzero::SysStats* sys_stats) {
-  base::ScopedDir devfreq_dir = OpenDevfreqDir();
-  if (devfreq_dir) {
-    while (struct dirent* dir_ent = readdir(*devfreq_dir)) {
+  if (!devfreq_devices_listed_) {
+    devfreq_devices_listed_ = true;
+    base::ScopedDir devfreq_dir = OpenDevfreqDir();
+    while (devfreq_dir) {
+      struct dirent* dir_ent = readdir(*devfreq_dir);
+      if (!dir_ent)
+        break;
       // Entries in /sys/class/devfreq are symlinks to /devices/platform
-      if (dir_ent->d_type != DT_LNK)
-        continue;
-      const char* name = dir_ent->d_name;
-      const char* file_content = ReadDevfreqCurFreq(name);
-      auto value = static_cast<uint64_t>(strtoll(file_content, nullptr, 10));
-      auto* devfreq = sys_stats->add_devfreq();
-      devfreq->set_key(name);
-      devfreq->set_value(value);
+      if (dir_ent->d_type == DT_LNK)
+        devfreq_devices_.emplace_back(dir_ent->d_name);
     }
   }
+  for (const std::string& name : devfreq_devices_) {
+    const char* file_content = ReadDevfreqCurFreq(name);
+    auto value = static_cast<uint64_t>(strtoll(file_content, nullptr, 10));
+    auto* devfreq = sys_stats->add_devfreq();
+    devfreq->set_key(name.data(), name.size());
+    devfreq->set_value(value);
+  }
 }
 
 void SysStatsDataSource::ReadCpufreq(protos::pbzero::SysStats* sys_stats) {
@@ -419,82 +441,74 @@ const char* SysStatsDataSource::ReadDevfreqCurFreq(
   const char* freq_file_name = "cur_freq";
   base::StackString<256> cur_freq_path("%s/%s/%s", devfreq_base_path,
                                        deviceName.c_str(), freq_file_name);
-  base::ScopedFile fd = OpenReadOnly(cur_freq_path.c_str());
-  if (!fd && !devfreq_error_logged_) {
-    devfreq_error_logged_ = true;
-    PERFETTO_PLOG("Failed to open %s", cur_freq_path.c_str());
-    return "";
+  auto it = devfreq_cur_freq_fds_.find(deviceName);
+  if (it == devfreq_cur_freq_fds_.end()) {
+    base::ScopedFile fd(base::OpenFile(cur_freq_path.c_str(), O_RDONLY));
+    if (!fd && !devfreq_error_logged_) {
+      devfreq_error_logged_ = true;
+      PERFETTO_PLOG("Failed to open %s", cur_freq_path.c_str());
+    }
+    // Failures are cached too, rather than retried on every read.
+    it = devfreq_cur_freq_fds_.emplace(deviceName, std::move(fd)).first;
   }
-  size_t rsize = ReadFile(&fd, cur_freq_path.c_str());
+  size_t rsize = reader_.Read(&it->second, cur_freq_path.c_str());
   if (!rsize)
     return "";
-  return static_cast<char*>(read_buf_.Get());
+  return reader_.buf();
 }
 
 void SysStatsDataSource::ReadMeminfo(protos::pbzero::SysStats* sys_stats) {
-  size_t rsize = ReadFile(&meminfo_fd_, "/proc/meminfo");
+  size_t rsize = reader_.Read(&meminfo_fd_, "/proc/meminfo");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    // Extract the meminfo key, dropping trailing ':' (e.g., "MemTotal: NN KB").
-    words.cur_token()[words.cur_token_size() - 1] = '\0';
-    auto it = meminfo_counters_.find(words.cur_token());
-    if (it == meminfo_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+  // |rsize| includes the null terminator.
+  const char* buf = reader_.buf();
+  meminfo_parser_.Parse(buf, rsize - 1, [sys_stats](int32_t id, uint64_t v) {
     auto* meminfo = sys_stats->add_meminfo();
-    meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(counter_id));
-    meminfo->set_value(value);
-  }
+    meminfo->set_key(static_cast<protos::pbzero::MeminfoCounters>(id));
+    meminfo->set_value(v);
+  });
 }
 
 void SysStatsDataSource::ReadVmstat(protos::pbzero::SysStats* sys_stats) {
-  size_t rsize = ReadFile(&vmstat_fd_, "/proc/vmstat");
+  size_t rsize = reader_.Read(&vmstat_fd_, "/proc/vmstat");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
-    auto it = vmstat_counters_.find(words.cur_token());
-    if (it == vmstat_counters_.end())
-      continue;
-    int counter_id = it->second;
-    if (!words.Next())
-      continue;
-    auto value = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+  const char* buf = reader_.buf();
+  vmstat_parser_.Parse(buf, rsize - 1, [sys_stats](int32_t id, uint64_t v) {
     auto* vmstat = sys_stats->add_vmstat();
-    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(counter_id));
-    vmstat->set_value(value);
-  }
+    vmstat->set_key(static_cast<protos::pbzero::VmstatCounters>(id));
+    vmstat->set_value(v);
+  });
 }
 
 void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
-  size_t rsize = ReadFile(&stat_fd_, "/proc/stat");
+  size_t rsize = reader_.Read(&stat_fd_, "/proc/stat");
   if (!rsize)
     return;
-  char* buf = static_cast<char*>(read_buf_.Get());
-  for (base::StringSplitter lines(buf, rsize, '\n'); lines.Next();) {
-    base::StringSplitter words(&lines, ' ');
-    if (!words.Next())
-      continue;
+  const char* buf = reader_.buf();
+  const char* const end = buf + rsize - 1;  // Without the null terminator.
+  for (const char* line = buf; line < end;) {
+    const char* eol = static_cast<const char*>(
+        memchr(line, '\n', static_cast<size_t>(end - line)));
+    if (!eol)
+      eol = end;
+    const char* ptr = line;
+    while (ptr < eol && *ptr != ' ')
+      ptr++;
+    base::StringView key(line, static_cast<size_t>(ptr - line));
+    line = eol + 1;
 
     // Per-CPU stats.
     if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_CPU_TIMES)) &&
-        words.cur_token_size() > 3 && !strncmp(words.cur_token(), "cpu", 3)) {
-      long cpu_id = strtol(words.cur_token() + 3, nullptr, 10);
+        key.size() > 3 && key.StartsWith("cpu")) {
+      const char* cpu_id_ptr = key.data() + 3;
+      uint64_t cpu_id = 0;
+      ParseNextUint(&cpu_id_ptr, key.end(), &cpu_id);
       std::array<uint64_t, 7> cpu_times{};
-      for (size_t i = 0; i < cpu_times.size() && words.Next(); i++) {
-        cpu_times[i] =
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+      for (size_t i = 0; i < cpu_times.size(); i++) {
+        if (!ParseNextUint(&ptr, eol, &cpu_times[i]))
+          break;
       }
       auto* cpu_stat = sys_stats->add_cpu_stat();
       cpu_stat->set_cpu_id(static_cast<uint32_t>(cpu_id));
@@ -508,9 +522,9 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     }
     // IRQ counters
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_IRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "intr")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+             key == "intr") {
+      uint64_t v;
+      for (size_t i = 0; ParseNextUint(&ptr, eol, &v); i++) {
         if (i == 0) {
           sys_stats->set_num_irq_total(v);
         } else if (v > 0) {
@@ -523,9 +537,9 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     // Softirq counters.
     else if ((stat_enabled_fields_ &
               (1 << SysStatsConfig::STAT_SOFTIRQ_COUNTS)) &&
-             !strcmp(words.cur_token(), "softirq")) {
-      for (size_t i = 0; words.Next(); i++) {
-        auto v = static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10));
+             key == "softirq") {
+      uint64_t v;
+      for (size_t i = 0; ParseNextUint(&ptr, eol, &v); i++) {
         if (i == 0) {
           sys_stats->set_num_softirq_total(v);
         } else {
@@ -537,13 +551,11 @@ void SysStatsDataSource::ReadStat(protos::pbzero::SysStats* sys_stats) {
     }
     // Number of forked processes since boot.
     else if ((stat_enabled_fields_ & (1 << SysStatsConfig::STAT_FORK_COUNT)) &&
-             !strcmp(words.cur_token(), "processes")) {
-      if (words.Next()) {
-        sys_stats->set_num_forks(
-            static_cast<uint64_t>(strtoll(words.cur_token(), nullptr, 10)));
-      }
+             key == "processes") {
+      uint64_t v;
+      if (ParseNextUint(&ptr, eol, &v))
+        sys_stats->set_num_forks(v);
     }
-
   }  // for (line)
 }
 
@@ -555,18 +567,4 @@ void SysStatsDataSource::Flush(FlushRequestID, std::function<void()> callback) {
   writer_->Flush(callback);
 }
 
-size_t SysStatsDataSource::ReadFile(base::ScopedFile* fd, const char* path) {
-  if (!*fd)
-    return 0;
-  ssize_t res = pread(**fd, read_buf_.Get(), kReadBufSize - 1, 0);
-  if (res <= 0) {
-    PERFETTO_PLOG("Failed reading %s", path);
-    fd->reset();
-    return 0;
-  }
-  size_t rsize = static_cast<size_t>(res);
-  static_cast<char*>(read_buf_.Get())[rsize] = '\0';
-  return rsize + 1;  // Include null terminator in the count.
-}
-
 }  // namespace perfetto
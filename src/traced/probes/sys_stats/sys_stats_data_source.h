@@ -17,20 +17,20 @@
 #ifndef SRC_TRACED_PROBES_SYS_STATS_SYS_STATS_DATA_SOURCE_H_
 #define SRC_TRACED_PROBES_SYS_STATS_SYS_STATS_DATA_SOURCE_H_
 
-#include <string.h>
-
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
-#include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/weak_ptr.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "perfetto/tracing/core/data_source_config.h"
 #include "src/traced/probes/common/cpu_freq_info.h"
+#include "src/traced/probes/common/proc_file_reader.h"
 #include "src/traced/probes/probes_data_source.h"
+#include "src/traced/probes/sys_stats/keyed_counter_parser.h"
 
 namespace perfetto {
 
@@ -63,6 +63,9 @@ class SysStatsDataSource : public ProbesDataSource {
 
   base::WeakPtr<SysStatsDataSource> GetWeakPtr() const;
 
+  // Reads the counters due at the current tick. Public for benchmarks.
+  void ReadSysStats();
+
   void set_ns_per_user_hz_for_testing(uint64_t ns) { ns_per_user_hz_ = ns; }
   uint32_t tick_for_testing() const { return tick_; }
 
@@ -71,17 +74,10 @@ class SysStatsDataSource : public ProbesDataSource {
   virtual const char* ReadDevfreqCurFreq(const std::string& name);
 
  private:
-  struct CStrCmp {
-    bool operator()(const char* a, const char* b) const {
-      return strcmp(a, b) < 0;
-    }
-  };
-
   static void Tick(base::WeakPtr<SysStatsDataSource>);
 
   SysStatsDataSource(const SysStatsDataSource&) = delete;
   SysStatsDataSource& operator=(const SysStatsDataSource&) = delete;
-  void ReadSysStats();  // Virtual for testing.
   void ReadMeminfo(protos::pbzero::SysStats* sys_stats);
   void ReadVmstat(protos::pbzero::SysStats* sys_stats);
   void ReadStat(protos::pbzero::SysStats* sys_stats);
@@ -90,7 +86,6 @@ class SysStatsDataSource : public ProbesDataSource {
   void ReadBuddyInfo(protos::pbzero::SysStats* sys_stats);
   void ReadDiskStat(protos::pbzero::SysStats* sys_stats);
   void ReadPsi(protos::pbzero::SysStats* sys_stats);
-  size_t ReadFile(base::ScopedFile*, const char* path);
 
   base::TaskRunner* const task_runner_;
   std::unique_ptr<TraceWriter> writer_;
@@ -102,10 +97,15 @@ class SysStatsDataSource : public ProbesDataSource {
   base::ScopedFile psi_cpu_fd_;
   base::ScopedFile psi_io_fd_;
   base::ScopedFile psi_memory_fd_;
-  base::PagedMemory read_buf_;
+  ProcFileReader reader_;
   TraceWriter::TracePacketHandle cur_packet_;
-  std::map<const char*, int, CStrCmp> meminfo_counters_;
-  std::map<const char*, int, CStrCmp> vmstat_counters_;
+  KeyedCounterParser meminfo_parser_;
+  KeyedCounterParser vmstat_parser_;
+  // The devices in /sys/class/devfreq, listed on the first read, and the
+  // cur_freq file of each.
+  std::vector<std::string> devfreq_devices_;
+  bool devfreq_devices_listed_ = false;
+  std::map<std::string, base::ScopedFile> devfreq_cur_freq_fds_;
   uint64_t ns_per_user_hz_ = 0;
   uint32_t tick_ = 0;
   uint32_t tick_period_ms_ = 0;
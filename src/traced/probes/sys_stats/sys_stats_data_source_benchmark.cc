@@ -0,0 +1,135 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Times SysStatsDataSource::ReadSysStats() on snapshots of the /proc files it
+// polls, so that only the reading and parsing is measured rather than the
+// kernel generating the files.
+// The snapshots are read from the directory pointed to by the
+// PERFETTO_SYS_STATS_SNAPSHOT env variable, if set, e.g. captured with:
+//   for f in meminfo vmstat stat; do adb shell cat /proc/$f > $f; done
+// Otherwise, the /proc files of the machine running the benchmark are
+// snapshotted at startup.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/scoped_file.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/tracing/core/data_source_config.h"
+#include "src/base/test/test_task_runner.h"
+#include "src/traced/probes/common/cpu_freq_info_for_testing.h"
+#include "src/traced/probes/sys_stats/sys_stats_data_source.h"
+#include "src/tracing/core/null_trace_writer.h"
+
+#include "protos/perfetto/common/sys_stats_counters.gen.h"
+#include "protos/perfetto/config/sys_stats/sys_stats_config.gen.h"
+
+namespace perfetto {
+namespace {
+
+constexpr const char* kSnapshotFiles[] = {"meminfo", "vmstat", "stat"};
+
+const std::string& SnapshotDir() {
+  static std::string* dir = [] {
+    if (const char* env = getenv("PERFETTO_SYS_STATS_SNAPSHOT"))
+      return new std::string(env);
+    // Leaked, like the snapshot files, until the end of the process.
+    auto* tmp = new base::TempDir(base::TempDir::Create());
+    for (const char* name : kSnapshotFiles) {
+      std::string contents;
+      PERFETTO_CHECK(base::ReadFile(std::string("/proc/") + name, &contents));
+      base::ScopedFile fd(base::OpenFile(tmp->path() + "/" + name,
+                                         O_WRONLY | O_CREAT | O_TRUNC, 0600));
+      PERFETTO_CHECK(base::WriteAll(*fd, contents.data(), contents.size()) ==
+                     static_cast<ssize_t>(contents.size()));
+    }
+    return new std::string(tmp->path());
+  }();
+  return *dir;
+}
+
+// Opens the snapshot of /proc/<name> instead of the file itself.
+base::ScopedFile OpenSnapshot(const char* path) {
+  const char* name = strrchr(path, '/') + 1;
+  for (const char* snapshot : kSnapshotFiles) {
+    if (!strcmp(name, snapshot) && !strncmp(path, "/proc/", 6))
+      return base::OpenFile(SnapshotDir() + "/" + name, O_RDONLY);
+  }
+  return base::ScopedFile();
+}
+
+void BM_SysStats(benchmark::State& state,
+                 const protos::gen::SysStatsConfig& sys_cfg) {
+  base::TestTaskRunner task_runner;
+  CpuFreqInfoForTesting cpu_freq_info;
+  DataSourceConfig config;
+  config.set_sys_stats_config_raw(sys_cfg.SerializeAsString());
+  SysStatsDataSource data_source(&task_runner, 0,
+                                 std::make_unique<NullTraceWriter>(), config,
+                                 cpu_freq_info.GetInstance(), OpenSnapshot);
+  for (auto _ : state)
+    data_source.ReadSysStats();
+}
+
+// All the counters of each file, as when the config doesn't list any.
+void BM_SysStatsMeminfo(benchmark::State& state) {
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  BM_SysStats(state, sys_cfg);
+}
+BENCHMARK(BM_SysStatsMeminfo);
+
+void BM_SysStatsVmstat(benchmark::State& state) {
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_vmstat_period_ms(10);
+  BM_SysStats(state, sys_cfg);
+}
+BENCHMARK(BM_SysStatsVmstat);
+
+void BM_SysStatsStat(benchmark::State& state) {
+  protos::gen::SysStatsConfig sys_cfg;
+  sys_cfg.set_stat_period_ms(10);
+  BM_SysStats(state, sys_cfg);
+}
+BENCHMARK(BM_SysStatsStat);
+
+// A typical config, with a few counters of each file.
+void BM_SysStatsFewCounters(benchmark::State& state) {
+  using protos::gen::MeminfoCounters;
+  using protos::gen::SysStatsConfig;
+  using protos::gen::VmstatCounters;
+  SysStatsConfig sys_cfg;
+  sys_cfg.set_meminfo_period_ms(10);
+  sys_cfg.add_meminfo_counters(MeminfoCounters::MEMINFO_MEM_AVAILABLE);
+  sys_cfg.add_meminfo_counters(MeminfoCounters::MEMINFO_CACHED);
+  sys_cfg.add_meminfo_counters(MeminfoCounters::MEMINFO_SWAP_FREE);
+  sys_cfg.set_vmstat_period_ms(10);
+  sys_cfg.add_vmstat_counters(VmstatCounters::VMSTAT_PGFAULT);
+  sys_cfg.add_vmstat_counters(VmstatCounters::VMSTAT_PGMAJFAULT);
+  sys_cfg.add_vmstat_counters(VmstatCounters::VMSTAT_NR_FREE_PAGES);
+  sys_cfg.set_stat_period_ms(10);
+  sys_cfg.add_stat_counters(SysStatsConfig::STAT_CPU_TIMES);
+  sys_cfg.add_stat_counters(SysStatsConfig::STAT_FORK_COUNT);
+  BM_SysStats(state, sys_cfg);
+}
+BENCHMARK(BM_SysStatsFewCounters);
+
+}  // namespace
+}  // namespace perfetto
@@ -20,6 +20,7 @@
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/string_splitter.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/protozero/scattered_heap_buffer.h"
 
 #include "protos/perfetto/trace/system_info/cpu_info.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -48,16 +49,34 @@ const ProbesDataSource::Descriptor SystemInfoDataSource::descriptor = {
 SystemInfoDataSource::SystemInfoDataSource(
     TracingSessionID session_id,
     std::unique_ptr<TraceWriter> writer,
-    std::unique_ptr<CpuFreqInfo> cpu_freq_info)
+    std::unique_ptr<CpuFreqInfo> cpu_freq_info,
+    Cache* cache)
     : ProbesDataSource(session_id, &descriptor),
       writer_(std::move(writer)),
-      cpu_freq_info_(std::move(cpu_freq_info)) {}
+      cpu_freq_info_(std::move(cpu_freq_info)),
+      cache_(cache) {}
 
 void SystemInfoDataSource::Start() {
   auto packet = writer_->NewTracePacket();
   packet->set_timestamp(static_cast<uint64_t>(base::GetBootTimeNs().count()));
-  auto* cpu_info = packet->set_cpu_info();
 
+  // /proc/cpuinfo and the frequencies only change when CPUs are hotplugged.
+  Cache local_cache;
+  Cache* cache = cache_ ? cache_ : &local_cache;
+  const std::string& online_cpus = cpu_freq_info_->online_cpus();
+  if (cache->cpu_info.empty() || cache->online_cpus != online_cpus) {
+    protozero::HeapBuffered<protos::pbzero::CpuInfo> cpu_info;
+    WriteCpuInfo(cpu_info.get());
+    cache->online_cpus = online_cpus;
+    cache->cpu_info = cpu_info.SerializeAsString();
+  }
+  packet->AppendBytes(protos::pbzero::TracePacket::kCpuInfoFieldNumber,
+                      cache->cpu_info.data(), cache->cpu_info.size());
+  packet->Finalize();
+  writer_->Flush();
+}
+
+void SystemInfoDataSource::WriteCpuInfo(protos::pbzero::CpuInfo* cpu_info) {
   // Parse /proc/cpuinfo which contains groups of "key\t: value" lines separated
   // by an empty line. Each group represents a CPU. See the full example in the
   // unittest.
@@ -96,9 +115,6 @@ void SystemInfoDataSource::Start() {
     else if (key == kProcessor)
       cpu_index = value;
   }
-
-  packet->Finalize();
-  writer_->Flush();
 }
 
 void SystemInfoDataSource::Flush(FlushRequestID,
@@ -18,6 +18,7 @@
 #define SRC_TRACED_PROBES_SYSTEM_INFO_SYSTEM_INFO_DATA_SOURCE_H_
 
 #include <memory>
+#include <string>
 
 #include "perfetto/ext/tracing/core/trace_writer.h"
 #include "src/traced/probes/common/cpu_freq_info.h"
@@ -25,13 +26,27 @@
 
 namespace perfetto {
 
+namespace protos {
+namespace pbzero {
+class CpuInfo;
+}  // namespace pbzero
+}  // namespace protos
+
 class SystemInfoDataSource : public ProbesDataSource {
  public:
   static const ProbesDataSource::Descriptor descriptor;
 
+  // The CpuInfo message written by a previous session, reused by the next
+  // ones as long as the online CPUs are the same. Owned by ProbesProducer.
+  struct Cache {
+    std::string online_cpus;
+    std::string cpu_info;  // Serialized CpuInfo proto.
+  };
+
   SystemInfoDataSource(TracingSessionID,
                        std::unique_ptr<TraceWriter> writer,
-                       std::unique_ptr<CpuFreqInfo> cpu_freq_info);
+                       std::unique_ptr<CpuFreqInfo> cpu_freq_info,
+                       Cache* cache = nullptr);
 
   // ProbesDataSource implementation.
   void Start() override;
@@ -42,7 +57,11 @@ class SystemInfoDataSource : public ProbesDataSource {
 
  private:
   std::unique_ptr<TraceWriter> writer_;
+  // Parses /proc/cpuinfo into |cpu_info|.
+  void WriteCpuInfo(protos::pbzero::CpuInfo* cpu_info);
+
   std::unique_ptr<CpuFreqInfo> cpu_freq_info_;
+  Cache* const cache_;
 };
 
 }  // namespace perfetto
@@ -109,24 +109,28 @@ Hardware	: Qualcomm Technologies, Inc SDM670
 class TestSystemInfoDataSource : public SystemInfoDataSource {
  public:
   TestSystemInfoDataSource(std::unique_ptr<TraceWriter> writer,
-                           std::unique_ptr<CpuFreqInfo> cpu_freq_info)
+                           std::unique_ptr<CpuFreqInfo> cpu_freq_info,
+                           Cache* cache)
       : SystemInfoDataSource(
             /* session_id */ 0,
             std::move(writer),
-            std::move(cpu_freq_info)) {}
+            std::move(cpu_freq_info),
+            cache) {}
 
   MOCK_METHOD(std::string, ReadFile, (std::string), (override));
 };
 
 class SystemInfoDataSourceTest : public ::testing::Test {
  protected:
-  std::unique_ptr<TestSystemInfoDataSource> GetSystemInfoDataSource() {
+  std::unique_ptr<TestSystemInfoDataSource> GetSystemInfoDataSource(
+      SystemInfoDataSource::Cache* cache = nullptr) {
     auto writer =
         std::unique_ptr<TraceWriterForTesting>(new TraceWriterForTesting());
     writer_raw_ = writer.get();
     auto instance =
         std::unique_ptr<TestSystemInfoDataSource>(new TestSystemInfoDataSource(
-            std::move(writer), cpu_freq_info_for_testing.GetInstance()));
+            std::move(writer), cpu_freq_info_for_testing.GetInstance(),
+            cache));
     return instance;
   }
 
@@ -156,5 +160,30 @@ TEST_F(SystemInfoDataSourceTest, CpuInfoAndroid) {
                           1536000, 1747200, 1843200, 1996800, 2803200));
 }
 
+TEST_F(SystemInfoDataSourceTest, CpuInfoCachedUntilHotplug) {
+  SystemInfoDataSource::Cache cache;
+  auto data_source = GetSystemInfoDataSource(&cache);
+  EXPECT_CALL(*data_source, ReadFile("/proc/cpuinfo"))
+      .WillOnce(Return(kMockCpuInfoAndroid));
+  data_source->Start();
+  ASSERT_EQ(writer_raw_->GetOnlyTracePacket().cpu_info().cpus_size(), 8);
+
+  // The next session reuses the CpuInfo of the first one.
+  data_source = GetSystemInfoDataSource(&cache);
+  EXPECT_CALL(*data_source, ReadFile("/proc/cpuinfo")).Times(0);
+  data_source->Start();
+  auto cpu_info = writer_raw_->GetOnlyTracePacket().cpu_info();
+  ASSERT_EQ(cpu_info.cpus_size(), 8);
+  EXPECT_EQ(cpu_info.cpus()[1].frequencies_size(), 11);
+
+  // CPUs went offline: /proc/cpuinfo is parsed again.
+  cpu_freq_info_for_testing.SetOnlineCpus("0\n");
+  data_source = GetSystemInfoDataSource(&cache);
+  EXPECT_CALL(*data_source, ReadFile("/proc/cpuinfo"))
+      .WillOnce(Return(kMockCpuInfoAndroid));
+  data_source->Start();
+  EXPECT_EQ(writer_raw_->GetOnlyTracePacket().cpu_info().cpus_size(), 8);
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -36,9 +36,14 @@
 #endif
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include "src/ipc/zlib_frame_compressor.h"
 #include "src/tracing/service/zlib_compressor.h"
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include "src/tracing/service/zstd_compressor.h"
+#endif
+
 namespace perfetto {
 namespace {
 void PrintUsage(const char* prog_name) {
@@ -57,6 +62,10 @@ Options and arguments
     --enable-relay-endpoint : enables the relay endpoint on producer socket(s)
         for traced_relay to communicate with traced in a multiple-machine
         tracing session.
+    --relay-producer-shmem-dir <dir> : lets the producers behind traced_relay
+        provide their shared memory buffer as a file in <dir>, a directory
+        backed by memory shared with their machine (e.g. cross-VM shared
+        memory). Only trusted producers must be able to write into <dir>.
 
 Example:
     %s --set-socket-permissions traced-producer:0660:traced-consumer:0660
@@ -73,11 +82,13 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
     OPT_VERSION = 1000,
     OPT_SET_SOCKET_PERMISSIONS = 1001,
     OPT_BACKGROUND,
-    OPT_ENABLE_RELAY_ENDPOINT
+    OPT_ENABLE_RELAY_ENDPOINT,
+    OPT_RELAY_PRODUCER_SHMEM_DIR
   };
 
   bool background = false;
   bool enable_relay_endpoint = false;
+  std::string relay_producer_shmem_dir;
 
   static const option long_options[] = {
       {"background", no_argument, nullptr, OPT_BACKGROUND},
@@ -86,6 +97,8 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
        OPT_SET_SOCKET_PERMISSIONS},
       {"enable-relay-endpoint", no_argument, nullptr,
        OPT_ENABLE_RELAY_ENDPOINT},
+      {"relay-producer-shmem-dir", required_argument, nullptr,
+       OPT_RELAY_PRODUCER_SHMEM_DIR},
       {nullptr, 0, nullptr, 0}};
 
   std::string producer_socket_group, consumer_socket_group,
@@ -118,6 +131,9 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
       case OPT_ENABLE_RELAY_ENDPOINT:
         enable_relay_endpoint = true;
         break;
+      case OPT_RELAY_PRODUCER_SHMEM_DIR:
+        relay_producer_shmem_dir = optarg;
+        break;
       default:
         PrintUsage(argv[0]);
         return 1;
@@ -133,9 +149,16 @@ int PERFETTO_EXPORT_ENTRYPOINT ServiceMain(int argc, char** argv) {
   TracingService::InitOpts init_opts = {};
 #if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
   init_opts.compressor_fn = &ZlibCompressFn;
+  init_opts.relay_frame_decompressor_fn = &ipc::ZlibDecompressFrames;
+#endif
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+  init_opts.zstd_compressor_fn = &ZstdCompressFn;
 #endif
+  init_opts.write_into_file_on_dedicated_thread = true;
+  init_opts.ipc_on_dedicated_thread = true;
   if (enable_relay_endpoint)
     init_opts.enable_relay_endpoint = true;
+  init_opts.relay_producer_shmem_dir = relay_producer_shmem_dir;
   svc = ServiceIPCHost::CreateInstance(&task_runner, init_opts);
 
   // When built as part of the Android tree, the two socket are created and
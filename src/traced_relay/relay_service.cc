@@ -35,6 +35,10 @@
 #include "src/traced_relay/socket_relay_handler.h"
 #include "src/tracing/ipc/producer/relay_ipc_client.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+#include "src/ipc/zlib_frame_compressor.h"
+#endif
+
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID) || \
     PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) ||   \
     PERFETTO_BUILDFLAG(PERFETTO_OS_APPLE)
@@ -153,8 +157,10 @@ void RelayClient::SendSyncClockRequest() {
   relay_ipc_client_->SyncClock(request);
 }
 
-void RelayClient::OnSyncClockResponse(const protos::gen::SyncClockResponse&) {
+void RelayClient::OnSyncClockResponse(
+    const protos::gen::SyncClockResponse& resp) {
   static constexpr uint32_t kSyncClockIntervalMs = 30000;  // 30 Sec.
+  host_accepts_compressed_frames_ = resp.accepts_compressed_frames();
   switch (phase_) {
     case Phase::CONNECTING:
       PERFETTO_DFATAL("Should be unreachable.");
@@ -261,6 +267,14 @@ void RelayService::OnConnect(base::UnixSocket* self, bool connected) {
   // Shut down event handlers and pair with a server connection.
   it->socket_pair->second.sock = self->ReleaseSocket();
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
+  // Compress the frames sent by the producer, which carry its trace data, if
+  // the host accepts them. The connections made before the first clock sync
+  // with the host aren't compressed.
+  if (relay_client_ && relay_client_->host_accepts_compressed_frames())
+    it->socket_pair->first.EnableFrameCompression(&ipc::ZlibCompressFrames);
+#endif
+
   // Transfer the socket pair to SocketRelayHandler.
   socket_relay_handler_.AddSocketPair(std::move(it->socket_pair));
 }
@@ -57,6 +57,12 @@ class RelayClient : private base::UnixSocket::EventListener,
     return clock_synced_with_service_for_testing_;
   }
 
+  // Whether the host accepts compressed frames on the relayed producer
+  // connections. Known after the first clock sync.
+  bool host_accepts_compressed_frames() const {
+    return host_accepts_compressed_frames_;
+  }
+
  private:
   // UnixSocket::EventListener implementation for connecting to the client
   // socket.
@@ -84,6 +90,7 @@ class RelayClient : private base::UnixSocket::EventListener,
   enum class Phase : uint32_t { CONNECTING = 1, PING, UPDATE };
   Phase phase_ = Phase::CONNECTING;
   bool clock_synced_with_service_for_testing_ = false;
+  bool host_accepts_compressed_frames_ = false;
 
   base::TaskRunner* task_runner_;
   OnErrorCallback on_error_callback_;
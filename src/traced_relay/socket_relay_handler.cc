@@ -36,6 +36,8 @@ namespace {
 static constexpr int kWatchdogTimeoutMs = 30000;
 // Timeout of the epoll_wait() call.
 static constexpr int kPollTimeoutMs = 30000;
+// The size of the header of the IPC frames. See BufferedFrameDeserializer.
+static constexpr size_t kFrameHeaderSize = sizeof(uint32_t);
 }  // namespace
 
 FdPoller::Watcher::~Watcher() = default;
@@ -116,6 +118,83 @@ void FdPoller::RemoveWatch(base::PlatformHandle fd) {
   poll_fds_.erase(it);
 }
 
+bool SocketWithBuffer::CompressFrames() {
+  PERFETTO_DCHECK(compressor_fn_);
+  const char* frames = reinterpret_cast<const char*>(data());
+  size_t consumed = 0;    // The frames already moved to |output_|.
+  size_t batch_size = 0;  // The frames batched after them.
+  auto compress_batch = [&] {
+    if (batch_size && !compressor_fn_(frames + consumed, batch_size, &output_))
+      return false;
+    consumed += batch_size;
+    batch_size = 0;
+    return true;
+  };
+
+  for (;;) {
+    size_t offset = consumed + batch_size;
+    if (data_size_ - offset < kFrameHeaderSize)
+      break;
+    uint32_t payload_size = 0;
+    memcpy(base::AssumeLittleEndian(&payload_size), frames + offset,
+           kFrameHeaderSize);
+    if (payload_size > data_size_ - offset - kFrameHeaderSize)
+      break;  // The frame isn't fully buffered yet.
+    size_t frame_size = kFrameHeaderSize + payload_size;
+    if (batch_size + frame_size > kMaxCompressedBatchSize) {
+      if (!compress_batch())
+        return false;
+      if (frame_size > kMaxCompressedBatchSize) {
+        // Too large to be batched: relay it as is.
+        output_.append(frames + consumed, frame_size);
+        consumed += frame_size;
+        continue;
+      }
+    }
+    batch_size += frame_size;
+  }
+  if (!compress_batch())
+    return false;
+
+  // A frame larger than the buffer can never be relayed.
+  if (consumed == 0 && available_bytes() == 0)
+    return false;
+  DequeueData(consumed);
+  return true;
+}
+
+const uint8_t* SocketWithBuffer::output_data() {
+  if (!compressor_fn_)
+    return data();
+  return reinterpret_cast<const uint8_t*>(&output_[output_offset_]);
+}
+
+size_t SocketWithBuffer::output_size() {
+  if (!compressor_fn_)
+    return data_size();
+  return output_.size() - output_offset_;
+}
+
+void SocketWithBuffer::DequeueOutput(size_t bytes) {
+  if (!compressor_fn_)
+    return DequeueData(bytes);
+  PERFETTO_CHECK(bytes <= output_size());
+  output_offset_ += bytes;
+  if (output_offset_ == output_.size()) {
+    output_.clear();
+    output_offset_ = 0;
+  } else if (output_offset_ >= kBuffSize) {
+    output_.erase(0, output_offset_);
+    output_offset_ = 0;
+  }
+}
+
+bool SocketWithBuffer::CanRead() {
+  // With frame compression, also stop reading while the output backs up.
+  return available_bytes() > 0 &&
+         (!compressor_fn_ || output_size() < kBuffSize);
+}
+
 SocketRelayHandler::SocketRelayHandler() : fd_poller_(this) {
   PERFETTO_DETACH_FROM_THREAD(io_thread_checker_);
 
@@ -177,7 +256,7 @@ void SocketRelayHandler::OnFdReadable(base::PlatformHandle fd) {
   auto [fd_sock, peer_sock] = *socket_pair;
   // Buffer some bytes.
   auto peer_fd = peer_sock.sock.fd();
-  while (fd_sock.available_bytes() > 0) {
+  while (fd_sock.CanRead()) {
     auto rsize =
         fd_sock.sock.Receive(fd_sock.buffer(), fd_sock.available_bytes());
     if (rsize > 0) {
@@ -190,20 +269,26 @@ void SocketRelayHandler::OnFdReadable(base::PlatformHandle fd) {
       RemoveSocketPair(fd_sock, peer_sock);
       return;
     }
+    break;  // errno == EAGAIN.
+  }
 
-    // If there is any buffered data that needs to be sent to |peer_sock|, arm
-    // the write watcher.
-    if (fd_sock.data_size() > 0) {
-      fd_poller_.WatchForWrite(peer_fd);
-    }
+  if (fd_sock.frame_compression_enabled() && !fd_sock.CompressFrames()) {
+    PERFETTO_ELOG("Failed to compress the relayed frames");
+    RemoveSocketPair(fd_sock, peer_sock);
     return;
   }
-  // We are not bufferable: need to turn off POLLIN to avoid spinning.
-  fd_poller_.UnwatchForRead(fd);
-  PERFETTO_DCHECK(fd_sock.data_size() > 0);
-  // Watching for POLLOUT will cause an OnFdWritable() event of
-  // |peer_sock|.
-  fd_poller_.WatchForWrite(peer_fd);
+
+  // If there is any buffered data that needs to be sent to |peer_sock|, arm
+  // the write watcher. Watching for POLLOUT will cause an OnFdWritable() event
+  // of |peer_sock|.
+  if (fd_sock.output_size() > 0)
+    fd_poller_.WatchForWrite(peer_fd);
+
+  // If we are not bufferable: need to turn off POLLIN to avoid spinning.
+  if (!fd_sock.CanRead()) {
+    PERFETTO_DCHECK(fd_sock.output_size() > 0);
+    fd_poller_.UnwatchForRead(fd);
+  }
 }
 
 void SocketRelayHandler::OnFdWritable(base::PlatformHandle fd) {
@@ -216,10 +301,11 @@ void SocketRelayHandler::OnFdWritable(base::PlatformHandle fd) {
   auto [fd_sock, peer_sock] = *socket_pair;
   // |fd_sock| can be written to without blocking. Now we can transfer from the
   // buffer in |peer_sock|.
-  while (peer_sock.data_size() > 0) {
-    auto wsize = fd_sock.sock.Send(peer_sock.data(), peer_sock.data_size());
+  while (peer_sock.output_size() > 0) {
+    auto wsize =
+        fd_sock.sock.Send(peer_sock.output_data(), peer_sock.output_size());
     if (wsize > 0) {
-      peer_sock.DequeueData(static_cast<size_t>(wsize));
+      peer_sock.DequeueOutput(static_cast<size_t>(wsize));
       continue;
     }
 
@@ -234,7 +320,7 @@ void SocketRelayHandler::OnFdWritable(base::PlatformHandle fd) {
   // We don't have buffered data to send. Disable watching for write.
   fd_poller_.UnwatchForWrite(fd);
   auto peer_fd = peer_sock.sock.fd();
-  if (peer_sock.available_bytes())
+  if (peer_sock.CanRead())
     fd_poller_.WatchForRead(peer_fd);
 }
 
@@ -24,6 +24,7 @@
 #include <future>
 #include <mutex>
 #include <optional>
+#include <string>
 #include <thread>
 #include <tuple>
 
@@ -94,10 +95,26 @@ class FdPoller {
 
 // This class groups a UnixSocketRaw with an associated ring buffer. The ring
 // buffer is used as a temporary storage for data *read* from the socket.
+//
+// If frame compression is enabled, the IPC frames read from the socket are
+// batched and compressed into compressed frames (see
+// IPCFrame.compressed_frames) before being relayed: the data to send to the
+// peer socket is then held in a separate output buffer.
 class SocketWithBuffer {
  public:
   constexpr static size_t kBuffSize = ipc::kIPCBufferSize;
 
+  // The maximum size of the frames batched into a compressed frame. Leaves
+  // room for the (rare) expansion of incompressible data, so that compressed
+  // frames never exceed the receiver's kIPCBufferSize.
+  constexpr static size_t kMaxCompressedBatchSize = kBuffSize / 2;
+
+  // Compresses |size| bytes of whole serialized frames into a compressed
+  // frame, appended serialized to |out|. See ipc::ZlibCompressFrames().
+  using FrameCompressorFn = bool (*)(const char* frames,
+                                     size_t size,
+                                     std::string* out);
+
   base::UnixSocketRaw sock;
 
   // Points to the beginning of buffered data.
@@ -122,6 +139,27 @@ class SocketWithBuffer {
     data_size_ -= bytes;
   }
 
+  // Compresses the frames read from |sock| with |compressor_fn|. Must be
+  // called before any data is relayed.
+  void EnableFrameCompression(FrameCompressorFn compressor_fn) {
+    compressor_fn_ = compressor_fn;
+  }
+  bool frame_compression_enabled() const { return compressor_fn_ != nullptr; }
+
+  // Moves the whole frames buffered so far, batched and compressed, to the
+  // output buffer. Returns false on errors, or if the buffer is full without
+  // holding a whole frame.
+  bool CompressFrames();
+
+  // The data to send to the peer socket: the buffered data, or the output
+  // buffer if frame compression is enabled.
+  const uint8_t* output_data();
+  size_t output_size();
+  void DequeueOutput(size_t bytes);
+
+  // Whether there is room to buffer more data read from |sock|.
+  bool CanRead();
+
   SocketWithBuffer() : buf_(kBuffSize) {}
 
   // Movable only.
@@ -133,6 +171,10 @@ class SocketWithBuffer {
  private:
   std::vector<uint8_t> buf_;
   size_t data_size_ = 0;
+
+  FrameCompressorFn compressor_fn_ = nullptr;
+  std::string output_;
+  size_t output_offset_ = 0;  // The data before it was already sent.
 };
 
 using SocketPair = std::pair<SocketWithBuffer, SocketWithBuffer>;
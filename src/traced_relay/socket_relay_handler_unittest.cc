@@ -26,6 +26,7 @@
 
 #include "perfetto/ext/base/threading/thread_pool.h"
 #include "perfetto/ext/base/unix_socket.h"
+#include "perfetto/ext/base/utils.h"
 
 #include "test/gtest_and_gmock.h"
 
@@ -108,6 +109,78 @@ TEST(SocketWithBufferTest, EnqueueDequeue) {
   EXPECT_EQ(buffered_data, "678901234567890");
 }
 
+std::string SerializedFrame(size_t payload_size) {
+  uint32_t size = static_cast<uint32_t>(payload_size);
+  std::string frame(sizeof(size), '\0');
+  memcpy(&frame[0], base::AssumeLittleEndian(&size), sizeof(size));
+  return frame + std::string(payload_size, 'x');
+}
+
+// Stands for a compressor, without actually compressing the frames.
+bool BracketFrames(const char* frames, size_t size, std::string* out) {
+  out->append("[");
+  out->append(frames, size);
+  out->append("]");
+  return true;
+}
+
+void Enqueue(SocketWithBuffer* socket_with_buffer, const std::string& data) {
+  ASSERT_GE(socket_with_buffer->available_bytes(), data.size());
+  memcpy(socket_with_buffer->buffer(), data.data(), data.size());
+  socket_with_buffer->EnqueueData(data.size());
+}
+
+std::string Output(SocketWithBuffer* socket_with_buffer) {
+  return std::string(
+      reinterpret_cast<const char*>(socket_with_buffer->output_data()),
+      socket_with_buffer->output_size());
+}
+
+// Only whole frames are compressed, in batches of kMaxCompressedBatchSize
+// bytes at most.
+TEST(SocketWithBufferTest, CompressFrames) {
+  SocketWithBuffer socket_with_buffer;
+  socket_with_buffer.EnableFrameCompression(&BracketFrames);
+  std::string frame1 = SerializedFrame(10);
+  std::string frame2 = SerializedFrame(20);
+  std::string frame3 = SerializedFrame(30);
+  Enqueue(&socket_with_buffer, frame1 + frame2 + frame3.substr(0, 10));
+  ASSERT_TRUE(socket_with_buffer.CompressFrames());
+  EXPECT_EQ(Output(&socket_with_buffer), "[" + frame1 + frame2 + "]");
+  EXPECT_EQ(socket_with_buffer.data_size(), 10u);
+
+  socket_with_buffer.DequeueOutput(socket_with_buffer.output_size());
+  Enqueue(&socket_with_buffer, frame3.substr(10));
+  ASSERT_TRUE(socket_with_buffer.CompressFrames());
+  EXPECT_EQ(Output(&socket_with_buffer), "[" + frame3 + "]");
+  EXPECT_EQ(socket_with_buffer.data_size(), 0u);
+  socket_with_buffer.DequeueOutput(socket_with_buffer.output_size());
+
+  const size_t kMaxBatchSize = SocketWithBuffer::kMaxCompressedBatchSize;
+  std::string half_frame = SerializedFrame(kMaxBatchSize / 2);
+  Enqueue(&socket_with_buffer, frame1 + half_frame + half_frame);
+  ASSERT_TRUE(socket_with_buffer.CompressFrames());
+  EXPECT_EQ(Output(&socket_with_buffer),
+            "[" + frame1 + half_frame + "][" + half_frame + "]");
+  socket_with_buffer.DequeueOutput(socket_with_buffer.output_size());
+
+  // Frames too large to be batched are relayed as they are.
+  std::string large_frame = SerializedFrame(kMaxBatchSize);
+  Enqueue(&socket_with_buffer, frame1 + large_frame + frame2);
+  ASSERT_TRUE(socket_with_buffer.CompressFrames());
+  EXPECT_EQ(Output(&socket_with_buffer),
+            "[" + frame1 + "]" + large_frame + "[" + frame2 + "]");
+  EXPECT_EQ(socket_with_buffer.data_size(), 0u);
+}
+
+TEST(SocketWithBufferTest, CompressFramesRejectsFramesLargerThanBuffer) {
+  SocketWithBuffer socket_with_buffer;
+  socket_with_buffer.EnableFrameCompression(&BracketFrames);
+  std::string frame = SerializedFrame(SocketWithBuffer::kBuffSize);
+  Enqueue(&socket_with_buffer, frame.substr(0, SocketWithBuffer::kBuffSize));
+  EXPECT_FALSE(socket_with_buffer.CompressFrames());
+}
+
 // Test the SocketRelayHander with randomized request and response data.
 TEST_P(SocketRelayHandlerTest, RandomizedRequestResponse) {
 #if defined(ADDRESS_SANITIZER) || defined(THREAD_SANITIZER) || \
@@ -12,13 +12,21 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
+#include "perfetto/base/time.h"
 #include "perfetto/tracing.h"
 #include "protos/perfetto/trace/test_event.pbzero.h"
 #include "protos/perfetto/trace/trace.pbzero.h"
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
+#include "protos/perfetto/trace/track_event/debug_annotation.pbzero.h"
 #include "protos/perfetto/trace/track_event/log_message.pbzero.h"
+#include "protos/perfetto/trace/track_event/track_event.pbzero.h"
 
 PERFETTO_DEFINE_CATEGORIES(perfetto::Category("benchmark"));
 PERFETTO_TRACK_EVENT_STATIC_STORAGE();
@@ -167,6 +175,243 @@ static void BM_TracingTrackEventLambda(benchmark::State& state) {
   PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
 }
 
+static void BM_TracingTrackEventInterning(benchmark::State& state) {
+  // Event and debug annotation names must outlive the tracing session.
+  static std::vector<std::string>* names = new std::vector<std::string>();
+  const size_t kNumNames = static_cast<size_t>(state.range(0));
+  while (names->size() < kNumNames)
+    names->push_back("Event" + std::to_string(names->size()));
+
+  auto tracing_session = StartTracing("track_event");
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const char* name = (*names)[i++ % kNumNames].c_str();
+    TRACE_EVENT_BEGIN("benchmark", perfetto::StaticString(name), name, 42);
+    benchmark::ClobberMemory();
+  }
+
+  tracing_session->StopBlocking();
+  PERFETTO_CHECK(!tracing_session->ReadTraceBlocking().empty());
+}
+
+// Data sources for the contention benchmarks, which differ only by what their
+// trace writers do when the SMB is full.
+class StallDataSource : public perfetto::DataSource<StallDataSource> {
+ public:
+  static constexpr char kName[] = "stall";
+  static constexpr perfetto::BufferExhaustedPolicy kBufferExhaustedPolicy =
+      perfetto::BufferExhaustedPolicy::kStall;
+};
+
+class DropDataSource : public perfetto::DataSource<DropDataSource> {
+ public:
+  static constexpr char kName[] = "drop";
+  static constexpr perfetto::BufferExhaustedPolicy kBufferExhaustedPolicy =
+      perfetto::BufferExhaustedPolicy::kDrop;
+};
+
+// Unlike StartTracing(), re-initializes the SDK so that each benchmark gets an
+// SMB of |smb_size_kb|. Must only be called when no other thread is tracing.
+std::unique_ptr<perfetto::TracingSession> StartContentionTracing(
+    const std::string& data_source_name,
+    uint32_t smb_size_kb) {
+  perfetto::Tracing::ResetForTesting();
+  perfetto::TracingInitArgs args;
+  args.backends = perfetto::kInProcessBackend;
+  args.shmem_size_hint_kb = smb_size_kb;
+  perfetto::Tracing::Initialize(args);
+
+  perfetto::DataSourceDescriptor dsd;
+  dsd.set_name(StallDataSource::kName);
+  StallDataSource::Register(dsd);
+  dsd.set_name(DropDataSource::kName);
+  DropDataSource::Register(dsd);
+  perfetto::TrackEvent::Register();
+
+  perfetto::TraceConfig cfg;
+  // Large enough for the central buffer not to be the bottleneck. Overwriting
+  // the oldest chunks doesn't count as dropped data, see CountDroppedEvents().
+  cfg.add_buffers()->set_size_kb(64 * 1024);
+  auto* ds_cfg = cfg.add_data_sources()->mutable_config();
+  ds_cfg->set_name(data_source_name);
+  auto tracing_session =
+      perfetto::Tracing::NewTrace(perfetto::kInProcessBackend);
+  tracing_session->Setup(cfg);
+  tracing_session->StartBlocking();
+  return tracing_session;
+}
+
+// Records the duration of one in kSamplingInterval emissions, so that reading
+// the clock doesn't dominate the cost of the cheap ones.
+class LatencySampler {
+ public:
+  static constexpr uint64_t kSamplingInterval = 16;
+  static constexpr size_t kMaxSamples = 64 * 1024;
+
+  LatencySampler() { samples_.reserve(kMaxSamples); }
+
+  template <typename Fn>
+  void Run(Fn fn) {
+    if (count_++ % kSamplingInterval) {
+      fn();
+      return;
+    }
+    int64_t start_ns = perfetto::base::GetWallTimeNs().count();
+    fn();
+    int64_t duration_ns = perfetto::base::GetWallTimeNs().count() - start_ns;
+    // Past kMaxSamples, the oldest samples are overwritten.
+    if (samples_.size() < kMaxSamples) {
+      samples_.push_back(duration_ns);
+    } else {
+      samples_[next_sample_++ % kMaxSamples] = duration_ns;
+    }
+  }
+
+  // Returns the 99th percentile of the sampled durations, in nanoseconds.
+  double P99() {
+    if (samples_.empty())
+      return 0;
+    size_t index = samples_.size() * 99 / 100;
+    std::nth_element(samples_.begin(),
+                     samples_.begin() + static_cast<ptrdiff_t>(index),
+                     samples_.end());
+    return static_cast<double>(samples_[index]);
+  }
+
+ private:
+  uint64_t count_ = 0;
+  size_t next_sample_ = 0;
+  std::vector<int64_t> samples_;
+};
+
+// Each event of the contention benchmarks carries the index of the event in
+// its thread. Returns the number of events missing from the middle of each
+// sequence, i.e. dropped by the trace writers rather than overwritten in the
+// central buffer, and sets |received| to the number of events in the trace.
+uint64_t CountDroppedEvents(const std::vector<char>& trace,
+                            uint64_t* received) {
+  // Last event index seen on each sequence.
+  std::map<uint32_t, uint64_t> last_index;
+  uint64_t dropped = 0;
+  *received = 0;
+  perfetto::protos::pbzero::Trace::Decoder decoder(
+      reinterpret_cast<const uint8_t*>(trace.data()), trace.size());
+  for (auto it = decoder.packet(); it; it++) {
+    perfetto::protos::pbzero::TracePacket::Decoder packet(*it);
+    uint64_t index = 0;
+    if (packet.has_for_testing()) {
+      perfetto::protos::pbzero::TestEvent::Decoder test_event(
+          packet.for_testing());
+      index = test_event.seq_value();
+    } else if (packet.has_track_event()) {
+      // The index is the first debug annotation of each event.
+      perfetto::protos::pbzero::TrackEvent::Decoder track_event(
+          packet.track_event());
+      auto annotation_it = track_event.debug_annotations();
+      if (!annotation_it)
+        continue;
+      perfetto::protos::pbzero::DebugAnnotation::Decoder annotation(
+          *annotation_it);
+      index = annotation.uint_value();
+    } else {
+      continue;
+    }
+    ++*received;
+    auto last = last_index.find(packet.trusted_packet_sequence_id());
+    if (last != last_index.end() && index > last->second + 1)
+      dropped += index - last->second - 1;
+    last_index[packet.trusted_packet_sequence_id()] = index;
+  }
+  return dropped;
+}
+
+void ReportDroppedEvents(benchmark::State& state,
+                         perfetto::TracingSession* tracing_session) {
+  tracing_session->StopBlocking();
+  std::vector<char> trace = tracing_session->ReadTraceBlocking();
+  uint64_t received = 0;
+  uint64_t dropped = CountDroppedEvents(trace, &received);
+  uint64_t total = received + dropped;
+  state.counters["DropRate"] =
+      total ? static_cast<double>(dropped) / static_cast<double>(total) : 0;
+}
+
+// SMB sizes, in KB, and thread counts for BM_TracingContentionDataSource.
+void ContentionDataSourceArgs(benchmark::internal::Benchmark* b) {
+  for (int smb_size_kb : {128, 1024, 8192})
+    b->Arg(smb_size_kb);
+  b->ThreadRange(1, 64)->UseRealTime();
+}
+
+// Emits small packets from many threads into an SMB of state.range(0) KB.
+// Reports, besides the time per event, the 99th percentile of the duration of
+// an emission (averaged over the threads) and the fraction of events dropped
+// by the trace writers.
+template <typename DataSourceType>
+static void BM_TracingContentionDataSource(benchmark::State& state) {
+  std::unique_ptr<perfetto::TracingSession> tracing_session;
+  if (state.thread_index == 0) {
+    tracing_session = StartContentionTracing(
+        DataSourceType::kName, static_cast<uint32_t>(state.range(0)));
+  }
+
+  LatencySampler sampler;
+  uint32_t index = 0;
+  for (auto _ : state) {
+    sampler.Run([&] {
+      DataSourceType::Trace([&](typename DataSourceType::TraceContext ctx) {
+        auto packet = ctx.NewTracePacket();
+        packet->set_timestamp(42);
+        auto* for_testing = packet->set_for_testing();
+        for_testing->set_seq_value(index);
+        for_testing->set_str("benchmark");
+      });
+    });
+    index++;
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["P99Ns"] =
+      benchmark::Counter(sampler.P99(), benchmark::Counter::kAvgThreads);
+  if (tracing_session)
+    ReportDroppedEvents(state, tracing_session.get());
+}
+
+// Emits track events with debug annotations from many threads, cycling through
+// state.range(0) event names to exercise the interning of each thread.
+static void BM_TracingContentionTrackEvent(benchmark::State& state) {
+  // Event names must outlive the tracing session.
+  static std::vector<std::string>* names = new std::vector<std::string>();
+  const size_t kNumNames = static_cast<size_t>(state.range(0));
+  std::unique_ptr<perfetto::TracingSession> tracing_session;
+  if (state.thread_index == 0) {
+    while (names->size() < kNumNames)
+      names->push_back("Event" + std::to_string(names->size()));
+    tracing_session =
+        StartContentionTracing("track_event", /*smb_size_kb=*/0);
+  }
+
+  LatencySampler sampler;
+  uint64_t index = 0;
+  for (auto _ : state) {
+    const char* name = (*names)[index % kNumNames].c_str();
+    sampler.Run([&] {
+      TRACE_EVENT_INSTANT("benchmark", perfetto::StaticString(name), "index",
+                          index, name, 42, "str", "benchmark");
+    });
+    index++;
+    benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()));
+  state.counters["P99Ns"] =
+      benchmark::Counter(sampler.P99(), benchmark::Counter::kAvgThreads);
+  if (tracing_session)
+    ReportDroppedEvents(state, tracing_session.get());
+}
+
 }  // namespace
 
 BENCHMARK(BM_TracingDataSourceDisabled);
@@ -175,4 +420,14 @@ BENCHMARK(BM_TracingDataSourceLambdaDifferentPacketSize)->Range(1, 1000);
 BENCHMARK(BM_TracingTrackEventBasic);
 BENCHMARK(BM_TracingTrackEventDebugAnnotations);
 BENCHMARK(BM_TracingTrackEventDisabled);
+BENCHMARK(BM_TracingTrackEventInterning)->Range(1, 4096);
 BENCHMARK(BM_TracingTrackEventLambda);
+BENCHMARK_TEMPLATE(BM_TracingContentionDataSource, StallDataSource)
+    ->Apply(ContentionDataSourceArgs);
+BENCHMARK_TEMPLATE(BM_TracingContentionDataSource, DropDataSource)
+    ->Apply(ContentionDataSourceArgs);
+BENCHMARK(BM_TracingContentionTrackEvent)
+    ->Arg(1)
+    ->Arg(4096)
+    ->ThreadRange(1, 64)
+    ->UseRealTime();
@@ -17,16 +17,23 @@
 #include "perfetto/tracing/console_interceptor.h"
 
 #include <stdarg.h>
+#include <string.h>
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <tuple>
 
 #include "perfetto/ext/base/file_utils.h"
 #include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/thread_utils.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/tracing/internal/track_event_internal.h"
 
@@ -55,6 +62,13 @@ namespace {
 
 int g_output_fd_for_testing;
 
+// Size of the ring buffer of each thread in asynchronous mode. Must be a power
+// of two.
+constexpr size_t kPacketRingSize = 64 * 1024;
+
+// How often the formatting thread checks the ring buffers for new packets.
+constexpr uint32_t kFormattingPollIntervalMs = 10;
+
 // Google Turbo colormap.
 constexpr std::array<ConsoleColor, 16> kTurboColors = {{
     ConsoleColor{0x30, 0x12, 0x3b},
@@ -118,6 +132,8 @@ uint32_t CounterToHue(uint32_t counter) {
 class ConsoleInterceptor::Delegate : public TrackEventStateTracker::Delegate {
  public:
   explicit Delegate(InterceptorContext&);
+  // Used by the formatting thread, which owns the session state.
+  Delegate(ThreadLocalState&, TrackEventStateTracker::SessionState*);
   ~Delegate() override;
 
   TrackEventStateTracker::SessionState* GetSessionState() override;
@@ -128,10 +144,119 @@ class ConsoleInterceptor::Delegate : public TrackEventStateTracker::Delegate {
  private:
   using SelfHandle = LockedHandle<ConsoleInterceptor>;
 
-  InterceptorContext& context_;
+  ThreadLocalState& tls_;
+  InterceptorContext* const context_ = nullptr;
+  TrackEventStateTracker::SessionState* const session_state_ = nullptr;
   std::optional<SelfHandle> locked_self_;
 };
 
+class ConsoleInterceptor::PacketRing {
+ public:
+  PacketRing() : buffer_(kPacketRingSize) {}
+
+  // Called on the emitting thread. Copies |packet| into the buffer, or drops
+  // it if there isn't enough room left.
+  void Write(protozero::ConstBytes packet) {
+    size_t write_pos = write_pos_.load(std::memory_order_relaxed);
+    size_t read_pos = read_pos_.load(std::memory_order_acquire);
+    size_t record_size = sizeof(uint32_t) + packet.size;
+    if (record_size > kPacketRingSize - (write_pos - read_pos)) {
+      dropped_packets_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    uint32_t packet_size = static_cast<uint32_t>(packet.size);
+    CopyIn(write_pos, &packet_size, sizeof(packet_size));
+    CopyIn(write_pos + sizeof(packet_size), packet.data, packet.size);
+    write_pos_.store(write_pos + record_size, std::memory_order_release);
+  }
+
+  // Called on the formatting thread. Invokes |fn| with each packet written so
+  // far, using |scratch| to make the packets contiguous.
+  template <typename Fn>
+  void Read(std::vector<uint8_t>* scratch, Fn fn) {
+    size_t read_pos = read_pos_.load(std::memory_order_relaxed);
+    size_t write_pos = write_pos_.load(std::memory_order_acquire);
+    while (read_pos != write_pos) {
+      uint32_t packet_size = 0;
+      CopyOut(read_pos, &packet_size, sizeof(packet_size));
+      scratch->resize(packet_size);
+      CopyOut(read_pos + sizeof(packet_size), scratch->data(), packet_size);
+      read_pos += sizeof(packet_size) + packet_size;
+      read_pos_.store(read_pos, std::memory_order_release);
+      fn(protozero::ConstBytes{scratch->data(), packet_size});
+    }
+  }
+
+  // Returns the number of packets dropped since the last call.
+  uint64_t TakeDroppedPackets() {
+    return dropped_packets_.exchange(0, std::memory_order_relaxed);
+  }
+
+ private:
+  // |pos| is a position in the (unbounded) stream of bytes written so far.
+  void CopyIn(size_t pos, const void* src, size_t size) {
+    size_t offset = pos & (kPacketRingSize - 1);
+    size_t first = std::min(size, kPacketRingSize - offset);
+    memcpy(&buffer_[offset], src, first);
+    memcpy(&buffer_[0], static_cast<const uint8_t*>(src) + first, size - first);
+  }
+
+  void CopyOut(size_t pos, void* dst, size_t size) const {
+    size_t offset = pos & (kPacketRingSize - 1);
+    size_t first = std::min(size, kPacketRingSize - offset);
+    memcpy(dst, &buffer_[offset], first);
+    memcpy(static_cast<uint8_t*>(dst) + first, &buffer_[0], size - first);
+  }
+
+  static_assert((kPacketRingSize & (kPacketRingSize - 1)) == 0,
+                "kPacketRingSize must be a power of two");
+
+  std::vector<uint8_t> buffer_;
+  std::atomic<size_t> write_pos_{};
+  std::atomic<size_t> read_pos_{};
+  std::atomic<uint64_t> dropped_packets_{};
+};
+
+// Owns the thread which decodes, formats and prints the packets of all the
+// emitting threads in asynchronous mode. Each emitting thread gets its own
+// ring buffer, so that copying a packet doesn't require any locking. The
+// rings are polled in turn: the output of different threads is only
+// approximately ordered.
+class ConsoleInterceptor::AsyncFormatter {
+ public:
+  AsyncFormatter(int fd, bool use_colors, uint64_t start_time_ns);
+
+  // Prints the packets left in the ring buffers and joins the thread.
+  ~AsyncFormatter();
+
+  // Returns the ring buffer which a newly seen thread should write into.
+  std::shared_ptr<PacketRing> AddSequence();
+
+ private:
+  struct Sequence {
+    std::shared_ptr<PacketRing> ring;
+    ThreadLocalState state;
+  };
+
+  void Run();
+  void Drain(Sequence*);
+
+  const int fd_;
+  const bool use_colors_;
+  const uint64_t start_time_ns_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  bool stop_ = false;                                // Guarded by |mutex_|.
+  std::vector<std::unique_ptr<Sequence>> sequences_;  // Guarded by |mutex_|.
+
+  // Only accessed on the formatting thread.
+  TrackEventStateTracker::SessionState session_state_;
+  std::vector<uint8_t> packet_buffer_;
+
+  std::thread thread_;
+};
+
 ConsoleInterceptor::~ConsoleInterceptor() = default;
 
 ConsoleInterceptor::ThreadLocalState::ThreadLocalState(
@@ -140,24 +265,37 @@ ConsoleInterceptor::ThreadLocalState::ThreadLocalState(
     start_time_ns = self->start_time_ns_;
     use_colors = self->use_colors_;
     fd = self->fd_;
+    if (self->async_formatter_)
+      packet_ring = self->async_formatter_->AddSequence();
   }
 }
 
+ConsoleInterceptor::ThreadLocalState::ThreadLocalState(int output_fd,
+                                                       bool enable_colors,
+                                                       uint64_t start_time)
+    : fd(output_fd), use_colors(enable_colors), start_time_ns(start_time) {}
+
 ConsoleInterceptor::ThreadLocalState::~ThreadLocalState() = default;
 
 ConsoleInterceptor::Delegate::Delegate(InterceptorContext& context)
-    : context_(context) {}
+    : tls_(context.GetThreadLocalState()), context_(&context) {}
+ConsoleInterceptor::Delegate::Delegate(
+    ThreadLocalState& tls,
+    TrackEventStateTracker::SessionState* session_state)
+    : tls_(tls), session_state_(session_state) {}
 ConsoleInterceptor::Delegate::~Delegate() = default;
 
 TrackEventStateTracker::SessionState*
 ConsoleInterceptor::Delegate::GetSessionState() {
+  if (session_state_)
+    return session_state_;
   // When the session state is retrieved for the first time, it is cached (and
   // kept locked) until we return from OnTracePacket. This avoids having to lock
   // and unlock the instance multiple times per invocation.
   if (locked_self_.has_value())
     return &locked_self_.value()->session_state_;
   locked_self_ =
-      std::make_optional<SelfHandle>(context_.GetInterceptorLocked());
+      std::make_optional<SelfHandle>(context_->GetInterceptorLocked());
   return &locked_self_.value()->session_state_;
 }
 
@@ -178,10 +316,9 @@ void ConsoleInterceptor::Delegate::OnTrackUpdated(
   }
   int title_width = static_cast<int>(title.size());
 
-  auto& tls = context_.GetThreadLocalState();
   std::array<char, 128> message_prefix{};
   size_t written = 0;
-  if (tls.use_colors) {
+  if (tls_.use_colors) {
     written = base::SprintfTrunc(message_prefix.data(), message_prefix.size(),
                                  FMT_RGB_SET_BG " %s%s %-*.*s", track_color.r,
                                  track_color.g, track_color.b, kReset, kDim,
@@ -200,44 +337,43 @@ void ConsoleInterceptor::Delegate::OnTrackEvent(
     const TrackEventStateTracker::Track& track,
     const TrackEventStateTracker::ParsedTrackEvent& event) {
   // Start printing.
-  auto& tls = context_.GetThreadLocalState();
-  tls.buffer_pos = 0;
+  tls_.buffer_pos = 0;
 
   // Print timestamp and track identifier.
-  SetColor(context_, kDim);
-  Printf(context_, "[%7.3lf] %.*s",
-         static_cast<double>(event.timestamp_ns - tls.start_time_ns) / 1e9,
+  SetColor(tls_, kDim);
+  Printf(tls_, "[%7.3lf] %.*s",
+         static_cast<double>(event.timestamp_ns - tls_.start_time_ns) / 1e9,
          static_cast<int>(track.user_data.size()), track.user_data.data());
 
   // Print category.
-  Printf(context_, "%-5.*s ",
+  Printf(tls_, "%-5.*s ",
          std::min(5, static_cast<int>(event.category.size)),
          event.category.data);
 
   // Print stack depth.
   for (size_t i = 0; i < event.stack_depth; i++) {
-    Printf(context_, "-  ");
+    Printf(tls_, "-  ");
   }
 
   // Print slice name.
   auto slice_color = HueToRGB(event.name_hash % kMaxHue);
   auto highlight_color = Mix(slice_color, kWhiteColor, kLightness);
   if (event.track_event.type() == protos::pbzero::TrackEvent::TYPE_SLICE_END) {
-    SetColor(context_, kDefault);
-    Printf(context_, "} ");
+    SetColor(tls_, kDefault);
+    Printf(tls_, "} ");
   }
-  SetColor(context_, highlight_color);
-  Printf(context_, "%.*s", static_cast<int>(event.name.size), event.name.data);
-  SetColor(context_, kReset);
+  SetColor(tls_, highlight_color);
+  Printf(tls_, "%.*s", static_cast<int>(event.name.size), event.name.data);
+  SetColor(tls_, kReset);
   if (event.track_event.type() ==
       protos::pbzero::TrackEvent::TYPE_SLICE_BEGIN) {
-    SetColor(context_, kDefault);
-    Printf(context_, " {");
+    SetColor(tls_, kDefault);
+    Printf(tls_, " {");
   }
 
   // Print annotations.
   if (event.track_event.has_debug_annotations()) {
-    PrintDebugAnnotations(context_, event.track_event, slice_color,
+    PrintDebugAnnotations(tls_, event.track_event, slice_color,
                           highlight_color);
   }
 
@@ -246,11 +382,11 @@ void ConsoleInterceptor::Delegate::OnTrackEvent(
   // Print duration for longer events.
   constexpr uint64_t kNsPerMillisecond = 1000000u;
   if (event.duration_ns >= 10 * kNsPerMillisecond) {
-    SetColor(context_, kDim);
-    Printf(context_, " +%" PRIu64 "ms", event.duration_ns / kNsPerMillisecond);
+    SetColor(tls_, kDim);
+    Printf(tls_, " +%" PRIu64 "ms", event.duration_ns / kNsPerMillisecond);
   }
-  SetColor(context_, kReset);
-  Printf(context_, "\n");
+  SetColor(tls_, kReset);
+  Printf(tls_, "\n");
 }
 
 // static
@@ -286,32 +422,113 @@ void ConsoleInterceptor::OnSetup(const SetupArgs& args) {
   }
   fd_ = fd;
   use_colors_ = use_colors;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WASM)
+  async_formatting_ = config.async_formatting();
+#endif
 }
 
 void ConsoleInterceptor::OnStart(const StartArgs&) {
   start_time_ns_ = internal::TrackEventInternal::GetTimeNs();
+  if (async_formatting_) {
+    async_formatter_.reset(
+        new AsyncFormatter(fd_, use_colors_, start_time_ns_));
+  }
 }
 
-void ConsoleInterceptor::OnStop(const StopArgs&) {}
+void ConsoleInterceptor::OnStop(const StopArgs&) {
+  async_formatter_.reset();
+}
 
 // static
 void ConsoleInterceptor::OnTracePacket(InterceptorContext context) {
+  auto& tls = context.GetThreadLocalState();
+  if (tls.packet_ring) {
+    tls.packet_ring->Write(context.packet_data);
+    return;
+  }
   {
-    auto& tls = context.GetThreadLocalState();
     Delegate delegate(context);
     perfetto::protos::pbzero::TracePacket::Decoder packet(
         context.packet_data.data, context.packet_data.size);
     TrackEventStateTracker::ProcessTracePacket(delegate, tls.sequence_state,
                                                packet);
   }  // (Potential) lock scope for session state.
-  Flush(context);
+  Flush(tls);
+}
+
+ConsoleInterceptor::AsyncFormatter::AsyncFormatter(int fd,
+                                                   bool use_colors,
+                                                   uint64_t start_time_ns)
+    : fd_(fd), use_colors_(use_colors), start_time_ns_(start_time_ns) {
+  thread_ = std::thread([this] { Run(); });
+}
+
+ConsoleInterceptor::AsyncFormatter::~AsyncFormatter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  cv_.notify_one();
+  thread_.join();
+}
+
+std::shared_ptr<ConsoleInterceptor::PacketRing>
+ConsoleInterceptor::AsyncFormatter::AddSequence() {
+  std::unique_ptr<Sequence> sequence(new Sequence{
+      std::make_shared<PacketRing>(),
+      ThreadLocalState(fd_, use_colors_, start_time_ns_)});
+  std::shared_ptr<PacketRing> ring = sequence->ring;
+  std::lock_guard<std::mutex> lock(mutex_);
+  sequences_.push_back(std::move(sequence));
+  return ring;
+}
+
+void ConsoleInterceptor::AsyncFormatter::Run() {
+  base::MaybeSetThreadName("ConsoleFormat");
+  std::vector<Sequence*> sequences;
+  for (;;) {
+    bool stop = false;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait_for(lock, std::chrono::milliseconds(kFormattingPollIntervalMs),
+                   [this] { return stop_; });
+      stop = stop_;
+      sequences.clear();
+      for (const auto& sequence : sequences_)
+        sequences.push_back(sequence.get());
+    }
+    // Formatting happens outside of the lock, so that threads emitting their
+    // first packet aren't blocked by it.
+    for (Sequence* sequence : sequences)
+      Drain(sequence);
+    if (stop)
+      return;
+  }
+}
+
+void ConsoleInterceptor::AsyncFormatter::Drain(Sequence* sequence) {
+  ThreadLocalState& tls = sequence->state;
+  Delegate delegate(tls, &session_state_);
+  sequence->ring->Read(&packet_buffer_, [&](protozero::ConstBytes data) {
+    perfetto::protos::pbzero::TracePacket::Decoder packet(data.data,
+                                                          data.size);
+    TrackEventStateTracker::ProcessTracePacket(delegate, tls.sequence_state,
+                                               packet);
+    Flush(tls);
+  });
+  if (uint64_t dropped = sequence->ring->TakeDroppedPackets()) {
+    SetColor(tls, kDim);
+    Printf(tls, "[%" PRIu64 " packets dropped]", dropped);
+    SetColor(tls, kReset);
+    Printf(tls, "\n");
+    Flush(tls);
+  }
 }
 
 // static
-void ConsoleInterceptor::Printf(InterceptorContext& context,
+void ConsoleInterceptor::Printf(ThreadLocalState& tls,
                                 const char* format,
                                 ...) {
-  auto& tls = context.GetThreadLocalState();
   ssize_t remaining = static_cast<ssize_t>(tls.message_buffer.size()) -
                       static_cast<ssize_t>(tls.buffer_pos);
   int written = 0;
@@ -331,7 +548,7 @@ void ConsoleInterceptor::Printf(InterceptorContext& context,
     if (g_output_fd_for_testing) {
       output = fdopen(dup(g_output_fd_for_testing), "w");
     }
-    Flush(context);
+    Flush(tls);
     va_list args;
     va_start(args, format);
     vfprintf(output, format, args);
@@ -345,64 +562,60 @@ void ConsoleInterceptor::Printf(InterceptorContext& context,
 }
 
 // static
-void ConsoleInterceptor::Flush(InterceptorContext& context) {
-  auto& tls = context.GetThreadLocalState();
+void ConsoleInterceptor::Flush(ThreadLocalState& tls) {
   ssize_t res = base::WriteAll(tls.fd, &tls.message_buffer[0], tls.buffer_pos);
   PERFETTO_DCHECK(res == static_cast<ssize_t>(tls.buffer_pos));
   tls.buffer_pos = 0;
 }
 
 // static
-void ConsoleInterceptor::SetColor(InterceptorContext& context,
+void ConsoleInterceptor::SetColor(ThreadLocalState& tls,
                                   const ConsoleColor& color) {
-  auto& tls = context.GetThreadLocalState();
   if (!tls.use_colors)
     return;
-  Printf(context, FMT_RGB_SET, color.r, color.g, color.b);
+  Printf(tls, FMT_RGB_SET, color.r, color.g, color.b);
 }
 
 // static
-void ConsoleInterceptor::SetColor(InterceptorContext& context,
+void ConsoleInterceptor::SetColor(ThreadLocalState& tls,
                                   const char* color) {
-  auto& tls = context.GetThreadLocalState();
   if (!tls.use_colors)
     return;
-  Printf(context, "%s", color);
+  Printf(tls, "%s", color);
 }
 
 // static
 void ConsoleInterceptor::PrintDebugAnnotations(
-    InterceptorContext& context,
+    ThreadLocalState& tls,
     const protos::pbzero::TrackEvent_Decoder& track_event,
     const ConsoleColor& slice_color,
     const ConsoleColor& highlight_color) {
-  SetColor(context, slice_color);
-  Printf(context, "(");
+  SetColor(tls, slice_color);
+  Printf(tls, "(");
 
   bool is_first = true;
   for (auto it = track_event.debug_annotations(); it; it++) {
     perfetto::protos::pbzero::DebugAnnotation::Decoder annotation(*it);
-    SetColor(context, slice_color);
+    SetColor(tls, slice_color);
     if (!is_first)
-      Printf(context, ", ");
+      Printf(tls, ", ");
 
-    PrintDebugAnnotationName(context, annotation);
-    Printf(context, ":");
+    PrintDebugAnnotationName(tls, annotation);
+    Printf(tls, ":");
 
-    SetColor(context, highlight_color);
-    PrintDebugAnnotationValue(context, annotation);
+    SetColor(tls, highlight_color);
+    PrintDebugAnnotationValue(tls, annotation);
 
     is_first = false;
   }
-  SetColor(context, slice_color);
-  Printf(context, ")");
+  SetColor(tls, slice_color);
+  Printf(tls, ")");
 }
 
 // static
 void ConsoleInterceptor::PrintDebugAnnotationName(
-    InterceptorContext& context,
+    ThreadLocalState& tls,
     const perfetto::protos::pbzero::DebugAnnotation::Decoder& annotation) {
-  auto& tls = context.GetThreadLocalState();
   protozero::ConstChars name{};
   if (annotation.name_iid()) {
     name.data =
@@ -413,56 +626,56 @@ void ConsoleInterceptor::PrintDebugAnnotationName(
     name.data = annotation.name().data;
     name.size = annotation.name().size;
   }
-  Printf(context, "%.*s", static_cast<int>(name.size), name.data);
+  Printf(tls, "%.*s", static_cast<int>(name.size), name.data);
 }
 
 // static
 void ConsoleInterceptor::PrintDebugAnnotationValue(
-    InterceptorContext& context,
+    ThreadLocalState& tls,
     const perfetto::protos::pbzero::DebugAnnotation::Decoder& annotation) {
   if (annotation.has_bool_value()) {
-    Printf(context, "%s", annotation.bool_value() ? "true" : "false");
+    Printf(tls, "%s", annotation.bool_value() ? "true" : "false");
   } else if (annotation.has_uint_value()) {
-    Printf(context, "%" PRIu64, annotation.uint_value());
+    Printf(tls, "%" PRIu64, annotation.uint_value());
   } else if (annotation.has_int_value()) {
-    Printf(context, "%" PRId64, annotation.int_value());
+    Printf(tls, "%" PRId64, annotation.int_value());
   } else if (annotation.has_double_value()) {
-    Printf(context, "%f", annotation.double_value());
+    Printf(tls, "%f", annotation.double_value());
   } else if (annotation.has_string_value()) {
-    Printf(context, "%.*s", static_cast<int>(annotation.string_value().size),
+    Printf(tls, "%.*s", static_cast<int>(annotation.string_value().size),
            annotation.string_value().data);
   } else if (annotation.has_pointer_value()) {
-    Printf(context, "%p", reinterpret_cast<void*>(annotation.pointer_value()));
+    Printf(tls, "%p", reinterpret_cast<void*>(annotation.pointer_value()));
   } else if (annotation.has_legacy_json_value()) {
-    Printf(context, "%.*s",
+    Printf(tls, "%.*s",
            static_cast<int>(annotation.legacy_json_value().size),
            annotation.legacy_json_value().data);
   } else if (annotation.has_dict_entries()) {
-    Printf(context, "{");
+    Printf(tls, "{");
     bool is_first = true;
     for (auto it = annotation.dict_entries(); it; ++it) {
       if (!is_first)
-        Printf(context, ", ");
+        Printf(tls, ", ");
       perfetto::protos::pbzero::DebugAnnotation::Decoder key_value(*it);
-      PrintDebugAnnotationName(context, key_value);
-      Printf(context, ":");
-      PrintDebugAnnotationValue(context, key_value);
+      PrintDebugAnnotationName(tls, key_value);
+      Printf(tls, ":");
+      PrintDebugAnnotationValue(tls, key_value);
       is_first = false;
     }
-    Printf(context, "}");
+    Printf(tls, "}");
   } else if (annotation.has_array_values()) {
-    Printf(context, "[");
+    Printf(tls, "[");
     bool is_first = true;
     for (auto it = annotation.array_values(); it; ++it) {
       if (!is_first)
-        Printf(context, ", ");
+        Printf(tls, ", ");
       perfetto::protos::pbzero::DebugAnnotation::Decoder key_value(*it);
-      PrintDebugAnnotationValue(context, key_value);
+      PrintDebugAnnotationValue(tls, key_value);
       is_first = false;
     }
-    Printf(context, "]");
+    Printf(tls, "]");
   } else {
-    Printf(context, "{}");
+    Printf(tls, "{}");
   }
 }
 
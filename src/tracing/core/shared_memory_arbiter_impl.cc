@@ -47,6 +47,13 @@ MaybeUnboundBufferID MakeTargetBufferIdForReservation(uint16_t reservation_id) {
 bool IsReservationTargetBufferId(MaybeUnboundBufferID buffer_id) {
   return (buffer_id >> 16) > 0;
 }
+
+// The pages of the SMB initially used by arbiters with lazy page growth.
+constexpr size_t kLazyGrowthInitialPages = 4;
+
+// With adaptive batching, the batching period is sized so that the chunks
+// committed during a period fill 1/kBatchSmbFraction of the SMB.
+constexpr size_t kBatchSmbFraction = 8;
 }  // namespace
 
 // static
@@ -70,9 +77,13 @@ std::unique_ptr<SharedMemoryArbiter> SharedMemoryArbiter::CreateUnboundInstance(
     SharedMemory* shared_memory,
     size_t page_size,
     ShmemMode mode) {
-  return std::unique_ptr<SharedMemoryArbiterImpl>(new SharedMemoryArbiterImpl(
+  std::unique_ptr<SharedMemoryArbiterImpl> arbiter(new SharedMemoryArbiterImpl(
       shared_memory->start(), shared_memory->size(), mode, page_size,
       /*producer_endpoint=*/nullptr, /*task_runner=*/nullptr));
+  // Unbound instances are used for startup tracing, which is enabled in many
+  // processes that write little, if anything, before the service binds.
+  arbiter->EnableLazyPageGrowth(kLazyGrowthInitialPages);
+  return arbiter;
 }
 
 SharedMemoryArbiterImpl::SharedMemoryArbiterImpl(
@@ -84,16 +95,61 @@ SharedMemoryArbiterImpl::SharedMemoryArbiterImpl(
     base::TaskRunner* task_runner)
     : producer_endpoint_(producer_endpoint),
       use_shmem_emulation_(mode == ShmemMode::kShmemEmulation),
-      task_runner_(task_runner),
       shmem_abi_(reinterpret_cast<uint8_t*>(start), size, page_size, mode),
+      num_usable_pages_(shmem_abi_.num_pages()),
+      task_runner_(task_runner),
       active_writer_ids_(kMaxWriterID),
       fully_bound_(task_runner && producer_endpoint),
       was_always_bound_(fully_bound_),
       weak_ptr_factory_(this) {}
 
+Chunk SharedMemoryArbiterImpl::TryAcquireFreeChunk(
+    const SharedMemoryABI::ChunkHeader& header,
+    SharedMemoryABI::PageLayout layout,
+    bool any_layout) {
+  // Concurrent callers can race on the same page: the state of all the chunks
+  // of a page lives in a single atomic word of its header, so the CAS in
+  // TryPartitionPage() and TryAcquireChunkForWriting() let only one of them
+  // win and the others move on to the next free chunk.
+  const size_t num_pages = num_usable_pages_.load(std::memory_order_relaxed);
+  const size_t initial_page_idx = page_idx_.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < num_pages; i++) {
+    const size_t page_idx = (initial_page_idx + i) % num_pages;
+    bool is_new_page = false;
+
+    if (shmem_abi_.is_page_free(page_idx))
+      is_new_page = shmem_abi_.TryPartitionPage(page_idx, layout);
+    uint32_t free_chunks;
+    if (is_new_page) {
+      free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
+    } else {
+      const uint32_t page_layout = shmem_abi_.GetPageLayout(page_idx);
+      if (!any_layout && ((page_layout & SharedMemoryABI::kLayoutMask) >>
+                          SharedMemoryABI::kLayoutShift) != layout) {
+        continue;
+      }
+      free_chunks = shmem_abi_.GetFreeChunks(page_idx);
+    }
+
+    for (uint32_t chunk_idx = 0; free_chunks; chunk_idx++, free_chunks >>= 1) {
+      if (!(free_chunks & 1))
+        continue;
+      // We found a free chunk.
+      Chunk chunk =
+          shmem_abi_.TryAcquireChunkForWriting(page_idx, chunk_idx, &header);
+      if (!chunk.is_valid())
+        continue;
+      page_idx_.store(page_idx, std::memory_order_relaxed);
+      return chunk;
+    }
+  }
+  return Chunk();
+}
+
 Chunk SharedMemoryArbiterImpl::GetNewChunk(
     const SharedMemoryABI::ChunkHeader& header,
-    BufferExhaustedPolicy buffer_exhausted_policy) {
+    BufferExhaustedPolicy buffer_exhausted_policy,
+    SharedMemoryABI::PageLayout layout_hint) {
   int stall_count = 0;
   unsigned stall_interval_us = 0;
   bool task_runner_runs_on_current_thread = false;
@@ -102,12 +158,66 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
   static const int kFlushCommitsAfterEveryNStalls = 2;
   static const int kAssertAtNStalls = 200;
 
+  // Chunks are never larger than the ones of |default_page_layout|.
+  const SharedMemoryABI::PageLayout layout =
+      std::max(layout_hint, SharedMemoryArbiterImpl::default_page_layout);
+
   for (;;) {
-    // TODO(primiano): Probably this lock is not really required and this code
-    // could be rewritten leveraging only the Try* atomic operations in
-    // SharedMemoryABI. But let's not be too adventurous for the moment.
+    // The fast path doesn't take |lock_|: TryAcquireFreeChunk() only relies on
+    // the atomic operations of SharedMemoryABI. Chunks from pages of another
+    // layout are only used if there are none of the requested one, rather than
+    // stalling or dropping data.
+    Chunk chunk = TryAcquireFreeChunk(header, layout, /*any_layout=*/false);
+    if (!chunk.is_valid())
+      chunk = TryAcquireFreeChunk(header, layout, /*any_layout=*/true);
+    if (!chunk.is_valid()) {
+      // With lazy page growth, start using more pages of the SMB before
+      // stalling or dropping data. Concurrent callers may race to grow: the
+      // losers just retry with the pages grown by the winner.
+      size_t usable = num_usable_pages_.load(std::memory_order_relaxed);
+      if (usable < shmem_abi_.num_pages()) {
+        num_usable_pages_.compare_exchange_strong(
+            usable, std::min(usable * 2, shmem_abi_.num_pages()),
+            std::memory_order_relaxed);
+        continue;
+      }
+    }
+    if (chunk.is_valid()) {
+      if (stall_count > kLogAfterNStalls) {
+        PERFETTO_LOG("Recovered from stall after %d iterations", stall_count);
+      }
+
+      // If more than half of the SMB.size() is filled with completed chunks
+      // for which we haven't notified the service yet (i.e. they are still
+      // enqueued in |commit_data_req_|), force a synchronous
+      // CommitDataRequest() even if we acquired a chunk, to reduce the
+      // likeliness of stalling the writer.
+      //
+      // We can only do this if we're writing on the same thread that we access
+      // the producer endpoint on, since we cannot notify the producer endpoint
+      // to commit synchronously on a different thread. Attempting to flush
+      // synchronously on another thread will lead to subtle bugs caused by
+      // out-of-order commit requests (crbug.com/919187#c28).
+      if (buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
+          bytes_pending_commit_.load(std::memory_order_relaxed) >=
+              shmem_abi_.size() / 2) {
+        bool should_commit_synchronously;
+        {
+          std::lock_guard<std::mutex> scoped_lock(lock_);
+          batch_smb_filled_up_ = true;
+          should_commit_synchronously =
+              task_runner_ && task_runner_->RunsTasksOnCurrentThread() &&
+              commit_data_req_;
+        }
+        if (should_commit_synchronously)
+          FlushPendingCommitDataRequests();
+      }
+      return chunk;
+    }
+
     {
-      std::unique_lock<std::mutex> scoped_lock(lock_);
+      std::lock_guard<std::mutex> scoped_lock(lock_);
+      batch_smb_filled_up_ = true;
 
       // If ever unbound, we do not support stalling. In theory, we could
       // support stalling for TraceWriters created after the arbiter and startup
@@ -119,65 +229,6 @@ Chunk SharedMemoryArbiterImpl::GetNewChunk(
 
       task_runner_runs_on_current_thread =
           task_runner_ && task_runner_->RunsTasksOnCurrentThread();
-
-      // If more than half of the SMB.size() is filled with completed chunks for
-      // which we haven't notified the service yet (i.e. they are still enqueued
-      // in |commit_data_req_|), force a synchronous CommitDataRequest() even if
-      // we acquire a chunk, to reduce the likeliness of stalling the writer.
-      //
-      // We can only do this if we're writing on the same thread that we access
-      // the producer endpoint on, since we cannot notify the producer endpoint
-      // to commit synchronously on a different thread. Attempting to flush
-      // synchronously on another thread will lead to subtle bugs caused by
-      // out-of-order commit requests (crbug.com/919187#c28).
-      bool should_commit_synchronously =
-          task_runner_runs_on_current_thread &&
-          buffer_exhausted_policy == BufferExhaustedPolicy::kStall &&
-          commit_data_req_ && bytes_pending_commit_ >= shmem_abi_.size() / 2;
-
-      const size_t initial_page_idx = page_idx_;
-      for (size_t i = 0; i < shmem_abi_.num_pages(); i++) {
-        page_idx_ = (initial_page_idx + i) % shmem_abi_.num_pages();
-        bool is_new_page = false;
-
-        // TODO(primiano): make the page layout dynamic.
-        auto layout = SharedMemoryArbiterImpl::default_page_layout;
-
-        if (shmem_abi_.is_page_free(page_idx_)) {
-          // TODO(primiano): Use the |size_hint| here to decide the layout.
-          is_new_page = shmem_abi_.TryPartitionPage(page_idx_, layout);
-        }
-        uint32_t free_chunks;
-        if (is_new_page) {
-          free_chunks = (1 << SharedMemoryABI::kNumChunksForLayout[layout]) - 1;
-        } else {
-          free_chunks = shmem_abi_.GetFreeChunks(page_idx_);
-        }
-
-        for (uint32_t chunk_idx = 0; free_chunks;
-             chunk_idx++, free_chunks >>= 1) {
-          if (!(free_chunks & 1))
-            continue;
-          // We found a free chunk.
-          Chunk chunk = shmem_abi_.TryAcquireChunkForWriting(
-              page_idx_, chunk_idx, &header);
-          if (!chunk.is_valid())
-            continue;
-          if (stall_count > kLogAfterNStalls) {
-            PERFETTO_LOG("Recovered from stall after %d iterations",
-                         stall_count);
-          }
-
-          if (should_commit_synchronously) {
-            // We can't flush while holding the lock.
-            scoped_lock.unlock();
-            FlushPendingCommitDataRequests();
-            return chunk;
-          } else {
-            return chunk;
-          }
-        }
-      }
     }  // scoped_lock
 
     if (buffer_exhausted_policy == BufferExhaustedPolicy::kDrop) {
@@ -266,8 +317,11 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       if (fully_bound_ && !delayed_flush_scheduled_) {
         weak_this = weak_ptr_factory_.GetWeakPtr();
         task_runner_to_post_delayed_callback_on = task_runner_;
-        flush_delay_ms = batch_commits_duration_ms_;
+        flush_delay_ms = cur_batch_commits_duration_ms_;
         delayed_flush_scheduled_ = true;
+        batch_start_ns_ = base::GetBootTimeNs().count();
+        batch_committed_bytes_ = 0;
+        batch_smb_filled_up_ = false;
       }
     }
 
@@ -277,6 +331,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
       PERFETTO_DCHECK(chunk.writer_id() == writer_id);
       uint8_t chunk_idx = chunk.chunk_idx();
       bytes_pending_commit_ += chunk.size();
+      batch_committed_bytes_ += chunk.size();
       size_t page_idx;
 
       ctm = commit_data_req_->add_chunks_to_move();
@@ -359,8 +414,10 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
     // accumulate the patch and a crash occurs before the patch is sent, the
     // service will not know of the patch and won't be able to reconstruct the
     // trace.
-    if (fully_bound_ &&
-        (last_patch_req || bytes_pending_commit_ >= shmem_abi_.size() / 2)) {
+    bool smb_filling_up = bytes_pending_commit_ >= shmem_abi_.size() / 2;
+    if (smb_filling_up)
+      batch_smb_filled_up_ = true;
+    if (fully_bound_ && (last_patch_req || smb_filling_up)) {
       weak_this = weak_ptr_factory_.GetWeakPtr();
       task_runner_to_post_delayed_callback_on = task_runner_;
       flush_delay_ms = 0;
@@ -380,6 +437,7 @@ void SharedMemoryArbiterImpl::UpdateCommitDataRequest(
             // Clear |delayed_flush_scheduled_|, allowing the next call to
             // UpdateCommitDataRequest to start another batching period.
             weak_this->delayed_flush_scheduled_ = false;
+            weak_this->AdaptBatchCommitsDurationLocked();
           }
           weak_this->FlushPendingCommitDataRequests();
         },
@@ -461,6 +519,59 @@ void SharedMemoryArbiterImpl::SetBatchCommitsDuration(
     uint32_t batch_commits_duration_ms) {
   std::lock_guard<std::mutex> scoped_lock(lock_);
   batch_commits_duration_ms_ = batch_commits_duration_ms;
+  cur_batch_commits_duration_ms_ =
+      adaptive_batch_commits_
+          ? std::min(cur_batch_commits_duration_ms_, batch_commits_duration_ms)
+          : batch_commits_duration_ms;
+}
+
+void SharedMemoryArbiterImpl::EnableLazyPageGrowth(size_t initial_pages) {
+  num_usable_pages_.store(std::max<size_t>(
+      1, std::min(initial_pages, shmem_abi_.num_pages())));
+}
+
+void SharedMemoryArbiterImpl::SetAdaptiveBatchCommits(bool enabled) {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  adaptive_batch_commits_ = enabled;
+  cur_batch_commits_duration_ms_ = enabled ? 0 : batch_commits_duration_ms_;
+}
+
+uint32_t SharedMemoryArbiterImpl::GetBatchCommitsDuration() {
+  std::lock_guard<std::mutex> scoped_lock(lock_);
+  return cur_batch_commits_duration_ms_;
+}
+
+void SharedMemoryArbiterImpl::AdaptBatchCommitsDurationLocked() {
+  if (!adaptive_batch_commits_)
+    return;
+  cur_batch_commits_duration_ms_ = NextBatchCommitsDuration(
+      cur_batch_commits_duration_ms_, batch_commits_duration_ms_,
+      base::GetBootTimeNs().count() - batch_start_ns_, batch_committed_bytes_,
+      shmem_abi_.size(), batch_smb_filled_up_);
+}
+
+// static
+uint32_t SharedMemoryArbiterImpl::NextBatchCommitsDuration(
+    uint32_t cur_ms,
+    uint32_t max_ms,
+    int64_t elapsed_ns,
+    size_t committed_bytes,
+    size_t smb_size,
+    bool smb_filled_up) {
+  // Back off quickly: the SMB filling up means that writers are about to stall
+  // or drop data.
+  if (smb_filled_up)
+    return cur_ms / 2;
+  // Otherwise size the period from the commit rate of the last one, growing
+  // gradually since the rate can be measured over a very short period.
+  uint64_t elapsed_ms =
+      static_cast<uint64_t>(std::max<int64_t>(elapsed_ns / 1000000, 1));
+  uint64_t target_bytes = smb_size / kBatchSmbFraction;
+  uint64_t next_ms = max_ms;
+  if (committed_bytes)
+    next_ms = target_bytes * elapsed_ms / committed_bytes;
+  next_ms = std::min(next_ms, uint64_t{cur_ms} * 2 + 1);
+  return static_cast<uint32_t>(std::min(next_ms, uint64_t{max_ms}));
 }
 
 bool SharedMemoryArbiterImpl::EnableDirectSMBPatching() {
@@ -19,6 +19,7 @@
 
 #include <stdint.h>
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
@@ -128,9 +129,17 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
 
   // Returns a new Chunk to write tracing data. Depending on the provided
   // BufferExhaustedPolicy, this may return an invalid chunk if no valid free
-  // chunk could be found in the SMB.
-  SharedMemoryABI::Chunk GetNewChunk(const SharedMemoryABI::ChunkHeader&,
-                                     BufferExhaustedPolicy);
+  // chunk could be found in the SMB. Doesn't take |lock_| unless the SMB is
+  // exhausted or more than half of it is pending commit.
+  //
+  // |layout_hint| is the layout of the pages to take the chunk from, which
+  // TraceWriterImpl adapts to its write rate. It is clamped so that chunks are
+  // never larger than the ones of the default layout, and chunks of pages with
+  // other layouts are returned if there are no free ones in the requested one.
+  SharedMemoryABI::Chunk GetNewChunk(
+      const SharedMemoryABI::ChunkHeader&,
+      BufferExhaustedPolicy,
+      SharedMemoryABI::PageLayout layout_hint = SharedMemoryABI::kPageDiv1);
 
   // Puts back a Chunk that has been completed and sends a request to the
   // service to move it to the central tracing buffer. |target_buffer| is the
@@ -151,6 +160,14 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
                    MaybeUnboundBufferID target_buffer,
                    PatchList* patch_list);
 
+  // Makes the arbiter take chunks only from the first |initial_pages| pages of
+  // the SMB, doubling them whenever all their chunks are taken, rather than
+  // from all of its pages. Pages of the SMB are only committed when first
+  // touched, so this keeps the memory used by producers that write little
+  // proportional to what they write rather than to the size of the SMB. Must
+  // be called before any chunk is acquired.
+  void EnableLazyPageGrowth(size_t initial_pages);
+
   SharedMemoryABI* shmem_abi_for_testing() { return &shmem_abi_; }
 
   static void set_default_layout_for_testing(SharedMemoryABI::PageLayout l) {
@@ -161,6 +178,17 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
     return default_page_layout;
   }
 
+  // Returns the length of the next batching period with adaptive batching,
+  // given the |cur_ms| length of the one which just ended, which lasted
+  // |elapsed_ns| and during which |committed_bytes| were committed. If
+  // |smb_filled_up| the SMB got more than half full during the period.
+  static uint32_t NextBatchCommitsDuration(uint32_t cur_ms,
+                                           uint32_t max_ms,
+                                           int64_t elapsed_ns,
+                                           size_t committed_bytes,
+                                           size_t smb_size,
+                                           bool smb_filled_up);
+
   // SharedMemoryArbiter implementation.
   // See include/perfetto/tracing/core/shared_memory_arbiter.h for comments.
   std::unique_ptr<TraceWriter> CreateTraceWriter(
@@ -177,6 +205,8 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   void NotifyFlushComplete(FlushRequestID) override;
 
   void SetBatchCommitsDuration(uint32_t batch_commits_duration_ms) override;
+  void SetAdaptiveBatchCommits(bool enabled) override;
+  uint32_t GetBatchCommitsDuration() override;
 
   bool EnableDirectSMBPatching() override;
 
@@ -218,6 +248,12 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
                                MaybeUnboundBufferID target_buffer,
                                PatchList* patch_list);
 
+  // Sets the length of the next batching period, at the end of the current
+  // one, if adaptive batching is enabled.
+  //
+  // Note: the caller must be holding |lock_| for the duration of the call.
+  void AdaptBatchCommitsDurationLocked();
+
   // Search the chunks that are being batched in |commit_data_req_| for a chunk
   // that needs patching and that matches the provided |writer_id| and
   // |patch.chunk_id|. If found, apply |patch| to that chunk, and if
@@ -255,6 +291,15 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // state.
   bool UpdateFullyBoundLocked();
 
+  // Scans the usable pages of the SMB, starting from |page_idx_|, for a free
+  // chunk and acquires it for writing. Free pages are partitioned with |layout|. Chunks of pages
+  // already partitioned are taken only if they have the same |layout|, unless
+  // |any_layout|. Returns an invalid chunk if there is none. Lock-free.
+  SharedMemoryABI::Chunk TryAcquireFreeChunk(
+      const SharedMemoryABI::ChunkHeader& header,
+      SharedMemoryABI::PageLayout layout,
+      bool any_layout);
+
   // Only accessed on |task_runner_| after the producer endpoint was bound.
   TracingService::ProducerEndpoint* producer_endpoint_ = nullptr;
 
@@ -262,15 +307,29 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // endpoint that doesn't support shared memory (e.g. vsock).
   const bool use_shmem_emulation_ = false;
 
+  // All the operations of SharedMemoryABI are atomic: it can be accessed
+  // without holding |lock_|.
+  SharedMemoryABI shmem_abi_;
+
+  // The page where the last chunk was found, where the next search starts.
+  // Just a hint, updated without holding |lock_|.
+  std::atomic<size_t> page_idx_{0};
+
+  // Chunks are only taken from the first |num_usable_pages_| pages of the SMB.
+  // Less than all the pages only with lazy page growth, see
+  // EnableLazyPageGrowth(). Only ever grows, without holding |lock_|.
+  std::atomic<size_t> num_usable_pages_;
+
   // --- Begin lock-protected members ---
 
   std::mutex lock_;
 
   base::TaskRunner* task_runner_ = nullptr;
-  SharedMemoryABI shmem_abi_;
-  size_t page_idx_ = 0;
   std::unique_ptr<CommitDataRequest> commit_data_req_;
-  size_t bytes_pending_commit_ = 0;  // SUM(chunk.size() : commit_data_req_).
+
+  // SUM(chunk.size() : commit_data_req_). Only updated while holding |lock_|,
+  // but read without it by GetNewChunk().
+  std::atomic<size_t> bytes_pending_commit_{0};
   IdAllocator<WriterID> active_writer_ids_;
   bool did_shutdown_ = false;
 
@@ -299,6 +358,19 @@ class SharedMemoryArbiterImpl : public SharedMemoryArbiter {
   // See SharedMemoryArbiter::SetBatchCommitsDuration.
   uint32_t batch_commits_duration_ms_ = 0;
 
+  // See SharedMemoryArbiter::SetAdaptiveBatchCommits.
+  bool adaptive_batch_commits_ = false;
+
+  // The length of the current batching period. Differs from
+  // |batch_commits_duration_ms_|, its upper bound, only with adaptive batching.
+  uint32_t cur_batch_commits_duration_ms_ = 0;
+
+  // Used to adapt the batching period: when the current one started, the bytes
+  // committed since and whether the SMB got more than half full meanwhile.
+  int64_t batch_start_ns_ = 0;
+  size_t batch_committed_bytes_ = 0;
+  bool batch_smb_filled_up_ = false;
+
   // See SharedMemoryArbiter::EnableDirectSMBPatching.
   bool direct_patching_enabled_ = false;
 
@@ -17,6 +17,11 @@
 #include "src/tracing/core/shared_memory_arbiter_impl.h"
 
 #include <bitset>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/commit_data_request.h"
@@ -211,6 +216,54 @@ TEST_P(SharedMemoryArbiterImplTest, BatchCommits) {
   arbiter_->FlushPendingCommitDataRequests();
 }
 
+TEST_P(SharedMemoryArbiterImplTest, AdaptiveBatchCommits) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  arbiter_->SetBatchCommitsDuration(1000);
+  EXPECT_EQ(arbiter_->GetBatchCommitsDuration(), 1000u);
+
+  // Adaptive batching starts with no batching.
+  arbiter_->SetAdaptiveBatchCommits(true);
+  EXPECT_EQ(arbiter_->GetBatchCommitsDuration(), 0u);
+
+  // A single chunk committed during the period: the period grows.
+  SharedMemoryABI::Chunk chunk =
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDefault);
+  ASSERT_TRUE(chunk.is_valid());
+  EXPECT_CALL(mock_producer_endpoint_, CommitData(_, _)).Times(1);
+  PatchList ignored;
+  arbiter_->ReturnCompletedChunk(std::move(chunk), 1, &ignored);
+  task_runner_->RunUntilIdle();
+  ASSERT_TRUE(Mock::VerifyAndClearExpectations(&mock_producer_endpoint_));
+  EXPECT_EQ(arbiter_->GetBatchCommitsDuration(), 1u);
+
+  // Disabling it goes back to the fixed period.
+  arbiter_->SetAdaptiveBatchCommits(false);
+  EXPECT_EQ(arbiter_->GetBatchCommitsDuration(), 1000u);
+}
+
+TEST(SharedMemoryArbiterImplBatchTest, NextBatchCommitsDuration) {
+  constexpr size_t kSmbSize = 1024 * 1024;
+  constexpr int64_t kMs = 1000 * 1000;
+  auto next = &SharedMemoryArbiterImpl::NextBatchCommitsDuration;
+
+  // Idle: grows gradually up to the max.
+  EXPECT_EQ(next(0, 100, 1 * kMs, 0, kSmbSize, false), 1u);
+  EXPECT_EQ(next(1, 100, 1 * kMs, 0, kSmbSize, false), 3u);
+  EXPECT_EQ(next(80, 100, 80 * kMs, 0, kSmbSize, false), 100u);
+
+  // 1/8 of the SMB (128 KB) is committed every 20 ms at 64 KB per 10 ms.
+  EXPECT_EQ(next(10, 100, 10 * kMs, 64 * 1024, kSmbSize, false), 20u);
+  EXPECT_EQ(next(40, 100, 40 * kMs, 256 * 1024, kSmbSize, false), 20u);
+
+  // The SMB filled up: halves.
+  EXPECT_EQ(next(40, 100, 40 * kMs, 0, kSmbSize, true), 20u);
+  EXPECT_EQ(next(1, 100, 1 * kMs, 0, kSmbSize, true), 0u);
+
+  // Never above the max.
+  EXPECT_EQ(next(10, 5, 10 * kMs, 1, kSmbSize, false), 5u);
+}
+
 TEST_P(SharedMemoryArbiterImplTest, UseShmemEmulation) {
   arbiter_.reset(new SharedMemoryArbiterImpl(
       buf(), buf_size(), ShmemMode::kShmemEmulation, page_size(),
@@ -362,6 +415,113 @@ TEST_P(SharedMemoryArbiterImplTest, BufferExhaustedPolicyDrop) {
   ASSERT_TRUE(chunks[0].is_valid());
 }
 
+// With lazy page growth, chunks are taken from the first pages of the SMB as
+// long as they have free ones.
+TEST_P(SharedMemoryArbiterImplTest, LazyPageGrowth) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv1);
+  arbiter_->EnableLazyPageGrowth(1);
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+  auto get_page = [&](SharedMemoryABI::Chunk* chunk) {
+    *chunk = arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop);
+    EXPECT_TRUE(chunk->is_valid());
+    return abi->GetPageAndChunkIndex(*chunk).first;
+  };
+  // Simulates the service reading and freeing the chunk.
+  auto free_chunk = [&](SharedMemoryABI::Chunk chunk) {
+    size_t page = abi->ReleaseChunkAsComplete(std::move(chunk));
+    SharedMemoryABI::Chunk read_chunk = abi->TryAcquireChunkForReading(page, 0);
+    ASSERT_TRUE(read_chunk.is_valid());
+    abi->ReleaseChunkAsFree(std::move(read_chunk));
+  };
+
+  SharedMemoryABI::Chunk chunks[3];
+  EXPECT_EQ(get_page(&chunks[0]), 0u);
+  EXPECT_EQ(get_page(&chunks[1]), 1u);
+  free_chunk(std::move(chunks[0]));
+  free_chunk(std::move(chunks[1]));
+
+  // Only the first two pages are used until both are taken.
+  EXPECT_EQ(get_page(&chunks[0]), 1u);
+  EXPECT_EQ(get_page(&chunks[1]), 0u);
+  EXPECT_EQ(get_page(&chunks[2]), 2u);
+
+  // It grows up to the whole SMB.
+  for (size_t i = 3; i < kNumPages; i++) {
+    SharedMemoryABI::Chunk chunk;
+    EXPECT_EQ(get_page(&chunk), i);
+  }
+  EXPECT_FALSE(
+      arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop).is_valid());
+}
+
+// Threads racing on GetNewChunk() should never get the same chunk.
+TEST_P(SharedMemoryArbiterImplTest, ConcurrentGetNewChunk) {
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv14);
+  static constexpr size_t kNumThreads = 4;
+  static constexpr size_t kChunksPerThread = kNumPages * 14 / kNumThreads;
+  std::vector<std::vector<SharedMemoryABI::Chunk>> chunks(kNumThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kNumThreads; t++) {
+    threads.emplace_back([this, &chunks, t] {
+      for (size_t i = 0; i < kChunksPerThread; i++) {
+        chunks[t].push_back(
+            arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop));
+      }
+    });
+  }
+  for (std::thread& thread : threads)
+    thread.join();
+
+  std::set<uint8_t*> chunk_begins;
+  for (const auto& thread_chunks : chunks) {
+    for (const SharedMemoryABI::Chunk& chunk : thread_chunks) {
+      ASSERT_TRUE(chunk.is_valid());
+      ASSERT_TRUE(chunk_begins.insert(chunk.begin()).second);
+    }
+  }
+  ASSERT_EQ(chunk_begins.size(), kNumThreads * kChunksPerThread);
+}
+
+TEST_P(SharedMemoryArbiterImplTest, LayoutHint) {
+  using PageAndChunk = std::pair<size_t, size_t>;
+  SharedMemoryABI* abi = arbiter_->shmem_abi_for_testing();
+  auto get_chunk = [this](SharedMemoryABI::PageLayout layout) {
+    return arbiter_->GetNewChunk({}, BufferExhaustedPolicy::kDrop, layout);
+  };
+
+  // Free pages are partitioned with the requested layout, and the next chunks
+  // with the same layout come from the same page.
+  SharedMemoryABI::Chunk large = get_chunk(SharedMemoryABI::kPageDiv1);
+  SharedMemoryABI::Chunk small1 = get_chunk(SharedMemoryABI::kPageDiv4);
+  SharedMemoryABI::Chunk small2 = get_chunk(SharedMemoryABI::kPageDiv4);
+  ASSERT_TRUE(large.is_valid() && small1.is_valid() && small2.is_valid());
+  EXPECT_EQ(abi->GetPageAndChunkIndex(large).first, 0u);
+  EXPECT_EQ(abi->GetPageAndChunkIndex(small1), PageAndChunk(1, 0));
+  EXPECT_EQ(abi->GetPageAndChunkIndex(small2), PageAndChunk(1, 1));
+  EXPECT_GT(large.size(), 2u * small1.size());
+
+  // Chunks are never larger than the ones of the default layout.
+  SharedMemoryArbiterImpl::set_default_layout_for_testing(
+      SharedMemoryABI::PageLayout::kPageDiv2);
+  SharedMemoryABI::Chunk clamped = get_chunk(SharedMemoryABI::kPageDiv1);
+  ASSERT_TRUE(clamped.is_valid());
+  EXPECT_EQ(abi->GetPageAndChunkIndex(clamped), PageAndChunk(2, 0));
+  EXPECT_LT(clamped.size(), large.size());
+
+  // When there are no free pages left, chunks of other layouts are used. Fill
+  // the rest of the SMB: the second chunk of page 2 and pages 3..13.
+  std::vector<SharedMemoryABI::Chunk> chunks;
+  for (size_t i = 0; i < 1 + 2 * (kNumPages - 3); i++) {
+    chunks.push_back(get_chunk(SharedMemoryABI::kPageDiv2));
+    ASSERT_TRUE(chunks.back().is_valid());
+  }
+  SharedMemoryABI::Chunk other = get_chunk(SharedMemoryABI::kPageDiv2);
+  ASSERT_TRUE(other.is_valid());
+  EXPECT_EQ(abi->GetPageAndChunkIndex(other).first, 1u);
+}
+
 TEST_P(SharedMemoryArbiterImplTest, CreateUnboundAndBind) {
   auto checkpoint_writer = task_runner_->CreateCheckpoint("writer_registered");
   auto checkpoint_flush = task_runner_->CreateCheckpoint("flush_completed");
@@ -23,6 +23,7 @@
 #include <utility>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/thread_annotations.h"
 #include "perfetto/protozero/message.h"
 #include "perfetto/protozero/proto_utils.h"
@@ -47,6 +48,15 @@ constexpr size_t kMaxPacketsPerChunk = ChunkHeader::Packets::kMaxCount - 1;
 // if it needs to.
 constexpr size_t kExtraRoomForInflatedPacket = 1;
 uint8_t g_garbage_chunk[1024];
+
+// See NextChunkLayout(). Writers that fill a chunk faster than
+// kBusyChunkDurationNs move to larger chunks, the ones that take longer than
+// kIdleChunkDurationNs (or flush them before they are full) move to smaller
+// ones, down to a quarter of a page.
+constexpr int64_t kBusyChunkDurationNs = 100 * 1000 * 1000;
+constexpr int64_t kIdleChunkDurationNs = 1000 * 1000 * 1000;
+constexpr SharedMemoryABI::PageLayout kSmallestChunkLayout =
+    SharedMemoryABI::kPageDiv4;
 }  // namespace
 
 TraceWriterImpl::TraceWriterImpl(SharedMemoryArbiterImpl* shmem_arbiter,
@@ -197,6 +207,21 @@ TraceWriterImpl::TracePacketHandle TraceWriterImpl::NewTracePacket() {
   return handle;
 }
 
+// static
+SharedMemoryABI::PageLayout TraceWriterImpl::NextChunkLayout(
+    SharedMemoryABI::PageLayout layout,
+    int64_t chunk_duration_ns) {
+  if (chunk_duration_ns < kBusyChunkDurationNs &&
+      layout > SharedMemoryABI::kPageDiv1) {
+    return static_cast<SharedMemoryABI::PageLayout>(layout - 1);
+  }
+  if (chunk_duration_ns >= kIdleChunkDurationNs &&
+      layout < kSmallestChunkLayout) {
+    return static_cast<SharedMemoryABI::PageLayout>(layout + 1);
+  }
+  return layout;
+}
+
 // Called by the Message. We can get here in two cases:
 // 1. In the middle of writing a Message,
 // when |fragmenting_packet_| == true. In this case we want to update the
@@ -238,8 +263,13 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
   header.chunk_id.store(next_chunk_id_, std::memory_order_relaxed);
   header.packets.store(packets, std::memory_order_relaxed);
 
-  SharedMemoryABI::Chunk new_chunk =
-      shmem_arbiter_->GetNewChunk(header, buffer_exhausted_policy_);
+  const int64_t now_ns = base::GetBootTimeNs().count();
+  if (cur_chunk_acquired_ns_) {
+    chunk_layout_ =
+        NextChunkLayout(chunk_layout_, now_ns - cur_chunk_acquired_ns_);
+  }
+  SharedMemoryABI::Chunk new_chunk = shmem_arbiter_->GetNewChunk(
+      header, buffer_exhausted_policy_, chunk_layout_);
   if (!new_chunk.is_valid()) {
     // Shared memory buffer exhausted, switch into |drop_packets_| mode. We'll
     // drop data until the garbage chunk has been filled once and then retry.
@@ -374,6 +404,7 @@ protozero::ContiguousMemoryRange TraceWriterImpl::GetNewBuffer() {
   }
 
   // Switch to the new chunk.
+  cur_chunk_acquired_ns_ = now_ns;
   drop_packets_ = false;
   reached_max_packets_per_chunk_ = false;
   retry_new_chunk_after_packet_ = false;
@@ -73,6 +73,14 @@ class TraceWriterImpl : public TraceWriter,
   }
   bool drop_packets_for_testing() const { return drop_packets_; }
 
+  // Returns the layout to request the next chunk with, given the one of the
+  // previous chunk and the time the writer held it for. Busy writers get
+  // larger chunks, which reduces the number of chunk rollovers and patches.
+  // Idle ones get smaller chunks, which wastes less of the SMB.
+  static SharedMemoryABI::PageLayout NextChunkLayout(
+      SharedMemoryABI::PageLayout layout,
+      int64_t chunk_duration_ns);
+
  private:
   TraceWriterImpl(const TraceWriterImpl&) = delete;
   TraceWriterImpl& operator=(const TraceWriterImpl&) = delete;
@@ -119,6 +127,11 @@ class TraceWriterImpl : public TraceWriter,
   // The chunk we are holding onto (if any).
   SharedMemoryABI::Chunk cur_chunk_;
 
+  // When |cur_chunk_| was acquired (CLOCK_BOOTTIME), and the page layout the
+  // next chunk is requested with. See NextChunkLayout().
+  int64_t cur_chunk_acquired_ns_ = 0;
+  SharedMemoryABI::PageLayout chunk_layout_ = SharedMemoryABI::kPageDiv1;
+
   // Passed to protozero message to write directly into |cur_chunk_|. It
   // keeps track of the write pointer. It calls us back (GetNewBuffer()) when
   // |cur_chunk_| is filled.
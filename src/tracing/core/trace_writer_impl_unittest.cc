@@ -1320,6 +1320,26 @@ TEST_P(TraceWriterImplTest, NestedMsgsPatches) {
   EXPECT_THAT(last_commit_.chunks_to_patch()[0].patches(), SizeIs(3));
 }
 
+TEST(TraceWriterImplChunkLayoutTest, NextChunkLayout) {
+  constexpr int64_t kMs = 1000 * 1000;
+  // Busy writers move to larger chunks, up to a whole page.
+  EXPECT_EQ(TraceWriterImpl::NextChunkLayout(SharedMemoryABI::kPageDiv4, kMs),
+            SharedMemoryABI::kPageDiv2);
+  EXPECT_EQ(TraceWriterImpl::NextChunkLayout(SharedMemoryABI::kPageDiv1, kMs),
+            SharedMemoryABI::kPageDiv1);
+  // Idle ones to smaller chunks, down to a quarter of a page.
+  EXPECT_EQ(
+      TraceWriterImpl::NextChunkLayout(SharedMemoryABI::kPageDiv1, 2000 * kMs),
+      SharedMemoryABI::kPageDiv2);
+  EXPECT_EQ(
+      TraceWriterImpl::NextChunkLayout(SharedMemoryABI::kPageDiv4, 2000 * kMs),
+      SharedMemoryABI::kPageDiv4);
+  // The others keep their layout.
+  EXPECT_EQ(
+      TraceWriterImpl::NextChunkLayout(SharedMemoryABI::kPageDiv2, 500 * kMs),
+      SharedMemoryABI::kPageDiv2);
+}
+
 // TODO(primiano): add multi-writer test.
 
 }  // namespace
@@ -168,10 +168,12 @@ TracingMuxerImpl::ProducerImpl::ProducerImpl(
     TracingMuxerImpl* muxer,
     TracingBackendId backend_id,
     uint32_t shmem_batch_commits_duration_ms,
+    bool shmem_adaptive_batch_commits,
     bool shmem_direct_patching_enabled)
     : muxer_(muxer),
       backend_id_(backend_id),
       shmem_batch_commits_duration_ms_(shmem_batch_commits_duration_ms),
+      shmem_adaptive_batch_commits_(shmem_adaptive_batch_commits),
       shmem_direct_patching_enabled_(shmem_direct_patching_enabled) {}
 
 TracingMuxerImpl::ProducerImpl::~ProducerImpl() {
@@ -262,6 +264,8 @@ void TracingMuxerImpl::ProducerImpl::OnTracingSetup() {
   did_setup_tracing_ = true;
   service_->MaybeSharedMemoryArbiter()->SetBatchCommitsDuration(
       shmem_batch_commits_duration_ms_);
+  if (shmem_adaptive_batch_commits_)
+    service_->MaybeSharedMemoryArbiter()->SetAdaptiveBatchCommits(true);
   if (shmem_direct_patching_enabled_) {
     service_->MaybeSharedMemoryArbiter()->EnableDirectSMBPatching();
   }
@@ -963,6 +967,7 @@ void TracingMuxerImpl::AddProducerBackend(TracingProducerBackend* backend,
   rb.type = type;
   rb.producer.reset(new ProducerImpl(this, backend_id,
                                      args.shmem_batch_commits_duration_ms,
+                                     args.shmem_adaptive_batch_commits,
                                      args.shmem_direct_patching_enabled));
   rb.producer_conn_args.producer = rb.producer.get();
   rb.producer_conn_args.producer_name = platform_->GetCurrentProcessName();
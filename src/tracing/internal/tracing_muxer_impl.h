@@ -212,6 +212,7 @@ class TracingMuxerImpl : public TracingMuxer {
     ProducerImpl(TracingMuxerImpl*,
                  TracingBackendId,
                  uint32_t shmem_batch_commits_duration_ms,
+                 bool shmem_adaptive_batch_commits,
                  bool shmem_direct_patching_enabled);
     ~ProducerImpl() override;
 
@@ -253,6 +254,7 @@ class TracingMuxerImpl : public TracingMuxer {
     bool producer_provided_smb_failed_ = false;
 
     const uint32_t shmem_batch_commits_duration_ms_ = 0;
+    const bool shmem_adaptive_batch_commits_ = false;
     const bool shmem_direct_patching_enabled_ = false;
 
     // Set of data sources that have been actually registered on this producer.
@@ -16,6 +16,8 @@
 
 #include "perfetto/tracing/internal/track_event_internal.h"
 
+#include <algorithm>
+
 #include "perfetto/base/proc_utils.h"
 #include "perfetto/base/time.h"
 #include "perfetto/tracing/core/data_source_config.h"
@@ -365,6 +367,108 @@ bool TrackEventInternal::IsCategoryEnabled(
   return true;
 }
 
+// static
+std::vector<TrackEventRateLimit> TrackEventInternal::GetCategoryRateLimits(
+    const protos::gen::TrackEventConfig& config) {
+  std::vector<TrackEventRateLimit> limits;
+  for (const auto& limit : config.category_rate_limits()) {
+    TrackEventRateLimit& rate_limit = limits.emplace_back();
+    rate_limit.category = limit.category();
+    rate_limit.sampling_interval = limit.sampling_interval();
+    rate_limit.max_events_per_sec = limit.max_events_per_sec();
+    rate_limit.burst_size = limit.burst_size() ? limit.burst_size()
+                                               : limit.max_events_per_sec();
+  }
+  return limits;
+}
+
+// static
+bool TrackEventInternal::ShouldEmitRateLimitedEvent(
+    const TrackEventCategoryRegistry& registry,
+    TrackEventTlsState& tls_state,
+    size_t category_index,
+    perfetto::protos::pbzero::TrackEvent::Type type,
+    bool on_current_thread_track,
+    uint64_t* dropped_events) {
+  using protos::pbzero::TrackEvent;
+  if (category_index >= tls_state.rate_limiters.size())
+    tls_state.rate_limiters.resize(category_index + 1);
+  TrackEventRateLimiter& limiter = tls_state.rate_limiters[category_index];
+  if (PERFETTO_UNLIKELY(!limiter.resolved)) {
+    limiter.resolved = true;
+    const Category* category = registry.GetCategory(category_index);
+    for (size_t i = 0; i < tls_state.rate_limits.size(); i++) {
+      if (NameMatchesPattern(tls_state.rate_limits[i].category, category->name,
+                             MatchType::kPattern)) {
+        limiter.limit_index = i;
+        break;
+      }
+    }
+  }
+  if (limiter.limit_index == TrackEventRateLimiter::kNotLimited)
+    return true;
+  const TrackEventRateLimit& limit = tls_state.rate_limits[limiter.limit_index];
+
+  bool keep = true;
+  bool is_slice = type == TrackEvent::TYPE_SLICE_BEGIN ||
+                  type == TrackEvent::TYPE_SLICE_END;
+  if (is_slice && !on_current_thread_track) {
+    // The end of a slice on another track can't be matched to its begin, so
+    // these are never dropped.
+  } else if (type == TrackEvent::TYPE_SLICE_END) {
+    // Follow the decision taken for the begin of the slice.
+    if (limiter.slice_depth > 0) {
+      uint32_t depth = --limiter.slice_depth;
+      uint64_t bit = uint64_t(1) << depth;
+      if (depth < TrackEventRateLimiter::kMaxSliceDepth &&
+          (limiter.dropped_slices & bit)) {
+        limiter.dropped_slices &= ~bit;
+        return false;
+      }
+    }
+  } else {
+    if (limit.sampling_interval > 1) {
+      keep = limiter.sampling_counter == 0;
+      if (++limiter.sampling_counter == limit.sampling_interval)
+        limiter.sampling_counter = 0;
+    }
+    if (keep && limit.max_events_per_sec) {
+      // Refill the token bucket for the time elapsed since the last event.
+      uint64_t now_ns = GetTimeNs();
+      if (limiter.last_refill_ns == 0) {
+        limiter.tokens = limit.burst_size;
+      } else if (now_ns > limiter.last_refill_ns) {
+        double elapsed_s =
+            static_cast<double>(now_ns - limiter.last_refill_ns) / 1e9;
+        limiter.tokens =
+            std::min(static_cast<double>(limit.burst_size),
+                     limiter.tokens + elapsed_s * limit.max_events_per_sec);
+      }
+      limiter.last_refill_ns = now_ns;
+      keep = limiter.tokens >= 1;
+      if (keep)
+        limiter.tokens -= 1;
+    }
+    if (type == TrackEvent::TYPE_SLICE_BEGIN) {
+      uint32_t depth = limiter.slice_depth++;
+      // Past the maximum depth, the decision can't be recorded for the end of
+      // the slice: keep the slice.
+      if (depth >= TrackEventRateLimiter::kMaxSliceDepth) {
+        keep = true;
+      } else if (!keep) {
+        limiter.dropped_slices |= uint64_t(1) << depth;
+      }
+    }
+  }
+  if (!keep) {
+    limiter.dropped_events++;
+    return false;
+  }
+  *dropped_events = limiter.dropped_events;
+  limiter.dropped_events = 0;
+  return true;
+}
+
 // static
 uint64_t TrackEventInternal::GetTimeNs() {
   if (GetClockId() == protos::pbzero::BUILTIN_CLOCK_BOOTTIME)
@@ -31,12 +31,15 @@
 #include <unistd.h>
 
 #include <memory>
+#include <string>
 #include <utility>
 
 #include "perfetto/base/compiler.h"
 #include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/memfd.h"
 #include "perfetto/ext/base/temp_file.h"
-#include "src/tracing/ipc/memfd.h"
+#include "perfetto/ext/base/uuid.h"
 
 namespace perfetto {
 
@@ -47,7 +50,7 @@ int kFileSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
 // static
 std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   base::ScopedFile fd =
-      CreateMemfd("perfetto_shmem", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+      base::CreateMemfd("perfetto_shmem", MFD_CLOEXEC | MFD_ALLOW_SEALING);
   bool is_memfd = !!fd;
 
   // In-tree builds only allow mem_fd, so we can inspect the seals to verify the
@@ -74,6 +77,53 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::Create(size_t size) {
   return MapFD(std::move(fd), size);
 }
 
+// static
+std::unique_ptr<PosixSharedMemory> PosixSharedMemory::CreateInDirectory(
+    const std::string& dir,
+    size_t size,
+    std::string* file_name) {
+  // The directory may be shared by several machines, so a PID isn't unique.
+  std::string name = "perfetto-smb-" + base::Uuidv4().ToPrettyString();
+  base::ScopedFile fd =
+      base::OpenFile(dir + "/" + name, O_RDWR | O_CREAT | O_EXCL, 0660);
+  if (!fd) {
+    PERFETTO_PLOG("Failed to create the SMB file in %s", dir.c_str());
+    return nullptr;
+  }
+  if (ftruncate(fd.get(), static_cast<off_t>(size)) != 0) {
+    PERFETTO_PLOG("Failed to resize the SMB file %s", name.c_str());
+    unlink((dir + "/" + name).c_str());
+    return nullptr;
+  }
+  *file_name = std::move(name);
+  return MapFD(std::move(fd), size);
+}
+
+// static
+std::unique_ptr<PosixSharedMemory> PosixSharedMemory::AttachToFileInDirectory(
+    const std::string& dir,
+    const std::string& file_name) {
+  if (file_name.empty() || file_name == "." || file_name == ".." ||
+      file_name.find('/') != std::string::npos) {
+    PERFETTO_ELOG("Invalid SMB file name \"%s\"", file_name.c_str());
+    return nullptr;
+  }
+  base::ScopedFile fd =
+      base::OpenFile(dir + "/" + file_name, O_RDWR | O_NOFOLLOW);
+  if (!fd) {
+    PERFETTO_PLOG("Failed to open the SMB file %s", file_name.c_str());
+    return nullptr;
+  }
+  struct stat stat_buf = {};
+  if (fstat(fd.get(), &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode) ||
+      stat_buf.st_size <= 0) {
+    PERFETTO_ELOG("The SMB file %s isn't a non-empty regular file",
+                  file_name.c_str());
+    return nullptr;
+  }
+  return MapFD(std::move(fd), static_cast<size_t>(stat_buf.st_size));
+}
+
 // static
 std::unique_ptr<PosixSharedMemory> PosixSharedMemory::AttachToFd(
     base::ScopedFile fd,
@@ -82,11 +132,11 @@ std::unique_ptr<PosixSharedMemory> PosixSharedMemory::AttachToFd(
 
 #if PERFETTO_BUILDFLAG(PERFETTO_ANDROID_BUILD)
   // In-tree kernels all support memfd.
-  PERFETTO_CHECK(HasMemfdSupport());
+  PERFETTO_CHECK(base::HasMemfdSupport());
 #else
   // In out-of-tree builds, we only require seals if the kernel supports memfd.
   if (requires_seals)
-    requires_seals = HasMemfdSupport();
+    requires_seals = base::HasMemfdSupport();
 #endif
 
   if (requires_seals) {
@@ -28,6 +28,7 @@
 #include <stddef.h>
 
 #include <memory>
+#include <string>
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/scoped_file.h"
@@ -47,6 +48,24 @@ class PosixSharedMemory : public SharedMemory {
   // Create a brand new SHM region.
   static std::unique_ptr<PosixSharedMemory> Create(size_t size);
 
+  // Creates a new SHM region backed by a new file in |dir|, e.g. a directory
+  // backed by memory shared with another VM, and stores the name of the file
+  // in |file_name|. The file isn't sealed and isn't unlinked: the caller must
+  // unlink it once the other side has attached to it. Returns nullptr if the
+  // file can't be created.
+  static std::unique_ptr<PosixSharedMemory> CreateInDirectory(
+      const std::string& dir,
+      size_t size,
+      std::string* file_name);
+
+  // Mmaps the file |file_name| in |dir| created by CreateInDirectory() on the
+  // other side. Returns nullptr if |file_name| isn't a plain file name or if
+  // the file isn't a non-empty regular file. The file can't be sealed, so the
+  // directory must be writable only by trusted processes.
+  static std::unique_ptr<PosixSharedMemory> AttachToFileInDirectory(
+      const std::string& dir,
+      const std::string& file_name);
+
   // Mmaps a file descriptor to an existing SHM region. If
   // |require_seals_if_supported| is true and the system supports
   // memfd_create(), the FD is required to be a sealed memfd with F_SEAL_SEAL,
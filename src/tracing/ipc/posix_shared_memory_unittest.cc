@@ -29,12 +29,12 @@
 
 #include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/memfd.h"
 #include "perfetto/ext/base/scoped_file.h"
 #include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "src/base/test/test_task_runner.h"
 #include "src/base/test/vm_test_utils.h"
-#include "src/tracing/ipc/memfd.h"
 #include "test/gtest_and_gmock.h"
 
 namespace perfetto {
@@ -103,7 +103,7 @@ TEST(PosixSharedMemoryTest, AttachToFdRequiresSeals) {
   std::unique_ptr<PosixSharedMemory> shm =
       PosixSharedMemory::AttachToFd(tmp_file.ReleaseFD());
 
-  if (HasMemfdSupport()) {
+  if (base::HasMemfdSupport()) {
     EXPECT_EQ(shm.get(), nullptr);
   } else {
     ASSERT_NE(shm.get(), nullptr);
@@ -146,6 +146,48 @@ TEST(PosixSharedMemoryTest, CreateAndMap) {
   ASSERT_FALSE(base::vm_test_utils::IsMapped(shm_start, shm_size));
 }
 
+TEST(PosixSharedMemoryTest, CreateAndAttachInDirectory) {
+  base::TempDir tmp_dir = base::TempDir::Create();
+  std::string file_name;
+  std::unique_ptr<PosixSharedMemory> shm = PosixSharedMemory::CreateInDirectory(
+      tmp_dir.path(), base::GetSysPageSize(), &file_name);
+  ASSERT_NE(shm.get(), nullptr);
+  ASSERT_FALSE(file_name.empty());
+  memcpy(shm->start(), "test", 5);
+
+  std::unique_ptr<PosixSharedMemory> shm2 =
+      PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), file_name);
+  ASSERT_EQ(unlink((tmp_dir.path() + "/" + file_name).c_str()), 0);
+  ASSERT_NE(shm2.get(), nullptr);
+  ASSERT_EQ(shm2->size(), base::GetSysPageSize());
+  ASSERT_EQ(0, memcmp("test", shm2->start(), 5));
+
+  // The mappings outlive the file.
+  memcpy(shm2->start(), "abcd", 5);
+  ASSERT_EQ(0, memcmp("abcd", shm->start(), 5));
+}
+
+TEST(PosixSharedMemoryTest, AttachToFileInDirectoryRejectsInvalidFiles) {
+  base::TempDir tmp_dir = base::TempDir::Create();
+  std::string empty_file = tmp_dir.path() + "/empty";
+  base::ScopedFile fd = base::OpenFile(empty_file, O_RDWR | O_CREAT, 0600);
+  ASSERT_TRUE(fd);
+
+  EXPECT_EQ(PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), ""),
+            nullptr);
+  EXPECT_EQ(PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), ".."),
+            nullptr);
+  EXPECT_EQ(
+      PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), "../empty"),
+      nullptr);
+  EXPECT_EQ(
+      PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), "missing"),
+      nullptr);
+  EXPECT_EQ(PosixSharedMemory::AttachToFileInDirectory(tmp_dir.path(), "empty"),
+            nullptr);
+  ASSERT_EQ(unlink(empty_file.c_str()), 0);
+}
+
 }  // namespace
 }  // namespace perfetto
 #endif  // OS_LINUX || OS_ANDROID || OS_APPLE
@@ -18,6 +18,7 @@
 
 #include <cinttypes>
 
+#include <stdlib.h>
 #include <string.h>
 
 #include "perfetto/base/logging.h"
@@ -38,6 +39,8 @@
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
 #include "src/tracing/ipc/shared_memory_windows.h"
 #else
+#include <unistd.h>
+
 #include "src/tracing/ipc/posix_shared_memory.h"
 #endif
 
@@ -151,6 +154,7 @@ ProducerIPCClientImpl::ProducerIPCClientImpl(
 
 ProducerIPCClientImpl::~ProducerIPCClientImpl() {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  UnlinkSharedMemoryFile();
 }
 
 void ProducerIPCClientImpl::Disconnect() {
@@ -215,6 +219,35 @@ void ProducerIPCClientImpl::OnConnect() {
 #endif
   }
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  const char* shmem_dir = getenv("PERFETTO_PRODUCER_SHMEM_DIR");
+  if (!shared_memory_ && shmem_dir) {
+    // The SMB can't be passed as an FD when connecting through traced_relay,
+    // e.g. from a VM guest. If the service shares a directory backed by shared
+    // memory with this machine, offer an SMB created in it instead. If the
+    // service doesn't adopt it, it falls back to a service-provided or
+    // emulated SMB.
+    size_t page_size = shared_memory_page_size_hint_bytes_
+                           ? shared_memory_page_size_hint_bytes_
+                           : TracingService::kDefaultShmPageSize;
+    size_t size = shared_memory_size_hint_bytes_
+                      ? shared_memory_size_hint_bytes_
+                      : TracingService::kDefaultShmSize;
+    std::string file_name;
+    shared_memory_file_ =
+        PosixSharedMemory::CreateInDirectory(shmem_dir, size, &file_name);
+    if (shared_memory_file_) {
+      shared_memory_file_path_ = std::string(shmem_dir) + "/" + file_name;
+      shared_memory_file_page_size_ = page_size;
+      req.set_producer_provided_shmem(true);
+      req.set_shmem_file_name(file_name);
+      req.set_shared_memory_size_hint_bytes(static_cast<uint32_t>(size));
+      req.set_shared_memory_page_size_hint_bytes(
+          static_cast<uint32_t>(page_size));
+    }
+  }
+#endif
+
   req.set_sdk_version(base::GetVersionString());
   producer_port_->InitializeConnection(req, std::move(on_init), shm_fd);
 
@@ -267,12 +300,29 @@ void ProducerIPCClientImpl::OnConnectionInitialized(
     bool direct_smb_patching_supported,
     bool use_shmem_emulation) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
+  // By now the service either mapped the SMB file or gave up on it.
+  UnlinkSharedMemoryFile();
   // If connection_succeeded == false, the OnDisconnect() call will follow next
   // and there we'll notify the |producer_|. TODO: add a test for this.
   if (!connection_succeeded)
     return;
   is_shmem_provided_by_producer_ = using_shmem_provided_by_producer;
   direct_smb_patching_supported_ = direct_smb_patching_supported;
+  if (shared_memory_file_) {
+    if (is_shmem_provided_by_producer_) {
+      // The service adopted the SMB file: use it as if the service provided
+      // it, except that no SetupTracing() FD will follow.
+      shared_memory_ = std::move(shared_memory_file_);
+      shared_buffer_page_size_kb_ = shared_memory_file_page_size_ / 1024;
+      shared_memory_arbiter_ = SharedMemoryArbiter::CreateInstance(
+          shared_memory_.get(), shared_memory_file_page_size_,
+          SharedMemoryABI::ShmemMode::kDefault, this, task_runner_);
+      if (direct_smb_patching_supported_)
+        shared_memory_arbiter_->SetDirectSMBPatchingSupportedByService();
+    } else {
+      shared_memory_file_.reset();
+    }
+  }
   // The tracing service may reject using shared memory and tell the client to
   // commit data over the socket. This can happen when the client connects to
   // the service via a relay service:
@@ -289,6 +339,15 @@ void ProducerIPCClientImpl::OnConnectionInitialized(
   }
 }
 
+void ProducerIPCClientImpl::UnlinkSharedMemoryFile() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  if (shared_memory_file_path_.empty())
+    return;
+  unlink(shared_memory_file_path_.c_str());
+  shared_memory_file_path_.clear();
+#endif
+}
+
 void ProducerIPCClientImpl::OnServiceRequest(
     const protos::gen::GetAsyncCommandResponse& cmd) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
@@ -20,6 +20,7 @@
 #include <stdint.h>
 
 #include <set>
+#include <string>
 #include <vector>
 
 #include "perfetto/ext/base/thread_checker.h"
@@ -100,6 +101,10 @@ class ProducerIPCClientImpl : public TracingService::ProducerEndpoint,
   // processing an IPC command.
   void ScheduleDisconnect();
 
+  // Removes the file of |shared_memory_file_| from the shared directory, once
+  // the service had a chance to map it.
+  void UnlinkSharedMemoryFile();
+
   // Invoked soon after having established the connection with the service.
   void OnConnectionInitialized(bool connection_succeeded,
                                bool using_shmem_provided_by_producer,
@@ -127,6 +132,14 @@ class ProducerIPCClientImpl : public TracingService::ProducerEndpoint,
   std::unique_ptr<SharedMemory> shared_memory_;
   std::unique_ptr<SharedMemoryArbiter> shared_memory_arbiter_;
   size_t shared_buffer_page_size_kb_ = 0;
+
+  // SMB created in the directory named by PERFETTO_PRODUCER_SHMEM_DIR, offered
+  // to the service in InitializeConnection() and adopted as |shared_memory_|
+  // if the service accepts it.
+  std::unique_ptr<SharedMemory> shared_memory_file_;
+  std::string shared_memory_file_path_;
+  size_t shared_memory_file_page_size_ = 0;
+
   std::set<DataSourceInstanceID> data_sources_setup_;
   bool connected_ = false;
   std::string const name_;
@@ -17,6 +17,7 @@
 #include "src/tracing/ipc/service/producer_ipc_service.h"
 
 #include <cinttypes>
+#include <utility>
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
@@ -40,8 +41,11 @@
 
 namespace perfetto {
 
-ProducerIPCService::ProducerIPCService(TracingService* core_service)
-    : core_service_(core_service), weak_ptr_factory_(this) {}
+ProducerIPCService::ProducerIPCService(TracingService* core_service,
+                                       std::string producer_shmem_dir)
+    : core_service_(core_service),
+      producer_shmem_dir_(std::move(producer_shmem_dir)),
+      weak_ptr_factory_(this) {}
 
 ProducerIPCService::~ProducerIPCService() = default;
 
@@ -87,6 +91,7 @@ void ProducerIPCService::InitializeConnection(
 
   // If the producer provided an SMB, tell the service to attempt to adopt it.
   std::unique_ptr<SharedMemory> shmem;
+  bool shmem_from_file = false;
   if (req.producer_provided_shmem()) {
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
     if (!req.has_shm_key_windows() || req.shm_key_windows().empty()) {
@@ -108,6 +113,12 @@ void ProducerIPCService::InitializeConnection(
             "Couldn't map producer-provided SMB, falling back to "
             "service-provided SMB");
       }
+    } else if (req.has_shmem_file_name() && !producer_shmem_dir_.empty()) {
+      // The producer is behind traced_relay, which doesn't forward FDs, and
+      // created its SMB in the directory shared with the service.
+      shmem = PosixSharedMemory::AttachToFileInDirectory(
+          producer_shmem_dir_, req.shmem_file_name());
+      shmem_from_file = !!shmem;
     } else {
       PERFETTO_DLOG(
           "InitializeConnectionRequest's producer_provided_shmem flag is set "
@@ -133,7 +144,13 @@ void ProducerIPCService::InitializeConnection(
     return;
   }
 
+  // The SMB file, if adopted, is shared memory even if the transport doesn't
+  // support passing it.
   bool use_shmem_emulation = ipc::Service::use_shmem_emulation();
+  if (shmem_from_file &&
+      producer->service_endpoint->IsShmemProvidedByProducer()) {
+    use_shmem_emulation = false;
+  }
   bool using_producer_shmem =
       !use_shmem_emulation &&
       producer->service_endpoint->IsShmemProvidedByProducer();
@@ -40,7 +40,11 @@ class Host;
 // on the IPC socket, through the methods overriddden from ProducerPort.
 class ProducerIPCService : public protos::gen::ProducerPort {
  public:
-  explicit ProducerIPCService(TracingService* core_service);
+  // |producer_shmem_dir|, if not empty, is the directory in which the producers
+  // that can't pass FDs (i.e. behind traced_relay) create their SMB file. See
+  // InitializeConnectionRequest.shmem_file_name.
+  explicit ProducerIPCService(TracingService* core_service,
+                              std::string producer_shmem_dir = std::string());
   ~ProducerIPCService() override;
 
   // ProducerPort implementation (from .proto IPC definition).
@@ -125,6 +129,7 @@ class ProducerIPCService : public protos::gen::ProducerPort {
   RemoteProducer* GetProducerForCurrentRequest();
 
   TracingService* const core_service_;
+  const std::string producer_shmem_dir_;
 
   // Maps IPC clients to ProducerEndpoint instances registered on the
   // |core_service_| business logic.
@@ -27,8 +27,11 @@
 
 namespace perfetto {
 
-RelayIPCService::RelayIPCService(TracingService* core_service)
-    : core_service_(core_service), weak_ptr_factory_(this) {}
+RelayIPCService::RelayIPCService(TracingService* core_service,
+                                 bool accepts_compressed_frames)
+    : core_service_(core_service),
+      accepts_compressed_frames_(accepts_compressed_frames),
+      weak_ptr_factory_(this) {}
 
 TracingService::RelayEndpoint* RelayIPCService::GetRelayEndpoint(
     ipc::ClientID client_id) {
@@ -56,6 +59,7 @@ void RelayIPCService::SyncClock(const protos::gen::SyncClockRequest& req,
 
   // Send the response to client to reduce RTT.
   auto async_resp = ipc::AsyncResult<protos::gen::SyncClockResponse>::Create();
+  async_resp->set_accepts_compressed_frames(accepts_compressed_frames_);
   resp.Resolve(std::move(async_resp));
 
   ClockSnapshotVector client_clock_snapshots;
@@ -33,7 +33,10 @@ namespace perfetto {
 // Implements the RelayPort IPC service.
 class RelayIPCService : public protos::gen::RelayPort {
  public:
-  explicit RelayIPCService(TracingService* core_service);
+  // |accepts_compressed_frames| is advertised to traced_relay in
+  // SyncClockResponse. See ipc::Host::SetFrameDecompressor().
+  explicit RelayIPCService(TracingService* core_service,
+                           bool accepts_compressed_frames = false);
   ~RelayIPCService() override = default;
 
   void OnClientDisconnected() override;
@@ -42,6 +45,7 @@ class RelayIPCService : public protos::gen::RelayPort {
 
  private:
   TracingService* const core_service_;
+  const bool accepts_compressed_frames_;
 
   using ClockSnapshots =
       base::FlatHashMap<uint32_t, std::pair<uint64_t, uint64_t>>;
@@ -18,6 +18,7 @@
 
 #include "perfetto/base/logging.h"
 #include "perfetto/base/task_runner.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/ipc/host.h"
 #include "perfetto/ext/tracing/core/tracing_service.h"
 #include "src/tracing/ipc/service/consumer_ipc_service.h"
@@ -34,6 +35,11 @@ namespace perfetto {
 
 namespace {
 constexpr uint32_t kProducerSocketTxTimeoutMs = 10;
+
+// ReadBuffers() replies larger than this are sent to the consumers through a
+// memfd rather than through the socket, which can only hold a fraction of
+// them at once.
+constexpr size_t kConsumerShmemFrameThreshold = 256 * 1024;
 }
 
 // TODO(fmayer): implement per-uid connection limit (b/69093705).
@@ -61,9 +67,10 @@ bool ServiceIPCHostImpl::Start(
   // Initialize the IPC transport.
   for (const auto& producer_socket_name : producer_socket_names)
     producer_ipc_ports_.emplace_back(
-        ipc::Host::CreateInstance(producer_socket_name.c_str(), task_runner_));
-  consumer_ipc_port_ =
-      ipc::Host::CreateInstance(consumer_socket_name, task_runner_);
+        ipc::Host::CreateInstance(producer_socket_name.c_str(), task_runner_,
+                                  GetIpcTaskRunner()));
+  consumer_ipc_port_ = ipc::Host::CreateInstance(
+      consumer_socket_name, task_runner_, GetIpcTaskRunner());
   return DoStart();
 }
 
@@ -72,10 +79,10 @@ bool ServiceIPCHostImpl::Start(base::ScopedSocketHandle producer_socket_fd,
   PERFETTO_CHECK(!svc_);  // Check if already started.
 
   // Initialize the IPC transport.
-  producer_ipc_ports_.emplace_back(
-      ipc::Host::CreateInstance(std::move(producer_socket_fd), task_runner_));
-  consumer_ipc_port_ =
-      ipc::Host::CreateInstance(std::move(consumer_socket_fd), task_runner_);
+  producer_ipc_ports_.emplace_back(ipc::Host::CreateInstance(
+      std::move(producer_socket_fd), task_runner_, GetIpcTaskRunner()));
+  consumer_ipc_port_ = ipc::Host::CreateInstance(
+      std::move(consumer_socket_fd), task_runner_, GetIpcTaskRunner());
   return DoStart();
 }
 
@@ -92,6 +99,16 @@ bool ServiceIPCHostImpl::Start(std::unique_ptr<ipc::Host> producer_host,
   return DoStart();
 }
 
+base::TaskRunner* ServiceIPCHostImpl::GetIpcTaskRunner() {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  if (init_opts_.ipc_on_dedicated_thread && !ipc_task_runner_) {
+    ipc_task_runner_ = std::make_unique<base::ThreadTaskRunner>(
+        base::ThreadTaskRunner::CreateAndStart("TracingSvcIPC"));
+  }
+#endif
+  return ipc_task_runner_ ? ipc_task_runner_.get() : task_runner_;
+}
+
 bool ServiceIPCHostImpl::DoStart() {
   // Create and initialize the platform-independent tracing business logic.
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
@@ -119,20 +136,26 @@ bool ServiceIPCHostImpl::DoStart() {
   // due to large messages such as ReadBuffersResponse.
   for (auto& producer_ipc_port : producer_ipc_ports_)
     producer_ipc_port->SetSocketSendTimeoutMs(kProducerSocketTxTimeoutMs);
+  consumer_ipc_port_->SetShmemFrameThreshold(kConsumerShmemFrameThreshold);
 
   // TODO(fmayer): add a test that destroyes the ServiceIPCHostImpl soon after
   // Start() and checks that no spurious callbacks are issued.
   for (auto& producer_ipc_port : producer_ipc_ports_) {
     bool producer_service_exposed = producer_ipc_port->ExposeService(
-        std::unique_ptr<ipc::Service>(new ProducerIPCService(svc_.get())));
+        std::unique_ptr<ipc::Service>(new ProducerIPCService(
+            svc_.get(), init_opts_.relay_producer_shmem_dir)));
     PERFETTO_CHECK(producer_service_exposed);
 
     if (!init_opts_.enable_relay_endpoint)
       continue;
     // Expose a secondary service for sync with remote relay service
     // if requested.
-    bool relay_service_exposed = producer_ipc_port->ExposeService(
-        std::unique_ptr<ipc::Service>(new RelayIPCService(svc_.get())));
+    auto decompressor_fn = init_opts_.relay_frame_decompressor_fn;
+    if (decompressor_fn)
+      producer_ipc_port->SetFrameDecompressor(decompressor_fn);
+    bool relay_service_exposed =
+        producer_ipc_port->ExposeService(std::unique_ptr<ipc::Service>(
+            new RelayIPCService(svc_.get(), decompressor_fn != nullptr)));
     PERFETTO_CHECK(relay_service_exposed);
   }
 
@@ -51,8 +51,13 @@ class ServiceIPCHostImpl : public ServiceIPCHost {
   bool DoStart();
   void Shutdown();
 
+  // The task runner of the IPC hosts' I/O thread, if |init_opts_| asks for
+  // one, or |task_runner_| otherwise. Must outlive the hosts.
+  base::TaskRunner* GetIpcTaskRunner();
+
   base::TaskRunner* const task_runner_;
   const TracingService::InitOpts init_opts_;
+  std::unique_ptr<base::TaskRunner> ipc_task_runner_;
   std::unique_ptr<TracingService> svc_;  // The service business logic.
 
   // The IPC hosts that listen on the Producer sockets. They own the
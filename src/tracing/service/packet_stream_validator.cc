@@ -21,7 +21,6 @@
 #include <cinttypes>
 
 #include "perfetto/base/logging.h"
-#include "perfetto/ext/base/utils.h"
 #include "perfetto/protozero/proto_utils.h"
 
 #include "protos/perfetto/trace/trace_packet.pbzero.h"
@@ -32,17 +31,50 @@ namespace {
 
 using protozero::proto_utils::ProtoWireType;
 
-const uint32_t kReservedFieldIds[] = {
+constexpr uint32_t kReservedFieldIds[] = {
     protos::pbzero::TracePacket::kTrustedUidFieldNumber,
     protos::pbzero::TracePacket::kTrustedPacketSequenceIdFieldNumber,
     protos::pbzero::TracePacket::kTraceConfigFieldNumber,
     protos::pbzero::TracePacket::kTraceStatsFieldNumber,
     protos::pbzero::TracePacket::kCompressedPacketsFieldNumber,
+    protos::pbzero::TracePacket::kZstdCompressedPacketsFieldNumber,
     protos::pbzero::TracePacket::kSynchronizationMarkerFieldNumber,
     protos::pbzero::TracePacket::kTrustedPidFieldNumber,
     protos::pbzero::TracePacket::kMachineIdFieldNumber,
 };
 
+// Reserved field ids are all < 128: a bitmap indexed by field id replaces the
+// linear scan of kReservedFieldIds in the hot path.
+class ReservedFieldBitmap {
+ public:
+  static constexpr uint32_t kMaxFieldId = 128;
+
+  constexpr ReservedFieldBitmap() {
+    for (uint32_t field_id : kReservedFieldIds)
+      words_[field_id / 64] |= 1ull << (field_id % 64);
+  }
+
+  bool IsReserved(uint64_t field_id) const {
+    return field_id < kMaxFieldId &&
+           (words_[field_id / 64] & (1ull << (field_id % 64)));
+  }
+
+ private:
+  uint64_t words_[kMaxFieldId / 64]{};
+};
+
+constexpr ReservedFieldBitmap kReservedFields;
+
+static_assert(
+    [] {
+      for (uint32_t field_id : kReservedFieldIds) {
+        if (field_id >= ReservedFieldBitmap::kMaxFieldId)
+          return false;
+      }
+      return true;
+    }(),
+    "Grow ReservedFieldBitmap::kMaxFieldId");
+
 // This translation unit is quite subtle and perf-sensitive. Remember to check
 // BM_PacketStreamValidator in perfetto_benchmarks when making changes.
 
@@ -89,13 +121,10 @@ class ProtoFieldParserFSM {
     switch (state_) {
       case kFieldPreamble: {
         uint64_t field_type = varint & 7;  // 7 = 0..0111
-        auto field_id = static_cast<uint32_t>(varint >> 3);
         // Check if the field id is reserved, go into an error state if it is.
-        for (size_t i = 0; i < base::ArraySize(kReservedFieldIds); ++i) {
-          if (field_id == kReservedFieldIds[i]) {
-            state_ = kWroteReservedField;
-            return 0;
-          }
+        if (kReservedFields.IsReserved(varint >> 3)) {
+          state_ = kWroteReservedField;
+          return 0;
         }
         // The field type is legit, now check it's well formed and within
         // boundaries.
@@ -166,10 +195,71 @@ class ProtoFieldParserFSM {
   uint32_t varint_shift_ = 0;
 };
 
+// Fast path for packets that are contiguous in memory, which is the case of
+// all the packets that don't straddle chunks. Walks the top-level fields with
+// the protozero varint decoder and skips their payloads in one step, rather
+// than pushing every preamble and length byte through the state machine.
+// Accepts exactly the same packets as ProtoFieldParserFSM.
+bool ValidateContiguous(const uint8_t* ptr, const uint8_t* end) {
+  using protozero::proto_utils::ParseVarInt;
+  while (ptr < end) {
+    uint64_t preamble;
+    const uint8_t* next = ParseVarInt(ptr, end, &preamble);
+    if (next == ptr)
+      return false;  // Truncated or too long varint.
+    ptr = next;
+    if (kReservedFields.IsReserved(preamble >> 3))
+      return false;
+    size_t avail = static_cast<size_t>(end - ptr);
+    switch (static_cast<ProtoWireType>(preamble & 7)) {
+      case ProtoWireType::kVarInt: {
+        uint64_t unused;
+        next = ParseVarInt(ptr, end, &unused);
+        if (next == ptr)
+          return false;
+        ptr = next;
+        break;
+      }
+      case ProtoWireType::kFixed32:
+        if (avail < 4)
+          return false;
+        ptr += 4;
+        break;
+      case ProtoWireType::kFixed64:
+        if (avail < 8)
+          return false;
+        ptr += 8;
+        break;
+      case ProtoWireType::kLengthDelimited: {
+        uint64_t len;
+        next = ParseVarInt(ptr, end, &len);
+        if (next == ptr || len > protozero::proto_utils::kMaxMessageLength)
+          return false;
+        ptr = next;
+        if (len > static_cast<uint64_t>(end - ptr))
+          return false;
+        ptr += len;
+        break;
+      }
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
 }  // namespace
 
 // static
 bool PacketStreamValidator::Validate(const Slices& slices) {
+  if (slices.size() == 1) {
+    const auto* start = reinterpret_cast<const uint8_t*>(slices[0].start);
+    if (ValidateContiguous(start, start + slices[0].size))
+      return true;
+    PERFETTO_DLOG("Packet validation error");
+    return false;
+  }
+
   ProtoFieldParserFSM parser;
   size_t skip_bytes = 0;
   for (const Slice& slice : slices) {
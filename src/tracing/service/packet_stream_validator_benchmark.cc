@@ -68,6 +68,66 @@ static void BM_PacketStreamValidator(benchmark::State& state) {
   PERFETTO_CHECK(res);
 }
 
+// Validates, one at a time, small packets with a handful of top-level fields
+// and each in a single slice, like most of the packets read from the buffers.
+static void BM_PacketStreamValidator_SmallPackets(benchmark::State& state) {
+  using namespace perfetto;
+
+  std::vector<std::vector<uint8_t>> bufs;
+  for (uint64_t i = 0; i < 64; i++) {
+    protozero::HeapBuffered<protos::pbzero::TracePacket> packet;
+    packet->set_timestamp(1000ull * 1000 * 1000 * 3600 + i * 1000);
+    packet->set_sequence_flags(2);
+    auto* evt = packet->set_for_testing();
+    evt->set_seq_value(static_cast<uint32_t>(i));
+    evt->set_str("event_name");
+    bufs.push_back(packet.SerializeAsArray());
+  }
+  std::vector<Slices> packets(bufs.size());
+  for (size_t i = 0; i < bufs.size(); i++)
+    packets[i].emplace_back(bufs[i].data(), bufs[i].size());
+
+  bool res = true;
+  for (auto _ : state) {
+    for (const Slices& slices : packets)
+      res &= PacketStreamValidator::Validate(slices);
+  }
+  PERFETTO_CHECK(res);
+  state.SetItemsProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(packets.size()));
+}
+
+// Adversarial stream: 4KB of one-byte varint fields, the worst case for the
+// number of preambles to decode per byte. The packet ends with a reserved
+// field, so the whole packet has to be scanned to reject it. state.range(0)
+// is the size of the slices the packet is split into, 0 for a single slice.
+static void BM_PacketStreamValidator_ManyFields(benchmark::State& state) {
+  using namespace perfetto;
+
+  std::vector<uint8_t> buf;
+  while (buf.size() < 4096) {
+    buf.push_back(0x08);  // Field 1, varint.
+    buf.push_back(0x01);
+  }
+  buf.push_back(0x18);  // trusted_uid (3), varint.
+  buf.push_back(0x01);
+
+  const size_t slice_size =
+      state.range(0) ? static_cast<size_t>(state.range(0)) : buf.size();
+  Slices slices;
+  for (size_t pos = 0; pos < buf.size(); pos += slice_size)
+    slices.emplace_back(&buf[pos], std::min(slice_size, buf.size() - pos));
+
+  bool res = false;
+  for (auto _ : state)
+    res |= PacketStreamValidator::Validate(slices);
+  PERFETTO_CHECK(!res);
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(buf.size()));
+}
+
 }  // namespace
 
 BENCHMARK(BM_PacketStreamValidator);
+BENCHMARK(BM_PacketStreamValidator_SmallPackets);
+BENCHMARK(BM_PacketStreamValidator_ManyFields)->Arg(0)->Arg(512)->Arg(1);
@@ -17,6 +17,8 @@
 #include "src/tracing/service/packet_stream_validator.h"
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "protos/perfetto/trace/ftrace/ftrace_event.gen.h"
 #include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
@@ -264,5 +266,53 @@ TEST(PacketStreamValidatorTest, TrailingGarbage) {
   EXPECT_FALSE(PacketStreamValidator::Validate(seq));
 }
 
+// Packets in a single slice take a fast path: check that it accepts the same
+// packets as the byte-by-byte parsing of fragmented ones.
+TEST(PacketStreamValidatorTest, ContiguousMatchesFragmented) {
+  const std::vector<std::pair<std::string, bool>> kCases = {
+      {"", true},
+      // for_testing (900) with an empty submessage.
+      {std::string("\xa2\x38\x00", 3), true},
+      // Varint field 1, 10 bytes long.
+      {std::string("\x08\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01", 11),
+       true},
+      // Varint field 1, 11 bytes long.
+      {std::string("\x08\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\x01",
+                   12),
+       false},
+      // Truncated varint.
+      {std::string("\x08\xff", 2), false},
+      // Fixed32 / fixed64 fields 1, complete and truncated.
+      {std::string("\x0d\x01\x02\x03\x04", 5), true},
+      {std::string("\x0d\x01\x02\x03", 4), false},
+      {std::string("\x09\x01\x02\x03\x04\x05\x06\x07\x08", 9), true},
+      {std::string("\x09\x01\x02\x03\x04\x05\x06\x07", 8), false},
+      // Length-delimited field 2 with a length past the end.
+      {std::string("\x12\x05\x01\x02", 4), false},
+      // Unknown wire types 3 and 7.
+      {std::string("\x0b", 1), false},
+      {std::string("\x0f", 1), false},
+      // trusted_uid (3) and zstd_compressed_packets (113).
+      {std::string("\x18\x01", 2), false},
+      {std::string("\x8a\x07\x00", 3), false},
+      // Field 113 + 128 = 241 isn't reserved.
+      {std::string("\x8a\x0f\x00", 3), true},
+      // trusted_uid, with an overlong (but still valid) preamble.
+      {std::string("\x98\x80\x00\x01", 4), false},
+  };
+  for (const auto& [buf, expected] : kCases) {
+    Slices contiguous;
+    contiguous.emplace_back(buf.data(), buf.size());
+    EXPECT_EQ(PacketStreamValidator::Validate(contiguous), expected);
+
+    Slices fragmented;
+    for (size_t i = 0; i < buf.size(); i++)
+      fragmented.emplace_back(&buf[i], 1);
+    fragmented.emplace_back(buf.data(), 0);
+    fragmented.emplace_back(buf.data(), 0);
+    EXPECT_EQ(PacketStreamValidator::Validate(fragmented), expected);
+  }
+}
+
 }  // namespace
 }  // namespace perfetto
@@ -16,9 +16,11 @@
 
 #include "src/tracing/service/trace_buffer.h"
 
+#include <algorithm>
 #include <limits>
 
 #include "perfetto/base/logging.h"
+#include "perfetto/base/time.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/client_identity.h"
 #include "perfetto/ext/tracing/core/shared_memory_abi.h"
@@ -47,12 +49,44 @@ const size_t TraceBuffer::InlineChunkHeaderSize = sizeof(ChunkRecord);
 
 // static
 std::unique_ptr<TraceBuffer> TraceBuffer::Create(size_t size_in_bytes,
-                                                 OverwritePolicy pol) {
+                                                 OverwritePolicy pol,
+                                                 size_t num_shards,
+                                                 ShardingPolicy sharding) {
   std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol));
-  if (!trace_buffer->Initialize(size_in_bytes))
+  num_shards = std::min(num_shards, size_in_bytes / kMinShardSize);
+  if (num_shards <= 1) {
+    if (!trace_buffer->Initialize(size_in_bytes))
+      return nullptr;
+    return trace_buffer;
+  }
+
+  // The shards are independent buffers, so the buffer itself has no memory.
+  const size_t shard_size = size_in_bytes / num_shards /
+                            SharedMemoryABI::kMinPageSize *
+                            SharedMemoryABI::kMinPageSize;
+  trace_buffer->sharding_policy_ = sharding;
+  for (size_t i = 0; i < num_shards; i++) {
+    std::unique_ptr<TraceBuffer> shard = Create(shard_size, pol);
+    if (!shard)
+      return nullptr;
+    trace_buffer->size_ += shard_size;
+    trace_buffer->shards_.emplace_back(std::move(shard));
+  }
+  return trace_buffer;
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+// static
+std::unique_ptr<TraceBuffer> TraceBuffer::CreateFileBacked(
+    int fd,
+    size_t size_in_bytes,
+    OverwritePolicy pol) {
+  std::unique_ptr<TraceBuffer> trace_buffer(new TraceBuffer(pol));
+  if (!trace_buffer->Initialize(size_in_bytes, fd))
     return nullptr;
   return trace_buffer;
 }
+#endif
 
 TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
   // See comments in ChunkRecord for the rationale of this.
@@ -61,16 +95,38 @@ TraceBuffer::TraceBuffer(OverwritePolicy pol) : overwrite_policy_(pol) {
                 "ChunkRecord out of sync with the layout of SharedMemoryABI");
 }
 
-TraceBuffer::~TraceBuffer() = default;
+TraceBuffer::~TraceBuffer() {
+  if (cow_source_)
+    DetachFromSource();
+  // The clones can't share the pages of a buffer which is going away.
+  for (TraceBuffer* clone : cow_clones_) {
+    clone->CopyPagesFromSource(0, clone->used_size_);
+    clone->cow_source_ = nullptr;
+  }
+}
 
-bool TraceBuffer::Initialize(size_t size) {
+bool TraceBuffer::Initialize(size_t size, int backing_fd) {
   static_assert(
       SharedMemoryABI::kMinPageSize % sizeof(ChunkRecord) == 0,
       "sizeof(ChunkRecord) must be an integer divider of a page size");
   auto max_size = std::numeric_limits<decltype(ChunkMeta::record_off)>::max();
   PERFETTO_CHECK(size <= static_cast<size_t>(max_size));
-  data_ = base::PagedMemory::Allocate(
-      size, base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit);
+  int flags = base::PagedMemory::kMayFail | base::PagedMemory::kDontCommit;
+  // Large buffers are written and read all over: back them with huge pages
+  // (when the kernel can) to save TLB misses.
+  if (size >= kHugePagesMinBufferSize)
+    flags |= base::PagedMemory::kHugePages;
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  if (backing_fd >= 0) {
+    data_ = base::PagedMemory::AllocateFileBacked(backing_fd, size, flags);
+    file_backed_ = data_.IsValid();
+  } else {
+    data_ = base::PagedMemory::Allocate(size, flags);
+  }
+#else
+  PERFETTO_CHECK(backing_fd < 0);
+  data_ = base::PagedMemory::Allocate(size, flags);
+#endif
   if (!data_.IsValid()) {
     PERFETTO_ELOG("Trace buffer allocation failed (size: %zu)", size);
     return false;
@@ -100,6 +156,13 @@ void TraceBuffer::CopyChunkUntrusted(
     const uint8_t* src,
     size_t size) {
   PERFETTO_CHECK(!read_only_);
+  if (!shards_.empty()) {
+    GetShardFor(producer_id_trusted, writer_id)
+        ->CopyChunkUntrusted(producer_id_trusted, client_identity_trusted,
+                             writer_id, chunk_id, num_fragments, chunk_flags,
+                             chunk_complete, src, size);
+    return;
+  }
 
   // |record_size| = |size| + sizeof(ChunkRecord), rounded up to avoid to end
   // up in a fragmented state where size_to_end() < sizeof(ChunkRecord).
@@ -220,13 +283,29 @@ void TraceBuffer::CopyChunkUntrusted(
   if (PERFETTO_UNLIKELY(discard_writes_))
     return DiscardWrite();
 
+  // Producer quotas only apply to new chunks: rewriting a chunk (see above)
+  // takes no additional space.
+  ProducerQuotaState* quota_state = nullptr;
+  uint32_t priority = 0;
+  if (PERFETTO_UNLIKELY(producer_quotas_)) {
+    quota_state = &(*producer_quotas_)[producer_id_trusted];
+    if (!ConsumeProducerQuota(quota_state, record_size)) {
+      quota_state->stats.chunks_dropped_over_quota++;
+      TRACE_BUFFER_DLOG("  dropping write over quota");
+      return;
+    }
+    priority = quota_state->quota.priority;
+  }
+
   // If there isn't enough room from the given write position. Write a padding
   // record to clear the end of the buffer and wrap back.
   const size_t cached_size_to_end = size_to_end();
   if (PERFETTO_UNLIKELY(record_size > cached_size_to_end)) {
-    ssize_t res = DeleteNextChunksFor(cached_size_to_end);
+    ssize_t res = DeleteNextChunksFor(cached_size_to_end, priority);
     if (res == -1)
       return DiscardWrite();
+    if (res == -2)
+      return DropWriteForPriority(quota_state, record_size);
     PERFETTO_DCHECK(static_cast<size_t>(res) <= cached_size_to_end);
     AddPaddingRecord(cached_size_to_end);
     wptr_ = begin();
@@ -254,14 +333,18 @@ void TraceBuffer::CopyChunkUntrusted(
   // +---------------------------------+---------------+--------------------+
 
   // Deletes all chunks from |wptr_| to |wptr_| + |record_size|.
-  ssize_t del_res = DeleteNextChunksFor(record_size);
+  ssize_t del_res = DeleteNextChunksFor(record_size, priority);
   if (del_res == -1)
     return DiscardWrite();
+  if (del_res == -2)
+    return DropWriteForPriority(quota_state, record_size);
   size_t padding_size = static_cast<size_t>(del_res);
 
   // Now first insert the new chunk. At the end, if necessary, add the padding.
   stats_.set_chunks_written(stats_.chunks_written() + 1);
   stats_.set_bytes_written(stats_.bytes_written() + record_size);
+  if (quota_state)
+    quota_state->stats.bytes_written += record_size;
 
   uint32_t chunk_off = GetOffset(GetChunkRecordAt(wptr_));
   auto it_and_inserted =
@@ -307,7 +390,8 @@ void TraceBuffer::CopyChunkUntrusted(
     AddPaddingRecord(padding_size);
 }
 
-ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
+ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear,
+                                         uint32_t writer_priority) {
   PERFETTO_CHECK(!discard_writes_);
 
   // Find the position of the first chunk which begins at or after
@@ -351,6 +435,10 @@ ssize_t TraceBuffer::DeleteNextChunksFor(size_t bytes_to_clear) {
         if (PERFETTO_UNLIKELY(meta.num_fragments_read < meta.num_fragments)) {
           if (overwrite_policy_ == kDiscard)
             return -1;
+          if (PERFETTO_UNLIKELY(producer_quotas_) &&
+              GetProducerPriority(key.producer_id) > writer_priority) {
+            return -2;
+          }
           chunks_overwritten++;
           bytes_overwritten += next_chunk.size;
         }
@@ -406,6 +494,11 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
                                         size_t patches_size,
                                         bool other_patches_pending) {
   PERFETTO_CHECK(!read_only_);
+  if (!shards_.empty()) {
+    return GetShardFor(producer_id, writer_id)
+        ->TryPatchChunkContents(producer_id, writer_id, chunk_id, patches,
+                                patches_size, other_patches_pending);
+  }
   ChunkMeta::Key key(producer_id, writer_id, chunk_id);
   auto it = index_.find(key);
   if (it == index_.end()) {
@@ -445,6 +538,7 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
       return false;
     }
 
+    PrepareWrite(ptr, Patch::kSize);
     memcpy(ptr, &patches[i].data[0], Patch::kSize);
   }
   TRACE_BUFFER_DLOG("Chunk raw (after patch): %s",
@@ -453,12 +547,22 @@ bool TraceBuffer::TryPatchChunkContents(ProducerID producer_id,
   stats_.set_patches_succeeded(stats_.patches_succeeded() + patches_size);
   if (!other_patches_pending) {
     chunk_meta.flags &= ~kChunkNeedsPatching;
+    PrepareWrite(chunk_begin, sizeof(ChunkRecord));
     chunk_record->flags = chunk_meta.flags & ChunkRecord::kFlagsBitMask;
   }
   return true;
 }
 
 void TraceBuffer::BeginRead() {
+  if (!shards_.empty()) {
+    readable_shards_.clear();
+    for (const auto& shard : shards_) {
+      shard->BeginRead();
+      readable_shards_.push_back(shard.get());
+    }
+    next_read_shard_ = 0;
+    return;
+  }
   read_iter_ = GetReadIterForSequence(index_.begin());
 #if PERFETTO_DCHECK_IS_ON()
   changed_since_last_read_ = false;
@@ -537,6 +641,11 @@ bool TraceBuffer::ReadNextTracePacket(
     TracePacket* packet,
     PacketSequenceProperties* sequence_properties,
     bool* previous_packet_on_sequence_dropped) {
+  if (!shards_.empty()) {
+    return ReadNextTracePacketFromShards(packet, sequence_properties,
+                                        previous_packet_on_sequence_dropped);
+  }
+
   // Note: MoveNext() moves only within the next chunk within the same
   // {ProducerID, WriterID} sequence. Here we want to:
   // - return the next patched+complete packet in the current sequence, if any.
@@ -808,8 +917,8 @@ TraceBuffer::ReadPacketResult TraceBuffer::ReadNextPacketInChunk(
   PERFETTO_DCHECK(chunk_meta->num_fragments_read < chunk_meta->num_fragments);
   PERFETTO_DCHECK(!(chunk_meta->flags & kChunkNeedsPatching));
 
-  const uint8_t* record_begin = begin() + chunk_meta->record_off;
-  DcheckIsAlignedAndWithinBounds(record_begin);
+  DcheckIsAlignedAndWithinBounds(begin() + chunk_meta->record_off);
+  const uint8_t* record_begin = GetChunkRecordForRead(chunk_meta->record_off);
   auto* chunk_record = reinterpret_cast<const ChunkRecord*>(record_begin);
   const uint8_t* record_end = record_begin + chunk_record->size;
   const uint8_t* packets_begin = record_begin + sizeof(ChunkRecord);
@@ -900,10 +1009,85 @@ void TraceBuffer::DiscardWrite() {
   TRACE_BUFFER_DLOG("  discarding write");
 }
 
+void TraceBuffer::DropWriteForPriority(ProducerQuotaState* quota_state,
+                                       size_t record_size) {
+  // The chunk doesn't count against the quota, as it wasn't written.
+  quota_state->tokens += static_cast<double>(record_size);
+  quota_state->stats.chunks_dropped_for_priority++;
+  TRACE_BUFFER_DLOG("  dropping write for priority");
+}
+
+bool TraceBuffer::ConsumeProducerQuota(ProducerQuotaState* quota_state,
+                                       size_t record_size) {
+  const uint64_t max_bytes_per_sec = quota_state->quota.max_bytes_per_sec;
+  if (max_bytes_per_sec == 0)
+    return true;
+  const int64_t now_ns = base::GetBootTimeNs().count();
+  const double elapsed_s =
+      static_cast<double>(now_ns - quota_state->last_refill_ns) / 1e9;
+  quota_state->last_refill_ns = now_ns;
+  quota_state->tokens =
+      std::min(static_cast<double>(max_bytes_per_sec),
+               quota_state->tokens +
+                   elapsed_s * static_cast<double>(max_bytes_per_sec));
+  if (quota_state->tokens < static_cast<double>(record_size))
+    return false;
+  quota_state->tokens -= static_cast<double>(record_size);
+  return true;
+}
+
+void TraceBuffer::SetProducerQuota(ProducerID producer_id,
+                                   const std::string& producer_name,
+                                   const ProducerQuota& quota) {
+  if (!producer_quotas_) {
+    producer_quotas_ = &producer_quotas_storage_;
+    for (const auto& shard : shards_)
+      shard->producer_quotas_ = producer_quotas_;
+  }
+  ProducerQuotaState& state = (*producer_quotas_)[producer_id];
+  state.producer_name = producer_name;
+  if (state.last_refill_ns == 0 ||
+      state.quota.max_bytes_per_sec != quota.max_bytes_per_sec) {
+    state.tokens = static_cast<double>(quota.max_bytes_per_sec);
+    state.last_refill_ns = base::GetBootTimeNs().count();
+  }
+  state.quota = quota;
+}
+
+void TraceBuffer::CopyProducerQuotasFrom(const TraceBuffer& other) {
+  if (!other.producer_quotas_)
+    return;
+  for (auto it = other.producer_quotas_->GetIterator(); it; ++it)
+    SetProducerQuota(it.key(), it.value().producer_name, it.value().quota);
+}
+
 std::unique_ptr<TraceBuffer> TraceBuffer::CloneReadOnly() const {
-  std::unique_ptr<TraceBuffer> buf(new TraceBuffer(CloneCtor(), *this));
-  if (!buf->data_.IsValid())
-    return nullptr;  // PagedMemory::Allocate() failed. We are out of memory.
+  std::unique_ptr<TraceBuffer> buf;
+  if (!shards_.empty()) {
+    buf.reset(new TraceBuffer(overwrite_policy_));
+    buf->read_only_ = true;
+    buf->size_ = size_;
+    buf->sharding_policy_ = sharding_policy_;
+    for (const auto& shard : shards_) {
+      std::unique_ptr<TraceBuffer> shard_clone = shard->CloneReadOnly();
+      if (!shard_clone)
+        return nullptr;
+      buf->shards_.emplace_back(std::move(shard_clone));
+    }
+  } else {
+    buf.reset(new TraceBuffer(CloneCtor(), *this));
+    if (!buf->data_.IsValid())
+      return nullptr;  // PagedMemory::Allocate() failed. We are out of memory.
+  }
+
+  // Carry over the per-producer stats. The shards of a sharded buffer don't
+  // own them and the clone is never written, so the shard clones don't need
+  // them.
+  if (producer_quotas_ == &producer_quotas_storage_) {
+    buf->producer_quotas_ = &buf->producer_quotas_storage_;
+    for (auto it = producer_quotas_->GetIterator(); it; ++it)
+      buf->producer_quotas_storage_.Insert(it.key(), it.value());
+  }
   return buf;
 }
 
@@ -911,13 +1095,38 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
     : overwrite_policy_(src.overwrite_policy_),
       read_only_(true),
       discard_writes_(src.discard_writes_) {
+  static_assert(kCowPageSize % sizeof(ChunkRecord) == 0,
+                "A ChunkRecord header must not straddle two pages");
   if (!Initialize(src.data_.size()))
     return;  // TraceBuffer::Clone() will check |data_| and return nullptr.
 
   // The assignments below must be done after Initialize().
 
-  EnsureCommitted(src.used_size_);
-  memcpy(data_.Get(), src.data_.Get(), src.used_size_);
+  // Share the pages with |src| rather than copying them. When |src| is itself
+  // a clone, share the pages it still shares with its source and copy the
+  // others: only the buffers which are written keep track of clones.
+  used_size_ = src.used_size_;
+  const size_t num_pages = base::AlignUp(used_size_, kCowPageSize) /
+                           kCowPageSize;
+  cow_pages_copied_.assign(num_pages, false);
+  cow_pages_shared_ = num_pages;
+  cow_source_ = src.cow_source_ ? src.cow_source_ : &src;
+  for (size_t page = 0; src.cow_source_ && page < num_pages; page++) {
+    if (src.cow_pages_copied_[page]) {
+      const size_t off = page * kCowPageSize;
+      const size_t size = std::min(kCowPageSize, used_size_ - off);
+      data_.EnsureCommitted(off + size);
+      memcpy(begin() + off, src.begin() + off, size);
+      cow_pages_copied_[page] = true;
+      cow_pages_shared_--;
+    }
+  }
+  if (cow_pages_shared_ > 0) {
+    cow_source_->cow_clones_.push_back(this);
+  } else {
+    cow_source_ = nullptr;
+  }
+
   last_chunk_id_written_ = src.last_chunk_id_written_;
 
   stats_ = src.stats_;
@@ -937,4 +1146,164 @@ TraceBuffer::TraceBuffer(CloneCtor, const TraceBuffer& src)
   read_iter_ = SequenceIterator();
 }
 
+const uint8_t* TraceBuffer::GetSharedChunkRecordForRead(uint32_t record_off) {
+  // Read the ChunkRecord header from wherever its page is: the header can't
+  // straddle two pages.
+  const size_t first_page = record_off / kCowPageSize;
+  const TraceBuffer* header_buf =
+      cow_pages_copied_[first_page] ? this : cow_source_;
+  const auto* record =
+      reinterpret_cast<const ChunkRecord*>(header_buf->begin() + record_off);
+  const size_t record_end = record_off + record->size;
+  PERFETTO_DCHECK(record_end <= used_size_);
+
+  // The packets of the chunk must be read from the same buffer. If only some
+  // of its pages have been copied, copy the others too.
+  size_t pages_copied = 0;
+  size_t num_pages = 0;
+  for (size_t page = first_page; page * kCowPageSize < record_end; page++) {
+    pages_copied += cow_pages_copied_[page];
+    num_pages++;
+  }
+  if (pages_copied == 0)
+    return cow_source_->begin() + record_off;
+  if (pages_copied < num_pages && CopyPagesFromSource(record_off, record->size))
+    DetachFromSource();
+  return begin() + record_off;
+}
+
+void TraceBuffer::CopyPagesIntoClones(const uint8_t* ptr, size_t size) {
+  const size_t offset = static_cast<size_t>(ptr - begin());
+  for (size_t i = 0; i < cow_clones_.size();) {
+    TraceBuffer* clone = cow_clones_[i];
+    if (clone->CopyPagesFromSource(offset, size)) {
+      clone->cow_source_ = nullptr;
+      cow_clones_.erase(cow_clones_.begin() + static_cast<ptrdiff_t>(i));
+    } else {
+      i++;
+    }
+  }
+}
+
+bool TraceBuffer::CopyPagesFromSource(size_t offset, size_t size) {
+  PERFETTO_DCHECK(cow_source_);
+  // The clone never reads past |used_size_|, what's there doesn't matter.
+  const size_t end_off = std::min(offset + size, used_size_);
+  for (size_t page = offset / kCowPageSize; page * kCowPageSize < end_off;
+       page++) {
+    if (cow_pages_copied_[page])
+      continue;
+    const size_t off = page * kCowPageSize;
+    const size_t page_size = std::min(kCowPageSize, used_size_ - off);
+    data_.EnsureCommitted(off + page_size);
+    memcpy(begin() + off, cow_source_->begin() + off, page_size);
+    cow_pages_copied_[page] = true;
+    cow_pages_shared_--;
+  }
+  return cow_pages_shared_ == 0;
+}
+
+void TraceBuffer::DetachFromSource() {
+  auto& clones = cow_source_->cow_clones_;
+  clones.erase(std::remove(clones.begin(), clones.end(), this), clones.end());
+  cow_source_ = nullptr;
+}
+
+void TraceBuffer::set_read_only() {
+  read_only_ = true;
+  for (const auto& shard : shards_)
+    shard->set_read_only();
+}
+
+size_t TraceBuffer::used_size() const {
+  size_t used_size = used_size_;
+  for (const auto& shard : shards_)
+    used_size += shard->used_size();
+  return used_size;
+}
+
+bool TraceBuffer::has_data() const {
+  return has_data_ ||
+         std::any_of(shards_.begin(), shards_.end(),
+                     [](const auto& shard) { return shard->has_data(); });
+}
+
+size_t TraceBuffer::ReadTracePackets(size_t max_bytes,
+                                     std::vector<ReadPacket>* packets) {
+  size_t bytes_read = 0;
+  while (bytes_read < max_bytes) {
+    packets->emplace_back();
+    ReadPacket& p = packets->back();
+    if (!ReadNextTracePacket(&p.packet, &p.sequence_properties,
+                             &p.previous_packet_on_sequence_dropped)) {
+      packets->pop_back();
+      break;
+    }
+    bytes_read += p.packet.size();
+  }
+  return bytes_read;
+}
+
+bool TraceBuffer::ReadNextTracePacketFromShards(
+    TracePacket* packet,
+    PacketSequenceProperties* sequence_properties,
+    bool* previous_packet_on_sequence_dropped) {
+  // Once a shard has no packets to read it won't have any more until the next
+  // BeginRead(), as no chunk can be written in between: drop it from the
+  // rotation so that each packet is read with a single call on a shard.
+  while (!readable_shards_.empty()) {
+    if (next_read_shard_ >= readable_shards_.size())
+      next_read_shard_ = 0;
+    TraceBuffer* shard = readable_shards_[next_read_shard_];
+    if (shard->ReadNextTracePacket(packet, sequence_properties,
+                                   previous_packet_on_sequence_dropped)) {
+      next_read_shard_++;
+      return true;
+    }
+    readable_shards_.erase(readable_shards_.begin() +
+                           static_cast<ptrdiff_t>(next_read_shard_));
+  }
+  return false;
+}
+
+const TraceStats::BufferStats& TraceBuffer::MergeShardStats() const {
+  merged_stats_ = TraceStats::BufferStats();
+  for (const auto& shard : shards_) {
+    const TraceStats::BufferStats& s = shard->stats();
+#define PERFETTO_TB_MERGE_STAT(name) \
+  merged_stats_.set_##name(merged_stats_.name() + s.name())
+    PERFETTO_TB_MERGE_STAT(buffer_size);
+    PERFETTO_TB_MERGE_STAT(bytes_written);
+    PERFETTO_TB_MERGE_STAT(bytes_overwritten);
+    PERFETTO_TB_MERGE_STAT(bytes_read);
+    PERFETTO_TB_MERGE_STAT(padding_bytes_written);
+    PERFETTO_TB_MERGE_STAT(padding_bytes_cleared);
+    PERFETTO_TB_MERGE_STAT(chunks_written);
+    PERFETTO_TB_MERGE_STAT(chunks_rewritten);
+    PERFETTO_TB_MERGE_STAT(chunks_overwritten);
+    PERFETTO_TB_MERGE_STAT(chunks_discarded);
+    PERFETTO_TB_MERGE_STAT(chunks_read);
+    PERFETTO_TB_MERGE_STAT(chunks_committed_out_of_order);
+    PERFETTO_TB_MERGE_STAT(write_wrap_count);
+    PERFETTO_TB_MERGE_STAT(patches_succeeded);
+    PERFETTO_TB_MERGE_STAT(patches_failed);
+    PERFETTO_TB_MERGE_STAT(readaheads_succeeded);
+    PERFETTO_TB_MERGE_STAT(readaheads_failed);
+    PERFETTO_TB_MERGE_STAT(abi_violations);
+    PERFETTO_TB_MERGE_STAT(trace_writer_packet_loss);
+#undef PERFETTO_TB_MERGE_STAT
+  }
+  return merged_stats_;
+}
+
+const TraceBuffer::WriterStatsMap& TraceBuffer::MergeShardWriterStats() const {
+  // The sequences of the shards are disjoint.
+  merged_writer_stats_.Clear();
+  for (const auto& shard : shards_) {
+    for (auto it = shard->writer_stats().GetIterator(); it; ++it)
+      merged_writer_stats_.Insert(it.key(), it.value());
+  }
+  return merged_writer_stats_;
+}
+
 }  // namespace perfetto
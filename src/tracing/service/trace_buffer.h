@@ -23,23 +23,27 @@
 #include <array>
 #include <limits>
 #include <map>
+#include <memory>
+#include <string>
 #include <tuple>
+#include <vector>
 
+#include "perfetto/base/build_config.h"
 #include "perfetto/base/logging.h"
 #include "perfetto/ext/base/flat_hash_map.h"
+#include "perfetto/ext/base/hash.h"
 #include "perfetto/ext/base/paged_memory.h"
 #include "perfetto/ext/base/thread_annotations.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/client_identity.h"
 #include "perfetto/ext/tracing/core/slice.h"
+#include "perfetto/ext/tracing/core/trace_packet.h"
 #include "perfetto/ext/tracing/core/trace_stats.h"
 #include "src/tracing/service/histogram.h"
 
 namespace perfetto {
 
-class TracePacket;
-
 // The main buffer, owned by the tracing service, where all the trace data is
 // ultimately stored into. The service will own several instances of this class,
 // at least one per active consumer (as defined in the |buffers| section of
@@ -141,6 +145,15 @@ class TracePacket;
 // (according to their ChunkID), but don't give any guarantee about the read
 // order of packets from different sequences, see comments in
 // ReadNextTracePacket() below.
+//
+// Sharding
+// --------
+// A buffer can be split into several shards (see Create()), each of them a
+// TraceBuffer of its own receiving the chunks of a subset of the producers (or
+// of the writers). All the chunks of a sequence go to the same shard, so each
+// shard keeps the guarantees above. A busy producer then only wraps over (or
+// fills, with kDiscard) its own shard, and each shard only indexes a fraction
+// of the chunks. Reads take one packet from each shard in turn.
 class TraceBuffer {
  public:
   static const size_t InlineChunkHeaderSize;  // For test/fake_packet.{cc,h}.
@@ -148,6 +161,16 @@ class TraceBuffer {
   // See comment in the header above.
   enum OverwritePolicy { kOverwrite, kDiscard };
 
+  // How the chunks are distributed among the shards of a sharded buffer.
+  enum ShardingPolicy { kShardByProducer, kShardByWriter };
+
+  // Shards are never smaller than this: smaller shards would wrap over too
+  // often and, below the size of a chunk, not even fit a single one.
+  static constexpr size_t kMinShardSize = 256 * 1024;
+
+  // Buffers at least this large ask for transparent huge pages.
+  static constexpr size_t kHugePagesMinBufferSize = 16 * 1024 * 1024;
+
   // Argument for out-of-band patches applied through TryPatchChunkContents().
   struct Patch {
     // From SharedMemoryABI::kPacketHeaderSize.
@@ -167,6 +190,14 @@ class TraceBuffer {
     pid_t producer_pid_trusted() const { return client_identity_trusted.pid(); }
   };
 
+  // A packet returned by ReadTracePackets(), with the same information
+  // ReadNextTracePacket() returns.
+  struct ReadPacket {
+    TracePacket packet;
+    PacketSequenceProperties sequence_properties{};
+    bool previous_packet_on_sequence_dropped = false;
+  };
+
   // Holds the "used chunk" stats for each <Producer, Writer> tuple.
   struct WriterStats {
     Histogram<8, 32, 128, 512, 1024, 2048, 4096, 8192, 12288, 16384>
@@ -179,9 +210,59 @@ class TraceBuffer {
                                            base::QuadraticProbe,
                                            /*AppendOnly=*/true>;
 
+  // Priority and bandwidth quota of a producer within the buffer (see
+  // BufferConfig.producer_quotas).
+  struct ProducerQuota {
+    // The chunks of a producer never overwrite the unread chunks of producers
+    // with a higher priority: they are dropped instead. Producers without a
+    // quota have priority 0. Only applies to kOverwrite buffers.
+    uint32_t priority = 0;
+
+    // If not zero, the chunks written beyond this rate are dropped. Bursts of
+    // up to one second worth of data are allowed.
+    uint64_t max_bytes_per_sec = 0;
+  };
+
+  // Per-producer stats, only kept for the buffers with producer quotas.
+  struct ProducerQuotaStats {
+    uint64_t bytes_written = 0;
+    uint64_t chunks_dropped_over_quota = 0;
+    uint64_t chunks_dropped_for_priority = 0;
+  };
+
+  struct ProducerQuotaState {
+    std::string producer_name;
+    ProducerQuota quota;
+    ProducerQuotaStats stats;
+
+    // Token bucket enforcing |quota.max_bytes_per_sec|.
+    double tokens = 0;
+    int64_t last_refill_ns = 0;
+  };
+
+  using ProducerQuotaMap = base::FlatHashMap<ProducerID, ProducerQuotaState>;
+
   // Can return nullptr if the memory allocation fails.
-  static std::unique_ptr<TraceBuffer> Create(size_t size_in_bytes,
-                                             OverwritePolicy = kOverwrite);
+  // If |num_shards| is greater than one, the buffer is split into (up to, see
+  // kMinShardSize) that many shards of equal size. See "Sharding" above.
+  static std::unique_ptr<TraceBuffer> Create(
+      size_t size_in_bytes,
+      OverwritePolicy = kOverwrite,
+      size_t num_shards = 1,
+      ShardingPolicy = kShardByProducer);
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  // Like Create(), for a buffer that is not sharded, but the memory of the
+  // buffer is a shared mapping of the file |fd| (which is truncated, see
+  // base::PagedMemory::AllocateFileBacked()). The page cache then decides
+  // which pages of the buffer are resident, which allows buffers much larger
+  // than the memory the service could otherwise afford. Clones of the buffer
+  // use anonymous memory.
+  static std::unique_ptr<TraceBuffer> CreateFileBacked(
+      int fd,
+      size_t size_in_bytes,
+      OverwritePolicy = kOverwrite);
+#endif
 
   ~TraceBuffer();
 
@@ -279,19 +360,57 @@ class TraceBuffer {
                            PacketSequenceProperties* sequence_properties,
                            bool* previous_packet_on_sequence_dropped);
 
+  // Batched version of ReadNextTracePacket(): reads packets, in the same order,
+  // and appends them to |packets| until there are no complete packets left or
+  // the size of the packets read reaches |max_bytes|. As with
+  // ReadNextTracePacket(), the slices of the packets point into the buffer and
+  // are valid only until the next call that alters it. Returns the size of the
+  // packets read: a value lower than |max_bytes| means that the buffer has no
+  // more packets to read.
+  size_t ReadTracePackets(size_t max_bytes, std::vector<ReadPacket>* packets);
+
   // Creates a read-only clone of the trace buffer. The read iterators of the
   // new buffer will be reset, as if no Read() had been called. Calls to
   // CopyChunkUntrusted() and TryPatchChunkContents() on the returned cloned
   // TraceBuffer will CHECK().
+  //
+  // The clone doesn't copy the contents of the buffer: it shares its pages
+  // with this buffer, which copies them into the clone (copy-on-write) only
+  // before overwriting them. Hence cloning costs O(index) rather than
+  // O(buffer size). The packets read from a clone may point into this buffer
+  // and, as usual, are valid only until the next call that writes into it.
   std::unique_ptr<TraceBuffer> CloneReadOnly() const;
 
-  void set_read_only() { read_only_ = true; }
-  const WriterStatsMap& writer_stats() const { return writer_stats_; }
-  const TraceStats::BufferStats& stats() const { return stats_; }
+  // Sets the priority and quota of the chunks of |producer_id|. The first call
+  // also starts keeping per-producer stats, for all the producers. Can be
+  // called again for the same producer: its stats are kept, as well as its
+  // unused quota if the rate didn't change.
+  void SetProducerQuota(ProducerID producer_id,
+                        const std::string& producer_name,
+                        const ProducerQuota&);
+
+  // Copies the quotas set with SetProducerQuota() on |other|, but not their
+  // stats. Used when a buffer is recreated.
+  void CopyProducerQuotasFrom(const TraceBuffer& other);
+
+  // Null if no quota was ever set.
+  const ProducerQuotaMap* producer_quotas() const { return producer_quotas_; }
+
+  void set_read_only();
+  const WriterStatsMap& writer_stats() const {
+    return shards_.empty() ? writer_stats_ : MergeShardWriterStats();
+  }
+  const TraceStats::BufferStats& stats() const {
+    return shards_.empty() ? stats_ : MergeShardStats();
+  }
   size_t size() const { return size_; }
-  size_t used_size() const { return used_size_; }
+  size_t used_size() const;
   OverwritePolicy overwrite_policy() const { return overwrite_policy_; }
-  bool has_data() const { return has_data_; }
+  bool has_data() const;
+  // 1 for a buffer which is not sharded.
+  size_t num_shards() const { return shards_.empty() ? 1 : shards_.size(); }
+  ShardingPolicy sharding_policy() const { return sharding_policy_; }
+  bool file_backed() const { return file_backed_; }
 
  private:
   friend class TraceBufferTest;
@@ -550,7 +669,9 @@ class TraceBuffer {
   struct CloneCtor {};
   TraceBuffer(CloneCtor, const TraceBuffer&);
 
-  bool Initialize(size_t size);
+  // |backing_fd| is the file backing the memory of the buffer, or -1 for
+  // anonymous memory.
+  bool Initialize(size_t size, int backing_fd = -1);
 
   // Returns an object that allows to iterate over chunks in the |index_| that
   // have the same {ProducerID, WriterID} of
@@ -585,6 +706,9 @@ class TraceBuffer {
   //   * -1 if the buffer |overwrite_policy_| == kDiscard and the deletion would
   //     cause unread chunks to be overwritten. In this case the buffer is left
   //     untouched.
+  //   * -2 if the deletion would cause unread chunks of a producer with a
+  //     higher priority than |writer_priority| to be overwritten (see
+  //     ProducerQuota). In this case the buffer is left untouched too.
   // Graphically, assume the initial situation is the following (|wptr_| = 10).
   // |0        |10 (wptr_)       |30       |40                 |60
   // +---------+-----------------+---------+-------------------+---------+
@@ -594,7 +718,8 @@ class TraceBuffer {
   //
   // A call to DeleteNextChunksFor(32) will remove chunks 2,3,4 and return 18
   // (60 - 42), the distance between chunk 5 and the end of the deletion range.
-  ssize_t DeleteNextChunksFor(size_t bytes_to_clear);
+  ssize_t DeleteNextChunksFor(size_t bytes_to_clear,
+                              uint32_t writer_priority = 0);
 
   // Decodes the boundaries of the next packet (or a fragment) pointed by
   // ChunkMeta and pushes that into |TracePacket|. It also increments the
@@ -606,12 +731,57 @@ class TraceBuffer {
                                          ChunkMeta*,
                                          TracePacket*);
 
+  // Returns a pointer to the ChunkRecord at |record_off|, for reading. This is
+  // begin() + |record_off| except for clones, whose pages might still be shared
+  // with the source buffer.
+  const uint8_t* GetChunkRecordForRead(uint32_t record_off) {
+    if (PERFETTO_LIKELY(!cow_source_))
+      return begin() + record_off;
+    return GetSharedChunkRecordForRead(record_off);
+  }
+  const uint8_t* GetSharedChunkRecordForRead(uint32_t record_off);
+
+  // Must be called before writing [ptr, ptr + size) into the buffer: copies
+  // the pages in the range which are still shared with a clone into it.
+  void PrepareWrite(const uint8_t* ptr, size_t size) {
+    if (PERFETTO_UNLIKELY(!cow_clones_.empty()))
+      CopyPagesIntoClones(ptr, size);
+  }
+  void CopyPagesIntoClones(const uint8_t* ptr, size_t size);
+
+  // Clones only: copies the pages in [offset, offset + size) which are still
+  // shared with |cow_source_| into the clone. Returns true if the clone shares
+  // no more pages, at which point it can be detached from |cow_source_|.
+  bool CopyPagesFromSource(size_t offset, size_t size);
+  void DetachFromSource();
+
   void DcheckIsAlignedAndWithinBounds(const uint8_t* ptr) const {
     PERFETTO_DCHECK(ptr >= begin() && ptr <= end() - sizeof(ChunkRecord));
     PERFETTO_DCHECK(
         (reinterpret_cast<uintptr_t>(ptr) & (alignof(ChunkRecord) - 1)) == 0);
   }
 
+  // Sharded buffers only: the shard receiving the chunks of the sequence.
+  TraceBuffer* GetShardFor(ProducerID producer_id, WriterID writer_id) {
+    uint64_t shard = sharding_policy_ == kShardByProducer
+                         ? producer_id
+                         : base::Hasher::Combine(producer_id, writer_id);
+    return shards_[shard % shards_.size()].get();
+  }
+  // Returns false if |record_size| bytes are over the quota of the producer.
+  bool ConsumeProducerQuota(ProducerQuotaState*, size_t record_size);
+  void DropWriteForPriority(ProducerQuotaState*, size_t record_size);
+  uint32_t GetProducerPriority(ProducerID producer_id) const {
+    const ProducerQuotaState* state = producer_quotas_->Find(producer_id);
+    return state ? state->quota.priority : 0;
+  }
+
+  bool ReadNextTracePacketFromShards(TracePacket*,
+                                     PacketSequenceProperties*,
+                                     bool* previous_packet_on_sequence_dropped);
+  const TraceStats::BufferStats& MergeShardStats() const;
+  const WriterStatsMap& MergeShardWriterStats() const;
+
   ChunkRecord* GetChunkRecordAt(uint8_t* ptr) {
     DcheckIsAlignedAndWithinBounds(ptr);
     // We may be accessing a new (empty) record.
@@ -646,6 +816,7 @@ class TraceBuffer {
 
     // We may be writing to this area for the first time.
     EnsureCommitted(static_cast<size_t>(wptr + record.size - begin()));
+    PrepareWrite(wptr, record.size);
 
     // Deliberately not a *D*CHECK.
     PERFETTO_CHECK(wptr + sizeof(record) + size <= end());
@@ -725,6 +896,9 @@ class TraceBuffer {
   // Per-{Producer, Writer} statistics.
   WriterStatsMap writer_stats_;
 
+  // True if |data_| is a mapping of a file, see CreateFileBacked().
+  bool file_backed_ = false;
+
   // Set to true upon the very first call to CopyChunkUntrusted() and never
   // cleared. This is used to tell if the buffer has never been used since its
   // creation (which in turn is used to optimize `clear_before_clone`).
@@ -738,6 +912,39 @@ class TraceBuffer {
   // bugs in the producers. This is for tests that feed malicious inputs and
   // hence mimic a buggy producer.
   bool suppress_client_dchecks_for_testing_ = false;
+
+  // Only for sharded buffers, which hold no data of their own: all the calls
+  // are forwarded to the shards.
+  std::vector<std::unique_ptr<TraceBuffer>> shards_;
+  ShardingPolicy sharding_policy_ = kShardByProducer;
+
+  // The shards which may still have packets to read since BeginRead(), and
+  // the index (in this vector) of the one to read the next packet from.
+  std::vector<TraceBuffer*> readable_shards_;
+  size_t next_read_shard_ = 0;
+
+  // The stats of the shards, merged on demand by stats() and writer_stats().
+  mutable TraceStats::BufferStats merged_stats_;
+  mutable WriterStatsMap merged_writer_stats_;
+
+  // The producer quotas of the buffer, if any. Points to
+  // |producer_quotas_storage_|, or for shards to the storage of the sharded
+  // buffer: quotas and stats are per buffer, not per shard.
+  ProducerQuotaMap* producer_quotas_ = nullptr;
+  ProducerQuotaMap producer_quotas_storage_;
+
+  // Copy-on-write clones. The pages of a clone are shared with the buffer it
+  // was cloned from (|cow_source_|) until the latter writes into them. Each
+  // buffer keeps track of the clones sharing its pages in |cow_clones_| and
+  // copies the pages into them before writing, see PrepareWrite(). Once all
+  // its pages have been copied, a clone is detached from its source.
+  static constexpr size_t kCowPageSize = 4096;
+  const TraceBuffer* cow_source_ = nullptr;
+  // Clones only: one entry per page of |data_| up to |used_size_|, true if
+  // the page has been copied into |data_|.
+  std::vector<bool> cow_pages_copied_;
+  size_t cow_pages_shared_ = 0;  // Number of false entries in the above.
+  mutable std::vector<TraceBuffer*> cow_clones_;
 };
 
 }  // namespace perfetto
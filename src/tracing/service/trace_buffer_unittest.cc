@@ -21,6 +21,8 @@
 #include <sstream>
 #include <vector>
 
+#include "perfetto/base/build_config.h"
+#include "perfetto/ext/base/temp_file.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/client_identity.h"
@@ -32,6 +34,10 @@
 #include "src/tracing/test/fake_packet.h"
 #include "test/gtest_and_gmock.h"
 
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <sys/stat.h>
+#endif
+
 namespace perfetto {
 
 using ::testing::ContainerEq;
@@ -185,6 +191,40 @@ TEST_F(TraceBufferTest, ReadWrite_EmptyBuffer) {
   ASSERT_THAT(ReadPacket(), IsEmpty());
 }
 
+TEST_F(TraceBufferTest, ReadWrite_Batch) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(32, 'a')
+      .AddPacket(32, 'b')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(32, 'c')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+
+  // Stops as soon as |max_bytes| are read. The size of the packets excludes
+  // their 1 byte size header.
+  std::vector<TraceBuffer::ReadPacket> packets;
+  ASSERT_EQ(trace_buffer()->ReadTracePackets(40, &packets), 62u);
+  ASSERT_EQ(packets.size(), 2u);
+  const Slice& a = packets[0].packet.slices()[0];
+  const Slice& b = packets[1].packet.slices()[0];
+  ASSERT_EQ(FakePacketFragment(a.start, a.size), FakePacketFragment(32, 'a'));
+  ASSERT_EQ(FakePacketFragment(b.start, b.size), FakePacketFragment(32, 'b'));
+  ASSERT_EQ(packets[1].sequence_properties.producer_id_trusted, 1);
+  ASSERT_FALSE(packets[1].previous_packet_on_sequence_dropped);
+
+  // Appends the remaining packets.
+  ASSERT_EQ(trace_buffer()->ReadTracePackets(1024, &packets), 31u);
+  ASSERT_EQ(packets.size(), 3u);
+  const Slice& c = packets[2].packet.slices()[0];
+  ASSERT_EQ(FakePacketFragment(c.start, c.size), FakePacketFragment(32, 'c'));
+  ASSERT_EQ(packets[2].sequence_properties.producer_id_trusted, 2);
+
+  ASSERT_EQ(trace_buffer()->ReadTracePackets(1024, &packets), 0u);
+  ASSERT_EQ(packets.size(), 3u);
+}
+
 // On each iteration writes a fixed-size chunk and reads it back.
 TEST_F(TraceBufferTest, ReadWrite_Simple) {
   ResetBuffer(64 * 1024);
@@ -2037,9 +2077,298 @@ TEST_F(TraceBufferTest, Clone_CommitOnlyUsedSize) {
   if (!is_only_first_page_mapped(*trace_buffer()))
     GTEST_SKIP() << "VM commit detection not supported";
 
+  // The clone shares the pages of the buffer: it doesn't need any of its own
+  // until they are overwritten.
   std::unique_ptr<TraceBuffer> snap = trace_buffer()->CloneReadOnly();
   ASSERT_EQ(snap->used_size(), trace_buffer()->used_size());
+  ASSERT_FALSE(IsMapped(GetBufData(*snap), page_size * kPages));
+
+  CreateChunk(ProducerID(1), WriterID(0), ChunkID(1))
+      .AddPacket(1024, static_cast<char>('a'))
+      .CopyIntoTraceBuffer();
   ASSERT_TRUE(is_only_first_page_mapped(*snap));
 }
 
+TEST_F(TraceBufferTest, Clone_CopyOnWrite) {
+  ResetBuffer(4096 * 4);
+  const size_t kFrgSize = 4096 - 32;  // One chunk per page.
+  for (WriterID i = 0; i < 4; i++) {
+    CreateChunk(ProducerID(1), WriterID(i), ChunkID(0))
+        .AddPacket(kFrgSize, static_cast<char>('a' + i))
+        .CopyIntoTraceBuffer();
+  }
+  std::unique_ptr<TraceBuffer> snap = trace_buffer()->CloneReadOnly();
+
+  // Overwrite the first two pages of the buffer. The clone is not affected.
+  for (WriterID i = 4; i < 6; i++) {
+    CreateChunk(ProducerID(1), WriterID(i), ChunkID(0))
+        .AddPacket(kFrgSize, static_cast<char>('a' + i))
+        .CopyIntoTraceBuffer();
+  }
+  snap->BeginRead();
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(kFrgSize, 'a')));
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(kFrgSize, 'b')));
+
+  // Nor is a clone of the clone, when the buffer is destroyed.
+  std::unique_ptr<TraceBuffer> snap2 = snap->CloneReadOnly();
+  ResetBuffer(4096);
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(kFrgSize, 'c')));
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(kFrgSize, 'd')));
+  ASSERT_THAT(ReadPacket(snap), IsEmpty());
+  snap.reset();
+  snap2->BeginRead();
+  for (char c = 'a'; c <= 'd'; c++) {
+    ASSERT_THAT(ReadPacket(snap2),
+                ElementsAre(FakePacketFragment(kFrgSize, c)));
+  }
+  ASSERT_THAT(ReadPacket(snap2), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Clone_CopyOnWriteWithPatches) {
+  ResetBuffer(4096);
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(9, 'a')
+      .ClearBytes(5, 4)  // 5 := 4th payload byte. Byte 0 is the varint header.
+      .CopyIntoTraceBuffer();
+  std::unique_ptr<TraceBuffer> snap = trace_buffer()->CloneReadOnly();
+  ASSERT_TRUE(TryPatchChunkContents(ProducerID(1), WriterID(1), ChunkID(0),
+                                    {{5, {{'Y', 'M', 'C', 'A'}}}}));
+
+  snap->BeginRead();
+  ASSERT_THAT(ReadPacket(snap),
+              ElementsAre(FakePacketFragment("a00-\0\0\0\0", 8)));
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment("a00-YMCA", 8)));
+}
+
+TEST_F(TraceBufferTest, Sharding_SmallBufferIsNotSharded) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/4);
+  ASSERT_EQ(buf->num_shards(), 2u);
+  ASSERT_EQ(buf->size(), TraceBuffer::kMinShardSize * 2);
+  buf = TraceBuffer::Create(4096, TraceBuffer::kOverwrite, /*num_shards=*/4);
+  ASSERT_EQ(buf->num_shards(), 1u);
+}
+
+TEST_F(TraceBufferTest, Sharding_ProducersAreIsolated) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/2);
+  ASSERT_EQ(buf->num_shards(), 2u);
+  FakeChunk(buf.get(), ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(32, 'b')
+      .CopyIntoTraceBuffer();
+
+  // Producer 1 wraps its own shard several times over, without overwriting
+  // the data of producer 2.
+  for (ChunkID c = 0; c < 256; c++) {
+    FakeChunk(buf.get(), ProducerID(1), WriterID(1), c)
+        .AddPacket(4000, static_cast<char>('a' + c % 2))
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_GT(buf->stats().chunks_overwritten(), 0u);
+
+  buf->BeginRead();
+  std::vector<std::vector<FakePacketFragment>> packets;
+  for (auto packet = ReadPacket(buf); !packet.empty(); packet = ReadPacket(buf))
+    packets.emplace_back(std::move(packet));
+  ASSERT_THAT(packets, testing::Contains(
+                           ElementsAre(FakePacketFragment(32, 'b'))));
+}
+
+TEST_F(TraceBufferTest, Sharding_RoundRobinRead) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/2);
+  for (ChunkID c = 0; c < 3; c++) {
+    FakeChunk(buf.get(), ProducerID(1), WriterID(1), c)
+        .AddPacket(10, static_cast<char>('a' + c))
+        .CopyIntoTraceBuffer();
+  }
+  FakeChunk(buf.get(), ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'x')
+      .CopyIntoTraceBuffer();
+
+  // Shard 0 holds producer 2 and shard 1 holds producer 1.
+  buf->BeginRead();
+  ASSERT_THAT(ReadPacket(buf), ElementsAre(FakePacketFragment(10, 'x')));
+  ASSERT_THAT(ReadPacket(buf), ElementsAre(FakePacketFragment(10, 'a')));
+  ASSERT_THAT(ReadPacket(buf), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(buf), ElementsAre(FakePacketFragment(10, 'c')));
+  ASSERT_THAT(ReadPacket(buf), IsEmpty());
+}
+
+TEST_F(TraceBufferTest, Sharding_ByWriter) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 4,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/4,
+                                 TraceBuffer::kShardByWriter);
+  ASSERT_EQ(buf->sharding_policy(), TraceBuffer::kShardByWriter);
+  for (WriterID w = 1; w <= 8; w++) {
+    FakeChunk(buf.get(), ProducerID(1), w, ChunkID(0))
+        .AddPacket(10, static_cast<char>('a' + w))
+        .CopyIntoTraceBuffer();
+  }
+  buf->BeginRead();
+  size_t num_packets = 0;
+  while (!ReadPacket(buf).empty())
+    num_packets++;
+  ASSERT_EQ(num_packets, 8u);
+}
+
+TEST_F(TraceBufferTest, Sharding_CloneAndStats) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/2);
+  FakeChunk(buf.get(), ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'a')
+      .CopyIntoTraceBuffer();
+  FakeChunk(buf.get(), ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(10, 'b')
+      .CopyIntoTraceBuffer();
+  ASSERT_TRUE(buf->has_data());
+  ASSERT_EQ(buf->stats().chunks_written(), 2u);
+  ASSERT_EQ(buf->stats().buffer_size(), buf->size());
+
+  std::unique_ptr<TraceBuffer> snap = buf->CloneReadOnly();
+  ASSERT_EQ(snap->num_shards(), 2u);
+  ASSERT_EQ(snap->used_size(), buf->used_size());
+  snap->BeginRead();
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(10, 'b')));
+  ASSERT_THAT(ReadPacket(snap), ElementsAre(FakePacketFragment(10, 'a')));
+  ASSERT_THAT(ReadPacket(snap), IsEmpty());
+  ASSERT_EQ(snap->stats().chunks_read(), 2u);
+  ASSERT_EQ(snap->writer_stats().size(), 2u);
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_Priority) {
+  ResetBuffer(4096);
+  trace_buffer()->SetProducerQuota(ProducerID(1), "high",
+                                   {/*priority=*/1, /*max_bytes_per_sec=*/0});
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'a')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(2048 - 16, 'b')
+      .CopyIntoTraceBuffer();
+
+  // Producer 2 can't overwrite the unread chunks of producer 1, while
+  // producer 1 can overwrite its own.
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'x')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(2))
+      .AddPacket(2048 - 16, 'c')
+      .CopyIntoTraceBuffer();
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'c')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  // Once read, they can be overwritten by anyone.
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(1))
+      .AddPacket(2048 - 16, 'y')
+      .CopyIntoTraceBuffer();
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'y')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  const auto* quotas = trace_buffer()->producer_quotas();
+  ASSERT_EQ(quotas->size(), 2u);
+  ASSERT_EQ(quotas->Find(ProducerID(1))->producer_name, "high");
+  ASSERT_EQ(quotas->Find(ProducerID(1))->stats.bytes_written, 3 * 2048u);
+  ASSERT_EQ(quotas->Find(ProducerID(2))->stats.bytes_written, 2048u);
+  ASSERT_EQ(quotas->Find(ProducerID(2))->stats.chunks_dropped_for_priority,
+            1u);
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_Rate) {
+  ResetBuffer(4096 * 4);
+  // Refilling the quota for a chunk takes half a second: much longer than the
+  // test.
+  trace_buffer()->SetProducerQuota(ProducerID(1), "chatty",
+                                   {/*priority=*/0, /*max_bytes_per_sec=*/4096});
+  for (ChunkID c = 0; c < 4; c++) {
+    CreateChunk(ProducerID(1), WriterID(1), c)
+        .AddPacket(2048 - 16, static_cast<char>('a' + c))
+        .CopyIntoTraceBuffer();
+  }
+  // Rewriting a chunk already in the buffer doesn't count.
+  CreateChunk(ProducerID(1), WriterID(1), ChunkID(1))
+      .AddPacket(1024 - 16, 'b')
+      .AddPacket(1024, 'b')
+      .CopyIntoTraceBuffer();
+  CreateChunk(ProducerID(2), WriterID(1), ChunkID(0))
+      .AddPacket(2048 - 16, 'x')
+      .CopyIntoTraceBuffer();
+
+  trace_buffer()->BeginRead();
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'a')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(1024 - 16, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(1024, 'b')));
+  ASSERT_THAT(ReadPacket(), ElementsAre(FakePacketFragment(2048 - 16, 'x')));
+  ASSERT_THAT(ReadPacket(), IsEmpty());
+
+  const auto* stats = &trace_buffer()->producer_quotas()->Find(1)->stats;
+  ASSERT_EQ(stats->bytes_written, 2 * 2048u);
+  ASSERT_EQ(stats->chunks_dropped_over_quota, 2u);
+}
+
+TEST_F(TraceBufferTest, ProducerQuota_ShardedBuffer) {
+  auto buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2,
+                                 TraceBuffer::kOverwrite, /*num_shards=*/2,
+                                 TraceBuffer::kShardByWriter);
+  buf->SetProducerQuota(ProducerID(1), "chatty",
+                        {/*priority=*/0, /*max_bytes_per_sec=*/4096});
+
+  // The quota is shared by the writers of the producer in all the shards.
+  for (WriterID w = 1; w <= 4; w++) {
+    FakeChunk(buf.get(), ProducerID(1), w, ChunkID(0))
+        .AddPacket(2048 - 16, 'a')
+        .CopyIntoTraceBuffer();
+  }
+  ASSERT_EQ(buf->stats().chunks_written(), 2u);
+
+  std::unique_ptr<TraceBuffer> snap = buf->CloneReadOnly();
+  const auto* stats = &snap->producer_quotas()->Find(1)->stats;
+  ASSERT_EQ(stats->bytes_written, 2 * 2048u);
+  ASSERT_EQ(stats->chunks_dropped_over_quota, 2u);
+
+  // The quotas, but not the stats, survive recreating the buffer.
+  auto new_buf = TraceBuffer::Create(TraceBuffer::kMinShardSize * 2);
+  new_buf->CopyProducerQuotasFrom(*buf);
+  const auto* state = new_buf->producer_quotas()->Find(1);
+  ASSERT_EQ(state->quota.max_bytes_per_sec, 4096u);
+  ASSERT_EQ(state->stats.bytes_written, 0u);
+}
+
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+TEST_F(TraceBufferTest, FileBacked) {
+  base::TempFile file = base::TempFile::CreateUnlinked();
+  auto buf = TraceBuffer::CreateFileBacked(file.fd(), 4096);
+  ASSERT_TRUE(buf);
+  ASSERT_TRUE(buf->file_backed());
+
+  // Wrap over the buffer a few times.
+  for (ChunkID c = 0; c < 8; c++) {
+    FakeChunk(buf.get(), ProducerID(1), WriterID(1), c)
+        .AddPacket(1024 - 16, static_cast<char>('a' + c))
+        .CopyIntoTraceBuffer();
+  }
+  std::unique_ptr<TraceBuffer> snap = buf->CloneReadOnly();
+  ASSERT_FALSE(snap->file_backed());
+
+  for (const auto* b : {&buf, &snap}) {
+    (*b)->BeginRead();
+    for (char c = 'e'; c <= 'h'; c++) {
+      ASSERT_THAT(ReadPacket(*b),
+                  ElementsAre(FakePacketFragment(1024 - 16, c)));
+    }
+    ASSERT_THAT(ReadPacket(*b), IsEmpty());
+  }
+
+  // The chunks are in the file.
+  struct stat st {};
+  ASSERT_EQ(fstat(file.fd(), &st), 0);
+  ASSERT_EQ(st.st_size, 4096);
+}
+#endif
+
 }  // namespace perfetto
@@ -31,6 +31,7 @@
 
 #if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
     !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+#include <stdlib.h>
 #include <sys/uio.h>
 #include <sys/utsname.h>
 #include <unistd.h>
@@ -60,9 +61,12 @@
 #include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/string_view.h"
 #include "perfetto/ext/base/sys_types.h"
+#include "perfetto/ext/base/temp_file.h"
+#include "perfetto/ext/base/thread_task_runner.h"
 #include "perfetto/ext/base/utils.h"
 #include "perfetto/ext/base/uuid.h"
 #include "perfetto/ext/base/version.h"
+#include "perfetto/ext/base/waitable_event.h"
 #include "perfetto/ext/base/watchdog.h"
 #include "perfetto/ext/tracing/core/basic_types.h"
 #include "perfetto/ext/tracing/core/consumer.h"
@@ -124,6 +128,48 @@ constexpr uint32_t kMaxTracingDurationMillis = 7 * 24 * kMillisPerHour;
 constexpr uint32_t kGuardrailsMaxTracingBufferSizeKb = 128 * 1024;
 constexpr uint32_t kGuardrailsMaxTracingDurationMillis = 24 * kMillisPerHour;
 
+// Appends |hist| to |out| (a TraceStats or a TracingServiceState message) as
+// the LatencyHistogram |name|. Returns nullptr, and skips it, if empty.
+template <typename H, typename P>
+auto* AddLatencyHistogram(const H& hist, const char* name, P* out) {
+  uint64_t total_count = 0;
+  for (size_t i = 0; i < hist.num_buckets(); ++i)
+    total_count += hist.GetBucketCount(i);
+  if (total_count == 0)
+    return static_cast<decltype(out->add_latency_histograms())>(nullptr);
+  auto* out_hist = out->add_latency_histograms();
+  out_hist->set_name(name);
+  for (size_t i = 0; i < hist.num_buckets(); ++i) {
+    out_hist->add_counts(hist.GetBucketCount(i));
+    out_hist->add_sums_ns(hist.GetBucketSum(i));
+  }
+  return out_hist;
+}
+
+// Creates the buffer of a BufferConfig with |file_backed| set, see
+// TraceBuffer::CreateFileBacked(). The backing file is created in the temp
+// directory and unlinked straight away. Falls back on anonymous memory if the
+// file can't be created or mapped.
+std::unique_ptr<TraceBuffer> CreateFileBackedTraceBuffer(
+    size_t size,
+    TraceBuffer::OverwritePolicy policy) {
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) && \
+    !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  std::string path = base::GetSysTempDir() + "/perfetto-buffer-XXXXXX";
+  base::ScopedFile fd(mkstemp(&path[0]));
+  if (fd) {
+    unlink(path.c_str());
+    std::unique_ptr<TraceBuffer> buf =
+        TraceBuffer::CreateFileBacked(*fd, size, policy);
+    if (buf)
+      return buf;
+  }
+  PERFETTO_ELOG("Could not back the trace buffer with %s, using memory",
+                path.c_str());
+#endif
+  return TraceBuffer::Create(size, policy);
+}
+
 #if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN) || PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
 struct iovec {
   void* iov_base;  // Address
@@ -268,6 +314,25 @@ base::ScopedFile CreateTraceFile(const std::string& path, bool overwrite) {
   return fd;
 }
 
+// Packets read from the trace buffers point into their memory, which is
+// recycled as soon as producers commit new chunks. Copies each packet into a
+// slice it owns, so that |packets| can be handed off to another thread.
+void CopyPacketsIntoOwnedSlices(std::vector<TracePacket>* packets) {
+  for (TracePacket& packet : *packets) {
+    Slice slice = Slice::Allocate(packet.size());
+    uint8_t* dst = slice.own_data();
+    for (const Slice& src : packet.slices()) {
+      memcpy(dst, src.start, src.size);
+      dst += src.size;
+    }
+    TracePacket owned;
+    owned.AddSlice(std::move(slice));
+    if (packet.buffer_index_for_stats())
+      owned.set_buffer_index_for_stats(*packet.buffer_index_for_stats());
+    packet = std::move(owned);
+  }
+}
+
 bool ShouldLogEvent(const TraceConfig& cfg) {
   switch (cfg.statsd_logging()) {
     case TraceConfig::STATSD_LOGGING_ENABLED:
@@ -348,6 +413,12 @@ TracingServiceImpl::TracingServiceImpl(
           static_cast<uint32_t>(base::GetWallTimeNs().count())),
       weak_ptr_factory_(this) {
   PERFETTO_DCHECK(task_runner_);
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+  if (init_opts_.zstd_compressor_fn) {
+    compression_task_runner_ = std::make_unique<base::ThreadTaskRunner>(
+        base::ThreadTaskRunner::CreateAndStart("TracingSvcZstd"));
+  }
+#endif
 }
 
 TracingServiceImpl::~TracingServiceImpl() {
@@ -918,7 +989,15 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
                                 cfg.output_path().c_str());
       }
     }
-    tracing_session->write_into_file = std::move(fd);
+    tracing_session->write_into_file =
+        std::make_shared<OutputFile>(std::move(fd));
+#if !PERFETTO_BUILDFLAG(PERFETTO_OS_NACL)
+    if (init_opts_.write_into_file_on_dedicated_thread &&
+        !file_writer_task_runner_) {
+      file_writer_task_runner_ = std::make_unique<base::ThreadTaskRunner>(
+          base::ThreadTaskRunner::CreateAndStart("TracingSvcFile"));
+    }
+#endif
     uint32_t write_period_ms = cfg.file_write_period_ms();
     if (write_period_ms == 0)
       write_period_ms = kDefaultWriteIntoFilePeriodMs;
@@ -937,6 +1016,14 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
           "COMPRESSION_TYPE_DEFLATE is not supported in the current build "
           "configuration. Skipping compression");
     }
+  } else if (cfg.compression_type() == TraceConfig::COMPRESSION_TYPE_ZSTD) {
+    if (init_opts_.zstd_compressor_fn) {
+      tracing_session->compress_zstd = true;
+    } else {
+      PERFETTO_LOG(
+          "COMPRESSION_TYPE_ZSTD is not supported in the current build "
+          "configuration. Skipping compression");
+    }
   }
 
   // Initialize the log buffers.
@@ -974,8 +1061,16 @@ base::Status TracingServiceImpl::EnableTracing(ConsumerEndpointImpl* consumer,
         buffer_cfg.fill_policy() == TraceConfig::BufferConfig::DISCARD
             ? TraceBuffer::kDiscard
             : TraceBuffer::kOverwrite;
-    auto it_and_inserted =
-        buffers_.emplace(global_id, TraceBuffer::Create(buf_size, policy));
+    TraceBuffer::ShardingPolicy sharding =
+        buffer_cfg.shard_by() == TraceConfig::BufferConfig::SHARD_BY_WRITER
+            ? TraceBuffer::kShardByWriter
+            : TraceBuffer::kShardByProducer;
+    const size_t num_shards = std::max<size_t>(buffer_cfg.num_shards(), 1);
+    auto it_and_inserted = buffers_.emplace(
+        global_id,
+        buffer_cfg.file_backed()
+            ? CreateFileBackedTraceBuffer(buf_size, policy)
+            : TraceBuffer::Create(buf_size, policy, num_shards, sharding));
     PERFETTO_DCHECK(it_and_inserted.second);  // buffers_.count(global_id) == 0.
     std::unique_ptr<TraceBuffer>& trace_buffer = it_and_inserted.first->second;
     if (!trace_buffer) {
@@ -1282,14 +1377,8 @@ base::Status TracingServiceImpl::StartTracing(TracingSessionID tsid) {
   }  // if (trace_duration_ms > 0).
 
   // Start the periodic drain tasks if we should to save the trace into a file.
-  if (tracing_session->config.write_into_file()) {
-    task_runner_->PostDelayedTask(
-        [weak_this, tsid] {
-          if (weak_this)
-            weak_this->ReadBuffersIntoFile(tsid);
-        },
-        tracing_session->delay_to_next_write_period_ms());
-  }
+  if (tracing_session->config.write_into_file())
+    PostReadBuffersIntoFile(tracing_session);
 
   // Start the periodic flush tasks if the config specified a flush period.
   if (tracing_session->config.flush_period_ms())
@@ -1830,6 +1919,7 @@ void TracingServiceImpl::FlushDataSourceInstances(
           .emplace_hint(tracing_session->pending_flushes.end(),
                         flush_request_id, PendingFlush(std::move(callback)))
           ->second;
+  pending_flush.start_ns = base::GetBootTimeNs().count();
 
   // Send a flush request to each producer involved in the tracing session. In
   // order to issue a flush request we have to build a map of all data source
@@ -1858,13 +1948,18 @@ void TracingServiceImpl::FlushDataSourceInstances(
 void TracingServiceImpl::NotifyFlushDoneForProducer(
     ProducerID producer_id,
     FlushRequestID flush_request_id) {
+  const ProducerEndpointImpl* producer = GetProducer(producer_id);
+  const int64_t now_ns = base::GetBootTimeNs().count();
   for (auto& kv : tracing_sessions_) {
     // Remove all pending flushes <= |flush_request_id| for |producer_id|.
     auto& pending_flushes = kv.second.pending_flushes;
     auto end_it = pending_flushes.upper_bound(flush_request_id);
     for (auto it = pending_flushes.begin(); it != end_it;) {
       PendingFlush& pending_flush = it->second;
-      pending_flush.producers.erase(producer_id);
+      if (pending_flush.producers.erase(producer_id) && producer) {
+        kv.second.flush_latency_by_producer[producer->name_].Add(
+            now_ns - pending_flush.start_ns);
+      }
       if (pending_flush.producers.empty()) {
         auto weak_this = weak_ptr_factory_.GetWeakPtr();
         TracingSessionID tsid = kv.first;
@@ -2194,8 +2289,8 @@ bool TracingServiceImpl::ReadBuffersIntoConsumer(
   std::vector<TracePacket> packets =
       ReadBuffers(tracing_session, kApproxBytesPerTask, &has_more);
 
+  auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
   if (has_more) {
-    auto weak_consumer = consumer->weak_ptr_factory_.GetWeakPtr();
     auto weak_this = weak_ptr_factory_.GetWeakPtr();
     task_runner_->PostTask([weak_this, weak_consumer, tsid] {
       if (!weak_this || !weak_consumer)
@@ -2204,6 +2299,31 @@ bool TracingServiceImpl::ReadBuffersIntoConsumer(
     });
   }
 
+  if (tracing_session->compress_zstd && compression_task_runner_) {
+    // Compress on the compression thread, so that the service keeps serving
+    // producers and reading the next chunk meanwhile. Both task runners are
+    // FIFO: the consumer receives the chunks in the order they were read.
+    auto compressor_fn = init_opts_.zstd_compressor_fn;
+    auto* task_runner = task_runner_;
+    CopyPacketsIntoOwnedSlices(&packets);
+    auto shared_packets =
+        std::make_shared<std::vector<TracePacket>>(std::move(packets));
+    compression_task_runner_->PostTask([compressor_fn, task_runner,
+                                        weak_consumer, shared_packets,
+                                        has_more] {
+      compressor_fn(shared_packets.get());
+      task_runner->PostTask([weak_consumer, shared_packets, has_more] {
+        if (!weak_consumer)
+          return;
+        weak_consumer->consumer_->OnTraceData(std::move(*shared_packets),
+                                              has_more);
+      });
+    });
+    return true;
+  }
+
+  MaybeCompressPackets(tracing_session, &packets);
+
   // Keep this as tail call, just in case the consumer re-enters.
   consumer->consumer_->OnTraceData(std::move(packets), has_more);
   return true;
@@ -2226,6 +2346,16 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
   if (IsWaitingForTrigger(tracing_session))
     return false;
 
+  const bool is_final_write = tracing_session->write_period_ms == 0;
+  if (file_writer_task_runner_ && !is_final_write &&
+      tracing_session->write_into_file->pending_batches.load() > 0) {
+    // The writer thread is still busy with the previous period. Leave the data
+    // in the trace buffers until the next period rather than queueing more
+    // copies of it in memory.
+    PostReadBuffersIntoFile(tracing_session);
+    return true;
+  }
+
   // ReadBuffers() can allocate memory internally, for filtering. By limiting
   // the data that ReadBuffers() reads to kWriteIntoChunksSize per iteration,
   // we limit the amount of memory used on each iteration.
@@ -2235,17 +2365,21 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
   // ReadBuffersIntoFile has to read the whole available data before returning,
   // to support the disable_immediately=true code paths.
   bool has_more = true;
-  bool stop_writing_into_file = false;
-  do {
+  bool stop_writing_into_file =
+      tracing_session->write_into_file->write_failed.load();
+  while (has_more && !stop_writing_into_file) {
     std::vector<TracePacket> packets =
         ReadBuffers(tracing_session, kWriteIntoFileChunkSize, &has_more);
+    MaybeCompressPackets(tracing_session, &packets);
 
     stop_writing_into_file = WriteIntoFile(tracing_session, std::move(packets));
-  } while (has_more && !stop_writing_into_file);
+  }
 
-  if (stop_writing_into_file || tracing_session->write_period_ms == 0) {
+  if (stop_writing_into_file || is_final_write) {
     // Ensure all data was written to the file before we close it.
-    base::FlushFile(tracing_session->write_into_file.get());
+    if (file_writer_task_runner_)
+      WaitForFileWrites();
+    base::FlushFile(*tracing_session->write_into_file->fd);
     tracing_session->write_into_file.reset();
     tracing_session->write_period_ms = 0;
     if (tracing_session->state == TracingSession::STARTED)
@@ -2253,14 +2387,20 @@ bool TracingServiceImpl::ReadBuffersIntoFile(TracingSessionID tsid) {
     return true;
   }
 
+  PostReadBuffersIntoFile(tracing_session);
+  return true;
+}
+
+void TracingServiceImpl::PostReadBuffersIntoFile(
+    TracingSession* tracing_session) {
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
+  TracingSessionID tsid = tracing_session->id;
   task_runner_->PostDelayedTask(
       [weak_this, tsid] {
         if (weak_this)
           weak_this->ReadBuffersIntoFile(tsid);
       },
       tracing_session->delay_to_next_write_period_ms());
-  return true;
 }
 
 bool TracingServiceImpl::IsWaitingForTrigger(TracingSession* tracing_session) {
@@ -2305,6 +2445,7 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DCHECK(tracing_session);
   *has_more = false;
+  const int64_t start_ns = base::GetBootTimeNs().count();
 
   std::vector<TracePacket> packets;
   packets.reserve(1024);  // Just an educated guess to avoid trivial expansions.
@@ -2356,6 +2497,7 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
   }
 
   bool did_hit_threshold = false;
+  std::vector<TraceBuffer::ReadPacket> read_packets;
 
   for (size_t buf_idx = 0;
        buf_idx < tracing_session->num_buffers() && !did_hit_threshold;
@@ -2367,14 +2509,19 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
     }
     TraceBuffer& tbuf = *tbuf_iter->second;
     tbuf.BeginRead();
-    while (!did_hit_threshold) {
-      TracePacket packet;
-      TraceBuffer::PacketSequenceProperties sequence_properties{};
-      bool previous_packet_dropped;
-      if (!tbuf.ReadNextTracePacket(&packet, &sequence_properties,
-                                    &previous_packet_dropped)) {
-        break;
-      }
+    // Read the packets of the buffer in one batch, up to the threshold, before
+    // validating them and appending their trusted fields.
+    const size_t max_bytes =
+        packets_bytes < threshold ? threshold - packets_bytes : 1;
+    read_packets.clear();
+    did_hit_threshold = tbuf.ReadTracePackets(max_bytes, &read_packets) >=
+                        max_bytes;
+    for (TraceBuffer::ReadPacket& read_packet : read_packets) {
+      TracePacket& packet = read_packet.packet;
+      const TraceBuffer::PacketSequenceProperties& sequence_properties =
+          read_packet.sequence_properties;
+      const bool previous_packet_dropped =
+          read_packet.previous_packet_on_sequence_dropped;
       packet.set_buffer_index_for_stats(static_cast<uint32_t>(buf_idx));
       PERFETTO_DCHECK(sequence_properties.producer_id_trusted != 0);
       PERFETTO_DCHECK(sequence_properties.writer_id != 0);
@@ -2424,12 +2571,13 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
 
       // Append the packet (inclusive of the trusted uid) to |packets|.
       packets_bytes += packet.size();
-      did_hit_threshold = packets_bytes >= threshold;
       packets.emplace_back(std::move(packet));
     }  // for(packets...)
   }    // for(buffers...)
 
   *has_more = did_hit_threshold;
+  tracing_session->read_buffers_latency.Add(base::GetBootTimeNs().count() -
+                                            start_ns);
 
   // Only emit the "read complete" lifetime event when there is no more trace
   // data available to read. These events are used as safe points to limit
@@ -2459,8 +2607,6 @@ std::vector<TracePacket> TracingServiceImpl::ReadBuffers(
 
   MaybeFilterPackets(tracing_session, &packets);
 
-  MaybeCompressPackets(tracing_session, &packets);
-
   if (!*has_more) {
     // We've observed some extremely high memory usage by scudo after
     // MaybeFilterPackets in the past. The original bug (b/195145848) is fixed
@@ -2535,11 +2681,11 @@ void TracingServiceImpl::MaybeFilterPackets(TracingSession* tracing_session,
 void TracingServiceImpl::MaybeCompressPackets(
     TracingSession* tracing_session,
     std::vector<TracePacket>* packets) {
-  if (!tracing_session->compress_deflate) {
-    return;
+  if (tracing_session->compress_deflate) {
+    init_opts_.compressor_fn(packets);
+  } else if (tracing_session->compress_zstd) {
+    init_opts_.zstd_compressor_fn(packets);
   }
-
-  init_opts_.compressor_fn(packets);
 }
 
 bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
@@ -2589,9 +2735,58 @@ bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
     num_iovecs_at_last_packet = num_iovecs;
   }
   PERFETTO_DCHECK(num_iovecs <= max_iovecs);
-  int fd = *tracing_session->write_into_file;
 
+  if (file_writer_task_runner_) {
+    // Copy the packets, which point into the trace buffers, and hand them off
+    // to the writer thread. The size is accounted for upfront: a failed write
+    // stops the session on the next ReadBuffersIntoFile() anyway.
+    size_t batch_size = 0;
+    for (size_t i = 0; i < num_iovecs; i++)
+      batch_size += iovecs[i].iov_len;
+    if (batch_size == 0)
+      return stop_writing_into_file;
+    auto batch = std::make_shared<std::vector<char>>(batch_size);
+    char* dst = batch->data();
+    for (size_t i = 0; i < num_iovecs; i++) {
+      memcpy(dst, iovecs[i].iov_base, iovecs[i].iov_len);
+      dst += iovecs[i].iov_len;
+    }
+    tracing_session->bytes_written_into_file += batch_size;
+    std::shared_ptr<OutputFile> file = tracing_session->write_into_file;
+    file->pending_batches++;
+    // The latency of the write is recorded back on the service thread.
+    auto weak_this = weak_ptr_factory_.GetWeakPtr();
+    base::TaskRunner* task_runner = task_runner_;
+    TracingSessionID tsid = tracing_session->id;
+    file_writer_task_runner_->PostTask([file, batch, weak_this, task_runner,
+                                        tsid] {
+      if (!file->write_failed) {
+        const int64_t start_ns = base::GetBootTimeNs().count();
+        ssize_t wr_size =
+            base::WriteAll(*file->fd, batch->data(), batch->size());
+        if (wr_size != static_cast<ssize_t>(batch->size())) {
+          PERFETTO_PLOG("write() failed");
+          file->write_failed = true;
+        }
+        const int64_t latency_ns = base::GetBootTimeNs().count() - start_ns;
+        task_runner->PostTask([weak_this, tsid, latency_ns] {
+          if (!weak_this)
+            return;
+          TracingSession* session = weak_this->GetTracingSession(tsid);
+          if (session)
+            session->file_write_latency.Add(latency_ns);
+        });
+      }
+      file->pending_batches--;
+    });
+    PERFETTO_DLOG("Draining into file, handed off: %zu KB, stop: %d",
+                  (batch_size + 1023) / 1024, stop_writing_into_file);
+    return stop_writing_into_file;
+  }
+
+  int fd = *tracing_session->write_into_file->fd;
   uint64_t total_wr_size = 0;
+  const int64_t start_ns = base::GetBootTimeNs().count();
 
   // writev() can take at most IOV_MAX entries per call. Batch them.
   constexpr size_t kIOVMax = IOV_MAX;
@@ -2607,12 +2802,25 @@ bool TracingServiceImpl::WriteIntoFile(TracingSession* tracing_session,
   }
 
   tracing_session->bytes_written_into_file += total_wr_size;
+  if (num_iovecs > 0) {
+    tracing_session->file_write_latency.Add(base::GetBootTimeNs().count() -
+                                            start_ns);
+  }
 
   PERFETTO_DLOG("Draining into file, written: %" PRIu64 " KB, stop: %d",
                 (total_wr_size + 1023) / 1024, stop_writing_into_file);
   return stop_writing_into_file;
 }
 
+void TracingServiceImpl::WaitForFileWrites() {
+  PERFETTO_DCHECK(file_writer_task_runner_);
+  // The writer thread runs its tasks in order: once this one runs, all the
+  // batches handed off before are written.
+  base::WaitableEvent written;
+  file_writer_task_runner_->PostTask([&written] { written.Notify(); });
+  written.Wait();
+}
+
 void TracingServiceImpl::FreeBuffers(TracingSessionID tsid) {
   PERFETTO_DCHECK_THREAD(thread_checker_);
   PERFETTO_DLOG("Freeing buffers for session %" PRIu64, tsid);
@@ -2945,6 +3153,24 @@ TracingServiceImpl::DataSourceInstance* TracingServiceImpl::SetupDataSource(
   PERFETTO_DCHECK(global_id);
   ds_config.set_target_buffer(global_id);
 
+  // Producers without a quota of their own still get one (priority 0, no rate
+  // limit): it's what the per-producer stats are keyed by.
+  const TraceConfig::BufferConfig& buffer_cfg =
+      tracing_session->config.buffers()[relative_buffer_id];
+  TraceBuffer* buf = GetBufferByID(global_id);
+  if (buf && !buffer_cfg.producer_quotas().empty()) {
+    TraceBuffer::ProducerQuota quota;
+    for (const auto& producer_quota : buffer_cfg.producer_quotas()) {
+      if (producer_quota.producer_name() == producer->name_) {
+        quota.priority = producer_quota.priority();
+        quota.max_bytes_per_sec =
+            static_cast<uint64_t>(producer_quota.max_kb_per_sec()) * 1024;
+        break;
+      }
+    }
+    buf->SetProducerQuota(producer->id_, producer->name_, quota);
+  }
+
   PERFETTO_DLOG("Setting up data source %s with target buffer %" PRIu16,
                 ds_config.name().c_str(), global_id);
   if (!producer->shared_memory()) {
@@ -3049,9 +3275,11 @@ void TracingServiceImpl::CopyProducerPageIntoLogBuffer(
     return;
   }
 
+  const int64_t start_ns = base::GetBootTimeNs().count();
   buf->CopyChunkUntrusted(producer_id_trusted, client_identity_trusted,
                           writer_id, chunk_id, num_fragments, chunk_flags,
                           chunk_complete, src, size);
+  chunk_copy_latency_.Add(base::GetBootTimeNs().count() - start_ns);
 }
 
 void TracingServiceImpl::ApplyChunkPatches(
@@ -3452,6 +3680,25 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     *trace_stats.add_buffer_stats() = buf->stats();
   }  // for (buf in session).
 
+  for (size_t buf_idx = 0; buf_idx < tracing_session->buffers_index.size();
+       buf_idx++) {
+    const TraceBuffer* buf =
+        GetBufferByID(tracing_session->buffers_index[buf_idx]);
+    if (!buf || !buf->producer_quotas())
+      continue;
+    for (auto it = buf->producer_quotas()->GetIterator(); it; ++it) {
+      const TraceBuffer::ProducerQuotaStats& stats = it.value().stats;
+      auto* prod_stats = trace_stats.add_producer_buffer_stats();
+      prod_stats->set_producer_name(it.value().producer_name);
+      prod_stats->set_buffer(static_cast<uint32_t>(buf_idx));
+      prod_stats->set_bytes_written(stats.bytes_written);
+      prod_stats->set_chunks_dropped_over_quota(
+          stats.chunks_dropped_over_quota);
+      prod_stats->set_chunks_dropped_for_priority(
+          stats.chunks_dropped_for_priority);
+    }
+  }
+
   if (!tracing_session->config.builtin_data_sources()
            .disable_chunk_usage_histograms()) {
     // Emit chunk usage stats broken down by sequence ID (i.e. by trace-writer).
@@ -3493,6 +3740,24 @@ TraceStats TracingServiceImpl::GetTraceStats(TracingSession* tracing_session) {
     }    // for each buffer.
   }      // if (!disable_chunk_usage_histograms)
 
+  // The thresholds are the same for all the latency histograms. The -1 is to
+  // skip the implicit overflow bucket.
+  for (size_t i = 0; i < commit_data_latency_.num_buckets() - 1; ++i) {
+    trace_stats.add_latency_histogram_def_ns(
+        commit_data_latency_.GetBucketThres(i));
+  }
+  AddLatencyHistogram(commit_data_latency_, "commit_data", &trace_stats);
+  AddLatencyHistogram(chunk_copy_latency_, "chunk_copy", &trace_stats);
+  AddLatencyHistogram(tracing_session->read_buffers_latency, "read_buffers",
+                      &trace_stats);
+  AddLatencyHistogram(tracing_session->file_write_latency, "file_write",
+                      &trace_stats);
+  for (const auto& [producer_name, hist] :
+       tracing_session->flush_latency_by_producer) {
+    AddLatencyHistogram(hist, "flush", &trace_stats)
+        ->set_producer_name(producer_name);
+  }
+
   return trace_stats;
 }
 
@@ -3763,8 +4028,13 @@ void TracingServiceImpl::FlushAndCloneSession(ConsumerEndpointImpl* consumer,
     // Some leftover data was left in the buffer. Recreate it to empty it.
     const auto buf_policy = buf->overwrite_policy();
     const auto buf_size = buf->size();
+    const auto buf_shards = buf->num_shards();
+    const auto buf_sharding = buf->sharding_policy();
     std::unique_ptr<TraceBuffer> old_buf = std::move(buf);
-    buf = TraceBuffer::Create(buf_size, buf_policy);
+    buf = old_buf->file_backed()
+              ? CreateFileBackedTraceBuffer(buf_size, buf_policy)
+              : TraceBuffer::Create(buf_size, buf_policy, buf_shards,
+                                    buf_sharding);
     if (!buf) {
       // This is extremely rare but could happen on 32-bit. If the new buffer
       // allocation failed, put back the buffer where it was and fail the clone.
@@ -3775,6 +4045,7 @@ void TracingServiceImpl::FlushAndCloneSession(ConsumerEndpointImpl* consumer,
           {false, "Buffer allocation failed while attempting to clone", {}});
       return;
     }
+    buf->CopyProducerQuotasFrom(*old_buf);
   }
 
   auto weak_this = weak_ptr_factory_.GetWeakPtr();
@@ -3916,12 +4187,19 @@ bool TracingServiceImpl::DoCloneBuffers(
     if (src->config.buffers()[buf_idx].transfer_on_clone()) {
       const auto buf_policy = src_buf->overwrite_policy();
       const auto buf_size = src_buf->size();
+      const auto buf_shards = src_buf->num_shards();
+      const auto buf_sharding = src_buf->sharding_policy();
       new_buf = std::move(src_buf);
-      src_buf = TraceBuffer::Create(buf_size, buf_policy);
+      src_buf = new_buf->file_backed()
+                    ? CreateFileBackedTraceBuffer(buf_size, buf_policy)
+                    : TraceBuffer::Create(buf_size, buf_policy, buf_shards,
+                                          buf_sharding);
       if (!src_buf) {
         // If the allocation fails put the buffer back and let the code below
         // handle the failure gracefully.
         src_buf = std::move(new_buf);
+      } else {
+        src_buf->CopyProducerQuotasFrom(*new_buf);
       }
     } else {
       new_buf = src_buf->CloneReadOnly();
@@ -4025,6 +4303,7 @@ base::Status TracingServiceImpl::FinishCloneSession(
   cloned_session->flushes_succeeded = src->flushes_succeeded;
   cloned_session->flushes_failed = src->flushes_failed;
   cloned_session->compress_deflate = src->compress_deflate;
+  cloned_session->compress_zstd = src->compress_zstd;
   if (src->trace_filter && !skip_trace_filter) {
     // Copy the trace filter, unless it's a clone-for-bugreport (b/317065412).
     cloned_session->trace_filter.reset(
@@ -4328,6 +4607,15 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryServiceState(
         static_cast<int>(registered_data_source.producer_id));
   }
 
+  for (size_t i = 0; i < service_->commit_data_latency_.num_buckets() - 1;
+       ++i) {
+    svc_state.add_latency_histogram_def_ns(
+        service_->commit_data_latency_.GetBucketThres(i));
+  }
+  AddLatencyHistogram(service_->commit_data_latency_, "commit_data",
+                      &svc_state);
+  AddLatencyHistogram(service_->chunk_copy_latency_, "chunk_copy", &svc_state);
+
   svc_state.set_supports_tracing_sessions(true);
   for (const auto& kv : service_->tracing_sessions_) {
     const TracingSession& s = kv.second;
@@ -4350,6 +4638,12 @@ void TracingServiceImpl::ConsumerEndpointImpl::QueryServiceState(
     }
     for (const auto& buf : s.config.buffers())
       session->add_buffer_size_kb(buf.size_kb());
+    AddLatencyHistogram(s.read_buffers_latency, "read_buffers", session);
+    AddLatencyHistogram(s.file_write_latency, "file_write", session);
+    for (const auto& [producer_name, hist] : s.flush_latency_by_producer) {
+      AddLatencyHistogram(hist, "flush", session)
+          ->set_producer_name(producer_name);
+    }
 
     switch (s.state) {
       case TracingSession::State::DISABLED:
@@ -4489,6 +4783,7 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     return;
   }
   PERFETTO_DCHECK(shmem_abi_.is_valid());
+  const int64_t start_ns = base::GetBootTimeNs().count();
   for (const auto& entry : req_untrusted.chunks_to_move()) {
     const uint32_t page_idx = entry.page();
     if (page_idx >= shmem_abi_.num_pages())
@@ -4548,6 +4843,9 @@ void TracingServiceImpl::ProducerEndpointImpl::CommitData(
     service_->NotifyFlushDoneForProducer(id_, req_untrusted.flush_request_id());
   }
 
+  service_->commit_data_latency_.Add(base::GetBootTimeNs().count() -
+                                     start_ns);
+
   // Keep this invocation last. ProducerIPCService::CommitData() relies on this
   // callback being invoked within the same callstack and not posted. If this
   // changes, the code there needs to be changed accordingly.
@@ -18,12 +18,14 @@
 #define SRC_TRACING_SERVICE_TRACING_SERVICE_IMPL_H_
 
 #include <algorithm>
+#include <atomic>
 #include <functional>
 #include <map>
 #include <memory>
 #include <optional>
 #include <random>
 #include <set>
+#include <string>
 #include <utility>
 #include <vector>
 
@@ -47,6 +49,7 @@
 #include "perfetto/tracing/core/trace_config.h"
 #include "src/android_stats/perfetto_atoms.h"
 #include "src/tracing/core/id_allocator.h"
+#include "src/tracing/service/histogram.h"
 
 namespace protozero {
 class MessageFilter;
@@ -378,6 +381,8 @@ class TracingServiceImpl : public TracingService {
   //
   // Returns false in case of error.
   bool ReadBuffersIntoFile(TracingSessionID);
+  // Schedules ReadBuffersIntoFile() at the start of the next write period.
+  void PostReadBuffersIntoFile(TracingSession*);
 
   void FreeBuffers(TracingSessionID);
 
@@ -474,6 +479,8 @@ class TracingServiceImpl : public TracingService {
   struct PendingFlush {
     std::set<ProducerID> producers;
     ConsumerEndpoint::FlushCallback callback;
+    // When the flush request was sent to the producers (CLOCK_BOOTTIME).
+    int64_t start_ns = 0;
     explicit PendingFlush(decltype(callback) cb) : callback(std::move(cb)) {}
   };
 
@@ -489,6 +496,32 @@ class TracingServiceImpl : public TracingService {
     bool skip_trace_filter = false;
   };
 
+  // The file a write_into_file session streams the trace into. When the file
+  // is written on |file_writer_task_runner_|, this is shared with the write
+  // tasks in flight so that the file is closed only once they are done.
+  // Durations, in nanoseconds, of the internal operations of the service. See
+  // TraceStats.latency_histograms.
+  using LatencyHistogram = Histogram<1000,
+                                     10000,
+                                     100000,
+                                     1000000,
+                                     10000000,
+                                     100000000,
+                                     1000000000>;
+
+  struct OutputFile {
+    explicit OutputFile(base::ScopedFile f) : fd(std::move(f)) {}
+
+    base::ScopedFile fd;
+
+    // Number of batches handed off to |file_writer_task_runner_| and not
+    // written yet.
+    std::atomic<uint32_t> pending_batches{0};
+
+    // Set by |file_writer_task_runner_| when a write fails.
+    std::atomic<bool> write_failed{false};
+  };
+
   // Holds the state of a tracing session. A tracing session is uniquely bound
   // a specific Consumer. Each Consumer can own one or more sessions.
   struct TracingSession {
@@ -644,6 +677,7 @@ class TracingServiceImpl : public TracingService {
 
     // Whether we should compress TracePackets after reading them.
     bool compress_deflate = false;
+    bool compress_zstd = false;
 
     // The number of received triggers we've emitted into the trace output.
     size_t num_triggers_emitted_into_trace = 0;
@@ -706,7 +740,7 @@ class TracingServiceImpl : public TracingService {
     // TraceConfig. In this case this represents the file we should stream the
     // trace packets into, rather than returning it to the consumer via
     // OnTraceData().
-    base::ScopedFile write_into_file;
+    std::shared_ptr<OutputFile> write_into_file;
     uint32_t write_period_ms = 0;
     uint64_t max_file_size_bytes = 0;
     uint64_t bytes_written_into_file = 0;
@@ -729,6 +763,13 @@ class TracingServiceImpl : public TracingService {
     uint64_t filter_time_taken_ns = 0;
     std::vector<uint64_t> filter_bytes_discarded_per_buffer;
 
+    // Latencies of the operations done on behalf of the session: the passes
+    // of ReadBuffers(), the writes into |write_into_file| and the round trips
+    // of flush requests, by producer name.
+    LatencyHistogram read_buffers_latency;
+    LatencyHistogram file_write_latency;
+    std::map<std::string, LatencyHistogram> flush_latency_by_producer;
+
     // A randomly generated trace identifier. Note that this does NOT always
     // match the requested TraceConfig.trace_uuid_msb/lsb. Spcifically, it does
     // until a gap-less snapshot is requested. Each snapshot re-generates the
@@ -853,12 +894,16 @@ class TracingServiceImpl : public TracingService {
                             std::vector<TracePacket>* packets);
 
   // If `*tracing_session` is configured to write into a file, writes `packets`
-  // into the file.
+  // into the file. With |file_writer_task_runner_|, `packets` are copied and
+  // handed off to it instead: see WaitForFileWrites().
   //
   // Returns true if the file should be closed (because it's full or there has
   // been an error), false otherwise.
   bool WriteIntoFile(TracingSession* tracing_session,
                      std::vector<TracePacket> packets);
+  // Blocks until the batches handed off to |file_writer_task_runner_| so far
+  // are written.
+  void WaitForFileWrites();
   void OnStartTriggersTimeout(TracingSessionID tsid);
   void MaybeLogUploadEvent(const TraceConfig&,
                            const base::Uuid&,
@@ -874,6 +919,15 @@ class TracingServiceImpl : public TracingService {
 
   base::TaskRunner* const task_runner_;
   const InitOpts init_opts_;
+
+  // The thread running |init_opts_.zstd_compressor_fn| for the traces read
+  // over IPC. Null if zstd is not supported.
+  std::unique_ptr<base::TaskRunner> compression_task_runner_;
+
+  // The thread writing the files of write_into_file sessions, if
+  // |init_opts_.write_into_file_on_dedicated_thread|. Created with the first
+  // of these sessions.
+  std::unique_ptr<base::TaskRunner> file_writer_task_runner_;
   std::unique_ptr<SharedMemory::Factory> shm_factory_;
   ProducerID last_producer_id_ = 0;
   DataSourceInstanceID last_data_source_instance_id_ = 0;
@@ -913,6 +967,8 @@ class TracingServiceImpl : public TracingService {
   // Stats.
   uint64_t chunks_discarded_ = 0;
   uint64_t patches_discarded_ = 0;
+  LatencyHistogram commit_data_latency_;
+  LatencyHistogram chunk_copy_latency_;
 
   PERFETTO_THREAD_CHECKER(thread_checker_)
 
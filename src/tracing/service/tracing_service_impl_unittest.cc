@@ -60,6 +60,11 @@
 #include "src/tracing/service/zlib_compressor.h"
 #endif
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+#include <zstd.h>
+#include "src/tracing/service/zstd_compressor.h"
+#endif
+
 using ::testing::_;
 using ::testing::AssertionFailure;
 using ::testing::AssertionResult;
@@ -67,6 +72,7 @@ using ::testing::AssertionSuccess;
 using ::testing::Contains;
 using ::testing::DoAll;
 using ::testing::Each;
+using ::testing::ElementsAre;
 using ::testing::ElementsAreArray;
 using ::testing::Eq;
 using ::testing::ExplainMatchResult;
@@ -163,6 +169,26 @@ std::vector<protos::gen::TracePacket> DecompressTrace(
 }
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+std::string ZstdDecompress(const std::string& data) {
+  char out[1024];
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  ZSTD_inBuffer in{data.data(), data.size(), 0};
+  std::string s;
+  size_t ret = 0;
+  do {
+    ZSTD_outBuffer out_buf{out, sizeof(out), 0};
+    ret = ZSTD_decompressStream(dctx, &out_buf, &in);
+    EXPECT_FALSE(ZSTD_isError(ret));
+    if (ZSTD_isError(ret))
+      break;
+    s.append(out, out_buf.pos);
+  } while (ret != 0);
+  ZSTD_freeDCtx(dctx);
+  return s;
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
 }  // namespace
 
 class TracingServiceImplTest : public testing::Test {
@@ -2096,6 +2122,72 @@ TEST_F(TracingServiceImplTest, CloneSessionWithCompression) {
 
 #endif  // PERFETTO_BUILDFLAG(PERFETTO_ZLIB)
 
+#if PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+TEST_F(TracingServiceImplTest, ZstdCompressionReadIpc) {
+  TracingService::InitOpts init_opts;
+  init_opts.zstd_compressor_fn = ZstdCompressFn;
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_compression_type(TraceConfig::COMPRESSION_TYPE_ZSTD);
+  consumer->EnableTracing(trace_config);
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  // Write enough data for the trace to be read in several chunks, all of
+  // them compressed on the compression thread.
+  for (int i = 0; i < 100; i++) {
+    auto tp = writer->NewTracePacket();
+    tp->set_for_testing()->set_str("payload-" + std::to_string(i) +
+                                   std::string(1024, 'x'));
+  }
+
+  writer->Flush();
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  std::vector<protos::gen::TracePacket> compressed_packets =
+      consumer->ReadBuffers();
+  EXPECT_GT(compressed_packets.size(), 1u);
+  EXPECT_THAT(compressed_packets,
+              Each(Property(&protos::gen::TracePacket::zstd_compressed_packets,
+                            Not(IsEmpty()))));
+  std::vector<std::string> payloads;
+  for (const auto& c : compressed_packets) {
+    protos::gen::Trace t;
+    ASSERT_TRUE(t.ParseFromString(ZstdDecompress(c.zstd_compressed_packets())));
+    for (const auto& packet : t.packet()) {
+      if (packet.has_for_testing()) {
+        const std::string& str = packet.for_testing().str();
+        payloads.push_back(str.substr(0, str.find('x')));
+      }
+    }
+  }
+  // The chunks are received in order.
+  ASSERT_EQ(payloads.size(), 100u);
+  for (size_t i = 0; i < payloads.size(); i++)
+    EXPECT_EQ(payloads[i], "payload-" + std::to_string(i));
+}
+#endif  // PERFETTO_BUILDFLAG(PERFETTO_ZSTD)
+
 // Note: file_write_period_ms is set to a large enough to have exactly one flush
 // of the tracing buffers (and therefore at most one synchronization section),
 // unless the test runs unrealistically slowly, or the implementation of the
@@ -2230,6 +2322,72 @@ TEST_F(TracingServiceImplTest, WriteIntoFileWithPath) {
                   Property(&protos::gen::TestEvent::str, Eq("payload")))));
 }
 
+TEST_F(TracingServiceImplTest, WriteIntoFileOnDedicatedThread) {
+  TracingService::InitOpts init_opts;
+  init_opts.write_into_file_on_dedicated_thread = true;
+  InitializeSvcWithOpts(init_opts);
+
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(4096);
+  auto* ds_config = trace_config.add_data_sources()->mutable_config();
+  ds_config->set_name("data_source");
+  ds_config->set_target_buffer(0);
+  trace_config.set_write_into_file(true);
+  trace_config.set_file_write_period_ms(1);
+  base::TempFile tmp_file = base::TempFile::Create();
+  consumer->EnableTracing(trace_config, base::ScopedFile(dup(tmp_file.fd())));
+
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  // Let several periodic writes hand batches off to the writer thread.
+  for (int i = 0; i < 100; i++) {
+    {
+      auto tp = writer->NewTracePacket();
+      tp->set_for_testing()->set_str("payload-" + std::to_string(i) +
+                                     std::string(1024, 'x'));
+    }
+    if (i % 10 == 9) {
+      writer->Flush();
+      std::string checkpoint_name = "wait_" + std::to_string(i);
+      task_runner.PostDelayedTask(
+          task_runner.CreateCheckpoint(checkpoint_name), 5);
+      task_runner.RunUntilCheckpoint(checkpoint_name);
+    }
+  }
+  writer.reset();
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  // All the batches are written, in order, once tracing is disabled.
+  std::string trace_raw;
+  ASSERT_TRUE(base::ReadFile(tmp_file.path().c_str(), &trace_raw));
+  protos::gen::Trace trace;
+  ASSERT_TRUE(trace.ParseFromString(trace_raw));
+  std::vector<std::string> payloads;
+  for (const auto& packet : trace.packet()) {
+    if (packet.has_for_testing()) {
+      const std::string& str = packet.for_testing().str();
+      payloads.push_back(str.substr(0, str.find('x')));
+    }
+  }
+  ASSERT_EQ(payloads.size(), 100u);
+  for (size_t i = 0; i < payloads.size(); i++)
+    EXPECT_EQ(payloads[i], "payload-" + std::to_string(i));
+}
+
 TEST_F(TracingServiceImplTest, WriteIntoFileFilterMultipleChunks) {
   static const size_t kNumTestPackets = 5;
   static const size_t kPayloadSize = 500 * 1024UL;
@@ -3857,6 +4015,67 @@ TEST_F(TracingServiceImplTest, GetTraceStats) {
   consumer->WaitForTracingDisabled();
 }
 
+TEST_F(TracingServiceImplTest, LatencyHistograms) {
+  std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
+  consumer->Connect(svc.get());
+
+  std::unique_ptr<MockProducer> producer = CreateMockProducer();
+  producer->Connect(svc.get(), "mock_producer");
+  producer->RegisterDataSource("data_source");
+
+  TraceConfig trace_config;
+  trace_config.add_buffers()->set_size_kb(128);
+  trace_config.add_data_sources()->mutable_config()->set_name("data_source");
+  consumer->EnableTracing(trace_config);
+  producer->WaitForTracingSetup();
+  producer->WaitForDataSourceSetup("data_source");
+  producer->WaitForDataSourceStart("data_source");
+
+  std::unique_ptr<TraceWriter> writer =
+      producer->CreateTraceWriter("data_source");
+  writer->NewTracePacket()->set_for_testing()->set_str("payload");
+
+  auto flush_request = consumer->Flush();
+  producer->ExpectFlush(writer.get());
+  ASSERT_TRUE(flush_request.WaitForReply());
+
+  TracingServiceState svc_state = consumer->QueryServiceState();
+  EXPECT_EQ(svc_state.latency_histogram_def_ns().size(), 7u);
+  EXPECT_THAT(svc_state.latency_histograms(),
+              UnorderedElementsAre(
+                  Property(&TracingServiceState::LatencyHistogram::name,
+                           "commit_data"),
+                  Property(&TracingServiceState::LatencyHistogram::name,
+                           "chunk_copy")));
+  ASSERT_EQ(svc_state.tracing_sessions().size(), 1u);
+  EXPECT_THAT(
+      svc_state.tracing_sessions()[0].latency_histograms(),
+      ElementsAre(AllOf(
+          Property(&TracingServiceState::LatencyHistogram::name, "flush"),
+          Property(&TracingServiceState::LatencyHistogram::producer_name,
+                   "mock_producer"))));
+
+  consumer->DisableTracing();
+  producer->WaitForDataSourceStop("data_source");
+  consumer->WaitForTracingDisabled();
+
+  auto packets = consumer->ReadBuffers();
+  std::set<std::string> names;
+  for (const auto& packet : packets) {
+    if (!packet.has_trace_stats())
+      continue;
+    const auto& stats = packet.trace_stats();
+    EXPECT_EQ(stats.latency_histogram_def_ns().size(), 7u);
+    for (const auto& hist : stats.latency_histograms()) {
+      names.insert(hist.name());
+      EXPECT_EQ(hist.counts().size(), 8u);
+      EXPECT_EQ(hist.sums_ns().size(), 8u);
+    }
+  }
+  EXPECT_THAT(names, UnorderedElementsAre("commit_data", "chunk_copy", "flush",
+                                          "read_buffers"));
+}
+
 TEST_F(TracingServiceImplTest, TraceWriterStats) {
   std::unique_ptr<MockConsumer> consumer = CreateMockConsumer();
   consumer->Connect(svc.get());
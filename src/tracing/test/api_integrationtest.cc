@@ -66,6 +66,7 @@
 #include "protos/perfetto/common/track_event_descriptor.gen.h"
 #include "protos/perfetto/common/track_event_descriptor.pbzero.h"
 #include "protos/perfetto/config/interceptor_config.gen.h"
+#include "protos/perfetto/config/interceptors/console_config.gen.h"
 #include "protos/perfetto/config/track_event/track_event_config.gen.h"
 #include "protos/perfetto/trace/clock_snapshot.gen.h"
 #include "protos/perfetto/trace/clock_snapshot.pbzero.h"
@@ -103,6 +104,9 @@
 // lookup.
 PERFETTO_DEFINE_TEST_CATEGORY_PREFIXES("dynamic");
 
+// Events in categories starting with "compiled_out" are removed at build time.
+PERFETTO_DEFINE_COMPILED_OUT_CATEGORY_PREFIXES("compiled_out");
+
 // Trace categories used in the tests.
 PERFETTO_DEFINE_CATEGORIES(
     perfetto::Category("test")
@@ -117,7 +121,8 @@ PERFETTO_DEFINE_CATEGORIES(
     perfetto::Category::Group("baz,bar,quux"),
     perfetto::Category::Group("red,green,blue,foo"),
     perfetto::Category::Group("red,green,blue,yellow"),
-    perfetto::Category(TRACE_DISABLED_BY_DEFAULT("cat")));
+    perfetto::Category(TRACE_DISABLED_BY_DEFAULT("cat")),
+    perfetto::Category("compiled_out"));
 PERFETTO_TRACK_EVENT_STATIC_STORAGE();
 
 // Test declaring an extra set of categories in a namespace in addition to the
@@ -1507,6 +1512,31 @@ TEST_P(PerfettoApiTest, TrackEventCategories) {
   EXPECT_THAT(trace, Not(HasSubstr("NotEnabled")));
 }
 
+TEST_P(PerfettoApiTest, TrackEventCompiledOutCategories) {
+  static_assert(perfetto_track_event::internal::IsCompiledOutCategory(
+                    "compiled_out"),
+                "Category should be compiled out");
+  static_assert(!perfetto_track_event::internal::IsCompiledOutCategory("bar"),
+                "Category shouldn't be compiled out");
+
+  // Enabling a compiled out category in the config has no effect.
+  auto* tracing_session = NewTraceWithCategories({"bar", "compiled_out"});
+  tracing_session->get()->StartBlocking();
+
+  EXPECT_TRUE(TRACE_EVENT_CATEGORY_ENABLED("bar"));
+  EXPECT_FALSE(TRACE_EVENT_CATEGORY_ENABLED("compiled_out"));
+  TRACE_EVENT_BEGIN("compiled_out", "CompiledOutBegin");
+  TRACE_EVENT_END("compiled_out");
+  { TRACE_EVENT("compiled_out", "CompiledOutScoped"); }
+  TRACE_EVENT_BEGIN("bar", "Enabled");
+  TRACE_EVENT_END("bar");
+
+  std::vector<char> raw_trace = StopSessionAndReturnBytes(tracing_session);
+  std::string trace(raw_trace.data(), raw_trace.size());
+  EXPECT_THAT(trace, HasSubstr("Enabled"));
+  EXPECT_THAT(trace, Not(HasSubstr("CompiledOut")));
+}
+
 TEST_P(PerfettoApiTest, ClearIncrementalState) {
   perfetto::DataSourceDescriptor dsd;
   dsd.set_name("incr_data_source");
@@ -1581,7 +1611,7 @@ TEST_P(PerfettoApiTest, TrackEventDescriptor) {
 
   // Check that the advertised categories match PERFETTO_DEFINE_CATEGORIES (see
   // above).
-  EXPECT_EQ(7, desc.available_categories_size());
+  EXPECT_EQ(8, desc.available_categories_size());
   EXPECT_EQ("test", desc.available_categories()[0].name());
   EXPECT_EQ("This is a test category",
             desc.available_categories()[0].description());
@@ -1595,6 +1625,7 @@ TEST_P(PerfettoApiTest, TrackEventDescriptor) {
   EXPECT_EQ("cat-with-dashes", desc.available_categories()[5].name());
   EXPECT_EQ("disabled-by-default-cat", desc.available_categories()[6].name());
   EXPECT_EQ("slow", desc.available_categories()[6].tags()[0]);
+  EXPECT_EQ("compiled_out", desc.available_categories()[7].name());
 }
 
 TEST_P(PerfettoApiTest, TrackEventSharedIncrementalState) {
@@ -3604,6 +3635,53 @@ TEST_P(PerfettoApiTest, FilterDynamicEventName) {
   }
 }
 
+TEST_P(PerfettoApiTest, TrackEventCategoryRateLimits) {
+  perfetto::protos::gen::TrackEventConfig te_cfg;
+  auto* sampling = te_cfg.add_category_rate_limits();
+  sampling->set_category("fo*");
+  sampling->set_sampling_interval(2);
+  auto* rate_limit = te_cfg.add_category_rate_limits();
+  rate_limit->set_category("bar");
+  rate_limit->set_max_events_per_sec(1);
+  rate_limit->set_burst_size(2);
+  auto* tracing_session = NewTraceWithCategories({"foo", "bar"}, te_cfg);
+  tracing_session->get()->StartBlocking();
+
+  for (int i = 0; i < 4; i++) {
+    TRACE_EVENT_BEGIN("foo", "Sampled");
+    TRACE_EVENT_INSTANT("bar", "RateLimited");
+    TRACE_EVENT_END("foo");
+  }
+
+  std::vector<char> raw_trace = StopSessionAndReturnBytes(tracing_session);
+  perfetto::protos::gen::Trace parsed_trace;
+  ASSERT_TRUE(parsed_trace.ParseFromArray(raw_trace.data(), raw_trace.size()));
+  std::vector<std::string> events;
+  for (const auto& packet : parsed_trace.packet()) {
+    if (!packet.has_track_event())
+      continue;
+    const auto& track_event = packet.track_event();
+    std::string event;
+    switch (track_event.type()) {
+      case perfetto::protos::gen::TrackEvent::TYPE_SLICE_BEGIN:
+        event = "B";
+        break;
+      case perfetto::protos::gen::TrackEvent::TYPE_SLICE_END:
+        event = "E";
+        break;
+      default:
+        event = "I";
+        break;
+    }
+    if (track_event.has_dropped_events_before())
+      event += "(" + std::to_string(track_event.dropped_events_before()) + ")";
+    events.push_back(event);
+  }
+  // The ends of the dropped slices are dropped too. The events of "bar" past
+  // the burst are dropped, and never reported since none is kept after them.
+  EXPECT_THAT(events, ElementsAre("B", "I", "E", "I", "B(1)", "E"));
+}
+
 TEST_P(PerfettoApiTest, TrackEventArgumentsNotEvaluatedWhenDisabled) {
   // Create a new trace session.
   auto* tracing_session = NewTraceWithCategories({"foo"});
@@ -5434,6 +5512,58 @@ TEST_P(PerfettoApiTest, ConsoleInterceptorVerify) {
   EXPECT_THAT(lines, ContainerEq(golden_lines));
 }
 
+TEST_P(PerfettoApiTest, ConsoleInterceptorAsyncFormatting) {
+  perfetto::ConsoleInterceptor::Register();
+  auto temp_file = perfetto::test::CreateTempFile();
+  perfetto::ConsoleInterceptor::SetOutputFdForTesting(temp_file.fd);
+
+  perfetto::TraceConfig cfg;
+  cfg.set_duration_ms(500);
+  cfg.add_buffers()->set_size_kb(1024);
+  auto* ds_cfg = cfg.add_data_sources()->mutable_config();
+  ds_cfg->set_name("track_event");
+  auto* interceptor_cfg = ds_cfg->mutable_interceptor_config();
+  interceptor_cfg->set_name("console");
+  interceptor_cfg->mutable_console_config()->set_async_formatting(true);
+
+  auto* tracing_session = NewTrace(cfg);
+  tracing_session->get()->StartBlocking();
+  // Events from a single thread, since the output of different threads is
+  // only approximately ordered in asynchronous mode.
+  TRACE_EVENT_INSTANT("foo", "Instant event");
+  {
+    TRACE_EVENT("foo", "Scoped event");
+    TRACE_EVENT_INSTANT("foo", "Annotated event", "foo", 1, "bar", "hello");
+  }
+  // The packets are printed when the data source stops at the latest.
+  tracing_session->get()->StopBlocking();
+  perfetto::ConsoleInterceptor::SetOutputFdForTesting(0);
+
+  std::vector<std::string> lines;
+  FILE* f = fdopen(temp_file.fd, "r");
+  fseek(f, 0u, SEEK_SET);
+  std::array<char, 128> line{};
+  while (fgets(line.data(), line.size(), f)) {
+    // Ignore timestamps and process/thread ids.
+    std::string s(line.data() + 28);
+    // Filter out durations.
+    s = std::regex_replace(s, std::regex(" [+][0-9]*ms"), "");
+    lines.push_back(std::move(s));
+  }
+  fclose(f);
+  EXPECT_EQ(0, remove(temp_file.path.c_str()));
+
+  // clang-format off
+  std::vector<std::string> golden_lines = {
+      "foo   Instant event\n",
+      "foo   Scoped event {\n",
+      "foo   -  Annotated event(foo:1, bar:hello)\n",
+      "foo   } Scoped event\n",
+  };
+  // clang-format on
+  EXPECT_THAT(lines, ContainerEq(golden_lines));
+}
+
 TEST_P(PerfettoApiTest, TrackEventObserver) {
   class Observer : public perfetto::TrackEventSessionObserver {
    public:
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "perfetto/tracing/track_event_interned_data_index.h"
+
+#include <map>
+#include <random>
+
+#include "test/gtest_and_gmock.h"
+
+namespace perfetto {
+namespace {
+
+// 12 entries at most before an eviction.
+using SmallIndex = FlatInternedDataTraitsWithSize<16>::Index<int>;
+
+size_t LookUpOrInsert(SmallIndex* index, int value, bool* found) {
+  size_t iid = 0;
+  *found = index->LookUpOrInsert(&iid, value);
+  return iid;
+}
+
+TEST(FlatInternedDataTraitsTest, LookUpOrInsert) {
+  FlatInternedDataTraits::Index<const char*> index;
+  static const char kFoo[] = "foo";
+  static const char kBar[] = "bar";
+  size_t foo_iid = 0;
+  size_t bar_iid = 0;
+  size_t iid = 0;
+  EXPECT_FALSE(index.LookUpOrInsert(&foo_iid, kFoo));
+  EXPECT_FALSE(index.LookUpOrInsert(&bar_iid, kBar));
+  EXPECT_EQ(foo_iid, 1u);
+  EXPECT_EQ(bar_iid, 2u);
+  EXPECT_TRUE(index.LookUpOrInsert(&iid, kFoo));
+  EXPECT_EQ(iid, foo_iid);
+  EXPECT_TRUE(index.LookUpOrInsert(&iid, kBar));
+  EXPECT_EQ(iid, bar_iid);
+}
+
+TEST(FlatInternedDataTraitsTest, EvictsEntriesNotHit) {
+  SmallIndex index;
+  bool found = false;
+  for (int i = 1; i <= 12; i++)
+    ASSERT_EQ(LookUpOrInsert(&index, i, &found), static_cast<size_t>(i));
+  for (int i = 1; i <= 4; i++)
+    LookUpOrInsert(&index, i, &found);
+
+  // The index is full: inserting another value drops the entries which were
+  // not hit since they were inserted.
+  EXPECT_EQ(LookUpOrInsert(&index, 13, &found), 13u);
+  EXPECT_FALSE(found);
+  for (int i = 1; i <= 4; i++) {
+    EXPECT_EQ(LookUpOrInsert(&index, i, &found), static_cast<size_t>(i));
+    EXPECT_TRUE(found);
+  }
+  EXPECT_EQ(LookUpOrInsert(&index, 5, &found), 14u);
+  EXPECT_FALSE(found);
+}
+
+TEST(FlatInternedDataTraitsTest, ResetsWhenMostEntriesAreHit) {
+  SmallIndex index;
+  bool found = false;
+  for (int i = 1; i <= 12; i++)
+    LookUpOrInsert(&index, i, &found);
+  for (int i = 1; i <= 12; i++)
+    LookUpOrInsert(&index, i, &found);
+
+  EXPECT_EQ(LookUpOrInsert(&index, 13, &found), 13u);
+  EXPECT_FALSE(found);
+  EXPECT_EQ(LookUpOrInsert(&index, 1, &found), 14u);
+  EXPECT_FALSE(found);
+}
+
+// Checks that a hit always returns the latest id given to a value, regardless
+// of the collisions and evictions.
+TEST(FlatInternedDataTraitsTest, ConsistentWithEvictions) {
+  SmallIndex index;
+  std::map<int, size_t> latest_iids;
+  size_t last_iid = 0;
+  std::minstd_rand rnd(42);
+  for (int i = 0; i < 10000; i++) {
+    int value = static_cast<int>(rnd() % 32) * 16;
+    bool found = false;
+    size_t iid = LookUpOrInsert(&index, value, &found);
+    if (found) {
+      ASSERT_EQ(iid, latest_iids[value]);
+    } else {
+      ASSERT_EQ(iid, ++last_iid);
+      latest_iids[value] = iid;
+    }
+  }
+}
+
+}  // namespace
+}  // namespace perfetto
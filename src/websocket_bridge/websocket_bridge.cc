@@ -16,6 +16,7 @@
 
 #include "src/websocket_bridge/websocket_bridge.h"
 
+#include <errno.h>
 #include <stdint.h>
 
 #include <cstdlib>
@@ -23,25 +24,38 @@
 #include <memory>
 #include <vector>
 
-#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/base/build_config.h"
 #include "perfetto/ext/base/http/http_server.h"
+#include "perfetto/ext/base/string_utils.h"
 #include "perfetto/ext/base/unix_socket.h"
 #include "perfetto/ext/base/unix_task_runner.h"
+#include "perfetto/ext/base/utils.h"
 #include "perfetto/tracing/default_socket.h"
 
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+#include <WinSock2.h>
+#endif
+
 namespace perfetto {
 namespace {
 
 constexpr int kWebsocketPort = 8037;
 
+// Data read from an endpoint is forwarded as websocket messages of up to this
+// size, read straight into a buffer shared by all the connections.
+constexpr size_t kMaxMessageSize = 64 * 1024;
+
+// While the websocket's send buffer is full, reading from the endpoint is
+// paused and the websocket is polled at this interval.
+constexpr uint32_t kFlowControlPollMs = 10;
+
 struct Endpoint {
   const char* uri;
   const char* endpoint;
   base::SockFamily family;
 };
 
-class WSBridge : public base::HttpRequestHandler,
-                 public base::UnixSocket::EventListener {
+class WSBridge : public base::HttpRequestHandler {
  public:
   void Main(int argc, char** argv);
 
@@ -50,20 +64,29 @@ class WSBridge : public base::HttpRequestHandler,
   void OnWebsocketMessage(const base::WebsocketMessage&) override;
   void OnHttpConnectionClosed(base::HttpServerConnection*) override;
 
-  // base::UnixSocket::EventListener implementation.
-  void OnNewIncomingConnection(base::UnixSocket*,
-                               std::unique_ptr<base::UnixSocket>) override;
-  void OnConnect(base::UnixSocket*, bool) override;
-  void OnDisconnect(base::UnixSocket*) override;
-  void OnDataAvailable(base::UnixSocket* self) override;
-
  private:
-  base::HttpServerConnection* GetWebsocket(base::UnixSocket*);
+  // The connection to the endpoint (e.g. traced) of a websocket. The bridge
+  // watches the socket itself, rather than using a base::UnixSocket, to stop
+  // reading from it when the websocket can't keep up. The data then backs up
+  // in the endpoint's socket buffer, rather than in the bridge.
+  struct EndpointConn {
+    uint64_t id = 0;  // Tells apart connections reusing the same websocket.
+    base::UnixSocketRaw sock;
+    bool reading = false;
+  };
+
+  EndpointConn* GetEndpointConn(base::HttpServerConnection*, uint64_t id);
+  void StartReading(base::HttpServerConnection*, EndpointConn*);
+  void StopReading(EndpointConn*);
+  void OnEndpointReadable(base::HttpServerConnection*, uint64_t id);
+  void ResumeWhenWritable(base::HttpServerConnection*, uint64_t id);
+  void CloseEndpointConn(base::HttpServerConnection*);
 
   base::UnixTaskRunner task_runner_;
   std::vector<Endpoint> endpoints_;
-  std::map<base::HttpServerConnection*, std::unique_ptr<base::UnixSocket>>
-      conns_;
+  std::map<base::HttpServerConnection*, EndpointConn> conns_;
+  uint64_t last_conn_id_ = 0;
+  std::unique_ptr<char[]> rxbuf_{new char[kMaxMessageSize]};
 };
 
 void WSBridge::Main(int, char**) {
@@ -126,9 +149,10 @@ void WSBridge::OnHttpRequest(const base::HttpRequest& req) {
     sock_raw.SetBlocking(false);
 
     PERFETTO_DLOG("[WSBridge] Connected to %s", ep.endpoint);
-    conns_[req.conn] = base::UnixSocket::AdoptConnected(
-        sock_raw.ReleaseFd(), this, &task_runner_, ep.family,
-        base::SockType::kStream);
+    EndpointConn& conn = conns_[req.conn];
+    conn.id = ++last_conn_id_;
+    conn.sock = std::move(sock_raw);
+    StartReading(req.conn, &conn);
 
     req.conn->UpgradeToWebsocket(req);
     return;
@@ -141,60 +165,108 @@ void WSBridge::OnWebsocketMessage(const base::WebsocketMessage& msg) {
   auto it = conns_.find(msg.conn);
   PERFETTO_CHECK(it != conns_.end());
   // Pass through the websocket message onto the endpoint TCP socket.
-  base::UnixSocket& sock = *it->second;
-  sock.Send(msg.data.data(), msg.data.size());
+  base::UnixSocketRaw& sock = it->second.sock;
+  sock.SetBlocking(true);
+  const ssize_t sz = sock.Send(msg.data.data(), msg.data.size());
+  sock.SetBlocking(false);
+  if (sz != static_cast<ssize_t>(msg.data.size())) {
+    PERFETTO_DPLOG("[WSBridge] Send to endpoint failed");
+    msg.conn->Close();  // Will trigger OnHttpConnectionClosed().
+  }
 }
 
-// Called when a TCP message is received from the endpoint.
-void WSBridge::OnDataAvailable(base::UnixSocket* sock) {
-  base::HttpServerConnection* websocket = GetWebsocket(sock);
-  PERFETTO_CHECK(websocket);
+// Called when the endpoint socket has data to read or has been closed.
+void WSBridge::OnEndpointReadable(base::HttpServerConnection* websocket,
+                                  uint64_t id) {
+  EndpointConn* conn = GetEndpointConn(websocket, id);
+  if (!conn || !conn->reading)
+    return;
 
-  char buf[8192];
-  auto rsize = sock->Receive(buf, sizeof(buf));
-  if (rsize > 0) {
-    websocket->SendWebsocketMessage(buf, static_cast<size_t>(rsize));
-  } else {
+  const ssize_t rsize = conn->sock.Receive(rxbuf_.get(), kMaxMessageSize);
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_WIN)
+  const bool would_block = WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  const bool would_block = base::IsAgain(errno);
+#endif
+  if (rsize < 0 && would_block)
+    return;
+  if (rsize <= 0) {
     // Connection closed or errored.
-    sock->Shutdown(/*notify=*/true);  // Will trigger OnDisconnect().
+    PERFETTO_DLOG("[WSBridge] Socket connection closed");
     websocket->Close();
+    CloseEndpointConn(websocket);
+    return;
   }
+
+  // The payload goes from |rxbuf_| to the socket in the same syscall as the
+  // frame header, see HttpServerConnection::SendWebsocketFrame().
+  websocket->SendWebsocketMessage(rxbuf_.get(), static_cast<size_t>(rsize));
+
+  // Apply backpressure: if the browser is not draining the websocket, stop
+  // reading from the endpoint until there is room in the send buffer again.
+  if (!websocket->IsWritable()) {
+    StopReading(conn);
+    ResumeWhenWritable(websocket, id);
+  }
+}
+
+void WSBridge::ResumeWhenWritable(base::HttpServerConnection* websocket,
+                                  uint64_t id) {
+  task_runner_.PostDelayedTask(
+      [this, websocket, id] {
+        EndpointConn* conn = GetEndpointConn(websocket, id);
+        if (!conn)
+          return;
+        if (!websocket->IsWritable()) {
+          ResumeWhenWritable(websocket, id);
+          return;
+        }
+        StartReading(websocket, conn);
+      },
+      kFlowControlPollMs);
+}
+
+void WSBridge::StartReading(base::HttpServerConnection* websocket,
+                            EndpointConn* conn) {
+  PERFETTO_DCHECK(!conn->reading);
+  conn->reading = true;
+  const uint64_t id = conn->id;
+  task_runner_.AddFileDescriptorWatch(
+      conn->sock.watch_handle(),
+      [this, websocket, id] { OnEndpointReadable(websocket, id); });
+}
+
+void WSBridge::StopReading(EndpointConn* conn) {
+  if (!conn->reading)
+    return;
+  conn->reading = false;
+  task_runner_.RemoveFileDescriptorWatch(conn->sock.watch_handle());
 }
 
 // Called when the browser terminates the websocket connection.
 void WSBridge::OnHttpConnectionClosed(base::HttpServerConnection* websocket) {
   PERFETTO_DLOG("[WSBridge] Websocket connection closed");
-  auto it = conns_.find(websocket);
-  if (it == conns_.end())
-    return;  // Can happen if ADB closed first.
-  base::UnixSocket& sock = *it->second;
-  sock.Shutdown(/*notify=*/true);
-  conns_.erase(websocket);
+  CloseEndpointConn(websocket);  // No-op if the endpoint closed first.
 }
 
-void WSBridge::OnDisconnect(base::UnixSocket* sock) {
-  base::HttpServerConnection* websocket = GetWebsocket(sock);
-  if (!websocket)
+void WSBridge::CloseEndpointConn(base::HttpServerConnection* websocket) {
+  auto it = conns_.find(websocket);
+  if (it == conns_.end())
     return;
-  websocket->Close();
-  sock->Shutdown(/*notify=*/false);
-  conns_.erase(websocket);
-  PERFETTO_DLOG("[WSBridge] Socket connection closed");
+  StopReading(&it->second);
+  it->second.sock.Shutdown();
+  conns_.erase(it);
 }
 
-base::HttpServerConnection* WSBridge::GetWebsocket(base::UnixSocket* sock) {
-  for (const auto& it : conns_) {
-    if (it.second.get() == sock) {
-      return it.first;
-    }
-  }
-  return nullptr;
+WSBridge::EndpointConn* WSBridge::GetEndpointConn(
+    base::HttpServerConnection* websocket,
+    uint64_t id) {
+  auto it = conns_.find(websocket);
+  if (it == conns_.end() || it->second.id != id)
+    return nullptr;
+  return &it->second;
 }
 
-void WSBridge::OnConnect(base::UnixSocket*, bool) {}
-void WSBridge::OnNewIncomingConnection(base::UnixSocket*,
-                                       std::unique_ptr<base::UnixSocket>) {}
-
 }  // namespace
 
 int PERFETTO_EXPORT_ENTRYPOINT WebsocketBridgeMain(int argc, char** argv) {
@@ -0,0 +1,276 @@
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replays ftrace ring buffer pages recorded on real devices through
+// traced_probes' CpuReader and then through trace processor, to catch
+// regressions on actual workloads rather than on synthetic pages.
+//
+// The corpus is the directory pointed to by the PERFETTO_FTRACE_CORPUS env
+// variable, with one subdirectory per workload (e.g. sched_heavy/,
+// binder_heavy/, graphics/, vendor/), each holding:
+//  - the tracefs format files of the device, as pulled by
+//    tools/pull_ftrace_format_files.py (events/<group>/<name>/format,
+//    events/header_page, ...) and optionally printk_formats.
+//  - cpu<N>.raw: pages read from per_cpu/cpu<N>/trace_pipe_raw while the
+//    workload was traced, e.g. after enabling the events and tracing_on:
+//      adb exec-out cat /sys/kernel/tracing/per_cpu/cpu0/trace_pipe_raw >
+//      cpu0.raw
+//    The pages must have the page size of the machine running the benchmark.
+//
+// For each workload, the following benchmarks report the throughput of their
+// input (bytes_per_second) and of ftrace events (items_per_second):
+//  - <workload>/cpu_reader: CpuReader::ProcessPagesForDataSource() of all the
+//    pages, with all the events of the corpus enabled and compact sched on.
+//  - <workload>/tp_tokenize: TraceProcessor::Parse() of the trace written by
+//    CpuReader, i.e. the FtraceTokenizer and the sorting of the events.
+//  - <workload>/tp_parse: TraceProcessor::NotifyEndOfFile() for that trace,
+//    i.e. the FtraceParser of the sorted events.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/flat_set.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/ext/base/utils.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "src/traced/probes/ftrace/compact_sched.h"
+#include "src/traced/probes/ftrace/cpu_reader.h"
+#include "src/traced/probes/ftrace/event_info.h"
+#include "src/traced/probes/ftrace/ftrace_config_muxer.h"
+#include "src/traced/probes/ftrace/ftrace_metadata.h"
+#include "src/traced/probes/ftrace/ftrace_procfs.h"
+#include "src/traced/probes/ftrace/proto_translation_table.h"
+#include "src/tracing/core/null_trace_writer.h"
+#include "src/tracing/core/trace_writer_for_testing.h"
+
+#include "protos/perfetto/config/ftrace/ftrace_config.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event.gen.h"
+#include "protos/perfetto/trace/ftrace/ftrace_event_bundle.gen.h"
+#include "protos/perfetto/trace/trace.gen.h"
+#include "protos/perfetto/trace/trace_packet.gen.h"
+
+namespace perfetto {
+namespace {
+
+struct Workload {
+  std::string name;
+  std::unique_ptr<FtraceProcfs> ftrace;
+  std::unique_ptr<ProtoTranslationTable> table;
+  std::unique_ptr<FtraceDataSourceConfig> ds_config;
+  // The pages of each cpu, back to back.
+  std::vector<std::string> cpu_pages;
+  size_t pages_bytes = 0;
+  // The trace written by CpuReader for the pages, and the number of ftrace
+  // events in it.
+  std::string trace;
+  uint64_t events = 0;
+};
+
+// Parses the pages of all the cpus of |workload| into |writer|.
+void ProcessPages(Workload* workload,
+                  TraceWriter* writer,
+                  FtraceMetadata* metadata,
+                  CompactSchedBuffer* compact_sched_buf) {
+  const size_t page_size = base::GetSysPageSize();
+  base::FlatSet<protos::pbzero::FtraceParseStatus> parse_errors;
+  for (size_t cpu = 0; cpu < workload->cpu_pages.size(); cpu++) {
+    const std::string& pages = workload->cpu_pages[cpu];
+    uint64_t last_read_event_ts = 0;
+    CpuReader::ProcessPagesForDataSource(
+        writer, metadata, cpu, workload->ds_config.get(), &parse_errors,
+        &last_read_event_ts, reinterpret_cast<const uint8_t*>(pages.data()),
+        pages.size() / page_size, compact_sched_buf, workload->table.get(),
+        /*symbolizer=*/nullptr, /*ftrace_clock_snapshot=*/nullptr,
+        protos::pbzero::FTRACE_CLOCK_UNSPECIFIED);
+    metadata->Clear();
+  }
+}
+
+std::unique_ptr<Workload> LoadWorkload(const std::string& dir,
+                                       const std::string& name) {
+  auto workload = std::make_unique<Workload>();
+  workload->name = name;
+  workload->ftrace.reset(new FtraceProcfs(dir + "/"));
+  workload->table = ProtoTranslationTable::Create(workload->ftrace.get(),
+                                                  GetStaticEventInfo(),
+                                                  GetStaticCommonFieldsInfo());
+  if (!workload->table) {
+    PERFETTO_ELOG("Invalid format files in %s", dir.c_str());
+    return nullptr;
+  }
+
+  EventFilter event_filter;
+  for (const Event& event : workload->table->events()) {
+    if (event.ftrace_event_id)
+      event_filter.AddEnabledEvent(event.ftrace_event_id);
+  }
+  FtraceConfig compact_sched_request;
+  compact_sched_request.mutable_compact_sched()->set_enabled(true);
+  workload->ds_config.reset(new FtraceDataSourceConfig(
+      std::move(event_filter), EventFilter{},
+      CreateCompactSchedConfig(compact_sched_request,
+                               /*switch_requested=*/true,
+                               workload->table->compact_sched_format()),
+      std::nullopt, {}, {}, /*symbolize_ksyms=*/false,
+      /*buffer_percent=*/0, {}));
+
+  const size_t page_size = base::GetSysPageSize();
+  for (size_t cpu = 0;; cpu++) {
+    std::string pages;
+    if (!base::ReadFile(dir + "/cpu" + std::to_string(cpu) + ".raw", &pages))
+      break;
+    pages.resize(pages.size() - pages.size() % page_size);
+    workload->pages_bytes += pages.size();
+    workload->cpu_pages.emplace_back(std::move(pages));
+  }
+  if (!workload->pages_bytes) {
+    PERFETTO_ELOG("No cpu<N>.raw pages in %s", dir.c_str());
+    return nullptr;
+  }
+
+  // Write the trace once, for the trace processor benchmarks.
+  TraceWriterForTesting writer;
+  FtraceMetadata metadata{};
+  auto compact_sched_buf = std::make_unique<CompactSchedBuffer>();
+  ProcessPages(workload.get(), &writer, &metadata, compact_sched_buf.get());
+  protos::gen::Trace trace;
+  for (const protos::gen::TracePacket& packet : writer.GetAllTracePackets()) {
+    const auto& bundle = packet.ftrace_events();
+    workload->events += bundle.event().size();
+    workload->events += bundle.compact_sched().switch_timestamp().size();
+    workload->events += bundle.compact_sched().waking_timestamp().size();
+    *trace.add_packet() = packet;
+  }
+  workload->trace = trace.SerializeAsString();
+  return workload;
+}
+
+// The items are the ftrace events.
+void SetCounters(benchmark::State& state, size_t bytes, uint64_t events) {
+  auto iterations = static_cast<uint64_t>(state.iterations());
+  state.SetBytesProcessed(static_cast<int64_t>(iterations * bytes));
+  state.SetItemsProcessed(static_cast<int64_t>(iterations * events));
+}
+
+void BM_CpuReader(benchmark::State& state, Workload* workload) {
+  NullTraceWriter writer;
+  FtraceMetadata metadata{};
+  auto compact_sched_buf = std::make_unique<CompactSchedBuffer>();
+  for (auto _ : state)
+    ProcessPages(workload, &writer, &metadata, compact_sched_buf.get());
+  SetCounters(state, workload->pages_bytes, workload->events);
+}
+
+// Times either the tokenization (Parse()) or the parsing (NotifyEndOfFile())
+// of the trace of |workload|.
+void BM_TraceProcessor(benchmark::State& state,
+                       Workload* workload,
+                       bool time_tokenization) {
+  using trace_processor::TraceBlob;
+  using trace_processor::TraceBlobView;
+  using trace_processor::TraceProcessor;
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto tp = TraceProcessor::CreateInstance(trace_processor::Config());
+    TraceBlob blob = TraceBlob::CopyFrom(workload->trace.data(),
+                                         workload->trace.size());
+    if (time_tokenization)
+      state.ResumeTiming();
+
+    PERFETTO_CHECK(tp->Parse(TraceBlobView(std::move(blob))).ok());
+
+    if (time_tokenization)
+      state.PauseTiming();
+    else
+      state.ResumeTiming();
+
+    tp->NotifyEndOfFile();
+
+    if (!time_tokenization)
+      state.PauseTiming();
+    tp.reset();
+    state.ResumeTiming();
+  }
+  SetCounters(state, workload->trace.size(), workload->events);
+}
+
+void BM_NoCorpus(benchmark::State& state) {
+  for (auto _ : state) {
+  }
+  state.SkipWithError(
+      "Set PERFETTO_FTRACE_CORPUS to a directory of recorded ftrace pages, "
+      "see test/ftrace_corpus_benchmark.cc");
+}
+
+// Registers the benchmarks of each workload of the corpus, which is only
+// known at runtime.
+int RegisterCorpusBenchmarks() {
+  const char* corpus_dir = getenv("PERFETTO_FTRACE_CORPUS");
+  if (!corpus_dir) {
+    benchmark::RegisterBenchmark("BM_FtraceCorpus", BM_NoCorpus);
+    return 0;
+  }
+
+  std::vector<std::string> files;
+  base::Status status = base::ListFilesRecursive(corpus_dir, files);
+  if (!status.ok())
+    PERFETTO_FATAL("%s", status.c_message());
+  std::set<std::string> workload_names;
+  for (const std::string& file : files) {
+    // Workloads are the first level directories with a cpu0.raw file.
+    if (base::EndsWith(file, "/cpu0.raw") &&
+        file.find('/') == file.size() - strlen("/cpu0.raw")) {
+      workload_names.insert(file.substr(0, file.find('/')));
+    }
+  }
+
+  // The workloads live until the end of the process, like the benchmarks.
+  for (const std::string& name : workload_names) {
+    Workload* workload =
+        LoadWorkload(std::string(corpus_dir) + "/" + name, name).release();
+    if (!workload)
+      continue;
+    std::string prefix = "BM_FtraceCorpus/" + name;
+    benchmark::RegisterBenchmark((prefix + "/cpu_reader").c_str(),
+                                 BM_CpuReader, workload)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((prefix + "/tp_tokenize").c_str(),
+                                 BM_TraceProcessor, workload,
+                                 /*time_tokenization=*/true)
+        ->Unit(benchmark::kMillisecond);
+    benchmark::RegisterBenchmark((prefix + "/tp_parse").c_str(),
+                                 BM_TraceProcessor, workload,
+                                 /*time_tokenization=*/false)
+        ->Unit(benchmark::kMillisecond);
+  }
+  return 0;
+}
+
+PERFETTO_UNUSED const int g_registered = RegisterCorpusBenchmarks();
+
+}  // namespace
+}  // namespace perfetto
@@ -81,3 +81,23 @@ class SurfaceFlingerLayers(TestSuite):
         2,1,"surfaceflinger_layer"
         3,1,"surfaceflinger_layer"
         """))
+
+  def test_layer_args(self):
+    return DiffTestBlueprint(
+        trace=Path('surfaceflinger_layers.textproto'),
+        query="""
+        SELECT
+          key, display_value
+        FROM
+          winscope_proto_to_args('surfaceflinger_layer', 0)
+        WHERE key IN ('id', 'type', 'children[1]', 'color.r', 'z')
+        ORDER BY key;
+        """,
+        out=Csv("""
+        "key","display_value"
+        "children[1]","35"
+        "color.r","-1.0"
+        "id","3"
+        "type","Layer"
+        "z","0"
+        """))
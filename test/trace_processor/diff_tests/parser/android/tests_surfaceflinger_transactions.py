@@ -41,11 +41,10 @@ class SurfaceFlingerTransactions(TestSuite):
         trace=Path('surfaceflinger_transactions.textproto'),
         query="""
         SELECT
-          args.key, args.display_value
+          key, display_value
         FROM
-          surfaceflinger_transactions AS sft JOIN args ON sft.arg_set_id = args.arg_set_id
-        WHERE sft.id = 0
-        ORDER BY args.key;
+          winscope_proto_to_args('surfaceflinger_transactions', 0)
+        ORDER BY key;
         """,
         out=Csv("""
         "key","display_value"
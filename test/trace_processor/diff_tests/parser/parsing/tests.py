@@ -93,6 +93,30 @@ class Parsing(TestSuite):
         query=Path('b120487929_test.sql'),
         out=Path('cpu_counters_b120487929.out'))
 
+  def test_window_operator_constraints(self):
+    return DiffTestBlueprint(
+        trace=TextProto(''),
+        query="""
+        CREATE VIRTUAL TABLE w USING window;
+
+        UPDATE w
+        SET window_start = 100, window_dur = 1000000000, quantum = 100
+        WHERE rowid = 0;
+
+        SELECT rowid, ts, dur, quantum_ts
+        FROM w
+        WHERE (ts > 250 AND ts <= 500) OR ts = 999999900 OR rowid = 7
+        ORDER BY ts;
+        """,
+        out=Csv("""
+        "rowid","ts","dur","quantum_ts"
+        2,300,100,2
+        3,400,100,3
+        4,500,100,4
+        7,800,100,7
+        9999998,999999900,100,9999998
+        """))
+
   # Test the filtering of ftrace events before tracing_start.
   def test_ftrace_with_tracing_start_list_sched_slice_spans(self):
     return DiffTestBlueprint(
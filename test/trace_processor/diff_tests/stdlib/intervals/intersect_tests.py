@@ -372,3 +372,142 @@ class IntervalsIntersect(TestSuite):
         "ii_count","thread_count","ii_sum","thread_sum"
         313,313,27540674879,27540674879
         """))
+
+  def test_interval_intersect_3(self):
+    return DiffTestBlueprint(
+        trace=TextProto(""),
+        #      0 1 2 3 4 5 6 7
+        # A:   _ - - - - - - _
+        # B:   - - _ - - _ - -
+        # C:   - - - - _ - - -
+        # res: _ - _ - _ _ - _
+        query="""
+        INCLUDE PERFETTO MODULE intervals.intersect;
+
+        CREATE PERFETTO TABLE A AS
+          WITH data(id, ts, dur) AS (
+            VALUES
+            (0, 1, 6)
+          )
+          SELECT * FROM data;
+
+        CREATE PERFETTO TABLE B AS
+          WITH data(id, ts, dur) AS (
+            VALUES
+            (0, 0, 2),
+            (1, 3, 2),
+            (2, 6, 2)
+          )
+          SELECT * FROM data;
+
+        CREATE PERFETTO TABLE C AS
+          WITH data(id, ts, dur) AS (
+            VALUES
+            (1, 5, 3),
+            (0, 0, 4)
+          )
+          SELECT * FROM data;
+
+        SELECT ts, dur, id_0, id_1, id_2
+        FROM _interval_intersect_3!(A, B, C)
+        ORDER BY ts;
+        """,
+        out=Csv("""
+        "ts","dur","id_0","id_1","id_2"
+        1,1,0,0,0
+        3,1,0,1,0
+        6,1,0,2,1
+        """))
+
+  def test_interval_intersect_partitioned(self):
+    return DiffTestBlueprint(
+        trace=TextProto(""),
+        query="""
+        INCLUDE PERFETTO MODULE intervals.intersect;
+
+        CREATE PERFETTO TABLE A AS
+          WITH data(id, ts, dur, cpu) AS (
+            VALUES
+            (0, 0, 10, 0),
+            (1, 0, 10, 1),
+            (2, 5, 10, 2)
+          )
+          SELECT * FROM data;
+
+        CREATE PERFETTO TABLE B AS
+          WITH data(id, ts, dur, cpu) AS (
+            VALUES
+            (0, 2, 2, 0),
+            (1, 5, 2, 0),
+            (2, 8, 4, 1),
+            (3, 0, 20, 3)
+          )
+          SELECT * FROM data;
+
+        SELECT ts, dur, cpu, left_id, right_id
+        FROM _interval_intersect_partitioned!(A, B, cpu);
+        """,
+        out=Csv("""
+        "ts","dur","cpu","left_id","right_id"
+        2,2,0,0,0
+        5,2,0,0,1
+        8,2,1,1,2
+        """))
+
+  def test_interval_intersect_partitioned_empty(self):
+    return DiffTestBlueprint(
+        trace=TextProto(""),
+        query="""
+        INCLUDE PERFETTO MODULE intervals.intersect;
+
+        CREATE PERFETTO TABLE A AS
+          WITH data(id, ts, dur, cpu) AS (
+            VALUES
+            (0, 0, 10, 0)
+          )
+          SELECT * FROM data;
+
+        CREATE PERFETTO TABLE B AS
+        SELECT * FROM A LIMIT 0;
+
+        SELECT ts, dur, cpu, left_id, right_id
+        FROM _interval_intersect_partitioned!(A, B, cpu);
+        """,
+        out=Csv("""
+        "ts","dur","cpu","left_id","right_id"
+        """))
+
+  def test_sanity_check_partitioned(self):
+    return DiffTestBlueprint(
+        trace=DataPath('example_android_trace_30s.pb'),
+        query="""
+        INCLUDE PERFETTO MODULE intervals.intersect;
+
+        CREATE PERFETTO TABLE trace_interval AS
+        SELECT
+          0 AS id,
+          TRACE_START() AS ts,
+          TRACE_DUR() AS dur,
+          cpu
+        FROM (SELECT DISTINCT cpu FROM sched);
+
+        CREATE PERFETTO TABLE non_overlapping AS
+        SELECT id, ts, dur, cpu
+        FROM sched
+        WHERE dur != -1;
+
+        WITH ii AS (
+          SELECT *
+          FROM _interval_intersect_partitioned!(
+            trace_interval, non_overlapping, cpu)
+        )
+        SELECT
+          (SELECT count(*) FROM ii) = (SELECT count(*) FROM non_overlapping)
+            AS same_count,
+          (SELECT sum(dur) FROM ii) = (SELECT sum(dur) FROM non_overlapping)
+            AS same_dur;
+        """,
+        out=Csv("""
+        "same_count","same_dur"
+        1,1
+        """))
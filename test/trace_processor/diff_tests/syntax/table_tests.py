@@ -297,3 +297,59 @@ class PerfettoTable(TestSuite):
         "id","numeric","string","nullable"
         0,3111,460,0
         """))
+
+  def test_create_index(self):
+    return DiffTestBlueprint(
+        trace=TextProto(r''),
+        query="""
+        CREATE PERFETTO TABLE foo AS
+        WITH RECURSIVE nums(x) AS (
+          SELECT 0
+          UNION ALL
+          SELECT x + 1 FROM nums WHERE x < 99
+        )
+        SELECT x % 5 AS utid, (x * 37) % 100 AS ts FROM nums;
+
+        CREATE PERFETTO INDEX foo_utid_ts ON foo(utid, ts);
+
+        SELECT utid, ts
+        FROM foo
+        WHERE utid = 3 AND ts BETWEEN 10 AND 40
+        ORDER BY ts;
+        """,
+        out=Csv("""
+        "utid","ts"
+        3,11
+        3,16
+        3,21
+        3,26
+        3,31
+        3,36
+        """))
+
+  def test_drop_index(self):
+    return DiffTestBlueprint(
+        trace=TextProto(r''),
+        query="""
+        CREATE PERFETTO TABLE foo AS
+        WITH RECURSIVE nums(x) AS (
+          SELECT 0
+          UNION ALL
+          SELECT x + 1 FROM nums WHERE x < 99
+        )
+        SELECT x % 5 AS utid, (x * 37) % 100 AS ts FROM nums;
+
+        CREATE PERFETTO INDEX foo_utid_ts ON foo(utid, ts);
+        DROP PERFETTO INDEX foo_utid_ts ON foo;
+        CREATE PERFETTO INDEX foo_utid_ts ON foo(utid);
+
+        SELECT utid, COUNT() AS cnt
+        FROM foo
+        WHERE utid >= 3 AND ts < 50
+        GROUP BY utid;
+        """,
+        out=Csv("""
+        "utid","cnt"
+        3,10
+        4,10
+        """))
@@ -0,0 +1,342 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// End-to-end benchmarks of trace processor on a fixed corpus of
+// representative traces of test/data (download them with
+// tools/test_data download): loading each trace and then running a battery of
+// stdlib queries and metrics on it.
+//
+// For each trace of the corpus (see GetCorpus()), the following benchmarks are
+// registered:
+//  - BM_TpCorpus/<trace>/load: TraceProcessor::Parse() and NotifyEndOfFile()
+//    of the whole trace. Reports the throughput of the trace bytes
+//    (bytes_per_second) and, on Linux and Android, how much the peak RSS of
+//    the process grew over its RSS before the load (peak_rss_mb).
+//  - BM_TpCorpus/<trace>/query:<name>: the query, including the INCLUDE
+//    PERFETTO MODULE of the stdlib modules it depends on, with all the rows
+//    iterated. The trace processor is restored to its initial tables between
+//    iterations so that the modules are evaluated every time, as they would
+//    be for the first query of a user.
+//  - BM_TpCorpus/<trace>/metric:<name>: TraceProcessor::ComputeMetric(),
+//    restored in the same way.
+//
+// The names of the benchmarks are stable so that the results can be tracked
+// across releases, e.g.:
+//   out/linux/perfetto_benchmarks --benchmark_filter=BM_TpCorpus
+//       --benchmark_format=json --benchmark_out=tp_corpus.json
+// Traces missing from test/data are reported as errors of their load
+// benchmark (and have no query benchmarks).
+
+#include <fcntl.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "perfetto/base/build_config.h"
+#include "perfetto/base/compiler.h"
+#include "perfetto/base/logging.h"
+#include "perfetto/ext/base/file_utils.h"
+#include "perfetto/ext/base/string_utils.h"
+#include "perfetto/trace_processor/basic_types.h"
+#include "perfetto/trace_processor/trace_blob.h"
+#include "perfetto/trace_processor/trace_blob_view.h"
+#include "perfetto/trace_processor/trace_processor.h"
+#include "src/base/test/utils.h"
+
+namespace perfetto {
+namespace {
+
+using trace_processor::Config;
+using trace_processor::TraceBlob;
+using trace_processor::TraceBlobView;
+using trace_processor::TraceProcessor;
+
+struct CorpusQuery {
+  const char* name;
+  const char* sql;
+};
+
+struct CorpusTrace {
+  // Name of the trace in the benchmark names.
+  const char* name;
+  // Path of the trace, relative to the root of the repository.
+  const char* path;
+  std::vector<CorpusQuery> queries;
+  std::vector<const char*> metrics;
+};
+
+// The queries common to all the traces.
+const CorpusQuery kCommonQueries[] = {
+    {"slice_count_by_name",
+     "SELECT name, COUNT(*) AS cnt FROM slice GROUP BY name ORDER BY cnt DESC"},
+    {"thread_slice",
+     "INCLUDE PERFETTO MODULE slices.with_context; "
+     "SELECT utid, COUNT(*), SUM(dur) FROM thread_slice GROUP BY utid"},
+};
+
+const std::vector<CorpusTrace>& GetCorpus() {
+  static const std::vector<CorpusTrace>* corpus = new std::vector<CorpusTrace>{
+      {
+          "android_system",
+          "test/data/example_android_trace_30s.pb",
+          {
+              {"thread_state_by_state",
+               "SELECT state, COUNT(*), SUM(dur) FROM thread_state "
+               "GROUP BY state"},
+              {"sched_runnable_thread_count",
+               "INCLUDE PERFETTO MODULE sched.thread_level_parallelism; "
+               "SELECT * FROM sched_runnable_thread_count"},
+              {"sched_utilization_per_second",
+               "INCLUDE PERFETTO MODULE sched.utilization.system; "
+               "SELECT * FROM sched_utilization_per_second"},
+              {"thread_slice_cpu_time",
+               "INCLUDE PERFETTO MODULE slices.cpu_time; "
+               "SELECT * FROM thread_slice_cpu_time"},
+          },
+          {"android_cpu", "android_mem"},
+      },
+      {
+          "android_startup",
+          "test/data/api34_startup_cold.perfetto-trace",
+          {
+              {"android_startups",
+               "INCLUDE PERFETTO MODULE android.startup.startups; "
+               "SELECT * FROM android_startups"},
+              {"android_binder_txns",
+               "INCLUDE PERFETTO MODULE android.binder; "
+               "SELECT * FROM android_binder_txns"},
+          },
+          {"android_startup"},
+      },
+      {
+          "chrome",
+          "test/data/chrome_scroll_without_vsync.pftrace",
+          {
+              {"chrome_scrolls",
+               "INCLUDE PERFETTO MODULE chrome.chrome_scrolls; "
+               "SELECT * FROM chrome_scrolls"},
+              {"chrome_tasks",
+               "INCLUDE PERFETTO MODULE chrome.tasks; "
+               "SELECT * FROM chrome_tasks"},
+          },
+          {},
+      },
+      {
+          "heap_graph",
+          "test/data/system-server-heap-graph-new.pftrace",
+          {
+              {"heap_graph_dominator_tree",
+               "INCLUDE PERFETTO MODULE memory.heap_graph_dominator_tree; "
+               "SELECT * FROM memory_heap_graph_dominator_tree"},
+          },
+          {},
+      },
+      {
+          "ftrace_heavy",
+          "test/data/android_sched_and_ps.pb",
+          {
+              {"ftrace_event_count_by_name",
+               "SELECT name, COUNT(*) FROM ftrace_event GROUP BY name"},
+              {"sched_active_cpu_count",
+               "INCLUDE PERFETTO MODULE sched.thread_level_parallelism; "
+               "SELECT * FROM sched_active_cpu_count"},
+          },
+          {},
+      },
+      {
+          "json",
+          "test/data/sfgate.json",
+          {},
+          {},
+      },
+  };
+  return *corpus;
+}
+
+// A trace of the corpus, loaded in memory. The trace processor used by the
+// query and metric benchmarks is loaded on first use.
+struct LoadedTrace {
+  std::string contents;
+  std::unique_ptr<TraceProcessor> tp;
+};
+
+// Resets the peak RSS of the process to its current RSS, so that
+// GetRssBytes("VmHWM") returns the peak from now on. Returns false if not
+// supported.
+bool ResetPeakRss() {
+#if PERFETTO_BUILDFLAG(PERFETTO_OS_LINUX) || \
+    PERFETTO_BUILDFLAG(PERFETTO_OS_ANDROID)
+  // Writing 5 to clear_refs resets VmHWM (Linux 4.0+).
+  return base::WriteAll(*base::OpenFile("/proc/self/clear_refs", O_WRONLY),
+                        "5", 1) == 1;
+#else
+  return false;
+#endif
+}
+
+// Returns |field| (VmRSS or VmHWM) of /proc/self/status.
+std::optional<uint64_t> GetRssBytes(const std::string& field) {
+  std::string status;
+  if (!base::ReadFile("/proc/self/status", &status))
+    return std::nullopt;
+  for (const std::string& line : base::SplitString(status, "\n")) {
+    if (!base::StartsWith(line, field + ":"))
+      continue;
+    std::optional<uint64_t> kb = base::StringToUInt64(base::TrimWhitespace(
+        base::StripSuffix(line.substr(field.size() + 1), "kB")));
+    if (kb)
+      return *kb * 1024;
+  }
+  return std::nullopt;
+}
+
+std::unique_ptr<TraceProcessor> LoadTrace(const std::string& trace) {
+  auto tp = TraceProcessor::CreateInstance(Config());
+  TraceBlob blob = TraceBlob::CopyFrom(trace.data(), trace.size());
+  PERFETTO_CHECK(tp->Parse(TraceBlobView(std::move(blob))).ok());
+  tp->NotifyEndOfFile();
+  return tp;
+}
+
+TraceProcessor* GetTraceProcessor(LoadedTrace* trace) {
+  if (!trace->tp)
+    trace->tp = LoadTrace(trace->contents);
+  return trace->tp.get();
+}
+
+void BM_Load(benchmark::State& state, LoadedTrace* trace) {
+  uint64_t peak_rss_growth = 0;
+  bool has_peak_rss = true;
+  for (auto _ : state) {
+    state.PauseTiming();
+    has_peak_rss = has_peak_rss && ResetPeakRss();
+    uint64_t rss_before = GetRssBytes("VmRSS").value_or(0);
+    state.ResumeTiming();
+
+    std::unique_ptr<TraceProcessor> tp = LoadTrace(trace->contents);
+
+    state.PauseTiming();
+    if (has_peak_rss) {
+      uint64_t peak_rss = GetRssBytes("VmHWM").value_or(0);
+      if (peak_rss > rss_before)
+        peak_rss_growth = std::max(peak_rss_growth, peak_rss - rss_before);
+    }
+    tp.reset();
+    state.ResumeTiming();
+  }
+  state.SetBytesProcessed(static_cast<int64_t>(state.iterations()) *
+                          static_cast<int64_t>(trace->contents.size()));
+  if (has_peak_rss) {
+    state.counters["peak_rss_mb"] =
+        static_cast<double>(peak_rss_growth) / (1024.0 * 1024.0);
+  }
+}
+
+void BM_Query(benchmark::State& state,
+              LoadedTrace* trace,
+              const CorpusQuery* query) {
+  TraceProcessor* tp = GetTraceProcessor(trace);
+  uint64_t rows = 0;
+  for (auto _ : state) {
+    auto it = tp->ExecuteQuery(query->sql);
+    while (it.Next())
+      rows++;
+    if (!it.Status().ok()) {
+      state.SkipWithError(it.Status().c_message());
+      break;
+    }
+
+    state.PauseTiming();
+    tp->RestoreInitialTables();
+    state.ResumeTiming();
+  }
+  state.counters["rows"] = benchmark::Counter(
+      static_cast<double>(rows), benchmark::Counter::kAvgIterations);
+}
+
+void BM_Metric(benchmark::State& state,
+               LoadedTrace* trace,
+               const char* metric) {
+  TraceProcessor* tp = GetTraceProcessor(trace);
+  std::vector<uint8_t> proto;
+  for (auto _ : state) {
+    proto.clear();
+    base::Status status = tp->ComputeMetric({metric}, &proto);
+    if (!status.ok()) {
+      state.SkipWithError(status.c_message());
+      break;
+    }
+
+    state.PauseTiming();
+    tp->RestoreInitialTables();
+    state.ResumeTiming();
+  }
+}
+
+void BM_MissingTrace(benchmark::State& state, const char* path) {
+  for (auto _ : state) {
+  }
+  state.SkipWithError(
+      (std::string(path) + " missing, run tools/test_data download").c_str());
+}
+
+// Registers the benchmarks of each trace of the corpus.
+int RegisterCorpusBenchmarks() {
+  for (const CorpusTrace& corpus_trace : GetCorpus()) {
+    std::string prefix = std::string("BM_TpCorpus/") + corpus_trace.name;
+    // The traces live until the end of the process, like the benchmarks.
+    auto* trace = new LoadedTrace();
+    if (!base::ReadFile(base::GetTestDataPath(corpus_trace.path),
+                        &trace->contents)) {
+      delete trace;
+      benchmark::RegisterBenchmark((prefix + "/load").c_str(), BM_MissingTrace,
+                                   corpus_trace.path);
+      continue;
+    }
+    benchmark::RegisterBenchmark((prefix + "/load").c_str(), BM_Load, trace)
+        ->Unit(benchmark::kMillisecond);
+
+    std::vector<const CorpusQuery*> queries;
+    for (const CorpusQuery& query : kCommonQueries)
+      queries.push_back(&query);
+    for (const CorpusQuery& query : corpus_trace.queries)
+      queries.push_back(&query);
+    for (const CorpusQuery* query : queries) {
+      benchmark::RegisterBenchmark(
+          (prefix + "/query:" + query->name).c_str(), BM_Query, trace, query)
+          ->Unit(benchmark::kMillisecond);
+    }
+    for (const char* metric : corpus_trace.metrics) {
+      benchmark::RegisterBenchmark((prefix + "/metric:" + metric).c_str(),
+                                   BM_Metric, trace, metric)
+          ->Unit(benchmark::kMillisecond);
+    }
+  }
+  return 0;
+}
+
+PERFETTO_UNUSED const int g_registered = RegisterCorpusBenchmarks();
+
+}  // namespace
+}  // namespace perfetto
@@ -87,6 +87,9 @@ const cfg = {
   httpServerListenHost: '127.0.0.1',
   httpServerListenPort: 10000,
   wasmModules: ['trace_processor', 'traceconv'],
+  // Wasm modules built with threads. Unlike the ones above, these are not
+  // bundled: the workers running their threads load their .js on their own.
+  wasmThreadsModules: ['trace_processor_threads'],
   crossOriginIsolation: false,
   testFilter: '',
   noOverrideGnArgs: false,
@@ -481,6 +484,7 @@ function buildWasm(skipWasmBuild) {
 
     const ninjaArgs = ['-C', cfg.outDir];
     ninjaArgs.push(...cfg.wasmModules.map((x) => `${x}_wasm`));
+    ninjaArgs.push(...cfg.wasmThreadsModules.map((x) => `${x}_wasm`));
     addTask(exec, [pjoin(ROOT_DIR, 'tools/ninja'), ninjaArgs]);
   }
 
@@ -497,6 +501,15 @@ function buildWasm(skipWasmBuild) {
       addTask(cp, [pjoin(wasmOutDir, fname), pjoin(cfg.outGenDir, fname)]);
     }
   }
+
+  const wasmThreadsOutDir = pjoin(cfg.outDir, 'wasm_threads');
+  for (const wasmMod of cfg.wasmThreadsModules) {
+    const exts = ['.js', '.worker.js', '.wasm'];
+    for (const ext of exts.concat(cfg.debug ? ['.wasm.map'] : [])) {
+      const src = `${wasmThreadsOutDir}/${wasmMod}${ext}`;
+      addTask(cp, [src, pjoin(cfg.outDistDir, wasmMod + ext)]);
+    }
+  }
 }
 
 // This transpiles all the sources (frontend, controller, engine, extension) in
@@ -23,6 +23,20 @@ import initTraceProcessor from '../gen/trace_processor';
 // HEAPU8[reqBufferAddr, +REQ_BUFFER_SIZE].
 const REQ_BUF_SIZE = 32 * 1024 * 1024;
 
+// The trace processor built with threads. Its .js is loaded with
+// importScripts() rather than bundled as the Web Workers running its threads
+// need to load it too. It defines a global with the same interface as
+// initTraceProcessor.
+const THREADS_SCRIPT = 'trace_processor_threads.js';
+declare const trace_processor_threads_wasm: typeof initTraceProcessor;
+// This runs in a Worker but is type-checked against the DOM lib.
+declare function importScripts(...urls: string[]): void;
+
+// Must match INITIAL_MEMORY and MAXIMUM_MEMORY in gn/standalone/wasm.gni.
+const WASM_PAGE_SIZE = 64 * 1024;
+const INITIAL_MEMORY_PAGES = (32 * 1024 * 1024) / WASM_PAGE_SIZE;
+const MAXIMUM_MEMORY_PAGES = (4 * 1024 * 1024 * 1024) / WASM_PAGE_SIZE;
+
 // The end-to-end interaction between JS and Wasm is as follows:
 // - [JS] Inbound data received by the worker (onmessage() in engine/index.ts).
 //   - [JS] onRpcDataReceived() (this file)
@@ -38,6 +52,8 @@ export class WasmBridge {
 
   private aborted: boolean;
   private connection: initTraceProcessor.Module;
+  // Only set when using the module with threads.
+  private sharedMemory?: WebAssembly.Memory;
   private reqBufferAddr = 0;
   private lastStderr: string[] = [];
   private messagePort?: MessagePort;
@@ -45,12 +61,29 @@ export class WasmBridge {
   constructor() {
     this.aborted = false;
     const deferredRuntimeInitialized = defer<void>();
-    this.connection = initTraceProcessor({
+    const args: initTraceProcessor.ModuleArgs = {
       locateFile: (s: string) => s,
       print: (line: string) => console.log(line),
       printErr: (line: string) => this.appendAndLogErr(line),
       onRuntimeInitialized: () => deferredRuntimeInitialized.resolve(),
-    });
+    };
+    let init = initTraceProcessor;
+    // Threads need a SharedArrayBuffer, which is only available when the page
+    // is cross-origin isolated. Otherwise stick to the single-threaded module.
+    if (self.crossOriginIsolated) {
+      importScripts(THREADS_SCRIPT);
+      init = trace_processor_threads_wasm;
+      // The memory is created here, rather than by the module, to be able to
+      // see it grow when any of the threads of the module grows it.
+      this.sharedMemory = new WebAssembly.Memory({
+        initial: INITIAL_MEMORY_PAGES,
+        maximum: MAXIMUM_MEMORY_PAGES,
+        shared: true,
+      });
+      args.wasmMemory = this.sharedMemory;
+      args.mainScriptUrlOrBlob = THREADS_SCRIPT;
+    }
+    this.connection = init(args);
     this.whenInitialized = deferredRuntimeInitialized.then(() => {
       const fn = this.connection.addFunction(this.onReply.bind(this), 'vii');
       this.reqBufferAddr = this.connection.ccall(
@@ -84,7 +117,7 @@ export class WasmBridge {
     while (wrSize < data.length) {
       const sliceLen = Math.min(data.length - wrSize, REQ_BUF_SIZE);
       const dataSlice = data.subarray(wrSize, wrSize + sliceLen);
-      this.connection.HEAPU8.set(dataSlice, this.reqBufferAddr);
+      this.heap().set(dataSlice, this.reqBufferAddr);
       wrSize += sliceLen;
       try {
         this.connection.ccall(
@@ -108,10 +141,19 @@ export class WasmBridge {
   // This function is bound and passed to Initialize and is called by the C++
   // code while in the ccall(trace_processor_on_rpc_request).
   private onReply(heapPtr: number, size: number) {
-    const data = this.connection.HEAPU8.slice(heapPtr, heapPtr + size);
+    const data = this.heap().slice(heapPtr, heapPtr + size);
     assertExists(this.messagePort).postMessage(data, [data.buffer]);
   }
 
+  // Returns a view of the whole Wasm memory. With threads, HEAPU8 is only
+  // updated when the memory is grown by this thread so it can be too short.
+  private heap(): Uint8Array {
+    if (this.sharedMemory !== undefined) {
+      return new Uint8Array(this.sharedMemory.buffer);
+    }
+    return this.connection.HEAPU8;
+  }
+
   private appendAndLogErr(line: string) {
     console.warn(line);
     // Keep the last N lines in the |lastStderr| buffer.